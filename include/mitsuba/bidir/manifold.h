@@ -113,6 +113,10 @@ private:
         /* Scratch space for matrix assembly */
         Matrix2x2 a, b, c, u;
 
+        /* World-space rows of 'c', i.e. c(r, k) = dot(cw[r], dp_k(next)).
+           Allows refreshing 'c' when only the next vertex's frame changes */
+        Vector cw[2];
+
         /* Manifold tangent space projected onto this vertex */
         Matrix2x2 Tp;
 
@@ -128,6 +132,13 @@ private:
             return T.x * dpdu + T.y * dpdv;
         }
 
+        /// Assemble 'c' from its world-space rows and the frame of the next vertex
+        inline void assembleC(const SimpleVertex &next) {
+            c = Matrix2x2(
+                dot(cw[0], next.dpdu), dot(cw[0], next.dpdv),
+                dot(cw[1], next.dpdu), dot(cw[1], next.dpdv));
+        }
+
         std::string toString() const;
     };
 
@@ -137,9 +148,19 @@ private:
     /**
      * \brief Compute the tangent vectors with the specified
      * components when projected onto the movable endpoint vertex
+     *
+     * When the vertex positions have not changed since the last call
+     * (e.g. after a rejected step, or when \ref init() was served from
+     * its cache), the previous block tridiagonal factorization is reused
+     * and only the terms involving the endpoint frame are updated.
      */
     bool computeTangents();
 
+    /// Forget the cached factorization (e.g. after modifying the vertices)
+    inline void invalidate() {
+        m_factorized = m_pristine = false;
+    }
+
     void check(SimpleVertex *v);
 protected:
     const Scene *m_scene;
@@ -147,6 +168,17 @@ protected:
     int m_iterations, m_maxIterations;
 
     std::vector<SimpleVertex> m_vertices, m_proposal;
+
+    /* Factorization state of the current vertices */
+    Matrix2x2 m_Li;
+    bool m_factorized, m_pristine;
+
+    /* Vertices (and their factorization) from the last call to init(),
+       which are reused when init() is called on the same configuration */
+    std::vector<SimpleVertex> m_cache;
+    std::vector<std::pair<Point, uint32_t> > m_cacheKey, m_key;
+    Matrix2x2 m_cacheLi;
+    bool m_cacheFactorized;
 };
 
 MTS_NAMESPACE_END
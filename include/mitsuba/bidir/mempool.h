@@ -63,6 +63,17 @@ public:
         m_vertexPool.release(vertex);
     }
 
+    /**
+     * \brief Release all edges and vertices at once
+     *
+     * This is much cheaper than releasing the paths one entry at a
+     * time, but invalidates all paths that were allocated from the pool.
+     */
+    inline void reset() {
+        m_vertexPool.reset();
+        m_edgePool.reset();
+    }
+
     /// Check if every entry has been released
     bool unused() const {
         return m_vertexPool.unused() && m_edgePool.unused();
@@ -58,6 +58,15 @@ public:
     /// Manually set the current sample index
     virtual void setSampleIndex(size_t sampleIndex);
 
+    /**
+     * \brief Reseed the underlying random number stream and
+     * rewind to its beginning
+     *
+     * This makes it possible to work with several independent
+     * replayable streams, e.g. when seeding in parallel.
+     */
+    void setSeed(uint64_t seed);
+
     /// Retrieve the next component value from the current sample
     virtual Float next1D();
 
@@ -86,9 +86,14 @@ public:
      * \remark This function performs type casts when <tt>Value != AltValue</tt>
      */
     template <typename AltValue> void init(const AltValue *data) {
-        for (int y=0; y<m_size.y; ++y)
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for
+        #endif
+        for (int y=0; y<m_size.y; ++y) {
+            const AltValue *row = data + (size_t) y * m_size.x;
             for (int x=0; x<m_size.x; ++x)
-                    (*this)(x, y) = Value(*data++);
+                (*this)(x, y) = Value(row[x]);
+        }
     }
 
     /**
@@ -109,15 +114,41 @@ public:
             max(-std::numeric_limits<Scalar>::infinity()),
             avg((Scalar) 0);
 
-        for (int y=0; y<m_size.y; ++y) {
-            for (int x=0; x<m_size.x; ++x) {
-                const AltValue &value = *data++;
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel
+        #endif
+        {
+            /* Per-thread partial statistics */
+            AltValue
+                tmin(+std::numeric_limits<Scalar>::infinity()),
+                tmax(-std::numeric_limits<Scalar>::infinity()),
+                tavg((Scalar) 0);
+
+            #if defined(MTS_OPENMP)
+                #pragma omp for nowait
+            #endif
+            for (int y=0; y<m_size.y; ++y) {
+                const AltValue *row = data + (size_t) y * m_size.x;
+                for (int x=0; x<m_size.x; ++x) {
+                    const AltValue &value = row[x];
+                    for (int i=0; i<AltValue::dim; ++i) {
+                        tmin[i]  = std::min(tmin[i], value[i]);
+                        tmax[i]  = std::max(tmax[i], value[i]);
+                        tavg[i] += value[i];
+                    }
+                    (*this)(x, y) = Value(value);
+                }
+            }
+
+            #if defined(MTS_OPENMP)
+                #pragma omp critical
+            #endif
+            {
                 for (int i=0; i<AltValue::dim; ++i) {
-                    min[i]  = std::min(min[i], value[i]);
-                    max[i]  = std::max(max[i], value[i]);
-                    avg[i] += value[i];
+                    min[i]  = std::min(min[i], tmin[i]);
+                    max[i]  = std::max(max[i], tmax[i]);
+                    avg[i] += tavg[i];
                 }
-                (*this)(x, y) = Value(value);
             }
         }
         min_ = min;
@@ -290,10 +321,15 @@ public:
      * \remark This function performs type casts when <tt>Value != AltValue</tt>
      */
     template <typename AltValue> void init(const AltValue *data) {
-        Value *ptr = m_data;
-        for (int y=0; y<m_size.y; ++y)
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for
+        #endif
+        for (int y=0; y<m_size.y; ++y) {
+            const AltValue *row = data + (size_t) y * m_size.x;
+            Value *ptr = m_data + (size_t) y * m_size.x;
             for (int x=0; x<m_size.x; ++x)
-                    *ptr++ = Value(*data++);
+                ptr[x] = Value(row[x]);
+        }
     }
 
     /**
@@ -314,17 +350,41 @@ public:
             max(-std::numeric_limits<Scalar>::infinity()),
             avg((Scalar) 0);
 
-        Value *ptr = m_data;
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel
+        #endif
+        {
+            /* Per-thread partial statistics */
+            AltValue
+                tmin(+std::numeric_limits<Scalar>::infinity()),
+                tmax(-std::numeric_limits<Scalar>::infinity()),
+                tavg((Scalar) 0);
+
+            #if defined(MTS_OPENMP)
+                #pragma omp for nowait
+            #endif
+            for (int y=0; y<m_size.y; ++y) {
+                const AltValue *row = data + (size_t) y * m_size.x;
+                for (int x=0; x<m_size.x; ++x) {
+                    const AltValue &value = row[x];
+                    for (int i=0; i<AltValue::dim; ++i) {
+                        tmin[i]  = std::min(tmin[i], value[i]);
+                        tmax[i]  = std::max(tmax[i], value[i]);
+                        tavg[i] += value[i];
+                    }
+                    m_data[(size_t) y * m_size.x + x] = Value(value);
+                }
+            }
 
-        for (int y=0; y<m_size.y; ++y) {
-            for (int x=0; x<m_size.x; ++x) {
-                const AltValue &value = *data++;
+            #if defined(MTS_OPENMP)
+                #pragma omp critical
+            #endif
+            {
                 for (int i=0; i<AltValue::dim; ++i) {
-                    min[i]  = std::min(min[i], value[i]);
-                    max[i]  = std::max(max[i], value[i]);
-                    avg[i] += value[i];
+                    min[i]  = std::min(min[i], tmin[i]);
+                    max[i]  = std::max(max[i], tmax[i]);
+                    avg[i] += tavg[i];
                 }
-                *ptr++ = Value(value);
             }
         }
         min_ = min;
@@ -532,6 +532,8 @@ public:
      *    strongly libpng will try to compress the output (with 1 being
      *    the lowest and 9 denoting the highest compression). Note that
      *    saving files with the highest compression will be very slow.
+     *    Level 1 additionally skips libpng's adaptive row filter
+     *    selection, which makes it the fastest choice for previews.
      *    For JPEG files, this denotes the desired quality (between 0 and 100,
      *    the latter being best). The default argument (-1) uses compression
      *    5 for PNG and 100 for JPEG files.
@@ -552,6 +554,8 @@ public:
      *    strongly libpng will try to compress the output (with 1 being
      *    the lowest and 9 denoting the highest compression). Note that
      *    saving files with the highest compression will be very slow.
+     *    Level 1 additionally skips libpng's adaptive row filter
+     *    selection, which makes it the fastest choice for previews.
      *    For JPEG files, this denotes the desired quality (between 0 and 100,
      *    the latter being best). The default argument (-1) uses compression
      *    5 for PNG and 100 for JPEG files.
@@ -569,6 +573,8 @@ public:
      *    strongly libpng will try to compress the output (with 1 being
      *    the lowest and 9 denoting the highest compression). Note that
      *    saving files with the highest compression will be very slow.
+     *    Level 1 additionally skips libpng's adaptive row filter
+     *    selection, which makes it the fastest choice for previews.
      *    For JPEG files, this denotes the desired quality (between 0 and 100,
      *    the latter being best). The default argument (-1) uses compression
      *    5 for PNG and 100 for JPEG files.
@@ -1233,6 +1239,18 @@ public:
     //! @}
     // ======================================================================
 
+    /**
+     * \brief Set the number of threads that OpenEXR uses to compress and
+     * decompress the scanlines or tiles of a file
+     *
+     * The default is the number of cores. The executables set this to
+     * the number of local worker threads (e.g. <tt>mitsuba -p</tt>).
+     */
+    static void setIOThreadCount(int count);
+
+    /// Return the number of OpenEXR I/O threads (see \ref setIOThreadCount())
+    static int getIOThreadCount();
+
     /// Run static initialization code (sets up OpenEXR for multithreading)
     static void staticInitialization();
 
@@ -76,10 +76,24 @@ MTS_NAMESPACE_BEGIN
  * if (!chiSqr.runTest())
  *    Log(EError, "Uh oh -- test failed, the implementation is probably incorrect!");
  * \endcode
+ *
+ * The numerical integration of the reference bin counts always runs in
+ * parallel. When the sampling procedure can be instantiated once per thread,
+ * \ref fillParallel() additionally distributes the sample generation over
+ * all cores and merges the resulting histograms.
  * \ingroup libcore
  */
 class MTS_EXPORT_CORE ChiSquare : public Object {
 public:
+    /// Sampling procedure: returns a direction, its weight and measure
+    typedef boost::function<boost::tuple<Vector, Float, EMeasure>()> SampleFunctor;
+
+    /// Density function that is integrated over the bins
+    typedef boost::function<Float (const Vector &, EMeasure)> PdfFunctor;
+
+    /// Creates an independent sampling procedure for the given worker index
+    typedef boost::function<SampleFunctor (int)> SampleFunctorFactory;
+
     /// Possible outcomes in \ref runTest()
     enum ETestResult {
         /// The null hypothesis was rejected
@@ -140,9 +154,21 @@ public:
      * Please see the class documentation for a description
      * on how to invoke this function
      */
-    void fill(
-        const boost::function<boost::tuple<Vector, Float, EMeasure>()> &sampleFn,
-        const boost::function<Float (const Vector &, EMeasure)> &pdfFn);
+    void fill(const SampleFunctor &sampleFn, const PdfFunctor &pdfFn);
+
+    /**
+     * \brief Fill the actual and reference bin counts using
+     * all available cores
+     *
+     * In contrast to \ref fill(), the sampling procedure need not be
+     * thread-safe: \c createSampleFn is invoked once per worker (from
+     * the calling thread) and each resulting functor is only ever used
+     * by a single thread. Every worker accumulates its share of the
+     * samples into a private histogram, which are merged afterwards.
+     * The density function must be safe to call concurrently.
+     */
+    void fillParallel(const SampleFunctorFactory &createSampleFn,
+        const PdfFunctor &pdfFn);
 
     /**
      * \brief Dump the bin counts to a file using MATLAB format
@@ -166,9 +192,16 @@ protected:
     /// Release all memory
     virtual ~ChiSquare();
 
+    /// Accumulate samples into a histogram (does not clear it)
+    void accumulate(const SampleFunctor &sampleFn, size_t sampleCount,
+        Float *table, std::vector<Vector> &discreteDirections) const;
+
+    /// Add the discrete and integrated continuous densities to the reference table
+    void integrate(const PdfFunctor &pdfFn,
+        const std::vector<Vector> &discreteDirections);
+
     /// Functor to evaluate the pdf values in parallel using OpenMP
-    static void integrand(
-        const boost::function<Float (const Vector &, EMeasure)> &pdfFn,
+    static void integrand(const PdfFunctor &pdfFn,
             size_t nPts, const Float *in, Float *out) {
         #if defined(MTS_OPENMP)
         #pragma omp parallel for
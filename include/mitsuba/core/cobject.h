@@ -91,11 +91,59 @@ protected:
     Properties m_properties;
 };
 
+/**
+ * \brief Entry points of a plugin that is linked into the plugin bundle
+ * (<tt>plugins/mitsuba-plugins.so/dll/dylib</tt>) instead of being
+ * loaded from a separate shared library
+ *
+ * The build compiles the plugin sources of the bundle with
+ * \c MTS_STATIC_PLUGIN set to the plugin name, which makes
+ * \ref MTS_EXPORT_PLUGIN register them when the bundle is loaded.
+ *
+ * \ingroup libcore
+ */
+struct StaticPluginEntry {
+    void *(*createInstance)(const Properties &props);
+    void *(*createUtility)();
+    const char *(*getDescription)();
+};
+
+/// Register a plugin of the bundle (see \ref StaticPluginEntry)
+extern MTS_EXPORT_CORE bool registerStaticPlugin(const char *name,
+    const StaticPluginEntry &entry);
+
+/// Look up a plugin of the bundle (returns \c NULL if it is unknown)
+extern MTS_EXPORT_CORE const StaticPluginEntry *findStaticPlugin(const std::string &name);
+
+#define MTS_STATIC_PLUGIN_NAME2(x) #x
+#define MTS_STATIC_PLUGIN_NAME(x) MTS_STATIC_PLUGIN_NAME2(x)
+
+/// Register the entry points of a plugin in the bundle (internal)
+#define MTS_REGISTER_STATIC_PLUGIN(createInstance, createUtility, getDescription) \
+    namespace { \
+        const StaticPluginEntry __staticPlugin = { createInstance, \
+            createUtility, getDescription }; \
+        const bool __staticPluginRegistered = registerStaticPlugin( \
+            MTS_STATIC_PLUGIN_NAME(MTS_STATIC_PLUGIN), __staticPlugin); \
+    }
+
 /** \brief This macro creates the binary interface, which Mitsuba
  * requires to load a plugin.
  *
  * \ingroup libcore
  */
+#if defined(MTS_STATIC_PLUGIN)
+#define MTS_EXPORT_PLUGIN(name, descr) \
+    namespace { \
+        void *CreateInstance(const Properties &props) { \
+            return new name(props); \
+        } \
+        const char *GetDescription() { \
+            return descr; \
+        } \
+    } \
+    MTS_REGISTER_STATIC_PLUGIN(CreateInstance, NULL, GetDescription)
+#else
 #define MTS_EXPORT_PLUGIN(name, descr) \
     extern "C" { \
         void MTS_EXPORT *CreateInstance(const Properties &props) { \
@@ -105,6 +153,7 @@ protected:
             return descr; \
         } \
     }
+#endif
 
 MTS_NAMESPACE_END
 
@@ -31,7 +31,6 @@ class Bitmap;
 class BlackBodySpectrum;
 struct BSphere;
 class ConfigurableObject;
-struct CacheLineCounter;
 class Class;
 class ConditionVariable;
 class ConsoleStream;
@@ -82,6 +81,8 @@ struct Color3;
 class SSHStream;
 class Statistics;
 class StatsCounter;
+struct StatsCounterSlot;
+struct StatsSlotTable;
 class Stream;
 class StreamAppender;
 class StreamBackend;
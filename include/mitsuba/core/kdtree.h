@@ -22,9 +22,52 @@
 
 #include <mitsuba/core/aabb.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/sse.h>
 
 MTS_NAMESPACE_BEGIN
 
+///! \cond
+namespace detail {
+    /**
+     * \brief Squared distances between a query point and the eight
+     * points of a \ref PointKDTree leaf bucket
+     *
+     * \param pos Bucket positions stored as <tt>[dim][8]</tt>
+     */
+    template <typename Scalar, int dim> struct KDBucketDistances {
+        template <typename PointType> static inline void eval(
+                const Scalar *pos, const PointType &p, Scalar *dist) {
+            for (int j=0; j<8; ++j)
+                dist[j] = 0;
+            for (int i=0; i<dim; ++i) {
+                for (int j=0; j<8; ++j) {
+                    Scalar diff = pos[8*i + j] - p[i];
+                    dist[j] += diff*diff;
+                }
+            }
+        }
+    };
+
+#if defined(MTS_SSE)
+    template <int dim> struct KDBucketDistances<float, dim> {
+        template <typename PointType> static inline void eval(
+                const float *pos, const PointType &p, float *dist) {
+            __m128 dist0 = _mm_setzero_ps(), dist1 = _mm_setzero_ps();
+            for (int i=0; i<dim; ++i) {
+                __m128 coord = _mm_set1_ps(p[i]),
+                       diff0 = _mm_sub_ps(_mm_loadu_ps(pos + 8*i), coord),
+                       diff1 = _mm_sub_ps(_mm_loadu_ps(pos + 8*i + 4), coord);
+                dist0 = _mm_add_ps(dist0, _mm_mul_ps(diff0, diff0));
+                dist1 = _mm_add_ps(dist1, _mm_mul_ps(diff1, diff1));
+            }
+            _mm_storeu_ps(dist, dist0);
+            _mm_storeu_ps(dist + 4, dist1);
+        }
+    };
+#endif
+}; // namespace detail
+///! \endcond
+
 /**
  * \brief Simple kd-tree node for use with \ref PointKDTree.
  *
@@ -208,6 +251,12 @@ template <typename _PointType, typename _DataRecord> struct LeftBalancedKDNode {
  * have some kind of spatial extent, the classes \ref GenericKDTree and
  * \ref ShapeKDTree will be more appropriate.
  *
+ * After construction, all subtrees containing between 2 and 8 points
+ * are additionally copied into "buckets" that store the positions in a
+ * structure-of-arrays layout. Queries that reach the root of such a
+ * subtree test all of its points using a single SIMD distance
+ * computation instead of traversing it.
+ *
  * \tparam _NodeType Underlying node data structure. See \ref SimpleKDNode as
  * an example for the required public interface
  *
@@ -280,6 +329,46 @@ public:
         }
     };
 
+    /**
+     * \brief Subtree whose construction was deferred by the task-based
+     * variant of \ref build()
+     *
+     * The subtrees of one build are disjoint, hence they can be
+     * constructed concurrently using \ref buildTask().
+     */
+    struct BuildTask {
+        typedef typename std::vector<IndexType>::iterator IteratorType;
+
+        /// Range of the indirection table covered by this subtree
+        IteratorType base, rangeStart, rangeEnd;
+        /// Permutation table (left-balanced layout only)
+        std::vector<IndexType> *permutation;
+        /// Bounds of the subtree
+        AABBType aabb;
+        /// Index of the subtree root (left-balanced layout only)
+        IndexType idx;
+        /// Depth of the subtree root
+        size_t depth;
+        /// Depth of the deepest leaf (set by \ref buildTask())
+        size_t maxDepth;
+
+        /// Return the number of points in the subtree
+        inline size_t size() const { return rangeEnd - rangeStart; }
+    };
+
+    /// Number of points (SIMD lanes) in a leaf bucket
+    enum {
+        EBucketSize = 8
+    };
+
+    /// Executor that constructs all deferred subtrees on the calling thread
+    struct SerialBuildExecutor {
+        inline void operator()(PointKDTree &tree, std::vector<BuildTask> &tasks) {
+            for (size_t i=0; i<tasks.size(); ++i)
+                tree.buildTask(tasks[i]);
+        }
+    };
+
 public:
     /**
      * \brief Create an empty KD-tree that can hold the specified
@@ -292,9 +381,9 @@ public:
     //! @{ \name \c stl::vector-like interface
     // =============================================================
     /// Clear the kd-tree array
-    inline void clear() { m_nodes.clear(); m_aabb.reset(); }
+    inline void clear() { m_nodes.clear(); m_aabb.reset(); clearBuckets(); }
     /// Resize the kd-tree array
-    inline void resize(size_t size) { m_nodes.resize(size); }
+    inline void resize(size_t size) { m_nodes.resize(size); clearBuckets(); }
     /// Reserve a certain amount of memory for the kd-tree array
     inline void reserve(size_t size) { m_nodes.reserve(size); }
     /// Return the size of the kd-tree
@@ -303,9 +392,19 @@ public:
     inline size_t capacity() const { return m_nodes.capacity(); }
     /// Append a kd-tree node to the node array
     inline void push_back(const NodeType &node) {
+        if (EXPECT_NOT_TAKEN(!m_bucketRoots.empty()))
+            clearBuckets();
         m_nodes.push_back(node);
         m_aabb.expandBy(node.getPosition());
     }
+    /// Append a contiguous array of kd-tree nodes to the node array
+    inline void append(const NodeType *nodes, size_t count) {
+        if (EXPECT_NOT_TAKEN(!m_bucketRoots.empty()))
+            clearBuckets();
+        m_nodes.insert(m_nodes.end(), nodes, nodes + count);
+        for (size_t i=0; i<count; ++i)
+            m_aabb.expandBy(nodes[i].getPosition());
+    }
     /// Return one of the KD-tree nodes by index
     inline NodeType &operator[](size_t idx) { return m_nodes[idx]; }
     /// Return one of the KD-tree nodes by index (const version)
@@ -324,6 +423,25 @@ public:
 
     /// Construct the KD-tree hierarchy
     void build(bool recomputeAABB = false) {
+        SerialBuildExecutor executor;
+        build(recomputeAABB, 0, executor);
+    }
+
+    /**
+     * \brief Construct the KD-tree hierarchy, handing off the
+     * construction of its subtrees to a custom executor
+     *
+     * The nodes above \c taskDepth are created on the calling thread.
+     * The remaining subtrees are then collected into a list of independent
+     * \ref BuildTask records, which is passed to <tt>executor(*this,
+     * tasks)</tt>. The executor must invoke \ref buildTask() exactly once
+     * on each of them (concurrently and in any order) before it returns.
+     * The resulting tree is identical to the one produced by
+     * \ref build(bool). A \c taskDepth of zero builds the entire tree
+     * on the calling thread.
+     */
+    template <typename Executor> void build(bool recomputeAABB,
+            size_t taskDepth, Executor &executor) {
         ref<Timer> timer = new Timer();
 
         if (m_nodes.size() == 0) {
@@ -351,24 +469,46 @@ public:
         for (size_t i=0; i<m_nodes.size(); ++i)
             indirection[i] = (IndexType) i;
 
-        m_depth = 0;
+        std::vector<BuildTask> tasks;
+        std::vector<BuildTask> *taskTarget = taskDepth > 0 ? &tasks : NULL;
+        BuildTask root;
+        root.base = root.rangeStart = indirection.begin();
+        root.rangeEnd = indirection.end();
+        root.permutation = NULL;
+        root.aabb = m_aabb;
+        root.idx = 0;
+        root.depth = 1;
+        root.maxDepth = 1;
+
         int constructionTime;
         if (NodeType::leftBalancedLayout) {
             std::vector<IndexType> permutation(m_nodes.size());
-            buildLB(0, 1, indirection.begin(), indirection.begin(),
-                indirection.end(), permutation);
+            root.permutation = &permutation;
+            buildLB(root.idx, root.depth, root.aabb, root.maxDepth, root.base,
+                root.rangeStart, root.rangeEnd, permutation, taskTarget, taskDepth);
+            if (!tasks.empty())
+                executor(*this, tasks);
             constructionTime = timer->getMilliseconds();
             timer->reset();
             permute_inplace(&m_nodes[0], permutation);
         } else {
-            build(1, indirection.begin(), indirection.begin(), indirection.end());
+            build(root.depth, root.aabb, root.maxDepth, root.base,
+                root.rangeStart, root.rangeEnd, taskTarget, taskDepth);
+            if (!tasks.empty())
+                executor(*this, tasks);
             constructionTime = timer->getMilliseconds();
             timer->reset();
             permute_inplace(&m_nodes[0], indirection);
         }
 
+        m_depth = root.maxDepth;
+        for (size_t i=0; i<tasks.size(); ++i)
+            m_depth = std::max(m_depth, tasks[i].maxDepth);
+
         int permutationTime = timer->getMilliseconds();
 
+        buildBuckets();
+
         if (recomputeAABB)
             SLog(EDebug, "Done after %i ms (breakdown: aabb: %i ms, build: %i ms, permute: %i ms). ",
                 aabbTime + constructionTime + permutationTime, aabbTime, constructionTime, permutationTime);
@@ -377,6 +517,109 @@ public:
                 constructionTime + permutationTime, constructionTime, permutationTime);
     }
 
+    /**
+     * \brief Construct a subtree that was deferred by the task-based
+     * variant of \ref build()
+     *
+     * Safe to call concurrently for the different tasks of one build.
+     */
+    void buildTask(BuildTask &task) {
+        task.maxDepth = task.depth;
+        if (NodeType::leftBalancedLayout)
+            buildLB(task.idx, task.depth, task.aabb, task.maxDepth, task.base,
+                task.rangeStart, task.rangeEnd, *task.permutation, NULL, 0);
+        else
+            build(task.depth, task.aabb, task.maxDepth, task.base,
+                task.rangeStart, task.rangeEnd, NULL, 0);
+    }
+
+    /**
+     * \brief Copy the small subtrees of the hierarchy into SIMD-friendly
+     * leaf buckets
+     *
+     * This is done automatically by \ref build(). It only needs to be
+     * called explicitly when the nodes were filled in some other way
+     * (e.g. when unserializing a tree), or after modifying the positions
+     * of the nodes. Without buckets, the queries fall back to a plain
+     * traversal of the tree.
+     */
+    void buildBuckets() {
+        clearBuckets();
+        size_t nodeCount = m_nodes.size();
+        if (nodeCount == 0)
+            return;
+
+        /* Determine the subtree sizes (children have larger indices) */
+        std::vector<IndexType> sizes(nodeCount);
+        for (size_t i=nodeCount; i-- > 0; ) {
+            const NodeType &node = m_nodes[i];
+            IndexType index = (IndexType) i, size = 1;
+            if (!node.isLeaf()) {
+                size += sizes[node.getLeftIndex(index)];
+                if (hasRightChild(index))
+                    size += sizes[node.getRightIndex(index)];
+            }
+            sizes[i] = size;
+        }
+
+        /* Create a bucket for every maximal subtree with 2..8 points */
+        m_bucketRoots.resize(nodeCount, (IndexType) EInvalidBucket);
+        std::vector<IndexType> stack, members;
+        stack.push_back(0);
+        while (!stack.empty()) {
+            IndexType index = stack.back();
+            stack.pop_back();
+            const NodeType &node = m_nodes[index];
+
+            if (sizes[index] > EBucketSize) {
+                stack.push_back(node.getLeftIndex(index));
+                if (hasRightChild(index))
+                    stack.push_back(node.getRightIndex(index));
+                continue;
+            } else if (sizes[index] == 1) {
+                continue;
+            }
+
+            members.clear();
+            members.push_back(index);
+            for (size_t j=0; j<members.size(); ++j) {
+                IndexType member = members[j];
+                if (m_nodes[member].isLeaf())
+                    continue;
+                members.push_back(m_nodes[member].getLeftIndex(member));
+                if (hasRightChild(member))
+                    members.push_back(m_nodes[member].getRightIndex(member));
+            }
+
+            m_bucketRoots[index] = (IndexType) (m_bucketIndices.size() / EBucketSize);
+            for (int j=0; j<EBucketSize; ++j)
+                m_bucketIndices.push_back(j < (int) members.size() ? members[j] : 0);
+
+            /* Unused lanes are placed at infinity and never match */
+            for (int dim=0; dim<PointType::dim; ++dim)
+                for (int j=0; j<EBucketSize; ++j)
+                    m_bucketPositions.push_back(j < (int) members.size() ?
+                        m_nodes[members[j]].getPosition()[dim] :
+                        std::numeric_limits<Scalar>::infinity());
+        }
+
+        SLog(EDebug, "Created " SIZE_T_FMT " leaf buckets (%s)",
+            m_bucketIndices.size() / EBucketSize, memString(
+            m_bucketRoots.size() * sizeof(IndexType) +
+            m_bucketIndices.size() * sizeof(IndexType) +
+            m_bucketPositions.size() * sizeof(Scalar)).c_str());
+    }
+
+    /// Release the leaf buckets created by \ref buildBuckets()
+    inline void clearBuckets() {
+        std::vector<IndexType>().swap(m_bucketRoots);
+        std::vector<IndexType>().swap(m_bucketIndices);
+        std::vector<Scalar>().swap(m_bucketPositions);
+    }
+
+    /// Return whether the leaf buckets are available
+    inline bool hasBuckets() const { return !m_bucketRoots.empty(); }
+
     /**
      * \brief Run a k-nearest-neighbor search query
      *
@@ -403,10 +646,25 @@ public:
         IndexType index = 0, stackPos = 1;
         Float sqrSearchRadius = _sqrSearchRadius;
         size_t resultCount = 0;
-        bool isHeap = false;
+        bool isHeap = false, bucketed = hasBuckets();
         stack[0] = 0;
 
         while (stackPos > 0) {
+            /* Test all points of a leaf bucket at once */
+            if (bucketed && m_bucketRoots[index] != (IndexType) EInvalidBucket) {
+                IndexType bucket = m_bucketRoots[index];
+                Scalar dist[EBucketSize];
+                bucketDistances(bucket, p, dist);
+                const IndexType *indices = &m_bucketIndices[(size_t) bucket * EBucketSize];
+                for (int j=0; j<EBucketSize; ++j) {
+                    if (dist[j] < sqrSearchRadius)
+                        insertResult(results, resultCount, k, isHeap,
+                            sqrSearchRadius, (Float) dist[j], indices[j]);
+                }
+                index = stack[--stackPos];
+                continue;
+            }
+
             const NodeType &node = m_nodes[index];
             IndexType nextIndex;
 
@@ -443,31 +701,9 @@ public:
             /* Check if the current point is within the query's search radius */
             const Float pointDistSquared = (node.getPosition() - p).lengthSquared();
 
-            if (pointDistSquared < sqrSearchRadius) {
-                /* Switch to a max-heap when the available search
-                   result space is exhausted */
-                if (resultCount < k) {
-                    /* There is still room, just add the point to
-                       the search result list */
-                    results[resultCount++] = SearchResult(pointDistSquared, index);
-                } else {
-                    if (!isHeap) {
-                        /* Establish the max-heap property */
-                        std::make_heap(results, results + resultCount,
-                                SearchResultComparator());
-                        isHeap = true;
-                    }
-                    SearchResult *end = results + resultCount + 1;
-
-                    /* Add the new point, remove the one that is farthest away */
-                    results[resultCount] = SearchResult(pointDistSquared, index);
-                    std::push_heap(results, end, SearchResultComparator());
-                    std::pop_heap(results, end, SearchResultComparator());
-
-                    /* Reduce the search radius accordingly */
-                    sqrSearchRadius = results[0].distSquared;
-                }
-            }
+            if (pointDistSquared < sqrSearchRadius)
+                insertResult(results, resultCount, k, isHeap,
+                    sqrSearchRadius, pointDistSquared, index);
             index = nextIndex;
         }
         _sqrSearchRadius = sqrSearchRadius;
@@ -502,12 +738,27 @@ public:
         IndexType *stack = (IndexType *) alloca((m_depth+1) * sizeof(IndexType));
         IndexType index = 0, stackPos = 1;
         size_t resultCount = 0;
-        bool isHeap = false;
+        bool isHeap = false, bucketed = hasBuckets();
         stack[0] = 0;
 
         while (stackPos > 0) {
-            const NodeType &node = m_nodes[index];
             ++traversalSteps;
+            /* Test all points of a leaf bucket at once */
+            if (bucketed && m_bucketRoots[index] != (IndexType) EInvalidBucket) {
+                IndexType bucket = m_bucketRoots[index];
+                Scalar dist[EBucketSize];
+                bucketDistances(bucket, p, dist);
+                const IndexType *indices = &m_bucketIndices[(size_t) bucket * EBucketSize];
+                for (int j=0; j<EBucketSize; ++j) {
+                    if (dist[j] < sqrSearchRadius)
+                        insertResult(results, resultCount, k, isHeap,
+                            sqrSearchRadius, (Float) dist[j], indices[j]);
+                }
+                index = stack[--stackPos];
+                continue;
+            }
+
+            const NodeType &node = m_nodes[index];
             IndexType nextIndex;
 
             /* Recurse on inner nodes */
@@ -543,30 +794,9 @@ public:
             /* Check if the current point is within the query's search radius */
             const Float pointDistSquared = (node.getPosition() - p).lengthSquared();
 
-            if (pointDistSquared < sqrSearchRadius) {
-                /* Switch to a max-heap when the available search
-                   result space is exhausted */
-                if (resultCount < k) {
-                    /* There is still room, just add the point to
-                       the search result list */
-                    results[resultCount++] = SearchResult(pointDistSquared, index);
-                } else {
-                    if (!isHeap) {
-                        /* Establish the max-heap property */
-                        std::make_heap(results, results + resultCount,
-                                SearchResultComparator());
-                        isHeap = true;
-                    }
-
-                    /* Add the new point, remove the one that is farthest away */
-                    results[resultCount] = SearchResult(pointDistSquared, index);
-                    std::push_heap(results, results + resultCount + 1, SearchResultComparator());
-                    std::pop_heap(results, results + resultCount + 1, SearchResultComparator());
-
-                    /* Reduce the search radius accordingly */
-                    sqrSearchRadius = results[0].distSquared;
-                }
-            }
+            if (pointDistSquared < sqrSearchRadius)
+                insertResult(results, resultCount, k, isHeap,
+                    sqrSearchRadius, pointDistSquared, index);
             index = nextIndex;
         }
         return resultCount;
@@ -611,9 +841,26 @@ public:
         IndexType *stack = (IndexType *) alloca((m_depth+1) * sizeof(IndexType));
         size_t index = 0, stackPos = 1, found = 0;
         Float distSquared = searchRadius*searchRadius;
+        bool bucketed = hasBuckets();
         stack[0] = 0;
 
         while (stackPos > 0) {
+            /* Test all points of a leaf bucket at once */
+            if (bucketed && m_bucketRoots[index] != (IndexType) EInvalidBucket) {
+                IndexType bucket = m_bucketRoots[index];
+                Scalar dist[EBucketSize];
+                bucketDistances(bucket, p, dist);
+                const IndexType *indices = &m_bucketIndices[(size_t) bucket * EBucketSize];
+                for (int j=0; j<EBucketSize; ++j) {
+                    if (dist[j] < distSquared) {
+                        functor(m_nodes[indices[j]]);
+                        ++found;
+                    }
+                }
+                index = stack[--stackPos];
+                continue;
+            }
+
             NodeType &node = m_nodes[index];
             IndexType nextIndex;
 
@@ -680,9 +927,26 @@ public:
         IndexType *stack = (IndexType *) alloca((m_depth+1) * sizeof(IndexType));
         IndexType index = 0, stackPos = 1, found = 0;
         Float distSquared = searchRadius*searchRadius;
+        bool bucketed = hasBuckets();
         stack[0] = 0;
 
         while (stackPos > 0) {
+            /* Test all points of a leaf bucket at once */
+            if (bucketed && m_bucketRoots[index] != (IndexType) EInvalidBucket) {
+                IndexType bucket = m_bucketRoots[index];
+                Scalar dist[EBucketSize];
+                bucketDistances(bucket, p, dist);
+                const IndexType *indices = &m_bucketIndices[(size_t) bucket * EBucketSize];
+                for (int j=0; j<EBucketSize; ++j) {
+                    if (dist[j] < distSquared) {
+                        ++found;
+                        functor(m_nodes[indices[j]]);
+                    }
+                }
+                index = stack[--stackPos];
+                continue;
+            }
+
             const NodeType &node = m_nodes[index];
             IndexType nextIndex;
 
@@ -746,9 +1010,26 @@ public:
         IndexType *stack = (IndexType *) alloca((m_depth+1) * sizeof(IndexType));
         IndexType index = 0, stackPos = 1, found = 0;
         Float distSquared = searchRadius*searchRadius;
+        bool bucketed = hasBuckets();
         stack[0] = 0;
 
         while (stackPos > 0) {
+            /* Test all points of a leaf bucket at once */
+            if (bucketed && m_bucketRoots[index] != (IndexType) EInvalidBucket) {
+                IndexType bucket = m_bucketRoots[index];
+                Scalar dist[EBucketSize];
+                bucketDistances(bucket, p, dist);
+                const IndexType *indices = &m_bucketIndices[(size_t) bucket * EBucketSize];
+                for (int j=0; j<EBucketSize; ++j) {
+                    if (dist[j] < distSquared) {
+                        ++found;
+                        results.push_back(indices[j]);
+                    }
+                }
+                index = stack[--stackPos];
+                continue;
+            }
+
             const NodeType &node = m_nodes[index];
             IndexType nextIndex;
 
@@ -811,6 +1092,45 @@ public:
         }
     }
 protected:
+    /// Marks nodes that aren't the root of a leaf bucket
+    enum {
+        EInvalidBucket = -1
+    };
+
+    /// Compute the squared distances between \c p and the points of a bucket
+    inline void bucketDistances(IndexType bucket, const PointType &p, Scalar *dist) const {
+        detail::KDBucketDistances<Scalar, PointType::dim>::eval(
+            &m_bucketPositions[(size_t) bucket * EBucketSize * PointType::dim], p, dist);
+    }
+
+    /// Add a point to the result list of a k-nearest-neighbor query
+    inline void insertResult(SearchResult *results, size_t &resultCount, size_t k,
+            bool &isHeap, Float &sqrSearchRadius, Float distSquared, IndexType index) const {
+        /* Switch to a max-heap when the available search
+           result space is exhausted */
+        if (resultCount < k) {
+            /* There is still room, just add the point to
+               the search result list */
+            results[resultCount++] = SearchResult(distSquared, index);
+        } else {
+            if (!isHeap) {
+                /* Establish the max-heap property */
+                std::make_heap(results, results + resultCount,
+                        SearchResultComparator());
+                isHeap = true;
+            }
+            SearchResult *end = results + resultCount + 1;
+
+            /* Add the new point, remove the one that is farthest away */
+            results[resultCount] = SearchResult(distSquared, index);
+            std::push_heap(results, end, SearchResultComparator());
+            std::pop_heap(results, end, SearchResultComparator());
+
+            /* Reduce the search radius accordingly */
+            sqrSearchRadius = results[0].distSquared;
+        }
+    }
+
     struct CoordinateOrdering : public std::binary_function<IndexType, IndexType, bool> {
     public:
         inline CoordinateOrdering(const std::vector<NodeType> &nodes, int axis)
@@ -873,17 +1193,41 @@ protected:
         return p - 1;
     }
 
-    /// Left-balanced tree construction routine
-    void buildLB(IndexType idx, size_t depth,
+    /// Record a subtree whose construction is deferred
+    inline void deferTask(std::vector<BuildTask> *tasks, IndexType idx, size_t depth,
+              const AABBType &aabb,
               typename std::vector<IndexType>::iterator base,
               typename std::vector<IndexType>::iterator rangeStart,
               typename std::vector<IndexType>::iterator rangeEnd,
-              typename std::vector<IndexType> &permutation) {
-        m_depth = std::max(depth, m_depth);
+              std::vector<IndexType> *permutation) {
+        BuildTask task;
+        task.base = base;
+        task.rangeStart = rangeStart;
+        task.rangeEnd = rangeEnd;
+        task.permutation = permutation;
+        task.aabb = aabb;
+        task.idx = idx;
+        task.depth = task.maxDepth = depth;
+        tasks->push_back(task);
+    }
 
+    /// Left-balanced tree construction routine
+    void buildLB(IndexType idx, size_t depth, AABBType &aabb, size_t &maxDepth,
+              typename std::vector<IndexType>::iterator base,
+              typename std::vector<IndexType>::iterator rangeStart,
+              typename std::vector<IndexType>::iterator rangeEnd,
+              typename std::vector<IndexType> &permutation,
+              std::vector<BuildTask> *tasks, size_t taskDepth) {
         IndexType count = (IndexType) (rangeEnd-rangeStart);
         SAssert(count > 0);
 
+        if (tasks && depth >= taskDepth && count > 1) {
+            deferTask(tasks, idx, depth, aabb, base, rangeStart, rangeEnd, &permutation);
+            return;
+        }
+
+        maxDepth = std::max(depth, maxDepth);
+
         if (count == 1) {
             /* Create a leaf node */
             m_nodes[*rangeStart].setLeaf(true);
@@ -893,7 +1237,7 @@ protected:
 
         typename std::vector<IndexType>::iterator split
             = rangeStart + leftSubtreeSize(count);
-        int axis = m_aabb.getLargestAxis();
+        int axis = aabb.getLargestAxis();
         std::nth_element(rangeStart, split, rangeEnd,
             CoordinateOrdering(m_nodes, axis));
 
@@ -903,30 +1247,38 @@ protected:
         permutation[idx] = *split;
 
         /* Recursively build the children */
-        Scalar temp = m_aabb.max[axis],
+        Scalar temp = aabb.max[axis],
             splitPos = splitNode.getPosition()[axis];
-        m_aabb.max[axis] = splitPos;
-        buildLB(2*idx+1, depth+1, base, rangeStart, split, permutation);
-        m_aabb.max[axis] = temp;
+        aabb.max[axis] = splitPos;
+        buildLB(2*idx+1, depth+1, aabb, maxDepth, base, rangeStart, split,
+            permutation, tasks, taskDepth);
+        aabb.max[axis] = temp;
 
         if (split+1 != rangeEnd) {
-            temp = m_aabb.min[axis];
-            m_aabb.min[axis] = splitPos;
-            buildLB(2*idx+2, depth+1, base, split+1, rangeEnd, permutation);
-            m_aabb.min[axis] = temp;
+            temp = aabb.min[axis];
+            aabb.min[axis] = splitPos;
+            buildLB(2*idx+2, depth+1, aabb, maxDepth, base, split+1, rangeEnd,
+                permutation, tasks, taskDepth);
+            aabb.min[axis] = temp;
         }
     }
 
     /// Default tree construction routine
-    void build(size_t depth,
+    void build(size_t depth, AABBType &aabb, size_t &maxDepth,
               typename std::vector<IndexType>::iterator base,
               typename std::vector<IndexType>::iterator rangeStart,
-              typename std::vector<IndexType>::iterator rangeEnd) {
-        m_depth = std::max(depth, m_depth);
-
+              typename std::vector<IndexType>::iterator rangeEnd,
+              std::vector<BuildTask> *tasks, size_t taskDepth) {
         IndexType count = (IndexType) (rangeEnd-rangeStart);
         SAssert(count > 0);
 
+        if (tasks && depth >= taskDepth && count > 1) {
+            deferTask(tasks, 0, depth, aabb, base, rangeStart, rangeEnd, NULL);
+            return;
+        }
+
+        maxDepth = std::max(depth, maxDepth);
+
         if (count == 1) {
             /* Create a leaf node */
             m_nodes[*rangeStart].setLeaf(true);
@@ -939,7 +1291,7 @@ protected:
         switch (m_heuristic) {
             case EBalanced: {
                     split = rangeStart + count/2;
-                    axis = m_aabb.getLargestAxis();
+                    axis = aabb.getLargestAxis();
                     std::nth_element(rangeStart, split, rangeEnd,
                         CoordinateOrdering(m_nodes, axis));
                 };
@@ -947,7 +1299,7 @@ protected:
 
             case ELeftBalanced: {
                     split = rangeStart + leftSubtreeSize(count);
-                    axis = m_aabb.getLargestAxis();
+                    axis = aabb.getLargestAxis();
                     std::nth_element(rangeStart, split, rangeEnd,
                         CoordinateOrdering(m_nodes, axis));
                 };
@@ -955,10 +1307,10 @@ protected:
 
             case ESlidingMidpoint: {
                     /* Sliding midpoint rule: find a split that is close to the spatial median */
-                    axis = m_aabb.getLargestAxis();
+                    axis = aabb.getLargestAxis();
 
                     Scalar midpoint = (Scalar) 0.5f
-                        * (m_aabb.max[axis]+m_aabb.min[axis]);
+                        * (aabb.max[axis]+aabb.min[axis]);
 
                     size_t nLT = std::count_if(rangeStart, rangeEnd,
                             LessThanOrEqual(m_nodes, axis, midpoint));
@@ -984,8 +1336,8 @@ protected:
                             CoordinateOrdering(m_nodes, dim));
 
                         size_t numLeft = 1, numRight = count-2;
-                        AABBType leftAABB(m_aabb), rightAABB(m_aabb);
-                        Float invVolume = 1.0f / m_aabb.getVolume();
+                        AABBType leftAABB(aabb), rightAABB(aabb);
+                        Float invVolume = 1.0f / aabb.getVolume();
                         for (typename std::vector<IndexType>::iterator it = rangeStart+1;
                                 it != rangeEnd; ++it) {
                             ++numLeft; --numRight;
@@ -1022,17 +1374,19 @@ protected:
         std::iter_swap(rangeStart, split);
 
         /* Recursively build the children */
-        Scalar temp = m_aabb.max[axis],
+        Scalar temp = aabb.max[axis],
             splitPos = splitNode.getPosition()[axis];
-        m_aabb.max[axis] = splitPos;
-        build(depth+1, base, rangeStart+1, split+1);
-        m_aabb.max[axis] = temp;
+        aabb.max[axis] = splitPos;
+        build(depth+1, aabb, maxDepth, base, rangeStart+1, split+1,
+            tasks, taskDepth);
+        aabb.max[axis] = temp;
 
         if (split+1 != rangeEnd) {
-            temp = m_aabb.min[axis];
-            m_aabb.min[axis] = splitPos;
-            build(depth+1, base, split+1, rangeEnd);
-            m_aabb.min[axis] = temp;
+            temp = aabb.min[axis];
+            aabb.min[axis] = splitPos;
+            build(depth+1, aabb, maxDepth, base, split+1, rangeEnd,
+                tasks, taskDepth);
+            aabb.min[axis] = temp;
         }
     }
 protected:
@@ -1040,6 +1394,12 @@ protected:
     AABBType m_aabb;
     EHeuristic m_heuristic;
     size_t m_depth;
+    /// Bucket ID of each node, or \ref EInvalidBucket
+    std::vector<IndexType> m_bucketRoots;
+    /// Node indices of the bucket lanes
+    std::vector<IndexType> m_bucketIndices;
+    /// Bucket positions in a <tt>[bucket][dim][lane]</tt> layout
+    std::vector<Scalar> m_bucketPositions;
 };
 
 MTS_NAMESPACE_END
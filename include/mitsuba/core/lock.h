@@ -43,6 +43,13 @@ public:
     /// Unlock the mutex
     void unlock();
 
+    /**
+     * \brief Try to lock the mutex without blocking
+     *
+     * \return \c true if the lock was acquired
+     */
+    bool tryLock();
+
     MTS_DECLARE_CLASS()
 protected:
     /// Virtual destructor
@@ -208,6 +215,12 @@ public:
         is_locked = true;
     }
 
+    bool tryLock() {
+        SAssert(!ownsLock() && m != NULL);
+        is_locked = m->tryLock();
+        return is_locked;
+    }
+
     void unlock() {
         SAssert(ownsLock() && m != NULL);
         m->unlock();
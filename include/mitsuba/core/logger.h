@@ -122,6 +122,25 @@ MTS_NAMESPACE_BEGIN
     } while (0)
 #endif
 
+/**
+ * Hot path assertions: checks in per-sample inner loops (sampling and
+ * pdf routines, BSSRDF evaluation, ...) whose cost shows up in render
+ * times. They are only compiled in when \c MTS_DEBUG_HOTPATH is defined
+ * (as in the debug build profiles), whereas the regular assertions above
+ * stay enabled unless \c MTS_NDEBUG is given.
+ */
+#if defined(MTS_DEBUG_HOTPATH) && !defined(MTS_NDEBUG)
+#define HotAssert(cond) Assert(cond)
+#define SHotAssert(cond) SAssert(cond)
+#define HotAssertWarn(cond) AssertWarn(cond)
+#define SHotAssertWarn(cond) SAssertWarn(cond)
+#else
+#define HotAssert(cond) ((void) 0)
+#define SHotAssert(cond) ((void) 0)
+#define HotAssertWarn(cond) ((void) 0)
+#define SHotAssertWarn(cond) ((void) 0)
+#endif
+
 /// Throw an exception reporting that the given function is not implemented
 #define NotImplementedError(funcName) \
     throw std::runtime_error(formatString("%s::" funcName "(): Not implemented!", \
@@ -230,6 +249,24 @@ public:
     /// Return the number of warnings reported so far
     inline size_t getWarningCount() const { return m_warningCount; }
 
+    /**
+     * \brief Hand messages to the appenders from a background thread
+     *
+     * When enabled, \ref log() only formats a message and pushes it into
+     * a lock-free queue, so that threads which log a lot (e.g. at the
+     * \ref EDebug level) don't serialize on the appenders. Errors and
+     * progress messages first flush the queue and are then delivered as
+     * before, which keeps the output in order. This should be configured
+     * before other threads start logging.
+     */
+    void setAsynchronous(bool async);
+
+    /// Are messages handed to the appenders from a background thread?
+    inline bool isAsynchronous() const { return m_async != NULL; }
+
+    /// Deliver all queued messages (see \ref setAsynchronous())
+    void flush();
+
     /// Initialize logging
     static void staticInitialization();
 
@@ -240,13 +277,19 @@ public:
 protected:
     /// Virtual destructor
     virtual ~Logger();
+
+    /// Deliver all queued messages (the caller must hold \c m_mutex)
+    void drainQueue();
 private:
+    struct AsyncState;
+
     ELogLevel m_logLevel;
     ELogLevel m_errorLevel;
     ref<Formatter> m_formatter;
     ref<Mutex> m_mutex;
     std::vector<Appender *> m_appenders;
     size_t m_warningCount;
+    AsyncState *m_async;
 };
 
 MTS_NAMESPACE_END
@@ -362,6 +362,85 @@ inline size_t roundToPowerOfTwo(size_t value) {
     inline bool catastrophicCancellation(double a, double b) {
         return std::abs(a+b)/std::abs(a-b) < 1e-7;
     }
+
+    /// Wrapper that keeps a function argument from taking part in template argument deduction
+    template <typename T> struct NonDeduced { typedef T type; };
+
+    /// Two Halley iterations for w*exp(w) = x (used by the Lambert W functions)
+    template <typename T> inline T lambertWHalley(T x, T w) {
+        for (int i = 0; i < 2; i++) {
+            T ew = std::exp(w);
+            T f = w * ew - x;
+            T wp1 = w + 1;
+            w -= f / (ew * wp1 - (w + 2) * f / (2 * wp1));
+        }
+        return w;
+    }
+
+    /**
+     * \brief Principal branch W_0 of the Lambert W function, i.e. the
+     * solution w >= -1 of w*exp(w) = x for x >= -1/e
+     *
+     * Starts from a branch point series, a Pade approximant or the
+     * asymptotic expansion (depending on x) and refines it with two Halley
+     * steps. The relative error is below 1e-11 in double precision.
+     * Arguments just below -1/e (due to roundoff) give -1, anything further
+     * outside of the domain gives NaN. Computes in Float by default, code
+     * that needs double precision irrespective of Float can request it
+     * with <tt>lambertW0<double>(x)</tt>.
+     */
+    template <typename T = Float> inline T lambertW0(typename NonDeduced<T>::type x) {
+        /* Leave some slack for roundoff errors in the argument */
+        const T minX = -1 / (T) M_E_DBL
+            * (1 + 4 * std::numeric_limits<T>::epsilon());
+        if (!(x >= minX))
+            return std::numeric_limits<T>::quiet_NaN();
+        if (x == 0)
+            return 0;
+
+        T w;
+        if (x < (T) -0.3) {
+            T p = std::sqrt(std::max((T) 0, 2 * ((T) M_E_DBL * x + 1)));
+            w = -1 + p * (1 + p * ((T) -1/3 + p * (T) 11/72));
+            if (p < (T) 1e-3)
+                return w; /* Halley steps are ill-conditioned here */
+        } else if (x < 3) {
+            w = x * (1 + (T) 4/3 * x)
+                / (1 + x * ((T) 7/3 + (T) 5/6 * x));
+        } else {
+            T L1 = std::log(x), L2 = std::log(L1);
+            w = L1 - L2 + L2 / L1;
+        }
+        return lambertWHalley(x, w);
+    }
+
+    /**
+     * \brief Lower branch W_{-1} of the Lambert W function, i.e. the
+     * solution w <= -1 of w*exp(w) = x for -1/e <= x < 0
+     *
+     * Same approach and accuracy as \ref lambertW0(). Returns -infinity
+     * for x = 0 and NaN outside of the domain.
+     */
+    template <typename T = Float> inline T lambertWm1(typename NonDeduced<T>::type x) {
+        const T minX = -1 / (T) M_E_DBL
+            * (1 + 4 * std::numeric_limits<T>::epsilon());
+        if (!(x >= minX && x <= 0))
+            return std::numeric_limits<T>::quiet_NaN();
+        if (x == 0)
+            return -std::numeric_limits<T>::infinity();
+
+        T w;
+        if (x < (T) -0.2) {
+            T p = -std::sqrt(std::max((T) 0, 2 * ((T) M_E_DBL * x + 1)));
+            w = -1 + p * (1 + p * ((T) -1/3 + p * (T) 11/72));
+            if (p > (T) -1e-3)
+                return w; /* Halley steps are ill-conditioned here */
+        } else {
+            T L1 = std::log(-x), L2 = std::log(-L1);
+            w = L1 - L2 + L2 / L1;
+        }
+        return lambertWHalley(x, w);
+    }
 }; /* namespace math */
 
 MTS_NAMESPACE_END
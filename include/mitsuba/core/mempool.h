@@ -34,31 +34,44 @@ MTS_NAMESPACE_BEGIN
  * \brief Basic memory pool for efficient allocation and deallocation
  * of objects of the same type.
  *
- * This class attempts to keep most instances contiguous in memory, while
- * having only minimal interaction with the underlying allocator.
+ * Entries are carved out of large contiguous slabs with a bump pointer,
+ * while released entries are kept on a free list and handed out again
+ * first. When all entries are no longer needed at once (e.g. at the end
+ * of a sample), \ref reset() releases everything in constant time and
+ * rewinds the bump pointer, so that subsequently allocated entries are
+ * again consecutive in memory. Entries are not constructed or destructed,
+ * hence \c T must be a plain data type.
  *
  * \ingroup libcore
  */
 template <typename T> class BasicMemoryPool {
 public:
     /// Create a new memory pool with an initial set of 128 entries
-    BasicMemoryPool(size_t nEntries = MTS_MEMPOOL_GRANULARITY) : m_size(0) {
+    BasicMemoryPool(size_t nEntries = MTS_MEMPOOL_GRANULARITY)
+        : m_size(0), m_used(0), m_slab(0), m_offset(0) {
         increaseCapacity(nEntries);
     }
 
     /// Destruct the memory pool and release all entries
     ~BasicMemoryPool() {
-        for (size_t i=0; i<m_cleanup.size(); ++i)
-            freeAligned(m_cleanup[i]);
+        for (size_t i=0; i<m_slabs.size(); ++i)
+            freeAligned(m_slabs[i].first);
     }
 
     /// Acquire an entry
     inline T *alloc() {
-        if (EXPECT_NOT_TAKEN(m_free.empty()))
-            increaseCapacity();
-        T *result = m_free.back();
-        m_free.pop_back();
-        return result;
+        ++m_used;
+        if (!m_free.empty()) {
+            T *result = m_free.back();
+            m_free.pop_back();
+            return result;
+        }
+        if (EXPECT_NOT_TAKEN(m_offset == m_slabs[m_slab].second)) {
+            if (++m_slab == m_slabs.size())
+                increaseCapacity();
+            m_offset = 0;
+        }
+        return m_slabs[m_slab].first + m_offset++;
     }
 
     void assertNotContained(T *ptr) {
@@ -76,6 +89,20 @@ public:
                 "inconsistency. Tried to release %s", ptr->toString().c_str());
 #endif
         m_free.push_back(ptr);
+        --m_used;
+    }
+
+    /**
+     * \brief Release all entries at once
+     *
+     * Any pointers to entries that were previously handed out
+     * become invalid.
+     */
+    inline void reset() {
+        m_free.clear();
+        m_used = 0;
+        m_slab = 0;
+        m_offset = 0;
     }
 
     /// Return the total size of the memory pool
@@ -85,27 +112,26 @@ public:
 
     /// Check if every entry has been released
     bool unused() const {
-        return m_free.size() == m_size;
+        return m_used == 0;
     }
 
     /// Return a human-readable description
     std::string toString() const {
         std::ostringstream oss;
-        oss << "BasicMemoryPool[size=" << m_size << ", free=" << m_free.size() << "]";
+        oss << "BasicMemoryPool[size=" << m_size << ", used=" << m_used << "]";
         return oss.str();
     }
 private:
     void increaseCapacity(size_t nEntries = MTS_MEMPOOL_GRANULARITY) {
         T *ptr = static_cast<T *>(allocAligned(sizeof(T) * nEntries));
-        for (size_t i=0; i<nEntries; ++i)
-            m_free.push_back(&ptr[i]);
-        m_cleanup.push_back(ptr);
+        m_slabs.push_back(std::make_pair(ptr, nEntries));
         m_size += nEntries;
     }
 private:
     std::vector<T *> m_free;
-    std::vector<T *> m_cleanup;
-    size_t m_size;
+    std::vector<std::pair<T *, size_t> > m_slabs;
+    size_t m_size, m_used;
+    size_t m_slab, m_offset;
 };
 
 MTS_NAMESPACE_END
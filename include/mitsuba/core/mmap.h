@@ -57,9 +57,28 @@ public:
     /// Return the associated filename
     const fs::path &getFilename() const;
 
+    /**
+     * \brief Rename the underlying file while keeping the mapping
+     *
+     * On POSIX systems, this atomically replaces any existing file of
+     * the same name. Processes that still have the replaced file mapped
+     * keep seeing its old contents.
+     */
+    void rename(const fs::path &filename);
+
     /// Return whether the mapped memory region is read-only
     bool isReadOnly() const;
 
+    /**
+     * \brief Release the physical memory backing the mapping
+     *
+     * The mapping stays valid: pages are transparently read back from the
+     * file when they are accessed again, hence this is safe even while
+     * other threads are reading. Not supported for copy-on-write mappings,
+     * whose modifications would be lost.
+     */
+    void evict() const;
+
     /// Return a string representation
     std::string toString() const;
 
@@ -71,6 +90,15 @@ public:
      */
     static ref<MemoryMappedFile> createTemporary(size_t size);
 
+    /**
+     * \brief Map the specified file into memory with copy-on-write
+     * semantics
+     *
+     * The mapped memory can be modified, but the changes are private
+     * to this process and never written back to the file.
+     */
+    static ref<MemoryMappedFile> createCopyOnWrite(const fs::path &filename);
+
     MTS_DECLARE_CLASS()
 protected:
     /// Internal constructor
@@ -44,6 +44,7 @@ public:
     inline void clear() {
         m_cdf.clear();
         m_cdf.push_back(0.0f);
+        m_alias.clear();
         m_normalized = false;
     }
 
@@ -55,6 +56,7 @@ public:
     /// Append an entry with the specified discrete probability
     inline void append(Float pdfValue) {
         m_cdf.push_back(m_cdf[m_cdf.size()-1] + pdfValue);
+        m_alias.clear();
     }
 
     /// Return the number of entries so far
@@ -100,6 +102,7 @@ public:
      */
     inline Float normalize() {
         SAssert(m_cdf.size() > 1);
+        m_alias.clear();
         m_sum = m_cdf[m_cdf.size()-1];
         if (m_sum > 0) {
             m_normalization = 1.0f / m_sum;
@@ -113,6 +116,71 @@ public:
         return m_sum;
     }
 
+    /**
+     * \brief Sample using Walker's alias method from now on
+     *
+     * Afterwards, \ref sample() and \ref sampleReuse() take constant time
+     * and read a single table entry instead of binary searching the CDF,
+     * which pays off for large distributions (e.g. the triangles of a mesh).
+     * Unlike the CDF inversion, the alias method does not map neighboring
+     * samples to neighboring entries, i.e. it does not preserve the
+     * stratification of the input samples across entries.
+     *
+     * The table is built in linear time (Vose's variant) and requires a
+     * normalized distribution. Any later modification discards it.
+     */
+    void buildAliasTable() {
+        SAssert(m_normalized && size() < 0xFFFFFFFFu);
+        uint32_t n = (uint32_t) size(), positive = 0;
+        std::vector<uint32_t> small, large;
+        std::vector<double> scaled(n);
+        m_alias.resize(n);
+
+        for (uint32_t i=0; i<n; ++i) {
+            Float pdf = operator[](i);
+            scaled[i] = (double) pdf * n;
+            if (scaled[i] < 1)
+                small.push_back(i);
+            else
+                large.push_back(i);
+            if (pdf > 0)
+                positive = i;
+            m_alias[i].pdf = pdf;
+        }
+
+        /* Pair entries with too little mass with ones that have too much */
+        while (!small.empty() && !large.empty()) {
+            uint32_t s = small.back(), l = large.back();
+            small.pop_back();
+            m_alias[s].prob = (Float) scaled[s];
+            m_alias[s].alias = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1;
+            if (scaled[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        /* Whatever is left over has a probability of one up to round-off,
+           except for empty entries, which must never be returned */
+        for (size_t i=0; i<large.size(); ++i) {
+            m_alias[large[i]].prob = 1;
+            m_alias[large[i]].alias = large[i];
+        }
+        for (size_t i=0; i<small.size(); ++i) {
+            AliasEntry &entry = m_alias[small[i]];
+            entry.prob = entry.pdf > 0 ? (Float) 1 : (Float) 0;
+            entry.alias = entry.pdf > 0 ? small[i] : positive;
+        }
+        for (uint32_t i=0; i<n; ++i)
+            m_alias[i].aliasPdf = m_alias[m_alias[i].alias].pdf;
+    }
+
+    /// Has an alias table been built (see \ref buildAliasTable())?
+    inline bool hasAliasTable() const {
+        return !m_alias.empty();
+    }
+
     /**
      * \brief %Transform a uniformly distributed sample to the stored distribution
      *
@@ -122,6 +190,9 @@ public:
      *     The discrete index associated with the sample
      */
     inline size_t sample(Float sampleValue) const {
+        if (!m_alias.empty())
+            return sampleAlias(sampleValue);
+
         std::vector<Float>::const_iterator entry =
                 std::lower_bound(m_cdf.begin(), m_cdf.end(), sampleValue);
         size_t index = std::min(m_cdf.size()-2,
@@ -146,6 +217,9 @@ public:
      *     The discrete index associated with the sample
      */
     inline size_t sample(Float sampleValue, Float &pdf) const {
+        if (!m_alias.empty())
+            return sampleAlias(sampleValue, pdf);
+
         size_t index = sample(sampleValue);
         pdf = operator[](index);
         return index;
@@ -162,6 +236,9 @@ public:
      *     The discrete index associated with the sample
      */
     inline size_t sampleReuse(Float &sampleValue) const {
+        if (!m_alias.empty())
+            return sampleAlias(sampleValue);
+
         size_t index = sample(sampleValue);
         sampleValue = (sampleValue - m_cdf[index])
             / (m_cdf[index + 1] - m_cdf[index]);
@@ -181,6 +258,9 @@ public:
      *     The discrete index associated with the sample
      */
     inline size_t sampleReuse(Float &sampleValue, Float &pdf) const {
+        if (!m_alias.empty())
+            return sampleAlias(sampleValue, pdf);
+
         size_t index = sample(sampleValue, pdf);
         sampleValue = (sampleValue - m_cdf[index])
             / (m_cdf[index + 1] - m_cdf[index]);
@@ -194,7 +274,8 @@ public:
     std::string toString() const {
         std::ostringstream oss;
         oss << "DiscreteDistribution[sum=" << m_sum << ", normalized="
-            << (int) m_normalized << ", cdf={";
+            << (int) m_normalized << ", alias=" << (int) hasAliasTable()
+            << ", cdf={";
         for (size_t i=0; i<m_cdf.size(); ++i) {
             oss << m_cdf[i];
             if (i != m_cdf.size()-1)
@@ -204,7 +285,40 @@ public:
         return oss.str();
     }
 private:
+    /// Alias table entry, which also caches the probabilities of both outcomes
+    struct AliasEntry {
+        Float prob;
+        uint32_t alias;
+        Float pdf, aliasPdf;
+    };
+
+    /// Alias method lookup, which rescales \c sampleValue for reuse
+    inline size_t sampleAlias(Float &sampleValue, Float &pdf) const {
+        size_t n = m_alias.size();
+        Float x = sampleValue * n;
+        size_t index = std::min((size_t) x, n - 1);
+        Float frac = x - index;
+        const AliasEntry &entry = m_alias[index];
+
+        if (frac < entry.prob || entry.prob == 1) {
+            sampleValue = frac / entry.prob;
+            pdf = entry.pdf;
+            return index;
+        } else {
+            sampleValue = (frac - entry.prob) / (1 - entry.prob);
+            pdf = entry.aliasPdf;
+            return entry.alias;
+        }
+    }
+
+    /// Alias method lookup, which rescales \c sampleValue for reuse
+    inline size_t sampleAlias(Float &sampleValue) const {
+        Float pdf;
+        return sampleAlias(sampleValue, pdf);
+    }
+
     std::vector<Float> m_cdf;
+    std::vector<AliasEntry> m_alias;
     Float m_sum, m_normalization;
     bool m_normalized;
 };
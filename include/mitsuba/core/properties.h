@@ -25,7 +25,7 @@
 
 MTS_NAMESPACE_BEGIN
 
-struct PropertyElement;
+struct PropertyStorage;
 
 /** \brief Associative parameter map for constructing
  * subclasses of \ref ConfigurableObject.
@@ -248,7 +248,7 @@ public:
     /// Return a string representation
     std::string toString() const;
 private:
-    std::map<std::string, PropertyElement> *m_elements;
+    PropertyStorage *m_elements;
     std::string m_pluginName, m_id;
 };
 
@@ -284,6 +284,48 @@ extern MTS_EXPORT_CORE Float radicalInverseFast(uint16_t baseIndex, uint64_t ind
 extern MTS_EXPORT_CORE Float scrambledRadicalInverseFast(uint16_t baseIndex,
         uint64_t index, uint16_t *perm);
 
+/**
+ * \brief Calculate the radical inverse function for a whole sequence of
+ * equally spaced indices
+ *
+ * This is equivalent to calling \ref radicalInverseFast() with the indices
+ * <tt>offset, offset + stride, .., offset + (count-1) * stride</tt>, but it
+ * is considerably faster: the digits of the index are updated incrementally
+ * instead of being recomputed with divisions.
+ *
+ * \param baseIndex
+ *    Prime number index starting at 0 (i.e. 3 would cause 7 to be
+ *    used as the basis)
+ * \param offset
+ *    First sequence index
+ * \param stride
+ *    Spacing of the sequence indices
+ * \param dest
+ *    Target array
+ * \param count
+ *    Number of values to compute
+ * \param destStride
+ *    Spacing of the entries in \c dest (e.g. 2 to fill one
+ *    component of an array of 2D points)
+ *
+ * \remark This function is not available in the Python API
+ */
+extern MTS_EXPORT_CORE void radicalInverseArray(uint16_t baseIndex,
+        uint64_t offset, uint64_t stride, Float *dest, size_t count,
+        size_t destStride = 1);
+
+/**
+ * \brief Scrambled version of \ref radicalInverseArray()
+ *
+ * Equivalent to calling \ref scrambledRadicalInverseFast() for every
+ * index of the sequence.
+ *
+ * \remark This function is not available in the Python API
+ */
+extern MTS_EXPORT_CORE void scrambledRadicalInverseArray(uint16_t baseIndex,
+        uint64_t offset, uint64_t stride, uint16_t *perm, Float *dest,
+        size_t count, size_t destStride = 1);
+
 //! @}
 // -----------------------------------------------------------------------
 
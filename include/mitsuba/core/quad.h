@@ -132,6 +132,7 @@ extern MTS_EXPORT_CORE void gaussLobatto(int n, Float *nodes, Float *weights);
 class MTS_EXPORT_CORE GaussLobattoIntegrator {
 public:
     typedef boost::function<Float (Float)> Integrand;
+    typedef boost::function<void (size_t, const Float *, Float *)> VectorizedIntegrand;
 
     /**
      * Initialize a Gauss-Lobatto integration scheme
@@ -165,6 +166,26 @@ public:
      */
     Float integrate(const Integrand &f, Float a, Float b,
         size_t *evals = NULL) const;
+
+    /**
+     * \brief Integrate the function \c f from \c a to \c b, evaluating
+     * the integrand in batches.
+     *
+     * The supplied function should have the interface
+     *
+     * <code>
+     * void integrand(size_t numPoints, const Float *in, Float *out);
+     * </code>
+     *
+     * and store the values at the \c numPoints abscissae \c in into
+     * \c out. Instead of recursing depth-first, this variant refines all
+     * unconverged intervals of one level at once, so that every call
+     * receives the five new abscissae of each of these intervals. The
+     * acceptance criterion is the same as in \ref integrate(), but the
+     * evaluation budget is spent level by level.
+     */
+    Float integrateVectorized(const VectorizedIntegrand &f, Float a, Float b,
+        size_t *evals = NULL) const;
 protected:
     /**
      * \brief Perform one step of the 4-point Gauss-Lobatto rule, then
@@ -187,6 +208,15 @@ protected:
      */
     Float calculateAbsTolerance(const boost::function<Float (Float)>& f,
         Float a, Float b, size_t &evals) const;
+
+    /**
+     * Compute the absolute error tolerance from the values \c y of
+     * the integrand at the 13 abscissae of \ref getToleranceNodes()
+     */
+    Float calculateAbsTolerance(const Float *y, Float h) const;
+
+    /// Return the 13 abscissae used by \ref calculateAbsTolerance()
+    void getToleranceNodes(Float a, Float b, Float *nodes) const;
 protected:
     Float m_absError, m_relError;
     size_t m_maxEvals;
@@ -292,9 +322,25 @@ public:
      */
     EResult integrateVectorized(const VectorizedIntegrand &f, const Float *min,
         const Float *max, Float *result, Float *error, size_t *evals = NULL) const;
+
+    /**
+     * \brief Enable or disable the parallel mode (disabled by default)
+     *
+     * In parallel mode, the integrator refines as many regions as possible
+     * in each step (also in \ref integrate()), and the resulting batches
+     * of abscissae are split across all OpenMP threads. The integrand must
+     * then be safe to call concurrently. When the integrator is invoked
+     * from within a parallel region, the batches are evaluated on the
+     * calling thread.
+     */
+    inline void setParallel(bool parallel) { m_parallel = parallel; }
+
+    /// Is the parallel mode enabled?
+    inline bool isParallel() const { return m_parallel; }
 protected:
     size_t m_fdim, m_dim, m_maxEvals;
     Float m_absError, m_relError;
+    bool m_parallel;
 };
 
 //! @}
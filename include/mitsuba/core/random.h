@@ -22,6 +22,7 @@
 
 #include <mitsuba/mitsuba.h>
 #include <mitsuba/core/cobject.h>
+#include <mitsuba/core/stream.h>
 
 /*
    SIMD oriented Fast Mersenne Twister (SFMT) pseudorandom number generator
@@ -137,6 +138,29 @@ public:
     /// Return a normally distributed value
     Float nextStandardNormal();
 
+    /**
+     * \brief Fill an array with floating point values on the [0, 1) interval
+     *
+     * Produces the same values as \c count calls to \ref nextFloat(), but
+     * converts whole blocks of the generator state at a time (using SSE2
+     * when available).
+     *
+     * \remark This function is currently not exposed
+     * by the Python bindings
+     */
+    void fillFloat(Float *dest, size_t count);
+
+    /**
+     * \brief Fill an array with points on the [0, 1)^2 square
+     *
+     * The coordinates are generated in the order <tt>x0, y0, x1, ...</tt>
+     * using \ref fillFloat().
+     *
+     * \remark This function is currently not exposed
+     * by the Python bindings
+     */
+    void fillPoint2(Point2 *dest, size_t count);
+
     /**
      * \brief Draw a uniformly distributed permutation and permute the
      * given STL container.
@@ -163,6 +187,96 @@ private:
     State *mt;
 };
 
+/**
+ * \brief Minimal PCG32 pseudorandom number generator
+ *
+ * Implements the \c XSH-RR variant of the permuted congruential
+ * generator by M. E. O'Neill ("PCG: A Family of Simple Fast
+ * Space-Efficient Statistically Good Algorithms for Random Number
+ * Generation"). In contrast to \ref Random, this is a plain value
+ * type with a 16 byte state whose functions are all inlined, which
+ * makes it a cheap per-thread generator for code that only needs
+ * uniform variates, e.g. a sampler's \c next1D() and \c next2D().
+ *
+ * Generators created with different \c initseq values produce
+ * independent streams.
+ *
+ * \remark This class is currently not exposed by the Python bindings
+ */
+class PCG32 {
+public:
+    /// Create a generator with the default state and stream
+    inline PCG32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+
+    /// Create a generator with a custom initial state and stream
+    inline PCG32(uint64_t initstate, uint64_t initseq) { seed(initstate, initseq); }
+
+    /// Unserialize a generator
+    inline PCG32(Stream *stream) {
+        m_state = stream->readULong();
+        m_inc = stream->readULong();
+    }
+
+    /// Seed the generator with an initial state and a stream index
+    inline void seed(uint64_t initstate, uint64_t initseq = 1) {
+        m_state = 0;
+        m_inc = (initseq << 1) | 1;
+        nextUInt();
+        m_state += initstate;
+        nextUInt();
+    }
+
+    /// Return a uniformly distributed 32 bit integer
+    inline uint32_t nextUInt() {
+        uint64_t oldstate = m_state;
+        m_state = oldstate * 0x5851f42d4c957f2dULL + m_inc;
+        uint32_t xorshifted = (uint32_t) (((oldstate >> 18) ^ oldstate) >> 27);
+        uint32_t rot = (uint32_t) (oldstate >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1) & 31));
+    }
+
+    /// Return a uniformly distributed 64 bit integer
+    inline uint64_t nextULong() {
+        uint64_t hi = nextUInt();
+        return (hi << 32) | nextUInt();
+    }
+
+    /// Return a floating point value on the [0, 1) interval
+    inline Float nextFloat() {
+        #if defined(DOUBLE_PRECISION)
+            union {
+                uint64_t u;
+                double d;
+            } x;
+            x.u = (nextULong() >> 12) | 0x3ff0000000000000ULL;
+            return x.d - 1.0;
+        #else
+            union {
+                uint32_t u;
+                float f;
+            } x;
+            x.u = (nextUInt() >> 9) | 0x3f800000UL;
+            return x.f - 1.0f;
+        #endif
+    }
+
+    /// Fill an array with floating point values on the [0, 1) interval
+    inline void fillFloat(Float *dest, size_t count) {
+        for (size_t i=0; i<count; ++i)
+            dest[i] = nextFloat();
+    }
+
+    /// Serialize the generator to a binary data stream
+    inline void serialize(Stream *stream) const {
+        stream->writeULong(m_state);
+        stream->writeULong(m_inc);
+    }
+
+private:
+    uint64_t m_state;
+    uint64_t m_inc;
+};
+
 
 MTS_NAMESPACE_END
 
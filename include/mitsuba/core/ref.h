@@ -34,6 +34,12 @@ MTS_NAMESPACE_BEGIN
  * the reference count of the object. When the last reference goes
  * out of scope, the associated object will be deallocated.
  *
+ * The reference count is updated atomically, which is expensive when
+ * many threads touch the same object (e.g. a BSDF shared by a large part
+ * of the scene). Rendering code should therefore only hold references
+ * in long-lived members and pass plain (borrowed) pointers otherwise,
+ * which is what accessors such as \ref Shape::getBSDF() return.
+ *
  * \author Wenzel Jakob
  * \ingroup libcore
  */
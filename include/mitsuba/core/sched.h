@@ -22,6 +22,7 @@
 
 #include <mitsuba/core/serialization.h>
 #include <mitsuba/core/lock.h>
+#include <mitsuba/core/statistics.h>
 #include <deque>
 
 /**
@@ -31,6 +32,61 @@
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * \brief Content hash of a part of a serialized resource
+ *
+ * Remote workers transfer resources in chunks whose boundaries are
+ * derived from the content (see \ref Scheduler::getResourceChunks()).
+ * Processing nodes with a \ref ResourceCache only receive the chunks
+ * that they don't have yet, e.g. the unchanged geometry of the next
+ * frame of an animation.
+ */
+struct ResourceChunk {
+    /// 128 bit hash of the chunk contents
+    uint64_t hash[2];
+    /// Position of the chunk within the resource stream
+    size_t offset;
+    /// Size of the chunk in bytes
+    size_t size;
+
+    /// Compute the hash of a block of memory
+    static void computeHash(const uint8_t *data, size_t size, uint64_t hash[2]);
+};
+
+/**
+ * \brief Scheduling telemetry of a single processed work unit
+ *
+ * All times are values of \ref readTimestampCounter(), which can be
+ * converted into seconds using \ref Statistics::getTicksPerSecond().
+ *
+ * For remote workers, \c started and \c finished refer to the time at
+ * which the work unit was submitted to the network and the time at which
+ * its result arrived. Since a remote node may process several units in
+ * parallel, these are matched to the results in submission order.
+ */
+struct WorkUnitTelemetry {
+    /// ID of the parallel process
+    int processID;
+    /// Index of the worker that processed the unit
+    int workerIndex;
+    /// Was the unit processed by a remote worker?
+    bool remote;
+    /// Generation of the work unit by \ref ParallelProcess::generateWork()
+    uint64_t generated;
+    /// Start of the processing (local) or submission (remote)
+    uint64_t started;
+    /// End of the processing (local) or arrival of the result (remote)
+    uint64_t finished;
+    /// Start and end of \ref ParallelProcess::processResult()
+    uint64_t mergeStarted, mergeFinished;
+    /// Serialized size of the work unit and result (remote only)
+    size_t bytesSent, bytesReceived;
+
+    inline WorkUnitTelemetry() : processID(-1), workerIndex(-1),
+        remote(false), generated(0), started(0), finished(0),
+        mergeStarted(0), mergeFinished(0), bytesSent(0), bytesReceived(0) { }
+};
+
 /**
  * \brief Abstract work unit -- represents a small amount of information
  * that encodes part of a larger processing task.
@@ -321,17 +377,65 @@ public:
      */
     virtual std::vector<std::string> getRequiredPlugins();
 
+    /**
+     * \brief Should the scheduler report \ref WorkUnitTelemetry
+     * to \ref recordTelemetry()?
+     *
+     * The default implementation returns false.
+     */
+    virtual bool isTelemetryEnabled() const;
+
+    /**
+     * \brief Called after a work result has been processed, when
+     * \ref isTelemetryEnabled() returns true
+     *
+     * Like \ref processResult(), this function may concurrently be
+     * executed by multiple threads. The default implementation
+     * does nothing.
+     */
+    virtual void recordTelemetry(const WorkResult *result,
+        const WorkUnitTelemetry &telemetry);
+
+    /**
+     * \brief Set the scheduling priority of this process (Default: 0)
+     *
+     * Whenever a worker requests a new work unit, the scheduler only
+     * considers the queued processes with the highest priority. A process
+     * with a lower priority is thus preempted at the next work unit
+     * boundary, e.g. when an interactive preview is scheduled while a
+     * batch render is running. May be changed at any time.
+     */
+    inline void setPriority(int priority) { m_priority = priority; }
+
+    /// Return the scheduling priority of this process
+    inline int getPriority() const { return m_priority; }
+
+    /**
+     * \brief Set the relative share of work units that this process
+     * receives when competing with processes of the same priority
+     * (Default: 1)
+     *
+     * The scheduler hands out work units so that the number of units
+     * dispatched per process is roughly proportional to this weight.
+     */
+    void setShareWeight(Float weight);
+
+    /// Return the fair-share weight of this process
+    inline Float getShareWeight() const { return m_shareWeight; }
+
     MTS_DECLARE_CLASS()
 protected:
     /// Protected constructor
     inline ParallelProcess() : m_returnStatus(EUnknown),
-        m_logLevel(EDebug) { }
+        m_logLevel(EDebug), m_priority(0), m_shareWeight(1) { }
     /// Virtual destructor
     virtual ~ParallelProcess() { }
 protected:
     ResourceBindings m_bindings;
     EStatus m_returnStatus;
     ELogLevel m_logLevel;
+    int m_priority;
+    Float m_shareWeight;
 };
 
 class Worker;
@@ -477,6 +581,35 @@ public:
     /// Is the scheduler currently executing work?
     bool isBusy() const;
 
+    /**
+     * \brief Enable or disable work stealing between local workers
+     *
+     * By default, every local worker obtains each work unit from the
+     * central queue, whose lock becomes a bottleneck when many cores
+     * process small work units. In work stealing mode, a local worker
+     * instead generates a small batch of work units at once (see
+     * \ref setStealBatchSize()), keeps the surplus in a private deque
+     * and only returns to the central queue once that deque is empty
+     * and there is nothing left to steal from the deques of the other
+     * local workers. Remote workers always use the central queue.
+     *
+     * May only be changed while the scheduler is not running.
+     */
+    void setWorkStealing(bool enabled);
+
+    /// Is work stealing between local workers enabled?
+    inline bool getWorkStealing() const { return m_workStealing; }
+
+    /**
+     * \brief Set the number of work units that a local worker generates
+     * whenever it acquires the central queue in work stealing mode
+     * (Default: 4)
+     */
+    void setStealBatchSize(int batchSize);
+
+    /// Return the number of work units generated per central queue access
+    inline int getStealBatchSize() const { return m_stealBatchSize; }
+
     /// Initialize the scheduler of this process -- called once in main()
     static void staticInitialization();
 
@@ -504,10 +637,12 @@ public:
         ref<WaitFlag> done;
         /* Log level for events associated with this process */
         ELogLevel logLevel;
+        /* Dispatched work units divided by the share weight */
+        double share;
 
         inline ProcessRecord(int id, ELogLevel logLevel, Mutex *mutex)
          : id(id), inflight(0), morework(true), cancelled(false),
-            active(true), logLevel(logLevel) {
+            active(true), logLevel(logLevel), share(0) {
             cond = new ConditionVariable(mutex);
             done = new WaitFlag();
         }
@@ -528,6 +663,7 @@ public:
         ref<WorkProcessor> wp;
         ref<WorkUnit> workUnit;
         ref<WorkResult> workResult;
+        WorkUnitTelemetry telemetry;
         bool stop;
 
         inline Item() : id(-1), workerIndex(-1), coreOffset(-1),
@@ -540,6 +676,7 @@ public:
     struct ResourceRecord {
         std::vector<SerializableObject *> resources;
         ref<MemoryStream> stream;
+        std::vector<ResourceChunk> chunks;
         int refCount;
         bool multi;
 
@@ -562,6 +699,28 @@ public:
         /// The scheduler is shutting down
         EStop
     };
+
+    /// Work unit waiting in the deque of a local worker
+    struct QueuedWork {
+        int id;
+        ProcessRecord *rec;
+        ref<WorkUnit> workUnit;
+        uint64_t generated;
+
+        inline QueuedWork(int id, ProcessRecord *rec, WorkUnit *workUnit,
+            uint64_t generated) : id(id), rec(rec), workUnit(workUnit),
+            generated(generated) { }
+    };
+
+    /// Per-worker deque used in work stealing mode
+    struct WorkQueue {
+        ref<Mutex> mutex;
+        std::deque<QueuedWork> units;
+        /* NUMA node of the owning worker (-1 if unknown) */
+        int numaNode;
+
+        inline WorkQueue() : mutex(new Mutex()), numaNode(-1) { }
+    };
     /// \endcond
 
     /// Look up a resource by ID & core index
@@ -570,6 +729,12 @@ public:
     /// Return a resource in the form of a binary data stream
     const MemoryStream *getResourceStream(int id);
 
+    /**
+     * \brief Return the content-defined chunks of the binary data
+     * stream of a resource (computed on first use)
+     */
+    const std::vector<ResourceChunk> &getResourceChunks(int id);
+
     /**
      * \brief Test whether this is a multi-resource,
      * i.e. different for every core.
@@ -588,13 +753,58 @@ protected:
      */
     EStatus acquireWork(Item &item, bool local, bool onlyTry, bool keepLock);
 
+    /**
+     * Generate a work unit from the process at the front of the given
+     * queue. Must be called while holding the main scheduler lock, which
+     * is still held upon return. When \c wakeOnQueued is set, the function
+     * also gives up with \c ENone when work units become available in the
+     * deques of the local workers.
+     */
+    EStatus generateWork(Item &item, bool local, bool onlyTry, bool wakeOnQueued);
+
+    /**
+     * Move the process that should provide the next work unit to the
+     * front of the given queue: the least-served process among those with
+     * the highest priority. The worker's current process (\c currentID)
+     * is kept while it is less than a scheduling quantum ahead, since
+     * switching processes requires preparing a new work processor.
+     */
+    void selectProcess(std::deque<int> &queue, int currentID);
+
+    /// Return the smallest share of all active processes (or zero)
+    double getMinimumShare() const;
+
+    /// Acquire a piece of work for a local worker in work stealing mode
+    EStatus acquireLocalWork(Item &item);
+
+    /**
+     * Take a work unit from the worker's own deque or steal one from
+     * another local worker. Returns \c false if all deques are empty.
+     */
+    bool popQueuedWork(Item &item);
+
+    /// Remove all queued work units of a cancelled process from the deques
+    void flushQueuedWork(ProcessRecord *rec);
+
+    /// Acquire the main scheduler lock and keep track of contention
+    void lockScheduler(UniqueLock &lock);
+
     /// Release the main scheduler lock -- internally used by the remote worker
     inline void releaseLock() { m_mutex->unlock(); }
 
     inline void releaseWork(Item &item) {
         ProcessRecord *rec = item.rec;
         try {
-            item.proc->processResult(item.workResult, item.stop);
+            if (EXPECT_NOT_TAKEN(item.proc->isTelemetryEnabled())) {
+                WorkUnitTelemetry &telemetry = item.telemetry;
+                telemetry.processID = item.id;
+                telemetry.mergeStarted = readTimestampCounter();
+                item.proc->processResult(item.workResult, item.stop);
+                telemetry.mergeFinished = readTimestampCounter();
+                item.proc->recordTelemetry(item.workResult, telemetry);
+            } else {
+                item.proc->processResult(item.workResult, item.stop);
+            }
         } catch (const std::exception &ex) {
             Log(EWarn, "Caught an exception - canceling process %i: %s",
                 item.id, ex.what());
@@ -652,7 +862,7 @@ private:
     mutable ref<Mutex> m_mutex;
     /// CV used to signal the availability of work
     ref<ConditionVariable> m_workAvailable;
-    /// Scheduled processes in FIFO order
+    /// Scheduled processes (in FIFO order among equal priority and share)
     std::deque<int> m_localQueue, m_remoteQueue;
     /// Set of all currently scheduled processes
     std::map<const ParallelProcess *, ProcessRecord *> m_processes;
@@ -662,8 +872,14 @@ private:
     std::map<int, ResourceRecord *> m_resources;
     /// List of all active workers
     std::vector<Worker *> m_workers;
+    /// Work unit deques of the local workers (work stealing mode)
+    std::vector<WorkQueue *> m_workQueues;
+    /// Total number of work units waiting in \c m_workQueues
+    volatile int32_t m_queuedWork;
     int m_resourceCounter, m_processCounter;
+    int m_stealBatchSize;
     bool m_running;
+    bool m_workStealing;
 };
 
 /**
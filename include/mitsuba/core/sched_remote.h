@@ -21,25 +21,104 @@
 #define __MITSUBA_CORE_SCHED_REMOTE_H_
 
 #include <mitsuba/core/sched.h>
+#include <boost/filesystem/path.hpp>
 #include <set>
+#include <map>
 
 /// Default port of <tt>mtssrv</tt>
 #define MTS_DEFAULT_PORT 7554
 
 /** How many work units should be sent to a remote worker
-   at a time? This is a multiple of the worker's core count */
+   at a time? This is a multiple of the worker's core count.
+   Once the number of work units in transit has dropped by one
+   core count, the worker continues sending batches of work
+   units (default value of \ref RemoteWorker's backlog) */
 #define MTS_BACKLOG_FACTOR 3
 
-/** Once the back log factor drops below this value (also a
-   multiple of the core size), the stream processor will
-   continue sending batches of work units */
-#define MTS_CONTINUE_FACTOR 2
+/** Payloads (resources, work results) below this size are
+   never compressed, even if compression was negotiated */
+#define MTS_COMPRESSION_THRESHOLD 1024
 
 MTS_NAMESPACE_BEGIN
 
 class RemoteWorkerReader;
 class StreamBackend;
 
+/**
+ * \brief Content-addressed cache of resource chunks on a processing node
+ *
+ * Keeps the chunks of the resources received by \ref StreamBackend
+ * instances across connections, so that the next render job (e.g. the
+ * next frame of an animation) only needs to transfer the parts of the
+ * scene that have changed. When a directory is specified, the chunks are
+ * stored there as files and the cache survives restarts of the server;
+ * otherwise, they are kept in memory.
+ *
+ * Once the total size exceeds the capacity, the least recently used
+ * chunks are evicted. Chunks that were advertised to a connected client
+ * are pinned and never evicted while the connection is open.
+ *
+ * \ingroup libcore
+ */
+class MTS_EXPORT_CORE ResourceCache : public Object {
+public:
+    /// Identifies a chunk by its 128 bit hash
+    typedef std::pair<uint64_t, uint64_t> Key;
+
+    /**
+     * \brief Create a new resource cache
+     *
+     * \param capacity
+     *    Maximum total size of the cached chunks in bytes
+     * \param directory
+     *    Directory for persistent storage (an empty path
+     *    keeps all chunks in memory)
+     */
+    ResourceCache(size_t capacity, const fs::path &directory = fs::path());
+
+    /// Pin all cached chunks and return their keys
+    void pinAll(std::vector<Key> &keys);
+
+    /// Add a chunk to the cache (it is returned pinned)
+    void put(const Key &key, const uint8_t *data, size_t size);
+
+    /// Append a chunk to the given stream (returns \c false if it is missing)
+    bool get(const Key &key, Stream *stream);
+
+    /// Release pinned chunks
+    void unpin(const std::vector<Key> &keys);
+
+    /// Return the total size of the cached chunks in bytes
+    inline size_t getSize() const { return m_size; }
+
+    /// Return the capacity of the cache in bytes
+    inline size_t getCapacity() const { return m_capacity; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~ResourceCache() { }
+
+    /// Remove unpinned chunks until the size is within the capacity
+    void evict();
+
+    /// Return the file name of a persistent chunk
+    fs::path getFilename(const Key &key) const;
+private:
+    struct Entry {
+        ref<MemoryStream> data;
+        size_t size;
+        uint64_t lastUse;
+        int pinCount;
+    };
+
+    ref<Mutex> m_mutex;
+    std::map<Key, Entry> m_entries;
+    fs::path m_directory;
+    size_t m_capacity, m_size;
+    uint64_t m_timestamp;
+};
+
 /**
  * \brief Acquires work from the scheduler and forwards
  * it to a processing node reachable through a \ref Stream.
@@ -53,12 +132,27 @@ public:
     /**
      * \brief Construct a new remote worker with the given name and
      * communication stream
+     *
+     * \param compression
+     *    Ask the node on the other side to exchange resources and work
+     *    results in compressed form
+     * \param backlog
+     *    Maximum number of work units in transit per remote core. Once
+     *    this many have been sent, the worker waits until one core's
+     *    worth of results has come back before sending more.
      */
-    RemoteWorker(const std::string &name, Stream *stream);
+    RemoteWorker(const std::string &name, Stream *stream,
+        bool compression = false, int backlog = MTS_BACKLOG_FACTOR);
 
     /// Return the name of the node on the other side
     inline const std::string &getNodeName() const { return m_nodeName; }
 
+    /// Was compression negotiated with the node on the other side?
+    inline bool isCompressed() const { return m_compression; }
+
+    /// Return the maximum number of work units in transit per remote core
+    inline int getBacklog() const { return m_backlog; }
+
     MTS_DECLARE_CLASS()
 protected:
     /// Virtual destructor
@@ -77,6 +171,15 @@ protected:
         m_inFlight--;
         m_finishCond->signal();
     }
+
+    /// Return the telemetry of the oldest work unit that is still in transit
+    inline void popSubmitted(WorkUnitTelemetry &telemetry) {
+        LockGuard lock(m_mutex);
+        if (!m_submitted.empty()) {
+            telemetry = m_submitted.front();
+            m_submitted.pop_front();
+        }
+    }
 protected:
     ref<Mutex> m_mutex;
     ref<ConditionVariable> m_finishCond;
@@ -90,7 +193,14 @@ protected:
     std::set<int> m_processes;
     std::set<std::string> m_plugins;
     std::string m_nodeName;
+    /* Telemetry of the work units in transit (in submission order) */
+    std::deque<WorkUnitTelemetry> m_submitted;
     size_t m_inFlight;
+    int m_backlog;
+    bool m_compression;
+    /* Chunks known to be cached by the remote node */
+    std::set<ResourceCache::Key> m_remoteChunks;
+    bool m_resourceCache;
 };
 
 /**
@@ -212,12 +322,25 @@ public:
      *    Stream used for communications
      * \param detach
      *    Should the associated thread be joinable or detach instead?
+     * \param cache
+     *    Optional cache that keeps resources across connections, so
+     *    that clients only need to send the parts they have not
+     *    sent before
      */
     StreamBackend(const std::string &name, Scheduler *scheduler,
-        const std::string &nodeName, Stream *stream, bool detach);
+        const std::string &nodeName, Stream *stream, bool detach,
+        ResourceCache *cache = NULL);
 
     MTS_DECLARE_CLASS()
 protected:
+    /// Feature flags negotiated when a connection is opened
+    enum ECapability {
+        /// Resources and work results are sent in compressed form
+        ECompression = 0x01,
+        /// Resources are sent in chunks, unless cached by the server
+        EResourceCache = 0x02
+    };
+
     enum EMessage {
         EUnknown = 0,
         ENewProcess,
@@ -233,6 +356,7 @@ protected:
         EResourceExpired,
         EQuit,
         EIncompatible,
+        ENewChunkedResource,
         EHello = 0x1bcd
     };
 
@@ -241,6 +365,24 @@ protected:
     virtual void run();
     void sendWorkResult(int id, const WorkResult *result, bool cancelled);
     void sendCancellation(int id, int numLost);
+
+    /**
+     * \brief Write a serialized payload (a resource or a work result)
+     * preceded by its size
+     *
+     * When \c compress is set, a flag announces whether the data that
+     * follows was compressed; payloads that are small or don't compress
+     * well are sent as they are.
+     */
+    static void writePayload(Stream *stream, const MemoryStream *payload,
+        bool compress);
+
+    /// \copydoc writePayload()
+    static void writePayload(Stream *stream, const uint8_t *data,
+        size_t size, bool compress);
+
+    /// Read a payload written by \ref writePayload()
+    static ref<MemoryStream> readPayload(Stream *stream, bool compress);
 private:
     Scheduler *m_scheduler;
     std::string m_nodeName;
@@ -249,7 +391,11 @@ private:
     std::map<int, RemoteProcess *> m_processes;
     std::map<int, int> m_resources;
     ref<Mutex> m_sendMutex;
+    ref<ResourceCache> m_cache;
+    /* Cached chunks pinned by this connection */
+    std::vector<ResourceCache::Key> m_pinned;
     bool m_detach;
+    bool m_compression;
 };
 
 MTS_NAMESPACE_END
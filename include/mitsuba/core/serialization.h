@@ -21,6 +21,7 @@
 #define __MITSUBA_CORE_SERIALIZATION_H_
 
 #include <mitsuba/mitsuba.h>
+#include <boost/unordered_map.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -84,8 +85,8 @@ private:
 private:
     unsigned int m_counter, m_lastID;
     std::vector<SerializableObject *> m_fullyAllocated;
-    std::map<unsigned int, SerializableObject *> m_idToObj;
-    std::map<const SerializableObject *, unsigned int> m_objToId;
+    boost::unordered_map<unsigned int, SerializableObject *> m_idToObj;
+    boost::unordered_map<const SerializableObject *, unsigned int> m_objToId;
 };
 
 MTS_NAMESPACE_END
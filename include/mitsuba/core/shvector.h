@@ -29,6 +29,10 @@ MTS_NAMESPACE_BEGIN
 /* Precompute normalization coefficients for the first 10 bands */
 #define SH_NORMTBL_SIZE 10
 
+/* Precompute the 90 degree rotation used by SHVector::rotate() for
+   the first 20 bands */
+#define SH_ROTTBL_SIZE 20
+
 struct SHVector;
 
 /**
@@ -242,6 +246,20 @@ public:
     /// Evaluate for a direction given in Cartesian coordinates
     Float eval(const Vector &v) const;
 
+    /// Evaluate for \c count directions given in Cartesian coordinates
+    void evalBatch(const Vector *v, Float *result, size_t count) const;
+
+    /**
+     * \brief Evaluate all basis functions of the first \c bands bands
+     * for a direction given in Cartesian coordinates
+     *
+     * The <tt>bands*bands</tt> values are written to \c basis in the same
+     * order as the coefficients of a SH vector. The associated Legendre
+     * polynomials and the azimuthal terms are computed with recurrences
+     * over all bands at once, which avoids trigonometric functions.
+     */
+    static void evalBasis(const Vector &v, int bands, Float *basis);
+
     /**
      * \brief Evaluate for a direction given in spherical coordinates.
      *
@@ -301,15 +319,14 @@ public:
         Float hExt = M_PI / res,
               hInt = (2*M_PI)/(res*2);
 
-        for (int l=0; l<m_bands; ++l)
-            for (int m=-l; m<=l; ++m)
-                operator()(l,m) = 0;
+        m_coeffs.setZero();
 
-        Float *sinPhi = (Float *) alloca(sizeof(Float)*m_bands),
-              *cosPhi = (Float *) alloca(sizeof(Float)*m_bands);
+        /* All bands are accumulated at once as a vector operation */
+        Eigen::Map<Eigen::Matrix<Float, Eigen::Dynamic, 1> > basis(
+            (Float *) alloca(sizeof(Float) * m_coeffs.size()), m_coeffs.size());
 
         for (int i=0; i<=res; ++i) {
-            Float theta = hExt*i, cosTheta = std::cos(theta);
+            Float theta = hExt*i;
             Float weightExt = (i & 1) ? 4.0f : 2.0f;
             if (i == 0 || i == res)
                 weightExt = 1.0f;
@@ -320,29 +337,17 @@ public:
                 if (j == 0 || j == 2*res)
                     weightInt = 1.0f;
 
-                for (int m=0; m<m_bands; ++m) {
-                    sinPhi[m] = std::sin((m+1)*phi);
-                    cosPhi[m] = std::cos((m+1)*phi);
-                }
-
-                Float value = f(sphericalDirection(theta, phi))*std::sin(theta)
-                    * weightExt*weightInt;
-
-                for (int l=0; l<m_bands; ++l) {
-                    for (int m=1; m<=l; ++m) {
-                        Float L = legendreP(l, m, cosTheta) * normalization(l, m);
-                        operator()(l, -m) += value * SQRT_TWO * sinPhi[m-1] * L;
-                        operator()(l, m) += value * SQRT_TWO * cosPhi[m-1] * L;
-                    }
+                Vector d = sphericalDirection(theta, phi);
+                Float value = f(d)*std::sin(theta) * weightExt*weightInt;
+                if (value == 0)
+                    continue;
 
-                    operator()(l, 0) += value * legendreP(l, 0, cosTheta) * normalization(l, 0);
-                }
+                evalBasis(d, m_bands, basis.data());
+                m_coeffs += value * basis;
             }
         }
 
-        for (int l=0; l<m_bands; ++l)
-            for (int m=-l; m<=l; ++m)
-                operator()(l,m) *= hExt*hInt/9;
+        m_coeffs *= hExt*hInt/9;
     }
 
     /// Compute the relative L2 error
@@ -398,6 +403,30 @@ public:
      */
     static void rotation(const Transform &t, SHRotation &rot);
 
+    /**
+     * \brief Rotate the represented function in place
+     *
+     * Produces the same result as applying the \ref SHRotation computed
+     * by \ref rotation(), but without constructing the rotation matrices.
+     * The rotation is decomposed into z-y-z Euler angles (\ref eulerZYZ()),
+     * and the rotation about the y axis is expressed as a z rotation
+     * between two fixed 90 degree rotations about the x axis (\a ZXZXZ).
+     * Rotations about z only mix the coefficient pairs (l, m) and (l, -m),
+     * hence this takes linear time in the number of coefficients apart
+     * from the two fixed rotations.
+     */
+    void rotate(const Transform &t);
+
+    /// Rotate in place, given z-y-z Euler angles in radians (see \ref eulerZYZ())
+    void rotateZYZ(Float alpha, Float beta, Float gamma);
+
+    /**
+     * \brief Decompose the rotation \c t into z-y-z Euler angles
+     * (in radians) so that
+     * <tt>t = rotate(Z, alpha) * rotate(Y, beta) * rotate(Z, gamma)</tt>
+     */
+    static void eulerZYZ(const Transform &t, Float &alpha, Float &beta, Float &gamma);
+
     /// Precomputes normalization coefficients for the first few bands
     static void staticInitialization();
 
@@ -409,10 +438,17 @@ protected:
 
     /// Compute a normalization coefficient
     static Float computeNormalization(int l, int m);
+
+    /// Helper function for rotateZYZ() -- rotate about the z axis
+    void rotateZ(Float angle);
+
+    /// Helper function for rotateZYZ() -- rotate by +/- 90 degrees about the x axis
+    void rotateX90(bool inverse);
 private:
     int m_bands;
     Eigen::Matrix<Float, Eigen::Dynamic, 1> m_coeffs;
     static Float *m_normalization;
+    static SHRotation *m_rotX90;
 };
 
 inline Float dot(const SHVector &v1, const SHVector &v2) {
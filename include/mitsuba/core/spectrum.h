@@ -21,6 +21,7 @@
 #define __MITSUBA_CORE_SPECTRUM_H_
 
 #include <mitsuba/mitsuba.h>
+#include <mitsuba/core/spectrum_sse.h>
 
 #if !defined(SPECTRUM_SAMPLES)
 #error The desired number of spectral samples must be \
@@ -296,6 +297,10 @@ template <typename T, int N> struct TSpectrum {
 public:
     typedef T          Scalar;
 
+    /// SIMD packet operations used by the arithmetic below
+    typedef detail::SpectrumPacket<T> Packet;
+    typedef typename Packet::Type     PacketType;
+
     /// Number of dimensions
     const static int dim = N;
 
@@ -333,39 +338,59 @@ public:
 
     /// Add two spectral power distributions
     inline TSpectrum operator+(const TSpectrum &spec) const {
-        TSpectrum value = *this;
-        for (int i=0; i<N; i++)
-            value.s[i] += spec.s[i];
+        TSpectrum value;
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            Packet::store(value.s + i, Packet::add(
+                Packet::load(s + i), Packet::load(spec.s + i)));
+        for (; i<N; i++)
+            value.s[i] = s[i] + spec.s[i];
         return value;
     }
 
     /// Add a spectral power distribution to this instance
     inline TSpectrum& operator+=(const TSpectrum &spec) {
-        for (int i=0; i<N; i++)
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            Packet::store(s + i, Packet::add(
+                Packet::load(s + i), Packet::load(spec.s + i)));
+        for (; i<N; i++)
             s[i] += spec.s[i];
         return *this;
     }
 
     /// Subtract a spectral power distribution
     inline TSpectrum operator-(const TSpectrum &spec) const {
-        TSpectrum value = *this;
-        for (int i=0; i<N; i++)
-            value.s[i] -= spec.s[i];
+        TSpectrum value;
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            Packet::store(value.s + i, Packet::sub(
+                Packet::load(s + i), Packet::load(spec.s + i)));
+        for (; i<N; i++)
+            value.s[i] = s[i] - spec.s[i];
         return value;
     }
 
     /// Subtract a spectral power distribution from this instance
     inline TSpectrum& operator-=(const TSpectrum &spec) {
-        for (int i=0; i<N; i++)
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            Packet::store(s + i, Packet::sub(
+                Packet::load(s + i), Packet::load(spec.s + i)));
+        for (; i<N; i++)
             s[i] -= spec.s[i];
         return *this;
     }
 
     /// Multiply by a scalar
     inline TSpectrum operator*(Scalar f) const {
-        TSpectrum value = *this;
-        for (int i=0; i<N; i++)
-            value.s[i] *= f;
+        TSpectrum value;
+        PacketType factor = Packet::set1(f);
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            Packet::store(value.s + i, Packet::mul(Packet::load(s + i), factor));
+        for (; i<N; i++)
+            value.s[i] = s[i] * f;
         return value;
     }
 
@@ -376,52 +401,68 @@ public:
 
     /// Multiply by a scalar
     inline TSpectrum& operator*=(Scalar f) {
-        for (int i=0; i<N; i++)
+        PacketType factor = Packet::set1(f);
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            Packet::store(s + i, Packet::mul(Packet::load(s + i), factor));
+        for (; i<N; i++)
             s[i] *= f;
         return *this;
     }
 
     /// Perform a component-wise multiplication by another spectrum
     inline TSpectrum operator*(const TSpectrum &spec) const {
-        TSpectrum value = *this;
-        for (int i=0; i<N; i++)
-            value.s[i] *= spec.s[i];
+        TSpectrum value;
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            Packet::store(value.s + i, Packet::mul(
+                Packet::load(s + i), Packet::load(spec.s + i)));
+        for (; i<N; i++)
+            value.s[i] = s[i] * spec.s[i];
         return value;
     }
 
     /// Perform a component-wise multiplication by another spectrum
     inline TSpectrum& operator*=(const TSpectrum &spec) {
-        for (int i=0; i<N; i++)
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            Packet::store(s + i, Packet::mul(
+                Packet::load(s + i), Packet::load(spec.s + i)));
+        for (; i<N; i++)
             s[i] *= spec.s[i];
         return *this;
     }
 
     /// Perform a component-wise division by another spectrum
     inline TSpectrum& operator/=(const TSpectrum &spec) {
-        for (int i=0; i<N; i++)
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            Packet::store(s + i, Packet::div(
+                Packet::load(s + i), Packet::load(spec.s + i)));
+        for (; i<N; i++)
             s[i] /= spec.s[i];
         return *this;
     }
 
     /// Perform a component-wise division by another spectrum
     inline TSpectrum operator/(const TSpectrum &spec) const {
-        TSpectrum value = *this;
-        for (int i=0; i<N; i++)
-            value.s[i] /= spec.s[i];
+        TSpectrum value;
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            Packet::store(value.s + i, Packet::div(
+                Packet::load(s + i), Packet::load(spec.s + i)));
+        for (; i<N; i++)
+            value.s[i] = s[i] / spec.s[i];
         return value;
     }
 
     /// Divide by a scalar
     inline TSpectrum operator/(Scalar f) const {
-        TSpectrum value = *this;
-#ifdef MTS_DEBUG
+#ifdef MTS_DEBUG_HOTPATH
         if (f == 0)
             SLog(EWarn, "TSpectrum: Division by zero!");
 #endif
-        Scalar recip = 1.0f / f;
-        for (int i=0; i<N; i++)
-            value.s[i] *= recip;
-        return value;
+        return *this * ((Scalar) 1.0f / f);
     }
 
     /// Equality test
@@ -445,14 +486,11 @@ public:
 
     /// Divide by a scalar
     inline TSpectrum& operator/=(Scalar f) {
-#ifdef MTS_DEBUG
+#ifdef MTS_DEBUG_HOTPATH
         if (f == 0)
             SLog(EWarn, "TTSpectrum: Division by zero!");
 #endif
-        Scalar recip = 1.0f / f;
-        for (int i=0; i<N; i++)
-            s[i] *= recip;
-        return *this;
+        return operator*=((Scalar) 1.0f / f);
     }
 
     /// Check for NaNs
@@ -481,14 +519,23 @@ public:
 
     /// Multiply-accumulate operation, adds \a weight * \a spec
     inline void addWeighted(Scalar weight, const TSpectrum &spec) {
-        for (int i=0; i<N; i++)
+        PacketType w = Packet::set1(weight);
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            Packet::store(s + i, Packet::add(Packet::load(s + i),
+                Packet::mul(w, Packet::load(spec.s + i))));
+        for (; i<N; i++)
             s[i] += weight * spec.s[i];
     }
 
     /// Return the average over all wavelengths
     inline Scalar average() const {
-        Scalar result = 0.0f;
-        for (int i=0; i<N; i++)
+        PacketType sum = Packet::zero();
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            sum = Packet::add(sum, Packet::load(s + i));
+        Scalar result = Packet::sum(sum);
+        for (; i<N; i++)
             result += s[i];
         return result * (1.0f / N);
     }
@@ -517,7 +564,10 @@ public:
     /// Component-wise square root
     inline TSpectrum sqrt() const {
         TSpectrum value;
-        for (int i=0; i<N; i++)
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            Packet::store(value.s + i, Packet::sqrt(Packet::load(s + i)));
+        for (; i<N; i++)
             value.s[i] = std::sqrt(s[i]);
         return value;
     }
@@ -541,7 +591,10 @@ public:
     /// Component-wise exponentation
     inline TSpectrum exp() const {
         TSpectrum value;
-        for (int i=0; i<N; i++)
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width)
+            Packet::store(value.s + i, Packet::exp(Packet::load(s + i)));
+        for (; i<N; i++)
             value.s[i] = math::fastexp(s[i]);
         return value;
     }
@@ -562,8 +615,18 @@ public:
 
     /// Return the highest-valued spectral sample
     inline Scalar max() const {
-        Scalar result = s[0];
-        for (int i=1; i<N; i++)
+        Scalar result;
+        int i;
+        if (N >= Packet::Width) {
+            PacketType value = Packet::load(s);
+            for (i = Packet::Width; i + Packet::Width <= N; i += Packet::Width)
+                value = Packet::max(value, Packet::load(s + i));
+            result = Packet::hmax(value);
+        } else {
+            result = s[0];
+            i = 1;
+        }
+        for (; i<N; i++)
             result = std::max(result, s[i]);
         return result;
     }
@@ -604,7 +667,12 @@ public:
 
     /// Check if this spectrum is zero at all wavelengths
     inline bool isZero() const {
-        for (int i=0; i<N; i++) {
+        int i = 0;
+        for (; i + Packet::Width <= N; i += Packet::Width) {
+            if (Packet::nonZero(Packet::load(s + i)))
+                return false;
+        }
+        for (; i<N; i++) {
             if (s[i] != 0.0f)
                 return false;
         }
@@ -0,0 +1,272 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_CORE_SPECTRUM_SSE_H_)
+#define __MITSUBA_CORE_SPECTRUM_SSE_H_
+
+#include <mitsuba/core/platform.h>
+
+/* The packet versions only need SSE2, which every x86-64 compiler
+   enables by default. This includes the double precision builds,
+   which don't define MTS_SSE */
+#if defined(__SSE2__) || defined(_M_X64) || defined(MTS_SSE)
+#define MTS_SSE_SPECTRUM 1
+#include <emmintrin.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#if defined(MTS_SSE)
+#include <mitsuba/core/ssemath.h>
+#endif
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+namespace detail {
+    /**
+     * \brief Packet operations used by the arithmetic of \ref TSpectrum
+     *
+     * The generic version processes a single sample at a time. The
+     * specializations for \c float and \c double process 4/8 or 2/4
+     * samples per instruction depending on whether SSE2 or AVX is enabled
+     * at compile time. \ref TSpectrum handles the samples that don't fill
+     * an entire packet with scalar code, hence RGB spectra are unaffected.
+     * All memory accesses are unaligned.
+     */
+    template <typename T> struct SpectrumPacket {
+        typedef T Type;
+        enum { Width = 1 };
+
+        static inline Type load(const T *ptr) { return *ptr; }
+        static inline void store(T *ptr, Type a) { *ptr = a; }
+        static inline Type set1(T value) { return value; }
+        static inline Type zero() { return (T) 0; }
+        static inline Type add(Type a, Type b) { return a + b; }
+        static inline Type sub(Type a, Type b) { return a - b; }
+        static inline Type mul(Type a, Type b) { return a * b; }
+        static inline Type div(Type a, Type b) { return a / b; }
+        static inline Type max(Type a, Type b) { return std::max(a, b); }
+        static inline Type sqrt(Type a) { return std::sqrt(a); }
+        static inline Type exp(Type a) { return math::fastexp(a); }
+        static inline bool nonZero(Type a) { return a != 0; }
+        static inline T sum(Type a) { return a; }
+        static inline T hmax(Type a) { return a; }
+    };
+
+#if defined(MTS_SSE_SPECTRUM)
+#if defined(MTS_SSE)
+    /**
+     * \brief \ref math::exp_ps() with the IEEE behavior outside of its range
+     *
+     * exp_ps() clamps its argument to [-88.38, 88.38]. This restores exact
+     * zeros on underflow (e.g. the transmittance over an infinite distance),
+     * infinities on overflow, and propagates NaNs.
+     */
+    inline __m128 exp_ps_full(__m128 a) {
+        const __m128 lo = _mm_set1_ps(-88.3762626647949f),
+                     hi = _mm_set1_ps(88.3762626647949f);
+        __m128 result = math::exp_ps(a);
+        result = _mm_andnot_ps(_mm_cmplt_ps(a, lo), result);
+        __m128 overflow = _mm_cmpgt_ps(a, hi);
+        result = _mm_or_ps(_mm_andnot_ps(overflow, result), _mm_and_ps(overflow,
+            _mm_set1_ps(std::numeric_limits<float>::infinity())));
+        __m128 nan = _mm_cmpunord_ps(a, a);
+        return _mm_or_ps(_mm_and_ps(nan, a), _mm_andnot_ps(nan, result));
+    }
+#endif
+
+#if defined(__AVX__)
+    template <> struct SpectrumPacket<float> {
+        typedef __m256 Type;
+        enum { Width = 8 };
+
+        static inline Type load(const float *ptr) { return _mm256_loadu_ps(ptr); }
+        static inline void store(float *ptr, Type a) { _mm256_storeu_ps(ptr, a); }
+        static inline Type set1(float value) { return _mm256_set1_ps(value); }
+        static inline Type zero() { return _mm256_setzero_ps(); }
+        static inline Type add(Type a, Type b) { return _mm256_add_ps(a, b); }
+        static inline Type sub(Type a, Type b) { return _mm256_sub_ps(a, b); }
+        static inline Type mul(Type a, Type b) { return _mm256_mul_ps(a, b); }
+        static inline Type div(Type a, Type b) { return _mm256_div_ps(a, b); }
+        static inline Type max(Type a, Type b) { return _mm256_max_ps(a, b); }
+        static inline Type sqrt(Type a) { return _mm256_sqrt_ps(a); }
+
+#if defined(MTS_SSE)
+        static inline Type exp(Type a) {
+            return _mm256_insertf128_ps(_mm256_castps128_ps256(
+                exp_ps_full(_mm256_castps256_ps128(a))),
+                exp_ps_full(_mm256_extractf128_ps(a, 1)), 1);
+        }
+#else
+        static inline Type exp(Type a) {
+            float temp[8];
+            _mm256_storeu_ps(temp, a);
+            for (int i=0; i<8; ++i)
+                temp[i] = math::fastexp(temp[i]);
+            return _mm256_loadu_ps(temp);
+        }
+#endif
+
+        static inline bool nonZero(Type a) {
+            return _mm256_movemask_ps(_mm256_cmp_ps(a,
+                _mm256_setzero_ps(), _CMP_NEQ_UQ)) != 0;
+        }
+
+        static inline float sum(Type a) {
+            __m128 t = _mm_add_ps(_mm256_castps256_ps128(a),
+                _mm256_extractf128_ps(a, 1));
+            t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+            t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+            return _mm_cvtss_f32(t);
+        }
+
+        static inline float hmax(Type a) {
+            __m128 t = _mm_max_ps(_mm256_castps256_ps128(a),
+                _mm256_extractf128_ps(a, 1));
+            t = _mm_max_ps(t, _mm_movehl_ps(t, t));
+            t = _mm_max_ss(t, _mm_shuffle_ps(t, t, 1));
+            return _mm_cvtss_f32(t);
+        }
+    };
+
+    template <> struct SpectrumPacket<double> {
+        typedef __m256d Type;
+        enum { Width = 4 };
+
+        static inline Type load(const double *ptr) { return _mm256_loadu_pd(ptr); }
+        static inline void store(double *ptr, Type a) { _mm256_storeu_pd(ptr, a); }
+        static inline Type set1(double value) { return _mm256_set1_pd(value); }
+        static inline Type zero() { return _mm256_setzero_pd(); }
+        static inline Type add(Type a, Type b) { return _mm256_add_pd(a, b); }
+        static inline Type sub(Type a, Type b) { return _mm256_sub_pd(a, b); }
+        static inline Type mul(Type a, Type b) { return _mm256_mul_pd(a, b); }
+        static inline Type div(Type a, Type b) { return _mm256_div_pd(a, b); }
+        static inline Type max(Type a, Type b) { return _mm256_max_pd(a, b); }
+        static inline Type sqrt(Type a) { return _mm256_sqrt_pd(a); }
+
+        static inline Type exp(Type a) {
+            double temp[4];
+            _mm256_storeu_pd(temp, a);
+            for (int i=0; i<4; ++i)
+                temp[i] = math::fastexp(temp[i]);
+            return _mm256_loadu_pd(temp);
+        }
+
+        static inline bool nonZero(Type a) {
+            return _mm256_movemask_pd(_mm256_cmp_pd(a,
+                _mm256_setzero_pd(), _CMP_NEQ_UQ)) != 0;
+        }
+
+        static inline double sum(Type a) {
+            __m128d t = _mm_add_pd(_mm256_castpd256_pd128(a),
+                _mm256_extractf128_pd(a, 1));
+            return _mm_cvtsd_f64(_mm_add_sd(t, _mm_unpackhi_pd(t, t)));
+        }
+
+        static inline double hmax(Type a) {
+            __m128d t = _mm_max_pd(_mm256_castpd256_pd128(a),
+                _mm256_extractf128_pd(a, 1));
+            return _mm_cvtsd_f64(_mm_max_sd(t, _mm_unpackhi_pd(t, t)));
+        }
+    };
+#else
+    template <> struct SpectrumPacket<float> {
+        typedef __m128 Type;
+        enum { Width = 4 };
+
+        static inline Type load(const float *ptr) { return _mm_loadu_ps(ptr); }
+        static inline void store(float *ptr, Type a) { _mm_storeu_ps(ptr, a); }
+        static inline Type set1(float value) { return _mm_set1_ps(value); }
+        static inline Type zero() { return _mm_setzero_ps(); }
+        static inline Type add(Type a, Type b) { return _mm_add_ps(a, b); }
+        static inline Type sub(Type a, Type b) { return _mm_sub_ps(a, b); }
+        static inline Type mul(Type a, Type b) { return _mm_mul_ps(a, b); }
+        static inline Type div(Type a, Type b) { return _mm_div_ps(a, b); }
+        static inline Type max(Type a, Type b) { return _mm_max_ps(a, b); }
+        static inline Type sqrt(Type a) { return _mm_sqrt_ps(a); }
+
+#if defined(MTS_SSE)
+        static inline Type exp(Type a) { return exp_ps_full(a); }
+#else
+        static inline Type exp(Type a) {
+            float temp[4];
+            _mm_storeu_ps(temp, a);
+            for (int i=0; i<4; ++i)
+                temp[i] = math::fastexp(temp[i]);
+            return _mm_loadu_ps(temp);
+        }
+#endif
+
+        static inline bool nonZero(Type a) {
+            return _mm_movemask_ps(_mm_cmpneq_ps(a, _mm_setzero_ps())) != 0;
+        }
+
+        static inline float sum(Type a) {
+            __m128 t = _mm_add_ps(a, _mm_movehl_ps(a, a));
+            t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+            return _mm_cvtss_f32(t);
+        }
+
+        static inline float hmax(Type a) {
+            __m128 t = _mm_max_ps(a, _mm_movehl_ps(a, a));
+            t = _mm_max_ss(t, _mm_shuffle_ps(t, t, 1));
+            return _mm_cvtss_f32(t);
+        }
+    };
+
+    template <> struct SpectrumPacket<double> {
+        typedef __m128d Type;
+        enum { Width = 2 };
+
+        static inline Type load(const double *ptr) { return _mm_loadu_pd(ptr); }
+        static inline void store(double *ptr, Type a) { _mm_storeu_pd(ptr, a); }
+        static inline Type set1(double value) { return _mm_set1_pd(value); }
+        static inline Type zero() { return _mm_setzero_pd(); }
+        static inline Type add(Type a, Type b) { return _mm_add_pd(a, b); }
+        static inline Type sub(Type a, Type b) { return _mm_sub_pd(a, b); }
+        static inline Type mul(Type a, Type b) { return _mm_mul_pd(a, b); }
+        static inline Type div(Type a, Type b) { return _mm_div_pd(a, b); }
+        static inline Type max(Type a, Type b) { return _mm_max_pd(a, b); }
+        static inline Type sqrt(Type a) { return _mm_sqrt_pd(a); }
+
+        static inline Type exp(Type a) {
+            double temp[2];
+            _mm_storeu_pd(temp, a);
+            return _mm_set_pd(math::fastexp(temp[1]), math::fastexp(temp[0]));
+        }
+
+        static inline bool nonZero(Type a) {
+            return _mm_movemask_pd(_mm_cmpneq_pd(a, _mm_setzero_pd())) != 0;
+        }
+
+        static inline double sum(Type a) {
+            return _mm_cvtsd_f64(_mm_add_sd(a, _mm_unpackhi_pd(a, a)));
+        }
+
+        static inline double hmax(Type a) {
+            return _mm_cvtsd_f64(_mm_max_sd(a, _mm_unpackhi_pd(a, a)));
+        }
+    };
+#endif
+#endif
+}
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_CORE_SPECTRUM_SSE_H_ */
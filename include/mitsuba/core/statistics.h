@@ -38,19 +38,6 @@ MTS_NAMESPACE_BEGIN
 /// Size (in characters) of the console-based progress message
 #define PROGRESS_MSG_SIZE 56
 
-/**
- * Specifies the number of internal counters associated with each
- * \ref StatsCounter instance.
- *
- * This is needed for SMP/ccNUMA systems where different processors might
- * be contending for a cache line containing a counter. The solution used
- * here tries to ensure that every processor has  its own local counter.
- */
-#define NUM_COUNTERS       128   // Must be a power of 2
-
-/// Bitmask for \ref NUM_COUNTERS
-#define NUM_COUNTERS_MASK (NUM_COUNTERS-1)
-
 /// Determines the multiples (e.g. 1000, 1024) and units of a \ref StatsCounter
 enum EStatsType {
     ENumberValue = 0, ///< Simple unitless number, e.g. # of rays
@@ -58,7 +45,8 @@ enum EStatsType {
     EPercentage,      ///< Percentage with respect to a base counter
     EMinimumValue,    ///< Minimum observed value of some quantity
     EMaximumValue,    ///< Maximum observed value of some quantity
-    EAverage          ///< Average value with respect to a base counter
+    EAverage,         ///< Average value with respect to a base counter
+    ETimeValue        ///< Processor time in cycles, the base counter holds the number of calls
 };
 
 #if (defined(_WIN32) && !defined(_WIN64)) || (defined(__POWERPC__) && !defined(_LP64))
@@ -66,22 +54,47 @@ enum EStatsType {
 #endif
 
 /**
- * \brief Counter data structure, which is suitable for ccNUMA/SMP machines
+ * \brief Storage of a \ref StatsCounter that is private to one thread
  *
- * This counter takes up at least one cache line to reduce false sharing.
+ * Slots are created lazily when a thread first touches a counter. They
+ * are allocated from cache-line-aligned blocks that belong to the thread,
+ * hence different threads never write to the same cache line. All slots
+ * of a counter are chained into a list, which is walked when the counter
+ * value is queried.
  */
-struct CacheLineCounter {
+struct StatsCounterSlot {
 #if MTS_32BIT_COUNTERS == 1
     // WIN32 & Darwin (PPC/32) don't support atomic 64 bit increment operations
     // -> restrict counters to 32bit :(
     uint32_t value;
-    uint32_t unused2;
+    uint32_t base;
 #else
     uint64_t value;
+    uint64_t base;
 #endif
-    char unused[120];
+    StatsCounterSlot *next;
 };
 
+/**
+ * \brief Read the processor's time stamp counter
+ *
+ * The counter is used for low-overhead timing measurements (see
+ * \ref ScopedStatsTimer) and is converted into seconds using
+ * \ref Statistics::getTicksPerSecond(). On platforms without such
+ * a counter, this function returns zero.
+ */
+inline uint64_t readTimestampCounter() {
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+    return __rdtsc();
+#elif defined(__i386__) || defined(__amd64__)
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t) hi << 32) | lo;
+#else
+    return 0;
+#endif
+}
+
 /** \brief General-purpose statistics counter
  *
  * This class implements a simple counter, which can be used to track various
@@ -100,7 +113,7 @@ public:
      * \param name     Name of the counter when shown in the statistics summary
      * \param type     Characterization of the quantity that will be measured
      * \param initial  Initial value of the counter
-     * \param base     Initial value of the base counter (only for <tt>type == EPercentage</tt> and <tt>EAverage</tt>)
+     * \param base     Initial value of the base counter (only for <tt>type == EPercentage</tt>, <tt>EAverage</tt> and <tt>ETimeValue</tt>)
      */
     StatsCounter(const std::string &category, const std::string &name,
         EStatsType type = ENumberValue, uint64_t initial = 0L, uint64_t base = 0L);
@@ -114,17 +127,17 @@ public:
         // do nothing
         return 0;
 #elif defined(_MSC_VER) && defined(_WIN64)
-        const int offset = Thread::getID() & NUM_COUNTERS_MASK;
-        _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&m_value[offset].value), 1);
-        return m_value[offset].value;
+        StatsCounterSlot *slot = getSlot();
+        _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&slot->value), 1);
+        return slot->value;
 #elif defined(_MSC_VER) && defined(_WIN32)
-        const int offset = Thread::getID() & NUM_COUNTERS_MASK;
-        _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&m_value[offset].value), 1);
-        return m_value[offset].value;
+        StatsCounterSlot *slot = getSlot();
+        _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&slot->value), 1);
+        return slot->value;
 #elif defined(__POWERPC__) && !defined(_LP64)
-        return (uint64_t) __sync_fetch_and_add(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value, 1);
+        return (uint64_t) __sync_fetch_and_add(&getSlot()->value, 1);
 #else
-        return __sync_fetch_and_add(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value, 1);
+        return __sync_fetch_and_add(&getSlot()->value, 1);
 #endif
     }
 
@@ -133,24 +146,24 @@ public:
 #ifdef MTS_NO_STATISTICS
         /// do nothing
 #elif defined(_MSC_VER) && defined(_WIN64)
-        _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
+        _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&getSlot()->value), amount);
 #elif defined(_MSC_VER) && defined(_WIN32)
-        _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
+        _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&getSlot()->value), amount);
 #else
-        __sync_fetch_and_add(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value, amount);
+        __sync_fetch_and_add(&getSlot()->value, amount);
 #endif
     }
 
-    /// Increment the base counter by the specified amount (only for use with EPercentage/EAverage)
+    /// Increment the base counter by the specified amount (only for use with EPercentage/EAverage/ETimeValue)
     inline void incrementBase(size_t amount = 1) {
 #ifdef MTS_NO_STATISTICS
         /// do nothing
 #elif defined(_MSC_VER) && defined(_WIN64)
-        _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&m_base[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
+        _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&getSlot()->base), amount);
 #elif defined(_WIN32)
-        _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&m_base[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
+        _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&getSlot()->base), amount);
 #else
-        __sync_fetch_and_add(&m_base[Thread::getID() & NUM_COUNTERS_MASK].value, amount);
+        __sync_fetch_and_add(&getSlot()->base, amount);
 #endif
     }
 
@@ -159,15 +172,14 @@ public:
      * an observation of the quantity whose minimum is to be determined
      */
     inline void recordMinimum(size_t value) {
-        int id = Thread::getID() & NUM_COUNTERS_MASK;
         #if MTS_32BIT_COUNTERS == 1
             volatile int32_t *ptr =
-                (volatile int32_t *) &m_value[id].value;
+                (volatile int32_t *) &getSlot()->value;
             int32_t curMinimum;
             int32_t newMinimum = (int32_t) value;
         #else
             volatile int64_t *ptr =
-                (volatile int64_t *) &m_value[id].value;
+                (volatile int64_t *) &getSlot()->value;
             int64_t curMinimum;
             int64_t newMinimum = (int64_t) value;
         #endif
@@ -187,15 +199,14 @@ public:
      * an observation of the quantity whose maximum is to be determined
      */
     inline void recordMaximum(size_t value) {
-        int id = Thread::getID() & NUM_COUNTERS_MASK;
         #if MTS_32BIT_COUNTERS == 1
             volatile int32_t *ptr =
-                (volatile int32_t *) &m_value[id].value;
+                (volatile int32_t *) &getSlot()->value;
             int32_t curMaximum;
             int32_t newMaximum = (int32_t) value;
         #else
             volatile int64_t *ptr =
-                (volatile int64_t *) &m_value[id].value;
+                (volatile int64_t *) &getSlot()->value;
             int64_t curMaximum;
             int64_t newMaximum = (int64_t) value;
         #endif
@@ -227,22 +238,22 @@ public:
 #else
     inline uint64_t getValue() const {
         uint64_t result = 0;
-        for (int i=0; i<NUM_COUNTERS; ++i)
-            result += m_value[i].value;
+        for (const StatsCounterSlot *slot = m_slots; slot; slot = slot->next)
+            result += slot->value;
         return result;
     }
 
     inline uint64_t getMinimum() const {
-        uint64_t result = 0;
-        for (int i=0; i<NUM_COUNTERS; ++i)
-            result = std::min(static_cast<uint64_t>(m_value[i].value), result);
+        uint64_t result = m_slots->value;
+        for (const StatsCounterSlot *slot = m_slots; slot; slot = slot->next)
+            result = std::min(static_cast<uint64_t>(slot->value), result);
         return result;
     }
 
     inline uint64_t getMaximum() const {
-        uint64_t result = 0;
-        for (int i=0; i<NUM_COUNTERS; ++i)
-            result = std::max(static_cast<uint64_t>(m_value[i].value), result);
+        uint64_t result = m_slots->value;
+        for (const StatsCounterSlot *slot = m_slots; slot; slot = slot->next)
+            result = std::max(static_cast<uint64_t>(slot->value), result);
         return result;
     }
 #endif
@@ -253,27 +264,80 @@ public:
 #else
     inline uint64_t getBase() const {
         uint64_t result = 0;
-        for (int i=0; i<NUM_COUNTERS; ++i)
-            result += m_base[i].value;
+        for (const StatsCounterSlot *slot = m_slots; slot; slot = slot->next)
+            result += slot->base;
         return result;
     }
 #endif
 
     /// Reset the stored counter values
     inline void reset() {
-        for (int i=0; i<NUM_COUNTERS; ++i) {
-            m_value[i].value = m_base[i].value = 0;
-        }
+        for (StatsCounterSlot *slot = m_slots; slot; slot = slot->next)
+            slot->value = slot->base = 0;
     }
 
     /// Sorting by name (for the statistics)
     bool operator<(const StatsCounter &v) const;
+private:
+    friend class Statistics;
+
+    /**
+     * \brief Return the slot of the calling thread
+     *
+     * The lookup goes through a thread-local table that is indexed by
+     * the counter ID. The slot is registered on first use.
+     */
+    StatsCounterSlot *getSlot();
 private:
     std::string m_category;
     std::string m_name;
     EStatsType m_type;
-    CacheLineCounter *m_value;
-    CacheLineCounter *m_base;
+    size_t m_id;
+    uint64_t m_initial;
+    StatsCounterSlot m_initialSlot;
+    StatsCounterSlot * volatile m_slots;
+};
+
+/** \brief Scoped timer that accumulates into a \ref StatsCounter
+ *
+ * The counter should be of type \ref ETimeValue. The time between
+ * construction and destruction of the timer is added to it in processor
+ * cycles, and its base counter is incremented by one. This makes it
+ * possible to measure the time spent in individual functions of a
+ * plugin, e.g.
+ *
+ * \code
+ * static StatsCounter bssrdfTime("Subsurface", "BSSRDF evaluation", ETimeValue);
+ *
+ * Spectrum MyBSSRDF::bssrdf(...) const {
+ *     ScopedStatsTimer timer(bssrdfTime);
+ *     ...
+ * }
+ * \endcode
+ *
+ * Nested timers simply measure inclusive times. The statistics summary
+ * reports the total time, the number of calls, and the average time
+ * per call. The overhead amounts to two time stamp counter reads and
+ * two additions to thread-local counter slots.
+ *
+ * \ingroup libcore
+ */
+class ScopedStatsTimer {
+public:
+#if defined(MTS_NO_STATISTICS)
+    inline ScopedStatsTimer(StatsCounter &) { }
+#else
+    inline ScopedStatsTimer(StatsCounter &counter)
+        : m_counter(counter), m_start(readTimestampCounter()) { }
+
+    inline ~ScopedStatsTimer() {
+        m_counter += (size_t) (readTimestampCounter() - m_start);
+        m_counter.incrementBase();
+    }
+private:
+    StatsCounter &m_counter;
+    uint64_t m_start;
+#endif
 };
 
 /** \brief General-purpose progress reporter
@@ -353,9 +417,49 @@ public:
     /// Return a string containing gathered statistics
     std::string getStats();
 
+    /// Return a snapshot of the list of all registered counters
+    std::vector<const StatsCounter *> getCounters();
+
     /// Reset all statistics counters
     void resetAll();
 
+    /// Return the frequency of \ref readTimestampCounter() (estimated at runtime)
+    Float getTicksPerSecond() const;
+
+    /**
+     * \brief Enable or disable the recording of a timeline
+     *
+     * While enabled, the scheduler records the start and end of every
+     * work unit that is processed by a local worker. The events are
+     * kept in per-thread buffers and merged by \ref writeTrace().
+     */
+    void setTraceEnabled(bool enabled);
+
+    /// Is the recording of a timeline enabled?
+    inline bool isTraceEnabled() const { return m_traceEnabled; }
+
+    /**
+     * \brief Append an event to the timeline of the calling thread
+     *
+     * \param name
+     *     Name of the event. Must point to a string that remains valid
+     *     until the timeline is written, e.g. a string literal or a
+     *     class name.
+     * \param start
+     *     Start of the event as returned by \ref readTimestampCounter()
+     * \param end
+     *     End of the event as returned by \ref readTimestampCounter()
+     */
+    void recordTraceEvent(const char *name, uint64_t start, uint64_t end);
+
+    /**
+     * \brief Write the recorded timeline to a JSON file
+     *
+     * The file uses the Trace Event format and can be opened using
+     * the <tt>chrome://tracing</tt> page of the Chrome web browser.
+     */
+    void writeTrace(const fs::path &filename);
+
     /// Initialize the global statistics collector
     static void staticInitialization();
 
@@ -367,8 +471,19 @@ protected:
     /// Create a statistics instance
     Statistics();
     /// Virtual destructor
-    virtual ~Statistics() { }
+    virtual ~Statistics();
 private:
+    struct TraceEvent {
+        const char *name;
+        uint64_t start, end;
+    };
+
+    struct TraceBuffer {
+        std::string threadName;
+        std::vector<TraceEvent> events;
+        ref<Mutex> mutex;
+    };
+
     struct compareCategory {
         bool operator()(const StatsCounter *c1, const StatsCounter *c2) {
             if (c1->getCategory() == c2->getCategory())
@@ -377,10 +492,20 @@ private:
         }
     };
 
+    friend class StatsCounter;
+
+    /// Create the slot of the calling thread for a counter
+    StatsCounterSlot *registerSlot(StatsCounter *counter);
+
     static ref<Statistics> m_instance;
     std::vector<const StatsCounter *> m_counters;
     std::vector<std::pair<std::string, std::string> > m_plugins;
     ref<Mutex> m_mutex;
+    ref<Timer> m_timer;
+    uint64_t m_startTicks;
+    bool m_traceEnabled;
+    std::vector<TraceBuffer *> m_traceBuffers;
+    std::vector<StatsSlotTable *> m_slotTables;
 };
 
 MTS_NAMESPACE_END
@@ -79,6 +79,12 @@ public:
     /// Return the core affinity
     int getCoreAffinity() const;
 
+    /**
+     * \brief Return the NUMA node of the core that this thread is
+     * pinned to, or \c -1 if the thread has no core affinity
+     */
+    int getNUMANode() const;
+
     /**
      * \brief Specify whether or not this thread is critical
      *
@@ -53,6 +53,8 @@ namespace detail {
         void *get(bool &existed);
         /// Like the other \c get(), but also returns whether the TLS object existed before (const version)
         const void *get(bool &existed) const;
+        /// Look up the data value in the per-thread map, bypassing the slot table (for benchmarks)
+        void *getUncached();
     protected:
         struct ThreadLocalPrivate;
         mutable boost::scoped_ptr<ThreadLocalPrivate> d;
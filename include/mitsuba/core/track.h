@@ -337,12 +337,12 @@ private:
     /// Internal functor used by \ref eval() and \ref SimpleCache
     struct MTS_EXPORT_CORE TransformFunctor {
     public:
-        inline TransformFunctor(const std::vector<AbstractAnimationTrack *> &tracks)
-            : m_tracks(tracks) {}
+        inline TransformFunctor(const AnimatedTransform &trafo)
+            : m_trafo(trafo) {}
 
         void operator()(const Float &time, Transform &trafo) const;
     private:
-        const std::vector<AbstractAnimationTrack *> &m_tracks;
+        const AnimatedTransform &m_trafo;
     };
 public:
     /**
@@ -353,7 +353,7 @@ public:
      * target value.
      */
     AnimatedTransform(const Transform &trafo = Transform())
-        : m_transform(trafo) { }
+        : m_transform(trafo), m_sampleStart(0), m_invSampleSpacing(0) { }
 
     /// Unserialized an animated transformation from a binary data stream
     AnimatedTransform(Stream *stream);
@@ -403,9 +403,30 @@ public:
         if (EXPECT_TAKEN(m_tracks.size() == 0))
             return m_transform;
         else
-            return m_cache.get(TransformFunctor(m_tracks), t);
+            return m_cache.get(TransformFunctor(*this), t);
     }
 
+    /**
+     * \brief Precompute the transformation at \c sampleCount uniformly
+     * spaced times covering the interval <tt>[start, end]</tt>
+     *
+     * Afterwards, \ref eval() linearly interpolates the cached forward and
+     * inverse matrices of the two nearest samples for times within this
+     * interval instead of evaluating the animation tracks and composing
+     * a new transformation. This is much cheaper for motion-blurred rays
+     * but only approximates rotations, hence the sample count should be
+     * chosen according to the amount of motion within the interval.
+     * Times outside of the interval are evaluated exactly.
+     *
+     * A sample count of zero discards the table. Modifying the animation
+     * tracks also discards it. Not thread-safe: call this before
+     * rendering starts.
+     */
+    void precompute(Float start, Float end, size_t sampleCount);
+
+    /// Return the number of precomputed time samples (or zero)
+    inline size_t getPrecomputedSampleCount() const { return m_samples.size(); }
+
     /// Is the animation static?
     inline bool isStatic() const { return m_tracks.size() == 0; }
 
@@ -497,10 +518,14 @@ public:
 protected:
     /// Virtual destructor
     virtual ~AnimatedTransform();
+    /// Evaluate the animation tracks at the given time
+    void evalTracks(Float t, Transform &trafo) const;
 private:
     std::vector<AbstractAnimationTrack *> m_tracks;
     mutable SimpleCache<Float, Transform> m_cache;
     Transform m_transform;
+    std::vector<Transform> m_samples;
+    Float m_sampleStart, m_invSampleSpacing;
 };
 
 MTS_NAMESPACE_END
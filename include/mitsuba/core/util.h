@@ -112,12 +112,69 @@ extern std::string MTS_EXPORT_CORE lastErrorText();
 /// Determine the number of available CPU cores
 extern MTS_EXPORT_CORE int getCoreCount();
 
+/**
+ * \brief Return the number of NUMA nodes that the available CPU cores
+ * are spread over (1 on platforms where this cannot be determined)
+ */
+extern MTS_EXPORT_CORE int getNUMANodeCount();
+
+/**
+ * \brief Return the NUMA node of an available CPU core
+ *
+ * \param coreID
+ *    Core index using the same numbering as \ref Thread::setCoreAffinity()
+ * \return A node index in <tt>[0, getNUMANodeCount())</tt> or \c -1 when
+ *    \c coreID is negative
+ */
+extern MTS_EXPORT_CORE int getCoreNUMANode(int coreID);
+
+/**
+ * \brief Return core indices for pinning \c count worker threads
+ * one NUMA node at a time
+ *
+ * The workers are split over the nodes in proportion to their core
+ * counts, and workers with consecutive indices share a node.
+ */
+extern MTS_EXPORT_CORE std::vector<int> getNUMACoreAssignment(int count);
+
+/**
+ * \brief Instruction set extensions that hot kernels can be dispatched on
+ *
+ * The shipped builds only assume SSE2. Kernels that benefit from newer
+ * extensions are compiled for them separately and selected at runtime
+ * with \ref hasCPUFeature().
+ */
+enum ECPUFeature {
+    ECPUSSE41 = 0,
+    ECPUAVX,
+    ECPUAVX2,
+    ECPUFMA,
+    ECPUF16C,
+    ECPUFeatureCount
+};
+
+/**
+ * \brief Does the processor (and the operating system) support the given
+ * instruction set extension?
+ *
+ * The result is determined once using \c cpuid. Setting the environment
+ * variable \c MTS_CPU_BASELINE disables all extensions, which makes
+ * every dispatched kernel fall back to its SSE2 version.
+ */
+extern MTS_EXPORT_CORE bool hasCPUFeature(ECPUFeature feature);
+
+/// Return the supported extensions as a list (e.g. "SSE4.1 AVX AVX2 FMA F16C" or "none")
+extern MTS_EXPORT_CORE std::string getCPUFeatureString();
+
 /// Return the host name of this machine
 extern MTS_EXPORT_CORE std::string getHostName();
 
 /// Return the process private memory usage in bytes
 extern MTS_EXPORT_CORE size_t getPrivateMemoryUsage();
 
+/// Return the peak resident set size of the process in bytes
+extern MTS_EXPORT_CORE size_t getPeakMemoryUsage();
+
 /// Returns the total amount of memory available to the OS
 extern MTS_EXPORT_CORE size_t getTotalSystemMemory();
 
@@ -103,6 +103,27 @@ namespace warp {
     /// Convert an uniformly distributed square sample into barycentric coordinates
     extern MTS_EXPORT_CORE Point2 squareToUniformTriangle(const Point2 &sample);
 
+    /**
+     * \brief Uniformly sample a direction within the spherical triangle
+     * spanned by the unit vectors \c a, \c b and \c c
+     *
+     * Based on "Stratified sampling of spherical triangles" by
+     * James Arvo (SIGGRAPH 1995). The density per unit solid angle is
+     * the reciprocal of \ref sphericalTriangleArea().
+     */
+    extern MTS_EXPORT_CORE Vector squareToSphericalTriangle(const Vector &a,
+        const Vector &b, const Vector &c, const Point2 &sample);
+
+    /**
+     * \brief Solid angle subtended by the spherical triangle
+     * spanned by the unit vectors \c a, \c b and \c c
+     *
+     * Uses the formula of Van Oosterom and Strackee, which
+     * remains accurate for very small triangles.
+     */
+    extern MTS_EXPORT_CORE Float sphericalTriangleArea(const Vector &a,
+        const Vector &b, const Vector &c);
+
     /**
      * \brief Sample a point on a 2D standard normal distribution
      *
@@ -26,6 +26,9 @@
 /// Buffer size used to communicate with zlib. The larger, the better.
 #define ZSTREAM_BUFSIZE 32768
 
+/// Uncompressed size of the independently compressed blocks of \ref ZStream::EBlockStream
+#define ZSTREAM_BLOCKSIZE (1024*1024)
+
 MTS_NAMESPACE_BEGIN
 
 /**
@@ -34,6 +37,12 @@ MTS_NAMESPACE_BEGIN
  * This class transparently decompresses and compresses reads and writes
  * to a nested stream, respectively.
  *
+ * The \ref EBlockStream type splits the data into blocks of
+ * \ref ZSTREAM_BLOCKSIZE bytes that are compressed independently, in the
+ * spirit of \c pigz. Each block is preceded by its uncompressed and
+ * compressed size, and a zero-sized block marks the end of the stream.
+ * Batches of blocks are compressed and decompressed in parallel.
+ *
  * \ingroup libcore
  */
 class MTS_EXPORT_CORE ZStream : public Stream {
@@ -45,7 +54,9 @@ public:
         /// A raw deflate stream
         EDeflateStream,
         /// A gzip-compatible stream
-        EGZipStream
+        EGZipStream,
+        /// Independently compressed blocks (parallel compression)
+        EBlockStream
     };
 
     /// Create a new compression stream
@@ -92,8 +103,19 @@ public:
 protected:
     // \brief Virtual destructor
     virtual ~ZStream();
+
+    /// Compress and write the pending blocks of an \ref EBlockStream
+    void writeBlocks();
+
+    /// Read and decompress the next batch of blocks of an \ref EBlockStream
+    void readBlocks();
 private:
     ref<Stream> m_childStream;
+    EStreamType m_streamType;
+    int m_level;
+    std::vector<uint8_t> m_blockBuffer;
+    size_t m_blockPos;
+    bool m_blockEnd;
     z_stream m_deflateStream, m_inflateStream;
     uint8_t m_deflateBuffer[ZSTREAM_BUFSIZE];
     uint8_t m_inflateBuffer[ZSTREAM_BUFSIZE];
@@ -0,0 +1,166 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_BVH_H_)
+#define __MITSUBA_RENDER_BVH_H_
+
+#include <mitsuba/render/trimesh.h>
+
+/// Compile-time BVH depth limit (sizes the traversal stack)
+#define MTS_BVH_MAXDEPTH 64
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Bounding volume hierarchy over a set of triangle meshes
+ * with optional key-framed deformation.
+ *
+ * The hierarchy is built once using a binned surface area heuristic
+ * over the first key frame's topology. Every key frame (a set of meshes
+ * with the same topology but different vertex positions) then gets its
+ * own node bounds, which are computed by a cheap bottom-up refit instead
+ * of a new build. Rays at a time between two key frames are traced
+ * against linearly interpolated bounds and vertex positions.
+ *
+ * Compared to \ref ShapeKDTree, the build is much faster and the tree
+ * can be kept up to date with \ref refit() when the vertex positions of
+ * the meshes change in place, at the cost of somewhat slower traversal.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER TriangleBVH : public Object {
+public:
+    typedef uint32_t IndexType;
+
+    /// Temporarily holds some intersection information
+    struct IntersectionCache {
+        IndexType shapeIndex;
+        IndexType primIndex;
+        Float u, v;
+    };
+
+    /// Create an empty BVH
+    TriangleBVH();
+
+    /**
+     * \brief Append a key frame
+     *
+     * All key frames must contain the same number of meshes with
+     * identical face topology.
+     */
+    void addKeyframe(const std::vector<const TriMesh *> &meshes);
+
+    /// Build the hierarchy and compute the bounds of all key frames
+    void build();
+
+    /**
+     * \brief Recompute the node bounds of all key frames from the current
+     * vertex positions of the meshes without changing the hierarchy
+     */
+    void refit();
+
+    /// Recompute the node bounds of a single key frame
+    void refit(IndexType frame);
+
+    /// Has the hierarchy been built?
+    inline bool isBuilt() const { return !m_nodes.empty(); }
+
+    /// Return the number of key frames
+    inline size_t getKeyframeCount() const { return m_frames.size(); }
+
+    /// Return the number of nodes
+    inline size_t getNodeCount() const { return m_nodes.size(); }
+
+    /// Return the number of triangles
+    inline size_t getPrimitiveCount() const { return m_prims.size(); }
+
+    /// Return a bounding box containing the geometry of all key frames
+    inline const AABB &getAABB() const { return m_aabb; }
+
+    /**
+     * \brief Find the closest intersection along a ray
+     *
+     * \param frame
+     *    Index of the key frame preceding the ray's time
+     *
+     * \param alpha
+     *    Interpolation weight between \c frame and the next key frame
+     */
+    bool rayIntersect(const Ray &ray, Float mint, Float maxt, Float &t,
+        IntersectionCache *cache, IndexType frame = 0, Float alpha = 0) const;
+
+    /// Test a ray segment for occlusion
+    bool rayIntersect(const Ray &ray, Float mint, Float maxt,
+        IndexType frame = 0, Float alpha = 0) const;
+
+    /// Return a string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Interior or leaf node of the hierarchy in 8 bytes
+    struct BVHNode {
+        /// Leaf: first primitive, interior: index of the right child
+        uint32_t offset;
+        /// Number of primitives, zero for interior nodes
+        uint16_t primCount;
+        /// Split axis of interior nodes
+        uint16_t axis;
+
+        inline bool isLeaf() const { return primCount > 0; }
+    };
+
+    /// A triangle referenced by the hierarchy
+    struct BVHPrimitive {
+        IndexType shapeIndex;
+        IndexType primIndex;
+    };
+
+    struct BuildPrimitive;
+
+    /// Recursively build the subtree over a range of primitives
+    void buildRecursive(std::vector<BuildPrimitive> &prims,
+        size_t begin, size_t end, int depth);
+
+    /// Return the bounding box of a triangle at a given key frame
+    inline AABB getPrimitiveAABB(const BVHPrimitive &prim,
+            IndexType frame) const {
+        const TriMesh *mesh = m_frames[frame][prim.shapeIndex];
+        return mesh->getTriangle(prim.primIndex).getAABB(
+            mesh->getVertexPositions());
+    }
+
+    template <bool shadowRay> bool rayIntersectInternal(const Ray &ray,
+        Float mint, Float maxt, Float &t, IntersectionCache *cache,
+        IndexType frame, Float alpha) const;
+
+    /// Virtual destructor
+    virtual ~TriangleBVH();
+private:
+    std::vector<std::vector<const TriMesh *> > m_frames;
+    std::vector<BVHNode> m_nodes;
+    std::vector<BVHPrimitive> m_prims;
+    /// Node bounds, one array of \c m_nodes.size() entries per key frame
+    std::vector<AABB> m_bounds;
+    AABB m_aabb;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_BVH_H_ */
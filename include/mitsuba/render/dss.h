@@ -22,10 +22,10 @@
 
 #include <mitsuba/render/subsurface.h>
 #include <mitsuba/core/pmf.h>
+#include <mitsuba/core/kdtree.h>
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/sampler.h>
 #include <mitsuba/render/shape.h>
-#include <gsl/gsl_sf_lambert.h>
 
 #include <iomanip>
 #include <functional>
@@ -55,6 +55,12 @@
  * for debugging. */
 #define MTS_DSS_ALLOW_INTERNAL_INCOMING_DIR false
 
+/* Round collected intersections (and the intersection whose pdf is
+ * queried) to fewer significant digits for more reproducible MIS weights?
+ * Normally 0: any problems this might take care of can be handled by a
+ * robust integrator (e.g. adaptiveRobustMC) instead. */
+#define MTS_DSS_ROUND_ITS_FOR_STABILITY 0
+
 MTS_NAMESPACE_BEGIN
 
 /**
@@ -162,14 +168,17 @@ public:
     RadianceSources() { }
     RadianceSources(Stream *stream, InstanceManager *manager) {
         size_t n = stream->readSize();
-        m_sources.reserve(n);
-        for (size_t i = 0; i < n; i++)
-            m_sources.push_back(RadianceSource(stream));
+        m_sources.resize(n);
+        /* RadianceSource only consists of Float fields */
+        if (n > 0)
+            stream->readFloatArray(reinterpret_cast<Float *>(&m_sources[0]),
+                n * sizeof(RadianceSource) / sizeof(Float));
     }
     void serialize(Stream *stream, InstanceManager *manager) const {
         stream->writeSize(m_sources.size());
-        for (const RadianceSource rs : m_sources)
-            rs.serialize(stream);
+        if (!m_sources.empty())
+            stream->writeFloatArray(reinterpret_cast<const Float *>(&m_sources[0]),
+                m_sources.size() * sizeof(RadianceSource) / sizeof(Float));
     }
     const std::vector<RadianceSource> &get() const {
         return m_sources;
@@ -186,18 +195,184 @@ protected:
 };
 
 
+/**
+ * \brief Cache of the radiance that is incident on the boundary of a
+ * direct sampling subsurface medium from the outside.
+ *
+ * The cache stores, at a set of well spread points on the boundary, a
+ * spherical harmonics projection of the incident radiance over the
+ * outward hemisphere. Lookups interpolate the nearest cache points that
+ * have a compatible normal (found through a kd-tree query), so that a
+ * single lookup replaces a full recursive radiance query of the
+ * integrator.
+ *
+ * This is a biased approximation in the spirit of the irradiance octree
+ * of the classic dipole model: it only makes sense for static, fairly
+ * low-frequency illumination that gets reused for many samples (or
+ * frames).
+ */
+class MTS_EXPORT_RENDER DSSRadianceCache : public SerializableObject {
+public:
+    /// Number of nearest cache points that get interpolated per lookup
+    enum {
+        ELookupNeighbours = 8
+    };
+
+    /// Create an empty cache with the given number of SH bands
+    DSSRadianceCache(int bands);
+
+    /// Unserialize a cache from a binary data stream
+    DSSRadianceCache(Stream *stream, InstanceManager *manager);
+
+    void serialize(Stream *stream, InstanceManager *manager) const;
+
+    /**
+     * \brief Add a cache point.
+     *
+     * \param directions Outward pointing directions (in world space) that
+     * were uniformly sampled over the hemisphere about \c n.
+     * \param radiance The incident radiance from each of those directions.
+     */
+    void put(const Point &p, const Normal &n,
+            const std::vector<Vector> &directions,
+            const std::vector<Spectrum> &radiance);
+
+    /// Append all cache points of another cache with the same number of bands
+    void merge(const DSSRadianceCache *other);
+
+    /// Build the lookup acceleration structure, call after the last put()
+    void build();
+
+    /**
+     * \brief Look up the cached radiance that arrives at \c p (with
+     * normal \c n) from the outgoing direction \c d.
+     */
+    Spectrum lookup(const Point &p, const Normal &n, const Vector &d) const;
+
+    inline size_t size() const {
+        return m_positions.size();
+    }
+
+    inline int getBands() const {
+        return m_bands;
+    }
+
+    MTS_DECLARE_CLASS();
+protected:
+    virtual ~DSSRadianceCache() { }
+
+    /// Evaluate the real SH basis functions in direction \c d
+    void evalBasis(const Vector &d, Float *basis) const;
+
+    typedef PointKDTree<SimpleKDNode<Point, uint32_t> > CacheTree;
+
+    int m_bands;
+    int m_numCoeffs; /// m_bands^2
+    std::vector<Point> m_positions;
+    std::vector<Normal> m_normals;
+    /// Coefficients, per point: [channel][coefficient]
+    std::vector<Float> m_coeffs;
+    CacheTree m_tree;
+};
+
+
+/**
+ * \brief List of intersections that is gathered along a projection probe.
+ *
+ * The kd-tree appends its hits to this list in place. Each
+ * \c IntersectionSampler keeps one such list per thread, so that the
+ * capacity of the buffer is retained between probes and collecting
+ * intersections does not touch the heap at steady state.
+ */
+typedef std::vector<Intersection> IntersectionList;
+
+class IntersectionSampler;
+
+/**
+ * \brief Probes that were cast for a single surface point query, shared
+ * by all surface samplers of a \ref DirectSamplingSubsurface.
+ *
+ * The MIS weight of a candidate point evaluates the pdf of every
+ * registered \ref SurfaceSampler. Samplers that cast an identical probe
+ * with the same \ref IntersectionSampler get the intersections of the
+ * first one instead of traversing the kd-tree again. The bounding box of
+ * the shapes, which bounds the plane of the projection samplers, is also
+ * only computed once per query.
+ *
+ * A context is only valid for a single query point (its_out, d_out) and
+ * has to be cleared before the next one. Clearing retains the capacity
+ * of the intersection lists.
+ */
+class MTS_EXPORT_RENDER DSSProbeContext {
+public:
+    DSSProbeContext() : m_numProbes(0), m_aabbValid(false) { }
+
+    /// Forget all probes and the bounding box of the previous query
+    inline void clear() {
+        m_numProbes = 0;
+        m_aabbValid = false;
+    }
+
+    /// Bounding box of the given shapes (computed on first use)
+    const AABB &getShapesAABB(const std::vector<Shape *> &shapes);
+
+    /**
+     * \brief Intersections of the given probe, as they would be collected
+     * by \ref IntersectionSampler::collectIntersections().
+     *
+     * Only casts the probe if the same intersection sampler did not
+     * already cast it for the current query.
+     */
+    const IntersectionList &collectIntersections(
+            const IntersectionSampler *itsSampler, const Scene *scene,
+            const Point &origin, const Vector &direction, Float time,
+            const std::vector<Shape *> &shapes, const Intersection &its_out,
+            const Vector &d_out, bool bidirectional);
+
+private:
+    struct Probe {
+        const IntersectionSampler *itsSampler;
+        const std::vector<Shape *> *shapes;
+        Point origin;
+        Vector direction;
+        Float time;
+        bool bidirectional;
+        IntersectionList intersections;
+    };
+
+    std::vector<Probe> m_probes; /// Only the first m_numProbes are valid
+    size_t m_numProbes;
+    AABB m_aabb;
+    bool m_aabbValid;
+};
+
 // channel can be -1 (= MIS over all channels)
 class MTS_EXPORT_RENDER IntersectionSampler : public Object {
 public:
-    IntersectionSampler(Float itsDistanceCutoff) :
-        m_itsDistanceCutoff(itsDistanceCutoff) { }
+    /**
+     * \param itsDistanceCutoff
+     *    Only intersections within this distance of the outgoing query
+     *    point are considered.
+     * \param itsWeightTolerance
+     *    If strictly positive, stop collecting intersections along the
+     *    probe line (outwards from the point closest to the outgoing query
+     *    point) as soon as a kd-tree leaf only adds a relative
+     *    \ref probeWeight() of at most this tolerance to the total so
+     *    far. Intersections beyond that point are treated as having zero
+     *    weight, which introduces a bias of the order of the tolerance.
+     *    Zero (the default) collects everything within the cutoff.
+     */
+    IntersectionSampler(Float itsDistanceCutoff,
+            Float itsWeightTolerance = 0) :
+        m_itsDistanceCutoff(itsDistanceCutoff),
+        m_itsWeightTolerance(itsWeightTolerance) { }
 
-    virtual Float sample(const std::vector<Intersection> &intersections,
+    virtual Float sample(const IntersectionList &intersections,
             Intersection &newIts,
             const Intersection &its_out, const Vector &d_out,
             int channel, Sampler *sampler) const = 0;
 
-    virtual Float pdf(const std::vector<Intersection> &intersections,
+    virtual Float pdf(const IntersectionList &intersections,
             const Intersection &newIts,
             const Intersection &its_out, const Vector &d_out,
             int channel) const = 0;
@@ -206,10 +381,11 @@ public:
             const Scene *scene, const Point &origin, const Vector &direction,
             Float time, const std::vector<Shape *> &shapes,
             const Intersection &its_out, const Vector &d_out,
-            int channel, Sampler *sampler, bool bidirectional = true) const {
-        const std::vector<Intersection> intersections =
-                collectIntersections(scene, origin, direction, time,
-                        shapes, its_out, bidirectional);
+            int channel, Sampler *sampler, bool bidirectional = true,
+            DSSProbeContext *probes = NULL) const {
+        const IntersectionList &intersections = probe(scene, origin,
+                direction, time, shapes, its_out, d_out, bidirectional,
+                probes);
         if (intersections.size() == 0)
             return 0;
         return sample(intersections, newIts, its_out, d_out, channel, sampler);
@@ -219,10 +395,11 @@ public:
             const Scene *scene, const Point &origin, const Vector &direction,
             Float time, const std::vector<Shape *> &shapes,
             const Intersection &its_out, const Vector &d_out,
-            int channel, bool bidirectional = true) const {
-        const std::vector<Intersection> intersections =
-                collectIntersections(scene, origin, direction, time,
-                        shapes, its_out, bidirectional);
+            int channel, bool bidirectional = true,
+            DSSProbeContext *probes = NULL) const {
+        const IntersectionList &intersections = probe(scene, origin,
+                direction, time, shapes, its_out, d_out, bidirectional,
+                probes);
         if (intersections.size() == 0) {
             SLog(EWarn, "Could not find any intersection, not even our own!");
             return 0.0f;
@@ -230,55 +407,72 @@ public:
         return pdf(intersections, newIts, its_out, d_out, channel);
     }
 
-    std::vector<Intersection> collectIntersections(const Scene *scene,
+    /**
+     * \brief Collect all intersections with the given shapes along the
+     * probe line that lie within \c m_itsDistanceCutoff of \c its_out.
+     *
+     * The given list is cleared first and is filled in place. The
+     * intersections are already rounded for stability (see
+     * \c MTS_DSS_ROUND_ITS_FOR_STABILITY). With a positive
+     * \c m_itsWeightTolerance, negligible intersections far away from
+     * \c its_out may be left out.
+     */
+    void collectIntersections(const Scene *scene,
             const Point &origin, const Vector &direction, Float time,
             const std::vector<Shape *> &shapes, const Intersection &its_out,
-            bool bidirectional = true) const {
-        std::vector<Intersection> intersections;
-
-        /* Find min and max t values that correspond to the
-         * m_itsDistanceCutoff range around the its_out.p query point
-         * (trivially equal to +/-m_itsDistanceCutoff in case the
-         * projection origin coincides with its_out.p, but slightly more
-         * involved if that is not the case) */
-        Vector centerOffset = origin - its_out.p;
-        Float offset2 = centerOffset.lengthSquared();
-        Float cutoff2 = math::square(m_itsDistanceCutoff);
-
-        Float proj = dot(centerOffset, direction);
-        Float tmp2 = proj*proj - offset2 + cutoff2;
-        if (tmp2 < 0)
-            return intersections; // no intersection
-
-        Float tmp = sqrt(tmp2);
-        Float max_t = -proj + tmp;
-        Float min_t = (bidirectional ? -proj - tmp : Epsilon);
-
-        Float maxDist = m_itsDistanceCutoff * (1+Epsilon);
-        Assert(distance(its_out.p, origin + direction * max_t) <= maxDist);
-        Assert(distance(its_out.p, origin + direction * min_t) <= maxDist);
-
-        scene->rayIntersectFully(Ray(origin,direction,min_t,max_t,time),
-                intersections, &shapes);
-        return intersections;
+            const Vector &d_out, IntersectionList &intersections,
+            bool bidirectional = true) const;
+
+    /**
+     * \brief Channel-independent importance of an intersection, used to
+     * decide when to stop collecting intersections (see the
+     * \c itsWeightTolerance constructor argument).
+     *
+     * Should be roughly proportional to the probability of choosing
+     * \c its. The default implementation weighs everything equally.
+     */
+    virtual Float probeWeight(const Intersection &its,
+            const Intersection &its_out, const Vector &d_out) const {
+        return 1.0f;
     }
 
     Float getItsDistanceCutoff() const {
         return m_itsDistanceCutoff;
     }
 
+    Float getItsWeightTolerance() const {
+        return m_itsWeightTolerance;
+    }
+
 protected:
     virtual ~IntersectionSampler() { }
     MTS_DECLARE_CLASS();
 
+    /// Collect the intersections of a probe through \c probes if given
+    inline const IntersectionList &probe(const Scene *scene,
+            const Point &origin, const Vector &direction, Float time,
+            const std::vector<Shape *> &shapes, const Intersection &its_out,
+            const Vector &d_out, bool bidirectional,
+            DSSProbeContext *probes) const {
+        if (probes)
+            return probes->collectIntersections(this, scene, origin,
+                    direction, time, shapes, its_out, d_out, bidirectional);
+        IntersectionList &intersections = m_intersections.get();
+        collectIntersections(scene, origin, direction, time,
+                shapes, its_out, d_out, intersections, bidirectional);
+        return intersections;
+    }
+
     Float m_itsDistanceCutoff;
+    Float m_itsWeightTolerance;
+    mutable PrimitiveThreadLocal<IntersectionList> m_intersections;
 };
 
 // channel can be -1 (= MIS over all channels)
 class MTS_EXPORT_RENDER MISIntersectionSampler : public IntersectionSampler {
 public:
     MISIntersectionSampler(const std::vector<std::pair<Float, const IntersectionSampler*> > &samplers) :
-            IntersectionSampler(0.0f) {
+            IntersectionSampler(0.0f, std::numeric_limits<Float>::infinity()) {
         if (samplers.size() < 1)
             Log(EError, "Trying to construct MISIntersectionSampler without "
                     "any samplers!");
@@ -291,6 +485,8 @@ public:
             m_samplers.push_back(p.second);
             m_itsDistanceCutoff = std::max(m_itsDistanceCutoff,
                     p.second->m_itsDistanceCutoff);
+            m_itsWeightTolerance = std::min(m_itsWeightTolerance,
+                    p.second->m_itsWeightTolerance);
         }
         if (m_samplers.size() < 1)
             Log(EError, "Trying to construct MISIntersectionSampler without "
@@ -298,15 +494,24 @@ public:
         m_weights.normalize();
     }
 
+    Float probeWeight(const Intersection &its,
+            const Intersection &its_out, const Vector &d_out) const {
+        Float weight = 0;
+        for (size_t j = 0; j < m_weights.size(); j++)
+            weight += m_weights[j] * m_samplers[j]->probeWeight(
+                    its, its_out, d_out);
+        return weight;
+    }
+
 
-    Float sample(const std::vector<Intersection> &intersections,
+    Float sample(const IntersectionList &intersections,
             Intersection &newIts,
             const Intersection &its_out, const Vector &d_out,
             int channel, Sampler *sampler) const {
         size_t i = m_weights.sample(sampler->next1D());
         Float thePdf = m_weights[i] * m_samplers[i]->sample(
                 intersections, newIts, its_out, d_out, channel, sampler);
-        Assert(std::isfinite(thePdf));
+        HotAssert(std::isfinite(thePdf));
         if (thePdf == 0)
             return 0;
         for (size_t j = 0; j < m_weights.size(); j++) {
@@ -314,23 +519,23 @@ public:
                 continue;
             Float thisPdf = m_samplers[j]->pdf(
                     intersections, newIts, its_out, d_out, channel);
-            Assert(thisPdf >= 0);
+            HotAssert(thisPdf >= 0);
             thePdf += m_weights[j] * thisPdf;
-            Assert(std::isfinite(thePdf));
+            HotAssert(std::isfinite(thePdf));
         }
         return thePdf;
     }
 
-    Float pdf(const std::vector<Intersection> &intersections,
+    Float pdf(const IntersectionList &intersections,
             const Intersection &newIts, const Intersection &its_out,
             const Vector &d_out, int channel) const {
         Float thePdf = 0;
         for (size_t j = 0; j < m_weights.size(); j++) {
             Float thisPdf = m_samplers[j]->pdf(
                     intersections, newIts, its_out, d_out, channel);
-            Assert(thisPdf >= 0);
+            HotAssert(thisPdf >= 0);
             thePdf += m_weights[j] * thisPdf;
-            Assert(std::isfinite(thePdf));
+            HotAssert(std::isfinite(thePdf));
         }
         return thePdf;
     }
@@ -349,14 +554,17 @@ typedef std::function<Float(const Intersection&, const Intersection&, const Vect
 class MTS_EXPORT_RENDER WeightIntersectionSampler : public IntersectionSampler {
 public:
     WeightIntersectionSampler(IntersectionWeightFunc intersectionWeight,
-            Float itsDistanceCutoff) :
-                IntersectionSampler(itsDistanceCutoff),
+            Float itsDistanceCutoff, Float itsWeightTolerance = 0) :
+                IntersectionSampler(itsDistanceCutoff, itsWeightTolerance),
                 m_intersectionWeight(intersectionWeight) { }
-    virtual Float sample(const std::vector<Intersection> &intersections,
+    /// The intersection weight, averaged over all channels
+    virtual Float probeWeight(const Intersection &its,
+            const Intersection &its_out, const Vector &d_out) const;
+    virtual Float sample(const IntersectionList &intersections,
             Intersection &newIts,
             const Intersection &its_out, const Vector &d_out,
             int channel, Sampler *sampler) const ;
-    virtual Float pdf(const std::vector<Intersection> &intersections,
+    virtual Float pdf(const IntersectionList &intersections,
             const Intersection &newIts,
             const Intersection &its_out, const Vector &d_out,
             int channel) const ;
@@ -517,7 +725,7 @@ public:
         if (!m_radialSampler->sample(channel, r, sampler, pdf))
             return false;
 
-        Assert(std::isfinite(r) && r >= 0);
+        HotAssert(std::isfinite(r) && r >= 0);
         Float s, c;
         math::sincos(TWO_PI * sampler->next1D(), &s, &c);
         x[0] = r*s;
@@ -596,17 +804,20 @@ protected:
 
 class MTS_EXPORT_RENDER SurfaceSampler : public Object {
 public:
-    // channel can be -1
+    /* channel can be -1. The optional probe context shares probes and
+     * the bounding box of the shapes with the other samplers that are
+     * evaluated for the same query (see \ref DSSProbeContext). */
     virtual Float sample(const Intersection &its,
             const Vector &d_out, const Scene *scene,
             const std::vector<Shape *> &shapes,
             Intersection &newIts, int channel,
-            Sampler *sampler) const = 0;
+            Sampler *sampler, DSSProbeContext *probes = NULL) const = 0;
     // channel can be -1
     virtual Float pdf(const Intersection &its,
             const Vector &d_out, const Scene *scene,
             const std::vector<Shape *> &shapes,
-            const Intersection &newIts, int channel) const = 0;
+            const Intersection &newIts, int channel,
+            DSSProbeContext *probes = NULL) const = 0;
 
     MTS_DECLARE_CLASS();
 protected:
@@ -621,11 +832,12 @@ public:
             const Vector &d_out, const Scene *scene,
             const std::vector<Shape *> &shapes,
             Intersection &newIts, int channel,
-            Sampler *sampler) const;
+            Sampler *sampler, DSSProbeContext *probes = NULL) const;
     virtual Float pdf(const Intersection &its,
             const Vector &d_out, const Scene *scene,
             const std::vector<Shape *> &shapes,
-            const Intersection &newIts, int channel) const;
+            const Intersection &newIts, int channel,
+            DSSProbeContext *probes = NULL) const;
 
     MTS_DECLARE_CLASS();
 protected:
@@ -642,11 +854,12 @@ public:
             const Vector &d_out, const Scene *scene,
             const std::vector<Shape *> &shapes,
             Intersection &newIts, int channel,
-            Sampler *sampler) const;
+            Sampler *sampler, DSSProbeContext *probes = NULL) const;
     virtual Float pdf(const Intersection &its,
             const Vector &d_out, const Scene *scene,
             const std::vector<Shape *> &shapes,
-            const Intersection &newIts, int channel) const;
+            const Intersection &newIts, int channel,
+            DSSProbeContext *probes = NULL) const;
 
     MTS_DECLARE_CLASS();
 protected:
@@ -669,12 +882,13 @@ public:
             const Vector &d_out, const Scene *scene,
             const std::vector<Shape *> &shapes,
             Intersection &newIts, int channel,
-            Sampler *sampler) const;
+            Sampler *sampler, DSSProbeContext *probes = NULL) const;
 
     virtual Float pdf(const Intersection &its,
             const Vector &d_out, const Scene *scene,
             const std::vector<Shape *> &shapes,
-            const Intersection &newIts, int channel) const;
+            const Intersection &newIts, int channel,
+            DSSProbeContext *probes = NULL) const;
 
     MTS_DECLARE_CLASS();
 protected:
@@ -734,15 +948,17 @@ public:
             Intersection &newIts, const Spectrum &throughput,
             Sampler *sampler) const {
         if (!m_allowIncomingOutgoingDirections)
-            Assert(dot(d_out, its.shFrame.n) >= 0);
+            HotAssert(dot(d_out, its.shFrame.n) >= 0);
         // One sample MIS weighting (balance heuristic)
         int channel = throughputToChannel(throughput);
-        Assert(m_weights.size() > 0);
-        Assert(m_weights.isNormalized());
+        HotAssert(m_weights.size() > 0);
+        HotAssert(m_weights.isNormalized());
+        DSSProbeContext &probes = m_probes.get();
+        probes.clear();
         size_t chosenSamplerIdx = m_weights.sample(sampler->next1D());
         Float p = m_weights[chosenSamplerIdx] *
-                m_surfaceSamplers[chosenSamplerIdx]->sample(
-                    its, d_out, scene, getShapes(), newIts, channel, sampler);
+                m_surfaceSamplers[chosenSamplerIdx]->sample(its, d_out,
+                    scene, getShapes(), newIts, channel, sampler, &probes);
         if (p == 0)
             return 0.0f;
 
@@ -750,9 +966,9 @@ public:
             if (i == chosenSamplerIdx)
                 continue;
             p += m_weights[i] * m_surfaceSamplers[i]->pdf(
-                its, d_out, scene, getShapes(), newIts, channel);
+                its, d_out, scene, getShapes(), newIts, channel, &probes);
         }
-        Assert(std::isfinite(p));
+        HotAssert(std::isfinite(p));
         return p;
     }
 
@@ -760,17 +976,19 @@ public:
             const Vector &d_out, const Scene *scene,
             const Intersection &newIts, const Spectrum &throughput) const {
         if (!m_allowIncomingOutgoingDirections)
-            Assert(dot(d_out, its.shFrame.n) >= 0);
+            HotAssert(dot(d_out, its.shFrame.n) >= 0);
         // One sample MIS weighting (balance heuristic)
         int channel = throughputToChannel(throughput);
-        Assert(m_weights.size() > 0);
-        Assert(m_weights.isNormalized());
+        HotAssert(m_weights.size() > 0);
+        HotAssert(m_weights.isNormalized());
+        DSSProbeContext &probes = m_probes.get();
+        probes.clear();
         Float p = 0;
         for (size_t i = 0; i < m_surfaceSamplers.size(); i++) {
             p += m_weights[i] * m_surfaceSamplers[i]->pdf(
-                its, d_out, scene, getShapes(), newIts, channel);
+                its, d_out, scene, getShapes(), newIts, channel, &probes);
         }
-        Assert(std::isfinite(p));
+        HotAssert(std::isfinite(p));
         return p;
     }
 
@@ -808,6 +1026,21 @@ public:
             const Point &p_out, const Vector &d_out, const Normal &n_out,
             const void *extraParams) const = 0;
 
+    /**
+     * \brief Evaluate the BSSRDF for a batch of incoming configurations
+     * that share the same outgoing point and direction.
+     *
+     * The extra parameters of entry \c i start at
+     * <tt>extraParams + i*extraParamsSize()</tt>. The default
+     * implementation calls \ref bssrdf() for every entry. Models can
+     * override this to evaluate the batch without a virtual call per
+     * entry, or to share work that only depends on the outgoing side.
+     */
+    virtual void bssrdfBatch(const Scene *scene, size_t count,
+            const Point *p_in,  const Vector *d_in,  const Normal *n_in,
+            const Point &p_out, const Vector &d_out, const Normal &n_out,
+            const char *extraParams, Spectrum *result) const;
+
     /**
      * Returns the number of bytes that is requested for the extra parameters.
      */
@@ -909,6 +1142,12 @@ public:
     virtual void wakeup(ConfigurableObject *parent,
             std::map<std::string, SerializableObject *> &params);
 
+    /// Cancel the computation of the radiance cache, if it is running
+    virtual void cancel();
+
+    /// Discard the radiance sources and the radiance cache
+    virtual void invalidate();
+
     virtual void serialize(Stream *stream, InstanceManager *manager) const;
 
     MTS_DECLARE_CLASS();
@@ -934,7 +1173,7 @@ protected:
      * Don't forget to call normalizeSamplers() afterwards! */
     void registerSampler(Float weight,
             const SurfaceSampler *surfaceSampler) {
-        Assert(weight >= 0);
+        HotAssert(weight >= 0);
         if (weight == 0)
             return;
         m_surfaceSamplers.push_back(surfaceSampler);
@@ -943,7 +1182,7 @@ protected:
 
     /// To be called after registering all samplers.
     void normalizeSamplers() {
-        Assert(m_weights.size() > 0);
+        HotAssert(m_weights.size() > 0);
         m_weights.normalize();
     }
 
@@ -1073,13 +1312,17 @@ protected:
      * given incoming point \c its_in, by importance sampling the angular
      * BSSRDF transport.
      *
+     * \param heroChannel If not -1, sample the directions with the
+     *     strategy of this channel only (see m_heroChannel)
+     *
      * \return pdf(d_in, rec_wi, extraParams)
      */
     Spectrum sampleIndirect(const Scene *scene, Sampler *sampler,
             Intersection &its_in, const Intersection &its_out,
             const Vector &d_out, const Spectrum &effectiveThroughput,
             Vector &d_in, Vector &rec_wi, void *extraParams,
-            EMeasure &bsdfMeasure, Spectrum &bsdfVal) const;
+            EMeasure &bsdfMeasure, Spectrum &bsdfVal,
+            int heroChannel = -1) const;
 
     /// Returns pdf(d_in, rec_wi, extraParams)
     Spectrum pdfIndirect(const Scene *scene,
@@ -1088,6 +1331,37 @@ protected:
             const Vector &d_in, const Vector &rec_wi, const void *extraParams,
             EMeasure bsdfMeasure) const;
 
+    /**
+     * \brief Pdf of a surface point in hero channel mode (see
+     * m_heroChannel)
+     *
+     * There, the surface point and the directions are sampled with the
+     * strategies of a single channel, which is chosen uniformly among the
+     * nonzero channels of \c effectiveThroughput, and all channels get
+     * evaluated. The pdfs are the one-sample MIS (balance heuristic)
+     * combinations over all channels that could have been the hero.
+     *
+     * \param channelPdfs Returns the surface pdf of each channel's
+     *     strategy, for \ref pdfHero()
+     */
+    Float pdfPointOnSurfaceHero(const Scene *scene,
+            const Intersection &its_in, const Intersection &its_out,
+            const Vector &d_out, const Spectrum &effectiveThroughput,
+            Spectrum &channelPdfs) const;
+
+    /**
+     * \brief Pdf of a full indirect sample in hero channel mode, i.e. the
+     * counterpart of <tt>surfacePdf * pdfIndirect()</tt>
+     *
+     * \param surfacePdfs Per-channel surface pdfs of \c its_in, as
+     *     computed by \ref pdfPointOnSurfaceHero()
+     */
+    Spectrum pdfHero(const Scene *scene,
+            const Intersection &its_in, const Intersection &its_out,
+            const Vector &d_out, const Spectrum &effectiveThroughput,
+            const Vector &d_in, const Vector &rec_wi, const void *extraParams,
+            EMeasure bsdfMeasure, const Spectrum &surfacePdfs) const;
+
 
 
 
@@ -1114,6 +1388,102 @@ protected:
         Spectrum weightForIndirectContrib;
     };
 
+    /**
+     * Tentative indirect samples of \c indirectSample_SIR(), in
+     * structure-of-arrays form, so that the BSSRDF can be evaluated for
+     * all of them at once (see \ref bssrdfBatch()). */
+    struct SIRCandidates {
+        std::vector<uint32_t> surface; /// Index of the sampled surface point
+        std::vector<Point> p_in;
+        std::vector<Normal> n_in;
+        std::vector<Vector> d_in;
+        std::vector<Vector> rec_wi;
+        std::vector<EMeasure> bsdfMeasure;
+        std::vector<Spectrum> bsdfVal;
+        std::vector<Spectrum> indirectPdf;
+        std::vector<Spectrum> bssrdfVal; /// Filled in by bssrdfBatch()
+
+        void reserve(size_t n) {
+            surface.reserve(n);
+            p_in.reserve(n);
+            n_in.reserve(n);
+            d_in.reserve(n);
+            rec_wi.reserve(n);
+            bsdfMeasure.reserve(n);
+            bsdfVal.reserve(n);
+            indirectPdf.reserve(n);
+            bssrdfVal.reserve(n);
+        }
+
+        void clear() {
+            surface.clear();
+            p_in.clear();
+            n_in.clear();
+            d_in.clear();
+            rec_wi.clear();
+            bsdfMeasure.clear();
+            bsdfVal.clear();
+            indirectPdf.clear();
+            bssrdfVal.clear();
+        }
+
+        inline size_t size() const {
+            return surface.size();
+        }
+
+        void push_back(uint32_t surfaceIdx, const Intersection &its_in,
+                const Vector &d, const Vector &wi, EMeasure measure,
+                const Spectrum &bsdf, const Spectrum &pdf) {
+            surface.push_back(surfaceIdx);
+            p_in.push_back(its_in.p);
+            n_in.push_back(its_in.shFrame.n);
+            d_in.push_back(d);
+            rec_wi.push_back(wi);
+            bsdfMeasure.push_back(measure);
+            bsdfVal.push_back(bsdf);
+            indirectPdf.push_back(pdf);
+        }
+    };
+
+    /**
+     * Per-thread scratch memory for \c indirectSample_SIR(), so that the
+     * SIR loop does not have to allocate on the heap for every shading
+     * point. It is created on first use in each thread, with room for
+     * all tentative samples (and their extra parameters) of this model. */
+    struct SIRScratch : public Object {
+        SIRScratch(size_t numSurface, size_t numAttempts, size_t parSize)
+                : paramSamples(numAttempts * parSize),
+                  sampleWeights(numAttempts), reservoirValid(false),
+                  reservoirParams(parSize) {
+            surfaceIts.reserve(numSurface);
+            surfacePdfs.reserve(numSurface);
+            candidates.reserve(numAttempts);
+            samples.reserve(numAttempts);
+            sampleSlots.reserve(numAttempts);
+        }
+
+        std::vector<Intersection> surfaceIts;
+        std::vector<Float> surfacePdfs;
+        SIRCandidates candidates;
+        std::vector<IndirectSamplingRecord> samples;
+        std::vector<size_t> sampleSlots; /// Candidate index of each sample
+        std::vector<char> paramSamples; /// Extra parameters per candidate
+        DiscreteDistribution sampleWeights;
+
+        /* Output of the previous SIR query in this thread, which can be
+         * merged into the next one (see \ref reuseSIRReservoir()) */
+        bool reservoirValid;
+        IndirectSamplingRecord reservoir;
+        Spectrum reservoirBsdfVal;
+        Spectrum reservoirUCW; /// Unbiased contribution weight of the sample
+        Float reservoirCount; /// Number of candidates that it represents
+        Point reservoirP_out;
+        Normal reservoirN_out;
+        std::vector<char> reservoirParams;
+    protected:
+        virtual ~SIRScratch() { }
+    };
+
     /**
      * Sample Importance Resampling (SIR) of direct&indirect MIS weighted
      * sampling (with full expected value estimator for the direct
@@ -1125,12 +1495,49 @@ protected:
             Spectrum &LiContribution,
             IndirectSamplingRecord &indirectSample, void * extraParams) const;
 
+    /**
+     * Merge the sample that \c indirectSample_SIR() just selected with the
+     * reservoir that the previous query of this thread left behind, if
+     * that one belongs to a nearby shading point (see m_SIRreuse).
+     *
+     * \param count Number of SIR attempts of the current query
+     * \param haveSample Did the current query select a sample?
+     * \param sampleWeight Resampling weight of the selected sample
+     * \param sampleUCW Its unbiased contribution weight (i.e. the
+     *     reciprocal of its effective pdf)
+     * \return \c false if neither reservoir provides a sample */
+    bool reuseSIRReservoir(const Scene *scene, Sampler *sampler,
+            SIRScratch *scratch, const Intersection &its_out,
+            const Vector &d_out, const Spectrum &channelWeight,
+            const Spectrum &channelWeightedThroughput, Float count,
+            bool haveSample, Float sampleWeight, const Spectrum &sampleUCW,
+            const Spectrum &sampleBsdfVal,
+            IndirectSamplingRecord &indirectSample, void *extraParams) const;
+
     bool indirectSample_noSIR(const Scene *scene, Sampler *sampler,
             const Intersection &its_out, const Vector &d,
             const Spectrum &channelWeight,
             const Spectrum &channelWeightedThroughput,
             Spectrum &LiContribution,
-            IndirectSamplingRecord &indirectSample, void * extraParams) const;
+            IndirectSamplingRecord &indirectSample, void * extraParams,
+            int heroChannel = -1) const;
+
+    /**
+     * \brief Fill in m_radianceCache by querying the integrator for the
+     * radiance that is incident on our boundary from the outside.
+     *
+     * The radiance is sampled in parallel, by a \ref ParallelProcess.
+     *
+     * \return \c false if the process was cancelled or failed.
+     */
+    bool buildRadianceCache(const Scene *scene, const RenderJob *job,
+            int sceneResID);
+
+    /**
+     * \brief Fill in m_sources by tracing the collimated light sources
+     * of the scene to our boundary.
+     */
+    void collectRadianceSources(const Scene *scene);
 
 
 
@@ -1180,12 +1587,24 @@ protected:
      * such sample gets m_SIRnonSurfaceOversamplingFactor individual 
      * tentative extraParams and direction samples. */
     size_t m_SIRnonSurfaceOversamplingFactor;
+    /** Confidence of the SIR reservoir that is reused from the previous
+     * shading point of the same thread, relative to the number of fresh
+     * SIR attempts (0: no reuse). */
+    Float m_SIRreuse;
+    /** Adaptive SIR: add surface samples while the relative variance of
+     * the mean SIR weight exceeds this threshold (0: fixed count)... */
+    Float m_SIRadaptiveThreshold;
+    /// ... but use at most this many of them
+    size_t m_SIRadaptiveMaxSurface;
     ref<RadianceSources> m_sources;
     int m_sourcesIndex;
     int m_sourcesResID;
     bool m_directSampling;
     bool m_directSamplingMIS;
     bool m_singleChannel;
+    /** Sample the surface point and the directions for a single 'hero'
+     * channel, but evaluate all of them (with spectral MIS weights) */
+    bool m_heroChannel;
     bool m_allowIncomingOutgoingDirections;
     bool m_nonCollimatedLightSourcesPresent;
     int m_maxInternalReflections; /// Maximum number of subsequent internal reflections (<0 for unbounded)
@@ -1195,6 +1614,19 @@ protected:
      * here for convenience, because all subclasses will pretty much need
      * this for their IntersectionSamplers. */
     Float m_itsDistanceCutoff;
+    /// Same remark as for m_itsDistanceCutoff (see \ref IntersectionSampler)
+    Float m_itsWeightTolerance;
+    mutable ThreadLocal<SIRScratch> m_SIRscratch;
+    /// Probes shared by the surface samplers during a single query
+    mutable PrimitiveThreadLocal<DSSProbeContext> m_probes;
+    /* Optional cache of the incident radiance on our boundary (see
+     * \ref DSSRadianceCache), shared as a resource like m_sources. */
+    ref<DSSRadianceCache> m_radianceCache;
+    int m_radianceCacheResID;
+    size_t m_radianceCacheSamples; /// Number of cache points (0: no cache)
+    size_t m_radianceCacheDirections; /// Radiance samples per cache point
+    int m_radianceCacheBands; /// Number of SH bands per cache point
+    ref<ParallelProcess> m_proc; /// Running preprocessing process, if any
 };
 
 MTS_NAMESPACE_END
@@ -534,6 +534,19 @@ public:
      */
     inline Float getSamplingWeight() const { return m_samplingWeight; }
 
+    /**
+     * \brief Return a cone bounding the directions of emission
+     *
+     * The emitter must not radiate into directions that make an angle
+     * larger than <tt>thetaO + thetaE</tt> with \c axis, where \c thetaO
+     * bounds the spread of the surface normals and \c thetaE the spread
+     * of emission about each normal. This information is used by the
+     * emitter hierarchy of \ref Scene.
+     *
+     * The default implementation returns the full sphere of directions.
+     */
+    virtual void getEmissionBounds(Vector &axis, Float &thetaO, Float &thetaE) const;
+
     /**
      * \brief Return a bitmap representation of the emitter
      *
@@ -0,0 +1,146 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_EMITTERBVH_H_)
+#define __MITSUBA_RENDER_EMITTERBVH_H_
+
+#include <mitsuba/render/emitter.h>
+#include <mitsuba/core/aabb.h>
+#include <mitsuba/core/pmf.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Bounding volume hierarchy over the emitters of a scene, which
+ * chooses emitters for direct illumination sampling based on the
+ * reference point.
+ *
+ * Every node stores the bounding box, a cone bounding the emission
+ * directions and the total power of the emitters below it. Sampling
+ * descends from the root and picks each child proportionally to an
+ * estimate of its contribution at the reference point (Conty Estevez
+ * and Kulla, "Importance Sampling of Many Lights with Adaptive Tree
+ * Splitting", 2018). The probability of an emitter is recovered by
+ * walking back up from its leaf, so \ref pdf() exactly matches
+ * \ref sampleReuse().
+ *
+ * Emitters without finite spatial bounds (environment maps, directional
+ * emitters) are kept outside of the hierarchy and chosen according to
+ * their sampling weights.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER EmitterBVH : public Object {
+public:
+    /// Create an empty hierarchy
+    EmitterBVH();
+
+    /// Build the hierarchy over a set of emitters
+    void build(const ref_vector<Emitter> &emitters);
+
+    /// Has the hierarchy been built?
+    inline bool isBuilt() const { return m_built; }
+
+    /**
+     * \brief Choose an emitter for direct illumination sampling
+     *
+     * \param ref
+     *    Reference point to be illuminated
+     *
+     * \param refN
+     *    Surface normal at the reference point, or a zero vector if
+     *    light arriving from both hemispheres is relevant
+     *
+     * \param sample
+     *    A uniform sample, which is rescaled for reuse
+     *
+     * \param pdf
+     *    Returns the discrete probability of the chosen emitter
+     *
+     * \return The chosen emitter, or \c NULL if no emitter can
+     *    contribute at the reference point
+     */
+    const Emitter *sampleReuse(const Point &ref, const Normal &refN,
+        Float &sample, Float &pdf) const;
+
+    /// Return the probability of choosing \c emitter in \ref sampleReuse()
+    Float pdf(const Point &ref, const Normal &refN, const Emitter *emitter) const;
+
+    /// Return the number of nodes
+    inline size_t getNodeCount() const { return m_nodes.size(); }
+
+    /// Return a string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Cone bounding a set of emission directions
+    struct EmissionCone {
+        Vector axis;
+        /// Bound on the spread of the surface normals
+        Float thetaO;
+        /// Bound on the spread of emission around each normal
+        Float thetaE;
+
+        /// Merge with another cone
+        void expandBy(const EmissionCone &cone);
+
+        /// Orientation measure used by the surface area orientation heuristic
+        Float getMeasure() const;
+    };
+
+    /// Interior or leaf node of the hierarchy
+    struct Node {
+        AABB aabb;
+        EmissionCone cone;
+        Float power;
+        /// Leaf: index of the emitter, interior: index of the right child
+        uint32_t offset;
+        /// Index of the parent node, or -1 for the root
+        uint32_t parent;
+        bool leaf;
+    };
+
+    struct BuildEmitter;
+
+    /// Recursively build the subtree over a range of emitters
+    uint32_t buildRecursive(std::vector<BuildEmitter> &emitters,
+        size_t begin, size_t end, uint32_t parent);
+
+    /// Estimate the contribution of a node at the reference point
+    Float importance(const Node &node, const Point &ref, const Normal &refN) const;
+
+    /// Virtual destructor
+    virtual ~EmitterBVH();
+private:
+    std::vector<Node> m_nodes;
+    std::vector<const Emitter *> m_emitters;
+    std::map<const Emitter *, uint32_t> m_leaves;
+    /// Emitters outside of the hierarchy and their sampling distribution
+    std::vector<const Emitter *> m_unbounded;
+    std::map<const Emitter *, uint32_t> m_unboundedIndices;
+    DiscreteDistribution m_unboundedPDF;
+    /// Probability of sampling the hierarchy instead of an unbounded emitter
+    Float m_boundedProb;
+    bool m_built;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_EMITTERBVH_H_ */
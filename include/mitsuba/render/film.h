@@ -63,6 +63,18 @@ public:
     /// Develop the film and write the result to the previously specified filename
     virtual void develop(const Scene *scene, Float renderTime) = 0;
 
+    /**
+     * \brief Write an intermediate result without stalling the caller
+     *
+     * Films that support this take a snapshot of their contents and
+     * convert and write it on a background thread; a later call to
+     * \ref develop() waits for any pending write to finish. The default
+     * implementation simply calls \ref develop().
+     */
+    virtual void developAsync(const Scene *scene, Float renderTime) {
+        develop(scene, renderTime);
+    }
+
     /**
      * \brief Develop the contents of a subregion of the film and store
      * it inside the given bitmap
@@ -81,6 +93,39 @@ public:
     /// Does the destination file already exist?
     virtual bool destinationExists(const fs::path &basename) const = 0;
 
+    /**
+     * \brief Notify the film that an image block, which was previously
+     * merged using \ref put(), has been rendered completely
+     *
+     * Films that support checkpointing use this to keep track of the
+     * blocks that do not have to be rendered again when an interrupted
+     * rendering is resumed. A block that was split into several work
+     * units is reported once, after all of its parts were merged.
+     * The default implementation does nothing.
+     */
+    virtual void setBlockComplete(const Point2i &offset, const Vector2i &size) { }
+
+    /**
+     * \brief Was the specified image block already rendered completely?
+     *
+     * This is the case for blocks that were restored from the checkpoint
+     * of an interrupted rendering. The default implementation
+     * returns \c false.
+     */
+    virtual bool isBlockComplete(const Point2i &offset, const Vector2i &size) const { return false; }
+
+    /**
+     * \brief Set the per-block rendering costs measured during the
+     * last rendering (one pixel per block, see \ref BlockedImageProcess)
+     *
+     * Subsequent renderings of this film can use them to hand out
+     * the most expensive blocks first.
+     */
+    inline void setBlockCosts(Bitmap *costs) { m_blockCosts = costs; }
+
+    /// Return the per-block rendering costs, or \c NULL if unknown
+    inline const Bitmap *getBlockCosts() const { return m_blockCosts.get(); }
+
     /**
      * Should regions slightly outside the image plane be sampled to improve
      * the quality of the reconstruction at the edges? This only makes
@@ -131,6 +176,7 @@ protected:
     Vector2i m_size, m_cropSize;
     bool m_highQualityEdges;
     ref<ReconstructionFilter> m_filter;
+    ref<Bitmap> m_blockCosts;
 };
 
 MTS_NAMESPACE_END
@@ -71,6 +71,7 @@ class Sampler;
 class Sensor;
 class Scene;
 class SceneHandler;
+class SceneObjectCache;
 class Shader;
 class Shape;
 class SparseMipmap3D;
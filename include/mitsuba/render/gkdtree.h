@@ -22,6 +22,7 @@
 
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/lock.h>
+#include <mitsuba/core/mmap.h>
 #include <boost/static_assert.hpp>
 #include <stack>
 
@@ -49,6 +50,12 @@
  */
 #define MTS_KD_AABB_EPSILON 1e-3f
 
+/// Version number of the on-disk kd-tree cache format
+#define MTS_KD_CACHE_VERSION 0x01
+
+/// Make sure that the cached node and index arrays start on a cache line
+#define MTS_KD_CACHE_ALIGNMENT 64
+
 #if defined(MTS_KD_DEBUG)
 #define KDAssert(expr) SAssert(expr)
 #define KDAssertEx(expr, text) SAssertEx(expr, text)
@@ -742,13 +749,18 @@ public:
         m_retract = true;
         m_parallelBuild = true;
         m_minMaxBins = 128;
+        m_maxBuildMemory = 0;
         m_logLevel = EDebug;
+        m_nodeCount = m_indexCount = 0;
+        m_heuristicCost = 0;
     }
 
     /**
      * \brief Release all memory
      */
     virtual ~GenericKDTree() {
+        if (m_cacheFile)
+            return; // nodes and indices are memory-mapped
         if (m_indices)
             delete[] m_indices;
         if (m_nodes)
@@ -767,6 +779,122 @@ public:
      */
     inline IndexType *getIndices() const { return m_indices; }
 
+    /// Return the number of nodes of the built tree
+    inline SizeType getNodeCount() const { return m_nodeCount; }
+
+    /**
+     * \brief Return the cost of the built tree according to the tree
+     * construction heuristic (normalized by the root node)
+     */
+    inline Float getHeuristicCost() const { return m_heuristicCost; }
+
+    /**
+     * \brief Write the built tree to a cache file, which can later be
+     * memory-mapped by \ref loadCache()
+     *
+     * The file is first written under a temporary name and then
+     * renamed, so that concurrent readers never see a partial file.
+     *
+     * \param key
+     *    Identifies the geometry and construction parameters of the tree
+     */
+    void saveCache(const fs::path &filename, uint64_t key) const {
+        if (!isBuilt())
+            KDLog(EError, "The kd-tree has not been built yet!");
+        if (m_nodeCount == 0)
+            return;
+
+        size_t nodeOffset = cacheNodeOffset(),
+               indexOffset = cacheIndexOffset(m_nodeCount),
+               size = indexOffset + sizeof(IndexType) * m_indexCount;
+
+        KDCacheHeader header;
+        memset(&header, 0, sizeof(KDCacheHeader));
+        memcpy(header.identifier, "MKD", 3);
+        header.version = MTS_KD_CACHE_VERSION;
+        header.scalarSize = (uint8_t) sizeof(Scalar);
+        header.nodeCount = m_nodeCount;
+        header.indexCount = m_indexCount;
+        header.key = key;
+        header.heuristicCost = m_heuristicCost;
+        header.aabb = m_aabb;
+        header.tightAABB = m_tightAABB;
+
+        fs::path tmpPath = filename.parent_path()
+            / (filename.filename().string() + ".tmp");
+        try {
+            fs::create_directories(filename.parent_path());
+            {
+                ref<MemoryMappedFile> mmap = new MemoryMappedFile(tmpPath, size);
+                uint8_t *data = (uint8_t *) mmap->getData();
+                memset(data, 0, size);
+                memcpy(data, &header, sizeof(KDCacheHeader));
+                memcpy(data + nodeOffset, m_nodes, sizeof(KDNode) * m_nodeCount);
+                memcpy(data + indexOffset, m_indices,
+                    sizeof(IndexType) * m_indexCount);
+            }
+            fs::rename(tmpPath, filename);
+        } catch (const std::exception &e) {
+            KDLog(EWarn, "Could not write the kd-tree cache file \"%s\": %s",
+                filename.string().c_str(), e.what());
+            return;
+        }
+        KDLog(EInfo, "Wrote the kd-tree cache file \"%s\" (%s)",
+            filename.string().c_str(), memString(size).c_str());
+    }
+
+    /**
+     * \brief Memory-map a tree that was previously written by
+     * \ref saveCache() instead of building it
+     *
+     * \return \c false if the file does not exist or does not match
+     *    \c key, in which case the tree remains unbuilt
+     */
+    bool loadCache(const fs::path &filename, uint64_t key) {
+        if (isBuilt())
+            KDLog(EError, "The kd-tree has already been built!");
+        if (!fs::exists(filename))
+            return false;
+
+        ref<MemoryMappedFile> mmap;
+        try {
+            mmap = new MemoryMappedFile(filename);
+        } catch (const std::exception &e) {
+            KDLog(EWarn, "Could not map the kd-tree cache file \"%s\": %s",
+                filename.string().c_str(), e.what());
+            return false;
+        }
+
+        KDCacheHeader header;
+        const uint8_t *data = (const uint8_t *) mmap->getData();
+        if (mmap->getSize() < sizeof(KDCacheHeader))
+            return false;
+        memcpy(&header, data, sizeof(KDCacheHeader));
+        size_t indexOffset = cacheIndexOffset(header.nodeCount);
+        if (memcmp(header.identifier, "MKD", 3) != 0
+                || header.version != MTS_KD_CACHE_VERSION
+                || header.scalarSize != sizeof(Scalar)
+                || header.key != key || mmap->getSize() !=
+                   indexOffset + sizeof(IndexType) * header.indexCount) {
+            KDLog(EWarn, "Ignoring invalid kd-tree cache file \"%s\"",
+                filename.string().c_str());
+            return false;
+        }
+
+        m_cacheFile = mmap;
+        m_nodes = (KDNode *) (data + cacheNodeOffset());
+        m_indices = (IndexType *) (data + indexOffset);
+        m_nodeCount = header.nodeCount;
+        m_indexCount = header.indexCount;
+        m_heuristicCost = header.heuristicCost;
+        m_aabb = header.aabb;
+        m_tightAABB = header.tightAABB;
+
+        KDLog(EInfo, "Mapped the kd-tree cache file \"%s\" into memory (%s)",
+            filename.string().c_str(), memString(mmap->getSize()).c_str());
+        return true;
+    }
+
     /**
      * \brief Return the traversal cost used by the tree construction heuristic
      */
@@ -931,7 +1059,56 @@ public:
     inline SizeType getExactPrimitiveThreshold() const {
         return m_exactPrimThreshold;
     }
+
+    /**
+     * \brief Bound the scratch memory used by the O(n log n) builder
+     *
+     * When set to a nonzero value (in bytes), the exact primitive
+     * threshold is lowered at build time so that the edge event lists
+     * of all concurrently built subtrees fit into the budget. Larger
+     * nodes are handled by the Min-Max binning builder, whose scratch
+     * storage only amounts to a few bytes per primitive.
+     */
+    inline void setMaxBuildMemory(size_t maxBuildMemory) {
+        m_maxBuildMemory = maxBuildMemory;
+    }
+
+    /// Return the scratch memory budget of the builder (0 = unlimited)
+    inline size_t getMaxBuildMemory() const {
+        return m_maxBuildMemory;
+    }
 protected:
+    /// Header of kd-tree cache files
+    struct KDCacheHeader {
+        char identifier[3];
+        uint8_t version;
+        uint8_t scalarSize;
+        SizeType nodeCount;
+        SizeType indexCount;
+        uint64_t key;
+        Float heuristicCost;
+        AABBType aabb;
+        AABBType tightAABB;
+    };
+
+    /**
+     * \brief Offset of the node array in a cache file
+     *
+     * The nodes are shifted by one entry relative to an aligned address
+     * just like in memory, which is required by \ref KDNode::getSibling().
+     */
+    static size_t cacheNodeOffset() {
+        size_t offset = sizeof(KDCacheHeader) + MTS_KD_CACHE_ALIGNMENT - 1;
+        return offset - offset % MTS_KD_CACHE_ALIGNMENT + sizeof(KDNode);
+    }
+
+    /// Offset of the index array in a cache file
+    static size_t cacheIndexOffset(SizeType nodeCount) {
+        size_t offset = cacheNodeOffset() + sizeof(KDNode) * nodeCount
+            + MTS_KD_CACHE_ALIGNMENT - 1;
+        return offset - offset % MTS_KD_CACHE_ALIGNMENT;
+    }
+
     /**
      * \brief Once the tree has been constructed, it is rewritten into
      * a more convenient binary storage format.
@@ -987,6 +1164,24 @@ protected:
             m_maxDepth = (int) (8 + 1.3f * math::log2i(primCount));
         m_maxDepth = std::min(m_maxDepth, (SizeType) MTS_KD_MAXDEPTH);
 
+        if (m_maxBuildMemory > 0) {
+            /* An exact subtree holds its own event list plus those of the
+               children under construction (roughly 3 lists of 2*dim events
+               per primitive), and every builder thread may work on one */
+            size_t contexts = (m_parallelBuild ? getCoreCount() : 0) + 1,
+                   perPrim = 3 * 2 * PointType::dim * sizeof(EdgeEvent) * contexts,
+                   baseline = 2 * (size_t) primCount * sizeof(IndexType),
+                   budget = m_maxBuildMemory > baseline ? m_maxBuildMemory - baseline : 0,
+                   exactPrims = std::max(budget / perPrim, (size_t) m_stopPrims + 1);
+
+            if (exactPrims < m_exactPrimThreshold) {
+                KDLog(m_logLevel, "Lowering the exact primitive threshold to %i "
+                    "to stay within the build memory budget of %s", (int) exactPrims,
+                    memString(m_maxBuildMemory).c_str());
+                m_exactPrimThreshold = (SizeType) exactPrims;
+            }
+        }
+
         KDLog(m_logLevel, "Creating a preliminary index list (%s)",
             memString(primCount * sizeof(IndexType)).c_str());
 
@@ -1024,6 +1219,9 @@ protected:
         KDLog(m_logLevel, "   Min-max bins             : %i", m_minMaxBins);
         KDLog(m_logLevel, "   O(n log n) method        : use for <= %i primitives",
                 m_exactPrimThreshold);
+        if (m_maxBuildMemory > 0)
+            KDLog(m_logLevel, "   Build memory budget      : %s",
+                memString(m_maxBuildMemory).c_str());
         KDLog(m_logLevel, "   Perfect splits           : %s", m_clip ? "yes" : "no");
         KDLog(m_logLevel, "   Retract bad splits       : %s",
                 m_retract ? "yes" : "no");
@@ -1209,6 +1407,7 @@ protected:
         expLeavesVisited /= rootQuantity;
         expPrimitivesIntersected /= rootQuantity;
         heuristicCost /= rootQuantity;
+        m_heuristicCost = heuristicCost;
 
         /* Slightly enlarge the bounding box
            (necessary e.g. when the scene is planar) */
@@ -2600,9 +2799,12 @@ protected:
     SizeType m_stopPrims;
     SizeType m_maxBadRefines;
     SizeType m_exactPrimThreshold;
+    size_t m_maxBuildMemory;
     SizeType m_minMaxBins;
     SizeType m_nodeCount;
     SizeType m_indexCount;
+    Float m_heuristicCost;
+    ref<MemoryMappedFile> m_cacheFile;
     std::vector<TreeBuilder *> m_builders;
     std::vector<KDNode *> m_indirections;
     ref<Mutex> m_indirectionLock;
@@ -23,6 +23,7 @@
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/sched.h>
 #include <mitsuba/core/rfilter.h>
+#include <mitsuba/core/atomic.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -97,10 +98,47 @@ public:
     inline const Bitmap *getBitmap() const { return m_bitmap.get(); }
 
     /// Clear everything to zero
-    inline void clear() { m_bitmap->clear(); }
+    inline void clear() { m_bitmap->clear(); clearCompensation(); }
+
+    /**
+     * \brief Change the precision of the accumulation buffer
+     *
+     * Image blocks normally accumulate in \ref Float. Large blocks that
+     * persist over an entire rendering (e.g. the storage of a film) can
+     * instead use \c EFloat32 or \c EFloat16 components to save memory.
+     * Channels flagged in \c compensated additionally keep a single
+     * precision Kahan compensation term, so that round-off does not build
+     * up when many contributions are added to the same pixel.
+     *
+     * Blocks with reduced precision only support the non-atomic \c put()
+     * variants. This function clears the block.
+     */
+    void setStorage(Bitmap::EComponentFormat format,
+        const std::vector<bool> &compensated = std::vector<bool>());
+
+    /// Return the component format of the accumulation buffer
+    inline Bitmap::EComponentFormat getStorage() const { return m_bitmap->getComponentFormat(); }
+
+    /// Return which channels use Kahan-compensated accumulation
+    inline const std::vector<bool> &getCompensated() const { return m_compensated; }
+
+    /**
+     * \brief Reset the Kahan compensation terms
+     *
+     * Must be called after the bitmap was overwritten by other means
+     * than the \c put() functions.
+     */
+    inline void clearCompensation() {
+        if (!m_compensation.empty())
+            memset(&m_compensation[0], 0, m_compensation.size() * sizeof(float));
+    }
 
     /// Accumulate another image block into this one
     inline void put(const ImageBlock *block) {
+        if (EXPECT_NOT_TAKEN(!m_native)) {
+            putCompact(block);
+            return;
+        }
         m_bitmap->accumulate(block->getBitmap(),
             Point2i(block->getOffset() - m_offset
                 - Vector2i(block->getBorderSize() - m_borderSize)));
@@ -141,7 +179,97 @@ public:
      * \return \c false if one of the sample values was \a invalid, e.g.
      *    NaN or negative. A warning is also printed in this case
      */
-    FINLINE bool put(const Point2 &_pos, const Float *value) {
+    FINLINE bool put(const Point2 &pos, const Float *value) {
+        return putInternal<false>(pos, value, m_weightsX, m_weightsY);
+    }
+
+    /**
+     * \brief Store a batch of samples inside the block
+     *
+     * Equivalent to calling \ref put(const Point2 &, const Float *) for
+     * every sample, but cheaper per sample. When the reconstruction filter
+     * is a box whose support does not exceed a pixel, each sample is
+     * added to the single pixel containing it without any filter lookups.
+     * Samples should be sorted by pixel for best memory locality.
+     *
+     * \param pos
+     *    Array of \c count sample positions in fractional pixel coordinates
+     * \param values
+     *    Array of <tt>count * getChannelCount()</tt> sample values,
+     *    stored one sample after another
+     * \param count
+     *    Number of samples
+     * \return \c false if one of the samples was \a invalid. Such
+     *    samples are skipped, and a warning is printed
+     */
+    bool put(const Point2 *pos, const Float *values, size_t count);
+
+    /**
+     * \brief Thread-safe variant of \ref put(const Point2 &, const Spectrum &, Float)
+     *
+     * Any number of threads may concurrently splat samples into the same
+     * image block using the atomic variants of \c put(). Every channel
+     * is updated with a compare-and-swap loop, which makes them somewhat
+     * slower than the regular versions.
+     */
+    FINLINE bool putAtomic(const Point2 &pos, const Spectrum &spec, Float alpha) {
+        Float temp[SPECTRUM_SAMPLES + 2];
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+            temp[i] = spec[i];
+        temp[SPECTRUM_SAMPLES] = alpha;
+        temp[SPECTRUM_SAMPLES + 1] = 1.0f;
+        return putAtomic(pos, temp);
+    }
+
+    /// Thread-safe variant of \ref put(const Point2 &, const Float *)
+    FINLINE bool putAtomic(const Point2 &pos, const Float *value) {
+        int tempBufferSize = (int) (m_weightsY - m_weightsX);
+        Float *weightsX = (Float *) alloca(2 * tempBufferSize * sizeof(Float));
+        return putInternal<true>(pos, value, weightsX, weightsX + tempBufferSize);
+    }
+
+    /**
+     * \brief Atomically accumulate another image block into this one
+     *
+     * Thread-safe with respect to all other atomic \c put() variants.
+     */
+    void putAtomic(const ImageBlock *block);
+
+    /// Create a clone of the entire image block
+    ref<ImageBlock> clone() const {
+        ref<ImageBlock> clone = new ImageBlock(m_bitmap->getPixelFormat(),
+            m_bitmap->getSize() - Vector2i(2*m_borderSize, 2*m_borderSize), m_filter, m_bitmap->getChannelCount());
+        if (!m_native)
+            clone->setStorage(getStorage(), m_compensated);
+        copyTo(clone);
+        return clone;
+    }
+
+    /// Copy the contents of this image block to another one with the same configuration
+    void copyTo(ImageBlock *copy) const {
+        memcpy(copy->getBitmap()->getUInt8Data(), m_bitmap->getUInt8Data(), m_bitmap->getBufferSize());
+        copy->m_compensation = m_compensation;
+        copy->m_size = m_size;
+        copy->m_offset = m_offset;
+        copy->m_warn = m_warn;
+    }
+
+    // ======================================================================
+    //! @{ \name Implementation of the WorkResult interface
+    // ======================================================================
+
+    void load(Stream *stream);
+    void save(Stream *stream) const;
+    std::string toString() const;
+
+    //! @}
+    // ======================================================================
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Splat a sample using the given temporary filter weight buffers
+    template <bool atomic> FINLINE bool putInternal(const Point2 &_pos,
+            const Float *value, Float *weightsX, Float *weightsY) {
         const int channels = m_bitmap->getChannelCount();
 
         /* Check if all sample values are valid */
@@ -171,21 +299,37 @@ public:
 
             /* Lookup values from the pre-rasterized filter */
             for (int x=min.x, idx = 0; x<=max.x; ++x)
-                m_weightsX[idx++] = m_filter->evalDiscretized(x-pos.x);
+                weightsX[idx++] = m_filter->evalDiscretized(x-pos.x);
             for (int y=min.y, idx = 0; y<=max.y; ++y)
-                m_weightsY[idx++] = m_filter->evalDiscretized(y-pos.y);
+                weightsY[idx++] = m_filter->evalDiscretized(y-pos.y);
+
+            if (EXPECT_NOT_TAKEN(!m_native)) {
+                if (atomic)
+                    Log(EError, "putAtomic(): not supported by image blocks "
+                        "with reduced storage precision!");
+                for (int y=min.y, yr=0; y<=max.y; ++y, ++yr) {
+                    for (int x=min.x, xr=0; x<=max.x; ++x, ++xr)
+                        putCompact(y * (size_t) size.x + x,
+                            weightsX[xr] * weightsY[yr], value);
+                }
+                return true;
+            }
 
             /* Rasterize the filtered sample into the framebuffer */
             for (int y=min.y, yr=0; y<=max.y; ++y, ++yr) {
-                const Float weightY = m_weightsY[yr];
+                const Float weightY = weightsY[yr];
                 Float *dest = m_bitmap->getFloatData()
                     + (y * (size_t) size.x + min.x) * channels;
 
                 for (int x=min.x, xr=0; x<=max.x; ++x, ++xr) {
-                    const Float weight = m_weightsX[xr] * weightY;
-
-                    for (int k=0; k<channels; ++k)
-                        *dest++ += weight * value[k];
+                    const Float weight = weightsX[xr] * weightY;
+
+                    for (int k=0; k<channels; ++k) {
+                        if (atomic)
+                            atomicAdd(dest++, weight * value[k]);
+                        else
+                            *dest++ += weight * value[k];
+                    }
                 }
             }
         }
@@ -207,35 +351,20 @@ public:
         return false;
     }
 
-    /// Create a clone of the entire image block
-    ref<ImageBlock> clone() const {
-        ref<ImageBlock> clone = new ImageBlock(m_bitmap->getPixelFormat(),
-            m_bitmap->getSize() - Vector2i(2*m_borderSize, 2*m_borderSize), m_filter, m_bitmap->getChannelCount());
-        copyTo(clone);
-        return clone;
-    }
-
-    /// Copy the contents of this image block to another one with the same configuration
-    void copyTo(ImageBlock *copy) const {
-        memcpy(copy->getBitmap()->getUInt8Data(), m_bitmap->getUInt8Data(), m_bitmap->getBufferSize());
-        copy->m_size = m_size;
-        copy->m_offset = m_offset;
-        copy->m_warn = m_warn;
-    }
+    /// Add a weighted sample to one pixel of a reduced precision block
+    void putCompact(size_t pixel, Float weight, const Float *value);
 
-    // ======================================================================
-    //! @{ \name Implementation of the WorkResult interface
-    // ======================================================================
-
-    void load(Stream *stream);
-    void save(Stream *stream) const;
-    std::string toString() const;
+    /// Accumulate a \ref Float-valued block into a reduced precision block
+    void putCompact(const ImageBlock *block);
 
-    //! @}
-    // ======================================================================
+    /**
+     * \brief Clip another block against this one
+     *
+     * \return \c false if the two blocks do not overlap
+     */
+    bool clip(const ImageBlock *block, Vector2i &sourceOffset,
+            Vector2i &targetOffset, Vector2i &size) const;
 
-    MTS_DECLARE_CLASS()
-protected:
     /// Virtual destructor
     virtual ~ImageBlock();
 protected:
@@ -245,9 +374,75 @@ protected:
     int m_borderSize;
     const ReconstructionFilter *m_filter;
     Float *m_weightsX, *m_weightsY;
+    /// Weight of a box filter with a single pixel support, or zero
+    Float m_boxWeight;
     bool m_warn;
+    /// Is the bitmap stored in \ref Float precision?
+    bool m_native;
+    /// Compensated channels and their index within a pixel's Kahan terms
+    std::vector<bool> m_compensated;
+    std::vector<int> m_compensationIndex;
+    int m_compensationStride;
+    std::vector<float> m_compensation;
 };
 
+/**
+ * \brief Thread-safe full-frame accumulation buffer with one
+ * image block per NUMA node
+ *
+ * Parallel processes that splat each work result over the entire image
+ * (e.g. particle tracing) would otherwise funnel all workers through one
+ * buffer and one lock. Here, every result is instead added to the buffer
+ * of the NUMA node that the calling worker is pinned to. The buffers are
+ * allocated lazily by the first worker of each node, so that their
+ * memory is local to it, and are only summed up in \ref merge().
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER ImageBlockAccumulator : public Object {
+public:
+    /// Create an accumulation buffer (see \ref ImageBlock for the parameters)
+    ImageBlockAccumulator(Bitmap::EPixelFormat fmt, const Vector2i &size,
+            const ReconstructionFilter *filter = NULL, int channels = -1);
+
+    /// Add an image block to the buffer of the calling thread's NUMA node
+    void put(const ImageBlock *block);
+
+    /**
+     * \brief Sum up the per-node buffers
+     *
+     * \return An image block holding the sum of all results that were
+     *    added so far. It remains valid until the next call.
+     */
+    ImageBlock *merge();
+
+    /// Clear all buffers
+    void clear();
+
+    /// Return the image dimensions
+    inline const Vector2i &getSize() const { return m_size; }
+
+    /// Return the number of per-node buffers allocated so far
+    size_t getBufferCount() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~ImageBlockAccumulator();
+private:
+    struct NodeBuffer {
+        mutable ref<Mutex> mutex;
+        ref<ImageBlock> block;
+    };
+
+    std::vector<NodeBuffer> m_buffers;
+    ref<ImageBlock> m_merged;
+    ref<Mutex> m_mergeMutex;
+    Bitmap::EPixelFormat m_pixelFormat;
+    Vector2i m_size;
+    const ReconstructionFilter *m_filter;
+    int m_channels;
+};
 
 MTS_NAMESPACE_END
 
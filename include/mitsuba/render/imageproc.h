@@ -21,19 +21,93 @@
 #define __MITSUBA_RENDER_IMAGEPROC_H_
 
 #include <mitsuba/core/sched.h>
+#include <mitsuba/core/bitmap.h>
+
+/// Blocks are never split below this size, see \ref BlockedImageProcess::setSplitting()
+#define MTS_MIN_SPLIT_SIZE 8
 
 MTS_NAMESPACE_BEGIN
 
 /**
  * Abstract parallel process, which performs a certain task (to be defined by
  * the subclass) on the pixels of an image where work on adjacent pixels
- * is independent. For preview purposes, a spiraling pattern of square
- * pixel blocks is generated.
+ * is independent. By default, a spiraling pattern of square pixel blocks
+ * is generated for preview purposes (see \ref EBlockOrder for the
+ * alternatives).
  *
  * \ingroup librender
  */
 class MTS_EXPORT_RENDER BlockedImageProcess : public ParallelProcess {
 public:
+    /// Order in which the pixel blocks are handed out
+    enum EBlockOrder {
+        /// Spiral starting at the center of the image (for previews)
+        ESpiralOrder = 0,
+
+        /// Hilbert curve over the blocks (coherent memory accesses)
+        EHilbertOrder,
+
+        /**
+         * Most expensive blocks first, based on the per-block costs of a
+         * previous rendering. This avoids that a few expensive blocks
+         * are still being worked on while the other cores are idle.
+         * Blocks of equal cost are visited in Hilbert curve order.
+         */
+        ECostOrder
+    };
+
+    /**
+     * \brief Change the order in which blocks are handed out
+     *
+     * Must be called after \ref init() and before the work
+     * generation starts.
+     *
+     * \param costs
+     *    Per-block costs (\ref Bitmap::ELuminance, \ref Bitmap::EFloat32)
+     *    with one pixel per block. Only used by \ref ECostOrder, which
+     *    reverts to \ref EHilbertOrder when the costs are missing or
+     *    do not match the block layout.
+     */
+    void setBlockOrder(EBlockOrder order, const Bitmap *costs = NULL);
+
+    /// Return the order in which blocks are handed out
+    inline EBlockOrder getBlockOrder() const { return m_blockOrder; }
+
+    /// Parse the name of a block order ("spiral", "hilbert" or "cost")
+    static EBlockOrder parseBlockOrder(const std::string &name);
+
+    /**
+     * \brief Enable adaptive splitting of the blocks near the end
+     *
+     * Based on the pixel rates reported to \ref recordThroughput(), a block
+     * is split into quarters when the requesting worker would still be
+     * working on it after the other workers have finished the remaining
+     * image. The leftover parts are handed out next. This keeps slow (e.g.
+     * remote) workers from holding up the end of a rendering. The
+     * generated work units may therefore be smaller than the block size.
+     */
+    void setSplitting(bool splitting);
+
+    /// Is adaptive block splitting enabled?
+    inline bool isSplitting() const { return m_splitting; }
+
+    /**
+     * \brief Report a finished work unit for the throughput estimates
+     * of \ref setSplitting() (thread-safe)
+     *
+     * \param worker
+     *    Index of the worker that processed the unit
+     * \param pixels
+     *    Number of pixels of the work unit
+     * \param generated
+     *    Time at which the unit was generated (\ref readTimestampCounter())
+     * \param finished
+     *    Time at which the result became available
+     */
+    void recordThroughput(int worker, size_t pixels,
+        uint64_t generated, uint64_t finished);
+
+
     // ======================================================================
     //! @{ \name Implementation of the ParallelProcess interface
     // ======================================================================
@@ -57,8 +131,16 @@ protected:
      */
     void init(const Point2i &offset, const Vector2i &size, uint32_t blockSize);
 
+    /// Determine the position of the next block (relative to \c m_offset)
+    bool nextBlock(Point2i &pos);
+
+    /// Shrink a block for the given worker, see \ref setSplitting()
+    void splitBlock(int worker, const Point2i &pos, Vector2i &size);
+
     /// Protected constructor
-    inline BlockedImageProcess() { }
+    inline BlockedImageProcess() : m_splitting(false) {
+        m_throughputMutex = new Mutex();
+    }
     /// Virtual destructor
     virtual ~BlockedImageProcess() { }
 protected:
@@ -76,6 +158,22 @@ protected:
     int m_stepsLeft, m_numBlocksTotal;
     int m_numBlocksGenerated;
     int m_blockSize;
+    EBlockOrder m_blockOrder;
+    /// Precomputed block sequence (all orders except \ref ESpiralOrder)
+    std::vector<Point2i> m_blockSequence;
+
+    struct WorkerThroughput {
+        uint64_t started, finished;
+        size_t pixels;
+
+        inline WorkerThroughput() : started(0), finished(0), pixels(0) { }
+    };
+
+    bool m_splitting;
+    size_t m_numPixelsGenerated;
+    std::vector<std::pair<Point2i, Vector2i> > m_pendingBlocks;
+    std::vector<WorkerThroughput> m_throughput;
+    ref<Mutex> m_throughputMutex;
 };
 
 MTS_NAMESPACE_END
@@ -350,6 +350,17 @@ public:
     virtual Spectrum Li(const RayDifferential &ray,
         RadianceQueryRecord &rRec) const = 0;
 
+    /**
+     * \brief Does the result of \ref Li() only depend on the first
+     * intersection along the ray?
+     *
+     * Such integrators (e.g. the \c field plugin) neither trace any
+     * further rays nor consume random numbers and leave the query record
+     * untouched, so that callers which already found the first
+     * intersection can share a single record between several of them.
+     * The default implementation returns \c false.
+     */
+    virtual bool isFirstHitOnly() const { return false; }
 
     /**
      * \brief Generate a sample of the irradiance at a given surface point.
@@ -212,9 +212,25 @@ public:
      */
     bool get(const Intersection &its, Spectrum &E) const;
 
-    /// Manually insert an irradiance record
+    /**
+     * \brief Manually insert an irradiance record
+     *
+     * The record is immediately visible to lookups from all threads.
+     * To avoid contention, insertion does not acquire a lock: the
+     * record is instead queued in a list owned by the calling thread
+     * until the next call to \ref flush().
+     */
     void insert(Record *rec);
 
+    /**
+     * \brief Merge the records inserted by the calling thread
+     * into the shared record list
+     *
+     * Intended to be called at a coarse granularity, e.g.
+     * once per rendered image block.
+     */
+    void flush();
+
     /**
      * Serialize an irradiance cache to a binary data stream
      */
@@ -329,13 +345,17 @@ protected:
     /*                        Protected attributes                           */
     /* ===================================================================== */
 
+    typedef std::vector<Record *> RecordList;
+
     DynamicOctree<Record *> m_octree;
-    std::vector<Record *> m_records;
+    RecordList m_records;
+    PrimitiveThreadLocal<RecordList *> m_pending;
+    std::vector<RecordList *> m_pendingLists;
     Float m_kappa;
     Float m_sceneSize;
     Float m_minDist, m_maxDist;
     bool m_clampScreen, m_clampNeighbor, m_useGradients;
-    ref<Mutex> m_mutex;
+    mutable ref<Mutex> m_mutex;
 };
 
 MTS_NAMESPACE_END
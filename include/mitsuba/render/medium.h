@@ -152,6 +152,19 @@ public:
     virtual Spectrum evalTransmittance(const Ray &ray,
         Sampler *sampler = NULL) const = 0;
 
+    /**
+     * \brief Compute the transmittance along a ray segment that
+     * points toward the given emitter
+     *
+     * Media that have cached their transmittance toward the emitter
+     * (see \ref cacheEmitterTransmittance()) answer this with a lookup.
+     * The default implementation calls \ref evalTransmittance().
+     */
+    virtual Spectrum evalEmitterTransmittance(const Ray &ray,
+            const Emitter *emitter, Sampler *sampler = NULL) const {
+        return evalTransmittance(ray, sampler);
+    }
+
     /// Return the phase function of this medium
     inline const PhaseFunction *getPhaseFunction() const { return m_phaseFunction.get(); }
 
@@ -178,6 +191,14 @@ public:
        and addition of all child \ref ConfigurableObject instances). */
     virtual void configure();
 
+    /**
+     * \brief Precompute the transmittance toward the emitters of the
+     * scene, when the medium supports and enables this
+     *
+     * Called by integrators during their preprocessing pass.
+     */
+    virtual void cacheEmitterTransmittance(const Scene *scene) { }
+
     /// Serialize this medium to a stream
     virtual void serialize(Stream *stream, InstanceManager *manager) const;
 
@@ -193,12 +193,18 @@ public:
 
         stats::mipStorage += cacheSize;
 
-        /* Potentially create a MIP map cache file */
+        /* Potentially create a MIP map cache file. It is written under a
+           unique name and only renamed once complete: other processes
+           rendering the same scene then never map (or truncate) a
+           partially written file, and share the pages of the final one */
         uint8_t *mmapData = NULL, *mmapPtr = NULL;
+        bool publishCache = false;
         if (!cacheFilename.empty()) {
             Log(EInfo, "Generating MIP map cache file \"%s\" ..", cacheFilename.string().c_str());
             try {
-                m_mmap = new MemoryMappedFile(cacheFilename, cacheSize);
+                m_mmap = new MemoryMappedFile(fs::unique_path(
+                    cacheFilename.string() + ".%%%%-%%%%.tmp"), cacheSize);
+                publishCache = true;
             } catch (std::runtime_error &e) {
                 Log(EWarn, "Unable to create MIP map cache file \"%s\" -- "
                     "retrying with a temporary file. Error message was: %s",
@@ -232,9 +238,13 @@ public:
         if (m_minimum.min() < 0) {
             Log(EWarn, "The texture contains negative pixel values! These will be clamped!");
             Value *value = (Value *) bitmap->getData();
+            ssize_t count = (ssize_t) bitmap->getPixelCount();
 
-            for (size_t i=0, count=bitmap->getPixelCount(); i<count; ++i)
-                (*value++).clampNegative();
+            #if defined(MTS_OPENMP)
+                #pragma omp parallel for
+            #endif
+            for (ssize_t i=0; i<count; ++i)
+                value[i].clampNegative();
 
             m_pyramid[0].init((Value *) bitmap->getData(), m_minimum, m_maximum, m_average);
         }
@@ -288,6 +298,14 @@ public:
             header.maximum = m_maximum;
             header.average = m_average;
             memcpy(mmapData, &header, sizeof(MIPMapHeader));
+
+            if (publishCache) {
+                try {
+                    m_mmap->rename(cacheFilename);
+                } catch (std::runtime_error &e) {
+                    Log(EWarn, "Unable to store the MIP map cache file: %s", e.what());
+                }
+            }
         }
 
         Log(EDebug, "Created %s of MIP maps in %i ms", memString(
@@ -445,6 +463,41 @@ public:
         return fs::file_size(path) == expectedFileSize;
     }
 
+    /**
+     * \brief Read the resolution and value range stored in a cache file
+     * without mapping it into memory
+     *
+     * The file should be checked with \ref validateCacheFile() first.
+     * \return \c true upon success
+     */
+    static bool readCacheInfo(const fs::path &path, Vector2i &size,
+            Value &minimum, Value &maximum, Value &average) {
+        fs::ifstream is(path);
+        MIPMapHeader header;
+        is.read((char *) &header, sizeof(MIPMapHeader));
+        if (!is.good())
+            return false;
+        size = Vector2i(header.width, header.height);
+        minimum = header.minimum;
+        maximum = header.maximum;
+        average = header.average;
+        return true;
+    }
+
+    /// Is the image pyramid stored in a memory-mapped file?
+    inline bool isMapped() const { return m_mmap.get() != NULL; }
+
+    /**
+     * \brief Release the physical memory of a memory-mapped image pyramid
+     *
+     * The contents are transparently paged back in from the cache file
+     * by subsequent lookups. See \ref MemoryMappedFile::evict().
+     */
+    inline void evict() const {
+        if (m_mmap.get())
+            m_mmap->evict();
+    }
+
     /// Return the size of all buffers
     size_t getBufferSize() const {
         size_t size = 0;
@@ -796,24 +849,40 @@ protected:
 
         Value result(0.0f);
         Float denominator = 0.0f;
-        Float ddq = 2*As, uu0 = (Float) u0 - u;
+        const Float lutSize = (Float) MTS_MIPMAP_LUT_SIZE,
+                    ddq = 2*As, invTwoAs = 0.5f / As;
+        const Array2DType &pyramid = m_pyramid[level];
         int nSamples = 0;
 
         for (int vt = v0; vt <= v1; ++vt) {
             const Float vv = (Float) vt - v;
 
-            Float q  = As*uu0*uu0 + (Bs*uu0 + Cs*vv)*vv;
-            Float dq = As*(2*uu0 + 1) + Bs*vv;
-
-            for (int ut = u0; ut <= u1; ++ut) {
-                if (q < (Float) MTS_MIPMAP_LUT_SIZE) {
-                    uint32_t qi = (uint32_t) q;
-                    if (qi < MTS_MIPMAP_LUT_SIZE) {
-                        const Float weight = m_weightLut[(int) q];
-                        result += evalTexel(level, ut, vt) * weight;
-                        denominator += weight;
-                        ++nSamples;
-                    }
+            /* Only visit the texels of this row that the ellipse covers, i.e.
+               where q = As*uu^2 + Bs*uu*vv + Cs*vv^2 is below the table size.
+               For skinny ellipses, most of the bounding box is skipped. The
+               span is padded by one texel to be safe against round-off */
+            Float qb = Bs*vv, qc = Cs*vv*vv,
+                  discrim = qb*qb - 4*As*(qc - lutSize);
+            if (!(discrim > 0))
+                continue;
+            Float sqrtDiscrim = std::sqrt(discrim);
+            int us = std::max(u0, math::ceilToInt(u + (-qb - sqrtDiscrim) * invTwoAs) - 1),
+                ue = std::min(u1, math::floorToInt(u + (-qb + sqrtDiscrim) * invTwoAs) + 1);
+
+            Float uu = (Float) us - u;
+            Float q  = (As*uu + qb)*uu + qc;
+            Float dq = As*(2*uu + 1) + qb;
+
+            /* Rows that don't touch the boundary skip the boundary handling */
+            bool interior = us >= 0 && ue < size.x && vt >= 0 && vt < size.y;
+
+            for (int ut = us; ut <= ue; ++ut) {
+                if (q >= 0 && q < lutSize) {
+                    const Float weight = m_weightLut[(int) q];
+                    result += (interior ? Value(pyramid(ut, vt))
+                        : evalTexel(level, ut, vt)) * weight;
+                    denominator += weight;
+                    ++nSamples;
                 }
 
                 q += dq;
@@ -70,6 +70,39 @@ public:
      */
     static Float turbulence(const Point &p, const Vector &dpdx,
         const Vector &dpdy, Float omega, int maxOctaves);
+
+    /**
+     * \brief Evaluate the Perlin noise function at \c count positions
+     *
+     * Equivalent to calling \ref perlinNoise() for every position.
+     * Single precision builds with SSE support process four positions
+     * at a time.
+     */
+    static void perlinNoise(const Point *p, Float *result, size_t count);
+
+    /**
+     * \brief Evaluate a fractional Brownian noise function
+     * at \c count positions
+     *
+     * Unlike \ref fbm(const Point &, const Vector &, const Vector &, Float, int),
+     * the (fractional) number of octaves is given explicitly and shared by all
+     * positions, so that every octave can be evaluated for the entire batch
+     * using \ref perlinNoise(const Point *, Float *, size_t).
+     */
+    static void fbm(const Point *p, Float *result, size_t count,
+        Float omega, Float octaves);
+
+    /// Batched variant of \ref turbulence() (see \ref fbm(const Point *, Float *, size_t, Float, Float))
+    static void turbulence(const Point *p, Float *result, size_t count,
+        Float omega, Float octaves);
+
+    /**
+     * \brief Return an upper bound on the magnitude of the values returned
+     * by the batched \ref fbm() and \ref turbulence() functions
+     *
+     * This is useful to compute majorants for Woodcock tracking.
+     */
+    static Float getFbmBound(Float omega, Float octaves);
 };
 
 MTS_NAMESPACE_END
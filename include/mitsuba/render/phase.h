@@ -185,6 +185,23 @@ public:
      */
     virtual Float pdf(const PhaseFunctionSamplingRecord &pRec) const;
 
+    /**
+     * \brief Evaluate the phase function for a batch of outgoing
+     * directions that share the same medium record and incident direction
+     *
+     * The default implementation calls \ref eval() for every entry.
+     * Phase functions can override this to evaluate the batch without a
+     * virtual call per entry, or to process several entries at once.
+     *
+     * \param mRec    The medium sampling record shared by all entries
+     * \param wi      The shared incident direction
+     * \param count   Number of entries
+     * \param wo      Array of \c count outgoing directions
+     * \param result  Will be filled with \c count phase function values
+     */
+    virtual void evalBatch(const MediumSamplingRecord &mRec, const Vector &wi,
+        size_t count, const Vector *wo, Float *result) const;
+
     /**
      * \brief Does this phase function require directionally varying scattering
      * and extinction coefficients?
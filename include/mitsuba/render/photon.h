@@ -32,11 +32,27 @@
  */
 #define MTS_PHOTONMAP_LEFT_BALANCED 0
 
+/**
+ * \brief Should Mitsuba use a compact photon representation?
+ *
+ * Single precision RGB builds always store the photon power in Greg
+ * Ward's RGBE format. Enabling this option does the same in double
+ * precision RGB builds, which reduces the size of a photon from 72
+ * to 40 bytes at the cost of an 8 bit mantissa per color channel.
+ */
+#define MTS_PHOTONMAP_COMPACT 0
+
+#if SPECTRUM_SAMPLES == 3 && (defined(SINGLE_PRECISION) || MTS_PHOTONMAP_COMPACT == 1)
+#define MTS_PHOTON_RGBE 1
+#else
+#define MTS_PHOTON_RGBE 0
+#endif
+
 MTS_NAMESPACE_BEGIN
 
 /// Internal data record used by \ref Photon
 struct PhotonData {
-#if defined(SINGLE_PRECISION) && SPECTRUM_SAMPLES == 3
+#if MTS_PHOTON_RGBE == 1
     uint8_t power[4];       //!< Photon power stored in Greg Ward's RGBE format
 #else
     Spectrum power;         //!< Accurate spectral photon power representation
@@ -108,7 +124,7 @@ public:
 
     /// Convert the photon power from RGBE to floating point
     inline Spectrum getPower() const {
-#if defined(SINGLE_PRECISION) && SPECTRUM_SAMPLES == 3
+#if MTS_PHOTON_RGBE == 1
         Spectrum result;
         result.fromRGBE(data.power);
         return result;
@@ -120,6 +136,21 @@ public:
     /// Serialize to a binary data stream
     void serialize(Stream *stream) const;
 
+    /**
+     * \brief Serialize an array of photons
+     *
+     * The fields of the photons are written as contiguous arrays (in
+     * chunks of \ref ESerializationChunk photons), which is much faster
+     * than serializing the photons one at a time.
+     */
+    static void serialize(Stream *stream, const Photon *photons, size_t count);
+
+    /// Unserialize an array of photons that was written by \ref serialize()
+    static void unserialize(Stream *stream, Photon *photons, size_t count);
+
+    /// Number of photons per chunk of the array serialization
+    enum { ESerializationChunk = 65536 };
+
     /// Return a string representation (for debugging)
     std::string toString() const;
 protected:
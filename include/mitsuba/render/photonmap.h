@@ -158,6 +158,18 @@ public:
         }
     }
 
+    /**
+     * \brief Append as many photons of a contiguous array as the
+     * remaining capacity permits
+     *
+     * \return The number of photons that were appended
+     */
+    inline size_t tryAppend(const Photon *photons, size_t count) {
+        count = std::min(count, capacity() - size());
+        m_kdtree.append(photons, count);
+        return count;
+    }
+
     /// Scale all photon power values contained in this photon map
     inline void setScaleFactor(Float value) { m_scale = value; }
 
@@ -168,9 +180,11 @@ public:
      * \brief Build a photon map over the supplied photons.
      *
      * This has to be done once after all photons have been stored,
-     * but prior to executing any queries.
+     * but prior to executing any queries. Large photon maps are built
+     * in parallel on the local workers of the scheduler (when it is
+     * running and this function is not invoked by one of its workers).
      */
-    inline void build(bool recomputeAABB = false) { m_kdtree.build(recomputeAABB); }
+    void build(bool recomputeAABB = false);
 
     /// Return the depth of the constructed KD-tree
     inline size_t getDepth() const { return m_kdtree.getDepth(); }
@@ -56,6 +56,44 @@ private:
     Vector2i m_size;
 };
 
+/**
+ * \brief Rectangular work unit with a mask of the pixels that
+ * should be processed.
+ *
+ * Used by \ref AdaptiveRenderProcess to restrict a progressive
+ * rendering pass to the pixels that have not converged yet.
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER AdaptiveWorkUnit : public RectangularWorkUnit {
+public:
+    inline AdaptiveWorkUnit() { }
+
+    /* WorkUnit implementation */
+    void set(const WorkUnit *wu);
+    void load(Stream *stream);
+    void save(Stream *stream) const;
+
+    /// Set the pixel mask (row-major, relative to the offset)
+    inline void setMask(const std::vector<uint8_t> &mask) { m_mask = mask; }
+
+    /// Return the pixel mask
+    inline const std::vector<uint8_t> &getMask() const { return m_mask; }
+
+    /// Should the pixel at the given position relative to the offset be processed?
+    inline bool isActive(int x, int y) const {
+        return m_mask[x + y * getSize().x] != 0;
+    }
+
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~AdaptiveWorkUnit() { }
+private:
+    std::vector<uint8_t> m_mask;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_RENDER_RECTWU_H_ */
@@ -110,6 +110,32 @@ public:
     /// Return the amount of time spent rendering the given job (in seconds)
     inline Float getRenderTime() const { return m_queue->getRenderTime(this); }
 
+    /**
+     * \brief Enable or disable the collection of scheduling telemetry
+     *
+     * When enabled, the image block processes of this job report the
+     * \ref WorkUnitTelemetry of every rendered block, and the job writes
+     * it to a CSV file named <tt>[destination]_workunits.csv</tt> once
+     * rendering has finished. This is useful to analyze the load balance,
+     * e.g. to choose the block size or the backlog of remote workers.
+     */
+    inline void setTelemetryEnabled(bool enabled) { m_telemetryEnabled = enabled; }
+
+    /// Is the collection of scheduling telemetry enabled?
+    inline bool isTelemetryEnabled() const { return m_telemetryEnabled; }
+
+    /// Record the telemetry of a rendered image block (thread-safe)
+    void recordTelemetry(const WorkUnitTelemetry &telemetry,
+        const Point2i &offset, const Vector2i &size) const;
+
+    /**
+     * \brief Write the recorded telemetry to a CSV file
+     *
+     * There is one line per work unit, and all times are given in
+     * seconds relative to the first generated work unit.
+     */
+    void writeTelemetry(const fs::path &filename) const;
+
     MTS_DECLARE_CLASS()
 protected:
     /// Virtual destructor
@@ -125,6 +151,14 @@ private:
     bool m_ownsSamplerResource;
     bool m_cancelled;
     bool m_interactive;
+    bool m_telemetryEnabled;
+
+    struct BlockTelemetry : public WorkUnitTelemetry {
+        Point2i offset;
+        Vector2i size;
+    };
+    mutable std::vector<BlockTelemetry> m_telemetry;
+    mutable ref<Mutex> m_telemetryMutex;
 };
 
 MTS_NAMESPACE_END
@@ -23,6 +23,7 @@
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/imageproc.h>
 #include <mitsuba/render/renderqueue.h>
+#include <boost/function.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -30,7 +31,15 @@ MTS_NAMESPACE_BEGIN
  * \brief Parallel process for rendering with sampling-based integrators.
  *
  * Splits an image into independent rectangular pixel regions, which are
- * then rendered in parallel.
+ * then rendered in parallel. The blocks are handed out in the order
+ * configured by \ref Scene::setBlockOrder(). In the case of
+ * \ref BlockedImageProcess::ECostOrder, the rendering time of every
+ * block is measured and stored in the film for the next rendering.
+ *
+ * When \ref setSplitting() is enabled (before binding the \c sensor
+ * resource), the blocks are split near the end of the rendering based on
+ * the measured throughput of the workers. A split block is reported to
+ * \ref Film::setBlockComplete() once all of its parts have been merged.
  *
  * \sa SamplingIntegrator
  * \ingroup librender
@@ -70,6 +79,9 @@ public:
     void processResult(const WorkResult *result, bool cancelled);
     void bindResource(const std::string &name, int id);
     EStatus generateWork(WorkUnit *unit, int worker);
+    bool isTelemetryEnabled() const;
+    void recordTelemetry(const WorkResult *result,
+        const WorkUnitTelemetry &telemetry);
 
     //! @}
     // ======================================================================
@@ -78,6 +90,18 @@ public:
 protected:
     /// Virtual destructor
     virtual ~BlockedRenderProcess();
+
+    /// Return the size of a (not split) block given its index
+    inline Vector2i getFullBlockSize(const Vector2i &index) const {
+        return Vector2i(
+            std::min(m_blockSize, m_size.x - index.x * m_blockSize),
+            std::min(m_blockSize, m_size.y - index.y * m_blockSize));
+    }
+
+    /// Progress made by a finished block (pixels when splitting, blocks otherwise)
+    inline int getProgressUnits(const Vector2i &size) const {
+        return m_splitting ? size.x * size.y : 1;
+    }
 protected:
     ref<RenderQueue> m_queue;
     ref<Scene> m_scene;
@@ -90,6 +114,242 @@ protected:
     Bitmap::EPixelFormat m_pixelFormat;
     int m_channelCount;
     bool m_warnInvalid;
+    EBlockOrder m_sceneBlockOrder;
+    ref<Bitmap> m_blockCosts;
+    size_t m_blockCostPixels;
+    std::vector<int> m_blockPixelsLeft;
+};
+
+/**
+ * \brief Image block with additional per-pixel sample statistics
+ *
+ * Returned by the workers of an \ref AdaptiveRenderProcess. The meaning
+ * of the statistics channels is up to the integrator, but they must be
+ * additive (e.g. sample counts and sums), so that the results of several
+ * rendering passes can simply be accumulated.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER AdaptiveWorkResult : public ImageBlock {
+public:
+    AdaptiveWorkResult(Bitmap::EPixelFormat fmt, const Vector2i &size,
+        const ReconstructionFilter *filter, int statChannels,
+        int channels = -1, bool warn = true);
+
+    /// Return the number of statistics channels per pixel
+    inline int getStatisticsChannelCount() const { return m_statChannels; }
+
+    /// Return the statistics of a pixel (relative to the block offset)
+    inline double *getStatistics(int x, int y) {
+        return m_statistics->getFloat64Data()
+            + (x + y * m_statistics->getWidth()) * m_statChannels;
+    }
+
+    /// Return the statistics of a pixel (relative to the block offset)
+    inline const double *getStatistics(int x, int y) const {
+        return m_statistics->getFloat64Data()
+            + (x + y * m_statistics->getWidth()) * m_statChannels;
+    }
+
+    /// Clear the statistics of all pixels
+    inline void clearStatistics() { m_statistics->clear(); }
+
+    /* WorkResult implementation */
+    void load(Stream *stream);
+    void save(Stream *stream) const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~AdaptiveWorkResult() { }
+protected:
+    ref<Bitmap> m_statistics;
+    int m_statChannels;
+};
+
+/**
+ * \brief Parallel process that renders one pass of progressive
+ * adaptive sampling.
+ *
+ * A shared buffer stores additive sample statistics of every pixel and
+ * persists across the passes. At the start of a pass, an integrator-supplied
+ * error function is evaluated on these statistics. Only the pixels whose
+ * error is still above one are rendered, and the blocks containing them
+ * are handed out in the order of decreasing total error. Here, cores keep
+ * working on the difficult image regions, while already converged blocks
+ * no longer cost anything.
+ *
+ * The workers call \ref SamplingIntegrator::renderBlock() with the active
+ * pixels of a block and an \ref AdaptiveWorkResult, into which the
+ * integrator should write the statistics of the samples it has taken.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER AdaptiveRenderProcess : public BlockedRenderProcess {
+public:
+    /**
+     * \brief Computes the relative error of a pixel from its statistics
+     *
+     * Values less than or equal to one mean that the pixel has converged.
+     */
+    typedef boost::function<Float (const double *)> ErrorFunction;
+
+    /**
+     * \brief Create a new rendering pass
+     *
+     * \param pass
+     *    Index of the pass. All pixels are rendered in the first pass.
+     * \param statChannels
+     *    Number of statistics channels per pixel
+     * \param statistics
+     *    Statistics buffer of the previous passes, or \c NULL for
+     *    the first pass
+     * \param error
+     *    Per-pixel error function
+     */
+    AdaptiveRenderProcess(const RenderJob *parent, RenderQueue *queue,
+        int blockSize, int pass, int statChannels, Bitmap *statistics,
+        const ErrorFunction &error);
+
+    /**
+     * \brief Render progressive passes until all pixels have converged
+     *
+     * \param process
+     *    Is set to the currently running pass, so that it can be
+     *    cancelled by the integrator
+     * \param maxPasses
+     *    Maximum number of passes, a negative value means no limit
+     * \param statistics
+     *    Optional pointer, which receives the final statistics buffer
+     */
+    static bool render(SamplingIntegrator *integrator,
+        ref<ParallelProcess> &process, Scene *scene, RenderQueue *queue,
+        const RenderJob *job, int sceneResID, int sensorResID,
+        int samplerResID, int statChannels, int maxPasses,
+        const ErrorFunction &error, ref<Bitmap> *statistics = NULL);
+
+    /// Return the number of pixels rendered by this pass
+    inline size_t getActivePixelCount() const { return m_activePixels; }
+
+    /// Return the number of blocks rendered by this pass
+    inline size_t getBlockCount() const { return m_blocks.size(); }
+
+    /// Return the statistics buffer shared by all passes
+    inline Bitmap *getStatistics() { return m_statistics; }
+
+    /// Return the integer offset of the statistics buffer
+    inline const Point2i &getStatisticsOffset() const { return m_offset; }
+
+    // ======================================================================
+    //! @{ \name Implementation of the ParallelProcess interface
+    // ======================================================================
+
+    ref<WorkProcessor> createWorkProcessor() const;
+    void processResult(const WorkResult *result, bool cancelled);
+    void bindResource(const std::string &name, int id);
+    EStatus generateWork(WorkUnit *unit, int worker);
+
+    //! @}
+    // ======================================================================
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~AdaptiveRenderProcess() { }
+
+    /// Determine the active pixels and order the blocks by their error
+    void planBlocks();
+protected:
+    struct Block {
+        Point2i offset;
+        Vector2i size;
+        std::vector<uint8_t> mask;
+        Float error;
+
+        inline bool operator<(const Block &block) const {
+            return error > block.error;
+        }
+    };
+
+    std::vector<Block> m_blocks;
+    size_t m_blockIndex, m_activePixels;
+    ref<Bitmap> m_statistics;
+    ErrorFunction m_error;
+    int m_pass, m_statChannels;
+};
+
+/**
+ * \brief Parallel process that renders one pass of a coarse-to-fine
+ * progressive rendering.
+ *
+ * The image is covered by several passes with a decreasing pixel stride.
+ * The first pass renders the pixels whose coordinates are multiples of
+ * the coarsest stride, and every further pass halves the stride and
+ * renders the pixels that were not visited yet. Each pixel thus still
+ * receives all of its samples exactly once, and the final image matches
+ * a regular rendering. Together with the reconstruction filter, a low
+ * resolution version of the complete frame becomes visible after a small
+ * fraction of the total work.
+ *
+ * \ref SamplingIntegrator::render() uses this process for interactive
+ * render jobs (e.g. those started from the GUI).
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER ProgressiveRenderProcess : public BlockedRenderProcess {
+public:
+    /**
+     * \brief Create a new rendering pass
+     *
+     * \param stride
+     *    Pixel stride of this pass (a power of two)
+     * \param coarsestStride
+     *    Pixel stride of the first pass
+     */
+    ProgressiveRenderProcess(const RenderJob *parent, RenderQueue *queue,
+        int blockSize, int stride, int coarsestStride);
+
+    /**
+     * \brief Render all passes
+     *
+     * \param process
+     *    Is set to the currently running pass, so that it can be
+     *    cancelled by the integrator
+     * \param levels
+     *    Number of passes before the final one; the coarsest
+     *    stride is <tt>2^levels</tt>
+     */
+    static bool render(SamplingIntegrator *integrator,
+        ref<ParallelProcess> &process, Scene *scene, RenderQueue *queue,
+        const RenderJob *job, int sceneResID, int sensorResID,
+        int samplerResID, int levels);
+
+    // ======================================================================
+    //! @{ \name Implementation of the ParallelProcess interface
+    // ======================================================================
+
+    ref<WorkProcessor> createWorkProcessor() const;
+    void processResult(const WorkResult *result, bool cancelled);
+    EStatus generateWork(WorkUnit *unit, int worker);
+    void bindResource(const std::string &name, int id);
+
+    //! @}
+    // ======================================================================
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~ProgressiveRenderProcess() { }
+
+    /// Is the pixel at the given position relative to the image offset rendered in this pass?
+    inline bool isActive(int x, int y) const {
+        if ((x & (m_stride - 1)) || (y & (m_stride - 1)))
+            return false;
+        return m_stride == m_coarsestStride ||
+            (x & (2 * m_stride - 1)) || (y & (2 * m_stride - 1));
+    }
+protected:
+    int m_stride, m_coarsestStride;
 };
 
 MTS_NAMESPACE_END
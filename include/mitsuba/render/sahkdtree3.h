@@ -169,6 +169,53 @@ protected:
         Point p;
     };
 
+    /**
+     * \brief Check whether a shadow ray hits any primitive of a leaf
+     *
+     * Called by the shadow ray traversal for the entries
+     * <tt>[start, end)</tt> of the index list. Derived classes can provide
+     * their own version to test several primitives at once.
+     */
+    FINLINE bool leafIntersectsShadowRay(const Ray &ray, IndexType start,
+            IndexType end, Float mint, Float maxt) const {
+        for (IndexType entry=start; entry != end; entry++) {
+            if (cast()->intersect(ray, m_indices[entry], mint, maxt))
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * \brief Intersect a ray with all primitives of a leaf
+     *
+     * Called by the traversal for the entries <tt>[start, end)</tt> of
+     * the index list. Whenever a closer intersection is found, its
+     * distance is stored in both \c t and \c maxt. Derived classes can
+     * provide their own version to test several primitives at once.
+     */
+    FINLINE bool leafIntersect(const Ray &ray, IndexType start, IndexType end,
+            Float mint, Float &maxt, Float &t, void *temp, HashedMailbox &mailbox) const {
+        bool foundIntersection = false;
+        for (IndexType entry=start; entry != end; entry++) {
+            const IndexType primIdx = m_indices[entry];
+
+            #if defined(MTS_KD_MAILBOX_ENABLED)
+            if (mailbox.contains(primIdx))
+                continue;
+            #endif
+
+            if (cast()->intersect(ray, primIdx, mint, maxt, t, temp)) {
+                maxt = t;
+                foundIntersection = true;
+            }
+
+            #if defined(MTS_KD_MAILBOX_ENABLED)
+            mailbox.put(primIdx);
+            #endif
+        }
+        return foundIntersection;
+    }
+
     /**
      * \brief Ray tracing kd-tree traversal loop (Havran variant)
      *
@@ -184,9 +231,7 @@ protected:
         static const int nextAxisTable[] = { 1, 2, 0 };
         #endif
 
-        #if defined(MTS_KD_MAILBOX_ENABLED)
         HashedMailbox mailbox;
-        #endif
 
         /* Set up the entry point */
         uint32_t enPt = 0;
@@ -268,31 +313,13 @@ protected:
             }
 
             /* Reached a leaf node */
-            for (IndexType entry=currNode->getPrimStart(),
-                    last = currNode->getPrimEnd(); entry != last; entry++) {
-                const IndexType primIdx = m_indices[entry];
-
-                #if defined(MTS_KD_MAILBOX_ENABLED)
-                if (mailbox.contains(primIdx))
-                    continue;
-                #endif
-
-                bool result;
-                if (!shadowRay)
-                    result = cast()->intersect(ray, primIdx, mint, maxt, t, temp);
-                else
-                    result = cast()->intersect(ray, primIdx, mint, maxt);
-
-                if (result) {
-                    if (shadowRay)
-                        return true;
-                    maxt = t;
-                    foundIntersection = true;
-                }
-
-                #if defined(MTS_KD_MAILBOX_ENABLED)
-                mailbox.put(primIdx);
-                #endif
+            if (shadowRay) {
+                if (cast()->leafIntersectsShadowRay(ray, currNode->getPrimStart(),
+                        currNode->getPrimEnd(), mint, maxt))
+                    return true;
+            } else if (cast()->leafIntersect(ray, currNode->getPrimStart(),
+                    currNode->getPrimEnd(), mint, maxt, t, temp, mailbox)) {
+                foundIntersection = true;
             }
 
             if (stack[exPt].t > maxt)
@@ -499,8 +526,35 @@ protected:
         return foundIntersection;
     }
 
+    /// Predicate for \ref rayIntersectFully() that never terminates early
+    struct NeverStopCollecting {
+        inline bool operator()(const std::vector<Intersection> &its,
+                size_t firstNew) const {
+            return false;
+        }
+    };
+
+    FINLINE void rayIntersectFully(const Ray &ray,
+            Float mint_, Float maxt_, std::vector<Intersection> &its,
+            const std::vector<Shape *> *shapes = NULL) const {
+        NeverStopCollecting stop;
+        rayIntersectFully(ray, mint_, maxt_, its, stop, shapes);
+    }
+
+    /**
+     * \brief Collect all intersections along the ray, but allow the
+     * caller to terminate the traversal early
+     *
+     * Leaf nodes are visited in front-to-back order. After each leaf
+     * that produced new intersections, <tt>stop(its, firstNew)</tt> is
+     * called, where \c firstNew is the index of the first intersection
+     * that was added by that leaf. If it returns \c true, the traversal
+     * ends and all intersections that were found so far are kept.
+     */
+    template <typename StopPredicate>
     FINLINE void rayIntersectFully(const Ray &ray,
             Float mint_, Float maxt_, std::vector<Intersection> &its,
+            StopPredicate &stop,
             const std::vector<Shape *> *shapes = NULL) const {
         KDStackEntry stack[MTS_KD_MAXDEPTH];
         int stackPos = 0;
@@ -549,12 +603,16 @@ protected:
                     }
                 }
             } else {
+                const size_t firstNew = its.size();
                 for (unsigned int entry=node->getPrimStart(),
                         last = node->getPrimEnd(); entry != last; entry++) {
                     const IndexType primIdx = m_indices[entry];
                     cast()->intersectFully(ray, primIdx, mint, maxt, its, shapes);
                 }
 
+                if (its.size() > firstNew && stop(its, firstNew))
+                    break;
+
                 if (stackPos > 0) {
                     --stackPos;
                     node = stack[stackPos].node;
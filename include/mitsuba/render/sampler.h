@@ -116,6 +116,20 @@ public:
     /// Retrieve the next two component values from the current sample
     virtual Point2 next2D() = 0;
 
+    /**
+     * \brief Retrieve the next \c count component values from the
+     * current sample
+     *
+     * This is equivalent to calling \ref next1D() \c count times, which is
+     * what the default implementation does. Samplers that can generate
+     * blocks of values more efficiently override it. See \ref SampleStream
+     * for a convenient way of consuming such blocks.
+     */
+    virtual void next1DBlock(Float *dest, size_t count);
+
+    /// Same as \ref next1DBlock(), but for \ref next2D()
+    virtual void next2DBlock(Point2 *dest, size_t count);
+
     /**
      * \brief Retrieve the next 2D array of values from the current sample.
      *
@@ -180,6 +194,75 @@ protected:
     size_t m_dimension1DArray, m_dimension2DArray;
 };
 
+/**
+ * \brief Non-virtual handle for drawing long sequences of samples
+ *
+ * Code that draws many values from a \ref Sampler in a row (e.g. the
+ * tracking loops of heterogeneous media) can do so through this class,
+ * which fetches blocks of values using \ref Sampler::next1DBlock() and
+ * \ref Sampler::next2DBlock() and hands them out through inline
+ * accessors. The block sizes start small and grow as values are
+ * consumed, so that at most about as many sample dimensions are skipped
+ * as were used.
+ *
+ * A stream draws from the current sample of its sampler and must not
+ * outlive it, i.e. it has to be discarded before the sampler's
+ * \ref Sampler::advance() or \ref Sampler::generate() function is
+ * called. It is fine to interleave its use with direct calls to the
+ * sampler; they simply obtain other dimensions of the sample.
+ *
+ * \ingroup librender
+ */
+class SampleStream {
+public:
+    /// Maximum number of values that are fetched at once
+    enum { EMaxBlockSize = 32 };
+
+    /// Create a new sample stream drawing from the current sample of \c sampler
+    explicit inline SampleStream(Sampler *sampler) : m_sampler(sampler),
+        m_pos1D(0), m_size1D(0), m_block1D(2),
+        m_pos2D(0), m_size2D(0), m_block2D(2) { }
+
+    /// Retrieve the next component value
+    inline Float next1D() {
+        if (EXPECT_NOT_TAKEN(m_pos1D == m_size1D))
+            refill1D();
+        return m_values1D[m_pos1D++];
+    }
+
+    /// Retrieve the next two component values
+    inline Point2 next2D() {
+        if (EXPECT_NOT_TAKEN(m_pos2D == m_size2D))
+            refill2D();
+        return m_values2D[m_pos2D++];
+    }
+
+    /// Return the underlying sampler
+    inline Sampler *getSampler() const { return m_sampler; }
+
+private:
+    inline void refill1D() {
+        m_size1D = m_block1D;
+        m_sampler->next1DBlock(m_values1D, m_size1D);
+        m_block1D = std::min(2 * m_block1D, (size_t) EMaxBlockSize);
+        m_pos1D = 0;
+    }
+
+    inline void refill2D() {
+        m_size2D = m_block2D;
+        m_sampler->next2DBlock(m_values2D, m_size2D);
+        m_block2D = std::min(2 * m_block2D, (size_t) EMaxBlockSize);
+        m_pos2D = 0;
+    }
+
+private:
+    Sampler *m_sampler;
+    Float m_values1D[EMaxBlockSize];
+    Point2 m_values2D[EMaxBlockSize];
+    size_t m_pos1D, m_size1D, m_block1D;
+    size_t m_pos2D, m_size2D, m_block2D;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_RENDER_SAMPLER_H_ */
@@ -25,6 +25,7 @@
 #include <mitsuba/core/aabb.h>
 #include <mitsuba/render/trimesh.h>
 #include <mitsuba/render/skdtree.h>
+#include <mitsuba/render/imageproc.h>
 #include <mitsuba/render/sensor.h>
 #include <mitsuba/render/integrator.h>
 #include <mitsuba/render/bsdf.h>
@@ -33,6 +34,7 @@
 #include <mitsuba/render/medium.h>
 #include <mitsuba/render/volume.h>
 #include <mitsuba/render/phase.h>
+#include <mitsuba/render/emitterbvh.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -64,22 +66,81 @@ public:
     /// Unserialize a scene from a binary data stream
     Scene(Stream *stream, InstanceManager *manager);
 
+    /// Parts of the scene that \ref initialize() needs to update
+    enum EDirtyFlags {
+        /// Shapes were added, removed or moved (rebuilds the kd-tree)
+        EGeometryDirty   = 0x01,
+        /// Emitters were added or modified (rebuilds the emitter sampling data)
+        EEmittersDirty   = 0x02,
+        /// The sensor was moved or replaced
+        ESensorDirty     = 0x04,
+        /// Precomputed subsurface scattering data is out of date
+        ESubsurfaceDirty = 0x08
+    };
+
     /**
      * \brief Initialize the scene
      *
      * This function \a must be called before using any
-     * of the methods in this class.
+     * of the methods in this class. When called again, only the
+     * parts that were flagged using \ref markDirty() are updated.
      */
     void initialize();
 
+    /**
+     * \brief Flag parts of the scene as modified (see \ref EDirtyFlags)
+     *
+     * The next call to \ref initialize(), which \ref preprocess() also
+     * performs, only updates the affected subsystems. Changes to the
+     * geometry or the emitters also discard the data precomputed by
+     * subsurface scattering models. Changes to BSDFs need no flag,
+     * see \ref replaceObject().
+     */
+    inline void markDirty(uint32_t flags) { m_dirty |= flags; }
+
+    /// Return the parts of the scene that are waiting for an update
+    inline uint32_t getDirtyFlags() const { return m_dirty; }
+
     /**
      *\brief Invalidate the kd-tree
      *
      * This function must be called if, after running \ref initialize(),
-     * additional geometry is added to the scene.
+     * additional geometry is added to the scene. It is equivalent to
+     * <tt>markDirty(EGeometryDirty)</tt>, except that the old kd-tree
+     * is released right away.
      */
     void invalidate();
 
+    /**
+     * \brief Use the kd-tree of another scene if it contains exactly
+     * the same shapes
+     *
+     * This is checked by the next \ref initialize() that builds a kd-tree,
+     * e.g. for the next frame of an animation whose geometry was reused
+     * by a \ref SceneObjectCache. The other scene must be initialized.
+     */
+    void reuseKDTree(const Scene *scene);
+
+    /**
+     * \brief Update the emitter sampling data structures
+     *
+     * This function must be called if, after running \ref initialize(),
+     * emitters or the sensor were modified (e.g. by assigning a new
+     * world transformation). The kd-tree is kept.
+     */
+    void updateEmitters();
+
+    /**
+     * \brief Replace a BSDF or subsurface scattering model
+     *
+     * Every shape referencing \c original is switched over to
+     * \c replacement, which must be fully configured and of the same
+     * kind. The kd-tree is kept, so that parameter sweeps only pay for
+     * \ref preprocess() and the rendering itself.
+     */
+    void replaceObject(ConfigurableObject *original,
+        ConfigurableObject *replacement);
+
     /**
      * \brief Initialize the scene for bidirectional rendering algorithms.
      *
@@ -242,6 +303,18 @@ public:
         return m_kdtree->rayIntersect(ray);
     }
 
+    /**
+     * \brief Test a batch of up to \ref MTS_KD_RAY_BATCH rays for occlusion
+     *
+     * The rays are traced as coherent packets where possible, see
+     * \ref ShapeKDTree::rayIntersectBatch().
+     *
+     * \return A bit mask, whose bit \c i is set when \c rays[i] is occluded
+     */
+    inline uint32_t rayIntersectBatch(const Ray *rays, size_t count) const {
+        return m_kdtree->rayIntersectBatch(rays, count);
+    }
+
     /**
      * \brief Intersect a ray against all primitives stored in the scene
      * and return detailed intersection information of all intersections
@@ -265,9 +338,44 @@ public:
     inline void rayIntersectFully(const Ray &ray,
             std::vector<Intersection> &its,
             const std::vector<Shape *> *shapes = NULL) const {
-        m_kdtree->rayIntersectFully(ray, its, shapes);
+        selectKDTree(shapes)->rayIntersectFully(ray, its, shapes);
+    }
+
+    /**
+     * \brief Like \ref rayIntersectFully(), but stop collecting
+     * intersections as soon as the predicate \c stop says so.
+     *
+     * The kd-tree leaves are visited in front-to-back order, so this is
+     * useful when intersections carry less and less importance further
+     * along the ray. See \ref ShapeKDTree::IntersectionStopFunc.
+     */
+    inline void rayIntersectFully(const Ray &ray,
+            std::vector<Intersection> &its,
+            const ShapeKDTree::IntersectionStopFunc &stop,
+            const std::vector<Shape *> *shapes = NULL) const {
+        selectKDTree(shapes)->rayIntersectFully(ray, its, stop, shapes);
     }
 
+    /**
+     * \brief Collect intersections along the ray by traversing outwards
+     * from the parameter value \c tCenter, in both directions.
+     *
+     * First the part <tt>[tCenter, ray.maxt]</tt> is traversed, then
+     * <tt>[ray.mint, tCenter]</tt> (starting from \c tCenter). Each of
+     * the two halves is traversed front-to-back (as seen from
+     * \c tCenter) and ends as soon as \c stop returns \c true. The
+     * resulting intersection records are all expressed with respect to
+     * the original \c ray (i.e. \c t and \c wi are as if they were
+     * found by \ref rayIntersectFully()).
+     *
+     * \param tCenter
+     *    Gets clamped to the range of the ray.
+     */
+    void rayIntersectFullyOutwards(const Ray &ray, Float tCenter,
+            std::vector<Intersection> &its,
+            const ShapeKDTree::IntersectionStopFunc &stop,
+            const std::vector<Shape *> *shapes = NULL) const;
+
     inline void collectIntersections(Point o, Vector d, Float time,
             Float maxDistance,
             std::vector<Intersection> &intersections,
@@ -290,6 +398,28 @@ public:
             rayIntersectFully(Ray(o,d,-inf,inf,time), intersections, shapes);
     }
 
+    /**
+     * \brief Collect the intersections within \c maxDistance of \c o in
+     * both directions along \c d, outwards from \c o, and stop each
+     * direction as soon as \c stop says so.
+     *
+     * A non-positive \c maxDistance means that the distance is
+     * unbounded. See \ref rayIntersectFullyOutwards().
+     */
+    inline void collectIntersectionsBidir(Point o, Vector d, Float time,
+            Float maxDistance,
+            std::vector<Intersection> &intersections,
+            const ShapeKDTree::IntersectionStopFunc &stop,
+            const std::vector<Shape*> *shapes = NULL) const {
+        Float inf = std::numeric_limits<Float>::infinity();
+        if (maxDistance > 0)
+            rayIntersectFullyOutwards(Ray(o,d,-maxDistance,maxDistance,time),
+                    0, intersections, stop, shapes);
+        else
+            rayIntersectFullyOutwards(Ray(o,d,-inf,inf,time),
+                    0, intersections, stop, shapes);
+    }
+
 
     /**
      * \brief Return the transmittance between \c p1 and \c p2 at the
@@ -772,7 +902,9 @@ public:
      *    A direct sampling record, which specifies the query
      *    location. Note that this record need not be completely
      *    filled out. The important fields are \c p, \c n, \c ref,
-     *    \c dist, \c d, \c measure, and \c uv.
+     *    \c dist, \c d, \c measure, and \c uv. When the scene uses
+     *    the emitter hierarchy, \c refN must also match the value
+     *    that was passed to \ref sampleEmitterDirect().
      *
      * \param p
      *    The world-space position that would have been passed to \ref
@@ -1120,6 +1252,17 @@ public:
     /// Return the scene's kd-tree accelerator
     inline const ShapeKDTree *getKDTree() const { return m_kdtree.get(); }
 
+    /**
+     * \brief Build a dedicated kd-tree over a subset of the scene's shapes
+     *
+     * Queries that collect all intersections along a ray and pass this
+     * very vector as their \c shapes filter (see \ref rayIntersectFully())
+     * will traverse this tree instead of the one of the entire scene.
+     * This is e.g. used by subsurface integrators for their probe rays.
+     * The trees are discarded together with the scene's kd-tree.
+     */
+    void addShapeSubset(const std::vector<Shape *> &shapes);
+
     /// Return the a list of all subsurface integrators
     inline ref_vector<Subsurface> &getSubsurfaceIntegrators() { return m_ssIntegrators; }
     /// Return the a list of all subsurface integrators
@@ -1169,9 +1312,35 @@ public:
     /// Return the block resolution used to split images into parallel workloads
     inline uint32_t getBlockSize() const { return m_blockSize; }
 
+    /// Set the order in which image blocks are handed out to the workers
+    inline void setBlockOrder(BlockedImageProcess::EBlockOrder order) { m_blockOrder = order; }
+    /// Return the order in which image blocks are handed out to the workers
+    inline BlockedImageProcess::EBlockOrder getBlockOrder() const { return m_blockOrder; }
+
     /// Serialize the whole scene to a network/file stream
     void serialize(Stream *stream, InstanceManager *manager) const;
 
+    /**
+     * \brief Write a binary snapshot of this scene to disk
+     *
+     * The snapshot uses the same serialization as network rendering and
+     * additionally stores the integrator and the active sensor, so that
+     * \ref loadSnapshot() can skip XML parsing and plugin configuration.
+     * The scene must have been initialized (see \ref initialize()).
+     */
+    void saveSnapshot(const fs::path &filename) const;
+
+    /**
+     * \brief Load a scene snapshot that was created by \ref saveSnapshot()
+     *
+     * The file is memory-mapped and unserialized directly from the mapping.
+     * The returned scene is configured and initialized.
+     */
+    static ref<Scene> loadSnapshot(const fs::path &filename);
+
+    /// Does the given file contain a scene snapshot?
+    static bool isSnapshot(const fs::path &filename);
+
     /* NetworkedObject implementation */
     void bindUsedResources(ParallelProcess *proc) const;
     void wakeup(ConfigurableObject *parent,
@@ -1192,8 +1361,56 @@ protected:
     /// Add a shape to the scene
     void addShape(Shape *shape);
     /// \endcond
+
+    /**
+     * \brief Choose an emitter for direct illumination sampling at the
+     * reference point of \c dRec, rescaling \c sample for reuse
+     *
+     * Returns \c NULL when no emitter can contribute at the reference point
+     */
+    const Emitter *sampleDirectEmitter(const DirectSamplingRecord &dRec,
+        Float &sample, Float &pdf) const;
+
+    /**
+     * \brief Shared implementation of \ref evalTransmittance() and
+     * \ref evalTransmittanceAll()
+     *
+     * Walks the segment interface by interface using
+     * \ref ShapeKDTree::rayIntersectInterface(). Full geometric information
+     * is only computed at interfaces whose BSDF is more than a pure
+     * \ref BSDF::ENull component (e.g. a textured mask).
+     *
+     * When \c p2 lies on \c emitter, the media are queried using
+     * \ref Medium::evalEmitterTransmittance().
+     */
+    Spectrum evalTransmittanceImpl(const Point &p1, bool p1OnSurface,
+        const Point &p2, bool p2OnSurface, Float time, const Medium *medium,
+        int &interactions, Sampler *sampler, bool specialShapes,
+        const Emitter *emitter = NULL) const;
+
+    /**
+     * \brief Return the kd-tree that answers queries with the given
+     * shape filter, see \ref addShapeSubset()
+     *
+     * When a dedicated tree is found, \c shapes is set to \c NULL
+     */
+    inline const ShapeKDTree *selectKDTree(const std::vector<Shape *> *&shapes) const {
+        if (shapes) {
+            for (size_t i=0; i<m_subsetKDTrees.size(); ++i) {
+                if (m_subsetKDTrees[i].first == shapes) {
+                    shapes = NULL;
+                    return m_subsetKDTrees[i].second.get();
+                }
+            }
+        }
+        return m_kdtree.get();
+    }
 private:
+    typedef std::pair<const std::vector<Shape *> *, ref<ShapeKDTree> > ShapeSubset;
+
     ref<ShapeKDTree> m_kdtree;
+    ref<ShapeKDTree> m_kdtreeCandidate;
+    std::vector<ShapeSubset> m_subsetKDTrees;
     ref<Sensor> m_sensor;
     ref<Integrator> m_integrator;
     ref<Sampler> m_sampler;
@@ -1210,10 +1427,13 @@ private:
     fs::path *m_sourceFile;
     fs::path *m_destinationFile;
     DiscreteDistribution m_emitterPDF;
+    ref<EmitterBVH> m_emitterBVH;
     AABB m_aabb;
     uint32_t m_blockSize;
+    BlockedImageProcess::EBlockOrder m_blockOrder;
     bool m_degenerateSensor;
     bool m_degenerateEmitters;
+    uint32_t m_dirty;
 };
 
 MTS_NAMESPACE_END
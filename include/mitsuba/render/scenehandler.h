@@ -27,6 +27,7 @@
 #include <mitsuba/core/version.h>
 #include <boost/unordered_map.hpp>
 #include <stack>
+#include <deque>
 #include <map>
 
 XERCES_CPP_NAMESPACE_BEGIN
@@ -71,6 +72,90 @@ private:
 /// Push a cleanup handler to be executed after loading the scene is done
 extern MTS_EXPORT_RENDER void pushSceneCleanupHandler(void (*cleanup)());
 
+/**
+ * \brief Keeps the shapes, textures, volumes and BSDFs of a scene alive
+ * so that they can be reused by the next scene that is loaded
+ *
+ * Used to render the frames of an animation in a batch. An object is
+ * reused when its plugin name, properties and children are identical, and
+ * none of the files referenced by its properties have been modified since
+ * it was loaded. Since the children are compared by identity, changing a
+ * texture also reloads the BSDFs and shapes that use it.
+ *
+ * Objects that were not used while loading a scene are released once
+ * the scene is complete. When several scenes are kept open at the same
+ * time (e.g. in the tabs of the interactive frontend), \ref setRetainShared()
+ * additionally keeps all objects that are still referenced by one of them.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER SceneObjectCache : public Object {
+public:
+    typedef std::vector<std::pair<std::string, ConfigurableObject *> > ChildList;
+
+    SceneObjectCache();
+
+    /**
+     * \brief Look up an object
+     *
+     * \param expanded
+     *    Returns the version of the object that should be referenced by
+     *    ID (see \ref Texture::expand())
+     * \return The object, or \c NULL when it was not found
+     */
+    ConfigurableObject *get(const Class *classType, const Properties &props,
+        const ChildList &children, ref<ConfigurableObject> &expanded);
+
+    /// Add an object to the cache
+    void put(const Class *classType, const Properties &props,
+        const ChildList &children, ConfigurableObject *object,
+        ConfigurableObject *expanded);
+
+    /**
+     * \brief Release the objects that were not used since the last call
+     *
+     * When \ref setRetainShared() is enabled, objects that are still
+     * referenced from outside of the cache are kept as well.
+     */
+    void purge();
+
+    /// Keep objects that are still referenced by another scene when purging?
+    inline void setRetainShared(bool value) { m_retainShared = value; }
+
+    /// Are objects that are referenced by another scene kept when purging?
+    inline bool getRetainShared() const { return m_retainShared; }
+
+    /// Return the number of cached objects
+    size_t getObjectCount() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SceneObjectCache() { }
+
+    /// Hash key of an object (objects may still differ if it matches)
+    std::string getKey(const Class *classType, const Properties &props) const;
+
+    /// Modification times and sizes of the files referenced by the properties
+    std::string getFileStamps(const Properties &props) const;
+private:
+    struct Entry {
+        Properties props;
+        /* Referenced so that their addresses can't be reused */
+        std::vector<std::pair<std::string, ref<ConfigurableObject> > > children;
+        std::string fileStamps;
+        ref<ConfigurableObject> object, expanded;
+        bool used;
+    };
+
+    /// Is an entry referenced from outside of the cache? (given the cache's own references)
+    bool isShared(const Entry &entry, const std::map<const Object *, int> &cacheRefs) const;
+
+    mutable ref<Mutex> m_mutex;
+    std::multimap<std::string, Entry> m_entries;
+    bool m_retainShared;
+};
+
 /**
  * \brief XML parser for Mitsuba scene files. To be used with the
  * SAX interface of Xerces-C++.
@@ -103,6 +188,20 @@ public:
     /// Free the memory taken up by staticInitialization()
     static void staticShutdown();
 
+    /**
+     * \brief Set the number of threads that instantiate shapes, textures
+     * and volumes while the scene is parsed
+     *
+     * These objects (e.g. meshes and bitmaps loaded from disk) are
+     * created concurrently and joined before their parent objects are
+     * configured. A value of one or less disables this. The default is
+     * the number of cores.
+     */
+    static void setLoaderThreadCount(int count);
+
+    /// Return the number of loader threads (see \ref setLoaderThreadCount())
+    static int getLoaderThreadCount();
+
     // -----------------------------------------------------------------------
     //  Implementation of the SAX DocumentHandler interface
     // -----------------------------------------------------------------------
@@ -119,6 +218,20 @@ public:
     inline const Scene *getScene() const { return m_scene.get(); }
     inline Scene *getScene() { return m_scene; }
 
+    /// Set the value of a parameter (i.e. \c $name) for the following scenes
+    inline void setParameter(const std::string &name, const std::string &value) {
+        m_params[name] = value;
+    }
+
+    /**
+     * \brief Reuse unchanged objects of the previously loaded scene
+     * (see \ref SceneObjectCache). \c NULL disables this (default)
+     */
+    inline void setObjectCache(SceneObjectCache *cache) { m_objectCache = cache; }
+
+    /// Return the object cache (if any)
+    inline SceneObjectCache *getObjectCache() { return m_objectCache; }
+
     // -----------------------------------------------------------------------
     //  Implementation of the SAX ErrorHandler interface
     // -----------------------------------------------------------------------
@@ -134,6 +247,18 @@ protected:
     void clear();
 
 private:
+    struct LoadTask;
+    class LoaderThread;
+
+    /// Wait for a deferred object, register its ID and return it
+    ConfigurableObject *resolve(LoadTask *task);
+
+    /// Instantiate a deferred object on the calling thread
+    void runTask(LoadTask *task);
+
+    /// Stop the loader threads (pending tasks are discarded)
+    void stopLoaderThreads();
+
     /**
      * Enumeration of all possible tags that can be encountered in a
      * Mitsuba scene file
@@ -160,6 +285,8 @@ private:
         Properties properties;
         std::map<std::string, std::string> attributes;
         std::vector<std::pair<std::string, ConfigurableObject *> > children;
+        /// Deferred children along with their index in \c children
+        std::vector<std::pair<size_t, ref<LoadTask> > > pending;
     };
 
 
@@ -176,7 +303,16 @@ private:
     TagMap m_tags;
     Transform m_transform;
     ref<AnimatedTransform> m_animatedTransform;
+    ref<SceneObjectCache> m_objectCache;
     bool m_isIncludedFile;
+
+    /* Deferred object instantiation */
+    std::map<std::string, ref<LoadTask> > m_pendingObjects;
+    std::deque<ref<LoadTask> > m_loadQueue;
+    std::vector<ref<LoaderThread> > m_loaderThreads;
+    ref<Mutex> m_loadMutex;
+    ref<ConditionVariable> m_loadCond;
+    bool m_loadQuit;
 };
 
 MTS_NAMESPACE_END
@@ -364,6 +364,15 @@ protected:
 
     /// Virtual destructor
     virtual ~Sensor();
+
+    /**
+     * \brief Tabulate an animated world transformation over the shutter
+     * interval (see \ref AnimatedTransform::precompute())
+     *
+     * Does nothing unless \c motionSamples was specified and both the
+     * transformation and the shutter interval are non-degenerate.
+     */
+    void precomputeWorldTransform();
 protected:
     ref<Film> m_film;
     ref<Sampler> m_sampler;
@@ -372,6 +381,7 @@ protected:
     Float m_shutterOpen;
     Float m_shutterOpenTime;
     Float m_aspect;
+    int m_motionSamples;
 };
 
 /**
@@ -28,6 +28,46 @@
 
 MTS_NAMESPACE_BEGIN
 
+/// Number of texture lookups that an \ref Intersection can hold on to
+#define MTS_TEXTURE_CACHE_SIZE 4
+
+/**
+ * \brief Texture lookups that have already been performed at an intersection
+ *
+ * Filled by \ref Texture::evalCached() and \ref Texture::evalGradientCached(),
+ * so that the BSDFs of a nested stack (blends, masks, coatings, bump maps,
+ * ...) evaluate each texture once per shading point. The entries belong
+ * to the position, UV coordinates and UV partials they were computed with
+ * and are dropped as soon as one of them changes, e.g. in the finite
+ * differences of \ref Texture::evalGradient(). Constant textures are
+ * not stored.
+ *
+ * \ingroup librender
+ */
+struct TextureLookupCache {
+    /// Kinds of lookups that are distinguished
+    enum ELookup {
+        EUnfiltered = 0,
+        EFiltered,
+        EGradientU,
+        EGradientV
+    };
+
+    inline TextureLookupCache() : size(0), next(0) { }
+
+    const Texture *texture[MTS_TEXTURE_CACHE_SIZE];
+    uint8_t lookup[MTS_TEXTURE_CACHE_SIZE];
+    Spectrum value[MTS_TEXTURE_CACHE_SIZE];
+
+    /// Surface location of the cached entries
+    Point p;
+    Point2 uv;
+    bool hasUVPartials;
+
+    /// Number of valid entries, and the one to replace next when full
+    uint8_t size, next;
+};
+
 /** \brief Container for all information related to
  * a surface intersection
  * \ingroup librender
@@ -153,6 +193,52 @@ public:
 
     /// Return a string representation
     std::string toString() const;
+
+    /// Return a cached texture lookup (\c false if there is none)
+    inline bool lookupTexture(const Texture *texture,
+            TextureLookupCache::ELookup lookup, Spectrum &value) const {
+        if (!validateTextureCache())
+            return false;
+        for (uint8_t i=0; i<texCache.size; ++i) {
+            if (texCache.texture[i] == texture && texCache.lookup[i] == lookup) {
+                value = texCache.value[i];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Store a texture lookup, replacing the oldest one if necessary
+    inline void cacheTexture(const Texture *texture,
+            TextureLookupCache::ELookup lookup, const Spectrum &value) const {
+        validateTextureCache();
+        uint8_t i;
+        if (texCache.size < MTS_TEXTURE_CACHE_SIZE) {
+            i = texCache.size++;
+        } else {
+            i = texCache.next;
+            texCache.next = (uint8_t) ((i + 1) % MTS_TEXTURE_CACHE_SIZE);
+        }
+        texCache.texture[i] = texture;
+        texCache.lookup[i] = (uint8_t) lookup;
+        texCache.value[i] = value;
+    }
+
+    /**
+     * \brief Drop the cached texture lookups if they belong to a different
+     * surface location. Returns \c false if there are none afterwards.
+     */
+    inline bool validateTextureCache() const {
+        if (texCache.p != p || texCache.uv != uv
+                || texCache.hasUVPartials != hasUVPartials) {
+            texCache.p = p;
+            texCache.uv = uv;
+            texCache.hasUVPartials = hasUVPartials;
+            texCache.size = texCache.next = 0;
+            return false;
+        }
+        return texCache.size > 0;
+    }
 public:
     /// Pointer to the associated shape
     const Shape *shape;
@@ -195,6 +281,9 @@ public:
 
     /// Stores a pointer to the parent instance, if applicable
     const Shape *instance;
+
+    /// Texture lookups performed at this intersection
+    mutable TextureLookupCache texCache;
 };
 
 /** \brief Abstract base class of all shapes
@@ -296,6 +385,31 @@ public:
     virtual void rayIntersectFully(const Ray &ray, Float mint, Float maxt,
             std::vector<Intersection> &its) const;
 
+#if defined(MTS_HAS_COHERENT_RT)
+    /**
+     * \brief Intersect a packet of four rays with the shape
+     *
+     * This is used by the coherent ray tracing code path of the
+     * kd-tree when it reaches a leaf with a non-triangle shape.
+     * Only the rays whose bit is set in \c mask are considered, and
+     * ray \c i is restricted to the interval <tt>[mint[i], maxt[i]]</tt>.
+     * For every hit, the ray distance is written to \c t[i] and
+     * the temporary information that \ref fillIntersectionRecord()
+     * expects is stored at <tt>temp + i*tempStride</tt>.
+     *
+     * The default implementation calls \ref rayIntersect() for
+     * each active ray. Shapes with an internal acceleration data
+     * structure can override it to traverse it with all four rays
+     * at once.
+     *
+     * \return A bit mask of the rays that hit the shape
+     * \remark This function is not exposed in Python
+     */
+    virtual int rayIntersectPacket(const RayPacket4 &packet,
+            const Float *mint, const Float *maxt, int mask, Float *t,
+            uint8_t *temp, size_t tempStride) const;
+#endif
+
     /**
      * \brief Given that an intersection has been found, create a
      * detailed intersection record
@@ -469,6 +583,8 @@ public:
     inline Subsurface *getSubsurface() { return m_subsurface; }
     /// Return the associated sub-surface integrator
     inline const Subsurface *getSubsurface() const { return m_subsurface.get(); }
+    /// Set the sub-surface integrator
+    inline void setSubsurface(Subsurface *subsurface) { m_subsurface = subsurface; }
 
     /// Is this shape also an area emitter?
     inline bool isEmitter() const { return m_emitter.get() != NULL; }
@@ -23,6 +23,7 @@
 #include <mitsuba/render/shape.h>
 #include <mitsuba/render/sahkdtree3.h>
 #include <mitsuba/render/triaccel.h>
+#include <functional>
 
 #if defined(MTS_KD_CONSERVE_MEMORY)
 #if defined(MTS_HAS_COHERENT_RT)
@@ -37,10 +38,36 @@
 #define MTS_KD_INTERSECTION_TEMP 128
 #endif
 
+/// Maximum number of rays in a call to \ref ShapeKDTree::rayIntersectBatch()
+#define MTS_KD_RAY_BATCH 32
+
 MTS_NAMESPACE_BEGIN
 
 typedef const Shape * ConstShapePtr;
 
+#if defined(MTS_SSE) && !defined(MTS_KD_CONSERVE_MEMORY)
+/**
+ * \brief Up to eight triangles of a leaf in structure-of-arrays layout
+ *
+ * Holds the same coefficients as \ref TriAccel (with the projection
+ * axis stored as a float), so that a shadow ray can be tested against
+ * all of them at once using SSE or AVX instructions.
+ * \ingroup librender
+ */
+struct TriAccel8 {
+    float k[8];
+    float n_u[8], n_v[8], n_d[8];
+    float a_u[8], a_v[8];
+    float b_nu[8], b_nv[8];
+    float c_nu[8], c_nv[8];
+    /// Lane mask of the triangles that are in use
+    uint32_t valid[8];
+    /// Is this the last group of its leaf?
+    uint32_t last;
+    uint32_t padding[7];
+};
+#endif
+
 /**
  * \brief SAH KD-tree acceleration data structure for fast ray-triangle
  * intersections.
@@ -97,9 +124,29 @@ public:
     /// Return an axis-aligned bounding box containing all primitives
     inline const AABB &getAABB() const { return m_aabb; }
 
-    /// Build the kd-tree (needs to be called before tracing any rays)
+    /**
+     * \brief Build the kd-tree (needs to be called before tracing any rays)
+     *
+     * When a cache directory has been set, a tree that was previously
+     * built over the same geometry and with the same construction
+     * parameters is memory-mapped from there instead.
+     */
     void build();
 
+    /**
+     * \brief Set a directory for caching built trees on disk
+     *
+     * Cache files are keyed by a hash of the geometry and of the
+     * construction parameters. An empty path disables caching.
+     */
+    inline void setCacheDirectory(const fs::path &dir) { m_cacheDirectory = dir; }
+
+    /// Return the directory for caching built trees on disk
+    inline const fs::path &getCacheDirectory() const { return m_cacheDirectory; }
+
+    /// Compute the key that identifies this tree in the on-disk cache
+    uint64_t getCacheKey() const;
+
     //! @}
     // =============================================================
 
@@ -144,6 +191,29 @@ public:
             std::vector<Intersection> &its,
             const std::vector<Shape *> *shapes = NULL) const;
 
+    /**
+     * \brief Predicate that decides whether \ref rayIntersectFully()
+     * may stop collecting intersections.
+     *
+     * Gets passed all intersections found so far and the index of the
+     * first one that was added by the most recently visited kd-tree leaf.
+     */
+    typedef std::function<bool (const std::vector<Intersection> &, size_t)>
+        IntersectionStopFunc;
+
+    /**
+     * \brief Like \ref rayIntersectFully(), but visit the kd-tree leaves
+     * in front-to-back order and stop as soon as \c stop returns
+     * \c true.
+     *
+     * The predicate is only consulted after leaves that produced new
+     * intersections. Everything that was found up to that point is kept.
+     */
+    void rayIntersectFully(const Ray &ray,
+            std::vector<Intersection> &its,
+            const IntersectionStopFunc &stop,
+            const std::vector<Shape *> *shapes = NULL) const;
+
     /**
      * \brief Intersect a ray against all primitives stored in the kd-tree
      * and return the traveled distance and intersected shape
@@ -176,6 +246,37 @@ public:
     bool rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
         Normal &n, Point2 &uv) const;
 
+    /**
+     * \brief Find the closest interface along a ray for the purpose
+     * of transmittance computations
+     *
+     * Only reports the traveled distance, the intersected shape and the
+     * cosine between the geometric normal and the ray direction (which
+     * suffices to determine the medium transition). For triangle meshes,
+     * this avoids normalizing the normal and interpolating UV coordinates
+     * at every null or index-matched boundary. When the BSDF at the
+     * interface needs more than that, \ref fillInterfaceRecord() can
+     * complete the query from the same temporary storage.
+     *
+     * \param cosTheta
+     *    Receives a value whose sign matches the cosine between the
+     *    geometric normal and \c ray.d (it is not normalized)
+     *
+     * \param temp
+     *    Temporary storage of size \ref MTS_KD_INTERSECTION_TEMP
+     *
+     * \return \c true if an intersection was found
+     */
+    bool rayIntersectInterface(const Ray &ray, Float &t,
+        ConstShapePtr &shape, Float &cosTheta, void *temp) const;
+
+    /**
+     * \brief Compute the geometric normal and UV coordinates of an
+     * intersection found by \ref rayIntersectInterface()
+     */
+    void fillInterfaceRecord(const Ray &ray, Float t, const void *temp,
+        Normal &n, Point2 &uv) const;
+
     /**
      * \brief Test a ray for occlusion with respect to all primitives
      *    stored in the kd-tree.
@@ -195,6 +296,22 @@ public:
      */
     bool rayIntersect(const Ray &ray) const;
 
+    /**
+     * \brief Test a batch of rays for occlusion
+     *
+     * When coherent ray tracing is available, the rays are grouped by
+     * the octant of their direction and traced four at a time using
+     * \ref rayIntersectPacket(). Otherwise, or for rays with a nonzero
+     * time value (ray packets do not carry one), this is equivalent to
+     * calling the shadow ray variant of \ref rayIntersect() for each ray.
+     *
+     * \param count
+     *    Number of rays, at most \ref MTS_KD_RAY_BATCH
+     *
+     * \return A bit mask, whose bit \c i is set when \c rays[i] is occluded
+     */
+    uint32_t rayIntersectBatch(const Ray *rays, size_t count) const;
+
 #if defined(MTS_HAS_COHERENT_RT)
     /**
      * \brief Intersect four rays with the stored triangle meshes while making
@@ -249,7 +366,7 @@ protected:
         const Shape *shape = m_shapes[shapeIdx];
         if (m_triangleFlag[shapeIdx]) {
             const TriMesh *mesh = static_cast<const TriMesh *>(shape);
-            return mesh->getTriangles()[idx].getAABB(mesh->getVertexPositions());
+            return mesh->getTriangle(idx).getAABB(mesh->getVertexPositions());
         } else {
             return shape->getAABB();
         }
@@ -261,7 +378,7 @@ protected:
         const Shape *shape = m_shapes[shapeIdx];
         if (m_triangleFlag[shapeIdx]) {
             const TriMesh *mesh = static_cast<const TriMesh *>(shape);
-            return mesh->getTriangles()[idx].getClippedAABB(mesh->getVertexPositions(), aabb);
+            return mesh->getTriangle(idx).getClippedAABB(mesh->getVertexPositions(), aabb);
         } else {
             return shape->getClippedAABB(aabb);
         }
@@ -289,7 +406,7 @@ protected:
         if (EXPECT_TAKEN(m_triangleFlag[shapeIdx])) {
             const TriMesh *mesh =
                 static_cast<const TriMesh *>(m_shapes[shapeIdx]);
-            const Triangle &tri = mesh->getTriangles()[idx];
+            const Triangle tri = mesh->getTriangle(idx);
             Float tempU, tempV, tempT;
             if (tri.rayIntersect(mesh->getVertexPositions(), ray,
                         tempU, tempV, tempT)) {
@@ -348,7 +465,7 @@ protected:
         if (EXPECT_TAKEN(m_triangleFlag[shapeIdx])) {
             const TriMesh *mesh =
                 static_cast<const TriMesh *>(m_shapes[shapeIdx]);
-            const Triangle &tri = mesh->getTriangles()[idx];
+            const Triangle tri = mesh->getTriangle(idx);
             Float tempU, tempV, tempT;
             if (tri.rayIntersect(mesh->getVertexPositions(), ray, tempU, tempV, tempT))
                 return tempT >= mint && tempT <= maxt;
@@ -370,6 +487,49 @@ protected:
 #endif
     }
 
+#if defined(MTS_SSE) && !defined(MTS_KD_CONSERVE_MEMORY)
+    /// Signature of the SIMD shadow ray test of a group sequence
+    typedef bool (*LeafShadowTest)(const TriAccel8 *group,
+        const Ray &ray, Float mint, Float maxt);
+
+    /// Marks leaves that are not tested using \ref TriAccel8 groups
+    static const uint32_t KNoLeafGroups = 0xFFFFFFFF;
+
+    /// Marks leaves that also contain non-triangle shapes
+    static const uint32_t KLeafHasShapes = 0x80000000;
+
+    /**
+     * \brief Shadow ray test against all primitives of a leaf
+     *
+     * Triangles of leaves with several of them are tested in groups using
+     * the SIMD kernel that was selected for this processor, while other
+     * shapes still go through \ref Shape::rayIntersect().
+     */
+    FINLINE bool leafIntersectsShadowRay(const Ray &ray, IndexType start,
+            IndexType end, Float mint, Float maxt) const {
+        uint32_t info = m_leafGroups[start];
+        if (info == KNoLeafGroups)
+            return SAHKDTree3D<ShapeKDTree>::leafIntersectsShadowRay(
+                ray, start, end, mint, maxt);
+
+        if (m_leafShadowTest(m_triAccel8 + (info & ~KLeafHasShapes), ray, mint, maxt))
+            return true;
+
+        if (info & KLeafHasShapes) {
+            for (IndexType entry=start; entry != end; entry++) {
+                const TriAccel &ta = m_triAccel[m_indices[entry]];
+                if (ta.k == KNoTriangleFlag &&
+                    m_shapes[ta.shapeIndex]->rayIntersect(ray, mint, maxt))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    /// Build the \ref TriAccel8 groups and select the shadow ray kernel
+    void buildLeafGroups();
+#endif
+
     FINLINE void intersectFully(const Ray &ray, IndexType idx,
             Float mint, Float maxt, std::vector<Intersection> &its,
             const std::vector<Shape *> *shapes = NULL) const {
@@ -385,7 +545,7 @@ protected:
         if (EXPECT_TAKEN(m_triangleFlag[shapeIdx])) {
             const TriMesh *mesh =
                 static_cast<const TriMesh *>(shape);
-            const Triangle &tri = mesh->getTriangles()[idx];
+            const Triangle tri = mesh->getTriangle(idx);
             Float tempU, tempV, tempT;
             if (tri.rayIntersect(mesh->getVertexPositions(), ray,
                         tempU, tempV, tempT)) {
@@ -438,10 +598,8 @@ protected:
         const Shape *shape = m_shapes[cache->shapeIndex];
         if (m_triangleFlag[cache->shapeIndex]) {
             const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
-            const Triangle &tri = trimesh->getTriangles()[cache->primIndex];
+            const Triangle tri = trimesh->getTriangle(cache->primIndex);
             const Point *vertexPositions = trimesh->getVertexPositions();
-            const Normal *vertexNormals = trimesh->getVertexNormals();
-            const Point2 *vertexTexcoords = trimesh->getVertexTexcoords();
             const Color3 *vertexColors = trimesh->getVertexColors();
             const TangentSpace *vertexTangents = trimesh->getUVTangents();
             const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
@@ -466,16 +624,20 @@ protected:
                 const TangentSpace &ts = vertexTangents[cache->primIndex];
                 its.dpdu = ts.dpdu;
                 its.dpdv = ts.dpdv;
+            } else if (trimesh->isCompact() && trimesh->hasVertexTexcoords()) {
+                /* Compact meshes don't store their UV tangents */
+                trimesh->computeUVTangent(cache->primIndex, its.dpdu, its.dpdv);
             } else {
                 its.dpdu = side1;
                 its.dpdv = side2;
             }
 
-            if (EXPECT_TAKEN(vertexNormals)) {
+            /* The accessors decode compactly stored meshes on the fly */
+            if (EXPECT_TAKEN(trimesh->hasVertexNormals())) {
                 const Normal
-                    &n0 = vertexNormals[idx0],
-                    &n1 = vertexNormals[idx1],
-                    &n2 = vertexNormals[idx2];
+                    n0 = trimesh->getVertexNormal(idx0),
+                    n1 = trimesh->getVertexNormal(idx1),
+                    n2 = trimesh->getVertexNormal(idx2);
 
                 its.shFrame.n = normalize(n0 * b.x + n1 * b.y + n2 * b.z);
 
@@ -487,10 +649,10 @@ protected:
             }
             its.geoFrame = Frame(faceNormal);
 
-            if (EXPECT_TAKEN(vertexTexcoords)) {
-                const Point2 &t0 = vertexTexcoords[idx0];
-                const Point2 &t1 = vertexTexcoords[idx1];
-                const Point2 &t2 = vertexTexcoords[idx2];
+            if (EXPECT_TAKEN(trimesh->hasVertexTexcoords())) {
+                const Point2 t0 = trimesh->getVertexTexcoord(idx0);
+                const Point2 t1 = trimesh->getVertexTexcoord(idx1);
+                const Point2 t2 = trimesh->getVertexTexcoord(idx2);
                 its.uv = t0 * b.x + t1 * b.y + t2 * b.z;
             } else {
                 its.uv = Point2(b.y, b.z);
@@ -555,9 +717,17 @@ private:
     std::vector<const Shape *> m_shapes;
     std::vector<bool> m_triangleFlag;
     std::vector<IndexType> m_shapeMap;
+    fs::path m_cacheDirectory;
 #if !defined(MTS_KD_CONSERVE_MEMORY)
     TriAccel *m_triAccel;
 #endif
+#if defined(MTS_SSE) && !defined(MTS_KD_CONSERVE_MEMORY)
+    /* First TriAccel8 group of every leaf, indexed by the
+       leaf's first entry in the index list */
+    std::vector<uint32_t> m_leafGroups;
+    TriAccel8 *m_triAccel8;
+    LeafShadowTest m_leafShadowTest;
+#endif
 };
 
 MTS_NAMESPACE_END
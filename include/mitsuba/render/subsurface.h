@@ -21,6 +21,7 @@
 #define __MITSUBA_RENDER_SUBSURFACE_H_
 
 #include <mitsuba/core/netobject.h>
+#include <functional>
 
 MTS_NAMESPACE_BEGIN
 
@@ -56,8 +57,17 @@ public:
     /// Cancel any running pre-process tasks
     virtual void cancel();
 
+    /**
+     * \brief Discard the results of an earlier \ref preprocess() call
+     *
+     * Called by the scene when the geometry or the emitters changed, so
+     * that the next \ref preprocess() recomputes everything that depends
+     * on them. The default implementation does nothing.
+     */
+    virtual void invalidate();
+
     /// Return the list of shapes associated with this subsurface integrator
-    inline const std::vector<Shape *> getShapes() const { return m_shapes; }
+    inline const std::vector<Shape *> &getShapes() const { return m_shapes; }
 
     /// Get the exitant radiance for a point on the surface
     virtual Spectrum Lo(const Scene *scene, Sampler *sampler,
@@ -92,9 +102,35 @@ protected:
 
     /// Virtual destructor
     virtual ~Subsurface();
+
+    /**
+     * \brief Try to load precomputed data of the given kind from the
+     * on-disk preprocessing cache.
+     *
+     * Caching is enabled through the \c preprocessCacheDir parameter.
+     * Cache files are named after a hash of the scene geometry, the
+     * emitters, the integrator and the parameters of this model, so data
+     * from a scene in which any of these changed is never picked up.
+     *
+     * \param load Reads the data from the given stream
+     * \return \c true when valid cached data was found and loaded
+     */
+    bool loadPreprocessCache(const Scene *scene, const std::string &kind,
+            const std::function<void (Stream *)> &load) const;
+
+    /**
+     * \brief Store precomputed data of the given kind in the on-disk
+     * preprocessing cache (no-op when caching is disabled).
+     *
+     * \param store Writes the data to the given stream
+     */
+    void storePreprocessCache(const Scene *scene, const std::string &kind,
+            const std::function<void (Stream *)> &store) const;
 protected:
     std::vector<Shape *> m_shapes;
     bool m_active;
+    /// Directory of the on-disk preprocessing cache (empty: disabled)
+    std::string m_preprocessCacheDir;
 };
 
 MTS_NAMESPACE_END
@@ -148,6 +148,19 @@ MTS_NAMESPACE_END
         return m_executed - m_succeeded;\
     }
 
+#if defined(MTS_STATIC_PLUGIN)
+#define MTS_EXPORT_TESTCASE(name, descr) \
+    MTS_IMPLEMENT_CLASS(name, false, TestCase) \
+    namespace { \
+        void *CreateUtility() { \
+            return new name(); \
+        } \
+        const char *GetDescription() { \
+            return descr; \
+        } \
+    } \
+    MTS_REGISTER_STATIC_PLUGIN(NULL, CreateUtility, GetDescription)
+#else
 #define MTS_EXPORT_TESTCASE(name, descr) \
     MTS_IMPLEMENT_CLASS(name, false, TestCase) \
     extern "C" { \
@@ -158,5 +171,6 @@ MTS_NAMESPACE_END
             return descr; \
         } \
     }
+#endif
 
 #endif /* __MITSUBA_RENDER_TESTCASE_H_ */
@@ -52,6 +52,18 @@ public:
      */
     virtual void evalGradient(const Intersection &its, Spectrum *gradient) const;
 
+    /**
+     * \brief Like \ref eval(), but reuses an earlier lookup of this
+     * texture at the same intersection (see \ref TextureLookupCache)
+     */
+    Spectrum evalCached(const Intersection &its, bool filter = true) const;
+
+    /**
+     * \brief Like \ref evalGradient(), but reuses an earlier lookup of
+     * this texture at the same intersection (see \ref TextureLookupCache)
+     */
+    void evalGradientCached(const Intersection &its, Spectrum *gradient) const;
+
     /// Return the component-wise average value of the texture over its domain
     virtual Spectrum getAverage() const;
 
@@ -22,8 +22,18 @@
 
 #include <mitsuba/core/triangle.h>
 #include <mitsuba/core/pmf.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/render/shape.h>
 
+/// Number of consecutive triangles that share a base index in compact meshes
+#define MTS_TRIMESH_CLUSTER_SIZE 256
+
+/// Meshes with up to this many triangles are sampled by solid angle (see \ref TriMesh::sampleDirect())
+#define MTS_TRIMESH_SPHTRI_MAX 64
+
+/// Minimum solid angle (in steradians) of a mesh that is sampled by solid angle
+#define MTS_TRIMESH_SPHTRI_MIN_SOLIDANGLE 1e-2
+
 MTS_NAMESPACE_BEGIN
 
 /**
@@ -123,22 +133,47 @@ public:
     /// Return the number of vertices
     inline size_t getVertexCount() const { return m_vertexCount; }
 
-    /// Return the triangle list (const version)
+    /**
+     * \brief Return the triangle list (const version)
+     *
+     * Returns \c NULL when the mesh stores compact indices, see
+     * \ref compact(). \ref getTriangle() works in both cases.
+     */
     inline const Triangle *getTriangles() const { return m_triangles; };
-    /// Return the triangle list
+    /// Return the triangle list (\c NULL when the indices are compact)
     inline Triangle *getTriangles() { return m_triangles; };
 
+    /// Return a triangle (decodes compact indices if necessary)
+    inline Triangle getTriangle(size_t index) const {
+        if (EXPECT_TAKEN(m_triangles != NULL))
+            return m_triangles[index];
+        const uint16_t *local = m_localIndices + 3*index;
+        uint32_t base = m_clusterBase[index / MTS_TRIMESH_CLUSTER_SIZE];
+        Triangle tri;
+        tri.idx[0] = base + local[0];
+        tri.idx[1] = base + local[1];
+        tri.idx[2] = base + local[2];
+        return tri;
+    }
+
     /// Return the vertex positions (const version)
     inline const Point *getVertexPositions() const { return m_positions; };
     /// Return the vertex positions
     inline Point *getVertexPositions() { return m_positions; };
 
-    /// Return the vertex normals (const version)
+    /// Return the vertex normals (const version, \c NULL when they are compact)
     inline const Normal *getVertexNormals() const { return m_normals; };
-    /// Return the vertex normals
+    /// Return the vertex normals (\c NULL when they are compact)
     inline Normal *getVertexNormals() { return m_normals; };
     /// Does the mesh have vertex normals?
-    inline bool hasVertexNormals() const { return m_normals != NULL; };
+    inline bool hasVertexNormals() const { return m_normals != NULL || m_packedNormals != NULL; };
+
+    /// Return a vertex normal (decodes compact normals if necessary)
+    inline Normal getVertexNormal(size_t index) const {
+        if (EXPECT_TAKEN(m_normals != NULL))
+            return m_normals[index];
+        return decodeNormal(m_packedNormals[index]);
+    }
 
     /// Return the vertex colors (const version)
     inline const Color3 *getVertexColors() const { return m_colors; };
@@ -147,20 +182,120 @@ public:
     /// Does the mesh have vertex colors?
     inline bool hasVertexColors() const { return m_colors != NULL; };
 
-    /// Return the vertex texture coordinates (const version)
+    /// Return the vertex texture coordinates (const version, \c NULL when they are compact)
     inline const Point2 *getVertexTexcoords() const { return m_texcoords; };
-    /// Return the vertex texture coordinates
+    /// Return the vertex texture coordinates (\c NULL when they are compact)
     inline Point2 *getVertexTexcoords() { return m_texcoords; };
     /// Does the mesh have vertex texture coordinates?
-    inline bool hasVertexTexcoords() const { return m_texcoords != NULL; };
+    inline bool hasVertexTexcoords() const { return m_texcoords != NULL || m_packedTexcoords != NULL; };
+
+    /// Return a vertex texture coordinate (decodes compact ones if necessary)
+    inline Point2 getVertexTexcoord(size_t index) const {
+        if (EXPECT_TAKEN(m_texcoords != NULL))
+            return m_texcoords[index];
+        const uint16_t *uv = m_packedTexcoords + 2*index;
+        return Point2(
+            m_texcoordOffset.x + uv[0] * m_texcoordScale.x,
+            m_texcoordOffset.y + uv[1] * m_texcoordScale.y);
+    }
 
-    /// Return the per-triangle UV tangents (const version)
+    /**
+     * \brief Return the per-triangle UV tangents (const version)
+     *
+     * Compact meshes don't store tangents, see \ref computeUVTangent().
+     */
     inline const TangentSpace *getUVTangents() const { return m_tangents; };
     /// Return the per-triangle UV tangents
     inline TangentSpace *getUVTangents() { return m_tangents; };
     /// Does the mesh have UV tangent information?
     inline bool hasUVTangents() const { return m_tangents != NULL; };
 
+    /**
+     * \brief Return the per-vertex curvatures (const version)
+     *
+     * The \c x and \c y components hold the mean and Gaussian
+     * curvature, see \ref computeVertexCurvatures().
+     */
+    inline const Vector2 *getVertexCurvatures() const { return m_curvatures; };
+    /// Return the per-vertex curvatures
+    inline Vector2 *getVertexCurvatures() { return m_curvatures; };
+    /// Does the mesh have precomputed vertex curvatures?
+    inline bool hasVertexCurvatures() const { return m_curvatures != NULL; };
+
+    /**
+     * \brief Interpolate the precomputed vertex curvatures at a
+     * surface location on this mesh
+     *
+     * The intersection record must refer to a triangle of this mesh in
+     * object space (i.e. not through an instance).
+     *
+     * \param H
+     *     Parameter used to store the mean curvature
+     * \param K
+     *     Parameter used to store the Gaussian curvature
+     */
+    void getVertexCurvature(const Intersection &its, Float &H, Float &K) const;
+
+    /// Should \ref configure() compute the vertex curvatures?
+    inline void setPrecomputeCurvature(bool value) { m_precomputeCurvature = value; }
+
+    /**
+     * \brief Compute the UV tangents of a single triangle
+     *
+     * Matches the values stored by \ref computeUVTangents(). The mesh
+     * must have texture coordinates.
+     */
+    inline void computeUVTangent(size_t index, Vector &dpdu, Vector &dpdv) const {
+        const Triangle tri = getTriangle(index);
+        const Point
+            &v0 = m_positions[tri.idx[0]],
+            &v1 = m_positions[tri.idx[1]],
+            &v2 = m_positions[tri.idx[2]];
+        const Point2
+            uv0 = getVertexTexcoord(tri.idx[0]),
+            uv1 = getVertexTexcoord(tri.idx[1]),
+            uv2 = getVertexTexcoord(tri.idx[2]);
+
+        Vector dP1 = v1 - v0, dP2 = v2 - v0;
+        Vector2 dUV1 = uv1 - uv0, dUV2 = uv2 - uv0;
+        Normal n = Normal(cross(dP1, dP2));
+        Float length = n.length();
+        if (length == 0) {
+            dpdu = dpdv = Vector(0.0f);
+            return;
+        }
+
+        Float determinant = dUV1.x * dUV2.y - dUV1.y * dUV2.x;
+        if (determinant == 0) {
+            /* The user-specified parameterization is degenerate. Pick
+               arbitrary tangents that are perpendicular to the geometric normal */
+            coordinateSystem(n/length, dpdu, dpdv);
+        } else {
+            Float invDet = 1.0f / determinant;
+            dpdu = ( dUV2.y * dP1 - dUV1.y * dP2) * invDet;
+            dpdv = (-dUV2.x * dP1 + dUV1.x * dP2) * invDet;
+        }
+    }
+
+    /// Does the mesh use the compact representation (see \ref compact())?
+    inline bool isCompact() const { return m_compact; }
+
+    /// Octahedral encoding of a unit vector using 2x16 bits
+    static uint32_t encodeNormal(const Normal &n);
+
+    /// Decode a normal that was encoded using \ref encodeNormal()
+    static inline Normal decodeNormal(uint32_t value) {
+        Float x = (int16_t) (value & 0xFFFF) * (Float) (1.0 / 32767),
+              y = (int16_t) (value >> 16) * (Float) (1.0 / 32767),
+              z = 1 - std::abs(x) - std::abs(y);
+        if (z < 0) {
+            Float tx = (1 - std::abs(y)) * (x >= 0 ? 1 : -1),
+                  ty = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+            x = tx; y = ty;
+        }
+        return normalize(Normal(x, y, z));
+    }
+
     //! @}
     // =============================================================
 
@@ -197,6 +332,23 @@ public:
 
     Float pdfPosition(const PositionSamplingRecord &pRec) const;
 
+    /**
+     * \brief Sample a point on the mesh as seen from the reference
+     * point \c dRec.ref (with respect to solid angle)
+     *
+     * Small meshes that cover a noticeable part of the reference point's
+     * field of view are sampled uniformly within the solid angle that they
+     * subtend: a triangle is chosen proportionally to its projected area
+     * on the unit sphere and then sampled using
+     * \ref warp::squareToSphericalTriangle(). All other cases fall back
+     * to the area sampling of \ref Shape::sampleDirect().
+     */
+    void sampleDirect(DirectSamplingRecord &dRec,
+            const Point2 &sample) const;
+
+    /// Query the probability density of \ref sampleDirect()
+    Float pdfDirect(const DirectSamplingRecord &dRec) const;
+
     //! @}
     // =============================================================
 
@@ -223,6 +375,18 @@ public:
      */
     void computeNormals(bool force = false);
 
+    /**
+     * \brief Estimate the mean and Gaussian curvature at every vertex
+     *
+     * Uses the discrete operators of Meyer et al. ("Discrete
+     * Differential-Geometry Operators for Triangulated 2-Manifolds") with
+     * barycentric vertex areas: the cotangent Laplacian yields the mean
+     * curvature and the angle deficit the Gaussian curvature. The signs
+     * match \ref Shape::getCurvature(). Large meshes are processed in
+     * parallel.
+     */
+    void computeVertexCurvatures();
+
     /**
      * \brief Rebuild the mesh so that adjacent faces
      * with a dihedral angle greater than \c maxAngle degrees
@@ -239,6 +403,28 @@ public:
      */
     void rebuildTopology(Float maxAngle);
 
+    /**
+     * \brief Switch to a compact representation of the mesh data
+     *
+     * Vertex normals are stored using a 32 bit octahedral encoding,
+     * texture coordinates are quantized to 16 bits per component (relative
+     * to their bounding rectangle), and the triangles of each cluster of
+     * \ref MTS_TRIMESH_CLUSTER_SIZE reference their vertices using 16 bit
+     * offsets from a shared base index. Per-triangle UV tangents are not
+     * stored but computed on the fly. Positions and vertex colors keep
+     * their full precision, as they are used for intersection tests.
+     *
+     * The 32 bit indices are retained if a cluster spans more than 65536
+     * vertices. Afterwards, the compactly stored arrays have to be
+     * accessed using \ref getTriangle(), \ref getVertexNormal() and
+     * \ref getVertexTexcoord(), and the topology of the mesh can no
+     * longer be modified.
+     *
+     * This is done by \ref configure() when the \c compact parameter
+     * of the mesh is set.
+     */
+    void compact();
+
     /// Serialize to a file/network stream
     void serialize(Stream *stream, InstanceManager *manager) const;
 
@@ -251,6 +437,25 @@ public:
      */
     void serialize(Stream *stream) const;
 
+    /**
+     * \brief Serialize to an uncompressed file that can be memory-mapped
+     *
+     * Like \ref serialize(Stream *), but the data is stored without
+     * compression, and every array starts at an offset (relative to the
+     * beginning of the stream) that is a multiple of 64 bytes. Meshes in
+     * such files can be loaded without copying their contents (see
+     * \ref loadMapped()).
+     */
+    void serializeMappable(Stream *stream) const;
+
+    /**
+     * \brief Return the number of meshes in a serialized file
+     *
+     * The stream must be positioned at the beginning of the file and
+     * its position is modified.
+     */
+    static int getSerializedMeshCount(Stream *stream);
+
     /**
      * \brief Build a discrete probability distribution
      * for sampling.
@@ -324,6 +529,38 @@ protected:
     /// Load a Mitsuba compressed triangle mesh substream
     void loadCompressed(Stream *stream, int idx = 0);
 
+    /**
+     * \brief Load a mesh from a memory-mapped serialized file
+     *
+     * When the mesh was written by \ref serializeMappable() with the
+     * floating point precision of this build, the mesh buffers point
+     * directly into the mapping, which is kept alive by the mesh. Pass
+     * a copy-on-write mapping if the mesh will be modified afterwards.
+     *
+     * \param offset
+     *    Position of the mesh within the file
+     */
+    void loadMapped(MemoryMappedFile *mapping, size_t offset);
+
+    /// Can meshes from files with the given version be loaded by \ref loadMapped()?
+    static bool isMappable(short version);
+
+    /// Release a mesh buffer unless it points into a file mapping
+    template <typename T> inline void releaseBuffer(T *&ptr) {
+        if (ptr && !isMapped(ptr))
+            delete[] ptr;
+        ptr = NULL;
+    }
+
+    /// Does the given buffer point into the file mapping of this mesh?
+    inline bool isMapped(const void *ptr) const {
+        if (!m_mapping)
+            return false;
+        const uint8_t *data = (const uint8_t *) m_mapping->getData();
+        return (const uint8_t *) ptr >= data &&
+               (const uint8_t *) ptr < data + m_mapping->getSize();
+    }
+
     /**
      * \brief Reads the header information of a compressed file, returning
      * the version ID.
@@ -352,6 +589,22 @@ protected:
 
     /// Prepare internal tables for sampling uniformly wrt. area
     void prepareSamplingTable();
+
+    /**
+     * \brief Compute the cumulative solid angles of the triangles as seen
+     * from \c ref for \ref sampleDirect()
+     *
+     * Returns the total solid angle, or zero when the mesh should
+     * be sampled by area instead. \c cdf must have space for
+     * <tt>MTS_TRIMESH_SPHTRI_MAX+1</tt> entries.
+     */
+    double computeSolidAngleCDF(const Point &ref, double *cdf) const;
+
+    /// Reset the compact representation (called by the constructors)
+    void initCompact(bool compact);
+
+    /// Release the compactly stored arrays
+    void releaseCompactBuffers();
 protected:
     AABB m_aabb;
     Triangle *m_triangles;
@@ -360,16 +613,30 @@ protected:
     Point2 *m_texcoords;
     TangentSpace *m_tangents;
     Color3 *m_colors;
+    Vector2 *m_curvatures;
     size_t m_triangleCount;
     size_t m_vertexCount;
     bool m_flipNormals;
     bool m_faceNormals;
+    bool m_precomputeCurvature;
+
+    /* Compact representation (see \ref compact()) */
+    bool m_compact;
+    uint32_t *m_packedNormals;
+    uint16_t *m_packedTexcoords;
+    Point2 m_texcoordOffset;
+    Vector2 m_texcoordScale;
+    uint32_t *m_clusterBase;
+    uint16_t *m_localIndices;
 
     /* Surface and distribution -- generated on demand */
     DiscreteDistribution m_areaDistr;
     Float m_surfaceArea;
     Float m_invSurfaceArea;
     ref<Mutex> m_mutex;
+
+    /* Memory-mapped file backing some of the buffers (if any) */
+    ref<MemoryMappedFile> m_mapping;
 };
 
 MTS_NAMESPACE_END
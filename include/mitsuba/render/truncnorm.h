@@ -1,45 +1,33 @@
 #ifndef __MITSUBA_RENDER_TRUNCNORM_H_
 #define __MITSUBA_RENDER_TRUNCNORM_H_
-/*
- * Code directly based on work of Jonathan Olmsted:
- * https://github.com/olmjo/RcppTN
- * http://olmjo.com/computing/RcppTN/
- */
 
 #include <mitsuba/core/platform.h>
 #include <mitsuba/core/warp.h>
 #include <mitsuba/render/sampler.h>
 
-// -*- mode: C++; c-indent-level: 4; c-basic-offset: 4; tab-width: 4 -*-
-
-// This C++ code implements an Accept/Reject sampler for a single
-// Truncated Normal random variable with a mixture of algorithms
-// depending on distributional parameters.
+// This code implements an inverse-cdf sampler for a single truncated
+// normal random variable, and the corresponding density.
 
 MTS_NAMESPACE_BEGIN
 
-inline Float truncnormPdf(const Float _mean,
-            const Float _sd,
-            const Float _lo,
-            const Float _hi,
-            const Float _z) {
-    /* We do everything explicitly in doubles here, because the
-     * exponentials are too prone to over/underflow with single precision
-     * */
-    double mean(_mean);
-    double sd(_sd);
-    double lo(_lo);
-    double hi(_hi);
-    double z(_z);
+/* Both the density and the sampler work in double precision irrespective
+ * of Float, because the exponentials are too prone to over/underflow with
+ * single precision. */
+
+inline double truncnormPdf(const double mean,
+            const double sd,
+            double lo,
+            double hi,
+            double z) {
 
     SAssert(lo <= hi);
     SAssert(sd >= 0);
 
     if (z < lo || z > hi)
-        return 0.0f;
+        return 0.0;
 
     if (lo == hi)
-        return 1.0f;
+        return 1.0;
 
     if (sd == 0) {
         double scale = hi - lo;
@@ -47,10 +35,10 @@ inline Float truncnormPdf(const Float _mean,
             SLog(EError, "I currently only support finite intervals when sd==0");
         double acceptedError = Epsilon * scale;
         if (lo <= mean && mean <= hi)
-            return math::abs(z - mean) < acceptedError ? 1.0 : 0.0;
+            return std::abs(z - mean) < acceptedError ? 1.0 : 0.0;
         if (mean > hi)
-            return math::abs(z - hi) < acceptedError ? 1.0 : 0.0;
-        return math::abs(z - lo) < acceptedError ? 1.0 : 0.0;
+            return std::abs(z - hi) < acceptedError ? 1.0 : 0.0;
+        return std::abs(z - lo) < acceptedError ? 1.0 : 0.0;
     }
 
     if (std::isinf(sd)) {
@@ -81,19 +69,15 @@ inline Float truncnormPdf(const Float _mean,
     double c_stdhi = (hi - mean) / sd; // standarized bound
     double c_stdlo = (lo - mean) / sd; // standarized bound
     double c_stdz  = (z - mean) / sd; // standarized sample
-#ifdef DOUBLE_PRECISION
     const double c_stdhiThreshold = -7;
-#else
-    const double c_stdhiThreshold = -4;
-#endif
     if (c_stdhi > c_stdhiThreshold) { // in this case: full erf expression should be sufficiently stable
         double absoluteExpArgument = 0.5 * pow((z - mean) / sd, 2);
-        double erfDiff = math::erf((hi - mean)/(SQRT_TWO*sd))
-                       - math::erf((lo - mean)/(SQRT_TWO*sd));
+        double erfDiff = std::erf((hi - mean)/(SQRT_TWO_DBL*sd))
+                       - std::erf((lo - mean)/(SQRT_TWO_DBL*sd));
         //SAssert(absoluteExpArgument < LOG_REDUCED_PRECISION); // this can underflow if pdf becomes 0, which is OK...
         SAssert(erfDiff > 0);
         pdf = 2.0*exp(-absoluteExpArgument)
-                / ((sqrt(TWO_PI) * sd) * erfDiff);
+                / ((sqrt(TWO_PI_DBL) * sd) * erfDiff);
         if (!std::isfinite(pdf))
             SLog(EWarn, "full pdf %e: stdlo:%e stdhi:%e stdz:%e sd:%e | m:%e lo:%e hi:%e z:%e",
                     pdf, c_stdlo, c_stdhi, c_stdz, sd,
@@ -133,197 +117,121 @@ inline Float truncnormPdf(const Float _mean,
 }
 
 
-// TODO: wasteful...
-inline Float stdnorm(Sampler *sampler) {
-    return warp::squareToStdNormal(sampler->next2D()).x;
-}
-
-
-/// Check if simpler subalgorithm is appropriate.
-inline bool CheckSimple(const Float low, ///< lower bound of distribution
-                        const Float high ///< upper bound of distribution
-                        ) {
-  // Init Values Used in Inequality of Interest
-  Float val1 = (2 * sqrt(exp(1))) / (low + sqrt(pow(low, 2) + 4));
-  Float val2 = exp((pow(low, 2) - low * sqrt(pow(low, 2) + 4)) / (4)) ;
-  //
-
-  // Test if Simple is Preferred
-  if (high > low + val1 * val2) {
-    return true ;
-  } else {
-    return false ;
-  }
-}
-
-
-/// XXX This check was missing from:
-/// https://github.com/olmjo/RcppTN
-/// http://olmjo.com/computing/RcppTN/
-inline bool CheckRejectFromUniformInsteadOfNormal(
-        const Float low, const Float high) {
-    if (low * high > 0)
-        return false;
-    return high - low < sqrt(TWO_PI);
+/**
+ * \brief Scaled complementary error function exp(z^2) erfc(z) for z >= 0
+ *
+ * Does not underflow for large z, where it switches to the asymptotic
+ * expansion (which is accurate to double precision there).
+ */
+inline double erfcScaled(double z) {
+    if (z < 26)
+        return std::exp(z*z) * std::erfc(z);
+    double iz2 = 1.0 / (z*z);
+    return (1 - 0.5*iz2*(1 - 1.5*iz2*(1 - 2.5*iz2*(1 - 3.5*iz2))))
+        * (SQRT_TWO_DBL * INV_SQRT_TWOPI_DBL) / z;
 }
 
-/// Draw using algorithm 1.
-
-///
-/// Naive Accept-Reject algorithm.
-///
-/// Samples z from gaussian and rejects when out of bounds
-
-inline Float UseAlg1(const Float low, ///< lower bound of distribution
-                      const Float high, ///< upper bound of distribution
-                      Sampler *sampler
-                      ) {
-  // Init Valid Flag
-  int valid = 0 ;
-  //
-
-  // Init Draw Storage
-  Float z = 0.0 ;
-  //
-
-  // Loop Until Valid Draw
-  while (valid == 0) {
-    z = stdnorm(sampler);
-
-    if (z <= high && z >= low) {
-      valid = 1 ;
-    }
-  }
-  //
-
-  // Returns
-  return z ;
-  //
+/// Cumulative distribution function of the standard normal distribution
+inline double stdnormCdf(double x) {
+    return 0.5 * std::erfc(-x * INV_SQRT_TWO_DBL);
 }
 
-/// Draw using algorithm 2.
-
-///
-///  Accept-Reject Algorithm
-///
-/// Samples from exponential distribution and rejects to transform to
-/// 'one-sided' bounded Gaussian.
-
-inline Float UseAlg2(const Float low, ///< lower bound of distribution
-                      Sampler *sampler
-                      ) {
-  // Init Values
-  const Float alphastar = (low +
-                sqrt(pow(low, 2) + 4.0)
-                ) / (2.0) ;
-  const Float alpha = alphastar ;
-  Float z;
-  Float rho;
-  Float u;
-  //
-
-  // Init Valid Flag
-  int valid = 0 ;
-  //
-
-  // Loop Until Valid Draw
-  while (valid == 0) {
-    Float e = -log(sampler->next1D());
-    z = low + e / alpha ;
-
-    rho = exp(-pow(alpha - z, 2) / 2) ;
-    u = sampler->next1D() ;
-    if (u <= rho) {
-      // Keep Successes
-      valid = 1 ;
+/**
+ * \brief Inverse of \ref stdnormCdf()
+ *
+ * Rational approximation by P. J. Acklam (relative error below 1.2e-9),
+ * followed by a single Halley step, which brings the result to full
+ * double precision. The probability is clamped such that the result is
+ * always finite.
+ */
+inline double stdnormQuantile(double p) {
+    static const double a[6] = { -3.969683028665376e+01,
+        2.209460984245205e+02, -2.759285104469687e+02,
+        1.383577518672690e+02, -3.066479806614716e+01,
+        2.506628277459239e+00 };
+    static const double b[5] = { -5.447609879822406e+01,
+        1.615858368580409e+02, -1.556989798598866e+02,
+        6.680131188771972e+01, -1.328068155288572e+01 };
+    static const double c[6] = { -7.784894002430293e-03,
+        -3.223964580411365e-01, -2.400758277161838e+00,
+        -2.549732539343734e+00,  4.374664141464968e+00,
+         2.938163982698783e+00 };
+    static const double d[4] = { 7.784695709041462e-03,
+        3.224671290700398e-01, 2.445134137142996e+00,
+        3.754408661907416e+00 };
+    const double pLow = 0.02425;
+
+    p = std::min(std::max(p, std::numeric_limits<double>::min()),
+            1 - std::numeric_limits<double>::epsilon());
+
+    double x;
+    if (p < pLow || p > 1 - pLow) {
+        double q = std::sqrt(-2 * std::log(p < pLow ? p : 1 - p));
+        x = (((((c[0]*q + c[1])*q + c[2])*q + c[3])*q + c[4])*q + c[5])
+            / ((((d[0]*q + d[1])*q + d[2])*q + d[3])*q + 1);
+        if (p > 1 - pLow)
+            x = -x;
+    } else {
+        double q = p - 0.5, r = q*q;
+        x = (((((a[0]*r + a[1])*r + a[2])*r + a[3])*r + a[4])*r + a[5])*q
+            / (((((b[0]*r + b[1])*r + b[2])*r + b[3])*r + b[4])*r + 1);
     }
-  }
-  //
 
-  // Returns
-  return z ;
-  //
+    double e = stdnormCdf(x) - p;
+    double u = e * std::exp(0.5*x*x) / INV_SQRT_TWOPI_DBL;
+    return x - u / (1 + 0.5*x*u);
 }
 
-/// Draw using algorithm 3.
-
-///
-/// Accept-Reject Algorithm
-///
-/// Samples z uniformly within lo..hi and rejects based on gaussian weight
-
-inline Float UseAlg3(const Float low, ///< lower bound of distribution
-                      const Float high, ///< upper bound of distribution
-                      Sampler *sampler
-                      ) {
-  // Init Valid Flag
-  int valid = 0 ;
-  //
-
-  // Declare Qtys
-  Float rho;
-  Float z;
-  Float u;
-  //
-
-  // Loop Until Valid Draw
-  while (valid == 0) {
-    z = low + sampler->next1D() * (high - low);
-    if (0 < low) {
-      rho = exp((pow(low, 2) - pow(z, 2)) / 2) ;
-    } else if (high < 0) {
-      rho = exp((pow(high, 2) - pow(z, 2)) / 2) ;
-    } else {
-      SAssert(0 <= high && low <= 0);
-      rho = exp(- pow(z, 2) / 2) ;
-    }
-
-    u = sampler->next1D();
-    if (u <= rho) {
-      valid = 1 ;
+/**
+ * \brief Map a uniform sample to a standard normal distribution that is
+ * truncated to [lo, hi], where lo < hi <= 0.
+ *
+ * Inverts the cumulative distribution function (relative to its value
+ * at \c hi, which can underflow far in the tail) with a fixed number of
+ * Newton steps on its logarithm. The logarithm of the cdf is concave, so
+ * that the iteration converges monotonically.
+ */
+inline double truncnormLeftTail(double lo, double hi, double u) {
+    // log(cdf(x) / exp(-hi^2/2)) and its derivative
+    auto logCdf = [=] (double x) {
+        return std::log(0.5 * erfcScaled(-x * INV_SQRT_TWO_DBL))
+            - 0.5*(x*x - hi*hi);
+    };
+    auto dLogCdf = [] (double x) {
+        return 2 * INV_SQRT_TWOPI_DBL / erfcScaled(-x * INV_SQRT_TWO_DBL);
+    };
+
+    double cdfHi = 0.5 * erfcScaled(-hi * INV_SQRT_TWO_DBL);
+    double cdfLo = std::isinf(lo) ? 0.0 : std::exp(logCdf(lo));
+    double target = cdfLo + u * (cdfHi - cdfLo);
+    target = std::max(target, cdfHi * std::numeric_limits<double>::epsilon());
+    double logTarget = std::log(target);
+
+    double x = hi + (logTarget - std::log(cdfHi)) / dLogCdf(hi);
+    for (int i = 0; i < 4; ++i) {
+        x = std::min(std::max(x, lo), hi);
+        x -= (logCdf(x) - logTarget) / dLogCdf(x);
     }
-  }
-  //
-
-  // Returns
-  return z ;
-  //
+    return std::min(std::max(x, lo), hi);
 }
 
-
-/// Draw from an arbitrary truncated normal distribution.
-
-///
-/// See Robert (1995): <br />
-/// Reference Type: Journal Article <br />
-/// Author: Robert, Christian P. <br />
-/// Primary Title: Simulation of truncated normal variables <br />
-/// Journal Name: Statistics and Computing <br />
-/// Cover Date: 1995-06-01 <br />
-/// Publisher: Springer Netherlands <br />
-/// Issn: 0960-3174 <br />
-/// Subject: Mathematics and Statistics <br />
-// Start Page: 121 <br />
-// End Page: 125 <br />
-/// Volume: 5 <br />
-/// Issue: 2 <br />
-/// Url: http://dx.doi.org/10.1007/BF00143942 <br />
-/// Doi: 10.1007/BF00143942 <br />
-///
-
-/* TODO: sampler generates only a few set of discrete samples for, eg,:
- * mean = 0, sd = 1, lo = 10, hi = 10.001
- * -> numerical cancellation issue + should simply sample uniformly here,
- *  because pdf is nearly constant anyway
+/**
+ * \brief Map a uniform sample in [0,1) to the normal distribution with
+ * the given mean and standard deviation that is truncated to [low, high]
+ *
+ * The cumulative distribution function is inverted directly, so exactly
+ * one sample is consumed per draw, no matter the parameters. This keeps
+ * (quasi-)random sequences stratified. When both bounds lie on the same
+ * side of the mean, the distribution is mirrored such that they lie on
+ * the left, where the cdf is small and accurate. Bounds far in the tail
+ * are handled by \ref truncnormLeftTail(). The corresponding density is
+ * \ref truncnormPdf().
  */
-
-inline Float truncnorm(const Float mean,
-            const Float sd,
-            const Float low,
-            const Float high,
-            Sampler *sampler
-            ) {
-
+inline double truncnorm(const double mean,
+            const double sd,
+            const double low,
+            const double high,
+            double sample) {
     SAssert(low <= high);
     SAssert(sd >= 0);
 
@@ -338,127 +246,43 @@ inline Float truncnorm(const Float mean,
         return low;
     }
 
-    if (std::isinf(sd)) {
-        return low + sampler->next1D() * (high - low);
-    }
+    if (std::isinf(sd))
+        return low + sample * (high - low);
 
-  // Init Useful Values
-  Float draw = 0;
-  int type = 0 ;
-  int valid = 0 ; // used only when switching to a simplified version
-          // of Alg 2 within Type 4 instead of the less
-          // efficient Alg 3
-
-  // Set Current Distributional Parameters
-   const Float c_mean = mean ;
-   Float c_sd = sd ;
-   const Float c_low = low ;
-   const Float c_high = high ;
-   Float c_stdlow = (c_low - c_mean) / c_sd ;
-   Float c_stdhigh = (c_high - c_mean) / c_sd ; // bounds are standardized
-
-   const Float INF = std::numeric_limits<Float>::infinity();
-
-
-  // Map Conceptual Cases to Algorithm Cases
-  // Case 1 (Simple Deterministic AR)
-  // mu \in [low, high]
-  if (0 <= c_stdhigh &&
-      0 >= c_stdlow
-      ) {
-    type = 1 ;
-  }
-
-  // Case 2 (Robert 2009 AR)
-  // mu < low, high = Inf
-  if (0 < c_stdlow &&
-      c_stdhigh == INF
-      ) {
-    type = 2 ;
-  }
-
-  // Case 3 (Robert 2009 AR)
-  // high < mu, low = -Inf
-  if (0 > c_stdhigh &&
-      c_stdlow == -INF
-      ) {
-    type = 3 ;
-  }
-
-  // Case 4 (Robert 2009 AR)
-  // mu -\in [low, high] & (abs(low) =\= Inf =\= high)
-  if ((0 > c_stdhigh || 0 < c_stdlow) &&
-      !(c_stdhigh == INF || c_stdlow == -INF)
-      ) {
-    type = 4 ;
-  }
-
-  ////////////
-  // Type 1 //
-  ////////////
-  if (type == 1) {
-    if (CheckRejectFromUniformInsteadOfNormal(c_stdlow, c_stdhigh))
-      draw = UseAlg3(c_stdlow, c_stdhigh, sampler) ;
-    else
-      draw = UseAlg1(c_stdlow, c_stdhigh, sampler) ;
-  }
-
-  ////////////
-  // Type 3 //
-  ////////////
-  if (type == 3) {
-    c_stdlow = -1 * c_stdhigh ;
-    c_stdhigh = INF ;
-    c_sd = -1 * c_sd ; // hack to get two negative signs to cancel out
-
-    // Use Algorithm #2 Post-Adjustments
-    type = 2 ;
-  }
-
-  ////////////
-  // Type 2 //
-  ////////////
-  if (type == 2) {
-    draw = UseAlg2(c_stdlow, sampler) ;
-  }
-
-    ////////////
-    // Type 4 //
-    ////////////
-
-    if (type == 4) {
-        // Flip to make the standardized bounds positive if they aren't
-        // already, or else Alg2 fails
-        SAssert(c_stdlow * c_stdhigh > 0); // double check that both have same sign
-        if (c_stdlow < 0) {
-            double tmp = c_stdlow;
-            c_stdlow = -c_stdhigh ;
-            c_stdhigh = -tmp;
-            c_sd = -1 * c_sd ; // hack to get two negative signs to cancel out
-        }
+    double lo = (low - mean) / sd;
+    double hi = (high - mean) / sd;
+    double u = sample;
 
-        if (CheckSimple(c_stdlow, c_stdhigh)) {
-            while (valid == 0) {
-                draw = UseAlg2(c_stdlow, sampler) ;
-                // use the simple
-                // algorithm if it is more
-                // efficient
-                if (draw <= c_stdhigh) {
-                    valid = 1 ;
-                }
-            }
-        } else {
-            draw = UseAlg3(c_stdlow, c_stdhigh, sampler) ; // use the complex
-            // algorithm if the simple
-            // is less efficient
-        }
+    /* Mirror such that the bounds are not both to the right of the mean */
+    bool flipped = lo >= 0;
+    if (flipped) {
+        double tmp = lo;
+        lo = -hi;
+        hi = -tmp;
+        u = 1 - u;
     }
 
-    if (draw < c_stdlow || draw > c_stdhigh) {
-        SLog(EWarn, "Generated out of bounds draw: %f not in [%f .. %f]",
-                draw, c_stdlow, c_stdhigh);
+    double draw;
+    if (hi < -5) {
+        draw = truncnormLeftTail(lo, hi, u);
+    } else {
+        double cdfLo = stdnormCdf(lo), cdfHi = stdnormCdf(hi);
+        draw = stdnormQuantile(cdfLo + u * (cdfHi - cdfLo));
     }
-    return math::clamp(c_mean + c_sd * draw, low, high); // to protect against round-off
+    if (flipped)
+        draw = -draw;
+
+    /* Clamp to protect against round-off */
+    return math::clamp(mean + sd * draw, low, high);
+}
+
+/// Draw from an arbitrary truncated normal distribution
+inline double truncnorm(const double mean,
+            const double sd,
+            const double low,
+            const double high,
+            Sampler *sampler) {
+    return truncnorm(mean, sd, low, high, sampler->next1D());
 }
 
 MTS_NAMESPACE_END
@@ -59,6 +59,19 @@ protected:
 #define MTS_DECLARE_UTILITY() \
     MTS_DECLARE_CLASS()
 
+#if defined(MTS_STATIC_PLUGIN)
+#define MTS_EXPORT_UTILITY(name, descr) \
+    MTS_IMPLEMENT_CLASS(name, false, Utility) \
+    namespace { \
+        void *CreateUtility() { \
+            return new name(); \
+        } \
+        const char *GetDescription() { \
+            return descr; \
+        } \
+    } \
+    MTS_REGISTER_STATIC_PLUGIN(NULL, CreateUtility, GetDescription)
+#else
 #define MTS_EXPORT_UTILITY(name, descr) \
     MTS_IMPLEMENT_CLASS(name, false, Utility) \
     extern "C" { \
@@ -69,6 +82,7 @@ protected:
             return descr; \
         } \
     }
+#endif
 
 MTS_NAMESPACE_END
 
@@ -45,6 +45,29 @@ public:
     /// Look up a floating point value by position
     virtual Float lookupFloat(const Point &p) const;
 
+    /**
+     * \brief Look up floating point values at \c count equally spaced
+     * positions <tt>p + i * increment</tt>, where <tt>i=0, ..., count-1</tt>
+     *
+     * This amortizes the per-lookup overhead when marching along a ray.
+     * The default implementation calls \ref lookupFloat() for every position.
+     */
+    virtual void lookupFloatSequence(const Point &p, const Vector &increment,
+        size_t count, Float *values) const;
+
+    /**
+     * \brief Look up a floating point value by position using
+     * stochastic filtering
+     *
+     * Instead of interpolating between several values, this fetches
+     * a single one that is chosen at random using \c sample (uniformly
+     * distributed on <tt>[0, 1)</tt>), so that the expected result
+     * equals that of \ref lookupFloat(). This is sufficient for estimators
+     * that are linear in the looked up value, such as Woodcock and
+     * ratio tracking. The default implementation calls \ref lookupFloat().
+     */
+    virtual Float lookupFloatStochastic(const Point &p, Float sample) const;
+
     /// Are spectrum-valued lookups permitted?
     virtual bool supportsSpectrumLookups() const;
 
@@ -71,6 +94,22 @@ public:
      */
     virtual Float getMaximumFloatValue() const = 0;
 
+    /**
+     * \brief Return the maximum floating point value that
+     * could be returned by \ref lookupFloat at positions
+     * within the given (world-space) bounding box.
+     *
+     * This is useful for computing local majorants. The default
+     * implementation returns \ref getMaximumFloatValue().
+     */
+    virtual Float getLocalMaximumFloatValue(const AABB &aabb) const;
+
+    /**
+     * \brief Does \ref getLocalMaximumFloatValue() provide
+     * bounds that are tighter than the global maximum?
+     */
+    virtual bool hasLocalMaxima() const;
+
     MTS_DECLARE_CLASS()
 protected:
     /// Virtual destructor
@@ -48,6 +48,38 @@ struct VPL {
     std::string toString() const;
 };
 
+/**
+ * \brief Virtual ray light (VRL): a segment of a light path that
+ * passes through a participating medium
+ *
+ * Used by rendering algorithms that compute scattering between the
+ * media along light paths and camera rays (Novak et al. 2012).
+ * \ingroup librender
+ */
+struct VRL {
+    inline VRL(const Point &o, const Vector &d, Float length,
+        const Spectrum &P, const Medium *medium, Float time, int depth)
+        : o(o), d(d), length(length), P(P), medium(medium),
+          time(time), depth(depth) {
+    }
+    /// Start of the segment
+    Point o;
+    /// Normalized direction of light propagation
+    Vector d;
+    /// Length of the segment
+    Float length;
+    /// Power arriving at \c o (before attenuation by the segment)
+    Spectrum P;
+    /// Medium containing the segment
+    const Medium *medium;
+    /// Associated scene time
+    Float time;
+    /// Index of the segment along its light path (1 = emitted)
+    int depth;
+
+    std::string toString() const;
+};
+
 /**
  * Generate a series of point light sources by sampling from the Halton
  * sequence (as is done in Instant Radiosity). The parameter \c offset
@@ -65,6 +97,34 @@ extern MTS_EXPORT_RENDER size_t generateVPLs(const Scene *scene,
         size_t count, int maxDepth, bool prune,
         std::deque<VPL> &vpls);
 
+/**
+ * Generate a series of virtual ray lights by tracing light paths through
+ * the scene's participating media. The paths are sampled from the Halton
+ * sequence as in \ref generateVPLs(), and the parameters \c offset and
+ * \c count have the same meaning. Every path segment within a medium is
+ * recorded as long as the resulting path (with one additional scattering
+ * event along a camera ray) does not exceed \c maxDepth. After generation,
+ * the power of the VRLs must be scaled by the inverse of the returned index.
+ */
+extern MTS_EXPORT_RENDER size_t generateVRLs(const Scene *scene,
+        size_t offset, size_t count, int maxDepth,
+        std::deque<VRL> &vrls);
+
+/**
+ * Reduce a set of VPLs to (approximately) at most \c maxClusters
+ * representatives in the spirit of Lightcuts. The VPLs are partitioned
+ * top-down: the cluster with the largest error bound (total luminance times
+ * squared extent in position and orientation) is repeatedly split at the
+ * median of its widest dimension. Only VPLs of the same type (and, for
+ * emitter VPLs, of the same emitter) are grouped together, hence the
+ * result can exceed \c maxClusters when there are more such groups.
+ * Every cluster is represented by one of its VPLs, chosen with probability
+ * proportional to its luminance, whose power is rescaled so that the
+ * expected contribution of the cluster is unchanged.
+ */
+extern MTS_EXPORT_RENDER void clusterVPLs(const std::deque<VPL> &vpls,
+        size_t maxClusters, Random *random, std::deque<VPL> &clusters);
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_RENDER_VPL_H_ */
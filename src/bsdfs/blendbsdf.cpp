@@ -134,7 +134,7 @@ public:
 
     Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         Float weight = std::min((Float) 1.0f, std::max((Float) 0.0f,
-            m_weight->eval(bRec.its).average()));
+            m_weight->evalCached(bRec.its).average()));
 
         if (bRec.component == -1) {
             return
@@ -155,7 +155,7 @@ public:
         Spectrum result;
 
         Float weight = std::min((Float) 1.0f, std::max((Float) 0.0f,
-            m_weight->eval(bRec.its).average()));
+            m_weight->evalCached(bRec.its).average()));
 
         if (bRec.component == -1) {
             return
@@ -177,7 +177,7 @@ public:
 
         Float weights[2];
         weights[1] = std::min((Float) 1.0f, std::max((Float) 0.0f,
-            m_weight->eval(bRec.its).average()));
+            m_weight->evalCached(bRec.its).average()));
         weights[0] = 1-weights[1];
 
         if (bRec.component == -1) {
@@ -223,7 +223,7 @@ public:
 
         Float weights[2];
         weights[1] = std::min((Float) 1.0f, std::max((Float) 0.0f,
-            m_weight->eval(bRec.its).average()));
+            m_weight->evalCached(bRec.its).average()));
         weights[0] = 1-weights[1];
 
         if (bRec.component == -1) {
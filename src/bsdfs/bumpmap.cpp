@@ -134,7 +134,7 @@ public:
 
     Frame getFrame(const Intersection &its) const {
         Spectrum grad[2];
-        m_displacement->evalGradient(its, grad);
+        m_displacement->evalGradientCached(its, grad);
 
         Float dDispDu = grad[0].getLuminance();
         Float dDispDv = grad[1].getLuminance();
@@ -161,7 +161,7 @@ public:
     Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         const Intersection& its = bRec.its;
         Intersection perturbed(its);
-        perturbed.shFrame = getFrame(its);
+        perturbed.shFrame = getFrame(perturbed);
 
         BSDFSamplingRecord perturbedQuery(perturbed,
             perturbed.toLocal(its.toWorld(bRec.wi)),
@@ -171,13 +171,15 @@ public:
         perturbedQuery.sampler = bRec.sampler;
         perturbedQuery.typeMask = bRec.typeMask;
         perturbedQuery.component = bRec.component;
-        return m_nested->eval(perturbedQuery, measure);
+        Spectrum result = m_nested->eval(perturbedQuery, measure);
+        its.texCache = perturbed.texCache;
+        return result;
     }
 
     Float pdf(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         const Intersection& its = bRec.its;
         Intersection perturbed(its);
-        perturbed.shFrame = getFrame(its);
+        perturbed.shFrame = getFrame(perturbed);
 
         BSDFSamplingRecord perturbedQuery(perturbed,
             perturbed.toLocal(its.toWorld(bRec.wi)),
@@ -188,13 +190,15 @@ public:
         perturbedQuery.sampler = bRec.sampler;
         perturbedQuery.typeMask = bRec.typeMask;
         perturbedQuery.component = bRec.component;
-        return m_nested->pdf(perturbedQuery, measure);
+        Float result = m_nested->pdf(perturbedQuery, measure);
+        its.texCache = perturbed.texCache;
+        return result;
     }
 
     Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &sample) const {
         const Intersection& its = bRec.its;
         Intersection perturbed(its);
-        perturbed.shFrame = getFrame(its);
+        perturbed.shFrame = getFrame(perturbed);
 
         BSDFSamplingRecord perturbedQuery(perturbed, bRec.sampler, bRec.mode);
         perturbedQuery.wi = perturbed.toLocal(its.toWorld(bRec.wi));
@@ -202,6 +206,7 @@ public:
         perturbedQuery.typeMask = bRec.typeMask;
         perturbedQuery.component = bRec.component;
         Spectrum result = m_nested->sample(perturbedQuery, sample);
+        its.texCache = perturbed.texCache;
         if (!result.isZero()) {
             bRec.sampledComponent = perturbedQuery.sampledComponent;
             bRec.sampledType = perturbedQuery.sampledType;
@@ -216,13 +221,14 @@ public:
     Spectrum sample(BSDFSamplingRecord &bRec, Float &pdf, const Point2 &sample) const {
         const Intersection& its = bRec.its;
         Intersection perturbed(its);
-        perturbed.shFrame = getFrame(its);
+        perturbed.shFrame = getFrame(perturbed);
 
         BSDFSamplingRecord perturbedQuery(perturbed, bRec.sampler, bRec.mode);
         perturbedQuery.wi = perturbed.toLocal(its.toWorld(bRec.wi));
         perturbedQuery.typeMask = bRec.typeMask;
         perturbedQuery.component = bRec.component;
         Spectrum result = m_nested->sample(perturbedQuery, pdf, sample);
+        its.texCache = perturbed.texCache;
 
         if (!result.isZero()) {
             bRec.sampledComponent = perturbedQuery.sampledComponent;
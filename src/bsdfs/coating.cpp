@@ -226,7 +226,7 @@ public:
 
         if (measure == EDiscrete && sampleSpecular &&
                 std::abs(dot(reflect(bRec.wi), bRec.wo)-1) < DeltaEpsilon) {
-            return m_specularReflectance->eval(bRec.its) *
+            return m_specularReflectance->evalCached(bRec.its) *
                 fresnelDielectricExt(std::abs(Frame::cosTheta(bRec.wi)), m_eta);
         } else if (sampleNested) {
             Float R12, R21;
@@ -240,7 +240,7 @@ public:
             Spectrum result = m_nested->eval(bRecInt, measure)
                 * (1-R12) * (1-R21);
 
-            Spectrum sigmaA = m_sigmaA->eval(bRec.its) * m_thickness;
+            Spectrum sigmaA = m_sigmaA->evalCached(bRec.its) * m_thickness;
             if (!sigmaA.isZero())
                 result *= (-sigmaA *
                     (1/std::abs(Frame::cosTheta(bRecInt.wi)) +
@@ -330,7 +330,7 @@ public:
             bRec.wo = reflect(bRec.wi);
             bRec.eta = 1.0f;
             pdf = sampleNested ? probSpecular : 1.0f;
-            return m_specularReflectance->eval(bRec.its) * (R12/pdf);
+            return m_specularReflectance->evalCached(bRec.its) * (R12/pdf);
         } else {
             if (R12 == 1.0f) /* Total internal reflection */
                 return Spectrum(0.0f);
@@ -344,7 +344,7 @@ public:
 
             Vector woPrime = bRec.wo;
 
-            Spectrum sigmaA = m_sigmaA->eval(bRec.its) * m_thickness;
+            Spectrum sigmaA = m_sigmaA->evalCached(bRec.its) * m_thickness;
             if (!sigmaA.isZero())
                 result *= (-sigmaA *
                     (1/std::abs(Frame::cosTheta(wiPrime)) +
@@ -232,7 +232,7 @@ public:
             std::abs(dot(reflect(bRec.wi), bRec.wo)-1) > DeltaEpsilon)
             return Spectrum(0.0f);
 
-        return m_specularReflectance->eval(bRec.its) *
+        return m_specularReflectance->evalCached(bRec.its) *
             fresnelConductorExact(Frame::cosTheta(bRec.wi), m_eta, m_k);
     }
 
@@ -263,7 +263,7 @@ public:
         bRec.wo = reflect(bRec.wi);
         bRec.eta = 1.0f;
 
-        return m_specularReflectance->eval(bRec.its) *
+        return m_specularReflectance->evalCached(bRec.its) *
             fresnelConductorExact(Frame::cosTheta(bRec.wi), m_eta, m_k);
     }
 
@@ -280,7 +280,7 @@ public:
         bRec.eta = 1.0f;
         pdf = 1;
 
-        return m_specularReflectance->eval(bRec.its) *
+        return m_specularReflectance->evalCached(bRec.its) *
             fresnelConductorExact(Frame::cosTheta(bRec.wi), m_eta, m_k);
     }
 
@@ -261,7 +261,7 @@ public:
             if (!sampleReflection || std::abs(dot(reflect(bRec.wi), bRec.wo)-1) > DeltaEpsilon)
                 return Spectrum(0.0f);
 
-            return m_specularReflectance->eval(bRec.its) * F;
+            return m_specularReflectance->evalCached(bRec.its) * F;
         } else {
             if (!sampleTransmission || std::abs(dot(refract(bRec.wi, cosThetaT), bRec.wo)-1) > DeltaEpsilon)
                 return Spectrum(0.0f);
@@ -271,7 +271,7 @@ public:
             Float factor = (bRec.mode == ERadiance)
                 ? (cosThetaT < 0 ? m_invEta : m_eta) : 1.0f;
 
-            return m_specularTransmittance->eval(bRec.its)  * factor * factor * (1 - F);
+            return m_specularTransmittance->evalCached(bRec.its)  * factor * factor * (1 - F);
         }
     }
 
@@ -336,7 +336,7 @@ public:
                 bRec.eta = 1.0f;
                 pdf = F;
 
-                return m_specularReflectance->eval(bRec.its);
+                return m_specularReflectance->evalCached(bRec.its);
             } else {
                 bRec.sampledComponent = 1;
                 bRec.sampledType = EDeltaTransmission;
@@ -349,7 +349,7 @@ public:
                 Float factor = (bRec.mode == ERadiance)
                     ? (cosThetaT < 0 ? m_invEta : m_eta) : 1.0f;
 
-                return m_specularTransmittance->eval(bRec.its) * (factor * factor);
+                return m_specularTransmittance->evalCached(bRec.its) * (factor * factor);
             }
         } else if (sampleReflection) {
             if (m_noExternalReflection) {
@@ -366,7 +366,7 @@ public:
             bRec.eta = 1.0f;
             pdf = 1.0f;
 
-            return m_specularReflectance->eval(bRec.its) * F;
+            return m_specularReflectance->evalCached(bRec.its) * F;
         } else if (sampleTransmission) {
             bRec.sampledComponent = 1;
             bRec.sampledType = EDeltaTransmission;
@@ -379,7 +379,7 @@ public:
             Float factor = (bRec.mode == ERadiance)
                 ? (cosThetaT < 0 ? m_invEta : m_eta) : 1.0f;
 
-            return m_specularTransmittance->eval(bRec.its) * (factor * factor * (1-F));
+            return m_specularTransmittance->evalCached(bRec.its) * (factor * factor * (1-F));
         }
 
         return Spectrum(0.0f);
@@ -412,7 +412,7 @@ public:
                 bRec.wo = reflect(bRec.wi);
                 bRec.eta = 1.0f;
 
-                return m_specularReflectance->eval(bRec.its);
+                return m_specularReflectance->evalCached(bRec.its);
             } else {
                 bRec.sampledComponent = 1;
                 bRec.sampledType = EDeltaTransmission;
@@ -424,7 +424,7 @@ public:
                 Float factor = (bRec.mode == ERadiance)
                     ? (cosThetaT < 0 ? m_invEta : m_eta) : 1.0f;
 
-                return m_specularTransmittance->eval(bRec.its) * (factor * factor);
+                return m_specularTransmittance->evalCached(bRec.its) * (factor * factor);
             }
         } else if (sampleReflection) {
             if (m_noExternalReflection) {
@@ -440,7 +440,7 @@ public:
             bRec.wo = reflect(bRec.wi);
             bRec.eta = 1.0f;
 
-            return m_specularReflectance->eval(bRec.its) * F;
+            return m_specularReflectance->evalCached(bRec.its) * F;
         } else if (sampleTransmission) {
             bRec.sampledComponent = 1;
             bRec.sampledType = EDeltaTransmission;
@@ -452,7 +452,7 @@ public:
             Float factor = (bRec.mode == ERadiance)
                 ? (cosThetaT < 0 ? m_invEta : m_eta) : 1.0f;
 
-            return m_specularTransmittance->eval(bRec.its) * (factor * factor * (1-F));
+            return m_specularTransmittance->evalCached(bRec.its) * (factor * factor * (1-F));
         }
 
         return Spectrum(0.0f);
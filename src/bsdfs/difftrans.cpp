@@ -78,7 +78,7 @@ public:
             || Frame::cosTheta(bRec.wi) * Frame::cosTheta(bRec.wo) >= 0)
             return Spectrum(0.0f);
 
-        return m_transmittance->eval(bRec.its)
+        return m_transmittance->evalCached(bRec.its)
             * (INV_PI * std::abs(Frame::cosTheta(bRec.wo)));
     }
 
@@ -99,7 +99,7 @@ public:
         bRec.eta = 1.0f;
         bRec.sampledComponent = 0;
         bRec.sampledType = EDiffuseTransmission;
-        return m_transmittance->eval(bRec.its);
+        return m_transmittance->evalCached(bRec.its);
     }
 
     Spectrum sample(BSDFSamplingRecord &bRec, Float &pdf, const Point2 &sample) const {
@@ -112,7 +112,7 @@ public:
         bRec.sampledComponent = 0;
         bRec.sampledType = EDiffuseTransmission;
         pdf = std::abs(Frame::cosTheta(bRec.wo)) * INV_PI;
-        return m_transmittance->eval(bRec.its);
+        return m_transmittance->evalCached(bRec.its);
     }
 
     void addChild(const std::string &name, ConfigurableObject *child) {
@@ -104,7 +104,7 @@ public:
     }
 
     Spectrum getDiffuseReflectance(const Intersection &its) const {
-        return m_reflectance->eval(its);
+        return m_reflectance->evalCached(its);
     }
 
     Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
@@ -113,7 +113,7 @@ public:
             || Frame::cosTheta(bRec.wo) <= 0)
             return Spectrum(0.0f);
 
-        return m_reflectance->eval(bRec.its)
+        return m_reflectance->evalCached(bRec.its)
             * (INV_PI * Frame::cosTheta(bRec.wo));
     }
 
@@ -134,7 +134,7 @@ public:
         bRec.eta = 1.0f;
         bRec.sampledComponent = 0;
         bRec.sampledType = EDiffuseReflection;
-        return m_reflectance->eval(bRec.its);
+        return m_reflectance->evalCached(bRec.its);
     }
 
     Spectrum sample(BSDFSamplingRecord &bRec, Float &pdf, const Point2 &sample) const {
@@ -146,7 +146,7 @@ public:
         bRec.sampledComponent = 0;
         bRec.sampledType = EDiffuseReflection;
         pdf = warp::squareToCosineHemispherePdf(bRec.wo);
-        return m_reflectance->eval(bRec.its);
+        return m_reflectance->evalCached(bRec.its);
     }
 
     void addChild(const std::string &name, ConfigurableObject *child) {
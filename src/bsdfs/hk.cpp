@@ -175,25 +175,61 @@ public:
         m_usesRayDifferentials = m_sigmaS->usesRayDifferentials()
             || m_sigmaA->usesRayDifferentials();
 
+        /* Skip the texture lookups when the coefficients are constant */
+        m_constantCoefficients = m_sigmaS->isConstant() && m_sigmaA->isConstant();
+        if (m_constantCoefficients) {
+            Intersection its;
+            lookupCoefficients(its, m_constantTauD, m_constantAlbedo);
+        }
+
+        /* Evaluate and sample Henyey-Greenstein lobes without virtual calls */
+        m_hgPhase = m_phase->getClass()->getName() == "HGPhaseFunction";
+        m_hgG = m_hgPhase ? m_phase->getMeanCosine() : 0.0f;
+
         BSDF::configure();
     }
 
-    Spectrum getDiffuseReflectance(const Intersection &its) const {
-        Spectrum sigmaA = m_sigmaA->eval(its),
-                 sigmaS = m_sigmaS->eval(its),
-                 sigmaT = sigmaA + sigmaS,
-                 albedo;
+    /// Optical thickness and single scattering albedo of the layer at \c its
+    inline void lookupCoefficients(const Intersection &its,
+            Spectrum &tauD, Spectrum &albedo) const {
+        Spectrum sigmaA = m_sigmaA->evalCached(its),
+                 sigmaS = m_sigmaS->evalCached(its),
+                 sigmaT = sigmaA + sigmaS;
+        tauD = sigmaT * m_thickness;
         for (int i = 0; i < SPECTRUM_SAMPLES; i++)
             albedo[i] = sigmaT[i] > 0 ? (sigmaS[i]/sigmaT[i]) : (Float) 0;
+    }
+
+    inline void evalCoefficients(const Intersection &its,
+            Spectrum &tauD, Spectrum &albedo) const {
+        if (m_constantCoefficients) {
+            tauD = m_constantTauD;
+            albedo = m_constantAlbedo;
+        } else {
+            lookupCoefficients(its, tauD, albedo);
+        }
+    }
+
+    /// Evaluate the phase function (which is also its sampling density)
+    inline Float evalPhase(const Vector &wi, const Vector &wo) const {
+        if (m_hgPhase) {
+            Float temp = 1.0f + m_hgG*m_hgG + 2.0f * m_hgG * dot(wi, wo);
+            return INV_FOURPI * (1 - m_hgG*m_hgG) / (temp * std::sqrt(temp));
+        }
+        MediumSamplingRecord dummy;
+        PhaseFunctionSamplingRecord pRec(dummy, wi, wo);
+        return m_phase->eval(pRec);
+    }
+
+    Spectrum getDiffuseReflectance(const Intersection &its) const {
+        Spectrum tauD, albedo;
+        evalCoefficients(its, tauD, albedo);
         return albedo; /* Very approximate .. */
     }
 
     Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
-        Spectrum sigmaA = m_sigmaA->eval(bRec.its),
-                 sigmaS = m_sigmaS->eval(bRec.its),
-                 sigmaT = sigmaA + sigmaS,
-                 tauD = sigmaT * m_thickness,
-                 result(0.0f);
+        Spectrum tauD, albedo, result(0.0f);
+        evalCoefficients(bRec.its, tauD, albedo);
 
         if (measure == EDiscrete) {
             /* Figure out if the specular transmission is specifically requested */
@@ -211,10 +247,6 @@ public:
             bool hasGlossyTransmission = (bRec.typeMask & EGlossyTransmission)
                 && (bRec.component == -1 || bRec.component == 1);
 
-            Spectrum albedo;
-            for (int i = 0; i < SPECTRUM_SAMPLES; i++)
-                albedo[i] = sigmaT[i] > 0 ? (sigmaS[i]/sigmaT[i]) : (Float) 0;
-
             const Float cosThetaI = Frame::cosTheta(bRec.wi),
                         cosThetaO = Frame::cosTheta(bRec.wo),
                         dp = cosThetaI*cosThetaO;
@@ -226,9 +258,7 @@ public:
             /* ==================================================================== */
 
             if (hasGlossyReflection && reflection) {
-                MediumSamplingRecord dummy;
-                PhaseFunctionSamplingRecord pRec(dummy,bRec.wi,bRec.wo);
-                const Float phaseVal = m_phase->eval(pRec);
+                const Float phaseVal = evalPhase(bRec.wi, bRec.wo);
 
                 result = albedo * (phaseVal*cosThetaI/(cosThetaI+cosThetaO)) *
                     (Spectrum(1.0f)-((-1.0f/std::abs(cosThetaI)-1.0f/std::abs(cosThetaO)) * tauD).exp());
@@ -240,9 +270,7 @@ public:
 
             if (hasGlossyTransmission && transmission
                     && m_thickness < std::numeric_limits<Float>::infinity()) {
-                MediumSamplingRecord dummy;
-                PhaseFunctionSamplingRecord pRec(dummy,bRec.wi,bRec.wo);
-                const Float phaseVal = m_phase->eval(pRec);
+                const Float phaseVal = evalPhase(bRec.wi, bRec.wo);
 
                 /* Hanrahan etal 93 Single Scattering transmission term */
                 if (std::abs(cosThetaI + cosThetaO) < Epsilon) {
@@ -266,10 +294,8 @@ public:
         bool hasSpecularTransmission = (bRec.typeMask & EDeltaTransmission)
             && (bRec.component == -1 || bRec.component == 2);
 
-        const Spectrum sigmaA = m_sigmaA->eval(bRec.its),
-                 sigmaS = m_sigmaS->eval(bRec.its),
-                 sigmaT = sigmaA + sigmaS,
-                 tauD = sigmaT * m_thickness;
+        Spectrum tauD, albedo;
+        evalCoefficients(bRec.its, tauD, albedo);
 
         Float probSpecularTransmission = (-tauD/std::abs(Frame::cosTheta(bRec.wi))).exp().average();
 
@@ -292,9 +318,14 @@ public:
                 return 0.0f;
 
             /* Sampled according to the phase function lobe(s) */
-            MediumSamplingRecord dummy;
-            PhaseFunctionSamplingRecord pRec(dummy, bRec.wi, bRec.wo);
-            Float pdf = m_phase->pdf(pRec);
+            Float pdf;
+            if (m_hgPhase) {
+                pdf = evalPhase(bRec.wi, bRec.wo);
+            } else {
+                MediumSamplingRecord dummy;
+                PhaseFunctionSamplingRecord pRec(dummy, bRec.wi, bRec.wo);
+                pdf = m_phase->pdf(pRec);
+            }
             if (hasSpecularTransmission)
                 pdf *= 1-probSpecularTransmission;
             return pdf;
@@ -310,10 +341,8 @@ public:
         bool hasSingleScattering = (bRec.typeMask & EGlossy)
             && (bRec.component == -1 || bRec.component == 0 || bRec.component == 1);
 
-        const Spectrum sigmaA = m_sigmaA->eval(bRec.its),
-                 sigmaS = m_sigmaS->eval(bRec.its),
-                 sigmaT = sigmaA + sigmaS,
-                 tauD = sigmaT * m_thickness;
+        Spectrum tauD, albedo;
+        evalCoefficients(bRec.its, tauD, albedo);
 
         /* Probability for a specular transmission is approximated by the average (per wavelength)
          * probability of a photon exiting without a scattering event or an absorption event */
@@ -346,12 +375,31 @@ public:
             bool hasGlossyTransmission = (bRec.typeMask & EGlossyTransmission)
                 && (bRec.component == -1 || bRec.component == 1);
 
-            /* Sample According to the phase function lobes */
-            PhaseFunctionSamplingRecord pRec(MediumSamplingRecord(), bRec.wi, bRec.wo);
-            m_phase->sample(pRec, _pdf, bRec.sampler);
+            if (m_hgPhase) {
+                /* Sample the Henyey-Greenstein lobe using the (remaining) BSDF sample */
+                Float cosTheta;
+                if (std::abs(m_hgG) < Epsilon) {
+                    cosTheta = 1 - 2*sample.x;
+                } else {
+                    Float sqrTerm = (1 - m_hgG * m_hgG) / (1 - m_hgG + 2 * m_hgG * sample.x);
+                    cosTheta = (1 + m_hgG * m_hgG - sqrTerm * sqrTerm) / (2 * m_hgG);
+                }
+
+                Float sinTheta = math::safe_sqrt(1.0f-cosTheta*cosTheta),
+                      sinPhi, cosPhi;
+                math::sincos(2*M_PI*sample.y, &sinPhi, &cosPhi);
+
+                bRec.wo = Frame(-bRec.wi).toWorld(Vector(
+                    sinTheta * cosPhi, sinTheta * sinPhi, cosTheta));
+                _pdf = evalPhase(bRec.wi, bRec.wo);
+            } else {
+                /* Sample According to the phase function lobes */
+                PhaseFunctionSamplingRecord pRec(MediumSamplingRecord(), bRec.wi, bRec.wo);
+                m_phase->sample(pRec, _pdf, bRec.sampler);
 
-            /* Store the sampled direction */
-            bRec.wo = pRec.wo;
+                /* Store the sampled direction */
+                bRec.wo = pRec.wo;
+            }
 
             bool reflection = Frame::cosTheta(bRec.wi) * Frame::cosTheta(bRec.wo) >= 0;
             if ((!hasGlossyReflection && reflection) ||
@@ -435,6 +483,10 @@ private:
     ref<Texture> m_sigmaS;
     ref<Texture> m_sigmaA;
     Float m_thickness;
+    bool m_constantCoefficients;
+    Spectrum m_constantTauD, m_constantAlbedo;
+    bool m_hgPhase;
+    Float m_hgG;
     /* Temporary fields */
     ref<Texture> m_sigmaT;
     ref<Texture> m_albedo;
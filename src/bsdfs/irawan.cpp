@@ -143,6 +143,16 @@ public:
         m_components.push_back(EDiffuseReflection | EFrontSide
             | ESpatiallyVarying);
 
+        /* Precompute everything in the specular terms that only depends
+           on the weave pattern and on the yarn parameters */
+        m_vonMisesNormalization = vonMisesNormalization(m_pattern.beta);
+        m_spines.resize(m_pattern.yarns.size());
+        for (size_t i=0; i<m_pattern.yarns.size(); ++i)
+            m_spines[i] = computeSpine(m_pattern.yarns[i]);
+        Float totalArea = m_pattern.warpArea + m_pattern.weftArea;
+        m_warpAreaFactor = totalArea / m_pattern.warpArea;
+        m_weftAreaFactor = totalArea / m_pattern.weftArea;
+
         /* Estimate the average reflectance under diffuse
            illumination and use it to normalize the specular
            component */
@@ -172,6 +182,21 @@ public:
         BSDF::configure();
     }
 
+    /// Shape of the spine of a yarn segment, see Section 5.3
+    struct Spine {
+        enum EType {
+            ECircle = 0,
+            EEllipse,
+            EHyperbola,
+            EParabola
+        };
+
+        EType type;
+        Float rhat, ahat, bhat;
+        /// Radius of a circular spine
+        Float R;
+    };
+
     Spectrum getDiffuseReflectance(const Intersection &its) const {
         Point2 uv = Point2(its.uv.x * m_repeatU,
             (1 - its.uv.y) * m_repeatV);
@@ -281,13 +306,17 @@ public:
         // Compute specular contribution.
         Spectrum result(0.0f);
         if (hasSpecular) {
+            /* The noise perturbs the spine of every segment differently */
+            Spine spine = m_pattern.period > 0.0f
+                ? computeSpine(yarn, umax) : m_spines[yarnID];
+
             Float integrand;
             if (psi != 0.0f)
                 integrand = evalStapleIntegrand(u, v, om_i, om_r, m_pattern.alpha,
-                        m_pattern.beta, psi, umax, kappa, w, l);
+                        psi, umax, kappa, w, l, spine);
             else
                 integrand = evalFilamentIntegrand(u, v, om_i, om_r, m_pattern.alpha,
-                        m_pattern.beta, m_pattern.ss, umax, kappa, w, l);
+                        m_pattern.ss, umax, kappa, w, l, spine);
 
             // Initialize random number generator based on texture location.
             Float intensityVariation = 1.0f;
@@ -306,10 +335,7 @@ public:
             else
                 result = Spectrum(intensityVariation * integrand);
 
-            if (type == Yarn::EWarp)
-                result *= (m_pattern.warpArea + m_pattern.weftArea) / m_pattern.warpArea;
-            else
-                result *= (m_pattern.warpArea + m_pattern.weftArea) / m_pattern.weftArea;
+            result *= type == Yarn::EWarp ? m_warpAreaFactor : m_weftAreaFactor;
         }
 
         if (hasDiffuse && !m_initialization)
@@ -378,7 +404,6 @@ public:
      *  ss  filament smoothing parameter
      *  fiber properties
      *  alpha uniform scattering
-     *  beta  forward scattering
      *  yarn geometry
      *  psi   fiber twist angle; because this is filament, psi = pi/2
      *  umax  maximum inclination angle
@@ -386,10 +411,11 @@ public:
      *  weave pattern
      *  w    width of segment rectangle
      *  l    length of segment rectangle
+     *  spine precomputed spine of the segment, see computeSpine()
      */
     Float evalFilamentIntegrand(Float u, Float v, const Vector &om_i,
-            const Vector &om_r, Float alpha, Float beta, Float ss,
-            Float umax, Float kappa, Float w, Float l) const {
+            const Vector &om_r, Float alpha, Float ss, Float umax,
+            Float kappa, Float w, Float l, const Spine &spine) const {
         // 0 <= ss < 1.0
         if (ss < 0.0f || ss >= 1.0f)
             return 0.0f;
@@ -418,7 +444,7 @@ public:
 
             // R is radius of curvature.
             Float R = radiusOfCurvature(std::min(std::abs(u_of_v),
-                (1-ss)*umax), (1-ss)*umax, kappa, w, l);
+                (1-ss)*umax), spine);
 
             // G is geometry factor.
             Float a = 0.5f * w;
@@ -428,7 +454,7 @@ public:
                 (om_i_plus_om_r.length() * std::abs(t_cross_h.x));
 
             // fc is phase function
-            Float fc = alpha + vonMises(-dot(om_i, om_r), beta);
+            Float fc = alpha + vonMises(-dot(om_i, om_r));
 
             // A is attenuation function without smoothing.
             // As is attenuation function with smoothing.
@@ -470,7 +496,6 @@ public:
      *  om_r  exitant direction
      *  fiber properties
      *  alpha uniform scattering
-     *  beta  forward scattering
      *  yarn geometry
      *  psi   fiber twist angle
      *  umax  maximum inclination angle
@@ -478,10 +503,11 @@ public:
      *  weave pattern
      *  w    width of segment rectangle
      *  l    length of segment rectangle
+     *  spine precomputed spine of the segment, see computeSpine()
      */
     Float evalStapleIntegrand(Float u, Float v, const Vector &om_i,
-            const Vector &om_r, Float alpha, Float beta, Float psi,
-            Float umax, Float kappa, Float w, Float l) const {
+            const Vector &om_r, Float alpha, Float psi, Float umax,
+            Float kappa, Float w, Float l, const Spine &spine) const {
         // w * sin(umax) < l
         if (w * std::sin(umax) >= l)
             return 0.0f;
@@ -511,7 +537,7 @@ public:
                     -std::sin(u) * std::cos(psi) + std::cos(u) * std::sin(v_of_u) * std::sin(psi))); */
 
             // R is radius of curvature.
-            Float R = radiusOfCurvature(std::abs(u), umax, kappa, w, l);
+            Float R = radiusOfCurvature(std::abs(u), spine);
 
             // G is geometry factor.
             Float a = 0.5f * w;
@@ -520,7 +546,7 @@ public:
                 / (om_i_plus_om_r.length() * dot(n, h) * std::abs(std::sin(psi)));
 
             // fc is phase function.
-            Float fc = alpha + vonMises(-dot(om_i, om_r), beta);
+            Float fc = alpha + vonMises(-dot(om_i, om_r));
 
             // A is attenuation function without smoothing.
             Float A = seeliger(dot(n, om_i), dot(n, om_r), 0, 1);
@@ -548,34 +574,69 @@ public:
         return 0.0f;
     }
 
-    Float radiusOfCurvature(Float u, Float umax, Float kappa, Float w, Float l) const {
+    /// Spine of a yarn whose maximum inclination angle is \c umax
+    Spine computeSpine(const Yarn &yarn, Float umax) const {
+        /* Filaments evaluate the curvature with a reduced range of u */
+        if (yarn.psi == 0.0f)
+            umax *= 1 - m_pattern.ss;
+        Float kappa = yarn.kappa, w = yarn.width, l = yarn.length;
+
         // rhat determines whether the spine is a segment
         // of an ellipse, a parabole, or a hyperbola.
         // See Section 5.3.
-        Float rhat = 1.0f + kappa * (1.0f + 1.0f / std::tan(umax));
-
-        Float a = 0.5f * w, R = 0;
-        if (rhat == 1.0f) { // circle; see Subsection 5.3.1.
-            R = (0.5f * l - a * std::sin(umax)) / std::sin(umax);
-        } else if (rhat > 0.0f) {
-            Float tmax = std::atan(rhat * std::tan(umax));
-            Float bhat = (0.5f * l - a * std::sin(umax)) / std::sin(tmax);
-            Float ahat = bhat / rhat;
-            Float t = std::atan(rhat * std::tan(u));
-            R = std::pow(bhat * bhat * std::cos(t) * std::cos(t)
-              + ahat * ahat * std::sin(t) * std::sin(t),(Float) 1.5f) / (ahat * bhat);
-        } else if (rhat < 0.0f) { // hyperbola; see Subsection 5.3.3.
-            Float tmax = -atanh(rhat * std::tan(umax));
-            Float bhat = (0.5f * l - a * std::sin(umax)) / std::sinh(tmax);
-            Float ahat = bhat / rhat;
-            Float t = -atanh(rhat * std::tan(u));
-            R = -std::pow(bhat * bhat * std::cosh(t) * std::cosh(t)
-                + ahat * ahat * std::sinh(t) * std::sinh(t), (Float) 1.5f) / (ahat * bhat);
+        Spine spine;
+        spine.rhat = 1.0f + kappa * (1.0f + 1.0f / std::tan(umax));
+        spine.ahat = spine.bhat = spine.R = 0;
+
+        Float a = 0.5f * w;
+        if (spine.rhat == 1.0f) { // circle; see Subsection 5.3.1.
+            spine.type = Spine::ECircle;
+            spine.R = (0.5f * l - a * std::sin(umax)) / std::sin(umax);
+        } else if (spine.rhat > 0.0f) {
+            spine.type = Spine::EEllipse;
+            Float tmax = std::atan(spine.rhat * std::tan(umax));
+            spine.bhat = (0.5f * l - a * std::sin(umax)) / std::sin(tmax);
+            spine.ahat = spine.bhat / spine.rhat;
+        } else if (spine.rhat < 0.0f) { // hyperbola; see Subsection 5.3.3.
+            spine.type = Spine::EHyperbola;
+            Float tmax = -atanh(spine.rhat * std::tan(umax));
+            spine.bhat = (0.5f * l - a * std::sin(umax)) / std::sinh(tmax);
+            spine.ahat = spine.bhat / spine.rhat;
         } else { // rhat == 0  // parabola; see Subsection 5.3.2.
+            spine.type = Spine::EParabola;
             Float tmax = std::tan(umax);
-            Float ahat = (0.5f * l - a * std::sin(umax)) / (2 * tmax);
-            Float t = std::tan(u);
-            R = 2 * ahat * std::pow(1 + t * t, (Float) 1.5f);
+            spine.ahat = (0.5f * l - a * std::sin(umax)) / (2 * tmax);
+        }
+        return spine;
+    }
+
+    inline Spine computeSpine(const Yarn &yarn) const {
+        return computeSpine(yarn, yarn.umax);
+    }
+
+    Float radiusOfCurvature(Float u, const Spine &spine) const {
+        Float ahat = spine.ahat, bhat = spine.bhat, R = 0;
+        switch (spine.type) {
+            case Spine::ECircle:
+                R = spine.R;
+                break;
+            case Spine::EEllipse: {
+                    Float t = std::atan(spine.rhat * std::tan(u));
+                    R = std::pow(bhat * bhat * std::cos(t) * std::cos(t)
+                      + ahat * ahat * std::sin(t) * std::sin(t),(Float) 1.5f) / (ahat * bhat);
+                }
+                break;
+            case Spine::EHyperbola: {
+                    Float t = -atanh(spine.rhat * std::tan(u));
+                    R = -std::pow(bhat * bhat * std::cosh(t) * std::cosh(t)
+                        + ahat * ahat * std::sinh(t) * std::sinh(t), (Float) 1.5f) / (ahat * bhat);
+                }
+                break;
+            case Spine::EParabola: {
+                    Float t = std::tan(u);
+                    R = 2 * ahat * std::pow(1 + t * t, (Float) 1.5f);
+                }
+                break;
         }
         return R;
     }
@@ -584,8 +645,13 @@ public:
         return math::fastlog((1.0f + arg) / (1.0f - arg)) / 2.0f;
     }
 
-    // von Mises Distribution
-    Float vonMises(Float cos_x, Float b) const {
+    // von Mises Distribution with the forward scattering parameter as concentration
+    inline Float vonMises(Float cos_x) const {
+        return math::fastexp(m_pattern.beta * cos_x) * m_vonMisesNormalization;
+    }
+
+    /// Normalization of the von Mises distribution, 1 / (2 pi I0(b))
+    Float vonMisesNormalization(Float b) const {
         // assumes a = 0, b > 0 is a concentration parameter.
 
         Float I0, absB = std::abs(b);
@@ -601,7 +667,7 @@ public:
                 + t*(0.02635537f + t*(-0.01647633f + t*0.00392377f))))))));
         }
 
-        return math::fastexp(b * cos_x) / (2 * M_PI * I0);
+        return 1 / (2 * M_PI * I0);
     }
 
     /// Attenuation term
@@ -639,6 +705,9 @@ private:
     Float m_repeatU, m_repeatV;
     Float m_specularNormalization;
     bool m_initialization;
+    Float m_vonMisesNormalization;
+    Float m_warpAreaFactor, m_weftAreaFactor;
+    std::vector<Spine> m_spines;
 };
 
 // ================ Hardware shader implementation ================
@@ -111,7 +111,7 @@ public:
     }
 
     Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
-        Spectrum opacity = m_opacity->eval(bRec.its);
+        Spectrum opacity = m_opacity->evalCached(bRec.its);
 
         if (measure == ESolidAngle)
             return m_nestedBSDF->eval(bRec, ESolidAngle) * opacity;
@@ -126,7 +126,7 @@ public:
             && (bRec.component == -1 || bRec.component == getComponentCount()-1);
         bool sampleNested = bRec.component == -1 || bRec.component < getComponentCount()-1;
 
-        Float prob = m_opacity->eval(bRec.its).getLuminance();
+        Float prob = m_opacity->evalCached(bRec.its).getLuminance();
         if (measure == ESolidAngle) {
             if (!sampleNested)
                 return 0.0f;
@@ -148,7 +148,7 @@ public:
 
     Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &_sample) const {
         Point2 sample(_sample);
-        Spectrum opacity = m_opacity->eval(bRec.its);
+        Spectrum opacity = m_opacity->evalCached(bRec.its);
         Float prob = opacity.getLuminance();
 
         bool sampleTransmission = bRec.typeMask & ENull
@@ -184,7 +184,7 @@ public:
         Point2 sample(_sample);
         Spectrum result(0.0f);
 
-        Spectrum opacity = m_opacity->eval(bRec.its);
+        Spectrum opacity = m_opacity->evalCached(bRec.its);
         Float prob = opacity.getLuminance();
 
         bool sampleTransmission = bRec.typeMask & ENull
@@ -274,6 +274,38 @@ public:
             return pdfAll(m);
     }
 
+    /**
+     * \brief Evaluate the distribution, the shadowing-masking term and
+     * the density of \ref sample() at once
+     *
+     * Equivalent to calling \ref eval(), \ref G() and \ref pdf(), but
+     * evaluates D(m) and G1(wi, m) only once.
+     *
+     * \param G
+     *     Will be set to the shadowing-masking term
+     * \param pdf
+     *     Will be set to the sampling density wrt. solid angles
+     * \return The value of the distribution function
+     */
+    inline Float evalAndPdf(const Vector &wi, const Vector &wo,
+            const Vector &m, Float &G, Float &pdf) const {
+        Float D = eval(m);
+        if (D == 0) {
+            G = pdf = 0.0f;
+            return 0.0f;
+        }
+
+        Float G1 = smithG1(wi, m);
+        G = G1 * smithG1(wo, m);
+        if (!m_sampleVisible)
+            pdf = D * Frame::cosTheta(m);
+        else if (Frame::cosTheta(wi) == 0)
+            pdf = 0.0f;
+        else
+            pdf = G1 * absDot(wi, m) * D / std::abs(Frame::cosTheta(wi));
+        return D;
+    }
+
     /**
      * \brief Draw a sample from the microfacet normal distribution
      * (including *all* normals) and return the associated
@@ -108,7 +108,7 @@ public:
         Frame result;
         Normal n;
 
-        m_normals->eval(its, false).toLinearRGB(n.x, n.y, n.z);
+        m_normals->evalCached(its, false).toLinearRGB(n.x, n.y, n.z);
         for (int i=0; i<3; ++i)
             n[i] = 2 * n[i] - 1;
 
@@ -126,13 +126,13 @@ public:
     void getFrameDerivative(const Intersection &its, Frame &du, Frame &dv) const {
         Vector n;
 
-        m_normals->eval(its, false).toLinearRGB(n.x, n.y, n.z);
+        m_normals->evalCached(its, false).toLinearRGB(n.x, n.y, n.z);
         for (int i=0; i<3; ++i)
             n[i] = 2 * n[i] - 1;
 
         Spectrum dn[2];
         Vector dndu, dndv;
-        m_normals->evalGradient(its, dn);
+        m_normals->evalGradientCached(its, dn);
         Spectrum(2*dn[0]).toLinearRGB(dndu.x, dndu.y, dndu.z);
         Spectrum(2*dn[1]).toLinearRGB(dndv.x, dndv.y, dndv.z);
 
@@ -167,7 +167,7 @@ public:
     Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         const Intersection& its = bRec.its;
         Intersection perturbed(its);
-        perturbed.shFrame = getFrame(its);
+        perturbed.shFrame = getFrame(perturbed);
 
         BSDFSamplingRecord perturbedQuery(perturbed,
             perturbed.toLocal(its.toWorld(bRec.wi)),
@@ -180,13 +180,15 @@ public:
         perturbedQuery.typeMask = bRec.typeMask;
         perturbedQuery.component = bRec.component;
 
-        return m_nested->eval(perturbedQuery, measure);
+        Spectrum result = m_nested->eval(perturbedQuery, measure);
+        its.texCache = perturbed.texCache;
+        return result;
     }
 
     Float pdf(const BSDFSamplingRecord &bRec, EMeasure measure) const {
         const Intersection& its = bRec.its;
         Intersection perturbed(its);
-        perturbed.shFrame = getFrame(its);
+        perturbed.shFrame = getFrame(perturbed);
 
         BSDFSamplingRecord perturbedQuery(perturbed,
             perturbed.toLocal(its.toWorld(bRec.wi)),
@@ -197,13 +199,15 @@ public:
         perturbedQuery.sampler = bRec.sampler;
         perturbedQuery.typeMask = bRec.typeMask;
         perturbedQuery.component = bRec.component;
-        return m_nested->pdf(perturbedQuery, measure);
+        Float result = m_nested->pdf(perturbedQuery, measure);
+        its.texCache = perturbed.texCache;
+        return result;
     }
 
     Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &sample) const {
         const Intersection& its = bRec.its;
         Intersection perturbed(its);
-        perturbed.shFrame = getFrame(its);
+        perturbed.shFrame = getFrame(perturbed);
 
         BSDFSamplingRecord perturbedQuery(perturbed, bRec.sampler, bRec.mode);
         perturbedQuery.wi = perturbed.toLocal(its.toWorld(bRec.wi));
@@ -211,6 +215,7 @@ public:
         perturbedQuery.typeMask = bRec.typeMask;
         perturbedQuery.component = bRec.component;
         Spectrum result = m_nested->sample(perturbedQuery, sample);
+        its.texCache = perturbed.texCache;
         if (!result.isZero()) {
             bRec.sampledComponent = perturbedQuery.sampledComponent;
             bRec.sampledType = perturbedQuery.sampledType;
@@ -225,13 +230,14 @@ public:
     Spectrum sample(BSDFSamplingRecord &bRec, Float &pdf, const Point2 &sample) const {
         const Intersection& its = bRec.its;
         Intersection perturbed(its);
-        perturbed.shFrame = getFrame(its);
+        perturbed.shFrame = getFrame(perturbed);
 
         BSDFSamplingRecord perturbedQuery(perturbed, bRec.sampler, bRec.mode);
         perturbedQuery.wi = perturbed.toLocal(its.toWorld(bRec.wi));
         perturbedQuery.typeMask = bRec.typeMask;
         perturbedQuery.component = bRec.component;
         Spectrum result = m_nested->sample(perturbedQuery, pdf, sample);
+        its.texCache = perturbed.texCache;
 
         if (!result.isZero()) {
             bRec.sampledComponent = perturbedQuery.sampledComponent;
@@ -107,11 +107,11 @@ public:
     }
 
     Spectrum getDiffuseReflectance(const Intersection &its) const {
-        return m_diffuseReflectance->eval(its);
+        return m_diffuseReflectance->evalCached(its);
     }
 
     Spectrum getSpecularReflectance(const Intersection &its) const {
-        return m_specularReflectance->eval(its);
+        return m_specularReflectance->evalCached(its);
     }
 
     /// Reflection in local coordinates
@@ -132,16 +132,16 @@ public:
         Spectrum result(0.0f);
         if (hasSpecular) {
             Float alpha    = dot(bRec.wo, reflect(bRec.wi)),
-                  exponent = m_exponent->eval(bRec.its).average();
+                  exponent = m_exponent->evalCached(bRec.its).average();
 
             if (alpha > 0.0f) {
-                result += m_specularReflectance->eval(bRec.its) *
+                result += m_specularReflectance->evalCached(bRec.its) *
                     ((exponent + 2) * INV_TWOPI * std::pow(alpha, exponent));
             }
         }
 
         if (hasDiffuse)
-            result += m_diffuseReflectance->eval(bRec.its) * INV_PI;
+            result += m_diffuseReflectance->evalCached(bRec.its) * INV_PI;
 
         return result * Frame::cosTheta(bRec.wo);
     }
@@ -163,7 +163,7 @@ public:
 
         if (hasSpecular) {
             Float alpha    = dot(bRec.wo, reflect(bRec.wi)),
-                  exponent = m_exponent->eval(bRec.its).average();
+                  exponent = m_exponent->evalCached(bRec.its).average();
             if (alpha > 0)
                 specProb = std::pow(alpha, exponent) *
                     (exponent + 1.0f) / (2.0f * M_PI);
@@ -205,7 +205,7 @@ public:
 
         if (choseSpecular) {
             Vector R = reflect(bRec.wi);
-            Float exponent = m_exponent->eval(bRec.its).average();
+            Float exponent = m_exponent->evalCached(bRec.its).average();
 
             /* Sample from a Phong lobe centered around (0, 0, 1) */
             Float sinAlpha = std::sqrt(1-std::pow(sample.y, 2/(exponent + 1)));
@@ -271,7 +271,7 @@ public:
         Assert(component == 0 || component == 1);
         /* Find the Beckmann-equivalent roughness */
         if (component == 0)
-            return std::sqrt(2 / (2+m_exponent->eval(its).average()));
+            return std::sqrt(2 / (2+m_exponent->evalCached(its).average()));
         else
             return std::numeric_limits<Float>::infinity();
     }
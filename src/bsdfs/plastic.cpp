@@ -217,11 +217,11 @@ public:
     }
 
     Spectrum getDiffuseReflectance(const Intersection &its) const {
-        return m_diffuseReflectance->eval(its) * (1-m_fdrExt);
+        return m_diffuseReflectance->evalCached(its) * (1-m_fdrExt);
     }
 
     Spectrum getSpecularReflectance(const Intersection &its) const {
-        return m_specularReflectance->eval(its);
+        return m_specularReflectance->evalCached(its);
     }
 
     void addChild(const std::string &name, ConfigurableObject *child) {
@@ -259,11 +259,11 @@ public:
             /* Check if the provided direction pair matches an ideal
                specular reflection; tolerate some roundoff errors */
             if (std::abs(dot(reflect(bRec.wi), bRec.wo)-1) < DeltaEpsilon)
-                return m_specularReflectance->eval(bRec.its) * Fi;
+                return m_specularReflectance->evalCached(bRec.its) * Fi;
         } else if (hasDiffuse) {
             Float Fo = fresnelDielectricExt(Frame::cosTheta(bRec.wo), m_eta);
 
-            Spectrum diff = m_diffuseReflectance->eval(bRec.its);
+            Spectrum diff = m_diffuseReflectance->evalCached(bRec.its);
 
             if (m_nonlinear)
                 diff /= Spectrum(1.0f) - diff * m_fdrInt;
@@ -329,7 +329,7 @@ public:
                 bRec.sampledType = EDeltaReflection;
                 bRec.wo = reflect(bRec.wi);
 
-                return m_specularReflectance->eval(bRec.its)
+                return m_specularReflectance->evalCached(bRec.its)
                     * Fi / probSpecular;
             } else {
                 bRec.sampledComponent = 1;
@@ -340,7 +340,7 @@ public:
                 ));
                 Float Fo = fresnelDielectricExt(Frame::cosTheta(bRec.wo), m_eta);
 
-                Spectrum diff = m_diffuseReflectance->eval(bRec.its);
+                Spectrum diff = m_diffuseReflectance->evalCached(bRec.its);
                 if (m_nonlinear)
                     diff /= Spectrum(1.0f) - diff*m_fdrInt;
                 else
@@ -352,14 +352,14 @@ public:
             bRec.sampledComponent = 0;
             bRec.sampledType = EDeltaReflection;
             bRec.wo = reflect(bRec.wi);
-            return m_specularReflectance->eval(bRec.its) * Fi;
+            return m_specularReflectance->evalCached(bRec.its) * Fi;
         } else {
             bRec.sampledComponent = 1;
             bRec.sampledType = EDiffuseReflection;
             bRec.wo = warp::squareToCosineHemisphere(sample);
             Float Fo = fresnelDielectricExt(Frame::cosTheta(bRec.wo), m_eta);
 
-            Spectrum diff = m_diffuseReflectance->eval(bRec.its);
+            Spectrum diff = m_diffuseReflectance->evalCached(bRec.its);
             if (m_nonlinear)
                 diff /= Spectrum(1.0f) - diff*m_fdrInt;
             else
@@ -393,7 +393,7 @@ public:
                 bRec.wo = reflect(bRec.wi);
 
                 pdf = probSpecular;
-                return m_specularReflectance->eval(bRec.its)
+                return m_specularReflectance->evalCached(bRec.its)
                     * Fi / probSpecular;
             } else {
                 bRec.sampledComponent = 1;
@@ -404,7 +404,7 @@ public:
                 ));
                 Float Fo = fresnelDielectricExt(Frame::cosTheta(bRec.wo), m_eta);
 
-                Spectrum diff = m_diffuseReflectance->eval(bRec.its);
+                Spectrum diff = m_diffuseReflectance->evalCached(bRec.its);
                 if (m_nonlinear)
                     diff /= Spectrum(1.0f) - diff*m_fdrInt;
                 else
@@ -420,14 +420,14 @@ public:
             bRec.sampledType = EDeltaReflection;
             bRec.wo = reflect(bRec.wi);
             pdf = 1;
-            return m_specularReflectance->eval(bRec.its) * Fi;
+            return m_specularReflectance->evalCached(bRec.its) * Fi;
         } else {
             bRec.sampledComponent = 1;
             bRec.sampledType = EDiffuseReflection;
             bRec.wo = warp::squareToCosineHemisphere(sample);
             Float Fo = fresnelDielectricExt(Frame::cosTheta(bRec.wo), m_eta);
 
-            Spectrum diff = m_diffuseReflectance->eval(bRec.its);
+            Spectrum diff = m_diffuseReflectance->evalCached(bRec.its);
             if (m_nonlinear)
                 diff /= Spectrum(1.0f) - diff*m_fdrInt;
             else
@@ -265,7 +265,7 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution distr(
             m_type,
-            m_alpha->eval(bRec.its).average(),
+            m_alpha->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -288,7 +288,7 @@ public:
             Float value = F * D * G /
                 (4.0f * std::abs(Frame::cosTheta(bRec.wi)));
 
-            result += m_specularReflectance->eval(bRec.its) * value;
+            result += m_specularReflectance->evalCached(bRec.its) * value;
         }
 
         if (hasNested) {
@@ -300,7 +300,7 @@ public:
                 m_roughTransmittance->eval(std::abs(Frame::cosTheta(bRec.wi)), distr.getAlpha()) *
                 m_roughTransmittance->eval(std::abs(Frame::cosTheta(bRec.wo)), distr.getAlpha());
 
-            Spectrum sigmaA = m_sigmaA->eval(bRec.its) * m_thickness;
+            Spectrum sigmaA = m_sigmaA->evalCached(bRec.its) * m_thickness;
             if (!sigmaA.isZero())
                 nestedResult *= (-sigmaA *
                     (1/std::abs(Frame::cosTheta(bRecInt.wi)) +
@@ -332,7 +332,7 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution distr(
             m_type,
-            m_alpha->eval(bRec.its).average(),
+            m_alpha->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -394,7 +394,7 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution distr(
             m_type,
-            m_alpha->eval(bRec.its).average(),
+            m_alpha->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -458,7 +458,7 @@ public:
     Float getRoughness(const Intersection &its, int component) const {
         return component < (int) m_components.size() - 1
             ? m_nested->getRoughness(its, component)
-            : m_alpha->eval(its).average();
+            : m_alpha->evalCached(its).average();
     }
 
     void addChild(const std::string &name, ConfigurableObject *child) {
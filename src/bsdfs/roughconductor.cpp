@@ -270,8 +270,8 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution distr(
             m_type,
-            m_alphaU->eval(bRec.its).average(),
-            m_alphaV->eval(bRec.its).average(),
+            m_alphaU->evalCached(bRec.its).average(),
+            m_alphaV->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -282,7 +282,7 @@ public:
 
         /* Fresnel factor */
         const Spectrum F = fresnelConductorExact(dot(bRec.wi, H), m_eta, m_k) *
-            m_specularReflectance->eval(bRec.its);
+            m_specularReflectance->evalCached(bRec.its);
 
         /* Smith's shadow-masking function */
         const Float G = distr.G(bRec.wi, bRec.wo, H);
@@ -308,8 +308,8 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution distr(
             m_type,
-            m_alphaU->eval(bRec.its).average(),
-            m_alphaV->eval(bRec.its).average(),
+            m_alphaU->evalCached(bRec.its).average(),
+            m_alphaV->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -330,8 +330,8 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution distr(
             m_type,
-            m_alphaU->eval(bRec.its).average(),
-            m_alphaV->eval(bRec.its).average(),
+            m_alphaU->evalCached(bRec.its).average(),
+            m_alphaV->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -353,7 +353,7 @@ public:
             return Spectrum(0.0f);
 
         Spectrum F = fresnelConductorExact(dot(bRec.wi, m),
-            m_eta, m_k) * m_specularReflectance->eval(bRec.its);
+            m_eta, m_k) * m_specularReflectance->evalCached(bRec.its);
 
         Float weight;
         if (m_sampleVisible) {
@@ -376,8 +376,8 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution distr(
             m_type,
-            m_alphaU->eval(bRec.its).average(),
-            m_alphaV->eval(bRec.its).average(),
+            m_alphaU->evalCached(bRec.its).average(),
+            m_alphaV->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -398,7 +398,7 @@ public:
             return Spectrum(0.0f);
 
         Spectrum F = fresnelConductorExact(dot(bRec.wi, m),
-            m_eta, m_k) * m_specularReflectance->eval(bRec.its);
+            m_eta, m_k) * m_specularReflectance->evalCached(bRec.its);
 
         Float weight;
         if (m_sampleVisible) {
@@ -432,8 +432,8 @@ public:
     }
 
     Float getRoughness(const Intersection &its, int component) const {
-        return 0.5f * (m_alphaU->eval(its).average()
-            + m_alphaV->eval(its).average());
+        return 0.5f * (m_alphaU->evalCached(its).average()
+            + m_alphaV->evalCached(its).average());
     }
 
     std::string toString() const {
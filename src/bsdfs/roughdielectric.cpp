@@ -317,8 +317,8 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution distr(
             m_type,
-            m_alphaU->eval(bRec.its).average(),
-            m_alphaV->eval(bRec.its).average(),
+            m_alphaU->evalCached(bRec.its).average(),
+            m_alphaV->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -349,7 +349,7 @@ public:
             Float value = F * D * G /
                 (4.0f * std::abs(Frame::cosTheta(bRec.wi)));
 
-            return m_specularReflectance->eval(bRec.its) * value;
+            return m_specularReflectance->evalCached(bRec.its) * value;
         } else {
             Float eta = Frame::cosTheta(bRec.wi) > 0.0f ? m_eta : m_invEta;
 
@@ -365,7 +365,7 @@ public:
             Float factor = (bRec.mode == ERadiance)
                 ? (Frame::cosTheta(bRec.wi) > 0 ? m_invEta : m_eta) : 1.0f;
 
-            return m_specularTransmittance->eval(bRec.its)
+            return m_specularTransmittance->evalCached(bRec.its)
                 * std::abs(value * factor * factor);
         }
     }
@@ -421,8 +421,8 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution sampleDistr(
             m_type,
-            m_alphaU->eval(bRec.its).average(),
-            m_alphaV->eval(bRec.its).average(),
+            m_alphaU->evalCached(bRec.its).average(),
+            m_alphaV->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -460,8 +460,8 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution distr(
             m_type,
-            m_alphaU->eval(bRec.its).average(),
-            m_alphaV->eval(bRec.its).average(),
+            m_alphaU->evalCached(bRec.its).average(),
+            m_alphaV->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -513,7 +513,7 @@ public:
                     return Spectrum(0.0f);
             }
 
-            weight *= m_specularReflectance->eval(bRec.its);
+            weight *= m_specularReflectance->evalCached(bRec.its);
         } else {
             if (cosThetaT == 0)
                 return Spectrum(0.0f);
@@ -533,7 +533,7 @@ public:
             Float factor = (bRec.mode == ERadiance)
                 ? (cosThetaT < 0 ? m_invEta : m_eta) : 1.0f;
 
-            weight *= m_specularTransmittance->eval(bRec.its) * (factor * factor);
+            weight *= m_specularTransmittance->evalCached(bRec.its) * (factor * factor);
         }
 
         if (m_sampleVisible)
@@ -561,8 +561,8 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution distr(
             m_type,
-            m_alphaU->eval(bRec.its).average(),
-            m_alphaV->eval(bRec.its).average(),
+            m_alphaU->evalCached(bRec.its).average(),
+            m_alphaV->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -620,7 +620,7 @@ public:
                     return Spectrum(0.0f);
             }
 
-            weight *= m_specularReflectance->eval(bRec.its);
+            weight *= m_specularReflectance->evalCached(bRec.its);
 
             /* Jacobian of the half-direction mapping */
             dwh_dwo = 1.0f / (4.0f * dot(bRec.wo, m));
@@ -643,7 +643,7 @@ public:
             Float factor = (bRec.mode == ERadiance)
                 ? (cosThetaT < 0 ? m_invEta : m_eta) : 1.0f;
 
-            weight *= m_specularTransmittance->eval(bRec.its) * (factor * factor);
+            weight *= m_specularTransmittance->evalCached(bRec.its) * (factor * factor);
 
             /* Jacobian of the half-direction mapping */
             Float sqrtDenom = dot(bRec.wi, m) + bRec.eta * dot(bRec.wo, m);
@@ -685,8 +685,8 @@ public:
     }
 
     Float getRoughness(const Intersection &its, int component) const {
-        return 0.5f * (m_alphaU->eval(its).average()
-            + m_alphaV->eval(its).average());
+        return 0.5f * (m_alphaU->evalCached(its).average()
+            + m_alphaV->evalCached(its).average());
     }
 
     std::string toString() const {
@@ -122,7 +122,7 @@ public:
     }
 
     Spectrum getDiffuseReflectance(const Intersection &its) const {
-        return m_reflectance->eval(its);
+        return m_reflectance->evalCached(its);
     }
 
     Spectrum eval(const BSDFSamplingRecord &bRec, EMeasure measure) const {
@@ -138,7 +138,7 @@ public:
            the match is not as good anymore */
         const Float conversionFactor = 1 / std::sqrt((Float) 2);
 
-        Float sigma = m_alpha->eval(bRec.its).average()
+        Float sigma = m_alpha->evalCached(bRec.its).average()
             * conversionFactor;
 
         const Float sigma2 = sigma*sigma;
@@ -169,7 +169,7 @@ public:
                 tanBeta = sinThetaO / Frame::cosTheta(bRec.wo);
             }
 
-            return m_reflectance->eval(bRec.its)
+            return m_reflectance->evalCached(bRec.its)
                 * (INV_PI * Frame::cosTheta(bRec.wo) * (A + B
                 * std::max(cosPhiDiff, (Float) 0.0f) * sinAlpha * tanBeta));
         } else {
@@ -208,7 +208,7 @@ public:
                     math::safe_sqrt(1.0f - sinAlpha * sinAlpha) +
                     math::safe_sqrt(1.0f - sinBeta  * sinBeta));
 
-            Spectrum rho = m_reflectance->eval(bRec.its),
+            Spectrum rho = m_reflectance->evalCached(bRec.its),
                      snglScat = rho * (C1 + cosPhiDiff * C2 * tanBeta +
                         (1.0f - std::abs(cosPhiDiff)) * C3 * tanHalf),
                      dblScat = rho * rho * (C4 * (1.0f - cosPhiDiff*tmp3*tmp3));
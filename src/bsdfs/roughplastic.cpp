@@ -308,14 +308,14 @@ public:
 
     Spectrum getDiffuseReflectance(const Intersection &its) const {
         /* Evaluate the roughness texture */
-        Float alpha = m_alpha->eval(its).average();
+        Float alpha = m_alpha->evalCached(its).average();
         Float Ftr = m_externalRoughTransmittance->evalDiffuse(alpha);
 
-        return m_diffuseReflectance->eval(its) * Ftr;
+        return m_diffuseReflectance->evalCached(its) * Ftr;
     }
 
     Spectrum getSpecularReflectance(const Intersection &its) const {
-        return m_specularReflectance->eval(its);
+        return m_specularReflectance->evalCached(its);
     }
 
     /// Helper function: reflect \c wi with respect to a given surface normal
@@ -339,7 +339,7 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution distr(
             m_type,
-            m_alpha->eval(bRec.its).average(),
+            m_alpha->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -361,11 +361,11 @@ public:
             Float value = F * D * G /
                 (4.0f * Frame::cosTheta(bRec.wi));
 
-            result += m_specularReflectance->eval(bRec.its) * value;
+            result += m_specularReflectance->evalCached(bRec.its) * value;
         }
 
         if (hasDiffuse) {
-            Spectrum diff = m_diffuseReflectance->eval(bRec.its);
+            Spectrum diff = m_diffuseReflectance->evalCached(bRec.its);
             Float T12 = m_externalRoughTransmittance->eval(Frame::cosTheta(bRec.wi), distr.getAlpha());
             Float T21 = m_externalRoughTransmittance->eval(Frame::cosTheta(bRec.wo), distr.getAlpha());
             Float Fdr = 1-m_internalRoughTransmittance->evalDiffuse(distr.getAlpha());
@@ -397,7 +397,7 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution distr(
             m_type,
-            m_alpha->eval(bRec.its).average(),
+            m_alpha->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -436,6 +436,69 @@ public:
         return result;
     }
 
+    /**
+     * Evaluate the model and the density of \ref sample() at once, which
+     * shares the texture lookups and the terms of the microfacet model
+     */
+    Spectrum evalAndPdf(const BSDFSamplingRecord &bRec, Float &pdf) const {
+        bool hasSpecular = (bRec.typeMask & EGlossyReflection) &&
+            (bRec.component == -1 || bRec.component == 0);
+        bool hasDiffuse = (bRec.typeMask & EDiffuseReflection) &&
+            (bRec.component == -1 || bRec.component == 1);
+
+        pdf = 0.0f;
+        if (Frame::cosTheta(bRec.wi) <= 0 ||
+            Frame::cosTheta(bRec.wo) <= 0 ||
+            (!hasSpecular && !hasDiffuse))
+            return Spectrum(0.0f);
+
+        MicrofacetDistribution distr(
+            m_type,
+            m_alpha->evalCached(bRec.its).average(),
+            m_sampleVisible
+        );
+
+        Float T12 = m_externalRoughTransmittance->eval(Frame::cosTheta(bRec.wi), distr.getAlpha());
+
+        Float probDiffuse, probSpecular;
+        if (hasSpecular && hasDiffuse) {
+            probSpecular = ((1-T12)*m_specularSamplingWeight) /
+                ((1-T12)*m_specularSamplingWeight +
+                T12 * (1-m_specularSamplingWeight));
+            probDiffuse = 1 - probSpecular;
+        } else {
+            probDiffuse = probSpecular = 1.0f;
+        }
+
+        Spectrum result(0.0f);
+        if (hasSpecular) {
+            const Vector H = normalize(bRec.wo+bRec.wi);
+            Float G, prob;
+            const Float D = distr.evalAndPdf(bRec.wi, bRec.wo, H, G, prob);
+            const Float F = fresnelDielectricExt(dot(bRec.wi, H), m_eta);
+
+            result += m_specularReflectance->evalCached(bRec.its) *
+                (F * D * G / (4.0f * Frame::cosTheta(bRec.wi)));
+            pdf = prob * probSpecular / (4.0f * dot(bRec.wo, H));
+        }
+
+        if (hasDiffuse) {
+            Spectrum diff = m_diffuseReflectance->evalCached(bRec.its);
+            Float T21 = m_externalRoughTransmittance->eval(Frame::cosTheta(bRec.wo), distr.getAlpha());
+            Float Fdr = 1-m_internalRoughTransmittance->evalDiffuse(distr.getAlpha());
+
+            if (m_nonlinear)
+                diff /= Spectrum(1.0f) - diff * Fdr;
+            else
+                diff /= 1-Fdr;
+
+            result += diff * (INV_PI * Frame::cosTheta(bRec.wo) * T12 * T21 * m_invEta2);
+            pdf += probDiffuse * warp::squareToCosineHemispherePdf(bRec.wo);
+        }
+
+        return result;
+    }
+
     inline Spectrum sample(BSDFSamplingRecord &bRec, Float &_pdf, const Point2 &_sample) const {
         bool hasSpecular = (bRec.typeMask & EGlossyReflection) &&
             (bRec.component == -1 || bRec.component == 0);
@@ -452,7 +515,7 @@ public:
            roughness values at the current surface position. */
         MicrofacetDistribution distr(
             m_type,
-            m_alpha->eval(bRec.its).average(),
+            m_alpha->evalCached(bRec.its).average(),
             m_sampleVisible
         );
 
@@ -492,12 +555,12 @@ public:
         bRec.eta = 1.0f;
 
         /* Guard against numerical imprecisions */
-        _pdf = pdf(bRec, ESolidAngle);
+        Spectrum value = evalAndPdf(bRec, _pdf);
 
         if (_pdf == 0)
             return Spectrum(0.0f);
         else
-            return eval(bRec, ESolidAngle) / _pdf;
+            return value / _pdf;
     }
 
     Spectrum sample(BSDFSamplingRecord &bRec, const Point2 &sample) const {
@@ -524,7 +587,7 @@ public:
         Assert(component == 0 || component == 1);
 
         if (component == 0)
-            return m_alpha->eval(its).average();
+            return m_alpha->evalCached(its).average();
         else
             return std::numeric_limits<Float>::infinity();
     }
@@ -16,13 +16,22 @@
     along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+
 #if !defined(__ROUGH_TRANSMITTANCE_H)
 #define __ROUGH_TRANSMITTANCE_H
 
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/spline.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/lock.h>
 #include "microfacet.h"
+#include <map>
+
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+#include <xmmintrin.h>
+#define MTS_RTRANS_SSE 1
+#endif
 
 #if defined(_MSC_VER)
 /// Don't warn about potential divide by zero errors
@@ -31,6 +40,230 @@
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * \brief Read-only view of a precomputed rough transmittance data file
+ *
+ * The file is memory-mapped once per distribution and shared by all
+ * instances of \ref RoughTransmittance (mappings in different plugins
+ * share the same physical pages). The values are used in place: for every
+ * (orientation, IOR, roughness) triple, the file stores the transmittance
+ * for all angles of incidence followed by the diffuse transmittance.
+ */
+class RoughTransmittanceData : public Object {
+public:
+    /// Return the shared data of a microfacet distribution (e.g. "beckmann")
+    static ref<RoughTransmittanceData> get(const std::string &name) {
+        static ref<Mutex> mutex = new Mutex();
+        static std::map<std::string, ref<RoughTransmittanceData> > cache;
+
+        LockGuard lock(mutex);
+        ref<RoughTransmittanceData> &entry = cache[name];
+        if (!entry)
+            entry = new RoughTransmittanceData(name);
+        return entry;
+    }
+
+    /// Pointer to the table of one orientation (\c inverted: eta < 1)
+    inline const float *getTable(bool inverted) const {
+        return m_values + (inverted ? m_etaSamples * m_alphaSamples * getCellSize() : 0);
+    }
+
+    /// Number of values stored per (IOR, roughness) pair
+    inline size_t getCellSize() const { return m_thetaSamples + 1; }
+
+    size_t m_etaSamples, m_alphaSamples, m_thetaSamples;
+    Float m_etaMin, m_etaMax, m_alphaMin, m_alphaMax;
+protected:
+    RoughTransmittanceData(const std::string &name) {
+        /* Resolve the precomputed data file */
+        fs::path sourceFile = Thread::getThread()->getFileResolver()->resolve(
+            formatString("data/microfacet/%s.dat", name.c_str()));
+
+        const char header[] = "MTS_TRANSMITTANCE";
+        const size_t headerSize = strlen(header) + 3*sizeof(uint64_t) + 4*sizeof(float);
+
+        m_mmap = new MemoryMappedFile(sourceFile);
+        const uint8_t *ptr = (const uint8_t *) m_mmap->getData();
+        if (m_mmap->getSize() < headerSize || memcmp(ptr, header, strlen(header)) != 0)
+            SLog(EError, "Encountered an invalid transmittance data file!");
+
+        ref<FileStream> fstream;
+        if (Stream::getHostByteOrder() != Stream::ELittleEndian) {
+            /* The values can't be used in place -- read a swapped copy */
+            fstream = new FileStream(sourceFile, FileStream::EReadOnly);
+            fstream->setByteOrder(Stream::ELittleEndian);
+            fstream->seek(strlen(header));
+            m_etaSamples = fstream->readSize();
+            m_alphaSamples = fstream->readSize();
+            m_thetaSamples = fstream->readSize();
+            m_etaMin = (Float) fstream->readSingle();
+            m_etaMax = (Float) fstream->readSingle();
+            m_alphaMin = (Float) fstream->readSingle();
+            m_alphaMax = (Float) fstream->readSingle();
+        } else {
+            uint64_t sizes[3];
+            float ranges[4];
+            memcpy(sizes, ptr + strlen(header), sizeof(sizes));
+            memcpy(ranges, ptr + strlen(header) + sizeof(sizes), sizeof(ranges));
+            m_etaSamples = (size_t) sizes[0];
+            m_alphaSamples = (size_t) sizes[1];
+            m_thetaSamples = (size_t) sizes[2];
+            m_etaMin = (Float) ranges[0];
+            m_etaMax = (Float) ranges[1];
+            m_alphaMin = (Float) ranges[2];
+            m_alphaMax = (Float) ranges[3];
+        }
+
+        size_t count = 2 * m_etaSamples * m_alphaSamples * getCellSize();
+        if (m_mmap->getSize() != headerSize + count * sizeof(float))
+            SLog(EError, "Encountered a truncated transmittance data file!");
+        if (m_etaSamples < 4 || m_alphaSamples < 4 || m_thetaSamples < 4)
+            SLog(EError, "Transmittance data files need at least 4 samples per dimension!");
+
+        if (fstream) {
+            m_swapped.resize(count);
+            fstream->readSingleArray(&m_swapped[0], count);
+            m_values = &m_swapped[0];
+            m_mmap = NULL;
+        } else {
+            m_values = (const float *) (ptr + headerSize);
+        }
+
+        SLog(EDebug, "Mapped " SIZE_T_FMT "x" SIZE_T_FMT "x" SIZE_T_FMT
+            " (%s) rough transmittance samples from \"%s\"", 2*m_etaSamples,
+            m_alphaSamples, m_thetaSamples, memString(count * sizeof(float)).c_str(),
+            sourceFile.string().c_str());
+
+        SLog(EDebug, "Precomputed data is available for the IOR range "
+            "[%.4f, %.1f] and roughness range [%.4f, %.1f]",  m_etaMin,
+            m_etaMax, m_alphaMin, m_alphaMax);
+    }
+
+    virtual ~RoughTransmittanceData() { }
+private:
+    ref<MemoryMappedFile> m_mmap;
+    std::vector<float> m_swapped;
+    const float *m_values;
+};
+
+/**
+ * \brief Tensor-product Catmull-Rom interpolation of a strided float table
+ *
+ * Computes the same interpolant as \ref evalCubicInterp1D() and its 2D/3D
+ * variants with knots spanning [0, 1], but reads the values in place. The
+ * window of four knots along each dimension is shifted into the table at
+ * the boundaries (the weights of the knots outside of it are zero), so
+ * that four consecutive values along the first dimension can be loaded and
+ * weighted using a single SSE operation when that dimension is contiguous.
+ */
+class RoughTransmittanceSpline {
+public:
+    /// Compute the window start and weights of one dimension; false if out of range
+    static inline bool computeWeights(Float x, size_t size, size_t &start, Float *weights) {
+        /* Give up when given an out-of-range or NaN argument */
+        if (!(x >= 0 && x <= 1))
+            return false;
+
+        /* Transform 'x' so that knots lie at integer positions */
+        Float t = x * (size - 1);
+        size_t knot = std::min((size_t) t, size - 2);
+        t = t - (Float) knot;
+
+        Float t2 = t*t, t3 = t2*t;
+        Float w[4] = { 0.0f, 2*t3 - 3*t2 + 1, -2*t3 + 3*t2, 0.0f };
+
+        /* Derivative weights turned into node weights using
+           the same finite differences stencil as evalCubicInterp*D */
+        Float d0 = t3 - 2*t2 + t, d1 = t3 - t2;
+        if (knot > 0) {
+            w[2] += 0.5f * d0;
+            w[0] -= 0.5f * d0;
+        } else {
+            w[2] += d0;
+            w[1] -= d0;
+        }
+        if (knot + 2 < size) {
+            w[3] += 0.5f * d1;
+            w[1] -= 0.5f * d1;
+        } else {
+            w[2] += d1;
+            w[1] -= d1;
+        }
+
+        /* Shift the window into the table: the dropped weight is zero */
+        if (knot == 0) {
+            start = 0;
+            weights[0] = w[1]; weights[1] = w[2]; weights[2] = w[3]; weights[3] = 0;
+        } else if (knot + 2 == size) {
+            start = size - 4;
+            weights[0] = 0; weights[1] = w[0]; weights[2] = w[1]; weights[3] = w[2];
+        } else {
+            start = knot - 1;
+            weights[0] = w[0]; weights[1] = w[1]; weights[2] = w[2]; weights[3] = w[3];
+        }
+        return true;
+    }
+
+    /// Weighted sum of four values with the given stride
+    static inline Float dot4(const float *values, size_t stride, const Float *w) {
+#if defined(MTS_RTRANS_SSE)
+        if (stride == 1) {
+            __m128 prod = _mm_mul_ps(_mm_loadu_ps(values), _mm_loadu_ps(w));
+            prod = _mm_add_ps(prod, _mm_movehl_ps(prod, prod));
+            prod = _mm_add_ss(prod, _mm_shuffle_ps(prod, prod, 1));
+            return _mm_cvtss_f32(prod);
+        }
+#endif
+        return w[0] * values[0] + w[1] * values[stride]
+             + w[2] * values[2*stride] + w[3] * values[3*stride];
+    }
+
+    static inline Float eval1D(const float *values, Float x, size_t size, size_t stride = 1) {
+        size_t s;
+        Float w[4];
+        if (!computeWeights(x, size, s, w))
+            return 0.0f;
+        return dot4(values + s*stride, stride, w);
+    }
+
+    static inline Float eval2D(const float *values, Float x, Float y,
+            const size_t *size, const size_t *stride) {
+        size_t s0, s1;
+        Float w0[4], w1[4];
+        if (!computeWeights(x, size[0], s0, w0) || !computeWeights(y, size[1], s1, w1))
+            return 0.0f;
+        const float *base = values + s0*stride[0] + s1*stride[1];
+        Float result = 0.0f;
+        for (int j=0; j<4; ++j) {
+            if (w1[j] != 0)
+                result += w1[j] * dot4(base + j*stride[1], stride[0], w0);
+        }
+        return result;
+    }
+
+    static inline Float eval3D(const float *values, Float x, Float y, Float z,
+            const size_t *size, const size_t *stride) {
+        size_t s0, s1, s2;
+        Float w0[4], w1[4], w2[4];
+        if (!computeWeights(x, size[0], s0, w0) || !computeWeights(y, size[1], s1, w1)
+                || !computeWeights(z, size[2], s2, w2))
+            return 0.0f;
+        const float *base = values + s0*stride[0] + s1*stride[1] + s2*stride[2];
+        Float result = 0.0f;
+        for (int k=0; k<4; ++k) {
+            if (w2[k] == 0)
+                continue;
+            Float partial = 0.0f;
+            for (int j=0; j<4; ++j) {
+                if (w1[j] != 0)
+                    partial += w1[j] * dot4(base + j*stride[1] + k*stride[2], stride[0], w0);
+            }
+            result += w2[k] * partial;
+        }
+        return result;
+    }
+};
+
 /**
  * \brief Utility class for evaluating the transmittance through rough
  * dielectric surfaces modeled using microfacet distributions.
@@ -63,7 +296,8 @@ MTS_NAMESPACE_BEGIN
  * This class therefore provides the operations \ref setEta()
  * and \ref setAlpha(), which reduce the heavy 3D table to
  * an (again spline-interpolated) 1D or 2D slice, which accelerates
- * subsequent lookups.
+ * subsequent lookups. The 3D table itself is memory-mapped and shared
+ * between all instances (see \ref RoughTransmittanceData).
  *
  * As a final bonus, this class also has support for evaluating the \a diffuse
  * rough transmittance, which is defined as a cosine-weighted integral
@@ -78,83 +312,25 @@ public:
      *     Denotes the type of a microfacet distribution,
      *     i.e. Beckmann or GGX
      */
-    RoughTransmittance(MicrofacetDistribution::EType type) : m_trans(NULL), m_diffTrans(NULL) {
-        std::string name;
-
+    RoughTransmittance(MicrofacetDistribution::EType type) {
         switch (type) {
-            case MicrofacetDistribution::EBeckmann: name = "beckmann"; break;
-            case MicrofacetDistribution::EPhong: name = "phong"; break;
-            case MicrofacetDistribution::EGGX: name = "ggx"; break;
+            case MicrofacetDistribution::EBeckmann: m_name = "beckmann"; break;
+            case MicrofacetDistribution::EPhong: m_name = "phong"; break;
+            case MicrofacetDistribution::EGGX: m_name = "ggx"; break;
             default:
                 SLog(EError, "RoughTransmittance: unsupported distribution type!");
         }
 
-        /* Resolve the precomputed data file */
-        fs::path sourceFile = Thread::getThread()->getFileResolver()->resolve(
-            formatString("data/microfacet/%s.dat", name.c_str()));
-
-        ref<FileStream> fstream = new FileStream(sourceFile,
-                FileStream::EReadOnly);
-        fstream->setByteOrder(Stream::ELittleEndian);
-
-        const char header[] = "MTS_TRANSMITTANCE";
-        char *fileHeader = (char *) alloca(strlen(header));
-
-        fstream->read(fileHeader, strlen(header));
-        if (memcmp(fileHeader, header, strlen(header)) != 0)
-            SLog(EError, "Encountered an invalid transmittance data file!");
-
-        m_etaSamples = fstream->readSize();
-        m_alphaSamples = fstream->readSize();
-        m_thetaSamples = fstream->readSize();
-
-        m_transSize = 2 * m_etaSamples * m_alphaSamples * m_thetaSamples;
-        m_diffTransSize = 2 * m_etaSamples * m_alphaSamples;
-
-        SLog(EDebug, "Loading " SIZE_T_FMT "x" SIZE_T_FMT "x" SIZE_T_FMT
-            " (%s) rough transmittance samples from \"%s\"", 2*m_etaSamples,
-            m_alphaSamples, m_thetaSamples,
-            memString((m_transSize + m_diffTransSize) * sizeof(float)).c_str(),
-            sourceFile.string().c_str());
-
-        m_trans = new Float[m_transSize];
-        m_diffTrans = new Float[m_diffTransSize];
+        m_data = RoughTransmittanceData::get(m_name);
+        m_etaSamples = m_data->m_etaSamples;
+        m_alphaSamples = m_data->m_alphaSamples;
+        m_thetaSamples = m_data->m_thetaSamples;
+        m_etaMin = m_data->m_etaMin;
+        m_etaMax = m_data->m_etaMax;
+        m_alphaMin = m_data->m_alphaMin;
+        m_alphaMax = m_data->m_alphaMax;
         m_etaFixed = false;
         m_alphaFixed = false;
-
-        m_etaMin = (Float) fstream->readSingle();
-        m_etaMax = (Float) fstream->readSingle();
-        m_alphaMin = (Float) fstream->readSingle();
-        m_alphaMax = (Float) fstream->readSingle();
-
-        SLog(EDebug, "Precomputed data is available for the IOR range "
-            "[%.4f, %.1f] and roughness range [%.4f, %.1f]",  m_etaMin,
-            m_etaMax, m_alphaMin, m_alphaMax);
-
-        float *temp = new float[m_transSize + m_diffTransSize];
-        fstream->readSingleArray(temp, m_transSize + m_diffTransSize);
-
-        float *ptr = temp;
-        size_t fdrEntry = 0, dataEntry = 0;
-        for (size_t i=0; i<2*m_etaSamples; ++i) {
-            for (size_t j=0; j<m_alphaSamples; ++j) {
-                for (size_t k=0; k<m_thetaSamples; ++k)
-                    m_trans[dataEntry++] = (Float) *ptr++;
-                m_diffTrans[fdrEntry++] = (Float) *ptr++;
-            }
-        }
-        delete[] temp;
-
-        SAssert(fstream->getPos() == fstream->getSize());
-    }
-
-    /// Release all memory
-    virtual ~RoughTransmittance() {
-        if (m_trans)
-            delete[] m_trans;
-        if (m_diffTrans)
-            delete[] m_diffTrans;
-
     }
 
     /// Return the minimum roughness value that is available in the precomputed data
@@ -187,34 +363,30 @@ public:
         if (m_alphaFixed && m_etaFixed) {
             if (!(cosTheta >= 0))
                 return 0.f;
-            //SAssert(cosTheta >= 0);
 
-            result = evalCubicInterp1D(warpedCosTheta,
-                m_trans, m_thetaSamples, 0.0f, 1.0f);
+            result = RoughTransmittanceSpline::eval1D(&m_trans[0],
+                warpedCosTheta, m_thetaSamples);
         } else if (m_etaFixed) {
             if (!(cosTheta >= 0))
                 return 0.f;
-            //SAssert(cosTheta >= 0);
 
             Float warpedAlpha = std::pow((alpha - m_alphaMin)
                     / (m_alphaMax-m_alphaMin), (Float) 0.25f);
 
-            result = evalCubicInterp2D(Point2(warpedCosTheta, warpedAlpha),
-                m_trans, Size2(m_thetaSamples, m_alphaSamples),
-                Point2(0.0f), Point2(1.0f));
+            const size_t size[2] = { m_thetaSamples, m_alphaSamples },
+                         stride[2] = { 1, m_thetaSamples };
+            result = RoughTransmittanceSpline::eval2D(&m_trans[0],
+                warpedCosTheta, warpedAlpha, size, stride);
         } else {
             if (cosTheta < 0) {
                 cosTheta = -cosTheta;
                 eta = 1.0f / eta;
             }
 
-            Float *data = m_trans;
-            if (eta < 1) {
-                /* Entering a less dense medium -- skip ahead to the
-                   second data block */
-                data += m_etaSamples * m_alphaSamples * m_thetaSamples;
+            /* Entering a less dense medium -- use the second data block */
+            const float *data = m_data->getTable(eta < 1);
+            if (eta < 1)
                 eta = 1.0f / eta;
-            }
 
             if (eta < m_etaMin)
                 eta = m_etaMin;
@@ -225,9 +397,11 @@ public:
             Float warpedEta = std::pow((eta - m_etaMin)
                     / (m_etaMax-m_etaMin), (Float) 0.25f);
 
-            result = evalCubicInterp3D(Point3(warpedCosTheta, warpedAlpha, warpedEta),
-                data, Size3(m_thetaSamples, m_alphaSamples, m_etaSamples),
-                Point3(0.0f), Point3(1.0f));
+            size_t cellSize = m_data->getCellSize();
+            const size_t size[3] = { m_thetaSamples, m_alphaSamples, m_etaSamples },
+                         stride[3] = { 1, cellSize, cellSize * m_alphaSamples };
+            result = RoughTransmittanceSpline::eval3D(data, warpedCosTheta,
+                warpedAlpha, warpedEta, size, stride);
         }
 
         return std::min((Float) 1.0f, std::max((Float) 0.0f, result));
@@ -255,16 +429,13 @@ public:
             Float warpedAlpha = std::pow((alpha - m_alphaMin)
                     / (m_alphaMax-m_alphaMin), (Float) 0.25f);
 
-            result = evalCubicInterp1D(warpedAlpha,
-                m_diffTrans, m_alphaSamples, 0.0f, 1.0f);
+            result = RoughTransmittanceSpline::eval1D(&m_diffTrans[0],
+                warpedAlpha, m_alphaSamples);
         } else {
-            Float *data = m_diffTrans;
-            if (eta < 1) {
-                /* Entering a less dense medium -- skip ahead to the
-                   second data block */
-                data += m_etaSamples * m_alphaSamples;
+            /* Entering a less dense medium -- use the second data block */
+            const float *data = m_data->getTable(eta < 1) + m_thetaSamples;
+            if (eta < 1)
                 eta = 1.0f / eta;
-            }
 
             if (eta < m_etaMin)
                 eta = m_etaMin;
@@ -275,9 +446,11 @@ public:
             Float warpedEta = std::pow((eta - m_etaMin)
                     / (m_etaMax-m_etaMin), (Float) 0.25f);
 
-            result = evalCubicInterp2D(Point2(warpedAlpha, warpedEta), data,
-                Size2(m_alphaSamples, m_etaSamples), Point2(0.0f), Point2(1.0f));
-
+            size_t cellSize = m_data->getCellSize();
+            const size_t size[2] = { m_alphaSamples, m_etaSamples },
+                         stride[2] = { cellSize, cellSize * m_alphaSamples };
+            result = RoughTransmittanceSpline::eval2D(data, warpedAlpha,
+                warpedEta, size, stride);
         }
 
         return std::min((Float) 1.0f, std::max((Float) 0.0f,  result));
@@ -293,22 +466,14 @@ public:
         if (m_etaFixed)
             return;
 
-        m_transSize = m_alphaSamples * m_thetaSamples;
-        m_diffTransSize = m_alphaSamples;
-
         SLog(EDebug, "Reducing dimension from 3D to 2D (%s), eta = %f",
-            memString((m_transSize + m_diffTransSize) * sizeof(Float)).c_str(), eta);
+            memString((m_alphaSamples * m_thetaSamples + m_alphaSamples)
+                * sizeof(float)).c_str(), eta);
 
-        Float *trans = m_trans,
-              *diffTrans = m_diffTrans;
-
-        if (eta < 1) {
-            /* Entering a less dense medium -- skip ahead to the
-               second data block */
-            trans += m_etaSamples * m_alphaSamples * m_thetaSamples;
-            diffTrans += m_etaSamples * m_alphaSamples;
+        /* Entering a less dense medium -- use the second data block */
+        const float *data = m_data->getTable(eta < 1);
+        if (eta < 1)
             eta = 1.0f / eta;
-        }
 
         if (eta < m_etaMin)
             eta = m_etaMin;
@@ -316,31 +481,29 @@ public:
         Float warpedEta = std::pow((eta - m_etaMin)
                 / (m_etaMax-m_etaMin), (Float) 0.25f);
 
-        Float *newTrans = new Float[m_transSize];
-        Float *newDiffTrans = new Float[m_diffTransSize];
+        m_trans.resize(m_alphaSamples * m_thetaSamples);
+        m_diffTrans.resize(m_alphaSamples);
 
         Float dAlpha = 1.0f / (m_alphaSamples - 1),
               dTheta = 1.0f / (m_thetaSamples - 1);
 
-        for (size_t i=0; i<m_alphaSamples; ++i) {
-            for (size_t j=0; j<m_thetaSamples; ++j) {
-                newTrans[i*m_thetaSamples + j] = evalCubicInterp3D(
-                    Point3(j*dTheta, i*dAlpha, warpedEta),
-                    trans, Size3(m_thetaSamples, m_alphaSamples, m_etaSamples),
-                    Point3(0.0f), Point3(1.0f));
-            }
+        size_t cellSize = m_data->getCellSize();
+        const size_t size[3] = { m_thetaSamples, m_alphaSamples, m_etaSamples },
+                     stride[3] = { 1, cellSize, cellSize * m_alphaSamples };
 
-            newDiffTrans[i] = evalCubicInterp2D(
-                    Point2(i*dAlpha, warpedEta),
-                    diffTrans, Size2(m_alphaSamples, m_etaSamples),
-                    Point2(0.0f), Point2(1.0f));
+        for (size_t i=0; i<m_alphaSamples; ++i) {
+            for (size_t j=0; j<m_thetaSamples; ++j)
+                m_trans[i*m_thetaSamples + j] = (float) RoughTransmittanceSpline::eval3D(
+                    data, std::min(j*dTheta, (Float) 1), std::min(i*dAlpha, (Float) 1),
+                    warpedEta, size, stride);
+
+            m_diffTrans[i] = (float) RoughTransmittanceSpline::eval2D(
+                data + m_thetaSamples, std::min(i*dAlpha, (Float) 1), warpedEta,
+                size + 1, stride + 1);
         }
 
-        delete[] m_trans;
-        delete[] m_diffTrans;
-
-        m_trans = newTrans;
-        m_diffTrans = newDiffTrans;
+        /* The shared 3D table is no longer needed by this instance */
+        m_data = NULL;
         m_etaFixed = true;
     }
 
@@ -356,34 +519,27 @@ public:
         if (m_alphaFixed)
             return;
 
-        m_transSize = m_thetaSamples;
-        m_diffTransSize = 1;
-
         SLog(EDebug, "Reducing dimension from 2D to 1D (%s), alpha = %f",
-            memString((m_transSize + m_diffTransSize) * sizeof(Float)).c_str(), alpha);
+            memString((m_thetaSamples + 1) * sizeof(float)).c_str(), alpha);
 
         Float warpedAlpha = std::pow((alpha - m_alphaMin)
                 / (m_alphaMax-m_alphaMin), (Float) 0.25f);
 
-        Float *newTrans = new Float[m_transSize];
-        Float *newDiffTrans = new Float[m_diffTransSize];
+        std::vector<float> newTrans(m_thetaSamples), newDiffTrans(1);
 
         Float dTheta = 1.0f / (m_thetaSamples - 1);
+        const size_t size[2] = { m_thetaSamples, m_alphaSamples },
+                     stride[2] = { 1, m_thetaSamples };
 
         for (size_t i=0; i<m_thetaSamples; ++i)
-            newTrans[i] = evalCubicInterp2D(
-                Point2(i*dTheta, warpedAlpha),
-                m_trans, Size2(m_thetaSamples, m_alphaSamples),
-                Point2(0.0f), Point2(1.0f));
-
-        newDiffTrans[0] = evalCubicInterp1D(warpedAlpha,
-                m_diffTrans, m_alphaSamples, 0.0f, 1.0f);
+            newTrans[i] = (float) RoughTransmittanceSpline::eval2D(&m_trans[0],
+                std::min(i*dTheta, (Float) 1), warpedAlpha, size, stride);
 
-        delete[] m_trans;
-        delete[] m_diffTrans;
+        newDiffTrans[0] = (float) RoughTransmittanceSpline::eval1D(
+            &m_diffTrans[0], warpedAlpha, m_alphaSamples);
 
-        m_trans = newTrans;
-        m_diffTrans = newDiffTrans;
+        m_trans.swap(newTrans);
+        m_diffTrans.swap(newDiffTrans);
         m_alphaFixed = true;
     }
 
@@ -406,10 +562,11 @@ public:
                 eta, m_etaMin, m_etaMax);
     }
 
-    /// Create a deep copy of the current instance
+    /// Create a copy of the current instance (the 3D table remains shared)
     ref<RoughTransmittance> clone() const {
         RoughTransmittance *result = new RoughTransmittance();
         result->m_name = m_name;
+        result->m_data = m_data;
         result->m_etaSamples = m_etaSamples;
         result->m_alphaSamples = m_alphaSamples;
         result->m_thetaSamples = m_thetaSamples;
@@ -419,18 +576,15 @@ public:
         result->m_etaMax = m_etaMax;
         result->m_alphaMin = m_alphaMin;
         result->m_alphaMax = m_alphaMax;
-        result->m_transSize = m_transSize;
-        result->m_diffTransSize = m_diffTransSize;
-        result->m_trans = new Float[m_transSize];
-        result->m_diffTrans = new Float[m_diffTransSize];
-        memcpy(result->m_trans, m_trans, m_transSize * sizeof(Float));
-        memcpy(result->m_diffTrans, m_diffTrans, m_diffTransSize * sizeof(Float));
+        result->m_trans = m_trans;
+        result->m_diffTrans = m_diffTrans;
         return result;
     }
 protected:
     inline RoughTransmittance() { }
 protected:
     std::string m_name;
+    ref<const RoughTransmittanceData> m_data;
     size_t m_etaSamples;
     size_t m_alphaSamples;
     size_t m_thetaSamples;
@@ -438,9 +592,8 @@ protected:
     bool m_alphaFixed;
     Float m_etaMin, m_etaMax;
     Float m_alphaMin, m_alphaMax;
-    size_t m_transSize;
-    size_t m_diffTransSize;
-    Float *m_trans, *m_diffTrans;
+    /// Reduced tables after \ref setEta() and \ref setAlpha()
+    std::vector<float> m_trans, m_diffTrans;
 };
 
 MTS_NAMESPACE_END
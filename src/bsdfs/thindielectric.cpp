@@ -166,12 +166,12 @@ public:
             if (!sampleReflection || std::abs(dot(reflect(bRec.wi), bRec.wo)-1) > DeltaEpsilon)
                 return Spectrum(0.0f);
 
-            return m_specularReflectance->eval(bRec.its) * R;
+            return m_specularReflectance->evalCached(bRec.its) * R;
         } else {
             if (!sampleTransmission || std::abs(dot(transmit(bRec.wi), bRec.wo)-1) > DeltaEpsilon)
                 return Spectrum(0.0f);
 
-            return m_specularTransmittance->eval(bRec.its) * (1 - R);
+            return m_specularTransmittance->evalCached(bRec.its) * (1 - R);
         }
     }
 
@@ -220,7 +220,7 @@ public:
                 bRec.eta = 1.0f;
                 pdf = R;
 
-                return m_specularReflectance->eval(bRec.its);
+                return m_specularReflectance->evalCached(bRec.its);
             } else {
                 bRec.sampledComponent = 1;
                 bRec.sampledType = ENull;
@@ -228,7 +228,7 @@ public:
                 bRec.eta = 1.0f;
                 pdf = 1-R;
 
-                return m_specularTransmittance->eval(bRec.its);
+                return m_specularTransmittance->evalCached(bRec.its);
             }
         } else if (sampleReflection) {
             bRec.sampledComponent = 0;
@@ -237,7 +237,7 @@ public:
             bRec.eta = 1.0f;
             pdf = 1.0f;
 
-            return m_specularReflectance->eval(bRec.its) * R;
+            return m_specularReflectance->evalCached(bRec.its) * R;
         } else if (sampleTransmission) {
             bRec.sampledComponent = 1;
             bRec.sampledType = ENull;
@@ -245,7 +245,7 @@ public:
             bRec.eta = 1.0f;
             pdf = 1.0f;
 
-            return m_specularTransmittance->eval(bRec.its) * (1-R);
+            return m_specularTransmittance->evalCached(bRec.its) * (1-R);
         }
 
         return Spectrum(0.0f);
@@ -270,14 +270,14 @@ public:
                 bRec.wo = reflect(bRec.wi);
                 bRec.eta = 1.0f;
 
-                return m_specularReflectance->eval(bRec.its);
+                return m_specularReflectance->evalCached(bRec.its);
             } else {
                 bRec.sampledComponent = 1;
                 bRec.sampledType = ENull;
                 bRec.wo = transmit(bRec.wi);
                 bRec.eta = 1.0f;
 
-                return m_specularTransmittance->eval(bRec.its);
+                return m_specularTransmittance->evalCached(bRec.its);
             }
         } else if (sampleReflection) {
             bRec.sampledComponent = 0;
@@ -285,14 +285,14 @@ public:
             bRec.wo = reflect(bRec.wi);
             bRec.eta = 1.0f;
 
-            return m_specularReflectance->eval(bRec.its) * R;
+            return m_specularReflectance->evalCached(bRec.its) * R;
         } else if (sampleTransmission) {
             bRec.sampledComponent = 1;
             bRec.sampledType = ENull;
             bRec.wo = transmit(bRec.wi);
             bRec.eta = 1.0f;
 
-            return m_specularTransmittance->eval(bRec.its) * (1-R);
+            return m_specularTransmittance->evalCached(bRec.its) * (1-R);
         }
 
         return Spectrum(0.0f);
@@ -171,7 +171,7 @@ public:
     }
 
     Spectrum getDiffuseReflectance(const Intersection &its) const {
-        return m_diffuseReflectance->eval(its);
+        return m_diffuseReflectance->evalCached(its);
     }
 
 
@@ -188,8 +188,8 @@ public:
         Spectrum result(0.0f);
         if (hasSpecular) {
             Vector H = bRec.wi+bRec.wo;
-            Float alphaU = m_alphaU->eval(bRec.its).average();
-            Float alphaV = m_alphaV->eval(bRec.its).average();
+            Float alphaU = m_alphaU->evalCached(bRec.its).average();
+            Float alphaV = m_alphaV->evalCached(bRec.its).average();
 
             Float factor1 = 0.0f;
             switch (m_modelVariant) {
@@ -216,11 +216,11 @@ public:
                sampling density of the Ward model in places where it takes
                on miniscule values (Veach-MLT does this for instance) */
             if (specRef > 1e-10f)
-                result += m_specularReflectance->eval(bRec.its) * specRef;
+                result += m_specularReflectance->evalCached(bRec.its) * specRef;
         }
 
         if (hasDiffuse)
-            result += m_diffuseReflectance->eval(bRec.its) * INV_PI;
+            result += m_diffuseReflectance->evalCached(bRec.its) * INV_PI;
 
         return result * Frame::cosTheta(bRec.wo);
     }
@@ -238,8 +238,8 @@ public:
         Float diffuseProb = 0.0f, specProb = 0.0f;
 
         if (hasSpecular) {
-            Float alphaU = m_alphaU->eval(bRec.its).average();
-            Float alphaV = m_alphaV->eval(bRec.its).average();
+            Float alphaU = m_alphaU->evalCached(bRec.its).average();
+            Float alphaV = m_alphaV->evalCached(bRec.its).average();
             Vector H = normalize(bRec.wi+bRec.wo);
             Float factor1 = 1.0f / (4.0f * M_PI * alphaU * alphaV *
                 dot(H, bRec.wi) * std::pow(Frame::cosTheta(H), 3));
@@ -287,8 +287,8 @@ public:
         }
 
         if (choseSpecular) {
-            Float alphaU = m_alphaU->eval(bRec.its).average();
-            Float alphaV = m_alphaV->eval(bRec.its).average();
+            Float alphaU = m_alphaU->evalCached(bRec.its).average();
+            Float alphaV = m_alphaV->evalCached(bRec.its).average();
 
             Float phiH = std::atan(alphaV/alphaU
                 * std::tan(2.0f * M_PI * sample.y));
@@ -361,8 +361,8 @@ public:
         Assert(component == 0 || component == 1);
 
         if (component == 0)
-            return 0.5f * (m_alphaU->eval(its).average()
-                + m_alphaV->eval(its).average());
+            return 0.5f * (m_alphaU->evalCached(its).average()
+                + m_alphaV->evalCached(its).average());
         else
             return std::numeric_limits<Float>::infinity();
     }
@@ -36,6 +36,7 @@
 #include <xercesc/util/XMLUni.hpp>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mstream.h>
 #include <boost/algorithm/string.hpp>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -296,6 +297,7 @@ void GeometryConverter::convert(const fs::path &inputFile,
         ofile.close();
     }
     if (m_geometryFile) {
+        flushPackedMeshes();
         for (size_t i=0; i<m_geometryDict.size(); ++i)
             m_geometryFile->writeULong((uint64_t) m_geometryDict[i]);
         m_geometryFile->writeUInt((uint32_t) m_geometryDict.size());
@@ -305,3 +307,74 @@ void GeometryConverter::convert(const fs::path &inputFile,
     m_filename = outputFile;
 }
 
+/// Maximum amount of mesh data that is queued before serializing a batch
+#define MAX_QUEUED_MESH_BYTES (256*1024*1024)
+
+/// 64-bit FNV-1a hash of a memory region
+static uint64_t hashBytes(const void *ptr, size_t size, uint64_t hash) {
+    const uint8_t *data = static_cast<const uint8_t *>(ptr);
+    for (size_t i=0; i<size; ++i)
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+int GeometryConverter::addPackedMesh(TriMesh *mesh) {
+    size_t vertexCount = mesh->getVertexCount(),
+           triangleCount = mesh->getTriangleCount();
+
+    /* Everything but the name ends up in the file */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t sizes[2] = { vertexCount, triangleCount };
+    hash = hashBytes(sizes, sizeof(sizes), hash);
+    hash = hashBytes(mesh->getVertexPositions(), vertexCount * sizeof(Point), hash);
+    if (mesh->hasVertexNormals())
+        hash = hashBytes(mesh->getVertexNormals(), vertexCount * sizeof(Normal), hash);
+    if (mesh->hasVertexTexcoords())
+        hash = hashBytes(mesh->getVertexTexcoords(), vertexCount * sizeof(Point2), hash);
+    if (mesh->hasVertexColors())
+        hash = hashBytes(mesh->getVertexColors(), vertexCount * sizeof(Color3), hash);
+    hash = hashBytes(mesh->getTriangles(), triangleCount * sizeof(Triangle), hash);
+    uint8_t flags = (mesh->hasVertexNormals() ? 1 : 0) | (mesh->hasVertexTexcoords() ? 2 : 0)
+        | (mesh->hasVertexColors() ? 4 : 0);
+    hash = hashBytes(&flags, 1, hash);
+
+    boost::unordered_map<uint64_t, int>::const_iterator it = m_meshHashes.find(hash);
+    if (it != m_meshHashes.end()) {
+        SLog(EInfo, "Mesh \"%s\" is identical to shape %i, reusing it",
+            mesh->getName().c_str(), it->second);
+        return it->second;
+    }
+
+    int index = (int) m_geometryDict.size();
+    m_geometryDict.push_back(0); /* Filled in by flushPackedMeshes() */
+    m_meshHashes[hash] = index;
+    m_meshQueue.push_back(std::make_pair(ref<TriMesh>(mesh), index));
+    m_queuedBytes += vertexCount * (sizeof(Point) + sizeof(Normal) + sizeof(Point2))
+        + triangleCount * sizeof(Triangle);
+
+    if (m_queuedBytes > MAX_QUEUED_MESH_BYTES)
+        flushPackedMeshes();
+    return index;
+}
+
+void GeometryConverter::flushPackedMeshes() {
+    std::vector<ref<MemoryStream> > streams(m_meshQueue.size());
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i=0; i<(int) m_meshQueue.size(); ++i) {
+        streams[i] = new MemoryStream();
+        streams[i]->setByteOrder(Stream::ELittleEndian);
+        m_meshQueue[i].first->serialize(streams[i]);
+    }
+
+    for (size_t i=0; i<m_meshQueue.size(); ++i) {
+        SLog(EInfo, "Saving mesh \"%s\" ..", m_meshQueue[i].first->getName().c_str());
+        m_geometryDict[m_meshQueue[i].second] = (uint64_t) m_geometryFile->getPos();
+        m_geometryFile->write(streams[i]->getData(), streams[i]->getPos());
+    }
+
+    m_meshQueue.clear();
+    m_queuedBytes = 0;
+}
@@ -18,6 +18,8 @@
 
 #include <mitsuba/core/fresolver.h>
 #include <set>
+#include <mitsuba/render/trimesh.h>
+#include <boost/unordered_map.hpp>
 
 using namespace mitsuba;
 
@@ -31,6 +33,7 @@ public:
         m_packGeometry = true;
         m_importMaterials = true;
         m_importAnimations = false;
+        m_queuedBytes = 0;
     }
 
     void convert(const fs::path &inputFile,
@@ -48,6 +51,17 @@ public:
     inline void setImportAnimations(bool importAnimations) { m_importAnimations = importAnimations; }
     inline void setFilmType(const std::string &filmType) { m_filmType = filmType; }
     inline const fs::path &getFilename() const { return m_filename; }
+
+    /**
+     * \brief Add a mesh to the packed geometry file and return its shape index
+     *
+     * Meshes are serialized in parallel batches, and a mesh whose data is
+     * identical to one that was added before reuses the existing entry.
+     */
+    int addPackedMesh(TriMesh *mesh);
+
+    /// Serialize all queued meshes and append them to the geometry file
+    void flushPackedMeshes();
 private:
     void convertCollada(const fs::path &inputFile, std::ostream &os,
         const fs::path &textureDirectory,
@@ -65,4 +79,7 @@ public:
     fs::path m_geometryFileName;
     std::vector<size_t> m_geometryDict;
     bool m_packGeometry;
+    std::vector<std::pair<ref<TriMesh>, int> > m_meshQueue;
+    size_t m_queuedBytes;
+    boost::unordered_map<uint64_t, int> m_meshHashes;
 };
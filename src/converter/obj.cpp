@@ -21,6 +21,7 @@
 
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/core/version.h>
 #include <mitsuba/render/scene.h>
 #include <boost/filesystem/fstream.hpp>
@@ -154,8 +155,7 @@ void GeometryConverter::convertOBJ(const fs::path &inputFile,
     const fs::path &textureDirectory,
     const fs::path &meshesDirectory) {
 
-    fs::ifstream is(inputFile);
-    if (is.bad() || is.fail())
+    if (!fs::exists(inputFile))
         SLog(EError, "Could not open OBJ file '%s'!", inputFile.string().c_str());
 
     os << "<?xml version=\"1.0\" encoding=\"utf-8\"?>" << endl << endl;
@@ -165,22 +165,32 @@ void GeometryConverter::convertOBJ(const fs::path &inputFile,
     os << "<scene version=\"" << MTS_VERSION << "\">" << endl;
     os << "\t<integrator id=\"integrator\" type=\"direct\"/>" << endl << endl;
 
-    std::string buf, line;
+    /* Look for material libraries. The geometry itself is parsed by the
+       'obj' plugin, so only the line starts need to be inspected here */
     std::set<std::string> mtlList;
-    while (is >> buf) {
-        if (buf == "mtllib" && m_importMaterials) {
-            std::getline(is, line);
-            std::string mtlName = trim(line.substr(1, line.length()-1));
-            ref<FileResolver> fRes = Thread::getThread()->getFileResolver()->clone();
-            fRes->prependPath(fs::absolute(fRes->resolve(inputFile)).parent_path());
-            fs::path fullMtlName = fRes->resolve(mtlName);
-            if (fs::exists(fullMtlName))
-                parseMaterials(this, os, textureDirectory, fullMtlName, mtlList);
-            else
-                SLog(EWarn, "Could not find referenced material library '%s'", mtlName.c_str());
-        } else {
-            /* Ignore */
-            std::getline(is, line);
+    if (m_importMaterials && fs::file_size(inputFile) > 0) {
+        ref<MemoryMappedFile> mmap = new MemoryMappedFile(inputFile);
+        const char *ptr = static_cast<const char *>(mmap->getData()),
+                   *end = ptr + mmap->getSize();
+
+        while (ptr < end) {
+            const char *eol = static_cast<const char *>(memchr(ptr, '\n', end - ptr));
+            if (!eol)
+                eol = end;
+            while (ptr < eol && (*ptr == ' ' || *ptr == '\t'))
+                ++ptr;
+            if (eol - ptr > 6 && memcmp(ptr, "mtllib", 6) == 0 &&
+                    (ptr[6] == ' ' || ptr[6] == '\t')) {
+                std::string mtlName = trim(std::string(ptr + 6, eol));
+                ref<FileResolver> fRes = Thread::getThread()->getFileResolver()->clone();
+                fRes->prependPath(fs::absolute(fRes->resolve(inputFile)).parent_path());
+                fs::path fullMtlName = fRes->resolve(mtlName);
+                if (fs::exists(fullMtlName))
+                    parseMaterials(this, os, textureDirectory, fullMtlName, mtlList);
+                else
+                    SLog(EWarn, "Could not find referenced material library '%s'", mtlName.c_str());
+            }
+            ptr = eol + 1;
         }
     }
 
@@ -207,11 +217,9 @@ void GeometryConverter::convertOBJ(const fs::path &inputFile,
             stream->close();
             os << "\t\t<string name=\"filename\" value=\"meshes/" << filename.c_str() << "\"/>" << endl;
         } else {
-            m_geometryDict.push_back((uint64_t) m_geometryFile->getPos());
-            SLog(EInfo, "Saving mesh \"%s\" ..", mesh->getName().c_str());
-            mesh->serialize(m_geometryFile);
+            int shapeIndex = addPackedMesh(mesh);
             os << "\t\t<string name=\"filename\" value=\"" << m_geometryFileName.filename().string() << "\"/>" << endl;
-            os << "\t\t<integer name=\"shapeIndex\" value=\"" << (m_geometryDict.size()-1) << "\"/>" << endl;
+            os << "\t\t<integer name=\"shapeIndex\" value=\"" << shapeIndex << "\"/>" << endl;
         }
 
         if (mesh->getBSDF() != NULL &&
@@ -18,6 +18,7 @@
 
 #include <mitsuba/render/emitter.h>
 #include <mitsuba/render/shape.h>
+#include <mitsuba/render/trimesh.h>
 #include <mitsuba/render/medium.h>
 #include <mitsuba/hw/gpuprogram.h>
 #include <mitsuba/core/warp.h>
@@ -205,6 +206,50 @@ public:
         return m_shape->getAABB();
     }
 
+    void getEmissionBounds(Vector &axis, Float &thetaO, Float &thetaE) const {
+        Emitter::getEmissionBounds(axis, thetaO, thetaE);
+
+        /* Bound the normals that samplePosition() can produce: the vertex
+           normals if present (interpolated normals stay within their cone
+           as long as it is narrower than a hemisphere), else the face normals */
+        ref<TriMesh> mesh = m_shape->createTriMesh();
+        if (!mesh || mesh->getTriangleCount() == 0)
+            return;
+
+        std::vector<Vector> normals;
+        if (mesh->hasVertexNormals()) {
+            normals.reserve(mesh->getVertexCount());
+            for (size_t i=0; i<mesh->getVertexCount(); ++i)
+                normals.push_back(Vector(mesh->getVertexNormal(i)));
+        } else {
+            const Point *p = mesh->getVertexPositions();
+            normals.reserve(mesh->getTriangleCount());
+            for (size_t i=0; i<mesh->getTriangleCount(); ++i) {
+                const Triangle tri = mesh->getTriangle(i);
+                Vector n = cross(p[tri.idx[1]] - p[tri.idx[0]],
+                                 p[tri.idx[2]] - p[tri.idx[0]]);
+                if (!n.isZero())
+                    normals.push_back(normalize(n));
+            }
+        }
+
+        Vector sum(0.0f);
+        for (size_t i=0; i<normals.size(); ++i)
+            sum += normals[i];
+        if (sum.isZero())
+            return;
+        Vector coneAxis = normalize(sum);
+
+        Float maxAngle = 0;
+        for (size_t i=0; i<normals.size(); ++i)
+            maxAngle = std::max(maxAngle, math::safe_acos(dot(coneAxis, normals[i])));
+
+        if (maxAngle < 0.5f * M_PI) {
+            axis = coneAxis;
+            thetaO = std::min(maxAngle + Epsilon, (Float) (0.5f * M_PI));
+        }
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "AreaLight[" << endl
@@ -26,6 +26,12 @@
 #include <mitsuba/hw/gpuprogram.h>
 #include <mitsuba/hw/gputexture.h>
 
+/// Largest number of CDF entries before pixels are grouped into blocks
+#define MTS_ENVMAP_MAX_CDF_ENTRIES (1 << 24)
+
+/// Upper bound on the block edge length of the sampling hierarchy
+#define MTS_ENVMAP_MAX_BLOCK_SIZE 16
+
 MTS_NAMESPACE_BEGIN
 
 #if SPECTRUM_SAMPLES == 3
@@ -265,47 +271,67 @@ public:
             const MIPMap::Array2DType &array = m_mipmap->getArray();
             m_size = array.getSize();
 
-            size_t nEntries = (size_t) (m_size.x + 1) * (size_t) m_size.y,
-                totalStorage = sizeof(float) * (m_size.x + 1 + nEntries);
-
-            Log(EInfo, "Precomputing data structures for environment map sampling (%s)",
-                memString(totalStorage).c_str());
+            /* Very large maps are sampled hierarchically: the CDF tables only
+               resolve square blocks of pixels, and a pixel within the chosen
+               block is found by scanning its texels. This yields the same
+               discrete distribution at a fraction of the storage */
+            m_blockSize = 1;
+            while (m_blockSize < MTS_ENVMAP_MAX_BLOCK_SIZE &&
+                   (size_t) (m_size.x / m_blockSize + 1) * (size_t) (m_size.y / m_blockSize)
+                    > MTS_ENVMAP_MAX_CDF_ENTRIES)
+                m_blockSize *= 2;
+            m_blocks = Vector2i(
+                (m_size.x + m_blockSize - 1) / m_blockSize,
+                (m_size.y + m_blockSize - 1) / m_blockSize);
+
+            size_t nEntries = (size_t) (m_blocks.x + 1) * (size_t) m_blocks.y,
+                totalStorage = sizeof(float) * (m_blocks.y + 1 + nEntries)
+                    + sizeof(Float) * m_size.y;
+
+            Log(EInfo, "Precomputing data structures for environment map sampling (%s, "
+                "%ix%i blocks)", memString(totalStorage).c_str(), m_blockSize, m_blockSize);
 
             ref<Timer> timer = new Timer();
             m_cdfCols = new float[nEntries];
-            m_cdfRows = new float[m_size.y + 1];
+            m_cdfRows = new float[m_blocks.y + 1];
             m_rowWeights = new Float[m_size.y];
 
+            for (int y=0; y<m_size.y; ++y)
+                m_rowWeights[y] = std::sin((y + 0.5f) * M_PI / m_size.y);
+
             size_t colPos = 0, rowPos = 0;
             Float rowSum = 0.0f;
 
             /* Build a marginal & conditional cumulative distribution
                function over luminances weighted by sin(theta) */
             m_cdfRows[rowPos++] = 0;
-            for (int y=0; y<m_size.y; ++y) {
+            for (int by=0; by<m_blocks.y; ++by) {
+                int y0 = by * m_blockSize, y1 = std::min(y0 + m_blockSize, m_size.y);
                 Float colSum = 0;
 
                 m_cdfCols[colPos++] = 0;
-                for (int x=0; x<m_size.x; ++x) {
-                    Spectrum value(array(x, y));
-
-                    colSum += value.getLuminance();
+                for (int bx=0; bx<m_blocks.x; ++bx) {
+                    int x0 = bx * m_blockSize, x1 = std::min(x0 + m_blockSize, m_size.x);
+                    for (int y=y0; y<y1; ++y) {
+                        Float lumSum = 0;
+                        for (int x=x0; x<x1; ++x)
+                            lumSum += Spectrum(array(x, y)).getLuminance();
+                        colSum += lumSum * m_rowWeights[y];
+                    }
                     m_cdfCols[colPos++] = (float) colSum;
                 }
 
                 float normalization = 1.0f / (float) colSum;
-                for (int x=1; x<m_size.x; ++x)
+                for (int x=1; x<m_blocks.x; ++x)
                     m_cdfCols[colPos-x-1] *= normalization;
                 m_cdfCols[colPos-1] = 1.0f;
 
-                Float weight = std::sin((y + 0.5f) * M_PI / m_size.y);
-                m_rowWeights[y] = weight;
-                rowSum += colSum * weight;
+                rowSum += colSum;
                 m_cdfRows[rowPos++] = (float) rowSum;
             }
 
             float normalization = 1.0f / (float) rowSum;
-            for (int y=1; y<m_size.y; ++y)
+            for (int y=1; y<m_blocks.y; ++y)
                 m_cdfRows[rowPos-y-1] *= normalization;
             m_cdfRows[rowPos-1] = 1.0f;
 
@@ -566,8 +592,10 @@ public:
     /// Helper function that samples a direction from the environment map
     void internalSampleDirection(Point2 sample, Vector &d, Spectrum &value, Float &pdf) const {
         /* Sample a discrete pixel position */
-        uint32_t row = sampleReuse(m_cdfRows, m_size.y, sample.y),
-                 col = sampleReuse(m_cdfCols + row * (m_size.x+1), m_size.x, sample.x);
+        uint32_t row = sampleReuse(m_cdfRows, m_blocks.y, sample.y),
+                 col = sampleReuse(m_cdfCols + row * (m_blocks.x+1), m_blocks.x, sample.x);
+        if (m_blockSize > 1)
+            sampleBlock(col, row, sample.x);
 
         /* Using the remaining bits of precision to shift the sample by an offset
            drawn from a tent function. This effectively creates a sampling strategy
@@ -660,6 +688,39 @@ private:
         sample = (sample - (Float) cdf[index]) / (Float) (cdf[index+1] - cdf[index]);
         return index;
     }
+
+    /**
+     * \brief Choose a pixel within a block of the sampling hierarchy
+     * proportionally to its luminance weighted by sin(theta)
+     *
+     * On entry, \c col and \c row specify the block. They are replaced
+     * by the pixel coordinates, and \c sample is rescaled for reuse.
+     */
+    inline void sampleBlock(uint32_t &col, uint32_t &row, Float &sample) const {
+        const MIPMap::Array2DType &array = m_mipmap->getArray();
+        int x0 = (int) col * m_blockSize, x1 = std::min(x0 + m_blockSize, m_size.x),
+            y0 = (int) row * m_blockSize, y1 = std::min(y0 + m_blockSize, m_size.y);
+
+        Float weights[MTS_ENVMAP_MAX_BLOCK_SIZE * MTS_ENVMAP_MAX_BLOCK_SIZE], sum = 0;
+        int count = 0;
+        for (int y=y0; y<y1; ++y) {
+            for (int x=x0; x<x1; ++x) {
+                weights[count] = Spectrum(array(x, y)).getLuminance() * m_rowWeights[y];
+                sum += weights[count++];
+            }
+        }
+
+        Float target = sample * sum;
+        int index = 0;
+        while (index < count - 1 && (target >= weights[index] || weights[index] == 0)) {
+            target -= weights[index];
+            ++index;
+        }
+
+        sample = weights[index] > 0 ? std::min(target / weights[index], ONE_MINUS_EPS) : 0.5f;
+        col = (uint32_t) (x0 + index % (x1 - x0));
+        row = (uint32_t) (y0 + index / (x1 - x0));
+    }
 private:
     MIPMap *m_mipmap;
     float *m_cdfRows, *m_cdfCols;
@@ -672,6 +733,8 @@ private:
     BSphere m_geoBSphere;
     BSphere m_sceneBSphere;
     Vector2i m_size;
+    Vector2i m_blocks;
+    int m_blockSize;
     Vector2 m_pixelSize;
 };
 
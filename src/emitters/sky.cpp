@@ -22,6 +22,7 @@
 #include <mitsuba/core/plugin.h>
 #include "sunsky/sunmodel.h"
 #include "sunsky/skymodel.h"
+#include "sunsky/bakecache.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -63,6 +64,11 @@ MTS_NAMESPACE_BEGIN
  *     }
  *     \parameter{resolution}{\Integer}{Specifies the horizontal resolution of the precomputed
  *         image that is used to represent the sun environment map \default{512, i.e. 512$\times$256}}
+ *     \parameter{cache}{\Boolean}{
+ *         Keep the rasterized environment map in memory, so that scenes
+ *         with the same sky parameters (e.g. successive frames of an animation)
+ *         can reuse it \default{\code{true}}
+ *     }
  *     \parameter{scale}{\Float}{
  *         This parameter can be used to scale the amount of illumination
  *         emitted by the sky emitter. \default{1}
@@ -226,6 +232,7 @@ public:
         m_albedo = props.getSpectrum("albedo", Spectrum(0.2f));
         m_sun = computeSunCoordinates(props);
         m_extend = props.getBoolean("extend", false);
+        m_cache = props.getBoolean("cache", true);
 
         if (m_turbidity < 1 || m_turbidity > 10)
             Log(EError, "The turbidity parameter must be in the range [1,10]!");
@@ -261,6 +268,7 @@ public:
         m_stretch = stream->readFloat();
         m_resolution = stream->readInt();
         m_extend = stream->readBool();
+        m_cache = stream->readBool();
         m_albedo = Spectrum(stream);
         m_sun = SphericalCoordinates(stream);
 
@@ -295,6 +303,7 @@ public:
         stream->writeFloat(m_stretch);
         stream->writeInt(m_resolution);
         stream->writeBool(m_extend);
+        stream->writeBool(m_cache);
         m_albedo.serialize(stream);
         m_sun.serialize(stream);
     }
@@ -307,32 +316,47 @@ public:
         if (i != 0)
             return NULL;
 
-        ref<Timer> timer = new Timer();
-        Log(EDebug, "Rasterizing skylight emitter to an %ix%i environment map ..",
-                m_resolution, m_resolution/2);
-        ref<Bitmap> bitmap = new Bitmap(SKY_PIXELFORMAT, Bitmap::EFloat,
-            Vector2i(m_resolution, m_resolution/2));
+        SkyBakeCache::Key key = getCacheKey();
+        ref<Bitmap> bitmap;
+        if (m_cache)
+            bitmap = SkyBakeCache::get(key);
+
+        if (bitmap) {
+            Log(EDebug, "Reusing a previously rasterized %ix%i skylight environment map",
+                    m_resolution, m_resolution/2);
+        } else {
+            ref<Timer> timer = new Timer();
+            Log(EDebug, "Rasterizing skylight emitter to an %ix%i environment map ..",
+                    m_resolution, m_resolution/2);
+            bitmap = new Bitmap(SKY_PIXELFORMAT, Bitmap::EFloat,
+                Vector2i(m_resolution, m_resolution/2));
+
+            Point2 factor((2*M_PI) / bitmap->getWidth(),
+                M_PI / bitmap->getHeight());
+
+            /* Rows below the horizon are much cheaper than the ones above
+               it, hence the dynamic schedule */
+            #if defined(MTS_OPENMP)
+                #pragma omp parallel for schedule(dynamic)
+            #endif
+            for (int y=0; y<bitmap->getHeight(); ++y) {
+                Float theta = (y+.5f) * factor.y;
+                Spectrum *target = (Spectrum *) bitmap->getFloatData()
+                    + y * bitmap->getWidth();
 
-        Point2 factor((2*M_PI) / bitmap->getWidth(),
-            M_PI / bitmap->getHeight());
+                for (int x=0; x<bitmap->getWidth(); ++x) {
+                    Float phi = (x+.5f) * factor.x;
 
-        #if defined(MTS_OPENMP)
-            #pragma omp parallel for
-        #endif
-        for (int y=0; y<bitmap->getHeight(); ++y) {
-            Float theta = (y+.5f) * factor.y;
-            Spectrum *target = (Spectrum *) bitmap->getFloatData()
-                + y * bitmap->getWidth();
+                    *target++ = getSkyRadiance(SphericalCoordinates(theta, phi));
+                }
+            }
 
-            for (int x=0; x<bitmap->getWidth(); ++x) {
-                Float phi = (x+.5f) * factor.x;
+            Log(EDebug, "Done (took %i ms)", timer->getMilliseconds());
 
-                *target++ = getSkyRadiance(SphericalCoordinates(theta, phi));
-            }
+            if (m_cache)
+                SkyBakeCache::put(key, bitmap);
         }
 
-        Log(EDebug, "Done (took %i ms)", timer->getMilliseconds());
-
         #if defined(MTS_DEBUG_SUNSKY)
         /* Write a debug image for inspection */
         {
@@ -409,6 +433,21 @@ protected:
         NotImplementedError("getAABB");
     }
 
+    /// Return all parameters that influence the rasterized environment map
+    SkyBakeCache::Key getCacheKey() const {
+        SkyBakeCache::Key key;
+        key.push_back((Float) m_resolution);
+        key.push_back(m_scale);
+        key.push_back(m_turbidity);
+        key.push_back(m_stretch);
+        key.push_back(m_extend ? 1.0f : 0.0f);
+        key.push_back(m_sun.elevation);
+        key.push_back(m_sun.azimuth);
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+            key.push_back(m_albedo[i]);
+        return key;
+    }
+
     /// Calculates the spectral radiance of the sky in the specified direction.
     Spectrum getSkyRadiance(const SphericalCoordinates &coords) const {
         Float theta = coords.elevation / m_stretch;
@@ -461,6 +500,8 @@ protected:
     Float m_stretch;
     /// Extend to the bottom hemisphere (super-unrealistic mode)
     bool m_extend;
+    /// Share the rasterized environment map between instances
+    bool m_cache;
     /// Ground albedo
     Spectrum m_albedo;
 
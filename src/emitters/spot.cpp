@@ -215,6 +215,29 @@ public:
         return m_worldTransform->getTranslationBounds();
     }
 
+    void getEmissionBounds(Vector &axis, Float &thetaO, Float &thetaE) const {
+        Emitter::getEmissionBounds(axis, thetaO, thetaE);
+        if (!m_worldTransform->isStatic())
+            return;
+
+        /* The cutoff angle only carries over to world space when the
+           transformation preserves angles */
+        const Transform &trafo = m_worldTransform->eval(0.0f);
+        Vector x = trafo(Vector(1, 0, 0)), y = trafo(Vector(0, 1, 0)),
+               z = trafo(Vector(0, 0, 1));
+        Float scale = z.length();
+        if (scale == 0 || std::abs(x.length() - scale) > Epsilon * scale
+            || std::abs(y.length() - scale) > Epsilon * scale
+            || std::abs(dot(x, y)) > Epsilon * scale * scale
+            || std::abs(dot(x, z)) > Epsilon * scale * scale
+            || std::abs(dot(y, z)) > Epsilon * scale * scale)
+            return;
+
+        axis = z / scale;
+        thetaO = m_cutoffAngle;
+        thetaE = 0.0f;
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "SpotEmitter[" << std::endl
@@ -21,6 +21,7 @@
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/qmc.h>
 #include "sunsky/sunmodel.h"
+#include "sunsky/bakecache.h"
 
 #if SPECTRUM_SAMPLES == 3
 # define SUNSKY_PIXELFORMAT Bitmap::ERGB
@@ -78,6 +79,11 @@ MTS_NAMESPACE_BEGIN
  *         Scale factor to adjust the radius of the sun, while preserving its power.
  *         Set to \code{0} to turn it into a directional light source.
  *     }
+ *     \parameter{cache}{\Boolean}{
+ *         Keep the rasterized environment map in memory, so that scenes
+ *         with the same parameters (e.g. successive frames of an animation)
+ *         can reuse it \default{\code{true}}
+ *     }
  * }
  * \vspace{-3mm}
  *
@@ -120,51 +126,13 @@ public:
         props.markQueried("albedo");
 
         int resolution = props.getInteger("resolution", 512);
-        ref<Bitmap> bitmap = new Bitmap(SUNSKY_PIXELFORMAT, Bitmap::EFloat,
-            Vector2i(resolution, resolution/2));
-
-        Point2 factor((2*M_PI) / bitmap->getWidth(),
-            M_PI / bitmap->getHeight());
-
-        ref<Timer> timer = new Timer();
-        Log(EDebug, "Rasterizing sun & skylight emitter to an %ix%i environment map ..",
-                resolution, resolution/2);
-
-        Spectrum *data = (Spectrum *) bitmap->getFloatData();
-
-        /* First, rasterize the sky */
-        #if defined(MTS_OPENMP)
-            #pragma omp parallel for
-        #endif
-        for (int y=0; y<bitmap->getHeight(); ++y) {
-            Float theta = (y+.5f) * factor.y;
-            Spectrum *target = data + y * bitmap->getWidth();
-
-            for (int x=0; x<bitmap->getWidth(); ++x) {
-                Float phi = (x+.5f) * factor.x;
-
-                RayDifferential ray(Point(0.0f),
-                    toSphere(SphericalCoordinates(theta, phi)), 0.0f);
-
-                *target++ = sky->evalEnvironment(ray);
-            }
-        }
-
-        /* Rasterizing the sphere to an environment map and checking the
-           individual pixels for coverage (which is what Mitsuba 0.3.0 did)
-           was slow and not very effective; for instance the power varied
-           dramatically with resolution changes. Since the sphere generally
-           just covers a few pixels, the code below rasterizes it much more
-           efficiently by generating a few thousand QMC samples.
-
-           Step 1: compute a *very* rough estimate of how many
-           pixel in the output environment map will be covered
-           by the sun */
+        bool cache = props.getBoolean("cache", true);
 
         SphericalCoordinates sun = computeSunCoordinates(props);
-        Spectrum sunRadiance = computeSunRadiance(sun.elevation,
-            props.getFloat("turbidity", 3.0f)) * sunScale;
-        sun.elevation *= props.getFloat("stretch", 1.0f);
+        Float turbidity = props.getFloat("turbidity", 3.0f),
+              stretch = props.getFloat("stretch", 1.0f);
+        Spectrum sunRadiance = computeSunRadiance(sun.elevation, turbidity) * sunScale;
+        sun.elevation *= stretch;
         Frame sunFrame = Frame(toSphere(sun));
 
         Float theta = degToRad(SUN_APP_RADIUS * 0.5f);
@@ -179,43 +147,113 @@ public:
             m_dirEmitter = static_cast<Emitter *>(
                 PluginManager::getInstance()->createObject(
                 MTS_CLASS(Emitter), props));
+        }
+
+        /* The baked map depends on the sky emitter's parameters and on
+           the sun disk that is splatted on top of it */
+        SkyBakeCache::Key key;
+        key.push_back((Float) resolution);
+        key.push_back(skyScale);
+        key.push_back(sunScale);
+        key.push_back(sunRadiusScale);
+        key.push_back(turbidity);
+        key.push_back(stretch);
+        key.push_back(props.getBoolean("extend", false) ? 1.0f : 0.0f);
+        key.push_back(sun.elevation);
+        key.push_back(sun.azimuth);
+        Spectrum albedo = props.getSpectrum("albedo", Spectrum(0.2f));
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+            key.push_back(albedo[i]);
+
+        ref<Bitmap> bitmap;
+        if (cache)
+            bitmap = SkyBakeCache::get(key);
+
+        if (bitmap) {
+            Log(EDebug, "Reusing a previously rasterized %ix%i sun & skylight "
+                "environment map", resolution, resolution/2);
         } else {
-            size_t pixelCount = resolution*resolution/2;
-            Float cosTheta = std::cos(theta * sunRadiusScale);
+            bitmap = new Bitmap(SUNSKY_PIXELFORMAT, Bitmap::EFloat,
+                Vector2i(resolution, resolution/2));
 
-            /* Ratio of the sphere that is covered by the sun */
-            Float coveredPortion = 0.5f * (1 - cosTheta);
+            Point2 factor((2*M_PI) / bitmap->getWidth(),
+                M_PI / bitmap->getHeight());
 
-            /* Approx. number of samples that need to be generated,
-               be very conservative */
-            size_t nSamples = (size_t) std::max((Float) 100,
-                (pixelCount * coveredPortion * 1000));
+            ref<Timer> timer = new Timer();
+            Log(EDebug, "Rasterizing sun & skylight emitter to an %ix%i environment map ..",
+                    resolution, resolution/2);
 
-            factor = Point2(bitmap->getWidth() / (2*M_PI),
-                bitmap->getHeight() / M_PI);
+            Spectrum *data = (Spectrum *) bitmap->getFloatData();
 
-            Spectrum value =
-                sunRadiance * (2 * M_PI * (1-std::cos(theta))) *
-                static_cast<Float>(bitmap->getWidth() * bitmap->getHeight())
-                / (2 * M_PI * M_PI * nSamples);
+            /* First, rasterize the sky. Rows below the horizon are much
+               cheaper than the ones above it, hence the dynamic schedule */
+            #if defined(MTS_OPENMP)
+                #pragma omp parallel for schedule(dynamic)
+            #endif
+            for (int y=0; y<bitmap->getHeight(); ++y) {
+                Float theta = (y+.5f) * factor.y;
+                Spectrum *target = data + y * bitmap->getWidth();
 
-            for (size_t i=0; i<nSamples; ++i) {
-                Vector dir = sunFrame.toWorld(
-                    warp::squareToUniformCone(cosTheta, sample02(i)));
+                for (int x=0; x<bitmap->getWidth(); ++x) {
+                    Float phi = (x+.5f) * factor.x;
 
-                Float sinTheta = math::safe_sqrt(1-dir.y*dir.y);
-                SphericalCoordinates sphCoords = fromSphere(dir);
+                    RayDifferential ray(Point(0.0f),
+                        toSphere(SphericalCoordinates(theta, phi)), 0.0f);
 
-                Point2i pos(
-                    std::min(std::max(0, (int) (sphCoords.azimuth * factor.x)), bitmap->getWidth()-1),
-                    std::min(std::max(0, (int) (sphCoords.elevation * factor.y)), bitmap->getHeight()-1));
+                    *target++ = sky->evalEnvironment(ray);
+                }
+            }
 
-                data[pos.x + pos.y * bitmap->getWidth()] += value / std::max((Float) 1e-3f, sinTheta);
+            /* Rasterizing the sphere to an environment map and checking the
+               individual pixels for coverage (which is what Mitsuba 0.3.0 did)
+               was slow and not very effective; for instance the power varied
+               dramatically with resolution changes. Since the sphere generally
+               just covers a few pixels, the code below rasterizes it much more
+               efficiently by generating a few thousand QMC samples.
+
+               Step 1: compute a *very* rough estimate of how many
+               pixel in the output environment map will be covered
+               by the sun */
+            if (sunRadiusScale != 0) {
+                size_t pixelCount = resolution*resolution/2;
+                Float cosTheta = std::cos(theta * sunRadiusScale);
+
+                /* Ratio of the sphere that is covered by the sun */
+                Float coveredPortion = 0.5f * (1 - cosTheta);
+
+                /* Approx. number of samples that need to be generated,
+                   be very conservative */
+                size_t nSamples = (size_t) std::max((Float) 100,
+                    (pixelCount * coveredPortion * 1000));
+
+                factor = Point2(bitmap->getWidth() / (2*M_PI),
+                    bitmap->getHeight() / M_PI);
+
+                Spectrum value =
+                    sunRadiance * (2 * M_PI * (1-std::cos(theta))) *
+                    static_cast<Float>(bitmap->getWidth() * bitmap->getHeight())
+                    / (2 * M_PI * M_PI * nSamples);
+
+                for (size_t i=0; i<nSamples; ++i) {
+                    Vector dir = sunFrame.toWorld(
+                        warp::squareToUniformCone(cosTheta, sample02(i)));
+
+                    Float sinTheta = math::safe_sqrt(1-dir.y*dir.y);
+                    SphericalCoordinates sphCoords = fromSphere(dir);
+
+                    Point2i pos(
+                        std::min(std::max(0, (int) (sphCoords.azimuth * factor.x)), bitmap->getWidth()-1),
+                        std::min(std::max(0, (int) (sphCoords.elevation * factor.y)), bitmap->getHeight()-1));
+
+                    data[pos.x + pos.y * bitmap->getWidth()] += value / std::max((Float) 1e-3f, sinTheta);
+                }
             }
 
-        }
+            Log(EDebug, "Done (took %i ms)", timer->getMilliseconds());
 
-        Log(EDebug, "Done (took %i ms)", timer->getMilliseconds());
+            if (cache)
+                SkyBakeCache::put(key, bitmap);
+        }
 
         /* Instantiate a nested envmap plugin */
         Properties envProps("envmap");
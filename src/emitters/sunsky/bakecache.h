@@ -0,0 +1,83 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__SKY_BAKECACHE_H)
+#define __SKY_BAKECACHE_H
+
+#include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/lock.h>
+#include <list>
+
+/// Number of baked environment maps that are kept per plugin
+#define SKY_BAKECACHE_SIZE 2
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Cache of rasterized sky environment maps
+ *
+ * Scenes that are loaded once per frame (e.g. turntable animations)
+ * would otherwise rasterize the same sky model over and over. Entries
+ * are keyed on all parameters that influence the baked image, and
+ * the most recently used ones are kept around. The cached bitmaps are
+ * shared and must not be modified.
+ */
+class SkyBakeCache {
+public:
+    typedef std::vector<Float> Key;
+
+    /// Look up a baked environment map, returns \c NULL on a miss
+    static ref<Bitmap> get(const Key &key) {
+        LockGuard lock(getMutex());
+        std::list<Entry> &entries = getEntries();
+        for (std::list<Entry>::iterator it = entries.begin();
+                it != entries.end(); ++it) {
+            if (it->first == key) {
+                entries.splice(entries.begin(), entries, it);
+                return entries.front().second;
+            }
+        }
+        return NULL;
+    }
+
+    /// Insert a baked environment map, evicting the least recently used one
+    static void put(const Key &key, Bitmap *bitmap) {
+        LockGuard lock(getMutex());
+        std::list<Entry> &entries = getEntries();
+        entries.push_front(Entry(key, bitmap));
+        while (entries.size() > SKY_BAKECACHE_SIZE)
+            entries.pop_back();
+    }
+
+private:
+    typedef std::pair<Key, ref<Bitmap> > Entry;
+
+    static Mutex *getMutex() {
+        static ref<Mutex> mutex = new Mutex();
+        return mutex;
+    }
+
+    static std::list<Entry> &getEntries() {
+        static std::list<Entry> entries;
+        return entries;
+    }
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __SKY_BAKECACHE_H */
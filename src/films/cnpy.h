@@ -10,6 +10,7 @@
 #include<sstream>
 #include<vector>
 #include<cstdio>
+#include<cstring>
 #include<typeinfo>
 #include<iostream>
 #include<cassert>
@@ -113,7 +114,7 @@ namespace cnpy {
         fclose(fp);
     }
 
-    template<typename T> void npz_save(std::string zipname, std::string fname, const T* data, const unsigned int* shape, const unsigned int ndims, std::string mode = "w")
+    template<typename T> void npz_save(std::string zipname, std::string fname, const T* data, const unsigned int* shape, const unsigned int ndims, std::string mode = "w", bool compress = false)
     {
         //first, append a .npy to the fname
     //    fname += ".npy";
@@ -148,24 +149,50 @@ namespace cnpy {
         std::vector<char> npy_header = create_npy_header(data,shape,ndims);
 
         unsigned long nels = 1;
-        for (int m=0; m<ndims; m++ ) nels *= shape[m];
+        for (unsigned int m=0; m<ndims; m++ ) nels *= shape[m];
         int nbytes = nels*sizeof(T) + npy_header.size();
 
         //get the CRC of the data to be added
         unsigned int crc = crc32(0L,(unsigned char*)&npy_header[0],npy_header.size());
         crc = crc32(crc,(unsigned char*)data,nels*sizeof(T));
 
+        //optionally deflate the npy header and data (raw stream without zlib header)
+        std::vector<char> compressed;
+        int cbytes = nbytes;
+        if (compress) {
+            z_stream strm;
+            memset(&strm, 0, sizeof(z_stream));
+            if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                throw std::runtime_error("npz_save: could not initialize zlib");
+            compressed.resize(deflateBound(&strm, nbytes));
+            strm.next_out = (Bytef *) &compressed[0];
+            strm.avail_out = (uInt) compressed.size();
+
+            strm.next_in = (Bytef *) &npy_header[0];
+            strm.avail_in = (uInt) npy_header.size();
+            int ret = deflate(&strm, Z_NO_FLUSH);
+            if (ret == Z_OK) {
+                strm.next_in = (Bytef *) data;
+                strm.avail_in = (uInt) (nels*sizeof(T));
+                ret = deflate(&strm, Z_FINISH);
+            }
+            cbytes = (int) strm.total_out;
+            deflateEnd(&strm);
+            if (ret != Z_STREAM_END)
+                throw std::runtime_error("npz_save: compression failed");
+        }
+
         //build the local header
         std::vector<char> local_header;
         local_header += "PK"; //first part of sig
         local_header += (unsigned short) 0x0403; //second part of sig
         local_header += (unsigned short) 20; //min version to extract
         local_header += (unsigned short) 0; //general purpose bit flag
-        local_header += (unsigned short) 0; //compression method
+        local_header += (unsigned short) (compress ? 8 : 0); //compression method
         local_header += (unsigned short) 0; //file last mod time
         local_header += (unsigned short) 0;     //file last mod date
         local_header += (unsigned int) crc; //crc
-        local_header += (unsigned int) nbytes; //compressed size
+        local_header += (unsigned int) cbytes; //compressed size
         local_header += (unsigned int) nbytes; //uncompressed size
         local_header += (unsigned short) fname.size(); //fname length
         local_header += (unsigned short) 0; //extra field length
@@ -192,13 +219,17 @@ namespace cnpy {
         footer += (unsigned short) (nrecs+1); //number of records on this disk
         footer += (unsigned short) (nrecs+1); //total number of records
         footer += (unsigned int) global_header.size(); //nbytes of global headers
-        footer += (unsigned int) (global_header_offset + nbytes + local_header.size()); //offset of start of global headers, since global header now starts after newly written array
+        footer += (unsigned int) (global_header_offset + cbytes + local_header.size()); //offset of start of global headers, since global header now starts after newly written array
         footer += (unsigned short) 0; //zip file comment length
 
         //write everything
         fwrite(&local_header[0],sizeof(char),local_header.size(),fp);
-        fwrite(&npy_header[0],sizeof(char),npy_header.size(),fp);
-        fwrite(data,sizeof(T),nels,fp);
+        if (compress) {
+            fwrite(&compressed[0],sizeof(char),cbytes,fp);
+        } else {
+            fwrite(&npy_header[0],sizeof(char),npy_header.size(),fp);
+            fwrite(data,sizeof(T),nels,fp);
+        }
         fwrite(&global_header[0],sizeof(char),global_header.size(),fp);
         fwrite(&footer[0],sizeof(char),footer.size(),fp);
         fclose(fp);
@@ -20,12 +20,103 @@
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/lock.h>
 #include <boost/algorithm/string.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
 #include "banner.h"
 #include "annotations.h"
 
 MTS_NAMESPACE_BEGIN
 
+/// Identifies checkpoint files written by \ref HDRFilm ("MTSD")
+#define MTS_HDRFILM_CHECKPOINT_ID 0x4453544D
+
+/**
+ * \brief Background thread that converts and writes snapshots of a film
+ *
+ * Only the most recent snapshot is kept while a write is in progress,
+ * older pending ones are dropped.
+ */
+class DevelopThread : public Thread {
+public:
+    typedef boost::function<void (const Scene *, Float, Bitmap *)> Callback;
+
+    DevelopThread(const Callback &callback) : Thread("develop"),
+            m_callback(callback), m_scene(NULL), m_renderTime(0),
+            m_busy(false), m_quit(false) {
+        m_mutex = new Mutex();
+        m_cond = new ConditionVariable(m_mutex);
+    }
+
+    /// Queue a snapshot for writing
+    void submit(const Scene *scene, Float renderTime, Bitmap *snapshot) {
+        LockGuard lock(m_mutex);
+        m_scene = scene;
+        m_renderTime = renderTime;
+        m_pending = snapshot;
+        m_cond->broadcast();
+    }
+
+    /// Wait until all queued snapshots have been written
+    void wait() {
+        LockGuard lock(m_mutex);
+        while (m_pending || m_busy)
+            m_cond->wait();
+    }
+
+    /// Write any queued snapshot and stop the thread
+    void quit() {
+        m_mutex->lock();
+        m_quit = true;
+        m_cond->broadcast();
+        m_mutex->unlock();
+        join();
+    }
+
+    void run() {
+        while (true) {
+            m_mutex->lock();
+            while (!m_pending && !m_quit)
+                m_cond->wait();
+            if (!m_pending) {
+                m_mutex->unlock();
+                break;
+            }
+            ref<Bitmap> snapshot = m_pending;
+            const Scene *scene = m_scene;
+            Float renderTime = m_renderTime;
+            m_pending = NULL;
+            m_busy = true;
+            m_mutex->unlock();
+
+            try {
+                m_callback(scene, renderTime, snapshot);
+            } catch (const std::exception &ex) {
+                Log(EWarn, "Could not write an intermediate result: %s", ex.what());
+            }
+
+            m_mutex->lock();
+            m_busy = false;
+            m_cond->broadcast();
+            m_mutex->unlock();
+        }
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~DevelopThread() { }
+private:
+    Callback m_callback;
+    ref<Mutex> m_mutex;
+    ref<ConditionVariable> m_cond;
+    ref<Bitmap> m_pending;
+    const Scene *m_scene;
+    Float m_renderTime;
+    bool m_busy, m_quit;
+};
+
 /*!\plugin{hdrfilm}{High dynamic range film}
  * \order{1}
  * \parameters{
@@ -74,6 +165,25 @@ MTS_NAMESPACE_BEGIN
  *        reconstruction filters. In general, this is not needed though.
  *        \default{\code{false}, i.e. disabled}
  *     }
+ *     \parameter{checkpointInterval}{\Float}{
+ *        When set to a positive value, the film periodically saves its
+ *        accumulated contents and the list of finished image blocks to a
+ *        \code{.checkpoint} file next to the output image (the interval
+ *        is specified in seconds). See below for details.
+ *        \default{\code{0}, i.e. disabled}
+ *     }
+ *     \parameter{storageFormat}{\String}{
+ *        Precision of the buffer that accumulates the image while
+ *        rendering. The options are \code{native} (the precision
+ *        Mitsuba was compiled with), \code{float32}, and \code{float16}.
+ *        See below for details. \default{\code{native}}
+ *     }
+ *     \parameter{compensate}{\Boolean}{
+ *        When a reduced \code{storageFormat} is used, accumulate
+ *        the first pixel format, alpha and the filter weights with
+ *        Kahan summation. This doubles their memory usage.
+ *        \default{\code{true}}
+ *     }
  *     \parameter{\Unnamed}{\RFilter}{Reconstruction filter that should
  *     be used by the film. \default{\code{gaussian}, a windowed Gaussian filter}}
  * }
@@ -95,6 +205,32 @@ MTS_NAMESPACE_BEGIN
  * For OpenEXR files, Mitsuba also supports fully general multi-channel output;
  * refer to the \pluginref{multichannel} plugin for details on how this works.
  *
+ * \subsubsection*{Checkpoints:}
+ * Long renderings on machines that may go away at any time (e.g. pre-emptible
+ * cloud instances) can be protected using the \code{checkpointInterval}
+ * parameter. The checkpoint stores the unnormalized film contents including
+ * the reconstruction filter weights at the storage precision, as well as the set of
+ * completed image blocks. When the same scene is rendered again with the same
+ * destination file, block size, and film settings, the checkpoint is restored
+ * and the finished blocks are skipped. The checkpoint file is removed once
+ * all blocks have been completed. Checkpoints are only supported by
+ * integrators that render the image block by block (e.g. \pluginref{path});
+ * other integrators simply do not produce any.
+ *
+ * \paragraph{Storage precision:}
+ * While rendering, the film accumulates the weighted samples of every pixel
+ * in a full-size buffer. In double precision builds, this buffer takes
+ * 8 bytes per channel, which adds up for large multi-channel images. The
+ * \code{storageFormat} parameter reduces it to 4 (\code{float32}) or 2 bytes
+ * (\code{float16}). Channels selected by \code{compensate} additionally
+ * keep a single precision Kahan compensation term, which prevents
+ * round-off from building up when many contributions are added to the
+ * same pixel (e.g. in progressive or particle tracing renderings). A
+ * typical configuration for a multi-channel film with several AOVs is
+ * \code{storageFormat=float16}, which stores the AOVs in half precision,
+ * while the primary image and the filter weights remain compensated.
+ * Note that \code{float16} values cannot exceed 65504.
+ *
  * The plugin can also write RLE-compressed files in the Radiance RGBE format
  * pioneered by Greg Ward (set \code{fileFormat=rgbe}), as well as the
  * Portable Float Map format (set \code{fileFormat=pfm}).
@@ -348,12 +484,27 @@ public:
                 props.markQueried(keys[i]);
         }
 
-        if (m_pixelFormats.size() == 1) {
-            m_storage = new ImageBlock(Bitmap::ESpectrumAlphaWeight, m_cropSize);
+        /* Interval (in seconds) between checkpoints, or zero to disable them */
+        m_checkpointInterval = props.getFloat("checkpointInterval", 0.0f);
+        if (m_checkpointInterval < 0)
+            Log(EError, "The \"checkpointInterval\" parameter must be nonnegative!");
+
+        /* Precision of the accumulation buffer */
+        std::string storageFormat = boost::to_lower_copy(
+            props.getString("storageFormat", "native"));
+        if (storageFormat == "native") {
+            m_storageFormat = Bitmap::EFloat;
+        } else if (storageFormat == "float32") {
+            m_storageFormat = Bitmap::EFloat32;
+        } else if (storageFormat == "float16") {
+            m_storageFormat = Bitmap::EFloat16;
         } else {
-            m_storage = new ImageBlock(Bitmap::EMultiSpectrumAlphaWeight, m_cropSize,
-                NULL, (int) (SPECTRUM_SAMPLES * m_pixelFormats.size() + 2));
+            Log(EError, "The \"storageFormat\" parameter must either be "
+                "equal to \"native\", \"float32\", or \"float16\"!");
         }
+        m_compensate = props.getBoolean("compensate", true);
+
+        createStorage();
     }
 
     HDRFilm(Stream *stream, InstanceManager *manager)
@@ -368,6 +519,10 @@ public:
         for (size_t i=0; i<m_channelNames.size(); ++i)
             m_channelNames[i] = stream->readString();
         m_componentFormat = (Bitmap::EComponentFormat) stream->readUInt();
+        m_checkpointInterval = stream->readFloat();
+        m_storageFormat = (Bitmap::EComponentFormat) stream->readUInt();
+        m_compensate = stream->readBool();
+        createStorage();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -382,18 +537,86 @@ public:
         for (size_t i=0; i<m_channelNames.size(); ++i)
             stream->writeString(m_channelNames[i]);
         stream->writeUInt(m_componentFormat);
+        stream->writeFloat(m_checkpointInterval);
+        stream->writeUInt(m_storageFormat);
+        stream->writeBool(m_compensate);
+    }
+
+    void createStorage() {
+        if (m_pixelFormats.size() == 1) {
+            m_storage = new ImageBlock(Bitmap::ESpectrumAlphaWeight, m_cropSize);
+        } else {
+            m_storage = new ImageBlock(Bitmap::EMultiSpectrumAlphaWeight, m_cropSize,
+                NULL, (int) (SPECTRUM_SAMPLES * m_pixelFormats.size() + 2));
+        }
+        configureStorage(m_storage);
+        m_totalBlocks = 0;
+        m_pendingPixels = 0;
+        m_checkpointValid = true;
+    }
+
+    /// Apply the requested storage precision to an accumulation buffer
+    void configureStorage(ImageBlock *storage) const {
+        if (m_storageFormat == Bitmap::EFloat)
+            return;
+
+        /* Compensate the first spectrum, alpha, and the weights */
+        std::vector<bool> compensated;
+        if (m_compensate) {
+            compensated.resize(storage->getChannelCount(), false);
+            for (size_t i=0; i<compensated.size(); ++i)
+                compensated[i] = i < SPECTRUM_SAMPLES || i + 2 >= compensated.size();
+        }
+        storage->setStorage(m_storageFormat, compensated);
     }
 
     void clear() {
         m_storage->clear();
+        m_completedBlocks.clear();
+        m_pendingPixels = 0;
+        m_checkpointValid = true;
+
+        if (m_resumeStorage) {
+            /* Continue from the checkpoint of an interrupted rendering */
+            m_storage = m_resumeStorage;
+            m_completedBlocks.swap(m_resumeBlocks);
+            m_resumeStorage = NULL;
+            m_resumeBlocks.clear();
+            Log(EInfo, "Resuming from checkpoint (" SIZE_T_FMT " of " SIZE_T_FMT
+                " blocks are complete)", m_completedBlocks.size(), m_totalBlocks);
+        }
+        if (m_checkpointTimer)
+            m_checkpointTimer->reset();
     }
 
     void put(const ImageBlock *block) {
         m_storage->put(block);
+        m_pendingPixels += (size_t) block->getSize().x * (size_t) block->getSize().y;
+    }
+
+    void setBlockComplete(const Point2i &offset, const Vector2i &size) {
+        /* A split block is merged in several parts, see BlockedRenderProcess */
+        size_t pixels = (size_t) size.x * (size_t) size.y;
+        m_pendingPixels -= std::min(m_pendingPixels, pixels);
+        m_completedBlocks.insert(std::make_pair(offset.x, offset.y));
+
+        if (m_checkpointTimer && m_checkpointTimer->getMilliseconds()
+                > 1000 * m_checkpointInterval) {
+            writeCheckpoint();
+            m_checkpointTimer->reset();
+        }
+    }
+
+    bool isBlockComplete(const Point2i &offset, const Vector2i &size) const {
+        return m_completedBlocks.find(std::make_pair(offset.x, offset.y))
+            != m_completedBlocks.end();
     }
 
     void setBitmap(const Bitmap *bitmap, Float multiplier) {
         bitmap->convert(m_storage->getBitmap(), multiplier);
+        m_storage->clearCompensation();
+        /* The contents can no longer be attributed to image blocks */
+        m_checkpointValid = false;
     }
 
     void addBitmap(const Bitmap *bitmap, Float multiplier) {
@@ -410,9 +633,14 @@ public:
             Log(EError, "addBitmap(): Unsupported bitmap format!");
         }
 
+        /* Reduced precision storage is expanded temporarily */
+        ref<Bitmap> storage = m_storage->getBitmap();
+        if (m_storageFormat != Bitmap::EFloat)
+            storage = storage->convert(Bitmap::ESpectrumAlphaWeight, Bitmap::EFloat);
+
         size_t nPixels = (size_t) size.x * (size_t) size.y;
         const Float *source = bitmap->getFloatData();
-        Float *target = m_storage->getBitmap()->getFloatData();
+        Float *target = storage->getFloatData();
         for (size_t i=0; i<nPixels; ++i) {
             Float weight = target[SPECTRUM_SAMPLES + 1];
             if (weight == 0)
@@ -422,13 +650,19 @@ public:
                 *target++ += *source++ * weight;
             target += 2;
         }
+
+        if (m_storageFormat != Bitmap::EFloat) {
+            storage->convert(m_storage->getBitmap());
+            m_storage->clearCompensation();
+        }
+        m_checkpointValid = false;
     }
 
     bool develop(const Point2i &sourceOffset, const Vector2i &size,
             const Point2i &targetOffset, Bitmap *target) const {
         const Bitmap *source = m_storage->getBitmap();
         const FormatConverter *cvt = FormatConverter::getInstance(
-            std::make_pair(Bitmap::EFloat, target->getComponentFormat())
+            std::make_pair(source->getComponentFormat(), target->getComponentFormat())
         );
 
         size_t sourceBpp = source->getBytesPerPixel();
@@ -443,7 +677,7 @@ public:
             /* Special case for general multi-channel images -- just develop the first component(s) */
             for (int i=0; i<size.y; ++i) {
                 for (int j=0; j<size.x; ++j) {
-                    Float weight = *((Float *) (sourceData + (j+1)*sourceBpp - sizeof(Float)));
+                    Float weight = readWeight(source, sourceData + j*sourceBpp);
                     Float invWeight = weight != 0 ? ((Float) 1 / weight) : (Float) 0;
                     cvt->convert(Bitmap::ESpectrum, 1.0f, sourceData + j*sourceBpp,
                         target->getPixelFormat(), target->getGamma(), targetData + j * targetBpp,
@@ -474,22 +708,163 @@ public:
         return true;
     }
 
+    /// Return the weight (i.e. the last channel) of a storage pixel
+    static Float readWeight(const Bitmap *source, const uint8_t *pixel) {
+        int last = source->getChannelCount() - 1;
+        switch (source->getComponentFormat()) {
+            case Bitmap::EFloat16: return (Float) (float) ((const half *) pixel)[last];
+            case Bitmap::EFloat32: return (Float) ((const float *) pixel)[last];
+            default: return (Float) ((const double *) pixel)[last];
+        }
+    }
+
     void setDestinationFile(const fs::path &destFile, uint32_t blockSize) {
         m_destFile = destFile;
+        m_checkpointTimer = NULL;
+        m_resumeStorage = NULL;
+        m_resumeBlocks.clear();
+
+        if (m_checkpointInterval == 0 || m_destFile.empty())
+            return;
+
+        m_checkpointFile = m_destFile;
+        m_checkpointFile.replace_extension(".checkpoint");
+        m_checkpointTimer = new Timer();
+        m_blockSize = (int) blockSize;
+
+        /* Number of blocks generated by a \ref BlockedRenderProcess */
+        Vector2i size = m_cropSize;
+        if (m_highQualityEdges)
+            size += Vector2i(2 * m_filter->getBorderSize());
+        m_totalBlocks = (size_t) ((size.x + m_blockSize - 1) / m_blockSize)
+            * (size_t) ((size.y + m_blockSize - 1) / m_blockSize);
+
+        if (fs::exists(m_checkpointFile))
+            loadCheckpoint();
+    }
+
+    /// Try to load a checkpoint that matches the current configuration
+    void loadCheckpoint() {
+        try {
+            ref<FileStream> stream = new FileStream(m_checkpointFile, FileStream::EReadOnly);
+            if (stream->readUInt() != MTS_HDRFILM_CHECKPOINT_ID) {
+                Log(EWarn, "\"%s\" is not a valid checkpoint file -- ignoring it.",
+                    m_checkpointFile.string().c_str());
+                return;
+            }
+            Vector2i cropSize(stream);
+            int blockSize = stream->readInt();
+            int channels = stream->readInt();
+            int floatSize = stream->readInt();
+            Bitmap::EComponentFormat storageFormat = (Bitmap::EComponentFormat) stream->readUInt();
+            bool compensate = stream->readBool();
+            if (cropSize != m_cropSize || blockSize != m_blockSize ||
+                channels != m_storage->getBitmap()->getChannelCount() ||
+                floatSize != (int) sizeof(Float) ||
+                storageFormat != m_storageFormat || compensate != m_compensate) {
+                Log(EWarn, "The checkpoint \"%s\" was created using a different "
+                    "configuration -- ignoring it.", m_checkpointFile.string().c_str());
+                return;
+            }
+
+            size_t blockCount = stream->readSize();
+            std::set<std::pair<int, int> > blocks;
+            for (size_t i=0; i<blockCount; ++i) {
+                Point2i offset(stream);
+                blocks.insert(std::make_pair(offset.x, offset.y));
+            }
+
+            ref<ImageBlock> storage = new ImageBlock(m_storage->getBitmap()->getPixelFormat(),
+                m_cropSize, NULL, channels);
+            configureStorage(storage);
+            storage->load(stream);
+
+            m_resumeStorage = storage;
+            m_resumeBlocks.swap(blocks);
+            Log(EInfo, "Loaded checkpoint \"%s\"", m_checkpointFile.string().c_str());
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Could not load the checkpoint \"%s\": %s",
+                m_checkpointFile.string().c_str(), ex.what());
+        }
+    }
+
+    /// Save the film contents and the set of completed blocks
+    void writeCheckpoint() {
+        /* Only blocks that were merged completely can be restored */
+        if (!m_checkpointValid || m_pendingPixels != 0)
+            return;
+
+        Log(EDebug, "Writing checkpoint (" SIZE_T_FMT " of " SIZE_T_FMT " blocks) ..",
+            m_completedBlocks.size(), m_totalBlocks);
+
+        /* Write to a temporary file first so that an interruption
+           never leaves behind a truncated checkpoint */
+        fs::path tempFile = m_checkpointFile;
+        tempFile.replace_extension(".checkpoint.tmp");
+        {
+            ref<FileStream> stream = new FileStream(tempFile, FileStream::ETruncWrite);
+            stream->writeUInt(MTS_HDRFILM_CHECKPOINT_ID);
+            m_cropSize.serialize(stream);
+            stream->writeInt(m_blockSize);
+            stream->writeInt(m_storage->getBitmap()->getChannelCount());
+            stream->writeInt((int) sizeof(Float));
+            stream->writeUInt(m_storageFormat);
+            stream->writeBool(m_compensate);
+            stream->writeSize(m_completedBlocks.size());
+            for (std::set<std::pair<int, int> >::const_iterator it = m_completedBlocks.begin();
+                    it != m_completedBlocks.end(); ++it)
+                Point2i(it->first, it->second).serialize(stream);
+            m_storage->save(stream);
+            stream->close();
+        }
+        fs::rename(tempFile, m_checkpointFile);
     }
 
     void develop(const Scene *scene, Float renderTime) {
         if (m_destFile.empty())
             return;
 
+        /* Don't let a pending intermediate result overwrite this one */
+        if (m_developThread)
+            m_developThread->wait();
+
         Log(EDebug, "Developing film ..");
+        write(scene, renderTime, m_storage->getBitmap());
 
+        if (m_checkpointTimer) {
+            if (m_completedBlocks.size() == m_totalBlocks) {
+                /* The rendering is done -- the checkpoint is not needed anymore */
+                if (fs::exists(m_checkpointFile))
+                    fs::remove(m_checkpointFile);
+            } else {
+                writeCheckpoint();
+            }
+        }
+    }
+
+    void developAsync(const Scene *scene, Float renderTime) {
+        if (m_destFile.empty())
+            return;
+
+        if (!m_developThread) {
+            m_developThread = new DevelopThread(
+                boost::bind(&HDRFilm::write, this, _1, _2, _3));
+            m_developThread->start();
+        }
+
+        /* Only the snapshot happens on the calling thread */
+        Log(EDebug, "Developing film in the background ..");
+        m_developThread->submit(scene, renderTime, m_storage->getBitmap()->clone());
+    }
+
+    /// Convert the given film storage and write it to the destination file
+    void write(const Scene *scene, Float renderTime, Bitmap *storage) const {
         ref<Bitmap> bitmap;
         if (m_pixelFormats.size() == 1) {
-            bitmap = m_storage->getBitmap()->convert(m_pixelFormats[0], m_componentFormat);
+            bitmap = storage->convert(m_pixelFormats[0], m_componentFormat);
             bitmap->setChannelNames(m_channelNames);
         } else {
-            bitmap = m_storage->getBitmap()->convertMultiSpectrumAlphaWeight(m_pixelFormats,
+            bitmap = storage->convertMultiSpectrumAlphaWeight(m_pixelFormats,
                     m_componentFormat, m_channelNames);
         }
 
@@ -579,23 +954,45 @@ public:
             << "  cropOffset = " << m_cropOffset.toString() << "," << endl
             << "  cropSize = " << m_cropSize.toString() << "," << endl
             << "  banner = " << m_banner << "," << endl
+            << "  checkpointInterval = " << m_checkpointInterval << "," << endl
+            << "  storageFormat = " << m_storageFormat << "," << endl
+            << "  compensate = " << m_compensate << "," << endl
             << "  filter = " << indent(m_filter->toString()) << endl
             << "]";
         return oss.str();
     }
 
     MTS_DECLARE_CLASS()
+protected:
+    virtual ~HDRFilm() {
+        if (m_developThread)
+            m_developThread->quit();
+    }
 protected:
     Bitmap::EFileFormat m_fileFormat;
     std::vector<Bitmap::EPixelFormat> m_pixelFormats;
     std::vector<std::string> m_channelNames;
     Bitmap::EComponentFormat m_componentFormat;
+    Bitmap::EComponentFormat m_storageFormat;
+    bool m_compensate;
     bool m_banner;
     bool m_attachLog;
     fs::path m_destFile;
     ref<ImageBlock> m_storage;
+
+    /* Checkpointing */
+    Float m_checkpointInterval;
+    fs::path m_checkpointFile;
+    ref<Timer> m_checkpointTimer;
+    std::set<std::pair<int, int> > m_completedBlocks, m_resumeBlocks;
+    ref<ImageBlock> m_resumeStorage;
+    size_t m_totalBlocks, m_pendingPixels;
+    int m_blockSize;
+    bool m_checkpointValid;
+    ref<DevelopThread> m_developThread;
 };
 
+MTS_IMPLEMENT_CLASS(DevelopThread, false, Thread)
 MTS_IMPLEMENT_CLASS_S(HDRFilm, false, Film)
 MTS_EXPORT_PLUGIN(HDRFilm, "High dynamic range film");
 MTS_NAMESPACE_END
@@ -37,6 +37,12 @@ MTS_NAMESPACE_BEGIN
  *       The desired output file format:
  *       \code{png} or \code{jpeg}. \default{\code{png}}
  *     }
+ *     \parameter{compression}{\Integer}{
+ *       For PNG output, the zlib compression level between 0 and 9. Level
+ *       1 is the fastest setting and useful for frequently written
+ *       previews. For JPEG output, the quality between 0 and 100.
+ *       \default{5 for PNG, 100 for JPEG}
+ *     }
  *     \parameter{pixelFormat}{\String}{Specifies the pixel format
  *         of the generated image. The options are \code{luminance},
  *         \code{luminanceAlpha}, \code{rgb} or \code{rgba} for PNG output
@@ -181,6 +187,7 @@ public:
         m_exposure = props.getFloat("exposure", 0.0f);
         m_reinhardKey = props.getFloat("key", 0.18f);
         m_reinhardBurn = props.getFloat("burn", 0.0);
+        m_compression = props.getInteger("compression", -1);
 
         std::vector<std::string> keys = props.getPropertyNames();
         for (size_t i=0; i<keys.size(); ++i) {
@@ -205,6 +212,7 @@ public:
         m_exposure = stream->readFloat();
         m_reinhardKey = stream->readFloat();
         m_reinhardBurn = stream->readFloat();
+        m_compression = stream->readInt();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -217,6 +225,7 @@ public:
         stream->writeFloat(m_exposure);
         stream->writeFloat(m_reinhardKey);
         stream->writeFloat(m_reinhardBurn);
+        stream->writeInt(m_compression);
     }
 
     void clear() {
@@ -349,7 +358,7 @@ public:
 
         annotate(scene, m_properties, bitmap, renderTime, m_gamma);
 
-        bitmap->write(m_fileFormat, stream);
+        bitmap->write(m_fileFormat, stream, m_compression);
     }
 
     bool hasAlpha() const {
@@ -379,6 +388,7 @@ public:
             << "  size = " << m_size.toString() << "," << endl
             << "  fileFormat = " << m_fileFormat << "," << endl
             << "  pixelFormat = " << m_pixelFormat << "," << endl
+            << "  compression = " << m_compression << "," << endl
             << "  gamma = " << m_gamma << "," << endl
             << "  cropOffset = " << m_cropOffset.toString() << "," << endl
             << "  cropSize = " << m_cropSize.toString() << "," << endl
@@ -402,6 +412,7 @@ protected:
     ref<ImageBlock> m_storage;
     ETonemapMethod m_tonemapMethod;
     Float m_exposure, m_reinhardKey, m_reinhardBurn;
+    int m_compression;
 };
 
 MTS_IMPLEMENT_CLASS_S(LDRFilm, false, Film)
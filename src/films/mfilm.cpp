@@ -19,6 +19,7 @@
 #include <mitsuba/render/film.h>
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/mmap.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <iomanip>
@@ -40,7 +41,15 @@ MTS_NAMESPACE_BEGIN
  *     }
  *     \parameter{fileFormat}{\String}{
  *       Specifies the desired output format; must be one of
- *       \code{matlab}, \code{mathematica}, or \code{numpy}. \default{\code{matlab}}
+ *       \code{matlab}, \code{mathematica}, \code{numpy}, or
+ *       \code{numpycompressed} (a deflate-compressed \code{.npz} archive
+ *       containing an array named after \code{variable}). \default{\code{matlab}}
+ *     }
+ *     \parameter{memoryMapped}{\Boolean}{
+ *       Only for the \code{numpy} file format: map the output file into
+ *       memory when rendering starts and write every finished image block
+ *       straight into it, rather than converting and writing the
+ *       whole array at the end. \default{\code{false}}
  *     }
  *     \parameter{digits}{\Integer}{
  *       Number of significant digits to be written \default{4}
@@ -83,7 +92,8 @@ public:
     enum EMode {
         EMATLAB = 0,
         EMathematica,
-        ENumPy
+        ENumPy,
+        ENumPyCompressed
     };
 
     MFilm(const Properties &props) : Film(props) {
@@ -126,6 +136,8 @@ public:
             m_fileFormat = EMathematica;
         } else if (fileFormat == "numpy") {
             m_fileFormat = ENumPy;
+        } else if (fileFormat == "numpycompressed") {
+            m_fileFormat = ENumPyCompressed;
         } else {
             Log(EError, "The \"fileFormat\" parameter must either be equal to "
                 "\"matlab\" or \"mathematica\" or \"numpy\" or \"numpycompressed\"!");
@@ -134,6 +146,11 @@ public:
         m_digits = props.getInteger("digits", 4);
         m_variable = props.getString("variable", "data");
 
+        /* Write finished blocks directly into a memory-mapped .npy file? */
+        m_memoryMapped = props.getBoolean("memoryMapped", false);
+        if (m_memoryMapped && m_fileFormat != ENumPy)
+            Log(EError, "The \"memoryMapped\" parameter requires the \"numpy\" file format!");
+
         m_storage = new ImageBlock(Bitmap::ESpectrumAlphaWeight, m_cropSize);
     }
 
@@ -143,6 +160,7 @@ public:
         m_fileFormat = (EMode) stream->readUInt();
         m_digits = stream->readInt();
         m_variable = stream->readString();
+        m_memoryMapped = stream->readBool();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -151,6 +169,7 @@ public:
         stream->writeUInt(m_fileFormat);
         stream->writeInt(m_digits);
         stream->writeString(m_variable);
+        stream->writeBool(m_memoryMapped);
     }
 
     void configure() {
@@ -166,14 +185,25 @@ public:
 
     void clear() {
         m_storage->clear();
+        updateMapped(Point2i(0), m_cropSize);
     }
 
     void put(const ImageBlock *block) {
         m_storage->put(block);
+
+        /* Refresh the affected region (including the block's border) */
+        Vector2i border(block->getBorderSize());
+        Point2i start = block->getOffset() - border;
+        Point2i end = start + block->getSize() + 2 * border;
+        start.x = std::max(start.x, 0); start.y = std::max(start.y, 0);
+        end.x = std::min(end.x, m_cropSize.x); end.y = std::min(end.y, m_cropSize.y);
+        if (end.x > start.x && end.y > start.y)
+            updateMapped(start, end - start);
     }
 
     void setBitmap(const Bitmap *bitmap, Float multiplier) {
         bitmap->convert(m_storage->getBitmap(), multiplier);
+        updateMapped(Point2i(0), m_cropSize);
     }
 
     void addBitmap(const Bitmap *bitmap, Float multiplier) {
@@ -201,6 +231,7 @@ public:
                 *target++ += *source++ * weight;
             target += 2;
         }
+        updateMapped(Point2i(0), m_cropSize);
     }
 
     bool develop(const Point2i &sourceOffset, const Vector2i &size,
@@ -240,26 +271,51 @@ public:
 
     void setDestinationFile(const fs::path &destFile, uint32_t blockSize) {
         m_destFile = destFile;
+        m_mapped = NULL;
+        m_mappedBitmap = NULL;
+
+        if (!m_memoryMapped || m_destFile.empty())
+            return;
+
+        /* Create the .npy file and map it into memory */
+        fs::path filename = getFilename(m_destFile);
+        int channels = ref<Bitmap>(new Bitmap(m_pixelFormat,
+            Bitmap::EFloat, Vector2i(1)))->getChannelCount();
+        unsigned int shape[] = {
+            (unsigned int) m_cropSize.y,
+            (unsigned int) m_cropSize.x,
+            (unsigned int) channels
+        };
+        std::vector<char> header = cnpy::create_npy_header(
+            (const Float *) NULL, shape, channels == 1 ? 2 : 3);
+        size_t dataSize = (size_t) m_cropSize.x * (size_t) m_cropSize.y
+            * channels * sizeof(Float);
+
+        Log(EInfo, "Mapping \"%s\" into memory ..", filename.filename().string().c_str());
+        m_mapped = new MemoryMappedFile(filename, header.size() + dataSize);
+        uint8_t *data = static_cast<uint8_t *>(m_mapped->getData());
+        memcpy(data, &header[0], header.size());
+
+        /* The header length is a multiple of 16, so this is aligned */
+        m_mappedBitmap = new Bitmap(m_pixelFormat, Bitmap::EFloat,
+            m_cropSize, channels, data + header.size());
+        updateMapped(Point2i(0), m_cropSize);
     }
 
     void develop(const Scene *scene, Float renderTime) {
         if (m_destFile.empty())
             return;
 
+        if (m_mapped) {
+            /* All blocks have already been written to the mapped file */
+            Log(EInfo, "Image is stored in memory-mapped file \"%s\"",
+                m_mapped->getFilename().filename().string().c_str());
+            return;
+        }
+
         Log(EDebug, "Developing film ..");
 
-        fs::path filename = m_destFile;
-        std::string extension = boost::to_lower_copy(filename.extension().string());
-        std::string expectedExtension;
-        if (m_fileFormat == EMathematica || m_fileFormat == EMATLAB) {
-            expectedExtension = ".m";
-        } else if (m_fileFormat == ENumPy) {
-            expectedExtension = ".npy";
-        } else {
-            Log(EError, "Invalid file format!");
-        }
-        if (extension != expectedExtension)
-            filename.replace_extension(expectedExtension);
+        fs::path filename = getFilename(m_destFile);
 
         ref<Bitmap> bitmap = m_storage->getBitmap()->convert(
             m_pixelFormat, Bitmap::EFloat);
@@ -344,23 +400,40 @@ public:
                 N = 2;
 
             const Float *data = bitmap->getFloatData();
-            cnpy::npy_save(filename.string(), data, shape_ptr, N, "w");
+            if (m_fileFormat == ENumPy)
+                cnpy::npy_save(filename.string(), data, shape_ptr, N, "w");
+            else
+                cnpy::npz_save(filename.string(), m_variable + ".npy",
+                    data, shape_ptr, N, "w", true);
         }
     }
 
-    bool destinationExists(const fs::path &baseName) const {
+    /// Return the output file name with the extension of the file format
+    fs::path getFilename(const fs::path &baseName) const {
         fs::path filename = baseName;
         std::string expectedExtension;
         if (m_fileFormat == EMathematica || m_fileFormat == EMATLAB) {
             expectedExtension = ".m";
         } else if (m_fileFormat == ENumPy) {
             expectedExtension = ".npy";
+        } else if (m_fileFormat == ENumPyCompressed) {
+            expectedExtension = ".npz";
         } else {
             Log(EError, "Invalid file format!");
         }
         if (boost::to_lower_copy(filename.extension().string()) != expectedExtension)
             filename.replace_extension(expectedExtension);
-        return fs::exists(filename);
+        return filename;
+    }
+
+    /// Convert a region of the storage into the memory-mapped output file
+    inline void updateMapped(const Point2i &offset, const Vector2i &size) {
+        if (m_mappedBitmap)
+            develop(offset, size, offset, m_mappedBitmap);
+    }
+
+    bool destinationExists(const fs::path &baseName) const {
+        return fs::exists(getFilename(baseName));
     }
 
     bool hasAlpha() const {
@@ -377,6 +450,7 @@ public:
             << "  size = " << m_size.toString() << "," << endl
             << "  pixelFormat = " << m_pixelFormat << "," << endl
             << "  digits = " << m_digits << "," << endl
+            << "  memoryMapped = " << m_memoryMapped << "," << endl
             << "  variable = \"" << m_variable << "\"," << endl
             << "  cropOffset = " << m_cropOffset.toString() << "," << endl
             << "  cropSize = " << m_cropSize.toString() << "," << endl
@@ -393,6 +467,9 @@ protected:
     ref<ImageBlock> m_storage;
     std::string m_variable;
     int m_digits;
+    bool m_memoryMapped;
+    ref<MemoryMappedFile> m_mapped;
+    ref<Bitmap> m_mappedBitmap;
 };
 
 MTS_IMPLEMENT_CLASS_S(MFilm, false, Film)
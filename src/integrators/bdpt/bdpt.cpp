@@ -58,6 +58,15 @@ MTS_NAMESPACE_BEGIN
  *        lower value can be beneficial.
  *        \default{\code{1.0}}
  *     }
+ *     \parameter{poolSize}{\Integer}{When set to a positive value, the
+ *        emitter subpaths of this many consecutive samples of a work unit are
+ *        kept in a shared pool, and every sensor subpath is connected to
+ *        \code{poolConnections} randomly chosen members of the pool instead
+ *        of only its own emitter subpath (see below). \default{\code{0}, i.e. disabled}
+ *     }
+ *     \parameter{poolConnections}{\Integer}{Number of pooled emitter
+ *        subpaths that each sensor subpath is connected to \default{\code{4}}
+ *     }
  * }
  *
  ** \renderings{
@@ -135,6 +144,20 @@ MTS_NAMESPACE_BEGIN
  * When rendering an image of a reasonable resolution without network nodes,
  * this is not a big concern, hence these strategies are enabled by default.
  *
+ * \paragraph{Light subpath pool:}
+ * Tracing an emitter subpath for every sensor subpath is wasteful
+ * in scenes where connections are cheap in comparison to the random walks,
+ * e.g. in indoor scenes with fairly simple geometry. When \code{poolSize}
+ * is set, the subpaths of that many samples are first generated and kept
+ * in memory. The sampling strategies that only involve one of the two
+ * subpaths (e.g. direct illumination sampling or the light image) are
+ * evaluated as usual, whereas every sensor subpath is connected to
+ * \code{poolConnections} uniformly chosen emitter subpaths of the
+ * pool, whose contributions are averaged. This remains unbiased and uses
+ * the usual multiple importance sampling weights. The pool is not used
+ * when the sensor has a shutter time, since all subpaths
+ * of a pool must share the same time.
+ *
  * \remarks{
  *    \item This integrator does not work with dipole-style subsurface
  *    scattering models.
@@ -152,6 +175,11 @@ public:
         m_config.sampleDirect = props.getBoolean("sampleDirect", true);
         m_config.showWeighted = props.getBoolean("showWeighted", false);
 
+        /* Number of samples that share a pool of emitter subpaths (0: disabled) */
+        m_config.poolSize = props.getInteger("poolSize", 0);
+        /* Number of pooled emitter subpaths connected to every sensor subpath */
+        m_config.poolConnections = props.getInteger("poolConnections", 4);
+
         #if BDPT_DEBUG == 1
         if (m_config.maxDepth == -1 || m_config.maxDepth > 6) {
             /* Limit the maximum depth when rendering image
@@ -168,6 +196,9 @@ public:
 
         if (m_config.maxDepth <= 0 && !m_config.rr.rouletteEnabled())
             Log(EError, "Disabling russian roulette and having unlimited path length are mutually exclusive!");
+
+        if (m_config.poolSize < 0 || m_config.poolConnections <= 0)
+            Log(EError, "'poolSize' must be nonnegative and 'poolConnections' must be positive!");
     }
 
     /// Unserialize from a binary data stream
@@ -221,6 +252,13 @@ public:
         m_config.blockSize = scene->getBlockSize();
         m_config.cropSize = film->getCropSize();
         m_config.sampleCount = sampleCount;
+
+        if (m_config.poolSize > 0 && sensor->needsTimeSample()) {
+            Log(EWarn, "The light subpath pool requires all subpaths to share "
+                "the same time -- disabling it since the sensor has a shutter time.");
+            m_config.poolSize = 0;
+        }
+
         m_config.dump();
 
         ref<BDPTProcess> process = new BDPTProcess(job, queue, m_config);
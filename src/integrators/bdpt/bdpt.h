@@ -48,6 +48,7 @@ struct BDPTConfiguration {
     size_t sampleCount;
     Vector2i cropSize;
     RussianRoulette rr;
+    int poolSize, poolConnections;
 
     inline BDPTConfiguration() { }
 
@@ -59,6 +60,8 @@ struct BDPTConfiguration {
         showWeighted = stream->readBool();
         sampleCount = stream->readSize();
         cropSize = Vector2i(stream);
+        poolSize = stream->readInt();
+        poolConnections = stream->readInt();
     }
 
     inline void serialize(Stream *stream) const {
@@ -70,6 +73,8 @@ struct BDPTConfiguration {
         stream->writeBool(showWeighted);
         stream->writeSize(sampleCount);
         cropSize.serialize(stream);
+        stream->writeInt(poolSize);
+        stream->writeInt(poolConnections);
     }
 
     void dump() const {
@@ -84,6 +89,10 @@ struct BDPTConfiguration {
         SLog(EDebug, "   Russian roulette            : %s", rr.toString().c_str());
         SLog(EDebug, "   Block size                  : %i", blockSize);
         SLog(EDebug, "   Number of samples           : " SIZE_T_FMT, sampleCount);
+        if (poolSize > 0) {
+            SLog(EDebug, "   Light subpath pool size     : %i", poolSize);
+            SLog(EDebug, "   Connections per subpath     : %i", poolConnections);
+        }
         #if BDPT_DEBUG == 1
             SLog(EDebug, "   Show weighted contributions : %s", showWeighted ? "yes" : "no");
         #endif
@@ -29,6 +29,26 @@ MTS_NAMESPACE_BEGIN
 
 class BDPTRenderer : public WorkProcessor {
 public:
+    /// Classification of the (s, t) sampling strategies
+    enum EStrategy {
+        /// Strategies that only depend on the sensor subpath
+        ESensorStrategy     = 0x01,
+        /// Strategies that only depend on the emitter subpath
+        EEmitterStrategy    = 0x02,
+        /// Deterministic connections between the two subpaths
+        EConnectionStrategy = 0x04,
+        EAllStrategies      = 0x07
+    };
+
+    /// A pair of subpaths which waits for its connections in the pool
+    struct PoolEntry {
+        Path emitterSubpath;
+        Path sensorSubpath;
+        size_t poolCount = 0;
+        Point2 samplePos;
+        Spectrum sampleValue;
+    };
+
     BDPTRenderer(const BDPTConfiguration &config) : m_config(config) { }
 
     BDPTRenderer(Stream *stream, InstanceManager *manager)
@@ -61,6 +81,10 @@ public:
         m_scene->setSampler(m_sampler);
         m_scene->wakeup(NULL, m_resources);
         m_scene->initializeBidirectional();
+        if (m_config.poolSize > 0) {
+            m_poolEntries.resize(m_config.poolSize);
+            m_random = new Random();
+        }
     }
 
     void process(const WorkUnit *workUnit, WorkResult *workResult, const bool &stop) {
@@ -80,6 +104,7 @@ public:
 
         Path emitterSubpath;
         Path sensorSubpath;
+        size_t poolCount = 0;
 
         /* Determine the necessary random walk depths based on properties of
            the endpoints */
@@ -114,15 +139,43 @@ public:
                     emitterSubpath, emitterDepth, sensorSubpath,
                     sensorDepth, offset, &m_config.rr, m_pool);
 
-                evaluate(result, emitterSubpath, sensorSubpath);
+                Point2 samplePos = sensorSubpath.vertex(1)->getSamplePosition();
+                Spectrum sampleValue(0.0f);
 
-                emitterSubpath.release(m_pool);
-                sensorSubpath.release(m_pool);
+                if (m_config.poolSize == 0) {
+                    evaluate(result, emitterSubpath, sensorSubpath, sampleValue);
+                    result->putSample(samplePos, sampleValue);
+
+                    /* Nothing else lives in the pool -- release it in bulk */
+                    emitterSubpath.clear();
+                    sensorSubpath.clear();
+                    m_pool.reset();
+                } else {
+                    /* Evaluate everything that requires the sampler right
+                       away and postpone the connections */
+                    evaluate(result, emitterSubpath, sensorSubpath, sampleValue,
+                        ESensorStrategy | EEmitterStrategy);
+
+                    /* Hand the vertices over to the pool entry */
+                    PoolEntry &entry = m_poolEntries[poolCount++];
+                    entry.emitterSubpath = emitterSubpath;
+                    entry.sensorSubpath = sensorSubpath;
+                    emitterSubpath.clear();
+                    sensorSubpath.clear();
+                    entry.samplePos = samplePos;
+                    entry.sampleValue = sampleValue;
+
+                    if (poolCount == m_poolEntries.size())
+                        connectPool(result, poolCount);
+                }
 
                 m_sampler->advance();
             }
         }
 
+        if (poolCount > 0)
+            connectPool(result, poolCount);
+
         #if defined(MTS_DEBUG_FP)
             disableFPExceptions();
         #endif
@@ -131,9 +184,53 @@ public:
         Assert(m_pool.unused());
     }
 
-    /// Evaluate the contributions of the given eye and light paths
+    /**
+     * \brief Connect the sensor subpaths of the pool to randomly chosen
+     * pooled emitter subpaths, splat them and release the pool
+     */
+    void connectPool(BDPTWorkResult *wr, size_t &poolCount) {
+        Float weight = 1.0f / m_config.poolConnections;
+
+        for (size_t i=0; i<poolCount; ++i) {
+            PoolEntry &entry = m_poolEntries[i];
+            for (int j=0; j<m_config.poolConnections; ++j) {
+                PoolEntry &other = m_poolEntries[
+                    m_random->nextUInt((uint32_t) poolCount)];
+                evaluate(wr, other.emitterSubpath, entry.sensorSubpath,
+                    entry.sampleValue, EConnectionStrategy, weight);
+            }
+            wr->putSample(entry.samplePos, entry.sampleValue);
+        }
+
+        for (size_t i=0; i<poolCount; ++i) {
+            m_poolEntries[i].emitterSubpath.clear();
+            m_poolEntries[i].sensorSubpath.clear();
+        }
+        m_pool.reset();
+        poolCount = 0;
+    }
+
+    /// Return the class of the (s, t) sampling strategy
+    inline EStrategy getStrategy(int s, int t) const {
+        if (s == 0 || (m_config.sampleDirect && s == 1 && t > 1))
+            return ESensorStrategy;
+        else if (t == 0 || (m_config.sampleDirect && t == 1 && s > 1))
+            return EEmitterStrategy;
+        else
+            return EConnectionStrategy;
+    }
+
+    /**
+     * \brief Evaluate the contributions of the given eye and light paths
+     *
+     * Contributions to the pixel of the sensor subpath are accumulated in
+     * \c sampleValue, and light image contributions are splatted directly.
+     * Only the strategies in \c strategies are evaluated, and their
+     * contributions are scaled by \c weight.
+     */
     void evaluate(BDPTWorkResult *wr,
-            Path &emitterSubpath, Path &sensorSubpath) {
+            Path &emitterSubpath, Path &sensorSubpath, Spectrum &sampleValue,
+            int strategies = EAllStrategies, Float weight = 1.0f) {
         Point2 initialSamplePos = sensorSubpath.vertex(1)->getSamplePosition();
         const Scene *scene = m_scene;
         PathVertex tempEndpoint, tempSample;
@@ -156,7 +253,6 @@ public:
                 sensorSubpath.vertex(i-1)->rrWeight *
                 sensorSubpath.edge(i-1)->weight[ERadiance];
 
-        Spectrum sampleValue(0.0f);
         for (int s = (int) emitterSubpath.vertexCount()-1; s >= 0; --s) {
             /* Determine the range of sensor vertices to be traversed,
                while respecting the specified maximum path length */
@@ -166,6 +262,9 @@ public:
                 maxT = std::min(maxT, m_config.maxDepth + 1 - s);
 
             for (int t = maxT; t >= minT; --t) {
+                if (!(strategies & getStrategy(s, t)))
+                    continue;
+
                 PathVertex
                     *vsPred = emitterSubpath.vertexOrNull(s-1),
                     *vtPred = sensorSubpath.vertexOrNull(t-1),
@@ -281,6 +380,7 @@ public:
                 /* Compute the multiple importance sampling weight */
                 Float miWeight = Path::miWeight(scene, emitterSubpath, &connectionEdge,
                     sensorSubpath, s, t, m_config.sampleDirect, m_config.lightImage);
+                value *= weight;
 
                 if (sampleDirect) {
                     /* Now undo the previous change */
@@ -310,7 +410,6 @@ public:
                     wr->putLightSample(samplePos, value * miWeight);
             }
         }
-        wr->putSample(initialSamplePos, sampleValue);
     }
 
     ref<WorkProcessor> clone() const {
@@ -324,6 +423,8 @@ private:
     ref<Sampler> m_sampler;
     ref<ReconstructionFilter> m_rfilter;
     MemoryPool m_pool;
+    std::vector<PoolEntry> m_poolEntries;
+    ref<Random> m_random;
     BDPTConfiguration m_config;
     HilbertCurve2D<uint8_t> m_hilbertCurve;
 };
@@ -29,6 +29,11 @@ MTS_NAMESPACE_BEGIN
  *
  *     \parameter{rayLength}{\Float}{Specifies the world-space length of the
  *         ambient occlusion rays that will be cast. \default{\code{-1}, i.e. automatic}}.
+ *
+ *     \parameter{batchRays}{\Boolean}{Generate all occlusion rays of a
+ *         shading point at once and trace them in batches, which are sorted
+ *         by direction and traversed as coherent ray packets when Mitsuba
+ *         was compiled with coherent ray tracing support \default{\code{false}}}
  * }
  * \renderings{
  *    \rendering{A view of the scene on page \pageref{fig:rungholt}, rendered using
@@ -46,6 +51,7 @@ public:
     AmbientOcclusionIntegrator(const Properties &props) : SamplingIntegrator(props) {
         m_shadingSamples = props.getSize("shadingSamples", 1);
         m_rayLength = props.getFloat("rayLength", -1);
+        m_batchRays = props.getBoolean("batchRays", false);
     }
 
     /// Unserialize from a binary data stream
@@ -53,6 +59,7 @@ public:
      : SamplingIntegrator(stream, manager) {
         m_shadingSamples = stream->readSize();
         m_rayLength = stream->readFloat();
+        m_batchRays = stream->readBool();
         configure();
     }
 
@@ -60,6 +67,7 @@ public:
         SamplingIntegrator::serialize(stream, manager);
         stream->writeSize(m_shadingSamples);
         stream->writeFloat(m_rayLength);
+        stream->writeBool(m_batchRays);
     }
 
     void configureSampler(const Scene *scene, Sampler *sampler) {
@@ -111,12 +119,29 @@ public:
         }
 
         const Intersection &its = rRec.its;
-        for (size_t i=0; i<numShadingSamples; ++i) {
-            Vector d = its.toWorld(warp::squareToCosineHemisphere(sampleArray[i]));
+        if (m_batchRays) {
+            Ray shadowRays[MTS_KD_RAY_BATCH];
+            for (size_t i=0; i<numShadingSamples; i += MTS_KD_RAY_BATCH) {
+                size_t count = std::min(numShadingSamples - i, (size_t) MTS_KD_RAY_BATCH);
+                for (size_t j=0; j<count; ++j) {
+                    Vector d = its.toWorld(warp::squareToCosineHemisphere(sampleArray[i+j]));
+                    shadowRays[j] = Ray(its.p, d, Epsilon, m_rayLength, ray.time);
+                }
+
+                uint32_t occluded = rRec.scene->rayIntersectBatch(shadowRays, count);
+                for (size_t j=0; j<count; ++j) {
+                    if (!(occluded & (1u << j)))
+                        Li += Spectrum(1.0f);
+                }
+            }
+        } else {
+            for (size_t i=0; i<numShadingSamples; ++i) {
+                Vector d = its.toWorld(warp::squareToCosineHemisphere(sampleArray[i]));
 
-            Ray shadowRay(its.p, d, Epsilon, m_rayLength, ray.time);
-            if (!rRec.scene->rayIntersect(shadowRay))
-                Li += Spectrum(1.0f);
+                Ray shadowRay(its.p, d, Epsilon, m_rayLength, ray.time);
+                if (!rRec.scene->rayIntersect(shadowRay))
+                    Li += Spectrum(1.0f);
+            }
         }
 
         Li /= static_cast<Float>(numShadingSamples);
@@ -128,7 +153,8 @@ public:
         std::ostringstream oss;
         oss << "AmbientOcclusionIntegrator[" << endl
             << "  shadingSamples = " << m_shadingSamples << "," << endl
-            << "  rayLength = " << m_rayLength << endl
+            << "  rayLength = " << m_rayLength << "," << endl
+            << "  batchRays = " << m_batchRays << endl
             << "]";
         return oss.str();
     }
@@ -137,6 +163,7 @@ public:
 private:
     size_t m_shadingSamples;
     Float m_rayLength;
+    bool m_batchRays;
 };
 
 MTS_IMPLEMENT_CLASS_S(AmbientOcclusionIntegrator, false, SamplingIntegrator)
@@ -46,6 +46,12 @@ MTS_NAMESPACE_BEGIN
  *        See page~\pageref{sec:hideemitters} for details.
  *        \default{no, i.e. \code{false}}
  *     }
+ *     \parameter{batchRays}{\Boolean}{Generate the shadow rays of all
+ *        emitter samples of a shading point at once and trace them in
+ *        batches, which are sorted by direction and traversed as coherent
+ *        ray packets when Mitsuba was compiled with coherent ray tracing
+ *        support \default{no, i.e. \code{false}}
+ *     }
  * }
  * \vspace{-1mm}
  * \renderings{
@@ -104,6 +110,8 @@ public:
         /* When this flag is set to true, contributions from directly
          * visible emitters will not be included in the rendered image */
         m_hideEmitters = props.getBoolean("hideEmitters", false);
+        /* Trace the shadow rays of the emitter samples in batches? */
+        m_batchRays = props.getBoolean("batchRays", false);
         Assert(m_emitterSamples + m_bsdfSamples > 0);
     }
 
@@ -114,6 +122,7 @@ public:
         m_bsdfSamples = stream->readSize();
         m_strictNormals = stream->readBool();
         m_hideEmitters = stream->readBool();
+        m_batchRays = stream->readBool();
         configure();
     }
 
@@ -123,6 +132,7 @@ public:
         stream->writeSize(m_bsdfSamples);
         stream->writeBool(m_strictNormals);
         stream->writeBool(m_hideEmitters);
+        stream->writeBool(m_batchRays);
     }
 
     void configure() {
@@ -214,33 +224,42 @@ public:
         }
 
         DirectSamplingRecord dRec(its);
-        if (bsdf->getType() & BSDF::ESmooth) {
+        if ((bsdf->getType() & BSDF::ESmooth) && m_batchRays) {
+            /* Sample all emitters first and then test the visibility
+               of a whole batch of samples at once */
+            DirectSamplingRecord dRecs[MTS_KD_RAY_BATCH];
+            Spectrum values[MTS_KD_RAY_BATCH];
+            Ray shadowRays[MTS_KD_RAY_BATCH];
+            for (size_t i=0; i<numDirectSamples; i += MTS_KD_RAY_BATCH) {
+                size_t count = std::min(numDirectSamples - i, (size_t) MTS_KD_RAY_BATCH),
+                       rayCount = 0;
+                for (size_t j=0; j<count; ++j) {
+                    dRecs[rayCount] = dRec;
+                    values[rayCount] = scene->sampleEmitterDirect(
+                        dRecs[rayCount], sampleArray[i+j], false);
+                    if (values[rayCount].isZero())
+                        continue;
+                    const DirectSamplingRecord &rec = dRecs[rayCount];
+                    shadowRays[rayCount++] = Ray(rec.ref, rec.d, Epsilon,
+                        rec.dist*(1-ShadowEpsilon), rec.time);
+                }
+
+                uint32_t occluded = scene->rayIntersectBatch(shadowRays, rayCount);
+                for (size_t j=0; j<rayCount; ++j) {
+                    if (!(occluded & (1u << j)))
+                        Li += evalEmitterSample(its, bsdf, dRecs[j], values[j],
+                            fracLum, fracBSDF, weightLum);
+                }
+            }
+        } else if (bsdf->getType() & BSDF::ESmooth) {
             /* Only use direct illumination sampling when the surface's
                BSDF has smooth (i.e. non-Dirac delta) component */
             for (size_t i=0; i<numDirectSamples; ++i) {
                 /* Estimate the direct illumination if this is requested */
                 Spectrum value = scene->sampleEmitterDirect(dRec, sampleArray[i]);
-                if (!value.isZero()) {
-                    const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
-
-                    /* Allocate a record for querying the BSDF */
-                    BSDFSamplingRecord bRec(its, its.toLocal(dRec.d));
-
-                    /* Evaluate BSDF * cos(theta) */
-                    const Spectrum bsdfVal = bsdf->eval(bRec);
-
-                    if (!bsdfVal.isZero() && (!m_strictNormals
-                            || dot(its.geoFrame.n, dRec.d) * Frame::cosTheta(bRec.wo) > 0)) {
-                        /* Calculate prob. of sampling that direction using BSDF sampling */
-                        Float bsdfPdf = emitter->isOnSurface() ? bsdf->pdf(bRec) : 0;
-
-                        /* Weight using the power heuristic */
-                        const Float weight = miWeight(dRec.pdf * fracLum,
-                                bsdfPdf * fracBSDF) * weightLum;
-
-                        Li += value * bsdfVal * weight;
-                    }
-                }
+                if (!value.isZero())
+                    Li += evalEmitterSample(its, bsdf, dRec, value,
+                        fracLum, fracBSDF, weightLum);
             }
         }
 
@@ -308,6 +327,32 @@ public:
         return Li;
     }
 
+    /// Weighted contribution of an unoccluded emitter sample
+    inline Spectrum evalEmitterSample(const Intersection &its, const BSDF *bsdf,
+            const DirectSamplingRecord &dRec, const Spectrum &value,
+            Float fracLum, Float fracBSDF, Float weightLum) const {
+        const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
+
+        /* Allocate a record for querying the BSDF */
+        BSDFSamplingRecord bRec(its, its.toLocal(dRec.d));
+
+        /* Evaluate BSDF * cos(theta) */
+        const Spectrum bsdfVal = bsdf->eval(bRec);
+
+        if (bsdfVal.isZero() || (m_strictNormals
+                && dot(its.geoFrame.n, dRec.d) * Frame::cosTheta(bRec.wo) <= 0))
+            return Spectrum(0.0f);
+
+        /* Calculate prob. of sampling that direction using BSDF sampling */
+        Float bsdfPdf = emitter->isOnSurface() ? bsdf->pdf(bRec) : 0;
+
+        /* Weight using the power heuristic */
+        const Float weight = miWeight(dRec.pdf * fracLum,
+                bsdfPdf * fracBSDF) * weightLum;
+
+        return value * bsdfVal * weight;
+    }
+
     inline Float miWeight(Float pdfA, Float pdfB) const {
         pdfA *= pdfA; pdfB *= pdfB;
         return pdfA / (pdfA + pdfB);
@@ -318,7 +363,8 @@ public:
         oss << "MIDirectIntegrator[" << endl
             << "  emitterSamples = " << m_emitterSamples << "," << endl
             << "  bsdfSamples = " << m_bsdfSamples << "," << endl
-            << "  strictNormals = " << m_strictNormals << endl
+            << "  strictNormals = " << m_strictNormals << "," << endl
+            << "  batchRays = " << m_batchRays << endl
             << "]";
         return oss.str();
     }
@@ -331,6 +377,7 @@ private:
     Float m_weightBSDF, m_weightLum;
     bool m_strictNormals;
     bool m_hideEmitters;
+    bool m_batchRays;
 };
 
 MTS_IMPLEMENT_CLASS_S(MIDirectIntegrator, false, SamplingIntegrator)
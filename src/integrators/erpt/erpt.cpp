@@ -62,6 +62,12 @@ MTS_NAMESPACE_BEGIN
  *     }
  *     \parameter{lambda}{\Float}{
  *         Jump size of the manifold perturbation \default{\code{50}}}
+ *     \parameter{sharedSeeds}{\Boolean}{
+ *         Start the Markov Chains from a shared population of seed paths
+ *         that is generated once for the whole image, instead of tracing
+ *         new seed candidates for every pixel. See below for details.
+ *         \default{\code{false}}
+ *     }
  * }
  * \renderings{
  *  \rendering{A brass chandelier with 24 glass-enclosed bulbs}{integrator_mept_luminaire}
@@ -123,6 +129,19 @@ MTS_NAMESPACE_BEGIN
  * Chain is created that has an initial configuration matching the seed path.
  * It is simulated for \code{chainLength} iterations, and each intermediate
  * state is recorded in the output image.
+ *
+ * When \code{sharedSeeds} is enabled, the per-pixel candidate pools are
+ * replaced by a single population of \code{luminanceSamples} bidirectional
+ * path samples, which is generated in parallel before rendering starts and
+ * also provides the average image luminance. On average \code{numChains}
+ * chains per pixel are then started from seeds that are drawn from this
+ * population proportional to their luminance, and every work unit
+ * simulates the chains whose seeds fall into its image region. This makes
+ * the seeding phase considerably cheaper in scenes where most of the
+ * energy is carried by rare paths (e.g. caustics), since these
+ * are found once and then shared by all chains.
+ * The \code{maxChains} parameter and the sample count of the sample
+ * generator are not used in this mode.
  */
 class EnergyRedistributionPathTracing : public Integrator {
 public:
@@ -167,6 +186,10 @@ public:
         m_config.avgAngleChangeSurface = props.getFloat("avgAngleChangeSurface", 0);
         m_config.avgAngleChangeMedium = props.getFloat("avgAngleChangeMedium", 0);
 
+        /* Seed the chains from a shared initial path population instead
+           of tracing new seed candidates for every pixel */
+        m_config.sharedSeeds = props.getBoolean("sharedSeeds", false);
+
         if (m_config.maxDepth <= 0 && m_config.maxDepth != -1)
             Log(EError, "'maxDepth' must be set to -1 (infinite) or a value greater than zero!");
     }
@@ -226,14 +249,39 @@ public:
             createObject(MTS_CLASS(Sampler), Properties("independent")));
         indepSampler->configure();
 
-        Properties props;
-        RussianRoulette rr(props); // initialize default rr
-        ref<PathSampler> pathSampler = new PathSampler(PathSampler::EBidirectional, scene,
-            indepSampler, indepSampler, indepSampler, m_config.maxDepth, rr,
-            m_config.separateDirect, true, true);
+        size_t luminanceSamples = m_config.luminanceSamples, seedCount = 0;
+        if (m_config.sharedSeeds) {
+            seedCount = m_config.getSeedCount(film->getCropSize());
+            if (luminanceSamples < seedCount) {
+                luminanceSamples = m_config.luminanceSamples = seedCount;
+                Log(EWarn, "Warning: increasing number of luminance samples to " SIZE_T_FMT,
+                    luminanceSamples);
+            }
+        }
+
+        /* Estimate the image luminance (and possibly generate the
+           shared seed paths) using all workers */
+        Log(EInfo, "Integrating luminance values over the image plane ("
+                SIZE_T_FMT " samples)..", luminanceSamples);
+        ref<ERPTBootstrapProcess> bootstrap = new ERPTBootstrapProcess(
+            job, m_config, luminanceSamples, std::min(luminanceSamples / 1000,
+            nCores * 16));
+        bootstrap->bindResource("scene", sceneResID);
+        bootstrap->bindResource("sensor", sensorResID);
+
+        m_process = bootstrap;
+        sched->schedule(bootstrap);
+        sched->wait(bootstrap);
+        m_process = NULL;
+        if (bootstrap->getReturnStatus() != ParallelProcess::ESuccess)
+            return false;
+
+        std::vector<ERPTSeed> seeds;
+        m_config.luminance = bootstrap->getLuminance();
+        if (m_config.sharedSeeds)
+            bootstrap->generateSeeds(seedCount, seeds);
+        bootstrap = NULL;
 
-        m_config.luminance = pathSampler->computeAverageLuminance(
-                m_config.luminanceSamples);
         m_config.blockSize = scene->getBlockSize();
 
         m_config.dump();
@@ -246,7 +294,9 @@ public:
                 return false;
         }
 
-        ref<ERPTProcess> process = new ERPTProcess(job, queue, m_config, directImage);
+        ref<ERPTProcess> process = new ERPTProcess(job, queue, m_config,
+            directImage, seeds);
+        seeds.clear();
 
         /* Create an independent sampler for use by the MLT chains */
         std::vector<SerializableObject *> indepSamplers(sched->getCoreCount());
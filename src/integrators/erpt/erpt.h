@@ -51,9 +51,16 @@ struct ERPTConfiguration {
     Float avgAngleChangeSurface;
     Float avgAngleChangeMedium;
     int maxChains;
+    bool sharedSeeds;
 
     inline ERPTConfiguration() { }
 
+    /// Number of chains started from the shared initial path population
+    inline size_t getSeedCount(const Vector2i &cropSize) const {
+        return std::max((size_t) 1, (size_t) ((double) numChains
+            * cropSize.x * cropSize.y + 0.5));
+    }
+
     void dump() const {
         std::ostringstream oss;
         if (bidirectionalMutation)
@@ -70,6 +77,7 @@ struct ERPTConfiguration {
         SLog(EDebug, "   Maximum path length         : %i", maxDepth);
         SLog(EDebug, "   Chain length                : " SIZE_T_FMT, chainLength);
         SLog(EDebug, "   Average number of chains    : %f", numChains);
+        SLog(EDebug, "   Shared seed paths           : %s", sharedSeeds ? "yes" : "no");
         SLog(EDebug, "   Separate direct illum.      : %s",
             separateDirect ? formatString("%i samples", directSamples).c_str() : "no");
         SLog(EDebug, "   Active mutators             : %s", oss.str().c_str());
@@ -100,6 +108,7 @@ struct ERPTConfiguration {
         avgAngleChangeSurface = stream->readFloat();
         avgAngleChangeMedium = stream->readFloat();
         maxChains = stream->readInt();
+        sharedSeeds = stream->readBool();
     }
 
     inline void serialize(Stream *stream) const {
@@ -120,6 +129,62 @@ struct ERPTConfiguration {
         stream->writeFloat(avgAngleChangeSurface);
         stream->writeFloat(avgAngleChangeMedium);
         stream->writeInt(maxChains);
+        stream->writeBool(sharedSeeds);
+    }
+};
+
+/**
+ * \brief Seed path of an ERPT chain, which is taken from the shared
+ * initial path population
+ *
+ * Every bootstrap work unit draws its samples from a separate
+ * \ref ReplayableSampler stream, which is seeded with the index of the
+ * unit's first sample. A seed path can therefore be reconstructed from the
+ * stream identifier, a sample index within that stream and the
+ * sampling strategy that produced it.
+ */
+struct ERPTSeed {
+    size_t stream;      ///< Seed value of the replayable random number stream
+    size_t sampleIndex; ///< Index into that stream
+    Float luminance;    ///< Luminance value of the path (for sanity checks)
+    int s;              ///< Number of steps from the luminaire
+    int t;              ///< Number of steps from the eye
+    Point2 position;    ///< Position of the path on the image plane
+
+    inline ERPTSeed() { }
+
+    inline ERPTSeed(size_t stream, size_t sampleIndex, Float luminance,
+            int s, int t, const Point2 &position)
+        : stream(stream), sampleIndex(sampleIndex), luminance(luminance),
+          s(s), t(t), position(position) { }
+
+    inline ERPTSeed(Stream *stream) {
+        this->stream = stream->readSize();
+        sampleIndex = stream->readSize();
+        luminance = stream->readFloat();
+        s = stream->readInt();
+        t = stream->readInt();
+        position = Point2(stream);
+    }
+
+    inline void serialize(Stream *stream) const {
+        stream->writeSize(this->stream);
+        stream->writeSize(sampleIndex);
+        stream->writeFloat(luminance);
+        stream->writeInt(s);
+        stream->writeInt(t);
+        position.serialize(stream);
+    }
+
+    /// Order by stream and position to avoid unnecessary rewinds
+    inline bool operator<(const ERPTSeed &seed) const {
+        if (stream != seed.stream)
+            return stream < seed.stream;
+        if (sampleIndex != seed.sampleIndex)
+            return sampleIndex < seed.sampleIndex;
+        if (s != seed.s)
+            return s < seed.s;
+        return t < seed.t;
     }
 };
 
@@ -22,6 +22,7 @@
 #include <mitsuba/bidir/mut_mchain.h>
 #include <mitsuba/bidir/mut_manifold.h>
 #include <mitsuba/bidir/pathsampler.h>
+#include <mitsuba/bidir/rsampler.h>
 #include <mitsuba/bidir/util.h>
 #include <mitsuba/core/sfcurve.h>
 #include <boost/bind.hpp>
@@ -36,6 +37,244 @@ static StatsCounter statsAccepted("Energy redistribution path tracing",
 static StatsCounter statsChainsPerPixel("Energy redistribution path tracing",
         "Chains started per pixel", EAverage);
 
+/* ==================================================================== */
+/*                     Work unit and result impl.                       */
+/* ==================================================================== */
+
+void ERPTWorkUnit::set(const WorkUnit *wu) {
+    RectangularWorkUnit::set(wu);
+    m_seeds = static_cast<const ERPTWorkUnit *>(wu)->m_seeds;
+}
+
+void ERPTWorkUnit::load(Stream *stream) {
+    RectangularWorkUnit::load(stream);
+    m_seeds.resize(stream->readSize());
+    for (size_t i=0; i<m_seeds.size(); ++i)
+        m_seeds[i] = ERPTSeed(stream);
+}
+
+void ERPTWorkUnit::save(Stream *stream) const {
+    RectangularWorkUnit::save(stream);
+    stream->writeSize(m_seeds.size());
+    for (size_t i=0; i<m_seeds.size(); ++i)
+        m_seeds[i].serialize(stream);
+}
+
+std::string ERPTWorkUnit::toString() const {
+    std::ostringstream oss;
+    oss << "ERPTWorkUnit[offset=" << getOffset().toString()
+        << ", size=" << getSize().toString()
+        << ", seeds=" << m_seeds.size() << "]";
+    return oss.str();
+}
+
+void ERPTBootstrapResult::load(Stream *stream) {
+    m_seeds.resize(stream->readSize());
+    for (size_t i=0; i<m_seeds.size(); ++i)
+        m_seeds[i] = ERPTSeed(stream);
+    m_sampleCount = stream->readSize();
+    m_luminance = stream->readDouble();
+    m_luminanceSqr = stream->readDouble();
+}
+
+void ERPTBootstrapResult::save(Stream *stream) const {
+    stream->writeSize(m_seeds.size());
+    for (size_t i=0; i<m_seeds.size(); ++i)
+        m_seeds[i].serialize(stream);
+    stream->writeSize(m_sampleCount);
+    stream->writeDouble(m_luminance);
+    stream->writeDouble(m_luminanceSqr);
+}
+
+std::string ERPTBootstrapResult::toString() const {
+    std::ostringstream oss;
+    oss << "ERPTBootstrapResult[seeds=" << m_seeds.size()
+        << ", sampleCount=" << m_sampleCount << "]";
+    return oss.str();
+}
+
+/* ==================================================================== */
+/*                        Bootstrap implementation                      */
+/* ==================================================================== */
+
+class ERPTBootstrapWorker : public WorkProcessor {
+public:
+    ERPTBootstrapWorker(const ERPTConfiguration &conf)
+        : m_config(conf) {
+    }
+
+    ERPTBootstrapWorker(Stream *stream, InstanceManager *manager)
+        : WorkProcessor(stream, manager) {
+        m_config = ERPTConfiguration(stream);
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        m_config.serialize(stream);
+    }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new RangeWorkUnit();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new ERPTBootstrapResult();
+    }
+
+    void prepare() {
+        Scene *scene = static_cast<Scene *>(getResource("scene"));
+        m_sensor = static_cast<Sensor *>(getResource("sensor"));
+        m_rplSampler = new ReplayableSampler();
+        m_scene = new Scene(scene);
+        m_scene->setSensor(m_sensor);
+        m_scene->setSampler(m_rplSampler);
+        m_scene->removeSensor(scene->getSensor());
+        m_scene->addSensor(m_sensor);
+        m_scene->setSensor(m_sensor);
+        m_scene->wakeup(NULL, m_resources);
+        m_scene->initializeBidirectional();
+
+        /* Must match the path sampler of ERPTRenderer, since
+           seed paths are reconstructed from the same streams */
+        Properties props;
+        RussianRoulette rr(props); // initialize default rr
+        m_pathSampler = new PathSampler(PathSampler::EBidirectional, m_scene,
+            m_rplSampler, m_rplSampler, m_rplSampler, m_config.maxDepth, rr,
+            m_config.separateDirect, true, true);
+    }
+
+    void seedCallback(int s, int t, Float weight, Path &path) {
+        m_luminance += weight;
+        if (m_config.sharedSeeds && weight > 0)
+            m_result->put(ERPTSeed(m_stream, m_sampleIndex, weight,
+                s, t, path.getSamplePosition()));
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult, const bool &stop) {
+        const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+        m_result = static_cast<ERPTBootstrapResult *>(workResult);
+        m_result->clear();
+
+        /* Every unit uses its own stream, which starts at the beginning */
+        m_stream = range->getRangeStart();
+        m_rplSampler->setSeed(m_stream);
+
+        PathSampler::PathCallback callback = boost::bind(
+            &ERPTBootstrapWorker::seedCallback, this, _1, _2, _3, _4);
+
+        for (size_t i=0; i<range->getSize() && !stop; ++i) {
+            m_sampleIndex = m_rplSampler->getSampleIndex();
+            m_luminance = 0;
+            m_pathSampler->samplePaths(Point2i(-1), callback);
+            m_result->addSample(m_luminance);
+        }
+        m_result = NULL;
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new ERPTBootstrapWorker(m_config);
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    ERPTConfiguration m_config;
+    ref<Scene> m_scene;
+    ref<Sensor> m_sensor;
+    ref<PathSampler> m_pathSampler;
+    ref<ReplayableSampler> m_rplSampler;
+    ERPTBootstrapResult *m_result;
+    size_t m_stream, m_sampleIndex;
+    Float m_luminance;
+};
+
+ERPTBootstrapProcess::ERPTBootstrapProcess(const RenderJob *parent,
+    const ERPTConfiguration &conf, size_t sampleCount, size_t streamCount)
+        : m_config(conf), m_sampleCount(sampleCount) {
+    m_streamCount = std::max(std::min(streamCount, sampleCount), (size_t) 1);
+    m_streamSize = (sampleCount + m_streamCount - 1) / m_streamCount;
+    m_streamCount = (sampleCount + m_streamSize - 1) / m_streamSize;
+    m_resultMutex = new Mutex();
+    m_workCounter = m_resultCounter = m_samplesTaken = 0;
+    m_luminance = m_luminanceSqr = 0;
+    m_progress = new ProgressReporter("Bootstrapping", m_streamCount, parent);
+    m_timer = new Timer();
+}
+
+ERPTBootstrapProcess::~ERPTBootstrapProcess() {
+    delete m_progress;
+}
+
+ref<WorkProcessor> ERPTBootstrapProcess::createWorkProcessor() const {
+    return new ERPTBootstrapWorker(m_config);
+}
+
+ParallelProcess::EStatus ERPTBootstrapProcess::generateWork(
+        WorkUnit *unit, int worker) {
+    if (m_workCounter >= m_streamCount)
+        return EFailure;
+
+    size_t start = m_workCounter++ * m_streamSize;
+    size_t end = std::min(start + m_streamSize, m_sampleCount) - 1;
+    static_cast<RangeWorkUnit *>(unit)->setRange(start, end);
+    return ESuccess;
+}
+
+void ERPTBootstrapProcess::processResult(const WorkResult *wr, bool cancelled) {
+    const ERPTBootstrapResult *result =
+        static_cast<const ERPTBootstrapResult *>(wr);
+    LockGuard lock(m_resultMutex);
+    const std::vector<ERPTSeed> &seeds = result->getSeeds();
+    m_candidates.insert(m_candidates.end(), seeds.begin(), seeds.end());
+    m_samplesTaken += result->getSampleCount();
+    m_luminance += result->getLuminance();
+    m_luminanceSqr += result->getLuminanceSqr();
+    m_progress->update(++m_resultCounter);
+}
+
+Float ERPTBootstrapProcess::getLuminance() {
+    LockGuard lock(m_resultMutex);
+    if (m_samplesTaken == 0)
+        Log(EError, "No luminance samples were taken!");
+
+    double mean = m_luminance / m_samplesTaken;
+    double variance = m_samplesTaken > 1 ? std::max((double) 0.0,
+        (m_luminanceSqr - m_samplesTaken * mean * mean) / (m_samplesTaken-1)) : 0.0;
+
+    Log(EInfo, "Done -- average luminance value = %f, stddev = %f (took %i ms, "
+        SIZE_T_FMT " streams)", mean, std::sqrt(variance),
+        m_timer->getMilliseconds(), m_streamCount);
+
+    if (mean == 0)
+        Log(EError, "The average image luminance appears to be zero! This could indicate "
+            "a problem with the scene setup. Aborting the rendering process.");
+
+    return (Float) mean;
+}
+
+void ERPTBootstrapProcess::generateSeeds(size_t seedCount,
+        std::vector<ERPTSeed> &seeds) {
+    LockGuard lock(m_resultMutex);
+    Log(EDebug, "Sampling " SIZE_T_FMT "/" SIZE_T_FMT " ERPT seeds",
+        seedCount, m_candidates.size());
+
+    /* Results arrive in an arbitrary order -- sort them to make
+       the choice of seeds independent of the scheduling */
+    std::sort(m_candidates.begin(), m_candidates.end());
+
+    DiscreteDistribution seedPDF(m_candidates.size());
+    for (size_t i=0; i<m_candidates.size(); ++i)
+        seedPDF.append(m_candidates[i].luminance);
+    seedPDF.normalize();
+
+    ref<Random> random = new Random();
+    seeds.clear();
+    seeds.reserve(seedCount);
+    for (size_t i=0; i<seedCount; ++i)
+        seeds.push_back(m_candidates.at(seedPDF.sample(random->nextFloat())));
+
+    /* Sort the seeds to avoid unnecessary rewinds in the ReplayableSampler */
+    std::sort(seeds.begin(), seeds.end());
+}
+
 /* ==================================================================== */
 /*                      Worker result implementation                    */
 /* ==================================================================== */
@@ -68,11 +307,11 @@ public:
 class ERPTRenderer : public WorkProcessor {
 public:
     ERPTRenderer(const ERPTConfiguration &conf)
-        : m_config(conf) {
+        : m_config(conf), m_seedPath(NULL) {
     }
 
     ERPTRenderer(Stream *stream, InstanceManager *manager)
-        : WorkProcessor(stream, manager) {
+        : WorkProcessor(stream, manager), m_seedPath(NULL) {
         m_config = ERPTConfiguration(stream);
     }
 
@@ -81,7 +320,7 @@ public:
     }
 
     ref<WorkUnit> createWorkUnit() const {
-        return new RectangularWorkUnit();
+        return new ERPTWorkUnit();
     }
 
     ref<WorkResult> createWorkResult() const {
@@ -111,6 +350,17 @@ public:
 
         m_pool = &m_pathSampler->getMemoryPool();
 
+        if (m_config.sharedSeeds) {
+            /* Seed paths are reconstructed by replaying the random
+               number streams of the bootstrap phase */
+            m_rplSampler = new ReplayableSampler();
+            m_rplStream = std::numeric_limits<size_t>::max();
+            m_seedSampler = new PathSampler(PathSampler::EBidirectional, m_scene,
+                m_rplSampler, m_rplSampler, m_rplSampler, m_config.maxDepth, rr,
+                m_config.separateDirect, true, true);
+            m_seedPath = new Path();
+        }
+
         /* Jump sizes recommended by Eric Veach */
         Float minJump = 0.1f, coveredArea = 0.05f;
 
@@ -172,6 +422,11 @@ public:
         Float depositionEnergy = weight / (m_sampler->getSampleCount()
                 * meanChains * m_config.chainLength);
 
+        runChains(path, numChains, depositionEnergy, stop);
+    }
+
+    /// Start \c numChains Markov chains from \c path
+    void runChains(Path &path, int numChains, Float depositionEnergy, const bool *stop) {
         DiscreteDistribution suitabilities(m_mutators.size());
         std::ostringstream oss;
         Spectrum relWeight(0.0f);
@@ -298,8 +553,15 @@ public:
         m_result->origOffset = rect->getOffset();
         m_result->origSize = rect->getSize();
 
-        m_hilbertCurve.initialize(TVector2<uint8_t>(rect->getSize()));
         m_result->clear();
+
+        if (m_config.sharedSeeds) {
+            processSeeds(static_cast<const ERPTWorkUnit *>(workUnit), stop);
+            m_result = NULL;
+            return;
+        }
+
+        m_hilbertCurve.initialize(TVector2<uint8_t>(rect->getSize()));
         boost::function<void (int, int, Float, Path &)> callback
             = boost::bind(&ERPTRenderer::pathCallback, this, _1, _2, _3, _4, &stop);
 
@@ -323,17 +585,56 @@ public:
         m_result = NULL;
     }
 
+    /// Run one chain for each seed from the shared path population
+    void processSeeds(const ERPTWorkUnit *wu, const bool &stop) {
+        const std::vector<ERPTSeed> &seeds = wu->getSeeds();
+        Vector2i cropSize = m_sensor->getFilm()->getCropSize();
+        MemoryPool &seedPool = m_seedSampler->getMemoryPool();
+
+        /* Seeds were chosen proportional to their luminance, hence
+           every chain carries the same share of the image luminance */
+        Float depositionEnergy = m_config.luminance * cropSize.x * cropSize.y
+            / (m_config.getSeedCount(cropSize) * m_config.chainLength);
+
+        statsChainsPerPixel.incrementBase(wu->getSize().x * wu->getSize().y);
+
+        for (size_t i=0; i<seeds.size() && !stop; ++i) {
+            const ERPTSeed &seed = seeds[i];
+            if (seed.stream != m_rplStream) {
+                m_rplSampler->setSeed(seed.stream);
+                m_rplStream = seed.stream;
+            }
+
+            m_seedSampler->reconstructPath(PathSeed(seed.sampleIndex,
+                seed.luminance, seed.s, seed.t), NULL, *m_seedPath);
+            runChains(*m_seedPath, 1, depositionEnergy, &stop);
+            m_seedPath->release(seedPool);
+        }
+
+        if (!m_pool->unused() || !seedPool.unused())
+            Log(EError, "Internal error: detected a memory pool leak!");
+    }
+
     ref<WorkProcessor> clone() const {
         return new ERPTRenderer(m_config);
     }
 
     MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~ERPTRenderer() {
+        if (m_seedPath)
+            delete m_seedPath;
+    }
 private:
     ERPTConfiguration m_config;
     ref<Sensor> m_sensor;
     ref<Scene> m_scene;
     ref<Sampler> m_sampler, m_indepSampler;
-    ref<PathSampler> m_pathSampler;
+    ref<PathSampler> m_pathSampler, m_seedSampler;
+    ref<ReplayableSampler> m_rplSampler;
+    size_t m_rplStream;
+    Path *m_seedPath;
     ref_vector<Mutator> m_mutators;
     HilbertCurve2D<uint8_t> m_hilbertCurve;
     ERPTWorkResult *m_result;
@@ -345,8 +646,10 @@ private:
 /* ==================================================================== */
 
 ERPTProcess::ERPTProcess(const RenderJob *job, RenderQueue *queue,
-    const ERPTConfiguration &conf, const Bitmap *directImage)
-    : BlockedRenderProcess(job, queue, conf.blockSize), m_job(job), m_config(conf) {
+    const ERPTConfiguration &conf, const Bitmap *directImage,
+    const std::vector<ERPTSeed> &seeds)
+    : BlockedRenderProcess(job, queue, conf.blockSize), m_job(job),
+      m_config(conf), m_seeds(seeds) {
     m_directImage = directImage;
 }
 
@@ -379,9 +682,35 @@ void ERPTProcess::bindResource(const std::string &name, int id) {
 
         m_accum = new ImageBlock(Bitmap::ESpectrum, film->getCropSize());
         m_accum->clear();
+
+        /* Sort the shared seeds into the image blocks that contain them */
+        m_seedBins.clear();
+        m_seedBins.resize(m_numBlocks.x * m_numBlocks.y);
+        for (size_t i=0; i<m_seeds.size(); ++i) {
+            const Point2 &p = m_seeds[i].position;
+            int x = math::clamp(math::floorToInt(p.x - m_offset.x) / m_blockSize, 0, m_numBlocks.x-1),
+                y = math::clamp(math::floorToInt(p.y - m_offset.y) / m_blockSize, 0, m_numBlocks.y-1);
+            m_seedBins[x + y * m_numBlocks.x].push_back(m_seeds[i]);
+        }
+        m_seeds.clear();
     }
 }
 
+ParallelProcess::EStatus ERPTProcess::generateWork(WorkUnit *unit, int worker) {
+    EStatus status = BlockedRenderProcess::generateWork(unit, worker);
+    if (status != ESuccess || m_seedBins.empty())
+        return status;
+
+    ERPTWorkUnit *wu = static_cast<ERPTWorkUnit *>(unit);
+    Point2i block = Point2i((wu->getOffset() - m_offset) / m_blockSize);
+    wu->getSeeds().swap(m_seedBins[block.x + block.y * m_numBlocks.x]);
+    return status;
+}
+
+MTS_IMPLEMENT_CLASS(ERPTWorkUnit, false, RectangularWorkUnit)
+MTS_IMPLEMENT_CLASS(ERPTBootstrapResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(ERPTBootstrapWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(ERPTBootstrapProcess, false, ParallelProcess)
 MTS_IMPLEMENT_CLASS_S(ERPTRenderer, false, WorkProcessor)
 MTS_IMPLEMENT_CLASS(ERPTProcess, false, BlockedRenderProcess)
 
@@ -21,6 +21,8 @@
 
 #include <mitsuba/render/renderproc.h>
 #include <mitsuba/render/renderjob.h>
+#include <mitsuba/render/rectwu.h>
+#include <mitsuba/render/range.h>
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/bitmap.h>
 #include "erpt.h"
@@ -28,13 +30,139 @@
 MTS_NAMESPACE_BEGIN
 
 /* ==================================================================== */
-/*                           Parallel process                           */
+/*                        Work units and results                        */
 /* ==================================================================== */
 
+/**
+ * \brief ERPT work unit -- a rectangular image region along with the
+ * seed paths from the shared population that fall into it
+ *
+ * The seed list is empty unless \c sharedSeeds is enabled.
+ */
+class ERPTWorkUnit : public RectangularWorkUnit {
+public:
+    inline ERPTWorkUnit() { }
+
+    /* WorkUnit implementation */
+    void set(const WorkUnit *wu);
+    void load(Stream *stream);
+    void save(Stream *stream) const;
+
+    inline const std::vector<ERPTSeed> &getSeeds() const { return m_seeds; }
+    inline std::vector<ERPTSeed> &getSeeds() { return m_seeds; }
+
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~ERPTWorkUnit() { }
+private:
+    std::vector<ERPTSeed> m_seeds;
+};
+
+/**
+ * \brief Result of a bootstrap work unit: the candidate seed paths
+ * with a nonzero luminance and the statistics of all samples
+ */
+class ERPTBootstrapResult : public WorkResult {
+public:
+    inline ERPTBootstrapResult() { clear(); }
+
+    inline void clear() {
+        m_seeds.clear();
+        m_sampleCount = 0;
+        m_luminance = m_luminanceSqr = 0;
+    }
+
+    inline void put(const ERPTSeed &seed) {
+        m_seeds.push_back(seed);
+    }
+
+    inline void addSample(Float luminance) {
+        m_luminance += luminance;
+        m_luminanceSqr += (double) luminance * (double) luminance;
+        m_sampleCount++;
+    }
+
+    inline const std::vector<ERPTSeed> &getSeeds() const { return m_seeds; }
+    inline size_t getSampleCount() const { return m_sampleCount; }
+    inline double getLuminance() const { return m_luminance; }
+    inline double getLuminanceSqr() const { return m_luminanceSqr; }
+
+    void load(Stream *stream);
+    void save(Stream *stream) const;
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~ERPTBootstrapResult() { }
+private:
+    std::vector<ERPTSeed> m_seeds;
+    size_t m_sampleCount;
+    double m_luminance, m_luminanceSqr;
+};
+
+/* ==================================================================== */
+/*                           Parallel processes                         */
+/* ==================================================================== */
+
+/**
+ * \brief Estimates the average image luminance using all available
+ * workers and optionally collects the shared initial path population
+ *
+ * The samples are split into several replayable random number streams,
+ * which are processed independently. When \c sharedSeeds is enabled,
+ * every path with a nonzero contribution is kept as a seed candidate,
+ * and the chain seeds are afterwards chosen proportional to luminance.
+ */
+class ERPTBootstrapProcess : public ParallelProcess {
+public:
+    ERPTBootstrapProcess(const RenderJob *parent,
+        const ERPTConfiguration &config, size_t sampleCount,
+        size_t streamCount);
+
+    /// Return the average luminance of a sample
+    Float getLuminance();
+
+    /**
+     * \brief Resample \c seedCount chain seeds from the collected
+     * candidates
+     */
+    void generateSeeds(size_t seedCount, std::vector<ERPTSeed> &seeds);
+
+    /* ParallelProcess impl. */
+    void processResult(const WorkResult *wr, bool cancelled);
+    ref<WorkProcessor> createWorkProcessor() const;
+    EStatus generateWork(WorkUnit *unit, int worker);
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~ERPTBootstrapProcess();
+private:
+    const ERPTConfiguration &m_config;
+    ProgressReporter *m_progress;
+    std::vector<ERPTSeed> m_candidates;
+    ref<Mutex> m_resultMutex;
+    size_t m_sampleCount, m_streamCount, m_streamSize;
+    size_t m_workCounter, m_resultCounter, m_samplesTaken;
+    double m_luminance, m_luminanceSqr;
+    ref<Timer> m_timer;
+};
+
 class ERPTProcess : public BlockedRenderProcess {
 public:
+    /**
+     * \param seeds
+     *    Chain seeds from the shared initial path population. These are
+     *    handed to the work units whose image region contains them. Only
+     *    used when \c sharedSeeds is enabled.
+     */
     ERPTProcess(const RenderJob *parent, RenderQueue *queue,
-        const ERPTConfiguration &config, const Bitmap *directImage);
+        const ERPTConfiguration &config, const Bitmap *directImage,
+        const std::vector<ERPTSeed> &seeds = std::vector<ERPTSeed>());
 
     void develop();
 
@@ -42,6 +170,7 @@ public:
     void processResult(const WorkResult *wr, bool cancelled);
     ref<WorkProcessor> createWorkProcessor() const;
     void bindResource(const std::string &name, int id);
+    EStatus generateWork(WorkUnit *unit, int worker);
 
     MTS_DECLARE_CLASS()
 protected:
@@ -52,6 +181,8 @@ private:
     ERPTConfiguration m_config;
     ref<const Bitmap> m_directImage;
     ref<ImageBlock> m_accum;
+    std::vector<ERPTSeed> m_seeds;
+    std::vector<std::vector<ERPTSeed> > m_seedBins;
 };
 
 MTS_NAMESPACE_END
@@ -18,7 +18,9 @@
 
 #include <mitsuba/render/scene.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/render/renderproc.h>
 #include <boost/math/distributions/normal.hpp>
+#include <boost/bind.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -40,6 +42,15 @@ MTS_NAMESPACE_BEGIN
  *         the \code{sampler}, this means that the adaptive integrator
  *         will give up after 32*64=2048 samples}
  *     }
+ *     \parameter{progressive}{\Boolean}{
+ *         Render progressive passes of \code{sampleCount} samples per pixel
+ *         instead of sampling each pixel until it has converged. The sample
+ *         statistics of all pixels are kept across the passes, and every pass
+ *         only renders the pixels that have not converged yet, starting with the
+ *         image blocks that have the largest error. This keeps all cores busy
+ *         on the difficult image regions. In this mode, \code{maxSampleFactor}
+ *         limits the number of passes. \default{\code{false}}
+ *     }
  * }
  *
  * This ``meta-integrator'' repeatedly invokes a provided sub-integrator
@@ -78,6 +89,8 @@ public:
         /* Required P-value to accept a sample. */
         m_pValue = props.getFloat("pValue", 0.05f);
         m_verbose = props.getBoolean("verbose", false);
+        /* Render progressive passes that only revisit unconverged pixels? */
+        m_progressive = props.getBoolean("progressive", false);
     }
 
     AdaptiveIntegrator(Stream *stream, InstanceManager *manager)
@@ -88,6 +101,7 @@ public:
         m_quantile = stream->readFloat();
         m_averageLuminance = stream->readFloat();
         m_pValue = stream->readFloat();
+        m_progressive = stream->readBool();
         m_verbose = false;
     }
 
@@ -177,6 +191,12 @@ public:
             Log(EError, "Starting the adaptive integrator with less than 8 "
                 "samples per pixel does not make much sense -- giving up.");
 
+        if (m_progressive) {
+            renderPass(scene, sensor, sampler,
+                static_cast<AdaptiveWorkResult *>(block), stop, points);
+            return;
+        }
+
         RayDifferential eyeRay;
         RadianceQueryRecord rRec(scene, sampler);
 
@@ -284,6 +304,97 @@ public:
         }
     }
 
+    bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        if (!m_progressive)
+            return SamplingIntegrator::render(scene, queue, job,
+                sceneResID, sensorResID, samplerResID);
+
+        /* Per-pixel statistics: sample count, luminance sum and sum of squares */
+        return AdaptiveRenderProcess::render(this, m_process, scene, queue,
+            job, sceneResID, sensorResID, samplerResID, 3, m_maxSampleFactor,
+            boost::bind(&AdaptiveIntegrator::pixelError, this, _1));
+    }
+
+    /// Relative error of a pixel in progressive mode (converged when <= 1)
+    Float pixelError(const double *stats) const {
+        double n = stats[0];
+        if (n < 2)
+            return std::numeric_limits<Float>::infinity();
+
+        /* Variance of the primary estimator */
+        double mean = stats[1] / n;
+        double variance = std::max(0.0, (stats[2] - n*mean*mean) / (n-1));
+
+        /* Half width of the confidence interval */
+        Float ciWidth = (Float) std::sqrt(variance / n) * m_quantile;
+
+        /* Relative error heuristic */
+        Float base = std::max((Float) mean, m_averageLuminance * 0.01f);
+
+        if (ciWidth <= m_maxError * base)
+            return 0.0f;
+        return ciWidth / (m_maxError * base);
+    }
+
+    /**
+     * \brief Render one progressive pass over the unconverged pixels of a block
+     *
+     * Every pixel receives the configured number of pixel samples, whose
+     * luminance statistics are added to the work result.
+     */
+    void renderPass(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, AdaptiveWorkResult *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points) const {
+        bool needsApertureSample = sensor->needsApertureSample();
+        bool needsTimeSample = sensor->needsTimeSample();
+
+        RayDifferential eyeRay;
+        RadianceQueryRecord rRec(scene, sampler);
+
+        Float diffScaleFactor = 1.0f /
+            std::sqrt((Float) sampler->getSampleCount());
+
+        Point2 apertureSample(0.5f);
+        Float timeSample = 0.5f;
+        block->clear();
+
+        for (size_t i=0; i<points.size(); ++i) {
+            Point2i offset = Point2i(points[i]) + Vector2i(block->getOffset());
+            double *stats = block->getStatistics(points[i].x, points[i].y);
+            sampler->generate(offset);
+
+            for (size_t j = 0; j<sampler->getSampleCount(); j++) {
+                if (stop)
+                    return;
+
+                rRec.newQuery(RadianceQueryRecord::ESensorRay, sensor->getMedium());
+                rRec.extra = RadianceQueryRecord::EAdaptiveQuery;
+
+                Point2 samplePos(Point2(offset) + Vector2(rRec.nextSample2D()));
+                if (needsApertureSample)
+                    apertureSample = rRec.nextSample2D();
+                if (needsTimeSample)
+                    timeSample = rRec.nextSample1D();
+
+                Spectrum sampleValue = sensor->sampleRayDifferential(
+                    eyeRay, samplePos, apertureSample, timeSample);
+                eyeRay.scaleDifferential(diffScaleFactor);
+
+                sampleValue *= m_subIntegrator->Li(eyeRay, rRec);
+
+                Float sampleLuminance = 0.0f;
+                if (block->put(samplePos, sampleValue, rRec.alpha))
+                    sampleLuminance = sampleValue.getLuminance();
+
+                stats[0] += 1;
+                stats[1] += sampleLuminance;
+                stats[2] += (double) sampleLuminance * (double) sampleLuminance;
+                sampler->advance();
+            }
+        }
+    }
+
     Spectrum Li(const RayDifferential &ray, RadianceQueryRecord &rRec) const {
         return m_subIntegrator->Li(ray, rRec);
     }
@@ -303,6 +414,7 @@ public:
         stream->writeFloat(m_quantile);
         stream->writeFloat(m_averageLuminance);
         stream->writeFloat(m_pValue);
+        stream->writeBool(m_progressive);
     }
 
     void bindUsedResources(ParallelProcess *proc) const {
@@ -332,6 +444,7 @@ public:
             << "  maxError = " << m_maxError << "," << endl
             << "  quantile = " << m_quantile << "," << endl
             << "  pvalue = " << m_pValue << "," << endl
+            << "  progressive = " << m_progressive << "," << endl
             << "  subIntegrator = " << indent(m_subIntegrator->toString()) << endl
             << "]";
         return oss.str();
@@ -343,6 +456,7 @@ private:
     Float m_maxError, m_quantile, m_pValue, m_averageLuminance;
     int m_maxSampleFactor;
     bool m_verbose;
+    bool m_progressive;
 };
 
 MTS_IMPLEMENT_CLASS_S(AdaptiveIntegrator, false, SamplingIntegrator)
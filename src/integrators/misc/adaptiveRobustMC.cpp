@@ -19,7 +19,9 @@
 #include <mitsuba/render/scene.h>
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/util.h>
+#include <mitsuba/render/renderproc.h>
 #include <boost/math/distributions/normal.hpp>
+#include <boost/bind.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -47,6 +49,15 @@ MTS_NAMESPACE_BEGIN
  *         highest sub-estimate. Note: the sample count given in the 
  *         sub-integrator is for each such sub-estimate. \default{10}
  *     }
+ *     \parameter{progressive}{\Boolean}{
+ *         Render progressive passes of roughly \code{sampleCount} samples per
+ *         pixel instead of sampling each pixel until it has converged. The batch
+ *         statistics of all pixels are kept across the passes, and every pass
+ *         only renders the pixels that have not converged yet, starting with the
+ *         image blocks that have the largest error. The image is only developed
+ *         after the last pass. In this mode, \code{maxSampleFactor} limits the
+ *         number of passes. \default{\code{false}}
+ *     }
  * }
  *
  * This ``meta-integrator'' repeatedly invokes a provided sub-integrator
@@ -102,6 +113,9 @@ public:
         if (m_numBatches < 4)
             Log(EError, "Need at least 4 batches, but got " SIZE_T_FMT, m_numBatches);
         m_verbose = props.getBoolean("verbose", false);
+        /* Render progressive passes that only revisit unconverged pixels? */
+        m_progressive = props.getBoolean("progressive", false);
+        configure();
     }
 
     AdaptiveIntegratorRobustMC(Stream *stream, InstanceManager *manager)
@@ -113,7 +127,18 @@ public:
         m_averageLuminance = stream->readFloat();
         m_pValue = stream->readFloat();
         m_numBatches = stream->readSize();
+        m_progressive = stream->readBool();
         m_verbose = false;
+        configure();
+    }
+
+    /// Precompute the contribution of every spectral channel to the luminance
+    void configure() {
+        for (int k = 0; k < SPECTRUM_SAMPLES; k++) {
+            Spectrum unit(0.0f);
+            unit[k] = 1.0f;
+            m_luminanceWeights[k] = unit.getLuminance();
+        }
     }
 
     void addChild(const std::string &name, ConfigurableObject *child) {
@@ -217,6 +242,12 @@ public:
     void renderBlock(const Scene *scene, const Sensor *sensor,
             Sampler *sampler, ImageBlock *block, const bool &stop,
             const std::vector< TPoint2<uint8_t> > &points) const {
+        if (m_progressive) {
+            renderPass(scene, sensor, sampler,
+                static_cast<AdaptiveWorkResult *>(block), stop, points);
+            return;
+        }
+
         bool needsApertureSample = sensor->needsApertureSample();
         bool needsTimeSample = sensor->needsTimeSample();
 
@@ -232,13 +263,18 @@ public:
         size_t sampleCount;
         block->clear();
 
+        /* Batch sums in SoA layout (see robustAverage()) and scratch
+           space for the batch luminances */
+        const size_t numSums = SPECTRUM_SAMPLES * m_numBatches;
+        Float *sums = (Float *) alloca(sizeof(Float) * (numSums + m_numBatches));
+        Float *luminance = sums + numSums;
+
         for (size_t i=0; i<points.size(); ++i) {
             Point2i offset = Point2i(points[i]) + Vector2i(block->getOffset());
             sampler->generate(offset);
 
-            Spectrum batch[m_numBatches];
-            for (size_t b = 0; b < m_numBatches; b++)
-                batch[b] = Spectrum(0.0f);
+            for (size_t j = 0; j < numSums; j++)
+                sums[j] = 0.0f;
 
             sampleCount = 0;
             Spectrum result;
@@ -265,8 +301,8 @@ public:
                     sampleValue *= m_subIntegrator->Li(eyeRay, rRec);
 
                     if (sampleValue.isFinite()) {
-                        Spectrum delta = sampleValue - batch[b];
-                        batch[b] += delta / sampleCount;
+                        for (int k = 0; k < SPECTRUM_SAMPLES; k++)
+                            sums[k * m_numBatches + b] += sampleValue[k];
                     } else {
                         Log(EWarn, "Bad sample value: %s",
                                 sampleValue.toString().c_str());
@@ -277,12 +313,13 @@ public:
 
 
                 if (sampleCount * m_numBatches >= m_maxSampleFactor * sampler->getSampleCount()) {
-                    result = robustAverage(batch);
+                    result = robustAverage(sums, (Float) sampleCount, luminance);
                     break;
                 } else if (sampleCount * m_numBatches >= sampler->getSampleCount()) {
                     /* Standard error of the primary estimator */
                     Float mean, stdErr;
-                    Spectrum avg = robustAverage(batch, &mean, &stdErr);
+                    Spectrum avg = robustAverage(sums, (Float) sampleCount,
+                        luminance, &mean, &stdErr);
 
                     /* Half width of the confidence interval */
                     Float ciWidth = stdErr * m_quantile;
@@ -317,49 +354,232 @@ public:
         }
     }
 
-    // Averages the spectra, excluding the smallest and largest sample
-    Spectrum robustAverage(const Spectrum *batches,
-            Float *meanLuminance = NULL, Float *stdErrLuminance = NULL) const {
+    /**
+     * \brief Average the batch estimates, excluding the batches with the
+     * smallest and largest luminance
+     *
+     * \param sums
+     *    Batch sums in SoA layout: entry <tt>k*m_numBatches+b</tt> holds
+     *    spectral channel \c k of batch \c b. This way, all loops below
+     *    run over contiguous arrays.
+     * \param count
+     *    Number of samples in every batch
+     * \param luminance
+     *    Scratch space for \c m_numBatches values
+     */
+    template <typename T> Spectrum robustAverage(const T *sums, Float count,
+            Float *luminance, Float *meanLuminance = NULL,
+            Float *stdErrLuminance = NULL) const {
+        const size_t n = m_numBatches;
+        const Float invCount = 1.0f / count;
+
+        /* Luminance is linear in the spectrum -- accumulate it row by row */
+        for (size_t b = 0; b < n; b++)
+            luminance[b] = 0.0f;
+        for (int k = 0; k < SPECTRUM_SAMPLES; k++) {
+            const T *row = sums + k * n;
+            const Float weight = m_luminanceWeights[k] * invCount;
+            for (size_t b = 0; b < n; b++)
+                luminance[b] += weight * (Float) row[b];
+        }
+
         size_t minIdx = 0, maxIdx = 0;
-        Float minim = 1./0.;
-        Float maxim = -1./0.;
-        for (size_t i = 0; i < m_numBatches; i++) {
-            Float x = batches[i].getLuminance();
-            if (x < minim) {
-                minIdx = i;
-                minim = x;
+        for (size_t b = 1; b < n; b++) {
+            if (luminance[b] < luminance[minIdx])
+                minIdx = b;
+            if (luminance[b] > luminance[maxIdx])
+                maxIdx = b;
+        }
+        const bool twoExcluded = minIdx != maxIdx;
+        const size_t sampleCount = twoExcluded ? n - 2 : n - 1;
+        Assert(sampleCount >= 2);
+
+        Spectrum result;
+        for (int k = 0; k < SPECTRUM_SAMPLES; k++) {
+            const T *row = sums + k * n;
+            T sum = 0;
+            for (size_t b = 0; b < n; b++)
+                sum += row[b];
+            sum -= row[minIdx];
+            if (twoExcluded)
+                sum -= row[maxIdx];
+            result[k] = (Float) sum * invCount / sampleCount;
+        }
+
+        if (meanLuminance || stdErrLuminance) {
+            Float sumLum = 0, sumSqrLum = 0;
+            for (size_t b = 0; b < n; b++)
+                sumLum += luminance[b];
+            sumLum -= luminance[minIdx];
+            if (twoExcluded)
+                sumLum -= luminance[maxIdx];
+            const Float meanLum = sumLum / sampleCount;
+
+            for (size_t b = 0; b < n; b++) {
+                const Float delta = luminance[b] - meanLum;
+                sumSqrLum += delta * delta;
             }
-            if (x > maxim) {
-                maxIdx = i;
-                maxim = x;
+            Float deltaMin = luminance[minIdx] - meanLum,
+                  deltaMax = luminance[maxIdx] - meanLum;
+            sumSqrLum -= deltaMin * deltaMin;
+            if (twoExcluded)
+                sumSqrLum -= deltaMax * deltaMax;
+
+            const Float lumVar = std::max((Float) 0, sumSqrLum) / (sampleCount-1);
+            if (meanLuminance)
+                *meanLuminance = meanLum;
+            if (stdErrLuminance)
+                *stdErrLuminance = std::sqrt(lumVar / sampleCount); // standard error of mean
+        }
+        return result;
+    }
+
+    bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        if (!m_progressive)
+            return MonteCarloIntegrator::render(scene, queue, job,
+                sceneResID, sensorResID, samplerResID);
+
+        /* Per-pixel statistics: samples per batch, alpha sum and the
+           spectrum sums of all batches (in the layout of robustAverage()) */
+        ref<Bitmap> statistics;
+        bool success = AdaptiveRenderProcess::render(this, m_process, scene,
+            queue, job, sceneResID, sensorResID, samplerResID,
+            getStatisticsChannelCount(), m_maxSampleFactor,
+            boost::bind(&AdaptiveIntegratorRobustMC::pixelError, this, _1),
+            &statistics);
+
+        if (statistics)
+            develop(scene->getSensor()->getFilm(), statistics);
+        queue->signalRefresh(job);
+
+        return success;
+    }
+
+    inline int getStatisticsChannelCount() const {
+        return 2 + (int) m_numBatches * SPECTRUM_SAMPLES;
+    }
+
+    /// Relative error of a pixel in progressive mode (converged when <= 1)
+    Float pixelError(const double *stats) const {
+        if (m_maxError <= 0 || stats[0] < 1)
+            return std::numeric_limits<Float>::infinity();
+
+        /* Standard error of the primary estimator */
+        Float *luminance = (Float *) alloca(sizeof(Float) * m_numBatches);
+        Float mean, stdErr;
+        robustAverage(stats + 2, (Float) stats[0], luminance, &mean, &stdErr);
+
+        /* Half width of the confidence interval */
+        Float ciWidth = stdErr * m_quantile;
+
+        /* Relative error heuristic */
+        Float base = std::max(mean, m_averageLuminance * 0.01f);
+
+        if (ciWidth <= m_maxError * base)
+            return 0.0f;
+        return ciWidth / (m_maxError * base);
+    }
+
+    /**
+     * \brief Render one progressive pass over the unconverged pixels of a block
+     *
+     * Only the batch statistics are accumulated, the image itself is
+     * developed from them after the last pass.
+     */
+    void renderPass(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, AdaptiveWorkResult *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points) const {
+        bool needsApertureSample = sensor->needsApertureSample();
+        bool needsTimeSample = sensor->needsTimeSample();
+
+        RayDifferential eyeRay;
+        RadianceQueryRecord rRec(scene, sampler);
+
+        Float diffScaleFactor = 1.0f /
+            std::sqrt((Float) sampler->getSampleCount());
+
+        Point2 apertureSample(0.5f);
+        Float timeSample = 0.5f;
+
+        /* Add roughly the configured number of samples per pass */
+        size_t rounds = std::max((size_t) 1,
+            (sampler->getSampleCount() + m_numBatches - 1) / m_numBatches);
+        block->clear();
+
+        for (size_t i=0; i<points.size(); ++i) {
+            Point2i offset = Point2i(points[i]) + Vector2i(block->getOffset());
+            double *stats = block->getStatistics(points[i].x, points[i].y);
+            sampler->generate(offset);
+
+            for (size_t r = 0; r < rounds; r++) {
+                if (stop)
+                    return;
+
+                const Point2 samplePos(Point2(offset) + Vector2(rRec.nextSample2D()));
+                if (needsApertureSample)
+                    apertureSample = rRec.nextSample2D();
+                if (needsTimeSample)
+                    timeSample = rRec.nextSample1D();
+
+                // Add an extra sample in all batches
+                double *sums = stats + 2;
+                for (size_t b = 0; b < m_numBatches; b++) {
+                    rRec.newQuery(RadianceQueryRecord::ESensorRay, sensor->getMedium());
+                    rRec.extra = RadianceQueryRecord::EAdaptiveQuery;
+
+                    Spectrum sampleValue = sensor->sampleRayDifferential(
+                        eyeRay, samplePos, apertureSample, timeSample);
+                    eyeRay.scaleDifferential(diffScaleFactor);
+
+                    sampleValue *= m_subIntegrator->Li(eyeRay, rRec);
+
+                    if (sampleValue.isFinite()) {
+                        for (int k = 0; k < SPECTRUM_SAMPLES; k++)
+                            sums[k * m_numBatches + b] += sampleValue[k];
+                    } else {
+                        Log(EWarn, "Bad sample value: %s",
+                                sampleValue.toString().c_str());
+                    }
+
+                    sampler->advance();
+                }
+                stats[0] += 1;
+                stats[1] += rRec.alpha;
             }
         }
-        size_t sampleCount = 0;
-        Spectrum sumSpec(0.0f);
-        Float meanLum = 0, meanSqrLum = 0;
-        for (size_t i = 0; i < m_numBatches; i++) {
-            if (i == minIdx || i == maxIdx)
-                continue;
-            Spectrum spec = batches[i];
-            sumSpec += spec;
-
-            Float x = spec.getLuminance();
-            ++sampleCount;
-            const Float delta = x - meanLum;
-            meanLum += delta / sampleCount;
-            meanSqrLum += delta * (x - meanLum);
+    }
+
+    /// Develop the robust averages of the accumulated batches onto the film
+    void develop(Film *film, const Bitmap *statistics) const {
+        const ReconstructionFilter *rfilter = film->getReconstructionFilter();
+        Vector2i size = statistics->getSize();
+        Point2i offset(0, 0);
+        if (film->hasHighQualityEdges())
+            offset -= Vector2i(rfilter->getBorderSize());
+
+        ref<ImageBlock> block = new ImageBlock(Bitmap::ESpectrumAlphaWeight,
+            size, rfilter);
+        block->setOffset(offset);
+        block->setSize(size);
+        block->clear();
+
+        Float *luminance = (Float *) alloca(sizeof(Float) * m_numBatches);
+        const double *stats = statistics->getFloat64Data();
+        int channels = getStatisticsChannelCount();
+        for (int y=0; y<size.y; ++y) {
+            for (int x=0; x<size.x; ++x, stats += channels) {
+                if (stats[0] < 1)
+                    continue;
+                Spectrum result = robustAverage(stats + 2, (Float) stats[0], luminance);
+                Float alpha = (Float) (stats[1] / stats[0]);
+                if (!block->put(Point2(offset + Vector2i(x, y)) + Vector2(0.5f), result, alpha)) {
+                    Log(EWarn, "Had trouble submitting our final result: %s",
+                            result.toString().c_str());
+                }
+            }
         }
-        Assert(sampleCount == m_numBatches - 2  ||  (sampleCount == m_numBatches - 1 && minIdx == maxIdx));
-        Assert(sampleCount >= 2);
-        const Float lumVar = meanSqrLum / (sampleCount-1);
-        if (meanLuminance)
-            *meanLuminance = meanLum;
-        if (stdErrLuminance)
-            *stdErrLuminance = sqrt(lumVar / sampleCount); // standard error of mean
-        // Consistency check:
-        Spectrum meanSpec = sumSpec / sampleCount;
-        Assert(math::abs(meanLum) <= RCPOVERFLOW || math::abs((meanSpec.getLuminance() - meanLum)) / meanLum < Epsilon);
-        return sumSpec / sampleCount;
+        film->put(block);
     }
 
     Spectrum Li(const RayDifferential &ray, RadianceQueryRecord &rRec) const {
@@ -382,6 +602,7 @@ public:
         stream->writeFloat(m_averageLuminance);
         stream->writeFloat(m_pValue);
         stream->writeSize(m_numBatches);
+        stream->writeBool(m_progressive);
     }
 
     void bindUsedResources(ParallelProcess *proc) const {
@@ -411,6 +632,8 @@ public:
             << "  maxError = " << m_maxError << "," << endl
             << "  quantile = " << m_quantile << "," << endl
             << "  pvalue = " << m_pValue << "," << endl
+            << "  numBatches = " << m_numBatches << "," << endl
+            << "  progressive = " << m_progressive << "," << endl
             << "  subIntegrator = " << indent(m_subIntegrator->toString()) << endl
             << "]";
         return oss.str();
@@ -423,6 +646,8 @@ private:
     int m_maxSampleFactor;
     size_t m_numBatches;
     bool m_verbose;
+    bool m_progressive;
+    Float m_luminanceWeights[SPECTRUM_SAMPLES];
 };
 
 MTS_IMPLEMENT_CLASS_S(AdaptiveIntegratorRobustMC, false, MonteCarloIntegrator)
@@ -176,6 +176,10 @@ public:
         return result;
     }
 
+    bool isFirstHitOnly() const {
+        return true;
+    }
+
     std::string toString() const {
         return "FieldIntegrator[]";
     }
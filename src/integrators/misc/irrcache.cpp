@@ -33,6 +33,9 @@ MTS_NAMESPACE_BEGIN
  *     \parameter{clampScreen}{\Boolean}{Use a screen-space clamping criterion \cite{Tabellion2004Approximate}? \default{\code{true}}}
  *     \parameter{overture}{\Boolean}{Do an overture pass before starting the main rendering process?
  *      Usually a good idea.\default{\code{true}}}
+ *     \parameter{overtureStride}{\Integer}{Pixel spacing of the overture pass. Values larger
+ *      than one pre-populate the cache from a coarser set of pixels, which is considerably
+ *      faster and leaves the remaining records to the main rendering pass. \default{1}}
  *     \parameter{quality\showbreak Adjustment}{\Float}{When an overture pass is used, Mitsuba subsequently reduces
  *      the quality parameter by this amount to interpolate amongst more samples, creating a visually
  *      smoother result. \default{0.5}}
@@ -91,6 +94,8 @@ public:
            parallel overture pass before the main rendering process starts.
            This is strongly recommended. */
         m_overture = props.getBoolean("overture", true);
+        /* Pixel spacing of the overture pass (1 = every pixel) */
+        m_overtureStride = props.getInteger("overtureStride", 1);
         /* Quality setting (\kappa in the [Tabellion et al.] paper).
            A value of 1 should be adequate in most cases. */
         m_quality = props.getFloat("quality", 1.0f);
@@ -120,6 +125,8 @@ public:
             m_overture = false;
 
         Assert(m_qualityAdjustment > 0 && m_qualityAdjustment <= 1);
+        if (m_overtureStride < 1)
+            Log(EError, "overtureStride must be at least 1!");
     }
 
     IrradianceCacheIntegrator(Stream *stream, InstanceManager *manager)
@@ -218,7 +225,7 @@ public:
         if (m_overture) {
             int subIntegratorResID = sched->registerResource(m_subIntegrator);
             ref<OvertureProcess> proc = new OvertureProcess(job, m_resolution, m_gradients,
-                m_clampNeighbor, m_clampScreen, m_quality);
+                m_clampNeighbor, m_clampScreen, m_quality, m_overtureStride);
             m_proc = proc;
             proc->bindResource("scene", sceneResID);
             proc->bindResource("sensor", sensorResID);
@@ -238,6 +245,7 @@ public:
             Log(EDebug, "Overture pass generated %i irradiance samples", vec->size());
             for (size_t i=0; i<vec->size(); ++i)
                 m_irrCache->insert(new IrradianceCache::Record((*vec)[i]));
+            m_irrCache->flush();
 
             m_irrCache->setQuality(m_quality * m_qualityAdjustment);
         }
@@ -253,6 +261,16 @@ public:
         }
     }
 
+    void renderBlock(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points) const {
+        SamplingIntegrator::renderBlock(scene, sensor, sampler, block, stop, points);
+
+        /* Records created while rendering the block were queued without
+           locking -- hand them over to the shared cache in one go */
+        m_irrCache->flush();
+    }
+
     Spectrum Li(const RayDifferential &ray, RadianceQueryRecord &rRec) const {
         Intersection &its = rRec.its;
 
@@ -381,7 +399,7 @@ private:
     Float m_quality, m_qualityAdjustment, m_diffScaleFactor;
     bool m_clampScreen, m_clampNeighbor;
     bool m_overture, m_gradients, m_debug, m_indirectOnly;
-    int m_resolution;
+    int m_resolution, m_overtureStride;
 };
 
 MTS_IMPLEMENT_CLASS_S(IrradianceCacheIntegrator, false, SamplingIntegrator)
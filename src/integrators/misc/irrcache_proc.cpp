@@ -26,9 +26,9 @@ MTS_NAMESPACE_BEGIN
 class OvertureWorker : public WorkProcessor {
 public:
     OvertureWorker(int resolution, bool gradients, bool clampNeighbor,
-        bool clampScreen, Float quality) : m_resolution(resolution), m_gradients(gradients),
-        m_clampNeighbor(clampNeighbor), m_clampScreen(clampScreen),
-        m_quality(quality) {
+        bool clampScreen, Float quality, int stride) : m_resolution(resolution),
+        m_stride(stride), m_gradients(gradients), m_clampNeighbor(clampNeighbor),
+        m_clampScreen(clampScreen), m_quality(quality) {
     }
 
     OvertureWorker(Stream *stream, InstanceManager *manager) {
@@ -37,6 +37,7 @@ public:
         m_clampNeighbor = stream->readBool();
         m_clampScreen = stream->readBool();
         m_quality = stream->readFloat();
+        m_stride = stream->readInt();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -45,6 +46,7 @@ public:
         stream->writeBool(m_clampNeighbor);
         stream->writeBool(m_clampScreen);
         stream->writeFloat(m_quality);
+        stream->writeInt(m_stride);
     }
 
     ref<WorkUnit> createWorkUnit() const {
@@ -88,8 +90,12 @@ public:
                 ey = sy + rect->getSize().y;
         result->clear();
 
-        for (int y = sy; y < ey; y++) {
-            for (int x = sx; x < ex; x++) {
+        /* Only visit pixels on the (global) stride lattice */
+        const int y0 = sy + (m_stride - sy % m_stride) % m_stride,
+                  x0 = sx + (m_stride - sx % m_stride) % m_stride;
+
+        for (int y = y0; y < ey; y += m_stride) {
+            for (int x = x0; x < ex; x += m_stride) {
                 if (stop)
                     break;
                 Point2 pixelSample(x + .5f, y + .5f);
@@ -134,7 +140,7 @@ public:
 
     ref<WorkProcessor> clone() const {
         return new OvertureWorker(m_resolution, m_gradients, m_clampNeighbor,
-            m_clampScreen, m_quality);
+            m_clampScreen, m_quality, m_stride);
     }
 
     MTS_DECLARE_CLASS()
@@ -147,7 +153,7 @@ private:
     ref<HemisphereSampler> m_hs;
     ref<SamplingIntegrator> m_subIntegrator;
     ref<IrradianceCache> m_irrCache;
-    int m_resolution;
+    int m_resolution, m_stride;
     bool m_gradients, m_clampNeighbor, m_clampScreen;
     Float m_quality;
 };
@@ -178,8 +184,8 @@ std::string IrradianceRecordVector::toString() const {
 }
 
 OvertureProcess::OvertureProcess(const RenderJob *job, int resolution, bool gradients,
-    bool clampNeighbor, bool clampScreen, Float quality) : m_job(job), m_resolution(resolution),
-    m_gradients(gradients), m_clampNeighbor(clampNeighbor),
+    bool clampNeighbor, bool clampScreen, Float quality, int stride) : m_job(job),
+    m_resolution(resolution), m_stride(stride), m_gradients(gradients), m_clampNeighbor(clampNeighbor),
     m_clampScreen(clampScreen), m_quality(quality), m_progress(NULL) {
     m_resultCount = 0;
     m_resultMutex = new Mutex();
@@ -193,7 +199,7 @@ OvertureProcess::~OvertureProcess() {
 
 ref<WorkProcessor> OvertureProcess::createWorkProcessor() const {
     return new OvertureWorker(m_resolution, m_gradients, m_clampNeighbor,
-        m_clampScreen, m_quality);
+        m_clampScreen, m_quality, m_stride);
 }
 
 void OvertureProcess::processResult(const WorkResult *wr, bool cancelled) {
@@ -72,7 +72,7 @@ private:
 class OvertureProcess : public BlockedImageProcess {
 public:
     OvertureProcess(const RenderJob *job, int resolution, bool gradients,
-        bool clampNeighbor, bool clampScreen, Float quality);
+        bool clampNeighbor, bool clampScreen, Float quality, int stride = 1);
 
     inline const IrradianceRecordVector *getSamples() const {
         return m_samples.get();
@@ -92,7 +92,7 @@ private:
     int m_resultCount;
     ref<Mutex> m_resultMutex;
     ref<IrradianceRecordVector> m_samples;
-    int m_resolution;
+    int m_resolution, m_stride;
     bool m_gradients, m_clampNeighbor, m_clampScreen;
     Float m_quality;
     ProgressReporter *m_progress;
@@ -64,6 +64,10 @@ static StatsCounter statsConverged(
  *     \parameter{maxSpaceSteps}{\Integer}{
  *        Maximum number of spatial sub-steps \default{10}
  *     }
+ *     \parameter{subSteps}{\Integer}{
+ *        Number of intervals into which the time range is split
+ *        by the specular solver \default{1}
+ *     }
  * }
  * This integrator extracts motion vectors for animated input scenes, alternatively
  * at primary hit points or at hit points observed through sequences of reflective
@@ -72,7 +76,10 @@ static StatsCounter statsConverged(
  * component (B) denotes the change in distance of the observed 3D point to the
  * camera position. Sometimes a specular path cannot be tracked from one frame to the other,
  * e.g. because it does not exist, or because the solver did not converge. In this case,
- * the pixel color is set to infinity. The images on the following page show
+ * the pixel color is set to infinity. Primary hit points (\code{config="d"})
+ * are reprojected in closed form by evaluating the animated transformation
+ * of the intersected shape at the target time, which only requires a
+ * single ray per sample. The images on the following page show
  * motion vectors obtained for a sphere that is moving from the left to the right.
  *
  * \renderings{
@@ -208,7 +215,6 @@ public:
             if (!tracePath(rRec, ray, source))
                 return Spectrum(0.0f);
 
-            m_scene = rRec.scene;
             p0 = source[1].p;
 
             int timeIteration = 0;
@@ -278,6 +284,11 @@ public:
 
         Float error = computeError(temp, target);
 
+        /* The full spatial step only depends on the current path. Cache it
+           while candidates with smaller step sizes are being rejected */
+        EVector spaceStep;
+        bool haveSpaceStep = false;
+
         Float spaceStepSize = 1.0f;
         int spaceIteration = 0;
         while (error > 1e-5f) {
@@ -287,7 +298,12 @@ public:
                 return false;
             }
 
-            Ray candidateRay = extrapolateSpaceRay(temp, target, spaceStepSize);
+            if (!haveSpaceStep) {
+                computeSpaceStep(temp, target, spaceStep);
+                haveSpaceStep = true;
+            }
+
+            Ray candidateRay = extrapolateSpaceRay(temp, spaceStep, spaceStepSize);
 
             Float candidateError = 0;
             if (!tracePath(rRec, candidateRay, temp2))
@@ -296,7 +312,8 @@ public:
                 candidateError = computeError(temp2, target);
 
             if (candidateError < error) {
-                temp = temp2;
+                temp.swap(temp2);
+                haveSpaceStep = false;
                 error = candidateError;
                 spaceStepSize = std::min((Float) 1.0f, spaceStepSize * 2);
             } else {
@@ -304,7 +321,7 @@ public:
             }
         }
 
-        source = temp;
+        source.swap(temp);
         return true;
     }
 
@@ -514,7 +531,8 @@ public:
         return (target[last].p-source[last].p).length() / scale;
     }
 
-    Ray extrapolateSpaceRay(const std::vector<Intersection> &source, const std::vector<Intersection> &target, Float stepSize) const {
+    /// Compute the full spatial step that moves the last vertex of \c source towards \c target
+    void computeSpaceStep(const std::vector<Intersection> &source, const std::vector<Intersection> &target, EVector &b) const {
         EMatrix M;
         assembleMatrix(source, target, M);
 
@@ -535,8 +553,11 @@ public:
               du = ( a22 * b1 - a12 * b2) * invDet,
               dv = (-a12 * b1 + a11 * b2) * invDet;
 
-        EVector b = -(du*lu.solve(M.col(M.cols()-3)) + dv*lu.solve(M.col(M.cols()-2)));
+        /* The system is linear -- a single solve suffices */
+        b = -lu.solve(du*M.col(M.cols()-3) + dv*M.col(M.cols()-2));
+    }
 
+    Ray extrapolateSpaceRay(const std::vector<Intersection> &source, const EVector &b, Float stepSize) const {
         Point rayTarget = source[1].p + stepSize * (source[1].dpdu * b[0] + source[1].dpdv * b[1]);
 
         return Ray(source[0].p, normalize(rayTarget-source[0].p), source[1].time);
@@ -555,7 +576,6 @@ private:
     int m_maxTimeSteps;
     int m_subSteps;
     Float m_glossyThreshold;
-    mutable const Scene *m_scene;
 };
 
 MTS_IMPLEMENT_CLASS_S(MotionIntegrator, false, SamplingIntegrator)
@@ -26,6 +26,11 @@ MTS_NAMESPACE_BEGIN
  * \parameters{
  *     \parameter{\Unnamed}{\Integrator}{One or more sub-integrators whose output
  *     should be rendered into a combined multi-channel image}
+ *     \parameter{secondMoment}{\Boolean}{Append one more channel, which
+ *     records the square of the first sub-integrator's samples. Together
+ *     with the pixel's sample count, its difference to the squared pixel
+ *     value yields the variance of the estimate, as used by the
+ *     \code{denoise} utility. \default{\code{false}}}
  * }
  *
  * The multi-channel integrator groups several sub-integrators together
@@ -38,6 +43,13 @@ MTS_NAMESPACE_BEGIN
  * of Mitsuba, e.g. to create reference data for computer vision algorithms. Currently, it only
  * works with a subset of the other plugins---see the red box for details.
  *
+ * The primary ray of each sample is intersected with the scene only once,
+ * and the resulting intersection record is handed to all sub-integrators,
+ * which therefore do not trace it again. Sub-integrators that only look
+ * at this first intersection (such as \pluginref{field}) furthermore share
+ * a single copy of the query record, so that adding auxiliary channels
+ * costs little in comparison to the main rendering.
+ *
  * Thee \code{multichannel} plugin also disables certain checks for negative or infinite
  * radiance values during rendering that normally cause warnings to be emitted.
  * This is simply to process extracted fields for which it is fine
@@ -73,6 +85,11 @@ MTS_NAMESPACE_BEGIN
  * </scene>
  * \end{xml}
  *
+ * For the \code{denoise} utility, the above setup would additionally use
+ * an \code{albedo} field and the \code{secondMoment} parameter, with
+ * a film whose channels are named \code{color, albedo, normal, distance,
+ * moment}.
+ *
  * \remarks{
  * \item Requires the \pluginref{hdrfilm} or \pluginref{tiledhdrfilm}.
  * \item All nested integrators must
@@ -86,13 +103,17 @@ MTS_NAMESPACE_BEGIN
 
 class MultiChannelIntegrator : public SamplingIntegrator {
 public:
-    MultiChannelIntegrator(const Properties &props) : SamplingIntegrator(props) { }
+    MultiChannelIntegrator(const Properties &props) : SamplingIntegrator(props) {
+        /* Append the squared samples of the first sub-integrator? */
+        m_secondMoment = props.getBoolean("secondMoment", false);
+    }
 
     MultiChannelIntegrator(Stream *stream, InstanceManager *manager)
      : SamplingIntegrator(stream, manager) {
         m_integrators.resize(stream->readSize());
         for (size_t i=0; i<m_integrators.size(); ++i)
             m_integrators[i] = static_cast<SamplingIntegrator *>(manager->getInstance(stream));
+        m_secondMoment = stream->readBool();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -101,6 +122,7 @@ public:
         stream->writeSize(m_integrators.size());
         for (size_t i=0; i<m_integrators.size(); ++i)
             manager->serialize(stream, m_integrators[i].get());
+        stream->writeBool(m_secondMoment);
     }
 
     bool preprocess(const Scene *scene, RenderQueue *queue,
@@ -139,10 +161,12 @@ public:
         /* This is a sampling-based integrator - parallelize */
         ref<BlockedRenderProcess> proc = new BlockedRenderProcess(job,
             queue, scene->getBlockSize());
+        proc->setSplitting(true);
 
+        size_t imageCount = getImageCount();
         proc->setPixelFormat(
-                m_integrators.size() > 1 ? Bitmap::EMultiSpectrumAlphaWeight : Bitmap::ESpectrumAlphaWeight,
-                (int) (m_integrators.size() * SPECTRUM_SAMPLES + 2), false);
+                imageCount > 1 ? Bitmap::EMultiSpectrumAlphaWeight : Bitmap::ESpectrumAlphaWeight,
+                (int) (imageCount * SPECTRUM_SAMPLES + 2), false);
 
         int integratorResID = sched->registerResource(this);
         proc->bindResource("integrator", integratorResID);
@@ -179,7 +203,21 @@ public:
         block->clear();
 
         uint32_t queryType = RadianceQueryRecord::ESensorRay;
-        Float *temp = (Float *) alloca(sizeof(Float) * (m_integrators.size() * SPECTRUM_SAMPLES + 2));
+
+        /* The samples of a pixel are collected and splatted as one batch */
+        const size_t channels = getImageCount() * SPECTRUM_SAMPLES + 2;
+        std::vector<Float> values(channels * sampler->getSampleCount());
+        std::vector<Point2> positions(sampler->getSampleCount());
+
+        /* Sub-integrators that only need the first intersection can
+           share one copy of the query record */
+        bool *firstHitOnly = (bool *) alloca(sizeof(bool) * m_integrators.size());
+        bool anyFirstHitOnly = false;
+        for (size_t k = 0; k<m_integrators.size(); ++k) {
+            firstHitOnly[k] = m_integrators[k]->isFirstHitOnly();
+            anyFirstHitOnly |= firstHitOnly[k];
+        }
+        RadianceQueryRecord firstHitRec(scene, sampler);
 
         for (size_t i = 0; i<points.size(); ++i) {
             Point2i offset = Point2i(points[i]) + Vector2i(block->getOffset());
@@ -191,6 +229,7 @@ public:
             for (size_t j = 0; j<sampler->getSampleCount(); j++) {
                 rRec.newQuery(queryType, sensor->getMedium());
                 Point2 samplePos(Point2(offset) + Vector2(rRec.nextSample2D()));
+                Float *temp = &values[j * channels];
 
                 if (needsApertureSample)
                     apertureSample = rRec.nextSample2D();
@@ -202,21 +241,37 @@ public:
                     sensorRay, samplePos, apertureSample, timeSample);
 
                 sensorRay.scaleDifferential(diffScaleFactor);
+
+                /* Trace the primary ray once; this clears the
+                   'EIntersection' flag so that none of the
+                   sub-integrators will trace it again */
                 rRec.rayIntersect(sensorRay);
+                if (anyFirstHitOnly)
+                    firstHitRec = rRec;
 
                 int offset = 0;
                 for (size_t k = 0; k<m_integrators.size(); ++k) {
-                    RadianceQueryRecord rRec2(rRec);
-                    rRec2.its = rRec.its;
-                    Spectrum result = spec * m_integrators[k]->Li(sensorRay, rRec2);
+                    Spectrum result;
+                    if (firstHitOnly[k]) {
+                        result = spec * m_integrators[k]->Li(sensorRay, firstHitRec);
+                    } else {
+                        RadianceQueryRecord rRec2(rRec);
+                        result = spec * m_integrators[k]->Li(sensorRay, rRec2);
+                    }
                     for (int l = 0; l<SPECTRUM_SAMPLES; ++l)
                         temp[offset++] = result[l];
                 }
+                if (m_secondMoment) {
+                    for (int l = 0; l<SPECTRUM_SAMPLES; ++l)
+                        temp[offset++] = temp[l] * temp[l];
+                }
                 temp[offset++] = rRec.alpha;
                 temp[offset] = 1.0f;
-                block->put(samplePos, temp);
+                positions[j] = samplePos;
                 sampler->advance();
             }
+
+            block->put(&positions[0], &values[0], sampler->getSampleCount());
         }
     }
 
@@ -255,6 +310,11 @@ public:
         NotImplementedError("Li");
     }
 
+    /// Number of images in the output, including the second moment
+    inline size_t getImageCount() const {
+        return m_integrators.size() + (m_secondMoment ? 1 : 0);
+    }
+
     const Integrator *getSubIntegrator(int idx) const {
         if (idx < 0 || idx >= (int) m_integrators.size())
             return NULL;
@@ -267,7 +327,8 @@ public:
             << "  integrators = {" << endl;
         for (size_t i=0; i<m_integrators.size(); ++i)
             oss << "    " << indent(m_integrators[i]->toString(), 2) << "," << endl;
-        oss << "  }" << endl
+        oss << "  }," << endl
+            << "  secondMoment = " << m_secondMoment << endl
             << "]";
         return oss.str();
     }
@@ -275,6 +336,7 @@ public:
     MTS_DECLARE_CLASS()
 private:
     ref_vector<SamplingIntegrator> m_integrators;
+    bool m_secondMoment;
 };
 
 MTS_IMPLEMENT_CLASS_S(MultiChannelIntegrator, false, SamplingIntegrator)
@@ -17,11 +17,17 @@
 */
 
 #include <mitsuba/bidir/util.h>
+#include <mitsuba/bidir/rsampler.h>
 #include <mitsuba/core/fstream.h>
+#include <boost/bind.hpp>
 #include "mlt_proc.h"
 
 MTS_NAMESPACE_BEGIN
 
+/* File format of the bootstrap cache */
+#define MTS_MLT_BOOTSTRAP_HEADER  0x4D4C
+#define MTS_MLT_BOOTSTRAP_VERSION 0x0001
+
 /*!\plugin{mlt}{Path Space Metropolis Light Transport}
  * \order{10}
  * \parameters{
@@ -48,6 +54,16 @@ MTS_NAMESPACE_BEGIN
  *        the average luminance arriving at the sensor by generating a
  *        number of samples. \default{\code{100000} samples}
  *     }
+ *     \parameter{bootstrapCache}{\String}{
+ *        File that stores the luminance estimate and the seed paths.
+ *        When it exists, its contents are reused to shorten the startup of
+ *        every frame of an animation. See \pluginref{pssmlt} for
+ *        details. \default{none}
+ *     }
+ *     \parameter{bootstrapRefinement}{\Float}{
+ *        Fraction of \code{luminanceSamples} that is taken again to refine
+ *        a cached bootstrap. See \pluginref{pssmlt} for details. \default{0}
+ *     }
  *     \parameter{twoStage}{\Boolean}{Use two-stage MLT?
  *       See \pluginref{pssmlt} for details.\!\default{{\footnotesize\code{false}}}\!}
  *     \parameter{bidirectional\showbreak\newline Mutation,\vspace{1mm}
@@ -196,12 +212,25 @@ public:
 
         /* Stop MLT after X seconds -- useful for equal-time comparisons */
         m_config.timeout = props.getInteger("timeout", 0);
+
+        /* Store the outcome of the bootstrap phase in this file and reuse
+           it when rendering again, e.g. the next frame of an animation */
+        m_bootstrapCache = props.getString("bootstrapCache", "");
+
+        /* Fraction of the luminance samples that are taken again to
+           refine a cached bootstrap */
+        m_bootstrapRefinement = props.getFloat("bootstrapRefinement", 0.0f);
+
+        if (m_bootstrapRefinement < 0 || m_bootstrapRefinement > 1)
+            Log(EError, "The 'bootstrapRefinement' parameter must be in [0, 1]!");
     }
 
     /// Unserialize from a binary data stream
     MLT(Stream *stream, InstanceManager *manager)
      : Integrator(stream, manager) {
         m_config = MLTConfiguration(stream);
+        m_bootstrapCache = stream->readString();
+        m_bootstrapRefinement = stream->readFloat();
     }
 
     virtual ~MLT() { }
@@ -209,6 +238,8 @@ public:
     void serialize(Stream *stream, InstanceManager *manager) const {
         Integrator::serialize(stream, manager);
         m_config.serialize(stream);
+        stream->writeString(m_bootstrapCache.string());
+        stream->writeFloat(m_bootstrapRefinement);
     }
 
     bool preprocess(const Scene *scene, RenderQueue *queue,
@@ -304,8 +335,58 @@ public:
         ref<MLTProcess> process = new MLTProcess(job, queue,
                 m_config, directImage, pathSeeds);
 
-        m_config.luminance = pathSampler->generateSeeds(luminanceSamples,
-            m_config.workUnits, true, m_config.importanceMap, pathSeeds);
+        /* Look for the bootstrap of a previous rendering. The nested
+           first stage of two-stage MLT always starts from scratch */
+        fs::path cachePath;
+        if (!m_bootstrapCache.empty() && !nested) {
+            cachePath = m_bootstrapCache;
+            if (!cachePath.is_absolute())
+                cachePath = scene->getDestinationFile().parent_path() / cachePath;
+        }
+
+        Float cachedLuminance = 0;
+        size_t cachedSamples = 0;
+        if (!cachePath.empty() && fs::exists(cachePath))
+            cachedSamples = loadBootstrap(cachePath, cachedLuminance, pathSeeds);
+
+        bool refine = cachedSamples > 0 && m_bootstrapRefinement > 0;
+        if (cachedSamples > 0 && !refine && (pathSeeds.size() != (size_t) m_config.workUnits
+                || !refreshSeeds(pathSampler, rplSampler, pathSeeds))) {
+            Log(EWarn, "The bootstrap cache \"%s\" does not match the current "
+                "configuration, discarding it", cachePath.string().c_str());
+            cachedSamples = 0;
+        }
+
+        if (cachedSamples == 0 || refine) {
+            size_t bootstrapSamples = luminanceSamples;
+            if (refine)
+                bootstrapSamples = std::max((size_t) m_config.workUnits * 10,
+                    (size_t) (luminanceSamples * m_bootstrapRefinement));
+
+            Float luminance = pathSampler->generateSeeds(bootstrapSamples,
+                m_config.workUnits, true, m_config.importanceMap, pathSeeds);
+
+            if (refine) {
+                /* Blend the new estimate into the cached one. The cache keeps
+                   its sample count, hence old frames fade out gradually */
+                Float weight = bootstrapSamples
+                    / (Float) (bootstrapSamples + cachedSamples);
+                m_config.luminance = cachedLuminance
+                    + weight * (luminance - cachedLuminance);
+                Log(EInfo, "Refined the cached luminance value %f to %f",
+                    cachedLuminance, m_config.luminance);
+            } else {
+                m_config.luminance = luminance;
+                cachedSamples = bootstrapSamples;
+            }
+
+            if (!cachePath.empty())
+                saveBootstrap(cachePath, cachedSamples, m_config.luminance, pathSeeds);
+        } else {
+            m_config.luminance = cachedLuminance;
+            Log(EInfo, "Reusing the cached bootstrap \"%s\" (average luminance "
+                "value = %f)", cachePath.string().c_str(), cachedLuminance);
+        }
 
         if (!nested)
             m_config.dump();
@@ -328,10 +409,134 @@ public:
     }
 
     MTS_DECLARE_CLASS()
+private:
+    /**
+     * \brief Load a cached bootstrap
+     *
+     * Returns the number of luminance samples behind the cached estimate,
+     * or zero when the file cannot be used
+     */
+    size_t loadBootstrap(const fs::path &path, Float &luminance,
+            std::vector<PathSeed> &seeds) const {
+        ref<FileStream> stream = new FileStream(path, FileStream::EReadOnly);
+        stream->setByteOrder(Stream::ELittleEndian);
+        if (stream->getSize() < 2 * sizeof(uint16_t)
+                || stream->readUShort() != MTS_MLT_BOOTSTRAP_HEADER
+                || stream->readUShort() != MTS_MLT_BOOTSTRAP_VERSION) {
+            Log(EWarn, "\"%s\" is not a MLT bootstrap cache!",
+                path.string().c_str());
+            return 0;
+        }
+
+        size_t sampleCount = stream->readSize();
+        luminance = (Float) stream->readDouble();
+        seeds.resize(stream->readSize());
+        for (size_t i=0; i<seeds.size(); ++i) {
+            seeds[i].sampleIndex = stream->readSize();
+            seeds[i].luminance = (Float) stream->readDouble();
+            seeds[i].s = stream->readInt();
+            seeds[i].t = stream->readInt();
+        }
+        return luminance > 0 ? sampleCount : 0;
+    }
+
+    /// Store the outcome of the bootstrap phase
+    void saveBootstrap(const fs::path &path, size_t sampleCount, Float luminance,
+            const std::vector<PathSeed> &seeds) const {
+        ref<FileStream> stream = new FileStream(path, FileStream::ETruncWrite);
+        stream->setByteOrder(Stream::ELittleEndian);
+        stream->writeUShort(MTS_MLT_BOOTSTRAP_HEADER);
+        stream->writeUShort(MTS_MLT_BOOTSTRAP_VERSION);
+        stream->writeSize(sampleCount);
+        stream->writeDouble(luminance);
+        stream->writeSize(seeds.size());
+        for (size_t i=0; i<seeds.size(); ++i) {
+            stream->writeSize(seeds[i].sampleIndex);
+            stream->writeDouble(seeds[i].luminance);
+            stream->writeInt(seeds[i].s);
+            stream->writeInt(seeds[i].t);
+        }
+    }
+
+    /// Records the weight of the seed configuration during a replay
+    static void refreshCallback(const PathSeed &seed, const Bitmap *importanceMap,
+            Float &luminance, int s, int t, Float weight, Path &path) {
+        if (s != seed.s || t != seed.t)
+            return;
+
+        /* Must match the computation in PathSampler::reconstructPath() */
+        if (importanceMap) {
+            const Float *luminanceValues = importanceMap->getFloatData();
+            Vector2i size = importanceMap->getSize();
+
+            const Point2 &pos = path.getSamplePosition();
+            Point2i intPos(
+                std::min(std::max(0, (int) pos.x), size.x-1),
+                std::min(std::max(0, (int) pos.y), size.y-1));
+            weight /= luminanceValues[intPos.x + intPos.y * size.x];
+        }
+        luminance = weight;
+    }
+
+    /// Sort predicate matching the order of \ref PathSampler::generateSeeds()
+    static bool seedOrder(const PathSeed &left, const PathSeed &right) {
+        return left.sampleIndex < right.sampleIndex;
+    }
+
+    /**
+     * \brief Replay cached seeds in the current scene
+     *
+     * This updates the seed luminances, which must exactly match the
+     * reconstructed paths. Seeds whose configuration no longer carries
+     * any energy are replaced by the others. Returns \c false when none
+     * of them is left.
+     */
+    bool refreshSeeds(PathSampler *pathSampler, ReplayableSampler *rplSampler,
+            std::vector<PathSeed> &seeds) const {
+        DiscreteDistribution seedPDF(seeds.size());
+        size_t invalid = 0;
+        for (size_t i=0; i<seeds.size(); ++i) {
+            PathSeed &seed = seeds[i];
+            Float luminance = 0;
+            PathSampler::PathCallback callback = boost::bind(&refreshCallback,
+                boost::cref(seed), m_config.importanceMap.get(),
+                boost::ref(luminance), _1, _2, _3, _4);
+
+            rplSampler->setSampleIndex(seed.sampleIndex);
+            pathSampler->samplePaths(Point2i(-1), callback);
+
+            seed.luminance = luminance;
+            if (!(luminance > 0)) {
+                seed.luminance = 0;
+                ++invalid;
+            }
+            seedPDF.append(seed.luminance);
+        }
+
+        if (invalid == seeds.size())
+            return false;
+
+        if (invalid > 0) {
+            Log(EInfo, "Replacing " SIZE_T_FMT "/" SIZE_T_FMT " cached seeds "
+                "that no longer contribute", invalid, seeds.size());
+            seedPDF.normalize();
+            ref<Random> random = new Random();
+            std::vector<PathSeed> candidates(seeds);
+            for (size_t i=0; i<seeds.size(); ++i) {
+                if (seeds[i].luminance == 0)
+                    seeds[i] = candidates[seedPDF.sample(random->nextFloat())];
+            }
+            std::sort(seeds.begin(), seeds.end(), seedOrder);
+        }
+        return true;
+    }
+
 private:
     ref<ParallelProcess> m_process;
     ref<RenderJob> m_nestedJob;
     MLTConfiguration m_config;
+    fs::path m_bootstrapCache;
+    Float m_bootstrapRefinement;
 };
 
 MTS_IMPLEMENT_CLASS_S(MLT, false, Integrator)
@@ -0,0 +1,748 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__PATH_GUIDING_H)
+#define __PATH_GUIDING_H
+
+#include <mitsuba/render/scene.h>
+#include <mitsuba/core/sched.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/tls.h>
+#include <functional>
+
+/**
+ * Online path guiding in the spirit of "Practical Path Guiding for
+ * Efficient Light-Transport Simulation" by Thomas Mueller, Markus Gross
+ * and Jan Novak (EGSR 2017). A binary tree over the scene bounds (the
+ * S-tree) stores a quadtree over the sphere of directions (a D-tree) in
+ * each of its leaves. The trees are trained over a number of passes with
+ * doubling sample counts, and the integrators mix the learned
+ * distribution with BSDF or phase function sampling through one-sample
+ * MIS.
+ */
+
+MTS_NAMESPACE_BEGIN
+
+/// Longest path prefix whose vertices are recorded for training
+#define MTS_GUIDING_MAX_VERTICES 64
+
+/// Number of training records a thread collects before merging them
+#define MTS_GUIDING_BUFFER_SIZE 16384
+
+/* ==================================================================== */
+/*                        Directional quadtree                          */
+/* ==================================================================== */
+
+/**
+ * \brief Quadtree over the cylindrical parameterization
+ * <tt>(0.5*(cos(theta)+1), phi/(2*pi))</tt> of the sphere,
+ * which has a constant Jacobian of <tt>4*pi</tt>
+ */
+class GuidingDTree {
+public:
+    struct Node {
+        /// Recorded flux in the four quadrants
+        Float sum[4];
+        /// Child node of each quadrant (0 for leaves)
+        uint32_t child[4];
+
+        inline Node() {
+            for (int i=0; i<4; ++i) {
+                sum[i] = 0;
+                child[i] = 0;
+            }
+        }
+
+        inline Float getTotal() const {
+            return sum[0] + sum[1] + sum[2] + sum[3];
+        }
+    };
+
+    inline GuidingDTree() : m_nodes(1), m_samples(0) { }
+
+    /// Map a direction to the unit square
+    static inline Point2 toSquare(const Vector &d) {
+        Float phi = std::atan2(d.y, d.x) * INV_TWOPI;
+        if (phi < 0)
+            phi += 1;
+        return Point2(
+            math::clamp((d.z + 1) * 0.5f, (Float) 0, (Float) 1),
+            math::clamp(phi, (Float) 0, (Float) 1));
+    }
+
+    /// Map a point of the unit square to a direction
+    static inline Vector toDirection(const Point2 &p) {
+        Float cosTheta = 2 * p.x - 1,
+              sinTheta = math::safe_sqrt(1 - cosTheta*cosTheta);
+        Float sinPhi, cosPhi;
+        math::sincos(2 * M_PI * p.y, &sinPhi, &cosPhi);
+        return Vector(sinTheta * cosPhi, sinTheta * sinPhi, cosTheta);
+    }
+
+    /// Add the flux \c value to the leaf containing \c p
+    void record(Point2 p, Float value) {
+        uint32_t index = 0;
+        while (true) {
+            int cx = p.x >= 0.5f ? 1 : 0, cy = p.y >= 0.5f ? 1 : 0;
+            Node &node = m_nodes[index];
+            node.sum[cx + 2*cy] += value;
+            index = node.child[cx + 2*cy];
+            if (index == 0)
+                break;
+            p.x = 2*p.x - cx;
+            p.y = 2*p.y - cy;
+        }
+    }
+
+    /// Total recorded flux
+    inline Float getTotal() const { return m_nodes[0].getTotal(); }
+
+    /// Sample a point of the unit square proportionally to the recorded flux
+    Point2 sample(Point2 sample) const {
+        Point2 origin(0.0f);
+        Float size = 1;
+        uint32_t index = 0;
+        while (true) {
+            const Node &node = m_nodes[index];
+            Float total = node.getTotal();
+            if (!(total > 0))
+                break;
+
+            /* Choose a column, then a row, reusing the sample */
+            int cx, cy;
+            Float left = (node.sum[0] + node.sum[2]) / total;
+            if (sample.x < left) {
+                cx = 0; sample.x /= left;
+            } else {
+                cx = 1; sample.x = (sample.x - left) / (1 - left);
+            }
+            Float column = node.sum[cx] + node.sum[cx+2],
+                  bottom = node.sum[cx] / column;
+            if (sample.y < bottom) {
+                cy = 0; sample.y /= bottom;
+            } else {
+                cy = 1; sample.y = (sample.y - bottom) / (1 - bottom);
+            }
+            sample.x = std::min(sample.x, ONE_MINUS_EPS);
+            sample.y = std::min(sample.y, ONE_MINUS_EPS);
+
+            size *= 0.5f;
+            origin += Vector2((Float) cx, (Float) cy) * size;
+            index = node.child[cx + 2*cy];
+            if (index == 0)
+                break;
+        }
+        return origin + Vector2(sample) * size;
+    }
+
+    /// Density of \ref sample() with respect to the unit square
+    Float pdf(Point2 p) const {
+        Float result = 1;
+        uint32_t index = 0;
+        while (true) {
+            const Node &node = m_nodes[index];
+            Float total = node.getTotal();
+            if (!(total > 0))
+                break;
+            int cx = p.x >= 0.5f ? 1 : 0, cy = p.y >= 0.5f ? 1 : 0;
+            result *= 4 * node.sum[cx + 2*cy] / total;
+            index = node.child[cx + 2*cy];
+            if (index == 0 || result == 0)
+                break;
+            p.x = 2*p.x - cx;
+            p.y = 2*p.y - cy;
+        }
+        return result;
+    }
+
+    /// Sample a direction, returns its solid angle density
+    inline Vector sampleDirection(const Point2 &s, Float &pdfValue) const {
+        Point2 p = sample(s);
+        pdfValue = pdf(p) * INV_FOURPI;
+        return toDirection(p);
+    }
+
+    /// Solid angle density of \ref sampleDirection()
+    inline Float pdfDirection(const Vector &d) const {
+        return pdf(toSquare(d)) * INV_FOURPI;
+    }
+
+    /**
+     * \brief Replace this tree by an empty one whose structure follows the
+     * flux recorded in \c stats: quadrants holding more than \c threshold
+     * of the total flux are subdivided, up to a depth of \c maxDepth
+     */
+    void build(const GuidingDTree &stats, Float threshold, int maxDepth) {
+        m_nodes.clear();
+        m_nodes.push_back(Node());
+        m_samples = 0;
+
+        Float total = stats.getTotal();
+        if (!(total > 0))
+            return;
+
+        struct Entry {
+            uint32_t node;
+            int stats; /* -1 if the statistics have no such node */
+            Float fraction;
+            int depth;
+        };
+        std::vector<Entry> stack;
+        Entry root = { 0, 0, 1, 1 };
+        stack.push_back(root);
+
+        while (!stack.empty()) {
+            Entry entry = stack.back();
+            stack.pop_back();
+            if (entry.depth >= maxDepth)
+                continue;
+
+            for (int i=0; i<4; ++i) {
+                Float fraction;
+                int child = -1;
+                if (entry.stats >= 0) {
+                    const Node &node = stats.m_nodes[entry.stats];
+                    fraction = node.sum[i] / total;
+                    if (node.child[i])
+                        child = (int) node.child[i];
+                } else {
+                    fraction = entry.fraction * 0.25f;
+                }
+                if (fraction <= threshold)
+                    continue;
+
+                uint32_t index = (uint32_t) m_nodes.size();
+                m_nodes.push_back(Node());
+                m_nodes[entry.node].child[i] = index;
+                Entry next = { index, child, fraction, entry.depth + 1 };
+                stack.push_back(next);
+            }
+        }
+    }
+
+    /// Number of training samples that were recorded
+    inline size_t getSampleCount() const { return m_samples; }
+    inline void setSampleCount(size_t samples) { m_samples = samples; }
+    inline void addSample() { ++m_samples; }
+
+    inline size_t getNodeCount() const { return m_nodes.size(); }
+
+private:
+    std::vector<Node> m_nodes;
+    size_t m_samples;
+};
+
+/* ==================================================================== */
+/*                            Spatial tree                              */
+/* ==================================================================== */
+
+/// Binary tree over the scene with a pair of D-trees in each leaf
+class GuidingSDTree {
+public:
+    /// The D-tree used for sampling, and the one collecting the current pass
+    struct Leaf {
+        GuidingDTree sampling, building;
+    };
+
+    GuidingSDTree() { clear(AABB(Point(0.0f), Point(1.0f))); }
+
+    /// Reset to a single leaf covering a cube around \c aabb
+    void clear(const AABB &aabb) {
+        /* Splitting a cube along alternating axes keeps the cells cubic */
+        Point center = aabb.getCenter();
+        Float extent = std::max(aabb.getExtents()[aabb.getLargestAxis()], Epsilon)
+            * 0.5f * (1 + Epsilon);
+        m_aabb = AABB(center - Vector(extent), center + Vector(extent));
+        m_nodes.clear();
+        m_nodes.push_back(Node());
+        m_leaves.clear();
+        m_leaves.push_back(Leaf());
+    }
+
+    /// Return the leaf containing \c p
+    inline const Leaf &lookup(const Point &p) const {
+        return m_leaves[m_nodes[find(p)].leaf];
+    }
+
+    inline Leaf &lookup(const Point &p) {
+        return m_leaves[m_nodes[find(p)].leaf];
+    }
+
+    /**
+     * \brief Split the leaves whose building tree received more than
+     * \c threshold samples. The halves inherit a copy of the D-trees.
+     */
+    void refine(size_t threshold) {
+        std::vector<std::pair<uint32_t, int> > stack;
+        stack.push_back(std::make_pair(0u, 0));
+        while (!stack.empty()) {
+            uint32_t index = stack.back().first;
+            int depth = stack.back().second;
+            stack.pop_back();
+
+            if (m_nodes[index].child[0] == 0) {
+                Leaf &leaf = m_leaves[m_nodes[index].leaf];
+                if (leaf.building.getSampleCount() <= threshold
+                        || depth >= MaxDepth)
+                    continue;
+                leaf.building.setSampleCount(leaf.building.getSampleCount() / 2);
+
+                Node node;
+                node.axis = (uint8_t) ((m_nodes[index].axis + 1) % 3);
+                node.leaf = m_nodes[index].leaf;
+                uint32_t first = (uint32_t) m_nodes.size();
+                m_nodes.push_back(node);
+                node.leaf = (uint32_t) m_leaves.size();
+                m_leaves.push_back(m_leaves[m_nodes[index].leaf]);
+                m_nodes.push_back(node);
+                m_nodes[index].child[0] = first;
+                m_nodes[index].child[1] = first + 1;
+            }
+
+            for (int i=0; i<2; ++i)
+                stack.push_back(std::make_pair(m_nodes[index].child[i], depth + 1));
+        }
+    }
+
+    /**
+     * \brief Start a new pass: the flux collected by the building trees
+     * is used for sampling, and the building trees are rebuilt empty
+     */
+    void swap(Float threshold, int maxDepth) {
+        for (size_t i=0; i<m_leaves.size(); ++i) {
+            Leaf &leaf = m_leaves[i];
+            leaf.sampling = leaf.building;
+            leaf.building.build(leaf.sampling, threshold, maxDepth);
+        }
+    }
+
+    inline size_t getLeafCount() const { return m_leaves.size(); }
+
+    /// Average number of nodes of the sampling D-trees
+    Float getAverageDTreeSize() const {
+        size_t nodes = 0;
+        for (size_t i=0; i<m_leaves.size(); ++i)
+            nodes += m_leaves[i].sampling.getNodeCount();
+        return nodes / (Float) m_leaves.size();
+    }
+
+private:
+    enum { MaxDepth = 48 };
+
+    struct Node {
+        /// Children (0 for leaves) and the leaf data index
+        uint32_t child[2];
+        uint32_t leaf;
+        /// Axis along which the children split this node
+        uint8_t axis;
+
+        inline Node() : leaf(0), axis(0) {
+            child[0] = child[1] = 0;
+        }
+    };
+
+    inline uint32_t find(const Point &_p) const {
+        Vector extents = m_aabb.getExtents();
+        Point p;
+        for (int i=0; i<3; ++i)
+            p[i] = math::clamp((_p[i] - m_aabb.min[i]) / extents[i],
+                (Float) 0, ONE_MINUS_EPS);
+
+        uint32_t index = 0;
+        while (m_nodes[index].child[0] != 0) {
+            const Node &node = m_nodes[index];
+            Float &value = p[node.axis];
+            int c = value >= 0.5f ? 1 : 0;
+            value = 2*value - c;
+            index = node.child[c];
+        }
+        return index;
+    }
+
+    AABB m_aabb;
+    std::vector<Node> m_nodes;
+    std::vector<Leaf> m_leaves;
+};
+
+/* ==================================================================== */
+/*                        Training record keeping                       */
+/* ==================================================================== */
+
+/// Incident flux estimate at a path vertex
+struct GuidingRecord {
+    Point p;
+    Vector d;
+    Float value;
+};
+
+/**
+ * \brief Path vertices whose incident radiance is being estimated
+ *
+ * Every contribution that the path makes after a vertex is also splatted
+ * into that vertex, divided by the path throughput up to and including
+ * the vertex. This yields an estimate of the radiance that arrives from
+ * the sampled direction. The path integrators own one of these per path.
+ */
+class GuidingPath {
+public:
+    inline GuidingPath() : m_size(0) { }
+
+    /**
+     * \brief Add a vertex that sampled the direction \c d with the
+     * density \c pdf and whose path throughput (after scattering)
+     * is \c throughput
+     */
+    inline void push(const Point &p, const Vector &d,
+            const Spectrum &throughput, Float pdf) {
+        if (m_size == MTS_GUIDING_MAX_VERTICES || !(pdf > 0))
+            return;
+        Vertex &vertex = m_vertices[m_size++];
+        vertex.p = p;
+        vertex.d = d;
+        vertex.invThroughput = throughput.invertButKeepZero();
+        vertex.radiance = Spectrum(0.0f);
+        vertex.pdf = pdf;
+    }
+
+    /// Add a contribution of the path to all vertices
+    inline void splat(const Spectrum &value) {
+        for (size_t i=0; i<m_size; ++i)
+            m_vertices[i].radiance += value * m_vertices[i].invThroughput;
+    }
+
+    inline size_t size() const { return m_size; }
+
+    /// Hand the vertices <tt>[start, size())</tt> to \c records and drop them
+    template <typename Recorder> void commit(Recorder &recorder, size_t start = 0) {
+        for (size_t i=start; i<m_size; ++i) {
+            const Vertex &vertex = m_vertices[i];
+            Float value = vertex.radiance.average() / vertex.pdf;
+            if (!std::isfinite(value) || value < 0)
+                continue;
+            GuidingRecord record;
+            record.p = vertex.p;
+            record.d = vertex.d;
+            record.value = value;
+            recorder.record(record);
+        }
+        m_size = std::min(m_size, start);
+    }
+
+private:
+    struct Vertex {
+        Point p;
+        Vector d;
+        Spectrum invThroughput, radiance;
+        Float pdf;
+    };
+
+    Vertex m_vertices[MTS_GUIDING_MAX_VERTICES];
+    size_t m_size;
+};
+
+/**
+ * \brief Online path guiding state of an integrator
+ *
+ * Holds the configuration, the SD-tree, and one buffer of training
+ * records per rendering thread. A thread merges its buffer into the
+ * building trees once it is full, and the remainder is merged after
+ * each pass. The trees are only trained on the local machine.
+ */
+class PathGuiding {
+public:
+    PathGuiding(const Properties &props) {
+        /* Train and use a guiding distribution? */
+        m_enabled = props.getBoolean("guiding", false);
+        /* Number of training passes, the k-th one uses 2^k samples per pixel */
+        m_passes = props.getInteger("guidingPasses", 5);
+        /* Subdivide an S-tree leaf after this many samples times sqrt(2^k) */
+        m_spatialThreshold = props.getInteger("guidingSpatialThreshold", 12000);
+        /* Subdivide D-tree quadrants holding more than this fraction of the flux */
+        m_directionalThreshold = props.getFloat("guidingDirectionalThreshold", 0.01f);
+        /* Maximum D-tree depth */
+        m_maxDepth = props.getInteger("guidingMaxDepth", 20);
+        /* Probability of sampling the BSDF or phase function instead of the guide */
+        m_bsdfSamplingFraction = props.getFloat("bsdfSamplingFraction", 0.5f);
+
+        if (m_passes < 0 || m_spatialThreshold <= 0 || m_maxDepth < 1)
+            SLog(EError, "Invalid path guiding parameters!");
+        if (m_bsdfSamplingFraction <= 0 || m_bsdfSamplingFraction > 1)
+            SLog(EError, "The 'bsdfSamplingFraction' parameter must be in (0, 1]!");
+        init();
+    }
+
+    PathGuiding(Stream *stream) {
+        m_enabled = stream->readBool();
+        m_passes = stream->readInt();
+        m_spatialThreshold = stream->readInt();
+        m_directionalThreshold = stream->readFloat();
+        m_maxDepth = stream->readInt();
+        m_bsdfSamplingFraction = stream->readFloat();
+        init();
+    }
+
+    ~PathGuiding() {
+        for (size_t i=0; i<m_buffers.size(); ++i)
+            delete m_buffers[i];
+    }
+
+    void serialize(Stream *stream) const {
+        stream->writeBool(m_enabled);
+        stream->writeInt(m_passes);
+        stream->writeInt(m_spatialThreshold);
+        stream->writeFloat(m_directionalThreshold);
+        stream->writeInt(m_maxDepth);
+        stream->writeFloat(m_bsdfSamplingFraction);
+    }
+
+    inline bool isEnabled() const { return m_enabled; }
+
+    /// Are training records being collected at the moment?
+    inline bool isTraining() const { return m_training; }
+
+    inline Float getBSDFSamplingFraction() const { return m_bsdfSamplingFraction; }
+
+    /**
+     * \brief Return the sampling D-tree at \c p, or \c NULL if it has
+     * not learned anything there yet
+     */
+    inline const GuidingDTree *lookup(const Point &p) const {
+        if (!m_enabled)
+            return NULL;
+        const GuidingDTree &tree = m_tree.lookup(p).sampling;
+        return tree.getTotal() > 0 ? &tree : NULL;
+    }
+
+    /**
+     * \brief Sample a direction from the mixture of \c bsdf and \c guide
+     *
+     * Works like \ref BSDF::sample(), \c pdf receives the density of the
+     * mixture. Directions of delta components can only come from the
+     * BSDF, their weight accounts for the selection probability.
+     */
+    Spectrum sample(const BSDF *bsdf, const GuidingDTree *guide,
+            BSDFSamplingRecord &bRec, Float &pdf, Point2 sample) const {
+        Float alpha = m_bsdfSamplingFraction;
+        Spectrum result;
+        if (sample.x < alpha) {
+            sample.x /= alpha;
+            Float bsdfPdf;
+            result = bsdf->sample(bRec, bsdfPdf, sample);
+            if (result.isZero()) {
+                pdf = 0;
+                return result;
+            }
+            if (bRec.sampledType & BSDF::EDelta) {
+                pdf = bsdfPdf * alpha;
+                return result / alpha;
+            }
+            result *= bsdfPdf;
+        } else {
+            sample.x = (sample.x - alpha) / (1 - alpha);
+            Float guidePdf;
+            bRec.wo = bRec.its.toLocal(guide->sampleDirection(sample, guidePdf));
+            bRec.sampledComponent = -1;
+            bRec.sampledType = bsdf->getType() & BSDF::ESmooth;
+            bRec.eta = 1.0f;
+            if (Frame::cosTheta(bRec.wi) * Frame::cosTheta(bRec.wo) < 0)
+                bRec.eta = Frame::cosTheta(bRec.wi) > 0
+                    ? bsdf->getEta() : 1 / bsdf->getEta();
+            result = bsdf->eval(bRec);
+            if (result.isZero()) {
+                pdf = 0;
+                return result;
+            }
+        }
+
+        pdf = this->pdf(bsdf, guide, bRec);
+        return pdf > 0 ? result / pdf : Spectrum(0.0f);
+    }
+
+    /// Density of the mixture of \c bsdf and \c guide (if not \c NULL)
+    inline Float pdf(const BSDF *bsdf, const GuidingDTree *guide,
+            const BSDFSamplingRecord &bRec) const {
+        Float pdf = bsdf->pdf(bRec);
+        if (!guide)
+            return pdf;
+        return m_bsdfSamplingFraction * pdf + (1 - m_bsdfSamplingFraction)
+            * guide->pdfDirection(bRec.its.toWorld(bRec.wo));
+    }
+
+    /// Sample a direction from the mixture of \c phase and \c guide
+    Float sample(const PhaseFunction *phase, const GuidingDTree *guide,
+            PhaseFunctionSamplingRecord &pRec, Float &pdf, Sampler *sampler) const {
+        Float alpha = m_bsdfSamplingFraction, value;
+        if (sampler->next1D() < alpha) {
+            Float phasePdf;
+            value = phase->sample(pRec, phasePdf, sampler);
+            if (value == 0) {
+                pdf = 0;
+                return 0;
+            }
+            value *= phasePdf;
+        } else {
+            Float guidePdf;
+            pRec.wo = guide->sampleDirection(sampler->next2D(), guidePdf);
+            value = phase->eval(pRec);
+            if (value == 0) {
+                pdf = 0;
+                return 0;
+            }
+        }
+
+        pdf = this->pdf(phase, guide, pRec);
+        return pdf > 0 ? value / pdf : 0;
+    }
+
+    /// Density of the mixture of \c phase and \c guide (if not \c NULL)
+    inline Float pdf(const PhaseFunction *phase, const GuidingDTree *guide,
+            const PhaseFunctionSamplingRecord &pRec) const {
+        Float pdf = phase->pdf(pRec);
+        if (!guide)
+            return pdf;
+        return m_bsdfSamplingFraction * pdf + (1 - m_bsdfSamplingFraction)
+            * guide->pdfDirection(pRec.wo);
+    }
+
+    /// Queue a training record of the current thread
+    inline void record(const GuidingRecord &record) {
+        std::vector<GuidingRecord> *&buffer = m_buffer.get();
+        if (EXPECT_NOT_TAKEN(!buffer)) {
+            buffer = new std::vector<GuidingRecord>();
+            buffer->reserve(MTS_GUIDING_BUFFER_SIZE);
+            LockGuard lock(m_mutex);
+            m_buffers.push_back(buffer);
+        }
+        buffer->push_back(record);
+        if (buffer->size() >= MTS_GUIDING_BUFFER_SIZE) {
+            LockGuard lock(m_mutex);
+            merge(*buffer);
+        }
+    }
+
+    /**
+     * \brief Run the training passes followed by the final rendering
+     *
+     * \param renderPass
+     *     Renders the image with the sampler registered under the given
+     *     resource ID, i.e. calls the \c render() implementation of the
+     *     integrator's base class
+     */
+    bool render(Scene *scene, int samplerResID,
+            const std::function<bool (int)> &renderPass) {
+        if (!m_enabled)
+            return renderPass(samplerResID);
+
+        ref<Scheduler> sched = Scheduler::getInstance();
+        ref<Film> film = scene->getFilm();
+        AABB aabb = scene->getAABB();
+        m_tree.clear(aabb.isValid() ? aabb : AABB(Point(0.0f), Point(1.0f)));
+
+        for (int pass=0; pass<m_passes; ++pass) {
+            size_t sampleCount = (size_t) 1 << pass;
+            Properties props("independent");
+            props.setInteger("sampleCount", (int) sampleCount);
+            ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+                createObject(MTS_CLASS(Sampler), props));
+            sampler->configure();
+
+            /* Create a sampler instance for every core */
+            std::vector<SerializableObject *> samplers(sched->getCoreCount());
+            for (size_t i=0; i<sched->getCoreCount(); ++i) {
+                ref<Sampler> clonedSampler = sampler->clone();
+                clonedSampler->incRef();
+                samplers[i] = clonedSampler.get();
+            }
+            int trainingResID = sched->registerMultiResource(samplers);
+            for (size_t i=0; i<sched->getCoreCount(); ++i)
+                samplers[i]->decRef();
+
+            SLog(EInfo, "Path guiding: training pass %i/%i (" SIZE_T_FMT " %s)",
+                pass + 1, m_passes, sampleCount, sampleCount == 1 ? "sample" : "samples");
+
+            m_training = true;
+            bool success = renderPass(trainingResID);
+            m_training = false;
+            sched->unregisterResource(trainingResID);
+
+            for (size_t i=0; i<m_buffers.size(); ++i)
+                merge(*m_buffers[i]);
+
+            if (!success)
+                return false;
+
+            m_tree.refine((size_t) (m_spatialThreshold
+                * std::sqrt((Float) sampleCount)));
+            m_tree.swap(m_directionalThreshold, m_maxDepth);
+            film->clear();
+
+            SLog(EInfo, "Path guiding: " SIZE_T_FMT " spatial cells, %.1f "
+                "directional nodes on average", m_tree.getLeafCount(),
+                m_tree.getAverageDTreeSize());
+        }
+
+        return renderPass(samplerResID);
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "PathGuiding[" << endl
+            << "  enabled = " << m_enabled << "," << endl
+            << "  passes = " << m_passes << "," << endl
+            << "  spatialThreshold = " << m_spatialThreshold << "," << endl
+            << "  directionalThreshold = " << m_directionalThreshold << "," << endl
+            << "  maxDepth = " << m_maxDepth << "," << endl
+            << "  bsdfSamplingFraction = " << m_bsdfSamplingFraction << endl
+            << "]";
+        return oss.str();
+    }
+
+private:
+    void init() {
+        m_training = false;
+        m_mutex = new Mutex();
+    }
+
+    /// Merge a buffer into the building trees (the caller holds the lock)
+    void merge(std::vector<GuidingRecord> &buffer) {
+        for (size_t i=0; i<buffer.size(); ++i) {
+            const GuidingRecord &record = buffer[i];
+            GuidingDTree &tree = m_tree.lookup(record.p).building;
+            tree.record(GuidingDTree::toSquare(record.d), record.value);
+            tree.addSample();
+        }
+        buffer.clear();
+    }
+
+    bool m_enabled;
+    int m_passes;
+    int m_spatialThreshold;
+    Float m_directionalThreshold;
+    int m_maxDepth;
+    Float m_bsdfSamplingFraction;
+
+    GuidingSDTree m_tree;
+    bool m_training;
+    ref<Mutex> m_mutex;
+    PrimitiveThreadLocal<std::vector<GuidingRecord> *> m_buffer;
+    std::vector<std::vector<GuidingRecord> *> m_buffers;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __PATH_GUIDING_H */
@@ -18,6 +18,7 @@
 
 #include <mitsuba/render/scene.h>
 #include <mitsuba/core/statistics.h>
+#include "guiding.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -56,8 +57,40 @@ static StatsCounter avgPathLength("Path tracer", "Average path length", EAverage
  *        See page~\pageref{sec:hideemitters} for details.
  *        \default{no, i.e. \code{false}}
  *     }
+ *     \parameter{guiding}{\Boolean}{Learn the distribution of incident
+ *        light over a number of training passes and use it to guide
+ *        BSDF sampling? See the description below for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
+ *     \parameter{guidingPasses}{\Integer}{Number of training passes,
+ *        the $k$-th one renders $2^k$ samples per pixel \default{\code{5}}
+ *     }
+ *     \parameter{bsdfSamplingFraction}{\Float}{Probability of sampling
+ *        the BSDF instead of the learned distribution \default{0.5}
+ *     }
+ *     \parameter{guidingSpatialThreshold, guidingDirectionalThreshold,
+ *        guidingMaxDepth}{\Integer, \Float, \Integer}{Subdivision criteria
+ *        of the spatial and directional trees
+ *        \default{\code{12000}, 0.01, \code{20}}
+ *     }
  * }
  *
+ * \paragraph{Path guiding:}
+ * When \code{guiding} is enabled, the integrator first renders a few
+ * training passes with doubling sample counts. Every path records
+ * estimates of the light arriving at its vertices into a binary tree over
+ * the scene, whose leaves hold quadtrees over the sphere of directions
+ * (an SD-tree, see ``Practical Path Guiding for Efficient Light-Transport
+ * Simulation'' by M\"uller et al.). After each pass, the trees are refined
+ * where enough light was recorded, and the following passes sample
+ * directions from a one-sample MIS combination of the BSDF and the
+ * learned distribution. This helps when light arrives through small
+ * openings that BSDF sampling rarely finds. The image of the final pass,
+ * which uses the sampler of the scene, is the result. The rendering
+ * threads collect their training records in private buffers that are
+ * merged into the trees when full and between passes; the trees are
+ * only trained on the local machine.
+ *
  * This integrator implements a basic path tracer and is a \emph{good default choice}
  * when there is no strong reason to prefer another method.
  *
@@ -122,11 +155,27 @@ static StatsCounter avgPathLength("Path tracer", "Average path length", EAverage
 class MIPathTracer : public MonteCarloIntegrator {
 public:
     MIPathTracer(const Properties &props)
-        : MonteCarloIntegrator(props) { }
+        : MonteCarloIntegrator(props), m_guiding(props) { }
 
     /// Unserialize from a binary data stream
     MIPathTracer(Stream *stream, InstanceManager *manager)
-        : MonteCarloIntegrator(stream, manager) { }
+        : MonteCarloIntegrator(stream, manager), m_guiding(stream) { }
+
+    bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        return m_guiding.render(scene, samplerResID, [&](int resID) {
+            return MonteCarloIntegrator::render(scene, queue, job,
+                sceneResID, sensorResID, resID);
+        });
+    }
+
+    /// Add a contribution to the radiance estimate and the training records
+    inline void addRadiance(Spectrum &Li, const Spectrum &value,
+            GuidingPath *guidingPath) const {
+        Li += value;
+        if (guidingPath)
+            guidingPath->splat(value);
+    }
 
     Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec) const {
         /* Some aliases and local variables */
@@ -144,13 +193,16 @@ public:
         Spectrum throughput(1.0f);
         Float eta = 1.0f;
 
+        GuidingPath trainingPath;
+        GuidingPath *guidingPath = m_guiding.isTraining() ? &trainingPath : NULL;
+
         while (rRec.depth <= m_maxDepth || m_maxDepth < 0) {
             if (!its.isValid()) {
                 /* If no intersection could be found, potentially return
                    radiance from a environment luminaire if it exists */
                 if ((rRec.type & RadianceQueryRecord::EEmittedRadiance)
                     && (!m_hideEmitters || scattered))
-                    Li += throughput * scene->evalEnvironment(ray);
+                    addRadiance(Li, throughput * scene->evalEnvironment(ray), guidingPath);
                 break;
             }
 
@@ -159,11 +211,12 @@ public:
             /* Possibly include emitted radiance if requested */
             if (its.isEmitter() && (rRec.type & RadianceQueryRecord::EEmittedRadiance)
                 && (!m_hideEmitters || scattered))
-                Li += throughput * its.Le(-ray.d);
+                addRadiance(Li, throughput * its.Le(-ray.d), guidingPath);
 
             /* Include radiance from a subsurface scattering model if requested */
             if (its.hasSubsurface() && (rRec.type & RadianceQueryRecord::ESubsurfaceRadiance))
-                Li += throughput * its.LoSub(scene, rRec.sampler, -ray.d, throughput, rRec.depth);
+                addRadiance(Li, throughput * its.LoSub(scene, rRec.sampler,
+                    -ray.d, throughput, rRec.depth), guidingPath);
 
             if ((rRec.depth >= m_maxDepth && m_maxDepth > 0)
                 || (m_strictNormals && dot(ray.d, its.geoFrame.n)
@@ -180,6 +233,10 @@ public:
             /*                     Direct illumination sampling                     */
             /* ==================================================================== */
 
+            /* Learned distribution of incident light, if available */
+            const GuidingDTree *guide = (bsdf->getType() & BSDF::ESmooth)
+                ? m_guiding.lookup(its.p) : NULL;
+
             /* Estimate the direct illumination if this is requested */
             DirectSamplingRecord dRec(its);
 
@@ -202,11 +259,11 @@ public:
                         /* Calculate prob. of having generated that direction
                            using BSDF sampling */
                         Float bsdfPdf = (emitter->isOnSurface() && dRec.measure == ESolidAngle)
-                            ? bsdf->pdf(bRec) : 0;
+                            ? m_guiding.pdf(bsdf, guide, bRec) : 0;
 
                         /* Weight using the power heuristic */
                         Float weight = miWeight(dRec.pdf, bsdfPdf);
-                        Li += throughput * value * bsdfVal * weight;
+                        addRadiance(Li, throughput * value * bsdfVal * weight, guidingPath);
                     }
                 }
             }
@@ -215,10 +272,12 @@ public:
             /*                            BSDF sampling                             */
             /* ==================================================================== */
 
-            /* Sample BSDF * cos(theta) */
+            /* Sample BSDF * cos(theta), possibly mixed with the guide */
             Float bsdfPdf;
             BSDFSamplingRecord bRec(its, rRec.sampler, ERadiance);
-            Spectrum bsdfWeight = bsdf->sample(bRec, bsdfPdf, rRec.nextSample2D());
+            Spectrum bsdfWeight = guide
+                ? m_guiding.sample(bsdf, guide, bRec, bsdfPdf, rRec.nextSample2D())
+                : bsdf->sample(bRec, bsdfPdf, rRec.nextSample2D());
             if (bsdfWeight.isZero())
                 break;
 
@@ -232,6 +291,7 @@ public:
 
             bool hitEmitter = false;
             Spectrum value;
+            Point p = its.p;
 
             /* Trace a ray in this direction */
             ray = Ray(its.p, wo, ray.time);
@@ -264,6 +324,10 @@ public:
             throughput *= bsdfWeight;
             eta *= bRec.eta;
 
+            /* Estimate the light arriving from this direction for training */
+            if (guidingPath && !(bRec.sampledType & BSDF::EDelta))
+                guidingPath->push(p, wo, throughput, bsdfPdf);
+
             /* If a luminaire was hit, estimate the local illumination and
                weight using the power heuristic */
             if (hitEmitter &&
@@ -272,7 +336,7 @@ public:
                    implemented direct illumination sampling technique */
                 const Float lumPdf = (!(bRec.sampledType & BSDF::EDelta)) ?
                     scene->pdfEmitterDirect(dRec) : 0;
-                Li += throughput * value * miWeight(bsdfPdf, lumPdf);
+                addRadiance(Li, throughput * value * miWeight(bsdfPdf, lumPdf), guidingPath);
             }
 
             /* ==================================================================== */
@@ -292,6 +356,9 @@ public:
             throughput /= q;
         }
 
+        if (guidingPath)
+            guidingPath->commit(m_guiding);
+
         /* Store statistics */
         avgPathLength.incrementBase();
         avgPathLength += rRec.depth;
@@ -307,6 +374,7 @@ public:
 
     void serialize(Stream *stream, InstanceManager *manager) const {
         MonteCarloIntegrator::serialize(stream, manager);
+        m_guiding.serialize(stream);
     }
 
     std::string toString() const {
@@ -314,12 +382,15 @@ public:
         oss << "MIPathTracer[" << endl
             << "  maxDepth = " << m_maxDepth << "," << endl
             << "  rr = " << m_rr.toString() << "," << endl
-            << "  strictNormals = " << m_strictNormals << endl
+            << "  strictNormals = " << m_strictNormals << "," << endl
+            << "  guiding = " << indent(m_guiding.toString()) << endl
             << "]";
         return oss.str();
     }
 
     MTS_DECLARE_CLASS()
+private:
+    mutable PathGuiding m_guiding;
 };
 
 MTS_IMPLEMENT_CLASS_S(MIPathTracer, false, MonteCarloIntegrator)
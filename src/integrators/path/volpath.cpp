@@ -18,6 +18,7 @@
 
 #include <mitsuba/render/scene.h>
 #include <mitsuba/core/statistics.h>
+#include "guiding.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -87,6 +88,30 @@ static StatsCounter avgPathLength("Volumetric path tracer",
  *        $\infty$, i.e.\ all paths are allowed.
  *        \default{\code{-1}}
  *     }
+ *     \parameter{wavefront}{\Boolean}{
+ *        Trace the paths of each image block in waves instead of one at a
+ *        time. Every wave first intersects the pending rays of all live
+ *        paths, and then advances the paths by one bounce, sorted by
+ *        medium and BSDF so that consecutive paths run the same code.
+ *        Requires the \pluginref{independent} sampler; other samplers
+ *        fall back to the regular mode.
+ *        \default{\code{false}}
+ *     }
+ *     \parameter{wavefrontSize}{\Integer}{
+ *        Maximum number of camera samples whose paths are traced together
+ *        in wavefront mode. Whole pixels are added until this budget is
+ *        reached.
+ *        \default{\code{4096}}
+ *     }
+ *     \parameter{guiding}{\Boolean}{Learn the distribution of light
+ *        arriving in participating media and use it to guide phase
+ *        function sampling? Works like the guiding of surface scattering
+ *        in the \pluginref{path} plugin, which also describes the
+ *        remaining \code{guiding*} parameters and
+ *        \code{bsdfSamplingFraction}. The training passes always trace one
+ *        path at a time, even in wavefront mode.
+ *        \default{no, i.e. \code{false}}
+ *     }
  * }
  *
  * This plugin provides a volumetric path tracer that can be used to
@@ -125,12 +150,43 @@ protected:
     int m_minMediumScatteringChain;
     int m_maxMediumScatteringChain;
 
+    bool m_wavefront;
+    size_t m_wavefrontSize;
+
+    /// State of a path that is traced in wavefront mode
+    struct WavefrontPath {
+        RayDifferential ray;
+        RadianceQueryRecord rRec;
+        Spectrum throughput;
+        Float eta;
+        int mediumInteractionChain;
+        bool hasEnteredAVolume;
+        /// Index of the camera sample that this path contributes to
+        uint32_t sample;
+    };
+
+    /// Camera sample whose paths are traced in wavefront mode
+    struct WavefrontSample {
+        Point2 samplePos;
+        Spectrum weight, Li;
+        Float alpha;
+        /* Split budget shared by all paths of this sample, like the
+           rRec.splits value that is threaded through LiPathSteps() */
+        int splits;
+    };
+
 public:
-    VolumetricPathTracer(const Properties &props) : MonteCarloIntegrator(props) {
+    VolumetricPathTracer(const Properties &props)
+            : MonteCarloIntegrator(props), m_guiding(props) {
         m_onlyPathsThatEnteredAVolume = props.getBoolean("onlyPathsThatEnteredAVolume", false);
         m_minMediumScatteringChain = props.getInteger("minMediumScatteringChain", -1);
         m_maxMediumScatteringChain = props.getInteger("maxMediumScatteringChain", -1);
         m_explicitSubsurfBoundary = props.getBoolean("explicitSubsurfBoundary", true);
+        m_wavefront = props.getBoolean("wavefront", false);
+        m_wavefrontSize = props.getSize("wavefrontSize", 4096);
+
+        if (m_wavefrontSize == 0)
+            Log(EError, "The 'wavefrontSize' parameter must be positive!");
 
         if (m_minMediumScatteringChain >= 0 && m_maxMediumScatteringChain >= 0
                 && m_minMediumScatteringChain > m_maxMediumScatteringChain) {
@@ -141,11 +197,13 @@ public:
 
     /// Unserialize from a binary data stream
     VolumetricPathTracer(Stream *stream, InstanceManager *manager)
-             : MonteCarloIntegrator(stream, manager) {
+             : MonteCarloIntegrator(stream, manager), m_guiding(stream) {
         m_onlyPathsThatEnteredAVolume = stream->readBool();
         m_minMediumScatteringChain = stream->readInt();
         m_maxMediumScatteringChain = stream->readInt();
         m_explicitSubsurfBoundary = stream->readBool();
+        m_wavefront = stream->readBool();
+        m_wavefrontSize = stream->readSize();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -154,6 +212,233 @@ public:
         stream->writeInt(m_minMediumScatteringChain);
         stream->writeInt(m_maxMediumScatteringChain);
         stream->writeBool(m_explicitSubsurfBoundary);
+        stream->writeBool(m_wavefront);
+        stream->writeSize(m_wavefrontSize);
+        m_guiding.serialize(stream);
+    }
+
+    bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        return m_guiding.render(scene, samplerResID, [&](int resID) {
+            return MonteCarloIntegrator::render(scene, queue, job,
+                sceneResID, sensorResID, resID);
+        });
+    }
+
+    bool preprocess(const Scene *scene, RenderQueue *queue,
+            const RenderJob *job, int sceneResID, int sensorResID,
+            int samplerResID) {
+        if (!MonteCarloIntegrator::preprocess(scene, queue, job,
+                sceneResID, sensorResID, samplerResID))
+            return false;
+        if (m_wavefront && !supportsWavefront(scene->getSampler()))
+            Log(EWarn, "Wavefront mode requires the 'independent' sampler, "
+                "falling back to tracing one path at a time");
+
+        /* Media that enable it cache their transmittance toward the emitters */
+        ref_vector<Medium> &media = const_cast<Scene *>(scene)->getMedia();
+        for (size_t i=0; i<media.size(); ++i)
+            media[i]->cacheEmitterTransmittance(scene);
+        return true;
+    }
+
+    /**
+     * Paths of a wavefront consume their random numbers in an interleaved
+     * order, which is only correct when the sampler does not correlate
+     * the dimensions of a sample
+     */
+    static bool supportsWavefront(const Sampler *sampler) {
+        return sampler && sampler->getClass()->getName() == "IndependentSampler";
+    }
+
+    void renderBlock(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points) const {
+        /* The training records need the paths to be traced one at a time */
+        if (!m_wavefront || !supportsWavefront(sampler) || m_guiding.isTraining()) {
+            MonteCarloIntegrator::renderBlock(scene, sensor, sampler,
+                    block, stop, points);
+            return;
+        }
+
+        Float diffScaleFactor = 1.0f /
+            std::sqrt((Float) sampler->getSampleCount());
+
+        bool needsApertureSample = sensor->needsApertureSample();
+        bool needsTimeSample = sensor->needsTimeSample();
+
+        Point2 apertureSample(0.5f);
+        Float timeSample = 0.5f;
+
+        uint32_t queryType = RadianceQueryRecord::ESensorRay;
+
+        if (!sensor->getFilm()->hasAlpha()) /* Don't compute an alpha channel if we don't have to */
+            queryType &= ~RadianceQueryRecord::EOpacity;
+
+        block->clear();
+
+        std::vector<WavefrontSample> samples;
+        std::vector<WavefrontPath> paths, nextPaths;
+        std::vector<uint32_t> order;
+        size_t pixel = 0;
+
+        while (pixel < points.size() && !stop) {
+            samples.clear();
+            paths.clear();
+
+            /* Generate the camera paths of as many pixels as the wavefront holds */
+            while (pixel < points.size() && (samples.empty() ||
+                    samples.size() + sampler->getSampleCount() <= m_wavefrontSize)) {
+                Point2i offset = Point2i(points[pixel++]) + Vector2i(block->getOffset());
+                sampler->generate(offset);
+
+                for (size_t j = 0; j<sampler->getSampleCount(); j++) {
+                    WavefrontPath path;
+                    path.rRec = RadianceQueryRecord(scene, sampler);
+                    path.rRec.newQuery(queryType, sensor->getMedium());
+                    Vector2 pixelOffset;
+                    if (sampler->getSampleCount() == 1) {
+                        pixelOffset = Vector2(0.5f);
+                    } else {
+                        pixelOffset = Vector2(path.rRec.nextSample2D());
+                    }
+
+                    WavefrontSample sample;
+                    sample.samplePos = Point2(offset) + pixelOffset;
+
+                    if (needsApertureSample)
+                        apertureSample = path.rRec.nextSample2D();
+                    if (needsTimeSample)
+                        timeSample = path.rRec.nextSample1D();
+
+                    sample.weight = sensor->sampleRayDifferential(
+                        path.ray, sample.samplePos, apertureSample, timeSample);
+                    path.ray.scaleDifferential(diffScaleFactor);
+
+                    sample.Li = Spectrum(0.0f);
+                    sample.alpha = path.rRec.alpha;
+                    path.throughput = Spectrum(1.0f);
+                    path.eta = 1.0f;
+                    path.mediumInteractionChain = 0;
+                    path.hasEnteredAVolume = false;
+                    path.sample = (uint32_t) samples.size();
+
+                    /* Same initial split decision as in Li() */
+                    int n = 1 + m_rr.split(path.rRec.splits,
+                            path.rRec.throughput, path.eta, sampler);
+                    sample.splits = path.rRec.splits;
+                    samples.push_back(sample);
+                    splitWavefrontPath(path, n, paths);
+
+                    sampler->advance();
+                }
+            }
+
+            while (!paths.empty() && !stop) {
+                /* Intersect the pending rays of all paths in one go */
+                for (size_t i=0; i<paths.size(); ++i) {
+                    WavefrontPath &path = paths[i];
+                    bool camera = path.rRec.type & RadianceQueryRecord::EOpacity;
+                    path.rRec.rayIntersect(path.ray);
+                    if (camera)
+                        samples[path.sample].alpha = path.rRec.alpha;
+                }
+
+                /* Group the paths by what they will interact with */
+                order.resize(paths.size());
+                for (size_t i=0; i<paths.size(); ++i)
+                    order[i] = (uint32_t) i;
+                std::sort(order.begin(), order.end(), WavefrontOrder(paths));
+
+                /* Advance all paths by one step, see LiPathSteps() */
+                nextPaths.clear();
+                for (size_t i=0; i<order.size(); ++i) {
+                    WavefrontPath &path = paths[order[i]];
+                    WavefrontSample &sample = samples[path.sample];
+                    RadianceQueryRecord &rRec = path.rRec;
+
+                    Spectrum throughputBeforeStep = path.throughput;
+                    rRec.splits = sample.splits;
+                    bool alive = LiPathStep(path.ray, rRec, path.eta,
+                        sample.Li, path.throughput, path.mediumInteractionChain,
+                        path.hasEnteredAVolume, NULL);
+                    sample.splits = rRec.splits;
+                    if (!alive) {
+                        avgPathLength.incrementBase();
+                        avgPathLength += rRec.depth;
+                        continue;
+                    }
+
+                    rRec.throughput *= path.throughput
+                            * throughputBeforeStep.invertButKeepZero();
+
+                    int numSplitsHere = 0;
+                    Float q = m_rr.roulette(
+                            rRec.depth, rRec.throughput, path.eta, rRec.sampler);
+                    if (q == 0.0f) {
+                        avgPathLength.incrementBase();
+                        avgPathLength += rRec.depth;
+                        continue;
+                    }
+                    if (q == 1.0f)
+                        numSplitsHere = m_rr.split(sample.splits,
+                                rRec.throughput, path.eta, rRec.sampler);
+                    rRec.throughput /= q;
+                    path.throughput /= q;
+
+                    avgNumSplits.incrementBase();
+                    avgNumSplits += numSplitsHere;
+
+                    splitWavefrontPath(path, numSplitsHere + 1, nextPaths);
+                }
+                paths.swap(nextPaths);
+            }
+
+            for (size_t i=0; i<samples.size(); ++i)
+                block->put(samples[i].samplePos, samples[i].weight * samples[i].Li,
+                        samples[i].alpha);
+        }
+    }
+
+    /// Orders path indices by medium and by the BSDF at the next intersection
+    struct WavefrontOrder {
+        const std::vector<WavefrontPath> &paths;
+
+        WavefrontOrder(const std::vector<WavefrontPath> &paths) : paths(paths) { }
+
+        inline const BSDF *bsdf(const WavefrontPath &path) const {
+            const Intersection &its = path.rRec.its;
+            return its.isValid() ? its.shape->getBSDF() : NULL;
+        }
+
+        inline bool operator()(uint32_t a, uint32_t b) const {
+            const WavefrontPath &pa = paths[a], &pb = paths[b];
+            if (pa.rRec.medium != pb.rRec.medium)
+                return pa.rRec.medium < pb.rRec.medium;
+            return bsdf(pa) < bsdf(pb);
+        }
+    };
+
+    /**
+     * Queue the \c n paths that continue from \c path, with the
+     * throughputs rescaled as in LiPathSteps(). The paths only share
+     * state through their camera sample, so they need not be traced
+     * one after the other.
+     */
+    void splitWavefrontPath(const WavefrontPath &path, int n,
+            std::vector<WavefrontPath> &queue) const {
+        if (path.rRec.depth > m_maxDepth && m_maxDepth > 0) {
+            avgPathLength.incrementBase();
+            avgPathLength += path.rRec.depth;
+            return;
+        }
+
+        for (int i = 0; i < n; i++) {
+            queue.push_back(path);
+            WavefrontPath &child = queue.back();
+            child.rRec.throughput /= n;
+            child.throughput /= n;
+        }
     }
 
     Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec) const {
@@ -173,8 +458,11 @@ public:
          * the rRec. */
         int initial_n = 1 + m_rr.split(rRec.splits, rRec.throughput, eta, rRec.sampler);
         bool hasEnteredAVolume = false;
+        GuidingPath trainingPath;
+        GuidingPath *guidingPath = m_guiding.isTraining() ? &trainingPath : NULL;
         Spectrum Li = LiPathSteps(ray, rRec, eta, internalThroughput, 
-                mediumInteractionChain, hasEnteredAVolume, initial_n);
+                mediumInteractionChain, hasEnteredAVolume, initial_n,
+                guidingPath);
         return Li;
     }
 
@@ -189,12 +477,16 @@ public:
      *
      * WARNING: rRec depth becomes meaningless at return! (due to path 
      * splitting!), the splits field does remains valid
+     *
+     * \param guidingPath Medium vertices whose incident radiance is being
+     * estimated for the path guiding (\c NULL unless training). The split
+     * paths share the vertices that were recorded before the split.
      */
     Spectrum LiPathSteps(const RayDifferential &origRay, RadianceQueryRecord 
             &rRec, const Float origEta, const Spectrum &initialThroughput,
             const int origMediumInteractionChain,
             const bool origHadVolumeInteraction,
-            const int n) const {
+            const int n, GuidingPath *guidingPath) const {
         if (rRec.depth > m_maxDepth && m_maxDepth > 0) {
             avgPathLength.incrementBase();
             avgPathLength += rRec.depth;
@@ -216,6 +508,7 @@ public:
             Float eta = origEta;
             rRec = rRecOrig;
             rRec.splits = totalNumSplits;
+            size_t guidingStart = guidingPath ? guidingPath->size() : 0;
 
             /* To avoid overflowing the stack, we only explicitly call 
              * ourselves recursively if we *have* to split into 2 or more 
@@ -226,7 +519,7 @@ public:
             do {
                 Spectrum throughputBeforeStep = thisThroughput;
                 if (!LiPathStep(ray, rRec, eta, Li, thisThroughput, 
-                        mediumInteractionChain, hasEnteredAVolume)) {
+                        mediumInteractionChain, hasEnteredAVolume, guidingPath)) {
                     avgPathLength.incrementBase();
                     avgPathLength += rRec.depth;
                     nRecursive = 0;
@@ -259,15 +552,18 @@ public:
                 avgNumSplits += numSplitsHere;
             } while (nRecursive == 1);
 
-            if (nRecursive == 0)
-                continue; // End of this path, go to the next split
+            if (nRecursive != 0) {
+                /* We have nRecursive > 1, so we explicitly have to call 
+                 * ourselves recursively */
+                Li += LiPathSteps(ray, rRec, eta, thisThroughput, 
+                        mediumInteractionChain, hasEnteredAVolume,
+                        nRecursive, guidingPath);
+                totalNumSplits = rRec.splits;
+            }
 
-            /* We have nRecursive > 1, so we explicitly have to call 
-             * ourselves recursively */
-            Li += LiPathSteps(ray, rRec, eta, thisThroughput, 
-                    mediumInteractionChain, hasEnteredAVolume,
-                    nRecursive);
-            totalNumSplits = rRec.splits;
+            /* End of this path, record the vertices it added */
+            if (guidingPath)
+                guidingPath->commit(m_guiding, guidingStart);
         }
 
         return Li;
@@ -286,7 +582,8 @@ public:
      */
     bool LiPathStep(RayDifferential &ray, RadianceQueryRecord &rRec,
             Float &eta, Spectrum &Li, Spectrum &throughput,
-            int &mediumInteractionChain, bool &hasEnteredAVolume) const {
+            int &mediumInteractionChain, bool &hasEnteredAVolume,
+            GuidingPath *guidingPath) const {
         /* Some aliases and local variables */
         const Scene *scene = rRec.scene;
         Intersection &its = rRec.its;
@@ -321,6 +618,9 @@ public:
 
             throughput *= mRec.sigmaS * mRec.transmittance / mRec.pdfSuccess;
 
+            /* Learned distribution of incident light, if available */
+            const GuidingDTree *guide = m_guiding.lookup(mRec.p);
+
             /* ==================================================================== */
             /*                          Luminaire sampling                          */
             /* ==================================================================== */
@@ -347,12 +647,12 @@ public:
                         /* Calculate prob. of having sampled that direction using
                            phase function sampling */
                         Float phasePdf = (emitter->isOnSurface() && dRec.measure == ESolidAngle)
-                                ? phase->pdf(pRec) : (Float) 0.0f;
+                                ? m_guiding.pdf(phase, guide, pRec) : (Float) 0.0f;
 
                         /* Weight using the power heuristic */
                         const Float weight = miWeight(dRec.pdf, phasePdf);
                         if (!m_onlyPathsThatEnteredAVolume || hasEnteredAVolume)
-                            Li += throughput * value * phaseVal * weight;
+                            addRadiance(Li, throughput * value * phaseVal * weight, guidingPath);
                     }
                 }
             }
@@ -363,11 +663,17 @@ public:
 
             Float phasePdf;
             PhaseFunctionSamplingRecord pRec(mRec, -ray.d);
-            Float phaseVal = phase->sample(pRec, phasePdf, rRec.sampler);
+            Float phaseVal = guide
+                ? m_guiding.sample(phase, guide, pRec, phasePdf, rRec.sampler)
+                : phase->sample(pRec, phasePdf, rRec.sampler);
             if (phaseVal == 0.0f)
                 return false;
             throughput *= phaseVal;
 
+            /* Estimate the light arriving from this direction for training */
+            if (guidingPath)
+                guidingPath->push(mRec.p, pRec.wo, throughput, phasePdf);
+
             /* Trace a ray in this direction */
             ray = Ray(mRec.p, pRec.wo, ray.time);
             ray.mint = 0;
@@ -382,7 +688,7 @@ public:
                     && includeMediumChainDepth(mediumInteractionChain)) {
                 const Float emitterPdf = scene->pdfEmitterDirect(dRec);
                 if (!m_onlyPathsThatEnteredAVolume || hasEnteredAVolume)
-                    Li += throughput * value * miWeight(phasePdf, emitterPdf);
+                    addRadiance(Li, throughput * value * miWeight(phasePdf, emitterPdf), guidingPath);
             }
 
             /* ==================================================================== */
@@ -414,7 +720,7 @@ public:
                     if (rRec.medium)
                         value *= rRec.medium->evalTransmittance(ray, rRec.sampler);
                     if (!m_onlyPathsThatEnteredAVolume || hasEnteredAVolume)
-                        Li += value;
+                        addRadiance(Li, value, guidingPath);
                 }
 
                 return false;
@@ -424,14 +730,15 @@ public:
             if (its.isEmitter() && (rRec.type & RadianceQueryRecord::EEmittedRadiance)
                 && (!m_hideEmitters || scattered))
                 if (!m_onlyPathsThatEnteredAVolume || hasEnteredAVolume)
-                    Li += throughput * its.Le(-ray.d);
+                    addRadiance(Li, throughput * its.Le(-ray.d), guidingPath);
 
             /* Include radiance from a subsurface integrator if requested */
             if (its.hasSubsurface() && (!m_explicitSubsurfBoundary || !its.hasLiSubsurface())
                     && (rRec.type & RadianceQueryRecord::ESubsurfaceRadiance)) {
                 if (!m_onlyPathsThatEnteredAVolume || hasEnteredAVolume)
-                    Li += throughput * its.LoSub(
-                            scene, rRec.sampler, -ray.d, throughput, rRec.depth);
+                    addRadiance(Li, throughput * its.LoSub(
+                            scene, rRec.sampler, -ray.d, throughput, rRec.depth),
+                            guidingPath);
             }
 
             if (rRec.depth >= m_maxDepth && m_maxDepth != -1)
@@ -480,7 +787,7 @@ public:
                         /* Weight using the power heuristic */
                         const Float weight = miWeight(dRec.pdf, bsdfPdf);
                         if (!m_onlyPathsThatEnteredAVolume || hasEnteredAVolume)
-                            Li += throughput * value * bsdfVal * weight;
+                            addRadiance(Li, throughput * value * bsdfVal * weight, guidingPath);
                     }
                 }
             }
@@ -524,8 +831,8 @@ public:
             if (its.hasSubsurface() && its.hasLiSubsurface() && m_explicitSubsurfBoundary) {
                 if (rRec.type & RadianceQueryRecord::ESubsurfaceRadiance) {
                     if (!m_onlyPathsThatEnteredAVolume || hasEnteredAVolume)
-                        Li += throughput * its.LiSub(scene, rRec.sampler, wo,
-                                        throughput, rRec.splits, rRec.depth);
+                        addRadiance(Li, throughput * its.LiSub(scene, rRec.sampler, wo,
+                                    throughput, rRec.splits, rRec.depth), guidingPath);
                 }
 
                 /* If 'outgoing' direction is away from the subsurf medium 
@@ -566,7 +873,7 @@ public:
                 const Float emitterPdf = (!(bRec.sampledType & BSDF::EDelta)) ?
                     scene->pdfEmitterDirect(dRec) : 0;
                 if (!m_onlyPathsThatEnteredAVolume || hasEnteredAVolume)
-                    Li += throughput * value * miWeight(bsdfPdf, emitterPdf);
+                    addRadiance(Li, throughput * value * miWeight(bsdfPdf, emitterPdf), guidingPath);
             }
 
             /* ==================================================================== */
@@ -677,6 +984,14 @@ public:
         return pdfA / (pdfA + pdfB);
     }
 
+    /// Add a contribution to the radiance estimate and the training records
+    inline void addRadiance(Spectrum &Li, const Spectrum &value,
+            GuidingPath *guidingPath) const {
+        Li += value;
+        if (guidingPath)
+            guidingPath->splat(value);
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "VolumetricPathTracer[" << endl
@@ -684,14 +999,19 @@ public:
             << "  onlyPathsThatEnteredAVolume = " << m_onlyPathsThatEnteredAVolume << "," << endl
             << "  minMediumScatteringChain = " << m_minMediumScatteringChain << "," << endl
             << "  maxMediumScatteringChain = " << m_maxMediumScatteringChain << "," << endl
+            << "  wavefront = " << m_wavefront << "," << endl
+            << "  wavefrontSize = " << m_wavefrontSize << "," << endl
             << "  maxDepth = " << m_maxDepth << "," << endl
             << "  rr = " << m_rr.toString() << "," << endl
-            << "  strictNormals = " << m_strictNormals << endl
+            << "  strictNormals = " << m_strictNormals << "," << endl
+            << "  guiding = " << indent(m_guiding.toString()) << endl
             << "]";
         return oss.str();
     }
 
     MTS_DECLARE_CLASS()
+private:
+    mutable PathGuiding m_guiding;
 };
 
 MTS_IMPLEMENT_CLASS_S(VolumetricPathTracer, false, MonteCarloIntegrator)
@@ -19,6 +19,10 @@
 #include <mitsuba/render/medium.h>
 #include <mitsuba/render/phase.h>
 #include <mitsuba/core/timer.h>
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+# include <mitsuba/core/sse.h>
+# define BRE_SSE 1
+#endif
 #if defined(MTS_OPENMP)
 # include <omp.h>
 #endif
@@ -26,7 +30,7 @@
 
 MTS_NAMESPACE_BEGIN
 
-BeamRadianceEstimator::BeamRadianceEstimator(const PhotonMap *pmap, size_t lookupSize) {
+BeamRadianceEstimator::BeamRadianceEstimator(const PhotonMap *pmap, size_t lookupSize, Float radiusScale) {
     /* Use an optimization proposed by Jarosz et al, which accelerates
        the radius computation by extrapolating radius information obtained
        from a kd-tree lookup of a smaller size */
@@ -38,8 +42,10 @@ BeamRadianceEstimator::BeamRadianceEstimator(const PhotonMap *pmap, size_t looku
     m_depth = pmap->getDepth();
 
     Log(EInfo, "Allocating %s of memory for the BRE acceleration data structure",
-        memString(sizeof(BRENode) * m_photonCount).c_str());
+        memString((sizeof(BRENode) + sizeof(BREChildBounds)) * m_photonCount).c_str());
     m_nodes = new BRENode[m_photonCount];
+    m_childBounds = static_cast<BREChildBounds *>(
+        allocAligned(sizeof(BREChildBounds) * m_photonCount));
 
     Log(EInfo, "Computing photon radii ..");
     #if defined(MTS_OPENMP)
@@ -71,14 +77,14 @@ BeamRadianceEstimator::BeamRadianceEstimator(const PhotonMap *pmap, size_t looku
         pmap->nnSearch(photon.getPosition(), searchRadiusSqr, reducedLookupSize, results);
 
         /* Compute photon radius based on a locally uniform density assumption */
-        node.radius = std::sqrt(searchRadiusSqr * sizeFactor);
+        node.radius = std::sqrt(searchRadiusSqr * sizeFactor) * radiusScale;
     }
     Log(EInfo, "Done (took %i ms)", timer->getMilliseconds());
 
     Log(EInfo, "Generating a hierarchy for the beam radiance estimate");
     timer->reset();
 
-    buildHierarchy(0);
+    buildHierarchy();
     Log(EInfo, "Done (took %i ms)", timer->getMilliseconds());
 
     for (int i=0; i<tcount; ++i)
@@ -90,102 +96,240 @@ BeamRadianceEstimator::BeamRadianceEstimator(Stream *stream, InstanceManager *ma
     m_photonCount = stream->readSize();
     m_depth = stream->readSize();
     m_scaleFactor = stream->readFloat();
+    m_aabb = AABB(stream);
     m_nodes = new BRENode[m_photonCount];
+    m_childBounds = static_cast<BREChildBounds *>(
+        allocAligned(sizeof(BREChildBounds) * m_photonCount));
     for (size_t i=0; i<m_photonCount; ++i) {
         BRENode &node = m_nodes[i];
-        node.aabb = AABB(stream);
         node.photon = Photon(stream);
         node.radius = stream->readFloat();
+        stream->readFloatArray(&m_childBounds[i].bounds[0][0], 12);
     }
 }
 
 void BeamRadianceEstimator::serialize(Stream *stream, InstanceManager *manager) const {
     Log(EDebug, "Serializing a BRE data structure (%s)",
-            memString(m_photonCount * sizeof(BRENode)).c_str());
+            memString(m_photonCount * (sizeof(BRENode) + sizeof(BREChildBounds))).c_str());
     stream->writeSize(m_photonCount);
     stream->writeSize(m_depth);
     stream->writeFloat(m_scaleFactor);
+    m_aabb.serialize(stream);
     for (size_t i=0; i<m_photonCount; ++i) {
         BRENode &node = m_nodes[i];
-        node.aabb.serialize(stream);
         node.photon.serialize(stream);
         stream->writeFloat(node.radius);
+        stream->writeFloatArray(&m_childBounds[i].bounds[0][0], 12);
+    }
+}
+
+void BeamRadianceEstimator::buildHierarchy() {
+    m_aabb.reset();
+    if (m_photonCount == 0)
+        return;
+
+    /* Determine a depth with enough subtrees to keep all threads busy */
+    int frontierDepth = -1;
+    #if defined(MTS_OPENMP)
+        int tcount = mts_omp_get_max_threads();
+        if (tcount > 1) {
+            frontierDepth = 1;
+            while ((1 << frontierDepth) < 16 * tcount && frontierDepth < (int) m_depth)
+                ++frontierDepth;
+        }
+    #endif
+
+    /* Collect the roots of these subtrees */
+    std::vector<IndexType> frontier;
+    if (frontierDepth > 0) {
+        std::vector<std::pair<IndexType, int> > stack;
+        stack.push_back(std::make_pair((IndexType) 0, 0));
+        while (!stack.empty()) {
+            IndexType index = stack.back().first;
+            int depth = stack.back().second;
+            stack.pop_back();
+            if (depth == frontierDepth) {
+                frontier.push_back(index);
+                continue;
+            }
+            const Photon &photon = m_nodes[index].photon;
+            if (photon.isLeaf())
+                continue;
+            stack.push_back(std::make_pair(photon.getLeftIndex(index), depth + 1));
+            if (hasRightChild(index))
+                stack.push_back(std::make_pair(photon.getRightIndex(index), depth + 1));
+        }
     }
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i=0; i<(int) frontier.size(); ++i)
+        buildHierarchy(frontier[i], 0, -1);
+
+    /* Finish the top levels */
+    m_aabb = buildHierarchy(0, 0, frontierDepth);
 }
 
-AABB BeamRadianceEstimator::buildHierarchy(IndexType index) {
-    BRENode &node = m_nodes[index];
+AABB BeamRadianceEstimator::buildHierarchy(IndexType index, int depth, int frontierDepth) {
+    if (depth == frontierDepth)
+        return getSubtreeBounds(index);
+
+    const BRENode &node = m_nodes[index];
+    Point center = node.photon.getPosition();
+    Float radius = node.radius;
+    AABB aabb(
+        center - Vector(radius, radius, radius),
+        center + Vector(radius, radius, radius)
+    );
+
+    if (!node.photon.isLeaf()) {
+        AABB left = buildHierarchy(node.photon.getLeftIndex(index),
+            depth + 1, frontierDepth), right;
+        aabb.expandBy(left);
+        if (hasRightChild(index)) {
+            right = buildHierarchy(node.photon.getRightIndex(index),
+                depth + 1, frontierDepth);
+            aabb.expandBy(right);
+        }
+        setChildBounds(index, left, right);
+    }
+
+    return aabb;
+}
 
+AABB BeamRadianceEstimator::getSubtreeBounds(IndexType index) const {
+    const BRENode &node = m_nodes[index];
     Point center = node.photon.getPosition();
     Float radius = node.radius;
-    node.aabb = AABB(
+    AABB aabb(
         center - Vector(radius, radius, radius),
         center + Vector(radius, radius, radius)
     );
 
     if (!node.photon.isLeaf()) {
-        IndexType left = node.photon.getLeftIndex(index);
-        IndexType right = node.photon.getRightIndex(index);
-        if (left)
-            node.aabb.expandBy(buildHierarchy(left));
-        if (right)
-            node.aabb.expandBy(buildHierarchy(right));
+        const BREChildBounds &cb = m_childBounds[index];
+        int children = hasRightChild(index) ? 2 : 1;
+        for (int i=0; i<children; ++i) {
+            aabb.expandBy(Point(cb.bounds[0][i], cb.bounds[1][i], cb.bounds[2][i]));
+            aabb.expandBy(Point(cb.bounds[0][i+2], cb.bounds[1][i+2], cb.bounds[2][i+2]));
+        }
     }
+    return aabb;
+}
 
-    return node.aabb;
+void BeamRadianceEstimator::setChildBounds(IndexType index, const AABB &left, const AABB &right) {
+    BREChildBounds &cb = m_childBounds[index];
+    bool hasRight = right.isValid();
+    for (int i=0; i<3; ++i) {
+        cb.bounds[i][0] = left.min[i];
+        cb.bounds[i][1] = hasRight ? right.min[i] : 0.0f;
+        cb.bounds[i][2] = left.max[i];
+        cb.bounds[i][3] = hasRight ? right.max[i] : 0.0f;
+    }
+}
+
+inline int BeamRadianceEstimator::intersectChildren(IndexType index, const Point &o,
+        const Vector &invD, Float mint, Float maxt) const {
+    const BREChildBounds &cb = m_childBounds[index];
+#if defined(BRE_SSE)
+    __m128 tNear = _mm_set1_ps(mint), tFar = _mm_set1_ps(maxt);
+    for (int i=0; i<3; ++i) {
+        /* Slab distances of (left min, right min, left max, right max) */
+        __m128 t = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(cb.bounds[i]),
+            _mm_set1_ps(o[i])), _mm_set1_ps(invD[i]));
+        __m128 swapped = _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2));
+        tNear = _mm_max_ps(tNear, _mm_min_ps(t, swapped));
+        tFar = _mm_min_ps(tFar, _mm_max_ps(t, swapped));
+    }
+    return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) & 3;
+#else
+    int mask = 0;
+    for (int j=0; j<2; ++j) {
+        Float tNear = mint, tFar = maxt;
+        for (int i=0; i<3; ++i) {
+            Float t1 = (cb.bounds[i][j] - o[i]) * invD[i],
+                  t2 = (cb.bounds[i][j+2] - o[i]) * invD[i];
+            tNear = std::max(tNear, std::min(t1, t2));
+            tFar = std::min(tFar, std::max(t1, t2));
+        }
+        if (tNear <= tFar)
+            mask |= 1 << j;
+    }
+    return mask;
+#endif
 }
 
 Spectrum BeamRadianceEstimator::query(const Ray &r, const Medium *medium) const {
     const Ray ray(r(r.mint), r.d, 0, r.maxt - r.mint, r.time);
-    IndexType *stack = (IndexType *) alloca((m_depth+1) * sizeof(IndexType));
-    IndexType index = 0, stackPos = 1;
     Spectrum result(0.0f);
 
+    /* Test against the bounding box of the whole hierarchy */
+    Float mint, maxt;
+    if (m_photonCount == 0 || !m_aabb.rayIntersect(ray, mint, maxt)
+            || maxt < ray.mint || mint > ray.maxt)
+        return result;
+
+    /* Avoid NaNs in the slab tests of axis-aligned rays */
+    Vector invD;
+    for (int i=0; i<3; ++i) {
+        invD[i] = 1.0f / ray.d[i];
+        if (!std::isfinite(invD[i]))
+            invD[i] = std::numeric_limits<Float>::max();
+    }
+
+    IndexType *stack = (IndexType *) alloca((m_depth+1) * sizeof(IndexType));
+    IndexType index = 0, stackPos = 0;
+
     const Spectrum &sigmaT = medium->getSigmaT();
     const PhaseFunction *phase = medium->getPhaseFunction();
     MediumSamplingRecord mRec;
 
-    while (stackPos > 0) {
+    /* Nodes are only visited when their bounds intersect the ray */
+    while (true) {
         const BRENode &node = m_nodes[index];
         const Photon &photon = node.photon;
 
-        /* Test against the node's bounding box */
-        Float mint, maxt;
-        if (!node.aabb.rayIntersect(ray, mint, maxt) || maxt < ray.mint || mint > ray.maxt) {
-            index = stack[--stackPos];
-            continue;
-        }
-
-        /* Recurse on inner photons */
-        if (!photon.isLeaf()) {
-            if (hasRightChild(index))
-                stack[stackPos++] = photon.getRightIndex(index);
-            index = photon.getLeftIndex(index);
-        } else {
-            index = stack[--stackPos];
-        }
-
-        Vector originToCenter = node.photon.getPosition() - ray.o;
+        Vector originToCenter = photon.getPosition() - ray.o;
         Float diskDistance = dot(originToCenter, ray.d), radSqr = node.radius * node.radius;
-        Float distSqr = (ray(diskDistance) - node.photon.getPosition()).lengthSquared();
+        Float distSqr = (ray(diskDistance) - photon.getPosition()).lengthSquared();
 
         if (diskDistance > 0 && distSqr < radSqr) {
             Float weight = K2(distSqr/radSqr)/radSqr;
 
-            Vector wi = -node.photon.getDirection();
+            Vector wi = -photon.getDirection();
 
             Spectrum transmittance = Spectrum(-sigmaT * diskDistance).exp();
-            result += transmittance * node.photon.getPower()
+            result += transmittance * photon.getPower()
                 * phase->eval(PhaseFunctionSamplingRecord(mRec, wi, -ray.d)) *
                 (weight * m_scaleFactor);
         }
-    }
 
-    return result;
+        int hit = 0;
+        if (!photon.isLeaf()) {
+            hit = intersectChildren(index, ray.o, invD, ray.mint, ray.maxt);
+            if (!hasRightChild(index))
+                hit &= 1;
+        }
+
+        switch (hit) {
+            case 1: index = photon.getLeftIndex(index); break;
+            case 2: index = photon.getRightIndex(index); break;
+            case 3:
+                stack[stackPos++] = photon.getRightIndex(index);
+                index = photon.getLeftIndex(index);
+                break;
+            default:
+                if (stackPos == 0)
+                    return result;
+                index = stack[--stackPos];
+        }
+    }
 }
 
 BeamRadianceEstimator::~BeamRadianceEstimator() {
     delete[] m_nodes;
+    freeAligned(m_childBounds);
 }
 
 MTS_IMPLEMENT_CLASS_S(BeamRadianceEstimator, false, Object)
@@ -36,8 +36,13 @@ public:
     /**
      * \brief Create a BRE acceleration data structure from
      * an existing volumetric photon map
+     *
+     * \param radiusScale
+     *    Uniform scale applied to all photon radii (used to
+     *    shrink the kernels in progressive rendering passes)
      */
-    BeamRadianceEstimator(const PhotonMap *pmap, size_t lookupSize);
+    BeamRadianceEstimator(const PhotonMap *pmap, size_t lookupSize,
+        Float radiusScale = 1.0f);
 
     /**
      * \brief Unserialize a BRE acceleration data structure from
@@ -56,8 +61,37 @@ protected:
     /// Release all memory
     virtual ~BeamRadianceEstimator();
 
-    /// Fit a hierarchy of bounding boxes to the stored photons
-    AABB buildHierarchy(IndexType index);
+    /**
+     * \brief Fit a hierarchy of bounding boxes to the stored photons
+     *
+     * The subtrees below a few top levels are processed in parallel.
+     */
+    void buildHierarchy();
+
+    /**
+     * \brief Fit bounding boxes to the subtree of the given node and
+     * return its bounds
+     *
+     * Subtrees at depth \c frontierDepth (relative to \c index) are
+     * expected to be finished already. Pass -1 to process the entire subtree.
+     */
+    AABB buildHierarchy(IndexType index, int depth, int frontierDepth);
+
+    /// Return the bounds of a finished subtree
+    AABB getSubtreeBounds(IndexType index) const;
+
+    /// Store the bounds of the children of an inner node
+    void setChildBounds(IndexType index, const AABB &left, const AABB &right);
+
+    /**
+     * \brief Intersect a ray segment with the bounds of both children
+     * of an inner node
+     *
+     * \return A bit mask, where bit 0 refers to the left and
+     * bit 1 to the right child
+     */
+    inline int intersectChildren(IndexType index, const Point &o,
+            const Vector &invD, Float mint, Float maxt) const;
 
     /// Blurring kernel used by the BRE
     inline Float K2(Float sqrParam) const {
@@ -81,12 +115,23 @@ protected:
     }
 protected:
     struct BRENode {
-        AABB aabb;
         Photon photon;
         Float radius;
     };
 
+    /**
+     * \brief Bounds of the two children of an inner node, stored so that
+     * both can be tested against a ray at once. For each axis, this
+     * contains the left and right minimum followed by the left
+     * and right maximum.
+     */
+    struct BREChildBounds {
+        Float bounds[3][4];
+    };
+
     BRENode *m_nodes;
+    BREChildBounds *m_childBounds;
+    AABB m_aabb;
     Float m_scaleFactor;
     size_t m_photonCount;
     size_t m_depth;
@@ -19,6 +19,7 @@
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/render/common.h>
 #include <mitsuba/render/gatherproc.h>
+#include <mitsuba/render/renderqueue.h>
 #include "bre.h"
 
 MTS_NAMESPACE_BEGIN
@@ -39,6 +40,11 @@ MTS_NAMESPACE_BEGIN
  *     \parameter{globalPhotons}{\Integer}{Number of photons that will be collected for the global photon map\default{250000}}
  *     \parameter{causticPhotons}{\Integer}{Number of photons that will be collected for the caustic photon map\default{250000}}
  *     \parameter{volumePhotons}{\Integer}{Number of photons that will be collected for the volumetric photon map\default{250000}}
+ *     \parameter{volumePasses}{\Integer}{Number of progressive passes of the volumetric
+ *        component. Every pass collects \code{volumePhotons} photons and releases them
+ *        again once the image has been rendered \default{1}}
+ *     \parameter{volumeAlpha}{\Float}{Radius reduction parameter \code{alpha} used
+ *        between progressive volume passes \default{0.7}}
  *     \parameter{globalLookup\showbreak Radius}{\Float}{Maximum radius of photon lookups in the global photon map (relative to the scene size)\default{0.05}}
  *     \parameter{causticLookup\showbreak Radius}{\Float}{Maximum radius of photon lookups in the caustic photon map (relative to the scene size)\default{0.0125}}
  *     \parameter{lookupSize}{\Integer}{Number of photons that should be fetched in photon map queries\default{120}}
@@ -92,6 +98,15 @@ MTS_NAMESPACE_BEGIN
  * When the scene contains participating media, the Beam Radiance Estimate \cite{Jarosz2008Beam}
  * by Jarosz et al. is used to estimate the illumination due to volumetric scattering.
  *
+ * When the volumetric component requires more photons than fit into memory, the
+ * \code{volumePasses} parameter switches to a progressive variant of the beam
+ * radiance estimate \cite{Jarosz2011Progressive}: each pass traces a new set of
+ * \code{volumePhotons} photons, renders the full image and then discards the
+ * photons, while the radii of the photon disks shrink from pass to pass. The result is
+ * the average of all passes, hence memory usage does not depend on the total
+ * number of photons. Note that every pass also re-renders the surface
+ * components, so the sample count of the sampler should be reduced accordingly.
+ *
  * \remarks{
  *     \item Currently, only homogeneous participating media are supported by this implementation
  * }
@@ -124,6 +139,10 @@ public:
         m_causticPhotons = props.getSize("causticPhotons", 250000);
         /* Number of photons to collect for the volumetric photon map */
         m_volumePhotons = props.getSize("volumePhotons", 250000);
+        /* Number of progressive passes of the volumetric photon map */
+        m_volumePasses = props.getInteger("volumePasses", 1);
+        /* Radius reduction parameter of the progressive volume passes */
+        m_volumeAlpha = props.getFloat("volumeAlpha", 0.7f);
         /* Max. radius of lookups in the global photon map (relative to the scene size) */
         m_globalLookupRadiusRel = props.getFloat("globalLookupRadius", 0.05f);
         /* Max. radius of lookups in the caustic photon map (relative to the scene size) */
@@ -155,6 +174,11 @@ public:
             m_maxDepth = 128;
         }
 
+        if (m_volumePasses <= 0)
+            Log(EError, "volumePasses must be greater than zero!");
+        if (m_volumeAlpha <= 0 || m_volumeAlpha > 1)
+            Log(EError, "volumeAlpha must be in the interval (0, 1]!");
+
         m_causticPhotonMapID = m_globalPhotonMapID = m_breID = 0;
     }
 
@@ -176,6 +200,8 @@ public:
         m_gatherLocally = stream->readBool();
         m_autoCancelGathering = stream->readBool();
         m_hideEmitters = stream->readBool();
+        m_volumePasses = stream->readInt();
+        m_volumeAlpha = stream->readFloat();
         m_causticPhotonMapID = m_globalPhotonMapID = m_breID = 0;
         configure();
     }
@@ -208,6 +234,8 @@ public:
         stream->writeBool(m_gatherLocally);
         stream->writeBool(m_autoCancelGathering);
         stream->writeBool(m_hideEmitters);
+        stream->writeInt(m_volumePasses);
+        stream->writeFloat(m_volumeAlpha);
     }
 
     /// Configure the sampler for a specified amount of direct illumination samples
@@ -322,36 +350,11 @@ public:
             }
         }
 
+        /* In progressive mode, the volume photons are traced by render() */
         size_t volumePhotons = scene->getMedia().size() == 0 ? 0 : m_volumePhotons;
-        if (m_volumePhotonMap.get() == NULL && volumePhotons > 0) {
-            /* Generate the volume photon map */
-            ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
-                GatherPhotonProcess::EVolumePhotons, volumePhotons,
-                m_granularity, m_maxDepth-1, m_rr, m_gatherLocally,
-                m_autoCancelGathering, job);
-
-            proc->bindResource("scene", sceneResID);
-            proc->bindResource("sensor", sensorResID);
-            proc->bindResource("sampler", qmcSamplerID);
-
-            m_proc = proc;
-            sched->schedule(proc);
-            sched->wait(proc);
-            m_proc = NULL;
-
-            if (proc->getReturnStatus() != ParallelProcess::ESuccess)
+        if (m_bre.get() == NULL && volumePhotons > 0 && m_volumePasses == 1) {
+            if (!gatherVolumePhotons(job, sceneResID, sensorResID, qmcSamplerID, 1.0f))
                 return false;
-
-            ref<PhotonMap> volumePhotonMap = proc->getPhotonMap();
-            if (volumePhotonMap->isFull()) {
-                Log(EDebug, "Volume photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: "
-                    SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
-
-                volumePhotonMap->setScaleFactor(1 / (Float) proc->getShotParticles());
-                volumePhotonMap->build();
-                m_bre = new BeamRadianceEstimator(volumePhotonMap, m_volumeLookupSize);
-                m_breID = sched->registerResource(m_bre);
-            }
         }
 
         /* Adapt to scene extents */
@@ -363,6 +366,124 @@ public:
         return true;
     }
 
+    /// Trace the volume photons and build the beam radiance estimator
+    bool gatherVolumePhotons(const RenderJob *job, int sceneResID,
+            int sensorResID, int samplerResID, Float radiusScale) {
+        ref<Scheduler> sched = Scheduler::getInstance();
+        ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
+            GatherPhotonProcess::EVolumePhotons, m_volumePhotons,
+            m_granularity, m_maxDepth-1, m_rr, m_gatherLocally,
+            m_autoCancelGathering, job);
+
+        proc->bindResource("scene", sceneResID);
+        proc->bindResource("sensor", sensorResID);
+        proc->bindResource("sampler", samplerResID);
+
+        m_proc = proc;
+        sched->schedule(proc);
+        sched->wait(proc);
+        m_proc = NULL;
+
+        if (proc->getReturnStatus() != ParallelProcess::ESuccess)
+            return false;
+
+        ref<PhotonMap> volumePhotonMap = proc->getPhotonMap();
+        if (volumePhotonMap->isFull()) {
+            Log(EDebug, "Volume photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: "
+                SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
+
+            volumePhotonMap->setScaleFactor(1 / (Float) proc->getShotParticles());
+            volumePhotonMap->build();
+            m_bre = new BeamRadianceEstimator(volumePhotonMap, m_volumeLookupSize, radiusScale);
+            m_breID = sched->registerResource(m_bre);
+        }
+        return true;
+    }
+
+    /// Release the beam radiance estimator of a progressive pass
+    void releaseVolumePhotons() {
+        if (m_breID)
+            Scheduler::getInstance()->unregisterResource(m_breID);
+        m_breID = 0;
+        m_bre = NULL;
+    }
+
+    bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        if (m_volumePasses == 1 || m_volumePhotons == 0 || scene->getMedia().size() == 0)
+            return SamplingIntegrator::render(scene, queue, job,
+                sceneResID, sensorResID, samplerResID);
+
+        ref<Scheduler> sched = Scheduler::getInstance();
+        ref<Film> film = scene->getSensor()->getFilm();
+        Vector2i cropSize = film->getCropSize();
+        Bitmap::EPixelFormat pixelFormat = film->hasAlpha()
+            ? Bitmap::ESpectrumAlpha : Bitmap::ESpectrum;
+
+        ref<Bitmap> passBitmap = new Bitmap(pixelFormat, Bitmap::EFloat, cropSize);
+        ref<Bitmap> accumBitmap = new Bitmap(pixelFormat, Bitmap::EFloat, cropSize);
+        ref<Bitmap> averageBitmap = new Bitmap(pixelFormat, Bitmap::EFloat, cropSize);
+        accumBitmap->clear();
+
+        /* Every pass needs a new set of photons -- use an independent sampler */
+        ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+            createObject(MTS_CLASS(Sampler), Properties("independent")));
+
+        Float radiusScale = 1.0f;
+        for (int it=0; it<m_volumePasses; ++it) {
+            /* Shrink the photon disks (Knaus and Zwicker, 2D kernel) */
+            if (it > 0)
+                radiusScale *= std::sqrt((it + m_volumeAlpha) / (it + 1));
+
+            Log(EInfo, "Starting volume pass %i/%i (radius scale = %f)",
+                it+1, m_volumePasses, radiusScale);
+
+            std::vector<SerializableObject *> samplers(sched->getCoreCount());
+            for (size_t i=0; i<sched->getCoreCount(); ++i) {
+                ref<Sampler> clonedSampler = sampler->clone();
+                clonedSampler->incRef();
+                samplers[i] = clonedSampler.get();
+            }
+            int photonSamplerID = sched->registerMultiResource(samplers);
+            for (size_t i=0; i<samplers.size(); ++i)
+                samplers[i]->decRef();
+
+            bool success = gatherVolumePhotons(job, sceneResID,
+                sensorResID, photonSamplerID, radiusScale);
+            sched->unregisterResource(photonSamplerID);
+
+            if (success) {
+                film->clear();
+                success = SamplingIntegrator::render(scene, queue, job,
+                    sceneResID, sensorResID, samplerResID);
+            }
+            releaseVolumePhotons();
+
+            if (!success) {
+                /* Keep the passes that did complete */
+                if (it > 0)
+                    film->setBitmap(averageBitmap);
+                return false;
+            }
+
+            film->develop(Point2i(0), cropSize, Point2i(0), passBitmap);
+            accumBitmap->accumulate(passBitmap);
+
+            /* Average over all passes so far (including the alpha channel) */
+            const Float *source = accumBitmap->getFloatData();
+            Float *target = averageBitmap->getFloatData();
+            size_t count = accumBitmap->getPixelCount() * accumBitmap->getChannelCount();
+            Float invPasses = 1.0f / (Float) (it + 1);
+            for (size_t i=0; i<count; ++i)
+                target[i] = source[i] * invPasses;
+
+            film->setBitmap(averageBitmap);
+            queue->signalRefresh(job);
+        }
+
+        return true;
+    }
+
     void setParent(ConfigurableObject *parent) {
         if (parent->getClass()->derivesFrom(MTS_CLASS(SamplingIntegrator)))
             m_parentIntegrator = static_cast<SamplingIntegrator *>(parent);
@@ -663,6 +784,8 @@ public:
             << "  globalPhotons = " << m_globalPhotons << "," << endl
             << "  causticPhotons = " << m_causticPhotons << "," << endl
             << "  volumePhotons = " << m_volumePhotons << "," << endl
+            << "  volumePasses = " << m_volumePasses << "," << endl
+            << "  volumeAlpha = " << m_volumeAlpha << "," << endl
             << "  gatherLocally = " << m_gatherLocally << "," << endl
             << "  globalLookupRadius = " << m_globalLookupRadius << "," << endl
             << "  causticLookupRadius = " << m_causticLookupRadius << "," << endl
@@ -682,7 +805,6 @@ public:
 private:
     ref<PhotonMap> m_globalPhotonMap;
     ref<PhotonMap> m_causticPhotonMap;
-    ref<PhotonMap> m_volumePhotonMap;
     ref<BeamRadianceEstimator> m_bre;
     ref<ParallelProcess> m_proc;
     SamplingIntegrator *m_parentIntegrator;
@@ -692,6 +814,8 @@ private:
     Float m_globalLookupRadiusRel, m_globalLookupRadius;
     Float m_causticLookupRadiusRel, m_causticLookupRadius;
     Float m_invEmitterSamples, m_invGlossySamples;
+    Float m_volumeAlpha;
+    int m_volumePasses;
     int m_granularity, m_directSamples, m_glossySamples;
     int m_maxDepth, m_maxSpecularDepth;
     RussianRoulette m_rr;
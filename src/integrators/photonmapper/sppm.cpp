@@ -18,6 +18,7 @@
 
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/atomic.h>
 #include <mitsuba/render/gatherproc.h>
 #include <mitsuba/render/renderqueue.h>
 
@@ -27,6 +28,352 @@
 
 MTS_NAMESPACE_BEGIN
 
+/// Represents one individual PPM gather point including relevant statistics
+struct SPPMGatherPoint {
+    Intersection its;
+    Float radius;
+    Spectrum weight;
+    Spectrum flux;
+    Spectrum emission;
+    Float N;
+    int depth;
+    Point2i pos;
+
+    /* Photon statistics of the current pass (only used by the hash grid) */
+    Spectrum passFlux;
+    int32_t passM;
+
+    inline SPPMGatherPoint() : weight(0.0f), flux(0.0f), emission(0.0f), N(0.0f),
+        passFlux(0.0f), passM(0) { }
+};
+
+/**
+ * \brief Spatial hash grid over the gather points of an SPPM pass
+ *
+ * Every gather point is referenced from all grid cells that overlap its
+ * search region. The cell size is set to twice the largest radius, so that
+ * this amounts to at most 8 cells per point, and a photon only needs to
+ * inspect the contents of the cell containing it. Cells are stored in a
+ * hash table of compressed lists that is rebuilt from scratch in every pass.
+ */
+class GatherPointGrid : public Object {
+public:
+    GatherPointGrid() : m_cellSize(0), m_invCellSize(0) { }
+
+    /// Rebuild the grid over all valid gather points
+    void build(std::vector<std::vector<SPPMGatherPoint> > &gatherBlocks) {
+        m_points.clear();
+        m_aabb.reset();
+        Float maxRadius = 0;
+        for (size_t i=0; i<gatherBlocks.size(); ++i) {
+            std::vector<SPPMGatherPoint> &gatherPoints = gatherBlocks[i];
+            for (size_t j=0; j<gatherPoints.size(); ++j) {
+                SPPMGatherPoint &gp = gatherPoints[j];
+                if (gp.depth == -1)
+                    continue;
+                m_points.push_back(&gp);
+                m_aabb.expandBy(gp.its.p);
+                maxRadius = std::max(maxRadius, gp.radius);
+            }
+        }
+
+        m_cellStart.clear();
+        m_entries.clear();
+        if (m_points.empty() || maxRadius == 0)
+            return;
+
+        m_aabb.min -= Vector(maxRadius);
+        m_aabb.max += Vector(maxRadius);
+        m_cellSize = 2 * maxRadius;
+        m_invCellSize = 1 / m_cellSize;
+
+        int pointCount = (int) m_points.size();
+        std::vector<int32_t> counts(pointCount + 1, 0);
+
+        /* First pass: determine the number of entries in each hash bucket */
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for
+        #endif
+        for (int i=0; i<pointCount; ++i) {
+            Point3i min, max;
+            getCellRange(*m_points[i], min, max);
+            for (int z=min.z; z<=max.z; ++z)
+                for (int y=min.y; y<=max.y; ++y)
+                    for (int x=min.x; x<=max.x; ++x)
+                        atomicAdd(&counts[hash(Point3i(x, y, z))], 1);
+        }
+
+        m_cellStart.resize(pointCount + 1);
+        uint32_t offset = 0;
+        for (int i=0; i<pointCount; ++i) {
+            m_cellStart[i] = offset;
+            offset += (uint32_t) counts[i];
+            counts[i] = (int32_t) m_cellStart[i];
+        }
+        m_cellStart[pointCount] = offset;
+        m_entries.resize(offset);
+
+        /* Second pass: fill the buckets */
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for
+        #endif
+        for (int i=0; i<pointCount; ++i) {
+            Point3i min, max;
+            getCellRange(*m_points[i], min, max);
+            for (int z=min.z; z<=max.z; ++z) {
+                for (int y=min.y; y<=max.y; ++y) {
+                    for (int x=min.x; x<=max.x; ++x) {
+                        int32_t idx = atomicAdd(&counts[hash(Point3i(x, y, z))], 1) - 1;
+                        m_entries[idx] = (uint32_t) i;
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * \brief Invoke a functor on every gather point that could
+     * contain the given position in its search region
+     */
+    template <typename Functor> inline void lookup(const Point &p, Functor &functor) const {
+        if (m_entries.empty() || !m_aabb.contains(p))
+            return;
+        Vector rel = (p - m_aabb.min) * m_invCellSize;
+        uint32_t h = hash(Point3i((int) rel.x, (int) rel.y, (int) rel.z));
+        for (uint32_t i=m_cellStart[h]; i<m_cellStart[h+1]; ++i)
+            functor(*m_points[m_entries[i]]);
+    }
+
+    /// Return the number of gather points in the grid
+    inline size_t getPointCount() const { return m_points.size(); }
+
+    /// Return the number of cell references
+    inline size_t getEntryCount() const { return m_entries.size(); }
+
+    MTS_DECLARE_CLASS()
+protected:
+    inline void getCellRange(const SPPMGatherPoint &gp, Point3i &min, Point3i &max) const {
+        Vector rel = gp.its.p - m_aabb.min;
+        Float r = gp.radius;
+        for (int i=0; i<3; ++i) {
+            min[i] = std::max(0, (int) ((rel[i] - r) * m_invCellSize));
+            max[i] = (int) ((rel[i] + r) * m_invCellSize);
+        }
+    }
+
+    inline uint32_t hash(const Point3i &p) const {
+        return (((uint32_t) p.x * 73856093u) ^ ((uint32_t) p.y * 19349663u)
+            ^ ((uint32_t) p.z * 83492791u)) % (uint32_t) m_points.size();
+    }
+
+    /// Virtual destructor
+    virtual ~GatherPointGrid() { }
+private:
+    std::vector<SPPMGatherPoint *> m_points;
+    std::vector<uint32_t> m_cellStart;
+    std::vector<uint32_t> m_entries;
+    AABB m_aabb;
+    Float m_cellSize, m_invCellSize;
+};
+
+/// Number of particles and deposited photons of a splatting work unit
+class SplatResult : public WorkResult {
+public:
+    SplatResult() : particleCount(0), photonCount(0) { }
+
+    void load(Stream *stream) {
+        particleCount = stream->readSize();
+        photonCount = stream->readSize();
+    }
+
+    void save(Stream *stream) const {
+        stream->writeSize(particleCount);
+        stream->writeSize(photonCount);
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "SplatResult[particleCount=" << particleCount
+            << ", photonCount=" << photonCount << "]";
+        return oss.str();
+    }
+
+    size_t particleCount, photonCount;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SplatResult() { }
+};
+
+/**
+ * \brief Particle tracer that directly splats photons into the
+ * gather points of a \ref GatherPointGrid
+ *
+ * The accumulation mirrors \ref PhotonMap::estimateRadianceRaw(), but the
+ * per-photon contributions are added to the gather points using atomic
+ * operations instead of storing the photons.
+ */
+class SplatPhotonWorker : public ParticleTracer {
+public:
+    SplatPhotonWorker(const GatherPointGrid *grid, int maxDepth, int pathDepth,
+        RussianRoulette rr) : ParticleTracer(maxDepth, rr, false),
+        m_grid(grid), m_pathDepth(pathDepth) { }
+
+    SplatPhotonWorker(Stream *stream, InstanceManager *manager)
+     : ParticleTracer(stream, manager) {
+        Log(EError, "Network rendering is not supported!");
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new SplatPhotonWorker(m_grid.get(), m_maxDepth, m_pathDepth, m_rr);
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Log(EError, "Network rendering is not supported!");
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new SplatResult();
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+        const bool &stop) {
+        m_workResult = static_cast<SplatResult *>(workResult);
+        m_workResult->particleCount = m_workResult->photonCount = 0;
+        ParticleTracer::process(workUnit, workResult, stop);
+        m_workResult = NULL;
+    }
+
+    void handleNewParticle() {
+        m_workResult->particleCount++;
+    }
+
+    void handleSurfaceInteraction(int depth_, int nullInteractions, bool delta,
+            const Intersection &its, const Medium *medium,
+            const Spectrum &weight) {
+        int bsdfType = its.getBSDF()->getType(), depth = depth_ - nullInteractions;
+        if (!(bsdfType & BSDF::EDiffuseReflection) && !(bsdfType & BSDF::EGlossyReflection))
+            return;
+
+        SplatQuery query(its.p, its.geoFrame.n, its.toWorld(its.wi), weight,
+            depth, m_pathDepth);
+        m_grid->lookup(its.p, query);
+        m_workResult->photonCount++;
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Deposits a photon into all gather points whose radius contains it
+    struct SplatQuery {
+        SplatQuery(const Point &p, const Normal &n, const Vector &wi,
+            const Spectrum &power, int depth, int pathDepth)
+            : p(p), n(n), wi(wi), power(power), depth(depth), pathDepth(pathDepth) {
+            wiDotGeoN = absDot(n, wi);
+        }
+
+        inline void operator()(SPPMGatherPoint &gp) const {
+            if (distanceSquared(gp.its.p, p) > gp.radius * gp.radius)
+                return;
+            atomicAdd(&gp.passM, 1);
+
+            int maxDepth = pathDepth == -1 ? INT_MAX : pathDepth - gp.depth;
+            if (depth > maxDepth || dot(n, gp.its.shFrame.n) < 1e-1f
+                || wiDotGeoN < 1e-2f)
+                return;
+
+            BSDFSamplingRecord bRec(gp.its, gp.its.toLocal(wi), gp.its.wi, EImportance);
+            Spectrum value = power * gp.its.getBSDF()->eval(bRec);
+            if (value.isZero())
+                return;
+
+            /* Account for non-symmetry due to shading normals */
+            value *= std::abs(Frame::cosTheta(bRec.wi) /
+                (wiDotGeoN * Frame::cosTheta(bRec.wo)));
+
+            for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+                atomicAdd(&gp.passFlux[i], value[i]);
+        }
+
+        Point p;
+        Normal n;
+        Vector wi;
+        Spectrum power;
+        Float wiDotGeoN;
+        int depth, pathDepth;
+    };
+
+    /// Virtual destructor
+    virtual ~SplatPhotonWorker() { }
+private:
+    ref<const GatherPointGrid> m_grid;
+    ref<SplatResult> m_workResult;
+    int m_pathDepth;
+};
+
+/**
+ * \brief Process that traces photons until a specified number of them
+ * has been splatted into a \ref GatherPointGrid
+ */
+class SplatPhotonProcess : public ParticleProcess {
+public:
+    SplatPhotonProcess(const GatherPointGrid *grid, size_t photonCount,
+        size_t granularity, int maxDepth, int pathDepth, const RussianRoulette &rr,
+        bool autoCancel, const void *progressReporterPayload)
+        : ParticleProcess(ParticleProcess::EGather, photonCount, granularity,
+          "Splatting photons", progressReporterPayload), m_grid(grid),
+          m_photonCount(photonCount), m_maxDepth(maxDepth), m_pathDepth(pathDepth),
+          m_rr(rr), m_autoCancel(autoCancel), m_numShot(0), m_numPhotons(0) { }
+
+    bool isLocal() const {
+        return true;
+    }
+
+    ref<WorkProcessor> createWorkProcessor() const {
+        return new SplatPhotonWorker(m_grid.get(), m_maxDepth, m_pathDepth, m_rr);
+    }
+
+    void processResult(const WorkResult *wr, bool cancelled) {
+        if (cancelled)
+            return;
+        const SplatResult *result = static_cast<const SplatResult *>(wr);
+        LockGuard lock(m_resultMutex);
+        m_numShot += result->particleCount;
+        m_numPhotons += result->photonCount;
+        increaseResultCount(result->photonCount);
+    }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        /* Use the same approach as GatherPhotonProcess for auto canceling */
+        LockGuard lock(m_resultMutex);
+        if (m_autoCancel && m_numShot > 100000 && m_numPhotons < m_photonCount
+                && (m_numPhotons == 0 || m_numPhotons < m_numShot/1024)) {
+            Log(EInfo, "Not enough photons could be collected, giving up");
+            return EFailure;
+        }
+
+        return ParticleProcess::generateWork(unit, worker);
+    }
+
+    /// Return the number of shot particles
+    inline size_t getShotParticles() const { return m_numShot; }
+
+    /// Return the number of splatted photons
+    inline size_t getPhotonCount() const { return m_numPhotons; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SplatPhotonProcess() { }
+private:
+    ref<const GatherPointGrid> m_grid;
+    size_t m_photonCount;
+    int m_maxDepth, m_pathDepth;
+    RussianRoulette m_rr;
+    bool m_autoCancel;
+    size_t m_numShot, m_numPhotons;
+};
+
 /*!\plugin{sppm}{Stochastic progressive photon mapping integrator}
  * \order{8}
  * \parameters{
@@ -61,6 +408,12 @@ MTS_NAMESPACE_BEGIN
  *     }
  *     \parameter{maxPasses}{\Integer}{Maximum number of passes to render (where \code{-1}
  *        corresponds to rendering until stopped manually). \default{\code{-1}}}
+ *     \parameter{hashGrid}{\Boolean}{When set to \code{true}, the gather points
+ *        are inserted into a spatial hash grid at the beginning of every pass,
+ *        and photons are splatted into them as soon as they are traced. This
+ *        avoids storing the photons and building a photon map and is usually
+ *        faster when a large number of photons is shot per pass.
+ *        \default{\code{false}}}
  * }
  * This plugin implements stochastic progressive photon mapping by Hachisuka et al.
  * \cite{Hachisuka2009Stochastic}. This algorithm is an extension of progressive photon
@@ -82,19 +435,7 @@ MTS_NAMESPACE_BEGIN
  */
 class SPPMIntegrator : public Integrator {
 public:
-    /// Represents one individual PPM gather point including relevant statistics
-    struct GatherPoint {
-        Intersection its;
-        Float radius;
-        Spectrum weight;
-        Spectrum flux;
-        Spectrum emission;
-        Float N;
-        int depth;
-        Point2i pos;
-
-        inline GatherPoint() : weight(0.0f), flux(0.0f), emission(0.0f), N(0.0f) { }
-    };
+    typedef SPPMGatherPoint GatherPoint;
 
     SPPMIntegrator(const Properties &props) : Integrator(props), m_rr(props) {
         /* Initial photon query radius (0 = infer based on scene size and sensor resolution) */
@@ -114,6 +455,8 @@ public:
         m_autoCancelGathering = props.getBoolean("autoCancelGathering", true);
         /* Maximum number of passes to render. -1 renders until the process is stopped. */
         m_maxPasses = props.getInteger("maxPasses", -1);
+        /* Splat photons directly into a hash grid over the gather points? */
+        m_hashGrid = props.getBoolean("hashGrid", false);
         m_mutex = new Mutex();
         if (m_maxDepth <= 1 && m_maxDepth != -1)
             Log(EError, "Maximum depth must be set to \"2\" or higher!");
@@ -323,28 +666,56 @@ public:
         Log(EInfo, "Performing a photon mapping pass %i (" SIZE_T_FMT " photons so far)",
                 it, m_totalPhotons);
         ref<Scheduler> sched = Scheduler::getInstance();
-
-        /* Generate the global photon map */
-        ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
-            GatherPhotonProcess::EAllSurfacePhotons, m_photonCount,
-            m_granularity, m_maxDepth == -1 ? -1 : m_maxDepth-1,
-            m_rr, true, m_autoCancelGathering, job);
-
-        proc->bindResource("scene", sceneResID);
-        proc->bindResource("sensor", sensorResID);
-        proc->bindResource("sampler", samplerResID);
-
-        sched->schedule(proc);
-        sched->wait(proc);
-
-        ref<PhotonMap> photonMap = proc->getPhotonMap();
-        photonMap->build();
-        Log(EDebug, "Photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: "
-            SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
+        ref<PhotonMap> photonMap;
+        size_t shotParticles;
+
+        if (m_hashGrid) {
+            /* Splat the photons directly into the gather points */
+            if (!m_grid)
+                m_grid = new GatherPointGrid();
+            m_grid->build(m_gatherBlocks);
+            Log(EDebug, "Gather point grid: " SIZE_T_FMT " points, " SIZE_T_FMT
+                " cell references", m_grid->getPointCount(), m_grid->getEntryCount());
+
+            ref<SplatPhotonProcess> proc = new SplatPhotonProcess(m_grid,
+                m_photonCount, m_granularity, m_maxDepth == -1 ? -1 : m_maxDepth-1,
+                m_maxDepth, m_rr, m_autoCancelGathering, job);
+
+            proc->bindResource("scene", sceneResID);
+            proc->bindResource("sensor", sensorResID);
+            proc->bindResource("sampler", samplerResID);
+
+            sched->schedule(proc);
+            sched->wait(proc);
+
+            Log(EDebug, "Splatted " SIZE_T_FMT " photons, shot " SIZE_T_FMT " particles",
+                proc->getPhotonCount(), proc->getShotParticles());
+            shotParticles = proc->getShotParticles();
+            m_totalPhotons += proc->getPhotonCount();
+        } else {
+            /* Generate the global photon map */
+            ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
+                GatherPhotonProcess::EAllSurfacePhotons, m_photonCount,
+                m_granularity, m_maxDepth == -1 ? -1 : m_maxDepth-1,
+                m_rr, true, m_autoCancelGathering, job);
+
+            proc->bindResource("scene", sceneResID);
+            proc->bindResource("sensor", sensorResID);
+            proc->bindResource("sampler", samplerResID);
+
+            sched->schedule(proc);
+            sched->wait(proc);
+
+            photonMap = proc->getPhotonMap();
+            photonMap->build();
+            Log(EDebug, "Photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: "
+                SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
+            shotParticles = proc->getShotParticles();
+            m_totalPhotons += photonMap->size();
+        }
 
         Log(EInfo, "Gathering ..");
-        m_totalEmitted += proc->getShotParticles();
-        m_totalPhotons += photonMap->size();
+        m_totalEmitted += shotParticles;
         film->clear();
         #if defined(MTS_OPENMP)
             #pragma omp parallel for schedule(dynamic)
@@ -358,7 +729,12 @@ public:
                 Float M, N = gp.N;
                 Spectrum flux, contrib;
 
-                if (gp.depth != -1) {
+                if (gp.depth != -1 && m_hashGrid) {
+                    M = (Float) gp.passM;
+                    flux = gp.passFlux;
+                    gp.passM = 0;
+                    gp.passFlux = Spectrum(0.0f);
+                } else if (gp.depth != -1) {
                     M = (Float) photonMap->estimateRadianceRaw(
                         gp.its, gp.radius, flux, m_maxDepth == -1 ? INT_MAX : m_maxDepth-gp.depth);
                 } else {
@@ -377,7 +753,7 @@ public:
 
                     gp.flux = (gp.flux +
                             gp.weight * flux +
-                            gp.emission * (Float) proc->getShotParticles() * M_PI * gp.radius*gp.radius) * ratio;
+                            gp.emission * (Float) shotParticles * M_PI * gp.radius*gp.radius) * ratio;
                     gp.N = N + m_alpha * M;
                     contrib = gp.flux / ((Float) m_totalEmitted * gp.radius*gp.radius * M_PI);
                 }
@@ -398,7 +774,8 @@ public:
             << "  alpha = " << m_alpha << "," << endl
             << "  photonCount = " << m_photonCount << "," << endl
             << "  granularity = " << m_granularity << "," << endl
-            << "  maxPasses = " << m_maxPasses << endl
+            << "  maxPasses = " << m_maxPasses << "," << endl
+            << "  hashGrid = " << m_hashGrid << endl
             << "]";
         return oss.str();
     }
@@ -418,8 +795,14 @@ private:
     bool m_running;
     bool m_autoCancelGathering;
     int m_maxPasses;
+    bool m_hashGrid;
+    ref<GatherPointGrid> m_grid;
 };
 
+MTS_IMPLEMENT_CLASS(GatherPointGrid, false, Object)
+MTS_IMPLEMENT_CLASS(SplatResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(SplatPhotonWorker, false, ParticleTracer)
+MTS_IMPLEMENT_CLASS(SplatPhotonProcess, false, ParticleProcess)
 MTS_IMPLEMENT_CLASS_S(SPPMIntegrator, false, Integrator)
 MTS_EXPORT_PLUGIN(SPPMIntegrator, "Stochastic progressive photon mapper");
 MTS_NAMESPACE_END
@@ -17,12 +17,18 @@
 */
 
 #include <mitsuba/bidir/util.h>
+#include <mitsuba/bidir/rsampler.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/fstream.h>
 #include "pssmlt_proc.h"
 #include "pssmlt_sampler.h"
 
 MTS_NAMESPACE_BEGIN
 
+/* File format of the bootstrap cache */
+#define MTS_PSSMLT_BOOTSTRAP_HEADER  0x5053
+#define MTS_PSSMLT_BOOTSTRAP_VERSION 0x0001
+
 /*!\plugin{pssmlt}{Primary Sample Space Metropolis Light Transport}
  * \order{9}
  * \parameters{
@@ -76,6 +82,20 @@ MTS_NAMESPACE_BEGIN
  *        the average luminance arriving at the sensor by generating a
  *        number of samples. \default{\code{100000} samples}
  *     }
+ *     \parameter{bootstrapCache}{\String}{
+ *        File that stores the luminance estimate and the Markov chain seeds
+ *        found while integrating the luminance. When it already exists, its
+ *        contents are reused instead, which shortens the startup of every
+ *        frame of an animation. Relative paths refer to the directory of the
+ *        output image. \default{none}
+ *     }
+ *     \parameter{bootstrapRefinement}{\Float}{
+ *        When reusing a cached bootstrap, integrate this fraction of
+ *        \code{luminanceSamples} again to follow changes in the scene. The
+ *        result is blended into the cached luminance estimate and provides
+ *        fresh seeds. When set to zero, the cached seeds are only
+ *        re-evaluated. \default{0}
+ *     }
  *     \parameter{twoStage}{\Boolean}{Use two-stage MLT?
  *       See below for details. \default{{\footnotesize\code{false}}}}
  *     \parameter{pLarge}{\Float}{
@@ -83,6 +103,26 @@ MTS_NAMESPACE_BEGIN
  *       with a completely new one. Usually, there is little need to change
  *       this. \default{0.3}
  *     }
+ *     \parameter{chains}{\Integer}{
+ *       Number of Markov chains that every work unit simulates in an
+ *       interleaved fashion. The mutations of a work unit are shared among
+ *       its chains, hence more chains cover the image more uniformly at
+ *       the same cost. \default{1}
+ *     }
+ *     \parameter{replicaExchange}{\Boolean}{
+ *       Run the chains of a work unit at different temperatures and let
+ *       them exchange their states (also known as \emph{parallel tempering}).
+ *       Hot chains see a flattened version of the luminance and move between
+ *       distant image features more easily, and exchanges hand these states
+ *       down to the chain at unit temperature, which is the only one
+ *       contributing to the image. Implies Veach-style MLT weights.
+ *       \default{\code{false}}
+ *     }
+ *     \parameter{maxTemperature}{\Float}{
+ *       Temperature of the hottest chain when \code{replicaExchange} is
+ *       enabled. The temperatures of the remaining chains are spaced
+ *       geometrically between $1$ and this value. \default{8}
+ *     }
  * }
  * Primary Sample Space Metropolis Light Transport (PSSMLT) is a rendering
  * technique developed by Kelemen et al. \cite{Kelemen2002Simple} which is
@@ -254,12 +294,39 @@ public:
 
         /* Stop MLT after X seconds -- useful for equal-time comparisons */
         m_config.timeout = props.getInteger("timeout", 0);
+
+        /* Number of Markov chains that are simulated by each work unit */
+        m_config.chains = props.getInteger("chains", 1);
+
+        /* Run the chains of a work unit at different temperatures
+           and exchange their states (parallel tempering) */
+        m_config.replicaExchange = props.getBoolean("replicaExchange", false);
+
+        /* Temperature of the hottest chain when using replica exchange */
+        m_config.maxTemperature = props.getFloat("maxTemperature", 8.0f);
+
+        /* Store the outcome of the bootstrap phase in this file and reuse
+           it when rendering again, e.g. the next frame of an animation */
+        m_bootstrapCache = props.getString("bootstrapCache", "");
+
+        /* Fraction of the luminance samples that are taken again to
+           refine a cached bootstrap */
+        m_bootstrapRefinement = props.getFloat("bootstrapRefinement", 0.0f);
+
+        if (m_config.chains <= 0)
+            Log(EError, "The 'chains' parameter must be positive!");
+        if (m_config.maxTemperature < 1)
+            Log(EError, "The 'maxTemperature' parameter must be at least one!");
+        if (m_bootstrapRefinement < 0 || m_bootstrapRefinement > 1)
+            Log(EError, "The 'bootstrapRefinement' parameter must be in [0, 1]!");
     }
 
     /// Unserialize from a binary data stream
     PSSMLT(Stream *stream, InstanceManager *manager)
      : Integrator(stream, manager) {
         m_config = PSSMLTConfiguration(stream);
+        m_bootstrapCache = stream->readString();
+        m_bootstrapRefinement = stream->readFloat();
         configure();
     }
 
@@ -268,6 +335,8 @@ public:
     void serialize(Stream *stream, InstanceManager *manager) const {
         Integrator::serialize(stream, manager);
         m_config.serialize(stream);
+        stream->writeString(m_bootstrapCache.string());
+        stream->writeFloat(m_bootstrapRefinement);
     }
 
     bool preprocess(const Scene *scene, RenderQueue *queue,
@@ -338,9 +407,10 @@ public:
             m_config.workUnits = (int) std::max(workUnits, (size_t) 1);
         }
 
+        size_t seedCount = (size_t) m_config.workUnits * m_config.chains;
         size_t luminanceSamples = m_config.luminanceSamples;
-        if (luminanceSamples < (size_t) m_config.workUnits * 10) {
-            luminanceSamples = (size_t) m_config.workUnits * 10;
+        if (luminanceSamples < seedCount * 10) {
+            luminanceSamples = seedCount * 10;
             Log(EWarn, "Warning: increasing number of luminance samples to " SIZE_T_FMT,
                 luminanceSamples);
         }
@@ -356,18 +426,82 @@ public:
                 return false;
         }
 
-        std::vector<PathSeed> pathSeeds;
-        ref<ReplayableSampler> rplSampler = new ReplayableSampler();
-        ref<PathSampler> pathSampler = new PathSampler(m_config.technique, scene,
-            rplSampler, rplSampler, rplSampler, m_config.maxDepth, m_config.rr,
-            m_config.separateDirect, m_config.directSampling);
+        /* Look for the bootstrap of a previous rendering. The nested
+           first stage of two-stage MLT always starts from scratch */
+        fs::path cachePath;
+        if (!m_bootstrapCache.empty() && !nested) {
+            cachePath = m_bootstrapCache;
+            if (!cachePath.is_absolute())
+                cachePath = scene->getDestinationFile().parent_path() / cachePath;
+        }
+
+        std::vector<PSSMLTSeed> pathSeeds;
+        Float cachedLuminance = 0;
+        size_t cachedSamples = 0;
+        if (!cachePath.empty() && fs::exists(cachePath))
+            cachedSamples = loadBootstrap(cachePath, cachedLuminance, pathSeeds);
+
+        bool refine = cachedSamples > 0 && m_bootstrapRefinement > 0;
+        if (cachedSamples > 0 && !refine && (pathSeeds.size() != seedCount
+                || !refreshSeeds(scene, pathSeeds))) {
+            Log(EWarn, "The bootstrap cache \"%s\" does not match the current "
+                "configuration, discarding it", cachePath.string().c_str());
+            cachedSamples = 0;
+        }
+
+        if (cachedSamples == 0 || refine) {
+            size_t bootstrapSamples = luminanceSamples;
+            if (refine)
+                bootstrapSamples = std::max(seedCount * 10,
+                    (size_t) (luminanceSamples * m_bootstrapRefinement));
+
+            /* Estimate the image luminance and find seed paths using all
+               workers. Every stream should be long enough to amortize the
+               scene setup of a work unit, but short enough to keep the
+               rewinds during the seed reconstruction cheap */
+            Log(EInfo, "Integrating luminance values over the image plane ("
+                    SIZE_T_FMT " samples)..", bootstrapSamples);
+            ref<PSSMLTBootstrapProcess> bootstrap = new PSSMLTBootstrapProcess(
+                job, m_config, bootstrapSamples, std::min(bootstrapSamples / 1000,
+                nCores * 16));
+            bootstrap->bindResource("scene", sceneResID);
+            bootstrap->bindResource("sensor", sensorResID);
+
+            m_process = bootstrap;
+            scheduler->schedule(bootstrap);
+            scheduler->wait(bootstrap);
+            m_process = NULL;
+            if (bootstrap->getReturnStatus() != ParallelProcess::ESuccess)
+                return false;
+
+            Float luminance = bootstrap->generateSeeds(seedCount, pathSeeds);
+            bootstrap = NULL;
+
+            if (refine) {
+                /* Blend the new estimate into the cached one. The cache keeps
+                   its sample count, hence old frames fade out gradually */
+                Float weight = bootstrapSamples
+                    / (Float) (bootstrapSamples + cachedSamples);
+                m_config.luminance = cachedLuminance
+                    + weight * (luminance - cachedLuminance);
+                Log(EInfo, "Refined the cached luminance value %f to %f",
+                    cachedLuminance, m_config.luminance);
+            } else {
+                m_config.luminance = luminance;
+                cachedSamples = bootstrapSamples;
+            }
+
+            if (!cachePath.empty())
+                saveBootstrap(cachePath, cachedSamples, m_config.luminance, pathSeeds);
+        } else {
+            m_config.luminance = cachedLuminance;
+            Log(EInfo, "Reusing the cached bootstrap \"%s\" (average luminance "
+                "value = %f)", cachePath.string().c_str(), cachedLuminance);
+        }
 
         ref<PSSMLTProcess> process = new PSSMLTProcess(job, queue,
                 m_config, directImage, pathSeeds);
 
-        m_config.luminance = pathSampler->generateSeeds(luminanceSamples,
-            m_config.workUnits, false, m_config.importanceMap, pathSeeds);
-
         if (!nested)
             m_config.dump();
 
@@ -382,28 +516,126 @@ public:
         int mltSamplerResID = scheduler->registerMultiResource(mltSamplers);
         for (size_t i=0; i<scheduler->getCoreCount(); ++i)
             mltSamplers[i]->decRef();
-        int rplSamplerResID = scheduler->registerResource(rplSampler);
 
         process->bindResource("scene", sceneResID);
         process->bindResource("sensor", sensorResID);
         process->bindResource("sampler", mltSamplerResID);
-        process->bindResource("rplSampler", rplSamplerResID);
 
         m_process = process;
         scheduler->schedule(process);
         scheduler->wait(process);
         m_process = NULL;
-        scheduler->unregisterResource(rplSamplerResID);
         process->develop();
 
         return process->getReturnStatus() == ParallelProcess::ESuccess;
     }
 
     MTS_DECLARE_CLASS()
+private:
+    /**
+     * \brief Load a cached bootstrap
+     *
+     * Returns the number of luminance samples behind the cached estimate,
+     * or zero when the file cannot be used
+     */
+    size_t loadBootstrap(const fs::path &path, Float &luminance,
+            std::vector<PSSMLTSeed> &seeds) const {
+        ref<FileStream> stream = new FileStream(path, FileStream::EReadOnly);
+        stream->setByteOrder(Stream::ELittleEndian);
+        if (stream->getSize() < 2 * sizeof(uint16_t)
+                || stream->readUShort() != MTS_PSSMLT_BOOTSTRAP_HEADER
+                || stream->readUShort() != MTS_PSSMLT_BOOTSTRAP_VERSION) {
+            Log(EWarn, "\"%s\" is not a PSSMLT bootstrap cache!",
+                path.string().c_str());
+            return 0;
+        }
+
+        size_t sampleCount = stream->readSize();
+        luminance = (Float) stream->readDouble();
+        seeds.resize(stream->readSize());
+        for (size_t i=0; i<seeds.size(); ++i) {
+            seeds[i].stream = stream->readSize();
+            seeds[i].sampleIndex = stream->readSize();
+            seeds[i].luminance = (Float) stream->readDouble();
+        }
+        return luminance > 0 ? sampleCount : 0;
+    }
+
+    /// Store the outcome of the bootstrap phase
+    void saveBootstrap(const fs::path &path, size_t sampleCount, Float luminance,
+            const std::vector<PSSMLTSeed> &seeds) const {
+        ref<FileStream> stream = new FileStream(path, FileStream::ETruncWrite);
+        stream->setByteOrder(Stream::ELittleEndian);
+        stream->writeUShort(MTS_PSSMLT_BOOTSTRAP_HEADER);
+        stream->writeUShort(MTS_PSSMLT_BOOTSTRAP_VERSION);
+        stream->writeSize(sampleCount);
+        stream->writeDouble(luminance);
+        stream->writeSize(seeds.size());
+        for (size_t i=0; i<seeds.size(); ++i) {
+            stream->writeSize(seeds[i].stream);
+            stream->writeSize(seeds[i].sampleIndex);
+            stream->writeDouble(seeds[i].luminance);
+        }
+    }
+
+    /**
+     * \brief Replay cached seeds in the current scene
+     *
+     * This mirrors \ref PSSMLTBootstrapWorker and updates the seed
+     * luminances, which the renderer checks when reconstructing them.
+     * Seeds that no longer carry any energy are replaced by the others.
+     * Returns \c false when none of them is left.
+     */
+    bool refreshSeeds(Scene *scene, std::vector<PSSMLTSeed> &seeds) const {
+        ref<ReplayableSampler> rplSampler = new ReplayableSampler();
+        ref<PathSampler> pathSampler = new PathSampler(m_config.technique, scene,
+            rplSampler, rplSampler, rplSampler, m_config.maxDepth,
+            m_config.rr, m_config.separateDirect, m_config.directSampling);
+
+        SplatList splatList;
+        DiscreteDistribution seedPDF(seeds.size());
+        size_t stream = 0, invalid = 0;
+        for (size_t i=0; i<seeds.size(); ++i) {
+            PSSMLTSeed &seed = seeds[i];
+            if (i == 0 || seed.stream != stream) {
+                rplSampler->setSeed(seed.stream);
+                stream = seed.stream;
+            }
+            rplSampler->setSampleIndex(seed.sampleIndex);
+            pathSampler->sampleSplats(Point2i(-1), splatList);
+
+            seed.luminance = splatList.luminance;
+            if (!(seed.luminance > 0)) {
+                seed.luminance = 0;
+                ++invalid;
+            }
+            seedPDF.append(seed.luminance);
+        }
+
+        if (invalid == seeds.size())
+            return false;
+
+        if (invalid > 0) {
+            Log(EInfo, "Replacing " SIZE_T_FMT "/" SIZE_T_FMT " cached seeds "
+                "that no longer contribute", invalid, seeds.size());
+            seedPDF.normalize();
+            ref<Random> random = new Random();
+            std::vector<PSSMLTSeed> candidates(seeds);
+            for (size_t i=0; i<seeds.size(); ++i) {
+                if (seeds[i].luminance == 0)
+                    seeds[i] = candidates[seedPDF.sample(random->nextFloat())];
+            }
+            std::sort(seeds.begin(), seeds.end());
+        }
+        return true;
+    }
+
 private:
     ref<ParallelProcess> m_process;
     ref<RenderJob> m_nestedJob;
     PSSMLTConfiguration m_config;
+    fs::path m_bootstrapCache;
+    Float m_bootstrapRefinement;
 };
 
 MTS_IMPLEMENT_CLASS_S(PSSMLT, false, Integrator)
@@ -54,10 +54,20 @@ struct PSSMLTConfiguration {
     bool firstStage;
     int firstStageSizeReduction;
     size_t timeout;
+    int chains;
+    bool replicaExchange;
+    Float maxTemperature;
     ref<Bitmap> importanceMap;
 
     inline PSSMLTConfiguration() { }
 
+    /// Return the inverse temperature of the chains at a given level
+    inline Float getInverseTemperature(int level) const {
+        if (!replicaExchange || chains <= 1)
+            return 1.0f;
+        return std::pow(maxTemperature, -level / (Float) (chains - 1));
+    }
+
     void dump() const {
         SLog(EDebug, "PSSMLT configuration:");
         SLog(EDebug, "   Maximum path depth          : %i", maxDepth);
@@ -83,6 +93,10 @@ struct PSSMLTConfiguration {
             luminance, luminanceSamples);
         SLog(EDebug, "   Total number of work units  : %i", workUnits);
         SLog(EDebug, "   Mutations per work unit     : " SIZE_T_FMT, nMutations);
+        SLog(EDebug, "   Chains per work unit        : %i", chains);
+        if (replicaExchange)
+            SLog(EDebug, "   Replica exchange            : yes (max. temperature %f)",
+                maxTemperature);
         if (timeout)
             SLog(EDebug, "   Timeout                     : " SIZE_T_FMT,  timeout);
     }
@@ -111,6 +125,9 @@ struct PSSMLTConfiguration {
                 (size_t) size.x * (size_t) size.y);
         }
         timeout = stream->readSize();
+        chains = stream->readInt();
+        replicaExchange = stream->readBool();
+        maxTemperature = stream->readFloat();
     }
 
     inline void serialize(Stream *stream) const {
@@ -139,6 +156,47 @@ struct PSSMLTConfiguration {
             Vector2i(0, 0).serialize(stream);
         }
         stream->writeSize(timeout);
+        stream->writeInt(chains);
+        stream->writeBool(replicaExchange);
+        stream->writeFloat(maxTemperature);
+    }
+};
+
+/**
+ * \brief Starting point of a Markov chain found by the bootstrap phase
+ *
+ * Every bootstrap work unit draws its luminance samples from a separate
+ * \ref ReplayableSampler stream, which is seeded with the index of the
+ * unit's first sample. A seed can therefore be reconstructed from the
+ * stream identifier and a sample index within that stream.
+ */
+struct PSSMLTSeed {
+    size_t stream;      ///< Seed value of the replayable random number stream
+    size_t sampleIndex; ///< Index into that stream
+    Float luminance;    ///< Luminance value of the path (for sanity checks)
+
+    inline PSSMLTSeed() { }
+
+    inline PSSMLTSeed(size_t stream, size_t sampleIndex, Float luminance)
+        : stream(stream), sampleIndex(sampleIndex), luminance(luminance) { }
+
+    inline PSSMLTSeed(Stream *stream) {
+        this->stream = stream->readSize();
+        sampleIndex = stream->readSize();
+        luminance = stream->readFloat();
+    }
+
+    inline void serialize(Stream *stream) const {
+        stream->writeSize(this->stream);
+        stream->writeSize(sampleIndex);
+        stream->writeFloat(luminance);
+    }
+
+    /// Order by stream and position to avoid unnecessary rewinds
+    inline bool operator<(const PSSMLTSeed &seed) const {
+        if (stream != seed.stream)
+            return stream < seed.stream;
+        return sampleIndex < seed.sampleIndex;
     }
 };
 
@@ -23,6 +23,238 @@
 
 MTS_NAMESPACE_BEGIN
 
+/* ==================================================================== */
+/*                     Work unit and result impl.                       */
+/* ==================================================================== */
+
+void PSSMLTWorkUnit::load(Stream *stream) {
+    m_seeds.resize(stream->readSize());
+    for (size_t i=0; i<m_seeds.size(); ++i)
+        m_seeds[i] = PSSMLTSeed(stream);
+    m_timeout = stream->readInt();
+}
+
+void PSSMLTWorkUnit::save(Stream *stream) const {
+    stream->writeSize(m_seeds.size());
+    for (size_t i=0; i<m_seeds.size(); ++i)
+        m_seeds[i].serialize(stream);
+    stream->writeInt(m_timeout);
+}
+
+std::string PSSMLTWorkUnit::toString() const {
+    std::ostringstream oss;
+    oss << "PSSMLTWorkUnit[seeds=" << m_seeds.size()
+        << ", timeout=" << m_timeout << "]";
+    return oss.str();
+}
+
+void PSSMLTWorkResult::load(Stream *stream) {
+    /* Shared results never leave the machine, see PSSMLTRenderer::prepare() */
+    if (stream->readBool() || m_shared)
+        Log(EError, "Shared PSSMLT results cannot be transmitted!");
+    ImageBlock::load(stream);
+}
+
+void PSSMLTWorkResult::save(Stream *stream) const {
+    stream->writeBool(m_shared);
+    if (m_shared)
+        Log(EError, "Shared PSSMLT results cannot be transmitted!");
+    ImageBlock::save(stream);
+}
+
+void PSSMLTBootstrapResult::load(Stream *stream) {
+    m_seeds.resize(stream->readSize());
+    for (size_t i=0; i<m_seeds.size(); ++i)
+        m_seeds[i] = PSSMLTSeed(stream);
+    m_sampleCount = stream->readSize();
+    m_luminance = stream->readDouble();
+    m_luminanceSqr = stream->readDouble();
+}
+
+void PSSMLTBootstrapResult::save(Stream *stream) const {
+    stream->writeSize(m_seeds.size());
+    for (size_t i=0; i<m_seeds.size(); ++i)
+        m_seeds[i].serialize(stream);
+    stream->writeSize(m_sampleCount);
+    stream->writeDouble(m_luminance);
+    stream->writeDouble(m_luminanceSqr);
+}
+
+std::string PSSMLTBootstrapResult::toString() const {
+    std::ostringstream oss;
+    oss << "PSSMLTBootstrapResult[seeds=" << m_seeds.size()
+        << ", sampleCount=" << m_sampleCount << "]";
+    return oss.str();
+}
+
+/* ==================================================================== */
+/*                        Bootstrap implementation                      */
+/* ==================================================================== */
+
+class PSSMLTBootstrapWorker : public WorkProcessor {
+public:
+    PSSMLTBootstrapWorker(const PSSMLTConfiguration &conf)
+        : m_config(conf) {
+    }
+
+    PSSMLTBootstrapWorker(Stream *stream, InstanceManager *manager)
+        : WorkProcessor(stream, manager) {
+        m_config = PSSMLTConfiguration(stream);
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        m_config.serialize(stream);
+    }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new RangeWorkUnit();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new PSSMLTBootstrapResult();
+    }
+
+    void prepare() {
+        Scene *scene = static_cast<Scene *>(getResource("scene"));
+        m_sensor = static_cast<Sensor *>(getResource("sensor"));
+        m_rplSampler = new ReplayableSampler();
+        m_scene = new Scene(scene);
+        m_scene->setSensor(m_sensor);
+        m_scene->setSampler(m_rplSampler);
+        m_scene->removeSensor(scene->getSensor());
+        m_scene->addSensor(m_sensor);
+        m_scene->setSensor(m_sensor);
+        m_scene->wakeup(NULL, m_resources);
+        m_scene->initializeBidirectional();
+
+        m_pathSampler = new PathSampler(m_config.technique, m_scene,
+            m_rplSampler, m_rplSampler, m_rplSampler, m_config.maxDepth,
+            m_config.rr, m_config.separateDirect, m_config.directSampling);
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult, const bool &stop) {
+        const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+        PSSMLTBootstrapResult *result = static_cast<PSSMLTBootstrapResult *>(workResult);
+        SplatList splatList;
+
+        /* Every unit uses its own stream, which starts at the beginning */
+        size_t stream = range->getRangeStart();
+        m_rplSampler->setSeed(stream);
+        result->clear();
+
+        for (size_t i=0; i<range->getSize() && !stop; ++i) {
+            size_t sampleIndex = m_rplSampler->getSampleIndex();
+
+            m_pathSampler->sampleSplats(Point2i(-1), splatList);
+            Float luminance = splatList.luminance;
+            splatList.normalize(m_config.importanceMap);
+
+            result->addSample(luminance);
+            if (luminance != 0)
+                result->put(PSSMLTSeed(stream, sampleIndex, luminance));
+        }
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new PSSMLTBootstrapWorker(m_config);
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    PSSMLTConfiguration m_config;
+    ref<Scene> m_scene;
+    ref<Sensor> m_sensor;
+    ref<PathSampler> m_pathSampler;
+    ref<ReplayableSampler> m_rplSampler;
+};
+
+PSSMLTBootstrapProcess::PSSMLTBootstrapProcess(const RenderJob *parent,
+    const PSSMLTConfiguration &conf, size_t sampleCount, size_t streamCount)
+        : m_job(parent), m_config(conf), m_sampleCount(sampleCount) {
+    m_streamCount = std::max(std::min(streamCount, sampleCount), (size_t) 1);
+    m_streamSize = (sampleCount + m_streamCount - 1) / m_streamCount;
+    m_streamCount = (sampleCount + m_streamSize - 1) / m_streamSize;
+    m_resultMutex = new Mutex();
+    m_workCounter = m_resultCounter = m_samplesTaken = 0;
+    m_luminance = m_luminanceSqr = 0;
+    m_progress = new ProgressReporter("Bootstrapping", m_streamCount, parent);
+    m_candidates.reserve(sampleCount);
+    m_timer = new Timer();
+}
+
+PSSMLTBootstrapProcess::~PSSMLTBootstrapProcess() {
+    delete m_progress;
+}
+
+ref<WorkProcessor> PSSMLTBootstrapProcess::createWorkProcessor() const {
+    return new PSSMLTBootstrapWorker(m_config);
+}
+
+ParallelProcess::EStatus PSSMLTBootstrapProcess::generateWork(
+        WorkUnit *unit, int worker) {
+    if (m_workCounter >= m_streamCount)
+        return EFailure;
+
+    size_t start = m_workCounter++ * m_streamSize;
+    size_t end = std::min(start + m_streamSize, m_sampleCount) - 1;
+    static_cast<RangeWorkUnit *>(unit)->setRange(start, end);
+    return ESuccess;
+}
+
+void PSSMLTBootstrapProcess::processResult(const WorkResult *wr, bool cancelled) {
+    const PSSMLTBootstrapResult *result =
+        static_cast<const PSSMLTBootstrapResult *>(wr);
+    LockGuard lock(m_resultMutex);
+    const std::vector<PSSMLTSeed> &seeds = result->getSeeds();
+    m_candidates.insert(m_candidates.end(), seeds.begin(), seeds.end());
+    m_samplesTaken += result->getSampleCount();
+    m_luminance += result->getLuminance();
+    m_luminanceSqr += result->getLuminanceSqr();
+    m_progress->update(++m_resultCounter);
+}
+
+Float PSSMLTBootstrapProcess::generateSeeds(size_t seedCount,
+        std::vector<PSSMLTSeed> &seeds) {
+    LockGuard lock(m_resultMutex);
+    if (m_samplesTaken == 0)
+        Log(EError, "No luminance samples were taken!");
+
+    double mean = m_luminance / m_samplesTaken;
+    double variance = m_samplesTaken > 1 ? std::max((double) 0.0,
+        (m_luminanceSqr - m_samplesTaken * mean * mean) / (m_samplesTaken-1)) : 0.0;
+
+    Log(EInfo, "Done -- average luminance value = %f, stddev = %f (took %i ms, "
+        SIZE_T_FMT " streams)", mean, std::sqrt(variance),
+        m_timer->getMilliseconds(), m_streamCount);
+
+    if (mean == 0)
+        Log(EError, "The average image luminance appears to be zero! This could indicate "
+            "a problem with the scene setup. Aborting the MLT rendering process.");
+
+    Log(EDebug, "Sampling " SIZE_T_FMT "/" SIZE_T_FMT " MLT seeds",
+        seedCount, m_candidates.size());
+
+    /* Results arrive in an arbitrary order -- sort them to make
+       the choice of seeds independent of the scheduling */
+    std::sort(m_candidates.begin(), m_candidates.end());
+
+    DiscreteDistribution seedPDF(m_candidates.size());
+    for (size_t i=0; i<m_candidates.size(); ++i)
+        seedPDF.append(m_candidates[i].luminance);
+    seedPDF.normalize();
+
+    ref<Random> random = new Random();
+    seeds.clear();
+    seeds.reserve(seedCount);
+    for (size_t i=0; i<seedCount; ++i)
+        seeds.push_back(m_candidates.at(seedPDF.sample(random->nextFloat())));
+
+    /* Sort the seeds to avoid unnecessary rewinds in the ReplayableSampler */
+    std::sort(seeds.begin(), seeds.end());
+
+    return (Float) mean;
+}
+
 /* ==================================================================== */
 /*                         Worker implementation                        */
 /* ==================================================================== */
@@ -35,15 +267,22 @@ StatsCounter acceptanceRate("Primary sample space MLT",
     "Overall acceptance rate", EPercentage);
 StatsCounter forcedAcceptance("Primary sample space MLT",
     "Number of forced acceptances");
+StatsCounter exchangeRate("Primary sample space MLT",
+    "Accepted replica exchanges", EPercentage);
 
 class PSSMLTRenderer : public WorkProcessor {
 public:
-    PSSMLTRenderer(const PSSMLTConfiguration &conf)
-        : m_config(conf) {
+    /**
+     * \param sharedBlock
+     *    Optional image buffer shared by all workers running in this
+     *    process. When available, local workers splat into it directly.
+     */
+    PSSMLTRenderer(const PSSMLTConfiguration &conf, ImageBlock *sharedBlock = NULL)
+        : m_config(conf), m_sharedBlock(sharedBlock), m_splatShared(false) {
     }
 
     PSSMLTRenderer(Stream *stream, InstanceManager *manager)
-        : WorkProcessor(stream, manager) {
+        : WorkProcessor(stream, manager), m_splatShared(false) {
         m_config = PSSMLTConfiguration(stream);
     }
 
@@ -52,12 +291,12 @@ public:
     }
 
     ref<WorkUnit> createWorkUnit() const {
-        return new SeedWorkUnit();
+        return new PSSMLTWorkUnit();
     }
 
     ref<WorkResult> createWorkResult() const {
-        return new ImageBlock(Bitmap::ESpectrum,
-            m_film->getCropSize(), m_film->getReconstructionFilter());
+        return new PSSMLTWorkResult(m_film->getCropSize(),
+            m_film->getReconstructionFilter(), m_splatShared);
     }
 
     void prepare() {
@@ -74,78 +313,129 @@ public:
         m_scene->wakeup(NULL, m_resources);
         m_scene->initializeBidirectional();
 
-        m_rplSampler = static_cast<ReplayableSampler*>(
-            static_cast<Sampler *>(getResource("rplSampler"))->clone().get());
-        m_sensorSampler = new PSSMLTSampler(m_origSampler);
-        m_emitterSampler = new PSSMLTSampler(m_origSampler);
-        m_directSampler = new PSSMLTSampler(m_origSampler);
+        m_rplSampler = new ReplayableSampler();
+        m_rplStream = std::numeric_limits<size_t>::max();
+
+        m_chains.resize(std::max(m_config.chains, 1));
+        for (size_t i=0; i<m_chains.size(); ++i) {
+            Chain &chain = m_chains[i];
+            chain.sensorSampler = new PSSMLTSampler(m_origSampler);
+            chain.emitterSampler = new PSSMLTSampler(m_origSampler);
+            chain.directSampler = new PSSMLTSampler(m_origSampler);
+            chain.pathSampler = new PathSampler(m_config.technique, m_scene,
+                chain.emitterSampler, chain.sensorSampler, chain.directSampler,
+                m_config.maxDepth, m_config.rr, m_config.separateDirect,
+                m_config.directSampling);
+        }
 
-        m_pathSampler = new PathSampler(m_config.technique, m_scene,
-            m_emitterSampler, m_sensorSampler, m_directSampler, m_config.maxDepth,
-            m_config.rr, m_config.separateDirect, m_config.directSampling);
+        m_invTemperatures.resize(m_chains.size());
+        for (size_t i=0; i<m_chains.size(); ++i)
+            m_invTemperatures[i] = m_config.getInverseTemperature((int) i);
+
+        /* Only local workers can access the shared buffer. Remote workers
+           receive a serialized copy without it, and the results that they
+           send back are read into processors created by other threads */
+        Thread *thread = Thread::getThread();
+        m_splatShared = m_sharedBlock.get() != NULL && thread
+            && thread->getClass()->derivesFrom(MTS_CLASS(LocalWorker));
     }
 
     void process(const WorkUnit *workUnit, WorkResult *workResult, const bool &stop) {
         ImageBlock *result = static_cast<ImageBlock *>(workResult);
-        const SeedWorkUnit *wu = static_cast<const SeedWorkUnit *>(workUnit);
-        const PathSeed &seed = wu->getSeed();
-        SplatList *current = new SplatList(), *proposed = new SplatList();
-
-        m_emitterSampler->reset();
-        m_sensorSampler->reset();
-        m_directSampler->reset();
-        m_sensorSampler->setRandom(m_rplSampler->getRandom());
-        m_emitterSampler->setRandom(m_rplSampler->getRandom());
-        m_directSampler->setRandom(m_rplSampler->getRandom());
-
-        /* Generate the initial sample by replaying the seeding random
-           number stream at the appropriate position. Afterwards, revert
-           back to this worker's own source of random numbers */
-        m_rplSampler->setSampleIndex(seed.sampleIndex);
-
-        m_pathSampler->sampleSplats(Point2i(-1), *current);
+        const PSSMLTWorkUnit *wu = static_cast<const PSSMLTWorkUnit *>(workUnit);
+        const std::vector<PSSMLTSeed> &seeds = wu->getSeeds();
+        size_t nChains = std::min(seeds.size(), m_chains.size());
+        ref<Random> random = m_origSampler->getRandom();
         result->clear();
+        if (nChains == 0)
+            return;
+
+        /* Chain i starts out at temperature level i */
+        std::vector<size_t> levels(nChains);
+        for (size_t i=0; i<nChains; ++i) {
+            const PSSMLTSeed &seed = seeds[i];
+            Chain &chain = m_chains[i];
+            levels[i] = i;
+            chain.current = new SplatList();
+            chain.proposed = new SplatList();
+            chain.cumulativeWeight = 0;
+
+            chain.emitterSampler->reset();
+            chain.sensorSampler->reset();
+            chain.directSampler->reset();
+            chain.sensorSampler->setRandom(m_rplSampler->getRandom());
+            chain.emitterSampler->setRandom(m_rplSampler->getRandom());
+            chain.directSampler->setRandom(m_rplSampler->getRandom());
+
+            /* Generate the initial sample by replaying the seeding random
+               number stream at the appropriate position. Afterwards, revert
+               back to this worker's own source of random numbers */
+            if (seed.stream != m_rplStream) {
+                m_rplSampler->setSeed(seed.stream);
+                m_rplStream = seed.stream;
+            }
+            m_rplSampler->setSampleIndex(seed.sampleIndex);
+
+            chain.pathSampler->sampleSplats(Point2i(-1), *chain.current);
+
+            chain.sensorSampler->setRandom(random);
+            chain.emitterSampler->setRandom(random);
+            chain.directSampler->setRandom(random);
+            m_rplSampler->updateSampleIndex(m_rplSampler->getSampleIndex()
+                + chain.sensorSampler->getSampleIndex()
+                + chain.emitterSampler->getSampleIndex()
+                + chain.directSampler->getSampleIndex());
+
+            chain.sensorSampler->accept();
+            chain.emitterSampler->accept();
+            chain.directSampler->accept();
+
+            /* Sanity check -- the luminance should match the one from
+               the warmup phase - an error here would indicate inconsistencies
+               regarding the use of random numbers during sample generation */
+            if (std::abs((chain.current->luminance - seed.luminance)
+                    / seed.luminance) > Epsilon)
+                Log(EError, "Error when reconstructing a seed path: luminance "
+                    "= %f, but expected luminance = %f", chain.current->luminance,
+                    seed.luminance);
+
+            chain.current->normalize(m_config.importanceMap);
+        }
 
-        ref<Random> random = m_origSampler->getRandom();
-        m_sensorSampler->setRandom(random);
-        m_emitterSampler->setRandom(random);
-        m_directSampler->setRandom(random);
-        m_rplSampler->updateSampleIndex(m_rplSampler->getSampleIndex()
-            + m_sensorSampler->getSampleIndex()
-            + m_emitterSampler->getSampleIndex()
-            + m_directSampler->getSampleIndex());
-
-        m_sensorSampler->accept();
-        m_emitterSampler->accept();
-        m_directSampler->accept();
-
-        /* Sanity check -- the luminance should match the one from
-           the warmup phase - an error here would indicate inconsistencies
-           regarding the use of random numbers during sample generation */
-        if (std::abs((current->luminance - seed.luminance)
-                / seed.luminance) > Epsilon)
-            Log(EError, "Error when reconstructing a seed path: luminance "
-                "= %f, but expected luminance = %f", current->luminance, seed.luminance);
+        /* The MIS weights of Kelemen et al. assume that the chain only
+           moves by mutations, which swaps between replicas violate */
+        bool kelemenStyleWeights = m_config.kelemenStyleWeights
+            && !m_config.replicaExchange;
+        bool replicaExchange = m_config.replicaExchange && nChains > 1;
 
         ref<Timer> timer = new Timer();
 
-        /* MLT main loop */
-        Float cumulativeWeight = 0;
-        current->normalize(m_config.importanceMap);
+        /* MLT main loop -- the chains take turns, one mutation each */
         for (uint64_t mutationCtr=0; mutationCtr<m_config.nMutations && !stop; ++mutationCtr) {
             if (wu->getTimeout() > 0 && (mutationCtr % 8192) == 0
                     && (int) timer->getMilliseconds() > wu->getTimeout())
                 break;
 
+            size_t level = (size_t) (mutationCtr % nChains);
+            Chain &chain = m_chains[levels[level]];
+            SplatList *&current = chain.current, *&proposed = chain.proposed;
+            Float invTemperature = m_invTemperatures[level];
+
+            /* Only chains at unit temperature sample the actual target */
+            bool splat = invTemperature == 1;
+
             bool largeStep = random->nextFloat() < m_config.pLarge;
-            m_sensorSampler->setLargeStep(largeStep);
-            m_emitterSampler->setLargeStep(largeStep);
-            m_directSampler->setLargeStep(largeStep);
+            chain.sensorSampler->setLargeStep(largeStep);
+            chain.emitterSampler->setLargeStep(largeStep);
+            chain.directSampler->setLargeStep(largeStep);
 
-            m_pathSampler->sampleSplats(Point2i(-1), *proposed);
+            chain.pathSampler->sampleSplats(Point2i(-1), *proposed);
             proposed->normalize(m_config.importanceMap);
 
-            Float a = std::min((Float) 1.0f, proposed->luminance / current->luminance);
+            Float a = proposed->luminance / current->luminance;
+            if (!splat)
+                a = std::pow(a, invTemperature);
+            a = std::min((Float) 1.0f, a);
 
             if (std::isnan(proposed->luminance) || proposed->luminance < 0) {
                 Log(EWarn, "Encountered a sample with luminance = %f, ignoring!",
@@ -157,7 +447,7 @@ public:
             Float currentWeight, proposedWeight;
 
             if (a > 0) {
-                if (m_config.kelemenStyleWeights && !m_config.importanceMap) {
+                if (kelemenStyleWeights && !m_config.importanceMap) {
                     /* Kelemen-style MLT weights (these don't work for 2-stage MLT) */
                     currentWeight = (1 - a) * current->luminance
                         / (current->luminance/m_config.luminance + m_config.pLarge);
@@ -170,7 +460,7 @@ public:
                 }
                 accept = (a == 1) || (random->nextFloat() < a);
             } else {
-                if (m_config.kelemenStyleWeights)
+                if (kelemenStyleWeights)
                     currentWeight = current->luminance
                         / (current->luminance/m_config.luminance + m_config.pLarge);
                 else
@@ -179,20 +469,19 @@ public:
                 accept = false;
             }
 
-            cumulativeWeight += currentWeight;
+            if (!splat)
+                currentWeight = proposedWeight = 0;
+
+            chain.cumulativeWeight += currentWeight;
             if (accept) {
-                for (size_t k=0; k<current->size(); ++k) {
-                    Spectrum value = current->getValue(k) * cumulativeWeight;
-                    if (!value.isZero())
-                        result->put(current->getPosition(k), &value[0]);
-                }
+                splatList(result, current, chain.cumulativeWeight);
 
-                cumulativeWeight = proposedWeight;
+                chain.cumulativeWeight = proposedWeight;
                 std::swap(proposed, current);
 
-                m_sensorSampler->accept();
-                m_emitterSampler->accept();
-                m_directSampler->accept();
+                chain.sensorSampler->accept();
+                chain.emitterSampler->accept();
+                chain.directSampler->accept();
                 if (largeStep) {
                     largeStepRatio.incrementBase(1);
                     ++largeStepRatio;
@@ -203,51 +492,95 @@ public:
                 acceptanceRate.incrementBase(1);
                 ++acceptanceRate;
             } else {
-                for (size_t k=0; k<proposed->size(); ++k) {
-                    Spectrum value = proposed->getValue(k) * proposedWeight;
-                    if (!value.isZero())
-                        result->put(proposed->getPosition(k), &value[0]);
-                }
+                splatList(result, proposed, proposedWeight);
 
-                m_sensorSampler->reject();
-                m_emitterSampler->reject();
-                m_directSampler->reject();
+                chain.sensorSampler->reject();
+                chain.emitterSampler->reject();
+                chain.directSampler->reject();
                 acceptanceRate.incrementBase(1);
                 if (largeStep)
                     largeStepRatio.incrementBase(1);
                 else
                     smallStepRatio.incrementBase(1);
             }
+
+            /* After every round, propose to exchange the states of the
+               chains at two adjacent temperature levels */
+            if (replicaExchange && level == nChains - 1) {
+                size_t lower = random->nextSize(nChains - 1);
+                Chain &chain1 = m_chains[levels[lower]],
+                      &chain2 = m_chains[levels[lower+1]];
+                Float ratio = std::pow(
+                    chain2.current->luminance / chain1.current->luminance,
+                    m_invTemperatures[lower] - m_invTemperatures[lower+1]);
+
+                exchangeRate.incrementBase(1);
+                if (ratio >= 1 || random->nextFloat() < ratio) {
+                    /* Flush the pending weight of a chain that stops
+                       sampling the target distribution */
+                    splatList(result, chain1.current, chain1.cumulativeWeight);
+                    chain1.cumulativeWeight = chain2.cumulativeWeight = 0;
+                    std::swap(levels[lower], levels[lower+1]);
+                    ++exchangeRate;
+                }
+            }
         }
 
         /* Perform the last splat */
-        for (size_t k=0; k<current->size(); ++k) {
-            Spectrum value = current->getValue(k) * cumulativeWeight;
-            if (!value.isZero())
-                result->put(current->getPosition(k), &value[0]);
+        for (size_t i=0; i<nChains; ++i) {
+            Chain &chain = m_chains[i];
+            splatList(result, chain.current, chain.cumulativeWeight);
+            delete chain.current;
+            delete chain.proposed;
+            chain.current = chain.proposed = NULL;
         }
-
-
-        delete current;
-        delete proposed;
     }
 
     ref<WorkProcessor> clone() const {
-        return new PSSMLTRenderer(m_config);
+        return new PSSMLTRenderer(m_config,
+            const_cast<ImageBlock *>(m_sharedBlock.get()));
     }
 
     MTS_DECLARE_CLASS()
 private:
+    /// Splat a weighted path into the shared buffer or the work result
+    inline void splatList(ImageBlock *result, const SplatList *list, Float weight) {
+        if (weight == 0)
+            return;
+        for (size_t k=0; k<list->size(); ++k) {
+            Spectrum value = list->getValue(k) * weight;
+            if (value.isZero())
+                continue;
+            if (m_splatShared)
+                m_sharedBlock->putAtomic(list->getPosition(k), &value[0]);
+            else
+                result->put(list->getPosition(k), &value[0]);
+        }
+    }
+
+    /// State of a single Markov chain
+    struct Chain {
+        ref<PSSMLTSampler> sensorSampler;
+        ref<PSSMLTSampler> emitterSampler;
+        ref<PSSMLTSampler> directSampler;
+        ref<PathSampler> pathSampler;
+        SplatList *current, *proposed;
+        Float cumulativeWeight;
+
+        inline Chain() : current(NULL), proposed(NULL), cumulativeWeight(0) { }
+    };
+
     PSSMLTConfiguration m_config;
     ref<Scene> m_scene;
     ref<Sensor> m_sensor;
     ref<Film> m_film;
-    ref<PathSampler> m_pathSampler;
     ref<PSSMLTSampler> m_origSampler;
-    ref<PSSMLTSampler> m_sensorSampler;
-    ref<PSSMLTSampler> m_emitterSampler;
-    ref<PSSMLTSampler> m_directSampler;
     ref<ReplayableSampler> m_rplSampler;
+    size_t m_rplStream;
+    std::vector<Chain> m_chains;
+    std::vector<Float> m_invTemperatures;
+    ref<ImageBlock> m_sharedBlock;
+    bool m_splatShared;
 };
 
 /* ==================================================================== */
@@ -256,7 +589,7 @@ private:
 
 PSSMLTProcess::PSSMLTProcess(const RenderJob *parent, RenderQueue *queue,
     const PSSMLTConfiguration &conf, const Bitmap *directImage,
-    const std::vector<PathSeed> &seeds) : m_job(parent), m_queue(queue),
+    const std::vector<PSSMLTSeed> &seeds) : m_job(parent), m_queue(queue),
         m_config(conf), m_progress(NULL), m_seeds(seeds) {
     m_directImage = directImage;
     m_timeoutTimer = new Timer();
@@ -268,11 +601,16 @@ PSSMLTProcess::PSSMLTProcess(const RenderJob *parent, RenderQueue *queue,
 }
 
 ref<WorkProcessor> PSSMLTProcess::createWorkProcessor() const {
-    return new PSSMLTRenderer(m_config);
+    return new PSSMLTRenderer(m_config,
+        const_cast<ImageBlock *>(m_sharedBlock.get()));
 }
 
 void PSSMLTProcess::develop() {
     LockGuard lock(m_resultMutex);
+
+    /* Crop away the border of the shared buffer */
+    m_accum->clear();
+    m_accum->put(m_sharedBlock);
     size_t pixelCount = m_accum->getBitmap()->getPixelCount();
     const Spectrum *accum = (Spectrum *) m_accum->getBitmap()->getData();
     const Spectrum *direct = m_directImage != NULL ?
@@ -311,8 +649,12 @@ void PSSMLTProcess::develop() {
 
 void PSSMLTProcess::processResult(const WorkResult *wr, bool cancelled) {
     LockGuard lock(m_resultMutex);
-    const ImageBlock *result = static_cast<const ImageBlock *>(wr);
-    m_accum->put(result);
+    const PSSMLTWorkResult *result = static_cast<const PSSMLTWorkResult *>(wr);
+
+    /* Local workers have already splatted into the shared buffer, only
+       results of remote workers need to be merged */
+    if (!result->isShared())
+        m_sharedBlock->putAtomic(result);
     m_progress->update(++m_resultCounter);
     m_refreshTimeout = std::min(2000U, m_refreshTimeout * 2);
 
@@ -332,8 +674,14 @@ ParallelProcess::EStatus PSSMLTProcess::generateWork(WorkUnit *unit, int worker)
     if (m_workCounter >= m_config.workUnits || timeout < 0)
         return EFailure;
 
-    SeedWorkUnit *workUnit = static_cast<SeedWorkUnit *>(unit);
-    workUnit->setSeed(m_seeds[m_workCounter++]);
+    /* Spread the (sorted) seeds over the work units, so that the
+       chains of a unit start out in different parts of the image */
+    PSSMLTWorkUnit *workUnit = static_cast<PSSMLTWorkUnit *>(unit);
+    std::vector<PSSMLTSeed> &seeds = workUnit->getSeeds();
+    seeds.clear();
+    for (size_t i=m_workCounter; i<m_seeds.size(); i += m_config.workUnits)
+        seeds.push_back(m_seeds[i]);
+    m_workCounter++;
     workUnit->setTimeout(timeout);
     return ESuccess;
 }
@@ -345,14 +693,21 @@ void PSSMLTProcess::bindResource(const std::string &name, int id) {
         if (m_progress)
             delete m_progress;
         m_progress = new ProgressReporter("Rendering", m_config.workUnits, m_job);
+        m_sharedBlock = new ImageBlock(Bitmap::ESpectrum, m_film->getCropSize(),
+            m_film->getReconstructionFilter());
+        m_sharedBlock->clear();
         m_accum = new ImageBlock(Bitmap::ESpectrum, m_film->getCropSize());
         m_accum->clear();
         m_developBuffer = new Bitmap(Bitmap::ESpectrum, Bitmap::EFloat, m_film->getCropSize());
     }
 }
 
+MTS_IMPLEMENT_CLASS_S(PSSMLTBootstrapWorker, false, WorkProcessor)
 MTS_IMPLEMENT_CLASS_S(PSSMLTRenderer, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(PSSMLTBootstrapProcess, false, ParallelProcess)
 MTS_IMPLEMENT_CLASS(PSSMLTProcess, false, ParallelProcess)
-MTS_IMPLEMENT_CLASS(SeedWorkUnit, false, WorkUnit)
+MTS_IMPLEMENT_CLASS(PSSMLTWorkUnit, false, WorkUnit)
+MTS_IMPLEMENT_CLASS(PSSMLTWorkResult, false, ImageBlock)
+MTS_IMPLEMENT_CLASS(PSSMLTBootstrapResult, false, WorkResult)
 
 MTS_NAMESPACE_END
@@ -21,6 +21,7 @@
 
 #include <mitsuba/render/renderproc.h>
 #include <mitsuba/render/renderjob.h>
+#include <mitsuba/render/range.h>
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/bitmap.h>
 #include "pssmlt.h"
@@ -28,14 +29,171 @@
 MTS_NAMESPACE_BEGIN
 
 /* ==================================================================== */
-/*                           Parallel process                           */
+/*                        Work units and results                        */
 /* ==================================================================== */
 
+/**
+ * PSSMLT work unit -- contains the seeds of all Markov chains
+ * that are simulated by one work unit
+ */
+class PSSMLTWorkUnit : public WorkUnit {
+public:
+    inline void set(const WorkUnit *wu) {
+        m_seeds = static_cast<const PSSMLTWorkUnit *>(wu)->m_seeds;
+        m_timeout = static_cast<const PSSMLTWorkUnit *>(wu)->m_timeout;
+    }
+
+    inline const std::vector<PSSMLTSeed> &getSeeds() const {
+        return m_seeds;
+    }
+
+    inline std::vector<PSSMLTSeed> &getSeeds() {
+        return m_seeds;
+    }
+
+    inline int getTimeout() const {
+        return m_timeout;
+    }
+
+    inline void setTimeout(int timeout) {
+        m_timeout = timeout;
+    }
+
+    void load(Stream *stream);
+    void save(Stream *stream) const;
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+private:
+    std::vector<PSSMLTSeed> m_seeds;
+    int m_timeout;
+};
+
+/**
+ * \brief Result of a PSSMLT work unit
+ *
+ * Local workers splat directly into the shared image buffer of the
+ * process; their results are \a shared and carry no pixel data.
+ */
+class PSSMLTWorkResult : public ImageBlock {
+public:
+    inline PSSMLTWorkResult(const Vector2i &res,
+            const ReconstructionFilter *filter, bool shared = false)
+     : ImageBlock(Bitmap::ESpectrum, shared ? Vector2i(1) : res,
+            shared ? NULL : filter), m_shared(shared) {
+        setOffset(Point2i(0, 0));
+        setSize(res);
+    }
+
+    /// Were the contributions splatted into the shared image buffer?
+    inline bool isShared() const {
+        return m_shared;
+    }
+
+    void load(Stream *stream);
+    void save(Stream *stream) const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~PSSMLTWorkResult() { }
+protected:
+    bool m_shared;
+};
+
+/**
+ * \brief Result of a bootstrap work unit: the candidate seeds with
+ * a nonzero luminance and the statistics of all luminance samples
+ */
+class PSSMLTBootstrapResult : public WorkResult {
+public:
+    inline PSSMLTBootstrapResult() { clear(); }
+
+    inline void clear() {
+        m_seeds.clear();
+        m_sampleCount = 0;
+        m_luminance = m_luminanceSqr = 0;
+    }
+
+    inline void put(const PSSMLTSeed &seed) {
+        m_seeds.push_back(seed);
+    }
+
+    inline void addSample(Float luminance) {
+        m_luminance += luminance;
+        m_luminanceSqr += (double) luminance * (double) luminance;
+        m_sampleCount++;
+    }
+
+    inline const std::vector<PSSMLTSeed> &getSeeds() const { return m_seeds; }
+    inline size_t getSampleCount() const { return m_sampleCount; }
+    inline double getLuminance() const { return m_luminance; }
+    inline double getLuminanceSqr() const { return m_luminanceSqr; }
+
+    void load(Stream *stream);
+    void save(Stream *stream) const;
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~PSSMLTBootstrapResult() { }
+private:
+    std::vector<PSSMLTSeed> m_seeds;
+    size_t m_sampleCount;
+    double m_luminance, m_luminanceSqr;
+};
+
+/* ==================================================================== */
+/*                           Parallel processes                         */
+/* ==================================================================== */
+
+/**
+ * \brief Estimates the average image luminance and collects candidate
+ * Markov chain seeds using all available workers
+ *
+ * The luminance samples are split into several replayable random number
+ * streams, which are processed independently. Afterwards, the chain
+ * seeds are chosen proportional to their luminance.
+ */
+class PSSMLTBootstrapProcess : public ParallelProcess {
+public:
+    PSSMLTBootstrapProcess(const RenderJob *parent,
+        const PSSMLTConfiguration &config, size_t sampleCount,
+        size_t streamCount);
+
+    /**
+     * \brief Resample \c seedCount chain seeds from the collected
+     * candidates and return the average luminance
+     */
+    Float generateSeeds(size_t seedCount, std::vector<PSSMLTSeed> &seeds);
+
+    /* ParallelProcess impl. */
+    void processResult(const WorkResult *wr, bool cancelled);
+    ref<WorkProcessor> createWorkProcessor() const;
+    EStatus generateWork(WorkUnit *unit, int worker);
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~PSSMLTBootstrapProcess();
+private:
+    ref<const RenderJob> m_job;
+    const PSSMLTConfiguration &m_config;
+    ProgressReporter *m_progress;
+    std::vector<PSSMLTSeed> m_candidates;
+    ref<Mutex> m_resultMutex;
+    size_t m_sampleCount, m_streamCount, m_streamSize;
+    size_t m_workCounter, m_resultCounter, m_samplesTaken;
+    double m_luminance, m_luminanceSqr;
+    ref<Timer> m_timer;
+};
+
 class PSSMLTProcess : public ParallelProcess {
 public:
     PSSMLTProcess(const RenderJob *parent, RenderQueue *queue,
         const PSSMLTConfiguration &config, const Bitmap *directImage,
-        const std::vector<PathSeed> &seeds);
+        const std::vector<PSSMLTSeed> &seeds);
 
     void develop();
 
@@ -55,9 +213,10 @@ private:
     const PSSMLTConfiguration &m_config;
     const Bitmap *m_directImage;
     ref<Bitmap> m_developBuffer;
-    ImageBlock *m_accum;
+    ref<ImageBlock> m_sharedBlock;
+    ref<ImageBlock> m_accum;
     ProgressReporter *m_progress;
-    const std::vector<PathSeed> &m_seeds;
+    const std::vector<PSSMLTSeed> &m_seeds;
     ref<Mutex> m_resultMutex;
     ref<Film> m_film;
     int m_resultCounter, m_workCounter;
@@ -52,6 +52,13 @@ MTS_NAMESPACE_BEGIN
  *        is not the bottleneck.
  *        \default{200K particles per work unit, i.e. \code{200000}}
  *     }
+ *     \parameter{flushInterval}{\Integer}{
+ *        When rendering on a cluster, the workers of every remote node
+ *        accumulate the results of up to this many work units before
+ *        sending them to the master, which reduces the network traffic
+ *        accordingly. Their contributions then show up in the preview with
+ *        some delay. \default{\code{8}}
+ *     }
  *     \parameter{bruteForce}{\Boolean}{
  *        If set to \code{true}, the integrator does not attempt to create
  *        connections to the sensor and purely relies on hitting it via ray
@@ -107,6 +114,10 @@ public:
            the partially exposed films is not the bottleneck. */
         m_granularity = props.getSize("granularity", 200000);
 
+        /* Number of work units that remote nodes accumulate
+           before sending their partial film to the master */
+        m_flushInterval = props.getSize("flushInterval", 8);
+
         /* Rely on hitting the sensor via ray tracing? */
         m_bruteForce = props.getBoolean("bruteForce", false);
 
@@ -122,6 +133,7 @@ public:
         m_maxDepth = stream->readInt();
         m_granularity = stream->readSize();
         m_bruteForce = stream->readBool();
+        m_flushInterval = stream->readSize();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -130,6 +142,7 @@ public:
         stream->writeInt(m_maxDepth);
         stream->writeSize(m_granularity);
         stream->writeBool(m_bruteForce);
+        stream->writeSize(m_flushInterval);
     }
 
     bool preprocess(const Scene *scene, RenderQueue *queue, const RenderJob *job,
@@ -173,7 +186,7 @@ public:
 
         ref<ParallelProcess> process = new CaptureParticleProcess(
             job, queue, m_sampleCount, m_granularity, maxPtracerDepth,
-            m_maxDepth, m_rr, m_bruteForce);
+            m_maxDepth, m_rr, m_bruteForce, m_flushInterval);
 
         process->bindResource("scene", sceneResID);
         process->bindResource("sensor", sensorResID);
@@ -192,7 +205,8 @@ public:
             << "  maxDepth = " << m_maxDepth << "," << endl
             << "  rr = " << m_rr.toString() << "," << endl
             << "  granularity = " << m_granularity << "," << endl
-            << "  bruteForce = " << m_bruteForce << endl
+            << "  bruteForce = " << m_bruteForce << "," << endl
+            << "  flushInterval = " << m_flushInterval << endl
             << "]";
         return oss.str();
     }
@@ -203,7 +217,7 @@ protected:
     ref<ParallelProcess> m_process;
     int m_maxDepth;
     RussianRoulette m_rr;
-    size_t m_sampleCount, m_granularity;
+    size_t m_sampleCount, m_granularity, m_flushInterval;
     bool m_bruteForce;
 };
 
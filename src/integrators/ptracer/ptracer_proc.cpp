@@ -24,20 +24,123 @@ MTS_NAMESPACE_BEGIN
 /*                           Work result impl.                          */
 /* ==================================================================== */
 
+CaptureParticleWorkResult::CaptureParticleWorkResult(const Vector2i &res,
+        const ReconstructionFilter *filter, bool shared)
+    : m_filter(filter), m_size(res), m_shared(shared) {
+    m_tileCount = Vector2i(
+        (res.x + MTS_PTRACER_TILE_SIZE - 1) / MTS_PTRACER_TILE_SIZE,
+        (res.y + MTS_PTRACER_TILE_SIZE - 1) / MTS_PTRACER_TILE_SIZE);
+    m_range = new RangeWorkUnit();
+}
+
+ImageBlock *CaptureParticleWorkResult::getTile(uint32_t index) {
+    ref<ImageBlock> &tile = m_tiles[index];
+    if (EXPECT_NOT_TAKEN(!tile)) {
+        Point2i offset(
+            (int) (index % m_tileCount.x) * MTS_PTRACER_TILE_SIZE,
+            (int) (index / m_tileCount.x) * MTS_PTRACER_TILE_SIZE);
+        Vector2i size(
+            std::min(MTS_PTRACER_TILE_SIZE, m_size.x - offset.x),
+            std::min(MTS_PTRACER_TILE_SIZE, m_size.y - offset.y));
+        tile = new ImageBlock(Bitmap::ESpectrum, size, m_filter.get());
+        tile->setOffset(offset);
+        tile->clear();
+    }
+    return tile;
+}
+
+void CaptureParticleWorkResult::put(const Point2 &pos, const Float *value) {
+    /* Samples outside of the film land in the border of an edge tile */
+    int x = math::clamp(math::floorToInt(pos.x) / MTS_PTRACER_TILE_SIZE, 0, m_tileCount.x - 1),
+        y = math::clamp(math::floorToInt(pos.y) / MTS_PTRACER_TILE_SIZE, 0, m_tileCount.y - 1);
+    getTile((uint32_t) (x + y * m_tileCount.x))->put(pos, value);
+}
+
+void CaptureParticleWorkResult::put(const CaptureParticleWorkResult *result) {
+    for (TileMap::const_iterator it = result->m_tiles.begin();
+            it != result->m_tiles.end(); ++it)
+        getTile(it->first)->put(it->second.get());
+}
+
+void CaptureParticleWorkResult::putAtomicInto(ImageBlock *target) const {
+    for (TileMap::const_iterator it = m_tiles.begin(); it != m_tiles.end(); ++it)
+        target->putAtomic(it->second.get());
+}
+
 void CaptureParticleWorkResult::load(Stream *stream) {
-    size_t nEntries = (size_t) m_size.x * (size_t) m_size.y;
-    stream->readFloatArray(reinterpret_cast<Float *>(m_bitmap->getFloatData()),
-        nEntries * SPECTRUM_SAMPLES);
+    /* Shared results never leave the machine, see CaptureParticleWorker::prepare() */
+    if (stream->readBool() || m_shared)
+        Log(EError, "Shared particle tracing results cannot be transmitted!");
+    m_tiles.clear();
+    size_t tileCount = stream->readSize();
+    for (size_t i=0; i<tileCount; ++i) {
+        Bitmap *bitmap = getTile(stream->readUInt())->getBitmap();
+        stream->readFloatArray(bitmap->getFloatData(),
+            bitmap->getPixelCount() * SPECTRUM_SAMPLES);
+    }
     m_range->load(stream);
 }
 
 void CaptureParticleWorkResult::save(Stream *stream) const {
-    size_t nEntries = (size_t) m_size.x * (size_t) m_size.y;
-    stream->writeFloatArray(reinterpret_cast<const Float *>(m_bitmap->getFloatData()),
-        nEntries * SPECTRUM_SAMPLES);
+    stream->writeBool(m_shared);
+    if (m_shared)
+        Log(EError, "Shared particle tracing results cannot be transmitted!");
+    stream->writeSize(m_tiles.size());
+    for (TileMap::const_iterator it = m_tiles.begin(); it != m_tiles.end(); ++it) {
+        const Bitmap *bitmap = it->second->getBitmap();
+        stream->writeUInt(it->first);
+        stream->writeFloatArray(bitmap->getFloatData(),
+            bitmap->getPixelCount() * SPECTRUM_SAMPLES);
+    }
     m_range->save(stream);
 }
 
+std::string CaptureParticleWorkResult::toString() const {
+    std::ostringstream oss;
+    oss << "CaptureParticleWorkResult[" << endl
+        << "  size = " << m_size.toString() << "," << endl
+        << "  tiles = " << m_tiles.size() << "/"
+        << m_tileCount.x * m_tileCount.y << "," << endl
+        << "  shared = " << m_shared << endl
+        << "]";
+    return oss.str();
+}
+
+/* ==================================================================== */
+/*                          Node buffer impl.                           */
+/* ==================================================================== */
+
+StatsCounter nodeFlushes("Particle tracer",
+    "Work units per transmitted film", EAverage);
+
+CaptureParticleNodeBuffer::CaptureParticleNodeBuffer(size_t flushInterval)
+    : m_flushInterval(flushInterval), m_active(0), m_unflushed(0) {
+    m_mutex = new Mutex();
+}
+
+void CaptureParticleNodeBuffer::begin() {
+    LockGuard lock(m_mutex);
+    ++m_active;
+}
+
+void CaptureParticleNodeBuffer::end(CaptureParticleWorkResult *result) {
+    LockGuard lock(m_mutex);
+    if (!m_pending)
+        m_pending = new CaptureParticleWorkResult(result->getSize(),
+            result->getFilter());
+    m_pending->put(result);
+    result->clear();
+    --m_active;
+    ++m_unflushed;
+
+    if (m_active == 0 || m_unflushed >= m_flushInterval) {
+        result->swapTiles(m_pending);
+        nodeFlushes.incrementBase();
+        nodeFlushes += m_unflushed;
+        m_unflushed = 0;
+    }
+}
+
 /* ==================================================================== */
 /*                         Work processor impl.                         */
 /* ==================================================================== */
@@ -46,27 +149,45 @@ CaptureParticleWorker::CaptureParticleWorker(Stream *stream, InstanceManager *ma
   : ParticleTracer(stream, manager) {
       m_maxPathDepth = stream->readInt();
       m_bruteForce = stream->readBool();
+      m_flushInterval = stream->readSize();
+      m_splatShared = false;
+
+      /* This instance runs on a remote node, where it is cloned for
+         every worker. Let them accumulate across work units */
+      if (m_flushInterval > 1)
+          m_nodeBuffer = new CaptureParticleNodeBuffer(m_flushInterval);
 }
 
 void CaptureParticleWorker::serialize(Stream *stream, InstanceManager *manager) const {
     ParticleTracer::serialize(stream, manager);
     stream->writeInt(m_maxPathDepth);
     stream->writeBool(m_bruteForce);
+    stream->writeSize(m_flushInterval);
 }
 
 void CaptureParticleWorker::prepare() {
     ParticleTracer::prepare();
     m_sensor = static_cast<Sensor *>(getResource("sensor"));
     m_rfilter = m_sensor->getFilm()->getReconstructionFilter();
+
+    /* Only local workers can access the shared buffer. Remote workers
+       receive a serialized copy without it, and the results that they
+       send back are read into processors created by other threads */
+    Thread *thread = Thread::getThread();
+    m_splatShared = m_sharedBlock.get() != NULL && thread
+        && thread->getClass()->derivesFrom(MTS_CLASS(LocalWorker));
 }
 
 ref<WorkProcessor> CaptureParticleWorker::clone() const {
-    return new CaptureParticleWorker(m_maxDepth, m_maxPathDepth, m_rr, m_bruteForce);
+    return new CaptureParticleWorker(m_maxDepth, m_maxPathDepth, m_rr,
+        m_bruteForce, m_flushInterval, const_cast<ImageBlock *>(m_sharedBlock.get()),
+        const_cast<CaptureParticleNodeBuffer *>(m_nodeBuffer.get()));
 }
 
 ref<WorkResult> CaptureParticleWorker::createWorkResult() const {
     const Film *film = m_sensor->getFilm();
-    return new CaptureParticleWorkResult(film->getCropSize(), m_rfilter.get());
+    return new CaptureParticleWorkResult(film->getCropSize(),
+        m_rfilter.get(), m_splatShared);
 }
 
 void CaptureParticleWorker::process(const WorkUnit *workUnit, WorkResult *workResult,
@@ -75,7 +196,11 @@ void CaptureParticleWorker::process(const WorkUnit *workUnit, WorkResult *workRe
     m_workResult = static_cast<CaptureParticleWorkResult *>(workResult);
     m_workResult->setRangeWorkUnit(range);
     m_workResult->clear();
+    if (m_nodeBuffer)
+        m_nodeBuffer->begin();
     ParticleTracer::process(workUnit, workResult, stop);
+    if (m_nodeBuffer)
+        m_nodeBuffer->end(m_workResult);
     m_workResult = NULL;
 }
 
@@ -102,7 +227,7 @@ void CaptureParticleWorker::handleEmission(const PositionSamplingRecord &pRec,
     value *= emitter->evalDirection(DirectionSamplingRecord(dRec.d), pRec);
 
     /* Splat onto the accumulation buffer */
-    m_workResult->put(dRec.uv, (Float *) &value[0]);
+    splat(dRec.uv, (Float *) &value[0]);
 }
 
 void CaptureParticleWorker::handleSurfaceInteraction(int depth, int nullInteractions,
@@ -123,7 +248,7 @@ void CaptureParticleWorker::handleSurfaceInteraction(int depth, int nullInteract
         if (value.isZero())
             return;
 
-        m_workResult->put(uv, (Float *) &value[0]);
+        splat(uv, (Float *) &value[0]);
         return;
     }
 
@@ -160,7 +285,7 @@ void CaptureParticleWorker::handleSurfaceInteraction(int depth, int nullInteract
     value *= bsdf->eval(bRec) * correction;
 
     /* Splat onto the accumulation buffer */
-    m_workResult->put(dRec.uv, (Float *) &value[0]);
+    splat(dRec.uv, (Float *) &value[0]);
 }
 
 void CaptureParticleWorker::handleMediumInteraction(int depth, int nullInteractions, bool caustic,
@@ -189,7 +314,7 @@ void CaptureParticleWorker::handleMediumInteraction(int depth, int nullInteracti
         return;
 
     /* Splat onto the accumulation buffer */
-    m_workResult->put(dRec.uv, (Float *) &value[0]);
+    splat(dRec.uv, (Float *) &value[0]);
 }
 
 /* ==================================================================== */
@@ -197,9 +322,13 @@ void CaptureParticleWorker::handleMediumInteraction(int depth, int nullInteracti
 /* ==================================================================== */
 
 void CaptureParticleProcess::develop() {
-    Float weight = (m_accum->getWidth() * m_accum->getHeight())
+    Float weight = (m_developBlock->getSize().x * m_developBlock->getSize().y)
         / (Float) m_receivedResultCount;
-    m_film->setBitmap(m_accum->getBitmap(), weight);
+
+    /* Crop away the border of the shared buffer */
+    m_developBlock->clear();
+    m_developBlock->put(m_sharedBlock);
+    m_film->setBitmap(m_developBlock->getBitmap(), weight);
     m_queue->signalRefresh(m_job);
 }
 
@@ -210,9 +339,14 @@ void CaptureParticleProcess::processResult(const WorkResult *wr, bool cancelled)
     if (cancelled)
         return;
 
+    /* Local workers have already splatted into the shared buffer, only
+       results of remote workers need to be added (without holding the
+       process-wide lock) */
+    if (!result->isShared())
+        result->putAtomicInto(m_sharedBlock);
+
     LockGuard lock(m_resultMutex);
     increaseResultCount(range->getSize());
-    m_accum->put(result);
     if (m_job->isInteractive() || m_receivedResultCount == m_workCount)
         develop();
 }
@@ -221,18 +355,22 @@ void CaptureParticleProcess::bindResource(const std::string &name, int id) {
     if (name == "sensor") {
         Sensor *sensor = static_cast<Sensor *>(Scheduler::getInstance()->getResource(id));
         m_film = sensor->getFilm();
-        m_accum = new ImageBlock(Bitmap::ESpectrum, m_film->getCropSize(), NULL);
-        m_accum->clear();
+        m_sharedBlock = new ImageBlock(Bitmap::ESpectrum, m_film->getCropSize(),
+            m_film->getReconstructionFilter());
+        m_sharedBlock->clear();
+        m_developBlock = new ImageBlock(Bitmap::ESpectrum, m_film->getCropSize(), NULL);
     }
     ParticleProcess::bindResource(name, id);
 }
 
 ref<WorkProcessor> CaptureParticleProcess::createWorkProcessor() const {
-    return new CaptureParticleWorker(m_maxDepth, m_maxPathDepth, m_rr, m_bruteForce);
+    return new CaptureParticleWorker(m_maxDepth, m_maxPathDepth, m_rr,
+        m_bruteForce, m_flushInterval, const_cast<ImageBlock *>(m_sharedBlock.get()));
 }
 
 MTS_IMPLEMENT_CLASS(CaptureParticleProcess, false, ParticleProcess)
-MTS_IMPLEMENT_CLASS(CaptureParticleWorkResult, false, ImageBlock)
+MTS_IMPLEMENT_CLASS(CaptureParticleWorkResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS(CaptureParticleNodeBuffer, false, Object)
 MTS_IMPLEMENT_CLASS_S(CaptureParticleWorker, false, ParticleTracer)
 MTS_NAMESPACE_END
 
@@ -23,6 +23,7 @@
 #include <mitsuba/render/range.h>
 #include <mitsuba/render/renderjob.h>
 #include <mitsuba/core/bitmap.h>
+#include <boost/unordered_map.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -30,40 +31,124 @@ MTS_NAMESPACE_BEGIN
 /*                             Work result                              */
 /* ==================================================================== */
 
+/// Edge length of the tiles of a sparse particle tracing result
+#define MTS_PTRACER_TILE_SIZE 64
+
 /**
  * \brief Packages the result of a particle tracing work unit. Contains
- * the range of traced particles plus a snapshot of the sensor film.
+ * the range of traced particles plus the affected parts of the sensor film.
+ *
+ * Particles usually reach only a fraction of the image, hence the film
+ * is split into tiles that are allocated once they receive a contribution.
+ * Only these are transmitted and merged into the process-wide buffer, so
+ * that the size of a result no longer scales with the film resolution.
+ *
+ * Local workers splat directly into the shared film buffer of the
+ * process; their results are \a shared and carry no pixel data.
  */
-class CaptureParticleWorkResult : public ImageBlock {
+class CaptureParticleWorkResult : public WorkResult {
 public:
-    inline CaptureParticleWorkResult(const Vector2i &res, const ReconstructionFilter *filter)
-     : ImageBlock(Bitmap::ESpectrum, res, filter) {
-        setOffset(Point2i(0, 0));
-        setSize(res);
-        m_range = new RangeWorkUnit();
-    }
+    CaptureParticleWorkResult(const Vector2i &res,
+            const ReconstructionFilter *filter, bool shared = false);
 
     inline const RangeWorkUnit *getRangeWorkUnit() const {
         return m_range.get();
     }
 
+    /// Were the contributions splatted into the shared film buffer?
+    inline bool isShared() const {
+        return m_shared;
+    }
+
     inline void setRangeWorkUnit(const RangeWorkUnit *range) {
         m_range->set(range);
     }
 
+    /// Splat a sample into the tile that contains it
+    void put(const Point2 &pos, const Float *value);
+
+    /// Add the contents of all tiles to \c target using atomic operations
+    void putAtomicInto(ImageBlock *target) const;
+
+    /// Add the tiles of another result to this one
+    void put(const CaptureParticleWorkResult *result);
+
+    /// Exchange the tiles of two results
+    inline void swapTiles(CaptureParticleWorkResult *result) {
+        m_tiles.swap(result->m_tiles);
+    }
+
+    /// Release all tiles
+    inline void clear() { m_tiles.clear(); }
+
+    /// Return the film size
+    inline const Vector2i &getSize() const { return m_size; }
+
+    /// Return the reconstruction filter used by the tiles
+    inline const ReconstructionFilter *getFilter() const { return m_filter.get(); }
+
+    /// Return the number of tiles that received contributions
+    inline size_t getTileCount() const { return m_tiles.size(); }
+
     /* Work unit implementation */
     void load(Stream *stream);
     void save(Stream *stream) const;
+    std::string toString() const;
 
     MTS_DECLARE_CLASS()
 protected:
     /// Virtual destructor
     virtual ~CaptureParticleWorkResult() { }
+
+    /// Look up a tile and allocate it if necessary
+    ImageBlock *getTile(uint32_t index);
 protected:
+    typedef boost::unordered_map<uint32_t, ref<ImageBlock> > TileMap;
+
     ref<RangeWorkUnit> m_range;
+    ref<const ReconstructionFilter> m_filter;
+    TileMap m_tiles;
+    Vector2i m_size, m_tileCount;
+    bool m_shared;
 };
 
 
+/**
+ * \brief Contributions of the workers on a remote node that have not
+ * been sent to the master yet
+ *
+ * Instead of returning a film for every work unit, the workers of a node
+ * merge their results into this buffer, and only every few work units
+ * one of them takes over the accumulated tiles. The last worker to finish
+ * while no other unit is in progress always does so, hence nothing remains
+ * on the node once the process ends.
+ */
+class CaptureParticleNodeBuffer : public Object {
+public:
+    /// Create a buffer that is flushed at least every \c flushInterval units
+    CaptureParticleNodeBuffer(size_t flushInterval);
+
+    /// Signal that a worker has started a work unit
+    void begin();
+
+    /**
+     * \brief Merge the result of a finished work unit
+     *
+     * Afterwards, \c result is either empty or holds all contributions
+     * that were accumulated since the last flush.
+     */
+    void end(CaptureParticleWorkResult *result);
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~CaptureParticleNodeBuffer() { }
+private:
+    ref<Mutex> m_mutex;
+    ref<CaptureParticleWorkResult> m_pending;
+    size_t m_flushInterval, m_active, m_unflushed;
+};
+
 /* ==================================================================== */
 /*                             Work processor                           */
 /* ==================================================================== */
@@ -74,10 +159,24 @@ protected:
  */
 class CaptureParticleWorker : public ParticleTracer {
 public:
+    /**
+     * \param sharedBlock
+     *    Optional film buffer shared by all workers running in this
+     *    process, which they then splat into using atomic operations
+     *    instead of accumulating a private image per worker
+     * \param flushInterval
+     *    Number of work units that the workers of a remote node
+     *    accumulate before sending their contributions to the master
+     * \param nodeBuffer
+     *    Accumulation buffer shared by the workers of a remote node
+     */
     inline CaptureParticleWorker(int maxDepth, int maxPathDepth,
-        RussianRoulette rr, bool bruteForce)
+        RussianRoulette rr, bool bruteForce, size_t flushInterval,
+        ImageBlock *sharedBlock = NULL, CaptureParticleNodeBuffer *nodeBuffer = NULL)
         : ParticleTracer(maxDepth, rr, true),
-        m_maxPathDepth(maxPathDepth), m_bruteForce(bruteForce) { }
+        m_sharedBlock(sharedBlock), m_nodeBuffer(nodeBuffer),
+        m_flushInterval(flushInterval), m_maxPathDepth(maxPathDepth),
+        m_bruteForce(bruteForce), m_splatShared(false) { }
 
     CaptureParticleWorker(Stream *stream, InstanceManager *manager);
 
@@ -120,14 +219,26 @@ public:
 
     MTS_DECLARE_CLASS()
 protected:
+    /// Splat a contribution into the shared buffer or the work result
+    inline void splat(const Point2 &uv, const Float *value) {
+        if (m_splatShared)
+            m_sharedBlock->putAtomic(uv, value);
+        else
+            m_workResult->put(uv, value);
+    }
+
     /// Virtual destructor
     virtual ~CaptureParticleWorker() { }
 private:
     ref<const Sensor> m_sensor;
     ref<const ReconstructionFilter> m_rfilter;
     ref<CaptureParticleWorkResult> m_workResult;
+    ref<ImageBlock> m_sharedBlock;
+    ref<CaptureParticleNodeBuffer> m_nodeBuffer;
+    size_t m_flushInterval;
     int m_maxPathDepth;
     bool m_bruteForce;
+    bool m_splatShared;
 };
 
 /* ==================================================================== */
@@ -141,11 +252,12 @@ class CaptureParticleProcess : public ParticleProcess {
 public:
     CaptureParticleProcess(const RenderJob *job, RenderQueue *queue,
             size_t sampleCount, size_t granularity, int maxDepth,
-            int maxPathDepth, RussianRoulette rr, bool bruteForce)
+            int maxPathDepth, RussianRoulette rr, bool bruteForce,
+            size_t flushInterval = 1)
         : ParticleProcess(ParticleProcess::ETrace, sampleCount,
           granularity, "Rendering", job), m_job(job), m_queue(queue),
           m_maxDepth(maxDepth), m_maxPathDepth(maxPathDepth),
-          m_rr(rr), m_bruteForce(bruteForce) {
+          m_rr(rr), m_bruteForce(bruteForce), m_flushInterval(flushInterval) {
     }
 
     void develop();
@@ -163,11 +275,13 @@ private:
     ref<const RenderJob> m_job;
     ref<RenderQueue> m_queue;
     ref<Film> m_film;
-    ref<ImageBlock> m_accum;
+    ref<ImageBlock> m_sharedBlock;
+    ref<ImageBlock> m_developBlock;
     int m_maxDepth;
     int m_maxPathDepth;
     RussianRoulette m_rr;
     bool m_bruteForce;
+    size_t m_flushInterval;
 };
 
 MTS_NAMESPACE_END
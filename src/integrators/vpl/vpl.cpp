@@ -43,6 +43,17 @@ MTS_NAMESPACE_BEGIN
  *       used to control the rendering artifact discussed below.
  *       \default{0.1}
  *     }
+ *     \parameter{maxClusters}{\Integer}{
+ *       When set to a nonzero value, the generated VPLs are grouped
+ *       into at most this many clusters, each of which is rendered
+ *       using a single representative VPL and shadow map
+ *       \default{0, i.e. render every VPL}
+ *     }
+ *     \parameter{reuseVPLs}{\Boolean}{
+ *       Keep the VPLs of the previous rendering when neither the emitters,
+ *       the geometry, nor the materials of the scene have changed
+ *       \default{\code{true}}
+ *     }
  * }
  *
  * This integrator implements a hardware-accelerated global illumination
@@ -75,6 +86,15 @@ MTS_NAMESPACE_BEGIN
  *     is too dark in certain areas). The default of \code{0.1} is
  *     usually reasonable.}{integrator_vpl_clamping03}
  * }
+ *
+ * For interactive use, e.g. while placing lights in large scenes, the
+ * \code{maxClusters} parameter bounds the amount of shadow map work per frame
+ * independently of the number of VPLs. Similar to Lightcuts
+ * \cite{Walter2005Lightcuts}, nearby VPLs with similar orientation are merged
+ * into clusters that are represented by a single VPL carrying the power of the
+ * whole cluster. Together with \code{reuseVPLs}, which skips the VPL generation
+ * altogether when only the camera has moved, this makes repeated renderings of
+ * the same scene considerably cheaper.
  */
 class VPLIntegrator : public Integrator {
 public:
@@ -85,6 +105,10 @@ public:
         m_maxDepth = props.getInteger("maxDepth", 5);
         /* Relative clamping factor (0=no clamping, 1=full clamping) */
         m_clamping = props.getFloat("clamping", 0.1f);
+        /* Max. number of VPL clusters (0 = no clustering) */
+        m_maxClusters = props.getSize("maxClusters", 0);
+        /* Reuse the VPLs of the previous rendering if the scene didn't change? */
+        m_reuseVPLs = props.getBoolean("reuseVPLs", true);
 
         m_session = Session::create();
         m_device = Device::create(m_session);
@@ -123,8 +147,14 @@ public:
             Log(EError, "The VPL integrator requires a projective camera "
                 "(e.g. perspective/thinlens/orthographic/telecentric)!");
 
-        m_vpls.clear();
         size_t sampleCount = scene->getSampler()->getSampleCount();
+        std::string signature = getSceneSignature(scene, sampleCount);
+        if (m_reuseVPLs && !m_vpls.empty() && signature == m_signature) {
+            Log(EInfo, "Reusing %i virtual point lights", m_vpls.size());
+            return true;
+        }
+
+        m_vpls.clear();
         Float normalization = (Float) 1 / generateVPLs(scene, m_random,
                 0, sampleCount, m_maxDepth, true, m_vpls);
         for (size_t i=0; i<m_vpls.size(); ++i) {
@@ -133,9 +163,39 @@ public:
         }
         Log(EInfo, "Generated %i virtual point lights", m_vpls.size());
 
+        if (m_maxClusters > 0 && m_vpls.size() > m_maxClusters) {
+            std::deque<VPL> clusters;
+            clusterVPLs(m_vpls, m_maxClusters, m_random, clusters);
+            Log(EInfo, "Grouped them into %i clusters", clusters.size());
+            m_vpls.swap(clusters);
+        }
+        m_signature = signature;
+
         return true;
     }
 
+    /**
+     * \brief Summarize everything the VPLs depend on
+     *
+     * The sensor is deliberately excluded -- it only affects the
+     * pruning step, which does not introduce bias.
+     */
+    std::string getSceneSignature(const Scene *scene, size_t sampleCount) const {
+        std::ostringstream oss;
+        oss << sampleCount << "," << m_maxDepth << "," << m_maxClusters << endl;
+        const ref_vector<Emitter> &emitters = scene->getEmitters();
+        for (size_t i=0; i<emitters.size(); ++i)
+            oss << emitters[i]->toString() << endl;
+        const ref_vector<Shape> &shapes = scene->getShapes();
+        for (size_t i=0; i<shapes.size(); ++i) {
+            const Shape *shape = shapes[i].get();
+            oss << shape->getAABB().toString() << endl;
+            if (shape->getBSDF())
+                oss << shape->getBSDF()->toString() << endl;
+        }
+        return oss.str();
+    }
+
     void cancel() {
         m_cancel = true;
     }
@@ -256,10 +316,13 @@ private:
     ref<GPUTexture> m_framebuffer, m_accumBuffer;
     ref<VPLShaderManager> m_shaderManager;
     std::deque<VPL> m_vpls;
+    std::string m_signature;
     ref<Random> m_random;
     int m_maxDepth;
     int m_shadowMapResolution;
+    size_t m_maxClusters;
     Float m_clamping;
+    bool m_reuseVPLs;
     bool m_cancel;
 };
 
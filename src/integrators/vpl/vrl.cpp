@@ -0,0 +1,742 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/scene.h>
+#include <mitsuba/render/vpl.h>
+#include <mitsuba/core/statistics.h>
+#include <queue>
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter avgCutSize("VRL integrator", "Average cut size", EAverage);
+
+/*!\plugin{vrl}{Virtual ray light integrator}
+ * \order{14}
+ * \parameters{
+ *     \parameter{maxDepth}{\Integer}{Specifies the longest path depth
+ *         in the generated output image (where \code{-1} corresponds to $\infty$).
+ *         A value of \code{2} will lead to direct-only illumination.
+ *         \default{\code{5}}
+ *     }
+ *     \parameter{vrlCount}{\Integer}{Approximate number of virtual
+ *         ray lights that are generated \default{10000}}
+ *     \parameter{maxCutSize}{\Integer}{Maximum number of light tree
+ *         nodes that are evaluated per pixel sample \default{64}}
+ *     \parameter{errorThreshold}{\Float}{Relative error bound below which
+ *         the cut of a slice is no longer refined \default{0.02}}
+ *     \parameter{sliceSize}{\Integer}{Side length of the pixel slices that
+ *         share a light cut \default{8}}
+ *     \parameter{clamping}{\Float}{Minimum distance between points on
+ *         camera rays and virtual ray lights (relative to the scene size).
+ *         Larger values reduce singularities at the expense of energy loss
+ *         \default{0.001}}
+ *     \parameter{hideEmitters}{\Boolean}{Hide directly visible emitters?
+ *        See page~\pageref{sec:hideemitters} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
+ * }
+ *
+ * This integrator renders participating media using \emph{virtual ray lights}
+ * (VRLs) \cite{Novak2012Virtual}, i.e. the segments of light paths that pass
+ * through a medium. Every camera ray gathers the light scattered from these
+ * segments onto itself, which captures multiple scattering with far fewer
+ * light paths than virtual point lights would require.
+ *
+ * To avoid evaluating every VRL for every pixel, the VRLs are organized in a
+ * light tree similar to Lightcuts \cite{Walter2005Lightcuts}: each node is
+ * represented by one of its VRLs carrying the power of the whole subtree.
+ * The image is divided into slices of \code{sliceSize}$\times$\code{sliceSize}
+ * pixels, and a cut through the tree is selected adaptively for every slice
+ * using representative camera rays, until the estimated error of every cut
+ * node drops below \code{errorThreshold} or the cut reaches \code{maxCutSize}
+ * nodes. All pixels of the slice then evaluate the same bounded cut.
+ *
+ * Single scattering and direct illumination of surfaces are computed using
+ * standard emitter sampling, and the VRLs provide light scattered by media
+ * both towards camera rays and towards the first visible surface.
+ *
+ * \remarks{
+ *     \item Only homogeneous participating media are supported
+ *     \item Light that reaches the first visible surface solely via
+ *           other surfaces is not accounted for
+ *     \item Network rendering is not supported
+ * }
+ */
+class VRLIntegrator : public SamplingIntegrator {
+public:
+    /// Maximum number of index-matched medium transitions along a camera ray
+    enum {
+        EMaxTransitions = 16,
+        EReceiverSamples = 8
+    };
+
+    /// Node of the VRL light tree
+    struct VRLNode {
+        /// Bounds of all segments below this node
+        AABB aabb;
+        /// Estimated total power scattered by the segments below this node
+        Float intensity;
+        /// Representative, whose power is scaled to stand in for the subtree
+        VRL vrl;
+        /// Child indices (0 for leaves)
+        uint32_t left, right;
+
+        inline VRLNode(const VRL &vrl) : vrl(vrl), left(0), right(0) { }
+
+        inline bool isLeaf() const { return left == 0; }
+    };
+
+    /// Entry of the cut refinement queue
+    struct CutEntry {
+        uint32_t node;
+        Float error;
+
+        inline CutEntry(uint32_t node, Float error) : node(node), error(error) { }
+
+        inline bool operator<(const CutEntry &e) const {
+            return error < e.error;
+        }
+    };
+
+    typedef std::vector<uint32_t> Cut;
+
+    VRLIntegrator(const Properties &props) : SamplingIntegrator(props) {
+        /* Longest visualized path length (\c -1 = infinite) */
+        m_maxDepth = props.getInteger("maxDepth", 5);
+        /* Approximate number of generated virtual ray lights */
+        m_vrlCount = props.getSize("vrlCount", 10000);
+        /* Maximum number of light tree nodes evaluated per sample */
+        m_maxCutSize = props.getSize("maxCutSize", 64);
+        /* Relative error bound that stops the cut refinement */
+        m_errorThreshold = props.getFloat("errorThreshold", 0.02f);
+        /* Side length of the pixel slices that share a cut */
+        m_sliceSize = props.getInteger("sliceSize", 8);
+        /* Minimum distance between camera rays and VRLs (relative to the scene size) */
+        m_clamping = props.getFloat("clamping", 0.001f);
+        /* When this flag is set to true, contributions from directly
+         * visible emitters will not be included in the rendered image */
+        m_hideEmitters = props.getBoolean("hideEmitters", false);
+
+        if (m_maxDepth == 0 || m_maxDepth < -1)
+            Log(EError, "maxDepth must be -1 or greater than zero!");
+        if (m_maxCutSize == 0)
+            Log(EError, "maxCutSize must be greater than zero!");
+        if (m_sliceSize <= 0)
+            Log(EError, "sliceSize must be greater than zero!");
+
+        m_minDistSqr = 0;
+    }
+
+    VRLIntegrator(Stream *stream, InstanceManager *manager)
+        : SamplingIntegrator(stream, manager) {
+        Log(EError, "Network rendering is not supported!");
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Log(EError, "Network rendering is not supported!");
+    }
+
+    bool preprocess(const Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        SamplingIntegrator::preprocess(scene, queue, job, sceneResID, sensorResID, samplerResID);
+
+        const ref_vector<Medium> &media = scene->getMedia();
+        for (ref_vector<Medium>::const_iterator it = media.begin(); it != media.end(); ++it) {
+            if (!(*it)->isHomogeneous())
+                Log(EError, "Inhomogeneous media are currently not supported by the VRL integrator!");
+        }
+
+        Float minDist = m_clamping * scene->getBSphere().radius;
+        m_minDistSqr = minDist * minDist;
+        m_nodes.clear();
+
+        std::deque<VRL> vrls;
+        if (!media.empty()) {
+            Float normalization = (Float) 1 / generateVRLs(scene, 0,
+                m_vrlCount, m_maxDepth, vrls);
+            for (size_t i=0; i<vrls.size(); ++i)
+                vrls[i].P *= normalization;
+        }
+        Log(EInfo, "Generated %i virtual ray lights", vrls.size());
+
+        buildTree(vrls);
+        return true;
+    }
+
+    /* ===================================================================== */
+    /*                          Light tree construction                      */
+    /* ===================================================================== */
+
+    /// Estimated power scattered out of a VRL
+    static Float getIntensity(const VRL &vrl) {
+        const Spectrum &sigmaS = vrl.medium->getSigmaS(),
+                       &sigmaT = vrl.medium->getSigmaT();
+        Float lum = vrl.P.getLuminance(), result = 0;
+        if (lum <= 0)
+            return 0;
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i) {
+            if (sigmaT[i] > 0)
+                result += sigmaS[i] / sigmaT[i] * (1 - math::fastexp(-sigmaT[i] * vrl.length));
+        }
+        return lum * result / SPECTRUM_SAMPLES;
+    }
+
+    void buildTree(const std::deque<VRL> &vrls) {
+        std::vector<uint32_t> indices;
+        std::vector<Float> intensity(vrls.size());
+        for (size_t i=0; i<vrls.size(); ++i) {
+            intensity[i] = getIntensity(vrls[i]);
+            if (intensity[i] > 0)
+                indices.push_back((uint32_t) i);
+        }
+
+        if (indices.empty())
+            return;
+
+        ref<Random> random = new Random();
+        m_nodes.reserve(2*indices.size());
+        buildTree(vrls, intensity, indices, 0, (uint32_t) indices.size(), random);
+        Log(EInfo, "Built a light tree with " SIZE_T_FMT " nodes", m_nodes.size());
+    }
+
+    uint32_t buildTree(const std::deque<VRL> &vrls, const std::vector<Float> &intensity,
+            std::vector<uint32_t> &indices, uint32_t start, uint32_t end, Random *random) {
+        uint32_t nodeIndex = (uint32_t) m_nodes.size();
+
+        if (end - start == 1) {
+            const VRL &vrl = vrls[indices[start]];
+            m_nodes.push_back(VRLNode(vrl));
+            VRLNode &node = m_nodes[nodeIndex];
+            node.aabb.expandBy(vrl.o);
+            node.aabb.expandBy(vrl.o + vrl.d * vrl.length);
+            node.intensity = intensity[indices[start]];
+            return nodeIndex;
+        }
+
+        /* Split at the median segment midpoint along the longest axis */
+        AABB centers;
+        for (uint32_t i=start; i<end; ++i) {
+            const VRL &vrl = vrls[indices[i]];
+            centers.expandBy(vrl.o + vrl.d * (vrl.length * 0.5f));
+        }
+        int axis = centers.getLargestAxis();
+        uint32_t mid = start + (end - start) / 2;
+        std::nth_element(indices.begin() + start, indices.begin() + mid,
+            indices.begin() + end, MidpointOrder(vrls, axis));
+
+        m_nodes.push_back(VRLNode(vrls[indices[start]]));
+        uint32_t left = buildTree(vrls, intensity, indices, start, mid, random);
+        uint32_t right = buildTree(vrls, intensity, indices, mid, end, random);
+
+        const VRLNode &leftNode = m_nodes[left], &rightNode = m_nodes[right];
+        VRLNode &node = m_nodes[nodeIndex];
+        node.left = left;
+        node.right = right;
+        node.aabb = leftNode.aabb;
+        node.aabb.expandBy(rightNode.aabb);
+        node.intensity = leftNode.intensity + rightNode.intensity;
+
+        /* Choose a representative proportional to intensity and rescale its
+           power so that the expected contribution remains unchanged */
+        const VRLNode &rep = random->nextFloat() * node.intensity < leftNode.intensity
+            ? leftNode : rightNode;
+        node.vrl = rep.vrl;
+        node.vrl.P *= node.intensity / rep.intensity;
+
+        return nodeIndex;
+    }
+
+    /// Orders VRL indices by the position of the segment midpoints
+    struct MidpointOrder {
+        const std::deque<VRL> &vrls;
+        int axis;
+
+        MidpointOrder(const std::deque<VRL> &vrls, int axis) : vrls(vrls), axis(axis) { }
+
+        inline bool operator()(uint32_t a, uint32_t b) const {
+            const VRL &va = vrls[a], &vb = vrls[b];
+            return va.o[axis] + va.d[axis] * (va.length * 0.5f)
+                 < vb.o[axis] + vb.d[axis] * (vb.length * 0.5f);
+        }
+    };
+
+    /* ===================================================================== */
+    /*                            Cut selection                              */
+    /* ===================================================================== */
+
+    /**
+     * \brief Collect points along a camera ray that receive light from VRLs
+     *
+     * Follows the ray through index-matched medium boundaries, sampling
+     * points along segments within media and adding the first visible surface.
+     */
+    void collectReceivers(const Scene *scene, Ray ray, const Medium *medium,
+            std::vector<Point> &receivers) const {
+        Intersection its;
+        for (int i=0; i<EMaxTransitions; ++i) {
+            bool hit = scene->rayIntersect(ray, its);
+            Float length = its.t;
+            if (!hit && !clipToScene(scene, ray, length))
+                return;
+
+            if (medium) {
+                for (int j=0; j<EReceiverSamples; ++j)
+                    receivers.push_back(ray(length * (j + 0.5f) / EReceiverSamples));
+            }
+
+            if (!hit)
+                return;
+
+            const BSDF *bsdf = its.getBSDF();
+            if (!isIndexMatched(its, bsdf)) {
+                receivers.push_back(its.p);
+                return;
+            }
+            medium = its.getTargetMedium(ray.d);
+            ray = Ray(its.p, ray.d, ray.time);
+        }
+    }
+
+    /// Heuristic error bound of a light tree node for a set of receivers
+    inline Float getError(const VRLNode &node, const std::vector<Point> &receivers) const {
+        Float distSqr = std::numeric_limits<Float>::infinity();
+        for (size_t i=0; i<receivers.size(); ++i)
+            distSqr = std::min(distSqr, node.aabb.squaredDistanceTo(receivers[i]));
+        return node.intensity / std::max(distSqr, m_minDistSqr);
+    }
+
+    /// Select a cut through the light tree for the given receivers
+    void selectCut(const std::vector<Point> &receivers, Cut &cut) const {
+        cut.clear();
+        if (m_nodes.empty() || receivers.empty())
+            return;
+
+        std::priority_queue<CutEntry> queue;
+        Float totalError = getError(m_nodes[0], receivers);
+        queue.push(CutEntry(0, totalError));
+
+        while (!queue.empty() && queue.size() + cut.size() < m_maxCutSize) {
+            CutEntry entry = queue.top();
+            if (entry.error <= m_errorThreshold * totalError)
+                break;
+            queue.pop();
+
+            const VRLNode &node = m_nodes[entry.node];
+            if (node.isLeaf()) {
+                cut.push_back(entry.node);
+                continue;
+            }
+
+            Float leftError = getError(m_nodes[node.left], receivers),
+                  rightError = getError(m_nodes[node.right], receivers);
+            totalError += leftError + rightError - entry.error;
+            queue.push(CutEntry(node.left, leftError));
+            queue.push(CutEntry(node.right, rightError));
+        }
+
+        while (!queue.empty()) {
+            cut.push_back(queue.top().node);
+            queue.pop();
+        }
+    }
+
+    /// Compute the cut shared by the pixels of a slice
+    void selectSliceCut(const Scene *scene, const Sensor *sensor,
+            const Point2i &start, const Point2i &end, Cut &cut) const {
+        std::vector<Point> receivers;
+        Point2 pixels[5] = {
+            Point2(start.x, start.y) + Vector2(0.5f),
+            Point2(end.x, start.y) + Vector2(-0.5f, 0.5f),
+            Point2(start.x, end.y) + Vector2(0.5f, -0.5f),
+            Point2(end.x, end.y) - Vector2(0.5f),
+            Point2(start.x + end.x, start.y + end.y) * 0.5f
+        };
+        Float time = sensor->getShutterOpen() + 0.5f * sensor->getShutterOpenTime();
+
+        for (int i=0; i<5; ++i) {
+            Ray ray;
+            if (sensor->sampleRay(ray, pixels[i], Point2(0.5f), time).isZero())
+                continue;
+            collectReceivers(scene, ray, sensor->getMedium(), receivers);
+        }
+        selectCut(receivers, cut);
+    }
+
+    void renderBlock(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points) const {
+        Float diffScaleFactor = 1.0f /
+            std::sqrt((Float) sampler->getSampleCount());
+
+        bool needsApertureSample = sensor->needsApertureSample();
+        bool needsTimeSample = sensor->needsTimeSample();
+
+        RadianceQueryRecord rRec(scene, sampler);
+        Point2 apertureSample(0.5f);
+        Float timeSample = 0.5f;
+        RayDifferential sensorRay;
+
+        block->clear();
+
+        uint32_t queryType = RadianceQueryRecord::ESensorRay;
+
+        if (!sensor->getFilm()->hasAlpha()) /* Don't compute an alpha channel if we don't have to */
+            queryType &= ~RadianceQueryRecord::EOpacity;
+
+        /* Cuts are computed lazily for every slice of the block */
+        Vector2i blockSize = block->getSize();
+        Point2i blockOffset = block->getOffset();
+        int slicesX = (blockSize.x + m_sliceSize - 1) / m_sliceSize,
+            slicesY = (blockSize.y + m_sliceSize - 1) / m_sliceSize;
+        std::vector<Cut> cuts(slicesX * slicesY);
+        std::vector<bool> cutValid(cuts.size(), false);
+
+        for (size_t i = 0; i<points.size(); ++i) {
+            Point2i offset = Point2i(points[i]) + Vector2i(blockOffset);
+            if (stop)
+                break;
+
+            int sx = points[i].x / m_sliceSize, sy = points[i].y / m_sliceSize;
+            size_t sliceIndex = sx + sy * slicesX;
+            if (!cutValid[sliceIndex]) {
+                Point2i start = blockOffset + Vector2i(sx, sy) * m_sliceSize;
+                Point2i end(
+                    std::min(start.x + m_sliceSize, blockOffset.x + blockSize.x),
+                    std::min(start.y + m_sliceSize, blockOffset.y + blockSize.y));
+                selectSliceCut(scene, sensor, start, end, cuts[sliceIndex]);
+                cutValid[sliceIndex] = true;
+            }
+            const Cut &cut = cuts[sliceIndex];
+
+            sampler->generate(offset);
+
+            for (size_t j = 0; j<sampler->getSampleCount(); j++) {
+                rRec.newQuery(queryType, sensor->getMedium());
+                Vector2 pixelOffset;
+                if (sampler->getSampleCount() == 1) {
+                    pixelOffset = Vector2(0.5f);
+                } else {
+                    pixelOffset = Vector2(rRec.nextSample2D());
+                }
+                Point2 samplePos = Point2(offset) + pixelOffset;
+
+                if (needsApertureSample)
+                    apertureSample = rRec.nextSample2D();
+                if (needsTimeSample)
+                    timeSample = rRec.nextSample1D();
+
+                Spectrum spec = sensor->sampleRayDifferential(
+                    sensorRay, samplePos, apertureSample, timeSample);
+
+                sensorRay.scaleDifferential(diffScaleFactor);
+
+                spec *= Li(sensorRay, rRec, cut);
+                block->put(samplePos, spec, rRec.alpha);
+                sampler->advance();
+            }
+        }
+    }
+
+    /* ===================================================================== */
+    /*                             Evaluation                                */
+    /* ===================================================================== */
+
+    Spectrum Li(const RayDifferential &ray, RadianceQueryRecord &rRec) const {
+        /* Not called through renderBlock() -- select a cut for this ray */
+        std::vector<Point> receivers;
+        collectReceivers(rRec.scene, ray, rRec.medium, receivers);
+        Cut cut;
+        selectCut(receivers, cut);
+        return Li(ray, rRec, cut);
+    }
+
+    Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec, const Cut &cut) const {
+        const Scene *scene = rRec.scene;
+        Intersection &its = rRec.its;
+        RayDifferential ray(r);
+        Spectrum Li(0.0f), throughput(1.0f);
+        const Medium *medium = rRec.medium;
+
+        avgCutSize.incrementBase();
+        avgCutSize += cut.size();
+
+        /* Perform the first ray intersection (or ignore if the
+           intersection has already been provided). */
+        rRec.rayIntersect(ray);
+
+        for (int i=0; i<EMaxTransitions; ++i) {
+            if (i > 0)
+                scene->rayIntersect(ray, its);
+
+            if (medium) {
+                Float length = its.t;
+                if (its.isValid() || clipToScene(scene, ray, length)) {
+                    Ray segment(ray, 0, length);
+                    if (rRec.type & RadianceQueryRecord::EVolumeRadiance)
+                        Li += throughput * evalMedium(scene, segment, medium, cut, rRec);
+                    throughput *= medium->evalTransmittance(segment, rRec.sampler);
+                }
+            }
+
+            if (!its.isValid()) {
+                /* If no intersection could be found, possibly return
+                   attenuated radiance from a background luminaire */
+                if ((rRec.type & RadianceQueryRecord::EEmittedRadiance) && !m_hideEmitters)
+                    Li += throughput * scene->evalEnvironment(ray);
+                break;
+            }
+
+            /* Possibly include emitted radiance if requested */
+            if (its.isEmitter() && (rRec.type & RadianceQueryRecord::EEmittedRadiance) && !m_hideEmitters)
+                Li += throughput * its.Le(-ray.d);
+
+            const BSDF *bsdf = its.getBSDF(ray);
+            if (isIndexMatched(its, bsdf)) {
+                /* Pass through index-matched medium boundaries */
+                medium = its.getTargetMedium(ray.d);
+                ray = RayDifferential(its.p, ray.d, ray.time);
+                continue;
+            }
+
+            Li += throughput * evalSurface(scene, its, bsdf, medium, cut, rRec);
+            break;
+        }
+
+        return Li;
+    }
+
+    /// Light scattered towards the sensor along a segment within a medium
+    Spectrum evalMedium(const Scene *scene, const Ray &ray, const Medium *medium,
+            const Cut &cut, RadianceQueryRecord &rRec) const {
+        const Spectrum &sigmaS = medium->getSigmaS(), &sigmaT = medium->getSigmaT();
+        const PhaseFunction *phase = medium->getPhaseFunction();
+        if (sigmaS.isZero())
+            return Spectrum(0.0f);
+
+        Sampler *sampler = rRec.sampler;
+        Spectrum result(0.0f);
+        MediumSamplingRecord mRec;
+        mRec.time = ray.time;
+        mRec.medium = medium;
+
+        /* Single scattering via emitter sampling */
+        if (rRec.type & RadianceQueryRecord::EDirectMediumRadiance) {
+            Float u, pdfU;
+            sampleSegment(sigmaT.average(), ray.maxt, sampler->next1D(), u, pdfU);
+            mRec.p = ray(u);
+            DirectSamplingRecord dRec(mRec.p, ray.time);
+            int interactions = m_maxDepth == -1 ? -1 : std::max(0, m_maxDepth - 2);
+            Spectrum value = scene->sampleAttenuatedEmitterDirect(
+                dRec, medium, interactions, sampler->next2D(), sampler);
+            if (!value.isZero()) {
+                Float phaseVal = phase->eval(
+                    PhaseFunctionSamplingRecord(mRec, -ray.d, dRec.d));
+                result += value * sigmaS * (-sigmaT * u).exp() * (phaseVal / pdfU);
+            }
+        }
+
+        if (!(rRec.type & RadianceQueryRecord::EIndirectMediumRadiance))
+            return result;
+
+        /* Multiple scattering from the VRLs of the cut */
+        for (size_t i=0; i<cut.size(); ++i) {
+            const VRL &vrl = m_nodes[cut[i]].vrl;
+
+            Float u, pdfU, v, pdfV;
+            sampleSegment(sigmaT.average(), ray.maxt, sampler->next1D(), u, pdfU);
+            Point x = ray(u);
+            if (!sampleEquiangular(vrl, x, sampler->next1D(), v, pdfV))
+                continue;
+            Point y = vrl.o + vrl.d * v;
+
+            Vector d = y - x;
+            Float distSqr = d.lengthSquared();
+            if (distSqr == 0)
+                continue;
+            d /= std::sqrt(distSqr);
+
+            int interactions = -1;
+            Spectrum transmittance = scene->evalTransmittance(x, false,
+                y, false, ray.time, medium, interactions, sampler);
+            if (transmittance.isZero())
+                continue;
+
+            mRec.p = x;
+            Float phaseCam = phase->eval(PhaseFunctionSamplingRecord(mRec, d, -ray.d));
+            Spectrum camTerm = sigmaS * (-sigmaT * u).exp() * phaseCam;
+
+            result += camTerm * evalVRL(vrl, v, d) * transmittance
+                / (std::max(distSqr, m_minDistSqr) * pdfU * pdfV);
+        }
+
+        return result;
+    }
+
+    /// Light reflected towards the sensor by the first visible surface
+    Spectrum evalSurface(const Scene *scene, const Intersection &its, const BSDF *bsdf,
+            const Medium *medium, const Cut &cut, RadianceQueryRecord &rRec) const {
+        Spectrum result(0.0f);
+        if (!(bsdf->getType() & BSDF::ESmooth))
+            return result;
+
+        /* Direct illumination via emitter sampling */
+        if (rRec.type & RadianceQueryRecord::EDirectSurfaceRadiance) {
+            DirectSamplingRecord dRec(its);
+            int interactions = m_maxDepth == -1 ? -1 : std::max(0, m_maxDepth - 2);
+            Spectrum value = scene->sampleAttenuatedEmitterDirect(
+                dRec, its, medium, interactions, rRec.nextSample2D(), rRec.sampler);
+            if (!value.isZero()) {
+                BSDFSamplingRecord bRec(its, its.toLocal(dRec.d));
+                result += value * bsdf->eval(bRec);
+            }
+        }
+
+        if (!(rRec.type & RadianceQueryRecord::EIndirectSurfaceRadiance))
+            return result;
+
+        /* Light scattered onto the surface by the VRLs of the cut */
+        Sampler *sampler = rRec.sampler;
+        for (size_t i=0; i<cut.size(); ++i) {
+            const VRL &vrl = m_nodes[cut[i]].vrl;
+
+            Float v, pdfV;
+            if (!sampleEquiangular(vrl, its.p, sampler->next1D(), v, pdfV))
+                continue;
+            Point y = vrl.o + vrl.d * v;
+
+            Vector d = y - its.p;
+            Float distSqr = d.lengthSquared();
+            if (distSqr == 0)
+                continue;
+            d /= std::sqrt(distSqr);
+
+            BSDFSamplingRecord bRec(its, its.toLocal(d));
+            Spectrum bsdfVal = bsdf->eval(bRec);
+            if (bsdfVal.isZero())
+                continue;
+
+            int interactions = -1;
+            const Medium *target = its.isMediumTransition() ? its.getTargetMedium(d) : medium;
+            Spectrum transmittance = scene->evalTransmittance(its.p, true,
+                y, false, its.time, target, interactions, sampler);
+            if (transmittance.isZero())
+                continue;
+
+            result += bsdfVal * evalVRL(vrl, v, d) * transmittance
+                / (std::max(distSqr, m_minDistSqr) * pdfV);
+        }
+
+        return result;
+    }
+
+    /**
+     * \brief Radiance leaving a VRL at distance \c v from its start,
+     * travelling in direction \c -d (i.e. \c d points towards the VRL)
+     */
+    inline Spectrum evalVRL(const VRL &vrl, Float v, const Vector &d) const {
+        MediumSamplingRecord mRec;
+        mRec.time = vrl.time;
+        mRec.medium = vrl.medium;
+        mRec.p = vrl.o + vrl.d * v;
+        Float phaseVal = vrl.medium->getPhaseFunction()->eval(
+            PhaseFunctionSamplingRecord(mRec, -vrl.d, -d));
+        return vrl.P * vrl.medium->getSigmaS()
+            * (-vrl.medium->getSigmaT() * v).exp() * phaseVal;
+    }
+
+    /// Sample a distance on [0, length] proportional to the transmittance
+    static inline void sampleSegment(Float sigmaT, Float length, Float sample,
+            Float &t, Float &pdf) {
+        if (sigmaT * length < 1e-4f) {
+            t = sample * length;
+            pdf = 1.0f / length;
+        } else {
+            Float norm = 1 - math::fastexp(-sigmaT * length);
+            t = std::min(length, -math::fastlog(1 - sample * norm) / sigmaT);
+            pdf = sigmaT * math::fastexp(-sigmaT * t) / norm;
+        }
+    }
+
+    /**
+     * \brief Equiangular sampling of a point on a VRL with respect to \c x
+     *
+     * Cancels the inverse squared distance along the VRL. The distance
+     * to the line is clamped to avoid degenerate densities.
+     */
+    inline bool sampleEquiangular(const VRL &vrl, const Point &x, Float sample,
+            Float &v, Float &pdf) const {
+        Float t0 = dot(x - vrl.o, vrl.d);
+        Float hSqr = std::max((x - (vrl.o + vrl.d * t0)).lengthSquared(), m_minDistSqr);
+        Float h = std::sqrt(hSqr);
+        if (h == 0)
+            return false;
+
+        Float thetaA = std::atan2(-t0, h),
+              thetaB = std::atan2(vrl.length - t0, h),
+              range = thetaB - thetaA;
+        if (range <= 0)
+            return false;
+
+        v = t0 + h * std::tan(thetaA + sample * range);
+        v = math::clamp(v, (Float) 0, vrl.length);
+        Float offset = v - t0;
+        pdf = h / (range * (hSqr + offset * offset));
+        return true;
+    }
+
+    /// Is the surface an index-matched boundary that rays simply pass through?
+    static inline bool isIndexMatched(const Intersection &its, const BSDF *bsdf) {
+        return its.isMediumTransition() && bsdf &&
+            (bsdf->getType() & BSDF::EAll) == BSDF::ENull;
+    }
+
+    /// Clip a ray that leaves the scene against its bounding box
+    static inline bool clipToScene(const Scene *scene, const Ray &ray, Float &length) {
+        Float nearT, farT;
+        if (!scene->getKDTree()->getAABB().rayIntersect(ray, nearT, farT) || farT <= 0)
+            return false;
+        length = farT;
+        return true;
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "VRLIntegrator[" << endl
+            << "  maxDepth = " << m_maxDepth << "," << endl
+            << "  vrlCount = " << m_vrlCount << "," << endl
+            << "  maxCutSize = " << m_maxCutSize << "," << endl
+            << "  errorThreshold = " << m_errorThreshold << "," << endl
+            << "  sliceSize = " << m_sliceSize << "," << endl
+            << "  clamping = " << m_clamping << "," << endl
+            << "  hideEmitters = " << m_hideEmitters << endl
+            << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    std::vector<VRLNode> m_nodes;
+    size_t m_vrlCount, m_maxCutSize;
+    Float m_errorThreshold, m_clamping, m_minDistSqr;
+    int m_maxDepth, m_sliceSize;
+    bool m_hideEmitters;
+};
+
+MTS_IMPLEMENT_CLASS_S(VRLIntegrator, false, SamplingIntegrator)
+MTS_EXPORT_PLUGIN(VRLIntegrator, "Virtual ray light integrator");
+MTS_NAMESPACE_END
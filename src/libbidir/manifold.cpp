@@ -49,9 +49,14 @@ static StatsCounter statsUpdateFailed(
         "Specular manifold", "Update failed");
 static StatsCounter statsMaxManifold(
         "Specular manifold", "Max. manifold size", EMaximumValue);
+static StatsCounter statsCachedInit(
+        "Specular manifold", "Cached initializations", EPercentage);
+static StatsCounter statsReusedFactorization(
+        "Specular manifold", "Reused factorizations", EPercentage);
 
 SpecularManifold::SpecularManifold(const Scene *scene, int maxIterations)
-  : m_scene(scene) {
+  : m_scene(scene), m_factorized(false), m_pristine(false),
+    m_cacheFactorized(false) {
     m_maxIterations = maxIterations > 0 ? maxIterations :
         MTS_MANIFOLD_MAX_ITERATIONS;
 }
@@ -67,6 +72,28 @@ bool SpecularManifold::init(const Path &path, int start, int end) {
         *vs = path.vertex(start),
         *ve = path.vertex(end);
 
+    m_time = vs->getTime();
+
+    /* Reuse the vertices of the previous call if it was made for
+       the same configuration (e.g. the current state of a Markov
+       chain after a rejected mutation) */
+    m_key.clear();
+    for (int i=start; i != end + step; i += step) {
+        const PathVertex *vertex = path.vertex(i);
+        m_key.push_back(std::make_pair(vertex->getPosition(),
+            (uint32_t) vertex->getType()));
+    }
+
+    statsCachedInit.incrementBase();
+    if (m_key == m_cacheKey) {
+        ++statsCachedInit;
+        m_vertices = m_cache;
+        m_Li = m_cacheLi;
+        m_factorized = m_cacheFactorized;
+        m_pristine = true;
+        return true;
+    }
+
     /* Create the initial vertex that is pinned in position by default */
     SimpleVertex v(EPinnedPosition, vs->getPosition());
 
@@ -84,7 +111,6 @@ bool SpecularManifold::init(const Path &path, int start, int end) {
         }
     }
 
-    m_time = vs->getTime();
     m_vertices.clear();
     m_vertices.push_back(v);
 
@@ -161,6 +187,11 @@ bool SpecularManifold::init(const Path &path, int start, int end) {
     v = SimpleVertex(EMovable, ve->getPosition());
     m_vertices.push_back(v);
 
+    m_cache = m_vertices;
+    m_cacheKey.swap(m_key);
+    m_cacheFactorized = m_factorized = false;
+    m_pristine = true;
+
     #if MTS_MANIFOLD_DEBUG == 1
         cout << "==========================================" << endl;
         cout << "Initialized specular manifold: " << toString() << endl;
@@ -178,6 +209,18 @@ bool SpecularManifold::computeTangents() {
     if (m_vertices.size() == 2) /* Nothing to do */
         return true;
 
+    statsReusedFactorization.incrementBase();
+    if (m_factorized) {
+        /* Only the frame of the movable endpoint may have changed, which
+           solely enters the last block of the right hand side */
+        ++statsReusedFactorization;
+        m_vertices[n-1].assembleC(m_vertices[n]);
+        m_vertices[n-1].Tp = -m_Li * m_vertices[n-1].c;
+        for (int i=n-2; i>=0; --i)
+            m_vertices[i].Tp = -m_vertices[i].u * m_vertices[i+1].Tp;
+        return true;
+    }
+
     /* Matrix assembly stage */
     for (int i=0; i<n; ++i) {
         SimpleVertex *v = &m_vertices[i];
@@ -193,11 +236,9 @@ bool SpecularManifold::computeTangents() {
             v[0].a.setZero();
             v[0].b.setIdentity();
             v[0].c.setZero();
+            v[0].cw[0] = v[0].cw[1] = Vector(0.0f);
             continue;
         } else if (v[0].type == EPinnedDirection) {
-
-            Vector dC_dnext_u = (v[1].dpdu - wo * dot(wo, v[1].dpdu)) * ilo;
-            Vector dC_dnext_v = (v[1].dpdv - wo * dot(wo, v[1].dpdv)) * ilo;
             Vector dC_dcur_u = (wo * dot(wo, v[0].dpdu) - v[0].dpdu) * ilo;
             Vector dC_dcur_v = (wo * dot(wo, v[0].dpdv) - v[0].dpdv) * ilo;
 
@@ -206,10 +247,11 @@ bool SpecularManifold::computeTangents() {
                 Vector2(dot(dC_dcur_u, v[0].dpdu), dot(dC_dcur_u, v[0].dpdv)),
                 Vector2(dot(dC_dcur_v, v[0].dpdu), dot(dC_dcur_v, v[0].dpdv))
             );
-            v[0].c = Matrix2x2(
-                Vector2(dot(dC_dnext_u, v[0].dpdu), dot(dC_dnext_u, v[0].dpdv)),
-                Vector2(dot(dC_dnext_v, v[0].dpdu), dot(dC_dnext_v, v[0].dpdv))
-            );
+
+            /* Derivatives with respect to x_{i+1} (projection is symmetric) */
+            v[0].cw[0] = (v[0].dpdu - wo * dot(wo, v[0].dpdu)) * ilo;
+            v[0].cw[1] = (v[0].dpdv - wo * dot(wo, v[0].dpdv)) * ilo;
+            v[0].assembleC(v[1]);
             continue;
         }
 
@@ -291,18 +333,16 @@ bool SpecularManifold::computeTangents() {
                 dot(dH_du, t) - dot(v[0].dpdv, v[0].dndu) * dot_H_n - dot_v_n * dot_H_dndu,
                 dot(dH_dv, t) - dot(v[0].dpdv, v[0].dndv) * dot_H_n - dot_v_n * dot_H_dndv);
 
-            /* Derivatives of C with respect to x_{i+1} */
-            dH_du = (v[1].dpdu - wo * dot(wo, v[1].dpdu)) * ilo;
-            dH_dv = (v[1].dpdv - wo * dot(wo, v[1].dpdv)) * ilo;
-
+            /* Derivatives of C with respect to x_{i+1}. Both projections
+               are symmetric, hence they can be applied to 's' and 't' */
+            Vector ps = s, pt = t;
             if (normalizeH) {
-                dH_du -= H * dot(dH_du, H);
-                dH_dv -= H * dot(dH_dv, H);
+                ps -= H * dot(ps, H);
+                pt -= H * dot(pt, H);
             }
-
-            v[0].c = Matrix2x2(
-                dot(dH_du, s), dot(dH_dv, s),
-                dot(dH_du, t), dot(dH_dv, t));
+            v[0].cw[0] = (ps - wo * dot(wo, ps)) * ilo;
+            v[0].cw[1] = (pt - wo * dot(wo, pt)) * ilo;
+            v[0].assembleC(v[1]);
 
             /* Store the microfacet normal wrt. the local (orthonormal) shading frame */
             s = normalize(s);
@@ -352,8 +392,6 @@ bool SpecularManifold::computeTangents() {
             Vector2
                 t_cur_dpdu (dot(v[ 0].dpdu, s), dot(v[ 0].dpdu, t)),
                 t_cur_dpdv (dot(v[ 0].dpdv, s), dot(v[ 0].dpdv, t)),
-                t_next_dpdu(dot(v[ 1].dpdu, s), dot(v[ 1].dpdu, t)),
-                t_next_dpdv(dot(v[ 1].dpdv, s), dot(v[ 1].dpdv, t)),
                 t_wo = Vector2(dot(wo, s), dot(wo, t));
 
             v[0].a = Matrix2x2(
@@ -367,9 +405,9 @@ bool SpecularManifold::computeTangents() {
                 (t_wo * dot(wo, v[0].dpdv) - t_cur_dpdv) * ilo +
                 Vector2(dot(ds_dcur_v, wo), dot(dt_dcur_v, wo)));
 
-            v[0].c = Matrix2x2(
-                (t_next_dpdu - t_wo * dot(wo, v[1].dpdu)) * ilo,
-                (t_next_dpdv - t_wo * dot(wo, v[1].dpdv)) * ilo);
+            v[0].cw[0] = (s - wo * t_wo.x) * ilo;
+            v[0].cw[1] = (t - wo * t_wo.y) * ilo;
+            v[0].assembleC(v[1]);
 
             v[0].m = Vector(dot(s, wo), dot(t, wo), dot(wi, wo));
         } else {
@@ -381,7 +419,7 @@ bool SpecularManifold::computeTangents() {
        vertex. For this, we must solve a tridiagonal system. The following is
        simplified version of the block tridiagonal LU factorization algorithm
        for this specific problem */
-    Matrix2x2 Li;
+    Matrix2x2 &Li = m_Li;
     if (!m_vertices[0].b.invert(Li))
         return false;
 
@@ -396,6 +434,14 @@ bool SpecularManifold::computeTangents() {
 
     for (int i=n-2; i>=0; --i)
         m_vertices[i].Tp = -m_vertices[i].u * m_vertices[i+1].Tp;
+
+    m_factorized = true;
+    if (m_pristine) {
+        /* Remember the factorization of the freshly initialized vertices */
+        m_cache = m_vertices;
+        m_cacheLi = m_Li;
+        m_cacheFactorized = true;
+    }
     return true;
 }
 
@@ -406,9 +452,9 @@ bool SpecularManifold::project(const Vector &d) {
     Ray ray(Point(0.0f), Vector(1.0f), 0); // make gcc happy
     Intersection its;
 
-    m_proposal.clear();
+    /* Overwrite the proposal in place (reuses its storage) */
+    m_proposal = m_vertices;
     for (size_t i=0; i<m_vertices.size(); ++i) {
-        m_proposal.push_back(m_vertices[i]);
         SimpleVertex &vertex = m_proposal[i];
 
         if (i == 0) {
@@ -619,6 +665,7 @@ bool SpecularManifold::move(const Point &target, const Normal &n) {
         ++statsStepSuccess;
 
         m_proposal.swap(m_vertices);
+        invalidate();
 
         /* Increase the step size */
         stepSize = std::min((Float) 1.0f, stepSize * 2.0f);
@@ -777,6 +824,10 @@ Float SpecularManifold::det(const Path &path, int a, int b, int c) {
     bool success = init(path, a, c);
     BDAssert(success);
 
+    /* A vertex in the middle becomes the movable one -- the
+       cached factorization does not apply */
+    invalidate();
+
     int b_idx = std::abs(b-a);
     SimpleVertex &vb = m_vertices[b_idx];
     const PathVertex *pb = path.vertex(b);
@@ -793,6 +844,7 @@ Float SpecularManifold::det(const Path &path, int a, int b, int c) {
         return 0.0f;
     }
 
+    invalidate();
     m_vertices[b_idx].a.setZero();
     m_vertices[b_idx].b.setIdentity();
     m_vertices[b_idx].c.setZero();
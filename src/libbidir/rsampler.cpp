@@ -77,6 +77,12 @@ void ReplayableSampler::setSampleIndex(size_t sampleIndex) {
     }
 }
 
+void ReplayableSampler::setSeed(uint64_t seed) {
+    m_initial->seed(seed);
+    m_random->set(m_initial);
+    m_sampleIndex = 0;
+}
+
 Float ReplayableSampler::next1D() {
     ++m_sampleIndex;
     return m_random->nextFloat();
@@ -1532,6 +1532,29 @@ Spectrum Bitmap::getPixel(const Point2i &pos) const {
     return result;
 }
 
+/// Convert chunks of pixels in parallel (the converters are stateless)
+static void convertChunks(const FormatConverter *cvt, const Bitmap *source,
+        Bitmap *target, Float multiplier, Spectrum::EConversionIntent intent) {
+    const size_t chunkSize = 16384;
+    size_t count = source->getPixelCount(),
+           sourceStride = source->getBytesPerPixel(),
+           targetStride = target->getBytesPerPixel();
+    ssize_t chunks = (ssize_t) ((count + chunkSize - 1) / chunkSize);
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for if (chunks > 1)
+    #endif
+    for (ssize_t i=0; i<chunks; ++i) {
+        size_t start = (size_t) i * chunkSize,
+               size = std::min(chunkSize, count - start);
+        cvt->convert(source->getPixelFormat(), source->getGamma(),
+            source->getUInt8Data() + start * sourceStride,
+            target->getPixelFormat(), target->getGamma(),
+            target->getUInt8Data() + start * targetStride,
+            size, multiplier, intent, source->getChannelCount());
+    }
+}
+
 void Bitmap::convert(Bitmap *target, Float multiplier, Spectrum::EConversionIntent intent) const {
     if (m_componentFormat == EBitmask || target->getComponentFormat() == EBitmask)
         Log(EError, "Conversions involving bitmasks are currently not supported!");
@@ -1552,10 +1575,7 @@ void Bitmap::convert(Bitmap *target, Float multiplier, Spectrum::EConversionInte
 
     Assert(cvt != NULL);
 
-    cvt->convert(m_pixelFormat, m_gamma, m_data,
-        target->getPixelFormat(), target->getGamma(), target->getData(),
-        (size_t) m_size.x * (size_t) m_size.y, multiplier, intent,
-        m_channelCount);
+    convertChunks(cvt, this, target, multiplier, intent);
 }
 
 ref<Bitmap> Bitmap::convert(EPixelFormat pixelFormat,
@@ -1584,10 +1604,7 @@ ref<Bitmap> Bitmap::convert(EPixelFormat pixelFormat,
         target->setChannelNames(m_channelNames);
     target->setGamma(gamma);
 
-    cvt->convert(m_pixelFormat, m_gamma, m_data,
-        pixelFormat, gamma, target->getData(),
-        (size_t) m_size.x * (size_t) m_size.y, multiplier, intent,
-        m_channelCount);
+    convertChunks(cvt, this, target, multiplier, intent);
 
     return target;
 }
@@ -1609,9 +1626,23 @@ void Bitmap::convertMultiSpectrumAlphaWeight(const Bitmap *source,
         const uint8_t *sourcePtr, const Bitmap *target, uint8_t *targetPtr,
         const std::vector<EPixelFormat> &pixelFormats,
         EComponentFormat componentFormat, size_t count) {
-    if (source->getComponentFormat() != EFloat && source->getPixelFormat() != EMultiSpectrumAlphaWeight)
+    if (source->getPixelFormat() != EMultiSpectrumAlphaWeight)
         Log(EError, "convertMultiSpectrumAlphaWeight(): unsupported!");
 
+    /* Reduced precision sources (see ImageBlock::setStorage()) are
+       expanded to Float first */
+    Float *expanded = NULL;
+    if (source->getComponentFormat() != EFloat) {
+        const FormatConverter *cvt = FormatConverter::getInstance(
+            std::make_pair(source->getComponentFormat(), EFloat));
+        if (!cvt)
+            Log(EError, "convertMultiSpectrumAlphaWeight(): unsupported!");
+        expanded = new Float[count * source->getChannelCount()];
+        cvt->convert(EMultiChannel, 1.0f, sourcePtr, EMultiChannel, 1.0f,
+            expanded, count, 1.0f, Spectrum::EReflectance, source->getChannelCount());
+        sourcePtr = (const uint8_t *) expanded;
+    }
+
     Float *temp = new Float[count * target->getChannelCount()], *dst = temp;
 
     for (size_t k = 0; k<count; ++k) {
@@ -1680,6 +1711,8 @@ void Bitmap::convertMultiSpectrumAlphaWeight(const Bitmap *source,
             count, 1.0f, Spectrum::EReflectance, target->getChannelCount());
 
     delete[] temp;
+    if (expanded)
+        delete[] expanded;
 }
 
 void Bitmap::convert(void *target, EPixelFormat pixelFormat,
@@ -2303,26 +2336,34 @@ template <typename Scalar> static void resample(ref<const ReconstructionFilter>
         /* Re-sample along the Y direction */
         Resampler<Scalar> r(rfilter, bcv, source->getHeight(), target->getHeight());
 
+        /* Filter strips of adjacent columns together so that each tap reads
+           contiguous memory instead of walking down a single column */
+        int strip = 16;
+        while (source->getWidth() % strip != 0)
+            strip /= 2;
+        int strips = source->getWidth() / strip,
+            stripChannels = strip * channels;
+
         if (clamp) {
             #if defined(MTS_OPENMP)
                 #pragma omp parallel for
             #endif
-            for (int x=0; x<source->getWidth(); ++x) {
-                const Scalar *srcPtr = (Scalar *) source->getUInt8Data() + x * channels;
-                Scalar *trgPtr = (Scalar *) target->getUInt8Data() + x * channels;
+            for (int x=0; x<strips; ++x) {
+                const Scalar *srcPtr = (Scalar *) source->getUInt8Data() + x * stripChannels;
+                Scalar *trgPtr = (Scalar *) target->getUInt8Data() + x * stripChannels;
 
-                r.resampleAndClamp(srcPtr, source->getWidth(), trgPtr, target->getWidth(),
-                    channels, safe_cast<Scalar>(minValue), safe_cast<Scalar>(maxValue));
+                r.resampleAndClamp(srcPtr, strips, trgPtr, strips, stripChannels,
+                    safe_cast<Scalar>(minValue), safe_cast<Scalar>(maxValue));
             }
         } else {
             #if defined(MTS_OPENMP)
                 #pragma omp parallel for
             #endif
-            for (int x=0; x<source->getWidth(); ++x) {
-                const Scalar *srcPtr = (Scalar *) source->getUInt8Data() + x * channels;
-                Scalar *trgPtr = (Scalar *) target->getUInt8Data() + x * channels;
+            for (int x=0; x<strips; ++x) {
+                const Scalar *srcPtr = (Scalar *) source->getUInt8Data() + x * stripChannels;
+                Scalar *trgPtr = (Scalar *) target->getUInt8Data() + x * stripChannels;
 
-                r.resample(srcPtr, source->getWidth(), trgPtr, target->getWidth(), channels);
+                r.resample(srcPtr, strips, trgPtr, strips, stripChannels);
             }
         }
     }
@@ -2603,6 +2644,11 @@ void Bitmap::writePNG(Stream *stream, int compression) const {
 
     png_set_write_fn(png_ptr, stream, (png_rw_ptr) png_write_data, (png_flush_ptr) png_flush_data);
     png_set_compression_level(png_ptr, compression);
+    if (compression <= 1) {
+        /* Trying all row filters dominates the cost at low compression levels */
+        png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE,
+            compression == 0 ? PNG_FILTER_NONE : PNG_FILTER_SUB);
+    }
 
     png_text *text = NULL;
 
@@ -3902,14 +3948,28 @@ void Bitmap::writePPM(Stream *stream) const {
     stream->write(m_data, getBufferSize());
 }
 
+static int __ioThreadCount = 1;
+
+void Bitmap::setIOThreadCount(int count) {
+    __ioThreadCount = std::max(count, 1);
+#if defined(MTS_HAS_OPENEXR)
+    /* With a single thread, OpenEXR does all the work on the caller */
+    Imf::setGlobalThreadCount(__ioThreadCount > 1 ? __ioThreadCount : 0);
+#endif
+}
+
+int Bitmap::getIOThreadCount() {
+    return __ioThreadCount;
+}
+
 void Bitmap::staticInitialization() {
 #if defined(MTS_HAS_OPENEXR)
     /* Prevent races during the OpenEXR initialization */
     Imf::staticInitialize();
+#endif
 
     /* Use multiple threads to read/write OpenEXR files */
-    Imf::setGlobalThreadCount(getCoreCount());
-#endif
+    setIOThreadCount(getCoreCount());
 
     /* Initialize the Bitmap format conversion */
     FormatConverter::staticInitialization();
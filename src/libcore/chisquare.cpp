@@ -24,6 +24,10 @@
 #include <boost/filesystem/fstream.hpp>
 #include <set>
 
+#if defined(MTS_OPENMP)
+# include <omp.h>
+#endif
+
 MTS_NAMESPACE_BEGIN
 
 /* Simple ordering for storing vectors in a set */
@@ -87,20 +91,77 @@ void ChiSquare::dumpTables(const fs::path &filename) {
     out.close();
 }
 
-void ChiSquare::fill(
-    const boost::function<boost::tuple<Vector, Float, EMeasure>()> &sampleFn,
-    const boost::function<Float (const Vector &, EMeasure measure)> &pdfFn) {
+void ChiSquare::fill(const SampleFunctor &sampleFn, const PdfFunctor &pdfFn) {
     memset(m_table, 0, m_thetaBins*m_phiBins*sizeof(Float));
     memset(m_refTable, 0, m_thetaBins*m_phiBins*sizeof(Float));
 
     Log(m_logLevel, "Accumulating " SIZE_T_FMT " samples into a %ix%i"
             " contingency table", m_sampleCount, m_thetaBins, m_phiBins);
-    Point2 factor(m_thetaBins / M_PI, m_phiBins / (2*M_PI));
 
-    std::set<Vector, VectorOrder> discreteDirections;
+    ref<Timer> timer = new Timer();
+    std::vector<Vector> discreteDirections;
+    accumulate(sampleFn, m_sampleCount, m_table, discreteDirections);
+
+    Log(m_logLevel, "Done, took %i ms. Integrating reference "
+        "contingency table ..", timer->getMilliseconds());
+
+    integrate(pdfFn, discreteDirections);
+}
+
+void ChiSquare::fillParallel(const SampleFunctorFactory &createSampleFn,
+        const PdfFunctor &pdfFn) {
+    int nThreads = std::max(1, (int) std::min(
+        (size_t) mts_omp_get_max_threads(), m_sampleCount));
+    size_t cellCount = (size_t) m_thetaBins * m_phiBins;
+
+    memset(m_table, 0, cellCount*sizeof(Float));
+    memset(m_refTable, 0, cellCount*sizeof(Float));
+
+    Log(m_logLevel, "Accumulating " SIZE_T_FMT " samples into a %ix%i"
+            " contingency table using %i threads", m_sampleCount,
+            m_thetaBins, m_phiBins, nThreads);
+
+    /* The factory itself need not be thread-safe */
+    std::vector<SampleFunctor> sampleFns(nThreads);
+    for (int i=0; i<nThreads; ++i)
+        sampleFns[i] = createSampleFn(i);
 
     ref<Timer> timer = new Timer();
-    for (size_t i=0; i<m_sampleCount; ++i) {
+    std::vector<Float> tables(cellCount * nThreads, 0.0f);
+    std::vector<std::vector<Vector> > discrete(nThreads);
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(static, 1) num_threads(nThreads)
+    #endif
+    for (int i=0; i<nThreads; ++i) {
+        size_t start = m_sampleCount * i / nThreads,
+               end = m_sampleCount * (i+1) / nThreads;
+        accumulate(sampleFns[i], end - start,
+            &tables[cellCount * i], discrete[i]);
+    }
+
+    /* Merge the per-thread histograms */
+    std::vector<Vector> discreteDirections;
+    for (int i=0; i<nThreads; ++i) {
+        const Float *table = &tables[cellCount * i];
+        for (size_t j=0; j<cellCount; ++j)
+            m_table[j] += table[j];
+        discreteDirections.insert(discreteDirections.end(),
+            discrete[i].begin(), discrete[i].end());
+    }
+
+    Log(m_logLevel, "Done, took %i ms. Integrating reference "
+        "contingency table ..", timer->getMilliseconds());
+
+    integrate(pdfFn, discreteDirections);
+}
+
+void ChiSquare::accumulate(const SampleFunctor &sampleFn, size_t sampleCount,
+        Float *table, std::vector<Vector> &discreteDirections) const {
+    Point2 factor(m_thetaBins / M_PI, m_phiBins / (2*M_PI));
+    std::set<Vector, VectorOrder> directions;
+
+    for (size_t i=0; i<sampleCount; ++i) {
         boost::tuple<Vector, Float, EMeasure> sample = sampleFn();
         Point2 sphCoords = toSphericalCoordinates(boost::get<0>(sample));
 
@@ -108,11 +169,22 @@ void ChiSquare::fill(
             math::floorToInt(sphCoords.x * factor.x)), m_thetaBins-1);
         int phiBin = std::min(std::max(0,
             math::floorToInt(sphCoords.y * factor.y)), m_phiBins-1);
-        m_table[thetaBin * m_phiBins + phiBin] += boost::get<1>(sample);
+        table[thetaBin * m_phiBins + phiBin] += boost::get<1>(sample);
         if (boost::get<1>(sample) > 0 && boost::get<2>(sample) == EDiscrete)
-            discreteDirections.insert(boost::get<0>(sample));
+            directions.insert(boost::get<0>(sample));
     }
 
+    discreteDirections.insert(discreteDirections.end(),
+        directions.begin(), directions.end());
+}
+
+void ChiSquare::integrate(const PdfFunctor &pdfFn,
+        const std::vector<Vector> &discrete) {
+    Point2 factor(m_thetaBins / M_PI, m_phiBins / (2*M_PI));
+
+    std::set<Vector, VectorOrder> discreteDirections(
+        discrete.begin(), discrete.end());
+
     if (discreteDirections.size() > 0) {
         Log(EDebug, "Incorporating the disrete density over "
             SIZE_T_FMT " direction(s) into the contingency table", discreteDirections.size());
@@ -133,31 +205,36 @@ void ChiSquare::fill(
 
     factor = Point2(M_PI / m_thetaBins, (2*M_PI) / m_phiBins);
 
-    Log(m_logLevel, "Done, took %i ms. Integrating reference "
-        "contingency table ..", timer->getMilliseconds());
-    timer->reset();
-    Float min[2], max[2];
-    size_t idx = 0;
+    ref<Timer> timer = new Timer();
+    int cellCount = m_thetaBins * m_phiBins;
+    std::vector<Float> errors(cellCount), results(cellCount);
 
+    /* The cells are integrated independently; cells with a complicated
+       density take much longer, hence the dynamic schedule. The nested
+       loop in integrand() then runs serially on the calling thread. */
     NDIntegrator integrator(1, 2, 100000, 0, 1e-6f);
-    Float maxError = 0, integral = 0;
-    for (int i=0; i<m_thetaBins; ++i) {
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int idx=0; idx<cellCount; ++idx) {
+        int i = idx / m_phiBins, j = idx % m_phiBins;
+        Float min[2], max[2];
         min[0] = i * factor.x;
         max[0] = (i+1) * factor.x;
-        for (int j=0; j<m_phiBins; ++j) {
-            min[1] = j * factor.y;
-            max[1] = (j+1) * factor.y;
-            Float result, error;
-
-            integrator.integrateVectorized(
-                boost::bind(&ChiSquare::integrand, pdfFn, _1, _2, _3),
-                min, max, &result, &error
-            );
-
-            integral += result;
-            m_refTable[idx++] += result * m_sampleCount;
-            maxError = std::max(maxError, error);
-        }
+        min[1] = j * factor.y;
+        max[1] = (j+1) * factor.y;
+
+        integrator.integrateVectorized(
+            boost::bind(&ChiSquare::integrand, pdfFn, _1, _2, _3),
+            min, max, &results[idx], &errors[idx]
+        );
+    }
+
+    Float maxError = 0, integral = 0;
+    for (int idx=0; idx<cellCount; ++idx) {
+        integral += results[idx];
+        m_refTable[idx] += results[idx] * m_sampleCount;
+        maxError = std::max(maxError, errors[idx]);
     }
 
     Log(m_logLevel, "Done, took %i ms (max error = %f, integral=%f).",
@@ -20,6 +20,7 @@
 #define BOOST_MPL_LIMIT_VECTOR_SIZE 40
 
 #include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/sse.h>
 #include <boost/mpl/vector.hpp>
 #include <boost/mpl/for_each.hpp>
 #include <boost/mpl/fold.hpp>
@@ -27,6 +28,23 @@
 #include <boost/mpl/pair.hpp>
 #include <boost/mpl/transform.hpp>
 
+/* Builds that don't assume F16C get a separately compiled version of the
+   half precision conversion, which is selected at runtime */
+#if !defined(__F16C__) && defined(__GNUC__) && defined(__SSE2__)
+#define MTS_FMTCONV_DISPATCH_F16C 1
+#endif
+
+#if defined(__F16C__) || defined(MTS_FMTCONV_DISPATCH_F16C)
+#include <immintrin.h>
+#endif
+
+/// Minimum number of pixels for which the bulk half-precision path is used
+#define MTS_FMTCONV_BULK_HALF   64
+/// Minimum number of gamma-corrected 8 bit values before a threshold table pays off
+#define MTS_FMTCONV_BULK_U8     8192
+/// Size of the intermediate buffer of the bulk conversion paths (in Float values)
+#define MTS_FMTCONV_CHUNK       4096
+
 MTS_NAMESPACE_BEGIN
 
 namespace mpl = boost::mpl;
@@ -38,8 +56,9 @@ namespace mpl = boost::mpl;
 /*  formats. The switch() and Boost MPL craziness below does exactly this:  */
 /*  it produces code for each possible pair                                 */
 /****************************************************************************/
-/*  Note that some cases in this file really scream for SSE optimization    */
-/*  (in case they ever become a bottleneck, that is..)                      */
+/*  Conversions to half precision and 8 bit integer formats are the common  */
+/*  case when films are developed. These first convert to Float and then    */
+/*  encode the intermediate values in bulk (see convertBulk())              */
 /****************************************************************************/
 
 namespace detail {
@@ -77,6 +96,106 @@ namespace detail {
     template <> inline half safe_cast(double a) {
         return static_cast<half>(static_cast<float>(a));
     }
+
+#if defined(MTS_SSE) && !defined(__F16C__)
+    /**
+     * Convert four single precision values to half precision. Rounds to
+     * the nearest value with ties to even like the \ref half class, and
+     * keeps infinities and NaNs (with different payloads)
+     */
+    inline __m128i float_to_half(__m128 f) {
+        const __m128i f16max      = _mm_set1_epi32((127 + 16) << 23);
+        const __m128i minNormal   = _mm_set1_epi32((127 - 14) << 23);
+        const __m128i subnormMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+        const __m128i normalBias  = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+
+        __m128 sign = _mm_and_ps(f, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+        __m128 absf = _mm_xor_ps(f, sign);
+        __m128i absi = _mm_castps_si128(absf);
+
+        /* Infinities and NaNs */
+        __m128i isNaN = _mm_castps_si128(_mm_cmpunord_ps(absf, absf));
+        __m128i special = _mm_or_si128(_mm_set1_epi32(0x7c00),
+            _mm_and_si128(isNaN, _mm_set1_epi32(0x200)));
+        __m128i isRegular = _mm_cmpgt_epi32(f16max, absi);
+
+        /* Subnormal results: let the FPU do the rounding */
+        __m128i isSubnormal = _mm_cmpgt_epi32(minNormal, absi);
+        __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(
+            _mm_add_ps(absf, _mm_castsi128_ps(subnormMagic))), subnormMagic);
+
+        /* Normalized results: rebias the exponent and round the mantissa */
+        __m128i mantissaOdd = _mm_srai_epi32(_mm_slli_epi32(absi, 31 - 13), 31);
+        __m128i normal = _mm_srli_epi32(_mm_sub_epi32(
+            _mm_add_epi32(absi, normalBias), mantissaOdd), 13);
+
+        __m128i result = mux_epi32(isRegular,
+            mux_epi32(isSubnormal, subnormal, normal), special);
+        return _mm_or_si128(result, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+    }
+#endif
+
+    typedef void (*ConvertToHalfFn)(const Float *source, half *dest, size_t count);
+
+    /// Portable version of \ref convertToHalf()
+    static void convertToHalfBaseline(const Float *source, half *dest, size_t count) {
+        size_t i = 0;
+#if defined(SINGLE_PRECISION) && (defined(__F16C__) || defined(MTS_SSE))
+        for (; i + 8 <= count; i += 8) {
+            __m128 a = _mm_loadu_ps(source + i), b = _mm_loadu_ps(source + i + 4);
+#if defined(__F16C__)
+            __m128i result = _mm_unpacklo_epi64(
+                _mm_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT),
+                _mm_cvtps_ph(b, _MM_FROUND_TO_NEAREST_INT));
+#else
+            /* Sign-extended 32 bit results, so signed saturation is exact */
+            __m128i result = _mm_packs_epi32(float_to_half(a), float_to_half(b));
+#endif
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), result);
+        }
+#endif
+        for (; i < count; ++i)
+            dest[i] = safe_cast<half>(source[i]);
+    }
+
+#if defined(MTS_FMTCONV_DISPATCH_F16C)
+    /// Version of \ref convertToHalf() for processors with F16C
+    __attribute__((target("f16c")))
+    static void convertToHalfF16C(const Float *source, half *dest, size_t count) {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+#if defined(SINGLE_PRECISION)
+            __m128 a = _mm_loadu_ps(source + i), b = _mm_loadu_ps(source + i + 4);
+#else
+            /* Rounds to single precision first, just like safe_cast<half> */
+            __m128 a = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(source + i)),
+                                     _mm_cvtpd_ps(_mm_loadu_pd(source + i + 2))),
+                   b = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(source + i + 4)),
+                                     _mm_cvtpd_ps(_mm_loadu_pd(source + i + 6)));
+#endif
+            __m128i result = _mm_unpacklo_epi64(
+                _mm_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT),
+                _mm_cvtps_ph(b, _MM_FROUND_TO_NEAREST_INT));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), result);
+        }
+        for (; i < count; ++i)
+            dest[i] = safe_cast<half>(source[i]);
+    }
+#endif
+
+    static ConvertToHalfFn selectConvertToHalf() {
+#if defined(MTS_FMTCONV_DISPATCH_F16C)
+        if (hasCPUFeature(ECPUF16C))
+            return convertToHalfF16C;
+#endif
+        return convertToHalfBaseline;
+    }
+
+    /// Convert an array of Float values to half precision
+    inline void convertToHalf(const Float *source, half *dest, size_t count) {
+        static const ConvertToHalfFn convertFn = selectConvertToHalf();
+        convertFn(source, dest, count);
+    }
 }
 
 template <typename T> struct FormatConverterImpl : public FormatConverter {
@@ -124,25 +243,36 @@ template <typename T> struct FormatConverterImpl : public FormatConverter {
         /* Revert to memcpy when the underlying data needs no transformation */
         if ((int) detail::get_pixelformat<SourceFormat>::value == (int) detail::get_pixelformat<DestFormat>::value &&
             sourceFormat == destFormat && sourceGamma == destGamma && multiplier == 1.0) {
-            switch (sourceFormat) {
-                case Bitmap::ELuminance:            channelCount = 1; break;
-                case Bitmap::ELuminanceAlpha:       channelCount = 2; break;
-                case Bitmap::ERGB:
-                case Bitmap::EXYZ:                  channelCount = 3; break;
-                case Bitmap::EXYZA:
-                case Bitmap::ERGBA:                 channelCount = 4; break;
-                case Bitmap::ESpectrum:             channelCount = SPECTRUM_SAMPLES; break;
-                case Bitmap::ESpectrumAlpha:        channelCount = SPECTRUM_SAMPLES + 1; break;
-                case Bitmap::ESpectrumAlphaWeight:  channelCount = SPECTRUM_SAMPLES + 2; break;
-                case Bitmap::EMultiChannel:         break;
-                default:
-                    SLog(EError, "Unsupported source/target pixel format!");
-                    return;
+            int colorChannels;
+            channelCount = getChannelCount(sourceFormat, channelCount, colorChannels);
+            if (channelCount == 0) {
+                SLog(EError, "Unsupported source/target pixel format!");
+                return;
             }
             memcpy(_dest, _source, sizeof(SourceFormat) * channelCount * count);
             return;
         }
 
+        /* Half precision and 8 bit targets take a bulk path, except from
+           8/16 bit sources, which are handled by a lookup table below */
+        if (!format_traits<SourceFormat>::is_compact &&
+            (boost::is_same<DestFormat, half>::value ||
+             boost::is_same<DestFormat, uint8_t>::value)) {
+            int colorChannels;
+            int destChannels = getChannelCount(destFormat, channelCount, colorChannels);
+
+            size_t minCount = (destGamma == 1 || boost::is_same<DestFormat, half>::value)
+                ? MTS_FMTCONV_BULK_HALF : MTS_FMTCONV_BULK_U8 / std::max(colorChannels, 1);
+
+            if (destChannels > 0 && count >= minCount &&
+                (destGamma == 1 || !boost::is_same<DestFormat, half>::value)) {
+                convertBulk(sourceFormat, sourceGamma, _source, destFormat, destGamma,
+                    reinterpret_cast<DestFormat *>(_dest), count, multiplier, intent,
+                    channelCount, destChannels, colorChannels);
+                return;
+            }
+        }
+
         const SourceFormat *source = reinterpret_cast<const SourceFormat *>(_source);
         DestFormat *dest = reinterpret_cast<DestFormat *>(_dest);
         const Float invDestGamma = 1.0f / destGamma;
@@ -1090,6 +1220,138 @@ template <typename T> struct FormatConverterImpl : public FormatConverter {
     }
 
 private:
+    /**
+     * Return the number of channels of a pixel format (0 if unsupported),
+     * and the number of leading channels that hold color values
+     */
+    static int getChannelCount(Bitmap::EPixelFormat format, int channelCount, int &colorChannels) {
+        switch (format) {
+            case Bitmap::ELuminance:            colorChannels = 1; return 1;
+            case Bitmap::ELuminanceAlpha:       colorChannels = 1; return 2;
+            case Bitmap::ERGB:
+            case Bitmap::EXYZ:                  colorChannels = 3; return 3;
+            case Bitmap::EXYZA:
+            case Bitmap::ERGBA:                 colorChannels = 3; return 4;
+            case Bitmap::ESpectrum:             colorChannels = SPECTRUM_SAMPLES; return SPECTRUM_SAMPLES;
+            case Bitmap::ESpectrumAlpha:        colorChannels = SPECTRUM_SAMPLES; return SPECTRUM_SAMPLES + 1;
+            case Bitmap::ESpectrumAlphaWeight:  colorChannels = SPECTRUM_SAMPLES; return SPECTRUM_SAMPLES + 2;
+            case Bitmap::EMultiChannel:         colorChannels = channelCount; return std::max(channelCount, 0);
+            default:                            colorChannels = 0; return 0;
+        }
+    }
+
+    /**
+     * Convert chunks of pixels into a linear Float buffer with the layout of
+     * the destination format, and then encode these in one pass. The result
+     * is identical to that of the per-pixel code path, but the half conversion
+     * is vectorized and the destination gamma curve of 8 bit outputs is
+     * evaluated by searching a table of quantization thresholds.
+     */
+    void convertBulk(Bitmap::EPixelFormat sourceFormat, Float sourceGamma, const void *_source,
+            Bitmap::EPixelFormat destFormat, Float destGamma, DestFormat *dest,
+            size_t count, Float multiplier, Spectrum::EConversionIntent intent,
+            int channelCount, int destChannels, int colorChannels) const {
+        const FormatConverter *cvt = FormatConverter::getInstance(
+            std::make_pair((Bitmap::EComponentFormat) detail::get_pixelformat<SourceFormat>::value,
+                Bitmap::EFloat));
+
+        int sourceChannels, sourceColorChannels;
+        sourceChannels = getChannelCount(sourceFormat, channelCount, sourceColorChannels);
+        if (sourceChannels == 0) {
+            SLog(EError, "Unsupported source pixel format!");
+            return;
+        }
+
+        const Float invDestGamma = 1.0f / destGamma;
+        Float thresholds[256];
+        if (!boost::is_same<DestFormat, half>::value && invDestGamma != 1)
+            computeThresholds(invDestGamma, thresholds);
+
+        const size_t chunkSize = std::max((size_t) 1, (size_t) (MTS_FMTCONV_CHUNK / destChannels));
+        Float *temp = (Float *) alloca(sizeof(Float) * chunkSize * destChannels);
+        const SourceFormat *source = reinterpret_cast<const SourceFormat *>(_source);
+
+        for (size_t offset = 0; offset < count; offset += chunkSize) {
+            size_t chunk = std::min(chunkSize, count - offset);
+            cvt->convert(sourceFormat, sourceGamma, source + offset * sourceChannels,
+                destFormat, 1.0f, temp, chunk, multiplier, intent, channelCount);
+            DestFormat *target = dest + offset*destChannels;
+
+            if (boost::is_same<DestFormat, half>::value) {
+                detail::convertToHalf(temp, (half *) target, chunk * destChannels);
+            } else if (invDestGamma == 1 || colorChannels == destChannels) {
+                const Float *table = invDestGamma == 1 ? NULL : thresholds;
+                for (size_t i=0, n = chunk*destChannels; i<n; ++i)
+                    target[i] = quantize(temp[i], table, invDestGamma);
+            } else {
+                const Float *value = temp;
+                for (size_t i=0; i<chunk; ++i) {
+                    for (int j=0; j<colorChannels; ++j)
+                        *target++ = quantize(*value++, thresholds, invDestGamma);
+                    for (int j=colorChannels; j<destChannels; ++j)
+                        *target++ = quantize(*value++, NULL, 1.0f);
+                }
+            }
+        }
+    }
+
+    /**
+     * Compute the smallest input values that map to each of the 255 nonzero
+     * outputs of \ref convertScalar() with the given gamma curve
+     */
+    static void computeThresholds(Float invGamma, Float *thresholds) {
+        thresholds[0] = -std::numeric_limits<Float>::infinity();
+        for (int k=1; k<256; ++k) {
+            /* Bracket the threshold around the inverse of the gamma curve .. */
+            Float x = (k - (Float) 0.5f) / (Float) 255, estimate;
+            if (invGamma == -1)
+                estimate = (x <= (Float) 0.04045) ? x * (Float) (1.0 / 12.92)
+                    : std::pow((x + (Float) 0.055) * (Float) (1.0 / 1.055), (Float) 2.4);
+            else
+                estimate = std::pow(x, 1 / invGamma);
+
+            Float lo = estimate * (Float) 0.999f, hi = estimate * (Float) 1.001f;
+            while (lo > 0 && quantizeGamma(lo, invGamma) >= k)
+                lo *= 0.5f;
+            while (quantizeGamma(hi, invGamma) < k)
+                hi = hi * 2 + std::numeric_limits<Float>::min();
+
+            /* .. and bisect it down to adjacent floating point values */
+            while (true) {
+                Float mid = lo + (hi - lo) * (Float) 0.5f;
+                if (mid <= lo || mid >= hi)
+                    break;
+                if (quantizeGamma(mid, invGamma) >= k)
+                    hi = mid;
+                else
+                    lo = mid;
+            }
+            thresholds[k] = hi;
+        }
+    }
+
+    inline static int quantizeGamma(Float value, Float invGamma) {
+        return (int) convertScalar<uint8_t>(value, 1.0f, (uint8_t *) NULL, 1.0f, invGamma);
+    }
+
+    /**
+     * Quantize a linear value or look it up in a threshold table. Negative
+     * values are rare and don't necessarily map to zero (e.g. when a gamma
+     * curve is an even power), so they take the scalar path.
+     */
+    inline static DestFormat quantize(Float value, const Float *thresholds, Float invGamma) {
+        if (!thresholds)
+            return convertScalar<DestFormat>(value);
+        else if (value < 0)
+            return convertScalar<DestFormat>(value, 1.0f, (DestFormat *) NULL, 1.0f, invGamma);
+        int index = 0;
+        for (int step = 128; step > 0; step >>= 1) {
+            if (value >= thresholds[index + step])
+                index += step;
+        }
+        return detail::safe_cast<DestFormat>(index);
+    }
+
     static Float undoGamma(Float value, Float gamma) {
         if (gamma == -1) {
             if (value <= (Float) 0.04045)
@@ -42,6 +42,10 @@ void Mutex::unlock() {
     d->mutex.unlock();
 }
 
+bool Mutex::tryLock() {
+    return d->mutex.try_lock();
+}
+
 struct ConditionVariable::ConditionVariablePrivate {
     ref<Mutex> mutex;
     boost::condition_variable_any cond;
@@ -20,6 +20,7 @@
 #include <mitsuba/core/appender.h>
 #include <mitsuba/core/lock.h>
 #include <stdarg.h>
+#include <atomic>
 
 #if defined(__OSX__)
 # include <sys/sysctl.h>
@@ -29,16 +30,146 @@
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * Queue of formatted messages for the asynchronous mode. This is a bounded
+ * ring buffer after D. Vyukov: producers claim a cell with a single
+ * compare-and-swap and publish it through the cell's sequence number.
+ * There is only one consumer at a time, since \ref drainQueue() is
+ * always called with the logger's mutex held.
+ */
+struct Logger::AsyncState {
+    struct Cell {
+        std::atomic<size_t> sequence;
+        ELogLevel level;
+        std::string text;
+    };
+
+    /// Waits for messages and hands them to the appenders
+    class DrainThread : public Thread {
+    public:
+        DrainThread(Logger *logger) : Thread("logd"), m_logger(logger) {
+            /* Don't inherit (and keep alive) the logger being drained */
+            ref<Logger> silent = new Logger(EError);
+            silent->setFormatter(new DefaultFormatter());
+            setLogger(silent);
+        }
+
+        void run() {
+            AsyncState *async = m_logger->m_async;
+            while (!async->stop) {
+                async->wakeup->wait(10);
+                async->wakeup->set(false);
+                LockGuard lock(m_logger->m_mutex);
+                m_logger->drainQueue();
+            }
+        }
+    protected:
+        virtual ~DrainThread() { }
+    private:
+        Logger *m_logger;
+    };
+
+    static const size_t cellCount = 4096;
+    Cell cells[cellCount];
+    std::atomic<size_t> enqueuePos;
+    size_t dequeuePos;
+    std::atomic<bool> stop;
+    ref<WaitFlag> wakeup;
+    ref<DrainThread> thread;
+
+    AsyncState() : enqueuePos(0), dequeuePos(0), stop(false) {
+        for (size_t i=0; i<cellCount; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        wakeup = new WaitFlag();
+    }
+
+    /// Try to enqueue a message (takes over the contents of \c text)
+    bool push(ELogLevel level, std::string &text) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &cells[pos % cellCount];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            ssize_t diff = (ssize_t) seq - (ssize_t) pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+                        std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false; /* Full */
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->level = level;
+        cell->text.swap(text);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Dequeue a message (single consumer)
+    bool pop(ELogLevel &level, std::string &text) {
+        Cell *cell = &cells[dequeuePos % cellCount];
+        if (cell->sequence.load(std::memory_order_acquire) != dequeuePos + 1)
+            return false;
+        level = cell->level;
+        text.swap(cell->text);
+        cell->sequence.store(dequeuePos + cellCount, std::memory_order_release);
+        ++dequeuePos;
+        return true;
+    }
+};
+
 Logger::Logger(ELogLevel level)
- : m_logLevel(level), m_errorLevel(EError), m_warningCount(0) {
+ : m_logLevel(level), m_errorLevel(EError), m_warningCount(0), m_async(NULL) {
     m_mutex = new Mutex();
 }
 
 Logger::~Logger() {
+    setAsynchronous(false);
     for (size_t i=0; i<m_appenders.size(); ++i)
         m_appenders[i]->decRef();
 }
 
+void Logger::setAsynchronous(bool async) {
+    if (async == (m_async != NULL))
+        return;
+
+    if (async) {
+        AsyncState *state = new AsyncState();
+        state->thread = new AsyncState::DrainThread(this);
+        m_async = state;
+        state->thread->start();
+    } else {
+        AsyncState *state = m_async;
+        state->stop = true;
+        state->wakeup->set(true);
+        state->thread->join();
+        LockGuard lock(m_mutex);
+        drainQueue();
+        m_async = NULL;
+        delete state;
+    }
+}
+
+void Logger::drainQueue() {
+    if (!m_async)
+        return;
+    ELogLevel level;
+    std::string text;
+    while (m_async->pop(level, text)) {
+        if (level >= EWarn)
+            m_warningCount++;
+        for (size_t i=0; i<m_appenders.size(); ++i)
+            m_appenders[i]->append(level, text);
+    }
+}
+
+void Logger::flush() {
+    LockGuard lock(m_mutex);
+    drainQueue();
+}
+
 void Logger::setFormatter(Formatter *formatter) {
     LockGuard lock(m_mutex);
     m_formatter = formatter;
@@ -97,12 +228,19 @@ void Logger::log(ELogLevel level, const Class *theClass,
     if (level < m_errorLevel) {
         if (msg != tmp)
             delete[] msg;
+        if (m_async && m_async->push(level, text))
+            return;
+        /* Synchronous mode, or the queue is full */
         LockGuard lock(m_mutex);
+        drainQueue();
         if (level >= EWarn)
             m_warningCount++;
         for (size_t i=0; i<m_appenders.size(); ++i)
             m_appenders[i]->append(level, text);
     } else {
+        /* Messages that were logged before the error should appear first */
+        flush();
+
 #if defined(__LINUX__)
         /* A critical error occurred: trap if we're running in a debugger */
 
@@ -152,6 +290,7 @@ void Logger::log(ELogLevel level, const Class *theClass,
 void Logger::logProgress(Float progress, const std::string &name,
     const std::string &formatted, const std::string &eta, const void *ptr) {
     LockGuard lock(m_mutex);
+    drainQueue();
     for (size_t i=0; i<m_appenders.size(); ++i)
         m_appenders[i]->logProgress(
             progress, name, formatted, eta, ptr);
@@ -165,6 +304,7 @@ void Logger::addAppender(Appender *appender) {
 
 void Logger::removeAppender(Appender *appender) {
     LockGuard lock(m_mutex);
+    drainQueue();
     m_appenders.erase(std::remove(m_appenders.begin(),
         m_appenders.end(), appender), m_appenders.end());
     appender->decRef();
@@ -173,6 +313,7 @@ void Logger::removeAppender(Appender *appender) {
 bool Logger::readLog(std::string &target) {
     bool success = false;
     LockGuard lock(m_mutex);
+    drainQueue();
     for (size_t i=0; i<m_appenders.size(); ++i) {
         Appender *appender = m_appenders[i];
         if (appender->getClass()->derivesFrom(MTS_CLASS(StreamAppender))) {
@@ -190,6 +331,7 @@ bool Logger::readLog(std::string &target) {
 
 void Logger::clearAppenders() {
     LockGuard lock(m_mutex);
+    drainQueue();
     for (size_t i=0; i<m_appenders.size(); ++i)
         m_appenders[i]->decRef();
     m_appenders.clear();
@@ -39,7 +39,39 @@ MTS_NAMESPACE_BEGIN
 namespace {
     typedef void *(*CreateInstanceFunc)(const Properties &props);
     typedef void *(*CreateUtilityFunc)();
-    typedef char *(*GetDescriptionFunc)();
+    typedef const char *(*GetDescriptionFunc)();
+
+    typedef std::map<std::string, StaticPluginEntry> StaticPluginMap;
+
+    /// Plugins of the bundle (constructed on first use by a static initializer)
+    StaticPluginMap &getStaticPlugins() {
+        static StaticPluginMap plugins;
+        return plugins;
+    }
+
+    /// Platform-specific file name of a plugin library
+    fs::path getPluginFilename(const std::string &name) {
+        fs::path filename = fs::path("plugins") / name;
+#if defined(__WINDOWS__)
+        filename.replace_extension(".dll");
+#elif defined(__OSX__)
+        filename.replace_extension(".dylib");
+#else
+        filename.replace_extension(".so");
+#endif
+        return filename;
+    }
+}
+
+bool registerStaticPlugin(const char *name, const StaticPluginEntry &entry) {
+    getStaticPlugins()[name] = entry;
+    return true;
+}
+
+const StaticPluginEntry *findStaticPlugin(const std::string &name) {
+    StaticPluginMap &plugins = getStaticPlugins();
+    StaticPluginMap::const_iterator it = plugins.find(name);
+    return it != plugins.end() ? &it->second : NULL;
 }
 
 struct Plugin::PluginPrivate {
@@ -101,6 +133,17 @@ Plugin::Plugin(const std::string &shortName, const fs::path &path)
     Class::staticInitialization();
 }
 
+Plugin::Plugin(const std::string &shortName, const StaticPluginEntry &entry)
+ : d(new PluginPrivate(shortName, fs::path())) {
+    /* The classes were registered when the bundle was loaded */
+    d->handle = NULL;
+    d->getDescription = entry.getDescription;
+    d->createInstance = (CreateInstanceFunc) entry.createInstance;
+    d->createUtility = (CreateUtilityFunc) entry.createUtility;
+    d->isUtility = entry.createUtility != NULL;
+    Statistics::getInstance()->logPlugin(shortName, getDescription());
+}
+
 bool Plugin::hasSymbol(const std::string &sym) const {
 #if defined(__WINDOWS__)
     void *ptr = GetProcAddress(d->handle, sym.c_str());
@@ -152,6 +195,8 @@ const std::string& Plugin::getShortName() const {
 }
 
 Plugin::~Plugin() {
+    if (!d->handle)
+        return;
 #if defined(__WINDOWS__)
     FreeLibrary(d->handle);
 #else
@@ -165,7 +210,7 @@ Plugin::~Plugin() {
 
 ref<PluginManager> PluginManager::m_instance = NULL;
 
-PluginManager::PluginManager() {
+PluginManager::PluginManager() : m_bundle(NULL), m_bundleChecked(false) {
     m_mutex = new Mutex();
 }
 
@@ -175,6 +220,43 @@ PluginManager::~PluginManager() {
         it != m_plugins.end(); ++it) {
         delete (*it).second;
     }
+
+    if (m_bundle) {
+#if defined(__WINDOWS__)
+        FreeLibrary((HMODULE) m_bundle);
+#else
+        dlclose(m_bundle);
+#endif
+    }
+}
+
+void PluginManager::loadBundle() {
+    m_bundleChecked = true;
+
+    fs::path shortName = getPluginFilename("mitsuba-plugins");
+    const FileResolver *resolver = Thread::getThread()->getFileResolver();
+    fs::path path = resolver->resolve(shortName);
+    if (!fs::exists(path))
+        return;
+
+    Log(EInfo, "Loading the plugin bundle \"%s\" ..", shortName.string().c_str());
+    /* The static initializers of the bundle register its plugins */
+#if defined(__WINDOWS__)
+    m_bundle = LoadLibraryW(path.c_str());
+    if (!m_bundle) {
+        Log(EError, "Error while loading the plugin bundle \"%s\": %s",
+            path.string().c_str(), lastErrorText().c_str());
+    }
+#else
+    m_bundle = dlopen(path.string().c_str(), RTLD_LAZY | RTLD_LOCAL);
+    if (!m_bundle) {
+        Log(EError, "Error while loading the plugin bundle \"%s\": %s",
+            path.string().c_str(), dlerror());
+    }
+#endif
+
+    /* New classes must be registered within the class hierarchy */
+    Class::staticInitialization();
 }
 
 ConfigurableObject *PluginManager::createObject(const Class *classType,
@@ -224,15 +306,17 @@ void PluginManager::ensurePluginLoaded(const std::string &name) {
     if (m_plugins[name] != NULL)
         return;
 
+    /* Prefer the plugin bundle, which doesn't need any file system lookups */
+    if (!m_bundleChecked)
+        loadBundle();
+    const StaticPluginEntry *entry = findStaticPlugin(name);
+    if (entry) {
+        m_plugins[name] = new Plugin(name, *entry);
+        return;
+    }
+
     /* Build the full plugin file name */
-    fs::path shortName = fs::path("plugins") / name;
-#if defined(__WINDOWS__)
-    shortName.replace_extension(".dll");
-#elif defined(__OSX__)
-    shortName.replace_extension(".dylib");
-#else
-    shortName.replace_extension(".so");
-#endif
+    fs::path shortName = getPluginFilename(name);
 
     const FileResolver *resolver = Thread::getThread()->getFileResolver();
     fs::path path = resolver->resolve(shortName);
@@ -23,6 +23,9 @@
 /* Keep the boost::variant includes outside of properties.h,
    since they noticeably add to the overall compile times */
 #include <boost/variant.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -35,35 +38,223 @@ struct PropertyElement {
     mutable bool queried;
 };
 
+/**
+ * Property names are interned: every distinct name is stored exactly once
+ * in a global table, along with its hash value. Properties records only
+ * keep pointers to these keys, which makes copying a record cheap and
+ * avoids string comparisons for everything but the initial lookup.
+ * The table is never freed, since the number of distinct names is small.
+ */
+struct PropertyKey {
+    std::string name;
+    size_t hash;
+};
+
+namespace {
+    /// 64 bit FNV-1a hash, truncated to size_t on 32 bit platforms
+    inline size_t hashPropertyName(const std::string &name) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (size_t i=0; i<name.length(); ++i) {
+            hash ^= (uint8_t) name[i];
+            hash *= 0x100000001b3ULL;
+        }
+        return (size_t) hash;
+    }
+
+    typedef boost::unordered_map<std::string, PropertyKey *> InternTable;
+
+    const PropertyKey *internPropertyName(const std::string &name, size_t hash) {
+        /* Intentionally leaked, properties may be destroyed during static shutdown */
+        static boost::mutex *mutex = new boost::mutex();
+        static InternTable *table = new InternTable();
+
+        boost::lock_guard<boost::mutex> guard(*mutex);
+        InternTable::iterator it = table->find(name);
+        if (it != table->end())
+            return it->second;
+        PropertyKey *key = new PropertyKey();
+        key->name = name;
+        key->hash = hash;
+        (*table)[name] = key;
+        return key;
+    }
+}
+
+/**
+ * Flat hash map from interned names to property elements. The entries are
+ * stored contiguously; small records (the vast majority) are searched
+ * linearly by comparing hash values, larger ones additionally use an
+ * open addressing index with linear probing.
+ */
+struct PropertyStorage {
+    struct Entry {
+        const PropertyKey *key;
+        PropertyElement element;
+    };
+
+    /// Records with at most this many entries don't build an index
+    enum { ELinearSearchLimit = 8 };
+
+    typedef std::vector<Entry>::iterator iterator;
+    typedef std::vector<Entry>::const_iterator const_iterator;
+
+    std::vector<Entry> entries;
+    /// Open addressing table of entry indices plus one (zero marks empty slots)
+    std::vector<uint32_t> index;
+
+    inline iterator begin() { return entries.begin(); }
+    inline iterator end() { return entries.end(); }
+    inline const_iterator begin() const { return entries.begin(); }
+    inline const_iterator end() const { return entries.end(); }
+    inline size_t size() const { return entries.size(); }
+
+    PropertyElement *find(const std::string &name) const {
+        size_t hash = hashPropertyName(name);
+        if (index.empty()) {
+            for (size_t i=0; i<entries.size(); ++i) {
+                const PropertyKey *key = entries[i].key;
+                if (key->hash == hash && key->name == name)
+                    return const_cast<PropertyElement *>(&entries[i].element);
+            }
+        } else {
+            size_t mask = index.size() - 1;
+            for (size_t slot = hash & mask; index[slot] != 0; slot = (slot + 1) & mask) {
+                const Entry &entry = entries[index[slot] - 1];
+                if (entry.key->hash == hash && entry.key->name == name)
+                    return const_cast<PropertyElement *>(&entry.element);
+            }
+        }
+        return NULL;
+    }
+
+    /// Look up an interned key, which only requires pointer comparisons
+    PropertyElement *find(const PropertyKey *key) const {
+        if (index.empty()) {
+            for (size_t i=0; i<entries.size(); ++i) {
+                if (entries[i].key == key)
+                    return const_cast<PropertyElement *>(&entries[i].element);
+            }
+        } else {
+            size_t mask = index.size() - 1;
+            for (size_t slot = key->hash & mask; index[slot] != 0; slot = (slot + 1) & mask) {
+                const Entry &entry = entries[index[slot] - 1];
+                if (entry.key == key)
+                    return const_cast<PropertyElement *>(&entry.element);
+            }
+        }
+        return NULL;
+    }
+
+    /// Append a new element (the key must not be present yet)
+    PropertyElement &insert(const PropertyKey *key) {
+        Entry entry;
+        entry.key = key;
+        entry.element.queried = false;
+        entries.push_back(entry);
+
+        if (entries.size() > ELinearSearchLimit) {
+            if (2 * entries.size() > index.size())
+                rebuildIndex();
+            else
+                insertIndex(entries.size() - 1);
+        }
+        return entries.back().element;
+    }
+
+    /// Find or insert an element (analogous to std::map::operator[])
+    PropertyElement &operator[](const std::string &name) {
+        PropertyElement *element = find(name);
+        if (element)
+            return *element;
+        return insert(internPropertyName(name, hashPropertyName(name)));
+    }
+
+    PropertyElement &operator[](const PropertyKey *key) {
+        PropertyElement *element = find(key);
+        if (element)
+            return *element;
+        return insert(key);
+    }
+
+    /// Remove an element; this moves the last entry into its place
+    void erase(PropertyElement *element) {
+        size_t i = 0;
+        while (&entries[i].element != element)
+            ++i;
+        if (i + 1 != entries.size())
+            entries[i] = entries.back();
+        entries.pop_back();
+        rebuildIndex();
+    }
+
+    /// Return the entries sorted by name (for deterministic output)
+    std::vector<const Entry *> getSorted() const {
+        std::vector<const Entry *> result(entries.size());
+        for (size_t i=0; i<entries.size(); ++i)
+            result[i] = &entries[i];
+        std::sort(result.begin(), result.end(), EntryOrdering());
+        return result;
+    }
+
+private:
+    struct EntryOrdering {
+        inline bool operator()(const Entry *a, const Entry *b) const {
+            return a->key->name < b->key->name;
+        }
+    };
+
+    void rebuildIndex() {
+        index.clear();
+        if (entries.size() <= ELinearSearchLimit)
+            return;
+        size_t size = 32;
+        while (size < 4 * entries.size())
+            size *= 2;
+        index.resize(size, 0);
+        for (size_t i=0; i<entries.size(); ++i)
+            insertIndex(i);
+    }
+
+    inline void insertIndex(size_t i) {
+        size_t mask = index.size() - 1, slot = entries[i].key->hash & mask;
+        while (index[slot] != 0)
+            slot = (slot + 1) & mask;
+        index[slot] = (uint32_t) (i + 1);
+    }
+};
+
 #define DEFINE_PROPERTY_ACCESSOR(Type, BaseType, TypeName, ReadableName) \
     void Properties::set##TypeName(const std::string &name, const Type &value, bool warnDuplicates) { \
-        if (hasProperty(name) && warnDuplicates) \
+        PropertyElement *element = m_elements->find(name); \
+        if (!element) \
+            element = &m_elements->insert(internPropertyName(name, hashPropertyName(name))); \
+        else if (warnDuplicates) \
             SLog(EWarn, "Property \"%s\" was specified multiple times!", name.c_str()); \
-        (*m_elements)[name].data = (BaseType) value; \
-        (*m_elements)[name].queried = false; \
+        element->data = (BaseType) value; \
+        element->queried = false; \
     } \
     \
     Type Properties::get##TypeName(const std::string &name) const { \
-        std::map<std::string, PropertyElement>::const_iterator it = m_elements->find(name); \
-        if (it == m_elements->end()) \
+        const PropertyElement *element = m_elements->find(name); \
+        if (!element) \
             SLog(EError, "Property \"%s\" has not been specified!", name.c_str()); \
-        const BaseType *result = boost::get<BaseType>(&it->second.data); \
+        const BaseType *result = boost::get<BaseType>(&element->data); \
         if (!result) \
             SLog(EError, "The property \"%s\" has the wrong type (expected <" #ReadableName ">). The " \
                     "complete property record is :\n%s", name.c_str(), toString().c_str()); \
-        it->second.queried = true; \
+        element->queried = true; \
         return (Type) *result; \
     } \
     \
     Type Properties::get##TypeName(const std::string &name, const Type &defVal) const { \
-        std::map<std::string, PropertyElement>::const_iterator it = m_elements->find(name); \
-        if (it == m_elements->end()) \
+        const PropertyElement *element = m_elements->find(name); \
+        if (!element) \
             return defVal; \
-        const BaseType *result = boost::get<BaseType>(&it->second.data); \
+        const BaseType *result = boost::get<BaseType>(&element->data); \
         if (!result) \
             SLog(EError, "The property \"%s\" has the wrong type (expected <" #ReadableName ">). The " \
                     "complete property record is :\n%s", name.c_str(), toString().c_str()); \
-        it->second.queried = true; \
+        element->queried = true; \
         return (Type) *result; \
     }
 
@@ -80,29 +271,32 @@ DEFINE_PROPERTY_ACCESSOR(std::string, std::string, String, string)
 DEFINE_PROPERTY_ACCESSOR(Properties::Data, Properties::Data, Data, data)
 
 void Properties::setAnimatedTransform(const std::string &name, const AnimatedTransform *value, bool warnDuplicates) {
-    if (hasProperty(name)) {
-        AnimatedTransform **old = boost::get<AnimatedTransform *>(&((*m_elements)[name].data));
+    PropertyElement *element = m_elements->find(name);
+    if (element) {
+        AnimatedTransform **old = boost::get<AnimatedTransform *>(&element->data);
         if (old)
             (*old)->decRef();
         if (warnDuplicates)
             SLog(EWarn, "Property \"%s\" was specified multiple times!", name.c_str());
+    } else {
+        element = &m_elements->insert(internPropertyName(name, hashPropertyName(name)));
     }
-    (*m_elements)[name].data = (AnimatedTransform *) value;
-    (*m_elements)[name].queried = false;
+    element->data = (AnimatedTransform *) value;
+    element->queried = false;
     value->incRef();
 }
 
 ref<const AnimatedTransform> Properties::getAnimatedTransform(const std::string &name) const {
-    std::map<std::string, PropertyElement>::const_iterator it = m_elements->find(name);
-    if (it == m_elements->end())
+    const PropertyElement *element = m_elements->find(name);
+    if (!element)
         SLog(EError, "Property \"%s\" missing", name.c_str());
-    const AnimatedTransform * const * result1 = boost::get<AnimatedTransform *>(&it->second.data);
-    const Transform *result2 = boost::get<Transform>(&it->second.data);
+    const AnimatedTransform * const * result1 = boost::get<AnimatedTransform *>(&element->data);
+    const Transform *result2 = boost::get<Transform>(&element->data);
 
     if (!result1 && !result2)
         SLog(EError, "The property \"%s\" has the wrong type (expected <animation> or <transform>). The "
                 "complete property record is :\n%s", name.c_str(), toString().c_str());
-    it->second.queried = true;
+    element->queried = true;
 
     if (result1)
         return *result1;
@@ -111,17 +305,17 @@ ref<const AnimatedTransform> Properties::getAnimatedTransform(const std::string
 }
 
 ref<const AnimatedTransform> Properties::getAnimatedTransform(const std::string &name, const AnimatedTransform *defVal) const {
-    std::map<std::string, PropertyElement>::const_iterator it = m_elements->find(name);
-    if (it == m_elements->end())
+    const PropertyElement *element = m_elements->find(name);
+    if (!element)
         return defVal;
-    AnimatedTransform * const * result1 = boost::get<AnimatedTransform *>(&it->second.data);
-    const Transform *result2 = boost::get<Transform>(&it->second.data);
+    AnimatedTransform * const * result1 = boost::get<AnimatedTransform *>(&element->data);
+    const Transform *result2 = boost::get<Transform>(&element->data);
 
     if (!result1 && !result2)
         SLog(EError, "The property \"%s\" has the wrong type (expected <animation> or <transform>). The "
                 "complete property record is :\n%s", name.c_str(), toString().c_str());
 
-    it->second.queried = true;
+    element->queried = true;
 
     if (result1)
         return *result1;
@@ -130,17 +324,17 @@ ref<const AnimatedTransform> Properties::getAnimatedTransform(const std::string
 }
 
 ref<const AnimatedTransform> Properties::getAnimatedTransform(const std::string &name, const Transform &defVal) const {
-    std::map<std::string, PropertyElement>::const_iterator it = m_elements->find(name);
-    if (it == m_elements->end())
+    const PropertyElement *element = m_elements->find(name);
+    if (!element)
         return new AnimatedTransform(defVal);
 
-    AnimatedTransform * const * result1 = boost::get<AnimatedTransform *>(&it->second.data);
-    const Transform *result2 = boost::get<Transform>(&it->second.data);
+    AnimatedTransform * const * result1 = boost::get<AnimatedTransform *>(&element->data);
+    const Transform *result2 = boost::get<Transform>(&element->data);
 
     if (!result1 && !result2)
         SLog(EError, "The property \"%s\" has the wrong type (expected <animation> or <transform>). The "
                 "complete property record is :\n%s", name.c_str(), toString().c_str());
-    it->second.queried = true;
+    element->queried = true;
 
     if (result1)
         return *result1;
@@ -203,30 +397,30 @@ namespace {
 
 Properties::Properties()
 : m_id("unnamed") {
-    m_elements = new std::map<std::string, PropertyElement>();
+    m_elements = new PropertyStorage();
 }
 
 Properties::Properties(const std::string &pluginName)
 : m_pluginName(pluginName), m_id("unnamed") {
-    m_elements = new std::map<std::string, PropertyElement>();
+    m_elements = new PropertyStorage();
 }
 
 Properties::Properties(const Properties &props)
 : m_pluginName(props.m_pluginName), m_id(props.m_id) {
-    m_elements = new std::map<std::string, PropertyElement>(*props.m_elements);
+    m_elements = new PropertyStorage(*props.m_elements);
 
-    for (std::map<std::string, PropertyElement>::iterator it = m_elements->begin();
+    for (PropertyStorage::iterator it = m_elements->begin();
             it != m_elements->end(); ++it) {
-        AnimatedTransform **trafo = boost::get<AnimatedTransform *>(&(*it).second.data);
+        AnimatedTransform **trafo = boost::get<AnimatedTransform *>(&it->element.data);
         if (trafo)
             (*trafo)->incRef();
     }
 }
 
 Properties::~Properties() {
-    for (std::map<std::string, PropertyElement>::iterator it = m_elements->begin();
+    for (PropertyStorage::iterator it = m_elements->begin();
             it != m_elements->end(); ++it) {
-        AnimatedTransform **trafo = boost::get<AnimatedTransform *>(&(*it).second.data);
+        AnimatedTransform **trafo = boost::get<AnimatedTransform *>(&it->element.data);
         if (trafo)
             (*trafo)->decRef();
     }
@@ -235,9 +429,9 @@ Properties::~Properties() {
 }
 
 void Properties::operator=(const Properties &props) {
-    for (std::map<std::string, PropertyElement>::iterator it = m_elements->begin();
+    for (PropertyStorage::iterator it = m_elements->begin();
             it != m_elements->end(); ++it) {
-        AnimatedTransform **trafo = boost::get<AnimatedTransform *>(&(*it).second.data);
+        AnimatedTransform **trafo = boost::get<AnimatedTransform *>(&it->element.data);
         if (trafo)
             (*trafo)->decRef();
     }
@@ -246,70 +440,70 @@ void Properties::operator=(const Properties &props) {
     m_id = props.m_id;
     *m_elements = *props.m_elements;
 
-    for (std::map<std::string, PropertyElement>::iterator it = m_elements->begin();
+    for (PropertyStorage::iterator it = m_elements->begin();
             it != m_elements->end(); ++it) {
-        AnimatedTransform **trafo = boost::get<AnimatedTransform *>(&(*it).second.data);
+        AnimatedTransform **trafo = boost::get<AnimatedTransform *>(&it->element.data);
         if (trafo)
             (*trafo)->incRef();
     }
 }
 
 bool Properties::hasProperty(const std::string &name) const {
-    return m_elements->find(name) != m_elements->end();
+    return m_elements->find(name) != NULL;
 }
 
 bool Properties::removeProperty(const std::string &name) {
-    std::map<std::string, PropertyElement>::iterator it = m_elements->find(name);
-    if (it == m_elements->end())
+    PropertyElement *element = m_elements->find(name);
+    if (!element)
         return false;
-    AnimatedTransform **trafo = boost::get<AnimatedTransform *>(&(*it).second.data);
+    AnimatedTransform **trafo = boost::get<AnimatedTransform *>(&element->data);
     if (trafo)
         (*trafo)->decRef();
-    m_elements->erase(it);
+    m_elements->erase(element);
     return true;
 }
 
 std::vector<std::string> Properties::getUnqueried() const {
-    std::map<std::string, PropertyElement>::const_iterator it = m_elements->begin();
+    std::vector<const PropertyStorage::Entry *> entries = m_elements->getSorted();
     std::vector<std::string> result;
 
-    for (; it != m_elements->end(); ++it) {
-        if (!(*it).second.queried)
-            result.push_back((*it).first);
+    for (size_t i=0; i<entries.size(); ++i) {
+        if (!entries[i]->element.queried)
+            result.push_back(entries[i]->key->name);
     }
 
     return result;
 }
 
 Properties::EPropertyType Properties::getType(const std::string &name) const {
-    std::map<std::string, PropertyElement>::const_iterator it = m_elements->find(name);
-    if (it == m_elements->end())
+    const PropertyElement *element = m_elements->find(name);
+    if (!element)
         SLog(EError, "Property \"%s\" has not been specified!", name.c_str());
 
-    return boost::apply_visitor(TypeVisitor(), it->second.data);
+    return boost::apply_visitor(TypeVisitor(), element->data);
 }
 
 std::string Properties::getAsString(const std::string &name, const std::string &defVal) const {
-    if (m_elements->find(name) == m_elements->end())
+    if (!m_elements->find(name))
         return defVal;
     return getAsString(name);
 }
 
 std::string Properties::getAsString(const std::string &name) const {
-    std::map<std::string, PropertyElement>::const_iterator it = m_elements->find(name);
-    if (it == m_elements->end())
+    const PropertyElement *element = m_elements->find(name);
+    if (!element)
         SLog(EError, "Property \"%s\" has not been specified!", name.c_str());
 
     std::ostringstream oss;
     StringVisitor strVisitor(oss, false);
-    boost::apply_visitor(strVisitor, it->second.data);
-    it->second.queried = true;
+    boost::apply_visitor(strVisitor, element->data);
+    element->queried = true;
 
     return oss.str();
 }
 
 std::string Properties::toString() const {
-    std::map<std::string, PropertyElement>::const_iterator it = m_elements->begin();
+    std::vector<const PropertyStorage::Entry *> entries = m_elements->getSorted();
     std::ostringstream oss;
     StringVisitor strVisitor(oss, true);
 
@@ -317,11 +511,11 @@ std::string Properties::toString() const {
         << "  pluginName = \"" << m_pluginName << "\"," << endl
         << "  id = \"" << m_id << "\"," << endl
         << "  elements = {" << endl;
-    while (it != m_elements->end()) {
-        oss << "    \"" << (*it).first << "\" -> ";
-        const ElementData &data = (*it).second.data;
+    for (size_t i=0; i<entries.size(); ++i) {
+        oss << "    \"" << entries[i]->key->name << "\" -> ";
+        const ElementData &data = entries[i]->element.data;
         boost::apply_visitor(strVisitor, data);
-        if (++it != m_elements->end())
+        if (i + 1 < entries.size())
             oss << ",";
         oss << endl;
     }
@@ -331,43 +525,43 @@ std::string Properties::toString() const {
 }
 
 void Properties::markQueried(const std::string &name) const {
-    std::map<std::string, PropertyElement>::const_iterator it = m_elements->find(name);
-    if (it == m_elements->end())
+    const PropertyElement *element = m_elements->find(name);
+    if (!element)
         return;
-    it->second.queried = true;
+    element->queried = true;
 }
 
 bool Properties::wasQueried(const std::string &name) const {
-    std::map<std::string, PropertyElement>::const_iterator it = m_elements->find(name);
-    if (it == m_elements->end())
+    const PropertyElement *element = m_elements->find(name);
+    if (!element)
         SLog(EError, "Could not find parameter \"%s\"!", name.c_str());
-    return it->second.queried;
+    return element->queried;
 }
 
 void Properties::putPropertyNames(std::vector<std::string> &results) const {
-    for (std::map<std::string, PropertyElement>::const_iterator it = m_elements->begin();
-            it != m_elements->end(); ++it)
-        results.push_back((*it).first);
+    std::vector<const PropertyStorage::Entry *> entries = m_elements->getSorted();
+    for (size_t i=0; i<entries.size(); ++i)
+        results.push_back(entries[i]->key->name);
 }
 
 void Properties::copyAttribute(const Properties &properties,
     const std::string &sourceName, const std::string &targetName) {
-    std::map<std::string, PropertyElement>::const_iterator it = properties.m_elements->find(sourceName);
-    if (it == properties.m_elements->end())
+    const PropertyElement *element = properties.m_elements->find(sourceName);
+    if (!element)
         SLog(EError, "copyAttribute(): Could not find parameter \"%s\"!", sourceName.c_str());
-    m_elements->operator[](targetName) = it->second;
+    (*m_elements)[targetName] = *element;
 }
 
 bool Properties::operator==(const Properties &p) const {
     if (m_pluginName != p.m_pluginName || m_id != p.m_id || m_elements->size() != p.m_elements->size())
         return false;
 
-    std::map<std::string, PropertyElement>::const_iterator it = m_elements->begin();
-    for (; it != m_elements->end(); ++it) {
-        const PropertyElement &first = it->second;
-        const PropertyElement &second = (*p.m_elements)[it->first];
+    for (PropertyStorage::const_iterator it = m_elements->begin();
+            it != m_elements->end(); ++it) {
+        const PropertyElement &first = it->element;
+        const PropertyElement *second = p.m_elements->find(it->key);
 
-        if (!boost::apply_visitor(EqualityVisitor(&first.data), second.data))
+        if (!second || !boost::apply_visitor(EqualityVisitor(&first.data), second->data))
             return false;
     }
 
@@ -375,9 +569,9 @@ bool Properties::operator==(const Properties &p) const {
 }
 
 void Properties::merge(const Properties &p) {
-    std::map<std::string, PropertyElement>::const_iterator it = p.m_elements->begin();
-    for (; it != p.m_elements->end(); ++it)
-        (*m_elements)[it->first] = it->second;
+    for (PropertyStorage::const_iterator it = p.m_elements->begin();
+            it != p.m_elements->end(); ++it)
+        (*m_elements)[it->key] = it->element;
 }
 
 ConfigurableObject::ConfigurableObject(Stream *stream, InstanceManager *manager)
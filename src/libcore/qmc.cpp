@@ -166,28 +166,88 @@ Float radicalInverseIncremental(int base, Float x) {
         inverse = factor * ((Float) value + radical * perm[0] / (1 - radical)); \
     }
 
+/* Radical inverse: table-driven versions for small bases. The digit
+   reversal of several digits at a time is looked up in a table, which
+   shortens the chain of dependent divisions accordingly */
+
+namespace {
+    /// Largest table that will be used for the blocks of digits
+    const int RINV_TABLE_LIMIT = 4096;
+
+    constexpr int rinvTableDigits(int base, int digits = 1, int size = 1) {
+        return size * base > RINV_TABLE_LIMIT ? digits - 1
+            : rinvTableDigits(base, digits + 1, size * base);
+    }
+
+    constexpr int rinvTablePower(int base, int exponent) {
+        return exponent == 0 ? 1 : base * rinvTablePower(base, exponent - 1);
+    }
+
+    /// Reversed digits of all numbers with \c digits digits in base \c base
+    template <int base> struct RadicalInverseTable {
+        static const int digits = rinvTableDigits(base);
+        static const int size = rinvTablePower(base, digits);
+
+        uint16_t reversed[size];
+
+        RadicalInverseTable() {
+            for (int i=0; i<size; ++i) {
+                int value = 0, index = i;
+                for (int j=0; j<digits; ++j) {
+                    value = value * base + index % base;
+                    index /= base;
+                }
+                reversed[i] = (uint16_t) value;
+            }
+        }
+
+        static const RadicalInverseTable instance;
+    };
+
+    template <int base> const RadicalInverseTable<base>
+        RadicalInverseTable<base>::instance;
+
+    template <int base> inline Float radicalInverseTable(uint64_t index) {
+        typedef RadicalInverseTable<base> Table;
+        const Float radical = (Float) 1 / (Float) Table::size;
+        uint64_t value = 0;
+        Float factor = 1.0f;
+        while (index) {
+            uint64_t next  = index / Table::size;
+            uint64_t block = index - next * Table::size;
+            value = value * Table::size + Table::instance.reversed[block];
+            factor *= radical;
+            index = next;
+        }
+        return (Float) value * factor;
+    }
+}
+
+#define TABLE_RINV(base) \
+        inverse = radicalInverseTable<base>(index)
+
 Float radicalInverseFast(uint16_t baseIndex, uint64_t index) {
     Float inverse = 0.0f;
 
     switch (baseIndex) {
         case 0: RINV(2); break;
-        case 1: RINV(3); break;
-        case 2: RINV(5); break;
-        case 3: RINV(7); break;
-        case 4: RINV(11); break;
-        case 5: RINV(13); break;
-        case 6: RINV(17); break;
-        case 7: RINV(19); break;
-        case 8: RINV(23); break;
-        case 9: RINV(29); break;
-        case 10: RINV(31); break;
-        case 11: RINV(37); break;
-        case 12: RINV(41); break;
-        case 13: RINV(43); break;
-        case 14: RINV(47); break;
-        case 15: RINV(53); break;
-        case 16: RINV(59); break;
-        case 17: RINV(61); break;
+        case 1: TABLE_RINV(3); break;
+        case 2: TABLE_RINV(5); break;
+        case 3: TABLE_RINV(7); break;
+        case 4: TABLE_RINV(11); break;
+        case 5: TABLE_RINV(13); break;
+        case 6: TABLE_RINV(17); break;
+        case 7: TABLE_RINV(19); break;
+        case 8: TABLE_RINV(23); break;
+        case 9: TABLE_RINV(29); break;
+        case 10: TABLE_RINV(31); break;
+        case 11: TABLE_RINV(37); break;
+        case 12: TABLE_RINV(41); break;
+        case 13: TABLE_RINV(43); break;
+        case 14: TABLE_RINV(47); break;
+        case 15: TABLE_RINV(53); break;
+        case 16: TABLE_RINV(59); break;
+        case 17: TABLE_RINV(61); break;
         case 18: RINV(67); break;
         case 19: RINV(71); break;
         case 20: RINV(73); break;
@@ -2230,4 +2290,91 @@ Float scrambledRadicalInverseFast(uint16_t baseIndex, uint64_t index, uint16_t *
     return std::min(inverse, ONE_MINUS_EPS);
 }
 
+/* Radical inverse: batched versions. The digits of the index are kept
+   around and the stride is added digit by digit, so that consecutive
+   entries only require an update of the digits that actually change */
+
+static void radicalInverseArrayImpl(uint16_t baseIndex, uint64_t offset,
+        uint64_t stride, uint16_t *perm, Float *dest, size_t count,
+        size_t destStride) {
+    if (count == 0)
+        return;
+    if (baseIndex >= primeTableSize)
+        SLog(EError, "radicalInverseArray(): base index %i is out of range!",
+            (int) baseIndex);
+
+    const uint64_t base = (uint64_t) primeTable[baseIndex];
+    const uint64_t last = offset + stride * (count - 1);
+
+    /* Number of digits that suffice for all indices */
+    int digitCount = 0;
+    uint64_t scale = 1;
+    while (scale <= last) {
+        if (scale > std::numeric_limits<uint64_t>::max() / base) {
+            /* Too many digits -- fall back to the regular implementation */
+            for (size_t i=0; i<count; ++i, dest += destStride) {
+                uint64_t index = offset + stride * i;
+                *dest = perm ? scrambledRadicalInverseFast(baseIndex, index, perm)
+                    : radicalInverseFast(baseIndex, index);
+            }
+            return;
+        }
+        scale *= base;
+        digitCount++;
+    }
+
+    uint64_t digits[64], strideDigits[64], weights[64];
+    uint64_t value = 0, weight = scale;
+    int strideDigitCount = 0;
+    for (int i=0; i<digitCount; ++i) {
+        weight /= base;
+        weights[i] = weight;
+        digits[i] = offset % base;
+        strideDigits[i] = stride % base;
+        offset /= base;
+        stride /= base;
+        if (strideDigits[i] != 0)
+            strideDigitCount = i + 1;
+        value += (perm ? perm[digits[i]] : digits[i]) * weight;
+    }
+
+    const Float radical = (Float) 1 / (Float) base;
+    Float factor = 1.0f;
+    for (int i=0; i<digitCount; ++i)
+        factor *= radical;
+    const Float tail = perm ? radical * perm[0] / (1 - radical) : (Float) 0;
+
+    for (size_t i=0; i<count; ++i, dest += destStride) {
+        if (i > 0) {
+            /* Add the stride, unsigned wrap-around takes care of the sign */
+            uint64_t carry = 0;
+            for (int j=0; j<digitCount; ++j) {
+                if (j >= strideDigitCount && carry == 0)
+                    break;
+                uint64_t digit = digits[j] + strideDigits[j] + carry;
+                carry = digit >= base ? 1 : 0;
+                if (carry)
+                    digit -= base;
+                if (perm)
+                    value += ((uint64_t) perm[digit] - (uint64_t) perm[digits[j]]) * weights[j];
+                else
+                    value += (digit - digits[j]) * weights[j];
+                digits[j] = digit;
+            }
+        }
+        *dest = std::min(factor * ((Float) value + tail), ONE_MINUS_EPS);
+    }
+}
+
+void radicalInverseArray(uint16_t baseIndex, uint64_t offset,
+        uint64_t stride, Float *dest, size_t count, size_t destStride) {
+    radicalInverseArrayImpl(baseIndex, offset, stride, NULL, dest, count, destStride);
+}
+
+void scrambledRadicalInverseArray(uint16_t baseIndex, uint64_t offset,
+        uint64_t stride, uint16_t *perm, Float *dest, size_t count,
+        size_t destStride) {
+    radicalInverseArrayImpl(baseIndex, offset, stride, perm, dest, count, destStride);
+}
+
 MTS_NAMESPACE_END
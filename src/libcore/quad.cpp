@@ -1,6 +1,10 @@
 #include <mitsuba/core/quad.h>
 #include <boost/bind.hpp>
 
+#if defined(MTS_OPENMP)
+# include <omp.h>
+#endif
+
 MTS_NAMESPACE_BEGIN
 
 float legendreP(int l, float x_) {
@@ -322,32 +326,133 @@ Float GaussLobattoIntegrator::integrate(
     return result;
 }
 
-Float GaussLobattoIntegrator::calculateAbsTolerance(
-        const boost::function<Float (Float)>& f, Float a, Float b, size_t &evals) const {
+Float GaussLobattoIntegrator::integrateVectorized(
+        const VectorizedIntegrand &f, Float a, Float b, size_t *_evals) const {
+    Float factor = 1;
+    if (a == b) {
+        if (_evals)
+            *_evals = 0;
+        return 0;
+    } else if (b < a) {
+        std::swap(a, b);
+        factor = -1;
+    }
+
+    /* The tolerance estimate also provides the values at the end points */
+    Float nodes[13], y[13];
+    getToleranceNodes(a, b, nodes);
+    f(13, nodes, y);
+    size_t evals = 13;
+    const Float acc = calculateAbsTolerance(y, (b-a)/2);
+
+    struct Interval {
+        Float a, b, fa, fb;
+    };
+
+    std::vector<Interval> current, next;
+    std::vector<Float> in, out;
+    Interval initial = { a, b, y[0], y[12] };
+    current.push_back(initial);
+    Float result = 0;
+    bool exhausted = false;
+
+    while (!current.empty()) {
+        size_t nIntervals = current.size();
+        in.resize(5 * nIntervals);
+        out.resize(5 * nIntervals);
+        for (size_t i=0; i<nIntervals; ++i) {
+            const Interval &iv = current[i];
+            const Float h = (iv.b-iv.a)/2, m = (iv.a+iv.b)/2;
+            in[5*i+0] = m-m_alpha*h;
+            in[5*i+1] = m-m_beta*h;
+            in[5*i+2] = m;
+            in[5*i+3] = m+m_beta*h;
+            in[5*i+4] = m+m_alpha*h;
+        }
+        f(5 * nIntervals, &in[0], &out[0]);
+        evals += 5 * nIntervals;
+
+        next.clear();
+        for (size_t i=0; i<nIntervals; ++i) {
+            const Interval &iv = current[i];
+            const Float h = (iv.b-iv.a)/2;
+            const Float *x = &in[5*i], *fx = &out[5*i];
+
+            const Float integral2=(h/6)*(iv.fa+iv.fb+5*(fx[1]+fx[3]));
+            const Float integral1=(h/1470)*(77*(iv.fa+iv.fb)
+                + 432*(fx[0]+fx[4]) + 625*(fx[1]+fx[3]) + 672*fx[2]);
+
+            /* Don't schedule more refinements than the budget allows */
+            if (evals + 5 * (next.size() + 6) > m_maxEvals) {
+                exhausted = true;
+                result += integral1;
+                continue;
+            }
+
+            Float dist = acc + (integral1-integral2);
+            if (dist==acc || x[0]<=iv.a || iv.b<=x[4]) {
+                result += integral1;
+            } else {
+                const Float bounds[7] = { iv.a, x[0], x[1], x[2], x[3], x[4], iv.b };
+                const Float values[7] = { iv.fa, fx[0], fx[1], fx[2], fx[3], fx[4], iv.fb };
+                for (int j=0; j<6; ++j) {
+                    Interval child = { bounds[j], bounds[j+1], values[j], values[j+1] };
+                    next.push_back(child);
+                }
+            }
+        }
+        current.swap(next);
+    }
+
+    if (exhausted && m_warn)
+        SLog(EWarn, "GaussLobattoIntegrator: Maximum number of evaluations reached!");
+    if (_evals)
+        *_evals = evals;
+    return factor * result;
+}
+
+void GaussLobattoIntegrator::getToleranceNodes(Float a, Float b, Float *nodes) const {
     const Float m = (a+b)/2;
     const Float h = (b-a)/2;
-    const Float y1 = f(a);
-    const Float y3 = f(m-m_alpha*h);
-    const Float y5 = f(m-m_beta*h);
-    const Float y7 = f(m);
-    const Float y9 = f(m+m_beta*h);
-    const Float y11= f(m+m_alpha*h);
-    const Float y13= f(b);
-
-    Float acc = h*((Float) 0.0158271919734801831*(y1+y13)
-                 + (Float) 0.0942738402188500455*(f(m-m_x1*h)+f(m+m_x1*h))
-                 + (Float) 0.1550719873365853963*(y3+y11)
-                 + (Float) 0.1888215739601824544*(f(m-m_x2*h)+ f(m+m_x2*h))
-                 + (Float) 0.1997734052268585268*(y5+y9)
-                 + (Float) 0.2249264653333395270*(f(m-m_x3*h)+f(m+m_x3*h))
-                 + (Float) 0.2426110719014077338*y7);
+    nodes[0]  = a;
+    nodes[1]  = m-m_x1*h;
+    nodes[2]  = m-m_alpha*h;
+    nodes[3]  = m-m_x2*h;
+    nodes[4]  = m-m_beta*h;
+    nodes[5]  = m-m_x3*h;
+    nodes[6]  = m;
+    nodes[7]  = m+m_x3*h;
+    nodes[8]  = m+m_beta*h;
+    nodes[9]  = m+m_x2*h;
+    nodes[10] = m+m_alpha*h;
+    nodes[11] = m+m_x1*h;
+    nodes[12] = b;
+}
+
+Float GaussLobattoIntegrator::calculateAbsTolerance(
+        const boost::function<Float (Float)>& f, Float a, Float b, size_t &evals) const {
+    Float nodes[13], y[13];
+    getToleranceNodes(a, b, nodes);
+    for (int i=0; i<13; ++i)
+        y[i] = f(nodes[i]);
     evals += 13;
+    return calculateAbsTolerance(y, (b-a)/2);
+}
+
+Float GaussLobattoIntegrator::calculateAbsTolerance(const Float *y, Float h) const {
+    Float acc = h*((Float) 0.0158271919734801831*(y[0]+y[12])
+                 + (Float) 0.0942738402188500455*(y[1]+y[11])
+                 + (Float) 0.1550719873365853963*(y[2]+y[10])
+                 + (Float) 0.1888215739601824544*(y[3]+y[9])
+                 + (Float) 0.1997734052268585268*(y[4]+y[8])
+                 + (Float) 0.2249264653333395270*(y[5]+y[7])
+                 + (Float) 0.2426110719014077338*y[6]);
 
     Float r = 1.0;
     if (m_useConvergenceEstimate) {
-        const Float integral2 = (h/6)*(y1+y13+5*(y5+y9));
+        const Float integral2 = (h/6)*(y[0]+y[12]+5*(y[4]+y[8]));
         const Float integral1 = (h/1470)*
-            (77*(y1+y13) + 432*(y3+y11) + 625*(y5+y9) + 672*y7);
+            (77*(y[0]+y[12]) + 432*(y[2]+y[10]) + 625*(y[4]+y[8]) + 672*y[6]);
 
         if (std::abs(integral2-acc) != 0.0)
             r = std::abs(integral1-acc)/std::abs(integral2-acc);
@@ -1382,38 +1487,91 @@ static NDIntegrator::EResult integrate(unsigned fdim, const VectorizedIntegrand
 class VectorizationAdapter {
 public:
     VectorizationAdapter(const NDIntegrator::Integrand &integrand, size_t fdim,
-            size_t dim) : m_integrand(integrand), m_fdim(fdim), m_dim(dim) {
-        m_temp = new Float[m_fdim];
-    }
+            size_t dim) : m_integrand(integrand), m_fdim(fdim), m_dim(dim) { }
 
-    ~VectorizationAdapter() {
-        delete[] m_temp;
-    }
-
-    void f(size_t nPt, const Float *in, Float *out) {
+    void f(size_t nPt, const Float *in, Float *out) const {
+        /* Local temporary: this may be invoked from several threads */
+        Float *temp = (Float *) alloca(sizeof(Float) * m_fdim);
         for (size_t i = 0; i < nPt; ++i) {
-            m_integrand(in + i*m_dim, m_temp);
+            m_integrand(in + i*m_dim, temp);
             for (size_t k = 0; k < m_fdim; ++k)
-                out[k*nPt + i] = m_temp[k];
+                out[k*nPt + i] = temp[k];
         }
     }
 private:
     const NDIntegrator::Integrand &m_integrand;
     size_t m_fdim, m_dim;
-    Float *m_temp;
+};
+
+/// Minimum number of abscissae per thread in parallel mode
+#define QUAD_MIN_POINTS_PER_THREAD 8
+
+/**
+ * Splits the batches of abscissae produced by the cubature code into
+ * contiguous chunks that are evaluated on separate threads. The results
+ * of a chunk are stored with a stride equal to its own size, hence they
+ * need to be scattered when there is more than one integrand.
+ */
+class ParallelizationAdapter {
+public:
+    ParallelizationAdapter(const VectorizedIntegrand &integrand, size_t fdim,
+            size_t dim) : m_integrand(integrand), m_fdim(fdim), m_dim(dim) { }
+
+    void f(size_t nPt, const Float *in, Float *out) const {
+        int nChunks = 1;
+        #if defined(MTS_OPENMP)
+            if (!omp_in_parallel())
+                nChunks = (int) std::min((size_t) mts_omp_get_max_threads(),
+                    nPt / QUAD_MIN_POINTS_PER_THREAD);
+        #endif
+        if (nChunks <= 1) {
+            m_integrand(nPt, in, out);
+            return;
+        }
+
+        std::vector<Float> temp(m_fdim > 1 ? nPt * m_fdim : 0);
+
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for schedule(static, 1) num_threads(nChunks)
+        #endif
+        for (int c=0; c<nChunks; ++c) {
+            size_t start = nPt * c / nChunks, end = nPt * (c+1) / nChunks;
+            if (m_fdim == 1)
+                m_integrand(end-start, in + start*m_dim, out + start);
+            else
+                m_integrand(end-start, in + start*m_dim, &temp[start*m_fdim]);
+        }
+
+        if (m_fdim > 1) {
+            for (int c=0; c<nChunks; ++c) {
+                size_t start = nPt * c / nChunks, end = nPt * (c+1) / nChunks;
+                const Float *chunk = &temp[start*m_fdim];
+                for (size_t k = 0; k < m_fdim; ++k)
+                    for (size_t i = start; i < end; ++i)
+                        out[k*nPt + i] = chunk[k*(end-start) + (i-start)];
+            }
+        }
+    }
+private:
+    const VectorizedIntegrand &m_integrand;
+    size_t m_fdim, m_dim;
 };
 
 NDIntegrator::NDIntegrator(size_t fDim, size_t dim,
             size_t maxEvals, Float absError, Float relError)
  : m_fdim(fDim), m_dim(dim), m_maxEvals(maxEvals), m_absError(absError),
-  m_relError(relError) { }
+  m_relError(relError), m_parallel(false) { }
 
 NDIntegrator::EResult NDIntegrator::integrate(const Integrand &f, const Float *min,
         const Float *max, Float *result, Float *error, size_t *_evals) const {
     VectorizationAdapter adapter(f, m_fdim, m_dim);
+    VectorizedIntegrand vf = boost::bind(
+        &VectorizationAdapter::f, &adapter, _1, _2, _3);
+    if (m_parallel)
+        return integrateVectorized(vf, min, max, result, error, _evals);
+
     size_t evals = 0;
-    EResult retval = mitsuba::integrate((unsigned int) m_fdim, boost::bind(
-        &VectorizationAdapter::f, &adapter, _1, _2, _3), (unsigned int) m_dim,
+    EResult retval = mitsuba::integrate((unsigned int) m_fdim, vf, (unsigned int) m_dim,
         min, max, m_maxEvals, m_absError, m_relError, result, error, evals, false);
     if (_evals)
         *_evals = evals;
@@ -1423,8 +1581,16 @@ NDIntegrator::EResult NDIntegrator::integrate(const Integrand &f, const Float *m
 NDIntegrator::EResult NDIntegrator::integrateVectorized(const VectorizedIntegrand &f, const Float *min,
         const Float *max, Float *result, Float *error, size_t *_evals) const {
     size_t evals = 0;
-    EResult retval = mitsuba::integrate((unsigned int) m_fdim, f, (unsigned int) m_dim,
-        min, max, m_maxEvals, m_absError, m_relError, result, error, evals, true);
+    EResult retval;
+    if (m_parallel) {
+        ParallelizationAdapter adapter(f, m_fdim, m_dim);
+        retval = mitsuba::integrate((unsigned int) m_fdim, boost::bind(
+            &ParallelizationAdapter::f, &adapter, _1, _2, _3), (unsigned int) m_dim,
+            min, max, m_maxEvals, m_absError, m_relError, result, error, evals, true);
+    } else {
+        retval = mitsuba::integrate((unsigned int) m_fdim, f, (unsigned int) m_dim,
+            min, max, m_maxEvals, m_absError, m_relError, result, error, evals, true);
+    }
     if (_evals)
         *_evals = evals;
     return retval;
@@ -296,6 +296,25 @@ struct Random::State {
         return r;
     }
 
+    /**
+    * This function returns a pointer to the next 64-bit pseudorandom
+    * numbers of the internal state array and skips over them. At most
+    * \c count values are returned, but fewer when the end of the state
+    * array is reached; \c count is updated accordingly.
+    * The same restrictions as for gen_rand64 apply.
+    */
+    FINLINE const uint64_t *gen_rand64_block(size_t &count) {
+        if (idx >= N32) {
+            gen_rand_all();
+            idx = 0;
+        }
+
+        count = std::min(count, (size_t) (N32 - idx) / 2);
+        const uint64_t *r = &psfmt64[idx / 2];
+        idx += 2 * (int) count;
+        return r;
+    }
+
 private:
 
     /**
@@ -639,6 +658,68 @@ Float Random::nextFloat() {
 }
 #endif
 
+#if defined(DOUBLE_PRECISION)
+void Random::fillFloat(Float *dest, size_t count) {
+    while (count > 0) {
+        size_t n = count;
+        const uint64_t *src = mt->gen_rand64_block(n);
+        union {
+            uint64_t u;
+            double d;
+        } x;
+        for (size_t i=0; i<n; ++i) {
+            x.u = (src[i] >> 12) | 0x3ff0000000000000ULL;
+            dest[i] = x.d - 1.0;
+        }
+
+        dest += n;
+        count -= n;
+    }
+}
+
+#else
+
+void Random::fillFloat(Float *dest, size_t count) {
+    while (count > 0) {
+        /* Convert as much of the current block as needed; see
+           nextFloat() for the mapping to [0, 1) */
+        size_t n = count, i = 0;
+        const uint64_t *src = mt->gen_rand64_block(n);
+
+#if MTS_SFMT_SSE
+        const __m128i mantissa = _mm_set1_epi32(0x3f800000);
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; i + 4 <= n; i += 4) {
+            /* Gather the lower halves of four 64-bit values */
+            __m128 lo = _mm_shuffle_ps(
+                _mm_castsi128_ps(_mm_loadu_si128((const __m128i *) (src + i))),
+                _mm_castsi128_ps(_mm_loadu_si128((const __m128i *) (src + i + 2))),
+                _MM_SHUFFLE(2, 0, 2, 0));
+            __m128i bits = _mm_or_si128(_mm_srli_epi32(
+                _mm_castps_si128(lo), 9), mantissa);
+            _mm_storeu_ps(dest + i, _mm_sub_ps(_mm_castsi128_ps(bits), one));
+        }
+#endif
+
+        union {
+            uint32_t u;
+            float f;
+        } x;
+        for (; i<n; ++i) {
+            x.u = ((src[i] & 0xFFFFFFFF) >> 9) | 0x3f800000UL;
+            dest[i] = x.f - 1.0f;
+        }
+
+        dest += n;
+        count -= n;
+    }
+}
+#endif
+
+void Random::fillPoint2(Point2 *dest, size_t count) {
+    fillFloat(reinterpret_cast<Float *>(dest), 2 * count);
+}
+
 Float Random::nextStandardNormal() {
     /* Marsaglia polar method for generating two standard
        normal variates. One is subsequently thrown away */
@@ -19,9 +19,14 @@
 #include <mitsuba/core/sched.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/mstream.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/atomic.h>
 
 #include <boost/thread/thread.hpp>
 
+/// Number of work units that a worker may run ahead of its fair share before switching processes
+#define MTS_SCHED_QUANTUM 8
+
 MTS_NAMESPACE_BEGIN
 
 SerializableObject *WorkProcessor::getResource(const std::string &name) {
@@ -45,6 +50,20 @@ bool ParallelProcess::isLocal() const {
     return false;
 }
 
+bool ParallelProcess::isTelemetryEnabled() const {
+    return false;
+}
+
+void ParallelProcess::recordTelemetry(const WorkResult *,
+        const WorkUnitTelemetry &) {
+}
+
+void ParallelProcess::setShareWeight(Float weight) {
+    if (!(weight > 0))
+        Log(EError, "The fair-share weight of a parallel process must be positive!");
+    m_shareWeight = weight;
+}
+
 /* ==================================================================== */
 /*                              Scheduler                               */
 /* ==================================================================== */
@@ -56,12 +75,31 @@ Scheduler::Scheduler() {
     m_workAvailable = new ConditionVariable(m_mutex);
     m_resourceCounter = 0;
     m_processCounter = 0;
+    m_queuedWork = 0;
+    m_stealBatchSize = 4;
     m_running = false;
+    m_workStealing = false;
 }
 
 Scheduler::~Scheduler() {
     for (size_t i=0; i<m_workers.size(); ++i)
         m_workers[i]->decRef();
+    for (size_t i=0; i<m_workQueues.size(); ++i)
+        delete m_workQueues[i];
+}
+
+void Scheduler::setWorkStealing(bool enabled) {
+    LockGuard lock(m_mutex);
+    if (m_running)
+        Log(EError, "setWorkStealing(): the scheduler must not be running!");
+    m_workStealing = enabled;
+}
+
+void Scheduler::setStealBatchSize(int batchSize) {
+    LockGuard lock(m_mutex);
+    if (batchSize < 1)
+        Log(EError, "setStealBatchSize(): the batch size must be positive!");
+    m_stealBatchSize = batchSize;
 }
 
 void Scheduler::registerWorker(Worker *worker) {
@@ -229,6 +267,122 @@ const MemoryStream *Scheduler::getResourceStream(int id) {
     return rec->stream;
 }
 
+/* Content-defined chunking parameters (minimum, average and maximum size) */
+#define MTS_CHUNK_MIN_SIZE (256*1024)
+#define MTS_CHUNK_AVG_BITS 20
+#define MTS_CHUNK_MAX_SIZE (4*1024*1024)
+
+namespace {
+    inline uint64_t fmix64(uint64_t k) {
+        k ^= k >> 33; k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33; k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    inline uint64_t rotl64(uint64_t x, int r) {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    /// Random table of the gear rolling hash used to find chunk boundaries
+    struct GearTable {
+        uint64_t entries[256];
+        GearTable() {
+            for (int i=0; i<256; ++i)
+                entries[i] = fmix64((uint64_t) i + 0x9e3779b97f4a7c15ULL);
+        }
+    };
+
+    static GearTable __gearTable;
+};
+
+void ResourceChunk::computeHash(const uint8_t *data, size_t size, uint64_t hash[2]) {
+    /* MurmurHash3 (x64, 128 bit variant) */
+    const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 0, h2 = 0;
+    size_t nblocks = size / 16;
+
+    for (size_t i=0; i<nblocks; ++i) {
+        uint64_t k1, k2;
+        memcpy(&k1, data + 16*i, sizeof(uint64_t));
+        memcpy(&k2, data + 16*i + 8, sizeof(uint64_t));
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+    }
+
+    const uint8_t *tail = data + nblocks * 16;
+    uint64_t k1 = 0, k2 = 0;
+    switch (size & 15) {
+        case 15: k2 ^= ((uint64_t) tail[14]) << 48;
+        case 14: k2 ^= ((uint64_t) tail[13]) << 40;
+        case 13: k2 ^= ((uint64_t) tail[12]) << 32;
+        case 12: k2 ^= ((uint64_t) tail[11]) << 24;
+        case 11: k2 ^= ((uint64_t) tail[10]) << 16;
+        case 10: k2 ^= ((uint64_t) tail[ 9]) << 8;
+        case  9: k2 ^= ((uint64_t) tail[ 8]);
+                 k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        case  8: k1 ^= ((uint64_t) tail[ 7]) << 56;
+        case  7: k1 ^= ((uint64_t) tail[ 6]) << 48;
+        case  6: k1 ^= ((uint64_t) tail[ 5]) << 40;
+        case  5: k1 ^= ((uint64_t) tail[ 4]) << 32;
+        case  4: k1 ^= ((uint64_t) tail[ 3]) << 24;
+        case  3: k1 ^= ((uint64_t) tail[ 2]) << 16;
+        case  2: k1 ^= ((uint64_t) tail[ 1]) << 8;
+        case  1: k1 ^= ((uint64_t) tail[ 0]);
+                 k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    };
+
+    h1 ^= (uint64_t) size; h2 ^= (uint64_t) size;
+    h1 += h2; h2 += h1;
+    h1 = fmix64(h1); h2 = fmix64(h2);
+    h1 += h2; h2 += h1;
+    hash[0] = h1; hash[1] = h2;
+}
+
+const std::vector<ResourceChunk> &Scheduler::getResourceChunks(int id) {
+    const MemoryStream *stream = getResourceStream(id);
+
+    LockGuard lock(m_mutex);
+    ResourceRecord *rec = m_resources[id];
+    if (!rec->chunks.empty() || stream->getSize() == 0)
+        return rec->chunks;
+
+    /* Cut the stream wherever the top bits of a rolling hash of the
+       preceding 64 bytes are zero. The boundaries only depend on the local
+       content, hence an edit (e.g. a different camera) only affects
+       the chunks around it */
+    const uint8_t *data = stream->getData();
+    size_t size = stream->getSize(), start = 0;
+    while (start < size) {
+        size_t end = std::min(start + MTS_CHUNK_MAX_SIZE, size);
+        if (start + MTS_CHUNK_MIN_SIZE < end) {
+            uint64_t h = 0;
+            size_t pos = start + MTS_CHUNK_MIN_SIZE;
+            for (size_t i=pos-64; i<pos; ++i)
+                h = (h << 1) + __gearTable.entries[data[i]];
+            for (; pos < end; ++pos) {
+                h = (h << 1) + __gearTable.entries[data[pos]];
+                if ((h >> (64 - MTS_CHUNK_AVG_BITS)) == 0) {
+                    end = pos + 1;
+                    break;
+                }
+            }
+        }
+
+        ResourceChunk chunk;
+        chunk.offset = start;
+        chunk.size = end - start;
+        ResourceChunk::computeHash(data + start, chunk.size, chunk.hash);
+        rec->chunks.push_back(chunk);
+        start = end;
+    }
+
+    return rec->chunks;
+}
+
 int Scheduler::getResourceID(const SerializableObject *obj) const {
     LockGuard lock(m_mutex);
     std::map<int, ResourceRecord *>::const_iterator it = m_resources.begin();
@@ -261,6 +415,8 @@ bool Scheduler::schedule(ParallelProcess *process) {
             Log(rec->logLevel, "Waking inactive process %i..", rec->id);
 #endif
             rec->active = true;
+            /* Don't let the process catch up on the time it was paused */
+            rec->share = std::max(rec->share, getMinimumShare());
             m_localQueue.push_back(rec->id);
             if (!process->isLocal())
                 m_remoteQueue.push_back(rec->id);
@@ -284,6 +440,7 @@ bool Scheduler::schedule(ParallelProcess *process) {
     }
     ProcessRecord *rec = new ProcessRecord(m_processCounter++,
         process->getLogLevel(), m_mutex);
+    rec->share = getMinimumShare();
     m_processes[process] = rec;
 #if defined(DEBUG_SCHED)
     Log(rec->logLevel, "Scheduling process %i: %s..", rec->id, process->toString().c_str());
@@ -383,6 +540,7 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
         m_localQueue.end());
     m_remoteQueue.erase(std::remove(m_remoteQueue.begin(), m_remoteQueue.end(), rec->id),
         m_remoteQueue.end());
+    flushQueuedWork(rec);
 
     /* Ensure that the process won't be considered 'done' when the
        last in-flight work unit is returned */
@@ -424,9 +582,43 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
     return true;
 }
 
+void Scheduler::lockScheduler(UniqueLock &lock) {
+    static StatsCounter contendedLocks("Scheduler",
+        "Contended scheduler lock acquisitions", EPercentage);
+
+    contendedLocks.incrementBase();
+    if (!lock.tryLock()) {
+        ++contendedLocks;
+        lock.lock();
+    }
+}
+
 Scheduler::EStatus Scheduler::acquireWork(Item &item,
         bool local, bool onlyTry, bool keepLock) {
-    UniqueLock lock(m_mutex);
+    if (local && m_workStealing && !onlyTry && !keepLock)
+        return acquireLocalWork(item);
+
+    UniqueLock lock(m_mutex, false);
+    lockScheduler(lock);
+
+    EStatus status = generateWork(item, local, onlyTry, false);
+    if (status != EOK)
+        return status;
+
+    item.rec->inflight++;
+    item.stop = false;
+
+    if (!keepLock)
+        lock.unlock();
+    else
+        lock.release(); /* Avoid the automatic unlocking upon destruction */
+
+    boost::this_thread::yield();
+    return EOK;
+}
+
+Scheduler::EStatus Scheduler::generateWork(Item &item,
+        bool local, bool onlyTry, bool wakeOnQueued) {
     std::deque<int> &queue = local ? m_localQueue : m_remoteQueue;
     while (true) {
         if (onlyTry && queue.size() == 0) {
@@ -435,13 +627,20 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
 
         /* Wait until work is available and return false
            if stop() is called */
-        while (queue.size() == 0 && m_running)
+        while (queue.size() == 0 && m_running &&
+               !(wakeOnQueued && m_queuedWork > 0))
             m_workAvailable->wait();
 
         if (!m_running) {
             return EStop;
+        } else if (queue.size() == 0) {
+            /* Another local worker has queued work that can be stolen */
+            return ENone;
         }
 
+        if (queue.size() > 1)
+            selectProcess(queue, item.id);
+
         /* Try to create a work unit from the parallel
            process currently on top of the queue */
         ParallelProcess::EStatus wStatus;
@@ -463,7 +662,9 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
         }
 
         if (wStatus == ParallelProcess::ESuccess) {
-            break;
+            item.rec->share += 1.0 / item.proc->getShareWeight();
+            item.telemetry.generated = readTimestampCounter();
+            return EOK;
         } else if (wStatus == ParallelProcess::EFailure) {
 #if defined(DEBUG_SCHED)
             if (item.rec->morework)
@@ -482,17 +683,221 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
             queue.pop_front();
         }
     }
+}
 
-    item.rec->inflight++;
-    item.stop = false;
+void Scheduler::selectProcess(std::deque<int> &queue, int currentID) {
+    size_t best = 0, current = queue.size();
+    int bestPriority = 0, currentPriority = 0;
+    double bestShare = 0, currentShare = 0;
+
+    for (size_t i=0; i<queue.size(); ++i) {
+        const ParallelProcess *proc = m_idToProcess[queue[i]];
+        const ProcessRecord *rec = m_processes[proc];
+        int priority = proc->getPriority();
+        if (i == 0 || priority > bestPriority ||
+            (priority == bestPriority && rec->share < bestShare)) {
+            best = i;
+            bestPriority = priority;
+            bestShare = rec->share;
+        }
+        if (queue[i] == currentID) {
+            current = i;
+            currentPriority = priority;
+            currentShare = rec->share;
+        }
+    }
+
+    if (current != queue.size() && currentPriority == bestPriority &&
+        currentShare < bestShare + MTS_SCHED_QUANTUM)
+        best = current;
+
+    if (best != 0) {
+        int id = queue[best];
+        queue.erase(queue.begin() + best);
+        queue.push_front(id);
+    }
+}
+
+double Scheduler::getMinimumShare() const {
+    double minShare = 0;
+    bool found = false;
+    for (std::map<const ParallelProcess *, ProcessRecord *>::const_iterator it
+            = m_processes.begin(); it != m_processes.end(); ++it) {
+        const ProcessRecord *rec = it->second;
+        if (!rec->active)
+            continue;
+        if (!found || rec->share < minShare)
+            minShare = rec->share;
+        found = true;
+    }
+    return minShare;
+}
+
+Scheduler::EStatus Scheduler::acquireLocalWork(Item &item) {
+    while (true) {
+        if (popQueuedWork(item))
+            return EOK;
+
+        UniqueLock lock(m_mutex, false);
+        lockScheduler(lock);
+
+        EStatus status = generateWork(item, true, false, true);
+        if (status == EStop)
+            return EStop;
+        else if (status == ENone)
+            continue; /* Try to steal the work queued by another worker */
+
+        /* Generate a few more work units from the same process while
+           holding the lock, so that the next ones don't require it */
+        std::vector<QueuedWork> batch;
+        bool failed = false;
+        for (int i=1; i<m_stealBatchSize && item.rec->active; ++i) {
+            ref<WorkUnit> unit = item.wp->createWorkUnit();
+            ParallelProcess::EStatus wStatus;
+            try {
+                wStatus = item.proc->generateWork(unit, item.workerIndex);
+            } catch (const std::exception &ex) {
+                Log(EWarn, "Caught an exception - canceling process %i: %s",
+                    item.id, ex.what());
+                failed = true;
+                break;
+            }
+
+            if (wStatus == ParallelProcess::ESuccess) {
+                batch.push_back(QueuedWork(item.id, item.rec, unit,
+                    readTimestampCounter()));
+                item.rec->inflight++;
+                item.rec->share += 1.0 / item.proc->getShareWeight();
+                continue;
+            }
+
+            /* As in generateWork(): the process is done or paused. It can't
+               have terminated yet, since the current unit is still pending */
+            if (wStatus == ParallelProcess::EFailure)
+                item.rec->morework = false;
+            item.rec->active = false;
+            m_localQueue.pop_front();
+        }
+
+        if (!batch.empty()) {
+            WorkQueue *queue = m_workQueues[item.workerIndex];
+            LockGuard queueLock(queue->mutex);
+            queue->units.insert(queue->units.end(), batch.begin(), batch.end());
+            atomicAdd(&m_queuedWork, (int32_t) batch.size());
+        }
+
+        if (failed) {
+            /* Also flushes the part of the batch that was already queued */
+            lock.unlock();
+            cancel(item.proc);
+            continue;
+        }
+
+        item.rec->inflight++;
+        item.stop = false;
+
+        /* Wake up idle workers, which can now steal from this worker */
+        if (!batch.empty())
+            m_workAvailable->broadcast();
 
-    if (!keepLock)
         lock.unlock();
-    else
-        lock.release(); /* Avoid the automatic unlocking upon destruction */
+        return EOK;
+    }
+}
 
-    boost::this_thread::yield();
-    return EOK;
+bool Scheduler::popQueuedWork(Item &item) {
+    static StatsCounter stealAttempts("Scheduler",
+        "Successful steal attempts", EPercentage);
+    static StatsCounter stolenUnits("Scheduler", "Work units stolen");
+    static StatsCounter remoteSteals("Scheduler",
+        "Work units stolen from other NUMA nodes");
+
+    if (m_queuedWork <= 0)
+        return false;
+
+    int workerIndex = item.workerIndex, queueCount = (int) m_workQueues.size();
+    int numaNode = m_workQueues[workerIndex]->numaNode;
+    bool found = false;
+    ref<WorkUnit> workUnit;
+    uint64_t generated = 0;
+    int id = -1;
+
+    /* Take the most recently queued unit from the own deque. Otherwise,
+       steal the oldest one from another worker, starting with the next
+       index and preferring workers that run on the same NUMA node */
+    for (int pass=0; pass<3 && !found; ++pass) {
+        for (int i=(pass == 0) ? 0 : 1; i<((pass == 0) ? 1 : queueCount) && !found; ++i) {
+            WorkQueue *queue = m_workQueues[(workerIndex + i) % queueCount];
+            if (pass > 0 && (queue->numaNode == numaNode) != (pass == 1))
+                continue;
+            if (pass > 0)
+                stealAttempts.incrementBase();
+
+            LockGuard queueLock(queue->mutex);
+            if (queue->units.empty())
+                continue;
+
+            const QueuedWork &entry = pass == 0 ? queue->units.back()
+                                                : queue->units.front();
+            id = entry.id;
+            workUnit = entry.workUnit;
+            generated = entry.generated;
+            if (pass == 0) {
+                queue->units.pop_back();
+            } else {
+                queue->units.pop_front();
+                ++stealAttempts;
+                ++stolenUnits;
+                if (pass == 2)
+                    ++remoteSteals;
+            }
+            found = true;
+        }
+    }
+
+    if (!found)
+        return false;
+
+    atomicAdd(&m_queuedWork, -1);
+
+    if (item.id != id) {
+        try {
+            setProcessByID(item, id);
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Caught an exception - canceling process %i: %s",
+                id, ex.what());
+            /* Drop the unit and force a new setup for the next one */
+            item.id = -1;
+            cancel(item.proc, true);
+            return false;
+        }
+    }
+
+    item.workUnit->set(workUnit);
+    item.telemetry.generated = generated;
+    item.stop = false;
+    return true;
+}
+
+void Scheduler::flushQueuedWork(ProcessRecord *rec) {
+    for (size_t i=0; i<m_workQueues.size(); ++i) {
+        WorkQueue *queue = m_workQueues[i];
+        LockGuard queueLock(queue->mutex);
+        size_t count = 0;
+        for (std::deque<QueuedWork>::iterator it = queue->units.begin();
+                it != queue->units.end();) {
+            if (it->rec == rec) {
+                it = queue->units.erase(it);
+                ++count;
+            } else {
+                ++it;
+            }
+        }
+        if (count > 0) {
+            rec->inflight -= (int) count;
+            atomicAdd(&m_queuedWork, -(int32_t) count);
+        }
+    }
 }
 
 void Scheduler::signalProcessTermination(ParallelProcess *proc, ProcessRecord *rec) {
@@ -529,6 +934,14 @@ void Scheduler::start() {
     if (m_workers.size() == 0)
         Log(EError, "Cannot start the scheduler - there are no registered workers!");
 
+    /* Work units queued before a pause() are kept */
+    if (m_workStealing) {
+        while (m_workQueues.size() < m_workers.size())
+            m_workQueues.push_back(new WorkQueue());
+        for (size_t i=0; i<m_workers.size(); ++i)
+            m_workQueues[i]->numaNode = m_workers[i]->getNUMANode();
+    }
+
     int coreIndex = 0;
     for (size_t i=0; i<m_workers.size(); ++i) {
         m_workers[i]->start(this, (int) i, coreIndex);
@@ -571,6 +984,10 @@ void Scheduler::stop() {
     m_idToProcess.clear();
     m_localQueue.clear();
     m_remoteQueue.clear();
+    for (size_t i=0; i<m_workQueues.size(); ++i)
+        delete m_workQueues[i];
+    m_workQueues.clear();
+    m_queuedWork = 0;
     for (std::map<int, ResourceRecord *>::iterator
         it = m_resources.begin(); it != m_resources.end(); ++it) {
         ResourceRecord *rec = (*it).second;
@@ -647,9 +1064,17 @@ LocalWorker::~LocalWorker() {
 }
 
 void LocalWorker::run() {
+    Statistics *statistics = Statistics::getInstance();
+    WorkUnitTelemetry &telemetry = m_schedItem.telemetry;
+    telemetry.workerIndex = m_schedItem.workerIndex;
     while (acquireWork(true) != Scheduler::EStop) {
         try {
+            telemetry.started = readTimestampCounter();
             m_schedItem.wp->process(m_schedItem.workUnit, m_schedItem.workResult, m_schedItem.stop);
+            telemetry.finished = readTimestampCounter();
+            if (EXPECT_NOT_TAKEN(statistics->isTraceEnabled()))
+                statistics->recordTraceEvent(m_schedItem.wp->getClass()->getName().c_str(),
+                    telemetry.started, telemetry.finished);
         } catch (const std::exception &ex) {
             m_schedItem.stop = true;
             releaseWork(m_schedItem);
@@ -19,6 +19,9 @@
 #include <mitsuba/core/sched_remote.h>
 #include <mitsuba/core/sstream.h>
 #include <mitsuba/core/mstream.h>
+#include <mitsuba/core/zstream.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/statistics.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/version.h>
 
@@ -38,7 +41,12 @@ private:
     ref<ParallelProcess> m_proc;
 };
 
-RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(name), m_stream(stream) {
+RemoteWorker::RemoteWorker(const std::string &name, Stream *stream,
+        bool compression, int backlog) : Worker(name), m_stream(stream),
+        m_backlog(backlog), m_compression(false), m_resourceCache(false) {
+    if (backlog < 2)
+        Log(EError, "The number of work units in transit per core must be at least 2!");
+
     const size_t dataLength = strlen(MTS_VERSION)+3;
     char *data = (char *) alloca(dataLength);
     strncpy(data, MTS_VERSION, strlen(MTS_VERSION)+1);
@@ -50,6 +58,8 @@ RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(nam
 #endif
     m_stream->writeShort(StreamBackend::EHello);
     m_stream->write(data, dataLength);
+    m_stream->writeShort((compression ? StreamBackend::ECompression : 0)
+        | StreamBackend::EResourceCache);
     m_stream->flush();
 
     int msg = m_stream->readShort();
@@ -59,6 +69,20 @@ RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(nam
         Log(EError, "Received an invalid response!");
     m_coreCount = m_stream->readShort();
     m_nodeName = m_stream->readString();
+    short capabilities = m_stream->readShort();
+    m_compression = (capabilities & StreamBackend::ECompression) != 0;
+    if (compression && !m_compression)
+        Log(EWarn, "\"%s\" declined to use compression!", m_nodeName.c_str());
+    m_resourceCache = (capabilities & StreamBackend::EResourceCache) != 0;
+    if (m_resourceCache) {
+        /* The server advertises the chunks that it already has */
+        size_t chunkCount = m_stream->readSize();
+        for (size_t i=0; i<chunkCount; ++i) {
+            uint64_t hash[2];
+            m_stream->readULongArray(hash);
+            m_remoteChunks.insert(ResourceCache::Key(hash[0], hash[1]));
+        }
+    }
     m_mutex = new Mutex();
     m_finishCond = new ConditionVariable(m_mutex);
     m_memStream = new MemoryStream();
@@ -67,8 +91,10 @@ RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(nam
     m_reader->start();
     m_inFlight = 0;
     m_isRemote = true;
-    Log(EDebug, "Connection to \"%s\" established (%i cores).",
-        m_nodeName.c_str(), m_coreCount);
+    Log(EDebug, "Connection to \"%s\" established (%i cores%s%s).",
+        m_nodeName.c_str(), m_coreCount, m_compression ? ", compressed" : "",
+        m_resourceCache ? formatString(", %i cached chunks",
+            (int) m_remoteChunks.size()).c_str() : "");
 }
 
 RemoteWorker::~RemoteWorker() {
@@ -117,6 +143,7 @@ void RemoteWorker::run() {
                all information required to receive and execute work
                units on the other side */
             std::vector<std::pair<int, const MemoryStream *> > resources;
+            std::vector<const std::vector<ResourceChunk> *> chunks;
             std::vector<std::pair<int, const SerializableObject *> > multiResources;
 
             /* First, look up all resources required by this process (the scheduler lock
@@ -130,6 +157,8 @@ void RemoteWorker::run() {
                     if (!m_scheduler->isMultiResource(resID)) {
                         resources.push_back(std::pair<int, const MemoryStream *>(resID,
                             m_scheduler->getResourceStream(resID)));
+                        chunks.push_back(m_resourceCache ?
+                            &m_scheduler->getResourceChunks(resID) : NULL);
                     } else {
                         for (size_t i=0; i<m_coreCount; ++i)
                             multiResources.push_back(std::pair<int, const SerializableObject *>(resID,
@@ -164,12 +193,39 @@ void RemoteWorker::run() {
             for (size_t i=0; i<resources.size(); ++i) {
                 int resID = resources[i].first;
                 const MemoryStream *resStream = resources[i].second;
-                Log(EDebug, "Sending resource %i to \"%s\" (%i KB)", resID, m_nodeName.c_str(),
-                    resStream->getPos() / 1024);
-                m_memStream->writeShort(StreamBackend::ENewResource);
+                if (!chunks[i]) {
+                    Log(EDebug, "Sending resource %i to \"%s\" (%i KB)", resID, m_nodeName.c_str(),
+                        resStream->getPos() / 1024);
+                    m_memStream->writeShort(StreamBackend::ENewResource);
+                    m_memStream->writeInt(resID);
+                    StreamBackend::writePayload(m_memStream, resStream, m_compression);
+                    continue;
+                }
+
+                /* Only send the chunks that are not cached on the other side */
+                const std::vector<ResourceChunk> &resChunks = *chunks[i];
+                size_t sent = 0;
+                m_memStream->writeShort(StreamBackend::ENewChunkedResource);
                 m_memStream->writeInt(resID);
-                m_memStream->writeSize(resStream->getPos());
-                m_memStream->write(resStream->getData(), resStream->getPos());
+                m_memStream->writeSize(resChunks.size());
+                m_memStream->writeSize(resStream->getSize());
+                for (size_t j=0; j<resChunks.size(); ++j) {
+                    const ResourceChunk &chunk = resChunks[j];
+                    ResourceCache::Key key(chunk.hash[0], chunk.hash[1]);
+                    bool hasData = m_remoteChunks.find(key) == m_remoteChunks.end();
+                    m_memStream->writeULongArray(chunk.hash);
+                    m_memStream->writeSize(chunk.size);
+                    m_memStream->writeBool(hasData);
+                    if (hasData) {
+                        StreamBackend::writePayload(m_memStream, resStream->getData()
+                            + chunk.offset, chunk.size, m_compression);
+                        m_remoteChunks.insert(key);
+                        sent += chunk.size;
+                    }
+                }
+                Log(EDebug, "Sending resource %i to \"%s\" (%i KB, %i KB cached remotely)",
+                    resID, m_nodeName.c_str(), (int) (sent / 1024),
+                    (int) ((resStream->getSize() - sent) / 1024));
             }
 
             for (size_t i=0; i<multiResources.size(); i += m_coreCount) {
@@ -183,8 +239,7 @@ void RemoteWorker::run() {
                     resStream->getPos() / 1024);
                 m_memStream->writeShort(StreamBackend::ENewMultiResource);
                 m_memStream->writeInt(resID);
-                m_memStream->writeSize(resStream->getPos());
-                m_memStream->write(resStream->getData(), resStream->getPos());
+                StreamBackend::writePayload(m_memStream, resStream, m_compression);
             }
 
             for (ParallelProcess::ResourceBindings::const_iterator it = bindings.begin();
@@ -198,17 +253,31 @@ void RemoteWorker::run() {
             releaseSchedulerLock();
         }
 
+        size_t pos = m_memStream->getPos();
         m_memStream->writeShort(StreamBackend::EWorkUnit);
         m_memStream->writeInt(id);
         m_schedItem.workUnit->save(m_memStream);
 
-        if (++m_inFlight == MTS_BACKLOG_FACTOR * m_coreCount) {
+        WorkUnitTelemetry telemetry = m_schedItem.telemetry;
+        telemetry.workerIndex = m_schedItem.workerIndex;
+        telemetry.remote = true;
+        telemetry.started = readTimestampCounter();
+        telemetry.bytesSent = m_memStream->getPos() - pos;
+        m_submitted.push_back(telemetry);
+
+        const size_t backlog = m_backlog * m_coreCount,
+                     resume = (m_backlog - 1) * m_coreCount;
+        if (++m_inFlight >= backlog) {
             flush();
             /* There are now too many packets in transit. Wait
                until this clears up a bit before attempting to
                send more work */
-            while (m_inFlight > MTS_CONTINUE_FACTOR * m_coreCount)
+            while (m_inFlight > resume)
                 m_finishCond->wait();
+        } else if (m_inFlight <= resume) {
+            /* The remote side is running low on work -- send
+               immediately instead of waiting for a full backlog */
+            flush();
         }
     }
     LockGuard lock(m_mutex);
@@ -267,8 +336,14 @@ RemoteWorkerReader::RemoteWorkerReader(RemoteWorker *worker)
 void RemoteWorkerReader::run() {
     int id=-1; short msg=-1;
 
+    /* Byte counts are only available for direct connections */
+    SocketStream *socket = NULL;
+    if (m_stream->getClass()->derivesFrom(MTS_CLASS(SocketStream)))
+        socket = static_cast<SocketStream *>(m_stream.get());
+
     while (true) {
         try {
+            size_t received = socket ? socket->getReceivedBytes() : 0;
             msg = m_stream->readShort();
             id = m_stream->readInt();
 
@@ -279,12 +354,23 @@ void RemoteWorkerReader::run() {
 
             switch (msg) {
                 case StreamBackend::EWorkResult:
-                    m_schedItem.workResult->load(m_stream);
+                    if (m_parent->m_compression)
+                        m_schedItem.workResult->load(
+                            StreamBackend::readPayload(m_stream, true));
+                    else
+                        m_schedItem.workResult->load(m_stream);
+                    m_parent->popSubmitted(m_schedItem.telemetry);
+                    m_schedItem.telemetry.finished = readTimestampCounter();
+                    m_schedItem.telemetry.bytesReceived = socket ?
+                        socket->getReceivedBytes() - received : 0;
                     m_schedItem.stop = false;
                     m_parent->releaseWork(m_schedItem);
                     m_parent->signalCompletion();
                     break;
                 case StreamBackend::ECancelledWorkResult:
+                    m_parent->popSubmitted(m_schedItem.telemetry);
+                    m_schedItem.telemetry.finished = readTimestampCounter();
+                    m_schedItem.telemetry.bytesReceived = 0;
                     m_schedItem.stop = true;
                     m_parent->releaseWork(m_schedItem);
                     m_parent->signalCompletion();
@@ -321,8 +407,9 @@ void RemoteWorkerReader::run() {
 /* ==================================================================== */
 
 StreamBackend::StreamBackend(const std::string &thrName, Scheduler *scheduler,
-        const std::string &nodeName, Stream *stream, bool detach) : Thread(thrName),
-        m_scheduler(scheduler), m_nodeName(nodeName), m_stream(stream), m_detach(detach) {
+        const std::string &nodeName, Stream *stream, bool detach, ResourceCache *cache)
+        : Thread(thrName), m_scheduler(scheduler), m_nodeName(nodeName), m_stream(stream),
+        m_cache(cache), m_detach(detach), m_compression(false) {
     m_sendMutex = new Mutex();
     m_memStream = new MemoryStream();
     m_memStream->setByteOrder(Stream::ENetworkByteOrder);
@@ -356,6 +443,7 @@ void StreamBackend::run() {
     refData[dataLength-1] = 0;
 #endif
     m_stream->read(data, dataLength);
+    short capabilities = m_stream->readShort();
 
     if (memcmp(data, refData, dataLength) != 0) {
         m_stream->writeShort(EIncompatible);
@@ -366,9 +454,23 @@ void StreamBackend::run() {
     }
 
     Log(EDebug, "Program versions match.");
+    m_compression = (capabilities & ECompression) != 0;
     m_memStream->writeShort(EHello);
     m_memStream->writeShort((short) m_scheduler->getCoreCount());
     m_memStream->writeString(m_nodeName);
+    bool cached = m_cache && (capabilities & EResourceCache);
+    m_memStream->writeShort((m_compression ? ECompression : 0)
+        | (cached ? EResourceCache : 0));
+    if (cached) {
+        /* Advertise the cached chunks. They stay pinned
+           until the connection is closed */
+        m_cache->pinAll(m_pinned);
+        m_memStream->writeSize(m_pinned.size());
+        for (size_t i=0; i<m_pinned.size(); ++i) {
+            m_memStream->writeULong(m_pinned[i].first);
+            m_memStream->writeULong(m_pinned[i].second);
+        }
+    }
     m_memStream->seek(0);
     m_memStream->copyTo(m_stream);
     m_stream->flush();
@@ -390,24 +492,45 @@ void StreamBackend::run() {
                     break;
                 case ENewResource: {
                         int id = m_stream->readInt();
-                        size_t size = m_stream->readSize();
                         ref<InstanceManager> manager = new InstanceManager();
+                        ref<MemoryStream> mstream = readPayload(m_stream, m_compression);
+                        ref<SerializableObject> res = static_cast<SerializableObject *>(manager->getInstance(mstream));
+                        m_resources[id] = m_scheduler->registerResource(res);
+                    }
+                    break;
+                case ENewChunkedResource: {
+                        int id = m_stream->readInt();
+                        size_t chunkCount = m_stream->readSize();
+                        size_t size = m_stream->readSize();
                         ref<MemoryStream> mstream = new MemoryStream(size);
                         mstream->setByteOrder(Stream::ENetworkByteOrder);
-                        m_stream->copyTo(mstream, size);
+                        for (size_t i=0; i<chunkCount; ++i) {
+                            uint64_t hash[2];
+                            m_stream->readULongArray(hash);
+                            size_t chunkSize = m_stream->readSize();
+                            ResourceCache::Key key(hash[0], hash[1]);
+                            if (m_stream->readBool()) {
+                                ref<MemoryStream> chunk = readPayload(m_stream, m_compression);
+                                if (chunk->getSize() != chunkSize)
+                                    Log(EError, "Received a resource chunk of invalid size!");
+                                mstream->write(chunk->getData(), chunkSize);
+                                m_cache->put(key, chunk->getData(), chunkSize);
+                                m_pinned.push_back(key);
+                            } else if (!m_cache->get(key, mstream)) {
+                                Log(EError, "Resource chunk %016llx%016llx is missing from the cache!",
+                                    (unsigned long long) key.first, (unsigned long long) key.second);
+                            }
+                        }
                         mstream->seek(0);
+                        ref<InstanceManager> manager = new InstanceManager();
                         ref<SerializableObject> res = static_cast<SerializableObject *>(manager->getInstance(mstream));
                         m_resources[id] = m_scheduler->registerResource(res);
                     }
                     break;
                 case ENewMultiResource: {
                         int id = m_stream->readInt();
-                        size_t size = m_stream->readSize();
                         ref<InstanceManager> manager = new InstanceManager();
-                        ref<MemoryStream> mstream = new MemoryStream(size);
-                        mstream->setByteOrder(Stream::ENetworkByteOrder);
-                        m_stream->copyTo(mstream, size);
-                        mstream->seek(0);
+                        ref<MemoryStream> mstream = readPayload(m_stream, m_compression);
                         size_t coreCount = m_scheduler->getCoreCount();
                         std::vector<SerializableObject *> objects(coreCount);
                         for (size_t i=0; i<coreCount; ++i)
@@ -486,6 +609,9 @@ void StreamBackend::run() {
         m_scheduler->unregisterResource((*it).second);
     }
 
+    if (m_cache)
+        m_cache->unpin(m_pinned);
+
     if (m_stream->getClass()->derivesFrom(MTS_CLASS(SocketStream))) {
         SocketStream *sstream = static_cast<SocketStream *>(m_stream.get());
         Log(EInfo, "Closing connection to %s - received %i KB / sent %i KB",
@@ -517,11 +643,25 @@ void StreamBackend::sendCancellation(int id, int numLost) {
 }
 
 void StreamBackend::sendWorkResult(int id, const WorkResult *result, bool cancelled) {
+    /* Compress before acquiring the lock so that
+       several workers can do this at the same time */
+    ref<MemoryStream> packed;
+    if (!cancelled && m_compression) {
+        ref<MemoryStream> payload = new MemoryStream();
+        payload->setByteOrder(Stream::ENetworkByteOrder);
+        result->save(payload);
+        packed = new MemoryStream();
+        packed->setByteOrder(Stream::ENetworkByteOrder);
+        writePayload(packed, payload, true);
+    }
+
     LockGuard lock(m_sendMutex);
     m_memStream->reset();
     m_memStream->writeShort(cancelled ? ECancelledWorkResult : EWorkResult);
     m_memStream->writeInt(id);
-    if (!cancelled)
+    if (packed)
+        m_memStream->write(packed->getData(), packed->getPos());
+    else if (!cancelled)
         result->save(m_memStream);
     try {
         m_memStream->seek(0);
@@ -534,6 +674,193 @@ void StreamBackend::sendWorkResult(int id, const WorkResult *result, bool cancel
     }
 }
 
+void StreamBackend::writePayload(Stream *stream, const MemoryStream *payload,
+        bool compress) {
+    writePayload(stream, payload->getData(), payload->getPos(), compress);
+}
+
+void StreamBackend::writePayload(Stream *stream, const uint8_t *data,
+        size_t size, bool compress) {
+    static StatsCounter compressedBytes("Network",
+        "Size of compressed payloads", EPercentage);
+
+    if (compress) {
+        if (size >= MTS_COMPRESSION_THRESHOLD) {
+            ref<MemoryStream> compressed = new MemoryStream(size / 2);
+            ref<ZStream> zstream = new ZStream(compressed, ZStream::EBlockStream);
+            zstream->write(data, size);
+            zstream = NULL; /* Writes the end of the deflate stream */
+
+            size_t compressedSize = compressed->getPos();
+            compressedBytes.incrementBase(size);
+            compressedBytes += compressedSize;
+
+            if (compressedSize < size) {
+                stream->writeBool(true);
+                stream->writeSize(size);
+                stream->writeSize(compressedSize);
+                stream->write(compressed->getData(), compressedSize);
+                return;
+            }
+        }
+        stream->writeBool(false);
+    }
+
+    stream->writeSize(size);
+    stream->write(data, size);
+}
+
+ref<MemoryStream> StreamBackend::readPayload(Stream *stream, bool compress) {
+    bool compressed = compress && stream->readBool();
+    size_t size = stream->readSize();
+    ref<MemoryStream> payload = new MemoryStream(size);
+    payload->setByteOrder(Stream::ENetworkByteOrder);
+
+    if (compressed) {
+        size_t compressedSize = stream->readSize();
+        ref<MemoryStream> cstream = new MemoryStream(compressedSize);
+        stream->copyTo(cstream, compressedSize);
+        cstream->seek(0);
+        ref<ZStream> zstream = new ZStream(cstream, ZStream::EBlockStream);
+        zstream->copyTo(payload, size);
+    } else {
+        stream->copyTo(payload, size);
+    }
+
+    payload->seek(0);
+    return payload;
+}
+
+/* ==================================================================== */
+/*                            Resource cache                            */
+/* ==================================================================== */
+
+ResourceCache::ResourceCache(size_t capacity, const fs::path &directory)
+        : m_directory(directory), m_capacity(capacity), m_size(0), m_timestamp(0) {
+    m_mutex = new Mutex();
+    if (m_directory.empty())
+        return;
+
+    if (!fs::exists(m_directory))
+        fs::create_directories(m_directory);
+
+    /* Pick up the chunks of a previous session (the least
+       recently written ones will be evicted first) */
+    std::vector<std::pair<std::time_t, Key> > files;
+    for (fs::directory_iterator it(m_directory), end; it != end; ++it) {
+        const fs::path &path = it->path();
+        std::string name = path.stem().string();
+        if (path.extension() != ".chunk" || name.length() != 32)
+            continue;
+        Key key(std::strtoull(name.substr(0, 16).c_str(), NULL, 16),
+                std::strtoull(name.substr(16).c_str(), NULL, 16));
+        Entry &entry = m_entries[key];
+        entry.size = (size_t) fs::file_size(path);
+        entry.pinCount = 0;
+        m_size += entry.size;
+        files.push_back(std::make_pair(fs::last_write_time(path), key));
+    }
+    std::sort(files.begin(), files.end());
+    for (size_t i=0; i<files.size(); ++i)
+        m_entries[files[i].second].lastUse = m_timestamp++;
+
+    Log(EInfo, "Resource cache \"%s\" contains %i chunks (%s)",
+        m_directory.string().c_str(), (int) m_entries.size(),
+        memString(m_size).c_str());
+    evict();
+}
+
+fs::path ResourceCache::getFilename(const Key &key) const {
+    return m_directory / formatString("%016llx%016llx.chunk",
+        (unsigned long long) key.first, (unsigned long long) key.second);
+}
+
+void ResourceCache::pinAll(std::vector<Key> &keys) {
+    LockGuard lock(m_mutex);
+    keys.reserve(keys.size() + m_entries.size());
+    for (std::map<Key, Entry>::iterator it = m_entries.begin();
+            it != m_entries.end(); ++it) {
+        it->second.pinCount++;
+        keys.push_back(it->first);
+    }
+}
+
+void ResourceCache::put(const Key &key, const uint8_t *data, size_t size) {
+    LockGuard lock(m_mutex);
+    std::map<Key, Entry>::iterator it = m_entries.find(key);
+    if (it != m_entries.end()) {
+        it->second.pinCount++;
+        it->second.lastUse = m_timestamp++;
+        return;
+    }
+
+    Entry entry;
+    entry.size = size;
+    entry.lastUse = m_timestamp++;
+    entry.pinCount = 1;
+    if (m_directory.empty()) {
+        entry.data = new MemoryStream(size);
+        entry.data->write(data, size);
+    } else {
+        ref<FileStream> fstream = new FileStream(getFilename(key),
+            FileStream::ETruncReadWrite);
+        fstream->write(data, size);
+        fstream->close();
+    }
+    m_entries[key] = entry;
+    m_size += size;
+    evict();
+}
+
+bool ResourceCache::get(const Key &key, Stream *stream) {
+    LockGuard lock(m_mutex);
+    std::map<Key, Entry>::iterator it = m_entries.find(key);
+    if (it == m_entries.end())
+        return false;
+    Entry &entry = it->second;
+    entry.lastUse = m_timestamp++;
+    if (entry.data) {
+        stream->write(entry.data->getData(), entry.size);
+    } else {
+        ref<FileStream> fstream = new FileStream(getFilename(key),
+            FileStream::EReadOnly);
+        fstream->copyTo(stream, entry.size);
+        fstream->close();
+    }
+    return true;
+}
+
+void ResourceCache::unpin(const std::vector<Key> &keys) {
+    LockGuard lock(m_mutex);
+    for (size_t i=0; i<keys.size(); ++i) {
+        std::map<Key, Entry>::iterator it = m_entries.find(keys[i]);
+        if (it != m_entries.end())
+            it->second.pinCount--;
+    }
+    evict();
+}
+
+void ResourceCache::evict() {
+    if (m_size <= m_capacity)
+        return;
+
+    std::vector<std::pair<uint64_t, Key> > candidates;
+    for (std::map<Key, Entry>::const_iterator it = m_entries.begin();
+            it != m_entries.end(); ++it) {
+        if (it->second.pinCount == 0)
+            candidates.push_back(std::make_pair(it->second.lastUse, it->first));
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for (size_t i=0; i<candidates.size() && m_size > m_capacity; ++i) {
+        const Key &key = candidates[i].second;
+        m_size -= m_entries[key].size;
+        m_entries.erase(key);
+        if (!m_directory.empty())
+            fs::remove(getFilename(key));
+    }
+}
+
 /* ==================================================================== */
 /*                            Remote process                            */
 /* ==================================================================== */
@@ -593,4 +920,5 @@ MTS_IMPLEMENT_CLASS(RemoteWorker, false, Worker)
 MTS_IMPLEMENT_CLASS(RemoteWorkerReader, false, Thread)
 MTS_IMPLEMENT_CLASS(StreamBackend, false, Thread)
 MTS_IMPLEMENT_CLASS(RemoteProcess, false, ParallelProcess)
+MTS_IMPLEMENT_CLASS(ResourceCache, false, Object)
 MTS_NAMESPACE_END
@@ -40,10 +40,13 @@ InstanceManager::~InstanceManager() {
 
 SerializableObject *InstanceManager::getInstance(Stream *stream) {
     m_lastID = stream->readUInt();
-    if (m_lastID == 0) {
+    if (m_lastID == 0)
         return NULL;
-    } else if (m_idToObj.find(m_lastID) != m_idToObj.end()) {
-        return m_idToObj[m_lastID];
+
+    boost::unordered_map<unsigned int, SerializableObject *>::const_iterator it
+        = m_idToObj.find(m_lastID);
+    if (it != m_idToObj.end()) {
+        return it->second;
     } else {
         SerializableObject *object = NULL;
         std::string className = stream->readString();
@@ -73,15 +76,20 @@ void InstanceManager::registerInstance(SerializableObject *object) {
 void InstanceManager::serialize(Stream *stream, const SerializableObject *inst) {
     if (inst == NULL) {
         stream->writeUInt(0);
-    } else if (m_objToId.find(inst) != m_objToId.end()) {
-        stream->writeUInt(m_objToId[inst]);
+        return;
+    }
+
+    /* Look up and register the instance with a single hash table access */
+    std::pair<boost::unordered_map<const SerializableObject *, unsigned int>::iterator, bool>
+        result = m_objToId.insert(std::make_pair(inst, m_counter + 1));
+    if (!result.second) {
+        stream->writeUInt(result.first->second);
     } else {
 #ifdef DEBUG_SERIALIZATION
         Log(EDebug, "Serializing a class of type '%s'", inst->getClass()->getName().c_str());
 #endif
         stream->writeUInt(++m_counter);
         stream->writeString(inst->getClass()->getName());
-        m_objToId[inst]=m_counter;
         inst->serialize(stream, this);
     }
 }
@@ -23,6 +23,7 @@
 MTS_NAMESPACE_BEGIN
 
 Float *SHVector::m_normalization = NULL;
+SHRotation *SHVector::m_rotX90 = NULL;
 
 SHVector::SHVector(Stream *stream) {
     m_bands = stream->readInt();
@@ -50,26 +51,7 @@ bool SHVector::isAzimuthallyInvariant() const {
 }
 
 Float SHVector::eval(Float theta, Float phi) const {
-    Float result = 0;
-    Float cosTheta = std::cos(theta);
-    Float *sinPhi = (Float *) alloca(sizeof(Float)*m_bands),
-          *cosPhi = (Float *) alloca(sizeof(Float)*m_bands);
-
-    for (int m=0; m<m_bands; ++m) {
-        sinPhi[m] = std::sin((m+1) * phi);
-        cosPhi[m] = std::cos((m+1) * phi);
-    }
-
-    for (int l=0; l<m_bands; ++l) {
-        for (int m=1; m<=l; ++m) {
-            Float L = legendreP(l, m, cosTheta) * normalization(l, m);
-            result += operator()(l, -m) * SQRT_TWO * sinPhi[m-1] * L;
-            result += operator()(l, m)  * SQRT_TWO * cosPhi[m-1] * L;
-        }
-
-        result += operator()(l, 0) * legendreP(l, 0, cosTheta) * normalization(l, 0);
-    }
-    return result;
+    return eval(sphericalDirection(theta, phi));
 }
 
 Float SHVector::findMinimum(int res = 32) const {
@@ -92,27 +74,57 @@ void SHVector::addOffset(Float value) {
 }
 
 Float SHVector::eval(const Vector &v) const {
-    Float result = 0;
-    Float cosTheta = v.z, phi = std::atan2(v.y, v.x);
-    if (phi < 0) phi += 2*M_PI;
-    Float *sinPhi = (Float *) alloca(sizeof(Float)*m_bands),
-          *cosPhi = (Float *) alloca(sizeof(Float)*m_bands);
+    Eigen::Map<Eigen::Matrix<Float, Eigen::Dynamic, 1> > basis(
+        (Float *) alloca(sizeof(Float) * m_coeffs.size()), m_coeffs.size());
+    evalBasis(v, m_bands, basis.data());
+    return m_coeffs.dot(basis);
+}
 
-    for (int m=0; m<m_bands; ++m) {
-        sinPhi[m] = std::sin((m+1) * phi);
-        cosPhi[m] = std::cos((m+1) * phi);
+void SHVector::evalBatch(const Vector *v, Float *result, size_t count) const {
+    Eigen::Map<Eigen::Matrix<Float, Eigen::Dynamic, 1> > basis(
+        (Float *) alloca(sizeof(Float) * m_coeffs.size()), m_coeffs.size());
+    for (size_t i=0; i<count; ++i) {
+        evalBasis(v[i], m_bands, basis.data());
+        result[i] = m_coeffs.dot(basis);
     }
+}
 
-    for (int l=0; l<m_bands; ++l) {
-        for (int m=1; m<=l; ++m) {
-            Float L = legendreP(l, m, cosTheta) * normalization(l, m);
-            result += operator()(l, -m) * SQRT_TWO * sinPhi[m-1] * L;
-            result += operator()(l, m)  * SQRT_TWO * cosPhi[m-1] * L;
+void SHVector::evalBasis(const Vector &v, int bands, Float *basis) {
+    /* Same conventions as legendreP(l, m, x) (incl. the Condon-Shortley
+       phase), evaluated in double precision like the latter */
+    double x = math::clamp((double) v.z, -1.0, 1.0),
+           somx2 = std::sqrt((1 - x) * (1 + x)),
+           r = std::sqrt((double) v.x * v.x + (double) v.y * v.y),
+           cosPhi = r > 0 ? v.x / r : 1.0,
+           sinPhi = r > 0 ? v.y / r : 0.0;
+
+    double p_mm = 1, cosMPhi = 1, sinMPhi = 0;
+    for (int m=0; m<bands; ++m) {
+        if (m > 0) {
+            p_mm *= -(2*m - 1) * somx2;
+            double tmp = cosMPhi * cosPhi - sinMPhi * sinPhi;
+            sinMPhi = sinMPhi * cosPhi + cosMPhi * sinPhi;
+            cosMPhi = tmp;
         }
 
-        result += operator()(l, 0) * legendreP(l, 0, cosTheta) * normalization(l, 0);
+        /* Upward recurrence over the bands l = m, m+1, .. */
+        double p_l = p_mm, p_lm1 = 0;
+        for (int l=m; l<bands; ++l) {
+            if (l > m) {
+                double p_next = ((2*l-1) * x * p_l - (l+m-1) * p_lm1) / (l-m);
+                p_lm1 = p_l;
+                p_l = p_next;
+            }
+
+            double L = p_l * normalization(l, m);
+            if (m == 0) {
+                basis[l*(l+1)] = (Float) L;
+            } else {
+                basis[l*(l+1) - m] = (Float) (SQRT_TWO * sinMPhi * L);
+                basis[l*(l+1) + m] = (Float) (SQRT_TWO * cosMPhi * L);
+            }
+        }
     }
-    return result;
 }
 
 Float SHVector::evalAzimuthallyInvariant(Float theta, Float phi) const {
@@ -202,11 +214,16 @@ void SHVector::staticInitialization() {
     for (int l=0; l<SH_NORMTBL_SIZE; ++l)
         for (int m=0; m<=l; ++m)
             m_normalization[l*(l+1)/2 + m] = computeNormalization(l, m);
+
+    m_rotX90 = new SHRotation(SH_ROTTBL_SIZE);
+    rotation(Transform::rotate(Vector(1, 0, 0), 90), *m_rotX90);
 }
 
 void SHVector::staticShutdown() {
     delete[] m_normalization;
     m_normalization = NULL;
+    delete m_rotX90;
+    m_rotX90 = NULL;
 }
 
 struct RotationBlockHelper {
@@ -339,6 +356,77 @@ void SHVector::rotation(const Transform &t, SHRotation &rot) {
         rotationBlock(rot.blocks[1], rot.blocks[i-1], rot.blocks[i]);
 }
 
+void SHVector::eulerZYZ(const Transform &t, Float &alpha, Float &beta, Float &gamma) {
+    const Matrix4x4 &M = t.getMatrix();
+    Float cosBeta = math::clamp(M.m[2][2], (Float) -1, (Float) 1);
+    beta = math::safe_acos(cosBeta);
+
+    if (std::abs(cosBeta) < 1 - Epsilon) {
+        alpha = std::atan2(M.m[1][2], M.m[0][2]);
+        gamma = std::atan2(M.m[2][1], -M.m[2][0]);
+    } else {
+        /* Gimbal lock: only alpha +/- gamma is determined */
+        alpha = std::atan2(-M.m[0][1], M.m[1][1]);
+        gamma = 0;
+    }
+}
+
+void SHVector::rotateZ(Float angle) {
+    Float cosAngle = std::cos(angle), sinAngle = std::sin(angle);
+    Float cosMAngle = 1, sinMAngle = 0;
+
+    for (int m=1; m<m_bands; ++m) {
+        Float tmp = cosMAngle * cosAngle - sinMAngle * sinAngle;
+        sinMAngle = sinMAngle * cosAngle + cosMAngle * sinAngle;
+        cosMAngle = tmp;
+
+        for (int l=m; l<m_bands; ++l) {
+            Float &cosCoeff = operator()(l, m), &sinCoeff = operator()(l, -m);
+            Float c = cosCoeff, s = sinCoeff;
+            cosCoeff = c * cosMAngle + s * sinMAngle;
+            sinCoeff = s * cosMAngle - c * sinMAngle;
+        }
+    }
+}
+
+void SHVector::rotateX90(bool inverse) {
+    Eigen::Matrix<Float, Eigen::Dynamic, 1> temp;
+    for (int l=1; l<m_bands; ++l) {
+        const SHRotation::Matrix &M = m_rotX90->blocks[l];
+        if (inverse)
+            temp = M.transpose() * m_coeffs.segment(l*l, 2*l+1);
+        else
+            temp = M * m_coeffs.segment(l*l, 2*l+1);
+        m_coeffs.segment(l*l, 2*l+1) = temp;
+    }
+}
+
+void SHVector::rotateZYZ(Float alpha, Float beta, Float gamma) {
+    if (m_bands > SH_ROTTBL_SIZE) {
+        Transform t = Transform::rotate(Vector(0, 0, 1), radToDeg(alpha))
+            * Transform::rotate(Vector(0, 1, 0), radToDeg(beta))
+            * Transform::rotate(Vector(0, 0, 1), radToDeg(gamma));
+        SHRotation rot(m_bands);
+        rotation(t, rot);
+        SHVector source(*this);
+        rot(source, *this);
+        return;
+    }
+
+    /* rotate(Y, beta) = rotate(X, -90) * rotate(Z, beta) * rotate(X, 90) */
+    rotateZ(alpha);
+    rotateX90(true);
+    rotateZ(beta);
+    rotateX90(false);
+    rotateZ(gamma);
+}
+
+void SHVector::rotate(const Transform &t) {
+    Float alpha, beta, gamma;
+    eulerZYZ(t, alpha, beta, gamma);
+    rotateZYZ(alpha, beta, gamma);
+}
+
 void SHRotation::operator()(const SHVector &source, SHVector &target) const {
     SAssert(source.getBands() == target.getBands());
     for (int l=0; l<source.getBands(); ++l) {
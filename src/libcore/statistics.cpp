@@ -19,6 +19,8 @@
 #include <mitsuba/mitsuba.h>
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/lock.h>
+#include <mitsuba/core/tls.h>
+#include <boost/filesystem/fstream.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -84,26 +86,79 @@ void ProgressReporter::update(long long value) {
     }
 }
 
+/// Number of slots in each block of thread-local counter storage
+#define STATS_SLOTS_PER_BLOCK 64
+
+/// Thread-local counter storage (owned by the statistics collector)
+struct StatsSlotTable {
+    /// Slots of the thread, indexed by the counter ID
+    std::vector<StatsCounterSlot *> slots;
+    /// Cache-line-aligned blocks from which the slots are allocated
+    std::vector<StatsCounterSlot *> blocks;
+    /// Number of used slots in the last block
+    size_t used;
+
+    StatsSlotTable() : used(STATS_SLOTS_PER_BLOCK) { }
+
+    ~StatsSlotTable() {
+        for (size_t i=0; i<blocks.size(); ++i)
+            freeAligned(blocks[i]);
+    }
+};
+
+#if defined(__WINDOWS__)
+static __declspec(thread) StatsSlotTable *__slotTable = NULL;
+static inline StatsSlotTable *getSlotTable() { return __slotTable; }
+static inline void setSlotTable(StatsSlotTable *table) { __slotTable = table; }
+#elif defined(__LINUX__)
+static __thread StatsSlotTable *__slotTable = NULL;
+static inline StatsSlotTable *getSlotTable() { return __slotTable; }
+static inline void setSlotTable(StatsSlotTable *table) { __slotTable = table; }
+#else
+static PrimitiveThreadLocal<StatsSlotTable *> __slotTable;
+static inline StatsSlotTable *getSlotTable() { return __slotTable.get(); }
+static inline void setSlotTable(StatsSlotTable *table) { __slotTable.set(table); }
+#endif
+
+/// Source of unique counter IDs
+static volatile int32_t __counterIDs = 0;
+
 StatsCounter::StatsCounter(const std::string &cat, const std::string &name, EStatsType type, uint64_t initial, uint64_t base)
  : m_category(cat), m_name(name), m_type(type) {
-    m_value = (CacheLineCounter *) allocAligned(sizeof(CacheLineCounter) * NUM_COUNTERS);
-    m_base = (CacheLineCounter *) allocAligned(sizeof(CacheLineCounter) * NUM_COUNTERS);
-    memset(m_value, 0, sizeof(CacheLineCounter) * NUM_COUNTERS);
-    memset(m_base, 0, sizeof(CacheLineCounter) * NUM_COUNTERS);
+    m_id = (size_t) (atomicAdd(&__counterIDs, 1) - 1);
+
+    /* Slots of minimum/maximum counters start at the initial value */
+    m_initial = (type == EMinimumValue || type == EMaximumValue) ? initial : 0;
+    memset(&m_initialSlot, 0, sizeof(StatsCounterSlot));
 #if defined(WIN32) && !defined(WIN64)
-    m_value[0].value = (uint32_t) initial;
-    m_base[0].value = (uint32_t) base;
+    m_initialSlot.value = (uint32_t) initial;
+    m_initialSlot.base = (uint32_t) base;
 #else
-    m_value[0].value = initial;
-    m_base[0].value = base;
+    m_initialSlot.value = initial;
+    m_initialSlot.base = base;
 #endif
+    m_slots = &m_initialSlot;
+
     assert(Statistics::getInstance() != NULL);
     Statistics::getInstance()->registerCounter(this);
 }
 
 StatsCounter::~StatsCounter() {
-    freeAligned(m_value);
-    freeAligned(m_base);
+    /* The thread-local slots are owned by the statistics collector */
+}
+
+StatsCounterSlot *StatsCounter::getSlot() {
+    StatsSlotTable *table = getSlotTable();
+    if (EXPECT_TAKEN(table != NULL && m_id < table->slots.size())) {
+        StatsCounterSlot *slot = table->slots[m_id];
+        if (EXPECT_TAKEN(slot != NULL))
+            return slot;
+    }
+
+    Statistics *statistics = Statistics::getInstance();
+    if (EXPECT_NOT_TAKEN(!statistics)) /* Shutting down */
+        return &m_initialSlot;
+    return statistics->registerSlot(this);
 }
 
 bool StatsCounter::operator<(const StatsCounter &v) const {
@@ -115,21 +170,142 @@ bool StatsCounter::operator<(const StatsCounter &v) const {
 ref<Statistics> Statistics::m_instance = new Statistics();
 
 void Statistics::staticInitialization() {
-    SAssert(sizeof(CacheLineCounter) == 128);
+    SAssert(STATS_SLOTS_PER_BLOCK * sizeof(StatsCounterSlot)
+        % L1_CACHE_LINE_SIZE == 0);
 }
 
 void Statistics::staticShutdown() {
     m_instance = NULL;
 }
 
-Statistics::Statistics() {
+/// Timeline buffer of the current thread (owned by the statistics collector)
+static PrimitiveThreadLocal<void *> __traceBuffer;
+
+Statistics::Statistics() : m_traceEnabled(false) {
     m_mutex = new Mutex();
+    m_timer = new Timer();
+    m_startTicks = readTimestampCounter();
+}
+
+Statistics::~Statistics() {
+    for (size_t i=0; i<m_traceBuffers.size(); ++i)
+        delete m_traceBuffers[i];
+    for (size_t i=0; i<m_slotTables.size(); ++i)
+        delete m_slotTables[i];
+}
+
+Float Statistics::getTicksPerSecond() const {
+    uint64_t ticks = readTimestampCounter() - m_startTicks;
+    uint64_t ns = m_timer->getNanoseconds();
+    if (ns == 0)
+        return 0;
+    return (Float) (ticks * 1e9 / (double) ns);
+}
+
+void Statistics::setTraceEnabled(bool enabled) {
+    m_traceEnabled = enabled;
+}
+
+void Statistics::recordTraceEvent(const char *name, uint64_t start, uint64_t end) {
+    TraceBuffer *buffer = static_cast<TraceBuffer *>(__traceBuffer.get());
+    if (EXPECT_NOT_TAKEN(!buffer)) {
+        buffer = new TraceBuffer();
+        Thread *thread = Thread::getThread();
+        buffer->threadName = thread ? thread->getName() : "unknown";
+        buffer->mutex = new Mutex();
+        LockGuard lock(m_mutex);
+        m_traceBuffers.push_back(buffer);
+        __traceBuffer.get() = buffer;
+    }
+
+    TraceEvent event;
+    event.name = name;
+    event.start = start;
+    event.end = end;
+
+    /* Only contended while the timeline is being written */
+    LockGuard lock(buffer->mutex);
+    buffer->events.push_back(event);
+}
+
+void Statistics::writeTrace(const fs::path &filename) {
+    fs::ofstream os(filename);
+    if (!os.good())
+        Log(EError, "Unable to write the timeline to \"%s\"!", filename.string().c_str());
+
+    LockGuard lock(m_mutex);
+    double usPerTick = 1e6 / getTicksPerSecond();
+    size_t eventCount = 0;
+    bool first = true;
+
+    os << "{\"traceEvents\": [" << endl;
+    for (size_t i=0; i<m_traceBuffers.size(); ++i) {
+        TraceBuffer *buffer = m_traceBuffers[i];
+        LockGuard lock2(buffer->mutex);
+        if (!first)
+            os << "," << endl;
+        first = false;
+        os << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << i
+           << ", \"args\": {\"name\": \"" << buffer->threadName << "\"}}";
+        for (size_t j=0; j<buffer->events.size(); ++j) {
+            const TraceEvent &event = buffer->events[j];
+            os << "," << endl << "  {\"name\": \"" << event.name
+               << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << i
+               << ", \"ts\": " << (int64_t) (event.start - m_startTicks) * usPerTick
+               << ", \"dur\": " << (event.end - event.start) * usPerTick << "}";
+        }
+        eventCount += buffer->events.size();
+    }
+    os << endl << "]}" << endl;
+
+    Log(EInfo, "Wrote " SIZE_T_FMT " timeline events of " SIZE_T_FMT " threads to \"%s\"",
+        eventCount, m_traceBuffers.size(), filename.string().c_str());
 }
 
 void Statistics::registerCounter(const StatsCounter *ctr) {
     m_counters.push_back(ctr);
 }
 
+StatsCounterSlot *Statistics::registerSlot(StatsCounter *counter) {
+    StatsSlotTable *table = getSlotTable();
+    if (EXPECT_NOT_TAKEN(!table)) {
+        table = new StatsSlotTable();
+        LockGuard lock(m_mutex);
+        m_slotTables.push_back(table);
+        setSlotTable(table);
+    }
+
+    /* Only the owning thread modifies its table -- no locking needed */
+    if (table->used == STATS_SLOTS_PER_BLOCK) {
+        size_t size = STATS_SLOTS_PER_BLOCK * sizeof(StatsCounterSlot);
+        StatsCounterSlot *block = (StatsCounterSlot *) allocAligned(size);
+        memset(block, 0, size);
+        table->blocks.push_back(block);
+        table->used = 0;
+    }
+
+    StatsCounterSlot *slot = table->blocks.back() + table->used++;
+#if MTS_32BIT_COUNTERS == 1
+    slot->value = (uint32_t) counter->m_initial;
+#else
+    slot->value = counter->m_initial;
+#endif
+
+    if (counter->m_id >= table->slots.size())
+        table->slots.resize(counter->m_id + 1, NULL);
+    table->slots[counter->m_id] = slot;
+
+    /* Publish the slot so that it is included in the counter value */
+    StatsCounterSlot *head;
+    do {
+        head = counter->m_slots;
+        slot->next = head;
+    } while (!atomicCompareAndExchangePtr(const_cast<StatsCounterSlot **>(
+        &counter->m_slots), slot, head));
+
+    return slot;
+}
+
 void Statistics::logPlugin(const std::string &name, const std::string &descr) {
     m_plugins.push_back(std::pair<std::string, std::string>(name, descr));
 }
@@ -147,6 +323,15 @@ void Statistics::resetAll() {
     LockGuard lock(m_mutex);
     for (size_t i=0; i<m_counters.size(); ++i)
         const_cast<StatsCounter *>(m_counters[i])->reset();
+    for (size_t i=0; i<m_traceBuffers.size(); ++i) {
+        LockGuard lock2(m_traceBuffers[i]->mutex);
+        m_traceBuffers[i]->events.clear();
+    }
+}
+
+std::vector<const StatsCounter *> Statistics::getCounters() {
+    LockGuard lock(m_mutex);
+    return m_counters;
 }
 
 std::string Statistics::getStats() {
@@ -172,6 +357,7 @@ std::string Statistics::getStats() {
 
     std::sort(m_counters.begin(), m_counters.end(), compareCategory());
     int statsEntries = 0;
+    Float ticksPerSecond = getTicksPerSecond();
 
     for (size_t i=0; i<m_counters.size(); ++i) {
         const StatsCounter *counter = m_counters[i];
@@ -189,7 +375,7 @@ std::string Statistics::getStats() {
             value = (float) counter->getValue();
 
         if ((type != EPercentage && value == 0) ||
-            (type == EPercentage && baseValue == 0))
+            ((type == EPercentage || type == ETimeValue) && baseValue == 0))
             continue;
 
         if (category != counter->getCategory()) {
@@ -256,6 +442,19 @@ std::string Statistics::getStats() {
                         value3, suffixesNumber[suffixIndex2].c_str());
                     break;
                 }
+            case ETimeValue: {
+                    Float seconds = ticksPerSecond > 0 ? value / ticksPerSecond : 0;
+                    Float perCall = seconds / (Float) baseValue;
+                    Float value3 = baseValue;
+                    while (value3 > 1000.0f && suffixIndex2 < lastSuffix) {
+                        value3 /= 1000.0f;
+                        suffixIndex2++;
+                    }
+                    snprintf(temp, sizeof(temp), "    -  %s : %s (%.2f%s calls, %.3f us/call)",
+                        counter->getName().c_str(), timeString(seconds, true).c_str(),
+                        value3, suffixesNumber[suffixIndex2].c_str(), perCall * 1e6f);
+                    break;
+                }
             default:
                 Log(EError, "Unknown counter type!");
         }
@@ -426,17 +426,17 @@ std::string Stream::readString() {
 }
 
 void Stream::copyTo(Stream *stream, int64_t numBytes) {
-    const int block_size = 512;
-    char data[block_size];
-    size_t copied = 0;
+    /* Large blocks keep the per-call overhead of big transfers (e.g.
+       serialized textures) low */
+    const size_t block_size = 256 * 1024;
 
     size_t amount = (numBytes == -1) ? (getSize() - getPos()) : (size_t) numBytes;
+    std::vector<char> data(std::min(amount, block_size));
     for (size_t i=0; i<amount; i+=block_size) {
         size_t blockSize = (i + block_size) <= amount ? block_size : amount-i;
 
-        read(data, blockSize);
-        copied += blockSize;
-        stream->write(data, blockSize);
+        read(&data[0], blockSize);
+        stream->write(&data[0], blockSize);
     }
 }
 
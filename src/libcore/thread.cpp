@@ -411,6 +411,10 @@ int Thread::getCoreAffinity() const {
     return d->coreAffinity;
 }
 
+int Thread::getNUMANode() const {
+    return getCoreNUMANode(d->coreAffinity);
+}
+
 void Thread::dispatch(Thread *thread) {
     detail::initializeLocalTLS();
 
@@ -44,7 +44,12 @@ namespace mi = boost::multi_index;
    such limits (caching in various subsystems of Mitsuba may create a huge amount,
    so this is a big deal) as well as nice cleanup semantics. The implementation
    is designed to make the \c get() operation as fast as as possible at the cost
-   of more involved locking when creating or destroying threads and TLS objects */
+   of more involved locking when creating or destroying threads and TLS objects.
+
+   Every TLS object is assigned a slot index when it is created (indices of
+   destroyed objects are recycled). Besides the hash map, each thread keeps
+   an array of data pointers indexed by slot, hence a \c get() of an entry
+   that already exists amounts to a native TLS read and an indexed load. */
 namespace detail {
 
 /// A single TLS entry + cleanup hook
@@ -82,6 +87,8 @@ struct PerThreadData {
 
     Map map;
     boost::recursive_mutex mutex;
+    /// Data pointers indexed by the slot index of the TLS object
+    std::vector<void *> slots;
 };
 
 /// List of all PerThreadData data structures (one for each thread)
@@ -89,6 +96,24 @@ boost::unordered_set<PerThreadData *> ptdGlobal;
 /// Lock to protect ptdGlobal
 boost::mutex ptdGlobalLock;
 
+/// Allocator of slot indices
+struct SlotAllocator {
+    boost::mutex mutex;
+    /// Number of slot indices handed out so far
+    size_t count;
+    /// Slot indices of destroyed TLS objects (to be reused)
+    std::vector<size_t> freeList;
+
+    SlotAllocator() : count(0) { }
+
+    /* Static TLS objects may be created before the globals of this file
+       are initialized -- construct the allocator on first use */
+    static SlotAllocator &getInstance() {
+        static SlotAllocator allocator;
+        return allocator;
+    }
+};
+
 #if defined(__WINDOWS__)
 __declspec(thread) PerThreadData *ptdLocal = NULL;
 #elif defined(__LINUX__)
@@ -97,13 +122,31 @@ __thread PerThreadData *ptdLocal = NULL;
 pthread_key_t ptdLocal;
 #endif
 
+static inline PerThreadData *getPerThreadData() {
+#if defined(__OSX__)
+    return (PerThreadData *) pthread_getspecific(ptdLocal);
+#else
+    return ptdLocal;
+#endif
+}
+
 struct ThreadLocalBase::ThreadLocalPrivate {
     ConstructFunctor constructFunctor;
     DestructFunctor destructFunctor;
+    size_t slot;
 
     ThreadLocalPrivate(const ConstructFunctor &constructFunctor,
             const DestructFunctor &destructFunctor) : constructFunctor(constructFunctor),
-            destructFunctor(destructFunctor) { }
+            destructFunctor(destructFunctor) {
+        SlotAllocator &allocator = SlotAllocator::getInstance();
+        boost::lock_guard<boost::mutex> guard(allocator.mutex);
+        if (allocator.freeList.empty()) {
+            slot = allocator.count++;
+        } else {
+            slot = allocator.freeList.back();
+            allocator.freeList.pop_back();
+        }
+    }
 
     ~ThreadLocalPrivate() {
         /* The TLS object was destroyed. Walk through all threads
@@ -122,24 +165,34 @@ struct ThreadLocalBase::ThreadLocalPrivate {
                 entry = it2->second;
                 ptd->map.erase(it2);
             }
+            if (slot < ptd->slots.size())
+                ptd->slots[slot] = NULL;
 
             lock.unlock();
 
             if (entry.data)
                 destructFunctor(entry.data);
         }
+
+        SlotAllocator &allocator = SlotAllocator::getInstance();
+        boost::lock_guard<boost::mutex> guard2(allocator.mutex);
+        allocator.freeList.push_back(slot);
+    }
+
+    /// Look up a TLS entry using the slot table of the current thread
+    inline void *getCached() {
+        PerThreadData *ptd = getPerThreadData();
+        if (EXPECT_TAKEN(ptd != NULL && slot < ptd->slots.size()))
+            return ptd->slots[slot];
+        return NULL;
     }
 
-    /// Look up a TLS entry. The goal is to make this operation very fast!
+    /// Look up a TLS entry in the per-thread map and update the slot table
     std::pair<void *, bool> get() {
         bool existed = true;
         void *data;
 
-#if defined(__OSX__)
-        PerThreadData *ptd = (PerThreadData *) pthread_getspecific(ptdLocal);
-#else
-        PerThreadData *ptd = ptdLocal;
-#endif
+        PerThreadData *ptd = getPerThreadData();
         if (EXPECT_NOT_TAKEN(!ptd))
             throw std::runtime_error("Internal error: call to ThreadLocalPrivate::get() "
                 " precedes the construction of thread-specific data structures!");
@@ -158,6 +211,10 @@ struct ThreadLocalBase::ThreadLocalPrivate {
             existed = false;
         }
 
+        if (slot >= ptd->slots.size())
+            ptd->slots.resize(slot + 1, NULL);
+        ptd->slots[slot] = data;
+
         return std::make_pair(data, existed);
     }
 };
@@ -169,25 +226,45 @@ ThreadLocalBase::ThreadLocalBase(
 ThreadLocalBase::~ThreadLocalBase() { }
 
 void *ThreadLocalBase::get() {
+    void *data = d->getCached();
+    if (EXPECT_TAKEN(data != NULL))
+        return data;
     return d->get().first;
 }
 
 const void *ThreadLocalBase::get() const {
+    void *data = d->getCached();
+    if (EXPECT_TAKEN(data != NULL))
+        return data;
     return d->get().first;
 }
 
 void *ThreadLocalBase::get(bool &existed) {
+    void *data = d->getCached();
+    if (EXPECT_TAKEN(data != NULL)) {
+        existed = true;
+        return data;
+    }
     std::pair<void *, bool> result = d->get();
     existed = result.second;
     return result.first;
 }
 
 const void *ThreadLocalBase::get(bool &existed) const {
+    void *data = d->getCached();
+    if (EXPECT_TAKEN(data != NULL)) {
+        existed = true;
+        return data;
+    }
     std::pair<void *, bool> result = d->get();
     existed = result.second;
     return result.first;
 }
 
+void *ThreadLocalBase::getUncached() {
+    return d->get().first;
+}
+
 void initializeGlobalTLS() {
 #if defined(__OSX__)
     pthread_key_create(&ptdLocal, NULL);
@@ -223,11 +300,7 @@ void initializeLocalTLS() {
 void destroyLocalTLS() {
     boost::lock_guard<boost::mutex> guard(ptdGlobalLock);
 
-#if defined(__OSX__)
-    PerThreadData *ptd = (PerThreadData *) pthread_getspecific(ptdLocal);
-#else
-    PerThreadData *ptd = ptdLocal;
-#endif
+    PerThreadData *ptd = getPerThreadData();
 
     boost::unique_lock<boost::recursive_mutex> lock(ptd->mutex);
 
@@ -6,7 +6,9 @@
 MTS_NAMESPACE_BEGIN
 
 AnimatedTransform::AnimatedTransform(const AnimatedTransform *trafo)
-        : m_transform(trafo->m_transform) {
+        : m_transform(trafo->m_transform), m_samples(trafo->m_samples),
+          m_sampleStart(trafo->m_sampleStart),
+          m_invSampleSpacing(trafo->m_invSampleSpacing) {
     m_tracks.reserve(trafo->getTrackCount());
     for (size_t i=0; i<trafo->getTrackCount(); ++i) {
         AbstractAnimationTrack *track = trafo->getTrack(i)->clone();
@@ -15,7 +17,8 @@ AnimatedTransform::AnimatedTransform(const AnimatedTransform *trafo)
     }
 }
 
-AnimatedTransform::AnimatedTransform(Stream *stream) {
+AnimatedTransform::AnimatedTransform(Stream *stream)
+        : m_sampleStart(0), m_invSampleSpacing(0) {
     size_t nTracks = stream->readSize();
     if (nTracks == 0) {
         m_transform = Transform(stream);
@@ -56,6 +59,7 @@ AnimatedTransform::AnimatedTransform(Stream *stream) {
 void AnimatedTransform::addTrack(AbstractAnimationTrack *track) {
     track->incRef();
     m_tracks.push_back(track);
+    m_samples.clear();
 }
 
 AABB1 AnimatedTransform::getTimeBounds() const {
@@ -149,6 +153,7 @@ AnimatedTransform::~AnimatedTransform() {
 
 void AnimatedTransform::sortAndSimplify() {
     bool isStatic = true;
+    m_samples.clear();
 
     for (size_t i=0; i<m_tracks.size(); ++i) {
         AbstractAnimationTrack *track = m_tracks[i];
@@ -218,6 +223,7 @@ void AnimatedTransform::prependScale(const Vector &scale) {
     FloatTrack *trackY = (FloatTrack *) findTrack(AbstractAnimationTrack::EScaleY);
     FloatTrack *trackZ = (FloatTrack *) findTrack(AbstractAnimationTrack::EScaleZ);
     VectorTrack *trackXYZ = (VectorTrack *) findTrack(AbstractAnimationTrack::EScaleXYZ);
+    m_samples.clear();
 
     if (m_tracks.empty()) {
         m_transform = m_transform * Transform::scale(scale);
@@ -273,7 +279,50 @@ void AnimatedTransform::serialize(Stream *stream) const {
     }
 }
 
+void AnimatedTransform::precompute(Float start, Float end, size_t sampleCount) {
+    m_samples.clear();
+    if (sampleCount == 0 || m_tracks.empty())
+        return;
+    if (!(end > start))
+        Log(EError, "AnimatedTransform::precompute(): the time interval must be nonempty!");
+
+    sampleCount = std::max(sampleCount, (size_t) 2);
+    Float spacing = (end - start) / (sampleCount - 1);
+    m_samples.resize(sampleCount);
+    for (size_t i=0; i<sampleCount; ++i)
+        evalTracks(i == sampleCount-1 ? end : start + i * spacing, m_samples[i]);
+
+    m_sampleStart = start;
+    m_invSampleSpacing = 1 / spacing;
+}
+
 void AnimatedTransform::TransformFunctor::operator()(const Float &t, Transform &trafo) const {
+    const std::vector<Transform> &samples = m_trafo.m_samples;
+    Float pos = (t - m_trafo.m_sampleStart) * m_trafo.m_invSampleSpacing;
+
+    if (samples.empty() || !(pos >= 0 && pos <= samples.size() - 1)) {
+        m_trafo.evalTracks(t, trafo);
+        return;
+    }
+
+    /* Interpolate between the two nearest precomputed samples */
+    size_t idx = std::min((size_t) pos, samples.size() - 2);
+    Float alpha = pos - idx;
+    const Matrix4x4 &m0 = samples[idx].getMatrix(),
+                    &m1 = samples[idx+1].getMatrix(),
+                    &inv0 = samples[idx].getInverseMatrix(),
+                    &inv1 = samples[idx+1].getInverseMatrix();
+    Matrix4x4 m, inv;
+    for (int i=0; i<4; ++i) {
+        for (int j=0; j<4; ++j) {
+            m.m[i][j] = (1-alpha) * m0.m[i][j] + alpha * m1.m[i][j];
+            inv.m[i][j] = (1-alpha) * inv0.m[i][j] + alpha * inv1.m[i][j];
+        }
+    }
+    trafo = Transform(m, inv);
+}
+
+void AnimatedTransform::evalTracks(Float t, Transform &trafo) const {
     Vector translation(0.0f);
     Vector scale(1.0f);
     Quaternion rotation;
@@ -324,6 +373,7 @@ void AnimatedTransform::TransformFunctor::operator()(const Float &t, Transform &
 }
 
 void AnimatedTransform::appendTransform(Float time, const Transform &trafo) {
+    m_samples.clear();
     /* Compute the polar decomposition and insert into the animated transform;
        uh oh.. we have to get rid of the two separate matrix libraries at some point :) */
     typedef Eigen::Matrix<Float, 3, 3> EMatrix;
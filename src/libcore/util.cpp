@@ -25,8 +25,18 @@
 #include <boost/bind.hpp>
 #include <stdarg.h>
 #include <iomanip>
+#include <fstream>
 #include <errno.h>
 
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define MTS_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
 #if defined(__OSX__)
 #include <sys/sysctl.h>
 #include <mach/mach.h>
@@ -47,6 +57,7 @@
 # include <sys/socket.h>
 # include <netdb.h>
 # include <fenv.h>
+# include <sys/resource.h>
 #endif
 
 // SSE is not enabled in general when using double precision, however it is
@@ -216,6 +227,224 @@ done:
 #endif
 }
 
+#if defined(__LINUX__)
+/// Parse a sysfs list such as "0-3,8-11" into its entries
+static std::vector<int> parseSysfsList(const std::string &list) {
+    std::vector<int> result;
+    std::vector<std::string> ranges = tokenize(list, ",\n");
+    for (size_t i=0; i<ranges.size(); ++i) {
+        std::vector<std::string> bounds = tokenize(ranges[i], "-");
+        if (bounds.size() == 0 || bounds.size() > 2)
+            continue;
+        int first = atoi(bounds[0].c_str()),
+            last = atoi(bounds[bounds.size()-1].c_str());
+        for (int j=first; j<=last; ++j)
+            result.push_back(j);
+    }
+    return result;
+}
+
+static std::string readSysfsLine(const std::string &path) {
+    std::ifstream is(path.c_str());
+    std::string line;
+    if (!is.fail())
+        std::getline(is, line);
+    return line;
+}
+#endif
+
+/// NUMA node of every available core (dense node indices)
+static std::vector<int> detectNUMATopology() {
+    std::vector<int> coreNodes(getCoreCount(), 0);
+
+#if defined(__LINUX__)
+    std::vector<int> nodes = parseSysfsList(
+        readSysfsLine("/sys/devices/system/node/online"));
+    if (nodes.size() <= 1)
+        return coreNodes;
+
+    std::map<int, int> cpuToNode;
+    for (size_t i=0; i<nodes.size(); ++i) {
+        std::vector<int> cpus = parseSysfsList(readSysfsLine(formatString(
+            "/sys/devices/system/node/node%i/cpulist", nodes[i])));
+        for (size_t j=0; j<cpus.size(); ++j)
+            cpuToNode[cpus[j]] = (int) i;
+    }
+
+    /* Enumerate the available CPUs in the order that is
+       also used by Thread::setCoreAffinity() */
+    int nLogicalCores = sysconf(_SC_NPROCESSORS_CONF);
+    size_t size = 0;
+    cpu_set_t *cpuset = NULL;
+    int retval = EINVAL;
+    for (int i = 0; i<6 && retval == EINVAL; ++i) {
+        size = CPU_ALLOC_SIZE(nLogicalCores);
+        cpuset = CPU_ALLOC(nLogicalCores);
+        if (!cpuset)
+            return coreNodes;
+        CPU_ZERO_S(size, cpuset);
+        retval = pthread_getaffinity_np(pthread_self(), size, cpuset);
+        if (retval != 0) {
+            CPU_FREE(cpuset);
+            cpuset = NULL;
+            nLogicalCores *= 2;
+        }
+    }
+
+    if (retval) {
+        SLog(EWarn, "getNUMANodeCount(): could not read the thread "
+            "affinity map: %s", strerror(retval));
+        return coreNodes;
+    }
+
+    /* Compact the node indices of the available cores */
+    std::map<int, int> denseIndex;
+    int coreID = 0;
+    for (int i=0; i<nLogicalCores && coreID < (int) coreNodes.size(); ++i) {
+        if (!CPU_ISSET_S(i, size, cpuset))
+            continue;
+        int node = cpuToNode.find(i) != cpuToNode.end() ? cpuToNode[i] : 0;
+        if (denseIndex.find(node) == denseIndex.end()) {
+            int index = (int) denseIndex.size();
+            denseIndex[node] = index;
+        }
+        coreNodes[coreID++] = denseIndex[node];
+    }
+    CPU_FREE(cpuset);
+
+    /* Keep the node order of the system */
+    std::map<int, int> remap;
+    int index = 0;
+    for (std::map<int, int>::iterator it = denseIndex.begin();
+            it != denseIndex.end(); ++it)
+        remap[(*it).second] = index++;
+    for (size_t i=0; i<coreNodes.size(); ++i)
+        coreNodes[i] = remap[coreNodes[i]];
+#endif
+
+    return coreNodes;
+}
+
+static const std::vector<int> &getNUMATopology() {
+    static std::vector<int> coreNodes = detectNUMATopology();
+    return coreNodes;
+}
+
+int getNUMANodeCount() {
+    const std::vector<int> &coreNodes = getNUMATopology();
+    int count = 1;
+    for (size_t i=0; i<coreNodes.size(); ++i)
+        count = std::max(count, coreNodes[i] + 1);
+    return count;
+}
+
+int getCoreNUMANode(int coreID) {
+    const std::vector<int> &coreNodes = getNUMATopology();
+    if (coreID < 0)
+        return -1;
+    else if (coreNodes.empty())
+        return 0;
+    return coreNodes[coreID % coreNodes.size()];
+}
+
+std::vector<int> getNUMACoreAssignment(int count) {
+    const std::vector<int> &coreNodes = getNUMATopology();
+    int nodeCount = getNUMANodeCount();
+    std::vector<std::vector<int> > nodeCores(nodeCount);
+    for (size_t i=0; i<coreNodes.size(); ++i)
+        nodeCores[coreNodes[i]].push_back((int) i);
+
+    std::vector<int> result;
+    result.reserve(count);
+    size_t totalCores = coreNodes.size(), coresBefore = 0;
+    for (int node=0; node<nodeCount && totalCores > 0; ++node) {
+        const std::vector<int> &cores = nodeCores[node];
+        /* Number of workers in proportion to the node's core count */
+        size_t first = (count * coresBefore) / totalCores;
+        coresBefore += cores.size();
+        size_t last = (count * coresBefore) / totalCores;
+        for (size_t j=0; j<last-first; ++j)
+            result.push_back(cores[j % cores.size()]);
+    }
+    return result;
+}
+
+namespace {
+    /// Bit mask of the supported \ref ECPUFeature values
+    int detectCPUFeatures() {
+        if (getenv("MTS_CPU_BASELINE") != NULL)
+            return 0;
+        int features = 0;
+#if defined(MTS_X86)
+        unsigned int leaf1[4] = { 0, 0, 0, 0 }, leaf7[4] = { 0, 0, 0, 0 };
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+        __cpuid(info, 1);
+        for (int i=0; i<4; ++i)
+            leaf1[i] = (unsigned int) info[i];
+        if (maxLeaf >= 7) {
+            __cpuidex(info, 7, 0);
+            for (int i=0; i<4; ++i)
+                leaf7[i] = (unsigned int) info[i];
+        }
+#else
+        unsigned int maxLeaf = __get_cpuid_max(0, NULL);
+        __get_cpuid(1, &leaf1[0], &leaf1[1], &leaf1[2], &leaf1[3]);
+        if (maxLeaf >= 7)
+            __cpuid_count(7, 0, leaf7[0], leaf7[1], leaf7[2], leaf7[3]);
+#endif
+        const unsigned int ecx = leaf1[2], ebx7 = leaf7[1];
+        if (ecx & (1 << 19))
+            features |= 1 << ECPUSSE41;
+
+        /* The AVX family additionally needs the OS to save the YMM
+           registers on context switches (OSXSAVE + XCR0) */
+        bool osAVX = false;
+        if ((ecx & (1 << 27)) && (ecx & (1 << 28))) {
+#if defined(_MSC_VER)
+            unsigned long long xcr0 = _xgetbv(0);
+#else
+            unsigned int eax, edx;
+            __asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+            unsigned long long xcr0 = ((unsigned long long) edx << 32) | eax;
+#endif
+            osAVX = (xcr0 & 6) == 6;
+        }
+        if (osAVX) {
+            features |= 1 << ECPUAVX;
+            if (ebx7 & (1 << 5))
+                features |= 1 << ECPUAVX2;
+            if (ecx & (1 << 12))
+                features |= 1 << ECPUFMA;
+            if (ecx & (1 << 29))
+                features |= 1 << ECPUF16C;
+        }
+#endif
+        return features;
+    }
+};
+
+bool hasCPUFeature(ECPUFeature feature) {
+    static const int features = detectCPUFeatures();
+    return (features & (1 << feature)) != 0;
+}
+
+std::string getCPUFeatureString() {
+    const char *names[ECPUFeatureCount] = {
+        "SSE4.1", "AVX", "AVX2", "FMA", "F16C" };
+    std::string result;
+    for (int i=0; i<ECPUFeatureCount; ++i) {
+        if (!hasCPUFeature((ECPUFeature) i))
+            continue;
+        if (!result.empty())
+            result += " ";
+        result += names[i];
+    }
+    return result.empty() ? "none" : result;
+}
+
 size_t getTotalSystemMemory() {
 #if defined(__WINDOWS__)
     MEMORYSTATUSEX status;
@@ -274,6 +503,23 @@ size_t getPrivateMemoryUsage() {
 #endif
 }
 
+size_t getPeakMemoryUsage() {
+#if defined(__WINDOWS__)
+    PROCESS_MEMORY_COUNTERS pmc;
+    GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+    return (size_t) pmc.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(__OSX__)
+    return (size_t) usage.ru_maxrss; /* Bytes on Mac OS */
+#else
+    return (size_t) usage.ru_maxrss * 1024; /* Kilobytes on Linux */
+#endif
+#endif
+}
+
 #if defined(__WINDOWS__)
 std::string lastErrorText() {
     DWORD errCode = GetLastError();
@@ -541,9 +787,12 @@ bool solveLinearSystem2x2(const Float a[2][2], const Float b[2], Float x[2]) {
 void stratifiedSample1D(Random *random, Float *dest, int count, bool jitter) {
     Float invCount = 1.0f / count;
 
+    if (jitter)
+        random->fillFloat(dest, count);
+
     for (int i=0; i<count; i++) {
-        Float offset = jitter ? random->nextFloat() : 0.5f;
-        *dest++ = (i + offset) * invCount;
+        Float offset = jitter ? dest[i] : 0.5f;
+        dest[i] = (i + offset) * invCount;
     }
 }
 
@@ -551,13 +800,15 @@ void stratifiedSample2D(Random *random, Point2 *dest, int countX, int countY, bo
     Float invCountX = 1.0f / countX;
     Float invCountY = 1.0f / countY;
 
+    if (jitter)
+        random->fillPoint2(dest, (size_t) countX * countY);
+
     for (int x=0; x<countX; x++) {
         for (int y=0; y<countY; y++) {
-            Float offsetX = jitter ? random->nextFloat() : 0.5f;
-            Float offsetY = jitter ? random->nextFloat() : 0.5f;
+            Point2 offset = jitter ? *dest : Point2(0.5f);
             *dest++ = Point2(
-                (x + offsetX) * invCountX,
-                (y + offsetY) * invCountY
+                (x + offset.x) * invCountX,
+                (y + offset.y) * invCountY
             );
         }
     }
@@ -565,9 +816,10 @@ void stratifiedSample2D(Random *random, Point2 *dest, int countX, int countY, bo
 
 void latinHypercube(Random *random, Float *dest, size_t nSamples, size_t nDim) {
     Float delta = 1 / (Float) nSamples;
+    random->fillFloat(dest, nSamples * nDim);
     for (size_t i = 0; i < nSamples; ++i)
         for (size_t j = 0; j < nDim; ++j)
-            dest[nDim * i + j] = (i + random->nextFloat()) * delta;
+            dest[nDim * i + j] = (i + dest[nDim * i + j]) * delta;
     for (size_t i = 0; i < nDim; ++i) {
         for (size_t j = 0; j < nSamples; ++j) {
             size_t other = random->nextSize(nSamples);
@@ -78,6 +78,57 @@ Point2 squareToUniformTriangle(const Point2 &sample) {
     return Point2(1 - a, a * sample.y);
 }
 
+Vector squareToSphericalTriangle(const Vector &_a, const Vector &_b,
+        const Vector &_c, const Point2 &sample) {
+    /* All computations are done in double precision -- the
+       angle sums below are prone to cancellation otherwise */
+    Vector3d a(_a), b(_b), c(_c);
+    Vector3d nAB = cross(a, b), nBC = cross(b, c), nCA = cross(c, a);
+    double lAB = nAB.length(), lBC = nBC.length(), lCA = nCA.length();
+    if (lAB == 0 || lBC == 0 || lCA == 0)
+        return _a; /* Degenerate triangle */
+    nAB /= lAB; nBC /= lBC; nCA /= lCA;
+
+    /* Interior angles at the three vertices */
+    double alpha = math::safe_acos(-dot(nAB, nCA)),
+           beta  = math::safe_acos(-dot(nBC, nAB)),
+           gamma = math::safe_acos(-dot(nCA, nBC));
+    double area = alpha + beta + gamma - M_PI_DBL;
+
+    /* Choose the sub-triangle (a, b, c') with the desired area */
+    double sinPhi = std::sin(sample.x * area - alpha),
+           cosPhi = std::cos(sample.x * area - alpha);
+    double cosAlpha = std::cos(alpha), sinAlpha = std::sin(alpha);
+    double u = cosPhi - cosAlpha,
+           v = sinPhi + sinAlpha * dot(a, b);
+    double denom = (v * sinPhi + u * cosPhi) * sinAlpha;
+    double q = denom != 0 ? ((v * cosPhi - u * sinPhi) * cosAlpha - v) / denom : 1.0;
+    q = math::clamp(q, -1.0, 1.0);
+
+    Vector3d cPerp = c - dot(c, a) * a;
+    double cPerpLength = cPerp.length();
+    Vector3d cp = q * a;
+    if (cPerpLength > 0)
+        cp += std::sqrt(1 - q*q) / cPerpLength * cPerp;
+
+    /* Choose a point on the arc between b and c' */
+    double z = math::clamp(1 - sample.y * (1 - dot(cp, b)), -1.0, 1.0);
+    Vector3d pPerp = cp - dot(cp, b) * b;
+    double pPerpLength = pPerp.length();
+    Vector3d result = z * b;
+    if (pPerpLength > 0)
+        result += std::sqrt(1 - z*z) / pPerpLength * pPerp;
+
+    return Vector(normalize(result));
+}
+
+Float sphericalTriangleArea(const Vector &_a, const Vector &_b, const Vector &_c) {
+    Vector3d a(_a), b(_b), c(_c);
+    double numer = std::abs(dot(a, cross(b, c))),
+           denom = 1 + dot(a, b) + dot(b, c) + dot(c, a);
+    return (Float) (2 * std::atan2(numer, denom));
+}
+
 Point2 squareToUniformDiskConcentric(const Point2 &sample) {
     Float r1 = 2.0f*sample.x - 1.0f;
     Float r2 = 2.0f*sample.y - 1.0f;
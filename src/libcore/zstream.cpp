@@ -17,15 +17,18 @@
 */
 
 #include <mitsuba/core/zstream.h>
+#include <mitsuba/core/util.h>
 
 MTS_NAMESPACE_BEGIN
 
 ZStream::ZStream(Stream *childStream, EStreamType streamType, int level)
-        : m_childStream(childStream), m_didWrite(false) {
+        : m_childStream(childStream), m_streamType(streamType), m_level(level),
+          m_blockPos(0), m_blockEnd(false), m_didWrite(false) {
     m_deflateStream.zalloc = Z_NULL;
     m_deflateStream.zfree = Z_NULL;
     m_deflateStream.opaque = Z_NULL;
 
+    /* Blocks of an EBlockStream use the zlib format (with checksums) */
     int windowBits = 15 + (streamType == EGZipStream ? 16 : 0);
 
     int retval = deflateInit2(&m_deflateStream, level,
@@ -75,7 +78,90 @@ void ZStream::flush() {
     Log(EError, "flush(): not implemented!");
 }
 
+void ZStream::writeBlocks() {
+    size_t blockCount = (m_blockBuffer.size() + ZSTREAM_BLOCKSIZE - 1) / ZSTREAM_BLOCKSIZE;
+    std::vector<std::vector<uint8_t> > compressed(blockCount);
+    std::vector<uLongf> compressedSize(blockCount);
+    bool failed = false;
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i=0; i<(int) blockCount; ++i) {
+        size_t offset = (size_t) i * ZSTREAM_BLOCKSIZE,
+               size = std::min((size_t) ZSTREAM_BLOCKSIZE, m_blockBuffer.size() - offset);
+        compressedSize[i] = compressBound((uLong) size);
+        compressed[i].resize(compressedSize[i]);
+        if (compress2(&compressed[i][0], &compressedSize[i], &m_blockBuffer[offset],
+                (uLong) size, m_level) != Z_OK)
+            failed = true;
+    }
+    if (failed)
+        Log(EError, "compress2(): unable to compress a block!");
+
+    for (size_t i=0; i<blockCount; ++i) {
+        size_t offset = i * ZSTREAM_BLOCKSIZE,
+               size = std::min((size_t) ZSTREAM_BLOCKSIZE, m_blockBuffer.size() - offset);
+        m_childStream->writeUInt((uint32_t) size);
+        m_childStream->writeUInt((uint32_t) compressedSize[i]);
+        m_childStream->write(&compressed[i][0], compressedSize[i]);
+    }
+    m_blockBuffer.clear();
+}
+
+void ZStream::readBlocks() {
+    size_t maxBlocks = (size_t) std::max(1, 2 * getCoreCount());
+    std::vector<std::vector<uint8_t> > compressed;
+    std::vector<size_t> offsets(1, 0);
+
+    while (compressed.size() < maxBlocks) {
+        uint32_t size = m_childStream->readUInt();
+        if (size == 0) {
+            m_blockEnd = true;
+            break;
+        }
+        if (size > ZSTREAM_BLOCKSIZE)
+            Log(EError, "Encountered an invalid compressed block!");
+        uint32_t compressedSize = m_childStream->readUInt();
+        compressed.push_back(std::vector<uint8_t>(compressedSize));
+        m_childStream->read(&compressed.back()[0], compressedSize);
+        offsets.push_back(offsets.back() + size);
+    }
+
+    m_blockBuffer.resize(offsets.back());
+    m_blockPos = 0;
+    bool failed = false;
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i=0; i<(int) compressed.size(); ++i) {
+        uLongf size = (uLongf) (offsets[i+1] - offsets[i]);
+        if (uncompress(&m_blockBuffer[offsets[i]], &size, &compressed[i][0],
+                (uLong) compressed[i].size()) != Z_OK || size != offsets[i+1] - offsets[i])
+            failed = true;
+    }
+    if (failed)
+        Log(EError, "uncompress(): data error!");
+}
+
 void ZStream::write(const void *ptr, size_t size) {
+    if (m_streamType == EBlockStream) {
+        /* Collect a batch of blocks per core before compressing */
+        const uint8_t *data = (const uint8_t *) ptr;
+        size_t batchSize = (size_t) std::max(1, 2 * getCoreCount()) * ZSTREAM_BLOCKSIZE;
+        while (size > 0) {
+            size_t amount = std::min(size, batchSize - m_blockBuffer.size());
+            m_blockBuffer.insert(m_blockBuffer.end(), data, data + amount);
+            data += amount;
+            size -= amount;
+            if (m_blockBuffer.size() == batchSize)
+                writeBlocks();
+        }
+        m_didWrite = true;
+        return;
+    }
+
     m_deflateStream.avail_in = (uInt) size;
     m_deflateStream.next_in = (uint8_t *) ptr;
 
@@ -100,6 +186,24 @@ void ZStream::write(const void *ptr, size_t size) {
 
 void ZStream::read(void *ptr, size_t size) {
     uint8_t *targetPtr = (uint8_t *) ptr;
+
+    if (m_streamType == EBlockStream) {
+        while (size > 0) {
+            if (m_blockPos == m_blockBuffer.size()) {
+                if (m_blockEnd)
+                    Log(EError, "Read less data than expected (%i more bytes required)", size);
+                readBlocks();
+                continue;
+            }
+            size_t amount = std::min(size, m_blockBuffer.size() - m_blockPos);
+            memcpy(targetPtr, &m_blockBuffer[m_blockPos], amount);
+            m_blockPos += amount;
+            targetPtr += amount;
+            size -= amount;
+        }
+        return;
+    }
+
     while (size > 0) {
         if (m_inflateStream.avail_in == 0) {
             size_t remaining = m_childStream->getSize() - m_childStream->getPos();
@@ -135,7 +239,11 @@ void ZStream::read(void *ptr, size_t size) {
 }
 
 ZStream::~ZStream() {
-    if (m_didWrite) {
+    if (m_didWrite && m_streamType == EBlockStream) {
+        if (!m_blockBuffer.empty())
+            writeBlocks();
+        m_childStream->writeUInt(0);
+    } else if (m_didWrite) {
         m_deflateStream.avail_in = 0;
         m_deflateStream.next_in = NULL;
         int outputSize = 0;
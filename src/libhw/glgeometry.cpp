@@ -60,11 +60,21 @@ void GLGeometry::refresh() {
         memString(m_size[EVertexID] + m_size[EIndexID]).c_str());
 
     GLfloat *vertices = new GLfloat[vertexCount * m_stride/sizeof(GLfloat)];
-    GLuint *indices = (GLuint *) m_mesh->getTriangles();
+    GLuint *indices = (GLuint *) m_mesh->getTriangles(), *compactIndices = NULL;
     const Point *sourcePositions = m_mesh->getVertexPositions();
-    const Normal *sourceNormals = m_mesh->getVertexNormals();
-    const Point2 *sourceTexcoords = m_mesh->getVertexTexcoords();
     const Color3 *sourceColors = m_mesh->getVertexColors();
+    bool hasNormals = m_mesh->hasVertexNormals(),
+         hasTexcoords = m_mesh->hasVertexTexcoords();
+
+    if (!indices) {
+        /* Expand the indices of compact meshes */
+        compactIndices = indices = new GLuint[3*triCount];
+        for (size_t i=0; i<triCount; ++i) {
+            const Triangle tri = m_mesh->getTriangle(i);
+            for (int j=0; j<3; ++j)
+                indices[3*i+j] = tri.idx[j];
+        }
+    }
     Vector *sourceTangents = NULL;
 
     if (m_mesh->hasUVTangents()) {
@@ -75,7 +85,7 @@ void GLGeometry::refresh() {
         memset(sourceTangents, 0, sizeof(Vector)*vertexCount);
 
         for (size_t i=0; i<triCount; ++i) {
-            const Triangle &tri = m_mesh->getTriangles()[i];
+            const Triangle tri = m_mesh->getTriangle(i);
             const TangentSpace &tangents = triTangents[i];
             for (int j=0; j<3; ++j) {
                 sourceTangents[tri.idx[j]] += tangents.dpdu;
@@ -97,14 +107,16 @@ void GLGeometry::refresh() {
         vertices[pos++] = (GLfloat) sourcePositions[i].x;
         vertices[pos++] = (GLfloat) sourcePositions[i].y;
         vertices[pos++] = (GLfloat) sourcePositions[i].z;
-        if (sourceNormals) {
-            vertices[pos++] = (GLfloat) sourceNormals[i].x;
-            vertices[pos++] = (GLfloat) sourceNormals[i].y;
-            vertices[pos++] = (GLfloat) sourceNormals[i].z;
+        if (hasNormals) {
+            Normal n = m_mesh->getVertexNormal(i);
+            vertices[pos++] = (GLfloat) n.x;
+            vertices[pos++] = (GLfloat) n.y;
+            vertices[pos++] = (GLfloat) n.z;
         }
-        if (sourceTexcoords) {
-            vertices[pos++] = (GLfloat) sourceTexcoords[i].x;
-            vertices[pos++] = (GLfloat) sourceTexcoords[i].y;
+        if (hasTexcoords) {
+            Point2 uv = m_mesh->getVertexTexcoord(i);
+            vertices[pos++] = (GLfloat) uv.x;
+            vertices[pos++] = (GLfloat) uv.y;
         }
         if (sourceTangents) {
             vertices[pos++] = (GLfloat) sourceTangents[i].x;
@@ -135,6 +147,7 @@ void GLGeometry::refresh() {
     unbind();
 
     delete[] vertices;
+    delete[] compactIndices;
     if (sourceTangents)
         delete[] sourceTangents;
 }
@@ -286,6 +286,10 @@ void GLRenderer::drawMesh(const TriMesh *mesh) {
     std::map<const Shape *, GPUGeometry *>::iterator it = m_geometry.find(mesh);
     if (it != m_geometry.end()) {
         GLRenderer::drawMesh((*it).second);
+    } else if (mesh->isCompact()) {
+        /* The vertex arrays below can't point into compact meshes */
+        Log(EWarn, "drawMesh(): compact mesh \"%s\" must be registered "
+            "as GPU geometry to be drawn!", mesh->getName().c_str());
     } else {
         /* This shape is not resident in GPU memory. Draw the slow way.. */
         const GLchar *positions = (const GLchar *) mesh->getVertexPositions();
@@ -208,6 +208,21 @@ static void scheduler_wait(Scheduler *scheduler, const ParallelProcess *proc) {
     scheduler->wait(proc);
 }
 
+static void scheduler_start(Scheduler *scheduler) {
+    ReleaseGIL gil;
+    scheduler->start();
+}
+
+static void scheduler_pause(Scheduler *scheduler) {
+    ReleaseGIL gil;
+    scheduler->pause();
+}
+
+static void scheduler_stop(Scheduler *scheduler) {
+    ReleaseGIL gil;
+    scheduler->stop();
+}
+
 static Matrix4x4 *Matrix4x4_fromList(bp::list list) {
     if (bp::len(list) == 4) {
         Float buf[4][4];
@@ -670,29 +685,55 @@ static void bitmap_applyMatrix(Bitmap *bitmap, bp::list list) {
 }
 
 static void bitmap_write1(Bitmap *bitmap, Bitmap::EFileFormat fmt, Stream *stream) {
+    ReleaseGIL gil;
     bitmap->write(fmt, stream);
 }
 
 static void bitmap_write2(Bitmap *bitmap, Bitmap::EFileFormat fmt, Stream *stream, int compression) {
+    ReleaseGIL gil;
     bitmap->write(fmt, stream, compression);
 }
 
 static void bitmap_write3(Bitmap *bitmap, Bitmap::EFileFormat fmt, const fs::path &path) {
+    ReleaseGIL gil;
     bitmap->write(fmt, path);
 }
 
 static void bitmap_write4(Bitmap *bitmap, Bitmap::EFileFormat fmt, const fs::path &path, int compression) {
+    ReleaseGIL gil;
     bitmap->write(fmt, path, compression);
 }
 
 static void bitmap_write5(Bitmap *bitmap, const fs::path &path) {
+    ReleaseGIL gil;
     bitmap->write(path);
 }
 
 static void bitmap_write6(Bitmap *bitmap, const fs::path &path, int compression) {
+    ReleaseGIL gil;
     bitmap->write(path, compression);
 }
 
+static ref<Bitmap> bitmap_read1(Bitmap::EFileFormat fmt, Stream *stream) {
+    ReleaseGIL gil;
+    return new Bitmap(fmt, stream);
+}
+
+static ref<Bitmap> bitmap_read2(Bitmap::EFileFormat fmt, Stream *stream, const std::string &prefix) {
+    ReleaseGIL gil;
+    return new Bitmap(fmt, stream, prefix);
+}
+
+static ref<Bitmap> bitmap_read3(const fs::path &path) {
+    ReleaseGIL gil;
+    return new Bitmap(path);
+}
+
+static ref<Bitmap> bitmap_read4(const fs::path &path, const std::string &prefix) {
+    ReleaseGIL gil;
+    return new Bitmap(path, prefix);
+}
+
 static void bitmap_convert_0(Bitmap *bitmap, Bitmap *target) {
     bitmap->convert(target);
 }
@@ -747,28 +788,32 @@ static ref<Bitmap> bitmap_extractChannels(Bitmap::EPixelFormat fmt, Bitmap *bitm
     return bitmap->extractChannels(fmt, channels);
 }
 
+/* Copy between a bitmap and any object implementing the buffer protocol
+   (bytearray, numpy arrays, ..) without going through Python-level loops */
 static void bitmap_fromByteArray(Bitmap *bitmap, bp::object obj) {
-    if (PyByteArray_Check(obj.ptr())) {
-        uint8_t *ptr = (uint8_t *) PyByteArray_AsString(obj.ptr());
-        size_t size = PyByteArray_Size(obj.ptr());
-        SAssertEx(size == bitmap->getBufferSize(), "Bitmap::fromByteArray(): buffer sizes don't match!");
-
-        memcpy(bitmap->getData(), ptr, size);
-    } else {
+    Py_buffer buffer;
+    if (PyObject_GetBuffer(obj.ptr(), &buffer, PyBUF_CONTIG_RO))
         SLog(EError, "Bitmap::fromByteArray(): Invalid argument!");
+    if ((size_t) buffer.len != bitmap->getBufferSize()) {
+        PyBuffer_Release(&buffer);
+        SLog(EError, "Bitmap::fromByteArray(): buffer sizes don't match!");
     }
+
+    memcpy(bitmap->getData(), buffer.buf, (size_t) buffer.len);
+    PyBuffer_Release(&buffer);
 }
 
 static void bitmap_toByteArray_1(const Bitmap *bitmap, bp::object obj) {
-    if (PyByteArray_Check(obj.ptr())) {
-        uint8_t *ptr = (uint8_t *) PyByteArray_AsString(obj.ptr());
-        size_t size = PyByteArray_Size(obj.ptr());
-        SAssertEx(size == bitmap->getBufferSize(), "Bitmap::fromByteArray(): buffer sizes don't match!");
-
-        memcpy(ptr, bitmap->getData(), size);
-    } else {
+    Py_buffer buffer;
+    if (PyObject_GetBuffer(obj.ptr(), &buffer, PyBUF_CONTIG))
         SLog(EError, "Bitmap::toByteArray(): Invalid argument!");
+    if ((size_t) buffer.len != bitmap->getBufferSize()) {
+        PyBuffer_Release(&buffer);
+        SLog(EError, "Bitmap::toByteArray(): buffer sizes don't match!");
     }
+
+    memcpy(buffer.buf, bitmap->getData(), (size_t) buffer.len);
+    PyBuffer_Release(&buffer);
 }
 
 static bp::object bitmap_toByteArray_2(const Bitmap *bitmap) {
@@ -1395,6 +1440,7 @@ void export_core() {
         .def("getPriority", &Thread::getPriority)
         .def("setCoreAffinity", &Thread::setCoreAffinity)
         .def("getCoreAffinity", &Thread::getCoreAffinity)
+        .def("getNUMANode", &Thread::getNUMANode)
         .def("setCritical", &Thread::setCritical)
         .def("getCritical", &Thread::getCritical)
         .def("setName", &Thread::setName)
@@ -1509,8 +1555,10 @@ void export_core() {
 
     BP_CLASS(Bitmap, Object, (bp::init<Bitmap::EPixelFormat, Bitmap::EComponentFormat, const Vector2i &>()))
         .def(bp::init<Bitmap::EPixelFormat, Bitmap::EComponentFormat, const Vector2i &, int>())
-        .def(bp::init<Bitmap::EFileFormat, Stream *, bp::optional<std::string> >())
-        .def(bp::init<fs::path, bp::optional<std::string> >())
+        .def("__init__", bp::make_constructor(bitmap_read1))
+        .def("__init__", bp::make_constructor(bitmap_read2))
+        .def("__init__", bp::make_constructor(bitmap_read3))
+        .def("__init__", bp::make_constructor(bitmap_read4))
         .def("__init__", bp::make_constructor(bitmap_array_constructor))
         .def("getPixelFormat", &Bitmap::getPixelFormat)
         .def("getComponentFormat", &Bitmap::getComponentFormat)
@@ -1757,6 +1805,10 @@ void export_core() {
         .def("createWorkProcessor", &ParallelProcess::createWorkProcessor)
         .def("bindResource", &ParallelProcess::bindResource)
         .def("isLocal", &ParallelProcess::isLocal)
+        .def("setPriority", &ParallelProcess::setPriority)
+        .def("getPriority", &ParallelProcess::getPriority)
+        .def("setShareWeight", &ParallelProcess::setShareWeight)
+        .def("getShareWeight", &ParallelProcess::getShareWeight)
         .def("getLogLevel", &ParallelProcess::getLogLevel)
         .def("getRequiredPlugins", &ParallelProcess::getRequiredPlugins, BP_RETURN_VALUE);
 
@@ -1776,8 +1828,10 @@ void export_core() {
     BP_CLASS(LocalWorker, Worker, (bp::init<int, const std::string>()))
         .def(bp::init<int, const std::string, Thread::EThreadPriority>());
 
-    BP_CLASS(RemoteWorker, Worker, (bp::init<const std::string, Stream *>()))
-        .def("getNodeName", &RemoteWorker::getNodeName, BP_RETURN_VALUE);
+    BP_CLASS(RemoteWorker, Worker, (bp::init<const std::string, Stream *, bp::optional<bool, int> >()))
+        .def("getNodeName", &RemoteWorker::getNodeName, BP_RETURN_VALUE)
+        .def("isCompressed", &RemoteWorker::isCompressed)
+        .def("getBacklog", &RemoteWorker::getBacklog);
 
     bp::class_<SerializableObjectVector>("SerializableObjectVector")
         .def(bp::vector_indexing_suite<SerializableObjectVector>());
@@ -1796,10 +1850,14 @@ void export_core() {
         .def("getWorkerCount", &Scheduler::getWorkerCount)
         .def("getLocalWorkerCount", &Scheduler::getLocalWorkerCount)
         .def("getWorker", &Scheduler::getWorker, BP_RETURN_VALUE)
-        .def("start", &Scheduler::start)
-        .def("pause", &Scheduler::pause)
-        .def("stop", &Scheduler::stop)
+        .def("start", scheduler_start)
+        .def("pause", scheduler_pause)
+        .def("stop", scheduler_stop)
         .def("getCoreCount", &Scheduler::getCoreCount)
+        .def("setWorkStealing", &Scheduler::setWorkStealing)
+        .def("getWorkStealing", &Scheduler::getWorkStealing)
+        .def("setStealBatchSize", &Scheduler::setStealBatchSize)
+        .def("getStealBatchSize", &Scheduler::getStealBatchSize)
         .def("hasLocalWorkers", &Scheduler::hasLocalWorkers)
         .def("hasRemoteWorkers", &Scheduler::hasRemoteWorkers)
         .def("getInstance", &Scheduler::getInstance, BP_RETURN_VALUE)
@@ -1854,6 +1912,8 @@ void export_core() {
         .def("appendTransform", &AnimatedTransform::appendTransform)
         .def("isStatic", &AnimatedTransform::isStatic)
         .def("sortAndSimplify", &AnimatedTransform::sortAndSimplify)
+        .def("precompute", &AnimatedTransform::precompute)
+        .def("getPrecomputedSampleCount", &AnimatedTransform::getPrecomputedSampleCount)
         .def("serialize", &AnimatedTransform::serialize)
         .def("getTranslationBounds", &AnimatedTransform::getTranslationBounds, BP_RETURN_VALUE)
         .def("getSpatialBounds", &AnimatedTransform::getSpatialBounds, BP_RETURN_VALUE)
@@ -2191,6 +2251,8 @@ void export_core() {
         .def("isNormalized", &DiscreteDistribution::isNormalized)
         .def("getSum", &DiscreteDistribution::getSum)
         .def("normalize", &DiscreteDistribution::normalize)
+        .def("buildAliasTable", &DiscreteDistribution::buildAliasTable)
+        .def("hasAliasTable", &DiscreteDistribution::hasAliasTable)
         .def("size", &DiscreteDistribution::size)
         .def("sample", &DiscreteDistribution_sample)
         .def("sampleReuse", &DiscreteDistribution_sampleReuse)
@@ -2362,6 +2424,8 @@ void export_core() {
     bp::def("timeString", &timeString1);
     bp::def("timeString", &timeString2);
     bp::def("getCoreCount", &getCoreCount);
+    bp::def("getNUMANodeCount", &getNUMANodeCount);
+    bp::def("getCoreNUMANode", &getCoreNUMANode);
     bp::def("getHostName", &getHostName);
     bp::def("getPrivateMemoryUsage", &getPrivateMemoryUsage);
     bp::def("getTotalSystemMemory", &getTotalSystemMemory);
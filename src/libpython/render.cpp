@@ -77,6 +77,11 @@ static bp::object shapekdtree_rayIntersect(const ShapeKDTree *kdtree, const Ray
 }
 
 
+/* Zero-copy view of the block's pixels, including the border region */
+static bp::object imageBlock_buffer(ImageBlock *block) {
+    return bp::object(ref<Bitmap>(block->getBitmap())).attr("buffer")();
+}
+
 static ShapeKDTree* shape_getKDTree(const Shape *shape) {
     return const_cast<ShapeKDTree *>(static_cast<const ShapeKDTree *>(shape->getKDTree()));
 }
@@ -127,6 +132,7 @@ static bp::tuple shape_getNormalDerivative(const Shape *shape, const Intersectio
 }
 
 static ref<Scene> loadScene1(const fs::path &filename) {
+    ReleaseGIL gil;
     return SceneHandler::loadScene(filename);
 }
 
@@ -134,6 +140,7 @@ static ref<Scene> loadScene2(const fs::path &filename, const StringMap &params)
     SceneHandler::ParameterMap pmap;
     for (StringMap::const_iterator it = params.begin(); it != params.end(); ++it)
         pmap[it->first]=it->second;
+    ReleaseGIL gil;
     return SceneHandler::loadScene(filename, pmap);
 }
 
@@ -267,6 +274,85 @@ private:
     bool m_locked;
 };
 
+/**
+ * One-shot listener that invokes a Python callable once a specific render
+ * job has finished. It is registered by \ref renderJob_startAsync() and
+ * removes itself from the render queue after firing.
+ */
+class RenderCompletionListener : public RenderListener {
+public:
+    RenderCompletionListener(RenderJob *job, RenderQueue *queue, PyObject *callback)
+        : m_job(job), m_queue(queue), m_callback(callback), m_locked(false) {
+        Py_INCREF(m_callback);
+    }
+
+    void workBeginEvent(const RenderJob *, const RectangularWorkUnit *, int) { }
+    void workEndEvent(const RenderJob *, const ImageBlock *, bool) { }
+    void workCanceledEvent(const RenderJob *, const Point2i &, const Vector2i &) { }
+    void refreshEvent(const RenderJob *) { }
+
+    void finishJobEvent(const RenderJob *job, bool cancelled) {
+        if (job != m_job.get())
+            return;
+        {
+            CALLBACK_SYNC_GIL();
+            try {
+                bp::call<void>(m_callback, bp::ptr(job), cancelled);
+            } catch (bp::error_already_set &) { check_python_exception(); }
+        }
+        /* The queue keeps a reference while the event is dispatched */
+        m_queue->unregisterListener(this);
+    }
+
+    virtual ~RenderCompletionListener() {
+        AcquireGIL gil;
+        Py_DECREF(m_callback);
+    }
+private:
+    ref<RenderJob> m_job;
+    RenderQueue *m_queue;
+    PyObject *m_callback;
+    bool m_locked;
+};
+
+/* Start a render job and return immediately. The callable is invoked as
+   callback(job, cancelled) from the job's thread once rendering finished,
+   which lets a driver script keep several jobs in flight at once. */
+static void renderJob_startAsync(RenderJob *job, bp::object callback) {
+    if (!PyCallable_Check(callback.ptr()))
+        SLog(EError, "RenderJob::startAsync(): the callback must be callable!");
+    RenderQueue *queue = job->getRenderQueue();
+    ref<RenderListener> listener = new RenderCompletionListener(job, queue, callback.ptr());
+    ReleaseGIL gil;
+    queue->registerListener(listener);
+    job->start();
+}
+
+static bool renderJob_wait(RenderJob *job) {
+    ReleaseGIL gil;
+    return job->wait();
+}
+
+/* The render queue dispatches listener events while holding its lock, and
+   Python listeners then acquire the GIL. Any queue operation that takes
+   the same lock must therefore be issued with the GIL released. */
+static void renderQueue_registerListener(RenderQueue *queue, RenderListener *listener) {
+    ReleaseGIL gil;
+    queue->registerListener(listener);
+}
+
+static void renderQueue_unregisterListener(RenderQueue *queue, RenderListener *listener) {
+    /* Keep the wrapper alive until the GIL has been re-acquired */
+    ref<RenderListener> keepAlive(listener);
+    ReleaseGIL gil;
+    queue->unregisterListener(listener);
+}
+
+static Float renderQueue_getRenderTime(RenderQueue *queue, const RenderJob *job) {
+    ReleaseGIL gil;
+    return queue->getRenderTime(job);
+}
+
 static void renderQueue_join(RenderQueue *queue) {
     ReleaseGIL gil;
     queue->join();
@@ -277,11 +363,61 @@ static void renderQueue_waitLeft(RenderQueue *queue, size_t count) {
     queue->waitLeft(count);
 }
 
+static void scene_initialize(Scene *scene) {
+    ReleaseGIL gil;
+    scene->initialize();
+}
+
+static bool scene_preprocess(Scene *scene, RenderQueue *queue, const RenderJob *job,
+        int sceneResID, int sensorResID, int samplerResID) {
+    ReleaseGIL gil;
+    return scene->preprocess(queue, job, sceneResID, sensorResID, samplerResID);
+}
+
+static bool scene_render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+        int sceneResID, int sensorResID, int samplerResID) {
+    ReleaseGIL gil;
+    return scene->render(queue, job, sceneResID, sensorResID, samplerResID);
+}
+
+static void scene_postprocess(Scene *scene, RenderQueue *queue, const RenderJob *job,
+        int sceneResID, int sensorResID, int samplerResID) {
+    ReleaseGIL gil;
+    scene->postprocess(queue, job, sceneResID, sensorResID, samplerResID);
+}
+
 static void scene_cancel(Scene *scene) {
     ReleaseGIL gil;
     scene->cancel();
 }
 
+/* Render a resident scene and develop the film into an existing bitmap.
+   The kd-tree and all other state that survives preprocess() is reused
+   between calls, and no output file is written. */
+static bool scene_renderToBitmap(Scene *scene, Bitmap *target) {
+    Film *film = scene->getFilm();
+    if (target->getSize() != film->getCropSize())
+        SLog(EError, "Scene::renderToBitmap(): the target bitmap must match "
+            "the crop size of the film!");
+
+    fs::path destinationFile = scene->getDestinationFile();
+    scene->setDestinationFile(fs::path());
+
+    bool success;
+    {
+        ReleaseGIL gil;
+        ref<RenderQueue> queue = new RenderQueue();
+        ref<RenderJob> job = new RenderJob("pyrender", scene, queue);
+        job->start();
+        success = job->wait();
+        queue->join();
+    }
+
+    scene->setDestinationFile(destinationFile);
+    return success && film->develop(Point2i(0), target->getSize(),
+        Point2i(0), target);
+}
+
 static void renderJob_cancel(RenderJob *job) {
     ReleaseGIL gil;
     job->cancel();
@@ -359,11 +495,16 @@ void export_render() {
         .def(bp::init<Properties>())
         .def(bp::init<Scene *>())
         .def(bp::init<Stream *, InstanceManager *>())
-        .def("initialize", &Scene::initialize)
+        .def("initialize", scene_initialize)
+        .def("markDirty", &Scene::markDirty)
+        .def("getDirtyFlags", &Scene::getDirtyFlags)
         .def("invalidate", &Scene::invalidate)
-        .def("preprocess", &Scene::preprocess)
-        .def("render", &Scene::render)
-        .def("postprocess", &Scene::postprocess)
+        .def("updateEmitters", &Scene::updateEmitters)
+        .def("replaceObject", &Scene::replaceObject)
+        .def("renderToBitmap", &scene_renderToBitmap)
+        .def("preprocess", scene_preprocess)
+        .def("render", scene_render)
+        .def("postprocess", scene_postprocess)
         .def("flush", &Scene::flush)
         .def("cancel", scene_cancel)
         .def("rayIntersect", &scene_rayIntersect)
@@ -404,6 +545,15 @@ void export_render() {
         .def("getMedia", &scene_getMedia)
         .def("getKDTree", scene_getKDTree, BP_RETURN_VALUE);
 
+    BP_SETSCOPE(Scene_class);
+    bp::enum_<Scene::EDirtyFlags>("EDirtyFlags")
+        .value("EGeometryDirty", Scene::EGeometryDirty)
+        .value("EEmittersDirty", Scene::EEmittersDirty)
+        .value("ESensorDirty", Scene::ESensorDirty)
+        .value("ESubsurfaceDirty", Scene::ESubsurfaceDirty)
+        .export_values();
+    BP_SETSCOPE(renderModule);
+
     BP_CLASS(Sampler, ConfigurableObject, bp::no_init)
         .def("clone", &Sampler::clone, BP_RETURN_VALUE)
         .def("generate", &Sampler::generate)
@@ -427,7 +577,8 @@ void export_render() {
     BP_CLASS(RenderJob, Thread, (bp::init<const std::string &, Scene *, RenderQueue *, bp::optional<int, int, int, bool, bool> >()))
         .def("flush", &RenderJob::flush)
         .def("cancel", renderJob_cancel)
-        .def("wait", &RenderJob::wait)
+        .def("wait", renderJob_wait)
+        .def("startAsync", renderJob_startAsync)
         .def("isInteractive", &RenderJob::isInteractive)
         .def("setInteractive", &RenderJob::setInteractive)
         .def("getScene", renderJob_getScene, BP_RETURN_VALUE)
@@ -437,9 +588,9 @@ void export_render() {
         .def("getJobCount", &RenderQueue::getJobCount)
         .def("addJob", &RenderQueue::addJob)
         .def("removeJob", &RenderQueue::removeJob)
-        .def("getRenderTime", &RenderQueue::getRenderTime)
-        .def("registerListener", &RenderQueue::registerListener)
-        .def("unregisterListener", &RenderQueue::unregisterListener)
+        .def("getRenderTime", renderQueue_getRenderTime)
+        .def("registerListener", renderQueue_registerListener)
+        .def("unregisterListener", renderQueue_unregisterListener)
         .def("waitLeft", renderQueue_waitLeft)
         .def("join", renderQueue_join)
         .def("flush", &RenderQueue::flush);
@@ -783,12 +934,14 @@ void export_render() {
         .def("getBitmap", &Texture::getBitmap, getBitmap_overloads()[BP_RETURN_VALUE]);
 
     bp::class_<Noise>("Noise")
-        .def("perlinNoise", &Noise::perlinNoise)
-        .def("turbulence", &Noise::turbulence)
-        .def("fbm", &Noise::fbm);
+        .def("perlinNoise", (Float (*)(const Point &)) &Noise::perlinNoise)
+        .def("turbulence", (Float (*)(const Point &, const Vector &, const Vector &, Float, int)) &Noise::turbulence)
+        .def("fbm", (Float (*)(const Point &, const Vector &, const Vector &, Float, int)) &Noise::fbm);
 
     void (ImageBlock::*imageBlock_put1)(const ImageBlock *) = &ImageBlock::put;
     bool (ImageBlock::*imageBlock_put2)(const Point2 &, const Spectrum &, Float) = &ImageBlock::put;
+    void (ImageBlock::*imageBlock_putAtomic1)(const ImageBlock *) = &ImageBlock::putAtomic;
+    bool (ImageBlock::*imageBlock_putAtomic2)(const Point2 &, const Spectrum &, Float) = &ImageBlock::putAtomic;
     Bitmap *(ImageBlock::*imageBlock_getBitmap)() = &ImageBlock::getBitmap;
 
     BP_CLASS(ImageBlock, WorkResult, (bp::init<Bitmap::EPixelFormat, const Vector2i &, bp::optional<const ReconstructionFilter *, int, bool> >()))
@@ -803,9 +956,12 @@ void export_render() {
         .def("getBorderSize", &ImageBlock::getBorderSize)
         .def("getChannelCount", &ImageBlock::getChannelCount)
         .def("getBitmap", imageBlock_getBitmap, BP_RETURN_VALUE)
+        .def("buffer", &imageBlock_buffer)
         .def("clear", &ImageBlock::clear)
         .def("put", imageBlock_put1)
         .def("put", imageBlock_put2)
+        .def("putAtomic", imageBlock_putAtomic1)
+        .def("putAtomic", imageBlock_putAtomic2)
         .def("clone", &ImageBlock::clone, BP_RETURN_VALUE)
         .def("copyTo", &ImageBlock::copyTo);
 
@@ -0,0 +1,367 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/bvh.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+/* Build parameters: number of SAH bins, largest leaf that may be created
+   without consulting the SAH, and the cost of a traversal step relative
+   to a triangle intersection */
+static const int bvhBinCount = 16;
+static const size_t bvhMaxLeafSize = 8;
+static const Float bvhTraversalCost = 1.0f;
+
+/* Beyond this depth, split at the median to bound the traversal stack */
+static const int bvhMedianSplitDepth = MTS_BVH_MAXDEPTH / 2;
+
+static StatsCounter bvhRefits("BVH", "Key frame refits");
+
+struct TriangleBVH::BuildPrimitive {
+    AABB aabb;
+    Point centroid;
+    BVHPrimitive prim;
+};
+
+TriangleBVH::TriangleBVH() { }
+
+TriangleBVH::~TriangleBVH() {
+    for (size_t i=0; i<m_frames.size(); ++i)
+        for (size_t j=0; j<m_frames[i].size(); ++j)
+            m_frames[i][j]->decRef();
+}
+
+void TriangleBVH::addKeyframe(const std::vector<const TriMesh *> &meshes) {
+    Assert(!isBuilt());
+    if (!m_frames.empty()) {
+        const std::vector<const TriMesh *> &first = m_frames[0];
+        if (meshes.size() != first.size())
+            Log(EError, "All key frames must contain the same number of meshes!");
+        for (size_t i=0; i<meshes.size(); ++i) {
+            bool match = meshes[i]->getTriangleCount() == first[i]->getTriangleCount();
+            for (size_t j=0; match && j<first[i]->getTriangleCount(); ++j) {
+                const Triangle t0 = first[i]->getTriangle(j),
+                               t1 = meshes[i]->getTriangle(j);
+                match = t0.idx[0] == t1.idx[0] && t0.idx[1] == t1.idx[1]
+                     && t0.idx[2] == t1.idx[2];
+            }
+            if (!match)
+                Log(EError, "All key frames must have the exact same face topology!");
+        }
+    }
+    for (size_t i=0; i<meshes.size(); ++i)
+        meshes[i]->incRef();
+    m_frames.push_back(meshes);
+}
+
+void TriangleBVH::build() {
+    if (isBuilt())
+        Log(EError, "The BVH has already been built!");
+    if (m_frames.empty())
+        Log(EError, "The BVH requires at least one key frame!");
+
+    ref<Timer> timer = new Timer();
+    const std::vector<const TriMesh *> &meshes = m_frames[0];
+
+    /* Primitive bounds enclose the triangle at every key frame, so
+       that the hierarchy stays reasonable throughout the animation */
+    std::vector<BuildPrimitive> prims;
+    for (IndexType i=0; i<meshes.size(); ++i) {
+        for (IndexType j=0; j<meshes[i]->getTriangleCount(); ++j) {
+            BuildPrimitive prim;
+            prim.prim.shapeIndex = i;
+            prim.prim.primIndex = j;
+            prim.aabb.reset();
+            for (IndexType frame=0; frame<m_frames.size(); ++frame)
+                prim.aabb.expandBy(getPrimitiveAABB(prim.prim, frame));
+            prim.centroid = prim.aabb.getCenter();
+            prims.push_back(prim);
+        }
+    }
+
+    if (prims.empty()) {
+        Log(EWarn, "BVH contains no geometry!");
+        BVHNode node;
+        node.offset = 0;
+        node.primCount = 0;
+        node.axis = 0;
+        m_nodes.push_back(node);
+        m_bounds.resize(m_frames.size());
+        m_aabb.reset();
+        return;
+    }
+
+    m_nodes.reserve(2 * prims.size() / bvhMaxLeafSize + 1);
+    m_prims.reserve(prims.size());
+    buildRecursive(prims, 0, prims.size(), 0);
+    std::vector<BVHNode>(m_nodes).swap(m_nodes);
+
+    refit();
+
+    Log(EDebug, "Built a BVH over " SIZE_T_FMT " triangles and " SIZE_T_FMT
+        " key frames in %i ms (" SIZE_T_FMT " nodes, %s)", m_prims.size(),
+        m_frames.size(), timer->getMilliseconds(), m_nodes.size(),
+        memString(m_nodes.size() * sizeof(BVHNode)
+            + m_bounds.size() * sizeof(AABB)
+            + m_prims.size() * sizeof(BVHPrimitive)).c_str());
+}
+
+void TriangleBVH::buildRecursive(std::vector<BuildPrimitive> &prims,
+        size_t begin, size_t end, int depth) {
+    size_t nodeIndex = m_nodes.size();
+    m_nodes.push_back(BVHNode());
+    size_t count = end - begin;
+
+    AABB aabb, centroidAABB;
+    aabb.reset();
+    centroidAABB.reset();
+    for (size_t i=begin; i<end; ++i) {
+        aabb.expandBy(prims[i].aabb);
+        centroidAABB.expandBy(prims[i].centroid);
+    }
+
+    int axis = centroidAABB.getLargestAxis();
+    Float minValue = centroidAABB.min[axis],
+          extent = centroidAABB.max[axis] - minValue;
+    size_t mid = begin;
+
+    if (extent > 0 && depth < bvhMedianSplitDepth) {
+        /* Binned SAH split along the largest centroid extent */
+        size_t binCounts[bvhBinCount];
+        AABB binAABBs[bvhBinCount];
+        for (int i=0; i<bvhBinCount; ++i) {
+            binCounts[i] = 0;
+            binAABBs[i].reset();
+        }
+        Float scale = bvhBinCount / extent;
+        for (size_t i=begin; i<end; ++i) {
+            int bin = std::min(bvhBinCount - 1,
+                (int) ((prims[i].centroid[axis] - minValue) * scale));
+            binCounts[bin]++;
+            binAABBs[bin].expandBy(prims[i].aabb);
+        }
+
+        Float rightAreas[bvhBinCount];
+        size_t rightCounts[bvhBinCount];
+        AABB rightAABB;
+        rightAABB.reset();
+        size_t rightCount = 0;
+        for (int i=bvhBinCount-1; i>0; --i) {
+            rightAABB.expandBy(binAABBs[i]);
+            rightCount += binCounts[i];
+            rightAreas[i] = rightAABB.isValid() ? rightAABB.getSurfaceArea() : 0;
+            rightCounts[i] = rightCount;
+        }
+
+        AABB leftAABB;
+        leftAABB.reset();
+        size_t leftCount = 0;
+        int bestSplit = -1;
+        Float bestCost = std::numeric_limits<Float>::infinity(),
+              invArea = 1.0f / aabb.getSurfaceArea();
+        for (int i=1; i<bvhBinCount; ++i) {
+            leftAABB.expandBy(binAABBs[i-1]);
+            leftCount += binCounts[i-1];
+            if (leftCount == 0 || rightCounts[i] == 0)
+                continue;
+            Float cost = bvhTraversalCost + invArea *
+                (leftAABB.getSurfaceArea() * leftCount
+                 + rightAreas[i] * rightCounts[i]);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestSplit = i;
+            }
+        }
+
+        if (bestSplit >= 0 && (count > bvhMaxLeafSize || bestCost < count)) {
+            mid = std::partition(prims.begin() + begin, prims.begin() + end,
+                [&](const BuildPrimitive &prim) {
+                    return std::min(bvhBinCount - 1, (int) ((prim.centroid[axis]
+                        - minValue) * scale)) < bestSplit;
+                }) - prims.begin();
+        } else if (count <= bvhMaxLeafSize) {
+            mid = end;
+        }
+    } else if (count <= bvhMaxLeafSize) {
+        mid = end;
+    }
+
+    if (mid == end || count == 1) {
+        /* Create a leaf node */
+        BVHNode &node = m_nodes[nodeIndex];
+        node.offset = (uint32_t) m_prims.size();
+        node.primCount = (uint16_t) count;
+        node.axis = 0;
+        for (size_t i=begin; i<end; ++i)
+            m_prims.push_back(prims[i].prim);
+        return;
+    }
+
+    if (mid == begin) {
+        /* No useful SAH split: fall back to the centroid median */
+        mid = begin + count / 2;
+        std::nth_element(prims.begin() + begin, prims.begin() + mid,
+            prims.begin() + end,
+            [&](const BuildPrimitive &a, const BuildPrimitive &b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+    }
+
+    m_nodes[nodeIndex].axis = (uint16_t) axis;
+    m_nodes[nodeIndex].primCount = 0;
+    buildRecursive(prims, begin, mid, depth + 1);
+    m_nodes[nodeIndex].offset = (uint32_t) m_nodes.size();
+    buildRecursive(prims, mid, end, depth + 1);
+}
+
+void TriangleBVH::refit() {
+    m_bounds.resize(m_nodes.size() * m_frames.size());
+    m_aabb.reset();
+    for (IndexType frame=0; frame<m_frames.size(); ++frame) {
+        refit(frame);
+        if (!m_prims.empty())
+            m_aabb.expandBy(m_bounds[frame * m_nodes.size()]);
+    }
+}
+
+void TriangleBVH::refit(IndexType frame) {
+    Assert(isBuilt() && frame < m_frames.size());
+    AABB *bounds = &m_bounds[frame * m_nodes.size()];
+
+    /* Children are always stored after their parent, so a reverse
+       sweep over the nodes visits them bottom-up */
+    for (size_t i=m_nodes.size(); i-- > 0; ) {
+        const BVHNode &node = m_nodes[i];
+        AABB &aabb = bounds[i];
+        if (node.isLeaf()) {
+            aabb.reset();
+            for (uint32_t j=0; j<node.primCount; ++j)
+                aabb.expandBy(getPrimitiveAABB(m_prims[node.offset + j], frame));
+        } else if (m_prims.empty()) {
+            aabb.reset();
+        } else {
+            aabb = bounds[i+1];
+            aabb.expandBy(bounds[node.offset]);
+        }
+    }
+    ++bvhRefits;
+}
+
+template <bool shadowRay> bool TriangleBVH::rayIntersectInternal(
+        const Ray &ray, Float mint, Float maxt, Float &t,
+        IntersectionCache *cache, IndexType frame, Float alpha) const {
+    if (m_prims.empty())
+        return false;
+
+    const size_t nodeCount = m_nodes.size();
+    const bool interpolate = alpha > 0 && frame + 1 < m_frames.size();
+    const AABB *bounds0 = &m_bounds[frame * nodeCount];
+    const AABB *bounds1 = interpolate ? bounds0 + nodeCount : NULL;
+    const std::vector<const TriMesh *> &meshes0 = m_frames[frame];
+    const std::vector<const TriMesh *> &meshes1 =
+        m_frames[interpolate ? frame + 1 : frame];
+
+    uint32_t stack[MTS_BVH_MAXDEPTH];
+    int stackPtr = 0;
+    uint32_t nodeIndex = 0;
+    bool foundIntersection = false;
+
+    while (true) {
+        const BVHNode &node = m_nodes[nodeIndex];
+        AABB aabb = bounds0[nodeIndex];
+        if (interpolate) {
+            /* Interpolated boxes bound the interpolated vertices */
+            const AABB &aabb1 = bounds1[nodeIndex];
+            aabb.min = aabb.min * (1 - alpha) + Vector(aabb1.min) * alpha;
+            aabb.max = aabb.max * (1 - alpha) + Vector(aabb1.max) * alpha;
+        }
+
+        Float nearT, farT;
+        if (aabb.rayIntersect(ray, nearT, farT) && nearT <= maxt && farT >= mint) {
+            if (!node.isLeaf()) {
+                /* Visit the near child first */
+                uint32_t left = nodeIndex + 1, right = node.offset;
+                if (ray.d[node.axis] < 0)
+                    std::swap(left, right);
+                stack[stackPtr++] = right;
+                nodeIndex = left;
+                continue;
+            }
+
+            for (uint32_t i=0; i<node.primCount; ++i) {
+                const BVHPrimitive &prim = m_prims[node.offset + i];
+                const Triangle tri = meshes0[prim.shapeIndex]->getTriangle(prim.primIndex);
+                const Point *pos0 = meshes0[prim.shapeIndex]->getVertexPositions();
+                const Point *pos1 = meshes1[prim.shapeIndex]->getVertexPositions();
+
+                Point p[3];
+                for (int j=0; j<3; ++j)
+                    p[j] = interpolate ? (1 - alpha) * pos0[tri.idx[j]]
+                        + alpha * pos1[tri.idx[j]] : pos0[tri.idx[j]];
+
+                Float tempU, tempV, tempT;
+                if (!Triangle::rayIntersect(p[0], p[1], p[2], ray, tempU, tempV, tempT)
+                        || tempT < mint || tempT > maxt)
+                    continue;
+
+                if (shadowRay)
+                    return true;
+
+                maxt = t = tempT;
+                cache->shapeIndex = prim.shapeIndex;
+                cache->primIndex = prim.primIndex;
+                cache->u = tempU;
+                cache->v = tempV;
+                foundIntersection = true;
+            }
+        }
+
+        if (stackPtr == 0)
+            break;
+        nodeIndex = stack[--stackPtr];
+    }
+
+    return foundIntersection;
+}
+
+bool TriangleBVH::rayIntersect(const Ray &ray, Float mint, Float maxt,
+        Float &t, IntersectionCache *cache, IndexType frame, Float alpha) const {
+    return rayIntersectInternal<false>(ray, mint, maxt, t, cache, frame, alpha);
+}
+
+bool TriangleBVH::rayIntersect(const Ray &ray, Float mint, Float maxt,
+        IndexType frame, Float alpha) const {
+    Float t;
+    return rayIntersectInternal<true>(ray, mint, maxt, t, NULL, frame, alpha);
+}
+
+std::string TriangleBVH::toString() const {
+    std::ostringstream oss;
+    oss << "TriangleBVH[" << endl
+        << "  primitiveCount = " << m_prims.size() << "," << endl
+        << "  nodeCount = " << m_nodes.size() << "," << endl
+        << "  keyframeCount = " << m_frames.size() << "," << endl
+        << "  aabb = " << m_aabb.toString() << endl
+        << "]";
+    return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(TriangleBVH, false, Object)
+MTS_NAMESPACE_END
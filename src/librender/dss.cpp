@@ -19,10 +19,15 @@
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/dss.h>
 #include <mitsuba/core/lock.h>
+#include <mitsuba/core/atomic.h>
 #include <mitsuba/core/sched.h>
 #include <mitsuba/core/util.h>
 #include <mitsuba/core/statistics.h>
-#include <boost/math/tools/roots.hpp>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/qmc.h>
+#include <mitsuba/core/quad.h>
+#include <mitsuba/core/shvector.h>
+#include <mitsuba/core/warp.h>
 #include "../medium/materials.h"
 
 MTS_NAMESPACE_BEGIN
@@ -46,8 +51,10 @@ static StatsCounter avgNumSplits("Direct Sampling Subsurface",
 static StatsCounter avgIntReflChainLen("Direct Sampling Subsurface",
         "Average length of an internal-reflection chain", EAverage);
 
-static ref<Mutex> sourcesMutex = new Mutex();
-static int sourcesIndex = 0;
+static StatsCounter reusedProbes("Direct Sampling Subsurface",
+        "Probes shared between surface samplers", EPercentage);
+
+static int32_t sourcesIndex = 0;
 
 static inline bool vectorEquals(const Vector &a, const Vector &b) {
     Vector sum = a+b;
@@ -79,7 +86,7 @@ static inline Float refract(Float eta, const Vector &d, const Vector &n,
     Float scale = -1.0f / eta;
     Vector d_loc = frame.toLocal(d);
     d_refracted = frame.toWorld(Vector(scale*d_loc.x, scale*d_loc.y, cosThetaT));
-    SAssert(fabs(d_refracted.length() - 1) < Epsilon);
+    SHotAssert(fabs(d_refracted.length() - 1) < Epsilon);
     return transmittance;
 }
 
@@ -120,6 +127,27 @@ DirectSamplingSubsurface::DirectSamplingSubsurface(const Properties &props) :
     m_numSIRsurface = props.getSize("numSIRsurface", 1);
     m_SIRnonSurfaceOversamplingFactor = props.getSize("SIRnonSurfaceOversamplingFactor", 1);
 
+    /* Merge the SIR reservoir of the previous shading point of the same
+     * thread (typically a neighbouring sample or pixel) into the current
+     * one, with this confidence relative to the fresh SIR attempts. This
+     * is a streaming variant of the spatial reuse of ReSTIR. Zero
+     * disables reuse, values around 20 are typical. */
+    m_SIRreuse = props.getFloat("SIRreuse", 0);
+    if (m_SIRreuse < 0)
+        Log(EError, "SIRreuse must be non-negative!");
+
+    /* Adaptive SIR: start with numSIRsurface surface samples and add more
+     * while the relative variance of the mean SIR weight exceeds this
+     * threshold, up to SIRadaptiveMaxSurface. Zero disables adaptivity. */
+    m_SIRadaptiveThreshold = props.getFloat("SIRadaptiveThreshold", 0);
+    m_SIRadaptiveMaxSurface = props.getSize("SIRadaptiveMaxSurface",
+            std::max((size_t) 16, m_numSIRsurface));
+    if (m_SIRadaptiveThreshold < 0)
+        Log(EError, "SIRadaptiveThreshold must be non-negative!");
+    if (m_SIRadaptiveMaxSurface < m_numSIRsurface)
+        Log(EError, "SIRadaptiveMaxSurface must not be smaller than "
+                "numSIRsurface!");
+
     /* Perform direct sampling of the light sources? */
     m_directSampling = props.getBoolean("directSampling", true);
 
@@ -130,6 +158,14 @@ DirectSamplingSubsurface::DirectSamplingSubsurface(const Properties &props) :
     /* Perform single spectral channel evaluations of the bssrdf? */
     m_singleChannel = props.getBoolean("singleChannel", false);
 
+    /* Sample the incoming point and directions for a single 'hero'
+     * channel, but evaluate all channels with spectral MIS weights?
+     * (Only without SIR. Without either of these options, each sampling
+     * step picks its own channel.) */
+    m_heroChannel = props.getBoolean("heroChannel", false);
+    if (m_heroChannel && m_singleChannel)
+        Log(EError, "heroChannel and singleChannel are mutually exclusive!");
+
     /* Allow the outgoing direction for Li to actually be an incoming one.
      * This is useful for checking the validity of assumed boundary
      * conditions for dipole models, for instance. */
@@ -146,7 +182,36 @@ DirectSamplingSubsurface::DirectSamplingSubsurface(const Properties &props) :
     Float cutoffNumAbsorptionLengths = props.getFloat(
             "cutoffNumAbsorptionLengths", 10);
 
-    if ((m_numSIRsurface > 1 || m_SIRnonSurfaceOversamplingFactor > 1)
+    /* Stop collecting intersections along a projection probe once the
+     * remaining ones carry less than this fraction of the total
+     * intersection weight. Zero means: always collect everything. */
+    m_itsWeightTolerance = props.getFloat("itsWeightTolerance", 0);
+    if (m_itsWeightTolerance < 0)
+        Log(EError, "itsWeightTolerance must be non-negative!");
+
+    /* Optionally replace the recursive radiance queries for rays that
+     * leave the medium by lookups in a precomputed cache of the incident
+     * radiance on the boundary (biased, only sensible for static and
+     * fairly low-frequency illumination). Zero samples: no cache. */
+    m_radianceCacheSamples = props.getSize("radianceCacheSamples", 0);
+    m_radianceCacheDirections = props.getSize("radianceCacheDirections", 256);
+    m_radianceCacheBands = props.getInteger("radianceCacheBands", 3);
+    if (m_radianceCacheSamples > 0 && (m_radianceCacheDirections == 0
+            || m_radianceCacheBands < 1))
+        Log(EError, "radianceCacheDirections and radianceCacheBands "
+                "must be positive!");
+    m_radianceCacheResID = -1;
+
+    if (m_heroChannel && (m_numSIRsurface > 1
+                || m_SIRnonSurfaceOversamplingFactor > 1
+                || m_SIRadaptiveThreshold > 0)) {
+        Log(EWarn, "heroChannel is not supported in combination with SIR, "
+                "ignoring it!");
+        m_heroChannel = false;
+    }
+
+    if ((m_numSIRsurface > 1 || m_SIRnonSurfaceOversamplingFactor > 1
+                || m_SIRadaptiveThreshold > 0)
             && !(m_directSampling && m_directSamplingMIS)) {
         Log(EWarn, "ATTENTION: numSIRsurface or "
                 "m_SIRnonSurfaceOversamplingFactor is > 1 (they're %d and %d), "
@@ -165,10 +230,7 @@ DirectSamplingSubsurface::DirectSamplingSubsurface(const Properties &props) :
             m_directSampling, m_directSamplingMIS,
             m_singleChannel, m_allowIncomingOutgoingDirections,
             m_maxInternalReflections);
-    {
-        LockGuard lock(sourcesMutex);
-        m_sourcesIndex = sourcesIndex++;
-    }
+    m_sourcesIndex = atomicAdd(&sourcesIndex, 1) - 1;
     m_sourcesResID = -1;
     m_nonCollimatedLightSourcesPresent = true; // Safety
 
@@ -187,14 +249,23 @@ DirectSamplingSubsurface::DirectSamplingSubsurface(Stream *stream,
             Subsurface(stream, manager) {
     m_numSIRsurface = stream->readSize();
     m_SIRnonSurfaceOversamplingFactor = stream->readSize();
+    m_SIRreuse = stream->readFloat();
+    m_SIRadaptiveThreshold = stream->readFloat();
+    m_SIRadaptiveMaxSurface = stream->readSize();
     m_directSampling = stream->readBool();
     m_directSamplingMIS = stream->readBool();
     m_singleChannel = stream->readBool();
+    m_heroChannel = stream->readBool();
     m_allowIncomingOutgoingDirections = stream->readBool();
     m_eta = stream->readFloat();
     m_sourcesIndex = stream->readInt();
     m_sourcesResID = -1;
     m_itsDistanceCutoff = stream->readFloat();
+    m_itsWeightTolerance = stream->readFloat();
+    m_radianceCacheSamples = stream->readSize();
+    m_radianceCacheDirections = stream->readSize();
+    m_radianceCacheBands = stream->readInt();
+    m_radianceCacheResID = -1;
     /* Note: serialize gets called before preprocess, so we can't pass
      * m_nonCollimatedLightSourcesPresent information here. So for safety: */
     m_nonCollimatedLightSourcesPresent = true;
@@ -205,13 +276,21 @@ void DirectSamplingSubsurface::serialize(Stream *stream,
     Subsurface::serialize(stream, manager);
     stream->writeSize(m_numSIRsurface);
     stream->writeSize(m_SIRnonSurfaceOversamplingFactor);
+    stream->writeFloat(m_SIRreuse);
+    stream->writeFloat(m_SIRadaptiveThreshold);
+    stream->writeSize(m_SIRadaptiveMaxSurface);
     stream->writeBool(m_directSampling);
     stream->writeBool(m_directSamplingMIS);
     stream->writeBool(m_singleChannel);
+    stream->writeBool(m_heroChannel);
     stream->writeBool(m_allowIncomingOutgoingDirections);
     stream->writeFloat(m_eta);
     stream->writeInt(m_sourcesIndex);
     stream->writeFloat(m_itsDistanceCutoff);
+    stream->writeFloat(m_itsWeightTolerance);
+    stream->writeSize(m_radianceCacheSamples);
+    stream->writeSize(m_radianceCacheDirections);
+    stream->writeInt(m_radianceCacheBands);
     /* Note: serialize gets called before preprocess, so we can't pass
      * m_nonCollimatedLightSourcesPresent information here. */
 }
@@ -219,39 +298,24 @@ void DirectSamplingSubsurface::serialize(Stream *stream,
 DirectSamplingSubsurface::~DirectSamplingSubsurface() {
     if (m_sourcesResID != -1)
         Scheduler::getInstance()->unregisterResource(m_sourcesResID);
+    if (m_radianceCacheResID != -1)
+        Scheduler::getInstance()->unregisterResource(m_radianceCacheResID);
 }
 
 void DirectSamplingSubsurface::bindUsedResources(ParallelProcess *proc) const {
     if (m_sourcesResID != -1)
         proc->bindResource(formatString("sources%i", m_sourcesIndex),
                 m_sourcesResID);
+    if (m_radianceCacheResID != -1)
+        proc->bindResource(formatString("radianceCache%i", m_sourcesIndex),
+                m_radianceCacheResID);
 }
 
-bool DirectSamplingSubsurface::preprocess(
-        const Scene *scene, RenderQueue *queue, const RenderJob *job,
-        int sceneResID, int cameraResID, int samplerResID) {
-    if (!scene->getIntegrator()->getClass()
-            ->derivesFrom(MTS_CLASS(MonteCarloIntegrator)))
-        Log(EError, "Direct sampling subsurface models require "
-            "a MonteCarlo-based surface integrator!");
-
+void DirectSamplingSubsurface::collectRadianceSources(const Scene *scene) {
 #if MTS_DSS_USE_RADIANCE_SOURCES
-    if (m_sources.get())
-        return true;
-
-    /*
-     * For degenerate light sources:
-     *   - point lights, spot lights and directional lights can (in
-     *     principle) be 'directly connected' to any sampled position on
-     *     the surface, cfr standard direct sampling methods.
-     *   - collimated light sources cannot be connected and must be
-     *     'sampled' starting at the light. Trace their (attenuated)
-     *     contribution to our surface and store the hitpoints with their
-     *     incoming radiance here in m_sources.
-     */
     m_sources = new RadianceSources();
     m_nonCollimatedLightSourcesPresent = false;
-    for (const ref<Emitter> emitter : scene->getEmitters()) {
+    for (const ref<Emitter> &emitter : scene->getEmitters()) {
         /* Ignore non-collimated light sources */
         if (!(emitter->getType() & Emitter::EDeltaDirection
            && emitter->getType() & Emitter::EDeltaPosition)) {
@@ -312,6 +376,59 @@ bool DirectSamplingSubsurface::preprocess(
         m_sources->push_back(RadianceSource(
                 its.p, its.shFrame.n, its.toWorld(bRec.wo), Li * bsdfVal));
     }
+#endif
+}
+
+bool DirectSamplingSubsurface::preprocess(
+        const Scene *scene, RenderQueue *queue, const RenderJob *job,
+        int sceneResID, int cameraResID, int samplerResID) {
+    if (!scene->getIntegrator()->getClass()
+            ->derivesFrom(MTS_CLASS(MonteCarloIntegrator)))
+        Log(EError, "Direct sampling subsurface models require "
+            "a MonteCarlo-based surface integrator!");
+
+    /* Let the probe rays only traverse our own shapes instead of the
+       entire scene (they pass m_shapes as their filter) */
+    const_cast<Scene *>(scene)->addShapeSubset(m_shapes);
+
+    if (m_radianceCacheSamples > 0 && !m_radianceCache.get()) {
+        if (!loadPreprocessCache(scene, "radianceCache", [&](Stream *stream) {
+                    m_radianceCache = new DSSRadianceCache(stream, NULL);
+                })) {
+            if (!buildRadianceCache(scene, job, sceneResID))
+                return false;
+            storePreprocessCache(scene, "radianceCache", [&](Stream *stream) {
+                    m_radianceCache->serialize(stream, NULL);
+                });
+        }
+        m_radianceCacheResID = Scheduler::getInstance()->registerResource(
+                m_radianceCache.get());
+    }
+
+#if MTS_DSS_USE_RADIANCE_SOURCES
+    if (m_sources.get())
+        return true;
+
+    /*
+     * For degenerate light sources:
+     *   - point lights, spot lights and directional lights can (in
+     *     principle) be 'directly connected' to any sampled position on
+     *     the surface, cfr standard direct sampling methods.
+     *   - collimated light sources cannot be connected and must be
+     *     'sampled' starting at the light. Trace their (attenuated)
+     *     contribution to our surface and store the hitpoints with their
+     *     incoming radiance here in m_sources.
+     */
+    if (!loadPreprocessCache(scene, "sources", [&](Stream *stream) {
+                m_sources = new RadianceSources(stream, NULL);
+                m_nonCollimatedLightSourcesPresent = stream->readBool();
+            })) {
+        collectRadianceSources(scene);
+        storePreprocessCache(scene, "sources", [&](Stream *stream) {
+                m_sources->serialize(stream, NULL);
+                stream->writeBool(m_nonCollimatedLightSourcesPresent);
+            });
+    }
     Log(EInfo, "DirectSamplingSubsurface medium stored %d collimated light "
             "sources", m_sources->get().size());
     if (!m_nonCollimatedLightSourcesPresent)
@@ -338,6 +455,523 @@ void DirectSamplingSubsurface::wakeup(ConfigurableObject *parent,
         }
     }
 #endif
+    std::string cacheName = formatString("radianceCache%i", m_sourcesIndex);
+    if (m_radianceCacheSamples > 0 && !m_radianceCache.get()) {
+        if (params.find(cacheName) != params.end()) {
+            m_radianceCache = static_cast<DSSRadianceCache *>(
+                    params[cacheName]);
+        } else {
+            Log(EWarn, "Woke up but could not find the radiance cache "
+                    "resource, falling back to regular radiance queries!");
+        }
+    }
+}
+
+/// Cache points of which the incident radiance still needs to be sampled
+class DSSCachePoints : public WorkUnit {
+public:
+    inline void put(const Point &p, const Normal &n, int shapeIndex) {
+        m_positions.push_back(p);
+        m_normals.push_back(n);
+        m_shapeIndices.push_back(shapeIndex);
+    }
+
+    inline size_t size() const {
+        return m_positions.size();
+    }
+
+    inline void clear() {
+        m_positions.clear();
+        m_normals.clear();
+        m_shapeIndices.clear();
+    }
+
+    /// Replace the contents by the points [start, start+count) of \c other
+    void setRange(const DSSCachePoints *other, size_t start, size_t count) {
+        m_positions.assign(other->m_positions.begin() + start,
+                other->m_positions.begin() + start + count);
+        m_normals.assign(other->m_normals.begin() + start,
+                other->m_normals.begin() + start + count);
+        m_shapeIndices.assign(other->m_shapeIndices.begin() + start,
+                other->m_shapeIndices.begin() + start + count);
+    }
+
+    inline const Point &getPosition(size_t i) const { return m_positions[i]; }
+    inline const Normal &getNormal(size_t i) const { return m_normals[i]; }
+    /// Index in the scene's shape list (-1: not a top-level shape)
+    inline int getShapeIndex(size_t i) const { return m_shapeIndices[i]; }
+
+    /* WorkUnit interface */
+    void set(const WorkUnit *workUnit) {
+        const DSSCachePoints *other = static_cast<const DSSCachePoints *>(workUnit);
+        setRange(other, 0, other->size());
+    }
+
+    void load(Stream *stream) {
+        clear();
+        size_t count = stream->readSize();
+        for (size_t i = 0; i < count; i++) {
+            Point p(stream);
+            Normal n(stream);
+            put(p, n, stream->readInt());
+        }
+    }
+
+    void save(Stream *stream) const {
+        stream->writeSize(size());
+        for (size_t i = 0; i < size(); i++) {
+            m_positions[i].serialize(stream);
+            m_normals[i].serialize(stream);
+            stream->writeInt(m_shapeIndices[i]);
+        }
+    }
+
+    std::string toString() const {
+        return formatString("DSSCachePoints[size=%d]", (int) size());
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~DSSCachePoints() { }
+private:
+    std::vector<Point> m_positions;
+    std::vector<Normal> m_normals;
+    std::vector<int> m_shapeIndices;
+};
+
+/// Radiance cache for a batch of points, as computed by a worker
+class DSSRadianceCacheResult : public WorkResult {
+public:
+    DSSRadianceCacheResult(int bands) : m_bands(bands) {
+        clear();
+    }
+
+    inline void clear() {
+        m_cache = new DSSRadianceCache(m_bands);
+    }
+
+    inline DSSRadianceCache *get() {
+        return m_cache.get();
+    }
+
+    inline const DSSRadianceCache *get() const {
+        return m_cache.get();
+    }
+
+    /* WorkResult interface */
+    void load(Stream *stream) {
+        m_cache = new DSSRadianceCache(stream, NULL);
+    }
+
+    void save(Stream *stream) const {
+        m_cache->serialize(stream, NULL);
+    }
+
+    std::string toString() const {
+        return formatString("DSSRadianceCacheResult[size=%d]",
+                (int) m_cache->size());
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~DSSRadianceCacheResult() { }
+private:
+    int m_bands;
+    ref<DSSRadianceCache> m_cache;
+};
+
+/// Samples the incident radiance at the cache points (worker)
+class DSSRadianceCacheWorker : public WorkProcessor {
+public:
+    DSSRadianceCacheWorker(int bands, size_t directions,
+            RadianceQueryRecord::ERadianceQuery queryType, Float time)
+        : m_bands(bands), m_directions(directions),
+          m_queryType(queryType), m_time(time) { }
+
+    DSSRadianceCacheWorker(Stream *stream, InstanceManager *manager) {
+        m_bands = stream->readInt();
+        m_directions = stream->readSize();
+        m_queryType = (RadianceQueryRecord::ERadianceQuery) stream->readInt();
+        m_time = stream->readFloat();
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        stream->writeInt(m_bands);
+        stream->writeSize(m_directions);
+        stream->writeInt(m_queryType);
+        stream->writeFloat(m_time);
+    }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new DSSCachePoints();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new DSSRadianceCacheResult(m_bands);
+    }
+
+    void prepare() {
+        m_scene = static_cast<Scene *>(getResource("scene"));
+        m_sampler = static_cast<Sampler *>(getResource("sampler"));
+        m_integrator = static_cast<MonteCarloIntegrator *>(
+                getResource("integrator"));
+        m_scene->wakeup(NULL, m_resources);
+        m_integrator->wakeup(NULL, m_resources);
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+            const bool &stop) {
+        const DSSCachePoints &points =
+                *static_cast<const DSSCachePoints *>(workUnit);
+        DSSRadianceCacheResult *result =
+                static_cast<DSSRadianceCacheResult *>(workResult);
+        const ref_vector<Shape> &shapes = m_scene->getShapes();
+
+        result->clear();
+        std::vector<Vector> directions(m_directions);
+        std::vector<Spectrum> radiance(m_directions);
+        for (size_t i = 0; i < points.size() && !stop; i++) {
+            int shapeIndex = points.getShapeIndex(i);
+            const Medium *medium = shapeIndex >= 0
+                    ? shapes[shapeIndex]->getExteriorMedium() : NULL;
+            Frame frame(points.getNormal(i));
+
+            for (size_t j = 0; j < m_directions; j++) {
+                directions[j] = frame.toWorld(
+                        warp::squareToUniformHemisphere(m_sampler->next2D()));
+                RadianceQueryRecord rRec(m_scene, m_sampler);
+                rRec.newQuery(m_queryType, medium);
+                RayDifferential ray(points.getPosition(i),
+                        directions[j], m_time);
+                radiance[j] = m_integrator->Li(ray, rRec);
+            }
+            result->get()->put(points.getPosition(i), points.getNormal(i),
+                    directions, radiance);
+        }
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new DSSRadianceCacheWorker(m_bands, m_directions,
+                m_queryType, m_time);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~DSSRadianceCacheWorker() { }
+private:
+    ref<Scene> m_scene;
+    ref<Sampler> m_sampler;
+    ref<MonteCarloIntegrator> m_integrator;
+    int m_bands;
+    size_t m_directions;
+    RadianceQueryRecord::ERadianceQuery m_queryType;
+    Float m_time;
+};
+
+/// Parallel process that fills in a \ref DSSRadianceCache
+class DSSRadianceCacheProcess : public ParallelProcess {
+public:
+    DSSRadianceCacheProcess(DSSCachePoints *points, size_t granularity,
+            int bands, size_t directions,
+            RadianceQueryRecord::ERadianceQuery queryType, Float time,
+            const void *data)
+        : m_points(points), m_granularity(granularity), m_bands(bands),
+          m_directions(directions), m_queryType(queryType), m_time(time) {
+        m_resultMutex = new Mutex();
+        m_cache = new DSSRadianceCache(bands);
+        m_pointsRequested = 0;
+        m_progress = new ProgressReporter("Caching DSS radiance",
+                points->size(), data);
+    }
+
+    inline DSSRadianceCache *getCache() {
+        return m_cache.get();
+    }
+
+    /* ParallelProcess implementation */
+    ref<WorkProcessor> createWorkProcessor() const {
+        return new DSSRadianceCacheWorker(m_bands, m_directions,
+                m_queryType, m_time);
+    }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        if (m_pointsRequested == m_points->size())
+            return EFailure;
+
+        /* Reserve a sequence of at most 'granularity' points */
+        size_t workSize = std::min(m_granularity,
+                m_points->size() - m_pointsRequested);
+        static_cast<DSSCachePoints *>(unit)->setRange(
+                m_points.get(), m_pointsRequested, workSize);
+        m_pointsRequested += workSize;
+        return ESuccess;
+    }
+
+    void processResult(const WorkResult *wr, bool cancelled) {
+        if (cancelled)
+            return;
+        const DSSRadianceCacheResult *result =
+                static_cast<const DSSRadianceCacheResult *>(wr);
+        LockGuard lock(m_resultMutex);
+        m_cache->merge(result->get());
+        m_progress->update(m_cache->size());
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~DSSRadianceCacheProcess() {
+        delete m_progress;
+    }
+private:
+    ref<DSSCachePoints> m_points;
+    ref<DSSRadianceCache> m_cache;
+    size_t m_pointsRequested, m_granularity;
+    int m_bands;
+    size_t m_directions;
+    RadianceQueryRecord::ERadianceQuery m_queryType;
+    Float m_time;
+    ref<Mutex> m_resultMutex;
+    ProgressReporter *m_progress;
+};
+
+bool DirectSamplingSubsurface::buildRadianceCache(const Scene *scene,
+        const RenderJob *job, int sceneResID) {
+    ref<Scheduler> sched = Scheduler::getInstance();
+
+    /* Spread the cache points over our shapes proportionally to their
+     * surface area, using a low-discrepancy sequence so that they are
+     * reasonably well distributed. */
+    DiscreteDistribution shapeAreas(m_shapes.size());
+    for (const Shape *shape : m_shapes)
+        shapeAreas.append(shape->getSurfaceArea());
+    if (shapeAreas.normalize() == 0)
+        Log(EError, "Cannot build a radiance cache on shapes without "
+                "surface area!");
+
+    const Sensor *sensor = scene->getSensor();
+    Float time = sensor->getShutterOpen()
+            + 0.5f * sensor->getShutterOpenTime();
+    const ref_vector<Shape> &sceneShapes = scene->getShapes();
+    ref<DSSCachePoints> points = new DSSCachePoints();
+    for (size_t i = 0; i < m_radianceCacheSamples; i++) {
+        Point2 sample(radicalInverse(2, i + 1), radicalInverse(3, i + 1));
+        const Shape *shape = m_shapes[shapeAreas.sampleReuse(sample.x)];
+        PositionSamplingRecord pRec(time);
+        shape->samplePosition(pRec, sample);
+        int shapeIndex = -1;
+        for (size_t k = 0; k < sceneShapes.size(); k++) {
+            if (sceneShapes[k].get() == shape) {
+                shapeIndex = (int) k;
+                break;
+            }
+        }
+        points->put(pRec.p, pRec.n, shapeIndex);
+    }
+
+    /* Use the same type of query as Li_internal() would for the rays
+     * that leave our medium, so that a lookup can stand in for it */
+    RadianceQueryRecord::ERadianceQuery queryType = m_directSampling
+            ? RadianceQueryRecord::ERadianceNoEmission
+            : RadianceQueryRecord::ERadiance;
+    ref<DSSRadianceCacheProcess> proc = new DSSRadianceCacheProcess(
+            points, 64, m_radianceCacheBands, m_radianceCacheDirections,
+            queryType, time, job);
+
+    /* Create a sampler instance for every core */
+    ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+        createObject(MTS_CLASS(Sampler), Properties("independent")));
+    std::vector<SerializableObject *> samplers(sched->getCoreCount());
+    for (size_t i=0; i<sched->getCoreCount(); ++i) {
+        ref<Sampler> clonedSampler = sampler->clone();
+        clonedSampler->incRef();
+        samplers[i] = clonedSampler.get();
+    }
+
+    int samplerResID = sched->registerMultiResource(samplers);
+    int integratorResID = sched->registerResource(
+        const_cast<Integrator *>(scene->getIntegrator()));
+
+    proc->bindResource("scene", sceneResID);
+    proc->bindResource("integrator", integratorResID);
+    proc->bindResource("sampler", samplerResID);
+    scene->bindUsedResources(proc);
+    m_proc = proc;
+    sched->schedule(proc);
+    sched->wait(proc);
+    m_proc = NULL;
+    for (size_t i=0; i<samplers.size(); ++i)
+        samplers[i]->decRef();
+
+    sched->unregisterResource(samplerResID);
+    sched->unregisterResource(integratorResID);
+    if (proc->getReturnStatus() != ParallelProcess::ESuccess)
+        return false;
+
+    m_radianceCache = proc->getCache();
+    m_radianceCache->build();
+    Log(EInfo, "DirectSamplingSubsurface medium cached the incident "
+            "radiance at %d points (%d SH bands, %d directions each)",
+            m_radianceCache->size(), m_radianceCacheBands,
+            m_radianceCacheDirections);
+    return true;
+}
+
+void DirectSamplingSubsurface::cancel() {
+    if (m_proc.get())
+        Scheduler::getInstance()->cancel(m_proc);
+}
+
+void DirectSamplingSubsurface::invalidate() {
+    if (m_sourcesResID != -1) {
+        Scheduler::getInstance()->unregisterResource(m_sourcesResID);
+        m_sourcesResID = -1;
+    }
+    if (m_radianceCacheResID != -1) {
+        Scheduler::getInstance()->unregisterResource(m_radianceCacheResID);
+        m_radianceCacheResID = -1;
+    }
+    m_sources = NULL;
+    m_radianceCache = NULL;
+}
+
+DSSRadianceCache::DSSRadianceCache(int bands)
+        : m_bands(bands), m_numCoeffs(bands*bands) { }
+
+DSSRadianceCache::DSSRadianceCache(Stream *stream, InstanceManager *manager) {
+    m_bands = stream->readInt();
+    m_numCoeffs = m_bands*m_bands;
+    size_t n = stream->readSize();
+    m_positions.reserve(n);
+    m_normals.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        m_positions.push_back(Point(stream));
+        m_normals.push_back(Normal(stream));
+    }
+    m_coeffs.resize(n * SPECTRUM_SAMPLES * m_numCoeffs);
+    if (n > 0)
+        stream->readFloatArray(&m_coeffs[0], m_coeffs.size());
+    build();
+}
+
+void DSSRadianceCache::serialize(Stream *stream,
+        InstanceManager *manager) const {
+    stream->writeInt(m_bands);
+    stream->writeSize(m_positions.size());
+    for (size_t i = 0; i < m_positions.size(); i++) {
+        m_positions[i].serialize(stream);
+        m_normals[i].serialize(stream);
+    }
+    if (m_positions.size() > 0)
+        stream->writeFloatArray(&m_coeffs[0], m_coeffs.size());
+}
+
+void DSSRadianceCache::evalBasis(const Vector &d, Float *basis) const {
+    SHVector::evalBasis(d, m_bands, basis);
+}
+
+void DSSRadianceCache::put(const Point &p, const Normal &n,
+        const std::vector<Vector> &directions,
+        const std::vector<Spectrum> &radiance) {
+    Assert(directions.size() == radiance.size() && directions.size() > 0);
+    m_positions.push_back(p);
+    m_normals.push_back(n);
+    size_t offset = m_coeffs.size();
+    m_coeffs.resize(offset + SPECTRUM_SAMPLES * m_numCoeffs, 0.0f);
+    Float *coeffs = &m_coeffs[offset];
+
+    /* Monte Carlo projection from uniform samples over the outward
+     * hemisphere, the inward one does not receive any radiance */
+    Float *basis = (Float *) alloca(sizeof(Float) * m_numCoeffs);
+    Float invPdf = 2 * M_PI / directions.size();
+    for (size_t j = 0; j < directions.size(); j++) {
+        if (radiance[j].isZero())
+            continue;
+        evalBasis(directions[j], basis);
+        for (int c = 0; c < SPECTRUM_SAMPLES; c++) {
+            Float val = radiance[j][c] * invPdf;
+            for (int i = 0; i < m_numCoeffs; i++)
+                coeffs[c*m_numCoeffs + i] += val * basis[i];
+        }
+    }
+}
+
+void DSSRadianceCache::merge(const DSSRadianceCache *other) {
+    Assert(other->m_bands == m_bands);
+    m_positions.insert(m_positions.end(),
+            other->m_positions.begin(), other->m_positions.end());
+    m_normals.insert(m_normals.end(),
+            other->m_normals.begin(), other->m_normals.end());
+    m_coeffs.insert(m_coeffs.end(),
+            other->m_coeffs.begin(), other->m_coeffs.end());
+}
+
+void DSSRadianceCache::build() {
+    m_tree.clear();
+    m_tree.reserve(m_positions.size());
+    for (size_t i = 0; i < m_positions.size(); i++) {
+        CacheTree::NodeType node((uint32_t) i);
+        node.setPosition(m_positions[i]);
+        m_tree.push_back(node);
+    }
+    if (m_positions.size() > 0)
+        m_tree.build();
+}
+
+Spectrum DSSRadianceCache::lookup(const Point &p, const Normal &n,
+        const Vector &d) const {
+    if (m_positions.size() == 0)
+        return Spectrum(0.0f);
+
+    CacheTree::SearchResult results[ELookupNeighbours + 1];
+    size_t found = m_tree.nnSearch(p, ELookupNeighbours, results);
+
+    /* Let the weights fall off linearly with the distance (up to slightly
+     * beyond the furthest neighbour), and skip neighbours that lie on a
+     * differently oriented part of the boundary. If that leaves nothing,
+     * fall back to the nearest neighbour. */
+    Float maxDistSqr = 0;
+    size_t nearest = 0;
+    for (size_t k = 0; k < found; k++) {
+        maxDistSqr = std::max(maxDistSqr, results[k].distSquared);
+        if (results[k].distSquared < results[nearest].distSquared)
+            nearest = k;
+    }
+    Float invRadius = maxDistSqr > 0 ? 1 / (1.1f * std::sqrt(maxDistSqr)) : 0;
+
+    Float *basis = (Float *) alloca(sizeof(Float) * m_numCoeffs);
+    evalBasis(d, basis);
+
+    Spectrum result(0.0f);
+    Float weightSum = 0;
+    for (size_t pass = 0; pass < 2 && weightSum == 0; pass++) {
+        for (size_t k = 0; k < found; k++) {
+            uint32_t idx = m_tree[results[k].index].getData();
+            Float weight;
+            if (pass == 0) {
+                if (dot(m_normals[idx], n) < 0.5f)
+                    continue;
+                weight = 1 - std::sqrt(results[k].distSquared) * invRadius;
+            } else {
+                if (k != nearest)
+                    continue;
+                weight = 1;
+            }
+            const Float *coeffs = &m_coeffs[
+                    idx * SPECTRUM_SAMPLES * m_numCoeffs];
+            for (int c = 0; c < SPECTRUM_SAMPLES; c++) {
+                Float val = 0;
+                for (int i = 0; i < m_numCoeffs; i++)
+                    val += coeffs[c*m_numCoeffs + i] * basis[i];
+                result[c] += weight * val;
+            }
+            weightSum += weight;
+        }
+    }
+    result /= weightSum;
+
+    /* The truncated SH expansion can ring below zero */
+    result.clampNegative();
+    return result;
 }
 
 MTS_EXPORT_RENDER DistanceWeightFunc makeExactDiffusionDipoleDistanceWeight(
@@ -370,15 +1004,17 @@ MTS_EXPORT_RENDER DistanceWeightFunc makeExactDiffusionDipoleDistanceWeight(
         if (sigmaTPrime[channel] == 0) // infinite mfp
             return (Float) 0.0f;
 
-        Float sigma = sigmaTr[channel];
-        Float zr = spectral_zr[channel];
-        Float zv = spectral_zv[channel];
+        /* Evaluated in double precision, the terms under- and overflow
+         * easily otherwise */
+        double sigma = sigmaTr[channel];
+        double zr = spectral_zr[channel];
+        double zv = spectral_zv[channel];
 
-        Float sr = sqrt(zr*zr + r*r);
-        Float sv = sqrt(zv*zv + r*r);
+        double sr = sqrt(zr*zr + (double) r*r);
+        double sv = sqrt(zv*zv + (double) r*r);
 
-        return zr*(1 + sigma*sr) * exp(-sigma*sr)/(sr*sr*sr)
-             + zv*(1 + sigma*sv) * exp(-sigma*sv)/(sv*sv*sv);
+        return (Float) (zr*(1 + sigma*sr) * exp(-sigma*sr)/(sr*sr*sr)
+                      + zv*(1 + sigma*sv) * exp(-sigma*sv)/(sv*sv*sv));
     };
 }
 
@@ -423,15 +1059,17 @@ RadialExactDipoleSampler2D::RadialExactDipoleSampler2D(
 
 bool RadialExactDipoleSampler2D::sample(int channel, Float &r,
         Sampler *sampler, Float *thePdf) const {
-    Float sigma = m_sigmaTr[channel];
+    /* Everything is done in double precision: the Lambert W inversion
+     * is badly conditioned close to the sources */
+    double sigma = m_sigmaTr[channel];
     if (sigma == 0)
         return false;
-    Float zr = m_zr[channel];
-    Float zv = m_zv[channel];
-    Float T = m_T[channel];
+    double zr = m_zr[channel];
+    double zv = m_zv[channel];
+    double T = m_T[channel];
 
-    Float xi = sampler->next1D();
-    Float z;
+    double xi = sampler->next1D();
+    double z;
     if (xi <= T) { // typo in paper
         z = zr;
         xi = xi/T;
@@ -439,20 +1077,32 @@ bool RadialExactDipoleSampler2D::sample(int channel, Float &r,
         z = zv;
         xi = (xi - T)/(1 - T);
     }
-    Float u = boost::math::tools::newton_raphson_iterate([=](Float u) {
-            return std::make_tuple(
-//                  sigma*z*(u-1) + log(u) + log(1-xi), /* f(u) */
-                    sigma*z*(u-1) + log(u*(1-xi)),      /* f(u) */
-                    sigma*z + 1./u); },                 /* f'(u) */
-//          (Float) 1, (Float) 0, std::numeric_limits<Float>::infinity(),
-            (Float) 1, (Float) 10*RCPOVERFLOW, (Float) 1.0/(10*RCPOVERFLOW),
-#ifdef DOUBLE_PRECISION
-            40
-#else
-            20
-#endif
-            );
-    r = z*math::safe_sqrt(u*u - 1);
+    /* Invert the radial CDF of this source in closed form: with c =
+     * sigma*z and y = -log(1-xi), we need the root u >= 1 of
+     *   f(u) = c*(u-1) + log(u) - y,
+     * which is u = W0(c*exp(c+y))/c. */
+    double c = sigma*z;
+    double y = -std::log(1 - xi);
+    if (!std::isfinite(y))
+        return false;
+    double logX = std::log(c) + c + y;
+    double w;
+    static const double logMaxDouble =
+            std::log(std::numeric_limits<double>::max());
+    if (logX < logMaxDouble) {
+        w = math::lambertW0<double>(std::exp(logX));
+    } else {
+        /* W0(x) for x beyond the floating point range: solve
+         * w + log(w) = log(x) in log space instead */
+        w = logX - std::log(logX);
+        for (int i = 0; i < 3; i++)
+            w -= (w + std::log(w) - logX) / (1 + 1/w);
+    }
+    double u = std::max(1.0, w / c);
+    /* Polish with one Newton step on f itself (removes the residual
+     * error of the Lambert W evaluation) */
+    u -= (c*(u - 1) + std::log(u) - y) / (c + 1/u);
+    r = (Float) (z*math::safe_sqrt(u*u - 1));
     if (thePdf) {
         *thePdf = pdf(channel, r);
     }
@@ -460,20 +1110,20 @@ bool RadialExactDipoleSampler2D::sample(int channel, Float &r,
 }
 
 Float RadialExactDipoleSampler2D::pdf(int channel, Float r) const {
-    Float sigma = m_sigmaTr[channel];
+    double sigma = m_sigmaTr[channel];
     if (sigma == 0)
         return false;
-    Float zr = m_zr[channel];
-    Float zv = m_zv[channel];
+    double zr = m_zr[channel];
+    double zv = m_zv[channel];
 
-    Float sr = sqrt(zr*zr + r*r);
-    Float sv = sqrt(zv*zv + r*r);
+    double sr = sqrt(zr*zr + (double) r*r);
+    double sv = sqrt(zv*zv + (double) r*r);
 
     /* 2*pi*r factor already built-in to take the pdf to the area measure
      * as required */
-    return INV_TWOPI * m_pdfNorm[channel]
+    return (Float) (INV_TWOPI_DBL * m_pdfNorm[channel]
             * (zr*(1 + sigma*sr) * exp(-sigma*sr)/(sr*sr*sr)
-              +zv*(1 + sigma*sv) * exp(-sigma*sv)/(sv*sv*sv));
+              +zv*(1 + sigma*sv) * exp(-sigma*sv)/(sv*sv*sv)));
 }
 
 /**
@@ -486,51 +1136,149 @@ Float RadialExactDipoleSampler2D::pdf(int channel, Float r) const {
  * cause inconsistent results, which is somewhat alleviated by carrying out
  * this rounding operation on the intersection before computing the pdf.
  * It also helps us 'find/identify' our own intersection again when given a
- * list of intersections by removing some of the numerical noise. */
-static inline Intersection roundItsForStability(const Intersection &its) {
-#if 1 /* If 1: don't do any rounding -- any possible problems that might
-         crop up, can be taken care of with a robust integrator (e.g.
-         adaptiveRobustMC) */
-    return its;
-#else
-    Intersection newIts(its);
-    newIts.p = roundPointForStability(its.p);
-    newIts.shFrame.n = roundDirectionForStability(its.shFrame.n);
-    newIts.geoFrame.n = roundDirectionForStability(its.geoFrame.n);
+ * list of intersections by removing some of the numerical noise.
+ *
+ * The rounding happens in place. */
+static inline void roundItsForStability(Intersection &its) {
+#if MTS_DSS_ROUND_ITS_FOR_STABILITY
+    its.p = roundPointForStability(its.p);
+    its.shFrame.n = roundDirectionForStability(its.shFrame.n);
+    its.geoFrame.n = roundDirectionForStability(its.geoFrame.n);
     /* NOTE: the other axes are now no longer orthogonal, but does not seem
      * to be a problem. */
-    return newIts;
 #endif
 }
 
-static inline std::vector<Intersection> roundItssForStability(
-        const std::vector<Intersection> &itss) {
-    std::vector<Intersection> newItss(itss.size());
-    for (size_t i = 0; i < itss.size(); i++)
-        newItss[i] = roundItsForStability(itss[i]);
-    return newItss;
+void IntersectionSampler::collectIntersections(const Scene *scene,
+        const Point &origin, const Vector &direction, Float time,
+        const std::vector<Shape *> &shapes, const Intersection &its_out,
+        const Vector &d_out, IntersectionList &intersections,
+        bool bidirectional) const {
+    intersections.clear();
+
+    /* Find min and max t values that correspond to the
+     * m_itsDistanceCutoff range around the its_out.p query point
+     * (trivially equal to +/-m_itsDistanceCutoff in case the
+     * projection origin coincides with its_out.p, but slightly more
+     * involved if that is not the case) */
+    Vector centerOffset = origin - its_out.p;
+    Float offset2 = centerOffset.lengthSquared();
+    Float cutoff2 = math::square(m_itsDistanceCutoff);
+
+    Float proj = dot(centerOffset, direction);
+    Float tmp2 = proj*proj - offset2 + cutoff2;
+    if (tmp2 < 0)
+        return; // no intersection
+
+    Float tmp = sqrt(tmp2);
+    Float max_t = -proj + tmp;
+    Float min_t = (bidirectional ? -proj - tmp : Epsilon);
+
+    HotAssert(distance(its_out.p, origin + direction * max_t)
+            <= m_itsDistanceCutoff * (1+Epsilon));
+    HotAssert(distance(its_out.p, origin + direction * min_t)
+            <= m_itsDistanceCutoff * (1+Epsilon));
+
+    Ray ray(origin, direction, min_t, max_t, time);
+    if (m_itsWeightTolerance <= 0) {
+        scene->rayIntersectFully(ray, intersections, &shapes);
+    } else {
+        /* Traverse outwards from the point on the line that is closest to
+         * its_out.p, which is where the weights are typically largest,
+         * and stop as soon as a leaf contributes next to nothing. */
+        Float cumulWeight = 0;
+        auto stop = [&] (const IntersectionList &itss, size_t firstNew) {
+            Float leafWeight = 0;
+            for (size_t i = firstNew; i < itss.size(); i++)
+                leafWeight += probeWeight(itss[i], its_out, d_out);
+            cumulWeight += leafWeight;
+            return cumulWeight > 0
+                    && leafWeight <= m_itsWeightTolerance * cumulWeight;
+        };
+        scene->rayIntersectFullyOutwards(ray, -proj, intersections,
+                stop, &shapes);
+    }
+
+#if MTS_DSS_ROUND_ITS_FOR_STABILITY
+    for (size_t i = 0; i < intersections.size(); i++)
+        roundItsForStability(intersections[i]);
+#endif
+}
+
+static AABB computeShapesAABB(const std::vector<Shape *> &shapes) {
+    AABB aabb;
+    for (const Shape *shape : shapes) {
+        aabb.expandBy(shape->getAABB());
+    }
+    return aabb;
+}
+
+const AABB &DSSProbeContext::getShapesAABB(
+        const std::vector<Shape *> &shapes) {
+    if (!m_aabbValid) {
+        m_aabb = computeShapesAABB(shapes);
+        m_aabbValid = true;
+    }
+    return m_aabb;
+}
+
+const IntersectionList &DSSProbeContext::collectIntersections(
+        const IntersectionSampler *itsSampler, const Scene *scene,
+        const Point &origin, const Vector &direction, Float time,
+        const std::vector<Shape *> &shapes, const Intersection &its_out,
+        const Vector &d_out, bool bidirectional) {
+    reusedProbes.incrementBase();
+    for (size_t i = 0; i < m_numProbes; i++) {
+        const Probe &probe = m_probes[i];
+        if (probe.itsSampler == itsSampler && probe.shapes == &shapes
+                && probe.origin == origin && probe.direction == direction
+                && probe.time == time
+                && probe.bidirectional == bidirectional) {
+            ++reusedProbes;
+            return probe.intersections;
+        }
+    }
+
+    if (m_numProbes == m_probes.size())
+        m_probes.push_back(Probe());
+    Probe &probe = m_probes[m_numProbes++];
+    probe.itsSampler = itsSampler;
+    probe.shapes = &shapes;
+    probe.origin = origin;
+    probe.direction = direction;
+    probe.time = time;
+    probe.bidirectional = bidirectional;
+    itsSampler->collectIntersections(scene, origin, direction, time,
+            shapes, its_out, d_out, probe.intersections, bidirectional);
+    return probe.intersections;
+}
+
+Float WeightIntersectionSampler::probeWeight(const Intersection &its,
+        const Intersection &its_out, const Vector &d_out) const {
+    return channelMean(-1, [&] (int chan) {
+            return m_intersectionWeight(its, its_out, d_out, chan); });
 }
 
 Float WeightIntersectionSampler::sample(
-        const std::vector<Intersection> &intersections, Intersection &newIts,
+        const IntersectionList &intersections, Intersection &newIts,
         const Intersection &its_out, const Vector &d_out,
         int channel, Sampler *sampler) const {
-    SAssert(intersections.size() != 0);
+    SHotAssert(intersections.size() != 0);
     Float intersectionProb;
     Vector n_geo(0.0f);
     Float weights[intersections.size()];
     Float cumulWeight = 0;
-    /* All decisions happen based on the safeItss (but newIts gets set to
-     * the corresponding original one, of course) */
-    std::vector<Intersection> safeItss = roundItssForStability(intersections);
-    for (size_t i = 0; i < safeItss.size(); i++) {
+    /* The intersections were already rounded for stability when they were
+     * collected */
+    for (size_t i = 0; i < intersections.size(); i++) {
+        const Intersection &its = intersections[i];
         weights[i] = channelMean(channel,
-                    [=] (int chan) { return m_intersectionWeight(
-                        safeItss[i], its_out, d_out, chan); });
-        Assert(weights[i] >= 0);
+                    [&] (int chan) { return m_intersectionWeight(
+                        its, its_out, d_out, chan); });
+        HotAssert(weights[i] >= 0);
         cumulWeight += weights[i];
     }
-    SAssert(cumulWeight >= 0);
+    SHotAssert(cumulWeight >= 0);
     if (cumulWeight <= RCPOVERFLOW) {
         /* Can potentially happen if all weights fall below the smallest
          * properly representable number (e.g. when intersections are far
@@ -547,8 +1295,8 @@ Float WeightIntersectionSampler::sample(
             sampler->next1D(), &intersectionProb);
     newIts = intersections[idx];
     n_geo = newIts.geoFrame.n;
-    SAssert(std::isfinite(intersectionProb) && intersectionProb > 0);
-    SAssert(!n_geo.isZero());
+    SHotAssert(std::isfinite(intersectionProb) && intersectionProb > 0);
+    SHotAssert(!n_geo.isZero());
 #ifdef MTS_DSS_PDF_CHECK
     Float pdf2 = pdf(intersections, newIts, its_out, d_out, channel);
     if (fabs((intersectionProb - pdf2)/(intersectionProb + pdf2)) > ShadowEpsilon)
@@ -559,29 +1307,36 @@ Float WeightIntersectionSampler::sample(
 }
 
 Float WeightIntersectionSampler::pdf(
-        const std::vector<Intersection> &intersections,
+        const IntersectionList &intersections,
         const Intersection &newIts, const Intersection &its_out,
         const Vector &d_out, int channel) const {
-    SAssert(intersections.size() != 0);
+    SHotAssert(intersections.size() != 0);
 
-    std::vector<Intersection> safeItss = roundItssForStability(intersections);
-    Intersection newSafeIts = roundItsForStability(newIts);
+    /* The intersections were already rounded for stability when they were
+     * collected, so only round our own one here (if needed at all) */
+#if MTS_DSS_ROUND_ITS_FOR_STABILITY
+    Intersection newSafeIts(newIts);
+    roundItsForStability(newSafeIts);
+#else
+    const Intersection &newSafeIts = newIts;
+#endif
 
     /* Find our weight */
     Float ourWeight = channelMean(channel,
-                    [=] (int chan) { return m_intersectionWeight(
+                    [&] (int chan) { return m_intersectionWeight(
                         newSafeIts, its_out, d_out, chan); });
-    Assert(ourWeight >= 0);
+    HotAssert(ourWeight >= 0);
     /* Find cumul weight of all intersections (and check if we find ours!) */
     size_t ourIdx = (size_t) -1;
     Float cumulWeight = 0;
     for (size_t i = 0; i < intersections.size(); i++) {
+        const Intersection &its = intersections[i];
         Float thisWeight = channelMean(channel,
-                    [=] (int chan) { return m_intersectionWeight(
-                        safeItss[i], its_out, d_out, chan); });
-        Assert(thisWeight >= 0);
+                    [&] (int chan) { return m_intersectionWeight(
+                        its, its_out, d_out, chan); });
+        HotAssert(thisWeight >= 0);
         cumulWeight += thisWeight;
-        if (vectorEquals(Vector(newSafeIts.p), Vector(safeItss[i].p)))
+        if (vectorEquals(Vector(newSafeIts.p), Vector(its.p)))
             ourIdx = i;
     }
 
@@ -612,9 +1367,10 @@ Float WeightIntersectionSampler::pdf(
         for (size_t i = 0; i < intersections.size(); i++) {
             if (i == ourIdx)
                 continue;
+            const Intersection &its = intersections[i];
             Float thisWeight = channelMean(channel,
-                        [=] (int chan) { return m_intersectionWeight(
-                            safeItss[i], its_out, d_out, chan); });
+                        [&] (int chan) { return m_intersectionWeight(
+                            its, its_out, d_out, chan); });
             sumOfOtherWeights += thisWeight;
         }
         SLog(EWarn, "Inconsistent weights for pdfIntersection: "
@@ -635,7 +1391,7 @@ Float UniformSurfaceSampler::sample(const Intersection &its,
         const Vector &d_out, const Scene *scene,
         const std::vector<Shape *> &shapes,
         Intersection &newIts, int channel,
-        Sampler *sampler) const {
+        Sampler *sampler, DSSProbeContext *probes) const {
     size_t N = shapes.size();
     Float weights[N];
     Float SA = 0;
@@ -663,7 +1419,8 @@ Float UniformSurfaceSampler::sample(const Intersection &its,
 Float UniformSurfaceSampler::pdf(const Intersection &its,
         const Vector &d_out, const Scene *scene,
         const std::vector<Shape *> &shapes,
-        const Intersection &newIts, int channel) const {
+        const Intersection &newIts, int channel,
+        DSSProbeContext *probes) const {
     Float SA = 0;
     for (auto shape : shapes) {
         SA += shape->getSurfaceArea();
@@ -676,7 +1433,7 @@ Float BRDFDeltaSurfaceSampler::sample(const Intersection &its,
         const Vector &d_out, const Scene *scene,
         const std::vector<Shape *> &shapes,
         Intersection &newIts, int channel,
-        Sampler *sampler) const {
+        Sampler *sampler, DSSProbeContext *probes) const {
     newIts = its;
     return 1.0;
 }
@@ -684,7 +1441,8 @@ Float BRDFDeltaSurfaceSampler::sample(const Intersection &its,
 Float BRDFDeltaSurfaceSampler::pdf(const Intersection &its,
         const Vector &d_out, const Scene *scene,
         const std::vector<Shape *> &shapes,
-        const Intersection &newIts, int channel) const {
+        const Intersection &newIts, int channel,
+        DSSProbeContext *probes) const {
     if (distance(newIts.p, its.p) <= Epsilon*Vector(its.p).length())
         return 1.0f;
     return 0.0f;
@@ -707,11 +1465,9 @@ void ProjSurfaceSampler::getProjFrame(
 
 static void getExtremalPlaneValues(const Vector &u, const Vector &v,
         const std::vector<Shape *> &shapes, const Point &p,
-        Vector2 &xLo, Vector2 &xHi) {
-    AABB aabb;
-    for (const Shape *shape : shapes) {
-        aabb.expandBy(shape->getAABB());
-    }
+        Vector2 &xLo, Vector2 &xHi, DSSProbeContext *probes) {
+    const AABB &aabb = probes ? probes->getShapesAABB(shapes)
+            : computeShapesAABB(shapes);
     xLo = Vector2( std::numeric_limits<Float>::infinity());
     xHi = Vector2(-std::numeric_limits<Float>::infinity());
     for (int i = 0; i < 8; i++) {
@@ -721,21 +1477,21 @@ static void getExtremalPlaneValues(const Vector &u, const Vector &v,
         xHi.x = std::max(xHi.x, dot(u, corner));
         xHi.y = std::max(xHi.y, dot(v, corner));
     }
-    SAssertWarn(xLo.isFinite());
-    SAssertWarn(xHi.isFinite());
+    SHotAssertWarn(xLo.isFinite());
+    SHotAssertWarn(xHi.isFinite());
 
     /* Because we only get called when the point p is actually on the
      * surface, we should have only negative xLo values and only positive
      * xHi values. */
-    SAssertWarn(xLo.x <= 0 && xLo.y <= 0);
-    SAssertWarn(xHi.x >= 0 && xHi.y >= 0);
+    SHotAssertWarn(xLo.x <= 0 && xLo.y <= 0);
+    SHotAssertWarn(xHi.x >= 0 && xHi.y >= 0);
 }
 
 Float ProjSurfaceSampler::sample(const Intersection &its,
         const Vector &d_out, const Scene *scene,
         const std::vector<Shape *> &shapes,
         Intersection &newIts, int channel,
-        Sampler *sampler) const {
+        Sampler *sampler, DSSProbeContext *probes) const {
     /* Sample from the uniformly weighted sum of the pdfs associated with
      * the different spectral channels. First pick a single channel
      * uniformly. */
@@ -750,7 +1506,7 @@ Float ProjSurfaceSampler::sample(const Intersection &its,
     getProjFrame(u, v, projectionDir, its, d_out);
 
     Vector2 xLo, xHi;
-    getExtremalPlaneValues(u, v, shapes, its.p, xLo, xHi);
+    getExtremalPlaneValues(u, v, shapes, its.p, xLo, xHi, probes);
 
     Vector2 x;
     if (!m_planeSampler->sample(chosenChannel, x, cosTheta, xLo, xHi, sampler))
@@ -806,7 +1562,7 @@ Float ProjSurfaceSampler::sample(const Intersection &its,
      */
     Float intersectionProb = m_itsSampler->sample(newIts, scene,
             o, projectionDir, its.time,
-            shapes, its, d_out, channel, sampler);
+            shapes, its, d_out, channel, sampler, true, probes);
     if (intersectionProb == 0)
         return 0.0f;
 
@@ -846,7 +1602,8 @@ Float ProjSurfaceSampler::sample(const Intersection &its,
 Float ProjSurfaceSampler::pdf(const Intersection &its,
         const Vector &d_out, const Scene *scene,
         const std::vector<Shape *> &shapes,
-        const Intersection &newIts, int channel) const {
+        const Intersection &newIts, int channel,
+        DSSProbeContext *probes) const {
     Vector u, v, projectionDir;
     getProjFrame(u, v, projectionDir, its, d_out);
 
@@ -859,14 +1616,14 @@ Float ProjSurfaceSampler::pdf(const Intersection &its,
     Float cosTheta = dot(n, d_out);
 
     Vector2 xLo, xHi;
-    getExtremalPlaneValues(u, v, shapes, its.p, xLo, xHi);
+    getExtremalPlaneValues(u, v, shapes, its.p, xLo, xHi, probes);
 
     Vector delta = newIts.p - its.p;
     Vector2 x(dot(delta,u), dot(delta,v));
 
     // Check consistency of extremal plane values: (reminder: xLo < 0)
-    Assert(x[0] >= xLo[0]*(1+Epsilon)  &&  x[0] <= xHi[0]*(1+Epsilon));
-    Assert(x[1] >= xLo[1]*(1+Epsilon)  &&  x[1] <= xHi[1]*(1+Epsilon));
+    HotAssert(x[0] >= xLo[0]*(1+Epsilon)  &&  x[0] <= xHi[0]*(1+Epsilon));
+    HotAssert(x[1] >= xLo[1]*(1+Epsilon)  &&  x[1] <= xHi[1]*(1+Epsilon));
 
     /* Pdf of the point in the tangent plane in its area measure, taking
      * into account that we could have sampled from any channel */
@@ -879,13 +1636,12 @@ Float ProjSurfaceSampler::pdf(const Intersection &its,
         SLog(EWarn, "Something fishy happened");
         return 0.0f;
     }
-    std::vector<Intersection> intersections;
     /* We should be able to choose the origin of our intersection
      * collection at the surface instead of where we would have started
      * from during the sampling step (point 'o'): */
     Float intersectionProb = m_itsSampler->pdf(newIts, scene,
             newIts.p, projectionDir, its.time,
-            shapes, its, d_out, channel);
+            shapes, its, d_out, channel, true, probes);
     if (intersectionProb == 0)
         return 0.0f;
 
@@ -937,7 +1693,7 @@ Spectrum DirectSamplingSubsurface::pdfBssrdfDirection(const Scene *scene,
 #if MTS_DSS_ALLOW_INTERNAL_INCOMING_DIR
     return Spectrum(INV_PI * math::abs(dot(d_in, n_in)));
 #else
-    Assert(-dot(d_in, n_in) >= 0);
+    HotAssert(-dot(d_in, n_in) >= 0);
     return Spectrum(INV_PI * (-dot(d_in, n_in)));
 #endif
 }
@@ -961,7 +1717,7 @@ Spectrum DirectSamplingSubsurface::sampleDirectionsFromBssrdf(
             throughput, sampler);
     if (d_in_pdf.isZero())
         return Spectrum(0.0f);
-    Assert(MTS_DSS_ALLOW_INTERNAL_INCOMING_DIR
+    HotAssert(MTS_DSS_ALLOW_INTERNAL_INCOMING_DIR
             || dot(d_in, its_in.shFrame.n) <= 0);
 
     /* Sample BSDF * cos(theta) */
@@ -1008,7 +1764,7 @@ Spectrum DirectSamplingSubsurface::pdfDirectionsFromBssrdf(
         EMeasure bsdfMeasure,
         const Spectrum &throughput,
         const void *extraParams) const {
-    Assert(bsdfMeasure != EInvalidMeasure);
+    HotAssert(bsdfMeasure != EInvalidMeasure);
     Spectrum d_in_pdf = pdfBssrdfDirection(
             scene, its_out, d_out, its_in, d_in, extraParams,
             throughput);
@@ -1067,12 +1823,12 @@ Spectrum DirectSamplingSubsurface::sampleDirectionsDirect(
     Spectrum bsdfVal = bsdf->sample(bRec, d_in_pdf, sampler->next2D());
     if (bsdfVal.isZero())
         return Spectrum(0.0);
-    Assert(Frame::cosTheta(bRec.wo) < 0); // inwards pointing direction
+    HotAssert(Frame::cosTheta(bRec.wo) < 0); // inwards pointing direction
     bsdfVal *= d_in_pdf; // Transform back to actual bsdf value
 
     /* The included cosine factor in the bsdfVal is on our 'd_in', get the
      * other cosine factor in as well */
-    Assert(dot(rec_wi, n_in) >= 0);
+    HotAssert(dot(rec_wi, n_in) >= 0);
     bsdfVal *= dot(rec_wi, n_in);
 
     bsdfMeasure = bsdf->getMeasure(bRec.sampledType);
@@ -1101,7 +1857,7 @@ Spectrum DirectSamplingSubsurface::pdfDirectionsDirect(
         const Intersection &its_in,  const Vector &d_in,
         const Vector &rec_wi,
         EMeasure bsdfMeasure) const {
-    Assert(bsdfMeasure != EInvalidMeasure);
+    HotAssert(bsdfMeasure != EInvalidMeasure);
 
     const BSDF *bsdf = its_in.getBSDF();
     Vector n_in = its_in.shFrame.n;
@@ -1168,11 +1924,9 @@ Spectrum DirectSamplingSubsurface::sampleDirect(
     if (extraParamsPdf.isZero())
         return Spectrum(0.0f);
 
-    Vector n_in = its_in.shFrame.n;
-    Float rec_wi_cosine = dot(rec_wi, n_in);
-    Assert(rec_wi_cosine >= 0);
-    Float d_in_cosine = dot(d_in, n_in);
-    Assert(MTS_DSS_ALLOW_INTERNAL_INCOMING_DIR || d_in_cosine <= 0);
+    HotAssert(dot(rec_wi, its_in.shFrame.n) >= 0);
+    HotAssert(MTS_DSS_ALLOW_INTERNAL_INCOMING_DIR
+            || dot(d_in, its_in.shFrame.n) <= 0);
 
     Spectrum thePdf = pdf_d_in_and_rec_wi * extraParamsPdf;
 
@@ -1196,7 +1950,7 @@ Spectrum DirectSamplingSubsurface::pdfDirect(const Scene *scene,
         const Spectrum &effectiveThroughput,
         const Vector &d_in, const Vector &rec_wi, const void *extraParams,
         EMeasure bsdfMeasure) const {
-    Assert(bsdfMeasure != EInvalidMeasure);
+    HotAssert(bsdfMeasure != EInvalidMeasure);
     Spectrum pdf_d_in_and_rec_wi = pdfDirectionsDirect(
             scene, its_out, d_out, its_in, d_in, rec_wi, bsdfMeasure);
     if (pdf_d_in_and_rec_wi.isZero())
@@ -1216,7 +1970,7 @@ Spectrum DirectSamplingSubsurface::sampleIndirect(
         const Vector &d_out,
         const Spectrum &effectiveThroughput,
         Vector &d_in, Vector &rec_wi, void *extraParams,
-        EMeasure &bsdfMeasure, Spectrum &bsdfVal) const {
+        EMeasure &bsdfMeasure, Spectrum &bsdfVal, int heroChannel) const {
 
     /* Sample extraParams based on its_in */
     Spectrum extraParamsPdf = sampleExtraParams(
@@ -1229,17 +1983,23 @@ Spectrum DirectSamplingSubsurface::sampleIndirect(
 
     /* Sample incoming directions d_in&rec_wi based on its_in and
      * extraParams */
+    Spectrum directionThroughput = effectiveThroughput * extraParamsPdf.zeroMask();
+    if (heroChannel != -1) {
+        Float value = directionThroughput[heroChannel];
+        if (value == 0)
+            return Spectrum(0.0f);
+        directionThroughput = Spectrum(0.0f);
+        directionThroughput[heroChannel] = value;
+    }
     bsdfVal = sampleDirectionsFromBssrdf(
             scene, its_out, d_out, its_in, d_in, rec_wi, bsdfMeasure,
-            pdf_d_in_and_rec_wi,
-            effectiveThroughput * extraParamsPdf.zeroMask(),
+            pdf_d_in_and_rec_wi, directionThroughput,
             extraParams, sampler);
     if (bsdfVal.isZero())
         return Spectrum(0.0f);
 
-    Vector n_in = its_in.shFrame.n;
-    Float d_in_cosine = dot(d_in, n_in);
-    Assert(MTS_DSS_ALLOW_INTERNAL_INCOMING_DIR || d_in_cosine <= 0);
+    HotAssert(MTS_DSS_ALLOW_INTERNAL_INCOMING_DIR
+            || dot(d_in, its_in.shFrame.n) <= 0);
 
     Spectrum thePdf = pdf_d_in_and_rec_wi * extraParamsPdf;
 
@@ -1263,9 +2023,9 @@ Spectrum DirectSamplingSubsurface::pdfIndirect(const Scene *scene,
         const Spectrum &effectiveThroughput,
         const Vector &d_in, const Vector &rec_wi, const void *extraParams,
         EMeasure bsdfMeasure) const {
-    Assert(bsdfMeasure != EInvalidMeasure);
-    Float d_in_cosine = dot(d_in, its_in.shFrame.n);
-    Assert(MTS_DSS_ALLOW_INTERNAL_INCOMING_DIR || d_in_cosine <= 0);
+    HotAssert(bsdfMeasure != EInvalidMeasure);
+    HotAssert(MTS_DSS_ALLOW_INTERNAL_INCOMING_DIR
+            || dot(d_in, its_in.shFrame.n) <= 0);
 
     Spectrum extraParamsPdf = pdfExtraParams(
             scene, its_out, d_out, its_in, NULL, effectiveThroughput,
@@ -1281,6 +2041,58 @@ Spectrum DirectSamplingSubsurface::pdfIndirect(const Scene *scene,
     return pdf_d_in_and_rec_wi * extraParamsPdf;
 }
 
+Float DirectSamplingSubsurface::pdfPointOnSurfaceHero(const Scene *scene,
+        const Intersection &its_in, const Intersection &its_out,
+        const Vector &d_out, const Spectrum &effectiveThroughput,
+        Spectrum &channelPdfs) const {
+    Float sum = 0;
+    int count = 0;
+    for (int k = 0; k < SPECTRUM_SAMPLES; k++) {
+        channelPdfs[k] = 0;
+        if (effectiveThroughput[k] == 0)
+            continue;
+        Spectrum single(0.0f);
+        single[k] = effectiveThroughput[k];
+        channelPdfs[k] = pdfPointOnSurface(its_out, d_out, scene, its_in,
+                single);
+        sum += channelPdfs[k];
+        count++;
+    }
+    return count > 0 ? sum / count : 0.0f;
+}
+
+Spectrum DirectSamplingSubsurface::pdfHero(const Scene *scene,
+        const Intersection &its_in, const Intersection &its_out,
+        const Vector &d_out,
+        const Spectrum &effectiveThroughput,
+        const Vector &d_in, const Vector &rec_wi, const void *extraParams,
+        EMeasure bsdfMeasure, const Spectrum &surfacePdfs) const {
+    /* The extra parameters are sampled for all channels independently,
+     * only the surface point and the directions depend on the hero */
+    Spectrum extraParamsPdf = pdfExtraParams(
+            scene, its_out, d_out, its_in, NULL, effectiveThroughput,
+            extraParams);
+    if (extraParamsPdf.isZero())
+        return Spectrum(0.0f);
+
+    Float sum = 0;
+    int count = 0;
+    for (int k = 0; k < SPECTRUM_SAMPLES; k++) {
+        if (effectiveThroughput[k] == 0)
+            continue;
+        count++;
+        /* The hero's direction sampling fails without its parameters */
+        if (surfacePdfs[k] == 0 || extraParamsPdf[k] == 0)
+            continue;
+        Spectrum single(0.0f);
+        single[k] = effectiveThroughput[k];
+        sum += surfacePdfs[k] * pdfDirectionsFromBssrdf(
+                scene, its_out, d_out, its_in, d_in, rec_wi, bsdfMeasure,
+                single, extraParams)[k];
+    }
+    return extraParamsPdf * (sum / count);
+}
+
 
 
 
@@ -1371,7 +2183,7 @@ void DirectSamplingSubsurface::checkSourcesOfVariance(
             integral.update(0);
             continue;
         }
-        Assert(bsdfMeasure == check_bsdfMeasure);
+        HotAssert(bsdfMeasure == check_bsdfMeasure);
 
         /* Evaluate BSSRDF */
         Spectrum bssrdfVal = bssrdf(scene, p_in, d_in, n_in, p_out,
@@ -1439,7 +2251,7 @@ void DirectSamplingSubsurface::checkSourcesOfVariance(
             intExtraParamsAndDir.update(0);
             continue;
         }
-        Assert(bsdfMeasure == check_bsdfMeasure);
+        HotAssert(bsdfMeasure == check_bsdfMeasure);
 
         /* Evaluate BSSRDF */
         Spectrum bssrdfVal = bssrdf(scene, p_in, d_in, n_in, p_out,
@@ -1503,7 +2315,7 @@ void DirectSamplingSubsurface::checkSourcesOfVariance(
             intDirection.update(0);
             continue;
         }
-        Assert(bsdfMeasure == check_bsdfMeasure);
+        HotAssert(bsdfMeasure == check_bsdfMeasure);
         intDirectionSampleOnlySuccess++;
 
         /* Evaluate BSSRDF */
@@ -1645,14 +2457,17 @@ Spectrum DirectSamplingSubsurface::Li_internal(const Scene *scene, Sampler *samp
     char extraParams[extraParamsSize()];
     Spectrum LiDirect;
     bool haveIndirect;
-    if (m_numSIRsurface > 1 || m_SIRnonSurfaceOversamplingFactor > 1) {
+    if (m_numSIRsurface > 1 || m_SIRnonSurfaceOversamplingFactor > 1
+            || m_SIRadaptiveThreshold > 0) {
         haveIndirect = indirectSample_SIR(scene, sampler, its_out, d_out,
                 channelWeight, channelWeightedThroughput, LiDirect,
                 indirectSample, extraParams);
     } else {
+        int heroChannel = m_heroChannel && !channelWeightedThroughput.isZero()
+            ? channelWeightedThroughput.sampleNonZeroChannelUniform(sampler) : -1;
         haveIndirect = indirectSample_noSIR(scene, sampler, its_out, d_out,
                 channelWeight, channelWeightedThroughput, LiDirect,
-                indirectSample, extraParams);
+                indirectSample, extraParams, heroChannel);
     }
     Spectrum result = LiDirect;
     if (!haveIndirect)
@@ -1742,7 +2557,7 @@ Spectrum DirectSamplingSubsurface::Li_internal(const Scene *scene, Sampler *samp
             RadianceQueryRecord::ERadianceQuery integratorQuery; // 'the rest'
             if (m_directSampling) {
                 Spectrum wgt = indirectSample.weightForDirectContrib;
-                Assert(m_directSamplingMIS || wgt.isZero()); // !MIS => wgt==0
+                HotAssert(m_directSamplingMIS || wgt.isZero()); // !MIS => wgt==0
                 if (!wgt.isZero()) {
                     rRec.recursiveQuery(rRecBase,
                             RadianceQueryRecord::EEmittedRadiance
@@ -1781,11 +2596,18 @@ Spectrum DirectSamplingSubsurface::Li_internal(const Scene *scene, Sampler *samp
             }
 #endif
 
-            // Get the actual indirect contribution from the integrator
-            rRec.recursiveQuery(rRecBase, integratorQuery, thisWeight);
-            Spectrum Li = integrator->Li(ray, rRec);
-            result += Li * thisWeight;
-            splits = rRec.splits;
+            if (m_radianceCache.get()) {
+                /* The cache was filled with the same type of query, so
+                 * it can stand in for the recursion */
+                result += thisWeight
+                        * m_radianceCache->lookup(p_in, n_in, rec_wi);
+            } else {
+                // Get the actual indirect contribution from the integrator
+                rRec.recursiveQuery(rRecBase, integratorQuery, thisWeight);
+                Spectrum Li = integrator->Li(ray, rRec);
+                result += Li * thisWeight;
+                splits = rRec.splits;
+            }
         }
     }
 
@@ -1812,13 +2634,23 @@ DSS_Li_radianceSourceSampling:
 #endif
 
     if (m_singleChannel)
-        Assert(result.numNonZeroChannels() <= 1);
+        HotAssert(result.numNonZeroChannels() <= 1);
 
     return result;
 }
 
 
 
+void DirectSamplingSubsurface::bssrdfBatch(const Scene *scene, size_t count,
+        const Point *p_in,  const Vector *d_in,  const Normal *n_in,
+        const Point &p_out, const Vector &d_out, const Normal &n_out,
+        const char *extraParams, Spectrum *result) const {
+    size_t parSize = extraParamsSize();
+    for (size_t i = 0; i < count; i++)
+        result[i] = bssrdf(scene, p_in[i], d_in[i], n_in[i],
+                p_out, d_out, n_out, extraParams + i*parSize);
+}
+
 /**
  * Sample Importance Resampling (SIR) of direct&indirect MIS weighted
  * sampling (with full expected value estimator for the direct
@@ -1839,17 +2671,42 @@ bool DirectSamplingSubsurface::indirectSample_SIR(
     if (!m_nonCollimatedLightSourcesPresent)
         return false;
 
-    std::vector<IndirectSamplingRecord> samples;
-    size_t totalSIRattempts = m_numSIRsurface * m_SIRnonSurfaceOversamplingFactor;
-    samples.reserve(totalSIRattempts);
+    size_t maxSIRsurface = m_SIRadaptiveThreshold > 0
+        ? m_SIRadaptiveMaxSurface : m_numSIRsurface;
     size_t parSize = extraParamsSize();
-    char *paramSamples = (parSize == 0 ? NULL : new char[totalSIRattempts * parSize]);
-    DiscreteDistribution sampleWeights;
-    sampleWeights.reserve(totalSIRattempts);
 
-    for (size_t i = 0; i < m_numSIRsurface; i++) {
-        IndirectSamplingRecord s;
-        void *extraPars = paramSamples + i*parSize;
+    /* Reuse the per-thread scratch buffers for the tentative samples */
+    SIRScratch *scratch = m_SIRscratch.get();
+    if (scratch == NULL) {
+        scratch = new SIRScratch(maxSIRsurface,
+            maxSIRsurface * m_SIRnonSurfaceOversamplingFactor, parSize);
+        m_SIRscratch.set(scratch);
+    }
+    std::vector<Intersection> &surfaceIts = scratch->surfaceIts;
+    std::vector<Float> &surfacePdfs = scratch->surfacePdfs;
+    SIRCandidates &cands = scratch->candidates;
+    std::vector<IndirectSamplingRecord> &samples = scratch->samples;
+    std::vector<size_t> &sampleSlots = scratch->sampleSlots;
+    DiscreteDistribution &sampleWeights = scratch->sampleWeights;
+    char *paramSamples = (parSize == 0 ? NULL : &scratch->paramSamples[0]);
+    surfaceIts.clear();
+    surfacePdfs.clear();
+    cands.clear();
+    samples.clear();
+    sampleSlots.clear();
+    sampleWeights.clear();
+
+    /* In adaptive mode, surface samples get added one at a time until the
+     * weights have a low enough relative variance (see below) */
+    size_t numSIRsurface = 0, targetSIRsurface = m_numSIRsurface;
+    size_t evaluated = 0;
+    Float weightSum = 0, weightSqrSum = 0;
+
+SIR_moreCandidates:
+    /* Generate all tentative samples first (and do the direct lighting
+     * estimate on the fly), so that the BSSRDF can then be evaluated for
+     * the whole batch of indirect candidates at once. */
+    for (size_t i = numSIRsurface; i < targetSIRsurface; i++) {
         Intersection its_in;
         Vector d_in, rec_wi;
         EMeasure bsdfMeasure;// = EInvalidMeasure;
@@ -1867,12 +2724,15 @@ bool DirectSamplingSubsurface::indirectSample_SIR(
         const Normal &n_in = its_in.shFrame.n;
         if (thisSurfacePdf == 0)
             continue;
+        uint32_t surfaceIdx = (uint32_t) surfaceIts.size();
+        surfaceIts.push_back(its_in);
+        surfacePdfs.push_back(thisSurfacePdf);
 
         /* Inner SIR loop over all non-surface sampling (because that is 
          * typically cheaper, so we can afford more SIR samples there */
         for (size_t j = 0; j < m_SIRnonSurfaceOversamplingFactor; j++) {
             do {
-                Assert(m_directSampling && m_directSamplingMIS);
+                HotAssert(m_directSampling && m_directSamplingMIS);
 
                 /* DIRECT SAMPLING */
 
@@ -1943,13 +2803,17 @@ bool DirectSamplingSubsurface::indirectSample_SIR(
                 }
 #endif
                 // expected value estimator for direct lighting
-                LiDirectContribution += directLi * directWeight / totalSIRattempts;
+                LiDirectContribution += directLi * directWeight;
             } while (false); // hack for break;
 
 
 
             /* INDIRECT SAMPLING to generate tentative SIR samples */
 
+            /* Extra parameters go in the slot of the next candidate (the
+             * slot simply gets reused if this attempt fails) */
+            void *extraPars = paramSamples + cands.size()*parSize;
+
             /* Sample directions and extra parameters */
             Spectrum bsdfVal;
             Spectrum indirectPdf = sampleIndirect(scene, sampler, its_in,
@@ -1963,80 +2827,222 @@ bool DirectSamplingSubsurface::indirectSample_SIR(
                     || dot(its_in.geoFrame.n, d_in)*dot(n_in, d_in) <= 0)
                 continue;
 
-            /* Evaluate BSSRDF */
-            Spectrum bssrdfVal = bssrdf(scene, p_in, d_in, n_in, p_out, d_out,
-                    n_out, extraPars);
-            if (bssrdfVal.isZero())
-                continue;
+            cands.push_back(surfaceIdx, its_in, d_in, rec_wi, bsdfMeasure,
+                    bsdfVal, indirectPdf);
+        }
+    }
+    numSIRsurface = targetSIRsurface;
+
+    /* Evaluate BSSRDF (for the candidates of this round) */
+    if (cands.size() > evaluated) {
+        cands.bssrdfVal.resize(cands.size());
+        bssrdfBatch(scene, cands.size() - evaluated, &cands.p_in[evaluated],
+                &cands.d_in[evaluated], &cands.n_in[evaluated], p_out, d_out,
+                n_out, paramSamples + evaluated*parSize,
+                &cands.bssrdfVal[evaluated]);
+    }
 
-            /* Weight factor (excluding the directions&extraParams pdf) */
-            Spectrum factor = channelWeight * bsdfVal * bssrdfVal
-                    / thisSurfacePdf;
-            if (factor.isZero())
-                continue;
+    for (size_t k = evaluated; k < cands.size(); k++) {
+        const Spectrum &bssrdfVal = cands.bssrdfVal[k];
+        if (bssrdfVal.isZero())
+            continue;
+        const Intersection &its_in = surfaceIts[cands.surface[k]];
+        const Normal &n_in = cands.n_in[k];
+        const Vector &d_in = cands.d_in[k];
+        const Vector &rec_wi = cands.rec_wi[k];
+        const Spectrum &indirectPdf = cands.indirectPdf[k];
+        const void *extraPars = paramSamples + k*parSize;
+
+        /* Weight factor (excluding the directions&extraParams pdf) */
+        Spectrum factor = channelWeight * cands.bsdfVal[k] * bssrdfVal
+                / surfacePdfs[cands.surface[k]];
+        if (factor.isZero())
+            continue;
 
-            /* pdf for the direct Li contribution of the 'indirectly sampled'
-             * part */
-            Spectrum pdfForDirectContrib;
-            if (dot(rec_wi, n_in) < 0) {
-                /* Internal reflection, guaranteed not to find direct
-                 * contribution (because we don't allow light sources within
-                 * our medium -- TODO: for now?), so no need to calculate
-                 * direct pdf as it will be zero. */
-                pdfForDirectContrib = indirectPdf;
-            } else {
-                Assert(m_directSamplingMIS);
-                /* Compute the MIS pdf for the direct Li contribution for this
-                 * indirect sampling in combination with direct sampling (2
-                 * sample MIS: 1 direct, 1 indirect -- the direct sample gets
-                 * taken below) */
-                Spectrum directPdf = pdfDirect(scene, its_in, its_out,
-                        d_out, channelWeightedThroughput, d_in, rec_wi,
-                        extraPars, bsdfMeasure); // note: this shoots a shadow ray!
-                pdfForDirectContrib = directPdf + indirectPdf;
-            }
-            // Store the tentative sample
-            s.its_in      = its_in;
-            s.d_in        = d_in;
-            s.rec_wi      = rec_wi;
-            s.bsdfMeasure = bsdfMeasure;
-            s.weightForDirectContrib   = factor * pdfForDirectContrib.invertButKeepZero();
-            s.weightForIndirectContrib = factor * indirectPdf.invertButKeepZero();
-
-            Float theSampleWeight = s.weightForIndirectContrib.maxAbsolute();
-            if (!std::isfinite(theSampleWeight) || theSampleWeight < 0) {
-                Log(EWarn, "Problematic sample weight: %e", theSampleWeight);
-            } else if (theSampleWeight > 0) {
-                /* Store the tentative sample */
-                sampleWeights.append(theSampleWeight);
-                samples.push_back(s);
-                Assert(math::abs(s.its_in.shFrame.n.length() - 1) < Epsilon);
-            }
+        /* pdf for the direct Li contribution of the 'indirectly sampled'
+         * part */
+        Spectrum pdfForDirectContrib;
+        if (dot(rec_wi, n_in) < 0) {
+            /* Internal reflection, guaranteed not to find direct
+             * contribution (because we don't allow light sources within
+             * our medium -- TODO: for now?), so no need to calculate
+             * direct pdf as it will be zero. */
+            pdfForDirectContrib = indirectPdf;
+        } else {
+            HotAssert(m_directSamplingMIS);
+            /* Compute the MIS pdf for the direct Li contribution for this
+             * indirect sampling in combination with direct sampling (2
+             * sample MIS: 1 direct, 1 indirect -- the direct sample gets
+             * taken below) */
+            Spectrum directPdf = pdfDirect(scene, its_in, its_out,
+                    d_out, channelWeightedThroughput, d_in, rec_wi,
+                    extraPars, cands.bsdfMeasure[k]); // note: this shoots a shadow ray!
+            pdfForDirectContrib = directPdf + indirectPdf;
+        }
+        IndirectSamplingRecord s;
+        s.its_in      = its_in;
+        s.d_in        = d_in;
+        s.rec_wi      = rec_wi;
+        s.bsdfMeasure = cands.bsdfMeasure[k];
+        s.weightForDirectContrib   = factor * pdfForDirectContrib.invertButKeepZero();
+        s.weightForIndirectContrib = factor * indirectPdf.invertButKeepZero();
+
+        Float theSampleWeight = s.weightForIndirectContrib.maxAbsolute();
+        if (!std::isfinite(theSampleWeight) || theSampleWeight < 0) {
+            Log(EWarn, "Problematic sample weight: %e", theSampleWeight);
+        } else if (theSampleWeight > 0) {
+            /* Store the tentative sample */
+            sampleWeights.append(theSampleWeight);
+            weightSum += theSampleWeight;
+            weightSqrSum += theSampleWeight * theSampleWeight;
+            samples.push_back(s);
+            sampleSlots.push_back(k);
+            HotAssert(math::abs(s.its_in.shFrame.n.length() - 1) < Epsilon);
+        }
+    }
+    evaluated = cands.size();
+
+    if (m_SIRadaptiveThreshold > 0 && numSIRsurface < maxSIRsurface) {
+        /* Relative variance of the mean SIR weight (failed attempts count
+         * as zero weights). Note that making the number of candidates
+         * depend on their weights introduces a slight bias. */
+        Float attempts = (Float) (numSIRsurface * m_SIRnonSurfaceOversamplingFactor);
+        Float mean = weightSum / attempts;
+        if (mean == 0 || (weightSqrSum / (attempts * mean * mean) - 1)
+                / attempts > m_SIRadaptiveThreshold) {
+            targetSIRsurface++;
+            goto SIR_moreCandidates;
         }
     }
 
-    Assert(sampleWeights.size() == samples.size());
-    Assert(samples.size() <= totalSIRattempts);
+    size_t totalSIRattempts = numSIRsurface * m_SIRnonSurfaceOversamplingFactor;
+    LiDirectContribution /= (Float) totalSIRattempts;
 
-    if (samples.size() == 0)
-        return false;
+    HotAssert(sampleWeights.size() == samples.size());
+    HotAssert(samples.size() <= totalSIRattempts);
 
-    sampleWeights.normalize();
-    if (sampleWeights.getSum() == 0)
-        return false;
+    if (samples.size() > 0)
+        sampleWeights.normalize();
+    if (samples.size() == 0 || sampleWeights.getSum() == 0)
+        return m_SIRreuse > 0 && reuseSIRReservoir(scene, sampler, scratch,
+                its_out, d_out, channelWeight, channelWeightedThroughput,
+                (Float) totalSIRattempts, false, 0.0f, Spectrum(0.0f),
+                Spectrum(0.0f), indirectSample, extraParams);
 
     Float sampleProb;
     size_t idx = sampleWeights.sample(sampler->next1D(), sampleProb);
-    Assert(idx >= 0 && idx < samples.size());
+    HotAssert(idx >= 0 && idx < samples.size());
 
     indirectSample = samples[idx];
     /* Update weights with the discrete SIR prob */
     indirectSample.weightForDirectContrib   /= (totalSIRattempts * sampleProb);
     indirectSample.weightForIndirectContrib /= (totalSIRattempts * sampleProb);
-    if (paramSamples) {
-        memcpy(extraParams, paramSamples + idx*parSize, parSize);
-        delete[] paramSamples;
+    if (paramSamples)
+        memcpy(extraParams, paramSamples + sampleSlots[idx]*parSize, parSize);
+
+    if (m_SIRreuse > 0) {
+        size_t k = sampleSlots[idx];
+        Spectrum sampleUCW = cands.indirectPdf[k].invertButKeepZero()
+            / (surfacePdfs[cands.surface[k]] * totalSIRattempts * sampleProb);
+        return reuseSIRReservoir(scene, sampler, scratch, its_out, d_out,
+                channelWeight, channelWeightedThroughput,
+                (Float) totalSIRattempts, true,
+                sampleWeights.getSum() / totalSIRattempts, sampleUCW,
+                cands.bsdfVal[k], indirectSample, extraParams);
+    }
+    return true;
+}
+
+/**
+ * Streaming variant of the spatial reservoir reuse of ReSTIR (Bitterli
+ * et al. 2020), in the generalized form that allows arbitrary resampling
+ * weights: both reservoirs carry a sample with an unbiased contribution
+ * weight, so the previous one remains a valid estimator at this shading
+ * point when its integrand is re-evaluated here. The reservoirs are
+ * weighted by their candidate counts, which leaves a bias only where the
+ * previous point could sample incoming points that we cannot. */
+bool DirectSamplingSubsurface::reuseSIRReservoir(
+        const Scene *scene, Sampler *sampler, SIRScratch *scratch,
+        const Intersection &its_out, const Vector &d_out,
+        const Spectrum &channelWeight,
+        const Spectrum &channelWeightedThroughput, Float count,
+        bool haveSample, Float sampleWeight, const Spectrum &sampleUCW,
+        const Spectrum &sampleBsdfVal,
+        IndirectSamplingRecord &indirectSample, void *extraParams) const {
+    const Point  &p_out = its_out.p;
+    const Normal &n_out = its_out.shFrame.n;
+    size_t parSize = extraParamsSize();
+    void *prevParams = (parSize == 0 ? NULL : &scratch->reservoirParams[0]);
+    const IndirectSamplingRecord &prev = scratch->reservoir;
+
+    /* Only consider the previous reservoir if it belongs to a nearby
+     * shading point with a similar orientation (its sample would rarely
+     * be of use otherwise) and re-evaluate its integrand here */
+    Float prevCount = 0, prevWeight = 0;
+    Spectrum prevValue(0.0f);
+    if (scratch->reservoirValid && dot(scratch->reservoirN_out, n_out) > 0.9f
+            && distanceSquared(scratch->reservoirP_out, p_out)
+                <= distanceSquared(scratch->reservoirP_out, prev.its_in.p)) {
+        Spectrum bssrdfVal = bssrdf(scene, prev.its_in.p, prev.d_in,
+                prev.its_in.shFrame.n, p_out, d_out, n_out, prevParams);
+        prevValue = channelWeight * scratch->reservoirBsdfVal * bssrdfVal;
+        prevWeight = (prevValue * scratch->reservoirUCW).maxAbsolute();
+        if (std::isfinite(prevWeight) && prevWeight > 0)
+            prevCount = std::min(scratch->reservoirCount, m_SIRreuse * count);
+        else
+            prevWeight = 0;
+    }
+
+    Float curPart = haveSample ? count * sampleWeight : 0,
+          prevPart = prevCount * prevWeight;
+    if (curPart + prevPart == 0) {
+        scratch->reservoirValid = false;
+        return false;
     }
+    Float totalCount = count + prevCount;
+    Float combinedWeight = (curPart + prevPart) / totalCount;
+
+    if (sampler->next1D() * (curPart + prevPart) >= prevPart) {
+        /* Keep the fresh sample */
+        Float scale = combinedWeight / sampleWeight;
+        indirectSample.weightForDirectContrib   *= scale;
+        indirectSample.weightForIndirectContrib *= scale;
+        scratch->reservoir = indirectSample;
+        scratch->reservoirBsdfVal = sampleBsdfVal;
+        scratch->reservoirUCW = sampleUCW * scale;
+        if (parSize > 0)
+            memcpy(prevParams, extraParams, parSize);
+    } else {
+        /* Take over the previous sample */
+        scratch->reservoirUCW *= combinedWeight / prevWeight;
+        indirectSample.its_in      = prev.its_in;
+        indirectSample.d_in        = prev.d_in;
+        indirectSample.rec_wi      = prev.rec_wi;
+        indirectSample.bsdfMeasure = prev.bsdfMeasure;
+        if (parSize > 0)
+            memcpy(extraParams, prevParams, parSize);
+
+        Spectrum weight = prevValue * scratch->reservoirUCW;
+        indirectSample.weightForIndirectContrib = weight;
+        if (dot(prev.rec_wi, prev.its_in.shFrame.n) < 0) {
+            /* Internal reflection, no direct contribution (see above) */
+            indirectSample.weightForDirectContrib = weight;
+        } else {
+            /* MIS weight w.r.t. the direct sampling at this shading point */
+            Spectrum indirectPdf = pdfIndirect(scene, prev.its_in, its_out,
+                    d_out, channelWeightedThroughput, prev.d_in, prev.rec_wi,
+                    extraParams, prev.bsdfMeasure);
+            Spectrum directPdf = pdfDirect(scene, prev.its_in, its_out,
+                    d_out, channelWeightedThroughput, prev.d_in, prev.rec_wi,
+                    extraParams, prev.bsdfMeasure);
+            indirectSample.weightForDirectContrib = weight * indirectPdf
+                    * (directPdf + indirectPdf).invertButKeepZero();
+        }
+    }
+    scratch->reservoirCount = totalCount;
+    scratch->reservoirP_out = p_out;
+    scratch->reservoirN_out = n_out;
+    scratch->reservoirValid = true;
     return true;
 }
 
@@ -2056,22 +3062,40 @@ bool DirectSamplingSubsurface::indirectSample_noSIR(
         const Spectrum &channelWeight,
         const Spectrum &channelWeightedThroughput,
         Spectrum &LiDirectContribution,
-        IndirectSamplingRecord &indirectSample, void * extraParams) const {
+        IndirectSamplingRecord &indirectSample, void * extraParams,
+        int heroChannel) const {
     const Point  p_out = its_out.p;
     const Normal n_out = its_out.shFrame.n;
     LiDirectContribution = Spectrum(0.0f);
     Vector d_in, rec_wi;
     EMeasure bsdfMeasure;
 
-    /* Sample BSSRDF marginalized over incoming direction and extraParams */
+    /* Sample BSSRDF marginalized over incoming direction and extraParams
+     * (in hero channel mode: with the strategy of the hero channel) */
     Intersection its_in;
+    Spectrum surfaceThroughput = channelWeightedThroughput;
+    if (heroChannel != -1) {
+        surfaceThroughput = Spectrum(0.0f);
+        surfaceThroughput[heroChannel] = channelWeightedThroughput[heroChannel];
+    }
     Float surfacePdf = samplePointOnSurface(
-            its_out, d_out, scene, its_in, channelWeightedThroughput, sampler);
+            its_out, d_out, scene, its_in, surfaceThroughput, sampler);
     const Point  &p_in = its_in.p;
     const Normal &n_in = its_in.shFrame.n;
     if (surfacePdf == 0)
         return false;
 
+    /* In hero channel mode, any channel could have been the hero. The
+     * indirect pdfs below are then divided by this MIS surface pdf, so
+     * that all weights keep their usual form. */
+    Spectrum heroSurfacePdfs;
+    if (heroChannel != -1) {
+        surfacePdf = pdfPointOnSurfaceHero(scene, its_in, its_out, d_out,
+                channelWeightedThroughput, heroSurfacePdfs);
+        if (surfacePdf == 0)
+            return false;
+    }
+
     /* DIRECT SAMPLING */
     if (m_directSampling) { do {
         Spectrum LiDirect, bsdfVal;
@@ -2098,7 +3122,11 @@ bool DirectSamplingSubsurface::indirectSample_noSIR(
          * extraParams */
         Spectrum effectivePdf;
         if (m_directSamplingMIS && lightSamplingMeasure != EDiscrete) {
-            Spectrum indirectPdf = pdfIndirect(scene, its_in,
+            Spectrum indirectPdf = heroChannel != -1
+                ? pdfHero(scene, its_in, its_out, d_out,
+                    channelWeightedThroughput, d_in, rec_wi, extraParams,
+                    bsdfMeasure, heroSurfacePdfs) / surfacePdf
+                : pdfIndirect(scene, its_in,
                     its_out, d_out, channelWeightedThroughput, d_in, rec_wi,
                     extraParams, bsdfMeasure);
 
@@ -2135,9 +3163,13 @@ bool DirectSamplingSubsurface::indirectSample_noSIR(
     Spectrum bsdfVal;
     Spectrum indirectPdf = sampleIndirect(scene, sampler, its_in,
             its_out, d_out, channelWeightedThroughput, d_in, rec_wi,
-            extraParams, bsdfMeasure, bsdfVal);
+            extraParams, bsdfMeasure, bsdfVal, heroChannel);
     if (indirectPdf.isZero())
         return false;
+    if (heroChannel != -1)
+        indirectPdf = pdfHero(scene, its_in, its_out, d_out,
+                channelWeightedThroughput, d_in, rec_wi, extraParams,
+                bsdfMeasure, heroSurfacePdfs) / surfacePdf;
 
     /* Prevent light leaks due to the use of shading normals */
     if (dot(its_in.geoFrame.n, rec_wi)*dot(n_in, rec_wi) <= 0
@@ -2284,17 +3316,22 @@ void DSSProjFrame::getProjFrame(Vector &u, Vector &v, Vector &projDir,
         default:
             SLog(EError, "Unknown DSSTangentFrameType: %d", m_projType);
     }
-    SAssert(fabs(dot(u, v)) < ShadowEpsilon);
-    SAssert(fabs(dot(projDir, u)) < ShadowEpsilon);
-    SAssert(fabs(dot(projDir, v)) < ShadowEpsilon);
-    SAssert(fabs(u.length() - 1) < ShadowEpsilon);
-    SAssert(fabs(v.length() - 1) < ShadowEpsilon);
-    SAssert(fabs(projDir.length() - 1) < ShadowEpsilon);
+    SHotAssert(fabs(dot(u, v)) < ShadowEpsilon);
+    SHotAssert(fabs(dot(projDir, u)) < ShadowEpsilon);
+    SHotAssert(fabs(dot(projDir, v)) < ShadowEpsilon);
+    SHotAssert(fabs(u.length() - 1) < ShadowEpsilon);
+    SHotAssert(fabs(v.length() - 1) < ShadowEpsilon);
+    SHotAssert(fabs(projDir.length() - 1) < ShadowEpsilon);
 }
 
 
 
 MTS_IMPLEMENT_CLASS_IS(RadianceSources, false, SerializableObject)
+MTS_IMPLEMENT_CLASS_S(DSSRadianceCache, false, SerializableObject)
+MTS_IMPLEMENT_CLASS(DSSCachePoints, false, WorkUnit)
+MTS_IMPLEMENT_CLASS(DSSRadianceCacheResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(DSSRadianceCacheWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(DSSRadianceCacheProcess, false, ParallelProcess)
 MTS_IMPLEMENT_CLASS(DirectSamplingSubsurface, true, Subsurface)
 
 MTS_IMPLEMENT_CLASS(Sampler1D, true, Object)
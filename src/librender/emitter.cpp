@@ -134,6 +134,12 @@ bool Emitter::fillDirectSamplingRecord(DirectSamplingRecord &dRec,
     NotImplementedError("fillDirectSamplingRecord");
 }
 
+void Emitter::getEmissionBounds(Vector &axis, Float &thetaO, Float &thetaE) const {
+    axis = Vector(0.0f, 0.0f, 1.0f);
+    thetaO = (Float) M_PI;
+    thetaE = (Float) (0.5f * M_PI);
+}
+
 Emitter::~Emitter() { }
 
 Emitter *Emitter::getElement(size_t index) {
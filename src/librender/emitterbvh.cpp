@@ -0,0 +1,422 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/emitterbvh.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+/* Build parameters: number of bins of the surface area orientation
+   heuristic per axis, and the smallest power that is assigned to an
+   emitter relative to the average (so that emitters whose power was
+   estimated poorly are still sampled) */
+static const int emitterBinCount = 12;
+static const Float emitterMinRelativePower = 1e-3f;
+
+struct EmitterBVH::BuildEmitter {
+    AABB aabb;
+    Point centroid;
+    EmissionCone cone;
+    Float power;
+    uint32_t index;
+};
+
+void EmitterBVH::EmissionCone::expandBy(const EmissionCone &cone) {
+    const EmissionCone *a = this, *b = &cone;
+    if (a->thetaO < b->thetaO)
+        std::swap(a, b);
+
+    Float thetaD = math::safe_acos(dot(a->axis, b->axis)),
+          newThetaE = std::max(a->thetaE, b->thetaE);
+
+    if (std::min(thetaD + b->thetaO, (Float) M_PI) <= a->thetaO) {
+        /* The larger cone already contains the smaller one */
+        axis = a->axis;
+        thetaO = a->thetaO;
+        thetaE = newThetaE;
+        return;
+    }
+
+    Float newThetaO = (a->thetaO + thetaD + b->thetaO) * 0.5f;
+    if (newThetaO >= M_PI) {
+        axis = a->axis;
+        thetaO = (Float) M_PI;
+        thetaE = newThetaE;
+        return;
+    }
+
+    /* Rotate the axis of the larger cone towards the smaller one */
+    Vector rotAxis = cross(a->axis, b->axis);
+    if (rotAxis.lengthSquared() == 0) {
+        Vector unused;
+        coordinateSystem(a->axis, rotAxis, unused);
+    } else {
+        rotAxis = normalize(rotAxis);
+    }
+    Float sinRot, cosRot;
+    math::sincos(newThetaO - a->thetaO, &sinRot, &cosRot);
+    axis = normalize(a->axis * cosRot + cross(rotAxis, a->axis) * sinRot);
+    thetaO = newThetaO;
+    thetaE = newThetaE;
+}
+
+Float EmitterBVH::EmissionCone::getMeasure() const {
+    Float thetaW = std::min(thetaO + thetaE, (Float) M_PI),
+          sinThetaO = std::sin(thetaO), cosThetaO = std::cos(thetaO);
+
+    return 2 * M_PI * (1 - cosThetaO) + 0.5f * M_PI * (2 * thetaW * sinThetaO
+        - std::cos(thetaO - 2 * thetaW) - 2 * thetaO * sinThetaO + cosThetaO);
+}
+
+EmitterBVH::EmitterBVH() : m_boundedProb(1.0f), m_built(false) { }
+
+EmitterBVH::~EmitterBVH() { }
+
+/// Estimate the emitted power by averaging the weights of a few emitted rays
+static Float estimatePower(const Emitter *emitter) {
+    const int res = 4;
+    Float sum = 0;
+    try {
+        for (int i=0; i<res; ++i) {
+            for (int j=0; j<res; ++j) {
+                Ray ray;
+                Point2 spatialSample((i + 0.5f) / res, (j + 0.5f) / res),
+                       directionalSample((j + 0.5f) / res, (i + 0.5f) / res);
+                sum += emitter->sampleRay(ray, spatialSample,
+                    directionalSample, 0.0f).getLuminance();
+            }
+        }
+    } catch (const std::exception &) {
+        return -1;
+    }
+    sum /= res * res;
+    return std::isfinite(sum) ? sum : (Float) -1;
+}
+
+void EmitterBVH::build(const ref_vector<Emitter> &emitters) {
+    ref<Timer> timer = new Timer();
+    std::vector<BuildEmitter> bounded;
+    Float boundedWeight = 0, unboundedWeight = 0, powerSum = 0;
+    size_t powerCount = 0;
+
+    m_nodes.clear();
+    m_emitters.clear();
+    m_leaves.clear();
+    m_unbounded.clear();
+    m_unboundedIndices.clear();
+    m_unboundedPDF.clear();
+
+    for (size_t i=0; i<emitters.size(); ++i) {
+        const Emitter *emitter = emitters[i].get();
+        Float weight = emitter->getSamplingWeight();
+        if (weight <= 0)
+            continue;
+
+        if (emitter->isEnvironmentEmitter() ||
+            (emitter->getType() & Emitter::EDeltaDirection) ||
+            !emitter->getAABB().isValid()) {
+            m_unboundedIndices[emitter] = (uint32_t) m_unbounded.size();
+            m_unbounded.push_back(emitter);
+            m_unboundedPDF.append(weight);
+            unboundedWeight += weight;
+            continue;
+        }
+
+        BuildEmitter be;
+        be.aabb = emitter->getAABB();
+        be.centroid = be.aabb.getCenter();
+        emitter->getEmissionBounds(be.cone.axis, be.cone.thetaO, be.cone.thetaE);
+        be.power = estimatePower(emitter);
+        if (be.power > 0) {
+            be.power *= weight;
+            powerSum += be.power;
+            powerCount++;
+        }
+        be.index = (uint32_t) m_emitters.size();
+        m_emitters.push_back(emitter);
+        bounded.push_back(be);
+        boundedWeight += weight;
+    }
+
+    if (boundedWeight + unboundedWeight == 0)
+        Log(EError, "Cannot build an emitter hierarchy: all emitters "
+            "have a sampling weight of zero!");
+
+    Float meanPower = powerCount > 0 ? powerSum / powerCount : (Float) 1;
+    for (size_t i=0; i<bounded.size(); ++i) {
+        if (bounded[i].power < 0)
+            bounded[i].power = meanPower;
+        else
+            bounded[i].power = std::max(bounded[i].power,
+                    meanPower * emitterMinRelativePower);
+    }
+
+    if (!m_unbounded.empty())
+        m_unboundedPDF.normalize();
+    m_boundedProb = boundedWeight / (boundedWeight + unboundedWeight);
+
+    if (!bounded.empty()) {
+        m_nodes.reserve(2 * bounded.size() - 1);
+        buildRecursive(bounded, 0, bounded.size(), (uint32_t) -1);
+        for (size_t i=0; i<m_nodes.size(); ++i) {
+            if (m_nodes[i].leaf)
+                m_leaves[m_emitters[m_nodes[i].offset]] = (uint32_t) i;
+        }
+    }
+    m_built = true;
+
+    Log(EInfo, "Built an emitter hierarchy over " SIZE_T_FMT " emitters ("
+        SIZE_T_FMT " nodes, " SIZE_T_FMT " unbounded emitters, took %i ms)",
+        m_emitters.size(), m_nodes.size(), m_unbounded.size(),
+        timer->getMilliseconds());
+}
+
+uint32_t EmitterBVH::buildRecursive(std::vector<BuildEmitter> &emitters,
+        size_t begin, size_t end, uint32_t parent) {
+    uint32_t nodeIndex = (uint32_t) m_nodes.size();
+    m_nodes.push_back(Node());
+
+    Node node;
+    node.aabb = emitters[begin].aabb;
+    node.cone = emitters[begin].cone;
+    node.power = emitters[begin].power;
+    node.parent = parent;
+    AABB centroidBounds(emitters[begin].centroid);
+    for (size_t i=begin+1; i<end; ++i) {
+        node.aabb.expandBy(emitters[i].aabb);
+        node.cone.expandBy(emitters[i].cone);
+        node.power += emitters[i].power;
+        centroidBounds.expandBy(emitters[i].centroid);
+    }
+
+    if (end - begin == 1) {
+        node.leaf = true;
+        node.offset = emitters[begin].index;
+        m_nodes[nodeIndex] = node;
+        return nodeIndex;
+    }
+
+    /* Find the best split using the surface area orientation heuristic */
+    Vector extents = node.aabb.getExtents();
+    Float maxExtent = std::max(std::max(extents.x, extents.y), extents.z);
+    Float bestCost = std::numeric_limits<Float>::infinity();
+    int bestAxis = -1, bestBin = -1;
+
+    for (int axis=0; axis<3; ++axis) {
+        Float cMin = centroidBounds.min[axis], cMax = centroidBounds.max[axis];
+        if (cMax <= cMin)
+            continue;
+
+        Float scale = emitterBinCount / (cMax - cMin);
+        AABB binAABB[emitterBinCount];
+        EmissionCone binCone[emitterBinCount];
+        Float binPower[emitterBinCount];
+        size_t binCount[emitterBinCount];
+        for (int b=0; b<emitterBinCount; ++b) {
+            binPower[b] = 0;
+            binCount[b] = 0;
+        }
+
+        for (size_t i=begin; i<end; ++i) {
+            const BuildEmitter &be = emitters[i];
+            int b = std::min((int) ((be.centroid[axis] - cMin) * scale), emitterBinCount - 1);
+            if (binCount[b]++ == 0) {
+                binAABB[b] = be.aabb;
+                binCone[b] = be.cone;
+            } else {
+                binAABB[b].expandBy(be.aabb);
+                binCone[b].expandBy(be.cone);
+            }
+            binPower[b] += be.power;
+        }
+
+        Float kr = maxExtent / std::max(extents[axis], Epsilon);
+        for (int split=0; split<emitterBinCount-1; ++split) {
+            AABB aabb[2];
+            EmissionCone cone[2];
+            Float power[2] = { 0, 0 };
+            size_t count[2] = { 0, 0 };
+            for (int b=0; b<emitterBinCount; ++b) {
+                int side = b <= split ? 0 : 1;
+                if (binCount[b] == 0)
+                    continue;
+                if (count[side] == 0) {
+                    aabb[side] = binAABB[b];
+                    cone[side] = binCone[b];
+                } else {
+                    aabb[side].expandBy(binAABB[b]);
+                    cone[side].expandBy(binCone[b]);
+                }
+                power[side] += binPower[b];
+                count[side] += binCount[b];
+            }
+            if (count[0] == 0 || count[1] == 0)
+                continue;
+
+            Float cost = kr * (
+                power[0] * cone[0].getMeasure() * aabb[0].getSurfaceArea() +
+                power[1] * cone[1].getMeasure() * aabb[1].getSurfaceArea());
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = split;
+            }
+        }
+    }
+
+    size_t mid = begin;
+    if (bestAxis != -1) {
+        Float cMin = centroidBounds.min[bestAxis],
+              scale = emitterBinCount / (centroidBounds.max[bestAxis] - cMin);
+        for (size_t i=begin; i<end; ++i) {
+            int b = std::min((int) ((emitters[i].centroid[bestAxis] - cMin) * scale),
+                emitterBinCount - 1);
+            if (b <= bestBin)
+                std::swap(emitters[i], emitters[mid++]);
+        }
+    }
+
+    if (mid == begin || mid == end) {
+        /* Coincident centroids -- split the range in half */
+        mid = (begin + end) / 2;
+    }
+
+    buildRecursive(emitters, begin, mid, nodeIndex);
+    node.leaf = false;
+    node.offset = buildRecursive(emitters, mid, end, nodeIndex);
+    m_nodes[nodeIndex] = node;
+    return nodeIndex;
+}
+
+Float EmitterBVH::importance(const Node &node, const Point &ref,
+        const Normal &refN) const {
+    Vector d = node.aabb.getCenter() - ref;
+    Float dist2 = d.lengthSquared(),
+          radius2 = 0.25f * node.aabb.getExtents().lengthSquared();
+
+    if (dist2 <= radius2) {
+        /* The reference point lies within the bounding sphere */
+        return radius2 > 0 ? node.power / radius2 : node.power;
+    }
+
+    Float dist = std::sqrt(dist2);
+    Vector w = d / dist;
+    Float thetaU = std::asin(std::min((Float) 1, std::sqrt(radius2 / dist2)));
+
+    /* Angle between the emission cone and the direction towards the
+       reference point, reduced by the angular extent of the node */
+    Float theta = math::safe_acos(-dot(node.cone.axis, w));
+    Float thetaP = std::max((Float) 0, theta - node.cone.thetaO - thetaU);
+    if (thetaP > node.cone.thetaE)
+        return 0.0f;
+    Float result = node.power * std::cos(thetaP) / dist2;
+
+    if (!refN.isZero()) {
+        Float thetaI = math::safe_acos(dot(refN, w));
+        Float thetaIP = std::max((Float) 0, thetaI - thetaU);
+        if (thetaIP >= 0.5f * M_PI)
+            return 0.0f;
+        result *= std::cos(thetaIP);
+    }
+
+    return result;
+}
+
+const Emitter *EmitterBVH::sampleReuse(const Point &ref, const Normal &refN,
+        Float &sample, Float &pdf) const {
+    pdf = 1.0f;
+    if (sample >= m_boundedProb) {
+        sample = std::min((sample - m_boundedProb) / (1 - m_boundedProb), ONE_MINUS_EPS);
+        Float unboundedPdf;
+        size_t index = m_unboundedPDF.sampleReuse(sample, unboundedPdf);
+        pdf = (1 - m_boundedProb) * unboundedPdf;
+        return m_unbounded[index];
+    } else if (m_boundedProb < 1) {
+        sample /= m_boundedProb;
+        pdf = m_boundedProb;
+    }
+
+    uint32_t index = 0;
+    while (!m_nodes[index].leaf) {
+        uint32_t left = index + 1, right = m_nodes[index].offset;
+        Float importanceLeft = importance(m_nodes[left], ref, refN),
+              importanceRight = importance(m_nodes[right], ref, refN),
+              sum = importanceLeft + importanceRight;
+
+        if (!(sum > 0) || !std::isfinite(sum)) {
+            pdf = 0.0f;
+            return NULL;
+        }
+
+        Float probLeft = importanceLeft / sum;
+        if (sample < probLeft) {
+            sample = sample / probLeft;
+            pdf *= probLeft;
+            index = left;
+        } else {
+            sample = std::min((sample - probLeft) / (1 - probLeft), ONE_MINUS_EPS);
+            pdf *= importanceRight / sum;
+            index = right;
+        }
+    }
+
+    return m_emitters[m_nodes[index].offset];
+}
+
+Float EmitterBVH::pdf(const Point &ref, const Normal &refN,
+        const Emitter *emitter) const {
+    std::map<const Emitter *, uint32_t>::const_iterator it = m_leaves.find(emitter);
+    if (it == m_leaves.end()) {
+        it = m_unboundedIndices.find(emitter);
+        if (it == m_unboundedIndices.end())
+            return 0.0f;
+        return (1 - m_boundedProb) * m_unboundedPDF[it->second];
+    }
+
+    Float result = m_boundedProb;
+    uint32_t index = it->second;
+    while (m_nodes[index].parent != (uint32_t) -1) {
+        uint32_t parent = m_nodes[index].parent,
+                 left = parent + 1, right = m_nodes[parent].offset;
+        Float importanceLeft = importance(m_nodes[left], ref, refN),
+              importanceRight = importance(m_nodes[right], ref, refN),
+              sum = importanceLeft + importanceRight;
+
+        if (!(sum > 0) || !std::isfinite(sum))
+            return 0.0f;
+
+        result *= (index == left ? importanceLeft : importanceRight) / sum;
+        index = parent;
+    }
+
+    return result;
+}
+
+std::string EmitterBVH::toString() const {
+    std::ostringstream oss;
+    oss << "EmitterBVH[" << endl
+        << "  emitterCount = " << m_emitters.size() << "," << endl
+        << "  unboundedCount = " << m_unbounded.size() << "," << endl
+        << "  nodeCount = " << m_nodes.size() << "," << endl
+        << "  boundedProb = " << m_boundedProb << endl
+        << "]";
+    return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(EmitterBVH, false, Object)
+MTS_NAMESPACE_END
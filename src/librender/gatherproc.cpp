@@ -66,16 +66,16 @@ public:
         stream->readUIntArray(&m_particleIndices[0], count);
         count = (size_t) stream->readUInt();
         m_photons.resize(count);
-        for (size_t i=0; i<count; ++i)
-            m_photons[i] = Photon(stream);
+        if (count > 0)
+            Photon::unserialize(stream, &m_photons[0], count);
     }
 
     void save(Stream *stream) const {
         stream->writeUInt((uint32_t) m_particleIndices.size());
         stream->writeUIntArray(&m_particleIndices[0], m_particleIndices.size());
         stream->writeUInt((uint32_t) m_photons.size());
-        for (size_t i=0; i<m_photons.size(); ++i)
-            m_photons[i].serialize(stream);
+        if (!m_photons.empty())
+            Photon::serialize(stream, &m_photons[0], m_photons.size());
     }
 
     std::string toString() const {
@@ -192,21 +192,18 @@ void GatherPhotonProcess::processResult(const WorkResult *wr, bool cancelled) {
     const PhotonVector &vec = *static_cast<const PhotonVector *>(wr);
     LockGuard lock(m_resultMutex);
 
-    size_t nParticles = 0;
-    for (size_t i=0; i<vec.getParticleCount(); ++i) {
-        size_t start = vec.getParticleIndex(i),
-               end   = vec.getParticleIndex(i+1);
-        ++nParticles;
-        bool full = false;
-        for (size_t j=start; j<end; ++j) {
-            if (!m_photonMap->tryAppend(vec[j])) {
-                m_excess += vec.size() - j;
-                full = true;
-                break;
-            }
-        }
-        if (full)
-            break;
+    /* Hand the worker's photon buffer to the photon map in one piece */
+    size_t appended = vec.size() > 0 ? m_photonMap->tryAppend(&vec[0], vec.size()) : 0;
+    size_t nParticles = vec.getParticleCount();
+
+    if (appended < vec.size()) {
+        /* The photon map is full: only count the particles that were
+           (partially) stored, exactly as a per-photon append would */
+        m_excess += vec.size() - appended;
+        nParticles = 0;
+        while (nParticles < vec.getParticleCount()
+                && vec.getParticleIndex(nParticles) <= appended)
+            ++nParticles;
     }
     m_numShot += nParticles;
     increaseResultCount(vec.size());
@@ -22,7 +22,8 @@ MTS_NAMESPACE_BEGIN
 
 ImageBlock::ImageBlock(Bitmap::EPixelFormat fmt, const Vector2i &size,
         const ReconstructionFilter *filter, int channels, bool warn) : m_offset(0),
-        m_size(size), m_filter(filter), m_weightsX(NULL), m_weightsY(NULL), m_warn(warn) {
+        m_size(size), m_filter(filter), m_weightsX(NULL), m_weightsY(NULL), m_boxWeight(0.0f), m_warn(warn),
+        m_native(true), m_compensationStride(0) {
     m_borderSize = filter ? filter->getBorderSize() : 0;
 
     /* Allocate a small bitmap data structure for the block */
@@ -34,6 +35,15 @@ ImageBlock::ImageBlock(Bitmap::EPixelFormat fmt, const Vector2i &size,
         int tempBufferSize = (int) std::ceil(2*filter->getRadius()) + 1;
         m_weightsX = new Float[2*tempBufferSize];
         m_weightsY = m_weightsX + tempBufferSize;
+
+        /* Detect box filters that cover at most two pixels per axis, and
+           whose discretization is constant over the entire support */
+        Float radius = filter->getRadius(), value = filter->evalDiscretized(0);
+        bool box = radius < 1;
+        for (int i=1; i<MTS_FILTER_RESOLUTION && box; ++i)
+            box = filter->evalDiscretized((radius * i) / MTS_FILTER_RESOLUTION) == value;
+        if (box)
+            m_boxWeight = value * value;
     }
 }
 
@@ -42,34 +52,294 @@ ImageBlock::~ImageBlock() {
         delete[] m_weightsX;
 }
 
+void ImageBlock::setStorage(Bitmap::EComponentFormat format,
+        const std::vector<bool> &compensated) {
+    const int channels = m_bitmap->getChannelCount();
+    if (format != Bitmap::EFloat16 && format != Bitmap::EFloat32 && format != Bitmap::EFloat)
+        Log(EError, "setStorage(): unsupported component format!");
+    if (!compensated.empty() && compensated.size() != (size_t) channels)
+        Log(EError, "setStorage(): expected one compensation flag per channel!");
+
+    if (format != m_bitmap->getComponentFormat())
+        m_bitmap = new Bitmap(m_bitmap->getPixelFormat(), format,
+            m_bitmap->getSize(), channels);
+    m_native = format == Bitmap::EFloat;
+
+    /* Float precision blocks don't need compensation */
+    m_compensated.assign(channels, false);
+    m_compensationIndex.assign(channels, -1);
+    m_compensationStride = 0;
+    if (!m_native && !compensated.empty()) {
+        m_compensated = compensated;
+        for (int i=0; i<channels; ++i) {
+            if (compensated[i])
+                m_compensationIndex[i] = m_compensationStride++;
+        }
+    }
+    std::vector<float>((size_t) m_bitmap->getWidth() * (size_t) m_bitmap->getHeight()
+        * m_compensationStride).swap(m_compensation);
+    clear();
+}
+
+namespace {
+    /// Kahan-compensated accumulation into a reduced precision pixel
+    template <typename T> FINLINE void accumulatePixel(T *dest, float *comp,
+            const int *compIndex, int channels, Float weight, const Float *value) {
+        for (int k=0; k<channels; ++k) {
+            Float sum = (Float) (float) dest[k], y = weight * value[k];
+            int idx = compIndex[k];
+            if (idx < 0) {
+                dest[k] = (T) (float) (sum + y);
+                continue;
+            }
+            y -= (Float) comp[idx];
+            dest[k] = (T) (float) (sum + y);
+            /* Track the part of 'y' that was lost to rounding */
+            comp[idx] = (float) (((Float) (float) dest[k] - sum) - y);
+        }
+    }
+}
+
+void ImageBlock::putCompact(size_t pixel, Float weight, const Float *value) {
+    const int channels = m_bitmap->getChannelCount();
+    float *comp = m_compensationStride > 0 ?
+        &m_compensation[pixel * m_compensationStride] : NULL;
+
+    if (m_bitmap->getComponentFormat() == Bitmap::EFloat16)
+        accumulatePixel(m_bitmap->getFloat16Data() + pixel * channels, comp,
+            &m_compensationIndex[0], channels, weight, value);
+    else
+        accumulatePixel(m_bitmap->getFloat32Data() + pixel * channels, comp,
+            &m_compensationIndex[0], channels, weight, value);
+}
+
+void ImageBlock::putCompact(const ImageBlock *block) {
+    const Bitmap *source = block->getBitmap();
+    const int channels = m_bitmap->getChannelCount();
+    if (source->getComponentFormat() != Bitmap::EFloat ||
+        source->getChannelCount() != channels)
+        Log(EError, "put(): incompatible image block!");
+
+    Vector2i sourceOffset, targetOffset, size;
+    if (!clip(block, sourceOffset, targetOffset, size))
+        return;
+
+    for (int y=0; y<size.y; ++y) {
+        const Float *src = source->getFloatData() + ((sourceOffset.y + y)
+            * (size_t) source->getWidth() + sourceOffset.x) * channels;
+        size_t pixel = (targetOffset.y + y) * (size_t) m_bitmap->getWidth() + targetOffset.x;
+        for (int x=0; x<size.x; ++x, ++pixel, src += channels) {
+            /* Skip empty pixels, e.g. outside of a split block */
+            bool empty = true;
+            for (int k=0; k<channels && empty; ++k)
+                empty = src[k] == 0;
+            if (!empty)
+                putCompact(pixel, 1.0f, src);
+        }
+    }
+}
+
+bool ImageBlock::clip(const ImageBlock *block, Vector2i &sourceOffset,
+        Vector2i &targetOffset, Vector2i &size) const {
+    sourceOffset = Vector2i(0);
+    targetOffset = block->getOffset() - m_offset
+        - Vector2i(block->getBorderSize() - m_borderSize);
+    size = block->getBitmap()->getSize();
+    for (int i=0; i<2; ++i) {
+        if (targetOffset[i] < 0) {
+            sourceOffset[i] = -targetOffset[i];
+            size[i] += targetOffset[i];
+            targetOffset[i] = 0;
+        }
+        size[i] = std::min(size[i], m_bitmap->getSize()[i] - targetOffset[i]);
+        if (size[i] <= 0)
+            return false;
+    }
+    return true;
+}
+
+bool ImageBlock::put(const Point2 *pos, const Float *values, size_t count) {
+    const int channels = m_bitmap->getChannelCount();
+    bool success = true;
+
+    if (m_boxWeight == 0 || !m_native) {
+        for (size_t i=0; i<count; ++i)
+            success &= put(pos[i], values + i * channels);
+        return success;
+    }
+
+    const Float filterRadius = m_filter->getRadius();
+    const Vector2i &size = m_bitmap->getSize();
+    const Float offsetX = 0.5f + (m_offset.x - m_borderSize),
+                offsetY = 0.5f + (m_offset.y - m_borderSize);
+    Float *data = m_bitmap->getFloatData();
+
+    for (size_t i=0; i<count; ++i) {
+        const Float *value = values + i * channels;
+        const Point2 p(pos[i].x - offsetX, pos[i].y - offsetY);
+
+        /* Same pixel range as in putInternal() */
+        const int minX = std::max((int) std::ceil (p.x - filterRadius), 0),
+                  minY = std::max((int) std::ceil (p.y - filterRadius), 0),
+                  maxX = std::min((int) std::floor(p.x + filterRadius), size.x - 1),
+                  maxY = std::min((int) std::floor(p.y + filterRadius), size.y - 1);
+
+        /* Samples close to a pixel boundary straddle two pixels */
+        if (EXPECT_NOT_TAKEN(minX != maxX || minY != maxY)) {
+            success &= put(pos[i], value);
+            continue;
+        }
+
+        bool valid = true;
+        for (int k=0; k<channels; ++k)
+            valid &= std::isfinite(value[k]);
+
+        if (EXPECT_NOT_TAKEN(!valid && m_warn)) {
+            /* Let the regular implementation print the warning */
+            success &= put(pos[i], value);
+            continue;
+        }
+
+        Float *dest = data + (minY * (size_t) size.x + minX) * channels;
+        for (int k=0; k<channels; ++k)
+            dest[k] += m_boxWeight * value[k];
+    }
+
+    return success;
+}
+
 void ImageBlock::load(Stream *stream) {
     m_offset = Point2i(stream);
     m_size = Vector2i(stream);
-    stream->readFloatArray(
-        m_bitmap->getFloatData(),
-        (size_t) m_bitmap->getSize().x *
-        (size_t) m_bitmap->getSize().y * m_bitmap->getChannelCount());
+    size_t count = (size_t) m_bitmap->getSize().x *
+        (size_t) m_bitmap->getSize().y * m_bitmap->getChannelCount();
+    switch (m_bitmap->getComponentFormat()) {
+        case Bitmap::EFloat16:
+            stream->readHalfArray(m_bitmap->getFloat16Data(), count);
+            break;
+        case Bitmap::EFloat32:
+            stream->readSingleArray(m_bitmap->getFloat32Data(), count);
+            break;
+        default:
+            stream->readDoubleArray(m_bitmap->getFloat64Data(), count);
+    }
+    if (!m_compensation.empty())
+        stream->readSingleArray(&m_compensation[0], m_compensation.size());
 }
 
 void ImageBlock::save(Stream *stream) const {
     m_offset.serialize(stream);
     m_size.serialize(stream);
-    stream->writeFloatArray(
-        m_bitmap->getFloatData(),
-        (size_t) m_bitmap->getSize().x *
-        (size_t) m_bitmap->getSize().y * m_bitmap->getChannelCount());
+    size_t count = (size_t) m_bitmap->getSize().x *
+        (size_t) m_bitmap->getSize().y * m_bitmap->getChannelCount();
+    switch (m_bitmap->getComponentFormat()) {
+        case Bitmap::EFloat16:
+            stream->writeHalfArray(m_bitmap->getFloat16Data(), count);
+            break;
+        case Bitmap::EFloat32:
+            stream->writeSingleArray(m_bitmap->getFloat32Data(), count);
+            break;
+        default:
+            stream->writeDoubleArray(m_bitmap->getFloat64Data(), count);
+    }
+    if (!m_compensation.empty())
+        stream->writeSingleArray(&m_compensation[0], m_compensation.size());
 }
 
 
+void ImageBlock::putAtomic(const ImageBlock *block) {
+    const Bitmap *source = block->getBitmap();
+    int channels = m_bitmap->getChannelCount();
+    Assert(source->getChannelCount() == channels);
+    if (!m_native)
+        Log(EError, "putAtomic(): not supported by image blocks "
+            "with reduced storage precision!");
+
+    /* Clip the source against the target bitmap */
+    Vector2i sourceOffset, targetOffset, size;
+    if (!clip(block, sourceOffset, targetOffset, size))
+        return;
+
+    for (int y=0; y<size.y; ++y) {
+        const Float *src = source->getFloatData() + ((sourceOffset.y + y)
+            * (size_t) source->getWidth() + sourceOffset.x) * channels;
+        Float *dest = m_bitmap->getFloatData() + ((targetOffset.y + y)
+            * (size_t) m_bitmap->getWidth() + targetOffset.x) * channels;
+        for (size_t i=0; i<(size_t) size.x * channels; ++i) {
+            if (src[i] != 0)
+                atomicAdd(dest + i, src[i]);
+        }
+    }
+}
+
 std::string ImageBlock::toString() const {
     std::ostringstream oss;
     oss << "ImageBlock[" << endl
         << "  offset = " << m_offset.toString() << "," << endl
         << "  size = " << m_size.toString() << "," << endl
-        << "  borderSize = " << m_borderSize << endl
+        << "  borderSize = " << m_borderSize << "," << endl
+        << "  storage = " << m_bitmap->getComponentFormat() << "," << endl
+        << "  compensatedChannels = " << m_compensationStride << endl
         << "]";
     return oss.str();
 }
 
+ImageBlockAccumulator::ImageBlockAccumulator(Bitmap::EPixelFormat fmt,
+        const Vector2i &size, const ReconstructionFilter *filter, int channels)
+        : m_pixelFormat(fmt), m_size(size), m_filter(filter), m_channels(channels) {
+    m_buffers.resize(getNUMANodeCount());
+    for (size_t i=0; i<m_buffers.size(); ++i)
+        m_buffers[i].mutex = new Mutex();
+    m_mergeMutex = new Mutex();
+}
+
+ImageBlockAccumulator::~ImageBlockAccumulator() {
+}
+
+void ImageBlockAccumulator::put(const ImageBlock *block) {
+    int node = Thread::getThread()->getNUMANode();
+    NodeBuffer &buffer = m_buffers[node < 0 ? 0 : (node % m_buffers.size())];
+
+    LockGuard lock(buffer.mutex);
+    if (EXPECT_NOT_TAKEN(!buffer.block)) {
+        /* First touch by a worker running on this node */
+        buffer.block = new ImageBlock(m_pixelFormat, m_size, m_filter, m_channels);
+        buffer.block->clear();
+    }
+    buffer.block->put(block);
+}
+
+ImageBlock *ImageBlockAccumulator::merge() {
+    LockGuard mergeLock(m_mergeMutex);
+    if (!m_merged)
+        m_merged = new ImageBlock(m_pixelFormat, m_size, m_filter, m_channels);
+    m_merged->clear();
+    for (size_t i=0; i<m_buffers.size(); ++i) {
+        LockGuard lock(m_buffers[i].mutex);
+        if (m_buffers[i].block)
+            m_merged->put(m_buffers[i].block);
+    }
+    return m_merged;
+}
+
+void ImageBlockAccumulator::clear() {
+    for (size_t i=0; i<m_buffers.size(); ++i) {
+        LockGuard lock(m_buffers[i].mutex);
+        if (m_buffers[i].block)
+            m_buffers[i].block->clear();
+    }
+}
+
+size_t ImageBlockAccumulator::getBufferCount() const {
+    size_t count = 0;
+    for (size_t i=0; i<m_buffers.size(); ++i) {
+        LockGuard lock(m_buffers[i].mutex);
+        if (m_buffers[i].block.get())
+            ++count;
+    }
+    return count;
+}
+
 MTS_IMPLEMENT_CLASS(ImageBlock, false, WorkResult)
+MTS_IMPLEMENT_CLASS(ImageBlockAccumulator, false, Object)
 MTS_NAMESPACE_END
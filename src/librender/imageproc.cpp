@@ -18,6 +18,8 @@
 
 #include <mitsuba/render/imageproc.h>
 #include <mitsuba/render/rectwu.h>
+#include <mitsuba/core/sfcurve.h>
+#include <boost/algorithm/string.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -38,23 +40,107 @@ void BlockedImageProcess::init(const Point2i &offset, const Vector2i &size, uint
     m_curBlock = Point2i(m_numBlocks / 2);
     m_stepsLeft = 1;
     m_numSteps = 1;
+    m_blockOrder = ESpiralOrder;
+    m_blockSequence.clear();
+    m_pendingBlocks.clear();
+    m_numPixelsGenerated = 0;
+}
+
+namespace {
+    struct BlockCostOrdering {
+        BlockCostOrdering(const float *costs, int width)
+            : m_costs(costs), m_width(width) { }
+
+        inline bool operator()(const Point2i &a, const Point2i &b) const {
+            return m_costs[a.x + a.y * m_width] > m_costs[b.x + b.y * m_width];
+        }
+
+        const float *m_costs;
+        int m_width;
+    };
+}
+
+void BlockedImageProcess::setBlockOrder(EBlockOrder order, const Bitmap *costs) {
+    Assert(m_numBlocksGenerated == 0);
+    m_blockOrder = order;
+    m_blockSequence.clear();
+    if (order == ESpiralOrder)
+        return;
+
+    HilbertCurve2D<int> curve;
+    curve.initialize(m_numBlocks);
+    const std::vector<Point2i> &points = curve.getPoints();
+    m_blockSequence.assign(points.begin(), points.end());
+
+    if (order != ECostOrder)
+        return;
+
+    if (!costs || costs->getSize() != m_numBlocks
+            || costs->getPixelFormat() != Bitmap::ELuminance
+            || costs->getComponentFormat() != Bitmap::EFloat32) {
+        Log(EDebug, "No matching block costs available, using the Hilbert curve order");
+        m_blockOrder = EHilbertOrder;
+        return;
+    }
+
+    std::stable_sort(m_blockSequence.begin(), m_blockSequence.end(),
+        BlockCostOrdering(costs->getFloat32Data(), m_numBlocks.x));
+}
+
+BlockedImageProcess::EBlockOrder BlockedImageProcess::parseBlockOrder(const std::string &name) {
+    std::string value = boost::to_lower_copy(name);
+    if (value == "spiral")
+        return ESpiralOrder;
+    else if (value == "hilbert")
+        return EHilbertOrder;
+    else if (value == "cost")
+        return ECostOrder;
+    SLog(EError, "Unknown block order \"%s\" -- must be "
+        "\"spiral\", \"hilbert\" or \"cost\"", name.c_str());
+    return ESpiralOrder;
 }
 
 ParallelProcess::EStatus BlockedImageProcess::generateWork(WorkUnit *unit, int worker) {
-    /* Reimplementation of the spiraling block generator by Adam Arbree */
     RectangularWorkUnit &rect = *static_cast<RectangularWorkUnit *>(unit);
-
-    if (m_numBlocksTotal == m_numBlocksGenerated)
+    Point2i pos;
+    Vector2i size;
+
+    if (!m_pendingBlocks.empty()) {
+        /* Leftovers of a block that was split for another worker */
+        pos = m_pendingBlocks.back().first;
+        size = m_pendingBlocks.back().second;
+        m_pendingBlocks.pop_back();
+    } else if (nextBlock(pos)) {
+        size = Vector2i(
+            std::min(m_size.x-pos.x, m_blockSize),
+            std::min(m_size.y-pos.y, m_blockSize));
+    } else {
         return EFailure;
+    }
+
+    if (m_splitting)
+        splitBlock(worker, pos, size);
 
-    Point2i pos = m_curBlock * m_blockSize;
+    m_numPixelsGenerated += (size_t) size.x * (size_t) size.y;
     rect.setOffset(pos + m_offset);
-    rect.setSize(Vector2i(
-        std::min(m_size.x-pos.x, m_blockSize),
-        std::min(m_size.y-pos.y, m_blockSize)));
+    rect.setSize(size);
+    return ESuccess;
+}
+
+bool BlockedImageProcess::nextBlock(Point2i &pos) {
+    if (m_numBlocksTotal == m_numBlocksGenerated)
+        return false;
+
+    if (m_blockOrder != ESpiralOrder) {
+        pos = m_blockSequence[m_numBlocksGenerated++] * m_blockSize;
+        return true;
+    }
+
+    /* Reimplementation of the spiraling block generator by Adam Arbree */
+    pos = m_curBlock * m_blockSize;
 
     if (++m_numBlocksGenerated == m_numBlocksTotal)
-        return ESuccess;
+        return true;
 
     do {
         switch (m_direction) {
@@ -74,7 +160,71 @@ ParallelProcess::EStatus BlockedImageProcess::generateWork(WorkUnit *unit, int w
         || m_curBlock.x >= m_numBlocks.x
         || m_curBlock.y >= m_numBlocks.y);
 
-    return ESuccess;
+    return true;
+}
+
+void BlockedImageProcess::setSplitting(bool splitting) {
+    m_splitting = splitting;
+}
+
+void BlockedImageProcess::recordThroughput(int worker, size_t pixels,
+        uint64_t generated, uint64_t finished) {
+    if (worker < 0)
+        return;
+    LockGuard lock(m_throughputMutex);
+    if ((size_t) worker >= m_throughput.size())
+        m_throughput.resize(worker + 1);
+    WorkerThroughput &t = m_throughput[worker];
+    if (t.pixels == 0 || generated < t.started)
+        t.started = generated;
+    t.finished = std::max(t.finished, finished);
+    t.pixels += pixels;
+}
+
+void BlockedImageProcess::splitBlock(int worker, const Point2i &pos, Vector2i &size) {
+    /* Estimate the pixel rates of the requesting worker and of all workers */
+    double rate = 0, totalRate = 0;
+    {
+        LockGuard lock(m_throughputMutex);
+        for (size_t i=0; i<m_throughput.size(); ++i) {
+            const WorkerThroughput &t = m_throughput[i];
+            if (t.pixels == 0 || t.finished <= t.started)
+                continue;
+            double r = t.pixels / (double) (t.finished - t.started);
+            totalRate += r;
+            if ((int) i == worker)
+                rate = r;
+        }
+    }
+    if (rate == 0)
+        return;
+
+    /* Split as long as this worker would need longer for the block than all
+       workers together need for the remaining image (assuming that they keep
+       their current rates). Near the end of the image, this lets slow
+       workers process small blocks so that everyone finishes at once. */
+    size_t remaining = (size_t) m_size.x * (size_t) m_size.y - m_numPixelsGenerated;
+    double remainingTime = remaining / totalRate;
+    while ((size.x > MTS_MIN_SPLIT_SIZE || size.y > MTS_MIN_SPLIT_SIZE) &&
+           (double) size.x * (double) size.y / rate > remainingTime) {
+        Vector2i half((size.x + 1) / 2, (size.y + 1) / 2);
+        if (size.x <= MTS_MIN_SPLIT_SIZE)
+            half.x = size.x;
+        if (size.y <= MTS_MIN_SPLIT_SIZE)
+            half.y = size.y;
+
+        /* Keep the top left part, and queue the others for other workers */
+        if (half.x < size.x)
+            m_pendingBlocks.push_back(std::make_pair(pos + Vector2i(half.x, 0),
+                Vector2i(size.x - half.x, half.y)));
+        if (half.y < size.y)
+            m_pendingBlocks.push_back(std::make_pair(pos + Vector2i(0, half.y),
+                Vector2i(half.x, size.y - half.y)));
+        if (half.x < size.x && half.y < size.y)
+            m_pendingBlocks.push_back(std::make_pair(pos + half,
+                size - half));
+        size = half;
+    }
 }
 
 MTS_IMPLEMENT_CLASS(BlockedImageProcess, true, ParallelProcess)
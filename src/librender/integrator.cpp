@@ -19,6 +19,7 @@
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/render/integrator.h>
 #include <mitsuba/render/renderproc.h>
+#include <mitsuba/render/renderjob.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -101,6 +102,11 @@ bool SamplingIntegrator::render(Scene *scene,
     ref<Sensor> sensor = static_cast<Sensor *>(sched->getResource(sensorResID));
     ref<Film> film = sensor->getFilm();
 
+    /* Interactive jobs first show a coarse version of the whole frame */
+    if (job->isInteractive())
+        return ProgressiveRenderProcess::render(this, m_process, scene,
+            queue, job, sceneResID, sensorResID, samplerResID, 2);
+
     size_t nCores = sched->getCoreCount();
     const Sampler *sampler = static_cast<const Sampler *>(sched->getResource(samplerResID, 0));
     size_t sampleCount = sampler->getSampleCount();
@@ -111,8 +117,9 @@ bool SamplingIntegrator::render(Scene *scene,
         nCores == 1 ? "core" : "cores");
 
     /* This is a sampling-based integrator - parallelize */
-    ref<ParallelProcess> proc = new BlockedRenderProcess(job,
+    ref<BlockedRenderProcess> proc = new BlockedRenderProcess(job,
         queue, scene->getBlockSize());
+    proc->setSplitting(true);
     int integratorResID = sched->registerResource(this);
     proc->bindResource("integrator", integratorResID);
     proc->bindResource("scene", sceneResID);
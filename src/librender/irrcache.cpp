@@ -254,6 +254,12 @@ IrradianceCache::IrradianceCache(Stream *stream, InstanceManager *manager) :
 IrradianceCache::~IrradianceCache() {
     for (size_t i=0; i<m_records.size(); ++i)
         delete m_records[i];
+    for (size_t i=0; i<m_pendingLists.size(); ++i) {
+        RecordList *pending = m_pendingLists[i];
+        for (size_t j=0; j<pending->size(); ++j)
+            delete (*pending)[j];
+        delete pending;
+    }
 }
 
 void IrradianceCache::serialize(Stream *stream, InstanceManager *manager) const {
@@ -263,9 +269,20 @@ void IrradianceCache::serialize(Stream *stream, InstanceManager *manager) const
     stream->writeBool(m_clampScreen);
     stream->writeBool(m_clampNeighbor);
     stream->writeBool(m_useGradients);
-    stream->writeSize(m_records.size());
-    for (uint32_t i=0; i<m_records.size(); ++i)
+
+    /* Also include records that haven't been flushed yet */
+    LockGuard lock(m_mutex);
+    size_t recordCount = m_records.size();
+    for (size_t i=0; i<m_pendingLists.size(); ++i)
+        recordCount += m_pendingLists[i]->size();
+    stream->writeSize(recordCount);
+    for (size_t i=0; i<m_records.size(); ++i)
         m_records[i]->serialize(stream);
+    for (size_t i=0; i<m_pendingLists.size(); ++i) {
+        const RecordList *pending = m_pendingLists[i];
+        for (size_t j=0; j<pending->size(); ++j)
+            (*pending)[j]->serialize(stream);
+    }
 }
 
 IrradianceCache::Record *IrradianceCache::put(const RayDifferential &ray, const Intersection &its,
@@ -348,8 +365,25 @@ void IrradianceCache::insert(Record *record) {
         record->p-Vector(1,1,1)*validRadius,
         record->p+Vector(1,1,1)*validRadius
     ));
+
+    RecordList *&pending = m_pending.get();
+    if (EXPECT_NOT_TAKEN(pending == NULL)) {
+        /* First insertion by this thread -- register a new list */
+        pending = new RecordList();
+        LockGuard lock(m_mutex);
+        m_pendingLists.push_back(pending);
+    }
+    pending->push_back(record);
+}
+
+void IrradianceCache::flush() {
+    RecordList *pending = m_pending.get();
+    if (pending == NULL || pending->empty())
+        return;
+
     LockGuard lock(m_mutex);
-    m_records.push_back(record);
+    m_records.insert(m_records.end(), pending->begin(), pending->end());
+    pending->clear();
 }
 
 static StatsCounter irradHits("Irradiance cache", "Hits");
@@ -371,9 +405,14 @@ bool IrradianceCache::get(const Intersection &its, Spectrum &E) const {
 }
 
 std::string IrradianceCache::toString() const {
+    LockGuard lock(m_mutex);
+    size_t recordCount = m_records.size();
+    for (size_t i=0; i<m_pendingLists.size(); ++i)
+        recordCount += m_pendingLists[i]->size();
+
     std::ostringstream oss;
     oss << "IrradianceCache[" << endl
-        << "  records = " << m_records.size() << "," << endl
+        << "  records = " << recordCount << "," << endl
         << "  quality = " << m_kappa << "," << endl
         << "  sceneSize = " << m_sceneSize << "," << endl
         << "  clampScreen = " << m_clampScreen << "," << endl
@@ -1,5 +1,22 @@
 #include <mitsuba/render/noise.h>
 
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+#include <mitsuba/core/sse.h>
+// Evaluate four Perlin noise lookups at a time using SSE
+#define NOISE_SSE 1
+#endif
+
+/// Number of positions per octave in the batched fBm functions
+#define NOISE_BATCH_SIZE 64
+
+/**
+ * Upper bound on |perlinNoise(p)|: the noise is a convex combination of the
+ * corner gradients' dot products, each bounded by the L1 norm of the offset
+ * to the corner. Per axis, the weighted offsets sum to (1-w(t))t + w(t)(1-t)
+ * with the fade function w, which is at most 1/2.
+ */
+#define NOISE_PERLIN_BOUND 1.5f
+
 MTS_NAMESPACE_BEGIN
 
 #define GRAD_PERLIN 1
@@ -140,4 +157,153 @@ Float Noise::turbulence(const Point &p, const Vector &dpdx,
     return sum;
 }
 
+#if defined(NOISE_SSE)
+static FINLINE __m128 select4(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/// Vectorized version of \ref grad() given the hashes of four cell corners
+static FINLINE __m128 grad4(__m128i h, __m128 dx, __m128 dy, __m128 dz) {
+    h = _mm_and_si128(h, _mm_set1_epi32(15));
+    __m128 lt8 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(8))),
+           lt4 = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4))),
+           is12or14 = _mm_castsi128_ps(_mm_cmpeq_epi32(
+               _mm_or_si128(h, _mm_set1_epi32(2)), _mm_set1_epi32(14)));
+
+    __m128 u = select4(lt8, dx, dy),
+           v = select4(lt4, dy, select4(is12or14, dx, dz));
+
+    /* Flip the signs based on the two lowest bits */
+    u = _mm_xor_ps(u, _mm_castsi128_ps(_mm_slli_epi32(
+        _mm_and_si128(h, _mm_set1_epi32(1)), 31)));
+    v = _mm_xor_ps(v, _mm_castsi128_ps(_mm_slli_epi32(
+        _mm_and_si128(h, _mm_set1_epi32(2)), 30)));
+    return _mm_add_ps(u, v);
+}
+
+static FINLINE __m128 noiseWeight4(__m128 t) {
+    __m128 t3 = _mm_mul_ps(_mm_mul_ps(t, t), t), t4 = _mm_mul_ps(t3, t),
+           t5 = _mm_mul_ps(t4, t);
+    return _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(6.0f), t5),
+        _mm_mul_ps(_mm_set1_ps(15.0f), t4)), _mm_mul_ps(_mm_set1_ps(10.0f), t3));
+}
+
+static FINLINE __m128 lerp4(__m128 t, __m128 v1, __m128 v2) {
+    return _mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.0f), t), v1),
+        _mm_mul_ps(t, v2));
+}
+
+/// Evaluate Perlin noise at four positions
+static FINLINE __m128 perlinNoise4(__m128 x, __m128 y, __m128 z) {
+    /* Round towards negative infinity */
+    __m128i ix = _mm_cvttps_epi32(x), iy = _mm_cvttps_epi32(y), iz = _mm_cvttps_epi32(z);
+    ix = _mm_add_epi32(ix, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(ix), x)));
+    iy = _mm_add_epi32(iy, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(iy), y)));
+    iz = _mm_add_epi32(iz, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(iz), z)));
+
+    __m128 dx = _mm_sub_ps(x, _mm_cvtepi32_ps(ix)),
+           dy = _mm_sub_ps(y, _mm_cvtepi32_ps(iy)),
+           dz = _mm_sub_ps(z, _mm_cvtepi32_ps(iz));
+
+    /* Hash the cell corners (the table lookups remain scalar) */
+    const __m128i mask = _mm_set1_epi32(NOISE_PERM_SIZE-1);
+    MM_ALIGN16 int cx[4], cy[4], cz[4], h[8][4];
+    _mm_store_si128((__m128i *) cx, _mm_and_si128(ix, mask));
+    _mm_store_si128((__m128i *) cy, _mm_and_si128(iy, mask));
+    _mm_store_si128((__m128i *) cz, _mm_and_si128(iz, mask));
+    for (int i=0; i<4; ++i) {
+        int a = NoisePerm[cx[i]] + cy[i], b = NoisePerm[cx[i]+1] + cy[i],
+            aa = NoisePerm[a] + cz[i], ab = NoisePerm[a+1] + cz[i],
+            ba = NoisePerm[b] + cz[i], bb = NoisePerm[b+1] + cz[i];
+        h[0][i] = NoisePerm[aa];   h[1][i] = NoisePerm[ba];
+        h[2][i] = NoisePerm[ab];   h[3][i] = NoisePerm[bb];
+        h[4][i] = NoisePerm[aa+1]; h[5][i] = NoisePerm[ba+1];
+        h[6][i] = NoisePerm[ab+1]; h[7][i] = NoisePerm[bb+1];
+    }
+
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 dx1 = _mm_sub_ps(dx, one), dy1 = _mm_sub_ps(dy, one), dz1 = _mm_sub_ps(dz, one);
+    __m128 w000 = grad4(_mm_load_si128((__m128i *) h[0]), dx,  dy,  dz),
+           w100 = grad4(_mm_load_si128((__m128i *) h[1]), dx1, dy,  dz),
+           w010 = grad4(_mm_load_si128((__m128i *) h[2]), dx,  dy1, dz),
+           w110 = grad4(_mm_load_si128((__m128i *) h[3]), dx1, dy1, dz),
+           w001 = grad4(_mm_load_si128((__m128i *) h[4]), dx,  dy,  dz1),
+           w101 = grad4(_mm_load_si128((__m128i *) h[5]), dx1, dy,  dz1),
+           w011 = grad4(_mm_load_si128((__m128i *) h[6]), dx,  dy1, dz1),
+           w111 = grad4(_mm_load_si128((__m128i *) h[7]), dx1, dy1, dz1);
+
+    __m128 wx = noiseWeight4(dx), wy = noiseWeight4(dy), wz = noiseWeight4(dz);
+    __m128 y0 = lerp4(wy, lerp4(wx, w000, w100), lerp4(wx, w010, w110)),
+           y1 = lerp4(wy, lerp4(wx, w001, w101), lerp4(wx, w011, w111));
+    return lerp4(wz, y0, y1);
+}
+#endif
+
+void Noise::perlinNoise(const Point *p, Float *result, size_t count) {
+    size_t i = 0;
+#if defined(NOISE_SSE)
+    for (; i+4 <= count; i += 4) {
+        __m128 x = _mm_set_ps(p[i+3].x, p[i+2].x, p[i+1].x, p[i].x),
+               y = _mm_set_ps(p[i+3].y, p[i+2].y, p[i+1].y, p[i].y),
+               z = _mm_set_ps(p[i+3].z, p[i+2].z, p[i+1].z, p[i].z);
+        _mm_storeu_ps(result + i, perlinNoise4(x, y, z));
+    }
+#endif
+    for (; i<count; ++i)
+        result[i] = perlinNoise(p[i]);
+}
+
+/// Shared implementation of the batched fBm and turbulence functions
+template <bool turbulence> static void fbmBatch(const Point *p, Float *result,
+        size_t count, Float omega, Float foctaves) {
+    int octaves = (int) foctaves;
+    Float partial = math::smoothStep((Float) .3f, (Float) .7f, foctaves - octaves);
+    Point scaled[NOISE_BATCH_SIZE];
+    Float noise[NOISE_BATCH_SIZE];
+
+    for (size_t start=0; start<count; start += NOISE_BATCH_SIZE) {
+        size_t size = std::min(count - start, (size_t) NOISE_BATCH_SIZE);
+        Float *sum = result + start;
+        for (size_t i=0; i<size; ++i)
+            sum[i] = 0.0f;
+
+        /* Same sequence of octaves as in the scalar version */
+        Float lambda = 1., o = 1.;
+        for (int k=0; k<=octaves; ++k) {
+            Float weight = k < octaves ? o : o * partial;
+            if (weight != 0) {
+                for (size_t i=0; i<size; ++i)
+                    scaled[i] = lambda * p[start + i];
+                Noise::perlinNoise(scaled, noise, size);
+                for (size_t i=0; i<size; ++i)
+                    sum[i] += weight * (turbulence ? std::abs(noise[i]) : noise[i]);
+            }
+            lambda *= 1.99f;
+            o *= omega;
+        }
+    }
+}
+
+void Noise::fbm(const Point *p, Float *result, size_t count,
+        Float omega, Float octaves) {
+    fbmBatch<false>(p, result, count, omega, octaves);
+}
+
+void Noise::turbulence(const Point *p, Float *result, size_t count,
+        Float omega, Float octaves) {
+    fbmBatch<true>(p, result, count, omega, octaves);
+}
+
+Float Noise::getFbmBound(Float omega, Float foctaves) {
+    int octaves = (int) foctaves;
+    Float partial = math::smoothStep((Float) .3f, (Float) .7f, foctaves - octaves);
+    Float sum = 0, o = 1;
+    for (int k=0; k<octaves; ++k) {
+        sum += std::abs(o);
+        o *= omega;
+    }
+    sum += std::abs(o) * partial;
+    return sum * NOISE_PERLIN_BOUND;
+}
+
 MTS_NAMESPACE_END
@@ -22,6 +22,12 @@ Float PhaseFunction::pdf(const PhaseFunctionSamplingRecord &pRec) const {
     return eval(pRec);
 }
 
+void PhaseFunction::evalBatch(const MediumSamplingRecord &mRec, const Vector &wi,
+        size_t count, const Vector *wo, Float *result) const {
+    for (size_t i=0; i<count; ++i)
+        result[i] = eval(PhaseFunctionSamplingRecord(mRec, wi, wo[i]));
+}
+
 bool PhaseFunction::needsDirectionallyVaryingCoefficients() const {
     return false;
 }
@@ -46,7 +46,7 @@ Photon::Photon(Stream *stream) {
     position = Point(stream);
     if (!leftBalancedLayout)
         setRightIndex(0, stream->readUInt());
-#if defined(SINGLE_PRECISION) && SPECTRUM_SAMPLES == 3
+#if MTS_PHOTON_RGBE == 1
     stream->read(data.power, 8);
 #else
     data.power = Spectrum(stream);
@@ -63,7 +63,7 @@ void Photon::serialize(Stream *stream) const {
     position.serialize(stream);
     if (!leftBalancedLayout)
         stream->writeUInt(getRightIndex(0));
-    #if defined(SINGLE_PRECISION) && SPECTRUM_SAMPLES == 3
+    #if MTS_PHOTON_RGBE == 1
         stream->write(data.power, 8);
     #else
         data.power.serialize(stream);
@@ -76,6 +76,103 @@ void Photon::serialize(Stream *stream) const {
     stream->writeUChar(flags);
 }
 
+void Photon::serialize(Stream *stream, const Photon *photons, size_t count) {
+    size_t chunkSize = std::min(count, (size_t) ESerializationChunk);
+    std::vector<Float> floats(chunkSize * std::max(3, SPECTRUM_SAMPLES));
+    std::vector<uint32_t> indices(leftBalancedLayout ? 0 : chunkSize);
+    std::vector<uint16_t> depths(chunkSize);
+    std::vector<uint8_t> bytes(chunkSize * 8);
+
+    for (size_t start=0; start<count; start += ESerializationChunk) {
+        const Photon *chunk = photons + start;
+        size_t n = std::min(count - start, (size_t) ESerializationChunk);
+
+        for (size_t i=0; i<n; ++i)
+            for (int j=0; j<3; ++j)
+                floats[3*i+j] = chunk[i].position[j];
+        stream->writeFloatArray(&floats[0], 3*n);
+
+        if (!leftBalancedLayout) {
+            for (size_t i=0; i<n; ++i)
+                indices[i] = chunk[i].getRightIndex(0);
+            stream->writeUIntArray(&indices[0], n);
+        }
+
+        #if MTS_PHOTON_RGBE == 1
+            for (size_t i=0; i<n; ++i)
+                memcpy(&bytes[8*i], chunk[i].data.power, 8);
+            stream->write(&bytes[0], 8*n);
+        #else
+            for (size_t i=0; i<n; ++i)
+                for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+                    floats[SPECTRUM_SAMPLES*i+j] = chunk[i].data.power[j];
+            stream->writeFloatArray(&floats[0], SPECTRUM_SAMPLES*n);
+            for (size_t i=0; i<n; ++i) {
+                bytes[4*i]   = chunk[i].data.phi;
+                bytes[4*i+1] = chunk[i].data.theta;
+                bytes[4*i+2] = chunk[i].data.phiN;
+                bytes[4*i+3] = chunk[i].data.thetaN;
+            }
+            stream->write(&bytes[0], 4*n);
+        #endif
+
+        for (size_t i=0; i<n; ++i) {
+            depths[i] = chunk[i].data.depth;
+            bytes[i] = chunk[i].flags;
+        }
+        stream->writeUShortArray(&depths[0], n);
+        stream->write(&bytes[0], n);
+    }
+}
+
+void Photon::unserialize(Stream *stream, Photon *photons, size_t count) {
+    size_t chunkSize = std::min(count, (size_t) ESerializationChunk);
+    std::vector<Float> floats(chunkSize * std::max(3, SPECTRUM_SAMPLES));
+    std::vector<uint32_t> indices(leftBalancedLayout ? 0 : chunkSize);
+    std::vector<uint16_t> depths(chunkSize);
+    std::vector<uint8_t> bytes(chunkSize * 8);
+
+    for (size_t start=0; start<count; start += ESerializationChunk) {
+        Photon *chunk = photons + start;
+        size_t n = std::min(count - start, (size_t) ESerializationChunk);
+
+        stream->readFloatArray(&floats[0], 3*n);
+        for (size_t i=0; i<n; ++i)
+            chunk[i].position = Point(floats[3*i], floats[3*i+1], floats[3*i+2]);
+
+        if (!leftBalancedLayout) {
+            stream->readUIntArray(&indices[0], n);
+            for (size_t i=0; i<n; ++i)
+                chunk[i].setRightIndex(0, indices[i]);
+        }
+
+        #if MTS_PHOTON_RGBE == 1
+            stream->read(&bytes[0], 8*n);
+            for (size_t i=0; i<n; ++i)
+                memcpy(chunk[i].data.power, &bytes[8*i], 8);
+        #else
+            stream->readFloatArray(&floats[0], SPECTRUM_SAMPLES*n);
+            for (size_t i=0; i<n; ++i)
+                for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+                    chunk[i].data.power[j] = floats[SPECTRUM_SAMPLES*i+j];
+            stream->read(&bytes[0], 4*n);
+            for (size_t i=0; i<n; ++i) {
+                chunk[i].data.phi    = bytes[4*i];
+                chunk[i].data.theta  = bytes[4*i+1];
+                chunk[i].data.phiN   = bytes[4*i+2];
+                chunk[i].data.thetaN = bytes[4*i+3];
+            }
+        #endif
+
+        stream->readUShortArray(&depths[0], n);
+        stream->read(&bytes[0], n);
+        for (size_t i=0; i<n; ++i) {
+            chunk[i].data.depth = depths[i];
+            chunk[i].flags = bytes[i];
+        }
+    }
+}
+
 Photon::Photon(const Point &p, const Normal &normal,
                const Vector &dir, const Spectrum &P,
                uint16_t _depth) {
@@ -112,7 +209,7 @@ Photon::Photon(const Point &p, const Normal &normal,
             data.phiN = (uint8_t) tmp;
     }
 
-#if defined(SINGLE_PRECISION) && SPECTRUM_SAMPLES == 3
+#if MTS_PHOTON_RGBE == 1
     /* Pack the photon power into Greg Ward's RGBE format */
     P.toRGBE(data.power);
 #else
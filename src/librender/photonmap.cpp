@@ -19,10 +19,123 @@
 #include <mitsuba/render/photonmap.h>
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/phase.h>
+#include <mitsuba/render/range.h>
+#include <mitsuba/core/sched.h>
 #include <fstream>
 
+/// Photon maps with fewer photons are always built on the calling thread
+#define MTS_PHOTONMAP_PARALLEL_THRESHOLD 100000
+
 MTS_NAMESPACE_BEGIN
 
+typedef PhotonMap::PhotonTree::BuildTask PhotonTreeBuildTask;
+
+class PhotonTreeBuildResult : public WorkResult {
+public:
+    void load(Stream *stream) { }
+    void save(Stream *stream) const { }
+    std::string toString() const { return "PhotonTreeBuildResult[]"; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~PhotonTreeBuildResult() { }
+};
+
+/// Constructs a range of deferred photon map subtrees
+class PhotonTreeBuildWorker : public WorkProcessor {
+public:
+    PhotonTreeBuildWorker(PhotonMap::PhotonTree *tree,
+            std::vector<PhotonTreeBuildTask> *tasks)
+        : m_tree(tree), m_tasks(tasks) { }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Log(EError, "Photon map construction is strictly local!");
+    }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new RangeWorkUnit();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new PhotonTreeBuildResult();
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new PhotonTreeBuildWorker(m_tree, m_tasks);
+    }
+
+    void prepare() { }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+        const bool &stop) {
+        /* Ignore 'stop', since an incomplete tree would be unusable */
+        const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+        for (size_t i=range->getRangeStart(); i<=range->getRangeEnd(); ++i)
+            m_tree->buildTask((*m_tasks)[i]);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~PhotonTreeBuildWorker() { }
+private:
+    PhotonMap::PhotonTree *m_tree;
+    std::vector<PhotonTreeBuildTask> *m_tasks;
+};
+
+/// Hands out the deferred subtrees of a photon map one at a time
+class PhotonTreeBuildProcess : public ParallelProcess {
+public:
+    PhotonTreeBuildProcess(PhotonMap::PhotonTree *tree,
+            std::vector<PhotonTreeBuildTask> *tasks)
+        : m_tree(tree), m_tasks(tasks), m_next(0) { }
+
+    ref<WorkProcessor> createWorkProcessor() const {
+        return new PhotonTreeBuildWorker(m_tree, m_tasks);
+    }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        if (m_next == m_tasks->size())
+            return EFailure;
+        static_cast<RangeWorkUnit *>(unit)->setRange(m_next, m_next);
+        ++m_next;
+        return ESuccess;
+    }
+
+    void processResult(const WorkResult *result, bool cancelled) { }
+
+    bool isLocal() const { return true; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~PhotonTreeBuildProcess() { }
+private:
+    PhotonMap::PhotonTree *m_tree;
+    std::vector<PhotonTreeBuildTask> *m_tasks;
+    size_t m_next;
+};
+
+struct PhotonTreeTaskOrdering : public std::binary_function<PhotonTreeBuildTask,
+        PhotonTreeBuildTask, bool> {
+    inline bool operator()(const PhotonTreeBuildTask &a, const PhotonTreeBuildTask &b) const {
+        return a.size() > b.size();
+    }
+};
+
+/// Constructs the deferred subtrees of a photon map on the scheduler
+struct PhotonTreeBuildExecutor {
+    void operator()(PhotonMap::PhotonTree &tree, std::vector<PhotonTreeBuildTask> &tasks) {
+        /* Start with the largest subtrees to balance the load */
+        std::sort(tasks.begin(), tasks.end(), PhotonTreeTaskOrdering());
+
+        ref<Scheduler> sched = Scheduler::getInstance();
+        ref<PhotonTreeBuildProcess> proc = new PhotonTreeBuildProcess(&tree, &tasks);
+        sched->schedule(proc);
+        sched->wait(proc);
+        if (proc->getReturnStatus() != ParallelProcess::ESuccess)
+            SLog(EError, "The parallel photon map construction did not finish!");
+    }
+};
+
 PhotonMap::PhotonMap(size_t photonCount)
         : m_kdtree(0, PhotonTree::ESlidingMidpoint), m_scale(1.0f) {
     m_kdtree.reserve(photonCount);
@@ -37,8 +150,9 @@ PhotonMap::PhotonMap(Stream *stream, InstanceManager *manager)
     m_kdtree.resize(stream->readSize());
     m_kdtree.setDepth(stream->readSize());
     m_kdtree.setAABB(AABB(stream));
-    for (size_t i=0; i<m_kdtree.size(); ++i)
-        m_kdtree[i] = Photon(stream);
+    if (m_kdtree.size() > 0)
+        Photon::unserialize(stream, &m_kdtree[0], m_kdtree.size());
+    m_kdtree.buildBuckets();
 }
 
 void PhotonMap::serialize(Stream *stream, InstanceManager *manager) const {
@@ -48,13 +162,34 @@ void PhotonMap::serialize(Stream *stream, InstanceManager *manager) const {
     stream->writeSize(m_kdtree.size());
     stream->writeSize(m_kdtree.getDepth());
     m_kdtree.getAABB().serialize(stream);
-    for (size_t i=0; i<m_kdtree.size(); ++i)
-        m_kdtree[i].serialize(stream);
+    if (m_kdtree.size() > 0)
+        Photon::serialize(stream, &m_kdtree[0], m_kdtree.size());
 }
 
 PhotonMap::~PhotonMap() {
 }
 
+void PhotonMap::build(bool recomputeAABB) {
+    ref<Scheduler> sched = Scheduler::getInstance();
+    size_t workerCount = sched->getLocalWorkerCount();
+    Thread *thread = Thread::getThread();
+
+    /* Waiting for a parallel process from within a worker could deadlock */
+    if (m_kdtree.size() < MTS_PHOTONMAP_PARALLEL_THRESHOLD || !sched->isRunning()
+        || workerCount <= 1 || (thread && thread->getClass()->derivesFrom(MTS_CLASS(Worker)))) {
+        m_kdtree.build(recomputeAABB);
+        return;
+    }
+
+    /* Defer enough subtrees to keep all workers busy */
+    size_t taskDepth = 1;
+    while (((size_t) 1 << (taskDepth - 1)) < 8 * workerCount)
+        ++taskDepth;
+
+    PhotonTreeBuildExecutor executor;
+    m_kdtree.build(recomputeAABB, taskDepth, executor);
+}
+
 std::string PhotonMap::toString() const {
     std::ostringstream oss;
     oss << "PhotonMap[" << endl
@@ -192,5 +327,8 @@ size_t PhotonMap::estimateRadianceRaw(const Intersection &its,
     return count;
 }
 
+MTS_IMPLEMENT_CLASS(PhotonTreeBuildResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS(PhotonTreeBuildWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(PhotonTreeBuildProcess, false, ParallelProcess)
 MTS_IMPLEMENT_CLASS_S(PhotonMap, false, SerializableObject)
 MTS_NAMESPACE_END
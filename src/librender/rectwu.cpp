@@ -55,5 +55,40 @@ std::string RectangularWorkUnit::toString() const {
     return oss.str();
 }
 
+/* ==================================================================== */
+/*                           AdaptiveWorkUnit                           */
+/* ==================================================================== */
+
+void AdaptiveWorkUnit::set(const WorkUnit *wu) {
+    RectangularWorkUnit::set(wu);
+    m_mask = static_cast<const AdaptiveWorkUnit *>(wu)->m_mask;
+}
+
+void AdaptiveWorkUnit::load(Stream *stream) {
+    RectangularWorkUnit::load(stream);
+    m_mask.resize((size_t) getSize().x * (size_t) getSize().y);
+    if (!m_mask.empty())
+        stream->read(&m_mask[0], m_mask.size());
+}
+
+void AdaptiveWorkUnit::save(Stream *stream) const {
+    RectangularWorkUnit::save(stream);
+    Assert(m_mask.size() == (size_t) getSize().x * (size_t) getSize().y);
+    if (!m_mask.empty())
+        stream->write(&m_mask[0], m_mask.size());
+}
+
+std::string AdaptiveWorkUnit::toString() const {
+    size_t active = 0;
+    for (size_t i=0; i<m_mask.size(); ++i)
+        active += m_mask[i] ? 1 : 0;
+    std::ostringstream oss;
+    oss << "AdaptiveWorkUnit[offset=" << getOffset().toString()
+        << ", size=" << getSize().toString()
+        << ", active=" << active << "]";
+    return oss.str();
+}
+
 MTS_IMPLEMENT_CLASS(RectangularWorkUnit, false, WorkUnit)
+MTS_IMPLEMENT_CLASS(AdaptiveWorkUnit, false, RectangularWorkUnit)
 MTS_NAMESPACE_END
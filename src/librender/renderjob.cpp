@@ -18,14 +18,17 @@
 
 #include <mitsuba/render/renderjob.h>
 #include <mitsuba/render/renderproc.h>
-#include <boost/filesystem.hpp>
+#include <mitsuba/core/statistics.h>
+#include <boost/filesystem/fstream.hpp>
 
 MTS_NAMESPACE_BEGIN
 
 RenderJob::RenderJob(const std::string &threadName,
     Scene *scene, RenderQueue *queue, int sceneResID, int sensorResID,
     int samplerResID, bool threadIsCritical, bool interactive)
-    : Thread(threadName), m_scene(scene), m_queue(queue), m_interactive(interactive) {
+    : Thread(threadName), m_scene(scene), m_queue(queue), m_interactive(interactive),
+      m_telemetryEnabled(false) {
+    m_telemetryMutex = new Mutex();
 
     /* Optional: bring the process down when this thread crashes */
     setCritical(threadIsCritical);
@@ -106,6 +109,11 @@ void RenderJob::run() {
                     m_scene->getSourceFile().filename().string().c_str());
             }
             Log(EInfo, "Render time: %s", timeString(m_queue->getRenderTime(this), true).c_str());
+            if (m_telemetryEnabled) {
+                fs::path destination = m_scene->getDestinationFile();
+                writeTelemetry(destination.parent_path() /
+                    (destination.stem().string() + "_workunits.csv"));
+            }
             m_scene->postprocess(m_queue, this, m_sceneResID, m_sensorResID, m_samplerResID);
         }
     } catch (const std::exception &ex) {
@@ -117,5 +125,49 @@ void RenderJob::run() {
     m_queue->removeJob(this, m_cancelled);
 }
 
+void RenderJob::recordTelemetry(const WorkUnitTelemetry &telemetry,
+        const Point2i &offset, const Vector2i &size) const {
+    BlockTelemetry entry;
+    static_cast<WorkUnitTelemetry &>(entry) = telemetry;
+    entry.offset = offset;
+    entry.size = size;
+
+    LockGuard lock(m_telemetryMutex);
+    m_telemetry.push_back(entry);
+}
+
+void RenderJob::writeTelemetry(const fs::path &filename) const {
+    LockGuard lock(m_telemetryMutex);
+    fs::ofstream os(filename);
+    if (!os.good())
+        Log(EError, "Unable to write the work unit telemetry to \"%s\"!",
+            filename.string().c_str());
+
+    uint64_t origin = 0;
+    for (size_t i=0; i<m_telemetry.size(); ++i) {
+        if (i == 0 || m_telemetry[i].generated < origin)
+            origin = m_telemetry[i].generated;
+    }
+    double scale = 1.0 / Statistics::getInstance()->getTicksPerSecond();
+
+    os << "process,worker,remote,x,y,width,height,generated,started,finished,"
+          "merge_started,merge_finished,bytes_sent,bytes_received" << endl;
+    os.precision(9);
+    for (size_t i=0; i<m_telemetry.size(); ++i) {
+        const BlockTelemetry &t = m_telemetry[i];
+        os << t.processID << "," << t.workerIndex << "," << (t.remote ? 1 : 0) << ","
+           << t.offset.x << "," << t.offset.y << "," << t.size.x << "," << t.size.y << ","
+           << ((int64_t) (t.generated - origin)) * scale << ","
+           << ((int64_t) (t.started - origin)) * scale << ","
+           << ((int64_t) (t.finished - origin)) * scale << ","
+           << ((int64_t) (t.mergeStarted - origin)) * scale << ","
+           << ((int64_t) (t.mergeFinished - origin)) * scale << ","
+           << t.bytesSent << "," << t.bytesReceived << endl;
+    }
+
+    Log(EInfo, "Wrote the telemetry of " SIZE_T_FMT " work units to \"%s\"",
+        m_telemetry.size(), filename.string().c_str());
+}
+
 MTS_IMPLEMENT_CLASS(RenderJob, false, Thread)
 MTS_NAMESPACE_END
@@ -20,15 +20,24 @@
 #include <mitsuba/core/sfcurve.h>
 #include <mitsuba/render/renderproc.h>
 #include <mitsuba/render/rectwu.h>
+#include <mitsuba/render/renderjob.h>
 
 MTS_NAMESPACE_BEGIN
 
 class BlockRenderer : public WorkProcessor {
 public:
+    /**
+     * When \c statChannels is positive, the renderer processes the
+     * masked work units of an \ref AdaptiveRenderProcess. Setting
+     * \c masked processes masked work units without collecting
+     * any statistics (\ref ProgressiveRenderProcess).
+     */
     BlockRenderer(Bitmap::EPixelFormat pixelFormat, int channelCount, int blockSize,
-        int borderSize, bool warnInvalid) : m_pixelFormat(pixelFormat),
-        m_channelCount(channelCount), m_blockSize(blockSize),
-        m_borderSize(borderSize), m_warnInvalid(warnInvalid) { }
+        int borderSize, bool warnInvalid, int statChannels = 0, bool masked = false)
+        : m_pixelFormat(pixelFormat), m_channelCount(channelCount),
+        m_blockSize(blockSize), m_borderSize(borderSize),
+        m_warnInvalid(warnInvalid), m_statChannels(statChannels),
+        m_masked(masked || statChannels > 0) { }
 
     BlockRenderer(Stream *stream, InstanceManager *manager) {
         m_pixelFormat = (Bitmap::EPixelFormat) stream->readInt();
@@ -36,13 +45,22 @@ public:
         m_blockSize = stream->readInt();
         m_borderSize = stream->readInt();
         m_warnInvalid = stream->readBool();
+        m_statChannels = stream->readInt();
+        m_masked = stream->readBool();
     }
 
     ref<WorkUnit> createWorkUnit() const {
+        if (m_masked)
+            return new AdaptiveWorkUnit();
         return new RectangularWorkUnit();
     }
 
     ref<WorkResult> createWorkResult() const {
+        if (m_statChannels > 0)
+            return new AdaptiveWorkResult(m_pixelFormat,
+                Vector2i(m_blockSize),
+                m_sensor->getFilm()->getReconstructionFilter(),
+                m_statChannels, m_channelCount, m_warnInvalid);
         return new ImageBlock(m_pixelFormat,
             Vector2i(m_blockSize),
             m_sensor->getFilm()->getReconstructionFilter(),
@@ -77,8 +95,24 @@ public:
         block->setOffset(rect->getOffset());
         block->setSize(rect->getSize());
         m_hilbertCurve.initialize(TVector2<uint8_t>(rect->getSize()));
-        m_integrator->renderBlock(m_scene, m_sensor, m_sampler,
-            block, stop, m_hilbertCurve.getPoints());
+
+        if (m_masked) {
+            /* Only visit the pixels that are active in this pass */
+            const AdaptiveWorkUnit *awu = static_cast<const AdaptiveWorkUnit *>(rect);
+            const std::vector<TPoint2<uint8_t> > &points = m_hilbertCurve.getPoints();
+            m_activePoints.clear();
+            for (size_t i=0; i<points.size(); ++i) {
+                if (awu->isActive(points[i].x, points[i].y))
+                    m_activePoints.push_back(points[i]);
+            }
+            if (m_statChannels > 0)
+                static_cast<AdaptiveWorkResult *>(block)->clearStatistics();
+            m_integrator->renderBlock(m_scene, m_sensor, m_sampler,
+                block, stop, m_activePoints);
+        } else {
+            m_integrator->renderBlock(m_scene, m_sensor, m_sampler,
+                block, stop, m_hilbertCurve.getPoints());
+        }
 
 #ifdef MTS_DEBUG_FP
         disableFPExceptions();
@@ -91,11 +125,13 @@ public:
         stream->writeInt(m_blockSize);
         stream->writeInt(m_borderSize);
         stream->writeBool(m_warnInvalid);
+        stream->writeInt(m_statChannels);
+        stream->writeBool(m_masked);
     }
 
     ref<WorkProcessor> clone() const {
         return new BlockRenderer(m_pixelFormat, m_channelCount,
-            m_blockSize, m_borderSize, m_warnInvalid);
+            m_blockSize, m_borderSize, m_warnInvalid, m_statChannels, m_masked);
     }
 
     MTS_DECLARE_CLASS()
@@ -111,16 +147,24 @@ private:
     int m_blockSize;
     int m_borderSize;
     bool m_warnInvalid;
+    int m_statChannels;
+    bool m_masked;
     HilbertCurve2D<uint8_t> m_hilbertCurve;
+    std::vector<TPoint2<uint8_t> > m_activePoints;
 };
 
 BlockedRenderProcess::BlockedRenderProcess(const RenderJob *parent, RenderQueue *queue,
-        int blockSize) : m_queue(queue), m_parent(parent), m_resultCount(0), m_progress(NULL) {
+        int blockSize) : m_queue(queue), m_parent(parent), m_resultCount(0), m_progress(NULL),
+        m_sceneBlockOrder(ESpiralOrder), m_blockCostPixels(0) {
     m_blockSize = blockSize;
     m_resultMutex = new Mutex();
     m_pixelFormat = Bitmap::ESpectrumAlphaWeight;
     m_channelCount = -1;
     m_warnInvalid = true;
+
+    /* Interactive previews preempt concurrently running batch renders */
+    if (parent && parent->isInteractive())
+        setPriority(1);
 }
 
 BlockedRenderProcess::~BlockedRenderProcess() {
@@ -141,22 +185,74 @@ ref<WorkProcessor> BlockedRenderProcess::createWorkProcessor() const {
 
 void BlockedRenderProcess::processResult(const WorkResult *result, bool cancelled) {
     const ImageBlock *block = static_cast<const ImageBlock *>(result);
+    Vector2i index = (block->getOffset() - m_offset) / m_blockSize;
     UniqueLock lock(m_resultMutex);
     m_film->put(block);
-    m_progress->update(++m_resultCount);
+
+    /* Split blocks are complete once all of their parts have arrived */
+    int &pixelsLeft = m_blockPixelsLeft[index.x + index.y * m_numBlocks.x];
+    if (cancelled)
+        pixelsLeft = -1;
+    else if (pixelsLeft > 0 && (pixelsLeft -= block->getSize().x * block->getSize().y) == 0)
+        m_film->setBlockComplete(m_offset + index * m_blockSize, getFullBlockSize(index));
+    m_progress->update(m_resultCount += getProgressUnits(block->getSize()));
     lock.unlock();
     m_queue->signalWorkEnd(m_parent, block, cancelled);
 }
 
 ParallelProcess::EStatus BlockedRenderProcess::generateWork(WorkUnit *unit, int worker) {
-    EStatus status = BlockedImageProcess::generateWork(unit, worker);
+    EStatus status;
+    while ((status = BlockedImageProcess::generateWork(unit, worker)) == ESuccess) {
+        RectangularWorkUnit *rect = static_cast<RectangularWorkUnit *>(unit);
+        Vector2i index = (rect->getOffset() - m_offset) / m_blockSize;
+
+        /* Skip blocks that were restored from a checkpoint */
+        LockGuard lock(m_resultMutex);
+        if (!m_film->isBlockComplete(m_offset + index * m_blockSize, getFullBlockSize(index)))
+            break;
+        m_progress->update(m_resultCount += getProgressUnits(rect->getSize()));
+    }
     if (status == ESuccess)
         m_queue->signalWorkBegin(m_parent, static_cast<RectangularWorkUnit *>(unit), worker);
     return status;
 }
 
+bool BlockedRenderProcess::isTelemetryEnabled() const {
+    return m_blockCosts.get() || m_splitting ||
+        (m_parent && m_parent->isTelemetryEnabled());
+}
+
+void BlockedRenderProcess::recordTelemetry(const WorkResult *result,
+        const WorkUnitTelemetry &telemetry) {
+    if (!result->getClass()->derivesFrom(MTS_CLASS(ImageBlock)))
+        return;
+    const ImageBlock *block = static_cast<const ImageBlock *>(result);
+    size_t pixels = (size_t) block->getSize().x * (size_t) block->getSize().y;
+
+    if (m_splitting)
+        recordThroughput(telemetry.workerIndex, pixels,
+            telemetry.generated, telemetry.finished);
+
+    if (m_blockCosts) {
+        /* Remember how long the block took for the next rendering */
+        Vector2i index = (block->getOffset() - m_offset) / m_blockSize;
+        LockGuard lock(m_resultMutex);
+        m_blockCosts->getFloat32Data()[index.x + index.y * m_numBlocks.x] +=
+            (float) (telemetry.finished - telemetry.started);
+        m_blockCostPixels += pixels;
+        if (m_blockCostPixels == (size_t) m_size.x * (size_t) m_size.y)
+            m_film->setBlockCosts(m_blockCosts);
+    }
+
+    if (m_parent && m_parent->isTelemetryEnabled())
+        m_parent->recordTelemetry(telemetry, block->getOffset(), block->getSize());
+}
+
 void BlockedRenderProcess::bindResource(const std::string &name, int id) {
-    if (name == "sensor") {
+    if (name == "scene") {
+        m_sceneBlockOrder = static_cast<Scene *>(Scheduler::getInstance()
+            ->getResource(id))->getBlockOrder();
+    } else if (name == "sensor") {
         m_film = static_cast<Sensor *>(Scheduler::getInstance()->getResource(id))->getFilm();
         m_borderSize = m_film->getReconstructionFilter()->getBorderSize();
 
@@ -174,13 +270,365 @@ void BlockedRenderProcess::bindResource(const std::string &name, int id) {
             Log(EError, "The block size must be larger than the image reconstruction filter radius!");
 
         BlockedImageProcess::init(offset, size, m_blockSize);
+        setBlockOrder(m_sceneBlockOrder, m_film->getBlockCosts());
+        if (m_sceneBlockOrder == ECostOrder) {
+            m_blockCosts = new Bitmap(Bitmap::ELuminance, Bitmap::EFloat32, m_numBlocks);
+            m_blockCosts->clear();
+            m_blockCostPixels = 0;
+        }
+
+        m_blockPixelsLeft.resize(m_numBlocksTotal);
+        for (int y=0; y<m_numBlocks.y; ++y) {
+            for (int x=0; x<m_numBlocks.x; ++x) {
+                Vector2i blockSize = getFullBlockSize(Vector2i(x, y));
+                m_blockPixelsLeft[x + y * m_numBlocks.x] = blockSize.x * blockSize.y;
+            }
+        }
+
         if (m_progress)
             delete m_progress;
-        m_progress = new ProgressReporter("Rendering", m_numBlocksTotal, m_parent);
+        m_progress = new ProgressReporter("Rendering", m_splitting ?
+            (long long) m_size.x * m_size.y : m_numBlocksTotal, m_parent);
     }
     BlockedImageProcess::bindResource(name, id);
 }
 
+/* ==================================================================== */
+/*                      Progressive adaptive rendering                  */
+/* ==================================================================== */
+
+AdaptiveWorkResult::AdaptiveWorkResult(Bitmap::EPixelFormat fmt,
+        const Vector2i &size, const ReconstructionFilter *filter,
+        int statChannels, int channels, bool warn)
+    : ImageBlock(fmt, size, filter, channels, warn), m_statChannels(statChannels) {
+    m_statistics = new Bitmap(Bitmap::EMultiChannel, Bitmap::EFloat64,
+        size, statChannels);
+    m_statistics->clear();
+}
+
+void AdaptiveWorkResult::load(Stream *stream) {
+    ImageBlock::load(stream);
+    stream->readDoubleArray(m_statistics->getFloat64Data(),
+        m_statistics->getPixelCount() * m_statChannels);
+}
+
+void AdaptiveWorkResult::save(Stream *stream) const {
+    ImageBlock::save(stream);
+    stream->writeDoubleArray(m_statistics->getFloat64Data(),
+        m_statistics->getPixelCount() * m_statChannels);
+}
+
+AdaptiveRenderProcess::AdaptiveRenderProcess(const RenderJob *parent,
+        RenderQueue *queue, int blockSize, int pass, int statChannels,
+        Bitmap *statistics, const ErrorFunction &error)
+    : BlockedRenderProcess(parent, queue, blockSize), m_blockIndex(0),
+      m_activePixels(0), m_statistics(statistics), m_error(error),
+      m_pass(pass), m_statChannels(statChannels) {
+}
+
+ref<WorkProcessor> AdaptiveRenderProcess::createWorkProcessor() const {
+    return new BlockRenderer(m_pixelFormat, m_channelCount,
+            m_blockSize, m_borderSize, m_warnInvalid, m_statChannels);
+}
+
+void AdaptiveRenderProcess::bindResource(const std::string &name, int id) {
+    BlockedRenderProcess::bindResource(name, id);
+    if (name == "sensor") {
+        if (!m_statistics) {
+            m_statistics = new Bitmap(Bitmap::EMultiChannel,
+                Bitmap::EFloat64, m_size, m_statChannels);
+            m_statistics->clear();
+        } else if (m_statistics->getSize() != m_size ||
+                   m_statistics->getChannelCount() != m_statChannels) {
+            Log(EError, "The statistics buffer does not match the image size!");
+        }
+        planBlocks();
+
+        if (m_progress)
+            delete m_progress;
+        m_progress = new ProgressReporter(formatString("Rendering (pass %i)",
+            m_pass + 1), m_blocks.size(), m_parent);
+    }
+}
+
+void AdaptiveRenderProcess::planBlocks() {
+    const double *stats = m_statistics->getFloat64Data();
+    int width = m_size.x;
+
+    m_blocks.clear();
+    m_blockIndex = m_activePixels = 0;
+    for (int by=0; by<m_numBlocks.y; ++by) {
+        for (int bx=0; bx<m_numBlocks.x; ++bx) {
+            Block block;
+            Point2i rel(bx * m_blockSize, by * m_blockSize);
+            block.offset = m_offset + Vector2i(rel);
+            block.size = Vector2i(
+                std::min(m_blockSize, m_size.x - rel.x),
+                std::min(m_blockSize, m_size.y - rel.y));
+            block.mask.resize((size_t) block.size.x * (size_t) block.size.y);
+            block.error = 0;
+
+            size_t active = 0;
+            for (int y=0; y<block.size.y; ++y) {
+                for (int x=0; x<block.size.x; ++x) {
+                    Float error = std::numeric_limits<Float>::infinity();
+                    if (m_pass > 0)
+                        error = m_error(stats + ((rel.y + y) * (size_t) width
+                            + rel.x + x) * m_statChannels);
+                    bool isActive = !(error <= 1);
+                    block.mask[x + y * block.size.x] = isActive ? 1 : 0;
+                    if (isActive) {
+                        ++active;
+                        block.error += std::isfinite(error) ? error : 1;
+                    }
+                }
+            }
+
+            if (active > 0) {
+                m_activePixels += active;
+                m_blocks.push_back(block);
+            }
+        }
+    }
+
+    /* Hand out the blocks with the largest remaining error first */
+    std::stable_sort(m_blocks.begin(), m_blocks.end());
+}
+
+ParallelProcess::EStatus AdaptiveRenderProcess::generateWork(WorkUnit *unit, int worker) {
+    if (m_blockIndex >= m_blocks.size())
+        return EFailure;
+
+    const Block &block = m_blocks[m_blockIndex++];
+    AdaptiveWorkUnit *awu = static_cast<AdaptiveWorkUnit *>(unit);
+    awu->setOffset(block.offset);
+    awu->setSize(block.size);
+    awu->setMask(block.mask);
+    m_queue->signalWorkBegin(m_parent, awu, worker);
+    return ESuccess;
+}
+
+void AdaptiveRenderProcess::processResult(const WorkResult *wr, bool cancelled) {
+    const AdaptiveWorkResult *result = static_cast<const AdaptiveWorkResult *>(wr);
+    UniqueLock lock(m_resultMutex);
+    m_film->put(result);
+
+    /* Accumulate the statistics into the shared buffer */
+    Vector2i rel = result->getOffset() - m_offset;
+    const Vector2i &size = result->getSize();
+    double *stats = m_statistics->getFloat64Data();
+    for (int y=0; y<size.y; ++y) {
+        double *target = stats + ((rel.y + y) * (size_t) m_size.x + rel.x) * m_statChannels;
+        for (int x=0; x<size.x; ++x) {
+            const double *source = result->getStatistics(x, y);
+            for (int c=0; c<m_statChannels; ++c)
+                *target++ += source[c];
+        }
+    }
+
+    m_progress->update(++m_resultCount);
+    lock.unlock();
+    m_queue->signalWorkEnd(m_parent, result, cancelled);
+}
+
+bool AdaptiveRenderProcess::render(SamplingIntegrator *integrator,
+        ref<ParallelProcess> &process, Scene *scene, RenderQueue *queue,
+        const RenderJob *job, int sceneResID, int sensorResID,
+        int samplerResID, int statChannels, int maxPasses,
+        const ErrorFunction &error, ref<Bitmap> *statistics) {
+    ref<Scheduler> sched = Scheduler::getInstance();
+    ref<Sensor> sensor = static_cast<Sensor *>(sched->getResource(sensorResID));
+    ref<Film> film = sensor->getFilm();
+
+    size_t nCores = sched->getCoreCount();
+    const Sampler *sampler = static_cast<const Sampler *>(sched->getResource(samplerResID, 0));
+    size_t sampleCount = sampler->getSampleCount();
+
+    Log(EInfo, "Starting progressive adaptive render job (%ix%i, " SIZE_T_FMT
+        " %s per pass, " SIZE_T_FMT " %s, " SSE_STR ") ..", film->getCropSize().x,
+        film->getCropSize().y, sampleCount, sampleCount == 1 ? "sample" : "samples",
+        nCores, nCores == 1 ? "core" : "cores");
+
+    int integratorResID = sched->registerResource(integrator);
+    ref<Bitmap> buffer;
+    bool success = true;
+
+    for (int pass=0; maxPasses < 0 || pass < maxPasses; ++pass) {
+        ref<AdaptiveRenderProcess> proc = new AdaptiveRenderProcess(job,
+            queue, scene->getBlockSize(), pass, statChannels, buffer, error);
+        proc->bindResource("integrator", integratorResID);
+        proc->bindResource("scene", sceneResID);
+        proc->bindResource("sensor", sensorResID);
+        proc->bindResource("sampler", samplerResID);
+        scene->bindUsedResources(proc);
+        integrator->bindUsedResources(proc);
+        buffer = proc->getStatistics();
+
+        if (proc->getActivePixelCount() == 0) {
+            Log(EInfo, "All pixels have converged after %i passes", pass);
+            break;
+        }
+
+        Log(EInfo, "Pass %i: " SIZE_T_FMT " unconverged pixels in "
+            SIZE_T_FMT " blocks", pass + 1, proc->getActivePixelCount(),
+            proc->getBlockCount());
+
+        sched->schedule(proc);
+        process = proc;
+        sched->wait(proc);
+        process = NULL;
+
+        if (proc->getReturnStatus() != ParallelProcess::ESuccess) {
+            success = false;
+            break;
+        }
+    }
+
+    sched->unregisterResource(integratorResID);
+    if (statistics)
+        *statistics = buffer;
+
+    return success;
+}
+
+/* ==================================================================== */
+/*                     Coarse-to-fine progressive rendering             */
+/* ==================================================================== */
+
+ProgressiveRenderProcess::ProgressiveRenderProcess(const RenderJob *parent,
+        RenderQueue *queue, int blockSize, int stride, int coarsestStride)
+    : BlockedRenderProcess(parent, queue, blockSize), m_stride(stride),
+      m_coarsestStride(coarsestStride) {
+}
+
+ref<WorkProcessor> ProgressiveRenderProcess::createWorkProcessor() const {
+    return new BlockRenderer(m_pixelFormat, m_channelCount,
+            m_blockSize, m_borderSize, m_warnInvalid, 0, true);
+}
+
+void ProgressiveRenderProcess::bindResource(const std::string &name, int id) {
+    BlockedRenderProcess::bindResource(name, id);
+    if (name == "sensor") {
+        int pass = 1, passCount = 1;
+        for (int stride = m_coarsestStride; stride > 1; stride /= 2) {
+            if (stride > m_stride)
+                ++pass;
+            ++passCount;
+        }
+
+        if (m_progress)
+            delete m_progress;
+        m_progress = new ProgressReporter(formatString("Rendering (pass %i/%i)",
+            pass, passCount), m_numBlocksTotal, m_parent);
+    }
+}
+
+ParallelProcess::EStatus ProgressiveRenderProcess::generateWork(WorkUnit *unit, int worker) {
+    AdaptiveWorkUnit *awu = static_cast<AdaptiveWorkUnit *>(unit);
+    std::vector<uint8_t> mask;
+    EStatus status;
+
+    while ((status = BlockedImageProcess::generateWork(unit, worker)) == ESuccess) {
+        const Point2i &offset = awu->getOffset();
+        const Vector2i &size = awu->getSize();
+        Vector2i rel = offset - m_offset;
+
+        /* Skip blocks that were restored from a checkpoint */
+        UniqueLock lock(m_resultMutex);
+        if (m_film->isBlockComplete(offset, size)) {
+            m_progress->update(++m_resultCount);
+            continue;
+        }
+        lock.unlock();
+
+        mask.resize((size_t) size.x * (size_t) size.y);
+        bool empty = true;
+        for (int y=0; y<size.y; ++y) {
+            for (int x=0; x<size.x; ++x) {
+                bool active = isActive(rel.x + x, rel.y + y);
+                mask[x + y * size.x] = active ? 1 : 0;
+                empty &= !active;
+            }
+        }
+
+        if (!empty)
+            break;
+
+        /* Blocks that are smaller than the stride may not contain any pixels */
+        lock.lock();
+        m_progress->update(++m_resultCount);
+    }
+
+    if (status == ESuccess) {
+        awu->setMask(mask);
+        m_queue->signalWorkBegin(m_parent, awu, worker);
+    }
+    return status;
+}
+
+void ProgressiveRenderProcess::processResult(const WorkResult *result, bool cancelled) {
+    const ImageBlock *block = static_cast<const ImageBlock *>(result);
+    UniqueLock lock(m_resultMutex);
+    m_film->put(block);
+
+    /* Only the final pass leaves a block in its finished state */
+    if (!cancelled && m_stride == 1)
+        m_film->setBlockComplete(block->getOffset(), block->getSize());
+    m_progress->update(++m_resultCount);
+    lock.unlock();
+    m_queue->signalWorkEnd(m_parent, block, cancelled);
+}
+
+bool ProgressiveRenderProcess::render(SamplingIntegrator *integrator,
+        ref<ParallelProcess> &process, Scene *scene, RenderQueue *queue,
+        const RenderJob *job, int sceneResID, int sensorResID,
+        int samplerResID, int levels) {
+    ref<Scheduler> sched = Scheduler::getInstance();
+    ref<Sensor> sensor = static_cast<Sensor *>(sched->getResource(sensorResID));
+    ref<Film> film = sensor->getFilm();
+
+    size_t nCores = sched->getCoreCount();
+    const Sampler *sampler = static_cast<const Sampler *>(sched->getResource(samplerResID, 0));
+    size_t sampleCount = sampler->getSampleCount();
+
+    Log(EInfo, "Starting progressive render job (%ix%i, " SIZE_T_FMT " %s, %i passes, "
+        SIZE_T_FMT " %s, " SSE_STR ") ..", film->getCropSize().x,
+        film->getCropSize().y, sampleCount, sampleCount == 1 ? "sample" : "samples",
+        levels + 1, nCores, nCores == 1 ? "core" : "cores");
+
+    int integratorResID = sched->registerResource(integrator);
+    int coarsestStride = 1 << levels;
+    bool success = true;
+
+    for (int pass=0; pass<=levels; ++pass) {
+        ref<ProgressiveRenderProcess> proc = new ProgressiveRenderProcess(job,
+            queue, scene->getBlockSize(), coarsestStride >> pass, coarsestStride);
+        proc->bindResource("integrator", integratorResID);
+        proc->bindResource("scene", sceneResID);
+        proc->bindResource("sensor", sensorResID);
+        proc->bindResource("sampler", samplerResID);
+        scene->bindUsedResources(proc);
+        integrator->bindUsedResources(proc);
+
+        sched->schedule(proc);
+        process = proc;
+        sched->wait(proc);
+        process = NULL;
+
+        if (proc->getReturnStatus() != ParallelProcess::ESuccess) {
+            success = false;
+            break;
+        }
+    }
+
+    sched->unregisterResource(integratorResID);
+
+    return success;
+}
+
 MTS_IMPLEMENT_CLASS(BlockedRenderProcess, false, BlockedImageProcess)
+MTS_IMPLEMENT_CLASS(AdaptiveRenderProcess, false, BlockedRenderProcess)
+MTS_IMPLEMENT_CLASS(ProgressiveRenderProcess, false, BlockedRenderProcess)
+MTS_IMPLEMENT_CLASS(AdaptiveWorkResult, false, ImageBlock)
 MTS_IMPLEMENT_CLASS_S(BlockRenderer, false, WorkProcessor)
 MTS_NAMESPACE_END
@@ -130,8 +130,12 @@ void RenderQueue::signalWorkCanceled(const RenderJob *job, const Point2i &offset
 
 void RenderQueue::signalFinishJob(const RenderJob *job, bool cancelled) {
     LockGuard lock(m_mutex);
-    for (size_t i=0; i<m_listeners.size(); ++i)
-        m_listeners[i]->finishJobEvent(job, cancelled);
+    /* Iterate over a copy, since one-shot listeners may unregister
+       themselves from within this callback */
+    std::vector<ref<RenderListener> > listeners(
+        m_listeners.begin(), m_listeners.end());
+    for (size_t i=0; i<listeners.size(); ++i)
+        listeners[i]->finishJobEvent(job, cancelled);
 }
 
 void RenderQueue::signalRefresh(const RenderJob *job) {
@@ -79,6 +79,16 @@ void Sampler::request2DArray(size_t size) {
     m_sampleArrays2D.push_back(new Point2[m_sampleCount * size]);
 }
 
+void Sampler::next1DBlock(Float *dest, size_t count) {
+    for (size_t i=0; i<count; ++i)
+        dest[i] = next1D();
+}
+
+void Sampler::next2DBlock(Point2 *dest, size_t count) {
+    for (size_t i=0; i<count; ++i)
+        dest[i] = next2D();
+}
+
 Point2 *Sampler::next2DArray(size_t size) {
     Assert(m_sampleIndex < m_sampleCount);
     if (m_dimension2DArray < m_req2D.size()) {
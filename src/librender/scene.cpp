@@ -20,9 +20,17 @@
 #include <mitsuba/render/renderjob.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/timer.h>
 
 #define DEFAULT_BLOCKSIZE 32
 
+/// Identifier and version of scene snapshot files
+#define MTS_SNAPSHOT_ID "MTSSNAP"
+#define MTS_SNAPSHOT_VERSION 1
+
 MTS_NAMESPACE_BEGIN
 
 // ===========================================================================
@@ -30,14 +38,19 @@ MTS_NAMESPACE_BEGIN
 // ===========================================================================
 
 Scene::Scene()
- : NetworkedObject(Properties()), m_blockSize(DEFAULT_BLOCKSIZE) {
+ : NetworkedObject(Properties()), m_blockSize(DEFAULT_BLOCKSIZE),
+   m_blockOrder(BlockedImageProcess::ESpiralOrder), m_dirty(0) {
     m_kdtree = new ShapeKDTree();
     m_sourceFile = new fs::path();
     m_destinationFile = new fs::path();
 }
 
 Scene::Scene(const Properties &props)
- : NetworkedObject(props), m_blockSize(DEFAULT_BLOCKSIZE) {
+ : NetworkedObject(props), m_blockSize(DEFAULT_BLOCKSIZE), m_dirty(0) {
+    /* Order in which image blocks are handed out: "spiral", "hilbert"
+       or "cost" (most expensive blocks of the previous rendering first) */
+    m_blockOrder = BlockedImageProcess::parseBlockOrder(
+        props.getString("blockOrder", "spiral"));
     m_kdtree = new ShapeKDTree();
     /* kd-tree construction: Enable primitive clipping? Generally leads to a
       significant improvement of the resulting tree. */
@@ -66,6 +79,11 @@ Scene::Scene(const Properties &props)
        O(n log n) SAH-based optimization method. */
     if (props.hasProperty("kdExactPrimitiveThreshold"))
         m_kdtree->setExactPrimitiveThreshold(props.getInteger("kdExactPrimitiveThreshold"));
+    /* kd-tree construction: Scratch memory budget of the builder in MiB
+       (0 = unlimited). Large scenes then use Min-Max binning for
+       bigger subtrees before switching to the O(n log n) method. */
+    if (props.hasProperty("kdMaxBuildMemory"))
+        m_kdtree->setMaxBuildMemory((size_t) props.getSize("kdMaxBuildMemory") * 1024 * 1024);
     /* kd-tree construction: use multiple processors? */
     if (props.hasProperty("kdParallelBuild"))
         m_kdtree->setParallelBuild(props.getBoolean("kdParallelBuild"));
@@ -76,13 +94,28 @@ Scene::Scene(const Properties &props)
        in succession before a leaf node will be created.*/
     if (props.hasProperty("kdMaxBadRefines"))
         m_kdtree->setMaxBadRefines(props.getInteger("kdMaxBadRefines"));
+    /* kd-tree construction: Directory for caching built trees on disk, so
+       that renders of the same geometry don't have to rebuild them */
+    if (props.hasProperty("kdCacheDirectory"))
+        m_kdtree->setCacheDirectory(props.getString("kdCacheDirectory"));
+    /* Strategy for choosing an emitter in direct illumination sampling:
+       "discrete" picks emitters proportionally to their sampling weights,
+       "bvh" uses a hierarchy that accounts for the reference point */
+    std::string emitterSampling = props.getString("emitterSampling", "discrete");
+    if (emitterSampling == "bvh")
+        m_emitterBVH = new EmitterBVH();
+    else if (emitterSampling != "discrete")
+        Log(EError, "Unknown emitter sampling strategy \"%s\" -- must be "
+            "\"discrete\" or \"bvh\"", emitterSampling.c_str());
     m_sourceFile = new fs::path();
     m_destinationFile = new fs::path();
 }
 
 Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
     m_kdtree = scene->m_kdtree;
+    m_subsetKDTrees = scene->m_subsetKDTrees;
     m_blockSize = scene->m_blockSize;
+    m_blockOrder = scene->m_blockOrder;
     m_aabb = scene->m_aabb;
     m_environmentEmitter = scene->m_environmentEmitter;
     m_sensor = scene->m_sensor;
@@ -90,6 +123,7 @@ Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
     m_sourceFile = new fs::path(*scene->m_sourceFile);
     m_destinationFile = new fs::path(*scene->m_destinationFile);
     m_emitterPDF = scene->m_emitterPDF;
+    m_emitterBVH = scene->m_emitterBVH;
     m_shapes = scene->m_shapes;
     m_sensors = scene->m_sensors;
     m_meshes = scene->m_meshes;
@@ -101,10 +135,11 @@ Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
     m_specialShapes = scene->m_specialShapes;
     m_degenerateSensor = scene->m_degenerateSensor;
     m_degenerateEmitters = scene->m_degenerateEmitters;
+    m_dirty = scene->m_dirty;
 }
 
 Scene::Scene(Stream *stream, InstanceManager *manager)
- : NetworkedObject(stream, manager) {
+ : NetworkedObject(stream, manager), m_dirty(0) {
     m_kdtree = new ShapeKDTree();
     m_kdtree->setQueryCost(stream->readFloat());
     m_kdtree->setTraversalCost(stream->readFloat());
@@ -113,10 +148,13 @@ Scene::Scene(Stream *stream, InstanceManager *manager)
     m_kdtree->setClip(stream->readBool());
     m_kdtree->setMaxDepth(stream->readUInt());
     m_kdtree->setExactPrimitiveThreshold(stream->readUInt());
+    m_kdtree->setMaxBuildMemory(stream->readSize());
     m_kdtree->setParallelBuild(stream->readBool());
     m_kdtree->setRetract(stream->readBool());
     m_kdtree->setMaxBadRefines(stream->readUInt());
+    m_kdtree->setCacheDirectory(stream->readString());
     m_blockSize = stream->readUInt();
+    m_blockOrder = (BlockedImageProcess::EBlockOrder) stream->readInt();
     m_degenerateSensor = stream->readBool();
     m_degenerateEmitters = stream->readBool();
     m_aabb = AABB(stream);
@@ -160,6 +198,8 @@ Scene::Scene(Stream *stream, InstanceManager *manager)
     m_netObjects.reserve(count);
     for (size_t i=0; i<count; ++i)
         m_netObjects.push_back(static_cast<NetworkedObject *>(manager->getInstance(stream)));
+    if (stream->readBool())
+        m_emitterBVH = new EmitterBVH();
 
     initialize();
 }
@@ -179,10 +219,13 @@ void Scene::serialize(Stream *stream, InstanceManager *manager) const {
     stream->writeBool(m_kdtree->getClip());
     stream->writeUInt(m_kdtree->getMaxDepth());
     stream->writeUInt(m_kdtree->getExactPrimitiveThreshold());
+    stream->writeSize(m_kdtree->getMaxBuildMemory());
     stream->writeBool(m_kdtree->getParallelBuild());
     stream->writeBool(m_kdtree->getRetract());
     stream->writeUInt(m_kdtree->getMaxBadRefines());
+    stream->writeString(m_kdtree->getCacheDirectory().string());
     stream->writeUInt(m_blockSize);
+    stream->writeInt(m_blockOrder);
     stream->writeBool(m_degenerateSensor);
     stream->writeBool(m_degenerateEmitters);
     m_aabb.serialize(stream);
@@ -229,6 +272,74 @@ void Scene::serialize(Stream *stream, InstanceManager *manager) const {
     for (ref_vector<NetworkedObject>::const_iterator it = m_netObjects.begin();
             it != m_netObjects.end(); ++it)
         manager->serialize(stream, it->get());
+    stream->writeBool(m_emitterBVH.get() != NULL);
+}
+
+void Scene::saveSnapshot(const fs::path &filename) const {
+    if (!m_integrator || !m_sensor)
+        Log(EError, "saveSnapshot(): the scene must be configured first!");
+
+    ref<Timer> timer = new Timer();
+    ref<FileStream> stream = new FileStream(filename, FileStream::ETruncWrite);
+    stream->setByteOrder(Stream::ELittleEndian);
+    stream->write(MTS_SNAPSHOT_ID, 7);
+    stream->writeUInt(MTS_SNAPSHOT_VERSION);
+
+    /* The receiving side needs these to look up classes by name */
+    std::vector<std::string> plugins =
+        PluginManager::getInstance()->getLoadedPlugins();
+    stream->writeSize(plugins.size());
+    for (size_t i=0; i<plugins.size(); ++i)
+        stream->writeString(plugins[i]);
+
+    ref<InstanceManager> manager = new InstanceManager();
+    manager->serialize(stream, this);
+    manager->serialize(stream, m_integrator.get());
+    manager->serialize(stream, m_sensor.get());
+    stream->close();
+
+    Log(EInfo, "Wrote a scene snapshot to \"%s\" (%s, took %i ms)",
+        filename.string().c_str(), memString(fs::file_size(filename)).c_str(),
+        timer->getMilliseconds());
+}
+
+bool Scene::isSnapshot(const fs::path &filename) {
+    if (!fs::is_regular_file(filename) || fs::file_size(filename) < 7)
+        return false;
+    char id[7];
+    ref<FileStream> stream = new FileStream(filename, FileStream::EReadOnly);
+    stream->read(id, 7);
+    return memcmp(id, MTS_SNAPSHOT_ID, 7) == 0;
+}
+
+ref<Scene> Scene::loadSnapshot(const fs::path &filename) {
+    ref<Timer> timer = new Timer();
+    ref<MemoryMappedFile> mmap = new MemoryMappedFile(filename);
+    ref<MemoryStream> ms = new MemoryStream(mmap->getData(), mmap->getSize());
+    ms->setByteOrder(Stream::ELittleEndian);
+
+    char id[7];
+    ms->read(id, 7);
+    if (memcmp(id, MTS_SNAPSHOT_ID, 7) != 0)
+        SLog(EError, "\"%s\" is not a scene snapshot!", filename.string().c_str());
+    uint32_t version = ms->readUInt();
+    if (version != MTS_SNAPSHOT_VERSION)
+        SLog(EError, "\"%s\": unsupported scene snapshot version %i!",
+            filename.string().c_str(), version);
+
+    size_t pluginCount = ms->readSize();
+    for (size_t i=0; i<pluginCount; ++i)
+        PluginManager::getInstance()->ensurePluginLoaded(ms->readString());
+
+    ref<InstanceManager> manager = new InstanceManager();
+    ref<Scene> scene = static_cast<Scene *>(manager->getInstance(ms));
+    scene->setIntegrator(static_cast<Integrator *>(manager->getInstance(ms)));
+    scene->setSensor(static_cast<Sensor *>(manager->getInstance(ms)));
+    scene->configure();
+
+    SLog(EInfo, "Loaded the scene snapshot \"%s\" in %i ms",
+        filename.string().c_str(), timer->getMilliseconds());
+    return scene;
 }
 
 // ===========================================================================
@@ -316,10 +427,49 @@ void Scene::configure() {
 }
 
 void Scene::invalidate() {
+    fs::path cacheDirectory = m_kdtree->getCacheDirectory();
     m_kdtree = new ShapeKDTree();
+    m_kdtree->setCacheDirectory(cacheDirectory);
+    m_subsetKDTrees.clear();
+    m_dirty = (m_dirty & ~EGeometryDirty) | ESubsurfaceDirty;
+}
+
+void Scene::reuseKDTree(const Scene *scene) {
+    m_kdtreeCandidate = const_cast<ShapeKDTree *>(scene->getKDTree());
+}
+
+void Scene::addShapeSubset(const std::vector<Shape *> &shapes) {
+    for (size_t i=0; i<m_subsetKDTrees.size(); ++i) {
+        if (m_subsetKDTrees[i].first == &shapes)
+            return;
+    }
+
+    /* Only worthwhile when the subset leaves out a part of the scene. Compound
+       shapes were expanded when building the scene's kd-tree, hence the
+       dedicated tree could not reproduce its intersections */
+    if (shapes.empty() || shapes.size() >= m_kdtree->getShapes().size())
+        return;
+    for (size_t i=0; i<shapes.size(); ++i) {
+        if (shapes[i]->isCompound())
+            return;
+    }
+
+    ref<ShapeKDTree> kdtree = new ShapeKDTree();
+    kdtree->setLogLevel(EDebug);
+    for (size_t i=0; i<shapes.size(); ++i)
+        kdtree->addShape(shapes[i]);
+    kdtree->build();
+
+    m_subsetKDTrees.push_back(ShapeSubset(&shapes, kdtree));
 }
 
 void Scene::initialize() {
+    if (m_dirty & EGeometryDirty) {
+        if (m_kdtree->isBuilt())
+            invalidate();
+        m_dirty |= ESubsurfaceDirty;
+    }
+
     if (!m_kdtree->isBuilt()) {
         /* Expand all geometry */
         ref_vector<Shape> temp;
@@ -341,8 +491,15 @@ void Scene::initialize() {
                 SIZE_T_FMT ".", primitiveCount, effPrimitiveCount);
         }
 
-        /* Build the kd-tree */
-        m_kdtree->build();
+        /* Build the kd-tree (unless an identical one is available) */
+        if (m_kdtreeCandidate && m_kdtreeCandidate->isBuilt() &&
+                m_kdtreeCandidate->getShapes() == m_kdtree->getShapes()) {
+            Log(EInfo, "Reusing the kd-tree of a previously loaded scene");
+            m_kdtree = m_kdtreeCandidate;
+        } else {
+            m_kdtree->build();
+        }
+        m_kdtreeCandidate = NULL;
 
         m_aabb = m_kdtree->getAABB();
     }
@@ -354,6 +511,15 @@ void Scene::initialize() {
     m_objects.ensureUnique();
     m_netObjects.ensureUnique();
 
+    if (m_dirty & EEmittersDirty) {
+        /* Rebuilt below. Don't touch the hierarchy that shallow
+           clones may still share */
+        m_emitterPDF.clear();
+        if (m_emitterBVH.get())
+            m_emitterBVH = new EmitterBVH();
+        m_dirty |= ESubsurfaceDirty;
+    }
+
     if (!m_emitterPDF.isNormalized()) {
         if (m_emitters.size() == 0) {
             Log(EWarn, "No emitters found -- adding sun & sky.");
@@ -378,9 +544,85 @@ void Scene::initialize() {
             m_emitterPDF.append(it->get()->getSamplingWeight());
 
         m_emitterPDF.normalize();
+
+        /* Constant-time selection among many emitters (e.g. instanced lights) */
+        if (m_emitterPDF.size() >= 256)
+            m_emitterPDF.buildAliasTable();
+    }
+
+    if (m_emitterBVH.get() && !m_emitterBVH->isBuilt())
+        m_emitterBVH->build(m_emitters);
+
+    if (m_dirty & ESubsurfaceDirty) {
+        for (ref_vector<Subsurface>::iterator it = m_ssIntegrators.begin();
+                it != m_ssIntegrators.end(); ++it)
+            (*it)->invalidate();
     }
 
     initializeBidirectional();
+    m_dirty = 0;
+}
+
+void Scene::updateEmitters() {
+    m_emitterPDF.clear();
+    for (ref_vector<Emitter>::iterator it = m_emitters.begin();
+            it != m_emitters.end(); ++it)
+        m_emitterPDF.append(it->get()->getSamplingWeight());
+    m_emitterPDF.normalize();
+    if (m_emitterPDF.size() >= 256)
+        m_emitterPDF.buildAliasTable();
+
+    /* Don't touch the hierarchy that shallow clones may still share */
+    if (m_emitterBVH.get()) {
+        m_emitterBVH = new EmitterBVH();
+        m_emitterBVH->build(m_emitters);
+    }
+
+    initializeBidirectional();
+
+    /* Subsurface models pick up the new lighting in preprocess() */
+    m_dirty = (m_dirty & ~EEmittersDirty) | ESubsurfaceDirty;
+}
+
+void Scene::replaceObject(ConfigurableObject *original,
+        ConfigurableObject *replacement) {
+    const Class *cClass = original->getClass();
+    bool isBSDF = cClass->derivesFrom(MTS_CLASS(BSDF)),
+         isSubsurface = cClass->derivesFrom(MTS_CLASS(Subsurface));
+
+    if (!isBSDF && !isSubsurface)
+        Log(EError, "replaceObject(): only BSDFs and subsurface scattering "
+            "models can be replaced!");
+    const Class *rClass = replacement->getClass();
+    if ((isBSDF && !rClass->derivesFrom(MTS_CLASS(BSDF))) ||
+        (isSubsurface && !rClass->derivesFrom(MTS_CLASS(Subsurface))))
+        Log(EError, "replaceObject(): the replacement is of a different kind!");
+
+    size_t count = 0;
+    for (ref_vector<Shape>::iterator it = m_shapes.begin();
+            it != m_shapes.end(); ++it) {
+        Shape *shape = it->get();
+        if (isBSDF && shape->getBSDF() == original) {
+            shape->setBSDF(static_cast<BSDF *>(replacement));
+            ++count;
+        } else if (isSubsurface && shape->getSubsurface() == original) {
+            Subsurface *subsurface = static_cast<Subsurface *>(replacement);
+            shape->setSubsurface(subsurface);
+            subsurface->setParent(shape);
+            ++count;
+        }
+    }
+
+    if (count == 0)
+        Log(EWarn, "replaceObject(): \"%s\" is not referenced by any shape!",
+            original->toString().c_str());
+
+    std::replace(m_objects.begin(), m_objects.end(),
+        ref<ConfigurableObject>(original), ref<ConfigurableObject>(replacement));
+    if (isSubsurface)
+        std::replace(m_ssIntegrators.begin(), m_ssIntegrators.end(),
+            ref<Subsurface>(static_cast<Subsurface *>(original)),
+            ref<Subsurface>(static_cast<Subsurface *>(replacement)));
 }
 
 void Scene::initializeBidirectional() {
@@ -456,7 +698,9 @@ void Scene::cancel() {
 }
 
 void Scene::flush(RenderQueue *queue, const RenderJob *job) {
-    m_sensor->getFilm()->develop(this, queue->getRenderTime(job));
+    /* Intermediate results are written in the background, since the render
+       queue is locked while this function runs */
+    m_sensor->getFilm()->developAsync(this, queue->getRenderTime(job));
 }
 
 void Scene::setDestinationFile(const fs::path &name) {
@@ -618,6 +862,13 @@ static StatsCounter mediumInconsistencies("General", "Detected medium inconsiste
 
 Spectrum Scene::evalTransmittance(const Point &p1, bool p1OnSurface, const Point &p2, bool p2OnSurface,
         Float time, const Medium *medium, int &interactions, Sampler *sampler) const {
+    return evalTransmittanceImpl(p1, p1OnSurface, p2, p2OnSurface, time,
+        medium, interactions, sampler, false);
+}
+
+Spectrum Scene::evalTransmittanceImpl(const Point &p1, bool p1OnSurface, const Point &p2, bool p2OnSurface,
+        Float time, const Medium *medium, int &interactions, Sampler *sampler,
+        bool specialShapes, const Emitter *emitter) const {
     Vector d = p2 - p1;
     Float remaining = d.length();
     d /= remaining;
@@ -625,13 +876,34 @@ Spectrum Scene::evalTransmittance(const Point &p1, bool p1OnSurface, const Point
     Float lengthFactor = p2OnSurface ? (1-ShadowEpsilon) : 1;
     Ray ray(p1, d, p1OnSurface ? Epsilon : 0, remaining * lengthFactor, time);
     Spectrum transmittance(1.0f);
+    uint8_t temp[MTS_KD_INTERSECTION_TEMP];
     Intersection its;
     int maxInteractions = interactions;
     interactions = 0;
 
     while (remaining > 0) {
-        Normal n;
-        bool surface = rayIntersect(ray, its.t, its.shape, its.geoFrame.n, its.uv);
+        /* Only determine the distance, shape and orientation of the
+           next interface -- the normal and UV coordinates are rarely needed */
+        Float cosTheta = 0;
+        bool surface = m_kdtree->rayIntersectInterface(ray, its.t, its.shape, cosTheta, temp);
+        bool complete = false;
+
+        if (specialShapes && !m_specialShapes.empty()) {
+            Float mint = ShapeKDTree::getAdaptiveRayMinT(ray),
+                  maxt = surface ? its.t : ray.maxt, tempT;
+            uint8_t buffer[MTS_KD_INTERSECTION_TEMP];
+
+            for (size_t i=0; i<m_specialShapes.size(); ++i) {
+                const Shape *shape = m_specialShapes[i].get();
+                if (shape->rayIntersect(ray, mint, maxt, tempT, buffer)) {
+                    its.t = maxt = tempT;
+                    its.shape = shape;
+                    shape->fillIntersectionRecord(ray, buffer, its);
+                    cosTheta = dot(its.geoFrame.n, ray.d);
+                    surface = complete = true;
+                }
+            }
+        }
 
         if (surface && (interactions == maxInteractions ||
             !(its.getBSDF()->getType() & BSDF::ENull))) {
@@ -639,7 +911,10 @@ Spectrum Scene::evalTransmittance(const Point &p1, bool p1OnSurface, const Point
             return Spectrum(0.0f);
         }
 
-        if (medium)
+        if (medium && emitter)
+            transmittance *= medium->evalEmitterTransmittance(
+                Ray(ray, 0, std::min(its.t, remaining)), emitter, sampler);
+        else if (medium)
             transmittance *= medium->evalTransmittance(
                 Ray(ray, 0, std::min(its.t, remaining)), sampler);
 
@@ -653,24 +928,31 @@ Spectrum Scene::evalTransmittance(const Point &p1, bool p1OnSurface, const Point
 
         const BSDF *bsdf = its.getBSDF();
 
-        its.p = ray.o;
-        its.geoFrame = Frame(its.geoFrame.n);
-        its.hasUVPartials = false;
-        Vector wo = its.geoFrame.toLocal(ray.d);
-        BSDFSamplingRecord bRec(its, -wo, wo, ERadiance);
-        bRec.typeMask = BSDF::ENull;
-        transmittance *= bsdf->eval(bRec, EDiscrete);
+        /* A pure null BSDF (e.g. an index-matched medium boundary)
+           transmits everything and doesn't need to be evaluated */
+        if ((bsdf->getType() & BSDF::EAll) != BSDF::ENull) {
+            if (!complete)
+                m_kdtree->fillInterfaceRecord(ray, its.t, temp, its.geoFrame.n, its.uv);
+            its.p = ray.o;
+            its.geoFrame = Frame(its.geoFrame.n);
+            its.hasUVPartials = false;
+            Vector wo = its.geoFrame.toLocal(ray.d);
+            BSDFSamplingRecord bRec(its, -wo, wo, ERadiance);
+            bRec.typeMask = BSDF::ENull;
+            transmittance *= bsdf->eval(bRec, EDiscrete);
+        }
 
         if (its.isMediumTransition()) {
-            if (medium != its.getTargetMedium(-d)) {
+            if (medium != its.getTargetMedium(-cosTheta)) {
                 ++mediumInconsistencies;
                 return Spectrum(0.0f);
             }
-            medium = its.getTargetMedium(d);
+            medium = its.getTargetMedium(cosTheta);
         }
 
         if (++interactions > 100) { /// Just a precaution..
-            Log(EWarn, "evalTransmittance(): round-off error issues?");
+            Log(EWarn, "%s(): round-off error issues?", specialShapes
+                ? "evalTransmittanceAll" : "evalTransmittance");
             break;
         }
 
@@ -687,6 +969,31 @@ Spectrum Scene::evalTransmittance(const Point &p1, bool p1OnSurface, const Point
 //             Ray tracing support for bidirectional algorithms
 // ===========================================================================
 
+void Scene::rayIntersectFullyOutwards(const Ray &ray, Float tCenter,
+        std::vector<Intersection> &its,
+        const ShapeKDTree::IntersectionStopFunc &stop,
+        const std::vector<Shape *> *shapes) const {
+    tCenter = std::min(std::max(tCenter, ray.mint), ray.maxt);
+
+    const ShapeKDTree *kdtree = selectKDTree(shapes);
+
+    /* Forward half */
+    kdtree->rayIntersectFully(Ray(ray, tCenter, ray.maxt), its, stop, shapes);
+
+    /* Backward half: trace the reversed ray, so that the kd-tree also
+     * visits these leaves starting from tCenter */
+    size_t firstBackward = its.size();
+    Ray reversed(ray.o, -ray.d, -tCenter, -ray.mint, ray.time);
+    kdtree->rayIntersectFully(reversed, its, stop, shapes);
+
+    /* Express the backward intersections with respect to the original
+     * ray (wi = toLocal(-ray.d) is linear in the ray direction) */
+    for (size_t i = firstBackward; i < its.size(); i++) {
+        its[i].t = -its[i].t;
+        its[i].wi = -its[i].wi;
+    }
+}
+
 bool Scene::rayIntersectAll(const Ray &ray) const {
     if (rayIntersect(ray))
         return true;
@@ -766,83 +1073,32 @@ bool Scene::rayIntersectAll(const Ray &ray, Intersection &its) const {
 
 Spectrum Scene::evalTransmittanceAll(const Point &p1, bool p1OnSurface, const Point &p2, bool p2OnSurface,
         Float time, const Medium *medium, int &interactions, Sampler *sampler) const {
-    Vector d = p2 - p1;
-    Float remaining = d.length();
-    d /= remaining;
-
-    Float lengthFactor = p2OnSurface ? (1-ShadowEpsilon) : 1;
-    Ray ray(p1, d, p1OnSurface ? Epsilon : 0, remaining * lengthFactor, time);
-    Spectrum transmittance(1.0f);
-    Intersection its;
-    int maxInteractions = interactions;
-    interactions = 0;
-
-    while (remaining > 0) {
-        Normal n;
-        bool surface = rayIntersectAll(ray, its.t, its.shape, its.geoFrame.n, its.uv);
-
-        if (surface && (interactions == maxInteractions ||
-            !(its.getBSDF()->getType() & BSDF::ENull))) {
-            /* Encountered an occluder -- zero transmittance. */
-            return Spectrum(0.0f);
-        }
-
-        if (medium)
-            transmittance *= medium->evalTransmittance(
-                Ray(ray, 0, std::min(its.t, remaining)), sampler);
-
-        if (!surface || transmittance.isZero())
-            break;
-
-       /* SSS models are assumed to be opaque (even when they have a null 
-        * BSDF */
-       if (its.hasSubsurface())
-           return Spectrum(0.0f);
-
-        const BSDF *bsdf = its.getBSDF();
-
-        its.p = ray.o;
-        its.geoFrame = Frame(its.geoFrame.n);
-        its.hasUVPartials = false;
-        Vector wo = its.geoFrame.toLocal(ray.d);
-        BSDFSamplingRecord bRec(its, -wo, wo, ERadiance);
-        bRec.typeMask = BSDF::ENull;
-        transmittance *= bsdf->eval(bRec, EDiscrete);
-
-        if (its.isMediumTransition()) {
-            if (medium != its.getTargetMedium(-d)) {
-                ++mediumInconsistencies;
-                return Spectrum(0.0f);
-            }
-            medium = its.getTargetMedium(d);
-        }
-
-        if (++interactions > 100) { /// Just a precaution..
-            Log(EWarn, "evalTransmittanceAll(): round-off error issues?");
-            break;
-        }
-
-        ray.o = ray(its.t);
-        remaining -= its.t;
-        ray.maxt = remaining * lengthFactor;
-        ray.mint = Epsilon;
-    }
-
-    return transmittance;
+    return evalTransmittanceImpl(p1, p1OnSurface, p2, p2OnSurface, time,
+        medium, interactions, sampler, true);
 }
 
 // ===========================================================================
 //                Emission and direct illumination sampling
 // ===========================================================================
 
+const Emitter *Scene::sampleDirectEmitter(const DirectSamplingRecord &dRec,
+        Float &sample, Float &pdf) const {
+    if (m_emitterBVH.get())
+        return m_emitterBVH->sampleReuse(dRec.ref, dRec.refN, sample, pdf);
+
+    size_t index = m_emitterPDF.sampleReuse(sample, pdf);
+    return m_emitters[index].get();
+}
+
 Spectrum Scene::sampleEmitterDirect(DirectSamplingRecord &dRec,
         const Point2 &_sample, bool testVisibility) const {
     Point2 sample(_sample);
 
     /* Randomly pick an emitter */
     Float emPdf;
-    size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
-    const Emitter *emitter = m_emitters[index].get();
+    const Emitter *emitter = sampleDirectEmitter(dRec, sample.x, emPdf);
+    if (!emitter)
+        return Spectrum(0.0f);
     Spectrum value = emitter->sampleDirect(dRec, sample);
 
     if (dRec.pdf != 0) {
@@ -867,14 +1123,15 @@ Spectrum Scene::sampleAttenuatedEmitterDirect(DirectSamplingRecord &dRec,
 
     /* Randomly pick an emitter */
     Float emPdf;
-    size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
-    const Emitter *emitter = m_emitters[index].get();
+    const Emitter *emitter = sampleDirectEmitter(dRec, sample.x, emPdf);
+    if (!emitter)
+        return Spectrum(0.0f);
     Spectrum value = emitter->sampleDirect(dRec, sample);
 
     if (dRec.pdf != 0) {
-        value *= evalTransmittance(dRec.ref, false,
+        value *= evalTransmittanceImpl(dRec.ref, false,
             dRec.p, emitter->isOnSurface(), dRec.time, medium,
-            interactions, sampler) / emPdf;
+            interactions, sampler, false, emitter) / emPdf;
         dRec.object = emitter;
         dRec.pdf *= emPdf;
         return value;
@@ -890,15 +1147,16 @@ Spectrum Scene::sampleAttenuatedEmitterDirect(DirectSamplingRecord &dRec,
 
     /* Randomly pick an emitter */
     Float emPdf;
-    size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
-    const Emitter *emitter = m_emitters[index].get();
+    const Emitter *emitter = sampleDirectEmitter(dRec, sample.x, emPdf);
+    if (!emitter)
+        return Spectrum(0.0f);
     Spectrum value = emitter->sampleDirect(dRec, sample);
 
     if (dRec.pdf != 0) {
         if (its.shape && its.isMediumTransition())
             medium = its.getTargetMedium(dRec.d);
-        value *= evalTransmittance(its.p, true, dRec.p, emitter->isOnSurface(),
-                dRec.time, medium, interactions, sampler) / emPdf;
+        value *= evalTransmittanceImpl(its.p, true, dRec.p, emitter->isOnSurface(),
+                dRec.time, medium, interactions, sampler, false, emitter) / emPdf;
         dRec.object = emitter;
         dRec.pdf *= emPdf;
         return value;
@@ -958,6 +1216,8 @@ Spectrum Scene::sampleAttenuatedSensorDirect(DirectSamplingRecord &dRec,
 
 Float Scene::pdfEmitterDirect(const DirectSamplingRecord &dRec) const {
     const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
+    if (m_emitterBVH.get())
+        return emitter->pdfDirect(dRec) * m_emitterBVH->pdf(dRec.ref, dRec.refN, emitter);
     return emitter->pdfDirect(dRec) * pdfEmitterDiscrete(emitter);
 }
 
@@ -30,6 +30,7 @@
 #include <xercesc/sax/Locator.hpp>
 #include <mitsuba/render/scenehandler.h>
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/lock.h>
 #include <mitsuba/render/scene.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/unordered_set.hpp>
@@ -49,11 +50,119 @@ typedef void (*CleanupFun) ();
 typedef boost::unordered_set<CleanupFun> CleanupSet;
 static PrimitiveThreadLocal<CleanupSet> __cleanup_tls;
 
+/// Number of loader threads, -1 means "one per core"
+static int __loaderThreadCount = -1;
+
+/// Call the cleanup handlers that were pushed by the calling thread
+static void runCleanupHandlers() {
+    CleanupSet &cleanup = __cleanup_tls.get();
+    for (CleanupSet::iterator it = cleanup.begin();
+            it != cleanup.end(); ++it)
+        (*it)();
+    cleanup.clear();
+}
+
+/**
+ * Shape, texture or volume whose construction and configuration is deferred
+ * to a loader thread. All of its children have been resolved beforehand.
+ */
+struct SceneHandler::LoadTask : public Object {
+    const Class *classType;
+    Properties props;
+    std::vector<std::pair<std::string, ConfigurableObject *> > children;
+    ref<FileResolver> resolver;
+    /// Location in the scene file, used as a prefix for messages
+    std::string location;
+    std::string id;
+    /// Add the result to the object cache?
+    bool cache;
+    SceneObjectCache::ChildList cacheChildren;
+    ref_vector<ConfigurableObject> cacheRefs;
+
+    /// Created object and its expanded version (for textures)
+    ref<ConfigurableObject> object, expanded;
+    std::string error;
+    bool started, done, resolved;
+
+    LoadTask() : cache(false), started(false), done(false), resolved(false) { }
+
+    void run() {
+        try {
+            object = PluginManager::getInstance()->createObject(classType, props);
+            for (size_t i=0; i<children.size(); ++i) {
+                if (children[i].second == NULL)
+                    continue;
+                object->addChild(children[i].first, children[i].second);
+                children[i].second->setParent(object);
+            }
+            releaseChildren();
+            object->configure();
+            expanded = object;
+            if (object->getClass()->derivesFrom(MTS_CLASS(Texture)))
+                expanded = static_cast<Texture *>(object.get())->expand();
+        } catch (const std::exception &ex) {
+            error = ex.what();
+            object = expanded = NULL;
+        }
+    }
+
+    void releaseChildren() {
+        for (size_t i=0; i<children.size(); ++i) {
+            if (children[i].second != NULL)
+                children[i].second->decRef();
+        }
+        children.clear();
+    }
+
+protected:
+    virtual ~LoadTask() {
+        releaseChildren();
+    }
+};
+
+class SceneHandler::LoaderThread : public Thread {
+public:
+    LoaderThread(SceneHandler *handler, int index)
+        : Thread(formatString("load%i", index)), m_handler(handler) { }
+
+    void run() {
+        while (true) {
+            ref<LoadTask> task;
+            {
+                LockGuard lock(m_handler->m_loadMutex);
+                while (m_handler->m_loadQueue.empty() && !m_handler->m_loadQuit)
+                    m_handler->m_loadCond->wait();
+                if (m_handler->m_loadQuit)
+                    break;
+                task = m_handler->m_loadQueue.front();
+                m_handler->m_loadQueue.pop_front();
+                task->started = true;
+            }
+
+            setFileResolver(task->resolver);
+            task->run();
+
+            LockGuard lock(m_handler->m_loadMutex);
+            task->done = true;
+            m_handler->m_loadCond->broadcast();
+        }
+
+        /* Release the caches of the loaded plugins on this thread */
+        runCleanupHandlers();
+    }
+
+private:
+    SceneHandler *m_handler;
+};
+
 SceneHandler::SceneHandler(const ParameterMap &params,
     NamedObjectMap *namedObjects, bool isIncludedFile) : m_params(params),
         m_namedObjects(namedObjects), m_isIncludedFile(isIncludedFile) {
     m_pluginManager = PluginManager::getInstance();
     m_locator = NULL;
+    m_loadMutex = new Mutex();
+    m_loadCond = new ConditionVariable(m_loadMutex);
+    m_loadQuit = false;
 
     if (m_isIncludedFile) {
         SAssert(namedObjects != NULL);
@@ -111,6 +220,7 @@ SceneHandler::SceneHandler(const ParameterMap &params,
 }
 
 SceneHandler::~SceneHandler() {
+    stopLoaderThreads();
     delete m_transcoder;
     clear();
     if (!m_isIncludedFile)
@@ -163,13 +273,87 @@ void SceneHandler::startDocument() {
 
 void SceneHandler::endDocument() {
     SAssert(m_scene != NULL);
+    SAssert(m_pendingObjects.empty());
 
     /* Call cleanup handlers */
-    CleanupSet &cleanup = __cleanup_tls.get();
-    for (CleanupSet::iterator it = cleanup.begin();
-            it != cleanup.end(); ++it)
-        (*it)();
-    cleanup.clear();
+    stopLoaderThreads();
+    runCleanupHandlers();
+
+    if (m_objectCache && !m_isIncludedFile)
+        m_objectCache->purge();
+}
+
+void SceneHandler::stopLoaderThreads() {
+    {
+        LockGuard lock(m_loadMutex);
+        m_loadQuit = true;
+        m_loadQueue.clear();
+        m_loadCond->broadcast();
+    }
+    for (size_t i=0; i<m_loaderThreads.size(); ++i)
+        m_loaderThreads[i]->join();
+    m_loaderThreads.clear();
+    m_pendingObjects.clear();
+    m_loadQuit = false;
+}
+
+void SceneHandler::runTask(LoadTask *task) {
+    task->run();
+    LockGuard lock(m_loadMutex);
+    task->done = true;
+}
+
+ConfigurableObject *SceneHandler::resolve(LoadTask *task) {
+    if (task->resolved)
+        return task->object;
+
+    bool runHere = false;
+    {
+        LockGuard lock(m_loadMutex);
+        if (!task->started) {
+            /* Not picked up by a loader thread yet -- don't wait for it */
+            m_loadQueue.erase(std::find(m_loadQueue.begin(), m_loadQueue.end(), task));
+            task->started = runHere = true;
+        } else {
+            while (!task->done)
+                m_loadCond->wait();
+        }
+    }
+    if (runHere)
+        runTask(task);
+
+    task->resolved = true;
+    if (!task->id.empty())
+        m_pendingObjects.erase(task->id);
+
+    if (!task->error.empty())
+        SLog(EError, "%sError while creating object: %s",
+            task->location.c_str(), task->error.c_str());
+
+    std::vector<std::string> unq = task->props.getUnqueried();
+    for (unsigned int i=0; i<unq.size(); ++i)
+        SLog(EWarn, "%sUnqueried attribute \"%s\"", task->location.c_str(), unq[i].c_str());
+
+    if (!task->id.empty()) {
+        (*m_namedObjects)[task->id] = task->expanded;
+        task->expanded->incRef();
+    }
+
+    if (task->cache) {
+        m_objectCache->put(task->classType, task->props, task->cacheChildren,
+            task->object, task->expanded);
+        task->cacheChildren.clear();
+        task->cacheRefs.clear();
+    }
+    return task->object;
+}
+
+void SceneHandler::setLoaderThreadCount(int count) {
+    __loaderThreadCount = count;
+}
+
+int SceneHandler::getLoaderThreadCount() {
+    return __loaderThreadCount < 0 ? getCoreCount() : __loaderThreadCount;
 }
 
 void SceneHandler::characters(const XMLCh* const name,
@@ -273,12 +457,20 @@ void pushSceneCleanupHandler(void (*cleanup)()) {
 void SceneHandler::endElement(const XMLCh* const xmlName) {
     std::string name = transcode(xmlName);
     ParseContext &context = m_context.top();
+
+    /* Join deferred children before this object is created and configured */
+    for (size_t i=0; i<context.pending.size(); ++i) {
+        ConfigurableObject *child = resolve(context.pending[i].second);
+        child->incRef();
+        context.children[context.pending[i].first].second = child;
+    }
+    context.pending.clear();
     std::string type = boost::to_lower_copy(context.attributes["type"]);
     context.properties.setPluginName(type);
     if (context.attributes.find("id") != context.attributes.end())
         context.properties.setID(context.attributes["id"]);
 
-    ref<ConfigurableObject> object;
+    ref<ConfigurableObject> object, expanded;
 
     TagMap::const_iterator it = m_tags.find(name);
     if (it == m_tags.end())
@@ -286,6 +478,10 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
 
     const TagEntry &tag = it->second;
 
+    /* Shapes, textures, volumes and BSDFs may be reused (see SceneObjectCache) */
+    bool cacheable = m_objectCache && (tag.first == EShape || tag.first == ETexture
+        || tag.first == EVolume || tag.first == EBSDF), cached = false;
+
     switch (tag.first) {
         case EScene:
             object = m_scene = new Scene(context.properties);
@@ -297,6 +493,8 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
 
         case EReference: {
                 std::string id = context.attributes["id"];
+                if (m_pendingObjects.find(id) != m_pendingObjects.end())
+                    resolve(m_pendingObjects[id]);
                 if (m_namedObjects->find(id) == m_namedObjects->end())
                     XMLLog(EError, "Referenced object '%s' not found!", id.c_str());
                 object = (*m_namedObjects)[id];
@@ -645,10 +843,13 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
 
         case EAlias: {
                 std::string id = context.attributes["id"], as = context.attributes["as"];
+                if (m_pendingObjects.find(id) != m_pendingObjects.end())
+                    resolve(m_pendingObjects[id]);
                 if (m_namedObjects->find(id) == m_namedObjects->end())
                     XMLLog(EError, "Referenced object '%s' not found!", id.c_str());
                 ConfigurableObject *obj = (*m_namedObjects)[id];
-                if (m_namedObjects->find(as) != m_namedObjects->end())
+                if (m_namedObjects->find(as) != m_namedObjects->end() ||
+                    m_pendingObjects.find(as) != m_pendingObjects.end())
                     XMLLog(EError, "Duplicate ID '%s' used in scene description!", id.c_str());
                 obj->incRef();
                 (*m_namedObjects)[as] = obj;
@@ -668,6 +869,7 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
 
                 /* Set the handler and start parsing */
                 SceneHandler *handler = new SceneHandler(m_params, m_namedObjects, true);
+                handler->setObjectCache(m_objectCache);
                 parser->setDoNamespaces(true);
                 parser->setDocumentHandler(handler);
                 parser->setErrorHandler(handler);
@@ -738,6 +940,64 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
                         object->addChild(shapeGroup);
 
                     }
+                    cacheable = false;
+                } else if (cacheable && (object = m_objectCache->get(tag.second,
+                        props, context.children, expanded)) != NULL) {
+                    /* Unchanged since the previously loaded scene */
+                    for (size_t i=0; i<context.children.size(); ++i) {
+                        if (context.children[i].second != NULL)
+                            context.children[i].second->decRef();
+                    }
+                    context.children.clear();
+                    std::vector<std::string> names = props.getPropertyNames();
+                    for (size_t i=0; i<names.size(); ++i)
+                        props.markQueried(names[i]);
+                    cached = true;
+                } else if ((tag.first == EShape || tag.first == ETexture || tag.first == EVolume)
+                        && getLoaderThreadCount() > 1) {
+                    /* Instantiate the object on a loader thread. It is joined
+                       before its parent or a reference to it is processed */
+                    std::string id = context.attributes["id"];
+                    if (id != "" && (m_namedObjects->find(id) != m_namedObjects->end() ||
+                            m_pendingObjects.find(id) != m_pendingObjects.end()))
+                        XMLLog(EError, "Duplicate ID '%s' used in scene description!", id.c_str());
+
+                    ref<LoadTask> task = new LoadTask();
+                    task->classType = tag.second;
+                    task->props = props;
+                    if (cacheable) {
+                        /* Added to the cache once the object has been resolved */
+                        task->cache = true;
+                        task->cacheChildren = context.children;
+                        for (size_t i=0; i<context.children.size(); ++i)
+                            task->cacheRefs.push_back(context.children[i].second);
+                    }
+                    task->children.swap(context.children);
+                    task->resolver = Thread::getThread()->getFileResolver()->clone();
+                    task->location = formatString("In file \"%s\" (near line %i): ",
+                        m_locator ? transcode(m_locator->getSystemId()).c_str() : "<unknown>",
+                        m_locator ? (int) m_locator->getLineNumber() : -1);
+                    task->id = id;
+                    if (id != "")
+                        m_pendingObjects[id] = task;
+
+                    context.parent->pending.push_back(std::make_pair(
+                        context.parent->children.size(), task));
+                    context.parent->children.push_back(
+                        std::pair<std::string, ConfigurableObject *>(context.attributes["name"], NULL));
+
+                    LockGuard lock(m_loadMutex);
+                    if (m_loaderThreads.empty()) {
+                        for (int i=0; i<getLoaderThreadCount(); ++i) {
+                            m_loaderThreads.push_back(new LoaderThread(this, i));
+                            m_loaderThreads.back()->start();
+                        }
+                    }
+                    m_loadQueue.push_back(task);
+                    m_loadCond->signal();
+
+                    m_context.pop();
+                    return;
                 } else {
                     try {
                         object = m_pluginManager->createObject(tag.second, props);
@@ -753,7 +1013,23 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
         std::string id = context.attributes["id"];
         std::string nodeName = context.attributes["name"];
 
-        if (object) {
+        /* Keep the children alive until the object has been added to the cache */
+        SceneObjectCache::ChildList cacheChildren;
+        ref_vector<ConfigurableObject> cacheRefs;
+        if (cacheable && !cached) {
+            cacheChildren = context.children;
+            for (size_t i=0; i<cacheChildren.size(); ++i)
+                cacheRefs.push_back(cacheChildren[i].second);
+        }
+
+        if (cached) {
+            if (context.parent != NULL) {
+                object->incRef();
+                context.parent->children.push_back(
+                    std::pair<std::string, ConfigurableObject *>(nodeName, object));
+            }
+            object = expanded;
+        } else if (object) {
             /* If the object has a parent, add it to the parent's children list */
             if (context.parent != NULL) {
                 object->incRef();
@@ -776,12 +1052,18 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
             if (name != "include" && (!m_isIncludedFile || !object->getClass()->derivesFrom(MTS_CLASS(Scene))))
                 object->configure();
 
+            expanded = object;
             if (object->getClass()->derivesFrom(MTS_CLASS(Texture)))
-                object = static_cast<Texture *>(object.get())->expand();
+                expanded = static_cast<Texture *>(object.get())->expand();
+            if (cacheable)
+                m_objectCache->put(tag.second, context.properties,
+                    cacheChildren, object, expanded);
+            object = expanded;
         }
 
         if (id != "" && name != "ref") {
-            if (m_namedObjects->find(id) != m_namedObjects->end())
+            if (m_namedObjects->find(id) != m_namedObjects->end() ||
+                m_pendingObjects.find(id) != m_pendingObjects.end())
                 XMLLog(EError, "Duplicate ID '%s' used in scene description!", id.c_str());
             (*m_namedObjects)[id] = object;
             if (object)
@@ -894,6 +1176,149 @@ void SceneHandler::staticShutdown() {
     XMLPlatformUtils::Terminate();
 }
 
+// -----------------------------------------------------------------------
+//  Scene object cache
+// -----------------------------------------------------------------------
+
+SceneObjectCache::SceneObjectCache() : m_retainShared(false) {
+    m_mutex = new Mutex();
+}
+
+std::string SceneObjectCache::getKey(const Class *classType, const Properties &props) const {
+    /* The textual representation rounds floating point values,
+       hence matching entries are compared exactly afterwards */
+    return classType->getName() + ":" + props.toString();
+}
+
+std::string SceneObjectCache::getFileStamps(const Properties &props) const {
+    const FileResolver *resolver = Thread::getThread()->getFileResolver();
+    Properties temp(props); /* Don't mark anything as queried */
+    std::vector<std::string> names = temp.getPropertyNames();
+    std::ostringstream oss;
+
+    for (size_t i=0; i<names.size(); ++i) {
+        if (temp.getType(names[i]) != Properties::EString)
+            continue;
+        try {
+            fs::path path = resolver->resolve(temp.getString(names[i]));
+            if (!fs::is_regular_file(path))
+                continue;
+            oss << names[i] << ":" << fs::file_size(path) << ":"
+                << fs::last_write_time(path) << ";";
+        } catch (const std::exception &) {
+            /* Not a file name */
+        }
+    }
+    return oss.str();
+}
+
+ConfigurableObject *SceneObjectCache::get(const Class *classType, const Properties &props,
+        const ChildList &children, ref<ConfigurableObject> &expanded) {
+    LockGuard lock(m_mutex);
+    typedef std::multimap<std::string, Entry>::iterator Iterator;
+    std::pair<Iterator, Iterator> range = m_entries.equal_range(getKey(classType, props));
+    if (range.first == range.second)
+        return NULL;
+
+    std::string fileStamps = getFileStamps(props);
+    for (Iterator it = range.first; it != range.second; ++it) {
+        Entry &entry = it->second;
+        if (entry.props != props || entry.fileStamps != fileStamps
+                || entry.children.size() != children.size())
+            continue;
+
+        bool match = true;
+        for (size_t i=0; i<children.size() && match; ++i)
+            match = entry.children[i].first == children[i].first &&
+                    entry.children[i].second.get() == children[i].second;
+        if (!match)
+            continue;
+
+        entry.used = true;
+        expanded = entry.expanded;
+        return entry.object;
+    }
+    return NULL;
+}
+
+void SceneObjectCache::put(const Class *classType, const Properties &props,
+        const ChildList &children, ConfigurableObject *object,
+        ConfigurableObject *expanded) {
+    Entry entry;
+    entry.props = props;
+    for (size_t i=0; i<children.size(); ++i)
+        entry.children.push_back(std::make_pair(children[i].first,
+            ref<ConfigurableObject>(children[i].second)));
+    entry.fileStamps = getFileStamps(props);
+    entry.object = object;
+    entry.expanded = expanded;
+    entry.used = true;
+
+    LockGuard lock(m_mutex);
+    m_entries.insert(std::make_pair(getKey(classType, props), entry));
+}
+
+bool SceneObjectCache::isShared(const Entry &entry,
+        const std::map<const Object *, int> &cacheRefs) const {
+    const ConfigurableObject *objects[2] = { entry.object.get(), entry.expanded.get() };
+    for (int i=0; i<2; ++i) {
+        if (!objects[i] || (i == 1 && objects[1] == objects[0]))
+            continue;
+        std::map<const Object *, int>::const_iterator it = cacheRefs.find(objects[i]);
+        if (objects[i]->getRefCount() > (it != cacheRefs.end() ? it->second : 0))
+            return true;
+    }
+    return false;
+}
+
+void SceneObjectCache::purge() {
+    LockGuard lock(m_mutex);
+    typedef std::multimap<std::string, Entry>::iterator Iterator;
+    size_t removed = 0;
+    bool changed = true;
+
+    /* Releasing an entry may drop the last outside reference to one of
+       its children (e.g. a texture of a BSDF), hence repeat until nothing
+       changes when objects of other scenes are retained */
+    while (changed) {
+        changed = false;
+
+        std::map<const Object *, int> cacheRefs;
+        if (m_retainShared) {
+            for (Iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+                const Entry &entry = it->second;
+                cacheRefs[entry.object.get()]++;
+                if (entry.expanded.get())
+                    cacheRefs[entry.expanded.get()]++;
+                for (size_t i=0; i<entry.children.size(); ++i)
+                    cacheRefs[entry.children[i].second.get()]++;
+            }
+        }
+
+        for (Iterator it = m_entries.begin(); it != m_entries.end(); ) {
+            if (!it->second.used && !(m_retainShared && isShared(it->second, cacheRefs))) {
+                m_entries.erase(it++);
+                ++removed;
+                changed = m_retainShared;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    for (Iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+        it->second.used = false;
+
+    SLog(EDebug, "Scene object cache: keeping " SIZE_T_FMT " objects, released "
+        SIZE_T_FMT, m_entries.size(), removed);
+}
+
+size_t SceneObjectCache::getObjectCount() const {
+    LockGuard lock(m_mutex);
+    return m_entries.size();
+}
+
 VersionException::~VersionException() throw () {}
 
+MTS_IMPLEMENT_CLASS(SceneObjectCache, false, Object)
 MTS_NAMESPACE_END
@@ -36,6 +36,12 @@ Sensor::Sensor(const Properties &props)
 
     if (m_shutterOpenTime == 0)
         m_type |= EDeltaTime;
+
+    /* Number of precomputed time samples of an animated transformation */
+    m_motionSamples = props.getInteger("motionSamples", 0);
+    if (m_motionSamples < 0)
+        Log(EError, "The 'motionSamples' parameter must be nonnegative!");
+    precomputeWorldTransform();
 }
 
 Sensor::Sensor(Stream *stream, InstanceManager *manager)
@@ -44,6 +50,8 @@ Sensor::Sensor(Stream *stream, InstanceManager *manager)
     m_sampler = static_cast<Sampler *>(manager->getInstance(stream));
     m_shutterOpen = stream->readFloat();
     m_shutterOpenTime = stream->readFloat();
+    m_motionSamples = stream->readInt();
+    precomputeWorldTransform();
 }
 
 Sensor::~Sensor() {
@@ -55,6 +63,18 @@ void Sensor::serialize(Stream *stream, InstanceManager *manager) const {
     manager->serialize(stream, m_sampler.get());
     stream->writeFloat(m_shutterOpen);
     stream->writeFloat(m_shutterOpenTime);
+    stream->writeInt(m_motionSamples);
+}
+
+void Sensor::precomputeWorldTransform() {
+    if (m_motionSamples == 0 || m_shutterOpenTime == 0 ||
+        m_worldTransform->isStatic())
+        return;
+
+    ref<AnimatedTransform> trafo = new AnimatedTransform(m_worldTransform.get());
+    trafo->precompute(m_shutterOpen, m_shutterOpen + m_shutterOpenTime,
+        (size_t) m_motionSamples);
+    m_worldTransform = trafo;
 }
 
 void Sensor::setShutterOpenTime(Float time) {
@@ -215,6 +235,7 @@ void ProjectiveCamera::setWorldTransform(const Transform &trafo) {
 void ProjectiveCamera::setWorldTransform(AnimatedTransform *trafo) {
     m_worldTransform = trafo;
     m_properties.setAnimatedTransform("toWorld", trafo, false);
+    precomputeWorldTransform();
 }
 
 PerspectiveCamera::PerspectiveCamera(const Properties &props)
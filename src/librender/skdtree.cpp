@@ -23,6 +23,7 @@
 #include <mitsuba/core/sse.h>
 #include <mitsuba/core/aabb_sse.h>
 #include <mitsuba/render/triaccel_sse.h>
+#include <immintrin.h>
 #endif
 
 MTS_NAMESPACE_BEGIN
@@ -30,6 +31,10 @@ MTS_NAMESPACE_BEGIN
 ShapeKDTree::ShapeKDTree() {
 #if !defined(MTS_KD_CONSERVE_MEMORY)
     m_triAccel = NULL;
+#endif
+#if defined(MTS_SSE) && !defined(MTS_KD_CONSERVE_MEMORY)
+    m_triAccel8 = NULL;
+    m_leafShadowTest = NULL;
 #endif
     m_shapeMap.push_back(0);
 }
@@ -38,11 +43,39 @@ ShapeKDTree::~ShapeKDTree() {
 #if !defined(MTS_KD_CONSERVE_MEMORY)
     if (m_triAccel)
         freeAligned(m_triAccel);
+#endif
+#if defined(MTS_SSE) && !defined(MTS_KD_CONSERVE_MEMORY)
+    if (m_triAccel8)
+        freeAligned(m_triAccel8);
 #endif
     for (size_t i=0; i<m_shapes.size(); ++i)
         m_shapes[i]->decRef();
 }
 
+namespace {
+/// 64-bit FNV-1a hash, used to key the on-disk kd-tree cache
+class KDCacheKeyHash {
+public:
+    KDCacheKeyHash() : m_hash(0xcbf29ce484222325ULL) { }
+
+    void putBytes(const void *data, size_t size) {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; ++i) {
+            m_hash ^= bytes[i];
+            m_hash *= 0x100000001b3ULL;
+        }
+    }
+
+    template <typename T> void putValue(const T &value) {
+        putBytes(&value, sizeof(T));
+    }
+
+    inline uint64_t get() const { return m_hash; }
+private:
+    uint64_t m_hash;
+};
+}
+
 static StatsCounter raysTraced("General", "Normal rays traced");
 static StatsCounter shadowRaysTraced("General", "Shadow rays traced");
 
@@ -65,11 +98,64 @@ void ShapeKDTree::addShape(const Shape *shape) {
     m_shapes.push_back(shape);
 }
 
+uint64_t ShapeKDTree::getCacheKey() const {
+    KDCacheKeyHash hash;
+    hash.putValue((int) MTS_KD_CACHE_VERSION);
+    hash.putValue(sizeof(Float));
+    hash.putValue(m_traversalCost);
+    hash.putValue(m_queryCost);
+    hash.putValue(m_emptySpaceBonus);
+    hash.putValue(m_clip);
+    hash.putValue(m_retract);
+    hash.putValue(m_maxDepth);
+    hash.putValue(m_stopPrims);
+    hash.putValue(m_maxBadRefines);
+    hash.putValue(m_exactPrimThreshold);
+    hash.putValue(m_minMaxBins);
+
+    for (size_t i=0; i<m_shapes.size(); ++i) {
+        const Shape *shape = m_shapes[i];
+        if (m_triangleFlag[i]) {
+            const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+            hash.putValue(mesh->getTriangleCount());
+            hash.putBytes(mesh->getVertexPositions(),
+                    mesh->getVertexCount() * sizeof(Point));
+            if (mesh->getTriangles()) {
+                hash.putBytes(mesh->getTriangles(),
+                        mesh->getTriangleCount() * sizeof(Triangle));
+            } else {
+                for (size_t j=0; j<mesh->getTriangleCount(); ++j)
+                    hash.putValue(mesh->getTriangle(j));
+            }
+        } else {
+            /* Other shapes only enter the tree through their bounds */
+            const std::string &name = shape->getClass()->getName();
+            hash.putBytes(name.c_str(), name.length() + 1);
+            AABB aabb = shape->getAABB();
+            hash.putValue(aabb.min);
+            hash.putValue(aabb.max);
+        }
+    }
+    return hash.get();
+}
+
 void ShapeKDTree::build() {
     for (size_t i=1; i<m_shapeMap.size(); ++i)
         m_shapeMap[i] += m_shapeMap[i-1];
 
-    SAHKDTree3D<ShapeKDTree>::buildInternal();
+    fs::path cacheFile;
+    uint64_t cacheKey = 0;
+    if (!m_cacheDirectory.empty() && getPrimitiveCount() > 0) {
+        cacheKey = getCacheKey();
+        cacheFile = m_cacheDirectory / formatString("%016llx.kdtree",
+            (unsigned long long) cacheKey);
+    }
+
+    if (cacheFile.empty() || !loadCache(cacheFile, cacheKey)) {
+        SAHKDTree3D<ShapeKDTree>::buildInternal();
+        if (!cacheFile.empty())
+            saveCache(cacheFile, cacheKey);
+    }
 
 #if !defined(MTS_KD_CONSERVE_MEMORY)
     ref<Timer> timer = new Timer();
@@ -83,10 +169,9 @@ void ShapeKDTree::build() {
         const Shape *shape = m_shapes[i];
         if (m_triangleFlag[i]) {
             const TriMesh *mesh = static_cast<const TriMesh *>(shape);
-            const Triangle *triangles = mesh->getTriangles();
             const Point *positions = mesh->getVertexPositions();
             for (IndexType j=0; j<mesh->getTriangleCount(); ++j) {
-                const Triangle &tri = triangles[j];
+                const Triangle tri = mesh->getTriangle(j);
                 const Point &v0 = positions[tri.idx[0]];
                 const Point &v1 = positions[tri.idx[1]];
                 const Point &v2 = positions[tri.idx[2]];
@@ -104,11 +189,250 @@ void ShapeKDTree::build() {
         }
     }
     Log(EDebug, "Finished -- took %i ms.", timer->getMilliseconds());
-    Log(m_logLevel, "");
     KDAssert(idx == primCount);
 #endif
+#if defined(MTS_SSE) && !defined(MTS_KD_CONSERVE_MEMORY)
+    buildLeafGroups();
+#endif
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+    Log(m_logLevel, "");
+#endif
+}
+
+#if defined(MTS_SSE) && !defined(MTS_KD_CONSERVE_MEMORY)
+/* Select the ray coordinates along the projection axes u, v and k
+   of each triangle, see TriAccel::rayIntersect() */
+#define MTS_TRIACCEL_SELECT(sel, k0, k1, o, u, v, w) \
+    sel(k0, o##u, sel(k1, o##v, o##w))
+
+static inline __m128 select4(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/// Shadow ray test against a sequence of TriAccel8 groups using SSE
+static bool leafShadowTestSSE(const TriAccel8 *group,
+        const Ray &ray, Float mint, Float maxt) {
+    const __m128
+        ox = _mm_set1_ps(ray.o.x), oy = _mm_set1_ps(ray.o.y), oz = _mm_set1_ps(ray.o.z),
+        dx = _mm_set1_ps(ray.d.x), dy = _mm_set1_ps(ray.d.y), dz = _mm_set1_ps(ray.d.z),
+        zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f),
+        mint4 = _mm_set1_ps(mint), maxt4 = _mm_set1_ps(maxt);
+
+    while (true) {
+        for (int half=0; half<8; half += 4) {
+            const __m128 valid = _mm_load_ps((const float *) group->valid + half);
+            if (_mm_movemask_ps(valid) == 0)
+                break;
+
+            const __m128 k = _mm_load_ps(group->k + half),
+                k0 = _mm_cmpeq_ps(k, zero), k1 = _mm_cmpeq_ps(k, one);
+
+            const __m128
+                o_u = MTS_TRIACCEL_SELECT(select4, k0, k1, o, y, z, x),
+                o_v = MTS_TRIACCEL_SELECT(select4, k0, k1, o, z, x, y),
+                o_k = MTS_TRIACCEL_SELECT(select4, k0, k1, o, x, y, z),
+                d_u = MTS_TRIACCEL_SELECT(select4, k0, k1, d, y, z, x),
+                d_v = MTS_TRIACCEL_SELECT(select4, k0, k1, d, z, x, y),
+                d_k = MTS_TRIACCEL_SELECT(select4, k0, k1, d, x, y, z);
+
+            const __m128
+                n_u = _mm_load_ps(group->n_u + half),
+                n_v = _mm_load_ps(group->n_v + half),
+                n_d = _mm_load_ps(group->n_d + half);
+
+            const __m128 t = _mm_div_ps(
+                _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(n_d, _mm_mul_ps(o_u, n_u)),
+                    _mm_mul_ps(o_v, n_v)), o_k),
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(d_u, n_u), _mm_mul_ps(d_v, n_v)), d_k));
+
+            __m128 hit = _mm_and_ps(valid, _mm_and_ps(
+                _mm_cmpge_ps(t, mint4), _mm_cmple_ps(t, maxt4)));
+            if (_mm_movemask_ps(hit) == 0)
+                continue;
+
+            const __m128
+                hu = _mm_sub_ps(_mm_add_ps(o_u, _mm_mul_ps(t, d_u)), _mm_load_ps(group->a_u + half)),
+                hv = _mm_sub_ps(_mm_add_ps(o_v, _mm_mul_ps(t, d_v)), _mm_load_ps(group->a_v + half));
+
+            const __m128
+                u = _mm_add_ps(_mm_mul_ps(hv, _mm_load_ps(group->b_nu + half)),
+                               _mm_mul_ps(hu, _mm_load_ps(group->b_nv + half))),
+                v = _mm_add_ps(_mm_mul_ps(hu, _mm_load_ps(group->c_nu + half)),
+                               _mm_mul_ps(hv, _mm_load_ps(group->c_nv + half)));
+
+            hit = _mm_and_ps(hit, _mm_and_ps(
+                _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)),
+                _mm_cmple_ps(_mm_add_ps(u, v), one)));
+            if (_mm_movemask_ps(hit) != 0)
+                return true;
+        }
+        if (group->last)
+            return false;
+        ++group;
+    }
+}
+
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define MTS_HAS_AVX_KERNEL 1
+
+#if defined(__GNUC__)
+#define MTS_TARGET_AVX __attribute__((target("avx")))
+#else
+#define MTS_TARGET_AVX
+#endif
+
+static inline MTS_TARGET_AVX __m256 select8(__m256 mask, __m256 a, __m256 b) {
+    return _mm256_blendv_ps(b, a, mask);
 }
 
+/// Shadow ray test against a sequence of TriAccel8 groups using AVX
+static MTS_TARGET_AVX bool leafShadowTestAVX(const TriAccel8 *group,
+        const Ray &ray, Float mint, Float maxt) {
+    const __m256
+        ox = _mm256_set1_ps(ray.o.x), oy = _mm256_set1_ps(ray.o.y), oz = _mm256_set1_ps(ray.o.z),
+        dx = _mm256_set1_ps(ray.d.x), dy = _mm256_set1_ps(ray.d.y), dz = _mm256_set1_ps(ray.d.z),
+        zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f),
+        mint8 = _mm256_set1_ps(mint), maxt8 = _mm256_set1_ps(maxt);
+
+    while (true) {
+        const __m256 valid = _mm256_loadu_ps((const float *) group->valid);
+        const __m256 k = _mm256_loadu_ps(group->k),
+            k0 = _mm256_cmp_ps(k, zero, _CMP_EQ_OQ), k1 = _mm256_cmp_ps(k, one, _CMP_EQ_OQ);
+
+        const __m256
+            o_u = MTS_TRIACCEL_SELECT(select8, k0, k1, o, y, z, x),
+            o_v = MTS_TRIACCEL_SELECT(select8, k0, k1, o, z, x, y),
+            o_k = MTS_TRIACCEL_SELECT(select8, k0, k1, o, x, y, z),
+            d_u = MTS_TRIACCEL_SELECT(select8, k0, k1, d, y, z, x),
+            d_v = MTS_TRIACCEL_SELECT(select8, k0, k1, d, z, x, y),
+            d_k = MTS_TRIACCEL_SELECT(select8, k0, k1, d, x, y, z);
+
+        const __m256
+            n_u = _mm256_loadu_ps(group->n_u),
+            n_v = _mm256_loadu_ps(group->n_v),
+            n_d = _mm256_loadu_ps(group->n_d);
+
+        const __m256 t = _mm256_div_ps(
+            _mm256_sub_ps(_mm256_sub_ps(_mm256_sub_ps(n_d, _mm256_mul_ps(o_u, n_u)),
+                _mm256_mul_ps(o_v, n_v)), o_k),
+            _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d_u, n_u), _mm256_mul_ps(d_v, n_v)), d_k));
+
+        __m256 hit = _mm256_and_ps(valid, _mm256_and_ps(
+            _mm256_cmp_ps(t, mint8, _CMP_GE_OQ), _mm256_cmp_ps(t, maxt8, _CMP_LE_OQ)));
+
+        if (_mm256_movemask_ps(hit) != 0) {
+            const __m256
+                hu = _mm256_sub_ps(_mm256_add_ps(o_u, _mm256_mul_ps(t, d_u)), _mm256_loadu_ps(group->a_u)),
+                hv = _mm256_sub_ps(_mm256_add_ps(o_v, _mm256_mul_ps(t, d_v)), _mm256_loadu_ps(group->a_v));
+
+            const __m256
+                u = _mm256_add_ps(_mm256_mul_ps(hv, _mm256_loadu_ps(group->b_nu)),
+                                  _mm256_mul_ps(hu, _mm256_loadu_ps(group->b_nv))),
+                v = _mm256_add_ps(_mm256_mul_ps(hu, _mm256_loadu_ps(group->c_nu)),
+                                  _mm256_mul_ps(hv, _mm256_loadu_ps(group->c_nv)));
+
+            hit = _mm256_and_ps(hit, _mm256_and_ps(
+                _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, zero, _CMP_GE_OQ)),
+                _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+            if (_mm256_movemask_ps(hit) != 0)
+                return true;
+        }
+
+        if (group->last)
+            return false;
+        ++group;
+    }
+}
+
+#endif
+
+#undef MTS_TRIACCEL_SELECT
+
+void ShapeKDTree::buildLeafGroups() {
+    ref<Timer> timer = new Timer();
+    m_leafGroups.clear();
+    m_leafGroups.resize(m_indexCount + 1, KNoLeafGroups);
+
+    /* Count the groups that are needed */
+    size_t groupCount = 0;
+    for (SizeType i=0; i<m_nodeCount; ++i) {
+        const KDNode &node = m_nodes[i];
+        if (!node.isLeaf())
+            continue;
+        size_t triangles = 0;
+        for (IndexType entry=node.getPrimStart(); entry != node.getPrimEnd(); ++entry)
+            triangles += m_triAccel[m_indices[entry]].k != KNoTriangleFlag ? 1 : 0;
+        if (triangles > 1)
+            groupCount += (triangles + 7) / 8;
+    }
+
+    if (groupCount >= (size_t) KLeafHasShapes)
+        Log(EError, "Too many triangle groups for the SIMD shadow ray test!");
+
+    if (m_triAccel8)
+        freeAligned(m_triAccel8);
+    m_triAccel8 = static_cast<TriAccel8 *>(
+        allocAligned(std::max(groupCount, (size_t) 1) * sizeof(TriAccel8)));
+
+    uint32_t groupIndex = 0;
+    for (SizeType i=0; i<m_nodeCount; ++i) {
+        const KDNode &node = m_nodes[i];
+        if (!node.isLeaf())
+            continue;
+
+        IndexType start = node.getPrimStart(), end = node.getPrimEnd();
+        size_t triangles = 0;
+        bool hasShapes = false;
+        for (IndexType entry=start; entry != end; ++entry) {
+            if (m_triAccel[m_indices[entry]].k != KNoTriangleFlag)
+                ++triangles;
+            else
+                hasShapes = true;
+        }
+        if (triangles <= 1)
+            continue;
+
+        m_leafGroups[start] = groupIndex | (hasShapes ? KLeafHasShapes : 0);
+
+        int lane = 8;
+        TriAccel8 *group = NULL;
+        for (IndexType entry=start; entry != end; ++entry) {
+            const TriAccel &ta = m_triAccel[m_indices[entry]];
+            if (ta.k == KNoTriangleFlag)
+                continue;
+            if (lane == 8) {
+                group = &m_triAccel8[groupIndex++];
+                memset(group, 0, sizeof(TriAccel8));
+                lane = 0;
+            }
+            /* Degenerate triangles have k=3, which no ray can hit */
+            group->k[lane] = (float) ta.k;
+            group->n_u[lane] = ta.n_u; group->n_v[lane] = ta.n_v;
+            group->n_d[lane] = ta.n_d;
+            group->a_u[lane] = ta.a_u; group->a_v[lane] = ta.a_v;
+            group->b_nu[lane] = ta.b_nu; group->b_nv[lane] = ta.b_nv;
+            group->c_nu[lane] = ta.c_nu; group->c_nv[lane] = ta.c_nv;
+            group->valid[lane] = ta.k < 3 ? 0xFFFFFFFF : 0;
+            ++lane;
+        }
+        group->last = 1;
+    }
+    KDAssert(groupIndex == groupCount);
+
+    m_leafShadowTest = leafShadowTestSSE;
+#if defined(MTS_HAS_AVX_KERNEL)
+    if (hasCPUFeature(ECPUAVX))
+        m_leafShadowTest = leafShadowTestAVX;
+#endif
+
+    Log(EDebug, "Grouped the triangles of large leaves for %s shadow "
+        "rays (%s, took %i ms)", m_leafShadowTest == leafShadowTestSSE
+        ? "SSE" : "AVX", memString(groupCount * sizeof(TriAccel8)
+        + m_leafGroups.size() * sizeof(uint32_t)).c_str(),
+        timer->getMilliseconds());
+}
+#endif
+
 bool ShapeKDTree::rayIntersect(const Ray &ray, Intersection &its) const {
     uint8_t temp[MTS_KD_INTERSECTION_TEMP];
     its.t = std::numeric_limits<Float>::infinity();
@@ -159,6 +483,30 @@ void ShapeKDTree::rayIntersectFully(const Ray &ray,
     }
 }
 
+void ShapeKDTree::rayIntersectFully(const Ray &ray,
+            std::vector<Intersection> &its,
+            const IntersectionStopFunc &stop,
+            const std::vector<Shape *> *shapes) const {
+    Float mint, maxt;
+
+    #if defined(MTS_FP_DEBUG_STRICT)
+        Assert(ray.o.isFinite() && ray.d.isFinite());
+    #endif
+
+    ++raysTraced;
+    if (m_aabb.rayIntersect(ray, mint, maxt)) {
+        /* Use an adaptive ray epsilon */
+        Float rayMinT = getAdaptiveRayMinT(ray);
+
+        if (rayMinT > mint) mint = rayMinT;
+        if (ray.maxt < maxt) maxt = ray.maxt;
+
+        if (EXPECT_TAKEN(maxt > mint)) {
+            SAHKDTree3D::rayIntersectFully(ray, mint, maxt, its, stop, shapes);
+        }
+    }
+}
+
 bool ShapeKDTree::rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
         Normal &n, Point2 &uv) const {
     uint8_t temp[MTS_KD_INTERSECTION_TEMP];
@@ -180,25 +528,7 @@ bool ShapeKDTree::rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
                 shape = m_shapes[cache->shapeIndex];
 
                 if (m_triangleFlag[cache->shapeIndex]) {
-                    const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
-                    const Triangle &tri = trimesh->getTriangles()[cache->primIndex];
-                    const Point *vertexPositions = trimesh->getVertexPositions();
-                    const Point2 *vertexTexcoords = trimesh->getVertexTexcoords();
-                    const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
-                    const Point &p0 = vertexPositions[idx0];
-                    const Point &p1 = vertexPositions[idx1];
-                    const Point &p2 = vertexPositions[idx2];
-                    n = normalize(cross(p1-p0, p2-p0));
-
-                    if (EXPECT_TAKEN(vertexTexcoords)) {
-                        const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
-                        const Point2 &t0 = vertexTexcoords[idx0];
-                        const Point2 &t1 = vertexTexcoords[idx1];
-                        const Point2 &t2 = vertexTexcoords[idx2];
-                        uv = t0 * b.x + t1 * b.y + t2 * b.z;
-                    } else {
-                        uv = Point2(0.0f);
-                    }
+                    fillInterfaceRecord(ray, t, temp, n, uv);
                 } else {
                     /// Uh oh... -- much unnecessary work is done here
                     Intersection its;
@@ -219,6 +549,84 @@ bool ShapeKDTree::rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
 }
 
 
+bool ShapeKDTree::rayIntersectInterface(const Ray &ray, Float &t,
+        ConstShapePtr &shape, Float &cosTheta, void *temp) const {
+    Float mint, maxt;
+
+    t = std::numeric_limits<Float>::infinity();
+
+    ++shadowRaysTraced;
+    if (m_aabb.rayIntersect(ray, mint, maxt)) {
+        /* Use an adaptive ray epsilon */
+        Float rayMinT = getAdaptiveRayMinT(ray);
+
+        if (rayMinT > mint) mint = rayMinT;
+        if (ray.maxt < maxt) maxt = ray.maxt;
+
+        if (EXPECT_TAKEN(maxt > mint)) {
+            if (rayIntersectHavran<false>(ray, mint, maxt, t, temp)) {
+                const IntersectionCache *cache = static_cast<const IntersectionCache *>(temp);
+                shape = m_shapes[cache->shapeIndex];
+
+                if (m_triangleFlag[cache->shapeIndex]) {
+                    const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
+                    const Triangle tri = trimesh->getTriangle(cache->primIndex);
+                    const Point *vertexPositions = trimesh->getVertexPositions();
+                    const Point &p0 = vertexPositions[tri.idx[0]];
+                    const Point &p1 = vertexPositions[tri.idx[1]];
+                    const Point &p2 = vertexPositions[tri.idx[2]];
+                    cosTheta = dot(cross(p1-p0, p2-p0), ray.d);
+                } else {
+                    Intersection its;
+                    its.t = t;
+                    shape->fillIntersectionRecord(ray,
+                        static_cast<const uint8_t*>(temp) + 2*sizeof(IndexType), its);
+                    cosTheta = dot(its.geoFrame.n, ray.d);
+                    if (its.shape)
+                        shape = its.shape;
+                }
+
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ShapeKDTree::fillInterfaceRecord(const Ray &ray, Float t, const void *temp,
+        Normal &n, Point2 &uv) const {
+    const IntersectionCache *cache = static_cast<const IntersectionCache *>(temp);
+    const Shape *shape = m_shapes[cache->shapeIndex];
+
+    if (m_triangleFlag[cache->shapeIndex]) {
+        const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
+        const Triangle tri = trimesh->getTriangle(cache->primIndex);
+        const Point *vertexPositions = trimesh->getVertexPositions();
+        const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
+        const Point &p0 = vertexPositions[idx0];
+        const Point &p1 = vertexPositions[idx1];
+        const Point &p2 = vertexPositions[idx2];
+        n = normalize(cross(p1-p0, p2-p0));
+
+        if (EXPECT_TAKEN(trimesh->hasVertexTexcoords())) {
+            const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
+            const Point2 t0 = trimesh->getVertexTexcoord(idx0);
+            const Point2 t1 = trimesh->getVertexTexcoord(idx1);
+            const Point2 t2 = trimesh->getVertexTexcoord(idx2);
+            uv = t0 * b.x + t1 * b.y + t2 * b.z;
+        } else {
+            uv = Point2(0.0f);
+        }
+    } else {
+        Intersection its;
+        its.t = t;
+        shape->fillIntersectionRecord(ray,
+            static_cast<const uint8_t*>(temp) + 2*sizeof(IndexType), its);
+        n = its.geoFrame.n;
+        uv = its.uv;
+    }
+}
+
 bool ShapeKDTree::rayIntersect(const Ray &ray) const {
     Float mint, maxt, t = std::numeric_limits<Float>::infinity();
 
@@ -237,6 +645,79 @@ bool ShapeKDTree::rayIntersect(const Ray &ray) const {
     return false;
 }
 
+uint32_t ShapeKDTree::rayIntersectBatch(const Ray *rays, size_t count) const {
+    Assert(count <= MTS_KD_RAY_BATCH);
+    uint32_t occluded = 0;
+
+#if defined(MTS_HAS_COHERENT_RT)
+    /* Sort the rays into buckets by direction octant, since a packet is
+       only traversed coherently when the direction signs of all rays agree */
+    uint8_t order[MTS_KD_RAY_BATCH];
+    size_t octantStart[9];
+    memset(octantStart, 0, sizeof(octantStart));
+    for (size_t i=0; i<count; ++i) {
+        if (rays[i].time != 0) {
+            if (rayIntersect(rays[i]))
+                occluded |= 1u << i;
+            continue;
+        }
+        const Vector &d = rays[i].d;
+        ++octantStart[1 + (d.x < 0 ? 1 : 0) + (d.y < 0 ? 2 : 0) + (d.z < 0 ? 4 : 0)];
+    }
+    for (int i=0; i<8; ++i)
+        octantStart[i+1] += octantStart[i];
+    size_t octantPos[8];
+    memcpy(octantPos, octantStart, sizeof(octantPos));
+    for (size_t i=0; i<count; ++i) {
+        if (rays[i].time != 0)
+            continue;
+        const Vector &d = rays[i].d;
+        order[octantPos[(d.x < 0 ? 1 : 0) + (d.y < 0 ? 2 : 0) + (d.z < 0 ? 4 : 0)]++] = (uint8_t) i;
+    }
+
+    uint8_t MM_ALIGN16 temp[MTS_KD_INTERSECTION_TEMP * 4 + 2*sizeof(IndexType)];
+    for (int octant=0; octant<8; ++octant) {
+        for (size_t j=octantStart[octant]; j<octantStart[octant+1]; j += 4) {
+            /* Fill up incomplete packets by repeating the last ray */
+            size_t packetSize = std::min((size_t) 4, octantStart[octant+1] - j);
+            Ray packetRays[4];
+            for (size_t k=0; k<4; ++k)
+                packetRays[k] = rays[order[j + std::min(k, packetSize - 1)]];
+
+            RayPacket4 MM_ALIGN16 packet;
+            if (!packet.load(packetRays)) {
+                /* Cannot happen for rays sorted by octant; be safe */
+                for (size_t k=0; k<packetSize; ++k) {
+                    if (rayIntersect(packetRays[k]))
+                        occluded |= 1u << order[j + k];
+                }
+                continue;
+            }
+
+            RayInterval4 MM_ALIGN16 interval(packetRays);
+            Intersection4 MM_ALIGN16 its;
+            for (int k=0; k<4; ++k)
+                interval.mint.f[k] = getAdaptiveRayMinT(packetRays[k]);
+
+            rayIntersectPacket(packet, interval, its, temp);
+            shadowRaysTraced += packetSize;
+
+            for (size_t k=0; k<packetSize; ++k) {
+                if (its.t.f[k] != std::numeric_limits<float>::infinity())
+                    occluded |= 1u << order[j + k];
+            }
+        }
+    }
+#else
+    for (size_t i=0; i<count; ++i) {
+        if (rayIntersect(rays[i]))
+            occluded |= 1u << i;
+    }
+#endif
+
+    return occluded;
+}
+
 #if defined(MTS_HAS_COHERENT_RT)
 
 /// Ray traversal stack entry for uncoherent ray tracing
@@ -328,26 +809,20 @@ void ShapeKDTree::rayIntersectPacket(const RayPacket4 &packet,
                         mitsuba::rayIntersectPacket(kdTri, packet, searchStart.ps, searchEnd.ps, masked.ps, its));
                 } else {
                     const Shape *shape = m_shapes[kdTri.shapeIndex];
+                    SSEVector t;
+
+                    int hits = shape->rayIntersectPacket(packet, searchStart.f,
+                        searchEnd.f, ~_mm_movemask_ps(masked.ps) & 0xF, t.f,
+                        reinterpret_cast<uint8_t *>(temp) + 2*sizeof(IndexType),
+                        MTS_KD_INTERSECTION_TEMP);
 
                     for (int i=0; i<4; ++i) {
-                        if (masked.i[i])
+                        if (!(hits & (1 << i)))
                             continue;
-                        Ray ray;
-                        for (int axis=0; axis<3; axis++) {
-                            ray.o[axis] = packet.o[axis].f[i];
-                            ray.d[axis] = packet.d[axis].f[i];
-                            ray.dRcp[axis] = packet.dRcp[axis].f[i];
-                        }
-                        Float t;
-
-                        if (shape->rayIntersect(ray, searchStart.f[i], searchEnd.f[i], t,
-                                reinterpret_cast<uint8_t *>(temp)
-                                + i * MTS_KD_INTERSECTION_TEMP + 2*sizeof(IndexType))) {
-                            its.t.f[i] = t;
-                            its.shapeIndex.i[i] = kdTri.shapeIndex;
-                            its.primIndex.i[i] = KNoTriangleFlag;
-                            itsFound.i[i] = 0xFFFFFFFF;
-                        }
+                        its.t.f[i] = t.f[i];
+                        its.shapeIndex.i[i] = kdTri.shapeIndex;
+                        its.primIndex.i[i] = KNoTriangleFlag;
+                        itsFound.i[i] = 0xFFFFFFFF;
                     }
                 }
                 searchEnd.ps = _mm_min_ps(searchEnd.ps, its.t.ps);
@@ -17,13 +17,18 @@
 */
 
 #include <mitsuba/core/properties.h>
+#include <mitsuba/core/fstream.h>
 #include <mitsuba/render/subsurface.h>
-#include <mitsuba/render/shape.h>
+#include <mitsuba/render/scene.h>
 
 MTS_NAMESPACE_BEGIN
 
 Subsurface::Subsurface(const Properties &props)
- : NetworkedObject(props), m_active(false) { }
+ : NetworkedObject(props), m_active(false) {
+    /* Directory where precomputed data (e.g. irradiance samples) gets
+     * cached between renders of the same scene. Empty: no caching. */
+    m_preprocessCacheDir = props.getString("preprocessCacheDir", "");
+}
 
 Subsurface::Subsurface(Stream *stream, InstanceManager *manager) :
     NetworkedObject(stream, manager) {
@@ -39,6 +44,8 @@ Subsurface::~Subsurface() { }
 
 void Subsurface::cancel() { }
 
+void Subsurface::invalidate() { }
+
 void Subsurface::setParent(ConfigurableObject *parent) {
     if (parent->getClass()->derivesFrom(MTS_CLASS(Shape))) {
         Shape *shape = static_cast<Shape *>(parent);
@@ -58,5 +65,140 @@ void Subsurface::serialize(Stream *stream, InstanceManager *manager) const {
         manager->serialize(stream, m_shapes[i]);
 }
 
+namespace {
+/// 64-bit FNV-1a hash, used to key the on-disk preprocessing caches
+class CacheKeyHash {
+public:
+    CacheKeyHash() : m_hash(0xcbf29ce484222325ULL) { }
+
+    void putBytes(const void *data, size_t size) {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; ++i) {
+            m_hash ^= bytes[i];
+            m_hash *= 0x100000001b3ULL;
+        }
+    }
+
+    void putString(const std::string &str) {
+        putBytes(str.c_str(), str.length() + 1);
+    }
+
+    template <typename T> void putValue(const T &value) {
+        putBytes(&value, sizeof(T));
+    }
+
+    /// Hash the geometry of a shape (but e.g. not its BSDF)
+    void putShape(const Shape *shape) {
+        putString(shape->getClass()->getName());
+        AABB aabb = shape->getAABB();
+        putValue(aabb.min);
+        putValue(aabb.max);
+        putValue(shape->getSurfaceArea());
+        if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+            const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+            putBytes(mesh->getVertexPositions(),
+                    mesh->getVertexCount() * sizeof(Point));
+            if (mesh->getTriangles()) {
+                putBytes(mesh->getTriangles(),
+                        mesh->getTriangleCount() * sizeof(Triangle));
+            } else {
+                for (size_t i=0; i<mesh->getTriangleCount(); ++i)
+                    putValue(mesh->getTriangle(i));
+            }
+        }
+    }
+
+    inline uint64_t get() const { return m_hash; }
+private:
+    uint64_t m_hash;
+};
+
+const char *preprocessCacheMagic = "MTS_PREPROCESS_CACHE";
+/// Bump whenever the serialized format of a cached payload changes
+const int preprocessCacheVersion = 2;
+}
+
+static fs::path getPreprocessCachePath(const Scene *scene,
+        const std::vector<Shape *> &shapes, const Properties &props,
+        const std::string &dir, const std::string &kind, uint64_t &key) {
+    CacheKeyHash hash;
+    hash.putValue(sizeof(Float));
+    hash.putString(kind);
+    hash.putString(props.toString());
+    for (size_t i = 0; i < shapes.size(); ++i)
+        hash.putShape(shapes[i]);
+    const ref_vector<Shape> &sceneShapes = scene->getShapes();
+    for (size_t i = 0; i < sceneShapes.size(); ++i)
+        hash.putShape(sceneShapes[i].get());
+    const ref_vector<Emitter> &emitters = scene->getEmitters();
+    for (size_t i = 0; i < emitters.size(); ++i)
+        hash.putString(emitters[i]->toString());
+    hash.putString(scene->getIntegrator()->toString());
+    key = hash.get();
+
+    return fs::path(dir) / formatString("%016llx-%s.cache",
+            (unsigned long long) key, kind.c_str());
+}
+
+bool Subsurface::loadPreprocessCache(const Scene *scene,
+        const std::string &kind,
+        const std::function<void (Stream *)> &load) const {
+    if (m_preprocessCacheDir.empty())
+        return false;
+
+    uint64_t key;
+    fs::path path = getPreprocessCachePath(scene, m_shapes,
+            getProperties(), m_preprocessCacheDir, kind, key);
+    if (!fs::exists(path))
+        return false;
+
+    try {
+        ref<FileStream> stream = new FileStream(path, FileStream::EReadOnly);
+        if (stream->readString() != preprocessCacheMagic
+                || stream->readInt() != preprocessCacheVersion
+                || stream->readULong() != key) {
+            Log(EWarn, "Ignoring invalid preprocessing cache file \"%s\"",
+                    path.string().c_str());
+            return false;
+        }
+        load(stream);
+    } catch (const std::exception &e) {
+        Log(EWarn, "Could not read the preprocessing cache file \"%s\": %s",
+                path.string().c_str(), e.what());
+        return false;
+    }
+    Log(EInfo, "Loaded precomputed %s from \"%s\"", kind.c_str(),
+            path.string().c_str());
+    return true;
+}
+
+void Subsurface::storePreprocessCache(const Scene *scene,
+        const std::string &kind,
+        const std::function<void (Stream *)> &store) const {
+    if (m_preprocessCacheDir.empty())
+        return;
+
+    uint64_t key;
+    fs::path path = getPreprocessCachePath(scene, m_shapes,
+            getProperties(), m_preprocessCacheDir, kind, key);
+
+    /* Write to a temporary file first, so that an interrupted render
+     * never leaves a truncated cache file behind */
+    fs::path tmpPath = path.parent_path() / (path.filename().string() + ".tmp");
+    try {
+        fs::create_directories(path.parent_path());
+        ref<FileStream> stream = new FileStream(tmpPath, FileStream::ETruncWrite);
+        stream->writeString(preprocessCacheMagic);
+        stream->writeInt(preprocessCacheVersion);
+        stream->writeULong(key);
+        store(stream);
+        stream->close();
+        fs::rename(tmpPath, path);
+    } catch (const std::exception &e) {
+        Log(EWarn, "Could not write the preprocessing cache file \"%s\": %s",
+                path.string().c_str(), e.what());
+    }
+}
+
 MTS_IMPLEMENT_CLASS(Subsurface, true, NetworkedObject)
 MTS_NAMESPACE_END
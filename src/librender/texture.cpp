@@ -72,6 +72,29 @@ void Texture::evalGradient(const Intersection &_its, Spectrum *gradient) const {
     gradient[1] = (valueV - value)*(1/eps);
 }
 
+Spectrum Texture::evalCached(const Intersection &its, bool filter) const {
+    TextureLookupCache::ELookup lookup = filter ? TextureLookupCache::EFiltered
+        : TextureLookupCache::EUnfiltered;
+    Spectrum value;
+    if (its.lookupTexture(this, lookup, value))
+        return value;
+    value = eval(its, filter);
+    if (!isConstant())
+        its.cacheTexture(this, lookup, value);
+    return value;
+}
+
+void Texture::evalGradientCached(const Intersection &its, Spectrum *gradient) const {
+    if (its.lookupTexture(this, TextureLookupCache::EGradientU, gradient[0]) &&
+        its.lookupTexture(this, TextureLookupCache::EGradientV, gradient[1]))
+        return;
+    evalGradient(its, gradient);
+    if (!isConstant()) {
+        its.cacheTexture(this, TextureLookupCache::EGradientU, gradient[0]);
+        its.cacheTexture(this, TextureLookupCache::EGradientV, gradient[1]);
+    }
+}
+
 Texture::~Texture() { }
 
 void Texture::serialize(Stream *stream, InstanceManager *manager) const {
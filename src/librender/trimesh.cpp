@@ -22,6 +22,7 @@
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/zstream.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/warp.h>
 #include <mitsuba/core/lock.h>
 #include <mitsuba/core/properties.h>
 #include <mitsuba/render/subsurface.h>
@@ -34,6 +35,15 @@
 #define MTS_FILEFORMAT_HEADER     0x041C
 #define MTS_FILEFORMAT_VERSION_V3 0x0003
 #define MTS_FILEFORMAT_VERSION_V4 0x0004
+#define MTS_FILEFORMAT_VERSION_V5 0x0005
+/// Same layout as V4, compressed as independent blocks (see ZStream::EBlockStream)
+#define MTS_FILEFORMAT_VERSION_V6 0x0006
+
+/// Alignment of the arrays in uncompressed (V5) files
+#define MTS_FILEFORMAT_ALIGNMENT  64
+
+/// Compute vertex normals in parallel for meshes with at least this many triangles
+#define MTS_PARALLEL_NORMALS_THRESHOLD 65536
 
 MTS_NAMESPACE_BEGIN
 
@@ -42,7 +52,7 @@ TriMesh::TriMesh(const std::string &name, size_t triangleCount,
         bool hasVertexColors, bool flipNormals, bool faceNormals)
     : Shape(Properties()), m_triangleCount(triangleCount),
       m_vertexCount(vertexCount), m_flipNormals(flipNormals),
-      m_faceNormals(faceNormals) {
+      m_faceNormals(faceNormals), m_precomputeCurvature(false) {
     m_name = name;
     m_triangles = new Triangle[m_triangleCount];
     m_positions = new Point[m_vertexCount];
@@ -50,6 +60,8 @@ TriMesh::TriMesh(const std::string &name, size_t triangleCount,
     m_texcoords = hasTexcoords ? new Point2[m_vertexCount] : NULL;
     m_colors = hasVertexColors ? new Color3[m_vertexCount] : NULL;
     m_tangents = NULL;
+    m_curvatures = NULL;
+    initCompact(false);
     m_surfaceArea = m_invSurfaceArea = -1;
     m_mutex = new Mutex();
 }
@@ -57,7 +69,7 @@ TriMesh::TriMesh(const std::string &name, size_t triangleCount,
 TriMesh::TriMesh(const Properties &props)
  : Shape(props), m_triangles(NULL), m_positions(NULL),
     m_normals(NULL), m_texcoords(NULL), m_tangents(NULL),
-    m_colors(NULL) {
+    m_colors(NULL), m_curvatures(NULL) {
 
     /* By default, any existing normals will be used for
        rendering. If no normals are found, Mitsuba will
@@ -71,6 +83,13 @@ TriMesh::TriMesh(const Properties &props)
     /* Causes all normals to be flipped */
     m_flipNormals = props.getBoolean("flipNormals", false);
 
+    /* Estimate per-vertex curvatures for the 'curvature' texture */
+    m_precomputeCurvature = props.getBoolean("precomputeCurvature", false);
+
+    /* Store normals, texture coordinates and indices at reduced
+       precision to save memory (see TriMesh::compact()) */
+    initCompact(props.getBoolean("compact", false));
+
     m_triangles = NULL;
     m_surfaceArea = m_invSurfaceArea = -1;
     m_mutex = new Mutex();
@@ -79,8 +98,10 @@ TriMesh::TriMesh(const Properties &props)
 TriMesh::TriMesh(Stream *stream, int index)
         : Shape(Properties()), m_triangles(NULL),
     m_positions(NULL), m_normals(NULL), m_texcoords(NULL),
-    m_tangents(NULL), m_colors(NULL) {
+    m_tangents(NULL), m_colors(NULL), m_curvatures(NULL),
+    m_precomputeCurvature(false) {
 
+    initCompact(false);
     m_mutex = new Mutex();
     loadCompressed(stream, index);
 }
@@ -92,12 +113,17 @@ enum ETriMeshFlags {
     EHasTangents     = 0x0004, // unused
     EHasColors       = 0x0008,
     EFaceNormals     = 0x0010,
+    ECompact         = 0x0020, // only used for network transfers
+    ECompactNormals  = 0x0040, // "
+    ECompactTexcoords= 0x0080, // "
+    ECompactIndices  = 0x0100, // "
+    EHasCurvatures   = 0x0200, // only used for network transfers
     ESinglePrecision = 0x1000,
     EDoublePrecision = 0x2000
 };
 
 TriMesh::TriMesh(Stream *stream, InstanceManager *manager)
-    : Shape(stream, manager), m_tangents(NULL) {
+    : Shape(stream, manager), m_tangents(NULL), m_curvatures(NULL) {
     m_name = stream->readString();
     m_aabb = AABB(stream);
 
@@ -110,8 +136,14 @@ TriMesh::TriMesh(Stream *stream, InstanceManager *manager)
         m_vertexCount * sizeof(Point)/sizeof(Float));
 
     m_faceNormals = flags & EFaceNormals;
+    m_precomputeCurvature = flags & EHasCurvatures;
+    initCompact(flags & ECompact);
 
-    if (flags & EHasNormals) {
+    if (flags & ECompactNormals) {
+        m_normals = NULL;
+        m_packedNormals = new uint32_t[m_vertexCount];
+        stream->readUIntArray(m_packedNormals, m_vertexCount);
+    } else if (flags & EHasNormals) {
         m_normals = new Normal[m_vertexCount];
         stream->readFloatArray(reinterpret_cast<Float *>(m_normals),
             m_vertexCount * sizeof(Normal)/sizeof(Float));
@@ -119,7 +151,13 @@ TriMesh::TriMesh(Stream *stream, InstanceManager *manager)
         m_normals = NULL;
     }
 
-    if (flags & EHasTexcoords) {
+    if (flags & ECompactTexcoords) {
+        m_texcoords = NULL;
+        m_texcoordOffset = Point2(stream);
+        m_texcoordScale = Vector2(stream);
+        m_packedTexcoords = new uint16_t[2*m_vertexCount];
+        stream->readUShortArray(m_packedTexcoords, 2*m_vertexCount);
+    } else if (flags & EHasTexcoords) {
         m_texcoords = new Point2[m_vertexCount];
         stream->readFloatArray(reinterpret_cast<Float *>(m_texcoords),
             m_vertexCount * sizeof(Point2)/sizeof(Float));
@@ -135,9 +173,19 @@ TriMesh::TriMesh(Stream *stream, InstanceManager *manager)
         m_colors = NULL;
     }
 
-    m_triangles = new Triangle[m_triangleCount];
-    stream->readUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
-        m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+    if (flags & ECompactIndices) {
+        size_t clusterCount = (m_triangleCount + MTS_TRIMESH_CLUSTER_SIZE - 1)
+            / MTS_TRIMESH_CLUSTER_SIZE;
+        m_triangles = NULL;
+        m_clusterBase = new uint32_t[clusterCount];
+        stream->readUIntArray(m_clusterBase, clusterCount);
+        m_localIndices = new uint16_t[3*m_triangleCount];
+        stream->readUShortArray(m_localIndices, 3*m_triangleCount);
+    } else {
+        m_triangles = new Triangle[m_triangleCount];
+        stream->readUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
+            m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+    }
     m_flipNormals = false;
     m_surfaceArea = m_invSurfaceArea = -1;
     m_mutex = new Mutex();
@@ -172,6 +220,125 @@ static void readHelper(Stream *stream, bool fileDoublePrecision,
     }
 }
 
+/// Number of padding bytes needed to align the given stream position
+static inline size_t getPadding(size_t pos) {
+    return (MTS_FILEFORMAT_ALIGNMENT - pos % MTS_FILEFORMAT_ALIGNMENT) % MTS_FILEFORMAT_ALIGNMENT;
+}
+
+static void skipPadding(Stream *stream) {
+    stream->skip(getPadding(stream->getPos()));
+}
+
+static void writePadding(Stream *stream) {
+    static const uint8_t zeros[MTS_FILEFORMAT_ALIGNMENT] = { 0 };
+    stream->write(zeros, getPadding(stream->getPos()));
+}
+
+/**
+ * Return a pointer to the next aligned array in a memory-mapped file. When
+ * the file precision doesn't match, the data is converted into a new buffer
+ */
+template <typename T> static T *mapHelper(uint8_t *data, size_t size,
+        size_t &pos, bool fileDoublePrecision, size_t count) {
+#if defined(SINGLE_PRECISION)
+    bool hostDoublePrecision = false;
+#else
+    bool hostDoublePrecision = true;
+#endif
+    const size_t nelems = count * (sizeof(T) / sizeof(Float));
+    const size_t bytes = nelems * (fileDoublePrecision ? sizeof(double) : sizeof(float));
+    pos += getPadding(pos);
+    if (pos > size || bytes > size - pos)
+        SLog(EError, "Encountered a truncated serialized mesh!");
+
+    uint8_t *ptr = data + pos;
+    pos += bytes;
+    if (fileDoublePrecision == hostDoublePrecision)
+        return reinterpret_cast<T *>(ptr);
+
+    T *target = new T[count];
+    Float *values = reinterpret_cast<Float *>(target);
+    if (fileDoublePrecision) {
+        const double *source = reinterpret_cast<const double *>(ptr);
+        for (size_t i=0; i<nelems; ++i)
+            values[i] = (Float) source[i];
+    } else {
+        const float *source = reinterpret_cast<const float *>(ptr);
+        for (size_t i=0; i<nelems; ++i)
+            values[i] = (Float) source[i];
+    }
+    return target;
+}
+
+bool TriMesh::isMappable(short version) {
+    return version == MTS_FILEFORMAT_VERSION_V5 &&
+        Stream::getHostByteOrder() == Stream::ELittleEndian;
+}
+
+void TriMesh::loadMapped(MemoryMappedFile *mapping, size_t offset) {
+    if (Stream::getHostByteOrder() != Stream::ELittleEndian)
+        Log(EError, "Memory-mapped meshes require a little endian host!");
+
+    uint8_t *data = (uint8_t *) mapping->getData();
+    const size_t size = mapping->getSize();
+    size_t pos = offset;
+
+    /* Parse the header (see serializeMappable()) */
+    short format, version;
+    uint32_t flags;
+    if (pos > size || size - pos < 2*sizeof(short) + sizeof(uint32_t))
+        Log(EError, "Encountered a truncated serialized mesh!");
+    memcpy(&format, data + pos, sizeof(short));
+    memcpy(&version, data + pos + sizeof(short), sizeof(short));
+    memcpy(&flags, data + pos + 2*sizeof(short), sizeof(uint32_t));
+    pos += 2*sizeof(short) + sizeof(uint32_t);
+    if (format != MTS_FILEFORMAT_HEADER || version != MTS_FILEFORMAT_VERSION_V5)
+        Log(EError, "Encountered a serialized mesh that can't be memory-mapped!");
+
+    const char *name = (const char *) data + pos;
+    size_t nameLength = 0;
+    while (pos + nameLength < size && name[nameLength] != '\0')
+        ++nameLength;
+    if (size - pos < nameLength + 1 + 2*sizeof(uint64_t))
+        Log(EError, "Encountered a truncated serialized mesh!");
+    m_name = std::string(name, nameLength);
+    pos += nameLength + 1;
+
+    uint64_t vertexCount, triangleCount;
+    memcpy(&vertexCount, data + pos, sizeof(uint64_t));
+    memcpy(&triangleCount, data + pos + sizeof(uint64_t), sizeof(uint64_t));
+    pos += 2*sizeof(uint64_t);
+    m_vertexCount = (size_t) vertexCount;
+    m_triangleCount = (size_t) triangleCount;
+
+    bool fileDoublePrecision = flags & EDoublePrecision;
+    m_faceNormals = flags & EFaceNormals;
+
+    releaseBuffer(m_positions);
+    releaseBuffer(m_normals);
+    releaseBuffer(m_texcoords);
+    releaseBuffer(m_colors);
+    releaseBuffer(m_triangles);
+    m_mapping = mapping;
+
+    m_positions = mapHelper<Point>(data, size, pos, fileDoublePrecision, m_vertexCount);
+    if (flags & EHasNormals)
+        m_normals = mapHelper<Normal>(data, size, pos, fileDoublePrecision, m_vertexCount);
+    if (flags & EHasTexcoords)
+        m_texcoords = mapHelper<Point2>(data, size, pos, fileDoublePrecision, m_vertexCount);
+    if (flags & EHasColors)
+        m_colors = mapHelper<Color3>(data, size, pos, fileDoublePrecision, m_vertexCount);
+
+    /* Vertex indices don't depend on the precision */
+    pos += getPadding(pos);
+    if (pos > size || m_triangleCount * sizeof(Triangle) > size - pos)
+        Log(EError, "Encountered a truncated serialized mesh!");
+    m_triangles = reinterpret_cast<Triangle *>(data + pos);
+
+    m_surfaceArea = m_invSurfaceArea = -1;
+    m_flipNormals = false;
+}
+
 void TriMesh::loadCompressed(Stream *_stream, int index) {
     ref<Stream> stream = _stream;
 
@@ -187,11 +354,16 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
         stream->skip(sizeof(short) * 2); // Skip the header
     }
 
-    stream = new ZStream(stream);
-    stream->setByteOrder(Stream::ELittleEndian);
+    /* V5 files are uncompressed, with padding in front of each array */
+    const bool aligned = version == MTS_FILEFORMAT_VERSION_V5;
+    if (!aligned) {
+        stream = new ZStream(stream, version == MTS_FILEFORMAT_VERSION_V6
+            ? ZStream::EBlockStream : ZStream::EDeflateStream);
+        stream->setByteOrder(Stream::ELittleEndian);
+    }
 
     uint32_t flags = stream->readUInt();
-    if (version == MTS_FILEFORMAT_VERSION_V4)
+    if (version != MTS_FILEFORMAT_VERSION_V3)
         m_name = stream->readString();
     m_vertexCount = stream->readSize();
     m_triangleCount = stream->readSize();
@@ -199,50 +371,47 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
     bool fileDoublePrecision = flags & EDoublePrecision;
     m_faceNormals = flags & EFaceNormals;
 
-    if (m_positions)
-        delete[] m_positions;
-
+    releaseBuffer(m_positions);
+    if (aligned)
+        skipPadding(stream);
     m_positions = new Point[m_vertexCount];
     readHelper(stream, fileDoublePrecision,
             reinterpret_cast<Float *>(m_positions),
             m_vertexCount, sizeof(Point)/sizeof(Float));
 
-    if (m_normals)
-        delete[] m_normals;
-
+    releaseBuffer(m_normals);
     if (flags & EHasNormals) {
+        if (aligned)
+            skipPadding(stream);
         m_normals = new Normal[m_vertexCount];
         readHelper(stream, fileDoublePrecision,
                 reinterpret_cast<Float *>(m_normals),
                 m_vertexCount, sizeof(Normal)/sizeof(Float));
-    } else {
-        m_normals = NULL;
     }
 
-    if (m_texcoords)
-        delete[] m_texcoords;
-
+    releaseBuffer(m_texcoords);
     if (flags & EHasTexcoords) {
+        if (aligned)
+            skipPadding(stream);
         m_texcoords = new Point2[m_vertexCount];
         readHelper(stream, fileDoublePrecision,
                 reinterpret_cast<Float *>(m_texcoords),
                 m_vertexCount, sizeof(Point2)/sizeof(Float));
-    } else {
-        m_texcoords = NULL;
     }
 
-    if (m_colors)
-        delete[] m_colors;
-
+    releaseBuffer(m_colors);
     if (flags & EHasColors) {
+        if (aligned)
+            skipPadding(stream);
         m_colors = new Color3[m_vertexCount];
         readHelper(stream, fileDoublePrecision,
                 reinterpret_cast<Float *>(m_colors),
                 m_vertexCount, sizeof(Color3)/sizeof(Float));
-    } else {
-        m_colors = NULL;
     }
 
+    releaseBuffer(m_triangles);
+    if (aligned)
+        skipPadding(stream);
     m_triangles = new Triangle[m_triangleCount];
     stream->readUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
         m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
@@ -263,7 +432,9 @@ short TriMesh::readHeader(Stream *stream) {
     }
     short version = stream->readShort();
     if (version != MTS_FILEFORMAT_VERSION_V3 &&
-        version != MTS_FILEFORMAT_VERSION_V4) {
+        version != MTS_FILEFORMAT_VERSION_V4 &&
+        version != MTS_FILEFORMAT_VERSION_V5 &&
+        version != MTS_FILEFORMAT_VERSION_V6) {
         Log(EError, "Encountered an incompatible file version!");
     }
     return version;
@@ -283,7 +454,7 @@ size_t TriMesh::readOffset(Stream *stream, short version, int idx) {
     }
 
     // Seek to the correct position
-    if (version == MTS_FILEFORMAT_VERSION_V4) {
+    if (version != MTS_FILEFORMAT_VERSION_V3) {
         stream->seek(stream->getSize() - sizeof(uint64_t) * (count-idx) - sizeof(uint32_t));
         return stream->readSize();
     } else {
@@ -310,7 +481,7 @@ int TriMesh::readOffsetDictionary(Stream *stream, short version,
 
     if (streamSize >= minSize) {
         outOffsets.resize(count);
-        if (version == MTS_FILEFORMAT_VERSION_V4) {
+        if (version != MTS_FILEFORMAT_VERSION_V3) {
             stream->seek(stream->getSize() - sizeof(uint64_t) * count - sizeof(uint32_t));
             if (typeid(size_t) == typeid(uint64_t)) {
                 stream->readArray(&outOffsets[0], count);
@@ -337,18 +508,35 @@ int TriMesh::readOffsetDictionary(Stream *stream, short version,
 }
 
 TriMesh::~TriMesh() {
-    if (m_positions)
-        delete[] m_positions;
-    if (m_normals)
-        delete[] m_normals;
-    if (m_texcoords)
-        delete[] m_texcoords;
-    if (m_tangents)
-        delete[] m_tangents;
-    if (m_colors)
-        delete[] m_colors;
-    if (m_triangles)
-        delete[] m_triangles;
+    releaseBuffer(m_positions);
+    releaseBuffer(m_normals);
+    releaseBuffer(m_texcoords);
+    releaseBuffer(m_tangents);
+    releaseBuffer(m_colors);
+    releaseBuffer(m_curvatures);
+    releaseBuffer(m_triangles);
+    releaseCompactBuffers();
+}
+
+void TriMesh::initCompact(bool compact) {
+    m_compact = compact;
+    m_packedNormals = NULL;
+    m_packedTexcoords = NULL;
+    m_texcoordOffset = Point2(0.0f);
+    m_texcoordScale = Vector2(0.0f);
+    m_clusterBase = NULL;
+    m_localIndices = NULL;
+}
+
+void TriMesh::releaseCompactBuffers() {
+    delete[] m_packedNormals;
+    delete[] m_packedTexcoords;
+    delete[] m_clusterBase;
+    delete[] m_localIndices;
+    m_packedNormals = NULL;
+    m_packedTexcoords = NULL;
+    m_clusterBase = NULL;
+    m_localIndices = NULL;
 }
 
 AABB TriMesh::getAABB() const {
@@ -383,6 +571,12 @@ void TriMesh::configure() {
     /* For manifold exploration: always compute UV tangents when a glossy material
        is involved. TODO: find a way to avoid this expense (compute on demand?) */
     computeUVTangents();
+
+    if (m_precomputeCurvature)
+        computeVertexCurvatures();
+
+    if (m_compact)
+        compact();
 }
 
 void TriMesh::prepareSamplingTable() {
@@ -396,9 +590,14 @@ void TriMesh::prepareSamplingTable() {
         /* Generate a PDF for sampling wrt. area */
         m_areaDistr.reserve(m_triangleCount);
         for (size_t i=0; i<m_triangleCount; i++)
-            m_areaDistr.append(m_triangles[i].surfaceArea(m_positions));
+            m_areaDistr.append(getTriangle(i).surfaceArea(m_positions));
         m_surfaceArea = m_areaDistr.normalize();
         m_invSurfaceArea = 1.0f / m_surfaceArea;
+
+        /* Constant-time triangle selection for large meshes. Small ones
+           keep the CDF, which preserves the sample stratification */
+        if (m_triangleCount >= 256)
+            m_areaDistr.buildAliasTable();
     }
 }
 
@@ -416,12 +615,136 @@ void TriMesh::samplePosition(PositionSamplingRecord &pRec,
 
     Point2 sample(_sample);
     size_t index = m_areaDistr.sampleReuse(sample.y);
-    pRec.p = m_triangles[index].sample(m_positions, m_normals,
-        m_texcoords, pRec.n, pRec.uv, sample);
+    if (EXPECT_TAKEN(!m_compact)) {
+        pRec.p = m_triangles[index].sample(m_positions, m_normals,
+            m_texcoords, pRec.n, pRec.uv, sample);
+    } else {
+        /* Decode the vertices into a temporary triangle */
+        const Triangle tri = getTriangle(index);
+        Triangle local;
+        Point p[3]; Normal n[3]; Point2 uv[3];
+        for (int i=0; i<3; ++i) {
+            local.idx[i] = i;
+            p[i] = m_positions[tri.idx[i]];
+            if (m_packedNormals)
+                n[i] = getVertexNormal(tri.idx[i]);
+            if (hasVertexTexcoords())
+                uv[i] = getVertexTexcoord(tri.idx[i]);
+        }
+        pRec.p = local.sample(p, m_packedNormals ? n : NULL,
+            hasVertexTexcoords() ? uv : NULL, pRec.n, pRec.uv, sample);
+    }
     pRec.pdf = m_invSurfaceArea;
     pRec.measure = EArea;
 }
 
+double TriMesh::computeSolidAngleCDF(const Point &ref, double *cdf) const {
+    if (m_triangleCount > MTS_TRIMESH_SPHTRI_MAX)
+        return 0;
+
+    cdf[0] = 0;
+    for (size_t i=0; i<m_triangleCount; ++i) {
+        const Triangle tri = getTriangle(i);
+        Vector3d d[3];
+        for (int j=0; j<3; ++j)
+            d[j] = normalize(Vector3d(m_positions[tri.idx[j]] - ref));
+
+        /* Solid angle formula of Van Oosterom and Strackee */
+        double numer = std::abs(dot(d[0], cross(d[1], d[2]))),
+               denom = 1 + dot(d[0], d[1]) + dot(d[1], d[2]) + dot(d[2], d[0]);
+        cdf[i+1] = cdf[i] + 2 * std::atan2(numer, denom);
+    }
+
+    double total = cdf[m_triangleCount];
+    if (!std::isfinite(total) || total < MTS_TRIMESH_SPHTRI_MIN_SOLIDANGLE)
+        return 0; /* The reference point lies on a vertex, or the mesh is far away */
+    return total;
+}
+
+void TriMesh::sampleDirect(DirectSamplingRecord &dRec,
+        const Point2 &_sample) const {
+    double cdf[MTS_TRIMESH_SPHTRI_MAX+1];
+    double total = computeSolidAngleCDF(dRec.ref, cdf);
+    if (total == 0) {
+        Shape::sampleDirect(dRec, _sample);
+        return;
+    }
+
+    /* Choose a triangle proportionally to its solid angle and reuse the sample */
+    double value = _sample.x * total;
+    size_t index = 0;
+    while (index < m_triangleCount-1 && value >= cdf[index+1])
+        ++index;
+    double width = cdf[index+1] - cdf[index];
+    Point2 sample(width > 0 ? (Float) std::min((value - cdf[index]) / width,
+        (double) ONE_MINUS_EPS) : (Float) 0.0f, _sample.y);
+
+    const Triangle tri = getTriangle(index);
+    const Point &p0 = m_positions[tri.idx[0]];
+    const Point &p1 = m_positions[tri.idx[1]];
+    const Point &p2 = m_positions[tri.idx[2]];
+    Vector3d o0(p0 - dRec.ref), o1(p1 - dRec.ref), o2(p2 - dRec.ref);
+
+    Vector3d d(warp::squareToSphericalTriangle(Vector(normalize(o0)),
+        Vector(normalize(o1)), Vector(normalize(o2)), sample));
+
+    /* Intersect the sampled direction with the triangle (Moeller-Trumbore) */
+    Vector3d edge1 = o1 - o0, edge2 = o2 - o0;
+    Vector3d pvec = cross(d, edge2), qvec = cross(-o0, edge1);
+    double det = dot(edge1, pvec);
+    Point2 bary(1.0f / 3.0f);
+    if (det != 0) {
+        double u = -dot(o0, pvec) / det, v = dot(d, qvec) / det;
+        u = std::max(u, 0.0); v = std::max(v, 0.0);
+        double sum = u + v;
+        if (sum > 1) {
+            u /= sum; v /= sum;
+        }
+        bary = Point2((Float) u, (Float) v);
+    }
+    Float w = 1.0f - bary.x - bary.y;
+    Vector sideA = p1 - p0, sideB = p2 - p0;
+    dRec.p = p0 + sideA * bary.x + sideB * bary.y;
+
+    if (hasVertexNormals())
+        dRec.n = Normal(normalize(getVertexNormal(tri.idx[0]) * w
+            + getVertexNormal(tri.idx[1]) * bary.x
+            + getVertexNormal(tri.idx[2]) * bary.y));
+    else
+        dRec.n = Normal(normalize(cross(sideA, sideB)));
+
+    if (hasVertexTexcoords())
+        dRec.uv = getVertexTexcoord(tri.idx[0]) * w
+            + getVertexTexcoord(tri.idx[1]) * bary.x
+            + getVertexTexcoord(tri.idx[2]) * bary.y;
+    else
+        dRec.uv = bary;
+
+    dRec.d = dRec.p - dRec.ref;
+    dRec.dist = dRec.d.length();
+    dRec.d /= dRec.dist;
+    dRec.pdf = (Float) (1.0 / total);
+    dRec.measure = ESolidAngle;
+}
+
+Float TriMesh::pdfDirect(const DirectSamplingRecord &dRec) const {
+    double cdf[MTS_TRIMESH_SPHTRI_MAX+1];
+    double total = computeSolidAngleCDF(dRec.ref, cdf);
+    if (total == 0)
+        return Shape::pdfDirect(dRec);
+
+    /* Every triangle is chosen proportionally to its solid angle and
+       then sampled uniformly within it, so the density is constant */
+    Float pdfSA = (Float) (1.0 / total);
+    if (dRec.measure == ESolidAngle)
+        return pdfSA;
+    else if (dRec.measure == EArea)
+        return pdfSA * absDot(dRec.d, dRec.n)
+            / (dRec.dist * dRec.dist);
+    else
+        return 0.0f;
+}
+
 struct Vertex {
     Point p;
     Point2 uv;
@@ -471,15 +794,15 @@ void TriMesh::rebuildTopology(Float maxAngle) {
     const Float dpThresh = std::cos(degToRad(maxAngle));
     size_t degenerateTriangles = 0;
 
-    if (m_normals) {
-        delete[] m_normals;
-        m_normals = NULL;
-    }
+    if (m_packedNormals || m_packedTexcoords || m_localIndices)
+        Log(EError, "\"%s\": rebuildTopology() is not supported for "
+            "compact meshes!", m_name.c_str());
 
-    if (m_tangents) {
-        delete[] m_tangents;
-        m_tangents = NULL;
-    }
+    releaseBuffer(m_normals);
+
+    releaseBuffer(m_tangents);
+
+    releaseBuffer(m_curvatures);
 
     Log(EInfo, "Rebuilding the topology of \"%s\" (" SIZE_T_FMT
             " triangles, " SIZE_T_FMT " vertices, max. angle = %f)",
@@ -499,18 +822,13 @@ void TriMesh::rebuildTopology(Float maxAngle) {
     if (m_colors != NULL)
         newColors.reserve(m_vertexCount);
 
-    /* Create an associative list and precompute a few things */
-    for (size_t i=0; i<m_triangleCount; ++i) {
+    /* Precompute the face normals */
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for reduction(+:degenerateTriangles) \
+            if (m_triangleCount >= MTS_PARALLEL_NORMALS_THRESHOLD)
+    #endif
+    for (int i=0; i<(int) m_triangleCount; ++i) {
         const Triangle &tri = m_triangles[i];
-        Vertex v;
-        for (int j=0; j<3; ++j) {
-            v.p = m_positions[tri.idx[j]];
-            if (m_texcoords)
-                v.uv = m_texcoords[tri.idx[j]];
-            if (m_colors)
-                v.col = m_colors[tri.idx[j]];
-            vertexToFace.insert(MPair(v, TopoData(i, false)));
-        }
         Point v0 = m_positions[tri.idx[0]];
         Point v1 = m_positions[tri.idx[1]];
         Point v2 = m_positions[tri.idx[2]];
@@ -529,6 +847,20 @@ void TriMesh::rebuildTopology(Float maxAngle) {
             newTriangles[i].idx[j] = 0xFFFFFFFFU;
     }
 
+    /* Create an associative list */
+    for (size_t i=0; i<m_triangleCount; ++i) {
+        const Triangle &tri = m_triangles[i];
+        Vertex v;
+        for (int j=0; j<3; ++j) {
+            v.p = m_positions[tri.idx[j]];
+            if (m_texcoords)
+                v.uv = m_texcoords[tri.idx[j]];
+            if (m_colors)
+                v.col = m_colors[tri.idx[j]];
+            vertexToFace.insert(MPair(v, TopoData(i, false)));
+        }
+    }
+
     /* Under the reasonable assumption that the vertex degree is
        bounded by a constant, the following runs in O(n) */
     for (MMap::iterator it = vertexToFace.begin(); it != vertexToFace.end();) {
@@ -575,21 +907,21 @@ void TriMesh::rebuildTopology(Float maxAngle) {
         for (int j=0; j<3; ++j)
             Assert(newTriangles[i].idx[j] != 0xFFFFFFFFU);
 
-    delete[] m_triangles;
+    releaseBuffer(m_triangles);
     m_triangles = newTriangles;
 
-    delete[] m_positions;
+    releaseBuffer(m_positions);
     m_positions = new Point[newPositions.size()];
     memcpy(m_positions, &newPositions[0], sizeof(Point) * newPositions.size());
 
     if (m_texcoords) {
-        delete[] m_texcoords;
+        releaseBuffer(m_texcoords);
         m_texcoords = new Point2[newTexcoords.size()];
         memcpy(m_texcoords, &newTexcoords[0], sizeof(Point2) * newTexcoords.size());
     }
 
     if (m_colors) {
-        delete[] m_colors;
+        releaseBuffer(m_colors);
         m_colors = new Color3[newColors.size()];
         memcpy(m_colors, &newColors[0], sizeof(Color3) * newColors.size());
     }
@@ -605,21 +937,137 @@ void TriMesh::rebuildTopology(Float maxAngle) {
     configure();
 }
 
+uint32_t TriMesh::encodeNormal(const Normal &n) {
+    Float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (sum == 0)
+        return 0;
+    Float x = n.x / sum, y = n.y / sum;
+    if (n.z < 0) {
+        /* Fold the lower hemisphere over the diagonals */
+        Float tx = (1 - std::abs(y)) * (x >= 0 ? 1 : -1),
+              ty = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+        x = tx; y = ty;
+    }
+    int16_t ix = (int16_t) math::roundToInt(math::clamp(x, (Float) -1, (Float) 1) * 32767),
+            iy = (int16_t) math::roundToInt(math::clamp(y, (Float) -1, (Float) 1) * 32767);
+    return (uint32_t) (uint16_t) ix | ((uint32_t) (uint16_t) iy << 16);
+}
+
+void TriMesh::compact() {
+    m_compact = true;
+    size_t before = 0, after = 0;
+
+    if (m_normals && !m_packedNormals) {
+        m_packedNormals = new uint32_t[m_vertexCount];
+        for (size_t i=0; i<m_vertexCount; ++i)
+            m_packedNormals[i] = encodeNormal(m_normals[i]);
+        releaseBuffer(m_normals);
+        before += m_vertexCount * sizeof(Normal);
+        after += m_vertexCount * sizeof(uint32_t);
+    }
+
+    if (m_texcoords && !m_packedTexcoords) {
+        Point2 min(std::numeric_limits<Float>::infinity()),
+               max(-std::numeric_limits<Float>::infinity());
+        for (size_t i=0; i<m_vertexCount; ++i) {
+            const Point2 &uv = m_texcoords[i];
+            min.x = std::min(min.x, uv.x); max.x = std::max(max.x, uv.x);
+            min.y = std::min(min.y, uv.y); max.y = std::max(max.y, uv.y);
+        }
+        m_texcoordOffset = min;
+        m_texcoordScale = (max - min) / (Float) 0xFFFF;
+        Vector2 invScale(
+            m_texcoordScale.x > 0 ? 1 / m_texcoordScale.x : 0,
+            m_texcoordScale.y > 0 ? 1 / m_texcoordScale.y : 0);
+        m_packedTexcoords = new uint16_t[2*m_vertexCount];
+        for (size_t i=0; i<m_vertexCount; ++i) {
+            const Point2 &uv = m_texcoords[i];
+            m_packedTexcoords[2*i]   = (uint16_t) std::min(0xFFFF,
+                math::roundToInt((uv.x - min.x) * invScale.x));
+            m_packedTexcoords[2*i+1] = (uint16_t) std::min(0xFFFF,
+                math::roundToInt((uv.y - min.y) * invScale.y));
+        }
+        releaseBuffer(m_texcoords);
+        before += m_vertexCount * sizeof(Point2);
+        after += m_vertexCount * 2 * sizeof(uint16_t);
+    }
+
+    if (m_tangents) {
+        /* Computed on the fly from now on */
+        releaseBuffer(m_tangents);
+        before += m_triangleCount * sizeof(TangentSpace);
+    }
+
+    if (m_triangles && !m_localIndices) {
+        size_t clusterCount = (m_triangleCount + MTS_TRIMESH_CLUSTER_SIZE - 1)
+            / MTS_TRIMESH_CLUSTER_SIZE;
+        uint32_t *clusterBase = new uint32_t[clusterCount];
+        bool success = true;
+        for (size_t c=0; c<clusterCount && success; ++c) {
+            size_t start = c * MTS_TRIMESH_CLUSTER_SIZE,
+                   end = std::min(start + MTS_TRIMESH_CLUSTER_SIZE, m_triangleCount);
+            uint32_t min = std::numeric_limits<uint32_t>::max(), max = 0;
+            for (size_t i=start; i<end; ++i) {
+                for (int j=0; j<3; ++j) {
+                    min = std::min(min, m_triangles[i].idx[j]);
+                    max = std::max(max, m_triangles[i].idx[j]);
+                }
+            }
+            clusterBase[c] = min;
+            success = max - min <= 0xFFFF;
+        }
+
+        if (success) {
+            m_clusterBase = clusterBase;
+            m_localIndices = new uint16_t[3*m_triangleCount];
+            for (size_t i=0; i<m_triangleCount; ++i) {
+                uint32_t base = m_clusterBase[i / MTS_TRIMESH_CLUSTER_SIZE];
+                for (int j=0; j<3; ++j)
+                    m_localIndices[3*i+j] = (uint16_t) (m_triangles[i].idx[j] - base);
+            }
+            releaseBuffer(m_triangles);
+            before += m_triangleCount * sizeof(Triangle);
+            after += m_triangleCount * 3 * sizeof(uint16_t)
+                + clusterCount * sizeof(uint32_t);
+        } else {
+            Log(EInfo, "\"%s\": the vertex indices are too scattered to be "
+                "stored compactly, keeping 32 bit indices.", m_name.c_str());
+            delete[] clusterBase;
+        }
+    }
+
+    if (before > 0)
+        Log(EDebug, "\"%s\": compact representation uses %s instead of %s",
+            m_name.c_str(), memString(after).c_str(), memString(before).c_str());
+}
+
 void TriMesh::computeNormals(bool force) {
     int invalidNormals = 0;
     if (m_faceNormals) {
-        if (m_normals) {
-            delete[] m_normals;
-            m_normals = NULL;
-        }
+        releaseBuffer(m_normals);
+        delete[] m_packedNormals;
+        m_packedNormals = NULL;
 
         if (m_flipNormals) {
             /* Change the winding order */
-            for (size_t i=0; i<m_triangleCount; ++i) {
-                Triangle &t = m_triangles[i];
-                std::swap(t.idx[0], t.idx[1]);
+            if (m_triangles) {
+                for (size_t i=0; i<m_triangleCount; ++i) {
+                    Triangle &t = m_triangles[i];
+                    std::swap(t.idx[0], t.idx[1]);
+                }
+            } else {
+                for (size_t i=0; i<m_triangleCount; ++i)
+                    std::swap(m_localIndices[3*i], m_localIndices[3*i+1]);
             }
         }
+    } else if (m_packedNormals) {
+        if (force)
+            Log(EError, "\"%s\": cannot recompute the normals of a "
+                "compact mesh!", m_name.c_str());
+        if (m_flipNormals) {
+            for (size_t i=0; i<m_vertexCount; i++)
+                m_packedNormals[i] = encodeNormal(-decodeNormal(m_packedNormals[i]));
+        }
     } else {
         if (m_normals && !force) {
             if (m_flipNormals) {
@@ -629,6 +1077,9 @@ void TriMesh::computeNormals(bool force) {
                 /* Do nothing */
             }
         } else {
+            if (m_compact && !m_triangles)
+                Log(EError, "\"%s\": cannot compute the normals of a "
+                    "compact mesh!", m_name.c_str());
             if (!m_normals)
                 m_normals = new Normal[m_vertexCount];
             memset(m_normals, 0, sizeof(Normal)*m_vertexCount);
@@ -637,27 +1088,71 @@ void TriMesh::computeNormals(bool force) {
                "Computing Vertex Normals from Polygonal Facets"
                by Grit Thuermer and Charles A. Wuethrich,
                JGT 1998, Vol 3 */
-            for (size_t i=0; i<m_triangleCount; i++) {
-                const Triangle &tri = m_triangles[i];
-                Normal n(0.0f);
-                for (int i=0; i<3; ++i) {
-                    const Point &v0 = m_positions[tri.idx[i]];
-                    const Point &v1 = m_positions[tri.idx[(i+1)%3]];
-                    const Point &v2 = m_positions[tri.idx[(i+2)%3]];
-                    Vector sideA(v1-v0), sideB(v2-v0);
-                    if (i==0) {
-                        n = cross(sideA, sideB);
+            if (m_triangleCount < MTS_PARALLEL_NORMALS_THRESHOLD) {
+                for (size_t i=0; i<m_triangleCount; i++) {
+                    const Triangle &tri = m_triangles[i];
+                    Normal n(0.0f);
+                    for (int i=0; i<3; ++i) {
+                        const Point &v0 = m_positions[tri.idx[i]];
+                        const Point &v1 = m_positions[tri.idx[(i+1)%3]];
+                        const Point &v2 = m_positions[tri.idx[(i+2)%3]];
+                        Vector sideA(v1-v0), sideB(v2-v0);
+                        if (i==0) {
+                            n = cross(sideA, sideB);
+                            Float length = n.length();
+                            if (length == 0)
+                                break;
+                            n /= length;
+                        }
+                        Float angle = unitAngle(normalize(sideA), normalize(sideB));
+                        m_normals[tri.idx[i]] += n * angle;
+                    }
+                }
+            } else {
+                /* Gather the triangle corners of each vertex in triangle
+                   order, so that every vertex can be processed independently
+                   and the sums are identical to the sequential version */
+                std::vector<uint32_t> cornerStart(m_vertexCount + 1, 0);
+                for (size_t i=0; i<m_triangleCount; i++)
+                    for (int j=0; j<3; ++j)
+                        cornerStart[m_triangles[i].idx[j] + 1]++;
+                for (size_t i=0; i<m_vertexCount; i++)
+                    cornerStart[i+1] += cornerStart[i];
+                std::vector<uint32_t> corners(cornerStart[m_vertexCount]);
+                std::vector<uint32_t> fill(cornerStart.begin(), cornerStart.end() - 1);
+                for (size_t i=0; i<m_triangleCount; i++)
+                    for (int j=0; j<3; ++j)
+                        corners[fill[m_triangles[i].idx[j]]++] = (uint32_t) (3*i + j);
+
+                #if defined(MTS_OPENMP)
+                    #pragma omp parallel for schedule(dynamic, 4096)
+                #endif
+                for (int v=0; v<(int) m_vertexCount; ++v) {
+                    Normal sum(0.0f);
+                    for (uint32_t k=cornerStart[v]; k<cornerStart[v+1]; ++k) {
+                        const Triangle &tri = m_triangles[corners[k] / 3];
+                        int i = (int) (corners[k] % 3);
+                        const Point &p0 = m_positions[tri.idx[0]];
+                        Normal n(cross(m_positions[tri.idx[1]] - p0, m_positions[tri.idx[2]] - p0));
                         Float length = n.length();
                         if (length == 0)
-                            break;
+                            continue;
                         n /= length;
+                        const Point &v0 = m_positions[tri.idx[i]];
+                        const Point &v1 = m_positions[tri.idx[(i+1)%3]];
+                        const Point &v2 = m_positions[tri.idx[(i+2)%3]];
+                        Vector sideA(v1-v0), sideB(v2-v0);
+                        sum += n * unitAngle(normalize(sideA), normalize(sideB));
                     }
-                    Float angle = unitAngle(normalize(sideA), normalize(sideB));
-                    m_normals[tri.idx[i]] += n * angle;
+                    m_normals[v] = sum;
                 }
             }
 
-            for (size_t i=0; i<m_vertexCount; i++) {
+            #if defined(MTS_OPENMP)
+                #pragma omp parallel for reduction(+:invalidNormals) \
+                    if (m_triangleCount >= MTS_PARALLEL_NORMALS_THRESHOLD)
+            #endif
+            for (int i=0; i<(int) m_vertexCount; i++) {
                 Normal &n = m_normals[i];
                 Float length = n.length();
                 if (m_flipNormals)
@@ -680,9 +1175,116 @@ void TriMesh::computeNormals(bool force) {
             m_name.c_str(), invalidNormals);
 }
 
+void TriMesh::computeVertexCurvatures() {
+    ref<Timer> timer = new Timer();
+    releaseBuffer(m_curvatures);
+    m_curvatures = new Vector2[m_vertexCount];
+
+    /* Gather the triangle corners of each vertex (as in computeNormals()),
+       so that every vertex can be processed independently */
+    std::vector<uint32_t> cornerStart(m_vertexCount + 1, 0);
+    for (size_t i=0; i<m_triangleCount; i++) {
+        const Triangle tri = getTriangle(i);
+        for (int j=0; j<3; ++j)
+            cornerStart[tri.idx[j] + 1]++;
+    }
+    for (size_t i=0; i<m_vertexCount; i++)
+        cornerStart[i+1] += cornerStart[i];
+    std::vector<uint32_t> corners(cornerStart[m_vertexCount]);
+    std::vector<uint32_t> fill(cornerStart.begin(), cornerStart.end() - 1);
+    for (size_t i=0; i<m_triangleCount; i++) {
+        const Triangle tri = getTriangle(i);
+        for (int j=0; j<3; ++j)
+            corners[fill[tri.idx[j]]++] = (uint32_t) (3*i + j);
+    }
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic, 4096) \
+            if (m_triangleCount >= MTS_PARALLEL_NORMALS_THRESHOLD)
+    #endif
+    for (int v=0; v<(int) m_vertexCount; ++v) {
+        Vector laplacian(0.0f), faceNormals(0.0f);
+        Float area = 0, angleSum = 0;
+        bool boundary = false;
+
+        for (uint32_t k=cornerStart[v]; k<cornerStart[v+1]; ++k) {
+            const Triangle tri = getTriangle(corners[k] / 3);
+            int i = (int) (corners[k] % 3);
+            const Point &p0 = m_positions[tri.idx[i]];
+            const Point &p1 = m_positions[tri.idx[(i+1)%3]];
+            const Point &p2 = m_positions[tri.idx[(i+2)%3]];
+            Vector side1(p1-p0), side2(p2-p0), side12(p2-p1);
+            Vector n = cross(side1, side2);
+            Float doubleArea = n.length();
+            if (doubleArea == 0)
+                continue;
+
+            /* Cotangents of the angles at p1 and p2, which are opposite
+               of the edges p0-p2 and p0-p1 */
+            Float cot1 = -dot(side1, side12) / doubleArea,
+                  cot2 =  dot(side2, side12) / doubleArea;
+            laplacian += side1 * cot2 + side2 * cot1;
+            area += doubleArea * (1.0f / 6.0f);
+            angleSum += unitAngle(normalize(side1), normalize(side2));
+            faceNormals += n;
+
+            /* The edge to p1 lies on the boundary unless another
+               triangle of this vertex traverses it in reverse */
+            bool shared = false;
+            for (uint32_t l=cornerStart[v]; l<cornerStart[v+1] && !shared; ++l) {
+                const Triangle other = getTriangle(corners[l] / 3);
+                shared = other.idx[(corners[l] % 3 + 2) % 3] == tri.idx[(i+1)%3];
+            }
+            boundary |= !shared;
+        }
+
+        if (area == 0) {
+            m_curvatures[v] = Vector2(0.0f);
+            continue;
+        }
+
+        /* Orient the curvature normal like the surface */
+        Vector n = hasVertexNormals() ? Vector(getVertexNormal(v)) : faceNormals;
+        if (!n.isZero())
+            n = normalize(n);
+
+        m_curvatures[v] = Vector2(
+            0.25f * dot(laplacian, n) / area,
+            ((boundary ? M_PI : 2 * M_PI) - angleSum) / area);
+    }
+
+    Log(EDebug, "\"%s\": computed the vertex curvatures in %i ms",
+        m_name.c_str(), timer->getMilliseconds());
+}
+
+void TriMesh::getVertexCurvature(const Intersection &its, Float &H, Float &K) const {
+    Assert(m_curvatures && its.shape == this);
+    const Triangle tri = getTriangle(its.primIndex);
+    const Point &p0 = m_positions[tri.idx[0]];
+    Vector side1(m_positions[tri.idx[1]] - p0),
+           side2(m_positions[tri.idx[2]] - p0),
+           rel(its.p - p0);
+
+    /* Barycentric coordinates of the projection onto the triangle */
+    Float d11 = dot(side1, side1), d12 = dot(side1, side2),
+          d22 = dot(side2, side2), r1 = dot(rel, side1),
+          r2 = dot(rel, side2), det = d11*d22 - d12*d12;
+    Float b1 = 1.0f / 3.0f, b2 = 1.0f / 3.0f;
+    if (det > 0) {
+        Float invDet = 1.0f / det;
+        b1 = math::clamp((d22*r1 - d12*r2) * invDet, (Float) 0, (Float) 1);
+        b2 = math::clamp((d11*r2 - d12*r1) * invDet, (Float) 0, 1 - b1);
+    }
+
+    Vector2 result = m_curvatures[tri.idx[0]] * (1 - b1 - b2)
+        + m_curvatures[tri.idx[1]] * b1 + m_curvatures[tri.idx[2]] * b2;
+    H = result.x;
+    K = result.y;
+}
+
 void TriMesh::computeUVTangents() {
     // int degenerate = 0;
-    if (!m_texcoords) {
+    if (!hasVertexTexcoords()) {
         bool anisotropic = hasBSDF() && m_bsdf->getType() & BSDF::EAnisotropic;
         if (anisotropic)
             Log(EError, "\"%s\": computeUVTangents(): texture coordinates "
@@ -692,13 +1294,18 @@ void TriMesh::computeUVTangents() {
         return;
     }
 
-    if (m_tangents)
+    /* Compact meshes compute the tangents on the fly */
+    if (m_tangents || m_compact)
         return;
 
     m_tangents = new TangentSpace[m_triangleCount];
     memset(m_tangents, 0, sizeof(TangentSpace)*m_triangleCount);
 
-    for (size_t i=0; i<m_triangleCount; i++) {
+    /* Every triangle is independent, so the parallel result is exact */
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for if (m_triangleCount >= MTS_PARALLEL_NORMALS_THRESHOLD)
+    #endif
+    for (int i=0; i<(int) m_triangleCount; i++) {
         uint32_t idx0 = m_triangles[i].idx[0],
                  idx1 = m_triangles[i].idx[1],
                  idx2 = m_triangles[i].idx[2];
@@ -744,12 +1351,12 @@ void TriMesh::computeUVTangents() {
 
 void TriMesh::getNormalDerivative(const Intersection &its,
         Vector &dndu, Vector &dndv, bool shadingFrame) const {
-    if (!shadingFrame || !m_normals) {
+    if (!shadingFrame || !hasVertexNormals()) {
         dndu = dndv = Vector(0.0f);
     } else {
         Assert(its.primIndex < m_triangleCount);
 
-        const Triangle &tri = m_triangles[its.primIndex];
+        const Triangle tri = getTriangle(its.primIndex);
 
         uint32_t idx0 = tri.idx[0],
                  idx1 = tri.idx[1],
@@ -780,9 +1387,9 @@ void TriMesh::getNormalDerivative(const Intersection &its,
               w = 1 - u - v;
 
         const Normal
-            &n0 = m_normals[idx0],
-            &n1 = m_normals[idx1],
-            &n2 = m_normals[idx2];
+            n0 = getVertexNormal(idx0),
+            n1 = getVertexNormal(idx1),
+            n2 = getVertexNormal(idx2);
 
         /* Now compute the derivative of "normalize(u*n1 + v*n2 + (1-u-v)*n0)"
            with respect to [u, v] in the local triangle parameterization.
@@ -797,13 +1404,13 @@ void TriMesh::getNormalDerivative(const Intersection &its,
         dndu = (n1 - n0) * il; dndu -= N * dot(N, dndu);
         dndv = (n2 - n0) * il; dndv -= N * dot(N, dndv);
 
-        if (m_texcoords) {
+        if (hasVertexTexcoords()) {
             /* Compute derivatives with respect to a specified texture
                UV parameterization.  */
             const Point2
-                &uv0 = m_texcoords[idx0],
-                &uv1 = m_texcoords[idx1],
-                &uv2 = m_texcoords[idx2];
+                uv0 = getVertexTexcoord(idx0),
+                uv1 = getVertexTexcoord(idx1),
+                uv2 = getVertexTexcoord(idx2);
 
             Vector2 duv1 = uv1 - uv0, duv2 = uv2 - uv0;
 
@@ -837,6 +1444,16 @@ void TriMesh::serialize(Stream *stream, InstanceManager *manager) const {
         flags |= EHasColors;
     if (m_faceNormals)
         flags |= EFaceNormals;
+    if (m_compact)
+        flags |= ECompact;
+    if (m_packedNormals)
+        flags |= ECompactNormals;
+    if (m_packedTexcoords)
+        flags |= ECompactTexcoords;
+    if (m_localIndices)
+        flags |= ECompactIndices;
+    if (m_curvatures)
+        flags |= EHasCurvatures;
     stream->writeString(m_name);
     m_aabb.serialize(stream);
     stream->writeUInt(flags);
@@ -848,14 +1465,27 @@ void TriMesh::serialize(Stream *stream, InstanceManager *manager) const {
     if (m_normals)
         stream->writeFloatArray(reinterpret_cast<Float *>(m_normals),
             m_vertexCount * sizeof(Normal)/sizeof(Float));
-    if (m_texcoords)
+    else if (m_packedNormals)
+        stream->writeUIntArray(m_packedNormals, m_vertexCount);
+    if (m_texcoords) {
         stream->writeFloatArray(reinterpret_cast<Float *>(m_texcoords),
             m_vertexCount * sizeof(Point2)/sizeof(Float));
+    } else if (m_packedTexcoords) {
+        m_texcoordOffset.serialize(stream);
+        m_texcoordScale.serialize(stream);
+        stream->writeUShortArray(m_packedTexcoords, 2*m_vertexCount);
+    }
     if (m_colors)
         stream->writeFloatArray(reinterpret_cast<Float *>(m_colors),
             m_vertexCount * sizeof(Color3)/sizeof(Float));
-    stream->writeUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
-        m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+    if (m_localIndices) {
+        stream->writeUIntArray(m_clusterBase, (m_triangleCount
+            + MTS_TRIMESH_CLUSTER_SIZE - 1) / MTS_TRIMESH_CLUSTER_SIZE);
+        stream->writeUShortArray(m_localIndices, 3*m_triangleCount);
+    } else {
+        stream->writeUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
+            m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+    }
 }
 
 ref<TriMesh> TriMesh::fromBlender(const std::string &name,
@@ -1005,7 +1635,59 @@ ref<TriMesh> TriMesh::fromBlender(const std::string &name,
     return triMesh;
 }
 
+/**
+ * The file formats always store the full-precision representation. This
+ * helper decodes the arrays of compact meshes (and passes through the
+ * arrays of regular ones)
+ */
+struct ExpandedArrays {
+    const Normal *normals;
+    const Point2 *texcoords;
+    const Triangle *triangles;
+
+    ExpandedArrays(const TriMesh *mesh) : m_normals(NULL),
+            m_texcoords(NULL), m_triangles(NULL) {
+        size_t vertexCount = mesh->getVertexCount(),
+               triangleCount = mesh->getTriangleCount();
+        normals = mesh->getVertexNormals();
+        if (!normals && mesh->hasVertexNormals()) {
+            m_normals = new Normal[vertexCount];
+            for (size_t i=0; i<vertexCount; ++i)
+                m_normals[i] = mesh->getVertexNormal(i);
+            normals = m_normals;
+        }
+        texcoords = mesh->getVertexTexcoords();
+        if (!texcoords && mesh->hasVertexTexcoords()) {
+            m_texcoords = new Point2[vertexCount];
+            for (size_t i=0; i<vertexCount; ++i)
+                m_texcoords[i] = mesh->getVertexTexcoord(i);
+            texcoords = m_texcoords;
+        }
+        triangles = mesh->getTriangles();
+        if (!triangles) {
+            m_triangles = new Triangle[triangleCount];
+            for (size_t i=0; i<triangleCount; ++i)
+                m_triangles[i] = mesh->getTriangle(i);
+            triangles = m_triangles;
+        }
+    }
+
+    ~ExpandedArrays() {
+        delete[] m_normals;
+        delete[] m_texcoords;
+        delete[] m_triangles;
+    }
+private:
+    Normal *m_normals;
+    Point2 *m_texcoords;
+    Triangle *m_triangles;
+};
+
 void TriMesh::writeOBJ(const fs::path &path) const {
+    ExpandedArrays expanded(this);
+    const Normal *normals = expanded.normals;
+    const Point2 *texcoords = expanded.texcoords;
+    const Triangle *triangles = expanded.triangles;
     fs::ofstream os(path);
     os << "o " << m_name << endl;
     for (size_t i=0; i<m_vertexCount; ++i) {
@@ -1015,33 +1697,33 @@ void TriMesh::writeOBJ(const fs::path &path) const {
             << m_positions[i].z << endl;
     }
 
-    if (m_texcoords) {
+    if (texcoords) {
         for (size_t i=0; i<m_vertexCount; ++i) {
             os << "vt "
-                << m_texcoords[i].x << " "
-                << m_texcoords[i].y << endl;
+                << texcoords[i].x << " "
+                << texcoords[i].y << endl;
         }
     }
 
-    if (m_normals) {
+    if (normals) {
         for (size_t i=0; i<m_vertexCount; ++i) {
             os << "vn "
-                << m_normals[i].x << " "
-                << m_normals[i].y << " "
-                << m_normals[i].z << endl;
+                << normals[i].x << " "
+                << normals[i].y << " "
+                << normals[i].z << endl;
         }
     }
 
     for (size_t i=0; i<m_triangleCount; ++i) {
-        uint32_t i0 = m_triangles[i].idx[0] + 1,
-                 i1 = m_triangles[i].idx[1] + 1,
-                 i2 = m_triangles[i].idx[2] + 1;
+        uint32_t i0 = triangles[i].idx[0] + 1,
+                 i1 = triangles[i].idx[1] + 1,
+                 i2 = triangles[i].idx[2] + 1;
 
-        if (m_normals && m_texcoords) {
+        if (normals && texcoords) {
             os << "f " << i0 << "/" << i0 << "/" << i0 << " "
                <<  i1 << "/" << i1 << "/" << i1 << " "
                <<  i2 << "/" << i2 << "/" << i2 << endl;
-        } else if (m_normals) {
+        } else if (normals) {
             os << "f " << i0 << "//" << i0 << " "
                <<  i1 << "//" << i1 << " "
                <<  i2 << "//" << i2 << endl;
@@ -1054,6 +1736,10 @@ void TriMesh::writeOBJ(const fs::path &path) const {
 }
 
 void TriMesh::writePLY(const fs::path &path) const {
+    ExpandedArrays expanded(this);
+    const Normal *normals = expanded.normals;
+    const Point2 *texcoords = expanded.texcoords;
+    const Triangle *triangles = expanded.triangles;
     fs::ofstream os(path, std::ios::out | std::ios::binary);
 
     os << "ply\n";
@@ -1069,14 +1755,14 @@ void TriMesh::writePLY(const fs::path &path) const {
     os << "property float y\n";
     os << "property float z\n";
 
-    if (m_normals) {
+    if (normals) {
         os << "property float nx\n";
         os << "property float ny\n";
         os << "property float nz\n";
         storagePerVertex += 3 * sizeof(float);
     }
 
-    if (m_texcoords) {
+    if (texcoords) {
         os << "property float u\n";
         os << "property float v\n";
         storagePerVertex += 2 * sizeof(float);
@@ -1098,11 +1784,11 @@ void TriMesh::writePLY(const fs::path &path) const {
 
     for (size_t i=0; i< getVertexCount(); ++i) {
         Vector3f p(m_positions[i]); memcpy(ptr, &p, sizeof(Vector3f)); ptr += sizeof(Vector3f);
-        if (m_normals) {
-            Vector3f n(m_normals[i]); memcpy(ptr, &n, sizeof(Vector3f)); ptr += sizeof(Vector3f);
+        if (normals) {
+            Vector3f n(normals[i]); memcpy(ptr, &n, sizeof(Vector3f)); ptr += sizeof(Vector3f);
         }
-        if (m_texcoords) {
-            Vector2f uv(m_texcoords[i]); memcpy(ptr, &uv, sizeof(Vector2f)); ptr += sizeof(Vector2f);
+        if (texcoords) {
+            Vector2f uv(texcoords[i]); memcpy(ptr, &uv, sizeof(Vector2f)); ptr += sizeof(Vector2f);
         }
         if (m_colors) {
             *ptr += (uint8_t) std::max(0.0f, std::min(255.0f, (float) m_colors[i][0] * 255.0f + 0.5f));
@@ -1119,7 +1805,7 @@ void TriMesh::writePLY(const fs::path &path) const {
     ptr = faceStorage;
     for (size_t i=0; i<getTriangleCount(); ++i) {
         *ptr++ = (uint8_t) 0x03;
-        memcpy(ptr, &m_triangles[i], sizeof(Triangle));
+        memcpy(ptr, &triangles[i], sizeof(Triangle));
         ptr += sizeof(Triangle);
     }
     Assert((size_t) (ptr-faceStorage) == faceStorageSize);
@@ -1129,6 +1815,11 @@ void TriMesh::writePLY(const fs::path &path) const {
     os.close();
 }
 void TriMesh::serialize(Stream *_stream) const {
+    ExpandedArrays expanded(this);
+    const Normal *normals = expanded.normals;
+    const Point2 *texcoords = expanded.texcoords;
+    const Triangle *triangles = expanded.triangles;
+
     ref<Stream> stream = _stream;
 
     if (stream->getByteOrder() != Stream::ELittleEndian)
@@ -1136,8 +1827,8 @@ void TriMesh::serialize(Stream *_stream) const {
             "which was not previously set to little endian byte order!");
 
     stream->writeShort(MTS_FILEFORMAT_HEADER);
-    stream->writeShort(MTS_FILEFORMAT_VERSION_V4);
-    stream = new ZStream(stream);
+    stream->writeShort(MTS_FILEFORMAT_VERSION_V6);
+    stream = new ZStream(stream, ZStream::EBlockStream);
 
 #if defined(SINGLE_PRECISION)
     uint32_t flags = ESinglePrecision;
@@ -1145,9 +1836,9 @@ void TriMesh::serialize(Stream *_stream) const {
     uint32_t flags = EDoublePrecision;
 #endif
 
-    if (m_normals)
+    if (normals)
         flags |= EHasNormals;
-    if (m_texcoords)
+    if (texcoords)
         flags |= EHasTexcoords;
     if (m_colors)
         flags |= EHasColors;
@@ -1161,19 +1852,83 @@ void TriMesh::serialize(Stream *_stream) const {
 
     stream->writeFloatArray(reinterpret_cast<Float *>(m_positions),
         m_vertexCount * sizeof(Point)/sizeof(Float));
-    if (m_normals)
-        stream->writeFloatArray(reinterpret_cast<Float *>(m_normals),
+    if (normals)
+        stream->writeFloatArray(reinterpret_cast<const Float *>(normals),
             m_vertexCount * sizeof(Normal)/sizeof(Float));
-    if (m_texcoords)
-        stream->writeFloatArray(reinterpret_cast<Float *>(m_texcoords),
+    if (texcoords)
+        stream->writeFloatArray(reinterpret_cast<const Float *>(texcoords),
             m_vertexCount * sizeof(Point2)/sizeof(Float));
     if (m_colors)
         stream->writeFloatArray(reinterpret_cast<Float *>(m_colors),
             m_vertexCount * sizeof(Color3)/sizeof(Float));
-    stream->writeUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
+    stream->writeUIntArray(reinterpret_cast<const uint32_t *>(triangles),
         m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
 }
 
+void TriMesh::serializeMappable(Stream *stream) const {
+    ExpandedArrays expanded(this);
+    const Normal *normals = expanded.normals;
+    const Point2 *texcoords = expanded.texcoords;
+    const Triangle *triangles = expanded.triangles;
+
+    if (stream->getByteOrder() != Stream::ELittleEndian)
+        Log(EError, "Tried to serialize a shape to a stream, "
+            "which was not previously set to little endian byte order!");
+
+    stream->writeShort(MTS_FILEFORMAT_HEADER);
+    stream->writeShort(MTS_FILEFORMAT_VERSION_V5);
+
+#if defined(SINGLE_PRECISION)
+    uint32_t flags = ESinglePrecision;
+#else
+    uint32_t flags = EDoublePrecision;
+#endif
+
+    if (normals)
+        flags |= EHasNormals;
+    if (texcoords)
+        flags |= EHasTexcoords;
+    if (m_colors)
+        flags |= EHasColors;
+    if (m_faceNormals)
+        flags |= EFaceNormals;
+
+    stream->writeUInt(flags);
+    stream->writeString(m_name);
+    stream->writeSize(m_vertexCount);
+    stream->writeSize(m_triangleCount);
+
+    writePadding(stream);
+    stream->writeFloatArray(reinterpret_cast<Float *>(m_positions),
+        m_vertexCount * sizeof(Point)/sizeof(Float));
+    if (normals) {
+        writePadding(stream);
+        stream->writeFloatArray(reinterpret_cast<const Float *>(normals),
+            m_vertexCount * sizeof(Normal)/sizeof(Float));
+    }
+    if (texcoords) {
+        writePadding(stream);
+        stream->writeFloatArray(reinterpret_cast<const Float *>(texcoords),
+            m_vertexCount * sizeof(Point2)/sizeof(Float));
+    }
+    if (m_colors) {
+        writePadding(stream);
+        stream->writeFloatArray(reinterpret_cast<Float *>(m_colors),
+            m_vertexCount * sizeof(Color3)/sizeof(Float));
+    }
+    writePadding(stream);
+    stream->writeUIntArray(reinterpret_cast<const uint32_t *>(triangles),
+        m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+}
+
+int TriMesh::getSerializedMeshCount(Stream *stream) {
+    const short version = readHeader(stream);
+    std::vector<size_t> offsets;
+    int count = readOffsetDictionary(stream, version, offsets);
+    /* Files without a dictionary contain a single mesh */
+    return count < 0 ? 1 : count;
+}
+
 size_t TriMesh::getPrimitiveCount() const {
     return m_triangleCount;
 }
@@ -1189,10 +1944,11 @@ std::string TriMesh::toString() const {
         << "  triangleCount = " << m_triangleCount << "," << endl
         << "  vertexCount = " << m_vertexCount << "," << endl
         << "  faceNormals = " << (m_faceNormals ? "true" : "false") << "," << endl
-        << "  hasNormals = " << (m_normals ? "true" : "false") << "," << endl
-        << "  hasTexcoords = " << (m_texcoords ? "true" : "false") << "," << endl
+        << "  hasNormals = " << (hasVertexNormals() ? "true" : "false") << "," << endl
+        << "  hasTexcoords = " << (hasVertexTexcoords() ? "true" : "false") << "," << endl
         << "  hasTangents = " << (m_tangents ? "true" : "false") << "," << endl
         << "  hasColors = " << (m_colors ? "true" : "false") << "," << endl
+        << "  compact = " << (m_compact ? "true" : "false") << "," << endl
         << "  surfaceArea = " << m_surfaceArea << "," << endl
         << "  aabb = " << m_aabb.toString() << "," << endl
         << "  bsdf = " << indent(m_bsdf.toString()) << "," << endl;
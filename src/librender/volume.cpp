@@ -44,6 +44,16 @@ Float VolumeDataSource::lookupFloat(const Point &p) const {
     return 0;
 }
 
+void VolumeDataSource::lookupFloatSequence(const Point &p, const Vector &increment,
+        size_t count, Float *values) const {
+    for (size_t i=0; i<count; ++i)
+        values[i] = lookupFloat(p + increment * (Float) i);
+}
+
+Float VolumeDataSource::lookupFloatStochastic(const Point &p, Float sample) const {
+    return lookupFloat(p);
+}
+
 Spectrum VolumeDataSource::lookupSpectrum(const Point &p) const {
     Log(EError, "'%s': does not implement lookupSpectrum()!", getClass()->getName().c_str());
     return Spectrum(0.0f);
@@ -66,6 +76,14 @@ bool VolumeDataSource::supportsVectorLookups() const {
     return false;
 }
 
+Float VolumeDataSource::getLocalMaximumFloatValue(const AABB &aabb) const {
+    return getMaximumFloatValue();
+}
+
+bool VolumeDataSource::hasLocalMaxima() const {
+    return false;
+}
+
 MTS_IMPLEMENT_CLASS(VolumeDataSource, true, ConfigurableObject)
 MTS_NAMESPACE_END
 
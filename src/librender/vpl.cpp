@@ -19,6 +19,7 @@
 #include <mitsuba/render/vpl.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/statistics.h>
+#include <queue>
 
 MTS_NAMESPACE_BEGIN
 
@@ -209,6 +210,277 @@ size_t generateVPLs(const Scene *scene, Random *random,
     return offset;
 }
 
+size_t generateVRLs(const Scene *scene, size_t offset, size_t count,
+        int maxDepth, std::deque<VRL> &vrls) {
+    /* A VRL of depth k contributes to paths of length k+2 */
+    if (maxDepth != -1 && maxDepth < 3)
+        return 0;
+
+    Properties props("halton");
+    props.setInteger("scramble", 0);
+    ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+        createObject(MTS_CLASS(Sampler), props));
+    sampler->configure();
+    sampler->generate(Point2i(0));
+
+    const Sensor *sensor = scene->getSensor();
+    const AABB &sceneAABB = scene->getKDTree()->getAABB();
+    int retries = 0;
+
+    while (vrls.size() < count) {
+        sampler->setSampleIndex(++offset);
+
+        if (vrls.empty() && ++retries > 10000) {
+            /* Unable to generate VRLs in this scene -- give up. */
+            return 0;
+        }
+
+        Float time = sensor->getShutterOpen()
+            + sensor->getShutterOpenTime() * sampler->next1D();
+
+        const Emitter *emitter;
+        Ray ray;
+        Spectrum power = scene->sampleEmitterRay(ray, emitter,
+            sampler->next2D(), sampler->next2D(), time);
+        const Medium *medium = emitter->getMedium();
+        int depth = 1;
+
+        while (!power.isZero() && (maxDepth == -1 || depth + 2 <= maxDepth)) {
+            Intersection its;
+            bool hit = scene->rayIntersect(ray, its);
+
+            if (medium) {
+                Float length = its.t;
+                if (!hit) {
+                    /* Clip escaping segments against the scene bounds */
+                    Float nearT, farT;
+                    if (!sceneAABB.rayIntersect(ray, nearT, farT) || farT <= 0)
+                        break;
+                    length = farT;
+                }
+
+                vrls.push_back(VRL(ray.o, ray.d, length, power, medium, time, depth));
+
+                MediumSamplingRecord mRec;
+                if (medium->sampleDistance(Ray(ray, 0, length), mRec, sampler)) {
+                    /* Continue the light path from a scattering event */
+                    power *= mRec.sigmaS * mRec.transmittance / mRec.pdfSuccess;
+                    PhaseFunctionSamplingRecord pRec(mRec, -ray.d);
+                    Float phaseVal = medium->getPhaseFunction()->sample(pRec, sampler);
+                    if (phaseVal == 0)
+                        break;
+                    power *= phaseVal;
+                    ray = Ray(mRec.p, pRec.wo, time);
+                    ++depth;
+                    continue;
+                }
+                power *= mRec.transmittance / mRec.pdfFailure;
+            }
+
+            if (!hit)
+                break;
+
+            const BSDF *bsdf = its.getBSDF();
+            BSDFSamplingRecord bRec(its, sampler, EImportance);
+            Spectrum bsdfVal = bsdf->sample(bRec, sampler->next2D());
+            if (bsdfVal.isZero())
+                break;
+
+            bool nullInteraction = bRec.sampledType & BSDF::ENull;
+            if (!nullInteraction) {
+                /* Russian roulette as in generateVPLs() */
+                Float approxAlbedo = std::min((Float) 0.95f, bsdfVal.max());
+                if (sampler->next1D() > approxAlbedo)
+                    break;
+                bsdfVal /= approxAlbedo;
+                ++depth;
+            }
+            power *= bsdfVal;
+
+            Vector wo = its.toWorld(bRec.wo);
+            if (its.isMediumTransition())
+                medium = its.getTargetMedium(wo);
+            ray = Ray(its.p, wo, time);
+        }
+    }
+
+    return offset;
+}
+
+namespace {
+    /// A contiguous range of VPL indices that forms one cluster
+    struct VPLCluster {
+        uint32_t start, end;
+        int axis;
+        Float error;
+
+        inline bool operator<(const VPLCluster &c) const {
+            return error < c.error;
+        }
+    };
+
+    /// Orders VPL indices by their grouping key (type, then emitter)
+    struct VPLGroupOrder {
+        const std::deque<VPL> &vpls;
+
+        VPLGroupOrder(const std::deque<VPL> &vpls) : vpls(vpls) { }
+
+        inline bool operator()(uint32_t a, uint32_t b) const {
+            const VPL &va = vpls[a], &vb = vpls[b];
+            if (va.type != vb.type)
+                return va.type < vb.type;
+            if (va.type == ESurfaceVPL)
+                return false;
+            return std::less<const Emitter *>()(va.emitter, vb.emitter);
+        }
+    };
+
+    /// Orders VPL indices along one dimension of the clustering space
+    struct VPLAxisOrder {
+        const Float *keys;
+        int axis;
+
+        VPLAxisOrder(const Float *keys, int axis) : keys(keys), axis(axis) { }
+
+        inline bool operator()(uint32_t a, uint32_t b) const {
+            return keys[6*a + axis] < keys[6*b + axis];
+        }
+    };
+
+    /// Compute the error bound and split axis of a range of VPLs
+    VPLCluster createCluster(uint32_t start, uint32_t end,
+            const std::vector<Float> &keys, const std::vector<Float> &luminance,
+            const std::vector<uint32_t> &indices) {
+        Float minKey[6], maxKey[6], lumSum = 0;
+        for (int j=0; j<6; ++j) {
+            minKey[j] = std::numeric_limits<Float>::infinity();
+            maxKey[j] = -std::numeric_limits<Float>::infinity();
+        }
+        for (uint32_t k=start; k<end; ++k) {
+            const Float *key = &keys[6*indices[k]];
+            for (int j=0; j<6; ++j) {
+                minKey[j] = std::min(minKey[j], key[j]);
+                maxKey[j] = std::max(maxKey[j], key[j]);
+            }
+            lumSum += luminance[indices[k]];
+        }
+
+        VPLCluster c;
+        c.start = start; c.end = end; c.axis = 0;
+        for (int j=1; j<6; ++j) {
+            if (maxKey[j]-minKey[j] > maxKey[c.axis]-minKey[c.axis])
+                c.axis = j;
+        }
+        Float extent = maxKey[c.axis] - minKey[c.axis];
+        c.error = lumSum * extent * extent;
+        return c;
+    }
+
+    /// Queue a cluster for refinement unless it can't be split any further
+    inline void enqueueCluster(const VPLCluster &c,
+            std::priority_queue<VPLCluster> &queue, std::vector<VPLCluster> &done) {
+        if (c.end - c.start > 1 && c.error > 0)
+            queue.push(c);
+        else
+            done.push_back(c);
+    }
+};
+
+void clusterVPLs(const std::deque<VPL> &vpls, size_t maxClusters,
+        Random *random, std::deque<VPL> &clusters) {
+    clusters.clear();
+    size_t count = vpls.size();
+    if (count == 0)
+        return;
+
+    /* Orientation is weighted relative to the extent of the VPL positions */
+    AABB aabb;
+    for (size_t i=0; i<count; ++i) {
+        if (vpls[i].type != EDirectionalEmitterVPL)
+            aabb.expandBy(vpls[i].its.p);
+    }
+    Float normalScale = aabb.isValid() ? 0.25f * aabb.getExtents().length() : 1.0f;
+
+    /* Each VPL becomes a point in a 6D space of position and orientation */
+    std::vector<Float> keys(6*count), luminance(count);
+    std::vector<uint32_t> indices(count);
+    for (size_t i=0; i<count; ++i) {
+        const VPL &vpl = vpls[i];
+        Float *key = &keys[6*i];
+        for (int j=0; j<3; ++j) {
+            key[j] = vpl.type == EDirectionalEmitterVPL ? 0.0f : vpl.its.p[j];
+            key[j+3] = vpl.its.shFrame.n[j] * normalScale;
+        }
+        luminance[i] = std::max((Float) 0, vpl.P.getLuminance());
+        indices[i] = (uint32_t) i;
+    }
+
+    std::priority_queue<VPLCluster> queue;
+    std::vector<VPLCluster> done;
+
+    /* Start with one cluster per group of compatible VPLs */
+    VPLGroupOrder groupOrder(vpls);
+    std::stable_sort(indices.begin(), indices.end(), groupOrder);
+    uint32_t groupStart = 0;
+    for (uint32_t i=1; i<=(uint32_t) count; ++i) {
+        if (i == count || groupOrder(indices[groupStart], indices[i])) {
+            enqueueCluster(createCluster(groupStart, i, keys, luminance, indices), queue, done);
+            groupStart = i;
+        }
+    }
+
+    /* Refine the cut until the cluster budget is exhausted */
+    while (!queue.empty() && queue.size() + done.size() < maxClusters) {
+        VPLCluster c = queue.top();
+        queue.pop();
+        uint32_t mid = c.start + (c.end - c.start) / 2;
+        std::nth_element(indices.begin() + c.start, indices.begin() + mid,
+            indices.begin() + c.end, VPLAxisOrder(&keys[0], c.axis));
+        enqueueCluster(createCluster(c.start, mid, keys, luminance, indices), queue, done);
+        enqueueCluster(createCluster(mid, c.end, keys, luminance, indices), queue, done);
+    }
+
+    while (!queue.empty()) {
+        done.push_back(queue.top());
+        queue.pop();
+    }
+
+    /* Pick a representative for every cluster */
+    for (size_t i=0; i<done.size(); ++i) {
+        const VPLCluster &c = done[i];
+        Float lumSum = 0, emitterScale = 0;
+        for (uint32_t k=c.start; k<c.end; ++k) {
+            lumSum += luminance[indices[k]];
+            emitterScale += vpls[indices[k]].emitterScale;
+        }
+
+        uint32_t rep = c.end - 1;
+        Float weight;
+        if (lumSum > 0) {
+            Float sample = random->nextFloat() * lumSum;
+            for (uint32_t k=c.start; k<c.end; ++k) {
+                Float lum = luminance[indices[k]];
+                if (lum > 0) {
+                    rep = k;
+                    if (sample < lum)
+                        break;
+                    sample -= lum;
+                }
+            }
+            weight = lumSum / luminance[indices[rep]];
+        } else {
+            rep = c.start + std::min(c.end - c.start - 1,
+                (uint32_t) (random->nextFloat() * (c.end - c.start)));
+            weight = (Float) (c.end - c.start);
+        }
+
+        VPL vpl = vpls[indices[rep]];
+        vpl.P *= weight;
+        vpl.emitterScale = emitterScale;
+        clusters.push_back(vpl);
+    }
+}
+
 const char *toString(EVPLType type) {
     switch (type) {
         case EPointEmitterVPL: return "emitterVPL";
@@ -234,4 +506,16 @@ std::string VPL::toString() const {
     return oss.str();
 }
 
+std::string VRL::toString() const {
+    std::ostringstream oss;
+    oss << "VRL[" << endl
+        << "  o = " << o.toString() << "," << endl
+        << "  d = " << d.toString() << "," << endl
+        << "  length = " << length << "," << endl
+        << "  P = " << P.toString() << "," << endl
+        << "  depth = " << depth << endl
+        << "]" << endl;
+    return oss.str();
+}
+
 MTS_NAMESPACE_END
@@ -61,6 +61,15 @@ static StatsCounter earlyExits("Heterogeneous volume",
  *             from good sample generators and not providing
  *             information that is required by bidirectional
  *             rendering techniques.
+ *             \item \code{ratio}: Like \code{woodcock}, but transmittances
+ *             are estimated using ratio tracking, which weights every
+ *             tentative collision instead of terminating at the first
+ *             real one. This gives a lower variance estimate of shadowing.
+ *             \item \code{residual}: Like \code{ratio}, but the
+ *             transmittance of the mean density of the medium is computed
+ *             analytically and only the residual is tracked (residual ratio
+ *             tracking). Works best when the density does not deviate much
+ *             from its mean.
  *         \end{enumerate}
  *         Default: \texttt{woodcock}
  *     }
@@ -81,6 +90,36 @@ static StatsCounter earlyExits("Heterogeneous volume",
  *         Provided for convenience when accomodating data based on different units,
  *         or to simply tweak the density of the medium. \default{1}
  *     }
+ *     \parameter{majorantResolution}{\Integer}{
+ *         When using Woodcock tracking, this optionally replaces the single
+ *         maximum density of the medium by a coarse grid of maxima
+ *         that has this many cells along the longest axis of the volume.
+ *         Tracking then takes far fewer tentative steps in sparse regions.
+ *         The maxima are found by evaluating the density at the resolution
+ *         of its step size, so the density should not contain features
+ *         that are smaller than that. Data sources that store bounds
+ *         for parts of their data (e.g. \pluginref{sparsevolume}) supply
+ *         the maxima directly instead. \default{0, i.e. disabled}
+ *     }
+ *     \parameter{stochasticLookups}{\Boolean}{
+ *         When tracking through the medium, fetch a single randomly chosen
+ *         voxel of the density per lookup instead of interpolating between
+ *         eight of them. The tracking estimates remain unbiased, since the
+ *         expected value of such a lookup equals the interpolated density.
+ *         This reduces the memory traffic of large volumes at the cost of
+ *         some additional noise. Has no effect when using Simpson
+ *         quadrature. \default{\code{false}}
+ *     }
+ *     \parameter{transmittanceCache}{\Integer}{
+ *         When rendering with \pluginref{volpath}, this optionally caches
+ *         the optical depth toward every point, spot and directional
+ *         emitter on a lattice with this many points along the longest
+ *         axis of the volume. Shadow rays toward these emitters then
+ *         interpolate the cached values instead of marching through the
+ *         density. This is biased (the density is effectively blurred
+ *         along the lattice spacing), and the cache is only built on the
+ *         machine that preprocesses the scene. \default{0, i.e. disabled}
+ *     }
  *     \parameter{\Unnamed}{\Phase}{
  *          A nested phase function that describes the directional
  *          scattering properties of the medium. When none is specified,
@@ -177,13 +216,29 @@ public:
          * incompatible with bidirectional rendering methods, which
          * usually need to know the probability of a sample.
          */
-        EWoodcockTracking
+        EWoodcockTracking,
+
+        /**
+         * \brief Sample scattering locations with Woodcock tracking,
+         * but estimate transmittances using ratio tracking
+         */
+        ERatioTracking,
+
+        /**
+         * \brief Sample scattering locations with Woodcock tracking,
+         * but estimate transmittances using residual ratio tracking
+         * with the mean density as control
+         */
+        EResidualRatioTracking
     };
 
     HeterogeneousMedium(const Properties &props)
         : Medium(props) {
         m_stepSize = props.getFloat("stepSize", 0);
         m_scale = props.getFloat("scale", 1);
+        m_majorantResolution = props.getInteger("majorantResolution", 0);
+        m_stochasticLookups = props.getBoolean("stochasticLookups", false);
+        m_transmittanceCacheResolution = props.getInteger("transmittanceCache", 0);
         if (props.hasProperty("sigmaS") || props.hasProperty("sigmaA"))
             Log(EError, "The 'sigmaS' and 'sigmaA' properties are only supported by "
                 "homogeneous media. Please use nested volume instances to supply "
@@ -197,6 +252,10 @@ public:
             m_method = EWoodcockTracking;
         else if (method == "simpson")
             m_method = ESimpsonQuadrature;
+        else if (method == "ratio")
+            m_method = ERatioTracking;
+        else if (method == "residual")
+            m_method = EResidualRatioTracking;
         else
             Log(EError, "Unsupported integration method \"%s\"!", method.c_str());
     }
@@ -210,6 +269,9 @@ public:
         m_albedo = static_cast<VolumeDataSource *>(manager->getInstance(stream));
         m_orientation = static_cast<VolumeDataSource *>(manager->getInstance(stream));
         m_stepSize = stream->readFloat();
+        m_majorantResolution = stream->readInt();
+        m_stochasticLookups = stream->readBool();
+        m_transmittanceCacheResolution = stream->readInt();
         configure();
     }
 
@@ -222,6 +284,9 @@ public:
         manager->serialize(stream, m_albedo.get());
         manager->serialize(stream, m_orientation.get());
         stream->writeFloat(m_stepSize);
+        stream->writeInt(m_majorantResolution);
+        stream->writeBool(m_stochasticLookups);
+        stream->writeInt(m_transmittanceCacheResolution);
     }
 
     void configure() {
@@ -257,6 +322,381 @@ public:
         if (m_anisotropicMedium && m_orientation.get() == NULL)
             Log(EError, "Cannot use anisotropic phase function: "
                 "did not specify a particle orientation field!");
+
+        m_majorants.clear();
+        if (m_majorantResolution > 0 && m_method != ESimpsonQuadrature)
+            buildMajorantGrid();
+
+        m_controlDensity = 0.0f;
+        m_residualMajorant = m_maxDensity;
+        m_invResidualMajorant = m_invMaxDensity;
+        if (m_method == EResidualRatioTracking)
+            computeControlDensity();
+    }
+
+    /**
+     * Compute the maximum density within each cell of a coarse grid over
+     * the density volume. When the data source cannot report local maxima,
+     * the density is evaluated on a lattice with the spacing of the voxels
+     * of the volume, and every lookup contributes to all cells within one
+     * lattice spacing, so that the maxima also bound the interpolated
+     * values between the lattice points.
+     */
+    void buildMajorantGrid() {
+        ref<Timer> timer = new Timer();
+        Vector extents = m_densityAABB.getExtents();
+        Float cellSize = extents[m_densityAABB.getLargestAxis()] / m_majorantResolution;
+        for (int i=0; i<3; ++i) {
+            m_majorantRes[i] = std::max(1, math::ceilToInt(extents[i] / cellSize));
+            m_majorantCellSize[i] = extents[i] / m_majorantRes[i];
+            m_invMajorantCellSize[i] = m_majorantCellSize[i] > 0 ? 1 / m_majorantCellSize[i] : 0;
+        }
+
+        size_t cellCount = (size_t) m_majorantRes.x * m_majorantRes.y * m_majorantRes.z;
+        m_majorants.resize(cellCount);
+        std::fill(m_majorants.begin(), m_majorants.end(), 0.0f);
+
+        if (m_density->hasLocalMaxima()) {
+            for (int z=0; z<m_majorantRes.z; ++z) {
+                for (int y=0; y<m_majorantRes.y; ++y) {
+                    for (int x=0; x<m_majorantRes.x; ++x) {
+                        Point cmin = m_densityAABB.min + Vector(x * m_majorantCellSize.x,
+                            y * m_majorantCellSize.y, z * m_majorantCellSize.z);
+                        m_majorants[(z * m_majorantRes.y + y) * m_majorantRes.x + x] =
+                            m_density->getLocalMaximumFloatValue(AABB(cmin, cmin + m_majorantCellSize));
+                    }
+                }
+            }
+        } else {
+            /* Grid volumes report half of their voxel size as step size */
+            Float spacing = 2 * m_density->getStepSize();
+            if (!std::isfinite(spacing) || spacing <= 0)
+                spacing = cellSize / EMaxMajorantLookups;
+
+            Vector3i lookups;
+            for (int i=0; i<3; ++i)
+                lookups[i] = std::min(math::ceilToInt(extents[i] / spacing),
+                        m_majorantRes[i] * EMaxMajorantLookups) + 1;
+
+            Vector step;
+            for (int i=0; i<3; ++i)
+                step[i] = lookups[i] > 1 ? extents[i] / (lookups[i] - 1) : 0;
+
+            for (int z=0; z<lookups.z; ++z) {
+                for (int y=0; y<lookups.y; ++y) {
+                    for (int x=0; x<lookups.x; ++x) {
+                        Point p = m_densityAABB.min + Vector(x * step.x, y * step.y, z * step.z);
+                        Float density = m_density->lookupFloat(p);
+                        if (density <= 0)
+                            continue;
+
+                        /* Range of cells within one lattice spacing of the lookup */
+                        Vector3i cmin, cmax;
+                        for (int i=0; i<3; ++i) {
+                            Float rel = p[i] - m_densityAABB.min[i];
+                            cmin[i] = math::clamp(math::floorToInt((rel - step[i]) * m_invMajorantCellSize[i]),
+                                    0, m_majorantRes[i] - 1);
+                            cmax[i] = math::clamp(math::floorToInt((rel + step[i]) * m_invMajorantCellSize[i]),
+                                    0, m_majorantRes[i] - 1);
+                        }
+                        for (int cz=cmin.z; cz<=cmax.z; ++cz)
+                            for (int cy=cmin.y; cy<=cmax.y; ++cy)
+                                for (int cx=cmin.x; cx<=cmax.x; ++cx) {
+                                    Float &majorant = m_majorants[(cz * m_majorantRes.y + cy) * m_majorantRes.x + cx];
+                                    majorant = std::max(majorant, density);
+                                }
+                    }
+                }
+            }
+        }
+
+        Float sum = 0;
+        for (size_t i=0; i<cellCount; ++i) {
+            Float majorant = m_majorants[i] * m_scale;
+            if (m_anisotropicMedium)
+                majorant *= m_phaseFunction->sigmaDirMax();
+            m_majorants[i] = std::min(majorant, m_maxDensity);
+            sum += m_majorants[i];
+        }
+
+        Log(EInfo, "Built a %s majorant grid in %i ms (average majorant: %f, "
+            "global maximum: %f)", m_majorantRes.toString().c_str(),
+            timer->getMilliseconds(), sum / cellCount, m_maxDensity);
+    }
+
+    /**
+     * Integrate the density from the points of a lattice over the volume
+     * toward each emitter with a single position or direction. Since all
+     * shadow rays toward such an emitter lie on rays that end there, the
+     * optical depth of a segment is the difference of the depths at its
+     * end points.
+     */
+    void cacheEmitterTransmittance(const Scene *scene) {
+        m_transmittanceCaches.clear();
+        if (m_transmittanceCacheResolution <= 0)
+            return;
+
+        ref<Timer> timer = new Timer();
+        Vector extents = m_densityAABB.getExtents();
+        Float spacing = extents[m_densityAABB.getLargestAxis()]
+            / m_transmittanceCacheResolution;
+        for (int i=0; i<3; ++i) {
+            m_cacheRes[i] = std::max(1, math::ceilToInt(extents[i] / spacing)) + 1;
+            m_cacheSpacing[i] = extents[i] / (m_cacheRes[i] - 1);
+            m_invCacheSpacing[i] = m_cacheSpacing[i] > 0 ? 1 / m_cacheSpacing[i] : 0;
+        }
+        size_t pointCount = (size_t) m_cacheRes.x * m_cacheRes.y * m_cacheRes.z;
+
+        const ref_vector<Emitter> &emitters = scene->getEmitters();
+        for (size_t i=0; i<emitters.size(); ++i) {
+            const Emitter *emitter = emitters[i].get();
+            int type = emitter->getType() & (Emitter::EDeltaPosition
+                | Emitter::EDeltaDirection | Emitter::EOnSurface);
+            if (type != Emitter::EDeltaPosition && type != Emitter::EDeltaDirection)
+                continue;
+
+            DirectSamplingRecord dRec(m_densityAABB.getCenter(), 0.0f);
+            emitter->sampleDirect(dRec, Point2(0.5f));
+
+            TransmittanceCache cache;
+            cache.emitter = emitter;
+            cache.directional = type == Emitter::EDeltaDirection;
+            cache.position = dRec.p;
+            cache.direction = dRec.d;
+            cache.depth.resize(pointCount);
+
+            int rows = m_cacheRes.y * m_cacheRes.z;
+            #if defined(MTS_OPENMP)
+                #pragma omp parallel for schedule(dynamic)
+            #endif
+            for (int row=0; row<rows; ++row) {
+                int y = row % m_cacheRes.y, z = row / m_cacheRes.y;
+                for (int x=0; x<m_cacheRes.x; ++x) {
+                    Point p = m_densityAABB.min + Vector(x * m_cacheSpacing.x,
+                        y * m_cacheSpacing.y, z * m_cacheSpacing.z);
+                    cache.depth[(size_t) row * m_cacheRes.x + x] =
+                        (float) integrateDensity(shadowRay(cache, p));
+                }
+            }
+            m_transmittanceCaches.push_back(cache);
+        }
+
+        if (!m_transmittanceCaches.empty())
+            Log(EInfo, "Cached the transmittance toward %i emitters on a %s "
+                "lattice in %i ms", (int) m_transmittanceCaches.size(),
+                m_cacheRes.toString().c_str(), timer->getMilliseconds());
+    }
+
+    Spectrum evalEmitterTransmittance(const Ray &ray,
+            const Emitter *emitter, Sampler *sampler) const {
+        for (size_t i=0; i<m_transmittanceCaches.size(); ++i) {
+            const TransmittanceCache &cache = m_transmittanceCaches[i];
+            if (cache.emitter != emitter)
+                continue;
+
+            /* The cache only covers segments that point toward the emitter */
+            Point p = ray(ray.mint);
+            if (dot(shadowRay(cache, p).d, ray.d) < 1 - 1e-3f)
+                break;
+
+            Float depth = cachedDepth(cache, p)
+                - cachedDepth(cache, ray(ray.maxt));
+            return Spectrum(math::fastexp(-std::max((Float) 0, depth)));
+        }
+        return evalTransmittance(ray, sampler);
+    }
+
+    /// State of a 3D DDA walk through the cells of the majorant grid
+    struct MajorantWalk {
+        Vector3i cell, step;
+        Float tNext[3], tDelta[3];
+        /// Axis of the next cell boundary
+        int axis;
+
+        /// Ray parameter where the current cell is left
+        inline Float tExit() const { return tNext[axis]; }
+    };
+
+    void beginMajorantWalk(const Ray &ray, Float mint, MajorantWalk &walk) const {
+        const Point p = ray(mint);
+        for (int i=0; i<3; ++i) {
+            Float rel = p[i] - m_densityAABB.min[i];
+            walk.cell[i] = math::clamp(math::floorToInt(rel * m_invMajorantCellSize[i]),
+                    0, m_majorantRes[i] - 1);
+            if (ray.d[i] > 0) {
+                walk.step[i] = 1;
+                walk.tNext[i] = mint + ((walk.cell[i] + 1) * m_majorantCellSize[i] - rel) / ray.d[i];
+                walk.tDelta[i] = m_majorantCellSize[i] / ray.d[i];
+            } else if (ray.d[i] < 0) {
+                walk.step[i] = -1;
+                walk.tNext[i] = mint + (walk.cell[i] * m_majorantCellSize[i] - rel) / ray.d[i];
+                walk.tDelta[i] = -m_majorantCellSize[i] / ray.d[i];
+            } else {
+                walk.step[i] = 0;
+                walk.tNext[i] = walk.tDelta[i] = std::numeric_limits<Float>::infinity();
+            }
+        }
+        walk.axis = nextMajorantAxis(walk);
+    }
+
+    /// Move to the next cell, returns false when leaving the grid
+    inline bool advanceMajorantWalk(MajorantWalk &walk) const {
+        int axis = walk.axis;
+        walk.cell[axis] += walk.step[axis];
+        if (walk.cell[axis] < 0 || walk.cell[axis] >= m_majorantRes[axis])
+            return false;
+        walk.tNext[axis] += walk.tDelta[axis];
+        walk.axis = nextMajorantAxis(walk);
+        return true;
+    }
+
+    inline int nextMajorantAxis(const MajorantWalk &walk) const {
+        const Float *tNext = walk.tNext;
+        return tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2)
+            : (tNext[1] < tNext[2] ? 1 : 2);
+    }
+
+    inline Float majorant(const MajorantWalk &walk) const {
+        return m_majorants[(walk.cell.z * m_majorantRes.y + walk.cell.y)
+            * m_majorantRes.x + walk.cell.x];
+    }
+
+    /**
+     * \brief Woodcock tracking through the majorant grid
+     *
+     * Walks the cells along <tt>[mint, maxt]</tt> with a 3D DDA and performs
+     * delta tracking with the majorant of each cell. Since free-flight
+     * sampling is memoryless, tracking simply restarts at each cell boundary.
+     *
+     * \return \c true if a collision was accepted; \c t and \c densityAtT
+     * then contain its position and the density there
+     */
+    bool trackMajorantGrid(const Ray &ray, Float mint, Float maxt,
+            SampleStream &stream, Float &t, Float &densityAtT) const {
+        MajorantWalk walk;
+        beginMajorantWalk(ray, mint, walk);
+
+        t = mint;
+        while (true) {
+            Float tExit = std::min(walk.tExit(), maxt);
+            Float cellMajorant = majorant(walk);
+
+            if (cellMajorant > 0) {
+                Float invMajorant = 1.0f / cellMajorant;
+                while (true) {
+                    t -= math::fastlog(1-stream.next1D()) * invMajorant;
+                    if (t >= tExit)
+                        break;
+                    densityAtT = lookupDensity(ray(t), ray.d, stream) * m_scale;
+                    if (densityAtT * invMajorant > stream.next1D())
+                        return true;
+                }
+            }
+
+            if (tExit >= maxt || !advanceMajorantWalk(walk))
+                return false;
+            t = tExit;
+        }
+    }
+
+    /**
+     * \brief Ratio tracking estimate of the transmittance along
+     * <tt>[mint, maxt]</tt>
+     *
+     * Same tentative collisions as Woodcock tracking, but instead of
+     * terminating at the first accepted one, the estimate is multiplied by
+     * the probability of a null collision at every tentative collision.
+     * Uses the majorant grid if there is one.
+     */
+    Float ratioTracking(const Ray &ray, Float mint, Float maxt, SampleStream &stream) const {
+        Float transmittance = 1.0f;
+
+        if (m_majorants.empty()) {
+            Float t = mint;
+            while (true) {
+                t -= math::fastlog(1-stream.next1D()) * m_invMaxDensity;
+                if (t >= maxt)
+                    break;
+                Float density = lookupDensity(ray(t), ray.d, stream) * m_scale;
+                transmittance *= 1 - density * m_invMaxDensity;
+                if (transmittance <= 0)
+                    return 0.0f;
+            }
+            return transmittance;
+        }
+
+        MajorantWalk walk;
+        beginMajorantWalk(ray, mint, walk);
+        Float t = mint;
+        while (true) {
+            Float tExit = std::min(walk.tExit(), maxt);
+            Float cellMajorant = majorant(walk);
+
+            if (cellMajorant > 0) {
+                Float invMajorant = 1.0f / cellMajorant;
+                while (true) {
+                    t -= math::fastlog(1-stream.next1D()) * invMajorant;
+                    if (t >= tExit)
+                        break;
+                    Float density = lookupDensity(ray(t), ray.d, stream) * m_scale;
+                    transmittance *= 1 - density * invMajorant;
+                    if (transmittance <= 0)
+                        return 0.0f;
+                }
+            }
+
+            if (tExit >= maxt || !advanceMajorantWalk(walk))
+                return transmittance;
+            t = tExit;
+        }
+    }
+
+    /**
+     * \brief Residual ratio tracking estimate of the transmittance along
+     * <tt>[mint, maxt]</tt>
+     *
+     * The transmittance of the constant control density is computed
+     * analytically, and ratio tracking only estimates the transmittance of
+     * the residual density (which can be negative) using a majorant of its
+     * absolute value.
+     */
+    Float residualRatioTracking(const Ray &ray, Float mint, Float maxt, SampleStream &stream) const {
+        Float transmittance = math::fastexp(-m_controlDensity * (maxt - mint));
+        if (m_residualMajorant == 0)
+            return transmittance;
+
+        Float t = mint;
+        while (true) {
+            t -= math::fastlog(1-stream.next1D()) * m_invResidualMajorant;
+            if (t >= maxt)
+                break;
+            Float density = lookupDensity(ray(t), ray.d, stream) * m_scale;
+            transmittance *= 1 - (density - m_controlDensity) * m_invResidualMajorant;
+        }
+        return transmittance;
+    }
+
+    /**
+     * Use the mean density over the volume as control density of residual
+     * ratio tracking. It is estimated with a lattice of lookups, and the
+     * residual majorant follows from the maximum density.
+     */
+    void computeControlDensity() {
+        const int lookups = EControlDensityLookups;
+        Vector extents = m_densityAABB.getExtents();
+        Float sum = 0;
+        for (int z=0; z<lookups; ++z)
+            for (int y=0; y<lookups; ++y)
+                for (int x=0; x<lookups; ++x)
+                    sum += m_density->lookupFloat(m_densityAABB.min + Vector(
+                        extents.x * (x + 0.5f) / lookups,
+                        extents.y * (y + 0.5f) / lookups,
+                        extents.z * (z + 0.5f) / lookups));
+        m_controlDensity = std::min(m_scale * sum / (lookups * lookups * lookups), m_maxDensity);
+        m_residualMajorant = std::max(m_maxDensity - m_controlDensity, m_controlDensity);
+        m_invResidualMajorant = m_residualMajorant > 0 ? 1.0f / m_residualMajorant : 0.0f;
+        Log(EDebug, "Residual ratio tracking: control density %f, residual majorant %f",
+            m_controlDensity, m_residualMajorant);
     }
 
     void addChild(const std::string &name, ConfigurableObject *child) {
@@ -339,6 +779,37 @@ public:
                     * m_scale);
         #endif
 
+        if (!m_anisotropicMedium) {
+            /* Look up the interior nodes in batches */
+            Float values[EDensityBatchSize];
+            for (uint32_t i=1; i<nSteps; i += EDensityBatchSize) {
+                uint32_t count = std::min((uint32_t) EDensityBatchSize, nSteps - i);
+                m_density->lookupFloatSequence(p + increment * (Float) i,
+                    increment, count, values);
+
+                /* Simpson weights: 4 for odd and 2 for even nodes */
+                for (uint32_t j=0; j<count; ++j)
+                    integratedDensity += (((i + j) & 1) ? 4 : 2) * values[j];
+
+                #if defined(HETVOL_STATISTICS)
+                    avgRayMarchingStepsTransmittance += count;
+                #endif
+
+                #if defined(HETVOL_EARLY_EXIT)
+                    if (integratedDensity > stopValue) {
+                        // Reached the threshold -- stop early
+                        #if defined(HETVOL_STATISTICS)
+                            ++earlyExits;
+                        #endif
+                        return std::numeric_limits<Float>::infinity();
+                    }
+                #endif
+            }
+
+            return integratedDensity * m_scale
+                * stepSize * (1.0f / 3.0f);
+        }
+
         p += increment;
 
         Float m = 4;
@@ -562,23 +1033,41 @@ public:
             int nSamples = 2; /// XXX make configurable
             Float result = 0;
 
+            /* Tracking draws long sequences of uniform variates */
+            SampleStream stream(sampler);
+
             for (int i=0; i<nSamples; ++i) {
+                if (m_method == ERatioTracking) {
+                    result += ratioTracking(ray, mint, maxt, stream);
+                    continue;
+                } else if (m_method == EResidualRatioTracking) {
+                    result += residualRatioTracking(ray, mint, maxt, stream);
+                    continue;
+                }
+
+                if (!m_majorants.empty()) {
+                    Float t, density;
+                    if (!trackMajorantGrid(ray, mint, maxt, stream, t, density))
+                        result += 1;
+                    continue;
+                }
+
                 Float t = mint;
                 while (true) {
-                    t -= math::fastlog(1-sampler->next1D()) * m_invMaxDensity;
+                    t -= math::fastlog(1-stream.next1D()) * m_invMaxDensity;
                     if (t >= maxt) {
                         result += 1;
                         break;
                     }
 
                     Point p = ray(t);
-                    Float density = lookupDensity(p, ray.d) * m_scale;
+                    Float density = lookupDensity(p, ray.d, stream) * m_scale;
 
                     #if defined(HETVOL_STATISTICS)
                         ++avgRayMarchingStepsTransmittance;
                     #endif
 
-                    if (density * m_invMaxDensity > sampler->next1D())
+                    if (density * m_invMaxDensity > stream.next1D())
                         break;
                 }
             }
@@ -630,32 +1119,42 @@ public:
             maxt = std::min(maxt, ray.maxt);
 
             Float t = mint, densityAtT = 0;
-            while (true) {
-                t -= math::fastlog(1-sampler->next1D()) * m_invMaxDensity;
-                if (t >= maxt)
-                    break;
+            bool collision = false;
+            SampleStream stream(sampler);
+            if (!m_majorants.empty()) {
+                collision = trackMajorantGrid(ray, mint, maxt, stream, t, densityAtT);
+            } else {
+                while (true) {
+                    t -= math::fastlog(1-stream.next1D()) * m_invMaxDensity;
+                    if (t >= maxt)
+                        break;
 
-                Point p = ray(t);
-                densityAtT = lookupDensity(p, ray.d) * m_scale;
-                #if defined(HETVOL_STATISTICS)
-                    ++avgRayMarchingStepsSampling;
-                #endif
-                if (densityAtT * m_invMaxDensity > sampler->next1D()) {
-                    mRec.t = t;
-                    mRec.p = p;
-                    Spectrum albedo = m_albedo->lookupSpectrum(p);
-                    mRec.sigmaS = albedo * densityAtT;
-                    mRec.sigmaA = Spectrum(densityAtT) - mRec.sigmaS;
-                    mRec.transmittance = Spectrum(densityAtT != 0.0f ? 1.0f / densityAtT : 0);
-                    if (!std::isfinite(mRec.transmittance[0])) // prevent rare overflow warnings
-                        mRec.transmittance = Spectrum(0.0f);
-                    mRec.orientation = m_orientation != NULL
-                        ? m_orientation->lookupVector(p) : Vector(0.0f);
-                    mRec.medium = this;
-                    success = true;
-                    break;
+                    densityAtT = lookupDensity(ray(t), ray.d, stream) * m_scale;
+                    #if defined(HETVOL_STATISTICS)
+                        ++avgRayMarchingStepsSampling;
+                    #endif
+                    if (densityAtT * m_invMaxDensity > stream.next1D()) {
+                        collision = true;
+                        break;
+                    }
                 }
             }
+
+            if (collision) {
+                Point p = ray(t);
+                mRec.t = t;
+                mRec.p = p;
+                Spectrum albedo = m_albedo->lookupSpectrum(p);
+                mRec.sigmaS = albedo * densityAtT;
+                mRec.sigmaA = Spectrum(densityAtT) - mRec.sigmaS;
+                mRec.transmittance = Spectrum(densityAtT != 0.0f ? 1.0f / densityAtT : 0);
+                if (!std::isfinite(mRec.transmittance[0])) // prevent rare overflow warnings
+                    mRec.transmittance = Spectrum(0.0f);
+                mRec.orientation = m_orientation != NULL
+                    ? m_orientation->lookupVector(p) : Vector(0.0f);
+                mRec.medium = this;
+                success = true;
+            }
         }
         mRec.medium = this;
 
@@ -705,8 +1204,83 @@ public:
 
     MTS_DECLARE_CLASS()
 protected:
+    enum {
+        /// Maximum number of density lookups per majorant cell and axis
+        EMaxMajorantLookups = 64,
+
+        /// Number of density lookups per axis to estimate the mean density
+        EControlDensityLookups = 32,
+
+        /// Number of density lookups per batch of the Simpson quadrature
+        EDensityBatchSize = 32
+    };
+
     inline Float lookupDensity(const Point &p, const Vector &d) const {
-        Float density = m_density->lookupFloat(p);
+        return orientDensity(m_density->lookupFloat(p), p, d);
+    }
+
+    /// Density lookup of the tracking methods, which may be stochastic
+    inline Float lookupDensity(const Point &p, const Vector &d, SampleStream &stream) const {
+        if (m_stochasticLookups)
+            return orientDensity(m_density->lookupFloatStochastic(p, stream.next1D()), p, d);
+        else
+            return orientDensity(m_density->lookupFloat(p), p, d);
+    }
+
+    /// Optical depth toward an emitter on a lattice over the volume
+    struct TransmittanceCache {
+        const Emitter *emitter;
+        bool directional;
+        /// Position of a point emitter
+        Point position;
+        /// Direction toward a directional emitter
+        Vector direction;
+        std::vector<float> depth;
+    };
+
+    /// Ray from \c p to the emitter of a transmittance cache
+    inline Ray shadowRay(const TransmittanceCache &cache, const Point &p) const {
+        if (cache.directional)
+            return Ray(p, cache.direction, 0,
+                std::numeric_limits<Float>::infinity(), 0);
+        Vector d = cache.position - p;
+        Float dist = d.length();
+        return Ray(p, dist > 0 ? d / dist : cache.direction, 0, dist, 0);
+    }
+
+    /// Interpolate the cached optical depth between \c p and the emitter
+    Float cachedDepth(const TransmittanceCache &cache, Point p) const {
+        if (!m_densityAABB.contains(p)) {
+            /* Use the depth where the shadow ray enters the volume */
+            Ray ray = shadowRay(cache, p);
+            Float nearT, farT;
+            if (!m_densityAABB.rayIntersect(ray, nearT, farT)
+                    || nearT < 0 || nearT > ray.maxt)
+                return 0.0f;
+            p = ray(nearT);
+        }
+
+        Vector3i idx;
+        Float w[3];
+        for (int i=0; i<3; ++i) {
+            Float v = (p[i] - m_densityAABB.min[i]) * m_invCacheSpacing[i];
+            idx[i] = math::clamp(math::floorToInt(v), 0, m_cacheRes[i] - 2);
+            w[i] = math::clamp(v - idx[i], (Float) 0, (Float) 1);
+        }
+
+        const float *depth = &cache.depth[((size_t) idx.z * m_cacheRes.y
+            + idx.y) * m_cacheRes.x + idx.x];
+        size_t dy = m_cacheRes.x, dz = (size_t) m_cacheRes.x * m_cacheRes.y;
+        Float d00 = (1-w[0]) * depth[0]       + w[0] * depth[1],
+              d10 = (1-w[0]) * depth[dy]      + w[0] * depth[dy+1],
+              d01 = (1-w[0]) * depth[dz]      + w[0] * depth[dz+1],
+              d11 = (1-w[0]) * depth[dz+dy]   + w[0] * depth[dz+dy+1];
+        return (1-w[2]) * ((1-w[1]) * d00 + w[1] * d10)
+            + w[2] * ((1-w[1]) * d01 + w[1] * d11);
+    }
+
+    /// Account for the directionally varying density of anisotropic media
+    inline Float orientDensity(Float density, const Point &p, const Vector &d) const {
         if (m_anisotropicMedium && density != 0) {
             Vector orientation = m_orientation->lookupVector(p);
             if (!orientation.isZero())
@@ -727,6 +1301,17 @@ protected:
     AABB m_densityAABB;
     Float m_maxDensity;
     Float m_invMaxDensity;
+    int m_majorantResolution;
+    bool m_stochasticLookups;
+    Vector3i m_majorantRes;
+    Vector m_majorantCellSize, m_invMajorantCellSize;
+    std::vector<Float> m_majorants;
+    Float m_controlDensity;
+    Float m_residualMajorant, m_invResidualMajorant;
+    int m_transmittanceCacheResolution;
+    Vector3i m_cacheRes;
+    Vector m_cacheSpacing, m_invCacheSpacing;
+    std::vector<TransmittanceCache> m_transmittanceCaches;
 };
 
 MTS_IMPLEMENT_CLASS_S(HeterogeneousMedium, false, Medium)
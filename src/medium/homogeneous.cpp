@@ -96,7 +96,12 @@ MTS_NAMESPACE_BEGIN
  * a single channel) and then merge them back into a RGB image. There
  * is a \code{mtsutil} (\secref{mtsutil}) plugin named \code{joinrgb}
  * that will perform this RGB merging process. The \code{autosingle}
- * strategy does a similar thing automatically.
+ * strategy does a similar thing automatically. Alternatively, the
+ * \code{spectral} strategy performs spectral tracking: distances are
+ * sampled against the largest extinction coefficient over all channels,
+ * and per-channel weights account for the null collisions. The choice
+ * between scattering and null collisions takes the path throughput into
+ * account, so that no single channel accumulates excessive weights.
  *
  * \begin{table}[h!]
  *     \centering
@@ -153,6 +158,7 @@ public:
         EAutoSingle,   /// Perfectly sample a single channel, no transport in other channels
         EManual,       /// Exponential distrib.; manually specify the falloff
         EMaximum,      /// Maximum-of-exponential distribution
+        ESpectral,     /// Spectral tracking against the maximal sigma_t
     };
 
     HomogeneousMedium(const Properties &props)
@@ -222,6 +228,10 @@ public:
             for (int i=0; i<SPECTRUM_SAMPLES; ++i)
                 coeffs[i] = m_sigmaT[i];
             m_maxExpDist = new MaxExpDist(coeffs);
+        } else if (strategy == "spectral") {
+            m_strategy = ESpectral;
+            if (m_sigmaT.max() == 0)
+                Log(EError, "The spectral strategy requires a nonzero extinction coefficient");
         } else if (strategy == "manual") {
             m_strategy = EManual;
             m_samplingDensity = props.getFloat("samplingDensity");
@@ -277,8 +287,83 @@ public:
         return transmittance;
     }
 
+    /**
+     * \brief Sample a distance using spectral tracking
+     *
+     * Tentative collisions are generated with the majorant
+     * <tt>max(sigma_t)</tt> over all channels. At each of them, either
+     * a scattering or a null collision is chosen with probabilities
+     * proportional to the channel average of the path throughput times
+     * sigma_s and sigma_n respectively, and the per-channel weights are
+     * updated accordingly. The weights end up in \c mRec.transmittance,
+     * so that the usual <tt>sigmaS * transmittance / pdfSuccess</tt> and
+     * <tt>transmittance / pdfFailure</tt> updates remain valid. The
+     * medium sampling weight is not used by this strategy.
+     */
+    bool sampleSpectralTracking(const Ray &ray, MediumSamplingRecord &mRec,
+            Sampler *sampler, const Spectrum *throughput) const {
+        const Float majorant = m_sigmaT.max(), invMajorant = 1 / majorant;
+        const Spectrum sigmaN = Spectrum(majorant) - m_sigmaT;
+        const Float distSurf = ray.maxt - ray.mint;
+
+        Spectrum weight(1.0f);
+        Float t = 0;
+        bool success = false;
+        SampleStream stream(sampler);
+        while (true) {
+            t -= math::fastlog(1-stream.next1D()) * invMajorant;
+            if (t >= distSurf)
+                break;
+
+            Spectrum history = throughput ? weight * *throughput : weight;
+            Float scatterWeight = (history * m_sigmaS).abs().average();
+            Float nullWeight = (history * sigmaN).abs().average();
+            if (scatterWeight + nullWeight == 0) {
+                weight = Spectrum(0.0f);
+                break;
+            }
+
+            Float probScatter = scatterWeight / (scatterWeight + nullWeight);
+            if (stream.next1D() < probScatter) {
+                mRec.t = t + ray.mint;
+                mRec.p = ray(mRec.t);
+                mRec.pdfSuccess = majorant * probScatter;
+                success = true;
+                break;
+            }
+
+            weight *= sigmaN * (invMajorant / (1 - probScatter));
+            if (weight.max() < 1e-20) {
+                weight = Spectrum(0.0f);
+                break;
+            }
+        }
+
+        if (success) {
+            /* Fail if there is no forward progress
+               (e.g. due to roundoff errors) */
+            if (mRec.p == ray.o)
+                success = false;
+        } else {
+            mRec.pdfSuccess = 1.0f;
+        }
+
+        mRec.sigmaA = m_sigmaA;
+        mRec.sigmaS = m_sigmaS;
+        mRec.time = ray.time;
+        mRec.medium = this;
+        mRec.transmittance = weight;
+        mRec.pdfSuccessRev = mRec.pdfSuccess;
+        mRec.pdfFailure = 1.0f;
+
+        return success;
+    }
+
     bool sampleDistance(const Ray &ray, MediumSamplingRecord &mRec,
             Sampler *sampler, const Spectrum *throughput) const {
+        if (m_strategy == ESpectral)
+            return sampleSpectralTracking(ray, mRec, sampler, throughput);
+
         const Float wgt = m_mediumSamplingWeight;
         Float rand = sampler->next1D(), sampledDistance;
         Float samplingDensity = m_samplingDensity;
@@ -426,6 +511,9 @@ public:
             case EAutoSingle:
                 Log(EError, "Can't use autosingle strategy with an eval() method [yet...]");
 
+            case ESpectral:
+                Log(EError, "Can't use spectral strategy with an eval() method");
+
             default:
                 Log(EError, "Unknown sampling strategy!");
         }
@@ -461,6 +549,7 @@ public:
             case EManual: oss << "manual," << endl; break;
             case EBalance: oss << "balance," << endl; break;
             case EMaximum: oss << "maximum," << endl; break;
+            case ESpectral: oss << "spectral," << endl; break;
         }
 
         oss << "  phase = " << indent(m_phaseFunction.toString()) << endl
@@ -28,6 +28,7 @@
 #include <mitsuba/core/sstream.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/fstream.h>
+#include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/appender.h>
 #include <mitsuba/core/sshstream.h>
 #include <mitsuba/core/shvector.h>
@@ -61,6 +62,11 @@ void help() {
     cout <<  "   -p count    Override the detected number of processors. Useful for reducing" << endl;
     cout <<  "               the load or creating scheduling-only nodes in conjunction with"  << endl;
     cout <<  "               the -c and -s parameters, e.g. -p 0 -c host1;host2;host3,..." << endl << endl;
+    cout <<  "   -k count    Let local workers steal work from each other, generating work" << endl;
+    cout <<  "               units in batches of 'count' (default: disabled). Reduces lock" << endl;
+    cout <<  "               contention on machines with many cores." << endl << endl;
+    cout <<  "   -N          NUMA-aware mode: pin the local workers one NUMA node at a time" << endl;
+    cout <<  "               so that workers with neighboring indices share a node" << endl << endl;
     cout <<  "   -q          Quiet mode - do not print any log messages to stdout" << endl << endl;
     cout <<  "   -c hosts    Network rendering: connect to mtssrv instances over a network." << endl;
     cout <<  "               Requires a semicolon-separated list of host names of the form" << endl;
@@ -71,18 +77,37 @@ void help() {
     cout <<  "                       out -- by default, \"~/mitsuba\" is used)" << endl << endl;
     cout <<  "   -s file     Connect to additional Mitsuba servers specified in a file" << endl;
     cout <<  "               with one name per line (same format as in -c)" << endl<< endl;
+    cout <<  "   -C          Compress resources and work results sent over network connections" << endl << endl;
+    cout <<  "   -B count    Number of work units in transit per remote core (default: "
+             << MTS_BACKLOG_FACTOR << ")" << endl << endl;
     cout <<  "   -j count    Simultaneously schedule several scenes. Can sometimes accelerate" << endl;
     cout <<  "               rendering when large amounts of processing power are available" << endl;
     cout <<  "               (e.g. when running Mitsuba on a cluster. Default: 1)" << endl << endl;
     cout <<  "   -n name     Assign a node name to this instance (Default: host name)" << endl << endl;
     cout <<  "   -x          Skip rendering of files where output already exists" << endl << endl;
+    cout <<  "   -E file     Export the scene as a binary snapshot to 'file' instead of" << endl;
+    cout <<  "               rendering it. Snapshots can be passed in place of scene" << endl;
+    cout <<  "               files and load without XML parsing or plugin configuration" << endl << endl;
+    cout <<  "   -A          Batch mode for animations: consecutive scenes reuse unchanged" << endl;
+    cout <<  "               shapes, textures, BSDFs and kd-trees, and the next scene is" << endl;
+    cout <<  "               loaded while the current one is rendering" << endl << endl;
+    cout <<  "   -F a[:b]    Render the frames a to b of every scene file (implies -A). The" << endl;
+    cout <<  "               frame number is available as the parameter $frame, and the" << endl;
+    cout <<  "               outputs are suffixed with it (e.g. 'scene_0012.exr')" << endl << endl;
     cout <<  "   -r sec      Write (partial) output images every 'sec' seconds" << endl << endl;
     cout <<  "   -b res      Specify the block resolution used to split images into parallel" << endl;
     cout <<  "               workloads (default: 32). Only applies to some integrators." << endl << endl;
+    cout <<  "   -O order    Order in which the blocks are rendered: 'spiral' (default)," << endl;
+    cout <<  "               'hilbert', or 'cost' (most expensive blocks of the previous" << endl;
+    cout <<  "               rendering pass first). Overrides the scene's 'blockOrder'" << endl << endl;
     cout <<  "   -v          Be more verbose (can be specified twice)" << endl << endl;
     cout <<  "   -L level    Explicitly specify the log level (trace/debug/info/warn/error)" << endl << endl;
     cout <<  "   -w          Treat warnings as errors" << endl << endl;
     cout <<  "   -z          Disable progress bars" << endl << endl;
+    cout <<  "   -W          Write the scheduling telemetry of every work unit to a CSV" << endl;
+    cout <<  "               file next to the output image ('<output>_workunits.csv')" << endl << endl;
+    cout <<  "   -T file     Write a timeline of the work units processed by each local" << endl;
+    cout <<  "               worker to 'file' (Chrome trace format, see chrome://tracing)" << endl << endl;
     cout <<  " For documentation, please refer to http://www.mitsuba-renderer.org/docs.html" << endl;
 }
 
@@ -135,14 +160,23 @@ int mitsuba_app(int argc, char **argv) {
         int nprocs_avail = getCoreCount(), nprocs = nprocs_avail;
         int numParallelScenes = 1;
         std::string nodeName = getHostName(),
-                    networkHosts = "", destFile="";
-        bool quietMode = false, progressBars = true, skipExisting = false;
+                    networkHosts = "", destFile="", traceFile="",
+                    snapshotFile="";
+        bool quietMode = false, progressBars = true, skipExisting = false,
+             telemetry = false;
         ELogLevel logLevel = EInfo;
         ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver();
         bool treatWarningsAsErrors = false;
         std::map<std::string, std::string, SimpleStringOrdering> parameters;
         int blockSize = 32;
+        std::string blockOrder;
         int flushTimer = -1;
+        int stealBatchSize = 0;
+        bool numaAware = false;
+        bool compressNetwork = false;
+        int networkBacklog = MTS_BACKLOG_FACTOR;
+        bool batchMode = false;
+        int firstFrame = 0, lastFrame = -1;
 
         if (argc < 2) {
             help();
@@ -151,7 +185,7 @@ int mitsuba_app(int argc, char **argv) {
 
         optind = 1;
         /* Parse command-line arguments */
-        while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:p:L:qhzvtwx")) != -1) {
+        while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:O:p:k:L:B:T:F:E:qhzvtwxNCWA")) != -1) {
             switch (optchar) {
                 case 'a': {
                         std::vector<std::string> paths = tokenize(optarg, ";");
@@ -215,11 +249,27 @@ int mitsuba_app(int argc, char **argv) {
                 case 'x':
                     skipExisting = true;
                     break;
+                case 'N':
+                    numaAware = true;
+                    break;
+                case 'C':
+                    compressNetwork = true;
+                    break;
+                case 'B':
+                    networkBacklog = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || networkBacklog < 2)
+                        SLog(EError, "Could not parse the network backlog (must be at least 2)!");
+                    break;
                 case 'p':
                     nprocs = strtol(optarg, &end_ptr, 10);
                     if (*end_ptr != '\0')
                         SLog(EError, "Could not parse the processor count!");
                     break;
+                case 'k':
+                    stealBatchSize = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || stealBatchSize < 1)
+                        SLog(EError, "Could not parse the work stealing batch size!");
+                    break;
                 case 'j':
                     numParallelScenes = strtol(optarg, &end_ptr, 10);
                     if (*end_ptr != '\0')
@@ -237,9 +287,43 @@ int mitsuba_app(int argc, char **argv) {
                     if (blockSize < 1 || blockSize > 128)
                         SLog(EError, "Invalid block size (should be in the range 1-128)");
                     break;
+                case 'O':
+                    blockOrder = optarg;
+                    BlockedImageProcess::parseBlockOrder(blockOrder);
+                    break;
                 case 'z':
                     progressBars = false;
                     break;
+                case 'T':
+                    traceFile = optarg;
+                    break;
+                case 'W':
+                    telemetry = true;
+                    break;
+                case 'E':
+                    snapshotFile = optarg;
+                    break;
+                case 'A':
+                    batchMode = true;
+                    break;
+                case 'F': {
+                        std::vector<std::string> range = tokenize(optarg, ":");
+                        if (range.size() < 1 || range.size() > 2)
+                            SLog(EError, "Could not parse the frame range!");
+                        firstFrame = strtol(range[0].c_str(), &end_ptr, 10);
+                        if (*end_ptr != '\0')
+                            SLog(EError, "Could not parse the frame range!");
+                        lastFrame = firstFrame;
+                        if (range.size() == 2) {
+                            lastFrame = strtol(range[1].c_str(), &end_ptr, 10);
+                            if (*end_ptr != '\0')
+                                SLog(EError, "Could not parse the frame range!");
+                        }
+                        if (firstFrame < 0 || lastFrame < firstFrame)
+                            SLog(EError, "Invalid frame range!");
+                        batchMode = true;
+                    }
+                    break;
                 case 'q':
                     quietMode = true;
                     break;
@@ -251,10 +335,17 @@ int mitsuba_app(int argc, char **argv) {
         }
 
         ProgressReporter::setEnabled(progressBars);
+        Statistics::getInstance()->setTraceEnabled(!traceFile.empty());
 
         /* Initialize OpenMP */
         Thread::initializeOpenMP(nprocs);
 
+        /* Decode and encode OpenEXR files using as many threads */
+        Bitmap::setIOThreadCount(nprocs);
+
+        /* Load shapes and textures using as many threads */
+        SceneHandler::setLoaderThreadCount(nprocs);
+
         /* Configure the logging subsystem */
         ref<Logger> log = Thread::getThread()->getLogger();
         log->setLogLevel(logLevel);
@@ -271,15 +362,26 @@ int mitsuba_app(int argc, char **argv) {
         if (!quietMode)
             log->addAppender(new StreamAppender(&std::cout));
 
+        /* Keep the render threads from waiting on the appenders */
+        log->setAsynchronous(true);
+
         SLog(EInfo, "Mitsuba version %s, Copyright (c) " MTS_YEAR " Wenzel Jakob",
                 Version(MTS_VERSION).toStringComplete().c_str());
+        SLog(EDebug, "Instruction set extensions used by the dispatched "
+                "kernels: %s", getCPUFeatureString().c_str());
 
         /* Configure the scheduling subsystem */
         Scheduler *scheduler = Scheduler::getInstance();
         bool useCoreAffinity = nprocs == nprocs_avail;
+        std::vector<int> cores;
+        if (numaAware) {
+            cores = getNUMACoreAssignment(nprocs);
+            SLog(EInfo, "Pinning %i workers to %i NUMA node(s)",
+                nprocs, getNUMANodeCount());
+        }
         for (int i=0; i<nprocs; ++i)
-            scheduler->registerWorker(new LocalWorker(useCoreAffinity ? i : -1,
-                formatString("wrk%i", i)));
+            scheduler->registerWorker(new LocalWorker(numaAware ? cores[i]
+                : (useCoreAffinity ? i : -1), formatString("wrk%i", i)));
         std::vector<std::string> hosts = tokenize(networkHosts, ";");
 
         /* Establish network connections to nested servers */
@@ -311,7 +413,8 @@ int mitsuba_app(int argc, char **argv) {
                 stream = new SSHStream(tokens[0], tokens[1], cmdLine);
             }
             try {
-                scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream));
+                scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream,
+                    compressNetwork, networkBacklog));
             } catch (std::runtime_error &e) {
                 if (hostName.find("@") != std::string::npos) {
 #if defined(__WINDOWS__)
@@ -326,6 +429,10 @@ int mitsuba_app(int argc, char **argv) {
             }
         }
 
+        if (stealBatchSize > 0) {
+            scheduler->setWorkStealing(true);
+            scheduler->setStealBatchSize(stealBatchSize);
+        }
         scheduler->start();
 
 #if !defined(__WINDOWS__)
@@ -356,6 +463,12 @@ int mitsuba_app(int argc, char **argv) {
         parser->setDocumentHandler(handler);
         parser->setErrorHandler(handler);
 
+        ref<SceneObjectCache> objectCache;
+        if (batchMode) {
+            objectCache = new SceneObjectCache();
+            handler->setObjectCache(objectCache);
+        }
+
         renderQueue = new RenderQueue();
 
         ref<FlushThread> flushThread;
@@ -364,37 +477,87 @@ int mitsuba_app(int argc, char **argv) {
             flushThread->start();
         }
 
-        int jobIdx = 0;
+        /* List of scene files and frame numbers (-1: not an animation) */
+        std::vector<std::pair<std::string, int> > frames;
         for (int i=optind; i<argc; ++i) {
+            if (lastFrame < 0)
+                frames.push_back(std::make_pair(std::string(argv[i]), -1));
+            for (int frame=firstFrame; frame<=lastFrame; ++frame)
+                frames.push_back(std::make_pair(std::string(argv[i]), frame));
+        }
+
+        int jobIdx = 0;
+        ref<Scene> previousScene;
+        for (size_t i=0; i<frames.size(); ++i) {
+            const std::string &file = frames[i].first;
+            int frame = frames[i].second;
             fs::path
-                filename = fileResolver->resolve(argv[i]),
+                filename = fileResolver->resolve(file),
                 filePath = fs::absolute(filename).parent_path(),
                 baseName = filename.stem();
             ref<FileResolver> frClone = fileResolver->clone();
             frClone->prependPath(filePath);
             Thread::getThread()->setFileResolver(frClone);
 
-            SLog(EInfo, "Parsing scene description from \"%s\" ..", argv[i]);
+            fs::path destination = destFile.length() > 0 ?
+                fs::path(destFile) : (filePath / baseName);
+            if (frame >= 0) {
+                handler->setParameter("frame", formatString("%i", frame));
+                destination = destination.string() + formatString("_%04i", frame);
+                SLog(EInfo, "Parsing scene description from \"%s\" (frame %i) ..",
+                    file.c_str(), frame);
+            } else {
+                SLog(EInfo, "Parsing scene description from \"%s\" ..", file.c_str());
+            }
 
-            parser->parse(filename.c_str());
-            ref<Scene> scene = handler->getScene();
+            ref<Scene> scene;
+            if (Scene::isSnapshot(filename)) {
+                scene = Scene::loadSnapshot(filename);
+            } else {
+                parser->parse(filename.c_str());
+                scene = handler->getScene();
+            }
 
             scene->setSourceFile(filename);
-            scene->setDestinationFile(destFile.length() > 0 ?
-                fs::path(destFile) : (filePath / baseName));
+            scene->setDestinationFile(destination);
             scene->setBlockSize(blockSize);
+            if (!blockOrder.empty())
+                scene->setBlockOrder(BlockedImageProcess::parseBlockOrder(blockOrder));
+
+            if (!snapshotFile.empty()) {
+                scene->initialize();
+                scene->saveSnapshot(snapshotFile);
+                continue;
+            }
 
             if (scene->destinationExists() && skipExisting)
                 continue;
 
+            if (batchMode) {
+                /* This scene was loaded while the previous one was
+                   rendering. Wait for a free slot before starting it */
+                renderQueue->waitLeft(numParallelScenes-1);
+                if (numParallelScenes == 1) {
+                    if (previousScene)
+                        scene->reuseKDTree(previousScene);
+                    if (i > 0)
+                        Statistics::getInstance()->resetAll();
+                }
+                previousScene = scene;
+            }
+
             ref<RenderJob> thr = new RenderJob(formatString("ren%i", jobIdx++),
                 scene, renderQueue, -1, -1, -1, true, flushTimer > 0);
+            thr->setTelemetryEnabled(telemetry);
             thr->start();
 
-            renderQueue->waitLeft(numParallelScenes-1);
-            if (i+1 < argc && numParallelScenes == 1)
-                Statistics::getInstance()->resetAll();
+            if (!batchMode) {
+                renderQueue->waitLeft(numParallelScenes-1);
+                if (i+1 < frames.size() && numParallelScenes == 1)
+                    Statistics::getInstance()->resetAll();
+            }
         }
+        previousScene = NULL;
 
         /* Wait for all render processes to finish */
         renderQueue->waitLeft(0);
@@ -406,6 +569,8 @@ int mitsuba_app(int argc, char **argv) {
         delete parser;
 
         Statistics::getInstance()->printStats();
+        if (!traceFile.empty())
+            Statistics::getInstance()->writeTrace(traceFile);
     } catch (const std::exception &e) {
         std::cerr << "Caught a critical exception: " << e.what() << endl;
         return -1;
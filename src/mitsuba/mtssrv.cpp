@@ -106,10 +106,15 @@ int mtssrv(int argc, char **argv) {
         std::string hostName = getFQDN();
         FileResolver *fileResolver = Thread::getThread()->getFileResolver();
         bool hostNameSet = false;
+        bool numaAware = false;
+        bool compressNetwork = false;
+        int networkBacklog = MTS_BACKLOG_FACTOR;
+        std::string cacheDirectory;
+        size_t cacheCapacity = 0;
 
         optind = 1;
         /* Parse command-line arguments */
-        while ((optchar = getopt(argc, argv, "a:c:s:n:p:i:l:L:qhv")) != -1) {
+        while ((optchar = getopt(argc, argv, "a:c:s:n:p:i:l:L:B:d:m:qhvNC")) != -1) {
             switch (optchar) {
                 case 'a': {
                         std::vector<std::string> paths = tokenize(optarg, ";");
@@ -176,6 +181,25 @@ int mtssrv(int argc, char **argv) {
                 case 'q':
                     quietMode = true;
                     break;
+                case 'N':
+                    numaAware = true;
+                    break;
+                case 'C':
+                    compressNetwork = true;
+                    break;
+                case 'B':
+                    networkBacklog = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || networkBacklog < 2)
+                        SLog(EError, "Could not parse the network backlog (must be at least 2)!");
+                    break;
+                case 'd':
+                    cacheDirectory = optarg;
+                    break;
+                case 'm':
+                    cacheCapacity = (size_t) strtol(optarg, &end_ptr, 10) * 1024 * 1024;
+                    if (*end_ptr != '\0')
+                        SLog(EError, "Could not parse the resource cache size!");
+                    break;
                 case 'h':
                 default:
                     cout <<  "Mitsuba version " << Version(MTS_VERSION).toStringComplete()
@@ -187,6 +211,8 @@ int mtssrv(int argc, char **argv) {
                     cout <<  "   -p count    Override the detected number of processors. Useful for reducing" << endl;
                     cout <<  "               the load or creating scheduling-only nodes in conjunction with"  << endl;
                     cout <<  "               the -c and -s parameters, e.g. -p 0 -c host1;host2;host3,..." << endl << endl;
+                    cout <<  "   -N          NUMA-aware mode: pin the local workers one NUMA node at a time" << endl;
+                    cout <<  "               so that workers with neighboring indices share a node" << endl << endl;
                     cout <<  "   -q          Quiet mode - do not print any log messages to stdout" << endl << endl;
                     cout <<  "   -c hosts    Nesting: connect to additional mtssrv instances over a network." << endl;
                     cout <<  "               Requires a semicolon-separated list of host names of the form" << endl;
@@ -197,6 +223,14 @@ int mtssrv(int argc, char **argv) {
                     cout <<  "                       out -- by default, \"~/mitsuba\" is used)" << endl << endl;
                     cout <<  "   -s file     Connect to additional Mitsuba servers specified in a file" << endl;
                     cout <<  "               with one name per line (same format as in -c)" << endl<< endl;
+                    cout <<  "   -C          Compress resources and work results sent over network connections" << endl << endl;
+                    cout <<  "   -B count    Number of work units in transit per remote core (default: "
+                             << MTS_BACKLOG_FACTOR << ")" << endl << endl;
+                    cout <<  "   -m size     Keep up to 'size' MB of resources (e.g. scene geometry) in a cache" << endl;
+                    cout <<  "               across render jobs, so that clients only need to send the parts" << endl;
+                    cout <<  "               that have changed (e.g. between the frames of an animation)" << endl << endl;
+                    cout <<  "   -d dir      Store the resource cache in the given directory, where it also" << endl;
+                    cout <<  "               persists across server restarts (default: in memory, requires -m)" << endl << endl;
                     cout <<  "   -i name     IP address / host name on which to listen for connections" << endl << endl;
                     cout <<  "   -l port     Listen for connections on a certain port (Default: " << MTS_DEFAULT_PORT << ")." << endl;
                     cout <<  "               To listen on stdin, specify \"-ls\" (implies -q)" << endl << endl;
@@ -215,6 +249,9 @@ int mtssrv(int argc, char **argv) {
         /* Initialize OpenMP */
         Thread::initializeOpenMP(nprocs);
 
+        /* Decode and encode OpenEXR files using as many threads */
+        Bitmap::setIOThreadCount(nprocs);
+
         /* Disable the default appenders */
         for (size_t i=0; i<log->getAppenderCount(); ++i) {
             Appender *appender = log->getAppender(i);
@@ -236,8 +273,15 @@ int mtssrv(int argc, char **argv) {
 
         /* Configure the scheduling subsystem */
         Scheduler *scheduler = Scheduler::getInstance();
+        std::vector<int> cores;
+        if (numaAware) {
+            cores = getNUMACoreAssignment(nprocs);
+            SLog(EInfo, "Pinning %i workers to %i NUMA node(s)",
+                nprocs, getNUMANodeCount());
+        }
         for (int i=0; i<nprocs; ++i)
-            scheduler->registerWorker(new LocalWorker(i, formatString("wrk%i", i)));
+            scheduler->registerWorker(new LocalWorker(numaAware ? cores[i] : i,
+                formatString("wrk%i", i)));
         std::vector<std::string> hosts = tokenize(networkHosts, ";");
 
         /* Establish network connections to nested servers */
@@ -269,7 +313,8 @@ int mtssrv(int argc, char **argv) {
                 stream = new SSHStream(tokens[0], tokens[1], cmdLine);
             }
             try {
-                scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream));
+                scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream,
+                    compressNetwork, networkBacklog));
             } catch (std::runtime_error &e) {
                 if (hostName.find("@") != std::string::npos) {
 #if defined(__WINDOWS__)
@@ -285,9 +330,15 @@ int mtssrv(int argc, char **argv) {
         }
         scheduler->start();
 
+        ref<ResourceCache> cache;
+        if (cacheCapacity > 0)
+            cache = new ResourceCache(cacheCapacity, cacheDirectory);
+        else if (!cacheDirectory.empty())
+            SLog(EError, "A resource cache directory requires a cache size (-m)!");
+
         if (listenPort == -1) {
             ref<StreamBackend> backend = new StreamBackend("con0",
-                    scheduler, nodeName, new ConsoleStream(), false);
+                    scheduler, nodeName, new ConsoleStream(), false, cache);
             backend->start();
             backend->join();
             return 0;
@@ -385,7 +436,7 @@ int mtssrv(int argc, char **argv) {
             }
 
             ref<StreamBackend> backend = new StreamBackend(formatString("con%i", connectionIndex++),
-                scheduler, nodeName, new SocketStream(newSocket), true);
+                scheduler, nodeName, new SocketStream(newSocket), true, cache);
             backend->start();
         }
 #if defined(__WINDOWS__)
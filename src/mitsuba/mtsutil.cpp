@@ -30,6 +30,7 @@
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/fstream.h>
+#include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/version.h>
 #include <mitsuba/core/appender.h>
 #include <mitsuba/render/util.h>
@@ -69,6 +70,9 @@ void help() {
     cout <<  "                       out -- by default, \"~/mitsuba\" is used)" << endl << endl;
     cout <<  "   -s file     Connect to additional Mitsuba servers specified in a file" << endl;
     cout <<  "               with one name per line (same format as in -c)" << endl<< endl;
+    cout <<  "   -C          Compress resources and work results sent over network connections" << endl << endl;
+    cout <<  "   -B count    Number of work units in transit per remote core (default: "
+             << MTS_BACKLOG_FACTOR << ")" << endl << endl;
     cout <<  "   -n name     Assign a node name to this instance (Default: host name)" << endl << endl;
     cout <<  "   -t          Execute all testcases" << endl << endl;
     cout <<  "   -v          Be more verbose" << endl << endl;
@@ -148,6 +152,8 @@ int mtsutil(int argc, char **argv) {
         ELogLevel logLevel = EInfo;
         FileResolver *fileResolver = Thread::getThread()->getFileResolver();
         bool testCaseMode = false, treatWarningsAsErrors = false;
+        bool compressNetwork = false;
+        int networkBacklog = MTS_BACKLOG_FACTOR;
 
         if (argc < 2) {
             help();
@@ -156,7 +162,7 @@ int mtsutil(int argc, char **argv) {
 
         optind = 1;
         /* Parse command-line arguments */
-        while ((optchar = getopt(argc, argv, "+a:c:s:n:p:qhwvt")) != -1) {
+        while ((optchar = getopt(argc, argv, "+a:c:s:n:p:B:qhwvtC")) != -1) {
             switch (optchar) {
                 case 'a': {
                         std::vector<std::string> paths = tokenize(optarg, ";");
@@ -202,6 +208,14 @@ int mtsutil(int argc, char **argv) {
                 case 'q':
                     quietMode = true;
                     break;
+                case 'C':
+                    compressNetwork = true;
+                    break;
+                case 'B':
+                    networkBacklog = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || networkBacklog < 2)
+                        SLog(EError, "Could not parse the network backlog (must be at least 2)!");
+                    break;
                 case 'h':
                 default:
                     help();
@@ -217,6 +231,9 @@ int mtsutil(int argc, char **argv) {
         /* Initialize OpenMP */
         Thread::initializeOpenMP(nprocs);
 
+        /* Decode and encode OpenEXR files using as many threads */
+        Bitmap::setIOThreadCount(nprocs);
+
         /* Disable the default appenders */
         for (size_t i=0; i<log->getAppenderCount(); ++i) {
             Appender *appender = log->getAppender(i);
@@ -269,7 +286,8 @@ int mtsutil(int argc, char **argv) {
                 stream = new SSHStream(tokens[0], tokens[1], cmdLine);
             }
             try {
-                scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream));
+                scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream,
+                    compressNetwork, networkBacklog));
             } catch (std::runtime_error &e) {
                 if (hostName.find("@") != std::string::npos) {
 #if defined(__WINDOWS__)
@@ -210,15 +210,29 @@ struct SceneContext {
     std::deque<VPL> vpls;
     PreviewQueueEntry previewBuffer;
 
+    /* Framebuffer region written by worker threads since the last upload */
+    AABB2 dirtyRegion;
+    ref<Mutex> dirtyMutex;
+
     SceneContext() : scene(NULL), sceneResID(-1),
         renderJob(NULL), wasRendering(false),
         currentLayer(0),
         selectionMode(ENothing),
-        selectedShape(NULL) { }
+        selectedShape(NULL), dirtyMutex(new Mutex()) { }
 
     /// Detect the path length
     int detectPathLength() const;
 
+    /// Record that a region of the framebuffer was modified (thread-safe)
+    void markDirty(const Point2i &offset, const Vector2i &size);
+
+    /**
+     * \brief Fetch and reset the modified framebuffer region (thread-safe)
+     *
+     * \return \c false if no region was recorded since the last call
+     */
+    bool fetchDirty(Point2i &offset, Vector2i &size);
+
     /* Clone a scene */
     SceneContext(SceneContext *ctx);
     ~SceneContext();
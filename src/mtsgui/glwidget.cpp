@@ -54,6 +54,7 @@ GLWidget::GLWidget(QWidget *parent) :
     m_navigationMode = EFlythrough;
     m_ignoreMouseEvent = QPoint(0, 0);
     m_didSetCursor = false;
+    m_fullRefresh = true;
 #if defined(MTS_GUI_SOFTWARE_FALLBACK)
     m_softwareFallback = true;
 #else
@@ -227,7 +228,7 @@ void GLWidget::setScene(SceneContext *context) {
         context = NULL;
 
     m_preview->setSceneContext(context, true, false);
-    m_framebufferChanged = true;
+    m_framebufferChanged = m_fullRefresh = true;
     m_mouseDrag = m_animation = m_cropping = false;
     m_leftKeyDown = m_rightKeyDown = m_upKeyDown = m_downKeyDown = false;
     m_aabb.reset();
@@ -238,7 +239,7 @@ void GLWidget::setScene(SceneContext *context) {
 }
 
 void GLWidget::refreshScene() {
-    m_framebufferChanged = true;
+    m_framebufferChanged = m_fullRefresh = true;
     resetPreview();
     updateGeometry();
     updateScrollBars();
@@ -1044,6 +1045,7 @@ void GLWidget::paintGL() {
                 m_framebuffer->setMipMapped(false);
                 m_framebuffer->setFilterType(GPUTexture::ENearest);
                 m_framebuffer->init();
+                m_fullRefresh = true;
             }
 
             if (m_framebufferChanged) {
@@ -1075,8 +1077,18 @@ void GLWidget::paintGL() {
                     }
 #endif
                 }
-                m_framebuffer->refresh();
-                m_framebufferChanged = false;
+
+                /* The workers only touch the blocks they render, hence
+                   upload just the modified region of large framebuffers.
+                   The tonemapping itself happens in a shader below. */
+                Point2i dirtyOffset;
+                Vector2i dirtySize;
+                bool dirty = m_context->fetchDirty(dirtyOffset, dirtySize);
+                if (dirty && !m_fullRefresh && !m_softwareFallback)
+                    m_framebuffer->refresh(dirtyOffset, dirtySize);
+                else
+                    m_framebuffer->refresh();
+                m_framebufferChanged = m_fullRefresh = false;
             }
 
             size = Vector2i(m_framebuffer->getSize().x, m_framebuffer->getSize().y);
@@ -224,7 +224,7 @@ private:
     ref<Timer> m_clock, m_wheelTimer, m_animationTimer;
     ref<Timer> m_statusTimer;
     std::string m_statusMessage;
-    bool m_framebufferChanged, m_mouseDrag;
+    bool m_framebufferChanged, m_fullRefresh, m_mouseDrag;
     bool m_leftKeyDown, m_rightKeyDown;
     bool m_upKeyDown, m_downKeyDown, m_animation;
     bool m_invertMouse, m_didSetCursor;
@@ -39,6 +39,7 @@
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/fstream.h>
+#include <mitsuba/render/scenehandler.h>
 
 #if !defined(WIN32)
 #include <pwd.h>
@@ -101,6 +102,12 @@ MainWindow::MainWindow(QWidget *parent) :
     ui->setupUi(this);
     isActive();
     m_lastTab = NULL;
+
+    /* Tabs that show the same scene (or a reloaded version of it) share
+       the shapes, textures, volumes and BSDFs that didn't change */
+    m_objectCache = new SceneObjectCache();
+    m_objectCache->setRetainShared(true);
+
     ui->glView->setScrollBars(ui->hScrollBar, ui->vScrollBar);
     ui->hScrollBar->setVisible(false);
     ui->vScrollBar->setVisible(false);
@@ -710,8 +717,22 @@ SceneContext *MainWindow::loadScene(const QString &qFileName, const QString &des
     loaddlg->setWindowTitle("Loading ...");
     loaddlg->show();
 
+    /* Reuse the kd-tree of another tab showing the same scene if possible */
+    ref<const Scene> kdtreeSource;
+    m_contextMutex.lock();
+    for (int i=0; i<m_context.size(); ++i) {
+        const Scene *scene = m_context[i]->scene.get();
+        if (scene && fs::absolute(scene->getSourceFile()) == fs::absolute(filename)) {
+            kdtreeSource = scene;
+            break;
+        }
+    }
+    m_contextMutex.unlock();
+
 retry:
     loadingThread = new SceneLoader(newResolver, filename, toFsPath(destFile), m_parameters);
+    loadingThread->setObjectCache(m_objectCache);
+    loadingThread->setKDTreeSource(kdtreeSource);
     loadingThread->start();
 
     while (loadingThread->isRunning()) {
@@ -1063,6 +1084,9 @@ bool MainWindow::on_tabBar_tabCloseRequested(int index) {
     }
     ui->glView->makeCurrent();
     delete context;
+
+    /* Release the cached objects that no other tab uses anymore */
+    m_objectCache->purge();
     return true;
 }
 
@@ -1846,6 +1870,7 @@ void MainWindow::onWorkBegin(const RenderJob *job, const RectangularWorkUnit *wu
     m_contextMutex.lock();
     context->workUnits.insert(vwu);
     drawVisualWorkUnit(context, vwu);
+    context->markDirty(vwu.offset, vwu.size);
     bool isCurrentView = ui->tabBar->currentIndex() < m_context.size() &&
         m_context[ui->tabBar->currentIndex()] == context;
     m_contextMutex.unlock();
@@ -1933,6 +1958,7 @@ void MainWindow::onWorkEnd(const RenderJob *job, const ImageBlock *block) {
         std::min(target->getHeight(), offset.y + block->getSize().y + 2 * border)-offset.y);
 
     context->scene->getFilm()->develop(offset, size, offset, target);
+    context->markDirty(offset, size);
 
     /* This is executed by worker threads -- take some precautions */
     m_contextMutex.lock();
@@ -1946,8 +1972,10 @@ void MainWindow::onWorkEnd(const RenderJob *job, const ImageBlock *block) {
                 " rectangular work unit.");
     }
     for (std::set<VisualWorkUnit, block_comparator>::const_iterator it =
-        context->workUnits.begin(); it != context->workUnits.end(); ++it)
+        context->workUnits.begin(); it != context->workUnits.end(); ++it) {
         drawVisualWorkUnit(context, *it);
+        context->markDirty(it->offset, it->size);
+    }
     m_contextMutex.unlock();
     if (isCurrentView)
         emit updateView();
@@ -1968,6 +1996,7 @@ void MainWindow::refresh(const RenderJob *job) {
     Bitmap *target = context->framebuffer;
     context->scene->getFilm()->develop(Point2i(0, 0),
         target->getSize(), Point2i(0, 0), target);
+    context->markDirty(Point2i(0, 0), target->getSize());
 
     /* This is executed by worker threads -- take some precautions */
     m_contextMutex.lock();
@@ -2155,6 +2184,7 @@ SceneContext::SceneContext(SceneContext *ctx) {
     for (size_t i=0; i<layers.size(); ++i)
         layers[i].second->incRef();
     currentLayer = ctx->currentLayer;
+    dirtyMutex = new Mutex();
 }
 
 SceneContext::~SceneContext() {
@@ -2168,6 +2198,32 @@ SceneContext::~SceneContext() {
         layers[i].second->decRef();
 }
 
+void SceneContext::markDirty(const Point2i &offset, const Vector2i &size) {
+    LockGuard lock(dirtyMutex);
+    dirtyRegion.expandBy(Point2((Float) offset.x, (Float) offset.y));
+    dirtyRegion.expandBy(Point2((Float) (offset.x + size.x),
+        (Float) (offset.y + size.y)));
+}
+
+bool SceneContext::fetchDirty(Point2i &offset, Vector2i &size) {
+    LockGuard lock(dirtyMutex);
+    if (!dirtyRegion.isValid())
+        return false;
+
+    /* Clip against the framebuffer */
+    Point2i min(
+        std::max(0, (int) dirtyRegion.min.x),
+        std::max(0, (int) dirtyRegion.min.y));
+    Point2i max(
+        std::min(framebuffer->getWidth(), (int) dirtyRegion.max.x),
+        std::min(framebuffer->getHeight(), (int) dirtyRegion.max.y));
+    dirtyRegion.reset();
+
+    offset = min;
+    size = max - min;
+    return size.x > 0 && size.y > 0;
+}
+
 int SceneContext::detectPathLength() const {
     if (!scene)
         return 2;
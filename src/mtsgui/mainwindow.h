@@ -236,6 +236,7 @@ private:
     bool m_activeWindowHack;
     int m_contextIndex;
     SceneContext *m_lastTab;
+    ref<SceneObjectCache> m_objectCache;
     std::map<std::string, std::string, SimpleStringOrdering> m_parameters;
 #if defined(__OSX__)
     PreviewSettingsDlg *m_previewSettings;
@@ -42,6 +42,14 @@ SceneLoader::SceneLoader(FileResolver *resolver, const fs::path &filename,
 SceneLoader::~SceneLoader() {
 }
 
+void SceneLoader::setObjectCache(SceneObjectCache *cache) {
+    m_objectCache = cache;
+}
+
+void SceneLoader::setKDTreeSource(const Scene *scene) {
+    m_kdtreeSource = scene;
+}
+
 void SceneLoader::run() {
     Thread::getThread()->setFileResolver(m_resolver);
     SAXParser* parser = new SAXParser();
@@ -49,6 +57,7 @@ void SceneLoader::run() {
     QString suffix = fileInfo.suffix().toLower();
 
     SceneHandler *handler = new SceneHandler(m_parameters);
+    handler->setObjectCache(m_objectCache);
     m_result = new SceneContext();
     try {
         QSettings settings;
@@ -129,6 +138,8 @@ void SceneLoader::run() {
 
             scene->setSourceFile(filename);
             scene->setDestinationFile(m_destFile.empty() ? (filePath / baseName) : m_destFile);
+            if (m_kdtreeSource)
+                scene->reuseKDTree(m_kdtreeSource);
             scene->initialize();
 
             if (scene->getIntegrator() == NULL)
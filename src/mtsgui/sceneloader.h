@@ -21,6 +21,7 @@
 
 #include <QtGui/QtGui>
 #include <mitsuba/mitsuba.h>
+#include <mitsuba/render/fwd.h>
 
 struct SceneContext;
 
@@ -34,6 +35,12 @@ public:
             const std::map<std::string, std::string, SimpleStringOrdering> &parameters);
     void run();
 
+    /// Reuse unchanged shapes, textures, volumes and BSDFs of other open scenes
+    void setObjectCache(SceneObjectCache *cache);
+
+    /// Reuse the kd-tree of an open scene if the geometry turns out to be identical
+    void setKDTreeSource(const Scene *scene);
+
     inline void wait(int ms) { m_wait->wait(ms); }
 
     inline SceneContext *getResult() { return m_result; }
@@ -45,6 +52,8 @@ protected:
 private:
     ref<FileResolver> m_resolver;
     ref<WaitFlag> m_wait;
+    ref<SceneObjectCache> m_objectCache;
+    ref<const Scene> m_kdtreeSource;
     SceneContext *m_result;
     std::string m_error;
     const QString m_filename;
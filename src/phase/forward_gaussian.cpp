@@ -53,19 +53,28 @@ public:
         m_mu = 1/VonMisesFisherDistr::forMeanCosine(m_g);
         Log(EInfo, "mu = %f (g = %f)", m_mu, m_g);
 
-        m_samplingFactor = math::fastexp(-2/m_mu);
-        Float pdfNormalization = INV_TWOPI / (m_mu * (2*sinh(1/m_mu)));
-        m_pdfLogNormalization = log(pdfNormalization);
+        /* Outside of the small 1/mu regime, both sampling and evaluation
+           reduce to a single log/exp with the constants below */
+        m_invMu = 1 / m_mu;
+        m_series = m_invMu < Epsilon;
+        if (m_invMu > LOG_REDUCED_PRECISION / 2) {
+            /* exp(-2/mu) underflows, drop it */
+            m_samplingFactor = 0;
+            m_logScale = std::log(INV_TWOPI * m_invMu);
+        } else {
+            m_samplingFactor = math::fastexp(-2 * m_invMu);
+            Float pdfNormalization = INV_TWOPI / (m_mu * (2*sinh(m_invMu)));
+            m_logScale = std::log(pdfNormalization) + m_invMu;
+        }
+        Assert(std::isfinite(m_logScale));
     }
 
-    inline Float sample(PhaseFunctionSamplingRecord &pRec,
-            Sampler *sampler) const {
+    /// Sample the cosine of the scattering angle given a uniform variate
+    inline Float sampleCosTheta(Float u) const {
         /* cosTheta = z is distributed according to an exponential
          * distribution exp(-(1-z)/mu) (truncated for z between -1 and 1) */
-
         Float cosTheta;
-        Float u = sampler->next1D();
-        if (1/m_mu < Epsilon) {
+        if (m_series) {
             /* Expansion in small 1/mu, up to second order. */
             Float u2 = u*u;
             Float u3 = u2*u;
@@ -73,24 +82,44 @@ public:
             cosTheta = 2.*u - 1
                     + (-2.*u2 + 2.*u) / m_mu
                     + (8./3.*u3 - 4.*u2 + 4./3.*u) / (m_mu*m_mu);
-        } else if (1/m_mu > LOG_REDUCED_PRECISION / 2) {
-            cosTheta = 1 + log(u) * m_mu;
-            if (cosTheta < -1) {
-                /* *INSANELY* unlikely (pdf below would probably cut off to
-                 * zero anyway, but universe would die of heat death first) */
-                Log(EWarn, "Woah! Universe should have encountered heat death, "
-                        "or code is bugged -- cosTheta: %f", cosTheta);
-                cosTheta = -1;
-            }
         } else {
-            Assert(std::isfinite(m_samplingFactor));
-            cosTheta = log(m_samplingFactor * (1 - u) + u)*m_mu + 1;
+            cosTheta = math::fastlog(m_samplingFactor + u * (1 - m_samplingFactor))
+                * m_mu + 1;
         }
 
         if (cosTheta < -1.001 || cosTheta > 1.001)
             Log(EWarn, "Numerical instability in sampling cosTheta: %f", cosTheta);
 
-        cosTheta = math::clamp(cosTheta, (Float) -1, (Float) 1); // For safety
+        return math::clamp(cosTheta, (Float) -1, (Float) 1); // For safety
+    }
+
+    /// Evaluate the phase function given the cosine of the scattering angle
+    inline Float evalCosTheta(Float cosTheta) const {
+        if (m_series) {
+            /* Expansion in small 1/mu, up to second order */
+            /* The expanded pdf is still guaranteed to be >= 0 */
+            return INV_FOURPI * (1 + cosTheta / m_mu
+                    + (0.5*cosTheta*cosTheta - 1./6.) / (m_mu*m_mu));
+        }
+        return math::fastexp((cosTheta - 1) * m_invMu + m_logScale);
+    }
+
+    inline Float sample(PhaseFunctionSamplingRecord &pRec,
+            Sampler *sampler) const {
+        sampleDirection(pRec, sampler);
+        return 1.0f;
+    }
+
+    Float sample(PhaseFunctionSamplingRecord &pRec,
+            Float &pdf, Sampler *sampler) const {
+        pdf = evalCosTheta(sampleDirection(pRec, sampler));
+        return 1.0f;
+    }
+
+    /// Sample an outgoing direction and return the cosine of the scattering angle
+    inline Float sampleDirection(PhaseFunctionSamplingRecord &pRec,
+            Sampler *sampler) const {
+        Float cosTheta = sampleCosTheta(sampler->next1D());
         Float sinTheta = sqrt(1 - math::square(cosTheta));
 
         Float sinPhi, cosPhi;
@@ -102,36 +131,39 @@ public:
             cosTheta
         ));
 
-        return 1.0f;
-    }
-
-    Float sample(PhaseFunctionSamplingRecord &pRec,
-            Float &pdf, Sampler *sampler) const {
-        sample(pRec, sampler);
-        pdf = eval(pRec);
-        return 1.0f;
+        return cosTheta;
     }
 
     Float eval(const PhaseFunctionSamplingRecord &pRec) const {
         Float cosTheta = math::clamp(-dot(pRec.wi, pRec.wo), (Float) -1, (Float) 1);
-
-        Float pdf;
-        if (1/m_mu < Epsilon) {
-            /* Expansion in small 1/mu, up to second order */
-            /* The expanded pdf is still guaranteed to be >= 0 */
-            pdf = INV_FOURPI * (1 + cosTheta / m_mu
-                    + (0.5*cosTheta*cosTheta - 1./6.) / (m_mu*m_mu));
-        } else if (1/m_mu > LOG_REDUCED_PRECISION / 2) {
-            pdf = INV_TWOPI * exp((cosTheta - 1) / m_mu) / m_mu;
-        } else {
-            Assert(std::isfinite(m_pdfLogNormalization));
-            pdf = exp(cosTheta / m_mu + m_pdfLogNormalization);
-        }
-
+        Float pdf = evalCosTheta(cosTheta);
         Assert(std::isfinite(pdf));
         return pdf;
     }
 
+    void evalBatch(const MediumSamplingRecord &mRec, const Vector &wi,
+            size_t count, const Vector *wo, Float *result) const {
+        size_t i = 0;
+#if defined(MTS_SSE)
+        if (!m_series) {
+            const __m128 invMu = _mm_set1_ps(m_invMu),
+                  offset = _mm_set1_ps(m_logScale - m_invMu),
+                  minusOne = _mm_set1_ps(-1.0f), one = _mm_set1_ps(1.0f);
+            for (; i + 4 <= count; i += 4) {
+                __m128 cosTheta = _mm_set_ps(
+                    -dot(wi, wo[i+3]), -dot(wi, wo[i+2]),
+                    -dot(wi, wo[i+1]), -dot(wi, wo[i]));
+                cosTheta = _mm_min_ps(_mm_max_ps(cosTheta, minusOne), one);
+                _mm_storeu_ps(result + i, detail::exp_ps_full(
+                    _mm_add_ps(_mm_mul_ps(cosTheta, invMu), offset)));
+            }
+        }
+#endif
+        for (; i < count; ++i)
+            result[i] = evalCosTheta(math::clamp(-dot(wi, wo[i]),
+                (Float) -1, (Float) 1));
+    }
+
     Float getMeanCosine() const {
         return m_g;
     }
@@ -146,7 +178,9 @@ public:
 private:
     Float m_g; /// mean cosine
     Float m_mu; /// 1/kappa in 'VMF-speak'
-    Float m_pdfLogNormalization; /// Cache for normalization constant of the pdf
+    Float m_invMu; /// kappa
+    bool m_series; /// Use the expansion in small 1/mu?
+    Float m_logScale; /// log of the pdf at cosTheta = 1
     Float m_samplingFactor; /// Cache for factor that gets used in the sampling routine
 };
 
@@ -22,9 +22,118 @@
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/frame.h>
 #include <mitsuba/core/warp.h>
+#include <mitsuba/core/lock.h>
 
 MTS_NAMESPACE_BEGIN
 
+/// Number of cells used to tabulate the specular lobe
+#define KKAY_TABLE_SIZE 1024
+
+/**
+ * \brief Normalization and sampling table of the Kajiya-Kay specular lobe
+ *
+ * In terms of the angle between the outgoing direction and the fiber
+ * tangent, the specular lobe is \f$\cos^n\delta\f$, where \f$\delta\f$
+ * is the offset from the cone of ideal reflection. Its density over
+ * \f$\delta\in[-\pi/2,\pi/2]\f$ is tabulated as a piecewise constant
+ * function. The tables are cached and shared by all phase functions with
+ * the same exponent.
+ */
+class KajiyaKayTable : public Object {
+public:
+    /// Return the shared table of an exponent
+    static const KajiyaKayTable *get(Float exponent) {
+        LockGuard lock(getMutex());
+        ref<KajiyaKayTable> &entry = getEntries()[exponent];
+        if (entry.get() == NULL)
+            entry = new KajiyaKayTable(exponent);
+        return entry.get();
+    }
+
+    /// Return the normalization for perpendicular illumination
+    inline Float getNormalization() const { return m_normalization; }
+
+    /// Return the tabulated probability mass of the offsets below \c delta
+    inline Float cdf(Float delta) const {
+        Float pos = (delta + (Float) (M_PI / 2)) * m_invCellWidth;
+        if (pos <= 0)
+            return 0;
+        else if (pos >= KKAY_TABLE_SIZE)
+            return 1;
+        int idx = (int) pos;
+        return m_cdf[idx] + (pos - idx) * (m_cdf[idx+1] - m_cdf[idx]);
+    }
+
+    /// Return the tabulated density of an offset
+    inline Float pdf(Float delta) const {
+        Float pos = (delta + (Float) (M_PI / 2)) * m_invCellWidth;
+        if (pos < 0 || pos >= KKAY_TABLE_SIZE)
+            return 0;
+        int idx = (int) pos;
+        return (m_cdf[idx+1] - m_cdf[idx]) * m_invCellWidth;
+    }
+
+    /// Sample an offset from the tabulated density restricted to [\c minDelta, \c maxDelta]
+    Float sample(Float sample, Float minDelta, Float maxDelta) const {
+        Float cdfMin = cdf(minDelta), cdfMax = cdf(maxDelta),
+              target = cdfMin + sample * (cdfMax - cdfMin);
+        int idx = (int) (std::upper_bound(m_cdf, m_cdf + KKAY_TABLE_SIZE + 1, target) - m_cdf) - 1;
+        idx = std::max(0, std::min(idx, KKAY_TABLE_SIZE - 1));
+
+        Float mass = m_cdf[idx+1] - m_cdf[idx];
+        Float offset = mass > 0 ? (target - m_cdf[idx]) / mass : (Float) 0.5f;
+        Float delta = (idx + offset) / m_invCellWidth - (Float) (M_PI / 2);
+        return std::max(minDelta, std::min(delta, maxDelta));
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    KajiyaKayTable(Float exponent) {
+        /* Compute the normalization for perpendicular illumination
+           using Simpson quadrature */
+        int nParts = 1000;
+        Float stepSize = M_PI / nParts, m=4, theta = stepSize;
+
+        m_normalization = 0; /* 0 at the endpoints */
+        for (int i=1; i<nParts; ++i) {
+            Float value = std::pow(std::cos(theta - M_PI/2), exponent)
+                * std::sin(theta);
+            m_normalization += value * m;
+            theta += stepSize;
+            m = 6-m;
+        }
+        m_normalization = 1/(m_normalization * stepSize/3 * 2 * M_PI);
+
+        /* Tabulate the lobe at the cell centers */
+        double cellWidth = M_PI / KKAY_TABLE_SIZE, sum = 0;
+        m_cdf[0] = 0;
+        for (int i=0; i<KKAY_TABLE_SIZE; ++i) {
+            sum += std::pow(std::cos((i + 0.5) * cellWidth - M_PI / 2), (double) exponent);
+            m_cdf[i+1] = (Float) sum;
+        }
+        for (int i=1; i<=KKAY_TABLE_SIZE; ++i)
+            m_cdf[i] = (Float) (m_cdf[i] / sum);
+        m_cdf[KKAY_TABLE_SIZE] = 1;
+        m_invCellWidth = (Float) (1 / cellWidth);
+    }
+
+    virtual ~KajiyaKayTable() { }
+
+    static Mutex *getMutex() {
+        static ref<Mutex> mutex = new Mutex();
+        return mutex;
+    }
+
+    static std::map<Float, ref<KajiyaKayTable> > &getEntries() {
+        static std::map<Float, ref<KajiyaKayTable> > entries;
+        return entries;
+    }
+
+private:
+    Float m_normalization, m_invCellWidth;
+    Float m_cdf[KKAY_TABLE_SIZE + 1];
+};
+
 /*!\plugin{kkay}{Kajiya-Kay phase function}
  * This plugin implements the Kajiya-Kay \cite{Kajiya1989Rendering}
  * phase function for volumetric rendering of fibers, e.g.
@@ -32,6 +141,9 @@ MTS_NAMESPACE_BEGIN
  *
  * The function is normalized so that it has no energy loss when
  * \code{ks}=1 and illumination arrives perpendicularly to the surface.
+ * Outgoing directions are importance sampled: the specular lobe around
+ * the cone of ideal reflection is sampled from a table that is shared by
+ * all instances with the same exponent.
  */
 class KajiyaKayPhaseFunction : public PhaseFunction {
 public:
@@ -55,21 +167,8 @@ public:
     virtual ~KajiyaKayPhaseFunction() { }
 
     void configure() {
-        /* Compute the normalization for perpendicular illumination
-           using Simpson quadrature */
-        int nParts = 1000;
-        Float stepSize = M_PI / nParts, m=4, theta = stepSize;
-
-        m_normalization = 0; /* 0 at the endpoints */
-        for (int i=1; i<nParts; ++i) {
-            Float value = std::pow(std::cos(theta - M_PI/2), m_exponent)
-                * std::sin(theta);
-            m_normalization += value * m;
-            theta += stepSize;
-            m = 6-m;
-        }
-
-        m_normalization = 1/(m_normalization * stepSize/3 * 2 * M_PI);
+        m_table = KajiyaKayTable::get(m_exponent);
+        m_normalization = m_table->getNormalization();
         m_type = EAnisotropic;
         Log(EDebug, "Kajiya-kay normalization factor = %f", m_normalization);
     }
@@ -84,19 +183,62 @@ public:
 
     Float sample(PhaseFunctionSamplingRecord &pRec,
             Sampler *sampler) const {
-        pRec.wo = warp::squareToUniformSphere(sampler->next2D());
-        return eval(pRec) * (4 * M_PI);
+        Float pdf;
+        return sample(pRec, pdf, sampler);
     }
 
     Float sample(PhaseFunctionSamplingRecord &pRec,
             Float &pdf, Sampler *sampler) const {
-        pRec.wo = warp::squareToUniformSphere(sampler->next2D());
-        pdf = warp::squareToUniformSpherePdf();
-        return eval(pRec) * (4 * M_PI);
+        Point2 sample(sampler->next2D());
+        Float specProb = getSpecularProbability(pRec);
+
+        if (sample.x < specProb) {
+            sample.x /= specProb;
+
+            /* Sample the angle to the tangent around the cone of ideal
+               reflection, and the azimuth uniformly */
+            Frame frame(normalize(pRec.mRec.orientation));
+            Float thetaR = math::safe_acos(-dot(pRec.wi, frame.n)),
+                  minDelta = std::max(-thetaR, (Float) -M_PI/2),
+                  maxDelta = std::min((Float) M_PI - thetaR, (Float) M_PI/2);
+            Float theta = thetaR + m_table->sample(sample.x, minDelta, maxDelta);
+
+            Float sinTheta, cosTheta, sinPhi, cosPhi;
+            math::sincos(theta, &sinTheta, &cosTheta);
+            math::sincos((Float) (2 * M_PI) * sample.y, &sinPhi, &cosPhi);
+            pRec.wo = frame.toWorld(Vector(
+                sinTheta * cosPhi, sinTheta * sinPhi, cosTheta));
+        } else {
+            sample.x = (sample.x - specProb) / (1 - specProb);
+            pRec.wo = warp::squareToUniformSphere(sample);
+        }
+
+        pdf = this->pdf(pRec);
+        if (pdf == 0)
+            return 0.0f;
+        return eval(pRec) / pdf;
     }
 
     Float pdf(const PhaseFunctionSamplingRecord &pRec) const {
-        return warp::squareToUniformSpherePdf();
+        Float specProb = getSpecularProbability(pRec);
+        Float result = (1 - specProb) * warp::squareToUniformSpherePdf();
+        if (specProb == 0)
+            return result;
+
+        Frame frame(normalize(pRec.mRec.orientation));
+        Float thetaR = math::safe_acos(-dot(pRec.wi, frame.n)),
+              cosTheta = dot(pRec.wo, frame.n),
+              sinTheta = math::safe_sqrt(1 - cosTheta*cosTheta),
+              delta = math::safe_acos(cosTheta) - thetaR;
+
+        /* Tabulated mass of the part of the lobe that lies on the sphere */
+        Float mass = m_table->cdf(std::min((Float) M_PI - thetaR, (Float) M_PI/2))
+                   - m_table->cdf(std::max(-thetaR, (Float) -M_PI/2));
+        if (mass <= 0 || sinTheta == 0)
+            return result;
+
+        return result + specProb * m_table->pdf(delta)
+            / (mass * 2 * M_PI * sinTheta);
     }
 
     Float eval(const PhaseFunctionSamplingRecord &pRec) const {
@@ -122,11 +264,21 @@ public:
     }
 
     MTS_DECLARE_CLASS()
+protected:
+    /// Probability of sampling the specular lobe instead of the diffuse one
+    inline Float getSpecularProbability(const PhaseFunctionSamplingRecord &pRec) const {
+        if (pRec.mRec.orientation.isZero() || m_ks + m_kd == 0)
+            return 0.0f;
+        return m_ks / (m_ks + m_kd);
+    }
+
 private:
     Float m_ks, m_kd, m_exponent, m_normalization;
+    const KajiyaKayTable *m_table;
 };
 
 
+MTS_IMPLEMENT_CLASS(KajiyaKayTable, false, Object)
 MTS_IMPLEMENT_CLASS_S(KajiyaKayPhaseFunction, false, PhaseFunction)
 MTS_EXPORT_PLUGIN(KajiyaKayPhaseFunction, "Kajiya-Kay phase function");
 MTS_NAMESPACE_END
@@ -41,6 +41,14 @@ static StatsCounter avgSampleIterations("Micro-flake model",
  *       Standard deviation of the micro-flake normals. This
  *       specifies the roughness of the fibers in the medium.
  *     }
+ *     \parameter{tabulate}{\Boolean}{
+ *       Tabulate the projected area of the flakes as a function of
+ *       the angle to the fiber axis, and sample the flake distribution
+ *       by inverting its CDF in closed form. The tables are shared by
+ *       all micro-flake phase functions with the same \code{stddev}.
+ *       Disable to evaluate the original series expansion and numerical
+ *       inversion instead \default{\code{true}}
+ *     }
  * }
  *
  * \renderings{
@@ -81,12 +89,14 @@ class MicroflakePhaseFunction : public PhaseFunction {
 public:
     MicroflakePhaseFunction(const Properties &props) : PhaseFunction(props) {
         /// Standard deviation of the flake distribution
-        m_fiberDistr = GaussianFiberDistribution(props.getFloat("stddev"));
+        m_fiberDistr = GaussianFiberDistribution(props.getFloat("stddev"),
+            props.getBoolean("tabulate", true));
     }
 
     MicroflakePhaseFunction(Stream *stream, InstanceManager *manager)
         : PhaseFunction(stream, manager) {
-        m_fiberDistr = GaussianFiberDistribution(stream->readFloat());
+        Float stddev = stream->readFloat();
+        m_fiberDistr = GaussianFiberDistribution(stddev, stream->readBool());
         configure();
     }
 
@@ -100,6 +110,7 @@ public:
     void serialize(Stream *stream, InstanceManager *manager) const {
         PhaseFunction::serialize(stream, manager);
         stream->writeFloat(m_fiberDistr.getStdDev());
+        stream->writeBool(m_fiberDistr.isTabulated());
     }
 
     Float eval(const PhaseFunctionSamplingRecord &pRec) const {
@@ -204,6 +215,7 @@ private:
     GaussianFiberDistribution m_fiberDistr;
 };
 
+MTS_IMPLEMENT_CLASS(GaussianFiberTable, false, Object)
 MTS_IMPLEMENT_CLASS_S(MicroflakePhaseFunction, false, PhaseFunction)
 MTS_EXPORT_PLUGIN(MicroflakePhaseFunction, "Microflake phase function");
 MTS_NAMESPACE_END
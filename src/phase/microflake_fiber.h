@@ -21,6 +21,7 @@
 
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/brent.h>
+#include <mitsuba/core/lock.h>
 #include <boost/bind.hpp>
 #include <boost/math/special_functions/erf.hpp>
 
@@ -40,6 +41,7 @@ FINLINE Float mts_erf(Float arg) {
 #define FIBERDIST_STDDEV_MAX        4
 #define FIBERDIST_SIGMA_T_ELEMENTS  100
 #define FIBERDIST_SIGMA_T_COEFFS    10
+#define FIBERDIST_TABLE_SIZE        512
 
 /**
  * Each row of this table table stores an expansion of \sigma_t in terms of
@@ -187,6 +189,64 @@ static StatsCounter avgBrentFunEvals("Micro-flake model",
 #endif
 
 
+/**
+ * \brief Tabulated \sigma_t of a fiber distribution with a fixed
+ * standard deviation
+ *
+ * The expansion in powers of sin(theta) is evaluated once at uniformly
+ * spaced values of sin(theta) and linearly interpolated afterwards. The
+ * tables are cached and shared by all distributions with the same
+ * standard deviation.
+ */
+class GaussianFiberTable : public Object {
+public:
+    /// Return the shared table of a standard deviation and its coefficients
+    static const GaussianFiberTable *get(Float stddev, const Float *coeffs) {
+        LockGuard lock(getMutex());
+        ref<GaussianFiberTable> &entry = getEntries()[stddev];
+        if (entry.get() == NULL)
+            entry = new GaussianFiberTable(coeffs);
+        return entry.get();
+    }
+
+    /// Evaluate \sigma_t as a function of \sin\theta
+    inline Float sigmaT(Float sinTheta) const {
+        Float pos = sinTheta * (FIBERDIST_TABLE_SIZE - 1);
+        int idx = std::max(0, std::min((int) pos, FIBERDIST_TABLE_SIZE - 2));
+        Float alpha = pos - idx;
+        return (1 - alpha) * m_sigmaT[idx] + alpha * m_sigmaT[idx + 1];
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    GaussianFiberTable(const Float *coeffs) {
+        for (int i=0; i<FIBERDIST_TABLE_SIZE; ++i) {
+            double sinTheta = i / (double) (FIBERDIST_TABLE_SIZE - 1),
+                   base = 1, result = 0;
+            for (int j=0; j<FIBERDIST_SIGMA_T_COEFFS; ++j) {
+                result += base * coeffs[j];
+                base *= sinTheta;
+            }
+            m_sigmaT[i] = (Float) result;
+        }
+    }
+
+    virtual ~GaussianFiberTable() { }
+
+    static Mutex *getMutex() {
+        static ref<Mutex> mutex = new Mutex();
+        return mutex;
+    }
+
+    static std::map<Float, ref<GaussianFiberTable> > &getEntries() {
+        static std::map<Float, ref<GaussianFiberTable> > entries;
+        return entries;
+    }
+
+private:
+    Float m_sigmaT[FIBERDIST_TABLE_SIZE];
+};
+
 /**
  * \brief Flake distribution for simulating rough fibers
  *
@@ -202,7 +262,16 @@ class GaussianFiberDistribution {
 public:
     inline GaussianFiberDistribution() {}
 
-    inline GaussianFiberDistribution(Float stddev) : m_stddev(stddev) {
+    /**
+     * \brief Create a new fiber distribution
+     *
+     * \param tabulate
+     *    Evaluate \sigma_t using a shared table (see \ref GaussianFiberTable)
+     *    and sample by inverting the CDF in closed form. Otherwise, the
+     *    expansion is evaluated directly and the CDF is inverted numerically.
+     */
+    inline GaussianFiberDistribution(Float stddev, bool tabulate = false)
+            : m_stddev(stddev) {
         m_normalization = 1/(std::pow(2*M_PI, (Float) 3 / (Float) 2) * m_stddev *
                 mts_erf(1/(SQRT_TWO * m_stddev)));
         m_c1 = 1.0f/mts_erf(1/(SQRT_TWO * m_stddev));
@@ -223,6 +292,9 @@ public:
         for (int i=0; i<FIBERDIST_SIGMA_T_COEFFS; ++i)
             m_coeffs[i] = (Float) (((1-alpha) * fiberSigmaTCoeffs[idx0][i]
                 + alpha * fiberSigmaTCoeffs[idx1][i]));
+
+        if (tabulate)
+            m_table = GaussianFiberTable::get(stddev, m_coeffs);
     }
 
     /// Evaluate \sigma_t as a function of \cos\theta
@@ -231,6 +303,9 @@ public:
                 (Float) 0, 1-cosTheta*cosTheta)),
               base = 1.0f, result = 0.0f;
 
+        if (m_table.get())
+            return m_table->sigmaT(sinTheta);
+
         /* Evaluate the expansion */
         for (int i=0; i<FIBERDIST_SIGMA_T_COEFFS; ++i) {
             result += base * m_coeffs[i];
@@ -257,18 +332,31 @@ public:
      * a uniformly distributed r.v. \xi on [0, 1]
      */
     Vector sample(const Point2 &sample) const {
-        BrentSolver brentSolver(100, 1e-6f);
-        BrentSolver::Result result = brentSolver.solve(
-            boost::bind(&GaussianFiberDistribution::cdfFunctor,
-                this, sample.x, _1), -1, 1);
-        SAssert(result.success);
-
-        #if defined(MICROFLAKE_STATISTICS)
-            avgBrentFunEvals.incrementBase();
-        #endif
+        Float cosTheta;
+        if (m_table.get()) {
+            /* cdf() has a closed-form inverse. The argument is kept away
+               from +-1, where erfinv() diverges; this only removes the
+               far tails of the Gaussian */
+            const Float maxArg = 1 - std::numeric_limits<Float>::epsilon();
+            Float arg = math::clamp((1 - 2 * sample.x) * (1 / m_c1),
+                -maxArg, maxArg);
+            cosTheta = math::clamp(SQRT_TWO * m_stddev * math::erfinv(arg),
+                (Float) -1, (Float) 1);
+        } else {
+            BrentSolver brentSolver(100, 1e-6f);
+            BrentSolver::Result result = brentSolver.solve(
+                boost::bind(&GaussianFiberDistribution::cdfFunctor,
+                    this, sample.x, _1), -1, 1);
+            SAssert(result.success);
+
+            #if defined(MICROFLAKE_STATISTICS)
+                avgBrentFunEvals.incrementBase();
+            #endif
+
+            cosTheta = result.x;
+        }
 
-        Float cosTheta = result.x,
-              sinTheta = std::sqrt(std::max((Float) 0, 1-cosTheta*cosTheta)),
+        Float sinTheta = std::sqrt(std::max((Float) 0, 1-cosTheta*cosTheta)),
               phi = 2 * M_PI * sample.y,
               sinPhi = std::sin(phi), cosPhi = std::cos(phi);
 
@@ -277,10 +365,13 @@ public:
 
     inline Float getStdDev() const { return m_stddev; }
 
+    /// Is \sigma_t tabulated?
+    inline bool isTabulated() const { return m_table.get() != NULL; }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "GaussianFiberDistribution[stddev="
-            << m_stddev << "]";
+            << m_stddev << ", tabulated=" << isTabulated() << "]";
         return oss.str();
     }
 protected:
@@ -302,6 +393,7 @@ protected:
     Float m_normalization;
     Float m_c1;
     Float m_coeffs[FIBERDIST_SIGMA_T_COEFFS];
+    ref<const GaussianFiberTable> m_table;
 };
 
 MTS_NAMESPACE_END
@@ -295,32 +295,24 @@ public:
 
         uint32_t dim = m_arrayStartDim;
         for (size_t i=0; i<m_req1D.size(); i++) {
-            if (!m_permutations.get()) {
-                for (size_t j=0; j<m_sampleCount * m_req1D[i]; ++j)
-                    m_sampleArrays1D[i][j] = radicalInverseFast(dim, m_offset + j * m_stride);
-            } else {
-                uint16_t *perm = m_permutations->getPermutation(dim);
-                for (size_t j=0; j<m_sampleCount * m_req1D[i]; ++j)
-                    m_sampleArrays1D[i][j] = scrambledRadicalInverseFast(dim, m_offset + j * m_stride, perm);
-            }
+            size_t count = m_sampleCount * m_req1D[i];
+            if (!m_permutations.get())
+                radicalInverseArray(dim, m_offset, m_stride, m_sampleArrays1D[i], count);
+            else
+                scrambledRadicalInverseArray(dim, m_offset, m_stride,
+                    m_permutations->getPermutation(dim), m_sampleArrays1D[i], count);
             dim += 1;
         }
 
         for (size_t i=0; i<m_req2D.size(); i++) {
-            if (!m_permutations.get()) {
-                for (size_t j=0; j<m_sampleCount * m_req2D[i]; ++j) {
-                    m_sampleArrays2D[i][j] = Point2(
-                        radicalInverseFast(dim,   m_offset + j * m_stride),
-                        radicalInverseFast(dim+1, m_offset + j * m_stride));
-                }
-            } else {
-                uint16_t *perm1 = m_permutations->getPermutation(dim);
-                uint16_t *perm2 = m_permutations->getPermutation(dim+1);
-                for (size_t j=0; j<m_sampleCount * m_req2D[i]; ++j) {
-                    m_sampleArrays2D[i][j] = Point2(
-                        scrambledRadicalInverseFast(dim,   m_offset + j * m_stride, perm1),
-                        scrambledRadicalInverseFast(dim+1, m_offset + j * m_stride, perm2));
-                }
+            size_t count = m_sampleCount * m_req2D[i];
+            Float *dest = reinterpret_cast<Float *>(m_sampleArrays2D[i]);
+            for (int j=0; j<2; ++j) {
+                if (!m_permutations.get())
+                    radicalInverseArray(dim + j, m_offset, m_stride, dest + j, count, 2);
+                else
+                    scrambledRadicalInverseArray(dim + j, m_offset, m_stride,
+                        m_permutations->getPermutation(dim + j), dest + j, count, 2);
             }
             dim += 2;
         }
@@ -383,6 +375,16 @@ public:
         return Point2(value1, value2);
     }
 
+    void next1DBlock(Float *dest, size_t count) {
+        for (size_t i=0; i<count; ++i)
+            dest[i] = HaltonSampler::next1D();
+    }
+
+    void next2DBlock(Point2 *dest, size_t count) {
+        for (size_t i=0; i<count; ++i)
+            dest[i] = HaltonSampler::next2D();
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "HaltonSampler[" << endl
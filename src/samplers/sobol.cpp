@@ -179,20 +179,21 @@ public:
 
         uint32_t dim = m_arrayStartDim;
         for (size_t i=0; i<m_req1D.size(); i++) {
-            for (size_t j=0; j<m_sampleCount * m_req1D[i]; ++j) {
-                uint64_t idx = sobol::look_up(m_logResolution, (uint32_t) j, m_pixelPosition.x, m_pixelPosition.y, m_scramble);
-                m_sampleArrays1D[i][j] = sobol::sample(idx, dim, m_scramble);
-            }
+            size_t count = m_sampleCount * m_req1D[i];
+            const sobol::SampleBits *bits = enumerate(dim, count, m_bits[0]);
+            for (size_t j=0; j<count; ++j)
+                m_sampleArrays1D[i][j] = sobol::bitsToFloat(bits[j]);
             dim += 1;
         }
 
         for (size_t i=0; i<m_req2D.size(); i++) {
-            for (size_t j=0; j<m_sampleCount * m_req2D[i]; ++j) {
-                uint64_t idx = sobol::look_up(m_logResolution, (uint32_t) j, m_pixelPosition.x, m_pixelPosition.y, m_scramble);
+            size_t count = m_sampleCount * m_req2D[i];
+            const sobol::SampleBits *bits1 = enumerate(dim, count, m_bits[0]);
+            const sobol::SampleBits *bits2 = enumerate(dim+1, count, m_bits[1]);
+            for (size_t j=0; j<count; ++j)
                 m_sampleArrays2D[i][j] = Point2(
-                    sobol::sample(idx, dim, m_scramble),
-                    sobol::sample(idx, dim+1, m_scramble));
-            }
+                    sobol::bitsToFloat(bits1[j]),
+                    sobol::bitsToFloat(bits2[j]));
             dim += 2;
         }
     }
@@ -205,17 +206,92 @@ public:
         m_dimension = 0;
         m_dimension1DArray = m_dimension2DArray = 0;
         m_sampleIndex = sampleIndex;
+        m_sobolSampleIndex = getSobolIndex(sampleIndex);
+    }
+
+    Float next1D() {
+        return sobol::sample(m_sobolSampleIndex, nextDimension(), m_scramble);
+    }
+
+    Point2 next2D() {
+        Float value1, value2;
+        uint32_t dim = nextDimension2D();
+
+        if (dim == 0 && m_sobolSampleIndex != (uint64_t) m_sampleIndex) {
+            value1 = sobol::sample(m_sobolSampleIndex, dim, m_scramble) * m_resolution - m_pixelPosition.x;
+            value2 = sobol::sample(m_sobolSampleIndex, dim+1, m_scramble) * m_resolution - m_pixelPosition.y;
+        } else {
+            value1 = sobol::sample(m_sobolSampleIndex, dim, m_scramble);
+            value2 = sobol::sample(m_sobolSampleIndex, dim+1, m_scramble);
+        }
+
+        return Point2(value1, value2);
+    }
+
+    void next1DBlock(Float *dest, size_t count) {
+        size_t i = 0;
+#if defined(SINGLE_PRECISION) && defined(MTS_SSE)
+        /* Evaluate four dimensions of the current point at once */
+        uint32_t dims[4];
+        for (; i + 4 <= count; i += 4) {
+            for (int k=0; k<4; ++k)
+                dims[k] = nextDimension();
+            sobol::sampleSingle4(m_sobolSampleIndex, dims,
+                (uint32_t) m_scramble, dest + i);
+        }
+#endif
+        for (; i<count; ++i)
+            dest[i] = SobolSampler::next1D();
+    }
+
+    void next2DBlock(Point2 *dest, size_t count) {
+        size_t i = 0;
+#if defined(SINGLE_PRECISION) && defined(MTS_SSE)
+        /* The image plane sample is offset by the pixel position */
+        if (m_dimension == 0 && count > 0)
+            dest[i++] = SobolSampler::next2D();
+
+        uint32_t dims[4];
+        float values[4];
+        for (; i + 2 <= count; i += 2) {
+            dims[0] = nextDimension2D(); dims[1] = dims[0] + 1;
+            dims[2] = nextDimension2D(); dims[3] = dims[2] + 1;
+            sobol::sampleSingle4(m_sobolSampleIndex, dims,
+                (uint32_t) m_scramble, values);
+            dest[i]   = Point2(values[0], values[1]);
+            dest[i+1] = Point2(values[2], values[3]);
+        }
+#endif
+        for (; i<count; ++i)
+            dest[i] = SobolSampler::next2D();
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "SobolSampler[" << endl
+            << "  sampleCount = " << m_sampleCount << "," << endl
+            << "  sampleIndex = " << m_sampleIndex << "," << endl
+            << "  resolution = " << m_resolution << "," << endl
+            << "  scramble = " << m_scramble << endl
+            << "]";
+        return oss.str();
+    }
 
+    MTS_DECLARE_CLASS()
+protected:
+    /// Return the index into the Sobol sequence of a sample of the current pixel
+    inline uint64_t getSobolIndex(size_t sampleIndex) const {
         if (m_logResolution > 1 && m_pixelPosition.x >= 0) {
             /* Find the next sample that is located in the current pixel */
-            m_sobolSampleIndex = sobol::look_up(m_logResolution, (uint32_t) m_sampleIndex,
+            return sobol::look_up(m_logResolution, (uint32_t) sampleIndex,
                     m_pixelPosition.x, m_pixelPosition.y, m_scramble);
         } else {
-            m_sobolSampleIndex = (uint64_t) m_sampleIndex;
+            return (uint64_t) sampleIndex;
         }
     }
 
-    Float next1D() {
+    /// Claim the next dimension for a 1D sample
+    inline uint32_t nextDimension() {
         /* Skip over dimensions that were reserved to arrays */
         if (m_dimension >= m_arrayStartDim && m_dimension < m_arrayEndDim)
             m_dimension = m_arrayEndDim;
@@ -224,12 +300,11 @@ public:
             Log(EError, "Lookup dimension exceeds the direction number table size! You "
                 "may have to reduce the 'maxDepth' parameter of your integrator.");
 
-        return sobol::sample(m_sobolSampleIndex, m_dimension++, m_scramble);
+        return m_dimension++;
     }
 
-    Point2 next2D() {
-        Float value1, value2;
-
+    /// Claim the next two dimensions for a 2D sample
+    inline uint32_t nextDimension2D() {
         /* Skip over dimensions that were reserved to arrays */
         if (m_dimension + 1 >= m_arrayStartDim && m_dimension < m_arrayEndDim)
             m_dimension = m_arrayEndDim;
@@ -238,29 +313,39 @@ public:
             Log(EError, "Lookup dimension exceeds the direction number table size! You "
                 "may have to reduce the 'maxDepth' parameter of your integrator.");
 
-        if (m_dimension == 0 && m_sobolSampleIndex != (uint64_t) m_sampleIndex) {
-            value1 = sobol::sample(m_sobolSampleIndex, m_dimension++, m_scramble) * m_resolution - m_pixelPosition.x;
-            value2 = sobol::sample(m_sobolSampleIndex, m_dimension++, m_scramble) * m_resolution - m_pixelPosition.y;
-        } else {
-            value1 = sobol::sample(m_sobolSampleIndex, m_dimension++, m_scramble);
-            value2 = sobol::sample(m_sobolSampleIndex, m_dimension++, m_scramble);
-        }
-
-        return Point2(value1, value2);
+        uint32_t dim = m_dimension;
+        m_dimension += 2;
+        return dim;
     }
 
-    std::string toString() const {
-        std::ostringstream oss;
-        oss << "SobolSampler[" << endl
-            << "  sampleCount = " << m_sampleCount << "," << endl
-            << "  sampleIndex = " << m_sampleIndex << "," << endl
-            << "  resolution = " << m_resolution << "," << endl
-            << "  scramble = " << m_scramble << endl
-            << "]";
-        return oss.str();
+    /**
+     * \brief Compute the raw bits of dimension \c dim for the first
+     * \c count samples of the current pixel
+     *
+     * The pixel's sample indices are an affine function of the sample
+     * number over GF(2), and so are the resulting bits. Hence, the bits
+     * of sample \c j follow from those of sample <tt>j & (j-1)</tt> and
+     * of the power of two <tt>j & -j</tt> with two XORs, and only the
+     * powers of two need a full matrix-vector product.
+     */
+    const sobol::SampleBits *enumerate(uint32_t dim, size_t count,
+            std::vector<sobol::SampleBits> &bits) const {
+        bits.resize(count);
+        if (count == 0)
+            return NULL;
+        const sobol::SampleBits base = sobol::sampleBits(
+            getSobolIndex(0), dim, m_scramble);
+        bits[0] = base;
+        for (size_t j=1; j<count; ++j) {
+            size_t low = j & (~j + 1);
+            if (low == j)
+                bits[j] = sobol::sampleBits(getSobolIndex(j), dim, m_scramble);
+            else
+                bits[j] = bits[j & (j-1)] ^ bits[low] ^ base;
+        }
+        return &bits[0];
     }
 
-    MTS_DECLARE_CLASS()
 private:
     uint32_t m_dimension;
     uint64_t m_scramble;
@@ -270,6 +355,7 @@ private:
     uint32_t m_arrayStartDim;
     uint32_t m_arrayEndDim;
     Point2i m_pixelPosition;
+    std::vector<sobol::SampleBits> m_bits[2];
 };
 
 MTS_IMPLEMENT_CLASS_S(SobolSampler, false, Sampler)
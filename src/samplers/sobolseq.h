@@ -23,6 +23,9 @@
 
 #include <mitsuba/mitsuba.h>
 #include <cassert>
+#if defined(MTS_SSE)
+#include <mitsuba/core/sse.h>
+#endif
 
 namespace sobol {
 
@@ -35,12 +38,12 @@ struct Matrices {
     static const uint64_t vdc_sobol_matrices[][52];
 };
 
-// Compute one component of the Sobol'-sequence, where the component
-// corresponds to the dimension parameter, and the index specifies
-// the point inside the sequence. The scramble parameter can be used
-// to permute elementary intervals, and might be chosen randomly to
-// generate a randomized QMC sequence.
-inline float sampleSingle(
+// Compute the raw bits of one component of the Sobol'-sequence, where
+// the component corresponds to the dimension parameter, and the index
+// specifies the point inside the sequence. The scramble parameter can
+// be used to permute elementary intervals, and might be chosen randomly
+// to generate a randomized QMC sequence.
+inline uint32_t sampleBitsSingle(
     uint64_t index,
     const uint32_t dimension,
     const uint32_t scramble = 0U)
@@ -54,16 +57,65 @@ inline float sampleSingle(
             result ^= Matrices::matrices32[i];
     }
 
-    return std::min(result * (1.0f / (1ULL << 32)), ONE_MINUS_EPS_FLT);
+    return result;
+}
+
+// Map the bits computed by sampleBitsSingle to [0, 1)
+inline float bitsToSingle(const uint32_t bits)
+{
+    return std::min(bits * (1.0f / (1ULL << 32)), ONE_MINUS_EPS_FLT);
+}
+
+// Compute one component of the Sobol'-sequence, see sampleBitsSingle
+inline float sampleSingle(
+    uint64_t index,
+    const uint32_t dimension,
+    const uint32_t scramble = 0U)
+{
+    return bitsToSingle(sampleBitsSingle(index, dimension, scramble));
+}
+
+#if defined(MTS_SSE)
+// Compute four components of the same point of the Sobol'-sequence at
+// once. The dimensions may be arbitrary; the results are bitwise
+// identical to four calls to sampleSingle.
+inline void sampleSingle4(
+    uint64_t index,
+    const uint32_t dimension[4],
+    const uint32_t scramble,
+    float *dest)
+{
+    const uint32_t
+        *m0 = Matrices::matrices32 + dimension[0] * Matrices::size,
+        *m1 = Matrices::matrices32 + dimension[1] * Matrices::size,
+        *m2 = Matrices::matrices32 + dimension[2] * Matrices::size,
+        *m3 = Matrices::matrices32 + dimension[3] * Matrices::size;
+
+    __m128i result = _mm_set1_epi32((int) scramble);
+    for (uint32_t i = 0; index; index >>= 1, ++i)
+    {
+        if (index & 1)
+            result = _mm_xor_si128(result, _mm_set_epi32(
+                (int) m3[i], (int) m2[i], (int) m1[i], (int) m0[i]));
+    }
+
+    // SSE2 only has a signed conversion. Both 16 bit halves convert
+    // exactly, and their sum is rounded once, like the scalar code.
+    __m128 hi = _mm_cvtepi32_ps(_mm_srli_epi32(result, 16));
+    __m128 lo = _mm_cvtepi32_ps(_mm_and_si128(result, _mm_set1_epi32(0xFFFF)));
+    __m128 value = _mm_add_ps(_mm_mul_ps(hi, _mm_set1_ps(65536.0f)), lo);
+    value = _mm_mul_ps(value, _mm_set1_ps(1.0f / (1ULL << 32)));
+    _mm_storeu_ps(dest, _mm_min_ps(value, _mm_set1_ps(ONE_MINUS_EPS_FLT)));
 }
+#endif
 
-// Compute one component of the Sobol'-sequence, where the component
-// corresponds to the dimension parameter, and the index specifies
-// the point inside the sequence. The scramble parameter can be used
-// to permute elementary intervals, and might be chosen randomly to
-// generate a randomized QMC sequence. Only the Matrices::size least
+// Compute the raw bits of one component of the Sobol'-sequence, where
+// the component corresponds to the dimension parameter, and the index
+// specifies the point inside the sequence. The scramble parameter can
+// be used to permute elementary intervals, and might be chosen randomly
+// to generate a randomized QMC sequence. Only the Matrices::size least
 // significant bits of the scramble value are used.
-inline double sampleDouble(
+inline uint64_t sampleBitsDouble(
     uint64_t index,
     const uint32_t dimension,
     const uint64_t scramble = 0ULL)
@@ -77,7 +129,52 @@ inline double sampleDouble(
             result ^= Matrices::matrices64[i];
     }
 
-    return std::min(result * (1.0 / (1ULL << Matrices::size)), ONE_MINUS_EPS_DBL);
+    return result;
+}
+
+// Map the bits computed by sampleBitsDouble to [0, 1)
+inline double bitsToDouble(const uint64_t bits)
+{
+    return std::min(bits * (1.0 / (1ULL << Matrices::size)), ONE_MINUS_EPS_DBL);
+}
+
+// Compute one component of the Sobol'-sequence, see sampleBitsDouble
+inline double sampleDouble(
+    uint64_t index,
+    const uint32_t dimension,
+    const uint64_t scramble = 0ULL)
+{
+    return bitsToDouble(sampleBitsDouble(index, dimension, scramble));
+}
+
+// Raw sample bits matching the compilation options
+#if defined(SINGLE_PRECISION)
+typedef uint32_t SampleBits;
+#else
+typedef uint64_t SampleBits;
+#endif
+
+// Call sampleBitsSingle or sampleBitsDouble depending on the compilation options
+inline SampleBits sampleBits(
+    const uint64_t index,
+    const uint32_t dimension,
+    const uint64_t scramble = 0ULL)
+{
+#if defined(SINGLE_PRECISION)
+    return sampleBitsSingle(index, dimension, (uint32_t) scramble);
+#else
+    return sampleBitsDouble(index, dimension, (uint64_t) scramble);
+#endif
+}
+
+// Call bitsToSingle or bitsToDouble depending on the compilation options
+inline mitsuba::Float bitsToFloat(const SampleBits bits)
+{
+#if defined(SINGLE_PRECISION)
+    return bitsToSingle(bits);
+#else
+    return bitsToDouble(bits);
+#endif
 }
 
 // Call sampleSingle or sampleDouble depending on the compilation options
@@ -66,6 +66,13 @@ MTS_NAMESPACE_BEGIN
  *         is only relevant when the scene is in motion.
  *         \default{0}
  *     }
+ *     \parameter{motionSamples}{\Integer}{
+ *         When set to a positive value, an animated \code{toWorld}
+ *         transformation is precomputed at this many uniformly spaced
+ *         times within the shutter interval, which speeds up ray
+ *         generation for motion blur. Rotations are approximated between
+ *         the samples.\default{0, i.e. evaluate the animation exactly}
+ *     }
  *     \parameter{nearClip, farClip}{\Float}{
  *         Distance to the near/far clip
  *         planes.\default{\code{near\code}-\code{Clip=1e-2} (i.e.
@@ -36,6 +36,17 @@ MTS_NAMESPACE_BEGIN
  *         The specifics of the model are described in detail on the following page:
  *         \url{http://www.vision.caltech.edu/bouguetj/calib_doc/htmls/parameters.html}
  *     }
+ *     \parameter{distortionTableSize}{\Integer}{
+ *         Number of entries of a lookup table that is used to invert the
+ *         distortion model when generating camera rays. Set this to zero to
+ *         invert it with Newton iterations for every ray instead.
+ *         \default{1024}
+ *     }
+ *     \parameter{distortionPolish}{\Boolean}{
+ *         Refine the value obtained from the lookup table with one Newton
+ *         iteration, which makes it practically exact.
+ *         \default{\code{true}}
+ *     }
  *     \parameter{focalLength}{\String}{
  *         Denotes the camera's focal length specified using
  *         \code{35mm} film equivalent units. See the main
@@ -123,20 +134,29 @@ public:
         } else {
             Log(EError, "The 'kc' requires two arguments!");
         }
+
+        m_distortionTableSize = props.getInteger("distortionTableSize", 1024);
+        if (m_distortionTableSize < 0)
+            Log(EError, "The 'distortionTableSize' parameter must be nonnegative!");
+        m_distortionPolish = props.getBoolean("distortionPolish", true);
     }
 
     PerspectiveCameraRDist(Stream *stream, InstanceManager *manager)
             : PerspectiveCamera(stream, manager) {
-        configure();
         m_kc[0] = stream->readFloat();
         m_kc[1] = stream->readFloat();
         m_distortion = m_kc[0] != 0 || m_kc[1] != 0;
+        m_distortionTableSize = stream->readInt();
+        m_distortionPolish = stream->readBool();
+        configure();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
         PerspectiveCamera::serialize(stream, manager);
         stream->writeFloat(m_kc[0]);
         stream->writeFloat(m_kc[1]);
+        stream->writeInt(m_distortionTableSize);
+        stream->writeBool(m_distortionPolish);
     }
 
     void configure() {
@@ -188,6 +208,25 @@ public:
         m_imageRect.expandBy(Point2(max.x, max.y) / max.z);
         m_normalization = 1.0f / m_imageRect.getVolume();
 
+        /* Tabulate the inverse of the radial distortion up to the most
+           distant corner of the image rectangle (plus a margin for samples
+           slightly outside of it), see lookupInvDistortion() */
+        m_invDistortion.clear();
+        if (m_distortion && m_distortionTableSize > 0) {
+            Float yMax = 0;
+            for (int i = 0; i < 4; ++i)
+                yMax = std::max(yMax, Vector2(m_imageRect.getCorner(i)).length());
+            yMax *= 1.05f;
+
+            m_invDistortion.resize(m_distortionTableSize + 1);
+            m_invDistortion[0] = 1.0f;
+            for (int i = 1; i <= m_distortionTableSize; ++i)
+                m_invDistortion[i] = invertDistortion(
+                    yMax * i / (Float) m_distortionTableSize);
+            m_invDistortionMax = yMax;
+            m_invDistortionScale = m_distortionTableSize / yMax;
+        }
+
         /* Clip-space transformation for OpenGL */
         m_clipTransform = Transform::translate(
             Vector((1-2*relOffset.x)/relSize.x - 1,
@@ -216,6 +255,31 @@ public:
         return r/y;
     }
 
+    /**
+     * \brief Same as \ref invertDistortion(), but interpolates the
+     * precomputed table (and optionally polishes the result with one
+     * Newton step) when \c y lies within its range
+     */
+    Float lookupInvDistortion(Float y) const {
+        if (m_invDistortion.empty() || !(y < m_invDistortionMax))
+            return invertDistortion(y);
+
+        Float t = y * m_invDistortionScale;
+        int i = std::min((int) t, m_distortionTableSize - 1);
+        Float alpha = t - i;
+        Float correction = (1 - alpha) * m_invDistortion[i]
+            + alpha * m_invDistortion[i+1];
+
+        if (m_distortionPolish && y > 0) {
+            Float r  = correction * y,
+                  r2 = r*r,
+                  f  = r*(1+r2*(m_kc[0] + r2*m_kc[1])) - y,
+                  df = 1 + r2*(3*m_kc[0] + 5*m_kc[1]*r2);
+            correction = (r - f / df) / y;
+        }
+        return correction;
+    }
+
     /**
      * \brief Compute the directional sensor response function
      * of the camera multiplied with the cosine foreshortening
@@ -304,7 +368,7 @@ public:
             pixelSample.y * m_invResolution.y, 0.0f));
 
         if (m_distortion) {
-            Float correction = invertDistortion(Vector2(nearP.x / nearP.z, nearP.y / nearP.z).length());
+            Float correction = lookupInvDistortion(Vector2(nearP.x / nearP.z, nearP.y / nearP.z).length());
             nearP.x *= correction; nearP.y *= correction;
         }
 
@@ -337,7 +401,7 @@ public:
 
         if (m_distortion) {
             /* Ray differentials don't take distortion into account */
-            Float correction = invertDistortion(Vector2(nearP.x / nearP.z, nearP.y / nearP.z).length());
+            Float correction = lookupInvDistortion(Vector2(nearP.x / nearP.z, nearP.y / nearP.z).length());
             nearP.x *= correction; nearP.y *= correction;
         }
 
@@ -399,7 +463,7 @@ public:
         Point nearP = m_sampleToCamera(samplePos);
 
         if (m_distortion) {
-            Float correction = invertDistortion(Vector2(nearP.x / nearP.z, nearP.y / nearP.z).length());
+            Float correction = lookupInvDistortion(Vector2(nearP.x / nearP.z, nearP.y / nearP.z).length());
             nearP.x *= correction; nearP.y *= correction;
         }
 
@@ -551,6 +615,10 @@ private:
     Vector m_dx, m_dy;
     bool m_distortion;
     Float m_kc[2];
+    int m_distortionTableSize;
+    bool m_distortionPolish;
+    std::vector<Float> m_invDistortion;
+    Float m_invDistortionMax, m_invDistortionScale;
 };
 
 MTS_IMPLEMENT_CLASS_S(PerspectiveCameraRDist, false, PerspectiveCamera)
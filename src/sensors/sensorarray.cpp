@@ -0,0 +1,460 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/sensor.h>
+#include <mitsuba/render/medium.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/track.h>
+#include <mitsuba/core/warp.h>
+#include <boost/algorithm/string.hpp>
+#include "../films/cnpy.h"
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{sensorarray}{Sensor array}
+ * \order{8}
+ * \parameters{
+ *     \parameter{filename}{\String}{
+ *        NumPy (\code{.npy}) file with the measurement locations. Each
+ *        record consists of a position and a direction ($x, y, z, d_x,
+ *        d_y, d_z$). The array can either be a list with shape
+ *        $N\times 6$, or a grid with shape $H\times W\times 6$. For
+ *        fluence measurements, the direction can be omitted
+ *        ($N\times 3$ or $H\times W\times 3$).
+ *     }
+ *     \parameter{measure}{\String}{
+ *        What to measure at every location; must be one of
+ *        \begin{enumerate}[(i)]
+ *          \item \code{radiance}: the radiance arriving at the position
+ *          from the direction, as with \pluginref{radiancemeter}.
+ *          \item \code{irradiance}: the irradiance arriving at the position
+ *          on a surface element that faces the direction.
+ *          \item \code{fluence}: the average radiance passing through the
+ *          position, as with \pluginref{fluencemeter}.
+ *        \end{enumerate}
+ *        \default{\code{radiance}}
+ *     }
+ *     \parameter{toWorld}{\Transform\Or\Animation}{
+ *        Specifies an optional sensor-to-world transformation that is
+ *        applied to all locations.
+ *        \default{none (i.e. sensor space $=$ world space)}
+ *     }
+ *     \parameter{shutterOpen, shutterClose}{\Float}{
+ *         Specifies the time interval of the measurement---this
+ *         is only relevant when the scene is in motion.
+ *         \default{0}
+ *     }
+ * }
+ *
+ * This sensor plugin carries out many point measurements in a single
+ * render job, so that the scene only needs to be loaded (and its
+ * acceleration data structures built) once for an entire sweep.
+ *
+ * Every record is mapped to one film pixel: record $i$ of a list ends
+ * up in pixel $(i \bmod w, \lfloor i / w\rfloor)$ of a film with width
+ * $w$, and the records of a grid end up in the corresponding pixels of
+ * a $W\times H$ film. Pixels without a record remain zero. The film
+ * should use the (default) box filter of \pluginref{mfilm}, since
+ * wider filters mix neighboring measurements.
+ *
+ * \vspace{4mm}
+ * \begin{xml}
+ * <scene version=$\MtsVer$>
+ *     <sensor type="sensorarray">
+ *         <!-- Measure the radiance at 1000 locations -->
+ *         <string name="filename" value="locations.npy"/>
+ *
+ *         <!-- Write the output to a NumPy file with a 1000x1 array -->
+ *         <film type="mfilm">
+ *             <integer name="width" value="1000"/>
+ *             <string name="fileFormat" value="numpy"/>
+ *             <string name="pixelFormat" value="spectrum"/>
+ *         </film>
+ *
+ *         <sampler type="independent">
+ *             <integer name="sampleCount" value="1024"/>
+ *         </sampler>
+ *     </sensor>
+ *
+ *     <!-- ... other scene declarations ... -->
+ * </scene>
+ * \end{xml}
+ */
+
+class SensorArray : public Sensor {
+public:
+    enum EMeasure {
+        ERadiance = 0,
+        EIrradiance,
+        EFluence
+    };
+
+    SensorArray(const Properties &props) : Sensor(props) {
+        std::string measure = boost::to_lower_copy(
+            props.getString("measure", "radiance"));
+        if (measure == "radiance")
+            m_measure = ERadiance;
+        else if (measure == "irradiance")
+            m_measure = EIrradiance;
+        else if (measure == "fluence")
+            m_measure = EFluence;
+        else
+            Log(EError, "The \"measure\" parameter must be equal to "
+                "either \"radiance\", \"irradiance\", or \"fluence\"!");
+
+        if (props.getTransform("toWorld", Transform()).hasScale())
+            Log(EError, "Scale factors in the sensor-to-world "
+                "transformation are not allowed!");
+
+        fs::path filename = Thread::getThread()->getFileResolver()->resolve(
+            props.getString("filename"));
+        loadRecords(filename);
+        configureType();
+    }
+
+    SensorArray(Stream *stream, InstanceManager *manager)
+     : Sensor(stream, manager) {
+        m_measure = (EMeasure) stream->readInt();
+        m_gridWidth = stream->readInt();
+        size_t count = stream->readSize();
+        m_positions.resize(count);
+        m_directions.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            m_positions[i] = Point(stream);
+            m_directions[i] = Vector(stream);
+        }
+        configureType();
+        configure();
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Sensor::serialize(stream, manager);
+        stream->writeInt(m_measure);
+        stream->writeInt(m_gridWidth);
+        stream->writeSize(m_positions.size());
+        for (size_t i = 0; i < m_positions.size(); ++i) {
+            m_positions[i].serialize(stream);
+            m_directions[i].serialize(stream);
+        }
+    }
+
+    void configure() {
+        Sensor::configure();
+
+        const Vector2i &size = m_film->getSize();
+        if (m_gridWidth > 0 && m_gridWidth != size.x)
+            Log(EError, "The film width (%i) must match the width of the "
+                "grid of measurement locations (%i)!", size.x, m_gridWidth);
+        if ((size_t) size.x * (size_t) size.y < m_positions.size())
+            Log(EError, "The film (%ix%i) has fewer pixels than there are "
+                "measurement locations (" SIZE_T_FMT ")!", size.x, size.y,
+                m_positions.size());
+        if (m_film->getReconstructionFilter()->getRadius() > 0.5f + Epsilon)
+            Log(EWarn, "The reconstruction filter of the film is wider than "
+                "a pixel; neighboring measurements will be mixed! Use a "
+                "box filter instead.");
+        m_filmWidth = size.x;
+        m_invCount = 1.0f / (Float) m_positions.size();
+    }
+
+    Spectrum sampleRay(Ray &ray, const Point2 &pixelSample,
+            const Point2 &otherSample, Float timeSample) const {
+        int index = recordIndex(pixelSample);
+        if (index < 0)
+            return Spectrum(0.0f);
+
+        ray.time = sampleTime(timeSample);
+        ray.mint = Epsilon;
+        ray.maxt = std::numeric_limits<Float>::infinity();
+
+        const Transform &trafo = m_worldTransform->eval(ray.time);
+        ray.setOrigin(trafo(m_positions[index]));
+
+        switch (m_measure) {
+            case ERadiance:
+                ray.setDirection(trafo(m_directions[index]));
+                return Spectrum(1.0f);
+            case EIrradiance:
+                ray.setDirection(Frame(trafo(m_directions[index])).toWorld(
+                    warp::squareToCosineHemisphere(otherSample)));
+                return Spectrum(M_PI);
+            default:
+                ray.setDirection(warp::squareToUniformSphere(otherSample));
+                return Spectrum(1.0f);
+        }
+    }
+
+    Spectrum samplePosition(PositionSamplingRecord &pRec, const Point2 &sample,
+            const Point2 *extra) const {
+        int index;
+        Float weight = 1.0f;
+        if (extra) {
+            /* The caller wants to condition on a specific pixel position */
+            index = recordIndex(*extra);
+            pRec.pdf = 1.0f;
+        } else {
+            index = std::min((int) (sample.x * m_positions.size()),
+                (int) m_positions.size() - 1);
+            pRec.pdf = m_invCount;
+            weight = (Float) m_positions.size();
+        }
+        if (index < 0) {
+            pRec.pdf = 0.0f;
+            return Spectrum(0.0f);
+        }
+
+        const Transform &trafo = m_worldTransform->eval(pRec.time);
+        pRec.p = trafo(m_positions[index]);
+        pRec.n = m_measure == EFluence ? Normal(0.0f)
+            : Normal(trafo(m_directions[index]));
+        pRec.uv = pixelPosition(index);
+        pRec.measure = EDiscrete;
+        return Spectrum(weight);
+    }
+
+    Spectrum evalPosition(const PositionSamplingRecord &pRec) const {
+        return Spectrum((pRec.measure == EDiscrete) ? 1.0f : 0.0f);
+    }
+
+    Float pdfPosition(const PositionSamplingRecord &pRec) const {
+        return (pRec.measure == EDiscrete) ? m_invCount : 0.0f;
+    }
+
+    Spectrum sampleDirection(DirectionSamplingRecord &dRec,
+            PositionSamplingRecord &pRec,
+            const Point2 &sample,
+            const Point2 *extra) const {
+        switch (m_measure) {
+            case ERadiance:
+                dRec.d = pRec.n;
+                dRec.pdf = 1.0f;
+                dRec.measure = EDiscrete;
+                break;
+            case EIrradiance: {
+                    Vector local = warp::squareToCosineHemisphere(sample);
+                    dRec.d = Frame(pRec.n).toWorld(local);
+                    dRec.pdf = warp::squareToCosineHemispherePdf(local);
+                    dRec.measure = ESolidAngle;
+                    return Spectrum(M_PI);
+                }
+            default:
+                dRec.d = warp::squareToUniformSphere(sample);
+                dRec.pdf = INV_FOURPI;
+                dRec.measure = ESolidAngle;
+                break;
+        }
+        return Spectrum(1.0f);
+    }
+
+    Float pdfDirection(const DirectionSamplingRecord &dRec,
+            const PositionSamplingRecord &pRec) const {
+        switch (m_measure) {
+            case ERadiance:
+                return (dRec.measure == EDiscrete) ? 1.0f : 0.0f;
+            case EIrradiance:
+                return (dRec.measure == ESolidAngle)
+                    ? INV_PI * std::max((Float) 0, dot(dRec.d, pRec.n)) : 0.0f;
+            default:
+                return (dRec.measure == ESolidAngle) ? INV_FOURPI : 0.0f;
+        }
+    }
+
+    Spectrum evalDirection(const DirectionSamplingRecord &dRec,
+            const PositionSamplingRecord &pRec) const {
+        switch (m_measure) {
+            case ERadiance:
+                return Spectrum((dRec.measure == EDiscrete) ? 1.0f : 0.0f);
+            case EIrradiance:
+                return Spectrum((dRec.measure == ESolidAngle)
+                    ? std::max((Float) 0, dot(dRec.d, pRec.n)) : 0.0f);
+            default:
+                return Spectrum((dRec.measure == ESolidAngle) ? INV_FOURPI : 0.0f);
+        }
+    }
+
+    Spectrum sampleDirect(DirectSamplingRecord &dRec, const Point2 &sample) const {
+        /* Direct sampling always fails for a response function on a 0D space */
+        if (m_measure == ERadiance) {
+            dRec.pdf = 0.0f;
+            return Spectrum(0.0f);
+        }
+
+        /* Choose one of the locations uniformly */
+        int index = std::min((int) (sample.x * m_positions.size()),
+            (int) m_positions.size() - 1);
+        const Transform &trafo = m_worldTransform->eval(dRec.time);
+
+        dRec.p = trafo.transformAffine(m_positions[index]);
+        dRec.uv = pixelPosition(index);
+        dRec.d = dRec.p - dRec.ref;
+        dRec.dist = dRec.d.length();
+        Float invDist = 1.0f / dRec.dist;
+        dRec.d *= invDist;
+        dRec.pdf = m_invCount;
+        dRec.measure = EDiscrete;
+
+        Float response;
+        if (m_measure == EIrradiance) {
+            dRec.n = Normal(trafo(m_directions[index]));
+            response = -dot(dRec.d, dRec.n);
+            if (response <= 0) {
+                dRec.pdf = 0.0f;
+                return Spectrum(0.0f);
+            }
+        } else {
+            dRec.n = Normal(0.0f);
+            response = INV_FOURPI;
+        }
+
+        return Spectrum(response * invDist * invDist * m_positions.size());
+    }
+
+    Float pdfDirect(const DirectSamplingRecord &dRec) const {
+        return (m_measure != ERadiance && dRec.measure == EDiscrete)
+            ? m_invCount : 0.0f;
+    }
+
+    bool getSamplePosition(const PositionSamplingRecord &pRec,
+            const DirectionSamplingRecord &dRec, Point2 &samplePosition) const {
+        samplePosition = pRec.uv;
+        return true;
+    }
+
+    AABB getAABB() const {
+        AABB aabb;
+        AABB translations = m_worldTransform->getTranslationBounds();
+        for (size_t i = 0; i < m_positions.size(); ++i) {
+            /* Rotations are ignored here, except for the one at t=0 */
+            Point p = m_worldTransform->eval(0)(m_positions[i]);
+            Vector offset = p - m_worldTransform->eval(0)(Point(0.0f));
+            aabb.expandBy(translations.min + offset);
+            aabb.expandBy(translations.max + offset);
+        }
+        return aabb;
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "SensorArray[" << endl
+            << "  measure = " << (m_measure == ERadiance ? "radiance"
+                : (m_measure == EIrradiance ? "irradiance" : "fluence")) << "," << endl
+            << "  locations = " << m_positions.size() << "," << endl
+            << "  worldTransform = " << indent(m_worldTransform.toString()) << "," << endl
+            << "  sampler = " << indent(m_sampler->toString()) << "," << endl
+            << "  film = " << indent(m_film->toString()) << "," << endl
+            << "  medium = " << indent(m_medium.toString()) << "," << endl
+            << "  shutterOpen = " << m_shutterOpen << "," << endl
+            << "  shutterOpenTime = " << m_shutterOpenTime << endl
+            << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    void configureType() {
+        m_type |= EDeltaPosition;
+        if (m_measure == ERadiance)
+            m_type |= EDeltaDirection;
+        else
+            m_type |= ENeedsApertureSample;
+    }
+
+    void loadRecords(const fs::path &filename) {
+        if (!fs::exists(filename))
+            Log(EError, "Measurement locations file \"%s\" could not be found!",
+                filename.string().c_str());
+
+        Log(EInfo, "Loading measurement locations from \"%s\" ..",
+            filename.filename().string().c_str());
+        cnpy::NpyArray array = cnpy::npy_load(filename.string());
+
+        size_t ndims = array.shape.size();
+        size_t columns = ndims > 0 ? array.shape[ndims - 1] : 0;
+        if (array.fortran_order || (ndims != 2 && ndims != 3)
+                || (columns != 6 && columns != 3)
+                || (array.word_size != 4 && array.word_size != 8)) {
+            array.destruct();
+            Log(EError, "\"%s\": expected a C-ordered float32 or float64 "
+                "array with shape Nx6, Nx3, HxWx6 or HxWx3!",
+                filename.string().c_str());
+        }
+        if (columns == 3 && m_measure != EFluence) {
+            array.destruct();
+            Log(EError, "\"%s\": the measurement locations need directions "
+                "(shape Nx6 or HxWx6) unless measuring the fluence!",
+                filename.string().c_str());
+        }
+
+        m_gridWidth = ndims == 3 ? (int) array.shape[1] : 0;
+        size_t count = ndims == 3 ? (size_t) array.shape[0] * array.shape[1]
+            : (size_t) array.shape[0];
+        if (count == 0) {
+            array.destruct();
+            Log(EError, "\"%s\" does not contain any measurement locations!",
+                filename.string().c_str());
+        }
+
+        m_positions.resize(count);
+        m_directions.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            Float values[6] = { 0, 0, 0, 0, 0, 1 };
+            for (size_t j = 0; j < columns; ++j) {
+                size_t offset = i * columns + j;
+                values[j] = array.word_size == 4
+                    ? (Float) reinterpret_cast<const float *>(array.data)[offset]
+                    : (Float) reinterpret_cast<const double *>(array.data)[offset];
+            }
+            m_positions[i] = Point(values[0], values[1], values[2]);
+            Vector d(values[3], values[4], values[5]);
+            if (d.isZero()) {
+                array.destruct();
+                Log(EError, "\"%s\": measurement location " SIZE_T_FMT
+                    " has a zero direction!", filename.string().c_str(), i);
+            }
+            m_directions[i] = normalize(d);
+        }
+        array.destruct();
+    }
+
+    /// Map a (fractional) pixel position to the index of its record, or -1
+    inline int recordIndex(const Point2 &pixel) const {
+        int x = math::floorToInt(pixel.x), y = math::floorToInt(pixel.y);
+        if (x < 0 || y < 0 || x >= m_filmWidth)
+            return -1;
+        size_t index = (size_t) y * (size_t) m_filmWidth + (size_t) x;
+        return index < m_positions.size() ? (int) index : -1;
+    }
+
+    /// Center of the pixel that is associated with a record
+    inline Point2 pixelPosition(int index) const {
+        return Point2((index % m_filmWidth) + 0.5f,
+            (index / m_filmWidth) + 0.5f);
+    }
+
+private:
+    EMeasure m_measure;
+    int m_gridWidth; ///< 0 for lists of locations
+    int m_filmWidth;
+    Float m_invCount;
+    std::vector<Point> m_positions;
+    std::vector<Vector> m_directions;
+};
+
+MTS_IMPLEMENT_CLASS_S(SensorArray, false, Sensor)
+MTS_EXPORT_PLUGIN(SensorArray, "Sensor array");
+MTS_NAMESPACE_END
@@ -19,10 +19,12 @@
 #include <mitsuba/render/shape.h>
 #include <mitsuba/render/sahkdtree4.h>
 #include <mitsuba/render/trimesh.h>
+#include <mitsuba/render/bvh.h>
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/mstream.h>
 #include <mitsuba/core/mmap.h>
+#include <boost/algorithm/string.hpp>
 
 #define SHAPE_PER_SEGMENT 1
 #define NO_CLIPPING_SUPPORT 1
@@ -100,7 +102,8 @@ public:
     }
 
 
-    void build() {
+    /// Validate the key frames and set up the primitive index mapping
+    void prepare() {
         if (m_meshes.size() < 2)
             Log(EError, "The deformable shape requires at least two sub-shapes!");
 
@@ -136,6 +139,10 @@ public:
         m_shapeMap[0] = 0;
         for (size_t i=0; i<m_meshes[0].size(); ++i)
             m_shapeMap[i+1] = m_shapeMap[i] + (SizeType) m_meshes[0][i]->getTriangleCount();
+    }
+
+    void build() {
+        prepare();
 
         this->setClip(false);
         buildInternal();
@@ -183,6 +190,13 @@ public:
             m_times.begin(), m_times.end(), time) - m_times.begin()) - 1, 0), (int) m_times.size()-1);
     }
 
+    /// Return the interpolation weight between a frame and its successor
+    inline Float getFrameAlpha(IndexType frameIndex, Float time) const {
+        return std::max((Float) 0.0f, std::min((Float) 1.0f,
+            (time - m_times[frameIndex])
+            / (m_times[frameIndex + 1] - m_times[frameIndex])));
+    }
+
     // ========================================================================
     //    Implementation of functions required by the parent class
     // ========================================================================
@@ -368,6 +382,17 @@ public:
         return m_meshes[frameIndex][shapeIndex];
     }
 
+    /// Recover the sub-shape index from the first-frame mesh of an intersection
+    inline IndexType findShapeIndex(const Shape *shape) const {
+        const std::vector<const TriMesh *> &meshes = m_meshes[0];
+        for (size_t i=0; i<meshes.size(); ++i) {
+            if (meshes[i] == shape)
+                return (IndexType) i;
+        }
+        Log(EError, "findShapeIndex(): unknown shape!");
+        return 0;
+    }
+
     inline Triangle getTriangle(IndexType shapeIndex, IndexType primIndex) const {
         return m_meshes[0][shapeIndex]->getTriangles()[primIndex];
     }
@@ -400,29 +425,88 @@ public:
             times[i] = value;
         }
         m_kdtree = new SpaceTimeKDTree(times);
+
+        /* Acceleration structure: a space-time kd-tree ("kdtree"), or a
+           BVH that is built once and refit to each key frame ("bvh") */
+        std::string accel = boost::to_lower_copy(
+            props.getString("accel", "kdtree"));
+        if (accel == "kdtree")
+            m_useBVH = false;
+        else if (accel == "bvh")
+            m_useBVH = true;
+        else
+            Log(EError, "Unknown acceleration structure \"%s\"! Must be "
+                "either \"kdtree\" or \"bvh\".", accel.c_str());
     }
 
     Deformable(Stream *stream, InstanceManager *manager)
         : Shape(stream, manager) {
         m_kdtree = new SpaceTimeKDTree(stream, manager);
+        m_useBVH = stream->readBool();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
         Shape::serialize(stream, manager);
         m_kdtree->serialize(stream, manager);
+        stream->writeBool(m_useBVH);
     }
 
     void configure() {
-        m_kdtree->build();
+        if (!m_useBVH) {
+            m_kdtree->build();
+            return;
+        }
+
+        /* Build the hierarchy once and refit it to every key frame */
+        m_kdtree->prepare();
+        m_bvh = new TriangleBVH();
+        const std::vector<std::vector<const TriMesh *> > &meshes
+            = m_kdtree->getMeshes();
+        for (size_t i=0; i<meshes.size(); ++i)
+            m_bvh->addKeyframe(meshes[i]);
+        m_bvh->build();
+    }
+
+    /**
+     * \brief Update the BVH after the vertex positions of the key frame
+     * meshes have been modified in place (e.g. for the next frame of an
+     * animation sequence), without rebuilding it
+     */
+    void refit() {
+        if (!m_bvh)
+            Log(EError, "refit(): only supported when using a BVH!");
+        m_bvh->refit();
     }
 
     bool rayIntersect(const Ray &ray, Float mint,
             Float maxt, Float &t, void *temp) const {
-        return m_kdtree->rayIntersect(ray, mint, maxt, t, temp);
+        if (!m_bvh)
+            return m_kdtree->rayIntersect(ray, mint, maxt, t, temp);
+
+        SpaceTimeKDTree::IntersectionCache *cache =
+            static_cast<SpaceTimeKDTree::IntersectionCache *>(temp);
+        TriangleBVH::IntersectionCache bvhCache;
+        uint32_t frameIndex = m_kdtree->findFrame(ray.time);
+        Float alpha = m_kdtree->getFrameAlpha(frameIndex, ray.time);
+        if (!m_bvh->rayIntersect(ray, mint, maxt, t, &bvhCache, frameIndex, alpha))
+            return false;
+
+        cache->frameIndex = frameIndex;
+        cache->alpha = alpha;
+        cache->shapeIndex = bvhCache.shapeIndex;
+        cache->primIndex = bvhCache.primIndex;
+        cache->u = bvhCache.u;
+        cache->v = bvhCache.v;
+        return true;
     }
 
     bool rayIntersect(const Ray &ray, Float mint, Float maxt) const {
-        return m_kdtree->rayIntersect(ray, mint, maxt);
+        if (!m_bvh)
+            return m_kdtree->rayIntersect(ray, mint, maxt);
+
+        uint32_t frameIndex = m_kdtree->findFrame(ray.time);
+        return m_bvh->rayIntersect(ray, mint, maxt, frameIndex,
+            m_kdtree->getFrameAlpha(frameIndex, ray.time));
     }
 
     void fillIntersectionRecord(const Ray &ray,
@@ -508,7 +592,6 @@ public:
         its.shape = m_kdtree->getMesh(0, cache->shapeIndex);
         its.hasUVPartials = false;
         its.primIndex = cache->primIndex;
-        its.other = cache->shapeIndex;
         its.instance = this;
         its.time = ray.time;
     }
@@ -522,7 +605,8 @@ public:
             (its.time - times[frameIndex])
             / (times[frameIndex + 1] - times[frameIndex])));
 
-        uint32_t primIndex = its.primIndex, shapeIndex = its.other;
+        uint32_t primIndex = its.primIndex,
+                 shapeIndex = m_kdtree->findShapeIndex(its.shape);
         const TriMesh *trimesh0 = m_kdtree->getMesh(frameIndex,   shapeIndex);
         const TriMesh *trimesh1 = m_kdtree->getMesh(frameIndex+1, shapeIndex);
         const Point *vertexPositions0 = trimesh0->getVertexPositions();
@@ -614,7 +698,7 @@ public:
         const std::vector<Float> &times = m_kdtree->getTimes();
 
         cache.primIndex = its.primIndex;
-        cache.shapeIndex = its.other;
+        cache.shapeIndex = m_kdtree->findShapeIndex(its.shape);
         cache.frameIndex = m_kdtree->findFrame(its.time);
         cache.alpha = std::max((Float) 0.0f, std::min((Float) 1.0f,
             (its.time - times[cache.frameIndex])
@@ -651,7 +735,7 @@ public:
 
 
     AABB getAABB() const {
-        return m_kdtree->getSpatialAABB();
+        return m_bvh.get() ? m_bvh->getAABB() : m_kdtree->getSpatialAABB();
     }
 
     size_t getPrimitiveCount() const {
@@ -678,7 +762,8 @@ public:
         oss << "Deformable[" << endl
             << "   primitiveCount = " << m_kdtree->getPrimitiveCount() << "," << endl
             << "   timeCount = " << m_kdtree->getTimeCount() << "," << endl
-            << "   aabb = " << indent(m_kdtree->getSpatialAABB().toString()) << endl
+            << "   accel = " << (m_useBVH ? "bvh" : "kdtree") << "," << endl
+            << "   aabb = " << indent(getAABB().toString()) << endl
             << "]";
         return oss.str();
     }
@@ -686,6 +771,8 @@ public:
     MTS_DECLARE_CLASS()
 private:
     ref<SpaceTimeKDTree> m_kdtree;
+    ref<TriangleBVH> m_bvh;
+    bool m_useBVH;
 };
 
 MTS_IMPLEMENT_CLASS_S(SpaceTimeKDTree, false, KDTreeBase)
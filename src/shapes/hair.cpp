@@ -25,6 +25,9 @@
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/fresolver.h>
+#if defined(MTS_SSE)
+#include <mitsuba/core/sse.h>
+#endif
 
 #define MTS_HAIR_USE_FANCY_CLIPPING 1
 
@@ -547,6 +550,122 @@ public:
         return intersect(ray, iv, mint, maxt, tempT, NULL);
     }
 
+#if defined(MTS_SSE)
+    /**
+     * \brief Intersect a ray with all segments of a leaf
+     *
+     * The infinite cylinders of two segments at a time are tested
+     * using SSE2 double precision arithmetic. Only the segments whose
+     * cylinder is hit within the current ray interval go on to the
+     * exact test (including the miter planes) in \ref intersect().
+     */
+    FINLINE bool leafIntersect(const Ray &ray, IndexType start, IndexType end,
+            Float mint, Float &maxt, Float &t, void *temp, HashedMailbox &mailbox) const {
+        bool foundIntersection = false;
+        IndexType pending[2];
+        int pendingCount = 0;
+
+        for (IndexType entry=start; entry != end; entry++) {
+            const IndexType iv = m_indices[entry];
+
+            #if defined(MTS_KD_MAILBOX_ENABLED)
+            if (mailbox.contains(iv))
+                continue;
+            mailbox.put(iv);
+            #endif
+
+            pending[pendingCount++] = iv;
+            if (pendingCount < 2)
+                continue;
+            pendingCount = 0;
+
+            int mask = cylinderTest(ray, pending[0], pending[1], mint, maxt);
+            for (int i=0; i<2; ++i) {
+                if ((mask & (1 << i)) && intersect(ray, pending[i], mint, maxt, t, temp)) {
+                    maxt = t;
+                    foundIntersection = true;
+                }
+            }
+        }
+
+        if (pendingCount > 0 && intersect(ray, pending[0], mint, maxt, t, temp)) {
+            maxt = t;
+            foundIntersection = true;
+        }
+
+        return foundIntersection;
+    }
+
+    /**
+     * \brief Conservatively test whether a ray hits the infinite
+     * cylinders around the segments \c iv0 and \c iv1 within
+     * <tt>[mint, maxt]</tt>
+     *
+     * Returns a bit mask of the segments that need an exact test.
+     */
+    inline int cylinderTest(const Ray &ray, IndexType iv0, IndexType iv1,
+            Float mint, Float maxt) const {
+        const Point &a0 = m_vertices[iv0], &b0 = m_vertices[iv0+1],
+                    &a1 = m_vertices[iv1], &b1 = m_vertices[iv1+1];
+
+        /* Segment axes */
+        __m128d ax = _mm_sub_pd(_mm_set_pd(b1.x, b0.x), _mm_set_pd(a1.x, a0.x)),
+                ay = _mm_sub_pd(_mm_set_pd(b1.y, b0.y), _mm_set_pd(a1.y, a0.y)),
+                az = _mm_sub_pd(_mm_set_pd(b1.z, b0.z), _mm_set_pd(a1.z, a0.z));
+        __m128d invLength = _mm_div_pd(_mm_set1_pd(1.0), _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(
+            _mm_mul_pd(ax, ax), _mm_mul_pd(ay, ay)), _mm_mul_pd(az, az))));
+        ax = _mm_mul_pd(ax, invLength);
+        ay = _mm_mul_pd(ay, invLength);
+        az = _mm_mul_pd(az, invLength);
+
+        /* Project the ray onto the plane normal to the axis */
+        const __m128d
+            rx = _mm_sub_pd(_mm_set1_pd(ray.o.x), _mm_set_pd(a1.x, a0.x)),
+            ry = _mm_sub_pd(_mm_set1_pd(ray.o.y), _mm_set_pd(a1.y, a0.y)),
+            rz = _mm_sub_pd(_mm_set1_pd(ray.o.z), _mm_set_pd(a1.z, a0.z)),
+            dx = _mm_set1_pd(ray.d.x), dy = _mm_set1_pd(ray.d.y), dz = _mm_set1_pd(ray.d.z),
+            dotO = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ax, rx), _mm_mul_pd(ay, ry)), _mm_mul_pd(az, rz)),
+            dotD = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ax, dx), _mm_mul_pd(ay, dy)), _mm_mul_pd(az, dz)),
+            pox = _mm_sub_pd(rx, _mm_mul_pd(dotO, ax)),
+            poy = _mm_sub_pd(ry, _mm_mul_pd(dotO, ay)),
+            poz = _mm_sub_pd(rz, _mm_mul_pd(dotO, az)),
+            pdx = _mm_sub_pd(dx, _mm_mul_pd(dotD, ax)),
+            pdy = _mm_sub_pd(dy, _mm_mul_pd(dotD, ay)),
+            pdz = _mm_sub_pd(dz, _mm_mul_pd(dotD, az));
+
+        /* Quadratic to intersect the circle in the projection */
+        const __m128d
+            A = _mm_add_pd(_mm_add_pd(_mm_mul_pd(pdx, pdx), _mm_mul_pd(pdy, pdy)), _mm_mul_pd(pdz, pdz)),
+            B = _mm_mul_pd(_mm_set1_pd(2.0), _mm_add_pd(_mm_add_pd(_mm_mul_pd(pox, pdx),
+                _mm_mul_pd(poy, pdy)), _mm_mul_pd(poz, pdz))),
+            C = _mm_sub_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(pox, pox), _mm_mul_pd(poy, poy)),
+                _mm_mul_pd(poz, poz)), _mm_set1_pd((double) m_radius * (double) m_radius)),
+            BB = _mm_mul_pd(B, B),
+            discrim = _mm_sub_pd(BB, _mm_mul_pd(_mm_set1_pd(4.0), _mm_mul_pd(A, C)));
+
+        /* Leave some slack, the exact test has the final word */
+        const __m128d
+            zero = _mm_setzero_pd(),
+            signMask = _mm_set1_pd(-0.0),
+            hitsCircle = _mm_cmpge_pd(discrim, _mm_mul_pd(BB, _mm_set1_pd(-1e-9))),
+            sqrtDiscrim = _mm_sqrt_pd(_mm_max_pd(discrim, zero)),
+            q = _mm_mul_pd(_mm_set1_pd(-0.5), _mm_add_pd(B,
+                _mm_xor_pd(sqrtDiscrim, _mm_and_pd(B, signMask)))),
+            x0 = _mm_div_pd(q, A), x1 = _mm_div_pd(C, q),
+            nearT = _mm_min_pd(x0, x1), farT = _mm_max_pd(x0, x1),
+            slack = _mm_set1_pd(Epsilon * std::max((Float) 1, std::abs(maxt))),
+            inInterval = _mm_and_pd(
+                _mm_cmple_pd(nearT, _mm_add_pd(_mm_set1_pd(maxt), slack)),
+                _mm_cmpge_pd(farT, _mm_sub_pd(_mm_set1_pd(mint), slack)));
+
+        /* Degenerate quadratics (e.g. rays parallel to the axis) always
+           go through the exact test */
+        const __m128d degenerate = _mm_or_pd(_mm_cmpeq_pd(A, zero), _mm_cmpeq_pd(q, zero));
+
+        return _mm_movemask_pd(_mm_or_pd(degenerate, _mm_and_pd(hitsCircle, inInterval)));
+    }
+#endif
+
     /* Some utility functions */
     inline Point firstVertex(IndexType iv) const { return m_vertices[iv]; }
     inline Point3d firstVertexDouble(IndexType iv) const { return Point3d(m_vertices[iv]); }
@@ -29,6 +29,12 @@
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/timer.h>
+#if defined(MTS_SSE)
+#include <mitsuba/core/sse.h>
+#endif
+#if defined(MTS_HAS_COHERENT_RT)
+#include <mitsuba/core/ray_sse.h>
+#endif
 
 #define MTS_QTREE_MAXDEPTH  50
 #define MTS_QTREE_FASTSTART 1
@@ -60,6 +66,36 @@ namespace {
     struct StackEntry {
         int level, x, y;
     };
+
+#if defined(MTS_SSE)
+    /// Per-lane selection: <tt>mask ? a : b</tt>
+    inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    /**
+     * \brief Clip the ray segments <tt>[nearT, farT]</tt> against
+     * the slabs <tt>[min, max]</tt> along one axis (one box per lane)
+     *
+     * Rays that are parallel to the slab either keep their segment or
+     * lose it entirely, just like in \ref AABB::rayIntersect().
+     */
+    inline void clipSlab(__m128 o, __m128 d, __m128 dRcp, __m128 min,
+            __m128 max, __m128 &nearT, __m128 &farT) {
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(min, o), dRcp),
+               t2 = _mm_mul_ps(_mm_sub_ps(max, o), dRcp),
+               parallel = _mm_cmpeq_ps(d, _mm_setzero_ps()),
+               inside = _mm_and_ps(_mm_cmpge_ps(o, min), _mm_cmple_ps(o, max));
+
+        __m128 tNear = select(parallel, select(inside,
+                    SSEConstants::n_inf.ps, SSEConstants::p_inf.ps), _mm_min_ps(t1, t2)),
+               tFar = select(parallel, select(inside,
+                    SSEConstants::p_inf.ps, SSEConstants::n_inf.ps), _mm_max_ps(t1, t2));
+
+        nearT = _mm_max_ps(nearT, tNear);
+        farT = _mm_min_ps(farT, tFar);
+    }
+#endif
 };
 
 /*!\plugin{heightfield}{Height field intersection shape}
@@ -291,6 +327,17 @@ public:
 
             Float tMax = farT - nearT;
 
+            #if defined(MTS_SSE)
+                if (entry.level == 1) {
+                    /* Test all leaves of this node at once */
+                    if (!intersectBlock(ray, entry.x, entry.y, mint, maxt,
+                            t, (PatchIntersectionRecord *) tmp))
+                        continue;
+                    numTraversals += nTraversals;
+                    return true;
+                }
+            #endif
+
             if (entry.level > 0) {
                 /* Inner node -- push child nodes in 2D DDA order */
                 const Vector2i &numChildren = m_numChildren[entry.level];
@@ -369,6 +416,246 @@ public:
         return false;
     }
 
+#if defined(MTS_SSE)
+    /**
+     * \brief Intersect a ray (in object space) against the up to 2x2
+     * bilinear patches below the node <tt>(x, y)</tt> on level 1
+     *
+     * Each SIMD lane handles one patch, including the bounding box
+     * test. This is equivalent to pushing the leaves and intersecting
+     * them one by one, but avoids the stack traffic and the serial
+     * quadratic solves. Returns the nearest intersection (if any)
+     * within <tt>[mint, maxt]</tt>.
+     */
+    bool intersectBlock(const Ray &ray, int x, int y, Float mint, Float maxt,
+            Float &t, PatchIntersectionRecord *rec) const {
+        const Vector2i &numChildren = m_numChildren[1];
+        const int x0 = x * numChildren.x, y0 = y * numChildren.y, width = m_dataSize.x;
+
+        /* Lane i handles the patch (x0 + (i & 1), y0 + (i >> 1)). When the
+           node only has one child along an axis, the lanes beyond it
+           duplicate the first patch and are masked out below */
+        const int dx = numChildren.x - 1, dy = (numChildren.y - 1) * width;
+        const Float *p00 = m_data + y0 * width + x0,
+                    *p01 = p00 + width;
+
+        const __m128
+            f00 = _mm_set_ps(p00[dy + dx],     p00[dy],     p00[dx],     p00[0]),
+            f10 = _mm_set_ps(p00[dy + dx + 1], p00[dy + 1], p00[dx + 1], p00[1]),
+            f01 = _mm_set_ps(p01[dy + dx],     p01[dy],     p01[dx],     p01[0]),
+            f11 = _mm_set_ps(p01[dy + dx + 1], p01[dy + 1], p01[dx + 1], p01[1]);
+
+        int validMask = 0xF;
+        if (numChildren.x == 1)
+            validMask &= 0x5;
+        if (numChildren.y == 1)
+            validMask &= 0x3;
+
+        const Float fx0 = (Float) x0, fy0 = (Float) y0;
+        const __m128
+            one   = SSEConstants::one.ps,
+            minX  = _mm_set_ps(fx0 + 1, fx0, fx0 + 1, fx0),
+            minY  = _mm_set_ps(fy0 + 1, fy0 + 1, fy0, fy0),
+            minZ  = _mm_min_ps(_mm_min_ps(f00, f01), _mm_min_ps(f10, f11)),
+            maxZ  = _mm_max_ps(_mm_max_ps(f00, f01), _mm_max_ps(f10, f11)),
+            ox = _mm_set1_ps(ray.o.x), oy = _mm_set1_ps(ray.o.y), oz = _mm_set1_ps(ray.o.z),
+            dx_ = _mm_set1_ps(ray.d.x), dy_ = _mm_set1_ps(ray.d.y), dz_ = _mm_set1_ps(ray.d.z);
+
+        /* Bounding box tests */
+        __m128 nearT = _mm_set1_ps(mint), farT = _mm_set1_ps(maxt);
+        clipSlab(ox, dx_, _mm_set1_ps(ray.dRcp.x), minX, _mm_add_ps(minX, one), nearT, farT);
+        clipSlab(oy, dy_, _mm_set1_ps(ray.dRcp.y), minY, _mm_add_ps(minY, one), nearT, farT);
+        clipSlab(oz, dz_, _mm_set1_ps(ray.dRcp.z), minZ, maxZ, nearT, farT);
+
+        __m128 active = _mm_cmple_ps(nearT, farT);
+        if ((_mm_movemask_ps(active) & validMask) == 0)
+            return false;
+
+        /* Entry points in patch-local coordinates */
+        const __m128
+            ex = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_add_ps(ox,
+                _mm_mul_ps(dx_, nearT)), minX), _mm_setzero_ps()), one),
+            ey = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_add_ps(oy,
+                _mm_mul_ps(dy_, nearT)), minY), _mm_setzero_ps()), one),
+            ez = _mm_add_ps(oz, _mm_mul_ps(dz_, nearT));
+
+        /* Quadratic coefficients of the ray-patch intersection */
+        const __m128
+            fSum = _mm_add_ps(_mm_sub_ps(_mm_sub_ps(f00, f01), f10), f11),
+            A = _mm_mul_ps(_mm_mul_ps(dx_, dy_), fSum),
+            B = _mm_sub_ps(_mm_add_ps(
+                    _mm_mul_ps(dy_, _mm_add_ps(_mm_sub_ps(f01, f00), _mm_mul_ps(ex, fSum))),
+                    _mm_mul_ps(dx_, _mm_add_ps(_mm_sub_ps(f10, f00), _mm_mul_ps(ey, fSum)))), dz_),
+            C = _mm_sub_ps(_mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(ex, one), _mm_sub_ps(ey, one)), f00),
+                    _mm_mul_ps(ey, f01)),
+                    _mm_mul_ps(ex, _mm_sub_ps(f10, _mm_mul_ps(ey,
+                        _mm_sub_ps(_mm_add_ps(f01, f10), f11))))), ez);
+
+        /* Solve it in the same way as solveQuadratic() */
+        const __m128
+            zero = _mm_setzero_ps(),
+            linear = _mm_cmpeq_ps(A, zero),
+            discrim = _mm_sub_ps(_mm_mul_ps(B, B), _mm_mul_ps(_mm_set1_ps(4.0f), _mm_mul_ps(A, C))),
+            rootDiscrim = _mm_sqrt_ps(_mm_max_ps(discrim, zero)),
+            temp = _mm_mul_ps(_mm_set1_ps(-0.5f), _mm_add_ps(B, _mm_xor_ps(rootDiscrim,
+                _mm_and_ps(B, SSEConstants::negation_mask.ps)))),
+            r0 = _mm_div_ps(temp, A), r1 = _mm_div_ps(C, temp),
+            tLinear = _mm_div_ps(_mm_xor_ps(C, SSEConstants::negation_mask.ps), B),
+            t0 = select(linear, tLinear, _mm_min_ps(r0, r1)),
+            t1 = select(linear, tLinear, _mm_max_ps(r0, r1));
+
+        active = _mm_and_ps(active, select(linear,
+            _mm_cmpneq_ps(B, zero), _mm_cmpge_ps(discrim, zero)));
+
+        /* Admissible range of the local ray distance */
+        const __m128
+            lower = _mm_max_ps(_mm_set1_ps(-Epsilon), _mm_sub_ps(_mm_set1_ps(mint), nearT)),
+            upper = _mm_min_ps(_mm_add_ps(_mm_sub_ps(farT, nearT), _mm_set1_ps(Epsilon)),
+                _mm_sub_ps(_mm_set1_ps(maxt), nearT)),
+            valid0 = _mm_and_ps(_mm_cmpge_ps(t0, lower), _mm_cmple_ps(t0, upper)),
+            valid1 = _mm_and_ps(_mm_cmpge_ps(t1, lower), _mm_cmple_ps(t1, upper));
+
+        active = _mm_and_ps(active, _mm_or_ps(valid0, valid1));
+        int hitMask = _mm_movemask_ps(active) & validMask;
+        if (hitMask == 0)
+            return false;
+
+        SSEVector tLocal, tHit;
+        tLocal.ps = select(valid0, t0, t1);
+        tHit.ps = _mm_add_ps(nearT, tLocal.ps);
+
+        /* Find the closest hit among the patches */
+        int lane = -1;
+        for (int i=0; i<4; ++i) {
+            if ((hitMask & (1 << i)) && (lane < 0 || tHit.f[i] < tHit.f[lane]))
+                lane = i;
+        }
+
+        t = tHit.f[lane];
+        if (rec) {
+            SSEVector enterX, enterY, enterZ;
+            enterX.ps = ex; enterY.ps = ey; enterZ.ps = ez;
+            rec->x = x0 + (lane & 1);
+            rec->y = y0 + (lane >> 1);
+            rec->p = Point(enterX.f[lane], enterY.f[lane], enterZ.f[lane])
+                + ray.d * tLocal.f[lane];
+        }
+        return true;
+    }
+#endif
+
+#if defined(MTS_HAS_COHERENT_RT)
+    int rayIntersectPacket(const RayPacket4 &packet, const Float *mint,
+            const Float *maxt, int mask, Float *t, uint8_t *temp,
+            size_t tempStride) const {
+        if (m_levelCount < 2)
+            return Shape::rayIntersectPacket(packet, mint, maxt, mask, t, temp, tempStride);
+
+        /* Up to four children are pushed per level */
+        StackEntry stack[3*MTS_QTREE_MAXDEPTH + 1];
+        const Transform worldToObject = m_objectToWorld.inverse();
+
+        /* Transform the rays into object space */
+        Ray rays[4];
+        QuadVector o, d, dRcp;
+        SSEVector rayMin, best;
+        int nActive = 0;
+
+        for (int i=0; i<4; ++i) {
+            Ray &ray = rays[i];
+            if (mask & (1 << i)) {
+                Ray worldRay;
+                for (int axis=0; axis<3; axis++) {
+                    worldRay.o[axis] = packet.o[axis].f[i];
+                    worldRay.d[axis] = packet.d[axis].f[i];
+                }
+                worldToObject(worldRay, ray);
+                rayMin.f[i] = mint[i];
+                best.f[i] = maxt[i];
+                ++nActive;
+            } else {
+                ray = Ray(Point(0.0f), Vector(0.0f, 0.0f, 1.0f), 0.0f);
+                rayMin.f[i] = std::numeric_limits<Float>::infinity();
+                best.f[i] = -std::numeric_limits<Float>::infinity();
+            }
+            for (int axis=0; axis<3; axis++) {
+                o[axis].f[i] = ray.o[axis];
+                d[axis].f[i] = ray.d[axis];
+                dRcp[axis].f[i] = ray.dRcp[axis];
+            }
+        }
+
+        /* Child visitation order (front to back for the first active ray) */
+        int ref = 0;
+        while (!(mask & (1 << ref)))
+            ++ref;
+        const Vector &dRef = rays[ref].d;
+        const bool flipX = dRef.x >= 0, flipY = dRef.y >= 0;
+
+        int stackIdx = 0, hits = 0;
+        stack[0].level = m_levelCount-1;
+        stack[0].x = stack[0].y = 0;
+
+        numTraversals.incrementBase(nActive);
+
+        size_t nTraversals = 0;
+        while (stackIdx >= 0) {
+            ++nTraversals;
+
+            /* Pop a node and intersect its bounding box with all rays */
+            StackEntry entry         = stack[stackIdx--];
+            const Interval &interval = m_minmax[entry.level][
+                entry.x + entry.y * m_levelSize[entry.level].x];
+            const Vector2 &blockSize = m_blockSizeF[entry.level];
+
+            const __m128
+                minX = _mm_set1_ps(entry.x * blockSize.x),
+                minY = _mm_set1_ps(entry.y * blockSize.y);
+            __m128 nearT = rayMin.ps, farT = best.ps;
+            clipSlab(o[0].ps, d[0].ps, dRcp[0].ps, minX,
+                _mm_add_ps(minX, _mm_set1_ps(blockSize.x)), nearT, farT);
+            clipSlab(o[1].ps, d[1].ps, dRcp[1].ps, minY,
+                _mm_add_ps(minY, _mm_set1_ps(blockSize.y)), nearT, farT);
+            clipSlab(o[2].ps, d[2].ps, dRcp[2].ps, _mm_set1_ps(interval.min),
+                _mm_set1_ps(interval.max), nearT, farT);
+
+            int active = _mm_movemask_ps(_mm_cmple_ps(nearT, farT));
+            if (!active)
+                continue;
+
+            if (entry.level == 1) {
+                /* Test the leaves against each ray that reached this node */
+                for (int i=0; i<4; ++i) {
+                    if (!(active & (1 << i)))
+                        continue;
+                    Float tHit;
+                    if (intersectBlock(rays[i], entry.x, entry.y, rayMin.f[i], best.f[i],
+                            tHit, (PatchIntersectionRecord *) (temp + i * tempStride))) {
+                        best.f[i] = t[i] = tHit;
+                        hits |= 1 << i;
+                    }
+                }
+            } else {
+                /* Inner node -- push the children so that the nearest one is popped first */
+                const Vector2i &numChildren = m_numChildren[entry.level];
+                for (int j=0; j<numChildren.y; ++j) {
+                    int y = flipY ? numChildren.y - 1 - j : j;
+                    for (int i=0; i<numChildren.x; ++i) {
+                        int x = flipX ? numChildren.x - 1 - i : i;
+                        stack[++stackIdx].level = entry.level - 1;
+                        stack[stackIdx].x = entry.x * numChildren.x + x;
+                        stack[stackIdx].y = entry.y * numChildren.y + y;
+                    }
+                }
+            }
+        }
+
+        numTraversals += nTraversals * nActive;
+        return hits;
+    }
+#endif
+
     void fillIntersectionRecord(const Ray &ray,
             const void *tmp, Intersection &its) const {
         PatchIntersectionRecord &temp = *((PatchIntersectionRecord *) tmp);
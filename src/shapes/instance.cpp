@@ -17,9 +17,18 @@
 */
 
 #include "instance.h"
+#include <mitsuba/core/statistics.h>
+
+/// Depth up to which the kd-tree of the shape group is used to clip instances
+#define MTS_INSTANCE_CLIP_DEPTH 6
 
 MTS_NAMESPACE_BEGIN
 
+static StatsCounter statsInstanceHits("Instances",
+        "Ray-instance intersection tests that hit", EPercentage);
+static StatsCounter statsShadowHits("Instances",
+        "Shadow ray-instance tests that hit", EPercentage);
+
 /*!\plugin{instance}{Geometry instance}
  * \order{9}
  * \parameters{
@@ -29,6 +38,14 @@ MTS_NAMESPACE_BEGIN
  *        Specifies an optional linear instance-to-world transformation.
  *        \default{none (i.e. instance space $=$ world space)}
  *     }
+ *     \parameter{motionSamples}{\Integer}{
+ *        When set to a positive value, an animated transformation is
+ *        precomputed at this many uniformly spaced times between its
+ *        first and last keyframe. Motion-blurred rays then interpolate
+ *        between the cached matrices. This is much faster, but rotations
+ *        are only approximated between the samples.
+ *        \default{0, i.e. evaluate the animation exactly}
+ *     }
  * }
  * \renderings{
  *    \rendering{Surface viewed from the top}{shape_instance_fractal_top}
@@ -56,18 +73,41 @@ MTS_NAMESPACE_BEGIN
 
 Instance::Instance(const Properties &props) : Shape(props) {
     m_transform = props.getAnimatedTransform("toWorld", Transform());
+    /* Number of precomputed time samples of an animated transformation */
+    m_motionSamples = props.getInteger("motionSamples", 0);
+    if (m_motionSamples < 0)
+        Log(EError, "The 'motionSamples' parameter must be nonnegative!");
+    cacheInverse();
 }
 
 Instance::Instance(Stream *stream, InstanceManager *manager)
     : Shape(stream, manager) {
     m_shapeGroup = static_cast<ShapeGroup *>(manager->getInstance(stream));
     m_transform = new AnimatedTransform(stream);
+    m_motionSamples = stream->readInt();
+    cacheInverse();
+}
+
+void Instance::cacheInverse() {
+    m_static = m_transform->isStatic();
+    if (m_static) {
+        m_invTransform = m_transform->eval(0).inverse();
+    } else if (m_motionSamples > 0) {
+        AABB1 timeBounds = m_transform->getTimeBounds();
+        if (timeBounds.max.x > timeBounds.min.x) {
+            ref<AnimatedTransform> trafo = new AnimatedTransform(m_transform.get());
+            trafo->precompute(timeBounds.min.x, timeBounds.max.x,
+                (size_t) m_motionSamples);
+            m_transform = trafo;
+        }
+    }
 }
 
 void Instance::serialize(Stream *stream, InstanceManager *manager) const {
     Shape::serialize(stream, manager);
     manager->serialize(stream, m_shapeGroup.get());
     m_transform->serialize(stream);
+    stream->writeInt(m_motionSamples);
 }
 
 void Instance::configure() {
@@ -95,6 +135,56 @@ AABB Instance::getAABB() const {
     return result;
 }
 
+AABB Instance::getClippedAABB(const AABB &box) const {
+    const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
+    if (!m_static || !kdtree->getAABB().isValid())
+        return Shape::getClippedAABB(box);
+
+    /* Bound the query box in the local space of the instance */
+    AABB localBox;
+    for (int i=0; i<8; ++i)
+        localBox.expandBy(m_invTransform(box.getCorner(i)));
+
+    /* Descend into the kd-tree of the shape group so that empty space
+       and geometry outside of the box don't count towards the bounds */
+    AABB result;
+    clipNode(kdtree->getRoot(), kdtree->getAABB(), localBox, box, 0, result);
+    return result;
+}
+
+void Instance::clipNode(const ShapeKDTree::KDNode *node, const AABB &nodeAABB,
+        const AABB &localBox, const AABB &box, int depth, AABB &result) const {
+    AABB clipped(nodeAABB);
+    clipped.clip(localBox);
+    if (!clipped.isValid())
+        return;
+
+    if (node->isLeaf() || depth == MTS_INSTANCE_CLIP_DEPTH) {
+        if (node->isLeaf() && node->getPrimStart() == node->getPrimEnd())
+            return;
+
+        const Transform &trafo = m_transform->eval(0);
+        AABB worldAABB;
+        for (int i=0; i<8; ++i)
+            worldAABB.expandBy(trafo(clipped.getCorner(i)));
+        worldAABB.clip(box);
+
+        if (worldAABB.isValid())
+            result.expandBy(worldAABB);
+        return;
+    }
+
+    int axis = node->getAxis();
+    Float split = node->getSplit();
+
+    AABB left(nodeAABB), right(nodeAABB);
+    left.max[axis] = split;
+    right.min[axis] = split;
+
+    clipNode(node->getLeft(), left, localBox, box, depth + 1, result);
+    clipNode(node->getRight(), right, localBox, box, depth + 1, result);
+}
+
 void Instance::addChild(const std::string &name, ConfigurableObject *child) {
     const Class *cClass = child->getClass();
     if (cClass->getName() == "ShapeGroup") {
@@ -115,18 +205,24 @@ size_t Instance::getEffectivePrimitiveCount() const {
 bool Instance::rayIntersect(const Ray &_ray, Float mint,
         Float maxt, Float &t, void *temp) const {
     const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
-    const Transform &trafo = m_transform->eval(_ray.time);
     Ray ray;
-    trafo.inverse()(_ray, ray);
-    return kdtree->rayIntersect(ray, mint, maxt, t, temp);
+    toLocal(_ray, ray);
+    statsInstanceHits.incrementBase();
+    if (!kdtree->rayIntersect(ray, mint, maxt, t, temp))
+        return false;
+    ++statsInstanceHits;
+    return true;
 }
 
 bool Instance::rayIntersect(const Ray &_ray, Float mint, Float maxt) const {
     const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
     Ray ray;
-    const Transform &trafo = m_transform->eval(_ray.time);
-    trafo.inverse()(_ray, ray);
-    return kdtree->rayIntersect(ray, mint, maxt);
+    toLocal(_ray, ray);
+    statsShadowHits.incrementBase();
+    if (!kdtree->rayIntersect(ray, mint, maxt))
+        return false;
+    ++statsShadowHits;
+    return true;
 }
 
 void Instance::adjustTime(Intersection &its, Float time) const {
@@ -148,7 +244,7 @@ void Instance::fillIntersectionRecord(const Ray &_ray,
     const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
     const Transform &trafo = m_transform->eval(_ray.time);
     Ray ray;
-    trafo.inverse()(_ray, ray);
+    toLocal(_ray, ray);
     kdtree->fillIntersectionRecord<false>(ray, temp, its);
 
     its.shFrame.n = normalize(trafo(its.shFrame.n));
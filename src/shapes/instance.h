@@ -60,6 +60,8 @@ public:
 
     AABB getAABB() const;
 
+    AABB getClippedAABB(const AABB &box) const;
+
     bool rayIntersect(const Ray &_ray, Float mint,
             Float maxt, Float &t, void *temp) const;
 
@@ -81,9 +83,30 @@ public:
     // =============================================================
 
     MTS_DECLARE_CLASS()
+protected:
+    /// Transform a world space ray into the local space of the instance
+    inline void toLocal(const Ray &ray, Ray &local) const {
+        if (EXPECT_TAKEN(m_static))
+            m_invTransform(ray, local);
+        else
+            m_transform->eval(ray.time).inverse()(ray, local);
+    }
+
+    /**
+     * Cache the inverse of a static instance-to-world transformation,
+     * or tabulate an animated one when \c motionSamples was specified
+     */
+    void cacheInverse();
+
+    /// Recursive helper function used by \ref getClippedAABB()
+    void clipNode(const ShapeKDTree::KDNode *node, const AABB &nodeAABB,
+        const AABB &localBox, const AABB &box, int depth, AABB &result) const;
 private:
     ref<ShapeGroup> m_shapeGroup;
     ref<const AnimatedTransform> m_transform;
+    Transform m_invTransform;
+    int m_motionSamples;
+    bool m_static;
 };
 
 MTS_NAMESPACE_END
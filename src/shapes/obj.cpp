@@ -20,14 +20,20 @@
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/render/emitter.h>
 #include <mitsuba/render/bsdf.h>
 #include <mitsuba/render/subsurface.h>
 #include <mitsuba/render/medium.h>
 #include <mitsuba/render/sensor.h>
 #include <mitsuba/hw/basicshader.h>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
 #include <set>
 
+/// Target size of the chunks that are parsed in parallel (in bytes)
+#define MTS_OBJ_CHUNK_SIZE (4*1024*1024)
+
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{obj}{Wavefront OBJ mesh loader}
@@ -65,6 +71,15 @@ MTS_NAMESPACE_BEGIN
  *     \parameter{collapse}{\Boolean}{
  *       Collapse all meshes into a single shape \default{\code{false}}
  *     }
+ *     \parameter{compact}{\Boolean}{
+ *       Store normals, texture coordinates and indices at reduced precision
+ *       to save memory (see \code{TriMesh::compact()}) \default{\code{false}}
+ *     }
+ *     \parameter{precomputeCurvature}{\Boolean}{
+ *       Estimate the mean and Gaussian curvature at every vertex while
+ *       loading, which speeds up the \pluginref{curvature} texture
+ *       \default{\code{false}}
+ *     }
  *     \parameter{loadMaterials}{\Boolean}{
  *       \mbox{Import materials from a \code{mtl} file, if it exists?\default{\code{true}}}
  *     }
@@ -162,6 +177,31 @@ public:
         }
     };
 
+    /// Statement that affects the grouping of the faces parsed so far
+    struct OBJCommand {
+        enum EType { EGroup, EMaterial, EMaterialLibrary };
+        EType type;
+        std::string arg;
+        /// Number of faces in the chunk preceding this statement
+        size_t faceOffset;
+
+        inline OBJCommand(EType type, const std::string &arg, size_t faceOffset)
+            : type(type), arg(arg), faceOffset(faceOffset) { }
+    };
+
+    /// Contents of a range of lines of the OBJ file
+    struct OBJChunk {
+        const char *start, *end;
+        std::vector<Point> vertices;
+        std::vector<Normal> normals;
+        std::vector<Point2> texcoords;
+        std::vector<OBJTriangle> triangles;
+        std::vector<OBJCommand> commands;
+        /// Negative (relative) face indices, which refer to earlier chunks
+        std::vector<size_t> relative;
+        std::string error;
+    };
+
     bool fetch_line(std::istream &is, std::string &line) {
         /// Fetch a line from the stream, while handling line breaks with backslashes
         if (!std::getline(is, line))
@@ -207,6 +247,12 @@ public:
         /* Collapse all contained shapes / groups into a single object? */
         m_collapse = props.getBoolean("collapse", false);
 
+        /* Use the compact mesh representation (see TriMesh::compact()) */
+        m_compact = props.getBoolean("compact", false);
+
+        /* Estimate per-vertex curvatures for the 'curvature' texture */
+        m_precomputeCurvature = props.getBoolean("precomputeCurvature", false);
+
         /* Causes all texture coordinates to be vertically flipped */
         bool flipTexCoords = props.getBoolean("flipTexCoords", true);
 
@@ -221,19 +267,17 @@ public:
 
         /* Load the geometry */
         Log(EInfo, "Loading geometry from \"%s\" ..", path.filename().string().c_str());
-        fs::ifstream is(path);
-        if (is.bad() || is.fail())
+        if (!fs::exists(path))
             Log(EError, "Wavefront OBJ file '%s' not found!", path.string().c_str());
 
         fileResolver->prependPath(fs::absolute(path).parent_path());
 
         ref<Timer> timer = new Timer();
-        std::string buf;
         std::vector<Point> vertices;
         std::vector<Normal> normals;
         std::vector<Point2> texcoords;
         std::vector<OBJTriangle> triangles;
-        std::string name = m_name, line;
+        std::string name = m_name;
         std::set<std::string> geomNames;
         std::vector<Vertex> vertexBuffer;
         fs::path materialLibrary;
@@ -241,90 +285,128 @@ public:
         bool nameBeforeGeometry = false;
         std::string materialName;
 
-        while (is.good() && !is.eof() && fetch_line(is, line)) {
-            std::istringstream iss(line);
-            if (!(iss >> buf))
-                continue;
+        /* Map the file and split it into chunks of whole lines,
+           which are parsed in parallel */
+        ref<MemoryMappedFile> mmap;
+        std::vector<OBJChunk> chunks;
+        if (fs::file_size(path) > 0) {
+            mmap = new MemoryMappedFile(path);
+            const char *data = static_cast<const char *>(mmap->getData()),
+                       *dataEnd = data + mmap->getSize();
+            size_t chunkCount = std::max((size_t) 1,
+                std::min(mmap->getSize() / MTS_OBJ_CHUNK_SIZE, (size_t) getCoreCount() * 4));
+
+            chunks.resize(chunkCount);
+            const char *ptr = data;
+            for (size_t i=0; i<chunkCount; ++i) {
+                chunks[i].start = ptr;
+                ptr = (i+1 == chunkCount) ? dataEnd
+                    : findLineStart(data, std::max(ptr, data + (i+1) * (mmap->getSize() / chunkCount)), dataEnd);
+                chunks[i].end = ptr;
+            }
 
-            if (buf == "v") {
-                /* Parse + transform vertices */
-                Point p;
-                iss >> p.x >> p.y >> p.z;
-                vertices.push_back(p);
-            } else if (buf == "vn") {
-                Normal n;
-                iss >> n.x >> n.y >> n.z;
-                normals.push_back(n);
-            } else if (buf == "g" && !m_collapse) {
-                std::string targetName;
-                std::string newName = trim(line.substr(1, line.length()-1));
-
-                /* There appear to be two different conventions
-                   for specifying object names in OBJ file -- try
-                   to detect which one is being used */
-                if (nameBeforeGeometry)
-                    // Save geometry under the previously specified name
-                    targetName = name;
-                else
-                    targetName = newName;
-
-                if (triangles.size() > 0) {
-                    /// make sure that we have unique names
-                    if (geomNames.find(targetName) != geomNames.end())
-                        targetName = formatString("%s_%i", targetName.c_str(), geomIndex);
-                    geomIndex += 1;
-                    geomNames.insert(targetName);
-                    if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
-                        createMesh(targetName, vertices, normals, texcoords,
-                            triangles, materialName, objectToWorld, vertexBuffer);
-                    triangles.clear();
-                } else {
-                    nameBeforeGeometry = true;
-                }
-                name = newName;
-            } else if (buf == "usemtl") {
-                /* Flush if necessary */
-                if (triangles.size() > 0 && !m_collapse) {
-                    /// make sure that we have unique names
-                    if (geomNames.find(name) != geomNames.end())
-                        name = formatString("%s_%i", name.c_str(), geomIndex);
-                    geomIndex += 1;
-                    geomNames.insert(name);
-                    if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
-                        createMesh(name, vertices, normals, texcoords,
-                            triangles, materialName, objectToWorld, vertexBuffer);
-                    triangles.clear();
-                    name = m_name;
+            #if defined(MTS_OPENMP)
+                #pragma omp parallel for schedule(dynamic)
+            #endif
+            for (int i=0; i<(int) chunkCount; ++i)
+                parseChunk(chunks[i], flipTexCoords);
+        }
+
+        size_t vertexOffset = 0, normalOffset = 0, texcoordOffset = 0;
+        for (size_t i=0; i<chunks.size(); ++i) {
+            if (!chunks[i].error.empty())
+                Log(EError, "%s", chunks[i].error.c_str());
+            vertexOffset += chunks[i].vertices.size();
+            normalOffset += chunks[i].normals.size();
+            texcoordOffset += chunks[i].texcoords.size();
+        }
+        vertices.reserve(vertexOffset);
+        normals.reserve(normalOffset);
+        texcoords.reserve(texcoordOffset);
+
+        for (size_t c=0; c<chunks.size(); ++c) {
+            OBJChunk &chunk = chunks[c];
+
+            /* Make relative indices absolute */
+            for (size_t i=0; i<chunk.relative.size(); ++i) {
+                size_t j = chunk.relative[i];
+                int &index = reinterpret_cast<int *>(&chunk.triangles[j / 9])[j % 9];
+                switch ((j % 9) / 3) {
+                    case 0: index += (int) vertices.size(); break;
+                    case 1: index += (int) normals.size(); break;
+                    default: index += (int) texcoords.size(); break;
                 }
+            }
 
-                materialName = trim(line.substr(6, line.length()-1));
-            } else if (buf == "mtllib") {
-                materialLibrary = fileResolver->resolve(trim(line.substr(6, line.length()-1)));
-            } else if (buf == "vt") {
-                Float u, v;
-                iss >> u >> v;
-                if (flipTexCoords)
-                    v = 1-v;
-                texcoords.push_back(Point2(u, v));
-            } else if (buf == "f") {
-                std::string  tmp;
-                OBJTriangle t;
-                iss >> tmp; parse(t, 0, tmp);
-                iss >> tmp; parse(t, 1, tmp);
-                iss >> tmp; parse(t, 2, tmp);
-                triangles.push_back(t);
-                /* Handle n-gons assuming a convex shape */
-                while (iss >> tmp) {
-                    t.p[1] = t.p[2];
-                    t.uv[1] = t.uv[2];
-                    t.n[1] = t.n[2];
-                    parse(t, 2, tmp);
-                    triangles.push_back(t);
+            vertices.insert(vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+            normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+            texcoords.insert(texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+
+            size_t faceOffset = 0;
+            for (size_t k=0; k<chunk.commands.size(); ++k) {
+                const OBJCommand &cmd = chunk.commands[k];
+                triangles.insert(triangles.end(), chunk.triangles.begin() + faceOffset,
+                    chunk.triangles.begin() + cmd.faceOffset);
+                faceOffset = cmd.faceOffset;
+
+                if (cmd.type == OBJCommand::EGroup && !m_collapse) {
+                    std::string targetName;
+                    const std::string &newName = cmd.arg;
+
+                    /* There appear to be two different conventions
+                       for specifying object names in OBJ file -- try
+                       to detect which one is being used */
+                    if (nameBeforeGeometry)
+                        // Save geometry under the previously specified name
+                        targetName = name;
+                    else
+                        targetName = newName;
+
+                    if (triangles.size() > 0) {
+                        /// make sure that we have unique names
+                        if (geomNames.find(targetName) != geomNames.end())
+                            targetName = formatString("%s_%i", targetName.c_str(), geomIndex);
+                        geomIndex += 1;
+                        geomNames.insert(targetName);
+                        if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
+                            createMesh(targetName, vertices, normals, texcoords,
+                                triangles, materialName, objectToWorld, vertexBuffer);
+                        triangles.clear();
+                    } else {
+                        nameBeforeGeometry = true;
+                    }
+                    name = newName;
+                } else if (cmd.type == OBJCommand::EMaterial) {
+                    /* Flush if necessary */
+                    if (triangles.size() > 0 && !m_collapse) {
+                        /// make sure that we have unique names
+                        if (geomNames.find(name) != geomNames.end())
+                            name = formatString("%s_%i", name.c_str(), geomIndex);
+                        geomIndex += 1;
+                        geomNames.insert(name);
+                        if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
+                            createMesh(name, vertices, normals, texcoords,
+                                triangles, materialName, objectToWorld, vertexBuffer);
+                        triangles.clear();
+                        name = m_name;
+                    }
+
+                    materialName = cmd.arg;
+                } else if (cmd.type == OBJCommand::EMaterialLibrary) {
+                    materialLibrary = fileResolver->resolve(cmd.arg);
                 }
-            } else {
-                /* Ignore */
             }
+            triangles.insert(triangles.end(), chunk.triangles.begin() + faceOffset,
+                chunk.triangles.end());
+
+            /* Release the chunk's memory early */
+            OBJChunk().triangles.swap(chunk.triangles);
+            OBJChunk().vertices.swap(chunk.vertices);
+            OBJChunk().normals.swap(chunk.normals);
+            OBJChunk().texcoords.swap(chunk.texcoords);
         }
+        mmap = NULL;
+
         if (geomNames.find(name) != geomNames.end())
             /// make sure that we have unique names
             name = formatString("%s_%i", m_name.c_str(), geomIndex);
@@ -349,6 +431,9 @@ public:
     }
 
     WavefrontOBJ(Stream *stream, InstanceManager *manager) : Shape(stream, manager) {
+        /* The meshes are transferred in their compact form */
+        m_compact = false;
+        m_precomputeCurvature = false;
         m_aabb = AABB(stream);
         uint32_t meshCount = stream->readUInt();
         m_meshes.resize(meshCount);
@@ -368,24 +453,261 @@ public:
             manager->serialize(stream, m_meshes[i]);
     }
 
-    void parse(OBJTriangle &t, int i, const std::string &str) {
-        std::vector<std::string> tokens = tokenize(str, "/");
-        if (tokens.size() == 1) {
-            t.p[i] = atoi(tokens[0].c_str());
-        } else if (tokens.size() == 2) {
-            if (str.find("//") == std::string::npos) {
-                t.p[i]  = atoi(tokens[0].c_str());
-                t.uv[i] = atoi(tokens[1].c_str());
-            } else {
-                t.p[i] = atoi(tokens[0].c_str());
-                t.n[i] = atoi(tokens[1].c_str());
+    static inline bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    /// Is the line ending at \c ptr (exclusive) continued with a backslash?
+    static bool isContinued(const char *start, const char *ptr) {
+        while (ptr > start && isSpace(ptr[-1]))
+            --ptr;
+        return ptr > start && ptr[-1] == '\\';
+    }
+
+    /// Return the start of the first (logical) line beginning after \c ptr
+    static const char *findLineStart(const char *start, const char *ptr, const char *end) {
+        while (ptr < end) {
+            const char *eol = static_cast<const char *>(memchr(ptr, '\n', end - ptr));
+            if (!eol)
+                return end;
+            ptr = eol + 1;
+            if (!isContinued(start, eol))
+                return ptr;
+        }
+        return end;
+    }
+
+    /// Parse a decimal integer, returns \c false if there is none
+    static inline bool parseInt(const char *&ptr, const char *end, int &value) {
+        bool negative = false;
+        if (ptr < end && (*ptr == '-' || *ptr == '+'))
+            negative = *ptr++ == '-';
+        if (ptr == end || *ptr < '0' || *ptr > '9')
+            return false;
+        int result = 0;
+        while (ptr < end && *ptr >= '0' && *ptr <= '9')
+            result = result * 10 + (*ptr++ - '0');
+        value = negative ? -result : result;
+        return true;
+    }
+
+    /**
+     * \brief Parse a floating point value
+     *
+     * Values with at most 19 significant digits and a small decimal exponent
+     * are converted exactly using double precision arithmetic. Everything
+     * else (long mantissas, "inf", "nan", ..) is handed to \c strtod.
+     */
+    static Float parseFloat(const char *&ptr, const char *end) {
+        static const double powers[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        while (ptr < end && isSpace(*ptr))
+            ++ptr;
+        const char *start = ptr;
+
+        bool negative = false;
+        if (ptr < end && (*ptr == '-' || *ptr == '+'))
+            negative = *ptr++ == '-';
+
+        uint64_t mantissa = 0;
+        int digits = 0, exponent = 0;
+        bool valid = false;
+        while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+            if (mantissa != 0 || *ptr != '0')
+                ++digits;
+            mantissa = mantissa * 10 + (*ptr++ - '0');
+            valid = true;
+        }
+        if (ptr < end && *ptr == '.') {
+            ++ptr;
+            while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+                if (mantissa != 0 || *ptr != '0')
+                    ++digits;
+                mantissa = mantissa * 10 + (*ptr++ - '0');
+                --exponent;
+                valid = true;
+            }
+        }
+        if (valid && ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+            const char *expStart = ptr++;
+            int value;
+            if (parseInt(ptr, end, value))
+                exponent += value;
+            else
+                ptr = expStart;
+        }
+
+        if (valid && digits <= 19 && mantissa <= ((uint64_t) 1 << 53)
+                && exponent >= -22 && exponent <= 22) {
+            double result = (double) mantissa;
+            result = exponent < 0 ? result / powers[-exponent]
+                                  : result * powers[exponent];
+            return (Float) (negative ? -result : result);
+        }
+
+        /* Slow path */
+        char buf[128];
+        ptr = start;
+        size_t length = 0;
+        while (ptr < end && !isSpace(*ptr) && *ptr != '\n' && length < sizeof(buf) - 1)
+            buf[length++] = *ptr++;
+        buf[length] = '\0';
+        char *endPtr = NULL;
+        double result = strtod(buf, &endPtr);
+        ptr = start + (endPtr - buf);
+        return (Float) result;
+    }
+
+    /// Parse a face vertex in the formats "p", "p/uv", "p//n" or "p/uv/n"
+    bool parseFaceVertex(const char *&ptr, const char *end, OBJTriangle &t, int i,
+            int &relative, const OBJChunk &chunk) {
+        int *indices[3] = { &t.p[i], &t.uv[i], &t.n[i] };
+        size_t counts[3] = { chunk.vertices.size(), chunk.texcoords.size(),
+            chunk.normals.size() };
+        /* Offsets of p, n and uv within OBJTriangle (see OBJChunk::relative) */
+        int slots[3] = { i, 6 + i, 3 + i };
+
+        for (int k=0; k<3; ++k) {
+            *indices[k] = 0;
+            relative &= ~(1 << slots[k]);
+            if (k > 0) {
+                if (ptr == end || *ptr != '/')
+                    break;
+                ++ptr;
+                if (ptr < end && *ptr == '/')
+                    continue;
+            }
+            int value;
+            if (!parseInt(ptr, end, value))
+                return false;
+            if (value < 0) {
+                value += (int) counts[k] + 1;
+                relative |= 1 << slots[k];
+            }
+            *indices[k] = value;
+        }
+        return ptr == end || isSpace(*ptr);
+    }
+
+    /// Append a face, \c relative has a bit set for every relative index
+    static void addTriangle(const OBJTriangle &t, int relative, OBJChunk &chunk) {
+        for (int j=0; relative != 0; ++j, relative >>= 1) {
+            if (relative & 1)
+                chunk.relative.push_back(chunk.triangles.size() * 9 + j);
+        }
+        chunk.triangles.push_back(t);
+    }
+
+    /// Parse the statement \c ptr .. \c end (a single logical line)
+    void parseLine(const char *ptr, const char *end, OBJChunk &chunk, bool flipTexCoords) {
+        while (ptr < end && isSpace(*ptr))
+            ++ptr;
+        const char *keyword = ptr;
+        while (ptr < end && !isSpace(*ptr))
+            ++ptr;
+        size_t length = ptr - keyword;
+        if (length == 0 || *keyword == '#')
+            return;
+
+        if (length == 1 && keyword[0] == 'v') {
+            Point p;
+            p.x = parseFloat(ptr, end);
+            p.y = parseFloat(ptr, end);
+            p.z = parseFloat(ptr, end);
+            chunk.vertices.push_back(p);
+        } else if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n') {
+            Normal n;
+            n.x = parseFloat(ptr, end);
+            n.y = parseFloat(ptr, end);
+            n.z = parseFloat(ptr, end);
+            chunk.normals.push_back(n);
+        } else if (length == 2 && keyword[0] == 'v' && keyword[1] == 't') {
+            Float u = parseFloat(ptr, end);
+            Float v = parseFloat(ptr, end);
+            if (flipTexCoords)
+                v = 1-v;
+            chunk.texcoords.push_back(Point2(u, v));
+        } else if (length == 1 && keyword[0] == 'f') {
+            OBJTriangle t;
+            int i = 0, relative = 0;
+            while (true) {
+                while (ptr < end && isSpace(*ptr))
+                    ++ptr;
+                if (ptr == end)
+                    break;
+                if (i == 3) {
+                    /* Handle n-gons assuming a convex shape */
+                    addTriangle(t, relative, chunk);
+                    t.p[1] = t.p[2];
+                    t.uv[1] = t.uv[2];
+                    t.n[1] = t.n[2];
+                    relative = (relative & ~0x92) | ((relative & 0x124) >> 1);
+                    i = 2;
+                }
+                if (!parseFaceVertex(ptr, end, t, i++, relative, chunk)) {
+                    if (chunk.error.empty())
+                        chunk.error = formatString("Invalid OBJ face format: \"%s\"!",
+                            std::string(keyword, end).c_str());
+                    return;
+                }
             }
-        } else if (tokens.size() == 3) {
-            t.p[i] = atoi(tokens[0].c_str());
-            t.uv[i] = atoi(tokens[1].c_str());
-            t.n[i] = atoi(tokens[2].c_str());
+            if (i < 3) {
+                if (chunk.error.empty())
+                    chunk.error = formatString("Invalid OBJ face format: \"%s\"!",
+                        std::string(keyword, end).c_str());
+                return;
+            }
+            addTriangle(t, relative, chunk);
         } else {
-            Log(EError, "Invalid OBJ face format!");
+            OBJCommand::EType type;
+            if (length == 1 && keyword[0] == 'g')
+                type = OBJCommand::EGroup;
+            else if (length == 6 && memcmp(keyword, "usemtl", 6) == 0)
+                type = OBJCommand::EMaterial;
+            else if (length == 6 && memcmp(keyword, "mtllib", 6) == 0)
+                type = OBJCommand::EMaterialLibrary;
+            else
+                return; /* Ignore */
+            chunk.commands.push_back(OBJCommand(type,
+                trim(std::string(ptr, end)), chunk.triangles.size()));
+        }
+    }
+
+    /// Parse all lines of a chunk of the OBJ file
+    void parseChunk(OBJChunk &chunk, bool flipTexCoords) {
+        const char *ptr = chunk.start;
+        std::string joined;
+        while (ptr < chunk.end && chunk.error.empty()) {
+            const char *eol = static_cast<const char *>(
+                memchr(ptr, '\n', chunk.end - ptr));
+            if (!eol)
+                eol = chunk.end;
+
+            if (!isContinued(ptr, eol)) {
+                parseLine(ptr, eol, chunk, flipTexCoords);
+                ptr = eol + (eol < chunk.end ? 1 : 0);
+                continue;
+            }
+
+            /* Join lines that end with a backslash */
+            joined.clear();
+            while (true) {
+                const char *last = eol;
+                while (last > ptr && isSpace(last[-1]))
+                    --last;
+                bool continued = last > ptr && last[-1] == '\\';
+                joined.append(ptr, continued ? last - 1 : last);
+                ptr = eol + (eol < chunk.end ? 1 : 0);
+                if (!continued || ptr >= chunk.end)
+                    break;
+                eol = static_cast<const char *>(memchr(ptr, '\n', chunk.end - ptr));
+                if (!eol)
+                    eol = chunk.end;
+            }
+            parseLine(joined.c_str(), joined.c_str() + joined.size(), chunk, flipTexCoords);
         }
     }
 
@@ -580,28 +902,25 @@ public:
         Point2 uv;
     };
 
-    /// For using vertices as keys in an associative structure
-    struct vertex_key_order : public
-        std::binary_function<Vertex, Vertex, bool> {
-    public:
+    /// For using vertices as keys in a hash table
+    struct vertex_hash : public std::unary_function<Vertex, size_t> {
+        size_t operator()(const Vertex &v) const {
+            size_t seed = 0;
+            boost::hash_combine(seed, v.p.x);
+            boost::hash_combine(seed, v.p.y);
+            boost::hash_combine(seed, v.p.z);
+            boost::hash_combine(seed, v.n.x);
+            boost::hash_combine(seed, v.n.y);
+            boost::hash_combine(seed, v.n.z);
+            boost::hash_combine(seed, v.uv.x);
+            boost::hash_combine(seed, v.uv.y);
+            return seed;
+        }
+    };
+
+    struct vertex_equal : public std::binary_function<Vertex, Vertex, bool> {
         bool operator()(const Vertex &v1, const Vertex &v2) const {
-            if (v1.p.x < v2.p.x) return true;
-            else if (v1.p.x > v2.p.x) return false;
-            if (v1.p.y < v2.p.y) return true;
-            else if (v1.p.y > v2.p.y) return false;
-            if (v1.p.z < v2.p.z) return true;
-            else if (v1.p.z > v2.p.z) return false;
-            if (v1.n.x < v2.n.x) return true;
-            else if (v1.n.x > v2.n.x) return false;
-            if (v1.n.y < v2.n.y) return true;
-            else if (v1.n.y > v2.n.y) return false;
-            if (v1.n.z < v2.n.z) return true;
-            else if (v1.n.z > v2.n.z) return false;
-            if (v1.uv.x < v2.uv.x) return true;
-            else if (v1.uv.x > v2.uv.x) return false;
-            if (v1.uv.y < v2.uv.y) return true;
-            else if (v1.uv.y > v2.uv.y) return false;
-            return false;
+            return v1.p == v2.p && v1.n == v2.n && v1.uv == v2.uv;
         }
     };
 
@@ -615,8 +934,8 @@ public:
             std::vector<Vertex> &vertexBuffer) {
         if (triangles.size() == 0)
             return;
-        typedef std::map<Vertex, uint32_t, vertex_key_order> VertexMapType;
-        VertexMapType vertexMap;
+        typedef boost::unordered_map<Vertex, uint32_t, vertex_hash, vertex_equal> VertexMapType;
+        VertexMapType vertexMap(2 * std::min(vertices.size(), 3 * triangles.size()));
 
         vertexBuffer.reserve(vertices.size());
         size_t numMerged = 0;
@@ -670,13 +989,13 @@ public:
                     vertex.uv = Point2(0.0f);
                 }
 
-                VertexMapType::iterator it = vertexMap.find(vertex);
-                if (it != vertexMap.end()) {
-                    key = it->second;
+                std::pair<VertexMapType::iterator, bool> result = vertexMap.insert(
+                    std::make_pair(vertex, (uint32_t) vertexBuffer.size()));
+                if (!result.second) {
+                    key = result.first->second;
                     numMerged++;
                 } else {
-                    key = (uint32_t) vertexBuffer.size();
-                    vertexMap[vertex] = key;
+                    key = result.first->second;
                     vertexBuffer.push_back(vertex);
                 }
 
@@ -725,6 +1044,10 @@ public:
         m_aabb.reset();
         for (size_t i=0; i<m_meshes.size(); ++i) {
             m_meshes[i]->configure();
+            if (m_precomputeCurvature)
+                m_meshes[i]->computeVertexCurvatures();
+            if (m_compact)
+                m_meshes[i]->compact();
             m_aabb.expandBy(m_meshes[i]->getAABB());
         }
     }
@@ -836,6 +1159,8 @@ private:
     bool m_flipNormals, m_faceNormals;
     AABB m_aabb;
     bool m_collapse;
+    bool m_compact;
+    bool m_precomputeCurvature;
 };
 
 MTS_IMPLEMENT_CLASS_S(WavefrontOBJ, false, Shape)
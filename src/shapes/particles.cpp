@@ -0,0 +1,765 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/shape.h>
+#include <mitsuba/render/bsdf.h>
+#include <mitsuba/render/emitter.h>
+#include <mitsuba/render/sensor.h>
+#include <mitsuba/render/subsurface.h>
+#include <mitsuba/render/medium.h>
+#include <mitsuba/core/properties.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/timer.h>
+#include <boost/algorithm/string.hpp>
+#if defined(MTS_SSE)
+#include <mitsuba/core/sse.h>
+#endif
+
+/// Compile-time limit of the hierarchy depth (sizes the traversal stack)
+#define MTS_PARTICLES_MAXDEPTH 64
+
+MTS_NAMESPACE_BEGIN
+
+/* Build parameters: particles per leaf (one SSE packet), number of SAH
+   bins, and the depth beyond which nodes are split at the median */
+static const size_t particleLeafSize = 4;
+static const int particleBinCount = 16;
+static const int particleMedianSplitDepth = MTS_PARTICLES_MAXDEPTH / 2;
+
+/// Number of particles that are converted at a time while loading
+static const size_t particleChunkSize = 65536;
+
+/*!\plugin{particles}{Particle cloud}
+ * \order{12}
+ * \parameters{
+ *     \parameter{filename}{\String}{
+ *       Filename of the particle data file that should be loaded
+ *     }
+ *     \parameter{radius}{\Float}{
+ *       When specified, all particles use this radius, and the file
+ *       does not contain a radius column \default{use the radius column}
+ *     }
+ *     \parameter{columns}{\Integer}{
+ *       Number of values per particle in raw binary files. Ignored
+ *       for \code{.npy} files. \default{4}
+ *     }
+ *     \parameter{color}{\String}{
+ *       Specifies what is exposed through the \pluginref{vertexcolors}
+ *       texture: \code{attributes} uses the attribute columns, \code{radius}
+ *       uses the particle radius, and \code{none} disables the lookup.
+ *       \default{\code{attributes} if the file contains any, else \code{none}}
+ *     }
+ *     \parameter{toWorld}{\Transform}{
+ *        Specifies an optional linear object-to-world transformation.
+ *        Note that non-uniform scales are not permitted!
+ *        \default{none, i.e. object space $=$ world space}
+ *     }
+ * }
+ *
+ * This plugin renders large numbers of spheres, such as the grains of a
+ * granular medium or the droplets of a spray, using a single shape. Compared
+ * to instantiating the \pluginref{sphere} plugin for every particle, it stores
+ * the particles compactly (16 bytes each, or 12 with a shared radius) and
+ * traces rays against them using a dedicated bounding volume hierarchy,
+ * whose leaves are intersected four spheres at a time.
+ *
+ * Each particle is a row of values: the $x$, $y$ and $z$ coordinates of its
+ * center, its radius (unless the \code{radius} parameter is given), and
+ * optionally one or three attribute values. Two file formats are supported:
+ * NumPy arrays (\code{.npy}) of shape $N\times\mathrm{columns}$ containing
+ * single or double precision values in little-endian byte order, and raw
+ * files without a header, which contain $N\cdot\mathrm{columns}$
+ * single precision values in little-endian byte order.
+ *
+ * Textures of the attached BSDF can look up the per-particle attributes
+ * or radius using the \pluginref{vertexcolors} texture:
+ * \begin{xml}[caption=A spray of droplets with per-particle colors]
+ * <shape type="particles">
+ *     <!-- Array of shape (N, 7): position, radius and RGB color -->
+ *     <string name="filename" value="spray.npy"/>
+ *
+ *     <bsdf type="roughplastic">
+ *         <texture type="vertexcolors" name="diffuseReflectance"/>
+ *     </bsdf>
+ * </shape>
+ * \end{xml}
+ */
+class ParticleCloud : public Shape {
+public:
+    /// What is exposed to textures through \ref Intersection::color
+    enum EColorSource {
+        ENoColor = 0,
+        EAttributeColor,
+        ERadiusColor
+    };
+
+    ParticleCloud(const Properties &props) : Shape(props) {
+        FileResolver *fileResolver = Thread::getThread()->getFileResolver();
+        fs::path path = fileResolver->resolve(props.getString("filename"));
+        m_name = path.filename().string();
+
+        m_uniformRadius = (float) props.getFloat("radius", 0.0f);
+        if (props.hasProperty("radius") && m_uniformRadius <= 0)
+            Log(EError, "The particle radius must be positive!");
+
+        Transform trafo = props.getTransform("toWorld", Transform());
+        Float scale = trafo(Vector(1, 0, 0)).length();
+        if (std::abs(trafo(Vector(0, 1, 0)).length() - scale) > 1e-4f * scale ||
+            std::abs(trafo(Vector(0, 0, 1)).length() - scale) > 1e-4f * scale)
+            Log(EError, "Non-uniform scales are not permitted!");
+
+        load(path, props.getInteger("columns", 4), trafo, scale);
+
+        std::string color = boost::to_lower_copy(props.getString("color",
+            m_attributeCount > 0 ? "attributes" : "none"));
+        if (color == "none") {
+            m_colorSource = ENoColor;
+        } else if (color == "attributes") {
+            if (m_attributeCount == 0)
+                Log(EError, "\"%s\" does not contain any attributes!", m_name.c_str());
+            m_colorSource = EAttributeColor;
+        } else if (color == "radius") {
+            m_colorSource = ERadiusColor;
+        } else {
+            Log(EError, "Unknown color source \"%s\", must be one of "
+                "\"none\", \"attributes\" or \"radius\"", color.c_str());
+        }
+
+        build();
+    }
+
+    ParticleCloud(Stream *stream, InstanceManager *manager)
+            : Shape(stream, manager) {
+        m_name = stream->readString();
+        m_count = stream->readSize();
+        m_uniformRadius = stream->readSingle();
+        bool hasRadius = stream->readBool();
+        m_attributeCount = stream->readUInt();
+        m_colorSource = (EColorSource) stream->readUInt();
+
+        readArray(stream, m_x, m_count);
+        readArray(stream, m_y, m_count);
+        readArray(stream, m_z, m_count);
+        if (hasRadius)
+            readArray(stream, m_radius, m_count);
+        for (uint32_t i=0; i<m_attributeCount; ++i)
+            readArray(stream, m_attributes[i], m_count);
+
+        build();
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Shape::serialize(stream, manager);
+
+        stream->writeString(m_name);
+        stream->writeSize(m_count);
+        stream->writeSingle(m_uniformRadius);
+        stream->writeBool(!m_radius.empty());
+        stream->writeUInt(m_attributeCount);
+        stream->writeUInt(m_colorSource);
+
+        if (m_count == 0)
+            return;
+        stream->writeSingleArray(&m_x[0], m_count);
+        stream->writeSingleArray(&m_y[0], m_count);
+        stream->writeSingleArray(&m_z[0], m_count);
+        if (!m_radius.empty())
+            stream->writeSingleArray(&m_radius[0], m_count);
+        for (uint32_t i=0; i<m_attributeCount; ++i)
+            stream->writeSingleArray(&m_attributes[i][0], m_count);
+    }
+
+    bool rayIntersect(const Ray &ray, Float mint, Float maxt, Float &t, void *temp) const {
+        return rayIntersectInternal<false>(ray, mint, maxt, t,
+            static_cast<uint32_t *>(temp));
+    }
+
+    bool rayIntersect(const Ray &ray, Float mint, Float maxt) const {
+        Float t;
+        return rayIntersectInternal<true>(ray, mint, maxt, t, NULL);
+    }
+
+    void fillIntersectionRecord(const Ray &ray,
+            const void *temp, Intersection &its) const {
+        uint32_t index = *static_cast<const uint32_t *>(temp);
+        Point center(m_x[index], m_y[index], m_z[index]);
+        Float radius = getRadius(index);
+
+        /* Re-project onto the sphere to limit cancellation effects */
+        Vector local = normalize(ray(its.t) - center);
+        its.p = center + local * radius;
+
+        Float theta = math::safe_acos(local.z);
+        Float phi = std::atan2(local.y, local.x);
+        if (phi < 0)
+            phi += 2*M_PI;
+
+        its.uv.x = phi * (0.5f * INV_PI);
+        its.uv.y = theta * INV_PI;
+        its.dpdu = Vector(-local.y, local.x, 0) * (2*M_PI*radius);
+        its.geoFrame.n = Normal(local);
+        Float zrad = std::sqrt(local.x*local.x + local.y*local.y);
+
+        if (zrad > 0) {
+            Float invZRad = 1.0f / zrad,
+                  cosPhi = local.x * invZRad,
+                  sinPhi = local.y * invZRad;
+            its.dpdv = Vector(local.z * cosPhi, local.z * sinPhi, -zrad) * (M_PI*radius);
+            its.geoFrame.s = normalize(its.dpdu);
+            its.geoFrame.t = normalize(its.dpdv);
+        } else {
+            // avoid a singularity
+            its.dpdv = Vector(0, local.z, 0) * (M_PI*radius);
+            coordinateSystem(its.geoFrame.n, its.geoFrame.s, its.geoFrame.t);
+        }
+
+        switch (m_colorSource) {
+            case EAttributeColor:
+                if (m_attributeCount == 1)
+                    its.color = Spectrum((Float) m_attributes[0][index]);
+                else
+                    its.color.fromLinearRGB(m_attributes[0][index],
+                        m_attributes[1][index], m_attributes[2][index]);
+                break;
+            case ERadiusColor:
+                its.color = Spectrum(radius);
+                break;
+            default:
+                break;
+        }
+
+        its.shape = this;
+        its.shFrame = its.geoFrame;
+        its.primIndex = index;
+        its.hasUVPartials = false;
+        its.instance = NULL;
+        its.time = ray.time;
+    }
+
+    AABB getAABB() const {
+        return m_aabb;
+    }
+
+    Float getSurfaceArea() const {
+        if (m_radius.empty())
+            return 4 * M_PI * m_uniformRadius * m_uniformRadius * m_count;
+        double area = 0;
+        for (size_t i=0; i<m_count; ++i)
+            area += (double) m_radius[i] * m_radius[i];
+        return (Float) (4 * M_PI * area);
+    }
+
+    size_t getPrimitiveCount() const {
+        return m_count;
+    }
+
+    size_t getEffectivePrimitiveCount() const {
+        return m_count;
+    }
+
+    std::string getName() const {
+        return m_name;
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "ParticleCloud[" << endl
+            << "  name = \"" << m_name << "\"," << endl
+            << "  particleCount = " << m_count << "," << endl
+            << "  radius = ";
+        if (m_radius.empty())
+            oss << m_uniformRadius;
+        else
+            oss << "per-particle";
+        oss << "," << endl
+            << "  attributeCount = " << m_attributeCount << "," << endl
+            << "  nodeCount = " << m_nodes.size() << "," << endl
+            << "  aabb = " << m_aabb.toString() << "," << endl
+            << "  bsdf = " << indent(m_bsdf.toString()) << "," << endl;
+        if (isMediumTransition())
+            oss << "  interiorMedium = " << indent(m_interiorMedium.toString()) << "," << endl
+                << "  exteriorMedium = " << indent(m_exteriorMedium.toString()) << "," << endl;
+        oss << "  emitter = " << indent(m_emitter.toString()) << "," << endl
+            << "  sensor = " << indent(m_sensor.toString()) << "," << endl
+            << "  subsurface = " << indent(m_subsurface.toString()) << endl
+            << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    /// Interior or leaf node of the hierarchy in 32 bytes
+    struct Node {
+        float min[3], max[3];
+        /// Leaf: first particle, interior: index of the right child
+        uint32_t offset;
+        /// Number of particles, zero for interior nodes
+        uint16_t count;
+        /// Split axis of interior nodes
+        uint16_t axis;
+    };
+
+    inline Float getRadius(uint32_t index) const {
+        return m_radius.empty() ? m_uniformRadius : m_radius[index];
+    }
+
+    inline Float getCenter(uint32_t index, int axis) const {
+        return axis == 0 ? m_x[index] : (axis == 1 ? m_y[index] : m_z[index]);
+    }
+
+    static void readArray(Stream *stream, std::vector<float> &array, size_t count) {
+        array.resize(count);
+        if (count > 0)
+            stream->readSingleArray(&array[0], count);
+    }
+
+    /// Parse the header of a NumPy array file and return the column count
+    static size_t readNumPyHeader(Stream *stream, const std::string &name,
+            size_t &rows, bool &doublePrecision) {
+        char magic[6];
+        stream->read(magic, 6);
+        if (memcmp(magic, "\x93NUMPY", 6) != 0)
+            SLog(EError, "\"%s\" is not a NumPy array file!", name.c_str());
+        uint8_t major = stream->readUChar();
+        stream->readUChar();
+        size_t headerLength = major == 1 ? (size_t) stream->readUShort()
+                                         : (size_t) stream->readUInt();
+        std::string header(headerLength, '\0');
+        stream->read(&header[0], headerLength);
+        header.erase(std::remove(header.begin(), header.end(), ' '), header.end());
+
+        size_t descrPos = header.find("'descr':'");
+        std::string descr = descrPos == std::string::npos ? "" :
+            header.substr(descrPos + 9, header.find('\'', descrPos + 9) - descrPos - 9);
+        if (descr == "<f4")
+            doublePrecision = false;
+        else if (descr == "<f8")
+            doublePrecision = true;
+        else
+            SLog(EError, "\"%s\": unsupported data type \"%s\", expected "
+                "little-endian float32 or float64 values!", name.c_str(), descr.c_str());
+
+        if (header.find("'fortran_order':False") == std::string::npos)
+            SLog(EError, "\"%s\": arrays in Fortran order are not supported!", name.c_str());
+
+        size_t shapePos = header.find("'shape':(");
+        std::vector<std::string> shape;
+        if (shapePos != std::string::npos)
+            shape = tokenize(header.substr(shapePos + 9,
+                header.find(')', shapePos) - shapePos - 9), ",");
+        if (shape.size() != 2)
+            SLog(EError, "\"%s\": expected a two-dimensional array of shape "
+                "(particles, columns)!", name.c_str());
+        rows = (size_t) std::strtoull(shape[0].c_str(), NULL, 10);
+        return (size_t) std::strtoull(shape[1].c_str(), NULL, 10);
+    }
+
+    /// Load the particles into the structure-of-arrays storage
+    void load(const fs::path &path, int rawColumns, const Transform &trafo, Float scale) {
+        ref<FileStream> stream = new FileStream(path, FileStream::EReadOnly);
+        stream->setByteOrder(Stream::ELittleEndian);
+        ref<Timer> timer = new Timer();
+
+        size_t rows, columns;
+        bool doublePrecision = false;
+        if (boost::to_lower_copy(path.extension().string()) == ".npy") {
+            columns = readNumPyHeader(stream, m_name, rows, doublePrecision);
+        } else {
+            if (rawColumns <= 0)
+                Log(EError, "The column count must be positive!");
+            columns = (size_t) rawColumns;
+            size_t rowSize = columns * sizeof(float);
+            if (stream->getSize() % rowSize != 0)
+                Log(EError, "\"%s\": the file size is not a multiple of %i "
+                    "columns of single precision values!", m_name.c_str(), rawColumns);
+            rows = stream->getSize() / rowSize;
+        }
+
+        bool hasRadius = m_uniformRadius == 0;
+        size_t firstAttribute = hasRadius ? 4 : 3;
+        if (columns < firstAttribute)
+            Log(EError, "\"%s\": expected at least %i columns (position%s), got "
+                SIZE_T_FMT "!", m_name.c_str(), (int) firstAttribute,
+                hasRadius ? " and radius" : "", columns);
+        size_t attributeColumns = columns - firstAttribute;
+        m_attributeCount = attributeColumns >= 3 ? 3 : (attributeColumns > 0 ? 1 : 0);
+        if (attributeColumns != m_attributeCount)
+            Log(EWarn, "\"%s\": ignoring " SIZE_T_FMT " of " SIZE_T_FMT " attribute "
+                "columns (only 1 or 3 are supported)", m_name.c_str(),
+                attributeColumns - m_attributeCount, attributeColumns);
+        if (rows > (size_t) std::numeric_limits<int32_t>::max())
+            Log(EError, "\"%s\": too many particles!", m_name.c_str());
+
+        Log(EInfo, "Loading " SIZE_T_FMT " particles from \"%s\" ..", rows, m_name.c_str());
+        m_x.reserve(rows + particleLeafSize - 1);
+        m_y.reserve(rows + particleLeafSize - 1);
+        m_z.reserve(rows + particleLeafSize - 1);
+        if (hasRadius)
+            m_radius.reserve(rows + particleLeafSize - 1);
+        for (uint32_t i=0; i<m_attributeCount; ++i)
+            m_attributes[i].reserve(rows);
+
+        std::vector<float> singleBuffer;
+        std::vector<double> doubleBuffer;
+        std::vector<Float> values;
+        size_t nSkipped = 0;
+        for (size_t row=0; row<rows; row += particleChunkSize) {
+            size_t chunkRows = std::min(particleChunkSize, rows - row),
+                   valueCount = chunkRows * columns;
+            values.resize(valueCount);
+            if (doublePrecision) {
+                doubleBuffer.resize(valueCount);
+                stream->readDoubleArray(&doubleBuffer[0], valueCount);
+                std::copy(doubleBuffer.begin(), doubleBuffer.end(), values.begin());
+            } else {
+                singleBuffer.resize(valueCount);
+                stream->readSingleArray(&singleBuffer[0], valueCount);
+                std::copy(singleBuffer.begin(), singleBuffer.end(), values.begin());
+            }
+
+            for (size_t i=0; i<chunkRows; ++i) {
+                const Float *v = &values[i * columns];
+                Point p = trafo(Point(v[0], v[1], v[2]));
+                Float radius = hasRadius ? v[3] * scale : 0;
+                if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)
+                        || (hasRadius && !(radius > 0 && std::isfinite(radius)))) {
+                    ++nSkipped;
+                    continue;
+                }
+                m_x.push_back((float) p.x);
+                m_y.push_back((float) p.y);
+                m_z.push_back((float) p.z);
+                if (hasRadius)
+                    m_radius.push_back((float) radius);
+                for (uint32_t j=0; j<m_attributeCount; ++j)
+                    m_attributes[j].push_back((float) v[firstAttribute + j]);
+            }
+        }
+        if (!hasRadius)
+            m_uniformRadius = (float) (m_uniformRadius * scale);
+
+        m_count = m_x.size();
+        if (nSkipped > 0)
+            Log(EWarn, "\"%s\": skipped " SIZE_T_FMT " particles with an invalid "
+                "position or radius", m_name.c_str(), nSkipped);
+        Log(EInfo, "Done (took %i ms, %s)", timer->getMilliseconds(),
+            memString(m_count * (sizeof(float) * (hasRadius ? 4 : 3)
+                + m_attributeCount * sizeof(float))).c_str());
+    }
+
+    /**
+     * \brief Build the hierarchy and reorder the particles, so that
+     * every leaf references a contiguous range of them
+     */
+    void build() {
+        ref<Timer> timer = new Timer();
+        m_nodes.clear();
+        m_aabb.reset();
+
+        /* Drop the padding of unserialized or previously built data */
+        m_x.resize(m_count);
+        m_y.resize(m_count);
+        m_z.resize(m_count);
+        if (!m_radius.empty())
+            m_radius.resize(m_count);
+
+        if (m_count == 0) {
+            Log(EWarn, "\"%s\" does not contain any particles!", m_name.c_str());
+            return;
+        }
+
+        std::vector<uint32_t> indices(m_count);
+        for (size_t i=0; i<m_count; ++i)
+            indices[i] = (uint32_t) i;
+        m_nodes.reserve(2 * m_count / particleLeafSize + 1);
+        buildRecursive(indices, 0, m_count, 0);
+        std::vector<Node>(m_nodes).swap(m_nodes);
+        m_aabb = AABB(Point(m_nodes[0].min[0], m_nodes[0].min[1], m_nodes[0].min[2]),
+                      Point(m_nodes[0].max[0], m_nodes[0].max[1], m_nodes[0].max[2]));
+
+        permute(m_x, indices);
+        permute(m_y, indices);
+        permute(m_z, indices);
+        if (!m_radius.empty())
+            permute(m_radius, indices);
+        for (uint32_t i=0; i<m_attributeCount; ++i)
+            permute(m_attributes[i], indices);
+
+        /* Pad the arrays, so that a leaf can always be loaded as one packet */
+        m_x.resize(m_count + particleLeafSize - 1, 0.0f);
+        m_y.resize(m_count + particleLeafSize - 1, 0.0f);
+        m_z.resize(m_count + particleLeafSize - 1, 0.0f);
+        if (!m_radius.empty())
+            m_radius.resize(m_count + particleLeafSize - 1, 0.0f);
+
+        Log(EDebug, "Built a BVH over " SIZE_T_FMT " particles in %i ms ("
+            SIZE_T_FMT " nodes, %s)", m_count, timer->getMilliseconds(),
+            m_nodes.size(), memString(m_nodes.size() * sizeof(Node)).c_str());
+    }
+
+    static void permute(std::vector<float> &array, const std::vector<uint32_t> &indices) {
+        std::vector<float> result(indices.size());
+        for (size_t i=0; i<indices.size(); ++i)
+            result[i] = array[indices[i]];
+        array.swap(result);
+    }
+
+    /// Recursively build the subtree over a range of particles
+    void buildRecursive(std::vector<uint32_t> &indices,
+            size_t begin, size_t end, int depth) {
+        size_t nodeIndex = m_nodes.size();
+        m_nodes.push_back(Node());
+        size_t count = end - begin;
+
+        AABB aabb, centroidAABB;
+        aabb.reset();
+        centroidAABB.reset();
+        for (size_t i=begin; i<end; ++i) {
+            uint32_t index = indices[i];
+            Point center(m_x[index], m_y[index], m_z[index]);
+            Vector extent(getRadius(index));
+            aabb.expandBy(center - extent);
+            aabb.expandBy(center + extent);
+            centroidAABB.expandBy(center);
+        }
+
+        /* Round outwards, since the bounds are stored in single precision */
+        Node &node = m_nodes[nodeIndex];
+        for (int i=0; i<3; ++i) {
+            node.min[i] = std::nextafter((float) aabb.min[i], -std::numeric_limits<float>::infinity());
+            node.max[i] = std::nextafter((float) aabb.max[i], std::numeric_limits<float>::infinity());
+        }
+
+        if (count <= particleLeafSize) {
+            node.offset = (uint32_t) begin;
+            node.count = (uint16_t) count;
+            node.axis = 0;
+            return;
+        }
+
+        int axis = centroidAABB.getLargestAxis();
+        Float minValue = centroidAABB.min[axis],
+              extent = centroidAABB.max[axis] - minValue;
+        size_t mid = begin;
+
+        if (extent > 0 && depth < particleMedianSplitDepth) {
+            /* Binned SAH split along the largest centroid extent */
+            size_t binCounts[particleBinCount];
+            AABB binAABBs[particleBinCount];
+            for (int i=0; i<particleBinCount; ++i) {
+                binCounts[i] = 0;
+                binAABBs[i].reset();
+            }
+            Float scale = particleBinCount / extent;
+            for (size_t i=begin; i<end; ++i) {
+                uint32_t index = indices[i];
+                int bin = std::min(particleBinCount - 1,
+                    (int) ((getCenter(index, axis) - minValue) * scale));
+                Point center(m_x[index], m_y[index], m_z[index]);
+                Vector radius(getRadius(index));
+                binCounts[bin]++;
+                binAABBs[bin].expandBy(center - radius);
+                binAABBs[bin].expandBy(center + radius);
+            }
+
+            Float rightAreas[particleBinCount];
+            size_t rightCounts[particleBinCount];
+            AABB rightAABB;
+            rightAABB.reset();
+            size_t rightCount = 0;
+            for (int i=particleBinCount-1; i>0; --i) {
+                rightAABB.expandBy(binAABBs[i]);
+                rightCount += binCounts[i];
+                rightAreas[i] = rightAABB.isValid() ? rightAABB.getSurfaceArea() : 0;
+                rightCounts[i] = rightCount;
+            }
+
+            AABB leftAABB;
+            leftAABB.reset();
+            size_t leftCount = 0;
+            int bestSplit = -1;
+            Float bestCost = std::numeric_limits<Float>::infinity();
+            for (int i=1; i<particleBinCount; ++i) {
+                leftAABB.expandBy(binAABBs[i-1]);
+                leftCount += binCounts[i-1];
+                if (leftCount == 0 || rightCounts[i] == 0)
+                    continue;
+                Float cost = leftAABB.getSurfaceArea() * leftCount
+                    + rightAreas[i] * rightCounts[i];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestSplit = i;
+                }
+            }
+
+            if (bestSplit >= 0) {
+                mid = std::partition(indices.begin() + begin, indices.begin() + end,
+                    [&](uint32_t index) {
+                        return std::min(particleBinCount - 1, (int) ((getCenter(index, axis)
+                            - minValue) * scale)) < bestSplit;
+                    }) - indices.begin();
+            }
+        }
+
+        if (mid == begin || mid == end) {
+            /* No useful SAH split: fall back to the centroid median */
+            mid = begin + count / 2;
+            std::nth_element(indices.begin() + begin, indices.begin() + mid,
+                indices.begin() + end, [&](uint32_t a, uint32_t b) {
+                    return getCenter(a, axis) < getCenter(b, axis);
+                });
+        }
+
+        m_nodes[nodeIndex].count = 0;
+        m_nodes[nodeIndex].axis = (uint16_t) axis;
+        buildRecursive(indices, begin, mid, depth + 1);
+        m_nodes[nodeIndex].offset = (uint32_t) m_nodes.size();
+        buildRecursive(indices, mid, end, depth + 1);
+    }
+
+    template <bool shadowRay> bool rayIntersectInternal(const Ray &ray,
+            Float mint, Float maxt, Float &t, uint32_t *index) const {
+        if (m_nodes.empty())
+            return false;
+
+        const Float invA = 1.0f / ray.d.lengthSquared();
+        uint32_t stack[MTS_PARTICLES_MAXDEPTH];
+        int stackPtr = 0;
+        uint32_t nodeIndex = 0;
+        bool foundIntersection = false;
+
+#if defined(MTS_SSE)
+        const __m128
+            ox = _mm_set1_ps(ray.o.x), oy = _mm_set1_ps(ray.o.y), oz = _mm_set1_ps(ray.o.z),
+            dx = _mm_set1_ps(ray.d.x), dy = _mm_set1_ps(ray.d.y), dz = _mm_set1_ps(ray.d.z),
+            invA4 = _mm_set1_ps(invA), uniformR = _mm_set1_ps(m_uniformRadius),
+            zero = _mm_setzero_ps(), mint4 = _mm_set1_ps(mint);
+        const __m128i lanes = _mm_set_epi32(3, 2, 1, 0);
+        const bool hasRadius = !m_radius.empty();
+#endif
+
+        while (true) {
+            const Node &node = m_nodes[nodeIndex];
+
+            /* Slab test against the node bounds */
+            Float nearT = mint, farT = maxt;
+            for (int i=0; i<3; ++i) {
+                Float t0 = (node.min[i] - ray.o[i]) * ray.dRcp[i],
+                      t1 = (node.max[i] - ray.o[i]) * ray.dRcp[i];
+                if (t0 > t1)
+                    std::swap(t0, t1);
+                nearT = t0 > nearT ? t0 : nearT;
+                farT = t1 < farT ? t1 : farT;
+            }
+
+            if (nearT <= farT) {
+                if (node.count == 0) {
+                    /* Visit the near child first */
+                    uint32_t left = nodeIndex + 1, right = node.offset;
+                    if (ray.d[node.axis] < 0)
+                        std::swap(left, right);
+                    stack[stackPtr++] = right;
+                    nodeIndex = left;
+                    continue;
+                }
+
+#if defined(MTS_SSE)
+                /* Intersect all spheres of the leaf at once. The roots are
+                   computed relative to the point of closest approach, which
+                   avoids cancellation for distant ray origins */
+                const uint32_t offset = node.offset;
+                __m128
+                    ocx = _mm_sub_ps(ox, _mm_loadu_ps(&m_x[offset])),
+                    ocy = _mm_sub_ps(oy, _mm_loadu_ps(&m_y[offset])),
+                    ocz = _mm_sub_ps(oz, _mm_loadu_ps(&m_z[offset])),
+                    r = hasRadius ? _mm_loadu_ps(&m_radius[offset]) : uniformR,
+                    tc = _mm_mul_ps(_mm_sub_ps(zero, _mm_add_ps(_mm_add_ps(
+                        _mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz))), invA4),
+                    lx = _mm_add_ps(ocx, _mm_mul_ps(tc, dx)),
+                    ly = _mm_add_ps(ocy, _mm_mul_ps(tc, dy)),
+                    lz = _mm_add_ps(ocz, _mm_mul_ps(tc, dz)),
+                    disc = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(r, r), _mm_add_ps(_mm_add_ps(
+                        _mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz))), invA4),
+                    sq = _mm_sqrt_ps(_mm_max_ps(disc, zero)),
+                    tn = _mm_sub_ps(tc, sq),
+                    tf = _mm_add_ps(tc, sq),
+                    th = mux_ps(_mm_cmpge_ps(tn, mint4), tn, tf),
+                    mask = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(disc, zero),
+                        epi32tops(_mm_cmplt_epi32(lanes, _mm_set1_epi32(node.count)))),
+                        _mm_and_ps(_mm_cmpge_ps(th, mint4),
+                        _mm_cmple_ps(th, _mm_set1_ps(maxt))));
+
+                int hits = _mm_movemask_ps(mask);
+                if (hits) {
+                    if (shadowRay)
+                        return true;
+                    SSEVector thv(th);
+                    for (int i=0; i<4; ++i) {
+                        if ((hits & (1 << i)) && thv.f[i] <= maxt) {
+                            maxt = t = thv.f[i];
+                            *index = offset + i;
+                        }
+                    }
+                    foundIntersection = true;
+                }
+#else
+                for (uint32_t i=node.offset; i<node.offset + node.count; ++i) {
+                    Vector oc = ray.o - Point(m_x[i], m_y[i], m_z[i]);
+                    Float r = getRadius(i),
+                          tc = -dot(oc, ray.d) * invA,
+                          disc = (r*r - (oc + ray.d * tc).lengthSquared()) * invA;
+                    if (disc < 0)
+                        continue;
+                    Float sq = std::sqrt(disc),
+                          tHit = tc - sq >= mint ? tc - sq : tc + sq;
+                    if (tHit < mint || tHit > maxt)
+                        continue;
+                    if (shadowRay)
+                        return true;
+                    maxt = t = tHit;
+                    *index = i;
+                    foundIntersection = true;
+                }
+#endif
+            }
+
+            if (stackPtr == 0)
+                break;
+            nodeIndex = stack[--stackPtr];
+        }
+
+        return foundIntersection;
+    }
+private:
+    std::string m_name;
+    size_t m_count;
+    /* Particle centers and radii in structure-of-arrays layout. The
+       radius array is empty when all particles share a radius */
+    std::vector<float> m_x, m_y, m_z, m_radius;
+    std::vector<float> m_attributes[3];
+    uint32_t m_attributeCount;
+    float m_uniformRadius;
+    EColorSource m_colorSource;
+    std::vector<Node> m_nodes;
+    AABB m_aabb;
+};
+
+MTS_IMPLEMENT_CLASS_S(ParticleCloud, false, Shape)
+MTS_EXPORT_PLUGIN(ParticleCloud, "Particle cloud");
+MTS_NAMESPACE_END
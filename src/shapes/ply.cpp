@@ -21,8 +21,13 @@
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/mmap.h>
 #include <ply/ply_parser.hpp>
 #include <functional>
+#include <sstream>
+
+/// Number of faces per block when loading binary files in parallel
+#define MTS_PLY_BLOCK_SIZE 65536
 
 MTS_NAMESPACE_BEGIN
 
@@ -45,6 +50,15 @@ MTS_NAMESPACE_BEGIN
  *       Optional flag to flip all normals. \default{\code{false}, i.e.
  *       the normals are left unchanged}.
  *     }
+ *     \parameter{compact}{\Boolean}{
+ *       Store normals, texture coordinates and indices at reduced precision
+ *       to save memory (see \code{TriMesh::compact()}) \default{\code{false}}
+ *     }
+ *     \parameter{precomputeCurvature}{\Boolean}{
+ *       Estimate the mean and Gaussian curvature at every vertex while
+ *       loading, which speeds up the \pluginref{curvature} texture
+ *       \default{\code{false}}
+ *     }
  *     \parameter{toWorld}{\Transform\Or\Animation}{
  *        Specifies an optional linear object-to-world transformation.
  *        \default{none (i.e. object space $=$ world space)}
@@ -66,6 +80,11 @@ MTS_NAMESPACE_BEGIN
  * The current plugin implementation supports triangle meshes with optional
  * UV coordinates, vertex normals, and vertex colors.
  *
+ * Binary files with a common layout (single precision vertex attributes,
+ * 8 bit or single precision colors and a single list of vertex indices per
+ * face) bypass \code{libply}: they are memory-mapped and decoded directly
+ * into the mesh arrays using multiple threads.
+ *
  * When loading meshes that contain vertex colors, note that they need to be
  * explicitly referenced in a BSDF using a special texture named
  * \pluginref{vertexcolors}.
@@ -96,7 +115,8 @@ public:
         m_hasNormals = false;
         m_hasTexCoords = false;
         memset(&m_face, 0, sizeof(uint32_t)*4);
-        loadPLY(filePath);
+        if (!loadBinaryPLY(filePath))
+            loadPLY(filePath);
 
         if (m_triangleCount == 0 || m_vertexCount == 0)
             Log(EError, "Unable to load \"%s\" (no triangles or vertices found)!");
@@ -110,14 +130,6 @@ public:
                 "can't be specified at the same time!");
             rebuildTopology(props.getFloat("maxSmoothAngle"));
         }
-
-        if (m_triangleCount < m_faceCount * 2) {
-            /* Needed less memory than the earlier conservative estimate -- free it! */
-            Triangle *temp = new Triangle[m_triangleCount];
-            memcpy(temp, m_triangles, sizeof(Triangle) * m_triangleCount);
-            delete[] m_triangles;
-            m_triangles = temp;
-        }
     }
 
 
@@ -125,6 +137,13 @@ public:
 
     void loadPLY(const fs::path &path);
 
+    /**
+     * \brief Directly decode a binary PLY file with a common layout
+     *
+     * Returns \c false if the file should be loaded using libply instead.
+     */
+    bool loadBinaryPLY(const fs::path &path);
+
     void info_callback(const std::string& filename, std::size_t line_number,
             const std::string& message) {
         Log(EInfo, "\"%s\" [line %i] info: %s", filename.c_str(), line_number,
@@ -478,6 +497,14 @@ void PLYLoader::loadPLY(const fs::path &path) {
     ref<Timer> timer = new Timer();
     ply_parser.parse(path.string());
 
+    if (m_triangleCount < m_faceCount * 2) {
+        /* Needed less memory than the earlier conservative estimate -- free it! */
+        Triangle *temp = new Triangle[m_triangleCount];
+        memcpy(temp, m_triangles, sizeof(Triangle) * m_triangleCount);
+        delete[] m_triangles;
+        m_triangles = temp;
+    }
+
     size_t vertexSize = sizeof(Point);
     if (m_normals)
         vertexSize += sizeof(Normal);
@@ -492,6 +519,340 @@ void PLYLoader::loadPLY(const fs::path &path) {
             timer->getMilliseconds());
 }
 
+namespace {
+    /// Size of a PLY scalar type in bytes (0 if unknown)
+    size_t plyTypeSize(const std::string &type) {
+        if (type == "char" || type == "uchar" || type == "int8" || type == "uint8")
+            return 1;
+        else if (type == "short" || type == "ushort" || type == "int16" || type == "uint16")
+            return 2;
+        else if (type == "int" || type == "uint" || type == "int32" || type == "uint32"
+                || type == "float" || type == "float32")
+            return 4;
+        else if (type == "double" || type == "float64")
+            return 8;
+        return 0;
+    }
+
+    template <typename T> inline T plyRead(const uint8_t *ptr, bool swap) {
+        T value;
+        memcpy(&value, ptr, sizeof(T));
+        return swap ? endianness_swap(value) : value;
+    }
+
+    inline uint32_t plyReadCount(const uint8_t *ptr, size_t size, bool swap) {
+        return size == 1 ? (uint32_t) *ptr : plyRead<uint32_t>(ptr, swap);
+    }
+
+    /// PLY element description needed by the direct loader
+    struct PLYElement {
+        std::string name;
+        size_t count, stride;
+        /// Byte offsets of named scalar properties within the element
+        std::map<std::string, std::pair<size_t, std::string> > props;
+        /// Face index list: offset within the element, count and index size
+        size_t listOffset, listCountSize, listIndexSize;
+        bool hasList;
+
+        PLYElement() : count(0), stride(0), listOffset(0),
+            listCountSize(0), listIndexSize(0), hasList(false) { }
+    };
+}
+
+bool PLYLoader::loadBinaryPLY(const fs::path &path) {
+    ref<Timer> timer = new Timer();
+    if (fs::file_size(path) == 0)
+        return false;
+    ref<MemoryMappedFile> mmap = new MemoryMappedFile(path);
+    const uint8_t *data = static_cast<const uint8_t *>(mmap->getData());
+    size_t size = mmap->getSize();
+
+    /* Parse the header */
+    const char *marker = "end_header";
+    const uint8_t *headerEnd = std::search(data, data + std::min(size, (size_t) 65536),
+        marker, marker + strlen(marker));
+    if (headerEnd == data + std::min(size, (size_t) 65536))
+        return false;
+    const uint8_t *body = static_cast<const uint8_t *>(
+        memchr(headerEnd, '\n', data + size - headerEnd));
+    if (!body)
+        return false;
+    body++;
+
+    std::istringstream header(std::string((const char *) data, (const char *) headerEnd));
+    std::string line, keyword;
+    std::vector<PLYElement> elements;
+    bool swap = false, magic = false;
+
+    while (std::getline(header, line)) {
+        std::istringstream iss(line);
+        if (!(iss >> keyword))
+            continue;
+        if (keyword == "ply") {
+            magic = true;
+        } else if (keyword == "format") {
+            std::string format;
+            iss >> format;
+            if (format == "binary_little_endian")
+                swap = Stream::getHostByteOrder() != Stream::ELittleEndian;
+            else if (format == "binary_big_endian")
+                swap = Stream::getHostByteOrder() != Stream::EBigEndian;
+            else
+                return false;
+        } else if (keyword == "element") {
+            PLYElement element;
+            iss >> element.name >> element.count;
+            if (element.name != "vertex" && element.name != "face")
+                return false;
+            elements.push_back(element);
+        } else if (keyword == "property") {
+            if (elements.empty())
+                return false;
+            PLYElement &element = elements.back();
+            std::string type, name;
+            iss >> type;
+            if (type == "list") {
+                std::string countType, indexType;
+                iss >> countType >> indexType >> name;
+                if (element.name != "face" || element.hasList ||
+                    (name != "vertex_indices" && name != "vertex_index"))
+                    return false;
+                element.listOffset = element.stride;
+                element.listCountSize = plyTypeSize(countType);
+                element.listIndexSize = plyTypeSize(indexType);
+                element.hasList = true;
+                if ((countType != "uchar" && countType != "uint8" &&
+                     countType != "uint" && countType != "uint32") ||
+                    (indexType != "int" && indexType != "int32" &&
+                     indexType != "uint" && indexType != "uint32"))
+                    return false;
+            } else {
+                iss >> name;
+                size_t typeSize = plyTypeSize(type);
+                if (typeSize == 0 || element.hasList)
+                    return false; /* Scalars after the list have no fixed offset */
+                element.props[name] = std::make_pair(element.stride, type);
+                element.stride += typeSize;
+            }
+        } else if (keyword != "comment" && keyword != "obj_info") {
+            return false;
+        }
+    }
+
+    const PLYElement *vertexElement = NULL, *faceElement = NULL;
+    for (size_t i=0; i<elements.size(); ++i) {
+        if (elements[i].name == "vertex")
+            vertexElement = &elements[i];
+        else
+            faceElement = &elements[i];
+    }
+    if (!magic || !vertexElement || !faceElement || !faceElement->hasList)
+        return false;
+
+    /* Locate the attributes of interest; give up on anything unusual */
+    const char *names[][3] = {
+        { "x", "x", "x" }, { "y", "y", "y" }, { "z", "z", "z" },
+        { "nx", "nx", "nx" }, { "ny", "ny", "ny" }, { "nz", "nz", "nz" },
+        { "u", "texture_u", "s" }, { "v", "texture_v", "t" },
+        { "red", "diffuse_red", "red" }, { "green", "diffuse_green", "green" },
+        { "blue", "diffuse_blue", "blue" }
+    };
+    const int attrCount = (int) (sizeof(names) / sizeof(names[0]));
+    int offsets[attrCount];
+    bool colorIsByte = false;
+    for (int i=0; i<attrCount; ++i) {
+        offsets[i] = -1;
+        for (int j=0; j<3; ++j) {
+            std::map<std::string, std::pair<size_t, std::string> >::const_iterator it =
+                vertexElement->props.find(names[i][j]);
+            if (it == vertexElement->props.end())
+                continue;
+            const std::string &type = it->second.second;
+            if (i >= 8 && (type == "uchar" || type == "uint8"))
+                colorIsByte = true;
+            else if (type != "float" && type != "float32")
+                return false;
+            offsets[i] = (int) it->second.first;
+            break;
+        }
+    }
+    bool hasNormals = offsets[3] >= 0, hasTexcoords = offsets[6] >= 0,
+         hasColors = offsets[8] >= 0;
+    if (offsets[0] < 0 || offsets[1] < 0 || offsets[2] < 0 ||
+        (hasNormals && (offsets[4] < 0 || offsets[5] < 0)) ||
+        (hasTexcoords && offsets[7] < 0) ||
+        (hasColors && (offsets[9] < 0 || offsets[10] < 0)))
+        return false;
+    if (hasColors) {
+        /* All three color channels must use the same type */
+        int colorSize = 0;
+        for (int i=8; i<11; ++i) {
+            for (int j=0; j<3; ++j) {
+                std::map<std::string, std::pair<size_t, std::string> >::const_iterator it =
+                    vertexElement->props.find(names[i][j]);
+                if (it != vertexElement->props.end()) {
+                    int s = (int) plyTypeSize(it->second.second);
+                    if (colorSize != 0 && colorSize != s)
+                        return false;
+                    colorSize = s;
+                    break;
+                }
+            }
+        }
+    }
+
+    /* Determine where the elements are, and where each block of faces starts */
+    const uint8_t *ptr = body, *end = data + size;
+    const uint8_t *vertexData = NULL;
+    std::vector<const uint8_t *> blockStart;
+    std::vector<size_t> blockTriangles;
+    size_t triangleCount = 0;
+
+    for (size_t i=0; i<elements.size(); ++i) {
+        const PLYElement &element = elements[i];
+        if (&element == vertexElement) {
+            if ((size_t) (end - ptr) < element.count * element.stride)
+                return false;
+            vertexData = ptr;
+            ptr += element.count * element.stride;
+            continue;
+        }
+
+        size_t headSize = element.listOffset + element.listCountSize;
+        for (size_t j=0; j<element.count; ++j) {
+            if (j % MTS_PLY_BLOCK_SIZE == 0) {
+                blockStart.push_back(ptr);
+                blockTriangles.push_back(triangleCount);
+            }
+            if ((size_t) (end - ptr) < headSize)
+                return false;
+            uint32_t count = plyReadCount(ptr + element.listOffset,
+                element.listCountSize, swap);
+            if (count != 3 && count != 4)
+                Log(EError, "Encountered a face with %i vertices! "
+                    "Only triangle and quad-based PLY meshes are supported for now.", count);
+            ptr += headSize + count * element.listIndexSize;
+            if (ptr > end)
+                return false;
+            triangleCount += count - 2;
+        }
+    }
+
+    m_vertexCount = vertexElement->count;
+    m_faceCount = faceElement->count;
+    m_triangleCount = triangleCount;
+    m_positions = new Point[m_vertexCount];
+    if (hasNormals)
+        m_normals = new Normal[m_vertexCount];
+    if (hasTexcoords)
+        m_texcoords = new Point2[m_vertexCount];
+    if (hasColors)
+        m_colors = new Color3[m_vertexCount];
+    m_triangles = new Triangle[m_triangleCount];
+
+    /* Decode the vertices */
+    const size_t stride = vertexElement->stride;
+    int blockCount = (int) ((m_vertexCount + MTS_PLY_BLOCK_SIZE - 1) / MTS_PLY_BLOCK_SIZE);
+    std::vector<AABB> blockAABB(blockCount);
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for
+    #endif
+    for (int block=0; block<blockCount; ++block) {
+        size_t start = (size_t) block * MTS_PLY_BLOCK_SIZE,
+               stop = std::min(start + MTS_PLY_BLOCK_SIZE, m_vertexCount);
+        AABB aabb;
+        for (size_t i=start; i<stop; ++i) {
+            const uint8_t *v = vertexData + i * stride;
+            Point p(plyRead<float>(v + offsets[0], swap),
+                    plyRead<float>(v + offsets[1], swap),
+                    plyRead<float>(v + offsets[2], swap));
+            p = m_objectToWorld(p);
+            aabb.expandBy(p);
+            m_positions[i] = p;
+
+            if (hasNormals)
+                m_normals[i] = normalize(m_objectToWorld(Normal(
+                    plyRead<float>(v + offsets[3], swap),
+                    plyRead<float>(v + offsets[4], swap),
+                    plyRead<float>(v + offsets[5], swap))));
+
+            if (hasTexcoords)
+                m_texcoords[i] = Point2(
+                    plyRead<float>(v + offsets[6], swap),
+                    plyRead<float>(v + offsets[7], swap));
+
+            if (hasColors) {
+                Float rgb[3];
+                for (int k=0; k<3; ++k)
+                    rgb[k] = colorIsByte ? v[offsets[8+k]] / 255.0f
+                        : (Float) plyRead<float>(v + offsets[8+k], swap);
+                if (m_sRGB)
+                    m_colors[i] = Color3(fromSRGBComponent(rgb[0]),
+                        fromSRGBComponent(rgb[1]), fromSRGBComponent(rgb[2]));
+                else
+                    m_colors[i] = Color3(rgb[0], rgb[1], rgb[2]);
+            }
+        }
+        blockAABB[block] = aabb;
+    }
+    for (int block=0; block<blockCount; ++block)
+        m_aabb.expandBy(blockAABB[block]);
+
+    /* Decode and triangulate the faces */
+    const size_t listOffset = faceElement->listOffset,
+                 countSize = faceElement->listCountSize,
+                 indexSize = faceElement->listIndexSize;
+    blockCount = (int) blockStart.size();
+    bool invalid = false;
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for reduction(||:invalid)
+    #endif
+    for (int block=0; block<blockCount; ++block) {
+        size_t start = (size_t) block * MTS_PLY_BLOCK_SIZE,
+               stop = std::min(start + MTS_PLY_BLOCK_SIZE, m_faceCount);
+        const uint8_t *f = blockStart[block];
+        Triangle *target = m_triangles + blockTriangles[block];
+
+        for (size_t i=start; i<stop; ++i) {
+            uint32_t count = plyReadCount(f + listOffset, countSize, swap);
+            const uint8_t *indices = f + listOffset + countSize;
+            uint32_t idx[4];
+            for (uint32_t k=0; k<count; ++k) {
+                idx[k] = plyRead<uint32_t>(indices + k * indexSize, swap);
+                invalid |= idx[k] >= m_vertexCount;
+            }
+            Triangle t;
+            t.idx[0] = idx[0]; t.idx[1] = idx[1]; t.idx[2] = idx[2];
+            *target++ = t;
+            if (count == 4) {
+                t.idx[0] = idx[3]; t.idx[1] = idx[0]; t.idx[2] = idx[2];
+                *target++ = t;
+            }
+            f = indices + count * indexSize;
+        }
+    }
+    if (invalid)
+        Log(EError, "\"%s\": encountered an out-of-bounds vertex index!", m_name.c_str());
+
+    m_vertexCtr = m_vertexCount;
+    m_faceCtr = m_faceCount;
+
+    size_t vertexSize = sizeof(Point);
+    if (m_normals)
+        vertexSize += sizeof(Normal);
+    if (m_colors)
+        vertexSize += sizeof(Spectrum);
+    if (m_texcoords)
+        vertexSize += sizeof(Point2);
+
+    Log(EInfo, "\"%s\": Loaded " SIZE_T_FMT " triangles, " SIZE_T_FMT
+            " vertices (%s in %i ms).", m_name.c_str(), m_triangleCount, m_vertexCount,
+            memString(sizeof(uint32_t) * m_triangleCount * 3 + vertexSize * m_vertexCount).c_str(),
+            timer->getMilliseconds());
+    return true;
+}
 
 MTS_IMPLEMENT_CLASS_S(PLYLoader, false, TriMesh)
 MTS_EXPORT_PLUGIN(PLYLoader, "PLY mesh loader");
@@ -57,6 +57,15 @@ extern MTS_EXPORT_RENDER void pushSceneCleanupHandler(void (*cleanup)());
  *       Optional flag to flip all normals. \default{\code{false}, i.e.
  *       the normals are left unchanged}.
  *     }
+ *     \parameter{compact}{\Boolean}{
+ *       Store normals, texture coordinates and indices at reduced precision
+ *       to save memory (see \code{TriMesh::compact()}) \default{\code{false}}
+ *     }
+ *     \parameter{precomputeCurvature}{\Boolean}{
+ *       Estimate the mean and Gaussian curvature at every vertex while
+ *       loading, which speeds up the \pluginref{curvature} texture
+ *       \default{\code{false}}
+ *     }
  *     \parameter{toWorld}{\Transform\Or\Animation}{
  *        Specifies an optional linear object-to-world transformation.
  *        \default{none (i.e. object space $=$ world space)}
@@ -142,6 +151,32 @@ extern MTS_EXPORT_RENDER void pushSceneCleanupHandler(void (*cleanup)());
  * \bottomrule
  * \end{longtable}
  * \end{center}
+ *
+ * \paragraph{Memory-mapped variant:}
+ * Files with version identifier \code{0x0005} contain the same fields,
+ * but are not compressed. Instead, each array is preceded by zero padding,
+ * such that it starts at a file offset that is a multiple of 64 bytes.
+ * Such files are mapped into memory, and when they were written with
+ * the floating point precision of the renderer, the mesh data is used
+ * in-place without any decoding. This makes loading large scenes much faster
+ * at the cost of larger files. The mapping is copy-on-write, so
+ * transformations specified via \code{toWorld} never modify the file.
+ * The \code{serializedcvt} utility converts between the two variants:
+ * \begin{shell}
+ * $\code{\$}$ mtsutil serializedcvt [-c] input.serialized output.serialized
+ * \end{shell}
+ * It writes the memory-mapped variant by default, and the compressed one
+ * when \code{-c} is specified.
+ *
+ * \paragraph{Block-compressed variant:}
+ * Files with version identifier \code{0x0006}, which Mitsuba writes
+ * by default, store the compressed part of each mesh as a sequence of
+ * independently compressed blocks of up to 1 MiB. Every block is preceded
+ * by two \code{uint32} values denoting its uncompressed and compressed size,
+ * and a block with an uncompressed size of zero ends the mesh. The blocks
+ * are compressed and decompressed in parallel. Files with version
+ * identifier \code{0x0004} (a single \code{zlib} stream per mesh) are
+ * still supported.
  */
 class SerializedMesh : public TriMesh {
 public:
@@ -235,6 +270,22 @@ private:
                 // Assume there is a single mesh in the file at offset 0
                 m_offsets.resize(1, 0);
             }
+
+            /* Uncompressed files are used in-place */
+            if (SerializedMesh::isMappable(version)) {
+                m_mapping = MemoryMappedFile::createCopyOnWrite(filePath);
+                m_fstream = NULL;
+            }
+        }
+
+        /// Return the file offset of the given shape index
+        inline size_t getOffset(size_t shapeIndex) const {
+            if (shapeIndex >= m_offsets.size()) {
+                SLog(EError, "Unable to unserialize mesh, "
+                    "shape index is out of range! (requested %i out of 0..%i)",
+                    (int) shapeIndex, (int) (m_offsets.size()-1));
+            }
+            return m_offsets[shapeIndex];
         }
 
         /**
@@ -242,19 +293,17 @@ private:
          * Returns the modified stream.
          */
         inline FileStream* seekStream(size_t shapeIndex) {
-            if (shapeIndex > m_offsets.size()) {
-                SLog(EError, "Unable to unserialize mesh, "
-                    "shape index is out of range! (requested %i out of 0..%i)",
-                    shapeIndex, (int) (m_offsets.size()-1));
-            }
-            const size_t pos = m_offsets[shapeIndex];
-            m_fstream->seek(pos);
+            m_fstream->seek(getOffset(shapeIndex));
             return m_fstream;
         }
 
+        /// Return the file mapping, if the file can be memory-mapped
+        inline MemoryMappedFile *getMapping() { return m_mapping.get(); }
+
     private:
         std::vector<size_t> m_offsets;
         ref<FileStream> m_fstream;
+        ref<MemoryMappedFile> m_mapping;
     };
 
     typedef LRUCache<fs::path, std::less<fs::path>,
@@ -298,7 +347,10 @@ private:
 
         boost::shared_ptr<MeshLoader> meshLoader = cache->get(filePath);
         Assert(meshLoader != NULL);
-        TriMesh::loadCompressed(meshLoader->seekStream((size_t) idx));
+        if (meshLoader->getMapping())
+            TriMesh::loadMapped(meshLoader->getMapping(), meshLoader->getOffset((size_t) idx));
+        else
+            TriMesh::loadCompressed(meshLoader->seekStream((size_t) idx));
     }
 
     static ThreadLocal<FileStreamCache> m_cache;
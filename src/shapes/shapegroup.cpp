@@ -17,14 +17,127 @@
 */
 
 #include "shapegroup.h"
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
 
 MTS_NAMESPACE_BEGIN
 
+static StatsCounter statsTreesBuilt("Shape groups",
+        "Kd-trees built");
+static StatsCounter statsBuildTime("Shape groups",
+        "Total kd-tree build time (ms)");
+static StatsCounter statsNodeCount("Shape groups",
+        "Total kd-tree nodes");
+static StatsCounter statsHeuristicCost("Shape groups",
+        "Average kd-tree SAH cost", EAverage);
+
+/// Build a shape group kd-tree and record its statistics
+static void buildShapeGroupKDTree(ShapeKDTree *kdtree, const std::string &name) {
+    ref<Timer> timer = new Timer();
+    kdtree->build();
+    unsigned int time = timer->getMilliseconds();
+
+    ++statsTreesBuilt;
+    statsBuildTime += time;
+    statsNodeCount += kdtree->getNodeCount();
+    statsHeuristicCost.incrementBase();
+    statsHeuristicCost += (uint64_t) kdtree->getHeuristicCost();
+
+    SLog(EDebug, "Built the kd-tree of shape group \"%s\" (%i primitives) "
+        "in %i ms: %i nodes, SAH cost %.2f", name.c_str(),
+        (int) kdtree->getPrimitiveCount(), time,
+        (int) kdtree->getNodeCount(), kdtree->getHeuristicCost());
+}
+
+class ShapeGroupBuildResult : public WorkResult {
+public:
+    void load(Stream *stream) { }
+    void save(Stream *stream) const { }
+    std::string toString() const { return "ShapeGroupBuildResult[]"; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~ShapeGroupBuildResult() { }
+};
+
+class ShapeGroupBuildWorker : public WorkProcessor {
+public:
+    ShapeGroupBuildWorker(const ref<ShapeKDTree> &kdtree,
+            const std::string &name)
+        : m_kdtree(kdtree), m_name(name) { }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Log(EError, "Shape group kd-tree construction is strictly local!");
+    }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new DummyWorkUnit();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new ShapeGroupBuildResult();
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new ShapeGroupBuildWorker(m_kdtree, m_name);
+    }
+
+    void prepare() { }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+        const bool &stop) {
+        buildShapeGroupKDTree(m_kdtree, m_name);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~ShapeGroupBuildWorker() { }
+private:
+    ref<ShapeKDTree> m_kdtree;
+    std::string m_name;
+};
+
+/// Builds the kd-tree of one shape group as a single work unit
+class ShapeGroupBuildProcess : public ParallelProcess {
+public:
+    ShapeGroupBuildProcess(const ref<ShapeKDTree> &kdtree,
+            const std::string &name)
+        : m_kdtree(kdtree), m_name(name), m_generated(false) { }
+
+    ref<WorkProcessor> createWorkProcessor() const {
+        return new ShapeGroupBuildWorker(m_kdtree, m_name);
+    }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        if (m_generated)
+            return EFailure;
+        m_generated = true;
+        return ESuccess;
+    }
+
+    void processResult(const WorkResult *result, bool cancelled) { }
+
+    bool isLocal() const { return true; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~ShapeGroupBuildProcess() { }
+private:
+    ref<ShapeKDTree> m_kdtree;
+    std::string m_name;
+    bool m_generated;
+};
+
 /*!\plugin{shapegroup}{Shape group for geometry instancing}
  * \order{8}
  * \parameters{
  *     \parameter{\Unnamed}{\Shape}{One or more shapes that should be
  *         made available for geometry instancing}
+ *     \parameter{parallelBuild}{\Boolean}{When a scheduler with
+ *         several local workers is running, build the kd-tree of this
+ *         group in the background so that the trees of different groups
+ *         are constructed concurrently. It is awaited when an instance
+ *         first references the group \default{\code{true}}}
  * }
  *
  * This plugin implements a container for shapes that should be
@@ -72,11 +185,17 @@ MTS_NAMESPACE_BEGIN
 
 ShapeGroup::ShapeGroup(const Properties &props) : Shape(props) {
     m_kdtree = new ShapeKDTree();
+    m_buildMutex = new Mutex();
+    /* Build the kd-trees of all shape groups concurrently while loading */
+    m_deferBuild = props.getBoolean("parallelBuild", true);
 }
 
 ShapeGroup::ShapeGroup(Stream *stream, InstanceManager *manager)
     : Shape(stream, manager) {
     m_kdtree = new ShapeKDTree();
+    m_buildMutex = new Mutex();
+    /* Unserialization may happen on a worker, so build right away */
+    m_deferBuild = false;
     size_t shapeCount = stream->readSize();
     for (size_t i=0; i<shapeCount; ++i)
         m_kdtree->addShape(static_cast<Shape *>(manager->getInstance(stream)));
@@ -97,8 +216,27 @@ void ShapeGroup::configure() {
        from SketchUp which create hundreds of tiny shape groups */
     if (m_kdtree->getPrimitiveCount() < 100*1024)
         m_kdtree->setLogLevel(ETrace);
-    if (!m_kdtree->isBuilt())
-        m_kdtree->build();
+    if (m_kdtree->isBuilt() || m_buildProcess)
+        return;
+
+    Scheduler *sched = Scheduler::getInstance();
+    if (m_deferBuild && sched->isRunning() && sched->getLocalWorkerCount() > 1) {
+        m_buildProcess = new ShapeGroupBuildProcess(m_kdtree, getName());
+        sched->schedule(m_buildProcess);
+    } else {
+        buildShapeGroupKDTree(m_kdtree, getName());
+    }
+}
+
+void ShapeGroup::waitForBuild() const {
+    LockGuard lock(m_buildMutex);
+    if (!m_buildProcess)
+        return;
+    Scheduler::getInstance()->wait(m_buildProcess);
+    if (m_buildProcess->getReturnStatus() != ParallelProcess::ESuccess)
+        Log(EError, "The kd-tree of shape group \"%s\" could not be built!",
+            getName().c_str());
+    m_buildProcess = NULL;
 }
 
 AABB ShapeGroup::getAABB() const {
@@ -163,6 +301,9 @@ std::string ShapeGroup::toString() const {
     return oss.str();
 }
 
+MTS_IMPLEMENT_CLASS(ShapeGroupBuildResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS(ShapeGroupBuildWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(ShapeGroupBuildProcess, false, ParallelProcess)
 MTS_IMPLEMENT_CLASS_S(ShapeGroup, false, Shape)
 MTS_EXPORT_PLUGIN(ShapeGroup, "Grouped geometry for instancing");
 MTS_NAMESPACE_END
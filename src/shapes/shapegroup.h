@@ -20,6 +20,8 @@
 #include <mitsuba/render/bsdf.h>
 #include <mitsuba/render/subsurface.h>
 #include <mitsuba/render/emitter.h>
+#include <mitsuba/core/sched.h>
+#include <mitsuba/core/lock.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -42,7 +44,13 @@ public:
     /// Serialize to a binary data stream
     void serialize(Stream *stream, InstanceManager *manager) const;
 
-    /// Build the internal KD-tree
+    /**
+     * \brief Build the internal KD-tree
+     *
+     * When loading a scene with a running scheduler, the build is only
+     * queued on the local workers, so that the trees of many shape groups
+     * are built concurrently. \ref getKDTree() waits for it to finish.
+     */
     void configure();
 
     /// Add a child object
@@ -59,8 +67,12 @@ public:
     /// Returns the surface area
     Float getSurfaceArea() const;
 
-    /// Return a pointer to the internal KD-tree
-    inline const ShapeKDTree *getKDTree() const { return m_kdtree.get(); }
+    /// Return a pointer to the internal KD-tree (waits for a pending build)
+    inline const ShapeKDTree *getKDTree() const {
+        if (EXPECT_NOT_TAKEN(m_buildProcess.get() != NULL))
+            waitForBuild();
+        return m_kdtree.get();
+    }
 
     /// Return the primitive count of the nested shapes
     size_t getPrimitiveCount() const;
@@ -72,8 +84,14 @@ public:
     std::string toString() const;
 
     MTS_DECLARE_CLASS()
+private:
+    /// Wait for the kd-tree build that was queued by \ref configure()
+    void waitForBuild() const;
 private:
     ref<ShapeKDTree> m_kdtree;
+    mutable ref<ParallelProcess> m_buildProcess;
+    mutable ref<Mutex> m_buildMutex;
+    bool m_deferBuild;
 };
 
 MTS_NAMESPACE_END
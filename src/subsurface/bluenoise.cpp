@@ -18,11 +18,10 @@
 
 #include "bluenoise.h"
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/qmc.h>
+#include <mitsuba/render/range.h>
 #include <boost/unordered_map.hpp>
-
-#if defined(MTS_OPENMP)
-# include <omp.h>
-#endif
+#include <functional>
 
 #if defined(__GNUC__) && defined(MTS_OPENMP) && __GNUC__ >= 4 && __GNUC_MINOR__ >= 3
 # define MTS_PARALLEL_SORT 1
@@ -62,26 +61,118 @@ struct Cell {
         : firstIndex(firstIndex), sample(sample) { }
 };
 
+/// Body of a parallel loop, called with half-open index ranges
+typedef std::function<void (size_t, size_t)> BlueNoiseLoopBody;
+
+/// Placeholder result: the loop bodies write their output in place
+class BlueNoiseLoopResult : public WorkResult {
+public:
+    void load(Stream *stream) { }
+    void save(Stream *stream) const { }
+    std::string toString() const { return "BlueNoiseLoopResult[]"; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~BlueNoiseLoopResult() { }
+};
+
+class BlueNoiseLoopWorker : public WorkProcessor {
+public:
+    BlueNoiseLoopWorker(const BlueNoiseLoopBody *body) : m_body(body) { }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Log(EError, "Blue noise point generation is strictly local!");
+    }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new RangeWorkUnit();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new BlueNoiseLoopResult();
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new BlueNoiseLoopWorker(m_body);
+    }
+
+    void prepare() { }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+        const bool &stop) {
+        const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+        (*m_body)(range->getRangeStart(), range->getRangeEnd() + 1);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~BlueNoiseLoopWorker() { }
+private:
+    const BlueNoiseLoopBody *m_body;
+};
+
+/**
+ * \brief Runs a loop over <tt>[0, count)</tt> on the local workers of the
+ * scheduler, in chunks of \c granularity indices
+ *
+ * The chunks do not depend on the number of workers, so a loop body that
+ * only derives its random numbers from the chunk start is deterministic.
+ */
+class BlueNoiseLoopProcess : public ParallelProcess {
+public:
+    BlueNoiseLoopProcess(size_t count, size_t granularity,
+            const BlueNoiseLoopBody &body)
+        : m_count(count), m_granularity(granularity), m_next(0), m_body(body) { }
+
+    ref<WorkProcessor> createWorkProcessor() const {
+        return new BlueNoiseLoopWorker(&m_body);
+    }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        if (m_next == m_count)
+            return EFailure;
+        size_t end = std::min(m_next + m_granularity, m_count);
+        static_cast<RangeWorkUnit *>(unit)->setRange(m_next, end - 1);
+        m_next = end;
+        return ESuccess;
+    }
+
+    void processResult(const WorkResult *result, bool cancelled) { }
+
+    bool isLocal() const { return true; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~BlueNoiseLoopProcess() { }
+private:
+    size_t m_count, m_granularity, m_next;
+    BlueNoiseLoopBody m_body;
+};
+
+static void blueNoiseParallelFor(size_t count, size_t granularity,
+        const BlueNoiseLoopBody &body) {
+    if (count == 0)
+        return;
+    ref<Scheduler> sched = Scheduler::getInstance();
+    ref<BlueNoiseLoopProcess> proc = new BlueNoiseLoopProcess(count, granularity, body);
+    sched->schedule(proc);
+    sched->wait(proc);
+    if (proc->getReturnStatus() != ParallelProcess::ESuccess)
+        SLog(EError, "Blue noise point generation did not finish!");
+}
+
 void blueNoisePointSet(const Scene *scene, const std::vector<Shape *> &shapes,
         Float radius, PositionSampleVector *target, Float &sa, AABB &aabb,
-        const void *data) {
+        const void *data, uint32_t seed) {
     int kmax = 8; /* Perform 8 trial runs */
 
-    #if defined(MTS_OPENMP)
-        int nproc = mts_omp_get_max_threads();
-    #else
-        int nproc = 1;
-    #endif
-    ProgressReporter rep("Generating sample positions", 27*kmax+5, data);
+    /* Number of white noise samples per work unit; every work unit
+       seeds its own random number generator from 'seed' */
+    const size_t whiteNoiseGranularity = 4096;
+    /* Number of cells of a phase group per work unit */
+    const size_t cellGranularity = 1024;
 
-    /* Create a random number generator for each thread */
-    ref<Random> rootRNG = new Random();
-    ref_vector<Random> t_rng(nproc);
-    std::vector<AABB> t_aabb(nproc);
-    for (int i=0; i<nproc; ++i) {
-        t_rng[i] = new Random(rootRNG);
-        t_aabb[i].reset();
-    }
+    ProgressReporter rep("Generating sample positions", 27*kmax+5, data);
 
     DiscreteDistribution areaDistr;
     std::vector<int> shapeMap(shapes.size());
@@ -109,27 +200,26 @@ void blueNoisePointSet(const Scene *scene, const std::vector<Shape *> &shapes,
     std::vector<UniformSample> samples(nsamples);
     rep.update(0);
 
-    #if defined(MTS_OPENMP)
-        #pragma omp parallel for schedule(static)
-    #endif
-    for (int i=0; i<nsamples; ++i) {
-        #if defined(MTS_OPENMP)
-            int tid = mts_omp_get_thread_num();
-        #else
-            int tid = 0;
-        #endif
-
-        Random *random = t_rng[tid].get();
-        Point2 sample(random->nextFloat(), random->nextFloat());
-        int shapeIndex = (int) areaDistr.sampleReuse(sample.x);
-        Shape *shape = shapes[shapeIndex];
-
-        PositionSamplingRecord pRec(0);
-        shape->samplePosition(pRec, sample);
-
-        samples[i] = UniformSample(pRec.p, pRec.n, 0, shapeMap[shapeIndex]);
-        t_aabb[tid].expandBy(pRec.p);
-    }
+    ref<Mutex> aabbMutex = new Mutex();
+    aabb.reset();
+    blueNoiseParallelFor(nsamples, whiteNoiseGranularity, [&](size_t start, size_t end) {
+        ref<Random> random = new Random(sampleTEA(seed,
+            (uint32_t) (start / whiteNoiseGranularity)));
+        AABB localAABB;
+        for (size_t i=start; i<end; ++i) {
+            Point2 sample(random->nextFloat(), random->nextFloat());
+            int shapeIndex = (int) areaDistr.sampleReuse(sample.x);
+            Shape *shape = shapes[shapeIndex];
+
+            PositionSamplingRecord pRec(0);
+            shape->samplePosition(pRec, sample);
+
+            samples[i] = UniformSample(pRec.p, pRec.n, 0, shapeMap[shapeIndex]);
+            localAABB.expandBy(pRec.p);
+        }
+        LockGuard lock(aabbMutex);
+        aabb.expandBy(localAABB);
+    });
     SLog(EInfo, "    done (took %i ms, %s)" , timer->getMilliseconds(),
         memString(sizeof(PositionSample) * samples.size()).c_str());
     rep.update(1);
@@ -138,9 +228,6 @@ void blueNoisePointSet(const Scene *scene, const std::vector<Shape *> &shapes,
     Float cellWidth = radius / std::sqrt(3.0f),
           invCellWidth = 1.0f / cellWidth;
 
-    aabb.reset();
-    for (int i=0; i<nproc; ++i)
-        aabb.expandBy(t_aabb[i]);
     Vector extents = aabb.getExtents();
 
     Vector3i cellCount;
@@ -148,17 +235,16 @@ void blueNoisePointSet(const Scene *scene, const std::vector<Shape *> &shapes,
         cellCount[i] = std::max(1, math::ceilToInt(extents[i] * invCellWidth));
 
     SLog(EInfo, "  phase 2: computing cell indices ..");
-    #if defined(MTS_OPENMP)
-        #pragma omp parallel for schedule(static)
-    #endif
-    for (int i=0; i<nsamples; ++i) {
-        Vector rel = samples[i].p - aabb.min;
-        Vector3i idx;
-        for (int j=0; j<3; ++j)
-            idx[j] = std::min((int) (rel[j] * invCellWidth), cellCount[j]-1);
-        samples[i].cellID = idx[0] + (int64_t) cellCount[0] *
-            (idx[1] + idx[2] * (int64_t) cellCount[1]);
-    }
+    blueNoiseParallelFor(nsamples, whiteNoiseGranularity, [&](size_t start, size_t end) {
+        for (size_t i=start; i<end; ++i) {
+            Vector rel = samples[i].p - aabb.min;
+            Vector3i idx;
+            for (int j=0; j<3; ++j)
+                idx[j] = std::min((int) (rel[j] * invCellWidth), cellCount[j]-1);
+            samples[i].cellID = idx[0] + (int64_t) cellCount[0] *
+                (idx[1] + idx[2] * (int64_t) cellCount[1]);
+        }
+    });
     SLog(EInfo, "    done (took %i ms)" , timer->getMilliseconds());
     rep.update(2);
     timer->reset();
@@ -210,50 +296,49 @@ void blueNoisePointSet(const Scene *scene, const std::vector<Shape *> &shapes,
         for (int phase=0; phase<27; ++phase) {
             const std::vector<int64_t> &phaseGroup = phaseGroups[phase];
 
-            #if defined(MTS_OPENMP)
-                #pragma omp parallel for
-            #endif
-            for (int i=0; i < (int) phaseGroup.size(); ++i) {
-                int64_t cellID = phaseGroup[i];
-                Cell &cell = cells[cellID];
-                int arrayIndex = cell.firstIndex + trial;
+            blueNoiseParallelFor(phaseGroup.size(), cellGranularity, [&](size_t start, size_t end) {
+                for (size_t i=start; i<end; ++i) {
+                    int64_t cellID = phaseGroup[i];
+                    Cell &cell = cells.find(cellID)->second;
+                    int arrayIndex = cell.firstIndex + trial;
 
-                if (arrayIndex >= (int) samples.size() ||
-                    samples[arrayIndex].cellID != cellID ||
-                    cell.sample != -1)
-                    continue;
+                    if (arrayIndex >= (int) samples.size() ||
+                        samples[arrayIndex].cellID != cellID ||
+                        cell.sample != -1)
+                        continue;
 
-                const UniformSample &sample = samples[arrayIndex];
+                    const UniformSample &sample = samples[arrayIndex];
 
-                bool conflict = false;
+                    bool conflict = false;
 
-                for (int z=-2; z<3; ++z) {
-                    for (int y=-2; y<3; ++y) {
-                        for (int x=-2; x<3; ++x) {
-                            int64_t neighborCellID = cellID + x
-                                + (int64_t) cellCount[0] * (y + z * (int64_t) cellCount[1]);
+                    for (int z=-2; z<3; ++z) {
+                        for (int y=-2; y<3; ++y) {
+                            for (int x=-2; x<3; ++x) {
+                                int64_t neighborCellID = cellID + x
+                                    + (int64_t) cellCount[0] * (y + z * (int64_t) cellCount[1]);
 
-                            CellMap::iterator it = cells.find(neighborCellID);
+                                CellMap::iterator it = cells.find(neighborCellID);
 
-                            if (it != cells.end()) {
-                                const Cell &neighbor = it->second;
-                                if (neighbor.sample != -1) {
-                                    const UniformSample &sample2 = samples[neighbor.sample];
+                                if (it != cells.end()) {
+                                    const Cell &neighbor = it->second;
+                                    if (neighbor.sample != -1) {
+                                        const UniformSample &sample2 = samples[neighbor.sample];
 
-                                    if ((sample.p-sample2.p).lengthSquared() < radius*radius) {
-                                        conflict = true;
-                                        goto bailout;
+                                        if ((sample.p-sample2.p).lengthSquared() < radius*radius) {
+                                            conflict = true;
+                                            goto bailout;
+                                        }
                                     }
                                 }
                             }
                         }
                     }
-                }
 
-            bailout:
-                if (!conflict)
-                    cell.sample = arrayIndex;
-            }
+                bailout:
+                    if (!conflict)
+                        cell.sample = arrayIndex;
+                }
+            });
             rep.update(5+trial*27+phase);
         }
     }
@@ -272,4 +357,8 @@ void blueNoisePointSet(const Scene *scene, const std::vector<Shape *> &shapes,
     SLog(EInfo, "Sampling finished (obtained %i blue noise samples)", (int) target->size());
 }
 
+MTS_IMPLEMENT_CLASS(BlueNoiseLoopResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS(BlueNoiseLoopWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(BlueNoiseLoopProcess, false, ParallelProcess)
+
 MTS_NAMESPACE_END
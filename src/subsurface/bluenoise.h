@@ -45,11 +45,15 @@ MTS_NAMESPACE_BEGIN
  * \param data
  *    Custom pointer that will be sent along with progress messages
  *    (usually contains a pointer to the \ref RenderJob instance)
+ * \param seed
+ *    Seed of the white noise. The work is spread over the local workers of
+ *    the \ref Scheduler, but the result only depends on the seed (and not
+ *    on the number of workers or on their timing)
  */
 extern void blueNoisePointSet(const Scene *scene,
     const std::vector<Shape *> &shapes, Float radius,
     PositionSampleVector *target, Float &sa, AABB &aabb,
-    const void *data);
+    const void *data, uint32_t seed = 0);
 
 MTS_NAMESPACE_END
 
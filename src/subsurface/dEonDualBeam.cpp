@@ -9,6 +9,99 @@ MTS_NAMESPACE_BEGIN
  * more samples... */
 #define MTS_DSS_DEON_DUAL_BEAM_NUM_SAMPLES 1
 
+/**
+ * \brief Tabulated radial profile of the dual beam model.
+ *
+ * Stores the profile for normal incidence and exitance on a radial grid
+ * r_k = rMax*(k/N)^2 (dense near the peak) and samples it as a piecewise
+ * constant density over the annuli between the grid points. The pdf is
+ * normalized for the area measure in the plane, as required by
+ * \c RadialSampler2D. Radii beyond rMax are never sampled, so this
+ * should be combined with a sampler that covers the tail.
+ */
+class MTS_EXPORT_RENDER DualBeamTabulatedRadialSampler1D : public Sampler1D {
+public:
+    /// \c profile holds N+1 values per channel, at the grid nodes
+    DualBeamTabulatedRadialSampler1D(const Spectrum &rMax, int N,
+            const std::vector<Float> profile[SPECTRUM_SAMPLES])
+            : m_rMax(rMax), m_N(N) {
+        for (int i = 0; i < SPECTRUM_SAMPLES; i++) {
+            m_annulusPdf[i].resize(N, 0.0f);
+            m_annuli[i].clear();
+            m_annuli[i].reserve(N);
+            Float total = 0;
+            for (int k = 0; k < N; k++) {
+                Float r0 = radius(i, (Float) k), r1 = radius(i, (Float) (k+1));
+                /* Profile at the radius that halves the annulus area */
+                Float rMid = std::sqrt(0.5f * (r0*r0 + r1*r1));
+                Float mass = std::max((Float) 0, interpolate(profile[i],
+                        N * std::sqrt(rMid / rMax[i])))
+                        * M_PI * (r1*r1 - r0*r0);
+                if (!std::isfinite(mass))
+                    mass = 0;
+                m_annuli[i].append(mass);
+                m_annulusPdf[i][k] = r1 > r0 ? mass / (M_PI*(r1*r1 - r0*r0)) : 0;
+                total += mass;
+            }
+            m_valid[i] = total > 0;
+            if (m_valid[i]) {
+                m_annuli[i].normalize();
+                for (int k = 0; k < N; k++)
+                    m_annulusPdf[i][k] /= total;
+            }
+        }
+    }
+
+    virtual bool sample(int channel, Float &r,
+            Sampler *sampler, Float *thePdf = NULL) const {
+        if (!m_valid[channel])
+            return false;
+        size_t k = m_annuli[channel].sample(sampler->next1D());
+        Float r0 = radius(channel, (Float) k);
+        Float r1 = radius(channel, (Float) (k+1));
+        /* Uniform in area within the annulus */
+        r = std::sqrt(r0*r0 + sampler->next1D() * (r1*r1 - r0*r0));
+        if (thePdf)
+            *thePdf = m_annulusPdf[channel][k];
+        return true;
+    }
+
+    virtual Float pdf(int channel, Float r) const {
+        if (!m_valid[channel] || r < 0 || r >= m_rMax[channel])
+            return 0;
+        int k = std::min(m_N - 1, (int) (m_N * std::sqrt(r / m_rMax[channel])));
+        return m_annulusPdf[channel][k];
+    }
+
+    /**
+     * \brief Catmull-Rom interpolation of node values at the (fractional)
+     * grid index t, with clamped end points.
+     */
+    static Float interpolate(const std::vector<Float> &values, Float t) {
+        int n = (int) values.size();
+        int k = math::clamp((int) std::floor(t), 0, n - 2);
+        Float x = t - k;
+        Float f0 = values[std::max(k - 1, 0)], f1 = values[k],
+              f2 = values[k + 1], f3 = values[std::min(k + 2, n - 1)];
+        return f1 + 0.5f * x * (f2 - f0 + x * (2*f0 - 5*f1 + 4*f2 - f3
+                + x * (3*(f1 - f2) + f3 - f0)));
+    }
+
+    MTS_DECLARE_CLASS();
+protected:
+    virtual ~DualBeamTabulatedRadialSampler1D() { }
+
+    inline Float radius(int channel, Float k) const {
+        return m_rMax[channel] * math::square(k / m_N);
+    }
+
+    Spectrum m_rMax;
+    int m_N;
+    bool m_valid[SPECTRUM_SAMPLES];
+    DiscreteDistribution m_annuli[SPECTRUM_SAMPLES];
+    std::vector<Float> m_annulusPdf[SPECTRUM_SAMPLES];
+};
+
 class DualBeamdEon : public DirectSamplingSubsurface {
 public:
     DualBeamdEon(const Properties &props)
@@ -16,6 +109,15 @@ public:
         lookupMaterial(props, m_sigmaS, m_sigmaA, m_g, &m_eta);
         m_modifiedDipoleTangentPlane = props.getBoolean("modifiedDipoleTangentPlane", true);
 
+        /* Importance sample the tangent plane with a tabulated profile of
+         * the model itself (in addition to the classical dipole) */
+        m_tabulatedSampler = props.getBoolean("tabulatedSampler", true);
+        /* Number of radial bins of that table; higher is more accurate
+         * but slower to build */
+        m_profileResolution = props.getInteger("profileResolution", 64);
+        if (m_profileResolution < 4)
+            Log(EError, "profileResolution must be at least 4!");
+
         if (m_eta != 1)
             Log(EWarn, "ATTENTION! The dual beam model was only fitted for "
                     "index matched media! You have requested implicit "
@@ -36,6 +138,8 @@ public:
         m_sourcesIndex = stream->readInt();
         m_sourcesResID = -1;
         m_modifiedDipoleTangentPlane = stream->readBool();
+        m_tabulatedSampler = stream->readBool();
+        m_profileResolution = stream->readInt();
         configure();
     }
 
@@ -46,6 +150,8 @@ public:
         m_g.serialize(stream);
         stream->writeInt(m_sourcesIndex);
         stream->writeBool(m_modifiedDipoleTangentPlane);
+        stream->writeBool(m_tabulatedSampler);
+        stream->writeInt(m_profileResolution);
     }
 
     virtual Spectrum sampleBssrdfDirection(const Scene *scene,
@@ -211,6 +317,52 @@ public:
         return m_CD[channel] * exp(-m_muEff[channel]*r) / r;
     }
 
+    /**
+     * \brief Radial profile for normal incidence and exitance at distance
+     * r, integrated numerically over the beam depths u and v.
+     *
+     * The exponential attenuation along the beams is absorbed in the
+     * substitution u = -log(1-xi)/sigmaTPrime, leaving a midpoint rule
+     * with \c M points per dimension.
+     */
+    Float normalIncidenceProfile(Float r, int channel, int M) const {
+        const Point p_out(0.0f), p_in(r, 0, 0);
+        const Vector n(0, 0, 1);
+        Float invSigmaTPrime = 1 / m_sigmaTPrime[channel];
+        Float sum = 0;
+        for (int j = 0; j < M; j++) {
+            Float u = -math::fastlog(1 - (j + 0.5f) / M) * invSigmaTPrime;
+            for (int k = 0; k < M; k++) {
+                Float v = -math::fastlog(1 - (k + 0.5f) / M) * invSigmaTPrime;
+                sum += pointToPointGreenFunction(p_out - n*u, p_in - n*v,
+                        n, p_out, channel);
+            }
+        }
+        return sum / (M*M) * math::square(m_sigmaSPrime[channel]
+                * invSigmaTPrime) * INV_FOURPI;
+    }
+
+    ref<Sampler1D> makeTabulatedSampler() const {
+        const int N = m_profileResolution;
+        const int M = std::max(8, N / 2);
+        /* The profile falls off as exp(-muEff*r) in the far field */
+        Spectrum rMax = 10.0f * m_muEff.invertButKeepZero();
+        std::vector<Float> profile[SPECTRUM_SAMPLES];
+        for (int i = 0; i < SPECTRUM_SAMPLES; i++) {
+            if (m_noSpectralDependence && i > 0) {
+                profile[i] = profile[0];
+                continue;
+            }
+            profile[i].resize(N + 1);
+            for (int k = 1; k <= N; k++)
+                profile[i][k] = normalIncidenceProfile(
+                        rMax[i] * math::square((Float) k / N), i, M);
+            /* Don't bother resolving the divergence at r=0 */
+            profile[i][0] = profile[i][1];
+        }
+        return new DualBeamTabulatedRadialSampler1D(rMax, N, profile);
+    }
+
     void configure() {
         m_sigmaSPrime = m_sigmaS * (Spectrum(1.0f) - m_g);
         m_sigmaTPrime = m_sigmaSPrime + m_sigmaA;
@@ -250,12 +402,21 @@ public:
 
         m_uvSampler = new ExpSampler1D(m_sigmaTPrime);
 
-        ref<RadialSampler2D> exactDipoleSampler(
+        ref<TangentSampler2D> exactDipoleSampler(
                 new RadialSampler2D(new RadialExactDipoleSampler2D(m_sigmaA, m_sigmaS, m_g, m_eta)));
+        if (m_tabulatedSampler) {
+            /* Keep the dipole around for the tail beyond the table */
+            ref<TangentSampler2D> tabulated(
+                    new RadialSampler2D(makeTabulatedSampler()));
+            std::vector<std::pair<Float, const TangentSampler2D*> > samplers;
+            samplers.push_back(std::make_pair(0.75f, tabulated.get()));
+            samplers.push_back(std::make_pair(0.25f, exactDipoleSampler.get()));
+            exactDipoleSampler = new MISTangentSampler2D(samplers);
+        }
         ref<WeightIntersectionSampler> itsSampler(
                 new WeightIntersectionSampler(distanceWeightWrapper(
                     makeExactDiffusionDipoleDistanceWeight(m_sigmaA, m_sigmaS, m_g, m_eta)),
-                m_itsDistanceCutoff));
+                m_itsDistanceCutoff, m_itsWeightTolerance));
         registerSampler(1, new ProjSurfaceSampler(
                 DSSProjFrame::ENormalNormal,  // normal
                 exactDipoleSampler.get(), itsSampler.get()));
@@ -281,6 +442,8 @@ public:
         oss << "  sigmaS = " << m_sigmaS.toString() << endl;
         oss << "  sigmaA = " << m_sigmaA.toString() << endl;
         oss << "  g = " << m_g.toString() << endl;
+        oss << "  tabulatedSampler = " << m_tabulatedSampler << endl;
+        oss << "  profileResolution = " << m_profileResolution << endl;
         oss << "]" << endl;
         return oss.str();
     }
@@ -304,9 +467,12 @@ private:
     Spectrum m_a_un, m_a_D;
     bool m_noSpectralDependence;
     bool m_modifiedDipoleTangentPlane;
+    bool m_tabulatedSampler;
+    int m_profileResolution;
     ref<const Sampler1D> m_uvSampler;
 };
 
 MTS_IMPLEMENT_CLASS_S(DualBeamdEon, false, DirectSamplingSubsurface)
+MTS_IMPLEMENT_CLASS(DualBeamTabulatedRadialSampler1D, false, Sampler1D)
 MTS_EXPORT_PLUGIN(DualBeamdEon, "The dual-beam 3D searchlight BSSRDF of Eugene d'Eon");
 MTS_NAMESPACE_END
@@ -72,6 +72,59 @@ struct IsotropicDipoleQuery {
         zrSqr = _mm_mul_ps(zr, zr);
         zvSqr = _mm_mul_ps(zv, zv);
         result.ps = _mm_setzero_ps();
+
+        /* Per-channel constants of the batched evaluation below */
+        for (int i=0; i<3; ++i) {
+            zrC[i] = _mm_set1_ps(_zr[i]);
+            zvC[i] = _mm_set1_ps(_zv[i]);
+            zrSqrC[i] = _mm_set1_ps(_zr[i] * _zr[i]);
+            zvSqrC[i] = _mm_set1_ps(_zv[i] * _zv[i]);
+            sigmaTrC[i] = _mm_set1_ps(_sigmaTr[i]);
+            batch[i] = _mm_setzero_ps();
+        }
+    }
+
+    /**
+     * Evaluate the dipole for all samples of an octree leaf. The lanes hold
+     * four different samples, and the three color channels are processed
+     * one after the other.
+     */
+    inline void operator()(const IrradianceOctree::SampleArrays &s,
+            uint32_t offset, uint32_t count) {
+        const __m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y),
+            pz = _mm_set1_ps(p.z), one = _mm_set1_ps(1.0f),
+            laneIndex = _mm_set_ps(3, 2, 1, 0);
+
+        for (uint32_t i=0; i<count; i += 4) {
+            const uint32_t idx = offset + i;
+            const __m128
+                dx = _mm_sub_ps(_mm_loadu_ps(s.x + idx), px),
+                dy = _mm_sub_ps(_mm_loadu_ps(s.y + idx), py),
+                dz = _mm_sub_ps(_mm_loadu_ps(s.z + idx), pz),
+                lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+                    _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)),
+                /* Lanes past the end of the leaf belong to other samples */
+                valid = _mm_cmplt_ps(laneIndex, _mm_set1_ps((float) (count - i))),
+                area = _mm_and_ps(valid, _mm_mul_ps(_mm_loadu_ps(s.area + idx),
+                    _mm_set1_ps(INV_FOURPI)));
+            const float *E[3] = { s.r + idx, s.g + idx, s.b + idx };
+
+            for (int c=0; c<3; ++c) {
+                const __m128
+                    drSqr = _mm_add_ps(zrSqrC[c], lengthSquared),
+                    dvSqr = _mm_add_ps(zvSqrC[c], lengthSquared),
+                    dr = _mm_sqrt_ps(drSqr), dv = _mm_sqrt_ps(dvSqr),
+                    C1fac = _mm_div_ps(_mm_mul_ps(zrC[c], _mm_add_ps(sigmaTrC[c], _mm_div_ps(one, dr))), drSqr),
+                    C2fac = _mm_div_ps(_mm_mul_ps(zvC[c], _mm_add_ps(sigmaTrC[c], _mm_div_ps(one, dv))), dvSqr),
+                    sigmaTrNeg = negate_ps(sigmaTrC[c]),
+                    exp1 = math::exp_ps(_mm_mul_ps(dr, sigmaTrNeg)),
+                    exp2 = math::exp_ps(_mm_mul_ps(dv, sigmaTrNeg)),
+                    factor = _mm_mul_ps(area, _mm_loadu_ps(E[c]));
+
+                batch[c] = _mm_add_ps(batch[c], _mm_mul_ps(factor, _mm_add_ps(
+                    _mm_mul_ps(C1fac, exp1), _mm_mul_ps(C2fac, exp2))));
+            }
+        }
     }
 
     inline void operator()(const IrradianceSample &sample) {
@@ -95,12 +148,15 @@ struct IsotropicDipoleQuery {
 
     Spectrum getResult() {
         Spectrum value;
-        for (int i=0; i<3; ++i)
-            value[i] = result.f[3-i];
+        for (int i=0; i<3; ++i) {
+            SSEVector sum(batch[i]);
+            value[i] = result.f[3-i] + (sum.f[0] + sum.f[1]) + (sum.f[2] + sum.f[3]);
+        }
         return value;
     }
 
     __m128 zr, zv, zrSqr, zvSqr, sigmaTr;
+    __m128 zrC[3], zvC[3], zrSqrC[3], zvSqrC[3], sigmaTrC[3], batch[3];
     SSEVector result;
 #endif
 
@@ -140,6 +196,18 @@ static int irrOctreeIndex = 0;
  *         Number of samples to use when estimating the
  *         irradiance at a point on the surface \default{16}
  *     }
+ *     \parameter{blueNoiseSeed}{\Integer}{
+ *         Seed of the blue noise point set on which the irradiance is
+ *         sampled. The point set only depends on this seed, so that
+ *         it stays the same between renders and render nodes. \default{0}
+ *     }
+ *     \parameter{preprocessCacheDir}{\String}{
+ *         Directory in which the precomputed data of this model is cached
+ *         between renders. It is reused as long as the scene geometry, the
+ *         emitters, the integrator and the parameters of this model do not
+ *         change (e.g. when only the camera moves).
+ *         \default{none, i.e. no caching}
+ *     }
  * }
  *
  * \renderings{
@@ -289,6 +357,9 @@ public:
         /* Error threshold - lower means better quality */
         m_quality = props.getFloat("quality", 0.2f);
 
+        /* Seed of the blue noise irradiance sample positions */
+        m_blueNoiseSeed = (uint32_t) props.getInteger("blueNoiseSeed", 0);
+
         /* Asymmetry parameter of the phase function */
         m_octreeResID = -1;
 
@@ -306,6 +377,7 @@ public:
         m_octreeIndex = stream->readInt();
         m_irrSamples = stream->readInt();
         m_irrIndirect = stream->readBool();
+        m_blueNoiseSeed = stream->readUInt();
         m_octreeResID = -1;
         configure();
     }
@@ -331,6 +403,7 @@ public:
         stream->writeInt(m_octreeIndex);
         stream->writeInt(m_irrSamples);
         stream->writeBool(m_irrIndirect);
+        stream->writeUInt(m_blueNoiseSeed);
     }
 
     Spectrum Lo(const Scene *scene, Sampler *sampler,
@@ -383,6 +456,13 @@ public:
             Log(EError, "The dipole subsurface scattering model requires "
                 "a sampling-based surface integrator!");
 
+        if (loadPreprocessCache(scene, "irrOctree", [&](Stream *stream) {
+                    m_octree = new IrradianceOctree(stream, NULL);
+                })) {
+            m_octreeResID = Scheduler::getInstance()->registerResource(m_octree);
+            return true;
+        }
+
         ref<Scheduler> sched = Scheduler::getInstance();
         ref<Timer> timer = new Timer();
 
@@ -393,13 +473,15 @@ public:
         /* It is necessary to increase the sampling resolution to
            prevent low-frequency noise in the output */
         Float actualRadius = m_radius / std::sqrt(m_sampleMultiplier * 20);
-        blueNoisePointSet(scene, m_shapes, actualRadius, points, sa, aabb, job);
+        blueNoisePointSet(scene, m_shapes, actualRadius, points, sa, aabb, job,
+            m_blueNoiseSeed);
 
         /* 2. Gather irradiance in parallel */
         const Sensor *sensor = scene->getSensor();
         ref<IrradianceSamplingProcess> proc = new IrradianceSamplingProcess(
             points, 1024, m_irrSamples, m_irrIndirect,
             sensor->getShutterOpen() + 0.5f * sensor->getShutterOpenTime(), job);
+        points = NULL; /* Released by the process once it has been handed out */
 
         /* Create a sampler instance for every core */
         ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
@@ -434,15 +516,15 @@ public:
         Log(EDebug, "Done gathering (took %i ms), clustering ..", timer->getMilliseconds());
         timer->reset();
 
-        std::vector<IrradianceSample> &samples = proc->getIrradianceSampleVector()->get();
-        sa /= samples.size();
-
-        for (size_t i=0; i<samples.size(); ++i)
-            samples[i].area = sa;
+        std::vector<IrradianceSample> samples;
+        proc->extractSamples(samples, sa / proc->getSampleCount());
 
         m_octree = new IrradianceOctree(aabb, m_quality, samples);
 
         Log(EDebug, "Done clustering (took %i ms).", timer->getMilliseconds());
+        storePreprocessCache(scene, "irrOctree", [&](Stream *stream) {
+                m_octree->serialize(stream, NULL);
+            });
         m_octreeResID = Scheduler::getInstance()->registerResource(m_octree);
 
         return true;
@@ -461,6 +543,14 @@ public:
         Scheduler::getInstance()->cancel(m_proc);
     }
 
+    void invalidate() {
+        if (m_octreeResID != -1) {
+            Scheduler::getInstance()->unregisterResource(m_octreeResID);
+            m_octreeResID = -1;
+        }
+        m_octree = NULL;
+    }
+
     MTS_DECLARE_CLASS()
 private:
     Float m_radius, m_sampleMultiplier;
@@ -473,6 +563,7 @@ private:
     int m_octreeResID, m_octreeIndex;
     int m_irrSamples;
     bool m_irrIndirect;
+    uint32_t m_blueNoiseSeed;
 };
 
 MTS_IMPLEMENT_CLASS_S(IsotropicDipole, false, Subsurface)
@@ -3,8 +3,8 @@
 
 MTS_NAMESPACE_BEGIN
 
-inline Float dEon_C1(const Float n) {
-    Float r;
+inline double dEon_C1(const double n) {
+    double r;
     if (n > 1.0) {
         r = -9.23372 + n * (22.2272 + n * (-20.9292 + n * (10.2291 + n * (-2.54396 + 0.254913 * n))));
     } else {
@@ -12,13 +12,13 @@ inline Float dEon_C1(const Float n) {
     }
     return r / 2.0;
 }
-inline Float dEon_C2(const Float n) {
-    Float r = -1641.1 + n * (1213.67 + n * (-568.556 + n * (164.798 + n * (-27.0181 + 1.91826 * n))));
+inline double dEon_C2(const double n) {
+    double r = -1641.1 + n * (1213.67 + n * (-568.556 + n * (164.798 + n * (-27.0181 + 1.91826 * n))));
     r += (((135.926 / n) - 656.175) / n + 1376.53) / n;
     return r / 3.0;
 }
 
-inline Float dEon_A(const Float eta) {
+inline double dEon_A(const double eta) {
     return (1 + 3*dEon_C2(eta)) / (1 - 2*dEon_C1(eta));
 }
 
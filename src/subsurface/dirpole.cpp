@@ -6,6 +6,7 @@
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/dss.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/ssemath.h>
 #include "../medium/materials.h"
 
 #include <math.h>
@@ -73,21 +74,70 @@ private:
 
     // directional dipole
     // --------------------------------
-    inline double Sp_d(const Vec& x, const Vec& w, const double& r, const Vec& n, const int j) const {
+
+    /* Inputs of the profile Sp_d of one type of source (real or virtual)
+     * for each channel: the distance to the source and the dot products
+     * x.w, w.n and x.n */
+    struct SourceTerms {
+        double r[SPECTRUM_SAMPLES];
+        double xw[SPECTRUM_SAMPLES];
+        double wn[SPECTRUM_SAMPLES];
+        double xn[SPECTRUM_SAMPLES];
+    };
+
+    inline double Sp_d(const SourceTerms &s, const int j) const {
         // evaluate the profile
+        const double r = s.r[j];
         const double s_tr_r = sigma_tr[j] * r;
         const double s_tr_r_one = 1.0 + s_tr_r;
-        const double x_dot_w = x.dot(w);
+        const double x_dot_w = s.xw[j];
         const double r_sqr = r * r;
 
         const double t0 = Cp_norm * (1.0 / (4.0 * M_PI * M_PI)) * exp(-s_tr_r) / (r * r_sqr);
         const double t1 = r_sqr / D[j] + 3.0 * s_tr_r_one * x_dot_w;
-        const double t2 = 3.0 * D[j] * s_tr_r_one * w.dot(n);
-        const double t3 = (s_tr_r_one + 3.0 * D[j] * (3.0 * s_tr_r_one + s_tr_r * s_tr_r) / r_sqr * x_dot_w) * x.dot(n);
+        const double t2 = 3.0 * D[j] * s_tr_r_one * s.wn[j];
+        const double t3 = (s_tr_r_one + 3.0 * D[j] * (3.0 * s_tr_r_one + s_tr_r * s_tr_r) / r_sqr * x_dot_w) * s.xn[j];
 
         return t0 * (Cp * t1 - Ce * (t2 - t3));
     }
-    inline double bssrdf(const Vec& xi, const Vec& ni, const Vec& wi, const Vec& xo, const Vec& no, const Vec& wo, const int j) const {
+
+#if defined(MTS_SSE) && SPECTRUM_SAMPLES == 3
+    /// Same as Sp_d, but for all channels at once in single precision
+    inline __m128 Sp_d_ps(const SourceTerms &s) const {
+        const __m128
+            one = _mm_set1_ps(1.0f),
+            three = _mm_set1_ps(3.0f),
+            /* Unused 4th lane: r=1 keeps it finite */
+            r = _mm_set_ps(1.0f, s.r[2], s.r[1], s.r[0]),
+            xw = _mm_set_ps(0.0f, s.xw[2], s.xw[1], s.xw[0]),
+            wn = _mm_set_ps(0.0f, s.wn[2], s.wn[1], s.wn[0]),
+            xn = _mm_set_ps(0.0f, s.xn[2], s.xn[1], s.xn[0]),
+            sigmaTr = _mm_set_ps(0.0f, sigma_tr[2], sigma_tr[1], sigma_tr[0]),
+            Dj = _mm_set_ps(1.0f, D[2], D[1], D[0]),
+            s_tr_r = _mm_mul_ps(sigmaTr, r),
+            s_tr_r_one = _mm_add_ps(one, s_tr_r),
+            r_sqr = _mm_mul_ps(r, r),
+            t0 = _mm_div_ps(
+                _mm_mul_ps(_mm_set1_ps((float) (Cp_norm / (4.0 * M_PI * M_PI))),
+                    math::exp_ps(negate_ps(s_tr_r))),
+                _mm_mul_ps(r, r_sqr)),
+            t1 = _mm_add_ps(_mm_div_ps(r_sqr, Dj),
+                _mm_mul_ps(three, _mm_mul_ps(s_tr_r_one, xw))),
+            t2 = _mm_mul_ps(_mm_mul_ps(three, Dj), _mm_mul_ps(s_tr_r_one, wn)),
+            t3 = _mm_mul_ps(_mm_add_ps(s_tr_r_one, _mm_mul_ps(
+                    _mm_div_ps(_mm_mul_ps(_mm_mul_ps(three, Dj),
+                        _mm_add_ps(_mm_mul_ps(three, s_tr_r_one),
+                            _mm_mul_ps(s_tr_r, s_tr_r))), r_sqr), xw)), xn);
+
+        return _mm_mul_ps(t0, _mm_sub_ps(_mm_mul_ps(_mm_set1_ps((float) Cp), t1),
+                _mm_mul_ps(_mm_set1_ps((float) Ce), _mm_sub_ps(t2, t3))));
+    }
+#endif
+
+    inline void bssrdf(const Vec& xi, const Vec& ni, const Vec& wi, const Vec& xo, const Vec& no, const Vec& wo, Spectrum &result) const {
+        /* Everything up to the source distances is independent of the
+         * channel, so only compute that once */
+
         // distance
         const Vec xoxi = xo - xi;
         const double r = xoxi.len();
@@ -100,25 +150,51 @@ private:
         const Vec wr = (wi * -nnt - ni * (ddn * nnt + sqrt(1.0 - nnt * nnt * (1.0 - ddn * ddn)))).normalized();
         const Vec wv = wr - ni_s * (2.0 * wr.dot(ni_s));
 
-        // distance to real sources
-        const double cos_beta = -sqrt((r * r - xoxi.dot(wr) * xoxi.dot(wr)) / (r * r + de[j] * de[j]));
-        double dr;
-        const double mu0 = -no.dot(wr);
-        if (mu0 > 0.0) {
-            dr = sqrt((D[j] * mu0) * ((D[j] * mu0) - de[j] * cos_beta * 2.0) + r * r);
-        } else {
-            dr = sqrt(1.0 / (3.0 * sigma_t[j] * 3.0 * sigma_t[j]) + r * r);
+        const double xoxi_dot_wr = xoxi.dot(wr);
+        const double wr_dot_no = wr.dot(no);
+        const double xoxi_dot_no = xoxi.dot(no);
+        const double wv_dot_no = wv.dot(no);
+        const double mu0 = -wr_dot_no;
+
+        SourceTerms real, virt;
+        for (int j = 0; j < SPECTRUM_SAMPLES; j++) {
+            // distance to real sources
+            const double cos_beta = -sqrt((r * r - xoxi_dot_wr * xoxi_dot_wr) / (r * r + de[j] * de[j]));
+            double dr;
+            if (mu0 > 0.0) {
+                dr = sqrt((D[j] * mu0) * ((D[j] * mu0) - de[j] * cos_beta * 2.0) + r * r);
+            } else {
+                dr = sqrt(1.0 / (3.0 * sigma_t[j] * 3.0 * sigma_t[j]) + r * r);
+            }
+            real.r[j] = dr;
+            real.xw[j] = xoxi_dot_wr;
+            real.wn[j] = wr_dot_no;
+            real.xn[j] = xoxi_dot_no;
+
+            // distance to virtual source
+            const Vec xoxv = xo - (xi + ni_s * (2.0 * A * de[j]));
+            virt.r[j] = xoxv.len();
+            virt.xw[j] = xoxv.dot(wv);
+            virt.wn[j] = wv_dot_no;
+            virt.xn[j] = xoxv.dot(no);
         }
 
-        // distance to virtual source
-        const Vec xoxv = xo - (xi + ni_s * (2.0 * A * de[j]));
-        const double dv = xoxv.len();
-
         // BSSRDF
-        const double result = Sp_d(xoxi, wr, dr, no, j) - Sp_d(xoxv, wv, dv, no, j);
+#if defined(MTS_SSE) && SPECTRUM_SAMPLES == 3
+        if (m_fastProfile) {
+            SSEVector value(_mm_max_ps(_mm_setzero_ps(),
+                    _mm_sub_ps(Sp_d_ps(real), Sp_d_ps(virt))));
+            for (int j = 0; j < SPECTRUM_SAMPLES; j++)
+                result[j] = value.f[j];
+            return;
+        }
+#endif
+        for (int j = 0; j < SPECTRUM_SAMPLES; j++) {
+            const double value = Sp_d(real, j) - Sp_d(virt, j);
 
-        // clamping to zero
-        return (result < 0.0) ? 0.0 : result;
+            // clamping to zero
+            result[j] = (value < 0.0) ? 0.0 : value;
+        }
     }
     // --------------------------------
 
@@ -127,6 +203,10 @@ public:
         : DirectSamplingSubsurface(props) {
 
         m_reciprocal = props.getBoolean("reciprocal", false);
+        /* Evaluate the profile for all channels at once, in single
+         * precision SSE (less accurate, e.g. for previews). Only has an
+         * effect in SSE builds with three spectral samples. */
+        m_fastProfile = props.getBoolean("fastProfile", false);
         lookupMaterial(props, m_sigmaS, m_sigmaA, m_g, &m_eta);
     }
 
@@ -136,6 +216,7 @@ public:
         m_sigmaA = Spectrum(stream);
         m_g = Spectrum(stream);
         m_reciprocal = stream->readBool();
+        m_fastProfile = stream->readBool();
         configure();
     }
 
@@ -158,7 +239,7 @@ public:
         ref<WeightIntersectionSampler> itsSampler(
                 new WeightIntersectionSampler(distanceWeightWrapper(
                     makeExactDiffusionDipoleDistanceWeight(m_sigmaA, m_sigmaS, m_g, m_eta)),
-                m_itsDistanceCutoff));
+                m_itsDistanceCutoff, m_itsWeightTolerance));
         registerSampler(1, new ProjSurfaceSampler(
                 DSSProjFrame::ENormalNormal,  // normal
                 exactDipoleSampler.get(), itsSampler.get()));
@@ -177,6 +258,7 @@ public:
         m_sigmaA.serialize(stream);
         m_g.serialize(stream);
         stream->writeBool(m_reciprocal);
+        stream->writeBool(m_fastProfile);
     }
 
     virtual Spectrum bssrdf(const Scene *scene, const Point &p_in, const Vector &d_in, const Normal &n_in,
@@ -189,13 +271,11 @@ public:
         Vec xo(p_out.x, p_out.y, p_out.z);
         Vec no(n_out.x, n_out.y, n_out.z);
         Vec wo(d_out.x, d_out.y, d_out.z);
-        for (int i = 0; i < SPECTRUM_SAMPLES; i++) {
-            if (m_reciprocal) {
-                transport[i] = 0.5 * (bssrdf(xi, ni, wi, xo, no, wo, i)
-                                    + bssrdf(xo, no, wo, xi, ni, wi, i));
-            } else {
-                transport[i] = bssrdf(xi, ni, wi, xo, no, wo, i);
-            }
+        bssrdf(xi, ni, wi, xo, no, wo, transport);
+        if (m_reciprocal) {
+            Spectrum reverse;
+            bssrdf(xo, no, wo, xi, ni, wi, reverse);
+            transport = 0.5f * (transport + reverse);
         }
 
         /* For eta != 1: modulate with Fresnel transmission.
@@ -261,6 +341,7 @@ public:
 protected:
     Spectrum m_sigmaS, m_sigmaA, m_g;
     bool m_reciprocal;
+    bool m_fastProfile;
 };
 
 MTS_IMPLEMENT_CLASS_S(DirectionalDipole, false, DirectSamplingSubsurface)
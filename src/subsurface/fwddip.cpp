@@ -21,9 +21,9 @@
 #include <mitsuba/render/skdtree.h>
 #include <mitsuba/render/truncnorm.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/statistics.h>
 #include <mitsuba/core/warp.h>
 #include <mitsuba/core/vmf.h>
-#include <gsl/gsl_sf_lambert.h>
 #include "../medium/materials.h"
 #include "fwdscat.h"
 #include "dipoleUtil.h"
@@ -33,14 +33,21 @@
 
 MTS_NAMESPACE_BEGIN
 
+static StatsCounter fwdDipBssrdfTime("Forward scattering dipole",
+        "BSSRDF evaluation", ETimeValue);
+static StatsCounter fwdDipSenseTime("Forward scattering dipole",
+        "Sensing ray casts", ETimeValue);
+static StatsCounter fwdDipLengthQueriesReused("Forward scattering dipole",
+        "Length queries reused", EPercentage);
+
 /// Helper functions to sample proportinal to 1/(xEpsilon + x) for x on [0..xMax]
-static inline Float inverseSampler_sample(Float xEps, Float xMax, Float u) {
-    SAssert(u >= 0 && u <= 1);
-    return -xEps  -  (xMax+xEps) * gsl_sf_lambert_W0(
+static inline double inverseSampler_sample(double xEps, double xMax, double u) {
+    SHotAssert(u >= 0 && u <= 1);
+    return -xEps  -  (xMax+xEps) * math::lambertW0<double>(
                 -exp((-u*xMax - xEps)/(xEps + xMax))
-                    * pow(xEps/(xEps + xMax), (Float)1.-u));
+                    * pow(xEps/(xEps + xMax), 1.-u));
 }
-static inline Float inverseSampler_pdf(Float xEps, Float xMax, Float x) {
+static inline double inverseSampler_pdf(double xEps, double xMax, double x) {
     if (x <= 0 || x >= xMax)
         return 0;
     return (xMax - x) / (
@@ -48,11 +55,11 @@ static inline Float inverseSampler_pdf(Float xEps, Float xMax, Float x) {
 }
 
 /// Helper functions to sample according to pdf(x) = -log(x) for x on [0..1]
-static inline Float logDivergenceSampler_sample(Float u) {
-    SAssert(u >= 0 && u <= 1);
-    return -u/gsl_sf_lambert_Wm1(-u/M_E);
+static inline double logDivergenceSampler_sample(double u) {
+    SHotAssert(u >= 0 && u <= 1);
+    return -u/math::lambertWm1<double>(-u/M_E_DBL);
 }
-static inline Float logDivergenceSampler_pdf(Float x) {
+static inline double logDivergenceSampler_pdf(double x) {
     if (x <= 0 || x >= 1)
         return 0;
     return -log(x);
@@ -66,21 +73,22 @@ public:
 
     virtual bool sample(int channel, Float &r,
             Sampler *sampler, Float *thePdf = NULL) const {
-        Float p = m_p[channel];
-        Float u = sampler->next1D();
-        r = sqrt(M_PI/6) * (1 - sqrt((1-u))) / p;
+        double p = m_p[channel];
+        double u = sampler->next1D();
+        r = (Float) (sqrt(M_PI_DBL/6) * (1 - sqrt((1-u))) / p);
         if (thePdf)
             *thePdf = pdf(channel, r);
         return true;
     }
     virtual Float pdf(int channel, Float r) const {
         // pdf in the plane! -> includes 1/(2*pi*r) factor
-        Float p = m_p[channel];
-        Float r_p1 = r*p;
-        Float max_r_p1 = sqrt(M_PI/6);
+        double p = m_p[channel];
+        double r_p1 = r*p;
+        double max_r_p1 = sqrt(M_PI_DBL/6);
         if (r_p1 > max_r_p1)
             return 0;
-        return p*p * sqrt(6.)*(sqrt(M_PI) - sqrt(6.)*r_p1) / (M_PI*M_PI*r_p1);
+        return (Float) (p*p * sqrt(6.)*(sqrt(M_PI_DBL) - sqrt(6.)*r_p1)
+                / (M_PI_DBL*M_PI_DBL*r_p1));
     }
 
     MTS_DECLARE_CLASS();
@@ -122,22 +130,20 @@ public:
     virtual bool sample(int channel, Vector2 &x, Float cosTheta,
             const Vector2 &xLo, const Vector2 &xHi,
             Sampler *sampler, Float *thePdf = NULL) const {
-        Assert(channel>=0);
-        Float p = m_p[channel];
+        HotAssert(channel>=0);
+        double p = m_p[channel];
         if (p == 0)
             return false;
-        Float phi = sampler->next1D() * TWO_PI;
-        Float sinPhi,cosPhi;
-        math::sincos(phi, &sinPhi, &cosPhi);
-        //Float r = 1 - sqrt(sampler->next1D()); // triangle
-        Float u = sampler->next1D();
-        Float s = sin(1./3.*atan2(2*sqrt(u*(1-u)), 1-2*u));
-        Float c = math::safe_sqrt(1 - s*s);
-        Float r = m_rCutoff * pow(
-                (Float) 0.5 * (1 - c) * (2 + c + sqrt(3.)*s),
-                (Float) 3./2.);
-        x[0] = sinPhi * r / p;
-        x[1] = cosPhi * r / p;
+        double phi = sampler->next1D() * TWO_PI_DBL;
+        double sinPhi = std::sin(phi), cosPhi = std::cos(phi);
+        //double r = 1 - sqrt(sampler->next1D()); // triangle
+        double u = sampler->next1D();
+        double s = sin(1./3.*atan2(2*sqrt(u*(1-u)), 1-2*u));
+        double c = math::safe_sqrt(1 - s*s);
+        double r = m_rCutoff * pow(
+                0.5 * (1 - c) * (2 + c + sqrt(3.)*s), 3./2.);
+        x[0] = (Float) (sinPhi * r / p);
+        x[1] = (Float) (cosPhi * r / p);
         if (thePdf)
             *thePdf = pdf(channel, x, cosTheta, xLo, xHi);
         return true;
@@ -145,15 +151,15 @@ public:
 
     virtual Float pdf(int channel, Vector2 x, Float cosTheta,
             const Vector2 &xLo, const Vector2 &xHi) const {
-        Assert(channel>=0);
-        Float p = m_p[channel];
-        Float r = x.length() * p;
+        HotAssert(channel>=0);
+        double p = m_p[channel];
+        double r = std::sqrt((double) x[0]*x[0] + (double) x[1]*x[1]) * p;
         //if (p == 0 || r > 1)
         if (p == 0 || r >= m_rCutoff)
             return 0;
-        //Float pdf_r = 2*(1-r); // triangle
-        Float pdf_r = 2*(pow(m_rCutoff*m_rCutoff * r, (Float) -1./3.) - 1/m_rCutoff);
-        return pdf_r * p*p / (TWO_PI*r);
+        //double pdf_r = 2*(1-r); // triangle
+        double pdf_r = 2*(pow(m_rCutoff*m_rCutoff * r, -1./3.) - 1/m_rCutoff);
+        return (Float) (pdf_r * p*p / (TWO_PI_DBL*r));
     }
 
     MTS_DECLARE_CLASS();
@@ -161,7 +167,7 @@ public:
 protected:
     virtual ~FwdDipSmallLengthSamplerPerpToDir() { }
     const Spectrum m_p;
-    const Float m_rCutoff = 1; // max radial distance
+    const double m_rCutoff = 1; // max radial distance
 };
 
 /*
@@ -192,20 +198,20 @@ public:
     virtual bool sample(int channel, Vector2 &x, Float cosTheta,
             const Vector2 &xLo, const Vector2 &xHi,
             Sampler *sampler, Float *thePdf = NULL) const {
-        Assert(channel>=0);
-        Float p = m_p[channel];
+        HotAssert(channel>=0);
+        double p = m_p[channel];
         if (p == 0)
             return false;
 
         // We work in p=1
 
-        Float Rmax, dMin, dMax;
+        double Rmax, dMin, dMax;
         getSamplingBounds(channel, xLo, xHi, Rmax, dMin, dMax);
 
         /* Sampling R: MIS between uniform back-up and importance sampled 
          * weight. */
-        Float R;
-        Float u = sampler->next1D();
+        double R;
+        double u = sampler->next1D();
         if (u < RUniformWeight) {
             u = u / RUniformWeight;
             R = Rmax * u;
@@ -215,17 +221,17 @@ public:
              * (see pdf() for the exact pdf) */
             R = inverseSampler_sample(Rmin, Rmax, u);
         }
-        Assert(std::isfinite(R));
-        AssertWarn(R >= 0 && R <= Rmax);
+        HotAssert(std::isfinite(R));
+        HotAssertWarn(R >= 0 && R <= Rmax);
 
         /* Sampling 'sideways' displacement d */
-        Float stddev = dMaxSafetyScale * sqrt(R*R*R/6);
-        Float d = truncnorm(0, stddev, dMin, dMax, sampler);
+        double stddev = dMaxSafetyScale * sqrt(R*R*R/6);
+        double d = truncnorm(0, stddev, dMin, dMax, sampler);
 
         /* We should displace ourselves backwards along the outgoing
          * direction to sample the query point! */
-        x[0] = -R/p; // 'backwards'
-        x[1] = d/p;
+        x[0] = (Float) (-R/p); // 'backwards'
+        x[1] = (Float) (d/p);
 
         if (thePdf)
             *thePdf = pdf(channel, x, cosTheta, xLo, xHi);
@@ -235,31 +241,31 @@ public:
 
     virtual Float pdf(int channel, Vector2 x, Float cosTheta,
             const Vector2 &xLo, const Vector2 &xHi) const {
-        Assert(channel>=0);
-        Float p = m_p[channel];
-        Float R = -x[0]*p; // displacement is backwards along the query point!
-        Float d = x[1]*p;
-        Float Rmax, dMin, dMax;
+        HotAssert(channel>=0);
+        double p = m_p[channel];
+        double R = -x[0]*p; // displacement is backwards along the query point!
+        double d = x[1]*p;
+        double Rmax, dMin, dMax;
         getSamplingBounds(channel, xLo, xHi, Rmax, dMin, dMax);
         if (p == 0 || R < 0 || R > Rmax)
             return 0;
 
         // check consistency of bounds (note: dMin < 0, hence the +Epsilon!):
-        AssertWarn(d >= dMin*(1+Epsilon) && d <= dMax*(1+Epsilon));
-
-        Float stddev = dMaxSafetyScale * sqrt(R*R*R/6);
-        Float dPdf = truncnormPdf(0, stddev, dMin, dMax, d);
-        Float RpdfImp = inverseSampler_pdf(Rmin, Rmax, R);
-        Float RpdfUnif = 1. / Rmax;
-        Float Rpdf = RpdfUnif * RUniformWeight  +  RpdfImp * (1 - RUniformWeight);
-        Assert(std::isfinite(Rpdf) && Rpdf >= 0);
-        return Rpdf * dPdf * p*p;
+        HotAssertWarn(d >= dMin*(1+Epsilon) && d <= dMax*(1+Epsilon));
+
+        double stddev = dMaxSafetyScale * sqrt(R*R*R/6);
+        double dPdf = truncnormPdf(0, stddev, dMin, dMax, d);
+        double RpdfImp = inverseSampler_pdf(Rmin, Rmax, R);
+        double RpdfUnif = 1. / Rmax;
+        double Rpdf = RpdfUnif * RUniformWeight  +  RpdfImp * (1 - RUniformWeight);
+        HotAssert(std::isfinite(Rpdf) && Rpdf >= 0);
+        return (Float) (Rpdf * dPdf * p*p);
     }
 
     inline void getSamplingBounds(int channel,
             const Vector2 &xLo, const Vector2 &xHi,
-            Float &Rmax, Float &dMin, Float &dMax) const {
-        Float p = m_p[channel];
+            double &Rmax, double &dMin, double &dMax) const {
+        double p = m_p[channel];
         // First dimension (u or d_out):
         /* Remember: d_out is opposite direction than our 
          * projection/sampling direction, so the Rmax bound is given by xLo 
@@ -279,16 +285,16 @@ protected:
 
     /* How much wider we make the sample area, to make sure we have covered
      * the peak properly. */
-    const Float dMaxSafetyScale = 2;
+    const double dMaxSafetyScale = 2;
 
     /* Boundaries for sampling R according to "~1/(Rmin + R)" with cut-off 
      * above Rmax and with Rmin denoting the inflection point towards an 
      * asymptotically uniform distribution for R < Rmin (i.e. R -> 0). */
-    const Float Rmin = 1e-10;
-    const Float RmaxDefault = 0.2; // gets clipped if bounding box is tighter
+    const double Rmin = 1e-10;
+    const double RmaxDefault = 0.2; // gets clipped if bounding box is tighter
 
     /* Sample R uniformly between 0 and Rmax with this weight: */
-    const Float RUniformWeight = 0.4;
+    const double RUniformWeight = 0.4;
 };
 
 inline IntersectionWeightFunc fwdDipSmallLengthWeightFunc(
@@ -300,13 +306,13 @@ inline IntersectionWeightFunc fwdDipSmallLengthWeightFunc(
 
     return [=] (const Intersection &its_in, const Intersection &its_out,
             const Vector &d_out, int i) {
-        SAssert(i>=0);
+        SHotAssert(i>=0);
         Vector rVec = its_out.p - its_in.p; // dimensionfull
         if (rVec.length() == 0)
             return (Float) 1.0f;
         Float cosTheta = dot(d_out, normalize(rVec));
         Float p = pSpec[i];
-        SAssert(p >= 0);
+        SHotAssert(p >= 0);
         if (p == 0)
             return (Float) 0.0f;
         Float R = rVec.length() * p; // dimensionless
@@ -328,8 +334,8 @@ inline IntersectionWeightFunc fwdDipSmallLengthWeightFunc(
         if (rVec.length() > 1/p) 
             result *= exp(-(rVec.length() - 1/p) * sigmaTr[i]);
 
-        SAssert(std::isfinite(result));
-        SAssert(result >= 0);
+        SHotAssert(std::isfinite(result));
+        SHotAssert(result >= 0);
         return result;
     };
 }
@@ -345,7 +351,7 @@ public:
             const Vector &d_out, const Scene *scene,
             const std::vector<Shape *> &shapes,
             Intersection &newIts, int channel,
-            Sampler *sampler) const {
+            Sampler *sampler, DSSProbeContext *probes = NULL) const {
         Vector rayDir;
         Float dirPdf = sampleDir(its, d_out, scene, shapes, channel, sampler, rayDir);
 
@@ -353,13 +359,13 @@ public:
         Point startPoint = getStartPoint(its, d_out);
         Float intersectionProb = m_itsSampler->sample(newIts, scene,
                 startPoint, rayDir, its.time,
-                shapes, its, d_out, channel, sampler, false);
+                shapes, its, d_out, channel, sampler, false, probes);
         if (intersectionProb == 0)
             return 0.0f;
 
         // Change of var
         Float r = distance(startPoint, newIts.p);
-        AssertWarn(r <= m_itsSampler->getItsDistanceCutoff() * 1.01);
+        HotAssertWarn(r <= m_itsSampler->getItsDistanceCutoff() * 1.01);
         Float surfaceCosine = dot(rayDir, newIts.geoFrame.n);
         Float absSurfCosine = math::abs(surfaceCosine);
         if (absSurfCosine <= MTS_DSS_COSINE_CUTOFF) {
@@ -612,11 +618,15 @@ public:
         /* Collect all intersections up to a distance of 1/p */
         Float tMax = channel == -1 ?
                 1.0/m_p.min() : 1.0/m_p[channel];
-        std::vector<Intersection> senseIntersections;
+        IntersectionList &senseIntersections = m_senseIntersections.get();
+        senseIntersections.clear();
         Vector senseDir = sensePerturb ? 
                 normalize(-d_out + *sensePerturb) : -d_out;
-        scene->rayIntersectFully(Ray(its.p, senseDir, Epsilon, tMax, its.time),
-                senseIntersections, &shapes);
+        {
+            ScopedStatsTimer timer(fwdDipSenseTime);
+            scene->rayIntersectFully(Ray(its.p, senseDir, Epsilon, tMax, its.time),
+                    senseIntersections, &shapes);
+        }
         if (senseIntersections.size() == 0)
             return false;
 
@@ -653,13 +663,13 @@ public:
 
     inline bool sampleWithSensing_internalVmf(
             int channel, Float distance, VonMisesFisherDistr &vmf) const {
-        Assert(channel>=0);
+        HotAssert(channel>=0);
         Float r = distance * m_p[channel];
-        Assert(r >= 0);
+        HotAssert(r >= 0);
         Float kappa = m_sampleWithSensingSafetyFactor * 2.5 / r;
         if (!std::isfinite(kappa))
             return false;
-        Assert(kappa >= 0);
+        HotAssert(kappa >= 0);
         //kappa = std::min(kappa, 1.0 / Epsilon); // clamp cosTheta in the range of Epsilon
         vmf = VonMisesFisherDistr(kappa);
         return true;
@@ -676,7 +686,8 @@ public:
     virtual Float pdf(const Intersection &its,
             const Vector &d_out, const Scene *scene,
             const std::vector<Shape *> &shapes,
-            const Intersection &newIts, int channel) const {
+            const Intersection &newIts, int channel,
+            DSSProbeContext *probes = NULL) const {
         Point startPoint = getStartPoint(its, d_out);
         Vector rayDirUnnorm = newIts.p - startPoint;
         Float t = rayDirUnnorm.length();
@@ -702,13 +713,13 @@ public:
         // Intersection prob
         Float intersectionProb = m_itsSampler->pdf(newIts, scene,
                 startPoint, rayDir, its.time,
-                shapes, its, d_out, channel, false);
+                shapes, its, d_out, channel, false, probes);
         if (intersectionProb == 0)
             return 0.0f;
 
         // Change of var
         Float r = distance(startPoint, newIts.p);
-        AssertWarn(r <= m_itsSampler->getItsDistanceCutoff() * 1.01);
+        HotAssertWarn(r <= m_itsSampler->getItsDistanceCutoff() * 1.01);
         Float solidAngleToAreaWeight = absSurfCosine/(r*r);
         Float pdf = solidAngleToAreaWeight * dirPdf * intersectionProb;
         if (!std::isfinite(pdf))
@@ -782,6 +793,9 @@ protected:
     const Float m_sensingWeight = 0.5;
 
     const ref<const IntersectionSampler> m_itsSampler;
+
+    /// Per-thread scratch list for the 'depth sensing' intersections
+    mutable PrimitiveThreadLocal<IntersectionList> m_senseIntersections;
 };
 
 
@@ -859,6 +873,26 @@ protected:
  *         absorption length over all channels.
  *         \default{10}
  *     }
+ *     \parameter{itsWeightTolerance}{\Float}{
+ *         Stop collecting candidate points along a projection probe once
+ *         the remaining ones only contribute this fraction of the total
+ *         sampling weight. Speeds up rendering of finely tessellated
+ *         geometry at the cost of a small bias; zero disables this.
+ *         \default{0}
+ *     }
+ *     \parameter{radianceCacheSamples}{\Integer}{
+ *         Number of points on the boundary at which the incident radiance
+ *         gets cached during preprocessing. Rays that leave the medium
+ *         then look up the cache instead of recursively querying the
+ *         integrator. This is biased and only sensible for static,
+ *         low-frequency lighting; zero disables the cache.
+ *         \default{0}
+ *     }
+ *     \parameter{radianceCacheDirections, radianceCacheBands}{\Integer}{
+ *         Number of radiance samples per cache point and number of
+ *         spherical harmonics bands they get projected onto.
+ *         \default{256 and 3}
+ *     }
  *     \parameter{reciprocal}{\Boolean}{
  *         Force reciprocity of the model?
  *         \default{\code{false}}
@@ -906,6 +940,17 @@ protected:
  *         greatly diminished variance.
  *         \default{\code{false}}
  *     }
+ *     \parameter{kernelMode}{\String}{
+ *         How to evaluate the length dependent part of the BSSRDF.
+ *         \begin{enumerate}[(i)]
+ *             \item \code{exact}:     Evaluate the analytical expressions.
+ *             \item \code{tabulated}: Interpolate in a precomputed table,
+ *                                     which is faster at the cost of a
+ *                                     relative error of at most $10^{-6}$.
+ *                                     Sampling is always exact.
+ *         \end{enumerate}
+ *         \default{\texttt{exact}}
+ *     }
  *     \parameter{onlyReal}{\Boolean}{
  *         Only show the contributions of the real source of the dipole.
  *         This is mainly for testing/debugging purposes.
@@ -925,6 +970,13 @@ protected:
  *         emitted back to the inside of the boundary.
  *         \default{\code{false}}
  *     }
+ *     \parameter{preprocessCacheDir}{\String}{
+ *         Directory in which the precomputed data of this model is cached
+ *         between renders. It is reused as long as the scene geometry, the
+ *         emitters, the integrator and the parameters of this model do not
+ *         change (e.g. when only the camera moves).
+ *         \default{none, i.e. no caching}
+ *     }
  * }
  *
  * This plugin implements the forward scattering dipole model from
@@ -993,6 +1045,15 @@ public:
 
         m_useEffectiveBRDF = props.getBoolean("useEffectiveBRDF", false);
 
+        std::string kernelModeStr = props.getString("kernelMode", "exact");
+        if (kernelModeStr == "exact") {
+            m_kernelMode = FwdScat::EExactKernel;
+        } else if (kernelModeStr == "tabulated") {
+            m_kernelMode = FwdScat::ETabulatedKernel;
+        } else {
+            Log(EError, "Unknown kernelMode: %s", kernelModeStr.c_str());
+        }
+
         lookupMaterial(props, m_sigmaS, m_sigmaA, m_g, &m_eta);
         Log(EInfo, "Loaded FwdDip with:\n"
                 "sigma_s = %s\nsigma_a = %s\ng = %s\np= %s\neta = %f",
@@ -1027,6 +1088,7 @@ public:
         m_zvMode = static_cast<FwdScat::ZvMode>(stream->readInt());
         m_dipoleMode = static_cast<FwdScat::DipoleMode>(stream->readInt());
         m_useEffectiveBRDF = stream->readBool();
+        m_kernelMode = static_cast<FwdScat::KernelMode>(stream->readInt());
         configure();
     }
 
@@ -1041,6 +1103,7 @@ public:
         stream->writeInt(m_zvMode);
         stream->writeInt(m_dipoleMode);
         stream->writeBool(m_useEffectiveBRDF);
+        stream->writeInt(m_kernelMode);
     }
 
 
@@ -1054,26 +1117,24 @@ public:
             Float *lengths, const Spectrum &throughput,
             Sampler *sampler) const {
         Spectrum weights;
-        Vector R = p_out - p_in;
-        if (m_useEffectiveBRDF)
-            Assert(R.isZero());
+        HotAssert(!m_useEffectiveBRDF || p_out == p_in);
         if (m_fwdScat.size() == 1) {
+            double s;
             weights = Spectrum(m_fwdScat[0]->sampleLengthDipole(
-                        d_out, n_out, R, d_in, n_in, m_tangentMode,
-                        lengths[0], sampler));
-            if (weights[0] == 0.0f)
-                lengths[0] = -1;
+                        getLengthQuery(p_in, n_in, d_in, p_out, n_out,
+                            d_out, 0), s, sampler));
+            lengths[0] = weights[0] == 0.0f ? -1 : (Float) s;
         } else {
             for (int i = 0; i < SPECTRUM_SAMPLES; i++) {
                 if (throughput[i] == 0) {
                     weights[i] = 0;
                     lengths[i] = -1;
                 } else {
+                    double s;
                     weights[i] = m_fwdScat[i]->sampleLengthDipole(
-                                d_out, n_out, R, d_in, n_in, m_tangentMode,
-                                lengths[i], sampler);
-                    if (weights[i] == 0.0f)
-                        lengths[i] = -1;
+                                getLengthQuery(p_in, n_in, d_in, p_out,
+                                    n_out, d_out, i), s, sampler);
+                    lengths[i] = weights[i] == 0.0f ? -1 : (Float) s;
                 }
             }
         }
@@ -1086,25 +1147,65 @@ public:
             const Point &p_out, const Vector &n_out, const Vector &d_out,
             const Float *lengths, const Spectrum &throughput) const {
         Spectrum pdf;
-        Vector R = p_out - p_in;
         if (m_fwdScat.size() == 1) {
             if (lengths[0] == -1)
                 return Spectrum(0.0f);
             pdf = Spectrum(m_fwdScat[0]->pdfLengthDipole(
-                        d_out, n_out, R, d_in, n_in, m_tangentMode, lengths[0]));
+                        getLengthQuery(p_in, n_in, d_in, p_out, n_out,
+                            d_out, 0), lengths[0]));
         } else {
             for (int i = 0; i < SPECTRUM_SAMPLES; i++) {
                 if (throughput[i] == 0 || lengths[i] == -1) {
                     pdf[i] = 0;
                 } else {
                     pdf[i] = m_fwdScat[i]->pdfLengthDipole(
-                                d_out, n_out, R, d_in, n_in, m_tangentMode, lengths[i]);
+                                getLengthQuery(p_in, n_in, d_in, p_out,
+                                    n_out, d_out, i), lengths[i]);
                 }
             }
         }
         return pdf;
     }
 
+    /**
+     * Length query of the given channel for this configuration. The
+     * queries of the last configuration with an unknown and with a known
+     * d_in are kept per thread: the SIR loop samples lengths (and
+     * evaluates their MIS weights) for the same incoming point over and
+     * over, mostly with an unknown d_in. */
+    inline const FwdScat::LengthQuery &getLengthQuery(
+            const Point &p_in,  const Vector &n_in,  const Vector *d_in,
+            const Point &p_out, const Vector &n_out, const Vector &d_out,
+            int channel) const {
+        fwdDipLengthQueriesReused.incrementBase();
+        LengthQuerySlot &slot = m_lengthQueries.get().slots[d_in ? 1 : 0];
+        if (!(slot.p_in == p_in && slot.n_in == n_in
+                && slot.p_out == p_out && slot.n_out == n_out
+                && slot.d_out == d_out && (!d_in || slot.d_in == *d_in))) {
+            slot.p_in = p_in;
+            slot.n_in = n_in;
+            slot.p_out = p_out;
+            slot.n_out = n_out;
+            slot.d_out = d_out;
+            if (d_in)
+                slot.d_in = *d_in;
+            slot.preparedChannels = 0;
+        }
+        if (slot.preparedChannels & (1 << channel)) {
+            ++fwdDipLengthQueriesReused;
+        } else {
+            Vector3d u0;
+            if (d_in)
+                u0 = Vector3d(*d_in);
+            m_fwdScat[channel]->prepareLengthQuery(Vector3d(d_out),
+                    Vector3d(n_out), Point3d(p_out) - Point3d(p_in),
+                    d_in ? &u0 : NULL, Vector3d(n_in), m_tangentMode,
+                    slot.queries[channel]);
+            slot.preparedChannels |= 1 << channel;
+        }
+        return slot.queries[channel];
+    }
+
     size_t extraParamsSize() const {
         return sizeof(ExtraParams);
     }
@@ -1119,10 +1220,10 @@ public:
         Point p_in = its_in.p;
         Point p_out = its_out.p;
 
-        Assert(dot(d_out, n_out) >= -Epsilon);
-        Assert(!d_in || dot(*d_in, n_in) <= Epsilon);
-        Assert(!m_useEffectiveBRDF || n_in == n_out);
-        Assert(!m_useEffectiveBRDF || p_in == p_out);
+        HotAssert(dot(d_out, n_out) >= -Epsilon);
+        HotAssert(!d_in || dot(*d_in, n_in) <= Epsilon);
+        HotAssert(!m_useEffectiveBRDF || n_in == n_out);
+        HotAssert(!m_useEffectiveBRDF || p_in == p_out);
 
         Spectrum extraParamsPdf = sampleLengths(p_in, n_in, d_in,
                 p_out, n_out, d_out, getLengths(extraParams), throughput,
@@ -1139,10 +1240,10 @@ public:
         Point p_in = its_in.p;
         Point p_out = its_out.p;
 
-        Assert(dot(d_out, n_out) >= -Epsilon);
-        Assert(!d_in || dot(*d_in, n_in) <= Epsilon);
-        Assert(!m_useEffectiveBRDF || n_in == n_out);
-        Assert(!m_useEffectiveBRDF || p_in == p_out);
+        HotAssert(dot(d_out, n_out) >= -Epsilon);
+        HotAssert(!d_in || dot(*d_in, n_in) <= Epsilon);
+        HotAssert(!m_useEffectiveBRDF || n_in == n_out);
+        HotAssert(!m_useEffectiveBRDF || p_in == p_out);
 
         Spectrum extraParamsPdf = pdfLengths(p_in, n_in, d_in,
                 p_out, n_out, d_out, getLengths(extraParams), throughput);
@@ -1200,7 +1301,7 @@ public:
         Float cosTheta = d_in_local.z;
         d_in_local.z *= -1; // Pointing inwards
         d_in = frame.toWorld(d_in_local);
-        AssertWarn(dot(d_in, n_in) <= 0);
+        HotAssertWarn(dot(d_in, n_in) <= 0);
         return cosTheta * INV_PI;
     }
 
@@ -1216,14 +1317,17 @@ public:
             Vector &d_in, const Vector &n_in,
             const Vector &d_out, const Vector &n_out,
             const Vector &R, Float s, Sampler *sampler) const {
-        Assert(s>=0);
-        Assert(dot(d_out, n_out) >= -Epsilon);
-        Assert(!m_useEffectiveBRDF || n_in == n_out);
-        Assert(!m_useEffectiveBRDF || R.isZero());
-
-        Float thePdf = m_fwdScat[i]->sampleDirectionDipole(
-                        d_in, n_in, d_out, n_out, R, s, m_tangentMode,
-                        m_useEffectiveBRDF, sampler);
+        HotAssert(s>=0);
+        HotAssert(dot(d_out, n_out) >= -Epsilon);
+        HotAssert(!m_useEffectiveBRDF || n_in == n_out);
+        HotAssert(!m_useEffectiveBRDF || R.isZero());
+
+        Vector3d u0;
+        Float thePdf = (Float) m_fwdScat[i]->sampleDirectionDipole(
+                        u0, Vector3d(n_in), Vector3d(d_out), Vector3d(n_out),
+                        Vector3d(R), s, m_tangentMode, m_useEffectiveBRDF,
+                        sampler);
+        d_in = Vector(u0);
         if (thePdf == 0) {
             /* Note: Or use hemisphere sampler? (nah: if dipole sampling
              * fails, that means bssrdf evaluation will fail as well [for
@@ -1237,8 +1341,8 @@ public:
             Log(EWarn, "Inconsistent direction pdf: %e vs %e, rel %f",
                     thePdf, pdfCheck, (thePdf-pdfCheck)/thePdf);
 #endif
-        Assert(thePdf >= 0);
-        AssertWarn(thePdf > 0);
+        HotAssert(thePdf >= 0);
+        HotAssertWarn(thePdf > 0);
         return thePdf;
     }
 
@@ -1246,13 +1350,14 @@ public:
             const Vector &d_in, const Vector &n_in,
             const Vector &d_out, const Vector &n_out,
             const Vector &R, Float s) const {
-        Assert(s>=0);
-        Assert(dot(d_out, n_out) >= -Epsilon);
-        Assert(!m_useEffectiveBRDF || n_in == n_out);
-        Assert(!m_useEffectiveBRDF || R.isZero());
-
-        return m_fwdScat[i]->pdfDirectionDipole(
-                            d_in, n_in, d_out, n_out, R, s, m_tangentMode,
+        HotAssert(s>=0);
+        HotAssert(dot(d_out, n_out) >= -Epsilon);
+        HotAssert(!m_useEffectiveBRDF || n_in == n_out);
+        HotAssert(!m_useEffectiveBRDF || R.isZero());
+
+        return (Float) m_fwdScat[i]->pdfDirectionDipole(
+                            Vector3d(d_in), Vector3d(n_in), Vector3d(d_out),
+                            Vector3d(n_out), Vector3d(R), s, m_tangentMode,
                             m_useEffectiveBRDF);
     }
 
@@ -1282,7 +1387,7 @@ public:
                     effectiveThroughput[j] = 0;
             }
             int i = effectiveThroughput.sampleNonZeroChannelUniform(sampler);
-            Assert(lengths[i] >= 0);
+            HotAssert(lengths[i] >= 0);
             Float pdf = sampleDirection(i,
                     d_in, n_in, d_out, n_out, R, lengths[i], sampler);
             if (pdf == 0)
@@ -1329,8 +1434,21 @@ public:
             const Point &p_in,  const Vector &d_in,  const Normal &n_in,
             const Point &p_out, const Vector &d_out, const Normal &n_out,
             const void *extraParams) const {
-        Assert(MTS_DSS_ALLOW_INTERNAL_INCOMING_DIR || dot(d_in, n_in) <= 0);
-        Assert(m_allowIncomingOutgoingDirections || dot(d_out, n_out) >= 0);
+        HotAssert(MTS_DSS_ALLOW_INTERNAL_INCOMING_DIR || dot(d_in, n_in) <= 0);
+        HotAssert(m_allowIncomingOutgoingDirections || dot(d_out, n_out) >= 0);
+        ScopedStatsTimer timer(fwdDipBssrdfTime);
+        /* The refraction at the boundary only depends on eta, which is the
+         * same for all channels, so do it only once */
+        FwdScat::DipoleQuery query, reverse;
+        if (!m_fwdScat[0]->prepareDipoleQuery(Vector3d(n_in),
+                Vector3d(d_in), Vector3d(n_out), Vector3d(d_out), query))
+            return Spectrum(0.0f);
+        if (m_reciprocal)
+            m_fwdScat[0]->prepareDipoleQuery(Vector3d(n_out),
+                    -query.uL, Vector3d(n_in), -query.u0, reverse);
+
+        const Float *lengths = getLengths(extraParams);
+        const Vector3d R = Point3d(p_out) - Point3d(p_in);
         Spectrum result;
         for (int i = 0; i < SPECTRUM_SAMPLES; i++) {
             // Shortcut for when the given spectra are effectively 1D:
@@ -1340,23 +1458,34 @@ public:
             }
 
             const FwdScat *fwdScat = m_fwdScat[i].get();
+            HotAssert(fwdScat->getEta() == m_fwdScat[0]->getEta());
 
-            const Float *lengths = getLengths(extraParams);
             Float s = lengths[i];
             if (s == -1) {
                 result[i] = 0;
                 continue;
             }
 
-            result[i] = fwdScat->evalDipole(
-                    n_in, d_in, n_out, d_out, p_out - p_in, s,
-                    m_rejectInternalIncoming, m_reciprocal,
+            result[i] = (Float) fwdScat->evalDipole(query,
+                    m_reciprocal ? &reverse : NULL, R, s,
+                    m_rejectInternalIncoming,
                     m_tangentMode, m_zvMode, m_useEffectiveBRDF,
                     m_dipoleMode);
         }
         return result;
     }
 
+    void bssrdfBatch(const Scene *scene, size_t count,
+            const Point *p_in,  const Vector *d_in,  const Normal *n_in,
+            const Point &p_out, const Vector &d_out, const Normal &n_out,
+            const char *extraParams, Spectrum *result) const {
+        /* Qualified call: no virtual dispatch per entry, so that bssrdf()
+         * can get inlined into this loop */
+        size_t parSize = extraParamsSize();
+        for (size_t i = 0; i < count; i++)
+            result[i] = FwdDip::bssrdf(scene, p_in[i], d_in[i], n_in[i],
+                    p_out, d_out, n_out, extraParams + i*parSize);
+    }
 
 
     Spectrum sampleBssrdfDirection(const Scene *scene,
@@ -1413,13 +1542,15 @@ public:
          && m_g.max() == m_g.min()) {
             // Effective 1D problem as far as spectral channels are concerned
             m_fwdScat.resize(1);
-            m_fwdScat[0] = new FwdScat(
-                    m_g.min(), m_sigmaS.min(), m_sigmaA.min(), m_eta);
+            m_fwdScat[0] = FwdScat::getCached(
+                    m_g.min(), m_sigmaS.min(), m_sigmaA.min(), m_eta,
+                    m_kernelMode);
         } else {
             m_fwdScat.resize(SPECTRUM_SAMPLES);
             for (int i = 0; i < SPECTRUM_SAMPLES; i++)
-                m_fwdScat[i] = new FwdScat(
-                        m_g[i], m_sigmaS[i], m_sigmaA[i], m_eta);
+                m_fwdScat[i] = FwdScat::getCached(
+                        m_g[i], m_sigmaS[i], m_sigmaA[i], m_eta,
+                        m_kernelMode);
         }
 
         Spectrum sigmaSPrime = m_sigmaS * (Spectrum(1.0f) - m_g);
@@ -1452,23 +1583,23 @@ public:
                     new WeightIntersectionSampler(distanceWeightWrapper(
                             makeExactDiffusionDipoleDistanceWeight(
                             m_sigmaA, m_sigmaS, m_g, m_eta)),
-                    m_itsDistanceCutoff);
+                    m_itsDistanceCutoff, m_itsWeightTolerance);
 
             ref<IntersectionSampler> itsSamplerEffectiveExtinction =
                     new WeightIntersectionSampler(distanceWeightWrapper(
                             makeExponentialDistanceWeight(sigmaTr)),
-                    m_itsDistanceCutoff);
+                    m_itsDistanceCutoff, m_itsWeightTolerance);
 
             ref<IntersectionSampler> itsSamplerFwdDipSmallLenR2 =
                     new WeightIntersectionSampler(
                             fwdDipSmallLengthWeightFunc(
                                 m_sigmaS, m_sigmaA, m_g, false),
-                    m_itsDistanceCutoff);
+                    m_itsDistanceCutoff, m_itsWeightTolerance);
             ref<IntersectionSampler> itsSamplerFwdDipSmallLenR3 =
                     new WeightIntersectionSampler(
                             fwdDipSmallLengthWeightFunc(
                                 m_sigmaS, m_sigmaA, m_g, true),
-                    m_itsDistanceCutoff);
+                    m_itsDistanceCutoff, m_itsWeightTolerance);
 
             std::vector<std::pair<Float, const IntersectionSampler*> > is;
             is.push_back(std::make_pair(0.1, itsSamplerEffectiveExtinction.get()));
@@ -1555,12 +1686,28 @@ private:
     FwdScat::ZvMode m_zvMode;
     FwdScat::DipoleMode m_dipoleMode;
     bool m_useEffectiveBRDF;
+    FwdScat::KernelMode m_kernelMode;
     ref_vector<FwdScat> m_fwdScat; // Initialized by configure()
 
     struct ExtraParams {
         Float lengths[SPECTRUM_SAMPLES];
     };
 
+    /// Prepared length queries of a configuration, see getLengthQuery()
+    struct LengthQuerySlot {
+        Point p_in, p_out;
+        Vector n_in, n_out, d_out, d_in;
+        uint32_t preparedChannels; /// Bit mask of the valid queries
+        FwdScat::LengthQuery queries[SPECTRUM_SAMPLES];
+
+        LengthQuerySlot() : p_in(std::numeric_limits<Float>::quiet_NaN()),
+            preparedChannels(0) { }
+    };
+    struct LengthQueryCache {
+        LengthQuerySlot slots[2]; /// Unknown and known d_in
+    };
+    mutable PrimitiveThreadLocal<LengthQueryCache> m_lengthQueries;
+
     static const Float* getLengths(const void *extraParams) {
         const ExtraParams &params(
                 *static_cast<const ExtraParams*>(extraParams));
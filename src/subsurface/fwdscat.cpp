@@ -1,7 +1,52 @@
 #include "fwdscat.h"
+#include <mitsuba/core/lock.h>
+#include <tuple>
 
 MTS_NAMESPACE_BEGIN
 
+typedef std::tuple<Float, Float, Float, Float, int> FwdScatCacheKey;
+static ref<Mutex> fwdScatCacheMutex = new Mutex();
+static std::map<FwdScatCacheKey, ref<FwdScat> > fwdScatCache;
+
+FwdScatKernelTable::FwdScatKernelTable() {
+    /* Below this, 1/ps amplifies the interpolation error too much; above
+     * it, the exact expressions are asymptotic and cheap anyway */
+    const double psMin = 1e-3, psMax = 20;
+    m_logPsMin = std::log(psMin);
+    m_logPsMax = std::log(psMax);
+    m_invStep = (EResolution - 1) / (m_logPsMax - m_logPsMin);
+
+    /* With mu = 1, sigma_s = 2 and sigma_a = 0, we have p = 1 and the
+     * lengths correspond to ps directly */
+    ref<FwdScat> unit = new FwdScat(0.0f, 2.0f, 0.0f, 1.0f);
+    for (int i = 0; i < EResolution; i++) {
+        double logPs = m_logPsMin + i / m_invStep;
+        double ps = std::exp(logPs);
+        double C, D, E, F;
+        unit->calcValues(ps, C, D, E, F);
+        m_values[0][i] = D * ps;
+        m_values[1][i] = E * ps * ps;
+        m_values[2][i] = F * ps * ps * ps;
+        m_values[3][i] = std::log(unit->absorptionAndNormalizationConstant(ps))
+                + 5.5 * logPs;
+    }
+}
+
+const FwdScatKernelTable &FwdScat::getKernelTable() {
+    static FwdScatKernelTable table;
+    return table;
+}
+
+FwdScat *FwdScat::getCached(Float g, Float sigma_s, Float sigma_a,
+        Float eta, KernelMode kernelMode) {
+    FwdScatCacheKey key(g, sigma_s, sigma_a, eta, kernelMode);
+    LockGuard lock(fwdScatCacheMutex);
+    ref<FwdScat> &entry = fwdScatCache[key];
+    if (entry.get() == NULL)
+        entry = new FwdScat(g, sigma_s, sigma_a, eta, kernelMode);
+    return entry.get();
+}
+
 MTS_IMPLEMENT_CLASS(FwdScat, false, Object);
 
 MTS_NAMESPACE_END
@@ -9,7 +9,8 @@ MTS_NAMESPACE_BEGIN
 /* This ensures that the pdf calculation from a set of ('numerically
  * rounded') directions doesn't become badly conditioned when compared to
  * the calculation of the pdf during sampling. */
-// WARNING: Single precision has not been tested! Value is just a guess...
+// The kernels compute in double, but the directions they are handed and
+// that they return are rounded to Float by the rest of the renderer.
 #ifdef SINGLE_PRECISION
 # define MTS_FWDSCAT_DIRECTION_MIN_MU 1e-3
 #else
@@ -17,12 +18,56 @@ MTS_NAMESPACE_BEGIN
 #endif
 
 
+/**
+ * \brief Precomputed length dependence of the forward scattering kernel.
+ *
+ * With p = 0.5*mu*sigma_s, the (dimensionful) coefficients D, E, F of
+ * \ref FwdScat::calcValues() and the normalization constant N combine
+ * into D*ps, E*ps^2/p, F*ps^3/p^2 and log(N/p^3) + sigma_a*s + 5.5*log(ps),
+ * which are smooth functions of log(ps) alone. A single table therefore
+ * serves all media. It is sampled uniformly in log(ps) and looked up with
+ * Catmull-Rom interpolation. Inside the tabulated range, the relative
+ * error of the coefficients is of the order of 1e-8, and up to 1e-6 close
+ * to where the exact expressions switch between their approximations.
+ */
+struct FwdScatKernelTable {
+    enum {
+        EResolution = 2048,
+        ENumValues = 4
+    };
+
+    /// Tabulate the kernel (only used by \ref FwdScat::getKernelTable())
+    FwdScatKernelTable();
+
+    /**
+     * \brief Look up the scaled coefficients at the given ps, in the
+     * order listed above, and also return log(ps).
+     *
+     * Returns \c false if ps falls outside of the tabulated range, in
+     * which case the exact expressions should be used instead.
+     */
+    inline bool lookup(double ps, double *values, double &logPs) const;
+
+    double m_logPsMin, m_logPsMax, m_invStep;
+    double m_values[ENumValues][EResolution];
+};
+
 class MTS_EXPORT FwdScat : public Object {
 public:
     MTS_DECLARE_CLASS();
+    friend struct FwdScatKernelTable;
+
+    /// How to evaluate the length dependent part of the kernel
+    enum KernelMode {
+        EExactKernel,     /// Evaluate the analytical expressions
+        ETabulatedKernel, /// Interpolate in a \ref FwdScatKernelTable
+    };
 
-    FwdScat(Float g, Float sigma_s, Float sigma_a, Float eta) :
-                mu(1 - g), sigma_s(sigma_s), sigma_a(sigma_a), m_eta(eta) {
+    FwdScat(double g, double sigma_s, double sigma_a, double eta,
+            KernelMode kernelMode = EExactKernel) :
+                mu(1 - g), sigma_s(sigma_s), sigma_a(sigma_a), m_eta(eta),
+                m_kernelTable(kernelMode == ETabulatedKernel ?
+                        &getKernelTable() : NULL) {
         if (g < 0 || g >= 1) {
             Log(EError, "Valid values for g are in [0,1). "
                     "Sensible values are close to 1.");
@@ -35,10 +80,24 @@ public:
                 <<", sigma_s="<<sigma_s
                 <<", sigma_a="<<sigma_a
                 <<", eta="<<m_eta
+                <<", kernel="<<(m_kernelTable ? "tabulated" : "exact")
                 <<"]";
         return oss.str();
     }
 
+    /// Return the shared kernel table, building it on first use
+    static const FwdScatKernelTable &getKernelTable();
+
+    /**
+     * \brief Return a process-wide shared instance for the given medium
+     *
+     * FwdScat instances are immutable, so all subsurface models with the
+     * same (g, sigma_s, sigma_a, eta, kernelMode) can use the same one.
+     * Instances live in the cache until the plugin gets unloaded.
+     */
+    static FwdScat *getCached(Float g, Float sigma_s, Float sigma_a,
+            Float eta, KernelMode kernelMode = EExactKernel);
+
     enum TangentPlaneMode {
         EUnmodifiedIncoming,
         EUnmodifiedOutgoing,
@@ -58,132 +117,224 @@ public:
         EFrisvadEtAlZv,    /// As in the directional dipole model of Frisvad et al.
     };
 
-    Float evalDipole(
-            Normal n0, Vector u0, Normal nL, Vector uL, Vector R, Float length,
+    double evalDipole(
+            Vector3d n0, Vector3d u0, Vector3d nL, Vector3d uL, Vector3d R, double length,
             bool rejectInternalIncoming, bool reciprocal,
             TangentPlaneMode tangentMode, ZvMode zvMode,
             bool useEffectiveBRDF = false,
             DipoleMode dipoleMode = ERealAndVirt) const;
 
+    /**
+     * \brief The part of a dipole evaluation that only depends on the
+     * boundary (the refracted directions and the Fresnel transmittance)
+     *
+     * This only depends on eta, so it can be shared between all spectral
+     * channels of a medium. See \ref prepareDipoleQuery().
+     */
+    struct DipoleQuery {
+        Vector3d n0, nL;
+        Vector3d u0, uL; /// Internal (refracted) directions
+        double fresnelTransmittance;
+        bool valid;    /// If false, the BSSRDF is zero
+    };
+
+    /// Fill in a \ref DipoleQuery, returns its validity
+    bool prepareDipoleQuery(Vector3d n0, Vector3d u0_external,
+            Vector3d nL, Vector3d uL_external, DipoleQuery &query) const;
+
+    /**
+     * \brief Evaluate the dipole for a prepared query
+     *
+     * \param reverse
+     *    If not \c NULL: make the result reciprocal by also evaluating
+     *    this reversed query. See the \ref evalDipole() overload above,
+     *    which fills it in based on the refracted directions of
+     *    \c query.
+     */
+    double evalDipole(const DipoleQuery &query, const DipoleQuery *reverse,
+            Vector3d R, double length, bool rejectInternalIncoming,
+            TangentPlaneMode tangentMode, ZvMode zvMode,
+            bool useEffectiveBRDF = false,
+            DipoleMode dipoleMode = ERealAndVirt) const;
+
+    double getEta() const { return m_eta; }
+
+    /**
+     * \brief The parts of the length sampling strategies of
+     * \ref sampleLengthDipole() that do not depend on the length itself
+     *
+     * The length is sampled from a mixture of a short length limit, a
+     * long length limit and an absorption strategy. Their means,
+     * variances and shape parameters only depend on (R, u0, uL), so
+     * preparing them once makes all further samples and pdf evaluations
+     * (i.e. the MIS weights) for that configuration cheap. See
+     * \ref prepareLengthQuery().
+     */
+    struct LengthQuery {
+        bool valid;      /// If false, the length pdf is zero
+        bool knownU0;    /// Was the incoming direction given?
+        Vector3d R_virt;   /// Tentative virtual source displacement
+        /* Short length limit: a truncated normal in t = (ps)^-3 for a
+         * known u0. Marginalized over u0, a truncated normal in
+         * t = (ps)^(-5/2) mixed with uniform sampling in ps, both without
+         * [0] and with [1] a safety factor on the variance. */
+        bool shortValid; /// If false, the short limit has zero pdf
+        double shortMean[2], shortStddev[2];
+        double shortUniformWeight[2];
+        double betaReal, betaVirt; /// Long length limit for R and R_virt
+    };
+
+    /// Fill in a \ref LengthQuery (u0 can be \c NULL), returns its validity
+    bool prepareLengthQuery(
+            const Vector3d &uL, const Vector3d &nL, const Vector3d &R,
+            const Vector3d *u0, const Vector3d &n0,
+            TangentPlaneMode tangentMode, LengthQuery &query) const;
+
     /// Returns the sample weight
-    Float sampleLengthDipole(
-            const Vector &uL, const Vector &nL, const Vector &R,
-            const Vector *u0, const Vector &n0,
-            TangentPlaneMode tangentMode, Float &s, Sampler *sampler) const;
-    Float pdfLengthDipole(
-            const Vector &uL, const Vector &nL, const Vector &R,
-            const Vector *u0, const Vector &n0,
-            TangentPlaneMode tangentMode, Float s) const;
+    double sampleLengthDipole(
+            const Vector3d &uL, const Vector3d &nL, const Vector3d &R,
+            const Vector3d *u0, const Vector3d &n0,
+            TangentPlaneMode tangentMode, double &s, Sampler *sampler) const;
+    double pdfLengthDipole(
+            const Vector3d &uL, const Vector3d &nL, const Vector3d &R,
+            const Vector3d *u0, const Vector3d &n0,
+            TangentPlaneMode tangentMode, double s) const;
+
+    /// Same as above, for a prepared query
+    double sampleLengthDipole(const LengthQuery &query,
+            double &s, Sampler *sampler) const;
+    double pdfLengthDipole(const LengthQuery &query, double s) const;
 
     /// Returns the pdf
-    Float sampleDirectionDipole(
-            Vector &u0, const Vector &n0, const Vector &uL, const Vector &nL,
-            const Vector &R, Float s, TangentPlaneMode tangentMode,
+    double sampleDirectionDipole(
+            Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &nL,
+            const Vector3d &R, double s, TangentPlaneMode tangentMode,
             bool useEffectiveBRDF, Sampler *sampler) const;
-    Float pdfDirectionDipole(
-            const Vector &u0, const Vector &n0, const Vector &uL, const Vector &nL,
-            const Vector &R, Float s, TangentPlaneMode tangentMode,
+    double pdfDirectionDipole(
+            const Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &nL,
+            const Vector3d &R, double s, TangentPlaneMode tangentMode,
             bool useEffectiveBRDF) const;
 
-    Float evalMonopole(Vector u0, Vector uL, Vector R, Float length) const;
+    double evalMonopole(Vector3d u0, Vector3d uL, Vector3d R, double length) const;
 
-    Float evalPlaneSource(Vector u0, Vector uL,
-            Vector n, Float Rz, Float length) const;
+    double evalPlaneSource(Vector3d u0, Vector3d uL,
+            Vector3d n, double Rz, double length) const;
 
 protected:
     void calcValues(double length, double &C, double &D, double &E, double &F,
             double *Z=NULL) const;
-    double absorptionAndNormalizationConstant(Float theLength) const;
+    double absorptionAndNormalizationConstant(double theLength) const;
+
+    /**
+     * \brief Compute C, D, E, F and the full normalization (including
+     * absorption) in one go, as needed for evaluating the kernel.
+     *
+     * Interpolates in the kernel table in tabulated mode. The sampling
+     * routines always use the exact \ref calcValues(), so that the pdfs
+     * stay consistent with the sampling decisions.
+     */
+    void calcValuesAndNormalization(double length, double &C, double &D,
+            double &E, double &F, double &N) const;
 
     bool getVirtualDipoleSource(
-            Normal n0, Vector u0,
-            Normal nL, Vector uL,
-            Vector R, Float length,
+            Vector3d n0, Vector3d u0,
+            Vector3d nL, Vector3d uL,
+            Vector3d R, double length,
             bool rejectInternalIncoming,
             TangentPlaneMode tangentMode,
             ZvMode zvMode,
-            Vector &u0_virt, Vector &R_virt,
-            Vector *optional_n0_effective = NULL) const;
+            Vector3d &u0_virt, Vector3d &R_virt,
+            Vector3d *optional_n0_effective = NULL) const;
 
     bool getTentativeIndexMatchedVirtualSourceDisp(
-            Normal n0,
-            Normal nL, Vector uL,
-            Vector R,
-            Float s,
+            Vector3d n0,
+            Vector3d nL, Vector3d uL,
+            Vector3d R,
+            double s,
             TangentPlaneMode tangentMode,
-            Vector &R_virt,
-            Vector *optional_n0_effective = NULL,
-            Float *optional_realSourceRelativeWeight = NULL) const;
+            Vector3d &R_virt,
+            Vector3d *optional_n0_effective = NULL,
+            double *optional_realSourceRelativeWeight = NULL) const;
 
 
     /// Returns the pdf
-    Float sampleLengthShortLimit(
-            Vector R, const Vector *u0, Vector uL, Float &s, Sampler *sampler) const;
-    Float pdfLengthShortLimit(
-            Vector R, const Vector *u0, Vector uL, Float s) const;
+    double sampleLengthShortLimit(
+            const LengthQuery &query, double &s, Sampler *sampler) const;
+    double pdfLengthShortLimit(
+            const LengthQuery &query, double s) const;
     void implLengthShortLimit(
-            Vector R, const Vector *u0, Vector uL, Float &s, Sampler *sampler, Float *pdf) const;
+            const LengthQuery &query, double &s, Sampler *sampler, double *pdf) const;
+    /// Returns false if the short limit has zero pdf
+    bool prepareLengthShortLimitKnownU0(
+            Vector3d R, Vector3d u0, Vector3d uL, double &mean, double &stddev) const;
     void implLengthShortLimitKnownU0(
-            Vector R, Vector u0, Vector uL, Float &s, Sampler *sampler, Float *pdf) const;
+            double mean, double stddev, double &s, Sampler *sampler, double *pdf) const;
     void implLengthShortLimitMargOverU0(
-            Vector R, Vector uL, Float &s, Sampler *sampler, Float *pdf) const;
+            const LengthQuery &query, double &s, Sampler *sampler, double *pdf) const;
+    /// Returns false if the short limit has zero pdf
+    bool prepareLengthShortLimitMargOverU0(
+            Vector3d R, Vector3d uL, double safetyFac, double &mean, double &stddev,
+            double &uniformWeight) const;
     void implLengthShortLimitMargOverU0_internal(
-            Vector R, Vector uL, Float &s, Sampler *sampler, Float *pdf, Float safetyFac) const;
+            double t_mean, double t_stddev, double uniformBackupWeight,
+            double &s, Sampler *sampler, double *pdf) const;
 
+    /// Shape parameter of the long length limit (in units where p = 1)
+    double lengthLongLimitBeta(const Vector3d &R, const Vector3d &uL) const;
     /// Returns the pdf
-    Float sampleLengthLongLimit(
-            Vector R, Vector uL, Float &s, Sampler *sampler) const;
-    Float pdfLengthLongLimit(
-            Vector R, Vector uL, Float s) const;
+    double sampleLengthLongLimit(
+            double beta, double &s, Sampler *sampler) const;
+    double pdfLengthLongLimit(
+            double beta, double s) const;
 
     /// Returns the pdf
-    Float sampleLengthAbsorption(
-            Float &s, Sampler *sampler) const;
-    Float pdfLengthAbsorption(
-            Float s) const;
+    double sampleLengthAbsorption(
+            double &s, Sampler *sampler) const;
+    double pdfLengthAbsorption(
+            double s) const;
 
 
     /// Returns the pdf
-    Float sampleDirectionBoundaryAwareMonopole_BRDF(
-            Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-            Float s, Sampler *sampler) const;
-    Float pdfDirectionBoundaryAwareMonopole_BRDF(
-            const Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-            Float s) const;
+    double sampleDirectionBoundaryAwareMonopole_BRDF(
+            Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+            double s, Sampler *sampler) const;
+    double pdfDirectionBoundaryAwareMonopole_BRDF(
+            const Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+            double s) const;
     void implDirectionBoundaryAwareMonopole_BRDF(
-            Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-            Float s, Sampler *sampler, Float *pdf) const;
+            Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+            double s, Sampler *sampler, double *pdf) const;
 
     /// Returns the pdf
-    Float sampleDirectionBoundaryAwareMonopole(
-            Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-            Float s, bool useEffectiveBRDF, Sampler *sampler) const;
-    Float pdfDirectionBoundaryAwareMonopole(
-            const Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-            Float s, bool useEffectiveBRDF) const;
+    double sampleDirectionBoundaryAwareMonopole(
+            Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+            double s, bool useEffectiveBRDF, Sampler *sampler) const;
+    double pdfDirectionBoundaryAwareMonopole(
+            const Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+            double s, bool useEffectiveBRDF) const;
 
     /// Returns the pdf
-    Float sampleDirectionBoundaryAwareMonopole_orig(
-            Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-            Float s, Sampler *sampler) const;
-    Float pdfDirectionBoundaryAwareMonopole_orig(
-            const Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-            Float s) const;
+    double sampleDirectionBoundaryAwareMonopole_orig(
+            Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+            double s, Sampler *sampler) const;
+    double pdfDirectionBoundaryAwareMonopole_orig(
+            const Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+            double s) const;
 
     /// Returns the pdf
-    Float sampleDirectionBoundaryAwareMonopole_bis(
-            Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-            Float s, Sampler *sampler) const;
-    Float pdfDirectionBoundaryAwareMonopole_bis(
-            const Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-            Float s) const;
+    double sampleDirectionBoundaryAwareMonopole_bis(
+            Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+            double s, Sampler *sampler) const;
+    double pdfDirectionBoundaryAwareMonopole_bis(
+            const Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+            double s) const;
     void implDirectionBoundaryAwareMonopole_bis(
-            Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-            Float s, Sampler *sampler, Float *pdf) const;
+            Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+            double s, Sampler *sampler, double *pdf) const;
 
-    const Float mu; /// Gaussian angle phase function standard deviation
-    const Float sigma_s; /// Scattering coefficient of medium
-    const Float sigma_a; /// Absorption coefficient of medium
+    const double mu; /// Gaussian angle phase function standard deviation
+    const double sigma_s; /// Scattering coefficient of medium
+    const double sigma_a; /// Absorption coefficient of medium
 
     /**
      * Bit of a hack for index-MISmatched dipole configurations. This makes
@@ -191,7 +342,10 @@ protected:
      * displacement (as determined by the Zvmode). This are 'implicit'
      * boundary conditions, as opposed to an explicit 'index matched'
      * (m_eta = 1) coupling to a proper BSDF as boundary.  */
-    const Float m_eta;
+    const double m_eta;
+
+    /// NULL if the kernel is evaluated exactly
+    const FwdScatKernelTable *m_kernelTable;
 };
 
 MTS_NAMESPACE_END
@@ -16,13 +16,13 @@ MTS_NAMESPACE_BEGIN
 
 #define MTS_FWDSCAT_GIVE_REAL_AND_VIRTUAL_SOURCE_EQUAL_SAMPLING_WEIGHT false
 
-static constexpr Float directionSampler_origWeight = 0.5; // TODO
+static constexpr double directionSampler_origWeight = 0.5; // TODO
 
 /* Sample the dipole direction as a simple cosine weighted hemisphere with
  * this weight. This improves robustness in case we would severely
  * undersample the transport with the dedicated importance samplers (e.g.
  * by underestimating the width of a sharp peak). */
-static constexpr Float directionSampler_dipoleHemiWeight = 0.05;
+static constexpr double directionSampler_dipoleHemiWeight = 0.05;
 
 #ifdef MTS_FWDSCAT_DEBUG
 # define FSAssert(x)      Assert(x)
@@ -36,7 +36,62 @@ static constexpr Float directionSampler_dipoleHemiWeight = 0.05;
 # define SFSAssertWarn(x) ((void) 0)
 #endif
 
-FINLINE Float _reducePrecisionForCosTheta(Float x) {
+/* The kernels below are evaluated in double precision irrespective of
+ * Float, so they use their own versions of the few helpers
+ * (math::square(), coordinateSystem(), Frame, refract()) that are only
+ * available for Float. */
+
+FINLINE double _square(double x) {
+    return x*x;
+}
+
+/// Double precision version of \ref coordinateSystem()
+FINLINE void _coordinateSystem(const Vector3d &a, Vector3d &b, Vector3d &c) {
+    if (std::abs(a.x) > std::abs(a.y)) {
+        double invLen = 1.0 / std::sqrt(a.x * a.x + a.z * a.z);
+        c = Vector3d(a.z * invLen, 0.0, -a.x * invLen);
+    } else {
+        double invLen = 1.0 / std::sqrt(a.y * a.y + a.z * a.z);
+        c = Vector3d(0.0, a.z * invLen, -a.y * invLen);
+    }
+    b = cross(c, a);
+}
+
+/// Double precision version of the Fresnel variant of \ref refract()
+FINLINE Vector3d _refract(const Vector3d &wi, const Vector3d &n, double eta,
+        double &cosThetaT, double &F) {
+    double cosThetaI = dot(wi, n);
+    if (EXPECT_NOT_TAKEN(eta == 1)) {
+        cosThetaT = -cosThetaI;
+        F = 0.0;
+        return -wi;
+    }
+
+    /* Using Snell's law, calculate the squared sine of the
+       angle between the normal and the transmitted ray */
+    double scale = (cosThetaI > 0) ? 1/eta : eta,
+           cosThetaTSqr = 1 - (1-cosThetaI*cosThetaI) * (scale*scale);
+
+    /* Check for total internal reflection */
+    if (cosThetaTSqr <= 0.0) {
+        cosThetaT = 0.0;
+        F = 1.0;
+        return Vector3d(0.0);
+    }
+
+    double absCosThetaI = std::abs(cosThetaI),
+           absCosThetaT = std::sqrt(cosThetaTSqr);
+    double Rs = (absCosThetaI - eta * absCosThetaT)
+              / (absCosThetaI + eta * absCosThetaT);
+    double Rp = (eta * absCosThetaI - absCosThetaT)
+              / (eta * absCosThetaI + absCosThetaT);
+    F = 0.5 * (Rs * Rs + Rp * Rp);
+    cosThetaT = (cosThetaI > 0) ? -absCosThetaT : absCosThetaT;
+
+    return n * (scale * cosThetaI + cosThetaT) - wi * scale;
+}
+
+FINLINE double _reducePrecisionForCosTheta(double x) {
     /* Turns out not to help too much -- or even make things worse! So
      * don't round. TODO: Test some more at some point... */
     return x;
@@ -45,17 +100,62 @@ FINLINE Float _reducePrecisionForCosTheta(Float x) {
 }
 
 FINLINE void roundCosThetaBoundsForStability(
-        Float &minCosTheta, Float &maxCosTheta) {
+        double &minCosTheta, double &maxCosTheta) {
     minCosTheta = _reducePrecisionForCosTheta(minCosTheta);
     maxCosTheta = _reducePrecisionForCosTheta(maxCosTheta);
 }
-FINLINE Float roundCosThetaForStability(Float cosTheta,
-        Float minCosTheta, Float maxCosTheta) {
+FINLINE double roundCosThetaForStability(double cosTheta,
+        double minCosTheta, double maxCosTheta) {
     cosTheta = math::clamp(cosTheta, minCosTheta, maxCosTheta);
     return _reducePrecisionForCosTheta(cosTheta);
 }
 
-FINLINE double FwdScat::absorptionAndNormalizationConstant(Float theLength) const {
+inline bool FwdScatKernelTable::lookup(double ps, double *values,
+        double &logPs) const {
+    if (!(ps > 0))
+        return false;
+    logPs = std::log(ps);
+    if (logPs < m_logPsMin || logPs > m_logPsMax)
+        return false;
+
+    double pos = (logPs - m_logPsMin) * m_invStep;
+    int idx = math::clamp((int) pos, 1, (int) EResolution - 3);
+    double t = pos - idx, t2 = t*t, t3 = t2*t;
+
+    /* Catmull-Rom weights for the nodes idx-1, ..., idx+2 */
+    double w0 = 0.5 * (-t3 + 2*t2 - t);
+    double w1 = 0.5 * (3*t3 - 5*t2 + 2);
+    double w2 = 0.5 * (-3*t3 + 4*t2 + t);
+    double w3 = 0.5 * (t3 - t2);
+
+    for (int k = 0; k < ENumValues; k++) {
+        const double *v = &m_values[k][idx - 1];
+        values[k] = w0*v[0] + w1*v[1] + w2*v[2] + w3*v[3];
+    }
+    return true;
+}
+
+FINLINE void FwdScat::calcValuesAndNormalization(double length,
+        double &C, double &D, double &E, double &F, double &N) const {
+    if (m_kernelTable) {
+        const double p = 0.5 * mu * sigma_s;
+        const double ps = p * length;
+        double values[FwdScatKernelTable::ENumValues], logPs;
+        if (m_kernelTable->lookup(ps, values, logPs)) {
+            const double invPs = 1.0 / ps;
+            C = 3 * invPs;
+            D = values[0] * invPs;
+            E = values[1] * p * invPs * invPs;
+            F = values[2] * p * p * invPs * invPs * invPs;
+            N = p*p*p * exp(values[3] - 5.5*logPs - sigma_a*length);
+            return;
+        }
+    }
+    calcValues(length, C, D, E, F);
+    N = absorptionAndNormalizationConstant(length);
+}
+
+FINLINE double FwdScat::absorptionAndNormalizationConstant(double theLength) const {
     const double p = 0.5 * sigma_s * mu;
     const double ps = p * theLength;
 
@@ -74,7 +174,7 @@ FINLINE double FwdScat::absorptionAndNormalizationConstant(Float theLength) cons
         double ZoverExpMinOne; // = Z / (exp(Z) - 1)
         if (Z < 0.002) {
             // small Z corresponds to limit of large ps
-            ZoverExpMinOne = 1. + 0.5*Z + 1./12.*Z*Z - 1./720*Z*Z*Z*Z;
+            ZoverExpMinOne = 1. - 0.5*Z + 1./12.*Z*Z - 1./720*Z*Z*Z*Z;
         } else {
             ZoverExpMinOne = Z / (exp(Z) - 1);
         }
@@ -162,15 +262,15 @@ FINLINE void FwdScat::calcValues(double length, double &C, double &D,
 
 /// if rejectInternalIncoming is requested: returns false if we should stop
 FINLINE bool FwdScat::getVirtualDipoleSource(
-        Normal n0, Vector u0,
-        Normal nL, Vector uL,
-        Vector R, Float length,
+        Vector3d n0, Vector3d u0,
+        Vector3d nL, Vector3d uL,
+        Vector3d R, double length,
         bool rejectInternalIncoming,
         TangentPlaneMode tangentMode,
         ZvMode zvMode,
-        Vector &u0_virt, Vector &R_virt,
-        Vector *optional_n0_effective) const {
-    Normal n0_effective;
+        Vector3d &u0_virt, Vector3d &R_virt,
+        Vector3d *optional_n0_effective) const {
+    Vector3d n0_effective;
     switch (tangentMode) {
     case EFrisvadEtAl:
         /* Use the modified tangent plane of the directional dipole model
@@ -189,7 +289,7 @@ FINLINE bool FwdScat::getVirtualDipoleSource(
          * 'average' normal at incoming and outgoing point instead of on
          * the incoming normal. This should immediately give reciprocity as
          * a bonus. */
-        Vector sumNormal = n0 + nL;
+        Vector3d sumNormal = n0 + nL;
         if (R.length() == 0) {
             n0_effective = n0;
         } else {
@@ -214,36 +314,36 @@ FINLINE bool FwdScat::getVirtualDipoleSource(
     if (rejectInternalIncoming && dot(n0_effective, u0) > 0)
         return false;
 
-    FSAssert(math::abs(n0_effective.length() - 1) < Epsilon);
+    FSAssert(std::abs(n0_effective.length() - 1) < Epsilon);
 
-    Float zv;
-    Float sigma_sp = sigma_s * mu;
-    Float sigma_tp = sigma_sp + sigma_a;
+    double zv;
+    double sigma_sp = sigma_s * mu;
+    double sigma_tp = sigma_sp + sigma_a;
 
 
     switch (zvMode) {
     case EFrisvadEtAlZv: {
         if (sigma_tp == 0 || sigma_sp == 0)
             return false;
-        Float D = 1./(3.*sigma_tp);
-        Float alpha_p = sigma_sp / sigma_tp;
-        Float d_e = 2.131 * D / sqrt(alpha_p);
-        Float A = dEon_A(m_eta);
+        double D = 1./(3.*sigma_tp);
+        double alpha_p = sigma_sp / sigma_tp;
+        double d_e = 2.131 * D / sqrt(alpha_p);
+        double A = dEon_A(m_eta);
         zv = 2*A*d_e;
         break; }
     case EBetterDipoleZv: {
         if (sigma_tp == 0)
             return false;
-        Float D = (2*sigma_a + sigma_sp)/(3*math::square(sigma_tp));
-        Float A = dEon_A(m_eta);
+        double D = (2*sigma_a + sigma_sp)/(3*_square(sigma_tp));
+        double A = dEon_A(m_eta);
         zv = 4*A*D;
         break; }
     case EClassicDiffusion: {
         if (sigma_tp == 0)
             return false;
-        Float Fdr = fresnelDiffuseReflectance(1 / m_eta);
-        Float A = (1 + Fdr) / (1 - Fdr);
-        Float D = 1./(3*sigma_tp);
+        double Fdr = fresnelDiffuseReflectance(1 / m_eta);
+        double A = (1 + Fdr) / (1 - Fdr);
+        double D = 1./(3*sigma_tp);
         zv = 4*A*D;
         break; }
     default:
@@ -263,16 +363,16 @@ FINLINE bool FwdScat::getVirtualDipoleSource(
 }
 
 FINLINE bool FwdScat::getTentativeIndexMatchedVirtualSourceDisp(
-        Normal n0,
-        Normal nL, Vector uL,
-        Vector R,
-        Float s, // not always required
+        Vector3d n0,
+        Vector3d nL, Vector3d uL,
+        Vector3d R,
+        double s, // not always required
         TangentPlaneMode tangentMode,
-        Vector &R_virt,
-        Vector *optional_n0_effective,
-        Float *optional_realSourceRelativeWeight) const {
-    Vector _u0_virt, n0_effective;
-    Vector _u0(0.0f/0.0f);
+        Vector3d &R_virt,
+        Vector3d *optional_n0_effective,
+        double *optional_realSourceRelativeWeight) const {
+    Vector3d _u0_virt, n0_effective;
+    Vector3d _u0(0.0f/0.0f);
     bool rejectInternalIncoming = false; //u0 not sensible yet!
     ZvMode zvMode = EClassicDiffusion; //only one that does not depend on u0
     if (!getVirtualDipoleSource(n0, _u0, nL, uL, R, s,
@@ -289,7 +389,7 @@ FINLINE bool FwdScat::getTentativeIndexMatchedVirtualSourceDisp(
     double C, D, E, F;
     calcValues(s, C, D, E, F);
     double ratio = exp(E*dot(R-R_virt,uL) - F*(R.lengthSquared()-R_virt.lengthSquared()));
-    Float realSourceWeight = (std::isinf(ratio + 1) ? 1.0 : ratio/(ratio + 1));
+    double realSourceWeight = (std::isinf(ratio + 1) ? 1.0 : ratio/(ratio + 1));
     // TODO: clamp the extremes of 0 and 1 to something slightly more 'centered'?
     FSAssert(realSourceWeight >= 0 && realSourceWeight <= 1);
 #if MTS_FWDSCAT_GIVE_REAL_AND_VIRTUAL_SOURCE_EQUAL_SAMPLING_WEIGHT
@@ -303,27 +403,20 @@ FINLINE bool FwdScat::getTentativeIndexMatchedVirtualSourceDisp(
 
 
 
-FINLINE Float FwdScat::evalDipole(
-        Normal n0, Vector u0_external,
-        Normal nL, Vector uL_external,
-        Vector R, Float length,
-        bool rejectInternalIncoming,
-        bool reciprocal,
-        TangentPlaneMode tangentMode,
-        ZvMode zvMode,
-        bool useEffectiveBRDF,
-        DipoleMode dipoleMode) const {
+FINLINE bool FwdScat::prepareDipoleQuery(
+        Vector3d n0, Vector3d u0_external,
+        Vector3d nL, Vector3d uL_external,
+        DipoleQuery &query) const {
+    query.valid = false;
+    query.n0 = n0;
+    query.nL = nL;
 
-    /* If reciprocal is requested, nL should be finite and uL_external should point
-     * along nL. */
-    FSAssert(!reciprocal || nL.isFinite());
-    FSAssert(!reciprocal || dot(uL_external,nL) >= -Epsilon); // positive with small margin for roundoff errors
     if (nL.isFinite() && dot(uL_external,nL) <= 0) // clamp to protect against roundoff errors
-        return 0.0f;
+        return false;
 
 #if MTS_FWDSCAT_DIPOLE_REJECT_INCOMING_WRT_TRUE_SURFACE_NORMAL
     if (dot(u0_external, n0) >= 0)
-        return 0.0f;
+        return false;
 #endif
 
 
@@ -332,24 +425,71 @@ FINLINE Float FwdScat::evalDipole(
      * keep the directions pointing along the propagation direction of
      * light (i.e. not the typical refract as in BSDFs, for instance, which
      * flips to the other side of the boundary). */
-    Float _cosThetaT, F0, FL;
-    Vector u0 = refract(-u0_external, n0, m_eta, _cosThetaT, F0);
-    Vector uL = -refract(uL_external, nL, m_eta, _cosThetaT, FL);
-    Float fresnelTransmittance = (1-F0)*(1-FL);
+    double _cosThetaT, F0, FL;
+    query.u0 = _refract(-u0_external, n0, m_eta, _cosThetaT, F0);
+    query.uL = -_refract(uL_external, nL, m_eta, _cosThetaT, FL);
+    query.fresnelTransmittance = (1-F0)*(1-FL);
 
     if (m_eta == 1)
-        FSAssert(u0 == u0_external  &&  uL == uL_external);
+        FSAssert(query.u0 == u0_external  &&  query.uL == uL_external);
 
-    if (u0.isZero() || uL.isZero()) {
+    if (query.u0.isZero() || query.uL.isZero()) {
         if (m_eta > 1)
             Log(EWarn, "Could not refract, which is weird because we have a "
                     "higher ior! (eta=%f)", m_eta);
-        return 0.0f;
+        return false;
     }
 
+    query.valid = true;
+    return true;
+}
+
+FINLINE double FwdScat::evalDipole(
+        Vector3d n0, Vector3d u0_external,
+        Vector3d nL, Vector3d uL_external,
+        Vector3d R, double length,
+        bool rejectInternalIncoming,
+        bool reciprocal,
+        TangentPlaneMode tangentMode,
+        ZvMode zvMode,
+        bool useEffectiveBRDF,
+        DipoleMode dipoleMode) const {
+
+    /* If reciprocal is requested, nL should be finite and uL_external should point
+     * along nL. */
+    FSAssert(!reciprocal || nL.isFinite());
+    FSAssert(!reciprocal || dot(uL_external,nL) >= -Epsilon); // positive with small margin for roundoff errors
+
+    DipoleQuery query, reverse;
+    if (!prepareDipoleQuery(n0, u0_external, nL, uL_external, query))
+        return 0.0f;
+    /* Note: the reverse query starts from the already refracted
+     * directions, as it always did */
+    if (reciprocal)
+        prepareDipoleQuery(nL, -query.uL, n0, -query.u0, reverse);
+
+    return evalDipole(query, reciprocal ? &reverse : NULL, R, length,
+            rejectInternalIncoming, tangentMode, zvMode, useEffectiveBRDF,
+            dipoleMode);
+}
+
+FINLINE double FwdScat::evalDipole(
+        const DipoleQuery &query, const DipoleQuery *reverse,
+        Vector3d R, double length,
+        bool rejectInternalIncoming,
+        TangentPlaneMode tangentMode,
+        ZvMode zvMode,
+        bool useEffectiveBRDF,
+        DipoleMode dipoleMode) const {
+    if (!query.valid)
+        return 0.0f;
 
-    Vector R_virt;
-    Vector u0_virt;
+    const Vector3d &n0 = query.n0, &nL = query.nL;
+    const Vector3d &u0 = query.u0, &uL = query.uL;
+    const double fresnelTransmittance = query.fresnelTransmittance;
+
+    Vector3d R_virt;
+    Vector3d u0_virt;
     if (!getVirtualDipoleSource(n0, u0, nL, uL, R, length,
             rejectInternalIncoming, tangentMode, zvMode,
             u0_virt, R_virt))
@@ -358,13 +498,13 @@ FINLINE Float FwdScat::evalDipole(
     // Effective BRDF?
     if (useEffectiveBRDF) {
         FSAssert((n0 - nL).length() < Epsilon); // same point -> same normal
-        Float Rv_z = dot(R_virt, nL);
+        double Rv_z = dot(R_virt, nL);
 #ifdef MTS_FWDSCAT_DEBUG
-        Float lRvl = R_virt.length();
+        double lRvl = R_virt.length();
         FSAssert((n0 - nL).length() < Epsilon); // same point -> same normal
         FSAssert(Rv_z <= 0); // pointing from virtual point towards xL -> into medium
         // the only displacement should be in the normal direction:
-        FSAssertWarn(lRvl == 0 || math::abs((lRvl - math::abs(Rv_z))/lRvl) < Epsilon);
+        FSAssertWarn(lRvl == 0 || std::abs((lRvl - std::abs(Rv_z))/lRvl) < Epsilon);
 #endif
 
         return fresnelTransmittance * (
@@ -373,22 +513,21 @@ FINLINE Float FwdScat::evalDipole(
     }
 
     // Full BSSRDF
-    Float real = 0, virt = 0;
+    double real = 0, virt = 0;
     if (dipoleMode & EReal)
         real = evalMonopole(u0,      uL, R,      length);
     if (dipoleMode & EVirt)
         virt = evalMonopole(u0_virt, uL, R_virt, length);
-    Float transport;
+    double transport;
     switch (dipoleMode) {
         case ERealAndVirt: transport = real - virt; break;
         case EReal:        transport = real; break;
         case EVirt:        transport = virt; break; // note: positive sign
         default: Log(EError, "Unknown dipoleMode: %d", dipoleMode); return 0;
     }
-    if (reciprocal) {
-        Float transportRev = evalDipole(
-                nL, -uL, n0, -u0, -R, length,
-                rejectInternalIncoming, false,
+    if (reverse) {
+        double transportRev = evalDipole(*reverse, NULL, -R, length,
+                rejectInternalIncoming,
                 tangentMode, zvMode, useEffectiveBRDF, dipoleMode);
         return 0.5 * (transport + transportRev) * fresnelTransmittance;
     } else {
@@ -398,24 +537,23 @@ FINLINE Float FwdScat::evalDipole(
 
 
 
-FINLINE Float FwdScat::evalMonopole(Vector u0, Vector uL, Vector R, Float length) const {
-    FSAssert(math::abs(u0.length() - 1) < 1e-6);
-    FSAssert(math::abs(uL.length() - 1) < 1e-6);
+FINLINE double FwdScat::evalMonopole(Vector3d u0, Vector3d uL, Vector3d R, double length) const {
+    FSAssert(std::abs(u0.length() - 1) < 1e-6);
+    FSAssert(std::abs(uL.length() - 1) < 1e-6);
     
-    double C, D, E, F;
-    calcValues(length, C, D, E, F);
+    double C, D, E, F, N;
+    calcValuesAndNormalization(length, C, D, E, F, N);
 
     /* We regularized the sampling of u0, so we should be consistent here.
      * NOTE: but E can still blow up in the final expression for G (TODO
      * does this happen?) */
     Vector3d H = E*Vector3d(R) - D*Vector3d(uL);
     double lHl = H.length();
-    Vector Hnorm = Vector(H / lHl);
-    Float lHlreg = (lHl > 1./MTS_FWDSCAT_DIRECTION_MIN_MU) ?
+    Vector3d Hnorm = Vector3d(H / lHl);
+    double lHlreg = (lHl > 1./MTS_FWDSCAT_DIRECTION_MIN_MU) ?
             1./MTS_FWDSCAT_DIRECTION_MIN_MU : lHl;
-    Float cosTheta = roundCosThetaForStability(dot(u0, Hnorm), -1, 1);
+    double cosTheta = roundCosThetaForStability(dot(u0, Hnorm), -1, 1);
 
-    double N = absorptionAndNormalizationConstant(length);
     double G = N * exp(-C + E*dot(R,uL) + lHlreg*cosTheta - F*R.lengthSquared());
     //Non-regularized:
     //G = N * exp(-C - D*dot(u0,uL) + E*(dot(R,u0) + dot(R,uL)) - F*R.lengthSquared());
@@ -423,11 +561,11 @@ FINLINE Float FwdScat::evalMonopole(Vector u0, Vector uL, Vector R, Float length
     // Note: fastmath compiler flags may change the order of the operations...
     /* We only care for cancellations if the result is sufficiently large
      * (otherwise exp(epsilon) ~= 1 anyway) */
-    if (math::abs(E*dot(R,uL)) > 1e3)
+    if (std::abs(E*dot(R,uL)) > 1e3)
         CancellationCheck(-C,  E*dot(R,uL));
-    if (math::abs(lHlreg*cosTheta) > 1e3)
+    if (std::abs(lHlreg*cosTheta) > 1e3)
         CancellationCheck(-C + E*dot(R,uL),  lHlreg*cosTheta);
-    if (math::abs(F*R.lengthSquared()) > 1e3)
+    if (std::abs(F*R.lengthSquared()) > 1e3)
         CancellationCheck(-C + E*dot(R,uL) + lHlreg*cosTheta, -F*R.lengthSquared());
 
 #ifdef MTS_FWDSCAT_DEBUG
@@ -448,20 +586,19 @@ FINLINE Float FwdScat::evalMonopole(Vector u0, Vector uL, Vector R, Float length
     return G;
 }
 
-FINLINE Float FwdScat::evalPlaneSource(Vector u0, Vector uL,
-        Vector n, Float Rz, Float length) const {
-    FSAssert(math::abs(u0.length() - 1) < 1e-6);
-    FSAssert(math::abs(uL.length() - 1) < 1e-6);
+FINLINE double FwdScat::evalPlaneSource(Vector3d u0, Vector3d uL,
+        Vector3d n, double Rz, double length) const {
+    FSAssert(std::abs(u0.length() - 1) < 1e-6);
+    FSAssert(std::abs(uL.length() - 1) < 1e-6);
 
-    double C, D, E, F;
-    calcValues(length, C, D, E, F);
+    double C, D, E, F, N;
+    calcValuesAndNormalization(length, C, D, E, F, N);
 
-    Float u0z = dot(u0,n);
-    Float uLz = dot(uL,n);
+    double u0z = dot(u0,n);
+    double uLz = dot(uL,n);
 
-    double result = absorptionAndNormalizationConstant(length)
-            * M_PI_DBL / F * exp(
-                E*E/4/F*(2 + 2*dot(u0,uL) - math::square(u0z + uLz))
+    double result = N * M_PI_DBL / F * exp(
+                E*E/4/F*(2 + 2*dot(u0,uL) - _square(u0z + uLz))
                 - D*dot(u0,uL)
                 - C
                 + E*Rz * (u0z + uLz)
@@ -477,43 +614,84 @@ FINLINE Float FwdScat::evalPlaneSource(Vector u0, Vector uL,
 
 
 // Strategy weights, must sum to one
-static constexpr Float lengthSample_w1 = 0.5; /* short length limit */
-static constexpr Float lengthSample_w2 = 0.5; /* long length limit */
-static constexpr Float lengthSample_w3 = 0.0; /* absorption */
+static constexpr double lengthSample_w1 = 0.5; /* short length limit */
+static constexpr double lengthSample_w2 = 0.5; /* long length limit */
+static constexpr double lengthSample_w3 = 0.0; /* absorption */
+
+/* Short length limit marginalized over u0: variance rescaling factor and
+ * weight of the 'safety' variant */
+static constexpr double lengthSample_shortSafetyFac = 3;
+static constexpr double lengthSample_shortSafetyWeight = 0.3;
 
 // If d_in is unknown, it is set to NULL
-FINLINE Float FwdScat::sampleLengthDipole(
-        const Vector &uL, const Vector &nL, const Vector &R,
-        const Vector *u0, const Vector &n0,
-        TangentPlaneMode tangentMode, Float &s, Sampler *sampler) const {
-
-    Vector R_virt;
-    if (!getTentativeIndexMatchedVirtualSourceDisp(
-            n0, nL, uL, R, 0./0., tangentMode, R_virt))
+FINLINE bool FwdScat::prepareLengthQuery(
+        const Vector3d &uL, const Vector3d &nL, const Vector3d &R,
+        const Vector3d *u0, const Vector3d &n0,
+        TangentPlaneMode tangentMode, LengthQuery &query) const {
+    query.valid = getTentativeIndexMatchedVirtualSourceDisp(
+            n0, nL, uL, R, 0./0., tangentMode, query.R_virt);
+    if (!query.valid)
+        return false;
+    query.knownU0 = (u0 != NULL);
+
+    query.shortValid = false;
+    if (lengthSample_w1 != 0) {
+        if (u0) {
+            query.shortValid = prepareLengthShortLimitKnownU0(R, *u0, uL,
+                    query.shortMean[0], query.shortStddev[0]);
+        } else {
+            query.shortValid = prepareLengthShortLimitMargOverU0(R, uL,
+                    1.0, query.shortMean[0], query.shortStddev[0],
+                    query.shortUniformWeight[0])
+                && prepareLengthShortLimitMargOverU0(R, uL,
+                    lengthSample_shortSafetyFac, query.shortMean[1],
+                    query.shortStddev[1], query.shortUniformWeight[1]);
+        }
+    }
+
+    if (lengthSample_w2 != 0) {
+        query.betaReal = lengthLongLimitBeta(R, uL);
+        query.betaVirt = lengthLongLimitBeta(query.R_virt, uL);
+    }
+    return true;
+}
+
+FINLINE double FwdScat::sampleLengthDipole(
+        const Vector3d &uL, const Vector3d &nL, const Vector3d &R,
+        const Vector3d *u0, const Vector3d &n0,
+        TangentPlaneMode tangentMode, double &s, Sampler *sampler) const {
+    LengthQuery query;
+    prepareLengthQuery(uL, nL, R, u0, n0, tangentMode, query);
+    return sampleLengthDipole(query, s, sampler);
+}
+
+FINLINE double FwdScat::sampleLengthDipole(const LengthQuery &query,
+        double &s, Sampler *sampler) const {
+    if (!query.valid)
         return 0.0;
 
     /* For R-dependent functions that don't take the dipole into account
      * themselves.
      * TODO: Smart MIS weight? (Need length-marginalized 'realSourceWeight'
      * from getTentativeIndexMatchedVirtualSourceDisp then.) */
-    Vector R_effective, R_other;
+    double betaEffective, betaOther;
     if (sampler->next1D() < 0.5) {
-        R_effective = R;
-        R_other = R_virt;
+        betaEffective = query.betaReal;
+        betaOther = query.betaVirt;
     } else {
-        R_effective = R_virt;
-        R_other = R;
+        betaEffective = query.betaVirt;
+        betaOther = query.betaReal;
     }
 
-    Float p1, p2, p3;
+    double p1, p2, p3;
     p1 = p2 = p3 = -1;
-    const Float u = sampler->next1D();
+    const double u = sampler->next1D();
     if (u < lengthSample_w1) {
-        p1 = sampleLengthShortLimit(R, u0, uL, s, sampler);
+        p1 = sampleLengthShortLimit(query, s, sampler);
         if (p1 == 0)
             return 0.0f;
     } else if (u < lengthSample_w1 + lengthSample_w2) {
-        p2 = sampleLengthLongLimit(R_effective, uL, s, sampler);
+        p2 = sampleLengthLongLimit(betaEffective, s, sampler);
         if (p2 == 0)
             return 0.0f;
     } else if (u < lengthSample_w1 + lengthSample_w2 + lengthSample_w3) {
@@ -523,37 +701,43 @@ FINLINE Float FwdScat::sampleLengthDipole(
     }
 
     if (p1 == -1)
-        p1 = (lengthSample_w1 == 0 ? 0 : pdfLengthShortLimit(R, u0, uL, s));
+        p1 = (lengthSample_w1 == 0 ? 0 : pdfLengthShortLimit(query, s));
     if (p2 == -1)
-        p2 = (lengthSample_w2 == 0 ? 0 : pdfLengthLongLimit(R_effective, uL, s));
+        p2 = (lengthSample_w2 == 0 ? 0 : pdfLengthLongLimit(betaEffective, s));
     if (p3 == -1)
         p3 = (lengthSample_w3 == 0 ? 0 : pdfLengthAbsorption(s));
 
     // Handle the MIS probabilities of having sampled based on R_other
     if (lengthSample_w2 != 0)
-        p2 = 0.5 * (p2 + pdfLengthLongLimit(R_other, uL, s));
+        p2 = 0.5 * (p2 + pdfLengthLongLimit(betaOther, s));
 
     return 1.0 / (lengthSample_w1 * p1
                 + lengthSample_w2 * p2
                 + lengthSample_w3 * p3);
 }
 
-FINLINE Float FwdScat::pdfLengthDipole(
-        const Vector &uL, const Vector &nL, const Vector &R,
-        const Vector *u0, const Vector &n0,
-        TangentPlaneMode tangentMode, Float s) const {
+FINLINE double FwdScat::pdfLengthDipole(
+        const Vector3d &uL, const Vector3d &nL, const Vector3d &R,
+        const Vector3d *u0, const Vector3d &n0,
+        TangentPlaneMode tangentMode, double s) const {
+    FSAssert(s >= 0);
+    LengthQuery query;
+    prepareLengthQuery(uL, nL, R, u0, n0, tangentMode, query);
+    return pdfLengthDipole(query, s);
+}
+
+FINLINE double FwdScat::pdfLengthDipole(const LengthQuery &query,
+        double s) const {
     FSAssert(s >= 0);
-    Vector R_virt;
-    if (!getTentativeIndexMatchedVirtualSourceDisp(
-            n0, nL, uL, R, 0./0., tangentMode, R_virt))
+    if (!query.valid)
         return 0.0;
 
-    Float p1 = (lengthSample_w1 == 0 ? 0 :
-            pdfLengthShortLimit(R, u0, uL, s));
-    Float p2 = (lengthSample_w2 == 0 ? 0 :
-            0.5 * (pdfLengthLongLimit(R, uL, s)
-                 + pdfLengthLongLimit(R_virt, uL, s)));
-    Float p3 = (lengthSample_w3 == 0 ? 0 :
+    double p1 = (lengthSample_w1 == 0 ? 0 :
+            pdfLengthShortLimit(query, s));
+    double p2 = (lengthSample_w2 == 0 ? 0 :
+            0.5 * (pdfLengthLongLimit(query.betaReal, s)
+                 + pdfLengthLongLimit(query.betaVirt, s)));
+    double p3 = (lengthSample_w3 == 0 ? 0 :
             pdfLengthAbsorption(s));
     return lengthSample_w1 * p1
          + lengthSample_w2 * p2
@@ -568,66 +752,68 @@ FINLINE Float FwdScat::pdfLengthDipole(
  * This is the safest bet 'at infinity' (the tail is certainly more heavy
  * than the target distribution), but extremely high variance is possible
  * for high albedo materials. */
-FINLINE Float FwdScat::sampleLengthAbsorption(
-        Float &s, Sampler *sampler) const {
+FINLINE double FwdScat::sampleLengthAbsorption(
+        double &s, Sampler *sampler) const {
     if (sigma_a == 0)
         return 0.0;
     s = -log(sampler->next1D())/sigma_a;
-    Float pdf = sigma_a*exp(-sigma_a*s);
+    double pdf = sigma_a*exp(-sigma_a*s);
     FSAssert(std::isfinite(s));
     FSAssert(s >= 0);
     FSAssert(std::isfinite(pdf));
     return pdf;
 }
 
-FINLINE Float FwdScat::pdfLengthAbsorption(
-        Float s) const {
+FINLINE double FwdScat::pdfLengthAbsorption(
+        double s) const {
     if (sigma_a == 0)
         return 0.0;
-    Float pdf = sigma_a*exp(-sigma_a*s);
+    double pdf = sigma_a*exp(-sigma_a*s);
     FSAssert(std::isfinite(pdf));
     return pdf;
 }
 
 
-FINLINE Float FwdScat::sampleLengthShortLimit(
-        Vector R, const Vector *u0, Vector uL, Float &s, Sampler *sampler) const {
-    Float pdf;
-    implLengthShortLimit(R, u0, uL, s, sampler, &pdf);
+FINLINE double FwdScat::sampleLengthShortLimit(
+        const LengthQuery &query, double &s, Sampler *sampler) const {
+    double pdf;
+    implLengthShortLimit(query, s, sampler, &pdf);
     return pdf;
 }
 
-FINLINE Float FwdScat::pdfLengthShortLimit(
-        Vector R, const Vector *u0, Vector uL, Float s) const {
-    Float pdf;
-    implLengthShortLimit(R, u0, uL, s, NULL, &pdf);
+FINLINE double FwdScat::pdfLengthShortLimit(
+        const LengthQuery &query, double s) const {
+    double pdf;
+    implLengthShortLimit(query, s, NULL, &pdf);
     return pdf;
 }
 
 FINLINE void FwdScat::implLengthShortLimit(
-        Vector R, const Vector *u0, Vector uL, Float &s, Sampler *sampler, Float *pdf) const {
-    if (u0 == NULL) {
-        implLengthShortLimitMargOverU0(R, uL, s, sampler, pdf);
+        const LengthQuery &query, double &s, Sampler *sampler, double *pdf) const {
+    if (!query.shortValid) {
+        if (sampler) s = 0;
+        if (pdf) *pdf = 0;
+        return;
+    }
+    if (!query.knownU0) {
+        implLengthShortLimitMargOverU0(query, s, sampler, pdf);
     } else {
-        implLengthShortLimitKnownU0(R, *u0, uL, s, sampler, pdf);
+        implLengthShortLimitKnownU0(query.shortMean[0],
+                query.shortStddev[0], s, sampler, pdf);
     }
 }
 
-FINLINE void FwdScat::implLengthShortLimitKnownU0(
-        Vector R, Vector u0, Vector uL, Float &s, Sampler *sampler, Float *pdf) const {
+FINLINE bool FwdScat::prepareLengthShortLimitKnownU0(
+        Vector3d R, Vector3d u0, Vector3d uL, double &mean, double &stddev) const {
     double p = 0.5*sigma_s*mu;
     double lRl = R.length();
     double r = lRl * p;
-    if (r == 0)  {
-        if (sampler) s = 0;
-        if (pdf) *pdf = 0;
-        return;
-    }
+    if (r == 0)
+        return false;
     double cosTheta0L = math::clamp(dot(R, u0) / lRl, -1.0, 1.0)
                       + math::clamp(dot(R, uL) / lRl, -1.0, 1.0);
     double u0dotuL = dot(u0, uL);
 
-    double mean;
     if (r > 1e-4) { // full expression is sufficiently stable
         // transformation t = (ps)^(-3)
         // compute mean of gaussian in t: (root of a cubic polynomial)
@@ -697,14 +883,19 @@ FINLINE void FwdScat::implLengthShortLimitKnownU0(
                 / (3*mean53 + 6*mean73 * r * cosTheta0L - (2*u0dotuL + 4)*mean2));
     }
     double stddevSafetyFactor = 2;
-    double stddev = stddevSafetyFactor * realStddev;
+    stddev = stddevSafetyFactor * realStddev;
     if (!std::isfinite(stddev) || stddev <= 0)  {
         stddev = mean; // heurstic!
     }
     FSAssert(std::isfinite(stddev));
     FSAssert(stddev>0);
+    return true;
+}
 
-    Float t, ps;
+FINLINE void FwdScat::implLengthShortLimitKnownU0(
+        double mean, double stddev, double &s, Sampler *sampler, double *pdf) const {
+    double p = 0.5*sigma_s*mu;
+    double t, ps;
     if (sampler) {
         do {
             t = truncnorm(mean, stddev, 0.0, 1.0/0.0, sampler);
@@ -719,7 +910,7 @@ FINLINE void FwdScat::implLengthShortLimitKnownU0(
     FSAssert(s > 0);
 
     if (pdf) {
-        Float tPdf = truncnormPdf(mean, stddev, 0.0, 1.0/0.0, t);
+        double tPdf = truncnormPdf(mean, stddev, 0.0, 1.0/0.0, t);
 
         // transform from pdf(t = (ps)^(-3)) to pdf(ps) [factor 3*(ps)^-4] & go back to p!=1 [factor p]
         *pdf = tPdf * 3 / (ps*ps*ps*ps) * p;
@@ -727,34 +918,40 @@ FINLINE void FwdScat::implLengthShortLimitKnownU0(
 }
 
 FINLINE void FwdScat::implLengthShortLimitMargOverU0(
-        Vector R, Vector uL, Float &s, Sampler *sampler, Float *pdf) const {
-    const Float safetyFac = 3;
-    const Float safetyWeight = 0.3;
-    Float pdfOrig, pdfSafety;
+        const LengthQuery &query, double &s, Sampler *sampler, double *pdf) const {
+    const double safetyWeight = lengthSample_shortSafetyWeight;
+    /* Variant 0 is the original one, variant 1 has the safety factor */
+    auto impl = [&] (int variant, Sampler *theSampler, double *thePdf) {
+        implLengthShortLimitMargOverU0_internal(query.shortMean[variant],
+                query.shortStddev[variant], query.shortUniformWeight[variant],
+                s, theSampler, thePdf);
+    };
+    double pdfOrig, pdfSafety;
     if (sampler) {
         if (sampler->next1D() > safetyWeight) {
-            implLengthShortLimitMargOverU0_internal(R, uL, s, sampler, &pdfSafety, safetyFac);
-            implLengthShortLimitMargOverU0_internal(R, uL, s, NULL,    &pdfOrig  , 1.0);
+            impl(1, sampler, &pdfSafety);
+            impl(0, NULL,    &pdfOrig  );
         } else {
-            implLengthShortLimitMargOverU0_internal(R, uL, s, sampler, &pdfOrig  , 1.0);
-            implLengthShortLimitMargOverU0_internal(R, uL, s, NULL,    &pdfSafety, safetyFac);
+            impl(0, sampler, &pdfOrig  );
+            impl(1, NULL,    &pdfSafety);
         }
     } else {
-            implLengthShortLimitMargOverU0_internal(R, uL, s, NULL,    &pdfOrig  , 1.0);
-            implLengthShortLimitMargOverU0_internal(R, uL, s, NULL,    &pdfSafety, safetyFac);
+            impl(0, NULL,    &pdfOrig  );
+            impl(1, NULL,    &pdfSafety);
     }
     if (pdf) {
         *pdf = safetyWeight*pdfSafety + (1-safetyWeight)*pdfOrig;
     }
 }
-FINLINE void FwdScat::implLengthShortLimitMargOverU0_internal(
-        Vector R, Vector uL, Float &s, Sampler *sampler, Float *pdf, Float safetyFac) const {
+FINLINE bool FwdScat::prepareLengthShortLimitMargOverU0(
+        Vector3d R, Vector3d uL, double safetyFac, double &mean, double &stddev,
+        double &uniformWeight) const {
     // Working in p=1, transforming back at the end
-    Float p = 0.5*sigma_s*mu;
-    Float lRl = R.length();
-    Float r = lRl * p;
-    Float r2 = r*r;
-    Float cosTheta = math::clamp(dot(R, uL) / lRl, (Float)-1, (Float)1);
+    double p = 0.5*sigma_s*mu;
+    double lRl = R.length();
+    double r = lRl * p;
+    double r2 = r*r;
+    double cosTheta = math::clamp(dot(R, uL) / lRl, (double)-1, (double)1);
 
     /* TODO:
      *
@@ -765,29 +962,26 @@ FINLINE void FwdScat::implLengthShortLimitMargOverU0_internal(
      * sampler 
      */
     //if (r == 0 || r > 1) {
-    if (r == 0) {
-        if (pdf) *pdf = 0;
-        if (sampler) s = 0;
-        return;
-    }
+    if (r == 0)
+        return false;
 
-    Float uniformBackupWeight;
-    Float t_mean = -1, t_stddev = -1;
+    double uniformBackupWeight;
+    double t_mean = -1, t_stddev = -1;
     do { /* construction to allow easy break out of code block (like a 'goto error') */
-        Float D = (25*cosTheta*(cosTheta + 1) - 25 - 30*r2)/225.0;
+        double D = (25*cosTheta*(cosTheta + 1) - 25 - 30*r2)/225.0;
         if (D <= 0) {
             uniformBackupWeight = 1;
             break;
         }
-        Float t_mean25 = ((cosTheta + 1)/3.0 + sqrt(D)) / r; // t_mean^(2/5)
+        double t_mean25 = ((cosTheta + 1)/3.0 + sqrt(D)) / r; // t_mean^(2/5)
         if (t_mean25 <= 0) {
             uniformBackupWeight = 1;
             break;
         }
         t_mean = t_mean25*t_mean25*sqrt(t_mean25); //pow(t_mean25, 5.0/2.0);
-        Float t_mean45 = math::square(t_mean25); // t_mean^(4/5)
-        Float t_mean85 = math::square(t_mean45); // t_mean^(8/5)
-        Float t_var = 125*t_mean85 / (
+        double t_mean45 = _square(t_mean25); // t_mean^(4/5)
+        double t_mean85 = _square(t_mean45); // t_mean^(8/5)
+        double t_var = 125*t_mean85 / (
                 135*r2*t_mean45
                 + 90*r*(cosTheta+1)*t_mean25
                 - 54*r2 - 45*(cosTheta+2));
@@ -806,16 +1000,16 @@ FINLINE void FwdScat::implLengthShortLimitMargOverU0_internal(
         /* Adjust mean and variance to take into account a safety factor 
          * (this factor is an approximate rescaling factor for the variance 
          * in ps, with the mean in ps kept constant). */
-        Float t_mean2 = t_mean*t_mean;
-        Float t_mean4 = t_mean2*t_mean2;
-        Float tmp2 = 1764*math::square((safetyFac-7./6.)*t_var)
+        double t_mean2 = t_mean*t_mean;
+        double t_mean4 = t_mean2*t_mean2;
+        double tmp2 = 1764*_square((safetyFac-7./6.)*t_var)
                 + (2450-2800*safetyFac)*t_var*t_mean2
                 + 625*t_mean4;
-        Float tmp = (tmp2 > 0 ? sqrt(tmp2) : 0);
-        Float newMean = t_mean
+        double tmp = (tmp2 > 0 ? sqrt(tmp2) : 0);
+        double newMean = t_mean
                 * (475*t_mean2 - 868*safetyFac*t_var + 931*t_var - 19*tmp)
                 / (350*t_mean2 + (686-588*safetyFac)*t_var - 14*tmp);
-        Float newVar = t_var * (7./2. - 3*safetyFac) + 25./14.*t_mean2 - tmp/14.;
+        double newVar = t_var * (7./2. - 3*safetyFac) + 25./14.*t_mean2 - tmp/14.;
         if (!(std::isfinite(tmp)) || !std::isfinite(newMean) || !(newVar > 0)) {
             // can potentially happen -> simply use the original stddev (and mean)
             t_stddev = sqrt(t_var);
@@ -830,11 +1024,7 @@ FINLINE void FwdScat::implLengthShortLimitMargOverU0_internal(
     FSAssert(uniformBackupWeight == 1 || std::isfinite(t_mean));
     FSAssert(uniformBackupWeight == 1 || t_stddev > 0);
 
-#if defined(SINGLE_PRECISION)
-    const Float meanTailCutoff = -1e4;
-#elif defined(DOUBLE_PRECISION)
-    const Float meanTailCutoff = -1e7;
-#endif
+    const double meanTailCutoff = -1e7;
     if (t_mean / t_stddev < meanTailCutoff) {
         /* Sampling would nearly always give t=0 (exactly), correspoding to 
          * ps=infinity. Use uniform sampling for now [TODO: use proper long 
@@ -842,8 +1032,18 @@ FINLINE void FwdScat::implLengthShortLimitMargOverU0_internal(
         uniformBackupWeight = 1;
     }
 
-    Float ps, t;
-    const Float uniformSpan = 2;
+    mean = t_mean;
+    stddev = t_stddev;
+    uniformWeight = uniformBackupWeight;
+    return true;
+}
+
+FINLINE void FwdScat::implLengthShortLimitMargOverU0_internal(
+        double t_mean, double t_stddev, double uniformBackupWeight,
+        double &s, Sampler *sampler, double *pdf) const {
+    double p = 0.5*sigma_s*mu;
+    double ps, t;
+    const double uniformSpan = 2;
     if (sampler) {
         if (uniformBackupWeight == 1 || sampler->next1D() < uniformBackupWeight) {
             // simple uniform sampling
@@ -868,9 +1068,9 @@ FINLINE void FwdScat::implLengthShortLimitMargOverU0_internal(
     }
 
     if (pdf) {
-        Float tPdf = (uniformBackupWeight == 1 ? 0 : truncnormPdf(t_mean, t_stddev, 0.0, 1.0/0.0, t));
-        Float unifPdf = (ps < uniformSpan ? 1.0/uniformSpan : 0);
-        Float psPdf = uniformBackupWeight * unifPdf
+        double tPdf = (uniformBackupWeight == 1 ? 0 : truncnormPdf(t_mean, t_stddev, 0.0, 1.0/0.0, t));
+        double unifPdf = (ps < uniformSpan ? 1.0/uniformSpan : 0);
+        double psPdf = uniformBackupWeight * unifPdf
                 + (1-uniformBackupWeight) * tPdf * 5.0/2.0*pow(ps, -7.0/2.0); // <- t to ps jacobian
         *pdf = psPdf * p; // <- ps to s jacobian
         FSAssert(*pdf >= 0 && (!sampler || *pdf > 0));
@@ -880,14 +1080,19 @@ FINLINE void FwdScat::implLengthShortLimitMargOverU0_internal(
 
 
 // TODO: approximation that does not require a numerical cdf inversion?
-FINLINE Float FwdScat::sampleLengthLongLimit(
-        Vector R, Vector uL, Float &s, Sampler *sampler) const {
-    Float p = 0.5*sigma_s*mu;
+FINLINE double FwdScat::lengthLongLimitBeta(
+        const Vector3d &R, const Vector3d &uL) const {
+    double p = 0.5*sigma_s*mu;
+    Vector3d R_p1 = R*p;
+    double R2minusRdotUL_p1 = R_p1.lengthSquared() - dot(R_p1, uL);
+    return 3./2. * R2minusRdotUL_p1;
+}
+
+FINLINE double FwdScat::sampleLengthLongLimit(
+        double beta, double &s, Sampler *sampler) const {
+    double p = 0.5*sigma_s*mu;
     if (p == 0)
         return 0;
-    Vector R_p1 = R*p;
-    Float R2minusRdotUL_p1 = R_p1.lengthSquared() - dot(R_p1, uL);
-    Float beta = 3./2. * R2minusRdotUL_p1;
     if (beta <= 0)
         return sampleLengthAbsorption(s, sampler);
     double B = beta;
@@ -954,7 +1159,7 @@ FINLINE Float FwdScat::sampleLengthLongLimit(
                 target, lo, hi,
                 boost::math::tools::eps_tolerance<double>(15),
                 max_iter);
-        Float s_p1 = 0.5*(Rvnsol.first + Rvnsol.second);
+        double s_p1 = 0.5*(Rvnsol.first + Rvnsol.second);
         s = s_p1 / p;
         if (!std::isfinite(s)) {
             Log(EWarn, "FIXME %f", s);
@@ -965,22 +1170,19 @@ FINLINE Float FwdScat::sampleLengthLongLimit(
                 sA, sB, e.what());
         return 0;
     }
-    return pdfLengthLongLimit(R, uL, s);
+    return pdfLengthLongLimit(beta, s);
 }
 
-FINLINE Float FwdScat::pdfLengthLongLimit(
-        Vector R, Vector uL, Float s) const {
-    Float p = 0.5*sigma_s*mu;
+FINLINE double FwdScat::pdfLengthLongLimit(
+        double beta, double s) const {
+    double p = 0.5*sigma_s*mu;
     if (p == 0)
         return 0;
-    Float s_p1 = s * p;
-    Vector R_p1 = R*p;
-    Float R2minusRdotUL_p1 = R_p1.lengthSquared() - dot(R_p1, uL);
-    Float beta = 3./2. * R2minusRdotUL_p1;
+    double s_p1 = s * p;
     if (beta <= 0)
         return pdfLengthAbsorption(s);
-    Float a_p1 = sigma_a/p;
-    Float pdf_p1 = sqrt(beta/M_PI) / (s_p1*sqrt(s_p1))
+    double a_p1 = sigma_a/p;
+    double pdf_p1 = sqrt(beta/M_PI_DBL) / (s_p1*sqrt(s_p1))
             * math::fastexp(-beta/s_p1 - a_p1*s_p1 + 2*sqrt(beta*a_p1));
     if (!std::isfinite(pdf_p1)) {
         //Log(EWarn, "FIXME %f %e %e %e", pdf_p1, beta, a_p1, s_p1);
@@ -993,29 +1195,31 @@ FINLINE Float FwdScat::pdfLengthLongLimit(
 
 
 
-FINLINE Float _sampleHemisphere(const Vector &n_in, Vector &d_in, Sampler *sampler) {
+FINLINE double _sampleHemisphere(const Vector3d &n_in, Vector3d &d_in, Sampler *sampler) {
     /* Sample an incoming direction (on our side of the medium) on the
      * cosine-weighted hemisphere */
     Vector hemiSamp = warp::squareToCosineHemisphere(sampler->next2D());
-    Float pdf = warp::squareToCosineHemispherePdf(hemiSamp);
-    hemiSamp.z = -hemiSamp.z; // pointing inwards
-    d_in = Frame(n_in).toWorld(hemiSamp); // pointing inwards
+    double pdf = warp::squareToCosineHemispherePdf(hemiSamp);
+    Vector3d s, t;
+    _coordinateSystem(n_in, s, t);
+    d_in = normalize(s * (double) hemiSamp.x + t * (double) hemiSamp.y
+            - n_in * (double) hemiSamp.z); // pointing inwards
     return pdf;
 }
 
-FINLINE Float _pdfHemisphere(const Vector &n_in, const Vector &d_in) {
-    return INV_PI * math::abs(dot(d_in, n_in));
+FINLINE double _pdfHemisphere(const Vector3d &n_in, const Vector3d &d_in) {
+    return INV_PI_DBL * std::abs(dot(d_in, n_in));
 }
 
 
 
 
-FINLINE Float FwdScat::sampleDirectionDipole(
-        Vector &u0, const Vector &n0, const Vector &uL, const Vector &nL,
-        const Vector &R, Float s, TangentPlaneMode tangentMode,
+FINLINE double FwdScat::sampleDirectionDipole(
+        Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &nL,
+        const Vector3d &R, double s, TangentPlaneMode tangentMode,
         bool useEffectiveBRDF, Sampler *sampler) const {
-    Vector R_virt, n0_effective;
-    Float realSourceWeight;
+    Vector3d R_virt, n0_effective;
+    double realSourceWeight;
     if (!getTentativeIndexMatchedVirtualSourceDisp(n0, nL, uL, R, s,
             tangentMode, R_virt, &n0_effective, &realSourceWeight)) {
         return 0.0f; // Won't be able to evaluate bssrdf transport anyway!
@@ -1023,17 +1227,17 @@ FINLINE Float FwdScat::sampleDirectionDipole(
         FSAssert(R_virt.isFinite());
     }
 
-    Float pReal = -1;
-    Float pVirt = -1;
-    Float u = sampler->next1D();
+    double pReal = -1;
+    double pVirt = -1;
+    double u = sampler->next1D();
     if (u <= (1 - directionSampler_dipoleHemiWeight) * realSourceWeight) {
         pReal = sampleDirectionBoundaryAwareMonopole(
                 u0, n0, uL, R, s, useEffectiveBRDF, sampler);
         if (pReal == 0)
             return 0.0f;
     } else if (u <= (1 - directionSampler_dipoleHemiWeight)) {
-        Vector u0_virt;
-        Vector n0_virt = n0  -  2*dot(n0_effective, n0) * n0_effective;
+        Vector3d u0_virt;
+        Vector3d n0_virt = n0  -  2*dot(n0_effective, n0) * n0_effective;
         pVirt = sampleDirectionBoundaryAwareMonopole(
                 u0_virt, n0_virt, uL, R_virt, s, useEffectiveBRDF, sampler);
         if (pVirt == 0)
@@ -1054,25 +1258,25 @@ FINLINE Float FwdScat::sampleDirectionDipole(
          * normal n0, so that, upon transforming u0_virt to its
          * corresponding u0, that u0 is on the correct side of the actual
          * boundary as determined by n0. */
-        Vector u0_virt = u0  -  2*dot(n0_effective, u0) * n0_effective;
-        Vector n0_virt = n0  -  2*dot(n0_effective, n0) * n0_effective;
+        Vector3d u0_virt = u0  -  2*dot(n0_effective, u0) * n0_effective;
+        Vector3d n0_virt = n0  -  2*dot(n0_effective, n0) * n0_effective;
         pVirt = pdfDirectionBoundaryAwareMonopole(
                 u0_virt, n0_virt, uL, R_virt, s, useEffectiveBRDF);
     }
 
-    Float pHemi = _pdfHemisphere(n0, u0);
+    double pHemi = _pdfHemisphere(n0, u0);
 
     return (1 - directionSampler_dipoleHemiWeight)
                 * (realSourceWeight * pReal + (1.0 - realSourceWeight) * pVirt)
             + directionSampler_dipoleHemiWeight * pHemi;
 }
 
-FINLINE Float FwdScat::pdfDirectionDipole(
-        const Vector &u0, const Vector &n0, const Vector &uL, const Vector &nL,
-        const Vector &R, Float s, TangentPlaneMode tangentMode,
+FINLINE double FwdScat::pdfDirectionDipole(
+        const Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &nL,
+        const Vector3d &R, double s, TangentPlaneMode tangentMode,
         bool useEffectiveBRDF) const {
-    Vector R_virt, n0_effective;
-    Float realSourceWeight;
+    Vector3d R_virt, n0_effective;
+    double realSourceWeight;
     if (!getTentativeIndexMatchedVirtualSourceDisp(n0, nL, uL, R, s,
             tangentMode, R_virt, &n0_effective, &realSourceWeight)) {
         return 0.0f; // Won't be able to evaluate bssrdf transport anyway!
@@ -1080,13 +1284,13 @@ FINLINE Float FwdScat::pdfDirectionDipole(
         FSAssert(R_virt.isFinite());
     }
 
-    Float pReal, pVirt, pHemi;
+    double pReal, pVirt, pHemi;
 
     pReal = pdfDirectionBoundaryAwareMonopole(
             u0, n0, uL, R, s, useEffectiveBRDF);
 
-    Vector u0_virt = u0  -  2*dot(n0_effective, u0) * n0_effective;
-    Vector n0_virt = n0  -  2*dot(n0_effective, n0) * n0_effective;
+    Vector3d u0_virt = u0  -  2*dot(n0_effective, u0) * n0_effective;
+    Vector3d n0_virt = n0  -  2*dot(n0_effective, n0) * n0_effective;
     pVirt = pdfDirectionBoundaryAwareMonopole(
             u0_virt, n0_virt, uL, R_virt, s, useEffectiveBRDF);
 
@@ -1099,28 +1303,28 @@ FINLINE Float FwdScat::pdfDirectionDipole(
 
 
 
-FINLINE Float FwdScat::pdfDirectionBoundaryAwareMonopole_BRDF(
-        const Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-        Float s) const {
-    Float pdf;
-    Vector u0nonConst(u0);
+FINLINE double FwdScat::pdfDirectionBoundaryAwareMonopole_BRDF(
+        const Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+        double s) const {
+    double pdf;
+    Vector3d u0nonConst(u0);
     implDirectionBoundaryAwareMonopole_BRDF(
             u0nonConst, n0, uL, R, s, NULL, &pdf);
     return pdf;
 }
 
-FINLINE Float FwdScat::sampleDirectionBoundaryAwareMonopole_BRDF(
-        Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-        Float s, Sampler *sampler) const {
-    Float pdf;
+FINLINE double FwdScat::sampleDirectionBoundaryAwareMonopole_BRDF(
+        Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+        double s, Sampler *sampler) const {
+    double pdf;
     implDirectionBoundaryAwareMonopole_BRDF(
             u0, n0, uL, R, s, sampler, &pdf);
 #ifdef MTS_FWDSCAT_DEBUG
     if (pdf == 0)
         return 0;
-    Float pdfCheck = pdfDirectionBoundaryAwareMonopole_BRDF(
+    double pdfCheck = pdfDirectionBoundaryAwareMonopole_BRDF(
             u0, n0, uL, R, s);
-    if (math::abs(pdf-pdfCheck)/pdf > 1e-3) {
+    if (std::abs(pdf-pdfCheck)/pdf > 1e-3) {
         Log(EWarn, "Inconsistent pdfs: %e %e, rel %f",
                 pdf, pdfCheck, (pdf-pdfCheck)/pdf);
     }
@@ -1131,8 +1335,8 @@ FINLINE Float FwdScat::sampleDirectionBoundaryAwareMonopole_BRDF(
 // if sampler is NULL: read u0 and set the pdf (should not be NULL)
 // if sampler is not NULL: sample u0 and set the pdf (if it isn't NULL)
 FINLINE void FwdScat::implDirectionBoundaryAwareMonopole_BRDF(
-        Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-        Float s, Sampler *sampler, Float *pdf) const {
+        Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+        double s, Sampler *sampler, double *pdf) const {
     /* Note to self: n0==nL is no longer guaranteed here, because if we are
      * sampling u0_virt, n0 will be mirrored (it will equal
      * '-n0_real = -nL') */
@@ -1141,37 +1345,37 @@ FINLINE void FwdScat::implDirectionBoundaryAwareMonopole_BRDF(
         *pdf = 0; // set to zero already so we can simply return on error
 
     if (sampler == NULL)
-        FSAssert(math::abs(u0.length() - 1) < Epsilon);
-    FSAssert(math::abs(uL.length() - 1) < Epsilon);
+        FSAssert(std::abs(u0.length() - 1) < Epsilon);
+    FSAssert(std::abs(uL.length() - 1) < Epsilon);
     FSAssert(R.isFinite());
     FSAssert(std::isfinite(s));
     FSAssert(s >= 0);
 
     // frame:
-    const Vector z = n0; /* (= nL for a BSRDF if we are sampling a real
+    const Vector3d z = n0; /* (= nL for a BSRDF if we are sampling a real
                             direction, and '-n0_real' = -nL if we are
                             sampling a virtual direction) */
-    Vector x_unnorm = uL - z*dot(z,uL);
+    Vector3d x_unnorm = uL - z*dot(z,uL);
     if (x_unnorm.length() <= Epsilon) {
         /* any frame will do; a will go to 0 and the sampling will be
          * uniform where needed (e.g. phi sampling) */
-        Frame f(z);
-        x_unnorm = f.s;
+        Vector3d t;
+        _coordinateSystem(z, x_unnorm, t);
     }
-    const Vector x = normalize(x_unnorm);
-    const Vector y = cross(x, z);
-    FSAssert(math::abs(dot(x,y)) < Epsilon);
-    FSAssert(math::abs(dot(x,z)) < Epsilon);
-    FSAssert(math::abs(dot(y,z)) < Epsilon);
+    const Vector3d x = normalize(x_unnorm);
+    const Vector3d y = cross(x, z);
+    FSAssert(std::abs(dot(x,y)) < Epsilon);
+    FSAssert(std::abs(dot(x,z)) < Epsilon);
+    FSAssert(std::abs(dot(y,z)) < Epsilon);
 
-    Vector woi = -uL; // outgoing direction in 'incident' orientation
+    Vector3d woi = -uL; // outgoing direction in 'incident' orientation
     /* BRDF consistency check:
      *   R == 0       if we are samping a real direction
      *   R == -|R|nL  if we are samping a virt direction
      *                note: in that case, the u0 that we get here, is
      *                actually '-u0_real', and -uL!
      */
-    FSAssert(R.isZero() || math::abs(dot(R,n0)) > 0.999 * R.length());
+    FSAssert(R.isZero() || std::abs(dot(R,n0)) > 0.999 * R.length());
 
     double C, D, E, F, Z;
     calcValues(s, C, D, E, F, &Z);
@@ -1181,7 +1385,7 @@ FINLINE void FwdScat::implDirectionBoundaryAwareMonopole_BRDF(
     double b = D * dot(woi,z) + E*dot(R,z);
     double c = 0.25*E*E/F;
 
-    if (math::abs(a) < 1e-4) {
+    if (std::abs(a) < 1e-4) {
         a = 0;
         /* This makes the standard deviations go to infinity (i.e. simply
          * uniform sampling) and helps with stability. There are pdf
@@ -1190,11 +1394,11 @@ FINLINE void FwdScat::implDirectionBoundaryAwareMonopole_BRDF(
 
 
     /* Sample cos(theta) */
-    double cosThetaSd = 1/sqrt(2*c + math::abs(a));
+    double cosThetaSd = 1/sqrt(2*c + std::abs(a));
     FSAssert(cosThetaSd>=0);
     if (cosThetaSd == 0)
         return;
-    double cosThetaMean = b * math::square(cosThetaSd);
+    double cosThetaMean = b * _square(cosThetaSd);
     double cosTheta;
     if (sampler) {
         cosTheta = truncnorm(cosThetaMean, cosThetaSd, -1.0, 0.0, sampler);
@@ -1204,7 +1408,7 @@ FINLINE void FwdScat::implDirectionBoundaryAwareMonopole_BRDF(
         cosTheta = math::clamp(cosTheta, -1.0, 0.0);
     }
     double cosThetaPdf = truncnormPdf(cosThetaMean, cosThetaSd, -1.0, 0.0, cosTheta);
-    double sinTheta = math::safe_sqrt(1 - math::square(cosTheta));
+    double sinTheta = math::safe_sqrt(1 - _square(cosTheta));
 
 
     /* Sample phi:
@@ -1213,7 +1417,7 @@ FINLINE void FwdScat::implDirectionBoundaryAwareMonopole_BRDF(
      *       - around phi=0  if a>0 (i.e. cos(phi) -> +1  => phi->0)
      *       - around phi=pi if a<0 (i.e. cos(phi) -> -1  => phi->pi)
      */
-    double phiSd = 1.0 / sqrt(math::abs(a) * sinTheta);
+    double phiSd = 1.0 / sqrt(std::abs(a) * sinTheta);
     if (phiSd == 0)
         return;
     double phiMean, phiLo, phiHi;
@@ -1239,8 +1443,8 @@ FINLINE void FwdScat::implDirectionBoundaryAwareMonopole_BRDF(
     double sinPhi, cosPhi;
     math::sincos(phi, &sinPhi, &cosPhi);
 
-    Vector constructed_u0 = x * cosPhi*sinTheta  +  y * sinPhi*sinTheta  +  z * cosTheta;
-    FSAssert(math::abs(constructed_u0.length() - 1) < Epsilon);
+    Vector3d constructed_u0 = x * cosPhi*sinTheta  +  y * sinPhi*sinTheta  +  z * cosTheta;
+    FSAssert(std::abs(constructed_u0.length() - 1) < Epsilon);
 
     if (sampler) {
         u0 = constructed_u0;
@@ -1262,15 +1466,15 @@ FINLINE void FwdScat::implDirectionBoundaryAwareMonopole_BRDF(
 
 
 
-FINLINE Float FwdScat::sampleDirectionBoundaryAwareMonopole(
-        Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-        Float s, bool useEffectiveBRDF, Sampler *sampler) const {
+FINLINE double FwdScat::sampleDirectionBoundaryAwareMonopole(
+        Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+        double s, bool useEffectiveBRDF, Sampler *sampler) const {
 
     if (useEffectiveBRDF)
         return sampleDirectionBoundaryAwareMonopole_BRDF(
                 u0, n0, uL, R, s, sampler);
 
-    Float p1,p2;
+    double p1,p2;
     if (sampler->next1D() < directionSampler_origWeight) {
         p1 = sampleDirectionBoundaryAwareMonopole_orig(
                 u0, n0, uL, R, s, sampler);
@@ -1289,15 +1493,15 @@ FINLINE Float FwdScat::sampleDirectionBoundaryAwareMonopole(
     return p1 * directionSampler_origWeight + p2 * (1 - directionSampler_origWeight);
 }
 
-FINLINE Float FwdScat::pdfDirectionBoundaryAwareMonopole(
-        const Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-        Float s, bool useEffectiveBRDF) const {
+FINLINE double FwdScat::pdfDirectionBoundaryAwareMonopole(
+        const Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+        double s, bool useEffectiveBRDF) const {
 
     if (useEffectiveBRDF)
         return pdfDirectionBoundaryAwareMonopole_BRDF(
                 u0, n0, uL, R, s);
 
-    Float p1,p2;
+    double p1,p2;
     p1 = pdfDirectionBoundaryAwareMonopole_orig(
             u0, n0, uL, R, s);
     p2 = pdfDirectionBoundaryAwareMonopole_bis(
@@ -1306,10 +1510,10 @@ FINLINE Float FwdScat::pdfDirectionBoundaryAwareMonopole(
 }
 
 
-FINLINE Float FwdScat::sampleDirectionBoundaryAwareMonopole_orig(
-        Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-        Float s, Sampler *sampler) const {
-    FSAssert(math::abs(uL.length() - 1) < Epsilon);
+FINLINE double FwdScat::sampleDirectionBoundaryAwareMonopole_orig(
+        Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+        double s, Sampler *sampler) const {
+    FSAssert(std::abs(uL.length() - 1) < Epsilon);
     FSAssert(R.isFinite());
     FSAssert(std::isfinite(s));
     FSAssert(s >= 0);
@@ -1359,26 +1563,26 @@ FINLINE Float FwdScat::sampleDirectionBoundaryAwareMonopole_orig(
     Vector3d H = E*Vector3d(R) - D*Vector3d(uL);
     double lHl = H.length();
     FSAssert(std::isfinite(lHl));
-    Vector Hnorm = Vector(H / lHl);
+    Vector3d Hnorm = Vector3d(H / lHl);
 
     /* Regularization */
     lHl = (lHl > 1./MTS_FWDSCAT_DIRECTION_MIN_MU) ? 1./MTS_FWDSCAT_DIRECTION_MIN_MU : lHl;
 
     /* If we are badly conditioned: pick coordinates around n0 instead of
      * trying to set up a Hnorm frame. */
-    bool badlyConditioned = math::abs(dot(n0, Hnorm)) > 1-Epsilon;
+    bool badlyConditioned = std::abs(dot(n0, Hnorm)) > 1-Epsilon;
 
-    Float minCosTheta, maxCosTheta;
-    Float phiCutoffSlope = 0./0.;
-    Vector projectionDir;
+    double minCosTheta, maxCosTheta;
+    double phiCutoffSlope = 0./0.;
+    Vector3d projectionDir;
     if (badlyConditioned) {
         projectionDir = n0;
         minCosTheta = -1;
         maxCosTheta = 0; // only incoming directions
     } else {
-        Float exactSin = dot(n0,Hnorm);
-        Float tmpCos = roundCosThetaForStability(math::safe_sqrt(1 - math::square(exactSin)), (Float)-1, (Float)1);
-        Float tmpSin = math::safe_sqrt(1 - math::square(tmpCos)); // detour because of potential rounding
+        double exactSin = dot(n0,Hnorm);
+        double tmpCos = roundCosThetaForStability(math::safe_sqrt(1 - _square(exactSin)), (double)-1, (double)1);
+        double tmpSin = math::safe_sqrt(1 - _square(tmpCos)); // detour because of potential rounding
         if (dot(Hnorm, n0) < 0) {
             // H points to the correct (=incoming) side of the boundary -> maxCos=1
             minCosTheta = -tmpCos;
@@ -1396,20 +1600,20 @@ FINLINE Float FwdScat::sampleDirectionBoundaryAwareMonopole_orig(
     FSAssert(minCosTheta >= -1 && minCosTheta <= 0);
     FSAssert(maxCosTheta >=  0 && maxCosTheta <= 1);
 
-    Float cosTheta;
-    Float cosThetaPdf;
+    double cosTheta;
+    double cosThetaPdf;
     if (lHl < Epsilon) {
         /* Expansion in small |H|, up to second order */
-        Float d = maxCosTheta - minCosTheta;
-        Float d2 = d*d;
-        Float d3 = d*d2;
-        Float u = sampler->next1D();
+        double d = maxCosTheta - minCosTheta;
+        double d2 = d*d;
+        double d3 = d*d2;
+        double u = sampler->next1D();
         /* The expanded cosTheta is still guaranteed to stay within bounds */
         cosTheta = roundCosThetaForStability(minCosTheta + d*u - 0.5*u*(u-1)*d2*lHl
                 + 1./6.*(2*u-1)*(u-1)*u*d3*lHl*lHl, minCosTheta, maxCosTheta);
         /* The expanded pdf is still guaranteed to be >= 0 */
         cosThetaPdf = (1 + 0.5*(2*cosTheta - minCosTheta - maxCosTheta) * lHl
-                + 1./12.*(math::square(maxCosTheta) + math::square(minCosTheta)
+                + 1./12.*(_square(maxCosTheta) + _square(minCosTheta)
                         + 4*minCosTheta*maxCosTheta
                         + 6*cosTheta*(cosTheta - minCosTheta - maxCosTheta))
                                 * lHl*lHl) / d;
@@ -1432,23 +1636,23 @@ FINLINE Float FwdScat::sampleDirectionBoundaryAwareMonopole_orig(
                     "cosTheta: %f (min %f max %f), lRlregularized %e",
                     cosThetaPdf, cosTheta, minCosTheta, maxCosTheta, lHl);
     } else {
-        Float u = sampler->next1D();
+        double u = sampler->next1D();
         cosTheta = roundCosThetaForStability(log((1-u)*exp(minCosTheta*lHl) + u*exp(maxCosTheta*lHl)) / lHl,
                 minCosTheta, maxCosTheta);
         cosThetaPdf = lHl/(exp(maxCosTheta*lHl) - exp(minCosTheta*lHl)) * exp(lHl * cosTheta);
     }
     FSAssert(minCosTheta - ShadowEpsilon <= cosTheta  &&  cosTheta <= maxCosTheta + ShadowEpsilon);
     FSAssert(std::isfinite(cosThetaPdf) && cosThetaPdf > 0);
-    Float sinTheta = math::safe_sqrt(1 - cosTheta * cosTheta);
+    double sinTheta = math::safe_sqrt(1 - cosTheta * cosTheta);
 
-    Float minPhi, maxPhi;
+    double minPhi, maxPhi;
     if (badlyConditioned) {
-        minPhi = -HALF_PI;
-        maxPhi = M_PI+HALF_PI;
+        minPhi = -HALF_PI_DBL;
+        maxPhi = M_PI_DBL+HALF_PI_DBL;
     } else {
         /* height of the cutoff, when looking at the phi slice circle */
-        Float h = phiCutoffSlope * cosTheta;
-        Float hUnitCircle; // to a height in a unit circle
+        double h = phiCutoffSlope * cosTheta;
+        double hUnitCircle; // to a height in a unit circle
         if (sinTheta == 0) {
             hUnitCircle = -1;
         } else {
@@ -1462,66 +1666,64 @@ FINLINE Float FwdScat::sampleDirectionBoundaryAwareMonopole_orig(
         /* if hUnitCircle < -1: the full 2pi range of phi is permitted ->
          * safe_asin clamps for us */
         minPhi = math::safe_asin(hUnitCircle);
-        maxPhi = M_PI - minPhi;
-        FSAssert(math::abs(sin(minPhi)-sin(maxPhi)) < Epsilon);
+        maxPhi = M_PI_DBL - minPhi;
+        FSAssert(std::abs(sin(minPhi)-sin(maxPhi)) < Epsilon);
     }
-    FSAssert(minPhi >= -HALF_PI && minPhi <= HALF_PI);
-    FSAssert(maxPhi >=  HALF_PI && maxPhi <= M_PI + HALF_PI);
-    Float phi = minPhi + (maxPhi - minPhi) * sampler->next1D();
+    FSAssert(minPhi >= -HALF_PI_DBL && minPhi <= HALF_PI_DBL);
+    FSAssert(maxPhi >=  HALF_PI_DBL && maxPhi <= M_PI_DBL + HALF_PI_DBL);
+    double phi = minPhi + (maxPhi - minPhi) * sampler->next1D();
     if (maxPhi == minPhi)
         return 0.0f;
-    Float phiPdf = 1.0 / (maxPhi - minPhi);
+    double phiPdf = 1.0 / (maxPhi - minPhi);
     FSAssert(std::isfinite(phiPdf) && phiPdf > 0);
     /* Note: for a perfect sampling, phiPdf should have been a constant
      * (independent of cosTheta) [And ideally the dot(n_in,d_ni) should
      * also have been taken into account] */
 
-    Vector upDir, zeroPhiDir;
+    Vector3d upDir, zeroPhiDir;
     if (badlyConditioned) { // Hnorm approximately equal to n0
         /* any frame perpendicular to H will do (min and max cosTheta
          * are set to -1 and 1 above anyway) */
-        Frame f(projectionDir);
-        upDir = f.s;
-        zeroPhiDir = f.t;
+        _coordinateSystem(projectionDir, upDir, zeroPhiDir);
     } else {
         FSAssert(projectionDir == Hnorm);
         upDir = -normalize(n0 - Hnorm*dot(n0, Hnorm)); // point in opposite direction than normal
         zeroPhiDir = cross(upDir, Hnorm);
     }
-    FSAssertWarn(math::abs(upDir.length() - 1) < Epsilon);
-    FSAssertWarn(math::abs(zeroPhiDir.length() - 1) < Epsilon);
-    FSAssertWarn(math::abs(dot(zeroPhiDir, projectionDir) < Epsilon));
-    FSAssertWarn(math::abs(dot(zeroPhiDir, upDir) < Epsilon));
-    FSAssertWarn(math::abs(dot(projectionDir, upDir) < Epsilon));
-    FSAssertWarn(badlyConditioned || math::abs(dot(zeroPhiDir, n0) < Epsilon));
+    FSAssertWarn(std::abs(upDir.length() - 1) < Epsilon);
+    FSAssertWarn(std::abs(zeroPhiDir.length() - 1) < Epsilon);
+    FSAssertWarn(std::abs(dot(zeroPhiDir, projectionDir) < Epsilon));
+    FSAssertWarn(std::abs(dot(zeroPhiDir, upDir) < Epsilon));
+    FSAssertWarn(std::abs(dot(projectionDir, upDir) < Epsilon));
+    FSAssertWarn(badlyConditioned || std::abs(dot(zeroPhiDir, n0) < Epsilon));
     FSAssertWarn(badlyConditioned || dot(upDir, n0) <= Epsilon); // negative with safety epsilon
 
 #if MTS_FWDSCAT_DEBUG
     /* This can become bad when roundCosThetaForStability is too agressive... */
     // The point at the extremal cosine should lie exactly in the plane
     if (minCosTheta != -1)
-        FSAssertWarn(ShadowEpsilon > math::abs(dot(n0,
+        FSAssertWarn(ShadowEpsilon > std::abs(dot(n0,
                 minCosTheta*projectionDir + math::safe_sqrt(1-minCosTheta*minCosTheta)*upDir)));
     if (maxCosTheta != 1)
-        FSAssertWarn(ShadowEpsilon > math::abs(dot(n0,
+        FSAssertWarn(ShadowEpsilon > std::abs(dot(n0,
                 maxCosTheta*projectionDir + math::safe_sqrt(1-maxCosTheta*maxCosTheta)*upDir)));
     // The point at the (non-trivial) extremal phi values should lie exactly in the plane
-    Float minCosPhi, minSinPhi;
+    double minCosPhi, minSinPhi;
     math::sincos(minPhi, &minSinPhi, &minCosPhi);
-    if (minPhi != -HALF_PI)
-        FSAssertWarn(ShadowEpsilon > math::abs(dot(n0,
+    if (minPhi != -HALF_PI_DBL)
+        FSAssertWarn(ShadowEpsilon > std::abs(dot(n0,
                 sinTheta * (minSinPhi*upDir + minCosPhi*zeroPhiDir) + cosTheta * projectionDir)));
-    Float maxCosPhi, maxSinPhi;
+    double maxCosPhi, maxSinPhi;
     math::sincos(maxPhi, &maxSinPhi, &maxCosPhi);
-    if (maxPhi != M_PI+HALF_PI)
-        FSAssertWarn(ShadowEpsilon > math::abs(dot(n0,
+    if (maxPhi != M_PI_DBL+HALF_PI_DBL)
+        FSAssertWarn(ShadowEpsilon > std::abs(dot(n0,
                 sinTheta * (maxSinPhi*upDir + maxCosPhi*zeroPhiDir) + cosTheta * projectionDir)));
 #endif
 
-    Float sinPhi, cosPhi;
+    double sinPhi, cosPhi;
     math::sincos(phi, &sinPhi, &cosPhi);
     u0 = sinTheta * (sinPhi*upDir + cosPhi*zeroPhiDir) + cosTheta * projectionDir;
-    FSAssertWarn(math::abs(u0.length() - 1) < Epsilon);
+    FSAssertWarn(std::abs(u0.length() - 1) < Epsilon);
 #ifdef MTS_FWDSCAT_DEBUG
     if (dot(u0,n0) > ShadowEpsilon) // We *aren't* an incoming direction (with some epsilon margin)
         Log(EWarn, "Generated non-incoming direction: cosine %f (should be < 0) -- badlyConditioned: %d",
@@ -1532,7 +1734,7 @@ FINLINE Float FwdScat::sampleDirectionBoundaryAwareMonopole_orig(
         return 0.0f;
     }
 
-    Float pdf = cosThetaPdf * phiPdf;
+    double pdf = cosThetaPdf * phiPdf;
     FSAssert(pdf >= 0);
     if (pdf == 0) {
         Log(EWarn, "Underflow occured in the pdf of sampleDirectionBoundaryAwareMonopole");
@@ -1540,18 +1742,18 @@ FINLINE Float FwdScat::sampleDirectionBoundaryAwareMonopole_orig(
         return 0.0f;
     }
 #ifdef MTS_FWDSCAT_DEBUG
-    Float pdfCheck = pdfDirectionBoundaryAwareMonopole_orig(u0, n0, uL, R, s);
-    if (math::abs((pdf - pdfCheck) / pdf) > 1e-3)
+    double pdfCheck = pdfDirectionBoundaryAwareMonopole_orig(u0, n0, uL, R, s);
+    if (std::abs((pdf - pdfCheck) / pdf) > 1e-3)
         Log(EWarn, "Inconsistent pdfs: %e %e, rel %f; costheta %e, |H| %e, E %e, D %e", pdf, pdfCheck, (pdf-pdfCheck)/pdf, cosTheta, lHl, E, D);
 #endif
-    FSAssertWarn(cosTheta == 0 || math::abs((dot(u0,projectionDir) - cosTheta) / cosTheta) < 1e-3);
+    FSAssertWarn(cosTheta == 0 || std::abs((dot(u0,projectionDir) - cosTheta) / cosTheta) < 1e-3);
     return pdf;
 }
 
 // TODO combine pdf and sampler with an 'impl' style function
-FINLINE Float FwdScat::pdfDirectionBoundaryAwareMonopole_orig(
-        const Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-        Float s) const {
+FINLINE double FwdScat::pdfDirectionBoundaryAwareMonopole_orig(
+        const Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+        double s) const {
 
     if (dot(u0,n0) >= 0)
         return 0.0;
@@ -1563,20 +1765,20 @@ FINLINE Float FwdScat::pdfDirectionBoundaryAwareMonopole_orig(
     Vector3d H = E*Vector3d(R) - D*Vector3d(uL);
     double lHl = H.length();
     FSAssert(std::isfinite(lHl));
-    Vector Hnorm = Vector(H / lHl);
+    Vector3d Hnorm = Vector3d(H / lHl);
 
     /* Regularization */
     lHl = (lHl > 1./MTS_FWDSCAT_DIRECTION_MIN_MU) ? 1./MTS_FWDSCAT_DIRECTION_MIN_MU : lHl;
-    bool badlyConditioned = math::abs(dot(n0, Hnorm)) > 1-Epsilon;
+    bool badlyConditioned = std::abs(dot(n0, Hnorm)) > 1-Epsilon;
 
-    Float minCosTheta, maxCosTheta, minPhi, maxPhi;
-    Vector projectionDir;
-    Float cosTheta;
+    double minCosTheta, maxCosTheta, minPhi, maxPhi;
+    Vector3d projectionDir;
+    double cosTheta;
     if (badlyConditioned) {
         minCosTheta = -1;
         maxCosTheta = 0;
-        minPhi = -HALF_PI;
-        maxPhi = M_PI+HALF_PI;
+        minPhi = -HALF_PI_DBL;
+        maxPhi = M_PI_DBL+HALF_PI_DBL;
         projectionDir = n0;
 
         cosTheta = roundCosThetaForStability(dot(projectionDir, u0),
@@ -1584,10 +1786,10 @@ FINLINE Float FwdScat::pdfDirectionBoundaryAwareMonopole_orig(
         FSAssertWarn(minCosTheta - Epsilon <= cosTheta);
         FSAssertWarn(cosTheta <= maxCosTheta + Epsilon);
     } else {
-        Float phiCutoffSlope;
-        Float exactSin = dot(n0,Hnorm);
-        Float tmpCos = roundCosThetaForStability(math::safe_sqrt(1 - math::square(exactSin)), (Float)-1, (Float)1); // z* in paper
-        Float tmpSin = math::safe_sqrt(1 - math::square(tmpCos)); // detour because of potential rounding
+        double phiCutoffSlope;
+        double exactSin = dot(n0,Hnorm);
+        double tmpCos = roundCosThetaForStability(math::safe_sqrt(1 - _square(exactSin)), (double)-1, (double)1); // z* in paper
+        double tmpSin = math::safe_sqrt(1 - _square(tmpCos)); // detour because of potential rounding
         if (dot(Hnorm, n0) < 0) {
             // H points to the correct (=incoming) side of the boundary -> maxCos=1
             minCosTheta = -tmpCos;
@@ -1606,9 +1808,9 @@ FINLINE Float FwdScat::pdfDirectionBoundaryAwareMonopole_orig(
         FSAssertWarn(minCosTheta - Epsilon <= cosTheta);
         FSAssertWarn(cosTheta <= maxCosTheta + Epsilon);
 
-        Float h = phiCutoffSlope * cosTheta;
-        Float sinTheta = math::safe_sqrt(1 - cosTheta * cosTheta);
-        Float hUnitCircle;
+        double h = phiCutoffSlope * cosTheta;
+        double sinTheta = math::safe_sqrt(1 - cosTheta * cosTheta);
+        double hUnitCircle;
         if (sinTheta == 0) {
             hUnitCircle = -1;
         } else {
@@ -1617,21 +1819,21 @@ FINLINE Float FwdScat::pdfDirectionBoundaryAwareMonopole_orig(
         FSAssert(std::isfinite(hUnitCircle));
         FSAssertWarn(hUnitCircle <= 1+ShadowEpsilon);
         minPhi = math::safe_asin(hUnitCircle);
-        maxPhi = M_PI - minPhi;
+        maxPhi = M_PI_DBL - minPhi;
     }
     FSAssert(minCosTheta >= -1 && minCosTheta <= 0);
     FSAssert(maxCosTheta >=  0 && maxCosTheta <= 1);
-    FSAssert(minPhi >= -HALF_PI && minPhi <= HALF_PI);
-    FSAssert(maxPhi >=  HALF_PI && maxPhi <= M_PI + HALF_PI);
+    FSAssert(minPhi >= -HALF_PI_DBL && minPhi <= HALF_PI_DBL);
+    FSAssert(maxPhi >=  HALF_PI_DBL && maxPhi <= M_PI_DBL + HALF_PI_DBL);
 
     FSAssert(minCosTheta - Epsilon <= cosTheta  &&  cosTheta <= maxCosTheta + Epsilon);
 
-    Float cosThetaPdf;
+    double cosThetaPdf;
     // expansion
     if (lHl < Epsilon) {
-        Float d = maxCosTheta - minCosTheta;
+        double d = maxCosTheta - minCosTheta;
         cosThetaPdf = (1 + 0.5*(2*cosTheta - minCosTheta - maxCosTheta) * lHl
-                + 1./12.*(math::square(maxCosTheta) + math::square(minCosTheta)
+                + 1./12.*(_square(maxCosTheta) + _square(minCosTheta)
                         + 4*minCosTheta*maxCosTheta
                         + 6*cosTheta*(cosTheta - minCosTheta - maxCosTheta))
                                 * lHl*lHl) / d;
@@ -1644,7 +1846,7 @@ FINLINE Float FwdScat::pdfDirectionBoundaryAwareMonopole_orig(
     }
     FSAssert(std::isfinite(cosThetaPdf) && cosThetaPdf >= 0);
 
-    Float phiPdf = 1.0 / (maxPhi - minPhi);
+    double phiPdf = 1.0 / (maxPhi - minPhi);
     return cosThetaPdf * phiPdf;
 }
 
@@ -1661,14 +1863,14 @@ FINLINE Float FwdScat::pdfDirectionBoundaryAwareMonopole_orig(
 FINLINE double sampleExpSinCos_dCos(double a, double b, double &cosTheta, Sampler *sampler) {
     SFSAssert(a >= -Epsilon);
     // TODO; better blend based on relative magnitudes of a and b...
-    Float laplaceWeight = (a < Epsilon) ? 0.00 : 0.49;
-    Float expWeight     = (a < Epsilon) ? 0.98 : 0.49;
-    Float uniformWeight = 0.02;
-    SFSAssert(math::abs(laplaceWeight + expWeight + uniformWeight - 1) < Epsilon);
+    double laplaceWeight = (a < Epsilon) ? 0.00 : 0.49;
+    double expWeight     = (a < Epsilon) ? 0.98 : 0.49;
+    double uniformWeight = 0.02;
+    SFSAssert(std::abs(laplaceWeight + expWeight + uniformWeight - 1) < Epsilon);
 
     enum {ELaplace, EExp, EUniform, ENone} strategy;
     if (sampler) {
-        Float u = sampler->next1D();
+        double u = sampler->next1D();
         if (u < laplaceWeight) {
             strategy = ELaplace;
         } else if (u < laplaceWeight + expWeight) {
@@ -1727,7 +1929,7 @@ FINLINE double sampleExpCos_dPhi(double a, double &phi, Sampler *sampler) {
         doUniformSamplingInstead = true;
     }
 
-    double phiOrigSd = 1.0 / sqrt(math::abs(a));
+    double phiOrigSd = 1.0 / sqrt(std::abs(a));
     double stddevSafetyFactor = phiOrigSd > 1.5 ? 1.8 : 1.1; // we are less precise for high stddev
     double phiSd = stddevSafetyFactor * phiOrigSd;
     if (phiSd == 0)
@@ -1760,7 +1962,7 @@ FINLINE double sampleExpCos_dPhi(double a, double &phi, Sampler *sampler) {
     SFSAssert(phiLo <= phiForPdf && phiForPdf <= phiHi);
 
     return truncnormWeight * truncnormPdf(phiMean, phiSd, phiLo, phiHi, phiForPdf)
-            + uniformWeight * INV_TWOPI;
+            + uniformWeight * INV_TWOPI_DBL;
 }
 
 
@@ -1770,20 +1972,20 @@ FINLINE double sampleExpCos_dPhi(double a, double &phi, Sampler *sampler) {
 
 
 
-FINLINE Float FwdScat::sampleDirectionBoundaryAwareMonopole_bis(
-        Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-        Float s, Sampler *sampler) const {
+FINLINE double FwdScat::sampleDirectionBoundaryAwareMonopole_bis(
+        Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+        double s, Sampler *sampler) const {
 
-    Float pdf;
+    double pdf;
     implDirectionBoundaryAwareMonopole_bis(
             u0, n0, uL, R, s, sampler, &pdf);
 
 #ifdef MTS_FWDSCAT_DEBUG
     if (pdf == 0)
         return 0;
-    Float pdfCheck = pdfDirectionBoundaryAwareMonopole_bis(
+    double pdfCheck = pdfDirectionBoundaryAwareMonopole_bis(
             u0, n0, uL, R, s);
-    if (math::abs(pdf-pdfCheck)/pdf > 1e-3) {
+    if (std::abs(pdf-pdfCheck)/pdf > 1e-3) {
         Log(EWarn, "Inconsistent pdfs: %e %e, rel %f",
                 pdf, pdfCheck, (pdf-pdfCheck)/pdf);
     }
@@ -1792,12 +1994,12 @@ FINLINE Float FwdScat::sampleDirectionBoundaryAwareMonopole_bis(
     return pdf;
 }
 
-FINLINE Float FwdScat::pdfDirectionBoundaryAwareMonopole_bis(
-        const Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-        Float s) const {
+FINLINE double FwdScat::pdfDirectionBoundaryAwareMonopole_bis(
+        const Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+        double s) const {
 
-    Float pdf;
-    Vector u0copy(u0);
+    double pdf;
+    Vector3d u0copy(u0);
     implDirectionBoundaryAwareMonopole_bis(
             u0copy, n0, uL, R, s, NULL, &pdf);
     return pdf;
@@ -1815,15 +2017,15 @@ FINLINE Float FwdScat::pdfDirectionBoundaryAwareMonopole_bis(
  * paper)
  * */
 FINLINE void FwdScat::implDirectionBoundaryAwareMonopole_bis(
-        Vector &u0, const Vector &n0, const Vector &uL, const Vector &R,
-        Float s, Sampler *sampler, Float *pdf) const {
+        Vector3d &u0, const Vector3d &n0, const Vector3d &uL, const Vector3d &R,
+        double s, Sampler *sampler, double *pdf) const {
     if (pdf)
         *pdf = 0; // set to zero already so we can simply return on error
 
     if (sampler == NULL)
-        FSAssert(math::abs(u0.length() - 1) < Epsilon);
+        FSAssert(std::abs(u0.length() - 1) < Epsilon);
 
-    FSAssert(math::abs(uL.length() - 1) < Epsilon);
+    FSAssert(std::abs(uL.length() - 1) < Epsilon);
     FSAssert(R.isFinite());
     FSAssert(std::isfinite(s));
     FSAssert(s >= 0);
@@ -1845,16 +2047,14 @@ FINLINE void FwdScat::implDirectionBoundaryAwareMonopole_bis(
     if (x_unnorm.length() <= Epsilon * H.length()) {
         /* any frame will do; a will go to 0 and the sampling will be
          * uniform where needed (e.g. phi sampling) */
-        Frame f(n0); // n0 = 'Vector(z)'
-        /* TODO when compiled for single precision: this will not be
-         * orthogonal up to double precision (single not tested...)!: */
-        x_unnorm = Vector3d(f.s);
+        Vector3d t;
+        _coordinateSystem(n0, x_unnorm, t); // n0 = 'z'
     }
     const Vector3d x = normalize(x_unnorm);
     const Vector3d y = cross(x, z);
-    FSAssert(math::abs(dot(x,y)) < Epsilon);
-    FSAssert(math::abs(dot(x,z)) < Epsilon);
-    FSAssert(math::abs(dot(y,z)) < Epsilon);
+    FSAssert(std::abs(dot(x,y)) < Epsilon);
+    FSAssert(std::abs(dot(x,z)) < Epsilon);
+    FSAssert(std::abs(dot(y,z)) < Epsilon);
 
     /* Sample cos(theta) */
     double a = dot(H,x);
@@ -1867,7 +2067,7 @@ FINLINE void FwdScat::implDirectionBoundaryAwareMonopole_bis(
     }
     FSAssert(a >= -10*Epsilon*H.length());
     FSAssert(std::isfinite(b));
-    if (math::abs(a) < 1e-4) {
+    if (std::abs(a) < 1e-4) {
         a = 0;
         /* This makes the standard deviations go to infinity (i.e. simply
          * uniform sampling) and helps with stability. There are pdf
@@ -1883,13 +2083,13 @@ FINLINE void FwdScat::implDirectionBoundaryAwareMonopole_bis(
         cosTheta = math::clamp(cosTheta, -1.0, 0.0);
         cosThetaPdf = sampleExpSinCos_dCos(a, b, cosTheta, NULL);
     }
-    double sinTheta = math::safe_sqrt(1 - math::square(cosTheta));
+    double sinTheta = math::safe_sqrt(1 - _square(cosTheta));
 
 
     /* Sample phi:
      * weight: exp(a*sin(theta) * cos(phi)) */
     double phi, phiPdf;
-    double phiCte = math::abs(a) * sinTheta;
+    double phiCte = std::abs(a) * sinTheta;
     if (sampler) {
         phiPdf = sampleExpCos_dPhi(phiCte, phi, sampler);
     } else {
@@ -1902,8 +2102,8 @@ FINLINE void FwdScat::implDirectionBoundaryAwareMonopole_bis(
     double sinPhi, cosPhi;
     math::sincos(phi, &sinPhi, &cosPhi);
 
-    Vector constructed_u0 = Vector(x * cosPhi*sinTheta  +  y * sinPhi*sinTheta  +  z * cosTheta);
-    FSAssert(math::abs(constructed_u0.length() - 1) < Epsilon);
+    Vector3d constructed_u0 = Vector3d(x * cosPhi*sinTheta  +  y * sinPhi*sinTheta  +  z * cosTheta);
+    FSAssert(std::abs(constructed_u0.length() - 1) < Epsilon);
 
     if (sampler) {
         u0 = constructed_u0;
@@ -21,6 +21,9 @@
 #include <mitsuba/render/range.h>
 #include "irrproc.h"
 
+/// Number of compact irradiance samples per chunk of collected results
+#define IRRPROC_CHUNK_SIZE 65536
+
 MTS_NAMESPACE_BEGIN
 
 /* Parallel irradiance sampling implementation (worker) */
@@ -76,11 +79,10 @@ public:
             its.time = m_time;
             its.hasUVPartials = false;
 
-            result->put(IrradianceSample(
-                its.p,
+            result->put(its.p,
                 integrator->E(m_scene.get(), its, its.shape->getExteriorMedium(), m_sampler,
                     m_irrSamples, m_irrIndirect)
-            ));
+            );
         }
     }
 
@@ -130,7 +132,7 @@ void IrradianceSampleVector::load(Stream *stream) {
     size_t count = stream->readSize();
     m_samples.resize(count);
     for (size_t i=0; i<count; ++i)
-        m_samples[i] = IrradianceSample(stream);
+        m_samples[i] = CompactIrradianceSample(stream);
 }
 
 void IrradianceSampleVector::save(Stream *stream) const {
@@ -152,8 +154,8 @@ IrradianceSamplingProcess::IrradianceSamplingProcess(PositionSampleVector *posit
     : m_positionSamples(positions), m_granularity(granularity),
       m_irrSamples(irrSamples), m_irrIndirect(irrIndirect), m_time(time) {
     m_resultMutex = new Mutex();
-    m_irradianceSamples = new IrradianceSampleVector();
-    m_irradianceSamples->reserve(positions->size());
+    m_positionCount = positions->size();
+    m_sampleCount = 0;
     m_samplesRequested = 0;
     m_progress = new ProgressReporter("Sampling irradiance", positions->size(), data);
 }
@@ -168,11 +170,11 @@ ref<WorkProcessor> IrradianceSamplingProcess::createWorkProcessor() const {
 }
 
 ParallelProcess::EStatus IrradianceSamplingProcess::generateWork(WorkUnit *unit, int worker) {
-    if (m_samplesRequested == m_positionSamples->size())
+    if (m_samplesRequested == m_positionCount)
         return EFailure;
 
     /* Reserve a sequence of at most 'granularity' samples */
-    size_t workSize = std::min(m_granularity, m_positionSamples->size() - m_samplesRequested);
+    size_t workSize = std::min(m_granularity, m_positionCount - m_samplesRequested);
 
     std::vector<PositionSample> &samples = static_cast<PositionSampleVector *>(unit)->get();
     const std::vector<PositionSample> &source = m_positionSamples->get();
@@ -183,15 +185,46 @@ ParallelProcess::EStatus IrradianceSamplingProcess::generateWork(WorkUnit *unit,
             source.begin() + m_samplesRequested + workSize);
     m_samplesRequested += workSize;
 
+    /* All positions have been copied into work units */
+    if (m_samplesRequested == m_positionCount)
+        m_positionSamples = NULL;
+
     return ESuccess;
 }
 
 void IrradianceSamplingProcess::processResult(const WorkResult *wr, bool cancelled) {
-    const IrradianceSampleVector *result = static_cast<const IrradianceSampleVector *>(wr);
+    const std::vector<CompactIrradianceSample> &samples =
+        static_cast<const IrradianceSampleVector *>(wr)->get();
+    LockGuard lock(m_resultMutex);
+
+    /* Append to fixed-size chunks, which never need to be reallocated */
+    for (size_t pos = 0; pos < samples.size(); ) {
+        if (m_chunks.empty() || m_chunks.back().size() == IRRPROC_CHUNK_SIZE) {
+            m_chunks.push_back(std::vector<CompactIrradianceSample>());
+            m_chunks.back().reserve(IRRPROC_CHUNK_SIZE);
+        }
+        std::vector<CompactIrradianceSample> &chunk = m_chunks.back();
+        size_t count = std::min(samples.size() - pos,
+            (size_t) IRRPROC_CHUNK_SIZE - chunk.size());
+        chunk.insert(chunk.end(), samples.begin() + pos, samples.begin() + pos + count);
+        pos += count;
+    }
+    m_sampleCount += samples.size();
+    m_progress->update(m_sampleCount);
+}
+
+void IrradianceSamplingProcess::extractSamples(std::vector<IrradianceSample> &samples, Float area) {
     LockGuard lock(m_resultMutex);
-    for (size_t i=0; i<result->size(); ++i)
-        m_irradianceSamples->put((*result)[i]);
-    m_progress->update(m_irradianceSamples->size());
+    samples.clear();
+    samples.reserve(m_sampleCount);
+    for (size_t i=0; i<m_chunks.size(); ++i) {
+        std::vector<CompactIrradianceSample> &chunk = m_chunks[i];
+        for (size_t j=0; j<chunk.size(); ++j)
+            samples.push_back(chunk[j].expand(area));
+        std::vector<CompactIrradianceSample>().swap(chunk);
+    }
+    m_chunks.clear();
+    m_sampleCount = 0;
 }
 
 MTS_IMPLEMENT_CLASS(PositionSampleVector, false, WorkUnit);
@@ -143,8 +143,83 @@ public:
 };
 
 /**
- * \brief This class stores a number of irradiance samples, which can be sent
- * over the wire as needed.
+ * \brief Irradiance sample in the compact format that is used while sampling
+ *
+ * The position is stored in single precision and the irradiance using
+ * 16-bit mantissas with a shared exponent (20 bytes for RGB instead of 32).
+ * All samples represent the same surface area, which is only assigned
+ * when they are expanded into \ref IrradianceSample records.
+ */
+class CompactIrradianceSample {
+public:
+    /// Default (empty) constructor
+    inline CompactIrradianceSample() { }
+
+    /// Unserialize a compact irradiance sample from a binary data stream
+    inline CompactIrradianceSample(Stream *stream) {
+        stream->readSingleArray(p);
+        stream->readUShortArray(mantissa, SPECTRUM_SAMPLES);
+        exponent = (int8_t) stream->readChar();
+    }
+
+    /// Encode a sample point and its irradiance
+    inline CompactIrradianceSample(const Point &p, const Spectrum &E) {
+        for (int i=0; i<3; ++i)
+            this->p[i] = (float) p[i];
+
+        Float max = 0;
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+            max = std::max(max, E[i]);
+
+        int exp = -128;
+        if (max > 0 && max < std::numeric_limits<Float>::infinity())
+            std::frexp(max, &exp);
+        if (exp <= -128) {
+            /* Zero, vanishingly small or invalid */
+            exponent = -128;
+            memset(mantissa, 0, sizeof(mantissa));
+            return;
+        }
+        exponent = (int8_t) std::min(exp, 127);
+
+        /* The largest component is stored with 16 significant bits. Scaling
+           each component separately avoids overflowing the scale factor */
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+            mantissa[i] = (uint16_t) std::min((Float) 0xFFFF, std::ldexp(
+                std::max(E[i], (Float) 0), 16 - exponent) + (Float) 0.5f);
+    }
+
+    /// Serialize a compact irradiance sample to a binary data stream
+    inline void serialize(Stream *stream) const {
+        stream->writeSingleArray(p);
+        stream->writeUShortArray(mantissa, SPECTRUM_SAMPLES);
+        stream->writeChar((char) exponent);
+    }
+
+    /// Decode the irradiance value
+    inline Spectrum getIrradiance() const {
+        Spectrum E;
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+            E[i] = std::ldexp((Float) mantissa[i], exponent - 16);
+        return E;
+    }
+
+    /// Expand into a full irradiance sample representing the given area
+    inline IrradianceSample expand(Float area) const {
+        IrradianceSample sample(Point((Float) p[0], (Float) p[1],
+            (Float) p[2]), getIrradiance());
+        sample.area = area;
+        return sample;
+    }
+
+    float p[3];
+    uint16_t mantissa[SPECTRUM_SAMPLES];
+    int8_t exponent;
+};
+
+/**
+ * \brief This class stores a number of compact irradiance samples, which
+ * can be sent over the wire as needed.
  *
  * Used to implement parallel irradiance sampling for the dipole BSSRDF.
  */
@@ -152,8 +227,8 @@ class IrradianceSampleVector : public WorkResult {
 public:
     IrradianceSampleVector() { }
 
-    inline void put(const IrradianceSample &rec) {
-        m_samples.push_back(rec);
+    inline void put(const Point &p, const Spectrum &E) {
+        m_samples.push_back(CompactIrradianceSample(p, E));
     }
 
     inline size_t size() const {
@@ -164,7 +239,11 @@ public:
         m_samples.clear();
     }
 
-    inline std::vector<IrradianceSample> &get() {
+    inline std::vector<CompactIrradianceSample> &get() {
+        return m_samples;
+    }
+
+    inline const std::vector<CompactIrradianceSample> &get() const {
         return m_samples;
     }
 
@@ -172,7 +251,7 @@ public:
         m_samples.reserve(size);
     }
 
-    inline const IrradianceSample &operator[](size_t index) const {
+    inline const CompactIrradianceSample &operator[](size_t index) const {
         return m_samples[index];
     }
 
@@ -186,11 +265,16 @@ protected:
     // Virtual destructor
     virtual ~IrradianceSampleVector() { }
 private:
-    std::vector<IrradianceSample> m_samples;
+    std::vector<CompactIrradianceSample> m_samples;
 };
 
 /**
- * Parallel process for performing distributed irradiance sampling
+ * \brief Parallel process for performing distributed irradiance sampling
+ *
+ * Results are collected in compact form into fixed-size chunks, and the
+ * position samples are released as soon as the last work unit has been
+ * handed out. This keeps the memory usage of dense sample sets low until
+ * the samples are expanded for the octree construction.
  */
 class IrradianceSamplingProcess : public ParallelProcess {
 public:
@@ -198,13 +282,18 @@ public:
         size_t granularity, int irrSamples, bool irrIndirect,
         Float time, const void *data);
 
-    inline IrradianceSampleVector *getIrradianceSampleVector() {
-        return m_irradianceSamples.get();
+    /// Return the number of irradiance samples that have been computed so far
+    inline size_t getSampleCount() const {
+        return m_sampleCount;
     }
 
-    inline PositionSampleVector *getPositionSampleVector() {
-        return m_positionSamples.get();
-    }
+    /**
+     * \brief Expand the computed samples into \c samples, all of which
+     * represent the given surface area
+     *
+     * The compact samples are released chunk by chunk along the way.
+     */
+    void extractSamples(std::vector<IrradianceSample> &samples, Float area);
 
     inline const AABB &getAABB() const {
         return m_aabb;
@@ -221,7 +310,8 @@ protected:
     virtual ~IrradianceSamplingProcess();
 private:
     ref<PositionSampleVector> m_positionSamples;
-    ref<IrradianceSampleVector> m_irradianceSamples;
+    std::vector<std::vector<CompactIrradianceSample> > m_chunks;
+    size_t m_positionCount, m_sampleCount;
     size_t m_samplesRequested, m_granularity;
     int m_irrSamples;
     bool m_irrIndirect;
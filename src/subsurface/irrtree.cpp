@@ -30,7 +30,10 @@ IrradianceOctree::IrradianceOctree(const AABB &bounds, Float solidAngleThreshold
     m_items.swap(records);
 
     build();
-    propagate(m_root);
+    if (m_root)
+        propagate(m_root);
+    compact();
+    buildSampleArrays();
 }
 
 IrradianceOctree::IrradianceOctree(Stream *stream, InstanceManager *manager) {
@@ -45,8 +48,20 @@ IrradianceOctree::IrradianceOctree(Stream *stream, InstanceManager *manager) {
     for (size_t i=0; i<items; ++i)
         m_items[i] = IrradianceSample(stream);
 
-    build();
-    propagate(m_root);
+    m_invQuantScale = Vector(stream);
+    size_t nodes = stream->readSize();
+    m_nodes.resize(nodes);
+    for (size_t i=0; i<nodes; ++i) {
+        FlatNode &node = m_nodes[i];
+        node.data = IrradianceSample(stream);
+        node.offset = stream->readUInt();
+        uint32_t count = stream->readUInt();
+        node.count = count & 0x7FFFFFFF;
+        node.leaf = count >> 31;
+        stream->readUShortArray(node.qmin, 3);
+        stream->readUShortArray(node.qmax, 3);
+    }
+    buildSampleArrays();
 }
 
 void IrradianceOctree::serialize(Stream *stream, InstanceManager *manager) const {
@@ -58,6 +73,103 @@ void IrradianceOctree::serialize(Stream *stream, InstanceManager *manager) const
     stream->writeSize(m_items.size());
     for (size_t i=0; i<m_items.size(); ++i)
         m_items[i].serialize(stream);
+
+    m_invQuantScale.serialize(stream);
+    stream->writeSize(m_nodes.size());
+    for (size_t i=0; i<m_nodes.size(); ++i) {
+        const FlatNode &node = m_nodes[i];
+        node.data.serialize(stream);
+        stream->writeUInt(node.offset);
+        stream->writeUInt(node.count | ((uint32_t) node.leaf << 31));
+        stream->writeUShortArray(node.qmin, 3);
+        stream->writeUShortArray(node.qmax, 3);
+    }
+}
+
+void IrradianceOctree::buildSampleArrays() {
+#if defined(MTS_SSE) && SPECTRUM_SAMPLES == 3
+    size_t stride = m_items.size() + 4;
+    m_sampleData.clear();
+    m_sampleData.resize(7 * stride, 0.0f);
+
+    float *data = &m_sampleData[0];
+    for (size_t i=0; i<m_items.size(); ++i) {
+        const IrradianceSample &sample = m_items[i];
+        for (int j=0; j<3; ++j) {
+            data[j*stride + i] = sample.p[j];
+            data[(3+j)*stride + i] = sample.E[j];
+        }
+        data[6*stride + i] = sample.area;
+    }
+
+    m_sampleArrays.x    = data;
+    m_sampleArrays.y    = data + stride;
+    m_sampleArrays.z    = data + 2*stride;
+    m_sampleArrays.r    = data + 3*stride;
+    m_sampleArrays.g    = data + 4*stride;
+    m_sampleArrays.b    = data + 5*stride;
+    m_sampleArrays.area = data + 6*stride;
+#endif
+}
+
+void IrradianceOctree::compact() {
+    Vector extents = m_aabb.getExtents();
+    for (int i=0; i<3; ++i)
+        m_invQuantScale[i] = extents[i] > 0 ? EQuantizationLevels / extents[i] : 0;
+
+    m_nodes.clear();
+    if (!m_root)
+        return;
+
+    /* Breadth-first traversal: the children of every node end up next to
+       each other, in the same order as in the pointer-based tree */
+    struct QueueEntry {
+        const OctreeNode *node;
+        AABB aabb;
+        int depth;
+    };
+    std::vector<QueueEntry> queue;
+    QueueEntry root = { m_root, m_aabb, 0 };
+    queue.push_back(root);
+
+    for (size_t head = 0; head < queue.size(); ++head) {
+        const QueueEntry entry = queue[head];
+        const OctreeNode *node = entry.node;
+        if (entry.depth >= EMaxDepth)
+            Log(EError, "Irradiance octree is too deep to be compacted!");
+
+        FlatNode flat;
+        flat.data = node->data;
+        flat.leaf = node->leaf;
+        for (int i=0; i<3; ++i) {
+            Float tMin = (entry.aabb.min[i] - m_aabb.min[i]) * m_invQuantScale[i];
+            Float tMax = (entry.aabb.max[i] - m_aabb.min[i]) * m_invQuantScale[i];
+            flat.qmin[i] = (uint16_t) math::clamp(math::floorToInt(tMin), 0, (int) EQuantizationLevels);
+            flat.qmax[i] = (uint16_t) math::clamp(math::ceilToInt(tMax), 0, (int) EQuantizationLevels);
+        }
+
+        if (node->leaf) {
+            flat.offset = node->offset;
+            flat.count = node->count;
+        } else {
+            flat.offset = (uint32_t) queue.size();
+            flat.count = 0;
+            Point center = entry.aabb.getCenter();
+            for (int i=0; i<8; i++) {
+                if (!node->children[i])
+                    continue;
+                QueueEntry child = { node->children[i],
+                    childBounds(i, entry.aabb, center), entry.depth + 1 };
+                queue.push_back(child);
+                flat.count++;
+            }
+        }
+        m_nodes.push_back(flat);
+    }
+
+    /* The pointer-based tree is not needed anymore */
+    delete m_root;
+    m_root = NULL;
 }
 
 void IrradianceOctree::propagate(OctreeNode *node) {
@@ -25,8 +25,31 @@
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * \brief Octree of irradiance samples, with representatives for distant nodes
+ *
+ * The tree is built with \ref StaticOctree and then compacted into a
+ * breadth-first array of nodes without pointers: the children of a node are
+ * stored contiguously and addressed with a 32-bit offset, and the node bounds
+ * are quantized to 16 bits relative to the bounds of the whole tree. The
+ * compacted layout is also what gets serialized, so that unserializing does
+ * not need to rebuild the tree.
+ */
 class IrradianceOctree : public StaticOctree<IrradianceSample, IrradianceSample>, public SerializableObject {
 public:
+#if defined(MTS_SSE) && SPECTRUM_SAMPLES == 3
+    /**
+     * \brief Structure-of-arrays copy of the samples in \c m_items
+     *
+     * Queries receive whole leaves through these arrays, so that they can
+     * process four samples per SSE instruction. Every array is padded
+     * with zeros, which permits unaligned 4-wide loads up to the end.
+     */
+    struct SampleArrays {
+        const float *x, *y, *z, *r, *g, *b, *area;
+    };
+#endif
+
     /// Construct a new irradiance octree
     IrradianceOctree(const AABB &aabb, Float solidAngleThreshold,
         std::vector<IrradianceSample> &records);
@@ -39,40 +62,91 @@ public:
 
     /// Query the octree using a customizable functor, while representatives for distant nodes
     template <typename QueryType> inline void performQuery(QueryType &query) const {
-        performQuery(m_aabb, m_root, query);
+        if (m_nodes.empty())
+            return;
+
+        /* Ranges of siblings that remain to be visited, one per tree level */
+        struct Range { uint32_t next, end; } stack[EMaxDepth + 1];
+        int stackPos = 0;
+        stack[0].next = 0; stack[0].end = 1;
+
+        while (stackPos >= 0) {
+            Range &range = stack[stackPos];
+            if (range.next == range.end) {
+                --stackPos;
+                continue;
+            }
+            const FlatNode &node = m_nodes[range.next++];
+
+            /* Compute the approximate solid angle subtended by samples within this node */
+            Float approxSolidAngle = node.data.area / (query.p - node.data.p).lengthSquared();
+
+            /* Use the representative if this is a distant node */
+            if (!nodeContains(node, query.p) && approxSolidAngle < m_solidAngleThreshold) {
+                query(node.data);
+            } else if (node.leaf) {
+#if defined(MTS_SSE) && SPECTRUM_SAMPLES == 3
+                query(m_sampleArrays, node.offset, node.count);
+#else
+                for (uint32_t i=0; i<node.count; ++i)
+                    query(m_items[node.offset + i]);
+#endif
+            } else {
+                ++stackPos;
+                stack[stackPos].next = node.offset;
+                stack[stackPos].end = node.offset + node.count;
+            }
+        }
     }
 
     MTS_DECLARE_CLASS()
 protected:
+    enum {
+        /// Maximum depth of a compacted tree (bounds the traversal stack)
+        EMaxDepth = 64,
+        /// Resolution of the quantized node bounds
+        EQuantizationLevels = 0xFFFF
+    };
+
+    /// Node of the compacted tree
+    struct FlatNode {
+        /// Cluster representative of all samples below this node
+        IrradianceSample data;
+        /// Leaf: first sample in \c m_items, interior node: first child in \c m_nodes
+        uint32_t offset;
+        /// Leaf: number of samples, interior node: number of children
+        uint32_t count : 31;
+        uint32_t leaf : 1;
+        /// Node bounds, quantized conservatively relative to \c m_aabb
+        uint16_t qmin[3], qmax[3];
+    };
+
     /// Propagate irradiance approximations througout the tree
     void propagate(OctreeNode *node);
 
-    /// Query the octree using a customizable functor, while representatives for distant nodes
-    template <typename QueryType> void performQuery(const AABB &aabb, OctreeNode *node, QueryType &query) const {
-        /* Compute the approximate solid angle subtended by samples within this node */
-        Float approxSolidAngle = node->data.area / (query.p - node->data.p).lengthSquared();
-
-        /* Use the representative if this is a distant node */
-        if (!aabb.contains(query.p) && approxSolidAngle < m_solidAngleThreshold) {
-            query(node->data);
-        } else {
-            if (node->leaf) {
-                for (uint32_t i=0; i<node->count; ++i)
-                    query(m_items[node->offset + i]);
-            } else {
-                Point center = aabb.getCenter();
-                for (int i=0; i<8; i++) {
-                    if (!node->children[i])
-                        continue;
-
-                    AABB childAABB = childBounds(i, aabb, center);
-                    performQuery(childAABB, node->children[i], query);
-                }
-            }
+    /// Rewrite the pointer-based tree into \c m_nodes and release it
+    void compact();
+
+    /// Fill the structure-of-arrays copy of the samples (SSE builds only)
+    void buildSampleArrays();
+
+    /// Does the (quantized) bounding box of a node contain \c p?
+    inline bool nodeContains(const FlatNode &node, const Point &p) const {
+        for (int i=0; i<3; ++i) {
+            Float t = (p[i] - m_aabb.min[i]) * m_invQuantScale[i];
+            if (t < (Float) node.qmin[i] || t > (Float) node.qmax[i])
+                return false;
         }
+        return true;
     }
 private:
     Float m_solidAngleThreshold;
+    std::vector<FlatNode> m_nodes;
+    Vector m_invQuantScale;
+#if defined(MTS_SSE) && SPECTRUM_SAMPLES == 3
+    std::vector<float> m_sampleData;
+    SampleArrays m_sampleArrays;
+#endif
 };
 
 MTS_NAMESPACE_END
@@ -28,6 +28,7 @@
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/sse.h>
 #include <mitsuba/core/ssemath.h>
+#include <mitsuba/core/timer.h>
 #include "../medium/materials.h"
 
 MTS_NAMESPACE_BEGIN
@@ -104,6 +105,12 @@ static ref<Mutex> mutex = new Mutex;
  *    Single scattering comes in two flavors: fast, the default straight line
  *    approximation (with multiple samples along the line), and slow, that is
  *    the accurate version described in \cite{Holzschuch2015}.
+ *    The accurate version (\code{fastSingleScatter=false}) culls the boundary
+ *    triangles with a bounding volume hierarchy that is built over each mesh
+ *    during preprocessing. With \code{singleScatterAdaptive=true}, the
+ *    \code{singleScatterDepth} internal reflections are followed with Russian
+ *    roulette on the path throughput, so that a larger depth mostly costs
+ *    time where the reflected light is still significant.
  *
  *   \item It is quite important that the \code{sigma*} parameters have the right units.
  *   For instance: if the \code{sigmaT} parameter is accidentally set to a value that
@@ -118,6 +125,7 @@ public:
     SingleScatter(const Properties &props) : Subsurface(props) {
         /* Single scattering strategy: use fast single scatter? (Jensen) */
         m_fastSingleScatter = props.getBoolean("fastSingleScatter", true);
+        m_preprocessed = false;
 
         /* Single scattering: number of samples along the inside ray ? */
         m_fastSingleScatterSamples = props.getInteger("fssSamples", 2);
@@ -137,6 +145,11 @@ public:
         /* Single scattering: number of total internal reflexion? */
         m_singleScatterDepth = props.getInteger("singleScatterDepth", 4);
 
+        /* Single scattering: use Russian roulette on the path throughput to
+         * decide which internal reflections are worth following? */
+        m_singleScatterAdaptive =
+            props.getBoolean("singleScatterAdaptive", false);
+
         /* Get the material parameters: */
         lookupMaterial(props, m_sigmaS, m_sigmaA, m_g);
 
@@ -169,10 +182,12 @@ public:
         m_eta = stream->readFloat();
         // Additions for single scatter
         m_fastSingleScatter = stream->readBool();
+        m_preprocessed = false;
         m_fastSingleScatterSamples = stream->readInt();
         m_singleScatterShadowRays = stream->readBool();
         m_singleScatterTransmittance = stream->readBool();
         m_singleScatterDepth = stream->readInt();
+        m_singleScatterAdaptive = stream->readBool();
         configure();
     }
 
@@ -193,6 +208,123 @@ public:
         stream->writeBool(m_singleScatterShadowRays);
         stream->writeBool(m_singleScatterTransmittance);
         stream->writeInt(m_singleScatterDepth);
+        stream->writeBool(m_singleScatterAdaptive);
+    }
+
+    //---------------- Boundary BVH for the accurate single scattering ----------------
+    /// Per-triangle bounds used by the spindle test, precomputed once per mesh
+    struct BoundaryTriangle {
+        BSphere sphere;
+        Vector coneAxis;
+        Float coneAngle;
+    };
+
+    /**
+     * \brief Bounding volume hierarchy over the boundary triangles of one of
+     * our meshes.
+     *
+     * The accurate single scattering culls the triangles that can hold a
+     * refracted connection to the light with the spindle test. Walking the
+     * scene kd-tree for this visits the triangles of every other shape and
+     * needs a (per-sample) table of triangles that were already tested, since
+     * kd-tree leaves share primitives. This hierarchy only covers the mesh
+     * itself and references every triangle exactly once.
+     */
+    struct BoundaryBVH {
+        struct Node {
+            AABB aabb;
+            /// Primitive range into \c indices (interior node: count == 0)
+            uint32_t start, count;
+            /// Index of the right child (the left child directly follows)
+            uint32_t right;
+        };
+
+        const TriMesh *mesh;
+        std::vector<Node> nodes;
+        std::vector<uint32_t> indices;
+        /// Precomputed bounds, indexed by triangle index
+        std::vector<BoundaryTriangle> triangles;
+    };
+
+    enum {
+        EBVHLeafSize = 4,
+        EBVHMaxDepth = 64
+    };
+
+    void buildBoundaryBVH(BoundaryBVH &bvh, const TriMesh *mesh) const {
+        const Point *positions = mesh->getVertexPositions();
+        const Vector *normals = mesh->getVertexNormals();
+        const Triangle *tris = mesh->getTriangles();
+        const uint32_t count = (uint32_t) mesh->getTriangleCount();
+
+        bvh.mesh = mesh;
+        bvh.triangles.resize(count);
+        bvh.indices.resize(count);
+        std::vector<Point> centroids(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            BoundaryTriangle &bt = bvh.triangles[i];
+            bt.sphere = tris[i].getBSphere(positions);
+            boundingConeNormals(tris[i], bt.coneAxis, bt.coneAngle, normals);
+            centroids[i] = tris[i].getAABB(positions).getCenter();
+            bvh.indices[i] = i;
+        }
+        bvh.nodes.clear();
+        bvh.nodes.reserve(2 * (count / EBVHLeafSize + 1));
+        if (count > 0)
+            buildBoundaryBVHNode(bvh, centroids, 0, count, 0);
+    }
+
+    uint32_t buildBoundaryBVHNode(BoundaryBVH &bvh,
+                                  const std::vector<Point> &centroids,
+                                  uint32_t start, uint32_t end,
+                                  int depth) const {
+        const Point *positions = bvh.mesh->getVertexPositions();
+        const Triangle *tris = bvh.mesh->getTriangles();
+        BoundaryBVH::Node node;
+        node.start = start;
+        node.count = 0;
+        node.right = 0;
+        AABB centroidBounds;
+        for (uint32_t i = start; i < end; ++i) {
+            node.aabb.expandBy(tris[bvh.indices[i]].getAABB(positions));
+            centroidBounds.expandBy(centroids[bvh.indices[i]]);
+        }
+        const uint32_t nodeIdx = (uint32_t) bvh.nodes.size();
+        bvh.nodes.push_back(node);
+
+        /* Median split along the largest extent of the centroids. Balanced,
+           so the depth stays logarithmic in the triangle count. */
+        const int axis = centroidBounds.getLargestAxis();
+        if (end - start <= EBVHLeafSize || depth + 1 >= EBVHMaxDepth
+                || centroidBounds.getExtents()[axis] == 0) {
+            bvh.nodes[nodeIdx].count = end - start;
+            return nodeIdx;
+        }
+        const uint32_t mid = start + (end - start) / 2;
+        std::nth_element(bvh.indices.begin() + start, bvh.indices.begin() + mid,
+            bvh.indices.begin() + end, CentroidOrder(centroids, axis));
+        buildBoundaryBVHNode(bvh, centroids, start, mid, depth + 1);
+        const uint32_t right =
+            buildBoundaryBVHNode(bvh, centroids, mid, end, depth + 1);
+        bvh.nodes[nodeIdx].right = right;
+        return nodeIdx;
+    }
+
+    struct CentroidOrder {
+        CentroidOrder(const std::vector<Point> &centroids, int axis)
+            : centroids(centroids), axis(axis) { }
+        bool operator()(uint32_t a, uint32_t b) const {
+            return centroids[a][axis] < centroids[b][axis];
+        }
+        const std::vector<Point> &centroids;
+        int axis;
+    };
+
+    const BoundaryBVH *findBoundaryBVH(const Shape *shape) const {
+        for (size_t i = 0; i < m_boundaryBVHs.size(); ++i)
+            if (m_boundaryBVHs[i].mesh == shape)
+                return &m_boundaryBVHs[i];
+        return NULL;
     }
 
     //---------------- Begin set of functions for single scattering --------------------
@@ -339,13 +471,15 @@ public:
     bool triangleSegmentTest(const Triangle &tri, const Point &L,
                              const Point &V2, const Point &V1,
                              const Point *positions, const Vector *normals,
-                             Float &alphaMin, Float &alphaMax) const {
+                             Float &alphaMin, Float &alphaMax,
+                             const BoundaryTriangle *pre = NULL) const {
         // Is there a ray from anywhere on segment [V1, V2] through triangle tri
         // connecting to L?
-        // Bounding sphere of the triangle:
+        // Bounding sphere of the triangle (precomputed by the boundary BVH, if
+        // available):
         alphaMin = 0;
         alphaMax = 1;
-        const BSphere triSphere = tri.getBSphere(positions);
+        const BSphere triSphere = pre ? pre->sphere : tri.getBSphere(positions);
 
         // Bounding cone for omega_L:
         Vector omegaL = L - triSphere.center;
@@ -442,7 +576,12 @@ public:
         // Now we get the cone bounding the normals:
         Vector omegaN;
         Float thetaN;
-        boundingConeNormals(tri, omegaN, thetaN, normals);
+        if (pre) {
+            omegaN = pre->coneAxis;
+            thetaN = pre->coneAngle;
+        } else {
+            boundingConeNormals(tri, omegaN, thetaN, normals);
+        }
 
         // Now, is there an intersection between (-omegaN, thetaN) and the
         // sweeping cone for omegaH? Equivalent to knowing whether the axis for
@@ -1320,7 +1459,7 @@ public:
     //------------------------------------------------------------------------
     Spectrum LoSingle(const Scene *scene, Sampler *sampler,
                       const Intersection &its, const Vector &dInternal,
-                      int depth, Float z0) const {
+                      int depth, Float z0, const Spectrum &throughput) const {
 
         Spectrum result(0.0f);
         if (depth >= m_singleScatterDepth) {
@@ -1390,12 +1529,24 @@ public:
             sampler->advance();
             Vector dReflect = its2.toWorld(bRec.wo);
 
-            if (!bsdfAtt.isZero()) {
+            // 2014-02-24 jDG: Attenuation on the whole path, at once.
+            Spectrum pathAtt = bsdfAtt * attenuation(m_sigmaT, -thickness);
+            if (!pathAtt.isZero() && m_singleScatterAdaptive) {
+                // Russian roulette on the throughput of the whole path: only
+                // follow the internal reflections that can still contribute.
+                const Float q = std::min((throughput * pathAtt).max(), (Float) 1);
+                if (sampler->next1D() < q)
+                    pathAtt /= q;
+                else
+                    pathAtt = Spectrum(0.0f);
+                sampler->advance();
+            }
+
+            if (!pathAtt.isZero()) {
                 Spectrum reflected = LoSingle(scene, sampler, its2, dReflect,
-                                              depth + 1, z0 + thickness);
-                reflected *= bsdfAtt;
-                // 2014-02-24 jDG: Attenuation on the whole path, at once.
-                reflected *= attenuation(m_sigmaT, -thickness);
+                                              depth + 1, z0 + thickness,
+                                              throughput * pathAtt);
+                reflected *= pathAtt;
                 result += reflected;
             }
         }
@@ -1488,13 +1639,52 @@ public:
             const TriMesh *triMesh = static_cast<const TriMesh *>(its.shape);
             const Point *positions = triMesh->getVertexPositions();
             const Vector *normals = triMesh->getVertexNormals();
+            const Triangle *triangles = triMesh->getTriangles();
+            const Spectrum lightValue = value * (dRec.dist * dRec.dist);
+
+            const BoundaryBVH *bvh = findBoundaryBVH(its.shape);
+            if (EXPECT_TAKEN(bvh != NULL)) {
+                // Cull the boundary BVH of this mesh with the spindle test
+                const BoundaryBVH::Node *stack[EBVHMaxDepth];
+                int stackPos = 0;
+                const BoundaryBVH::Node *node = &bvh->nodes[0];
+                while (true) {
+                    if (aabbSegmentTest(node->aabb, L, its.p, its2.p)) {
+                        if (node->count == 0) {
+                            stack[stackPos++] = &bvh->nodes[node->right];
+                            ++node;
+                            continue;
+                        }
+                        for (uint32_t entry = node->start;
+                             entry < node->start + node->count; ++entry) {
+                            const uint32_t primIdx = bvh->indices[entry];
+                            Float alphaMin, alphaMax;
+                            if (triangleSegmentTest(triangles[primIdx], L,
+                                    its.p, its2.p, positions, normals,
+                                    alphaMin, alphaMax,
+                                    &bvh->triangles[primIdx])) {
+                                result += testThisTriangle(triangles[primIdx],
+                                    L, its.p, dInternal, alphaMin * thickness,
+                                    alphaMax * thickness, positions, normals,
+                                    lightValue, scene, its.time);
+                            }
+                        }
+                    }
+                    if (stackPos == 0)
+                        break;
+                    node = stack[--stackPos];
+                }
+                return result;
+            }
 
+            // No boundary BVH for this shape (e.g. on a remote worker): scan
+            // the scene kd-tree instead
             size_t numTriangles = triMesh->getTriangleCount();
             bool *doneThisTriangleBefore = new bool[numTriangles];
             for (size_t i = 0; i < numTriangles; i++) {
                 doneThisTriangleBefore[i] = false;
             }
-            // scan the kd-tree, cull all nodes not intersecting with segment,
+            // Scan the kd-tree, cull all nodes not intersecting with segment,
             // keep going.
             struct spindleStackEntry {
                 const ShapeKDTree::KDNode *node;
@@ -1632,7 +1822,8 @@ public:
             if (!refractAttenuation.isZero()) {
                 result +=
                     refractAttenuation *
-                    LoSingle(scene, sampler, its, dInternal, depth + 1, 0);
+                    LoSingle(scene, sampler, its, dInternal, depth + 1, 0,
+                             refractAttenuation);
             }
         }
         return result;
@@ -1666,9 +1857,43 @@ public:
                 MTS_CLASS(SamplingIntegrator)))
             Log(EError, "The single scattering pluging requires "
                         "a sampling-based surface integrator!");
+
+        /* The boundary BVHs only depend on the geometry */
+        if (m_preprocessed)
+            return true;
+
+        m_boundaryBVHs.clear();
+        if (!m_fastSingleScatter) {
+            ref<Timer> timer = new Timer();
+            const std::vector<TriMesh *> &meshes = scene->getMeshes();
+            size_t triangleCount = 0;
+            for (size_t i = 0; i < meshes.size(); ++i) {
+                if (meshes[i]->getSubsurface() != this
+                        || meshes[i]->getTriangleCount() == 0)
+                    continue;
+                if (!meshes[i]->hasVertexNormals())
+                    Log(EError, "The accurate single scattering requires "
+                                "meshes with vertex normals!");
+                if (meshes[i]->isCompact())
+                    Log(EError, "The accurate single scattering does not "
+                                "support compact meshes!");
+                m_boundaryBVHs.push_back(BoundaryBVH());
+                buildBoundaryBVH(m_boundaryBVHs.back(), meshes[i]);
+                triangleCount += meshes[i]->getTriangleCount();
+            }
+            Log(EInfo, "Built the boundary BVHs of %i mesh(es) (%i triangles) "
+                "in %i ms", (int) m_boundaryBVHs.size(), (int) triangleCount,
+                timer->getMilliseconds());
+        }
+        m_preprocessed = true;
         return true;
     }
 
+    void invalidate() {
+        m_boundaryBVHs.clear();
+        m_preprocessed = false;
+    }
+
     void wakeup(ConfigurableObject *parent,
                 std::map<std::string, SerializableObject *> &params) {}
 
@@ -1688,6 +1913,10 @@ private:
     bool m_singleScatterShadowRays;
     bool m_singleScatterTransmittance;
     int m_singleScatterDepth;
+    bool m_singleScatterAdaptive;
+
+    std::vector<BoundaryBVH> m_boundaryBVHs;
+    bool m_preprocessed;
 };
 
 MTS_IMPLEMENT_CLASS_S(SingleScatter, false, Subsurface)
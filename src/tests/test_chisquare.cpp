@@ -21,6 +21,7 @@
 #include <mitsuba/core/chisquare.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/render/testcase.h>
+#include <mitsuba/render/dss.h>
 #include <boost/bind.hpp>
 
 /* Statistical significance level of the test. Set to
@@ -50,6 +51,8 @@ public:
     MTS_DECLARE_TEST(test01_BSDF)
     MTS_DECLARE_TEST(test02_PhaseFunction)
     MTS_DECLARE_TEST(test03_EmitterDirect)
+    MTS_DECLARE_TEST(test04_Sampler1D)
+    MTS_DECLARE_TEST(test05_TangentSampler2D)
     MTS_END_TESTCASE()
 
     /**
@@ -388,6 +391,149 @@ public:
         PositionSamplingRecord m_pRec;
     };
 
+    /**
+     * Adapter to use 1D distributions on the positive half-line in the
+     * chi-square test. A sample x is mapped to a direction with polar
+     * angle 2*atan(x/scale) and a uniformly distributed azimuth.
+     */
+    class Sampler1DAdapter {
+    public:
+        Sampler1DAdapter(const Sampler1D *distr, Sampler *sampler,
+                int channel, Float scale) : m_distr(distr), m_sampler(sampler),
+                m_channel(channel), m_scale(scale) { }
+
+        boost::tuple<Vector, Float, EMeasure> generateSample() {
+            Float x, sampledPdf;
+            if (!m_distr->sample(m_channel, x, m_sampler, &sampledPdf))
+                return boost::make_tuple(Vector(0, 0, 1), 0.0f, ESolidAngle);
+
+            Float pdfVal = m_distr->pdf(m_channel, x);
+            Float err = std::abs(pdfVal - sampledPdf);
+            if (!std::isfinite(x) || x < 0 || err > ERROR_REQ * std::max((Float) 1, pdfVal))
+                Log(EWarn, "Potential inconsistency: x=%f, pdfVal=%f, sampledPDF=%f",
+                    x, pdfVal, sampledPdf);
+
+            Float theta = 2 * std::atan(x / m_scale);
+            Float phi = TWO_PI * m_sampler->next1D();
+            return boost::make_tuple(sphericalDirection(theta, phi),
+                1.0f, ESolidAngle);
+        }
+
+        /// Switch to an independent copy of the sampler (for use by another thread)
+        void cloneSampler() { m_sampler = m_sampler->clone(); }
+
+        Float pdf(const Vector &d, EMeasure measure) const {
+            if (measure != ESolidAngle)
+                return 0.0f;
+
+            Float halfTheta = 0.5f * math::safe_acos(d.z);
+            Float s = std::sin(halfTheta), c = std::cos(halfTheta);
+            if (s <= 0 || c <= 0)
+                return 0.0f;
+
+            /* Jacobian of x = scale*tan(theta/2), spread over the azimuth */
+            Float x = m_scale * s / c;
+            return m_distr->pdf(m_channel, x) * m_scale
+                / (8 * M_PI * s * c * c * c);
+        }
+    private:
+        ref<const Sampler1D> m_distr;
+        ref<Sampler> m_sampler;
+        int m_channel;
+        Float m_scale;
+    };
+
+    /**
+     * Adapter to use 2D distributions in the tangent plane in the
+     * chi-square test. The plane is mapped onto the sphere by an inverse
+     * stereographic projection: a point at distance r from the origin
+     * has the polar angle 2*atan(r/scale).
+     */
+    class TangentSampler2DAdapter {
+    public:
+        TangentSampler2DAdapter(const TangentSampler2D *distr, Sampler *sampler,
+                int channel, Float scale) : m_distr(distr), m_sampler(sampler),
+                m_channel(channel), m_scale(scale),
+                m_xLo(-std::numeric_limits<Float>::infinity()),
+                m_xHi(std::numeric_limits<Float>::infinity()) { }
+
+        boost::tuple<Vector, Float, EMeasure> generateSample() {
+            Vector2 x;
+            Float sampledPdf;
+            if (!m_distr->sample(m_channel, x, 1.0f, m_xLo, m_xHi,
+                    m_sampler, &sampledPdf))
+                return boost::make_tuple(Vector(0, 0, 1), 0.0f, ESolidAngle);
+
+            Float pdfVal = m_distr->pdf(m_channel, x, 1.0f, m_xLo, m_xHi);
+            Float err = std::abs(pdfVal - sampledPdf);
+            if (!x.isFinite() || err > ERROR_REQ * std::max((Float) 1, pdfVal))
+                Log(EWarn, "Potential inconsistency: x=%s, pdfVal=%f, sampledPDF=%f",
+                    x.toString().c_str(), pdfVal, sampledPdf);
+
+            Float theta = 2 * std::atan(x.length() / m_scale);
+            Float phi = std::atan2(x.y, x.x);
+            return boost::make_tuple(sphericalDirection(theta, phi),
+                1.0f, ESolidAngle);
+        }
+
+        /// Switch to an independent copy of the sampler (for use by another thread)
+        void cloneSampler() { m_sampler = m_sampler->clone(); }
+
+        Float pdf(const Vector &d, EMeasure measure) const {
+            if (measure != ESolidAngle)
+                return 0.0f;
+
+            Float halfTheta = 0.5f * math::safe_acos(d.z);
+            Float s = std::sin(halfTheta), c = std::cos(halfTheta);
+            if (c <= 0)
+                return 0.0f;
+
+            /* Area to solid angle Jacobian of the stereographic projection */
+            Float r = m_scale * s / c, phi = std::atan2(d.y, d.x);
+            Vector2 x(r * std::cos(phi), r * std::sin(phi));
+            return m_distr->pdf(m_channel, x, 1.0f, m_xLo, m_xHi)
+                * m_scale * m_scale / (4 * c * c * c * c);
+        }
+    private:
+        ref<const TangentSampler2D> m_distr;
+        ref<Sampler> m_sampler;
+        int m_channel;
+        Float m_scale;
+        Vector2 m_xLo, m_xHi;
+    };
+
+    /// Run the chi-square test on all cores for independent adapter copies
+    template <typename Adapter> bool runParallelTest(const Adapter &adapter,
+            int thetaBins, int numTests, int &failureCount) {
+        ref<ChiSquare> chiSqr = new ChiSquare(thetaBins, 2*thetaBins, numTests);
+        chiSqr->setLogLevel(EDebug);
+
+        // Initialize the tables used by the chi-square test
+        chiSqr->fillParallel(
+            boost::bind(&TestChiSquare::createSampleFunctor<Adapter>, adapter, _1),
+            boost::bind(&Adapter::pdf, adapter, _1, _2)
+        );
+
+        ChiSquare::ETestResult result = chiSqr->runTest(SIGNIFICANCE_LEVEL);
+        if (result == ChiSquare::EReject) {
+            std::string filename = formatString("failure_%i.m", failureCount++);
+            chiSqr->dumpTables(filename);
+            failAndContinue(formatString("Uh oh, the chi-square test indicates a potential "
+                "issue. Dumped the contingency tables to '%s' for user analysis",
+                filename.c_str()));
+            return false;
+        }
+        succeed();
+        return true;
+    }
+
+    /// Create a sampling functor that uses its own sampler instance
+    template <typename Adapter> static ChiSquare::SampleFunctor
+            createSampleFunctor(Adapter adapter, int) {
+        adapter.cloneSampler();
+        return boost::bind(&Adapter::generateSample, adapter);
+    }
+
     void test01_BSDF() {
         /* Load a set of BSDF instances to be tested from the following XML file */
         FileResolver *resolver = Thread::getThread()->getFileResolver();
@@ -617,6 +763,61 @@ public:
         }
         Log(EInfo, "%i/%i emitter checks succeeded", testCount-failureCount, testCount);
     }
+
+    void test04_Sampler1D() {
+        ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+                createObject(MTS_CLASS(Sampler), Properties("independent")));
+        int thetaBins = 10, failureCount = 0, testCount = 0;
+
+        Spectrum lambda;
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+            lambda[i] = 0.5f + i;
+        ref<Sampler1D> distr = new ExpSampler1D(lambda);
+
+        Log(EInfo, "Verifying the exponential 1D sampler ..");
+        for (int channel=0; channel<SPECTRUM_SAMPLES; ++channel) {
+            Sampler1DAdapter adapter(distr, sampler, channel, 1 / lambda[channel]);
+            runParallelTest(adapter, thetaBins, SPECTRUM_SAMPLES, failureCount);
+            ++testCount;
+        }
+        Log(EInfo, "%i/%i 1D sampler checks succeeded", testCount-failureCount, testCount);
+    }
+
+    void test05_TangentSampler2D() {
+        ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+                createObject(MTS_CLASS(Sampler), Properties("independent")));
+        int thetaBins = 10, failureCount = 0, testCount = 0;
+
+        Spectrum sigmaA, sigmaS, g(0.0f);
+        for (int i=0; i<SPECTRUM_SAMPLES; ++i) {
+            sigmaA[i] = 0.05f * (i+1);
+            sigmaS[i] = 1.0f + 0.5f * i;
+        }
+        ref<TangentSampler2D> dipole = new RadialSampler2D(
+            new RadialExactDipoleSampler2D(sigmaA, sigmaS, g, 1.3f));
+        ref<TangentSampler2D> narrowDipole = new RadialSampler2D(
+            new RadialExactDipoleSampler2D(sigmaA * 4, sigmaS * 4, g, 1.0f));
+
+        std::vector<std::pair<Float, const TangentSampler2D*> > samplers;
+        samplers.push_back(std::make_pair((Float) 0.7f, dipole.get()));
+        samplers.push_back(std::make_pair((Float) 0.3f, narrowDipole.get()));
+        ref<TangentSampler2D> mis = new MISTangentSampler2D(samplers);
+
+        const TangentSampler2D *distrs[] = { dipole.get(), mis.get() };
+        const char *names[] = { "radial exact dipole", "MIS" };
+        int numTests = 2 * SPECTRUM_SAMPLES;
+
+        for (int i=0; i<2; ++i) {
+            Log(EInfo, "Verifying the %s tangent plane sampler ..", names[i]);
+            for (int channel=0; channel<SPECTRUM_SAMPLES; ++channel) {
+                TangentSampler2DAdapter adapter(distrs[i], sampler, channel, 1.0f);
+                runParallelTest(adapter, thetaBins, numTests, failureCount);
+                ++testCount;
+            }
+        }
+        Log(EInfo, "%i/%i tangent plane sampler checks succeeded",
+            testCount-failureCount, testCount);
+    }
 };
 
 MTS_EXPORT_TESTCASE(TestChiSquare, "Chi-square test for various sampling functions")
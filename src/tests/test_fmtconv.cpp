@@ -0,0 +1,134 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+class TestFormatConversion : public TestCase {
+public:
+    MTS_BEGIN_TESTCASE()
+    MTS_DECLARE_TEST(test01_halfConversion)
+    MTS_DECLARE_TEST(test02_gammaConversion)
+    MTS_DECLARE_TEST(test03_benchmark)
+    MTS_END_TESTCASE()
+
+    /// Create a film-like bitmap with random values, weights and a few special cases
+    ref<Bitmap> createBitmap(const Vector2i &size) {
+        ref<Random> random = new Random();
+        ref<Bitmap> bitmap = new Bitmap(Bitmap::ESpectrumAlphaWeight, Bitmap::EFloat, size);
+        Float *data = bitmap->getFloatData();
+        size_t channels = bitmap->getChannelCount();
+
+        for (size_t i=0; i<bitmap->getPixelCount(); ++i) {
+            Float *pixel = data + i*channels;
+            Float weight = random->nextFloat() * 4;
+            for (int j=0; j<SPECTRUM_SAMPLES; ++j)
+                pixel[j] = (random->nextFloat() * (Float) 1.2f - (Float) 0.1f) * weight;
+            pixel[SPECTRUM_SAMPLES] = random->nextFloat() * weight;
+            pixel[SPECTRUM_SAMPLES+1] = weight;
+            if (i % 97 == 0)
+                pixel[0] *= 1e5f;
+            if (i % 89 == 0)
+                pixel[1] *= 1e-6f;
+        }
+        return bitmap;
+    }
+
+    /// Compare a bulk conversion against (scalar) per-pixel conversions
+    int compare(const Bitmap *source, Bitmap::EPixelFormat pixelFormat,
+            Bitmap::EComponentFormat componentFormat, Float gamma, Float multiplier) {
+        ref<Bitmap> result = const_cast<Bitmap *>(source)->convert(
+            pixelFormat, componentFormat, gamma, multiplier);
+
+        const FormatConverter *cvt = FormatConverter::getInstance(
+            std::make_pair(source->getComponentFormat(), componentFormat));
+        size_t sourceSize = source->getBytesPerPixel(), destSize = result->getBytesPerPixel();
+        uint8_t *pixel = (uint8_t *) alloca(destSize);
+        int mismatches = 0;
+
+        for (size_t i=0; i<source->getPixelCount(); ++i) {
+            cvt->convert(source->getPixelFormat(), source->getGamma(),
+                source->getUInt8Data() + i*sourceSize, pixelFormat, gamma,
+                pixel, 1, multiplier);
+            if (memcmp(pixel, result->getUInt8Data() + i*destSize, destSize) != 0)
+                ++mismatches;
+        }
+        return mismatches;
+    }
+
+    void test01_halfConversion() {
+        ref<Bitmap> bitmap = createBitmap(Vector2i(61, 37));
+        assertEquals(compare(bitmap, Bitmap::ERGBA, Bitmap::EFloat16, 1.0f, 1.0f), 0);
+        assertEquals(compare(bitmap, Bitmap::ERGB, Bitmap::EFloat16, 1.0f, 0.5f), 0);
+        assertEquals(compare(bitmap, Bitmap::ELuminanceAlpha, Bitmap::EFloat16, 1.0f, 1.0f), 0);
+    }
+
+    void test02_gammaConversion() {
+        ref<Bitmap> bitmap = createBitmap(Vector2i(128, 128));
+        assertEquals(compare(bitmap, Bitmap::ERGBA, Bitmap::EUInt8, -1.0f, 1.0f), 0);
+        assertEquals(compare(bitmap, Bitmap::ERGB, Bitmap::EUInt8, -1.0f, 2.0f), 0);
+        assertEquals(compare(bitmap, Bitmap::ERGB, Bitmap::EUInt8, 2.2f, 1.0f), 0);
+        assertEquals(compare(bitmap, Bitmap::ELuminance, Bitmap::EUInt8, 1.0f, 1.0f), 0);
+    }
+
+    void test03_benchmark() {
+        ref<Bitmap> bitmap = createBitmap(Vector2i(1024, 1024));
+        const FormatConverter *toHalf = FormatConverter::getInstance(
+            std::make_pair(Bitmap::EFloat, Bitmap::EFloat16));
+        const FormatConverter *toUInt8 = FormatConverter::getInstance(
+            std::make_pair(Bitmap::EFloat, Bitmap::EUInt8));
+        ref<Bitmap> hdr = new Bitmap(Bitmap::ERGBA, Bitmap::EFloat16, bitmap->getSize());
+        ref<Bitmap> ldr = new Bitmap(Bitmap::ERGB, Bitmap::EUInt8, bitmap->getSize());
+        size_t pixels = bitmap->getPixelCount(), channels = bitmap->getChannelCount();
+        const Float *data = bitmap->getFloatData();
+        ref<Timer> timer = new Timer();
+
+        /* The per-pixel timings correspond to the scalar code path */
+        timer->reset();
+        toHalf->convert(Bitmap::ESpectrumAlphaWeight, 1.0f, data, Bitmap::ERGBA,
+            1.0f, hdr->getData(), pixels);
+        Float bulk = timer->getSeconds();
+        timer->reset();
+        for (size_t i=0; i<pixels; ++i)
+            toHalf->convert(Bitmap::ESpectrumAlphaWeight, 1.0f, data + i*channels,
+                Bitmap::ERGBA, 1.0f, hdr->getFloat16Data() + 4*i, 1);
+        Float scalar = timer->getSeconds();
+        Log(EInfo, "Spectrum/alpha/weight to RGBA float16: %.2f ms (%.2f ms pixel by pixel)",
+            bulk * 1000, scalar * 1000);
+
+        timer->reset();
+        toUInt8->convert(Bitmap::ESpectrumAlphaWeight, 1.0f, data, Bitmap::ERGB,
+            -1.0f, ldr->getData(), pixels);
+        bulk = timer->getSeconds();
+        timer->reset();
+        for (size_t i=0; i<pixels; ++i)
+            toUInt8->convert(Bitmap::ESpectrumAlphaWeight, 1.0f, data + i*channels,
+                Bitmap::ERGB, -1.0f, ldr->getUInt8Data() + 3*i, 1);
+        scalar = timer->getSeconds();
+        Log(EInfo, "Spectrum/alpha/weight to sRGB uint8: %.2f ms (%.2f ms pixel by pixel)",
+            bulk * 1000, scalar * 1000);
+    }
+};
+
+MTS_EXPORT_TESTCASE(TestFormatConversion, "Testcase for bitmap format conversions")
+MTS_NAMESPACE_END
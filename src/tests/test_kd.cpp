@@ -20,6 +20,7 @@
 #include <mitsuba/core/kdtree.h>
 #include <mitsuba/render/testcase.h>
 #include <mitsuba/render/skdtree.h>
+#include <mitsuba/render/bvh.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -29,8 +30,30 @@ public:
     MTS_DECLARE_TEST(test01_sutherlandHodgman)
     MTS_DECLARE_TEST(test02_bunnyBenchmark)
     MTS_DECLARE_TEST(test03_pointKDTree)
+    MTS_DECLARE_TEST(test04_shadowRays)
+    MTS_DECLARE_TEST(test05_treeCache)
+    MTS_DECLARE_TEST(test06_bvhRefit)
+    MTS_DECLARE_TEST(test07_pointKDTreeTasks)
+    MTS_DECLARE_TEST(test08_pointKDTreeBuckets)
     MTS_END_TESTCASE()
 
+    /// Create a soup of overlapping random triangles in the unit cube
+    ref<TriMesh> createTriangleSoup(Random *random, size_t nTriangles) {
+        ref<TriMesh> mesh = new TriMesh("soup", nTriangles, 3*nTriangles);
+        Point *vertices = mesh->getVertexPositions();
+        Triangle *triangles = mesh->getTriangles();
+        for (size_t i=0; i<nTriangles; ++i) {
+            Point center(random->nextFloat(), random->nextFloat(), random->nextFloat());
+            for (int j=0; j<3; ++j) {
+                vertices[3*i+j] = center + Vector(random->nextFloat(),
+                    random->nextFloat(), random->nextFloat()) * 0.3f;
+                triangles[i].idx[j] = (uint32_t) (3*i+j);
+            }
+        }
+        mesh->configure();
+        return mesh;
+    }
+
     void test01_sutherlandHodgman() {
         /* Test the triangle clipping algorithm on the unit triangle */
         Point vertices[3];
@@ -214,6 +237,267 @@ public:
         Log(EInfo, "Normal node size = " SIZE_T_FMT " bytes", sizeof(KDTree2::NodeType));
         Log(EInfo, "Left-balanced node size = " SIZE_T_FMT " bytes", sizeof(KDTree2Left::NodeType));
     }
+
+    void test04_shadowRays() {
+        /* A soup of overlapping triangles, so that many leaves contain
+           enough of them for the grouped shadow ray test */
+        const size_t nTriangles = 500, nRays = 100000;
+        ref<Random> random = new Random();
+        ref<TriMesh> mesh = createTriangleSoup(random, nTriangles);
+
+        ref<ShapeKDTree> tree = new ShapeKDTree();
+        tree->addShape(mesh);
+        tree->build();
+        BSphere bsphere = tree->getAABB().getBSphere();
+
+        /* Shadow rays must agree with regular intersection queries, up
+           to a few rays that graze triangle edges */
+        size_t nMismatches = 0, nIntersections = 0;
+        for (size_t i=0; i<nRays; ++i) {
+            Point2 sample1(random->nextFloat(), random->nextFloat()),
+                sample2(random->nextFloat(), random->nextFloat());
+            Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+            Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+            Ray r(p1, normalize(p2-p1), 0.0f);
+            r.maxt = random->nextFloat() * 2 * bsphere.radius;
+            Intersection its;
+
+            bool shadow = tree->rayIntersect(r);
+            if (shadow != tree->rayIntersect(r, its))
+                ++nMismatches;
+            if (shadow)
+                ++nIntersections;
+        }
+        Log(EInfo, SIZE_T_FMT " of " SIZE_T_FMT " shadow rays were occluded, "
+            SIZE_T_FMT " mismatches", nIntersections, nRays, nMismatches);
+        assertTrue(nIntersections > 0);
+        assertTrue(nMismatches * 10000 <= nRays);
+    }
+
+    void test05_treeCache() {
+        const size_t nTriangles = 5000, nRays = 10000;
+        ref<Random> random = new Random();
+        ref<TriMesh> mesh = createTriangleSoup(random, nTriangles);
+        fs::path cacheDir = fs::temp_directory_path()
+            / fs::unique_path("mitsuba-kdcache-%%%%-%%%%");
+
+        /* The first build writes the cache file, the second one maps it */
+        ref<ShapeKDTree> built = new ShapeKDTree();
+        built->setCacheDirectory(cacheDir);
+        built->addShape(mesh);
+        built->build();
+        fs::path cacheFile = cacheDir / formatString("%016llx.kdtree",
+            (unsigned long long) built->getCacheKey());
+        assertTrue(fs::exists(cacheFile));
+
+        ref<ShapeKDTree> cached = new ShapeKDTree();
+        cached->setCacheDirectory(cacheDir);
+        cached->addShape(mesh);
+        cached->build();
+        assertEquals((int) built->getNodeCount(), (int) cached->getNodeCount());
+        assertEquals(built->getAABB().min, cached->getAABB().min);
+        assertEquals(built->getAABB().max, cached->getAABB().max);
+
+        /* Both trees must report exactly the same intersections */
+        BSphere bsphere = built->getAABB().getBSphere();
+        size_t nMismatches = 0;
+        for (size_t i=0; i<nRays; ++i) {
+            Point2 sample1(random->nextFloat(), random->nextFloat()),
+                sample2(random->nextFloat(), random->nextFloat());
+            Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+            Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+            Ray r(p1, normalize(p2-p1), 0.0f);
+            Intersection its1, its2;
+            bool hit1 = built->rayIntersect(r, its1),
+                 hit2 = cached->rayIntersect(r, its2);
+            if (hit1 != hit2 || (hit1 && (its1.t != its2.t
+                    || its1.primIndex != its2.primIndex)))
+                ++nMismatches;
+        }
+        assertEquals((int) nMismatches, 0);
+
+        /* Different construction parameters must not reuse the file */
+        ref<ShapeKDTree> other = new ShapeKDTree();
+        other->setCacheDirectory(cacheDir);
+        other->setStopPrims(2);
+        other->addShape(mesh);
+        assertTrue(other->getCacheKey() != built->getCacheKey());
+
+        fs::remove_all(cacheDir);
+    }
+
+    /// Count rays on which the BVH and a kd-tree over \c mesh disagree
+    size_t compareBVH(Random *random, const TriangleBVH *bvh,
+            const TriMesh *mesh, size_t nRays) {
+        ref<ShapeKDTree> kdtree = new ShapeKDTree();
+        kdtree->addShape(mesh);
+        kdtree->build();
+        BSphere bsphere = kdtree->getAABB().getBSphere();
+
+        size_t nMismatches = 0;
+        for (size_t i=0; i<nRays; ++i) {
+            Point2 sample1(random->nextFloat(), random->nextFloat()),
+                sample2(random->nextFloat(), random->nextFloat());
+            Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+            Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+            Ray r(p1, normalize(p2-p1), 0.0f);
+
+            Intersection its;
+            TriangleBVH::IntersectionCache cache;
+            Float t;
+            bool hit1 = kdtree->rayIntersect(r, its),
+                 hit2 = bvh->rayIntersect(r, r.mint, r.maxt, t, &cache);
+            if (hit1 != hit2 || hit2 != bvh->rayIntersect(r, r.mint, r.maxt)
+                    || (hit1 && std::abs(its.t - t) > 1e-4f * its.t))
+                ++nMismatches;
+        }
+        return nMismatches;
+    }
+
+    void test06_bvhRefit() {
+        const size_t nTriangles = 2000, nRays = 10000;
+        ref<Random> random = new Random();
+        ref<TriMesh> mesh = createTriangleSoup(random, nTriangles);
+        std::vector<const TriMesh *> meshes(1, mesh.get());
+
+        ref<TriangleBVH> bvh = new TriangleBVH();
+        bvh->addKeyframe(meshes);
+        bvh->build();
+        assertEquals((int) bvh->getPrimitiveCount(), (int) nTriangles);
+        assertTrue(compareBVH(random, bvh, mesh, nRays) * 1000 <= nRays);
+
+        /* Deform the mesh in place: after a refit, the BVH must agree
+           with a kd-tree that was built from scratch */
+        Point *vertices = mesh->getVertexPositions();
+        for (size_t i=0; i<mesh->getVertexCount(); ++i)
+            vertices[i] += Vector(std::sin(4 * vertices[i].y), 0.0f,
+                0.5f * vertices[i].x * vertices[i].x);
+        bvh->refit();
+        assertTrue(compareBVH(random, bvh, mesh, nRays) * 1000 <= nRays);
+    }
+
+    /// Builds the deferred subtrees of a point kd-tree in reverse order
+    template <typename TreeType> struct ReverseBuildExecutor {
+        size_t taskCount;
+
+        inline ReverseBuildExecutor() : taskCount(0) { }
+
+        void operator()(TreeType &tree, std::vector<typename TreeType::BuildTask> &tasks) {
+            taskCount = tasks.size();
+            for (size_t i=tasks.size(); i-- > 0;)
+                tree.buildTask(tasks[i]);
+        }
+    };
+
+    /// Check that two point kd-trees have the same layout
+    template <typename TreeType> void compareTrees(const TreeType &tree1, const TreeType &tree2) {
+        assertEquals((int) tree1.size(), (int) tree2.size());
+        assertEquals((int) tree1.getDepth(), (int) tree2.getDepth());
+        for (size_t i=0; i<tree1.size(); ++i) {
+            assertTrue(tree1[i].getPosition() == tree2[i].getPosition());
+            assertTrue(tree1[i].isLeaf() == tree2[i].isLeaf());
+            if (!tree1[i].isLeaf())
+                assertEquals((int) tree1[i].getAxis(), (int) tree2[i].getAxis());
+        }
+    }
+
+    void test07_pointKDTreeTasks() {
+        typedef PointKDTree< SimpleKDNode<Point, Float> > KDTree3;
+        typedef PointKDTree< LeftBalancedKDNode<Point, Float> > KDTree3Left;
+
+        /* Deferring subtrees to an executor must not change the tree */
+        size_t nPoints = 20000;
+        ref<Random> random = new Random();
+        for (int heuristic=0; heuristic<3; ++heuristic) {
+            KDTree3 tree1(nPoints, (KDTree3::EHeuristic) heuristic),
+                    tree2(nPoints, (KDTree3::EHeuristic) heuristic);
+            for (size_t i=0; i<nPoints; ++i) {
+                Point p(random->nextFloat(), random->nextFloat(), random->nextFloat());
+                tree1[i].setPosition(p);
+                tree2[i].setPosition(p);
+            }
+            ReverseBuildExecutor<KDTree3> executor;
+            tree1.build(true);
+            tree2.build(true, 5, executor);
+            assertEquals((int) executor.taskCount, 16);
+            compareTrees(tree1, tree2);
+        }
+
+        KDTree3Left tree1(nPoints, KDTree3Left::ELeftBalanced),
+                    tree2(nPoints, KDTree3Left::ELeftBalanced);
+        for (size_t i=0; i<nPoints; ++i) {
+            Point p(random->nextFloat(), random->nextFloat(), random->nextFloat());
+            tree1[i].setPosition(p);
+            tree2[i].setPosition(p);
+        }
+        ReverseBuildExecutor<KDTree3Left> executor;
+        tree1.build(true);
+        tree2.build(true, 5, executor);
+        compareTrees(tree1, tree2);
+    }
+
+    /// Run the same queries with and without leaf buckets
+    template <typename Tree> void compareBucketQueries(Tree &tree, Random *random) {
+        Tree plain(tree);
+        plain.clearBuckets();
+        assertTrue(tree.hasBuckets() && !plain.hasBuckets());
+
+        typename Tree::SearchResult results1[11], results2[11];
+        std::vector<typename Tree::IndexType> indices1, indices2;
+        ref<Timer> bucketTimer = new Timer(false), plainTimer = new Timer(false);
+
+        for (int i=0; i<10000; ++i) {
+            Point p(random->nextFloat(), random->nextFloat(), random->nextFloat());
+            Float radius1 = std::numeric_limits<Float>::infinity(), radius2 = radius1;
+
+            bucketTimer->start();
+            size_t count1 = tree.nnSearch(p, radius1, 10, results1);
+            bucketTimer->stop();
+            plainTimer->start();
+            size_t count2 = plain.nnSearch(p, radius2, 10, results2);
+            plainTimer->stop();
+
+            assertEquals((int) count1, (int) count2);
+            assertEquals(radius1, radius2);
+            std::sort(results1, results1 + count1, typename Tree::SearchResultComparator());
+            std::sort(results2, results2 + count2, typename Tree::SearchResultComparator());
+            for (size_t j=0; j<count1; ++j)
+                assertTrue(results1[j] == results2[j]);
+
+            indices1.clear(); indices2.clear();
+            tree.search(p, 0.05f, indices1);
+            plain.search(p, 0.05f, indices2);
+            std::sort(indices1.begin(), indices1.end());
+            std::sort(indices2.begin(), indices2.end());
+            assertTrue(indices1 == indices2);
+        }
+
+        Log(EInfo, "10-NN queries: %.2f us with buckets, %.2f us without",
+            bucketTimer->getSeconds() * 100, plainTimer->getSeconds() * 100);
+    }
+
+    void test08_pointKDTreeBuckets() {
+        typedef PointKDTree< SimpleKDNode<Point, Float> > KDTree3;
+        typedef PointKDTree< LeftBalancedKDNode<Point, Float> > KDTree3Left;
+
+        size_t nPoints = 100000;
+        ref<Random> random = new Random();
+        for (int heuristic=0; heuristic<4; ++heuristic) {
+            KDTree3 tree(nPoints, (KDTree3::EHeuristic) heuristic);
+            for (size_t i=0; i<nPoints; ++i)
+                tree[i].setPosition(Point(random->nextFloat(),
+                    random->nextFloat(), random->nextFloat()));
+            tree.build(true);
+            compareBucketQueries(tree, random);
+        }
+
+        KDTree3Left tree(nPoints, KDTree3Left::ELeftBalanced);
+        for (size_t i=0; i<nPoints; ++i)
+            tree[i].setPosition(Point(random->nextFloat(),
+                random->nextFloat(), random->nextFloat()));
+        tree.build(true);
+        compareBucketQueries(tree, random);
+    }
 };
 
 MTS_EXPORT_TESTCASE(TestKDTree, "Testcase for kd-tree related code")
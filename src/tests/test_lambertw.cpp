@@ -0,0 +1,97 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <mitsuba/render/testcase.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_sf_lambert.h>
+
+MTS_NAMESPACE_BEGIN
+
+class TestLambertW : public TestCase {
+public:
+    MTS_BEGIN_TESTCASE()
+    MTS_DECLARE_TEST(test01_principalBranch)
+    MTS_DECLARE_TEST(test02_lowerBranch)
+    MTS_DECLARE_TEST(test03_domain)
+    MTS_END_TESTCASE()
+
+#ifdef SINGLE_PRECISION
+    static constexpr Float relTol = 1e-5f;
+#else
+    static constexpr Float relTol = 1e-9;
+#endif
+
+    /// Relative error, but absolute for |ref| < 1 (W0 goes through zero)
+    static Float error(Float w, Float ref) {
+        return std::abs(w - ref) / std::max(std::abs(ref), (Float) 1);
+    }
+
+    void test01_principalBranch() {
+        /* Don't abort on domain errors right at the branch point */
+        gsl_set_error_handler_off();
+        const int n = 100000;
+        Float maxRelErr = 0;
+        for (int i = 1; i < n; i++) {
+            Float t = i / (Float) n;
+            /* Densely sample the branch point, then up to large x */
+            Float xs[2] = { -1 / (Float) M_E * (1 - t*t),
+                            std::exp(-20 + 40 * t) };
+            for (int j = 0; j < 2; j++) {
+                Float w = math::lambertW0(xs[j]);
+                Float ref = (Float) gsl_sf_lambert_W0(xs[j]);
+                maxRelErr = std::max(maxRelErr, error(w, ref));
+            }
+        }
+        Log(EInfo, "lambertW0(): maximum relative error %e", maxRelErr);
+        assertTrue(maxRelErr < relTol);
+        assertEquals(math::lambertW0(0), (Float) 0);
+    }
+
+    void test02_lowerBranch() {
+        gsl_set_error_handler_off();
+        const int n = 100000;
+        Float maxRelErr = 0;
+        for (int i = 1; i <= n; i++) {
+            Float t = i / (Float) n;
+            /* Densely sample the branch point, then down to tiny |x| */
+            Float xs[2] = { -1 / (Float) M_E * (1 - t*t),
+                            -1 / (Float) M_E * std::pow((Float) 10, -200 * t) };
+            for (int j = 0; j < 2; j++) {
+                if (!(xs[j] < 0))
+                    continue;
+                Float w = math::lambertWm1(xs[j]);
+                Float ref = (Float) gsl_sf_lambert_Wm1(xs[j]);
+                maxRelErr = std::max(maxRelErr, error(w, ref));
+            }
+        }
+        Log(EInfo, "lambertWm1(): maximum relative error %e", maxRelErr);
+        assertTrue(maxRelErr < relTol);
+    }
+
+    void test03_domain() {
+        const Float minX = -1 / (Float) M_E;
+        assertEqualsEpsilon(math::lambertW0(minX), (Float) -1, 1e-6f);
+        assertEqualsEpsilon(math::lambertWm1(minX), (Float) -1, 1e-6f);
+        assertTrue(std::isnan(math::lambertW0(-1)));
+        assertTrue(std::isnan(math::lambertWm1(-1)));
+        assertTrue(std::isnan(math::lambertWm1(1)));
+        assertTrue(math::lambertWm1(0) == -std::numeric_limits<Float>::infinity());
+    }
+};
+
+MTS_EXPORT_TESTCASE(TestLambertW, "Testcase for the Lambert W functions")
+MTS_NAMESPACE_END
@@ -32,6 +32,8 @@ public:
     MTS_DECLARE_TEST(test05_gaussLegendre_odd)
     MTS_DECLARE_TEST(test06_gaussLobatto_even)
     MTS_DECLARE_TEST(test07_gaussLobatto_odd)
+    MTS_DECLARE_TEST(test08_quad_vectorized)
+    MTS_DECLARE_TEST(test09_nD_parallel)
     MTS_END_TESTCASE()
 
     Float testF(Float t) const {
@@ -61,6 +63,11 @@ public:
         }
     }
 
+    void testFVectorized(size_t nPoints, const Float *in, Float *out) const {
+        for (size_t i=0; i<nPoints; ++i)
+            out[i] = std::sin(in[i]);
+    }
+
     void test01_quad() {
         GaussLobattoIntegrator quad(1024, 0, 1e-5f);
         size_t evals;
@@ -162,6 +169,29 @@ public:
         assertEqualsEpsilon(weights[3], (Float) (49.0/90.0), 1e-8f);
         assertEqualsEpsilon(weights[4], (Float) (1.0/10.0), 1e-8f);
     }
+
+    void test08_quad_vectorized() {
+        GaussLobattoIntegrator quad(1024, 0, 1e-5f);
+        size_t evals;
+        Float result = quad.integrateVectorized(boost::bind(
+            &TestQuadrature::testFVectorized, this, _1, _2, _3), 0, 10, &evals);
+        Float ref = 2 * std::pow(std::sin((Float) 5.0f), (Float) 2.0f);
+        Log(EInfo, "test08_quad_vectorized(): used " SIZE_T_FMT " function evaluations", evals);
+        assertEqualsEpsilon(result, ref, 1e-5f);
+    }
+
+    void test09_nD_parallel() {
+        NDIntegrator quad(2, 3, 1000000, 0, 1e-5f);
+        quad.setParallel(true);
+        size_t evals;
+        Float min[3] = { -1, -1, -1 } , max[3] = { 1, 1, 1 }, result[2], err[2];
+        assertTrue(quad.integrateVectorized(boost::bind(
+            &TestQuadrature::testF3, this, _1, _2, _3), min, max, result, err, &evals) == NDIntegrator::ESuccess);
+        Log(EInfo, "test09_nD_parallel(): used " SIZE_T_FMT " function evaluations, "
+                "error=[%f, %f]", evals, err[0], err[1]);
+        assertEqualsEpsilon(result[0], 1.0f, 1e-5f);
+        assertEqualsEpsilon(result[1], 1.0f, 1e-5f);
+    }
 };
 
 MTS_EXPORT_TESTCASE(TestQuadrature, "Testcase for quadrature routines")
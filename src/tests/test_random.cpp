@@ -344,6 +344,8 @@ public:
     MTS_DECLARE_TEST(test07_uniform_distribution_ks);
     MTS_DECLARE_TEST(test08_serialize);
     MTS_DECLARE_TEST(test09_set);
+    MTS_DECLARE_TEST(test10_fill);
+    MTS_DECLARE_TEST(test11_pcg32);
     MTS_DECLARE_TEST(benchmark);
     MTS_END_TESTCASE()
 
@@ -358,6 +360,8 @@ public:
     void test07_uniform_distribution_ks();
     void test08_serialize();
     void test09_set();
+    void test10_fill();
+    void test11_pcg32();
     void benchmark();
 
 private:
@@ -817,6 +821,61 @@ void TestRandom::test09_set()
 
 
 
+// Test that the bulk generation matches the scalar version, also across
+// the boundaries of the internal SFMT blocks and from unaligned offsets
+void TestRandom::test10_fill()
+{
+    const size_t counts[] = { 1, 3, 4, 7, 311, 1000, 4096 };
+    ref<Random> rnd1 = new Random(0x1234abcdULL);
+    ref<Random> rnd2 = new Random(0x1234abcdULL);
+    std::vector<Float> values;
+
+    for (int iter = 0; iter < 20; ++iter) {
+        for (size_t k = 0; k < array_size(counts); ++k) {
+            values.resize(counts[k]);
+            rnd1->fillFloat(&values[0], counts[k]);
+            for (size_t i = 0; i < counts[k]; ++i)
+                assertTrue(values[i] == rnd2->nextFloat());
+
+            /* Leave the generators at an odd position */
+            assertTrue(rnd1->nextULong() == rnd2->nextULong());
+        }
+    }
+
+    std::vector<Point2> points(100);
+    rnd1->fillPoint2(&points[0], points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+        assertTrue(points[i].x == rnd2->nextFloat());
+        assertTrue(points[i].y == rnd2->nextFloat());
+    }
+}
+
+
+
+// Check PCG32 against the output of the reference implementation and
+// verify the range of the generated floating point values
+void TestRandom::test11_pcg32()
+{
+    const uint32_t reference[] = {
+        0xa15c02b7U, 0x7b47f409U, 0xba1d3330U,
+        0x83d2f293U, 0xbfa4784bU, 0xcbed606eU
+    };
+    PCG32 pcg(42, 54);
+    for (size_t i = 0; i < array_size(reference); ++i)
+        assertTrue(pcg.nextUInt() == reference[i]);
+
+    double sum = 0;
+    const int N = 1000000;
+    for (int i = 0; i < N; ++i) {
+        Float v = pcg.nextFloat();
+        assertTrue(v >= 0 && v < 1);
+        sum += v;
+    }
+    assertEqualsEpsilon(static_cast<Float>(sum / N), 0.5f, 1e-3f);
+}
+
+
+
 // Simple benchmark based on the mean test
 void TestRandom::benchmark()
 {
@@ -28,6 +28,8 @@ public:
     MTS_DECLARE_TEST(test01_Halton)
     MTS_DECLARE_TEST(test02_Hammersley)
     MTS_DECLARE_TEST(test03_radicalInverseIncr)
+    MTS_DECLARE_TEST(test04_radicalInverseArray)
+    MTS_DECLARE_TEST(test05_aliasTable)
     MTS_END_TESTCASE()
 
     void test01_Halton() {
@@ -84,6 +86,58 @@ public:
             x = radicalInverseIncremental(2, x);
         }
     }
+
+    void test04_radicalInverseArray() {
+        const size_t count = 1000;
+        std::vector<Float> values(count);
+        uint16_t perm[64];
+
+        for (uint16_t baseIndex=0; baseIndex<20; ++baseIndex) {
+            int base = primeTable[baseIndex];
+            for (int i=0; i<base; ++i)
+                perm[i] = (uint16_t) ((i * 5 + 3) % base);
+
+            radicalInverseArray(baseIndex, 12345, 17, &values[0], count);
+            for (size_t i=0; i<count; ++i) {
+                assertEqualsEpsilon(values[i], radicalInverse(base, 12345 + 17 * i), 1e-6);
+                assertEqualsEpsilon(values[i], radicalInverseFast(baseIndex, 12345 + 17 * i), 1e-6);
+            }
+
+            scrambledRadicalInverseArray(baseIndex, 7, 1, perm, &values[0], count);
+            for (size_t i=0; i<count; ++i)
+                assertEqualsEpsilon(values[i], scrambledRadicalInverse(base, 7 + i, perm), 1e-6);
+        }
+    }
+
+    void test05_aliasTable() {
+        const size_t entries = 1000, samples = 1000000;
+        DiscreteDistribution cdf, alias;
+        for (size_t i=0; i<entries; ++i) {
+            Float value = (i % 7 == 0) ? 0.0f : (Float) (1 + (i * 37) % 101);
+            cdf.append(value);
+            alias.append(value);
+        }
+        cdf.normalize();
+        alias.normalize();
+        alias.buildAliasTable();
+        assertTrue(alias.hasAliasTable());
+
+        std::vector<size_t> histogram(entries, 0);
+        for (size_t i=0; i<samples; ++i) {
+            Float sample = (i + 0.5f) / samples, pdf;
+            size_t index = alias.sampleReuse(sample, pdf);
+            assertEqualsEpsilon(pdf, cdf[index], 1e-6);
+            assertTrue(sample >= 0 && sample <= 1);
+            histogram[index]++;
+        }
+
+        for (size_t i=0; i<entries; ++i) {
+            if (cdf[i] == 0)
+                assertTrue(histogram[i] == 0);
+            else
+                assertEqualsEpsilon(histogram[i] / (Float) samples, cdf[i], 1e-4);
+        }
+    }
 };
 
 MTS_EXPORT_TESTCASE(TestSamplers, "Testcase for sampling-related code")
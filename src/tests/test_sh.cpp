@@ -26,6 +26,7 @@ public:
     MTS_BEGIN_TESTCASE()
     MTS_DECLARE_TEST(test01_shRotation)
     MTS_DECLARE_TEST(test02_shSampler)
+    MTS_DECLARE_TEST(test03_shFastRotation)
     MTS_END_TESTCASE()
 
     void test01_shRotation() {
@@ -96,6 +97,39 @@ public:
         }
         assertTrue(accum / nInAvg < 0.01);
     }
+
+    void test03_shFastRotation() {
+        /* Compare the Euler angle-based rotation against the
+           rotation matrices, including the degenerate cases */
+        ref<Random> random = new Random();
+        int bands = 8;
+
+        SHVector vec1(bands);
+        for (int l=0; l<bands; ++l)
+            for (int m=-l; m<=l; ++m)
+                vec1(l, m) = random->nextFloat();
+
+        for (int i=0; i<10; ++i) {
+            Vector axis(warp::squareToUniformSphere(Point2(random->nextFloat(), random->nextFloat())));
+            Float angle = random->nextFloat()*360;
+            if (i == 0)
+                axis = Vector(0, 0, 1);
+            else if (i == 1)
+                axis = Vector(1, 0, 0), angle = 180;
+
+            Transform trafo = Transform::rotate(axis, angle);
+            SHRotation rot(bands);
+            SHVector::rotation(trafo, rot);
+
+            SHVector vec2(bands), vec3(vec1);
+            rot(vec1, vec2);
+            vec3.rotate(trafo);
+
+            for (int l=0; l<bands; ++l)
+                for (int m=-l; m<=l; ++m)
+                    assertEqualsEpsilon(vec2(l, m), vec3(l, m), Epsilon);
+        }
+    }
 };
 
 MTS_EXPORT_TESTCASE(TestSphericalHarmonics, "Testcase for Spherical Harmonics code")
@@ -0,0 +1,136 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/core/tls.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+class TestTLS : public TestCase {
+public:
+    MTS_BEGIN_TESTCASE()
+    MTS_DECLARE_TEST(test01_perThreadValues)
+    MTS_DECLARE_TEST(test02_slotReuse)
+    MTS_DECLARE_TEST(test03_benchmark)
+    MTS_END_TESTCASE()
+
+    /// Writes a thread-specific value into the TLS objects and reads it back
+    class TLSThread : public Thread {
+    public:
+        TLSThread(int id, PrimitiveThreadLocal<int> &value, int iterations)
+            : Thread(formatString("tls%i", id)), m_id(id), m_value(value),
+              m_iterations(iterations), m_success(false) { }
+
+        void run() {
+            m_value.get() = m_id;
+            m_success = true;
+            for (int i=0; i<m_iterations; ++i) {
+                if (m_value.get() != m_id)
+                    m_success = false;
+                m_value.get() = m_id;
+            }
+        }
+
+        inline bool getSuccess() const { return m_success; }
+    private:
+        int m_id;
+        PrimitiveThreadLocal<int> &m_value;
+        int m_iterations;
+        bool m_success;
+    };
+
+    void test01_perThreadValues() {
+        PrimitiveThreadLocal<int> value;
+        value.get() = -1;
+
+        std::vector<ref<TLSThread> > threads;
+        for (int i=0; i<8; ++i) {
+            threads.push_back(new TLSThread(i, value, 100000));
+            threads[i]->start();
+        }
+        for (int i=0; i<8; ++i) {
+            threads[i]->join();
+            assertTrue(threads[i]->getSuccess());
+        }
+        assertEquals(value.get(), -1);
+    }
+
+    void test02_slotReuse() {
+        /* Slot indices of destroyed objects are recycled -- a new
+           object must never see the data of its predecessor */
+        for (int i=0; i<100; ++i) {
+            PrimitiveThreadLocal<int> *value = new PrimitiveThreadLocal<int>();
+            assertEquals(value->get(), 0);
+            value->get() = i + 1;
+            assertEquals(value->get(), i + 1);
+            delete value;
+        }
+
+        std::vector<PrimitiveThreadLocal<int> *> values;
+        for (int i=0; i<100; ++i) {
+            values.push_back(new PrimitiveThreadLocal<int>());
+            values[i]->get() = i;
+        }
+        for (int i=0; i<100; ++i) {
+            assertEquals(values[i]->get(), i);
+            delete values[i];
+        }
+    }
+
+    void test03_benchmark() {
+        const int nObjects = 64, nIterations = 1000000;
+        std::vector<PrimitiveThreadLocal<int> *> values;
+        for (int i=0; i<nObjects; ++i) {
+            values.push_back(new PrimitiveThreadLocal<int>());
+            values[i]->get() = 1;
+        }
+
+        /* Compare the slot table against the per-thread hash map */
+        ref<Timer> timer = new Timer();
+        int sum = 0;
+        for (int i=0; i<nIterations; ++i)
+            sum += values[i % nObjects]->get();
+        Float cached = timer->getSeconds();
+
+        /* getUncached() isn't exposed by PrimitiveThreadLocal */
+        std::vector<detail::ThreadLocalBase *> bases;
+        for (int i=0; i<nObjects; ++i)
+            bases.push_back(new detail::ThreadLocalBase(&construct, &destruct));
+
+        timer->reset();
+        for (int i=0; i<nIterations; ++i)
+            sum += *static_cast<int *>(bases[i % nObjects]->getUncached());
+        Float uncached = timer->getSeconds();
+
+        Log(EInfo, "ThreadLocal lookups: %.2f ns (slot table) vs. %.2f ns (hash map)",
+            cached * 1e9 / nIterations, uncached * 1e9 / nIterations);
+        assertEquals(sum, 2 * nIterations);
+
+        for (int i=0; i<nObjects; ++i) {
+            delete values[i];
+            delete bases[i];
+        }
+    }
+
+    static void *construct() { return new int(1); }
+    static void destruct(void *data) { delete static_cast<int *>(data); }
+};
+
+MTS_EXPORT_TESTCASE(TestTLS, "Testcase for thread local storage")
+MTS_NAMESPACE_END
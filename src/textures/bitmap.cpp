@@ -22,6 +22,7 @@
 #include <mitsuba/core/mstream.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/sched.h>
+#include <mitsuba/core/atomic.h>
 #include <mitsuba/render/texture.h>
 #include <mitsuba/render/mipmap.h>
 #include <mitsuba/hw/renderer.h>
@@ -86,6 +87,17 @@ MTS_NAMESPACE_BEGIN
  *       (e.g. \texttt{r}, \texttt{g}, \texttt{b}, \texttt{a}, \texttt{x},
  *       \texttt{y}, \texttt{z} etc.). \default{use all channels}
  *     }
+ *     \parameter{lazy}{\Boolean}{
+ *        Defer loading the texture until it is first accessed, and keep its
+ *        MIP map in a memory-mapped cache file that counts towards a shared
+ *        memory budget (see below). Implies \code{cache=true}.
+ *        \default{\code{false}}
+ *     }
+ *     \parameter{cacheBudget}{\Integer}{
+ *        Memory budget in MiB shared by all lazily loaded textures. When several
+ *        textures specify a budget, the smallest one is used.
+ *        \default{half of the system memory}
+ *     }
  * }
  * This plugin provides a bitmap-backed texture source that supports \emph{filtered}
  * texture lookups on\footnote{Some of these may not be available depending on how
@@ -154,6 +166,10 @@ MTS_NAMESPACE_BEGIN
  *    \item Because the texture storage is entirely disk-backed and can be \emph{memory-mapped},
  *    Mitsuba is able to work with truly massive textures that would otherwise exhaust the main system memory.
  * \end{enumerate}
+ * Since the cache files are mapped read-only, several Mitsuba processes rendering on the same
+ * machine share a single copy of the MIP map data in memory. Cache files are written under a
+ * temporary name and only renamed once they are complete, hence processes that are started
+ * simultaneously never see partially written files.
  *
  * The texture caches are automatically regenerated when the input texture is modified.
  * Of course, the cache files can be cumbersome when they are not needed anymore. On Linux
@@ -162,7 +178,43 @@ MTS_NAMESPACE_BEGIN
  * \begin{shell}
  * $\code{\$}$ find . -name "*.mip" -delete
  * \end{shell}
+ *
+ * \paragraph{Lazy loading:}
+ * Scenes with many large textures can set \code{lazy=true}. Such textures are not
+ * loaded until a lookup needs them; when an up-to-date MIP map cache exists, only
+ * its header is read at startup. Because the MIP map data is stored in blocks and
+ * memory-mapped, only the parts of the image pyramid that lookups actually touch are
+ * paged in. The textures share a memory budget: when it is exceeded, the least
+ * recently used textures are evicted from memory and transparently paged back in
+ * from their cache files when they are accessed again.
+ */
+
+class BitmapTexture;
+
+/**
+ * Keeps track of the lazily loaded bitmap textures that currently occupy
+ * memory and evicts the least recently used ones when the budget is exceeded
  */
+class TextureCache {
+public:
+    /// Lower the shared budget (in bytes)
+    static void setBudget(size_t budget);
+
+    /// Mark a texture as used, potentially evicting others
+    static void touch(const BitmapTexture *texture);
+
+    /// Stop tracking a texture
+    static void release(const BitmapTexture *texture);
+
+    /// Incremented whenever a texture becomes resident
+    static volatile int32_t epoch;
+private:
+    static ref<Mutex> m_mutex;
+    static std::vector<const BitmapTexture *> m_resident;
+    static size_t m_budget, m_usage;
+};
+
+static StatsCounter textureEvictions("Texture cache", "Evicted textures");
 
 class BitmapTexture : public Texture2D {
 public:
@@ -177,10 +229,11 @@ public:
     typedef TMIPMap<Color3, Color3h> MIPMap3;
 
     BitmapTexture(const Properties &props) : Texture2D(props) {
-        uint64_t timestamp = 0;
-        bool tryReuseCache = false;
-        fs::path cacheFile;
         ref<Bitmap> bitmap;
+        m_timestamp = 0;
+        m_lastAccess = -1;
+        m_loaded = true;
+        m_resident = m_hasInfo = false;
 
         m_channel = boost::to_lower_copy(props.getString("channel", ""));
 
@@ -196,20 +249,29 @@ public:
                 Log(EError, "Texture file \"%s\" could not be found!", m_filename.string().c_str());
 
             boost::system::error_code ec;
-            timestamp = (uint64_t) fs::last_write_time(m_filename, ec);
+            m_timestamp = (uint64_t) fs::last_write_time(m_filename, ec);
             if (ec.value())
                 Log(EError, "Could not determine modification time of \"%s\"!", m_filename.string().c_str());
 
-            cacheFile = m_filename;
+            m_cacheFile = m_filename;
 
             if (m_channel.empty())
-                cacheFile.replace_extension(".mip");
+                m_cacheFile.replace_extension(".mip");
             else
-                cacheFile.replace_extension(formatString(".%s.mip", m_channel.c_str()));
-
-            tryReuseCache = fs::exists(cacheFile) && props.getBoolean("cache", true);
+                m_cacheFile.replace_extension(formatString(".%s.mip", m_channel.c_str()));
         }
 
+        /* Defer loading until the texture is accessed? (requires a filename) */
+        m_lazy = props.getBoolean("lazy", false) && !m_cacheFile.empty();
+
+        /* Use a MIP map cache file? (-1: automatic) */
+        m_cache = props.hasProperty("cache") ? (int) props.getBoolean("cache") : -1;
+        if (m_lazy)
+            m_cache = 1;
+
+        if (props.hasProperty("cacheBudget"))
+            TextureCache::setBudget((size_t) props.getInteger("cacheBudget") * 1024 * 1024);
+
         std::string filterType = boost::to_lower_copy(props.getString("filterType", "ewa"));
         std::string wrapMode = props.getString("wrapMode", "repeat");
         m_wrapModeU = parseWrapMode(props.getString("wrapModeU", wrapMode));
@@ -234,6 +296,49 @@ public:
         if (m_filterType != EEWA)
             m_maxAnisotropy = 1.0f;
 
+        if (m_lazy) {
+            m_loaded = false;
+            m_loadMutex = new Mutex();
+            readCacheInfo();
+        } else {
+            load(bitmap);
+        }
+    }
+
+    /// Fetch the resolution and value range of a lazy texture from its cache file
+    void readCacheInfo() {
+        if (!fs::exists(m_cacheFile))
+            return;
+
+        if (MIPMap3::validateCacheFile(m_cacheFile, m_timestamp, Bitmap::ERGB,
+                m_wrapModeU, m_wrapModeV, m_filterType, m_gamma)) {
+            Color3 minimum, maximum, average;
+            if (!MIPMap3::readCacheInfo(m_cacheFile, m_size, minimum, maximum, average))
+                return;
+            m_minimum.fromLinearRGB(minimum[0], minimum[1], minimum[2]);
+            m_maximum.fromLinearRGB(maximum[0], maximum[1], maximum[2]);
+            m_average.fromLinearRGB(average[0], average[1], average[2]);
+            m_monochromatic = false;
+            m_hasInfo = true;
+        } else if (MIPMap1::validateCacheFile(m_cacheFile, m_timestamp, Bitmap::ELuminance,
+                m_wrapModeU, m_wrapModeV, m_filterType, m_gamma)) {
+            Color1 minimum, maximum, average;
+            if (!MIPMap1::readCacheInfo(m_cacheFile, m_size, minimum, maximum, average))
+                return;
+            m_minimum = Spectrum(minimum[0]);
+            m_maximum = Spectrum(maximum[0]);
+            m_average = Spectrum(average[0]);
+            m_monochromatic = true;
+            m_hasInfo = true;
+        }
+    }
+
+    /// Load the texture (or its MIP map cache file) and create the MIP map
+    void load(ref<Bitmap> bitmap) {
+        bool tryReuseCache = !m_cacheFile.empty() && m_cache != 0 && fs::exists(m_cacheFile);
+        const fs::path &cacheFile = m_cacheFile;
+        uint64_t timestamp = m_timestamp;
+
         if (tryReuseCache && MIPMap3::validateCacheFile(cacheFile, timestamp,
                 Bitmap::ERGB, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma)) {
             /* Reuse an existing MIP map cache file */
@@ -287,8 +392,8 @@ public:
             rfilter->configure();
 
             /* Potentially create a new MIP map cache file */
-            bool createCache = !cacheFile.empty() && props.getBoolean("cache",
-                bitmap->getSize().x * bitmap->getSize().y > 1024*1024);
+            bool createCache = !cacheFile.empty() && (m_cache == -1 ?
+                (bitmap->getSize().x * bitmap->getSize().y > 1024*1024) : (m_cache == 1));
 
             if (pixelFormat == Bitmap::ELuminance)
                 m_mipmap1 = new MIPMap1(bitmap, pixelFormat, Bitmap::EFloat,
@@ -301,6 +406,42 @@ public:
         }
     }
 
+    virtual ~BitmapTexture() {
+        if (m_lazy)
+            TextureCache::release(this);
+    }
+
+    /// Make sure that a lazy texture is loaded and resident
+    inline void activate() const {
+        if (EXPECT_NOT_TAKEN(m_lazy && m_lastAccess != TextureCache::epoch))
+            const_cast<BitmapTexture *>(this)->activateSlow();
+    }
+
+    void activateSlow() {
+        if (!m_loaded) {
+            LockGuard lock(m_loadMutex);
+            if (!m_loaded) {
+                load(NULL);
+                m_loaded = true;
+            }
+        }
+        TextureCache::touch(this);
+    }
+
+    /// Size of the (memory-mapped) MIP map
+    inline size_t getMemoryUsage() const {
+        return m_mipmap3.get() ? m_mipmap3->getBufferSize()
+            : m_mipmap1->getBufferSize();
+    }
+
+    /// Release the memory occupied by the MIP map (it is paged back in on access)
+    inline void evict() const {
+        if (m_mipmap3.get())
+            m_mipmap3->evict();
+        else
+            m_mipmap1->evict();
+    }
+
     static int findChannel(const Bitmap *bitmap, const std::string channel) {
         int found = -1;
         std::string channelNames;
@@ -340,6 +481,11 @@ public:
 
     BitmapTexture(Stream *stream, InstanceManager *manager)
      : Texture2D(stream, manager) {
+        m_lazy = m_resident = m_hasInfo = false;
+        m_loaded = true;
+        m_lastAccess = -1;
+        m_cache = 0;
+        m_timestamp = 0;
         m_filename = stream->readString();
         Log(EDebug, "Unserializing texture \"%s\"", m_filename.filename().string().c_str());
         m_filterType = (EMIPFilterType) stream->readUInt();
@@ -400,6 +546,7 @@ public:
 
     void serialize(Stream *stream, InstanceManager *manager) const {
         Texture2D::serialize(stream, manager);
+        activate();
         stream->writeString(m_filename.string());
         stream->writeUInt(m_filterType);
         stream->writeUInt(m_wrapModeU);
@@ -431,6 +578,7 @@ public:
     Spectrum eval(const Point2 &uv) const {
         /* There are no ray differentials to do any kind of
            prefiltering. Evaluate the full-resolution texture */
+        activate();
 
         Spectrum result;
         if (m_mipmap3.get()) {
@@ -456,6 +604,7 @@ public:
     void evalGradient(const Point2 &uv, Spectrum *gradient) const {
         /* There are no ray differentials to do any kind of
            prefiltering. Evaluate the full-resolution texture */
+        activate();
 
         if (m_mipmap3.get()) {
             Color3 result[2];
@@ -480,10 +629,12 @@ public:
     }
 
     ref<Bitmap> getBitmap(const Vector2i &/* unused */) const {
+        activate();
         return m_mipmap1.get() ? m_mipmap1->toBitmap() : m_mipmap3->toBitmap();
     }
 
     Spectrum eval(const Point2 &uv, const Vector2 &d0, const Vector2 &d1) const {
+        activate();
         stats::filteredLookups.incrementBase();
         ++stats::filteredLookups;
 
@@ -499,6 +650,10 @@ public:
     }
 
     Spectrum getAverage() const {
+        if (!m_loaded && m_hasInfo)
+            return m_average;
+        activate();
+
         Spectrum result;
         if (m_mipmap3.get()) {
             Color3 value = m_mipmap3->getAverage();
@@ -511,6 +666,10 @@ public:
     }
 
     Spectrum getMaximum() const {
+        if (!m_loaded && m_hasInfo)
+            return m_maximum;
+        activate();
+
         Spectrum result;
         if (m_mipmap3.get()) {
             Color3 value = m_mipmap3->getMaximum();
@@ -523,6 +682,10 @@ public:
     }
 
     Spectrum getMinimum() const {
+        if (!m_loaded && m_hasInfo)
+            return m_minimum;
+        activate();
+
         Spectrum result;
         if (m_mipmap3.get()) {
             Color3 value = m_mipmap3->getMinimum();
@@ -543,10 +706,17 @@ public:
     }
 
     bool isMonochromatic() const {
+        if (!m_loaded && m_hasInfo)
+            return m_monochromatic;
+        activate();
         return m_mipmap1.get() != NULL;
     }
 
     Vector3i getResolution() const {
+        if (!m_loaded && m_hasInfo)
+            return Vector3i(m_size.x, m_size.y, 1);
+        activate();
+
         if (m_mipmap3.get()) {
             return Vector3i(
                 m_mipmap3->getWidth(),
@@ -567,7 +737,9 @@ public:
         oss << "BitmapTexture[" << endl
             << "  filename = \"" << m_filename.string() << "\"," << endl;
 
-        if (m_mipmap3.get())
+        if (!m_loaded)
+            oss << "  mipmap = <not loaded>" << endl;
+        else if (m_mipmap3.get())
             oss << "  mipmap = " << indent(m_mipmap3.toString()) << endl;
         else
             oss << "  mipmap = " << indent(m_mipmap1.toString()) << endl;
@@ -580,6 +752,8 @@ public:
 
     MTS_DECLARE_CLASS()
 protected:
+    friend class TextureCache;
+
     ref<MIPMap1> m_mipmap1;
     ref<MIPMap3> m_mipmap3;
     EMIPFilterType m_filterType;
@@ -587,9 +761,73 @@ protected:
     ReconstructionFilter::EBoundaryCondition m_wrapModeV;
     Float m_gamma, m_maxAnisotropy;
     std::string m_channel;
-    fs::path m_filename;
+    fs::path m_filename, m_cacheFile;
+    uint64_t m_timestamp;
+    int m_cache;
+
+    /* Lazy loading */
+    bool m_lazy;
+    volatile bool m_loaded;
+    ref<Mutex> m_loadMutex;
+    /// Epoch of the last access, guarded by the texture cache
+    mutable volatile int32_t m_lastAccess;
+    mutable bool m_resident;
+
+    /* Resolution and value range read from the cache file header */
+    bool m_hasInfo, m_monochromatic;
+    Vector2i m_size;
+    Spectrum m_minimum, m_maximum, m_average;
 };
 
+volatile int32_t TextureCache::epoch = 0;
+ref<Mutex> TextureCache::m_mutex = new Mutex();
+std::vector<const BitmapTexture *> TextureCache::m_resident;
+size_t TextureCache::m_budget = getTotalSystemMemory() / 2;
+size_t TextureCache::m_usage = 0;
+
+void TextureCache::setBudget(size_t budget) {
+    LockGuard lock(m_mutex);
+    m_budget = std::min(m_budget, budget);
+}
+
+void TextureCache::touch(const BitmapTexture *texture) {
+    LockGuard lock(m_mutex);
+    if (!texture->m_resident) {
+        texture->m_resident = true;
+        m_usage += texture->getMemoryUsage();
+        m_resident.push_back(texture);
+
+        /* Evict the least recently used textures until the budget is met */
+        while (m_usage > m_budget && m_resident.size() > 1) {
+            size_t lru = 0;
+            for (size_t i=1; i<m_resident.size() - 1; ++i) {
+                if (m_resident[i]->m_lastAccess < m_resident[lru]->m_lastAccess)
+                    lru = i;
+            }
+            const BitmapTexture *victim = m_resident[lru];
+            m_resident.erase(m_resident.begin() + lru);
+            victim->m_resident = false;
+            m_usage -= victim->getMemoryUsage();
+            victim->evict();
+            ++textureEvictions;
+        }
+
+        /* Make all other textures report their next access */
+        atomicAdd(&epoch, 1);
+    }
+    texture->m_lastAccess = epoch;
+}
+
+void TextureCache::release(const BitmapTexture *texture) {
+    LockGuard lock(m_mutex);
+    std::vector<const BitmapTexture *>::iterator it =
+        std::find(m_resident.begin(), m_resident.end(), texture);
+    if (it != m_resident.end()) {
+        m_usage -= texture->getMemoryUsage();
+        m_resident.erase(it);
+    }
+}
+
 // ================ Hardware shader implementation ================
 class BitmapTextureShader : public Shader {
 public:
@@ -689,6 +927,7 @@ private:
 };
 
 Shader *BitmapTexture::createShader(Renderer *renderer) const {
+    activate();
     return new BitmapTextureShader(renderer, m_filename.filename().string(),
             m_mipmap1.get(), m_mipmap3.get(), m_uvOffset, m_uvScale,
             m_wrapModeU, m_wrapModeV, m_maxAnisotropy);
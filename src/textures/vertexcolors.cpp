@@ -27,7 +27,8 @@ MTS_NAMESPACE_BEGIN
  * When rendering with a mesh that contains vertex colors,
  * this plugin exposes the underlying color data as a texture.
  * Currently, this is only supported by the \code{PLY}
- * file format loader.
+ * file format loader and the \pluginref{particles} shape, which
+ * exposes per-particle attributes or radii in this way.
  *
  * Here is an example:
  * \begin{xml}[caption=Rendering a PLY file with vertex colors]
@@ -95,7 +95,7 @@ public:
             if (m_lineWidth == 0) {
                 Float lineWidth = 0;
                 for (size_t i=0; i<triMesh->getTriangleCount(); ++i) {
-                    const Triangle &tri = triMesh->getTriangles()[i];
+                    const Triangle tri = triMesh->getTriangle(i);
                     for (int j=0; j<3; ++j)
                         lineWidth += (positions[tri.idx[j]]
                             - positions[tri.idx[(j+1)%3]]).length();
@@ -105,7 +105,7 @@ public:
             }
         }
 
-        const Triangle &tri = triMesh->getTriangles()[its.primIndex];
+        const Triangle tri = triMesh->getTriangle(its.primIndex);
 
         Float minDist = std::numeric_limits<Float>::infinity();
         for (int i=0; i<3; ++i) {
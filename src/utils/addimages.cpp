@@ -20,6 +20,7 @@
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/render/util.h>
+#include "exrscanline.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -39,6 +40,14 @@ public:
         if (*end_ptr != '\0')
             SLog(EError, "Could not parse floating point value");
 
+#if defined(MTS_HAS_OPENEXR)
+        if (EXRScanlineReader::canStream(argv[2]) &&
+            EXRScanlineReader::canStream(argv[4])) {
+            addStreaming(weight1, argv[2], weight2, argv[4], argv[5]);
+            return 0;
+        }
+#endif
+
         ref<FileStream> aFile   = new FileStream(argv[2], FileStream::EReadOnly);
         ref<FileStream> bFile   = new FileStream(argv[4], FileStream::EReadOnly);
         ref<FileStream> outFile = new FileStream(argv[5], FileStream::ETruncReadWrite);
@@ -104,6 +113,43 @@ public:
         return 0;
     }
 
+#if defined(MTS_HAS_OPENEXR)
+    /// Same as above, but only keeps a few scanlines of each image in memory
+    void addStreaming(Float weight1, const fs::path &aPath,
+            Float weight2, const fs::path &bPath, const fs::path &outPath) {
+        EXRScanlineReader aReader(aPath), bReader(bPath);
+
+        /* A few sanity checks */
+        if (aReader.getPixelFormat() != bReader.getPixelFormat())
+            Log(EError, "Error: Input bitmaps have a different pixel format!");
+        if (aReader.getComponentFormat() != bReader.getComponentFormat())
+            Log(EError, "Error: Input bitmaps have a different component format!");
+        if (aReader.getSize() != bReader.getSize())
+            Log(EError, "Error: Input bitmaps have a different size!");
+
+        const Vector2i &size = aReader.getSize();
+        EXRScanlineWriter writer(outPath, size, aReader.getPixelFormat(),
+            aReader.getComponentFormat(), aReader.getCompression());
+
+        for (int y=0; y<size.y; y += MTS_EXR_SCANLINE_CHUNK) {
+            int rows = std::min(MTS_EXR_SCANLINE_CHUNK, size.y - y);
+            ref<Bitmap> aChunk = aReader.read(y, rows);
+            ref<Bitmap> bChunk = bReader.read(y, rows);
+
+            size_t nEntries = (size_t) size.x * (size_t) rows
+                * aChunk->getChannelCount();
+            float *aData = aChunk->getFloat32Data();
+            const float *bData = bChunk->getFloat32Data();
+            for (size_t i=0; i<nEntries; ++i)
+                aData[i] = (float) std::max((Float) 0,
+                        weight1 * (Float) aData[i] +
+                        weight2 * (Float) bData[i]);
+
+            writer.write(aChunk);
+        }
+    }
+#endif
+
     MTS_DECLARE_UTILITY()
 };
 
@@ -17,23 +17,88 @@
 */
 
 #include <mitsuba/hw/viewer.h>
+#include <mitsuba/hw/gpugeometry.h>
+#include <mitsuba/hw/gpuprogram.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/timer.h>
+#include <boost/algorithm/string.hpp>
 
 MTS_NAMESPACE_BEGIN
 
+/* The mesh stays resident in GPU memory, and the clipping against the
+   cylinder happens per fragment. Interacting only changes uniforms. */
+static const char *sh_cylclip_vert =
+    "/* -> Fragment shader */\n"
+    "varying vec3 position;\n"
+    "\n"
+    "void main() {\n"
+    "   position = gl_Vertex.xyz;\n"
+    "   gl_Position = ftransform();\n"
+    "}\n";
+
+static const char *sh_cylclip_frag =
+    "uniform vec3 cylPos, cylD, camPos;\n"
+    "uniform float radius;\n"
+    "\n"
+    "/* 0: keep the inside of the cylinder, 1: keep the outside, 2: no clipping */\n"
+    "uniform int mode;\n"
+    "\n"
+    "varying vec3 position;\n"
+    "\n"
+    "void main() {\n"
+    "   vec3 rel = position - cylPos,\n"
+    "        perp = rel - cylD * dot(rel, cylD);\n"
+    "   bool inside = dot(perp, perp) < radius*radius;\n"
+    "   if ((mode == 0 && !inside) || (mode == 1 && inside))\n"
+    "       discard;\n"
+    "\n"
+    "   /* Flat shading with a headlight, works for meshes without normals */\n"
+    "   vec3 n = normalize(cross(dFdx(position), dFdy(position)));\n"
+    "   float shade = abs(dot(n, normalize(camPos - position)));\n"
+    "   gl_FragColor = vec4(vec3(0.15 + 0.6*shade), 1.0);\n"
+    "}\n";
+
 class CylClip : public Viewer {
 public:
+    enum EClipMode {
+        EKeepInside = 0,
+        EKeepOutside,
+        ENoClipping,
+        EClipModeCount
+    };
+
     CylClip() : m_red(0.0f), m_blue(0.0f), m_gray(.5f), m_angle(0) {
-        m_viewTransform = Transform::lookAt(Point(10*std::sin(m_angle), 0, std::cos(m_angle)*10),
-                Point(0, 0, 0), Vector(0, 1, 0));
         m_lineParams = Point2(M_PI/2, 0.28f);
-        m_cylPos = Point(0.0f);
         m_device->setFSAA(4);
         m_red[0] = 1.0f;
         m_blue[2] = 1.0f;
         m_showEllipses = false;
         m_showRectangles = false;
         m_showClippedAABB = false;
-        m_radius = .2f;
+        m_showMesh = true;
+        m_clipMode = EKeepInside;
+        m_frameTime = 0;
+        m_geometry = NULL;
+        m_timer = new Timer();
+        setBounds(AABB(Point(-3, -1, -1), Point(3, 1, 1)));
+    }
+
+    /// Adapt the camera and the cylinder to the size of the displayed geometry
+    void setBounds(const AABB &aabb) {
+        m_aabb = aabb;
+        /* Relative to the default box, whose bounding sphere has radius sqrt(11) */
+        m_scale = aabb.getBSphere().radius / std::sqrt((Float) 11);
+        m_cylPos = aabb.getCenter();
+        m_radius = .2f * m_scale;
+        updateView();
+    }
+
+    void updateView() {
+        m_viewTransform = Transform::lookAt(m_aabb.getCenter()
+            + Vector(std::sin(m_angle), 0, std::cos(m_angle)) * 10 * m_scale,
+            m_aabb.getCenter(), Vector(0, 1, 0));
     }
 
     void windowResized(const DeviceEvent &event) {
@@ -45,8 +110,7 @@ public:
     void mouseDragged(const DeviceEvent &event) {
         if (event.getMouseButton() == Device::ELeftButton) {
             m_angle += event.getMouseRelative().x / 100.0f;
-            m_viewTransform = Transform::lookAt(Point(10*std::sin(m_angle), 0, std::cos(m_angle)*10),
-                    Point(0, 0, 0), Vector(0, 1, 0));
+            updateView();
         } else if (event.getMouseButton() == Device::ERightButton) {
             m_lineParams += Vector2(
                 event.getMouseRelative().x / 500.0f,
@@ -57,7 +121,7 @@ public:
                 event.getMouseRelative().x / 300.0f,
                 0,
                 event.getMouseRelative().y / 300.0f
-            );
+            ) * m_scale;
         }
         redraw();
     }
@@ -222,27 +286,144 @@ public:
             case ']':
                 m_radius /= 1.1;
                 break;
+            case 'm':
+                m_showMesh = !m_showMesh;
+                break;
+            case 'c':
+                m_clipMode = (EClipMode) ((m_clipMode + 1) % EClipModeCount);
+                break;
         }
         redraw();
     }
 
+    /// Create a box spanning \c aabb (shown when no mesh was specified)
+    static ref<TriMesh> createBox(const AABB &aabb) {
+        ref<TriMesh> mesh = new TriMesh("box", 12, 8);
+        Point *positions = mesh->getVertexPositions();
+        Triangle *triangles = mesh->getTriangles();
+        for (int i=0; i<8; ++i)
+            positions[i] = aabb.getCorner(i);
+
+        /* Two triangles per face, corner i has bit k set when it lies on
+           the maximum side along axis k */
+        const int faces[6][4] = {
+            { 0, 2, 6, 4 }, { 1, 5, 7, 3 }, { 0, 4, 5, 1 },
+            { 2, 3, 7, 6 }, { 0, 1, 3, 2 }, { 4, 6, 7, 5 }
+        };
+        for (int i=0; i<6; ++i) {
+            Triangle &t0 = triangles[2*i], &t1 = triangles[2*i+1];
+            t0.idx[0] = faces[i][0]; t0.idx[1] = faces[i][1]; t0.idx[2] = faces[i][2];
+            t1.idx[0] = faces[i][2]; t1.idx[1] = faces[i][3]; t1.idx[2] = faces[i][0];
+        }
+        mesh->configure();
+        return mesh;
+    }
+
+    /// Load a PLY, OBJ or serialized mesh
+    ref<TriMesh> loadMesh(const std::string &filename) {
+        std::string lowercase = boost::to_lower_copy(filename);
+        ref<TriMesh> mesh;
+        if (boost::ends_with(lowercase, ".serialized")) {
+            ref<FileStream> stream = new FileStream(filename, FileStream::EReadOnly);
+            stream->setByteOrder(Stream::ELittleEndian);
+            mesh = new TriMesh(stream);
+        } else if (boost::ends_with(lowercase, ".ply")
+                || boost::ends_with(lowercase, ".obj")) {
+            Properties props(boost::ends_with(lowercase, ".ply") ? "ply" : "obj");
+            props.setString("filename", filename);
+            ref<Shape> shape = static_cast<Shape *> (PluginManager::getInstance()->
+                    createObject(MTS_CLASS(Shape), props));
+            shape->configure();
+            mesh = shape->createTriMesh();
+        } else {
+            Log(EError, "The supplied mesh filename must end in PLY, OBJ or SERIALIZED!");
+        }
+        if (!mesh)
+            Log(EError, "Could not convert \"%s\" into a triangle mesh!", filename.c_str());
+        return mesh;
+    }
+
     bool init(int argc, char **argv) {
         m_renderer->setPointSize(4.0f);
+
+        if (!m_renderer->getCapabilities()->isSupported(
+                RendererCapabilities::EShadingLanguage)) {
+            Log(EWarn, "The renderer does not support GLSL!");
+            return false;
+        }
+
+        if (argc > 1) {
+            m_mesh = loadMesh(argv[1]);
+            setBounds(m_mesh->getAABB());
+        } else {
+            m_mesh = createBox(m_aabb);
+        }
+
+        /* Upload the mesh once. Without vertex buffer support, drawMesh()
+           falls back to client-side arrays */
+        m_geometry = m_renderer->registerGeometry(m_mesh);
+        if (!m_geometry)
+            Log(EWarn, "Vertex buffer objects are not supported, the "
+                "mesh will be transmitted to the GPU every frame");
+
+        m_program = m_renderer->createGPUProgram("Cylinder clipping shader");
+        m_program->setSource(GPUProgram::EVertexProgram, sh_cylclip_vert);
+        m_program->setSource(GPUProgram::EFragmentProgram, sh_cylclip_frag);
+        m_program->init();
+
+        m_param_cylPos = m_program->getParameterID("cylPos");
+        m_param_cylD = m_program->getParameterID("cylD");
+        m_param_camPos = m_program->getParameterID("camPos");
+        m_param_radius = m_program->getParameterID("radius");
+        m_param_mode = m_program->getParameterID("mode");
+
+        Log(EInfo, "Displaying a mesh with " SIZE_T_FMT " triangles",
+            m_mesh->getTriangleCount());
         return true;
     }
 
+    void shutdown() {
+        m_program->cleanup();
+        m_program = NULL;
+        if (m_geometry) {
+            m_renderer->unregisterGeometry(m_mesh);
+            m_geometry = NULL;
+        }
+        m_mesh = NULL;
+    }
+
+    void drawMesh(const Vector &cylD) {
+        m_program->bind();
+        m_program->setParameter(m_param_cylPos, m_cylPos);
+        m_program->setParameter(m_param_cylD, cylD);
+        m_program->setParameter(m_param_camPos, m_viewTransform(Point(0.0f)));
+        m_program->setParameter(m_param_radius, m_radius);
+        m_program->setParameter(m_param_mode, (int) m_clipMode);
+
+        m_renderer->beginDrawingMeshes(true);
+        if (m_geometry)
+            m_renderer->drawMesh(m_geometry);
+        else
+            m_renderer->drawMesh(m_mesh.get());
+        m_renderer->endDrawingMeshes();
+        m_program->unbind();
+    }
+
     void draw() {
+        m_timer->reset();
         m_renderer->setDepthTest(true);
         m_renderer->setCamera(m_projTransform.getMatrix(),
             m_viewTransform.inverse().getMatrix());
 
-        AABB aabb(Point(-3, -1, -1), Point(3, 1, 1));
+        const AABB &aabb = m_aabb;
+        Vector cylD(sphericalDirection(m_lineParams.x, m_lineParams.y));
+        if (m_showMesh)
+            drawMesh(cylD);
+
         m_renderer->setColor(Spectrum(0.3f));
         m_renderer->drawAABB(aabb);
 
         m_renderer->setColor(m_gray);
-        Vector cylD(sphericalDirection(m_lineParams.x, m_lineParams.y));
-
         m_renderer->drawLine(m_cylPos-cylD*1e4, m_cylPos+cylD*1e4);
         AABB clippedAABB;
 
@@ -283,14 +464,27 @@ public:
                 m_renderer->drawAABB(clippedAABB);
         }
 
+        /* Wait for the GPU so that the readout covers the actual rendering */
+        m_renderer->finish();
+        m_frameTime = m_timer->getMicrosecondsSinceStart() / 1000.0f;
+
+        const char *clipModes[] = { "Keep inside", "Keep outside", "Off" };
+
         m_renderer->setDepthTest(false);
         drawHUD(formatString("Cylinder clipping test. LMB-dragging moves the camera, RMB-dragging rotates the cylinder\n"
                 "[e] Ellipses: %s\n"
                 "[r] Bounding rectangles : %s\n"
-                "[a] Clipped AABB : %s",
+                "[a] Clipped AABB : %s\n"
+                "[m] Mesh (" SIZE_T_FMT " triangles) : %s\n"
+                "[c] Clipping : %s\n"
+                "Frame time : %.2f ms",
             m_showEllipses ? "On": "Off",
             m_showRectangles ? "On": "Off",
-            m_showClippedAABB ? "On": "Off"
+            m_showClippedAABB ? "On": "Off",
+            m_mesh->getTriangleCount(),
+            m_showMesh ? "On": "Off",
+            clipModes[m_clipMode],
+            m_frameTime
         ));
     }
 
@@ -300,10 +494,20 @@ private:
     Spectrum m_red, m_blue, m_gray;
     Point2 m_lineParams;
     Point m_cylPos;
-    Float m_angle, m_radius;
+    AABB m_aabb;
+    Float m_angle, m_radius, m_scale;
     bool m_showEllipses;
     bool m_showRectangles;
     bool m_showClippedAABB;
+    bool m_showMesh;
+    EClipMode m_clipMode;
+    ref<TriMesh> m_mesh;
+    GPUGeometry *m_geometry;
+    ref<GPUProgram> m_program;
+    int m_param_cylPos, m_param_cylD, m_param_camPos;
+    int m_param_radius, m_param_mode;
+    ref<Timer> m_timer;
+    Float m_frameTime;
 };
 
 MTS_EXPORT_UTILITY(CylClip, "Cylinder clipping test")
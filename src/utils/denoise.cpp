@@ -0,0 +1,312 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/bitmap.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * Feature-guided denoiser for the multi-channel images of the
+ * \c multichannel integrator. The color is filtered with non-local means,
+ * where the distance between two patches is normalized by the variance of
+ * the pixel estimates (Rousselle et al. 2012, "Adaptive rendering with
+ * non-local means filtering"). The weights are additionally attenuated by
+ * the differences of the optional albedo, normal and depth features, which
+ * keeps texture and geometric edges sharp.
+ */
+class Denoise : public Utility {
+public:
+    /// One layer of the input image as float32 values without alpha
+    struct Buffer {
+        int channels;
+        std::vector<float> data;
+
+        inline Buffer() : channels(0) { }
+        inline bool empty() const { return channels == 0; }
+        inline const float *at(size_t pixel) const { return &data[pixel * channels]; }
+    };
+
+    void help() {
+        cout << endl;
+        cout << "Synopsis: Feature-guided denoiser for images rendered with the 'multichannel'" << endl;
+        cout << "integrator. The input is an OpenEXR file with a color layer, the second moment" << endl;
+        cout << "of its samples (see the 'secondMoment' parameter) and optionally albedo, normal" << endl;
+        cout << "and depth layers (e.g. from the 'field' integrator)." << endl;
+        cout << endl;
+        cout << "Usage: mtsutil denoise [options] <input.exr> <output.exr>" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -n count       Number of samples per pixel of the rendering (required)" << endl << endl;
+        cout << "   -r radius      Radius of the search window (default: 7)" << endl << endl;
+        cout << "   -f radius      Radius of the compared patches (default: 1)" << endl << endl;
+        cout << "   -k strength    Filter strength, larger values blur more (default: 0.45)" << endl << endl;
+        cout << "   -s scale       Scale factor of the feature tolerances (default: 1)" << endl << endl;
+        cout << "   -l names       Layer names of color, moment, albedo, normal and depth" << endl
+             << "                  (default: \"color,moment,albedo,normal,distance\")" << endl << endl;
+    }
+
+    /// Load a layer, or return an empty buffer when it doesn't exist
+    Buffer loadLayer(std::map<std::string, ref<Bitmap> > &layers,
+            const std::string &name, bool required) {
+        Buffer buffer;
+        std::map<std::string, ref<Bitmap> >::iterator it = layers.find(name);
+        if (it == layers.end()) {
+            if (required)
+                Log(EError, "The input image has no layer named \"%s\"!", name.c_str());
+            Log(EInfo, "No \"%s\" layer, the corresponding feature is not used", name.c_str());
+            return buffer;
+        }
+
+        ref<Bitmap> bitmap = it->second->convert(it->second->getPixelFormat(),
+            Bitmap::EFloat32, 1.0f);
+        int channels = bitmap->getChannelCount();
+        buffer.channels = std::min(3, bitmap->hasAlpha() ? channels - 1 : channels);
+        size_t pixelCount = (size_t) bitmap->getWidth() * bitmap->getHeight();
+        buffer.data.resize(pixelCount * buffer.channels);
+        const float *data = bitmap->getFloat32Data();
+        for (size_t i=0; i<pixelCount; ++i)
+            for (int j=0; j<buffer.channels; ++j)
+                buffer.data[i * buffer.channels + j] = data[i * channels + j];
+        return buffer;
+    }
+
+    int run(int argc, char **argv) {
+        int optchar;
+        char *end_ptr = NULL;
+        int radius = 7, patchRadius = 1, sampleCount = 0;
+        Float k = 0.45f, featureScale = 1.0f;
+        std::vector<std::string> names = tokenize("color,moment,albedo,normal,distance", ",");
+        optind = 1;
+
+        /* Parse command-line arguments */
+        while ((optchar = getopt(argc, argv, "n:r:f:k:s:l:h")) != -1) {
+            switch (optchar) {
+                case 'n':
+                    sampleCount = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || sampleCount <= 0)
+                        SLog(EError, "Could not parse the sample count!");
+                    break;
+                case 'r':
+                    radius = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || radius < 0)
+                        SLog(EError, "Could not parse the window radius!");
+                    break;
+                case 'f':
+                    patchRadius = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || patchRadius < 0)
+                        SLog(EError, "Could not parse the patch radius!");
+                    break;
+                case 'k':
+                    k = (Float) strtod(optarg, &end_ptr);
+                    if (*end_ptr != '\0' || k <= 0)
+                        SLog(EError, "Could not parse the filter strength!");
+                    break;
+                case 's':
+                    featureScale = (Float) strtod(optarg, &end_ptr);
+                    if (*end_ptr != '\0' || featureScale <= 0)
+                        SLog(EError, "Could not parse the feature scale!");
+                    break;
+                case 'l':
+                    names = tokenize(optarg, ",");
+                    if (names.size() != 5)
+                        SLog(EError, "Expected five layer names!");
+                    break;
+                case 'h':
+                default:
+                    help();
+                    return 0;
+            }
+        }
+
+        if (argc - optind != 2 || sampleCount == 0) {
+            help();
+            return -1;
+        }
+
+        ref<Timer> timer = new Timer();
+        fs::path inputPath = Thread::getThread()->getFileResolver()->resolve(argv[optind]);
+        ref<Bitmap> input = new Bitmap(inputPath);
+        Vector2i size = input->getSize();
+
+        std::map<std::string, ref<Bitmap> > layers;
+        {
+            std::map<std::string, Bitmap *> split = input->split();
+            for (std::map<std::string, Bitmap *>::iterator it = split.begin();
+                    it != split.end(); ++it)
+                layers[it->first] = it->second;
+        }
+        input = NULL;
+
+        Buffer color  = loadLayer(layers, names[0], true),
+               moment = loadLayer(layers, names[1], true),
+               albedo = loadLayer(layers, names[2], false),
+               normal = loadLayer(layers, names[3], false),
+               depth  = loadLayer(layers, names[4], false);
+        layers.clear();
+
+        if (color.channels != moment.channels)
+            Log(EError, "The color and moment layers have a different number of channels!");
+
+        ref<Bitmap> output = denoise(size, color,
+            estimateVariance(size, color, moment, sampleCount),
+            albedo, normal, depth, radius, patchRadius, k, featureScale);
+
+        output->write(Bitmap::EOpenEXR, argv[optind+1]);
+        Log(EInfo, "Denoised a %ix%i image in %i ms", size.x, size.y,
+            timer->getMilliseconds());
+        return 0;
+    }
+
+    /**
+     * Variance of the pixel estimates, box filtered over 3x3 pixels,
+     * since the estimate from a few samples is very noisy itself
+     */
+    Buffer estimateVariance(const Vector2i &size, const Buffer &color,
+            const Buffer &moment, int sampleCount) {
+        int channels = color.channels;
+        size_t pixelCount = (size_t) size.x * size.y;
+        std::vector<float> variance(pixelCount * channels);
+        for (size_t i=0; i<variance.size(); ++i) {
+            float mean = color.data[i];
+            variance[i] = std::max(0.0f, moment.data[i] - mean*mean) / sampleCount;
+        }
+
+        Buffer result;
+        result.channels = channels;
+        result.data.resize(variance.size());
+        for (int y=0; y<size.y; ++y) {
+            for (int x=0; x<size.x; ++x) {
+                int count = 0;
+                float *target = &result.data[((size_t) y * size.x + x) * channels];
+                for (int dy=-1; dy<=1; ++dy) {
+                    for (int dx=-1; dx<=1; ++dx) {
+                        int px = x + dx, py = y + dy;
+                        if (px < 0 || py < 0 || px >= size.x || py >= size.y)
+                            continue;
+                        const float *source = &variance[((size_t) py * size.x + px) * channels];
+                        for (int c=0; c<channels; ++c)
+                            target[c] += source[c];
+                        ++count;
+                    }
+                }
+                for (int c=0; c<channels; ++c)
+                    target[c] /= count;
+            }
+        }
+        return result;
+    }
+
+    /// Squared distance of two feature values, normalized by the tolerance
+    static inline Float featureDistance(const Buffer &feature,
+            size_t p, size_t q, Float invTolerance2) {
+        if (feature.empty())
+            return 0.0f;
+        const float *fp = feature.at(p), *fq = feature.at(q);
+        Float dist = 0;
+        for (int c=0; c<feature.channels; ++c)
+            dist += (fp[c] - fq[c]) * (fp[c] - fq[c]);
+        return dist * invTolerance2;
+    }
+
+    ref<Bitmap> denoise(const Vector2i &size, const Buffer &color,
+            const Buffer &variance, const Buffer &albedo, const Buffer &normal,
+            const Buffer &depth, int radius, int patchRadius, Float k,
+            Float featureScale) {
+        const int channels = color.channels;
+        const Float k2 = k * k, epsilon = 1e-10f;
+        const Float patchNormalization = 1.0f /
+            (channels * (2*patchRadius + 1) * (2*patchRadius + 1));
+
+        /* Tolerated differences of the features */
+        const Float invAlbedoTolerance2 = 1 / std::pow(0.1f * featureScale, 2),
+                    invNormalTolerance2 = 1 / std::pow(0.3f * featureScale, 2),
+                    relDepthTolerance = 0.05f * featureScale;
+
+        ref<Bitmap> output = new Bitmap(channels == 1 ? Bitmap::ELuminance
+            : Bitmap::ERGB, Bitmap::EFloat32, size);
+        float *target = output->getFloat32Data();
+
+        #if defined(MTS_OPENMP)
+            #pragma omp parallel for schedule(dynamic)
+        #endif
+        for (int y=0; y<size.y; ++y) {
+            std::vector<Float> sum(channels);
+            for (int x=0; x<size.x; ++x) {
+                size_t p = (size_t) y * size.x + x;
+                std::fill(sum.begin(), sum.end(), 0.0f);
+                Float weightSum = 0;
+
+                for (int qy=std::max(0, y-radius); qy<=std::min(size.y-1, y+radius); ++qy) {
+                    for (int qx=std::max(0, x-radius); qx<=std::min(size.x-1, x+radius); ++qx) {
+                        size_t q = (size_t) qy * size.x + qx;
+
+                        /* Variance-normalized distance of the color patches */
+                        Float colorDist = 0;
+                        for (int oy=-patchRadius; oy<=patchRadius; ++oy) {
+                            int py1 = math::clamp(y + oy, 0, size.y - 1),
+                                py2 = math::clamp(qy + oy, 0, size.y - 1);
+                            for (int ox=-patchRadius; ox<=patchRadius; ++ox) {
+                                size_t p1 = (size_t) py1 * size.x + math::clamp(x + ox, 0, size.x - 1),
+                                       p2 = (size_t) py2 * size.x + math::clamp(qx + ox, 0, size.x - 1);
+                                const float *c1 = color.at(p1), *c2 = color.at(p2),
+                                            *v1 = variance.at(p1), *v2 = variance.at(p2);
+                                for (int c=0; c<channels; ++c) {
+                                    Float diff = c1[c] - c2[c];
+                                    colorDist += (diff * diff - (v1[c] + std::min(v1[c], v2[c])))
+                                        / (epsilon + k2 * (v1[c] + v2[c]));
+                                }
+                            }
+                        }
+                        colorDist = std::max((Float) 0, colorDist * patchNormalization);
+
+                        /* Feature distances */
+                        Float featureDist = featureDistance(albedo, p, q, invAlbedoTolerance2)
+                            + featureDistance(normal, p, q, invNormalTolerance2);
+                        if (!depth.empty()) {
+                            Float dp = depth.at(p)[0], dq = depth.at(q)[0],
+                                  tol = relDepthTolerance * std::max(std::abs(dp), epsilon);
+                            featureDist += (dp - dq) * (dp - dq) / (tol * tol);
+                        }
+
+                        Float weight = math::fastexp(-colorDist - featureDist);
+                        const float *cq = color.at(q);
+                        for (int c=0; c<channels; ++c)
+                            sum[c] += weight * cq[c];
+                        weightSum += weight;
+                    }
+                }
+
+                /* The center pixel always has a weight of one */
+                for (int c=0; c<channels; ++c)
+                    target[p * channels + c] = (float) (sum[c] / weightSum);
+            }
+        }
+        return output;
+    }
+
+    MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(Denoise, "Feature-guided denoiser for multi-channel images")
+MTS_NAMESPACE_END
@@ -0,0 +1,220 @@
+#pragma once
+#if !defined(__MITSUBA_UTILS_EXRSCANLINE_H_)
+#define __MITSUBA_UTILS_EXRSCANLINE_H_
+
+#include <mitsuba/core/bitmap.h>
+#include <boost/algorithm/string.hpp>
+
+#if defined(MTS_HAS_OPENEXR)
+#if defined(_MSC_VER)
+#pragma warning(disable : 4231) // nonstandard extension used : 'extern' before template explicit instantiation
+#endif
+#include <ImfInputFile.h>
+#include <ImfOutputFile.h>
+#include <ImfChannelList.h>
+#include <ImfFrameBuffer.h>
+#include <ImfStandardAttributes.h>
+#include <ImfTestFile.h>
+#include <ImathBox.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * Helpers for the image utilities that process OpenEXR files in chunks of
+ * scanlines instead of loading them into memory at once. Only the common
+ * layouts are supported (RGB, RGBA, Y and YA with half or float
+ * components and without custom chromaticities); \ref canStream() tells
+ * whether a file qualifies. Everything else has to go through \ref Bitmap.
+ */
+
+/// Number of scanlines the utilities process at a time
+#define MTS_EXR_SCANLINE_CHUNK 64
+
+#if defined(MTS_HAS_OPENEXR)
+
+/// Reads chunks of scanlines of an OpenEXR file as float32 bitmaps
+class EXRScanlineReader {
+public:
+    EXRScanlineReader(const fs::path &path)
+            : m_file(new Imf::InputFile(path.string().c_str())) {
+        const Imf::Header &header = m_file->header();
+        m_dataWindow = header.dataWindow();
+        m_size = Vector2i(m_dataWindow.max.x - m_dataWindow.min.x + 1,
+            m_dataWindow.max.y - m_dataWindow.min.y + 1);
+        m_supported = categorize(header, m_channels, m_pixelFormat,
+            m_componentFormat);
+    }
+
+    /// Can this file be processed in chunks (or does it need a \ref Bitmap)?
+    static bool canStream(const fs::path &path) {
+        if (!Imf::isOpenExrFile(path.string().c_str()))
+            return false;
+        EXRScanlineReader reader(path);
+        return reader.m_supported;
+    }
+
+    inline const Vector2i &getSize() const { return m_size; }
+    inline Bitmap::EPixelFormat getPixelFormat() const { return m_pixelFormat; }
+    /// Component format stored in the file (the chunks are always float32)
+    inline Bitmap::EComponentFormat getComponentFormat() const { return m_componentFormat; }
+    inline Imf::Compression getCompression() const { return m_file->header().compression(); }
+
+    /// Read the scanlines <tt>[y, y+rows)</tt> (relative to the data window)
+    ref<Bitmap> read(int y, int rows) {
+        if (!m_supported)
+            SLog(EError, "EXRScanlineReader: unsupported channel layout!");
+        ref<Bitmap> chunk = new Bitmap(m_pixelFormat, Bitmap::EFloat32,
+            Vector2i(m_size.x, rows));
+        int channels = chunk->getChannelCount();
+        size_t xStride = channels * sizeof(float),
+               yStride = xStride * m_size.x;
+        char *base = reinterpret_cast<char *>(chunk->getFloat32Data())
+            - m_dataWindow.min.x * xStride
+            - (m_dataWindow.min.y + y) * yStride;
+
+        Imf::FrameBuffer frameBuffer;
+        for (int i=0; i<channels; ++i)
+            frameBuffer.insert(m_channels[i].c_str(), Imf::Slice(Imf::FLOAT,
+                base + i * sizeof(float), xStride, yStride));
+        m_file->setFrameBuffer(frameBuffer);
+        m_file->readPixels(m_dataWindow.min.y + y,
+            m_dataWindow.min.y + y + rows - 1);
+        return chunk;
+    }
+
+protected:
+    /// Simplified version of the channel matching in Bitmap::readOpenEXR()
+    static bool categorize(const Imf::Header &header,
+            std::vector<std::string> &names, Bitmap::EPixelFormat &pixelFormat,
+            Bitmap::EComponentFormat &componentFormat) {
+        const char *ch[5] = { NULL, NULL, NULL, NULL, NULL }; // r, g, b, a, y
+        const char *suffixes[5][2] = { { "r", "red" }, { "g", "green" },
+            { "b", "blue" }, { "a", "alpha" }, { "y", "luminance" } };
+        const Imf::ChannelList &channels = header.channels();
+
+        for (Imf::ChannelList::ConstIterator it = channels.begin(); it != channels.end(); ++it) {
+            std::string name = boost::to_lower_copy(std::string(it.name()));
+            bool known = false;
+            for (int i=0; i<5 && !known; ++i) {
+                for (int j=0; j<2 && !known; ++j) {
+                    std::string suffix = suffixes[i][j];
+                    if (!ch[i] && (name == suffix || boost::ends_with(name, "." + suffix))) {
+                        ch[i] = it.name();
+                        known = true;
+                    }
+                }
+            }
+            if (!known)
+                return false;
+        }
+
+        if (ch[0] && ch[1] && ch[2] && !ch[4]) {
+            pixelFormat = ch[3] ? Bitmap::ERGBA : Bitmap::ERGB;
+            names.assign(ch, ch + (ch[3] ? 4 : 3));
+        } else if (ch[4] && !ch[0] && !ch[1] && !ch[2]) {
+            pixelFormat = ch[3] ? Bitmap::ELuminanceAlpha : Bitmap::ELuminance;
+            names.push_back(ch[4]);
+            if (ch[3])
+                names.push_back(ch[3]);
+        } else {
+            return false;
+        }
+
+        /* Non-standard chromaticities need color processing */
+        if (Imf::hasChromaticities(header))
+            return false;
+
+        Imf::PixelType type = channels.findChannel(names[0].c_str())->type;
+        for (size_t i=0; i<names.size(); ++i) {
+            const Imf::Channel *channel = channels.findChannel(names[i].c_str());
+            if (channel->type != type || channel->xSampling != 1
+                    || channel->ySampling != 1)
+                return false;
+        }
+        if (type == Imf::HALF)
+            componentFormat = Bitmap::EFloat16;
+        else if (type == Imf::FLOAT)
+            componentFormat = Bitmap::EFloat32;
+        else
+            return false;
+        return true;
+    }
+
+private:
+    std::unique_ptr<Imf::InputFile> m_file;
+    Imath::Box2i m_dataWindow;
+    Vector2i m_size;
+    bool m_supported;
+    std::vector<std::string> m_channels;
+    Bitmap::EPixelFormat m_pixelFormat;
+    Bitmap::EComponentFormat m_componentFormat;
+};
+
+/// Writes an OpenEXR file from consecutive chunks of float32 scanlines
+class EXRScanlineWriter {
+public:
+    /**
+     * \param componentFormat
+     *     Component format of the file (\c EFloat16 or \c EFloat32),
+     *     the chunks that are passed to \ref write() are always float32
+     */
+    EXRScanlineWriter(const fs::path &path, const Vector2i &size,
+            Bitmap::EPixelFormat pixelFormat,
+            Bitmap::EComponentFormat componentFormat,
+            Imf::Compression compression = Imf::PIZ_COMPRESSION)
+            : m_size(size), m_pixelFormat(pixelFormat), m_y(0) {
+        switch (pixelFormat) {
+            case Bitmap::ELuminance: m_channels = "Y"; break;
+            case Bitmap::ELuminanceAlpha: m_channels = "YA"; break;
+            case Bitmap::ERGB: m_channels = "RGB"; break;
+            case Bitmap::ERGBA: m_channels = "RGBA"; break;
+            default:
+                SLog(EError, "EXRScanlineWriter: unsupported pixel format!");
+        }
+        Imf::PixelType type = componentFormat == Bitmap::EFloat16
+            ? Imf::HALF : Imf::FLOAT;
+
+        Imf::Header header(size.x, size.y);
+        header.compression() = compression;
+        for (size_t i=0; i<m_channels.length(); ++i)
+            header.channels().insert(std::string(1, m_channels[i]).c_str(),
+                Imf::Channel(type));
+        m_file.reset(new Imf::OutputFile(path.string().c_str(), header));
+    }
+
+    /// Append the scanlines of \c chunk (float32, same width and pixel format)
+    void write(const Bitmap *chunk) {
+        SAssert(chunk->getComponentFormat() == Bitmap::EFloat32 &&
+               chunk->getPixelFormat() == m_pixelFormat &&
+               chunk->getWidth() == m_size.x &&
+               m_y + chunk->getHeight() <= m_size.y);
+        int channels = (int) m_channels.length();
+        size_t xStride = channels * sizeof(float),
+               yStride = xStride * m_size.x;
+        /* The frame buffer is addressed with absolute scanline numbers */
+        char *base = reinterpret_cast<char *>(const_cast<float *>(
+            chunk->getFloat32Data())) - m_y * yStride;
+
+        Imf::FrameBuffer frameBuffer;
+        for (int i=0; i<channels; ++i)
+            frameBuffer.insert(std::string(1, m_channels[i]).c_str(),
+                Imf::Slice(Imf::FLOAT, base + i * sizeof(float), xStride, yStride));
+        m_file->setFrameBuffer(frameBuffer);
+        m_file->writePixels(chunk->getHeight());
+        m_y += chunk->getHeight();
+    }
+
+private:
+    std::unique_ptr<Imf::OutputFile> m_file;
+    Vector2i m_size;
+    Bitmap::EPixelFormat m_pixelFormat;
+    std::string m_channels;
+    int m_y;
+};
+
+#endif
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_UTILS_EXRSCANLINE_H_ */
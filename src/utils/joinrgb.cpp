@@ -19,12 +19,21 @@
 #include <mitsuba/render/util.h>
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/fstream.h>
+#include "exrscanline.h"
 
 MTS_NAMESPACE_BEGIN
 
 class JoinRGB : public Utility {
 public:
     void joinRGB(const std::string &s1, const std::string &s2, const std::string &s3, const std::string &s4) {
+#if defined(MTS_HAS_OPENEXR)
+        if (EXRScanlineReader::canStream(s1) && EXRScanlineReader::canStream(s2)
+                && EXRScanlineReader::canStream(s3)) {
+            joinRGBStreaming(s1, s2, s3, s4);
+            return;
+        }
+#endif
+
         ref<FileStream> rFile   = new FileStream(s1, FileStream::EReadOnly);
         ref<FileStream> gFile   = new FileStream(s2, FileStream::EReadOnly);
         ref<FileStream> bFile   = new FileStream(s3, FileStream::EReadOnly);
@@ -41,11 +50,53 @@ public:
         sourceBitmaps.push_back(gBitmap);
         sourceBitmaps.push_back(bBitmap);
 
-        ref<Bitmap> result = Bitmap::join(Bitmap::ERGBA, sourceBitmaps);
+        ref<Bitmap> result = Bitmap::join(Bitmap::ERGB, sourceBitmaps);
         ref<FileStream> outFile = new FileStream(s4, FileStream::ETruncReadWrite);
         result->write(Bitmap::EOpenEXR, outFile);
     }
 
+#if defined(MTS_HAS_OPENEXR)
+    /// Same as above, but only keeps a few scanlines of each image in memory
+    void joinRGBStreaming(const fs::path &rPath, const fs::path &gPath,
+            const fs::path &bPath, const fs::path &outPath) {
+        std::unique_ptr<EXRScanlineReader> readers[3];
+        readers[0].reset(new EXRScanlineReader(rPath));
+        readers[1].reset(new EXRScanlineReader(gPath));
+        readers[2].reset(new EXRScanlineReader(bPath));
+
+        const Vector2i &size = readers[0]->getSize();
+        for (int i=1; i<3; ++i) {
+            if (readers[i]->getSize() != size)
+                Log(EError, "Error: Input bitmaps have a different size!");
+            if (readers[i]->getComponentFormat() != readers[0]->getComponentFormat())
+                Log(EError, "Error: Input bitmaps have a different component format!");
+        }
+
+        EXRScanlineWriter writer(outPath, size, Bitmap::ERGB,
+            readers[0]->getComponentFormat(), readers[0]->getCompression());
+        ref<Bitmap> result = new Bitmap(Bitmap::ERGB, Bitmap::EFloat32,
+            Vector2i(size.x, MTS_EXR_SCANLINE_CHUNK));
+
+        for (int y=0; y<size.y; y += MTS_EXR_SCANLINE_CHUNK) {
+            int rows = std::min(MTS_EXR_SCANLINE_CHUNK, size.y - y);
+            if (rows != result->getHeight())
+                result = new Bitmap(Bitmap::ERGB, Bitmap::EFloat32, Vector2i(size.x, rows));
+            size_t pixels = (size_t) size.x * (size_t) rows;
+            float *target = result->getFloat32Data();
+
+            /* Take the first channel of every source */
+            for (int i=0; i<3; ++i) {
+                ref<Bitmap> chunk = readers[i]->read(y, rows);
+                const float *source = chunk->getFloat32Data();
+                int stride = chunk->getChannelCount();
+                for (size_t j=0; j<pixels; ++j)
+                    target[3*j + i] = source[j * stride];
+            }
+            writer.write(result);
+        }
+    }
+#endif
+
     int run(int argc, char **argv) {
         if (argc < 5) {
             cout << "Join three monochromatic images into a RGB-valued EXR file" << endl;
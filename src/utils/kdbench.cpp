@@ -17,28 +17,135 @@
 */
 
 #include <mitsuba/render/util.h>
+#include <mitsuba/render/bvh.h>
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/plugin.h>
 #include <boost/algorithm/string.hpp>
+#include <fstream>
 #if defined(WIN32)
 #include <mitsuba/core/getopt.h>
 #endif
 
 MTS_NAMESPACE_BEGIN
 
+/// Traces batches of rays of one workload through the benchmarked structure
+class BenchmarkTracer {
+public:
+    enum EWorkload {
+        /// Uniformly distributed rays through the bounding sphere
+        EUniform = 0,
+        /// Camera rays in tile order (coherent)
+        ECamera,
+        /// Cosine-distributed bounce rays from camera hits (incoherent)
+        ESecondary,
+        /// Shadow rays from camera hits towards the emitters
+        EShadow,
+        /// Infinite lines through camera hits, collecting all intersections
+        EProbe,
+        EWorkloadCount
+    };
+
+    BenchmarkTracer(const ShapeKDTree *kdtree, const TriangleBVH *bvh)
+        : m_kdtree(kdtree), m_bvh(bvh) { }
+
+    static const char *getWorkloadName(EWorkload workload) {
+        static const char *names[] = { "uniform", "camera",
+            "secondary", "shadow", "probe" };
+        return names[workload];
+    }
+
+    /// Trace a range of rays and return the number of intersections
+    size_t trace(EWorkload workload, const Ray *rays, size_t count) const {
+        size_t nIntersections = 0;
+        if (workload == EShadow) {
+            for (size_t i=0; i<count; ++i) {
+                const Ray &r = rays[i];
+                if (m_bvh ? m_bvh->rayIntersect(r, r.mint, r.maxt)
+                          : m_kdtree->rayIntersect(r))
+                    nIntersections++;
+            }
+        } else if (workload == EProbe) {
+            std::vector<Intersection> its;
+            for (size_t i=0; i<count; ++i) {
+                its.clear();
+                m_kdtree->rayIntersectFully(rays[i], its);
+                nIntersections += its.size();
+            }
+        } else if (m_bvh) {
+            TriangleBVH::IntersectionCache cache;
+            Float t;
+            for (size_t i=0; i<count; ++i) {
+                const Ray &r = rays[i];
+                if (m_bvh->rayIntersect(r, r.mint, r.maxt, t, &cache))
+                    nIntersections++;
+            }
+        } else {
+            Intersection its;
+            for (size_t i=0; i<count; ++i) {
+                if (m_kdtree->rayIntersect(rays[i], its))
+                    nIntersections++;
+            }
+        }
+        return nIntersections;
+    }
+private:
+    const ShapeKDTree *m_kdtree;
+    const TriangleBVH *m_bvh;
+};
+
+/// Worker thread that traces one contiguous chunk of a ray batch
+class BenchmarkThread : public Thread {
+public:
+    BenchmarkThread(int id, const BenchmarkTracer *tracer,
+            BenchmarkTracer::EWorkload workload, const Ray *rays, size_t count)
+        : Thread(formatString("bench%i", id)), m_tracer(tracer),
+          m_workload(workload), m_rays(rays), m_count(count),
+          m_intersections(0) { }
+
+    void run() {
+        m_intersections = m_tracer->trace(m_workload, m_rays, m_count);
+    }
+
+    inline size_t getIntersectionCount() const { return m_intersections; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~BenchmarkThread() { }
+private:
+    const BenchmarkTracer *m_tracer;
+    BenchmarkTracer::EWorkload m_workload;
+    const Ray *m_rays;
+    size_t m_count;
+    size_t m_intersections;
+};
+
 class KDBench : public Utility {
 public:
     void help() {
         cout << endl;
-        cout << "Synopsis: kd-tree performance benchmark. Traces uniformly distributed rays" << endl;
-        cout << "though the bounding sphere of a scene and reports the resulting number of" << endl;
-        cout << "rays per second. The main intent of this utility is to optimize the kd-tree" << endl;
-        cout << "construction parameters for particular scenes and machines." << endl;
+        cout << "Synopsis: kd-tree performance benchmark. Replays one or more ray workloads" << endl;
+        cout << "(by default, uniformly distributed rays through the bounding sphere of the" << endl;
+        cout << "scene) and reports the resulting number of rays per second. The main intent" << endl;
+        cout << "of this utility is to optimize the kd-tree construction parameters for" << endl;
+        cout << "particular scenes and machines, and to track performance across builds." << endl;
         cout << endl;
         cout << "Usage: mtsutil kdbench [options] <Scene XML file or PLY file>" << endl;
         cout << "Options/Arguments:" << endl;
         cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -a kdtree/bvh  Benchmark the SAH kd-tree (default) or a BVH built" << endl;
+        cout << "                  over the triangle meshes of the scene" << endl << endl;
+        cout << "   -w list        Comma-separated workloads to replay, or \"all\":" << endl;
+        cout << "                    uniform   : uniform rays through the bounding sphere" << endl;
+        cout << "                    camera    : coherent camera rays in tile order" << endl;
+        cout << "                    secondary : incoherent bounce rays from camera hits" << endl;
+        cout << "                    shadow    : shadow rays from camera hits to emitters" << endl;
+        cout << "                    probe     : DSS probe lines through camera hits that" << endl;
+        cout << "                                collect all intersections (kd-tree only)" << endl;
+        cout << "                  (default: uniform)" << endl << endl;
+        cout << "   -n list        Comma-separated thread counts (default: 1)" << endl << endl;
+        cout << "   -N count       Number of rays per workload (default: 5000000)" << endl << endl;
+        cout << "   -j file        Write the results as JSON to a file (\"-\" for stdout)" << endl << endl;
         cout << "   -t value       Specify the SAH traversal cost" << endl << endl;
         cout << "   -i value       Specify the SAH intersection cost" << endl << endl;
         cout << "   -e value       Specify the SAH empty space bonus" << endl << endl;
@@ -71,11 +178,50 @@ public:
         Float intersectionCost = -1, traversalCost = -1, emptySpaceBonus = -1;
         int stopPrims = -1, maxDepth = -1, exactPrims = -1, minMaxBins = -1;
         bool clip = true, parallel = true, retract = true, fitParameters = false;
+        bool useBVH = false;
+        std::vector<BenchmarkTracer::EWorkload> workloads(1, BenchmarkTracer::EUniform);
+        std::vector<int> threadCounts(1, 1);
+        size_t nRays = 5000000;
+        std::string jsonFilename;
         optind = 1;
 
         /* Parse command-line arguments */
-        while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:l:x:b:d:hf")) != -1) {
+        while ((optchar = getopt(argc, argv, "a:w:n:N:j:i:t:e:c:p:r:l:x:b:d:hf")) != -1) {
             switch (optchar) {
+                case 'w':
+                    workloads = parseWorkloads(optarg);
+                    break;
+                case 'n': {
+                        threadCounts.clear();
+                        std::vector<std::string> tokens = tokenize(optarg, ",");
+                        for (size_t i=0; i<tokens.size(); ++i) {
+                            int count = strtol(tokens[i].c_str(), &end_ptr, 10);
+                            if (*end_ptr != '\0' || count <= 0)
+                                SLog(EError, "Could not parse the thread counts!");
+                            threadCounts.push_back(count);
+                        }
+                        if (threadCounts.empty())
+                            SLog(EError, "Could not parse the thread counts!");
+                    }
+                    break;
+                case 'N': {
+                        long long count = strtoll(optarg, &end_ptr, 10);
+                        if (*end_ptr != '\0' || count <= 0)
+                            SLog(EError, "Could not parse the ray count!");
+                        nRays = (size_t) count;
+                    }
+                    break;
+                case 'j':
+                    jsonFilename = optarg;
+                    break;
+                case 'a':
+                    if (strcmp(optarg, "kdtree") == 0)
+                        useBVH = false;
+                    else if (strcmp(optarg, "bvh") == 0)
+                        useBVH = true;
+                    else
+                        SLog(EError, "Could not parse the acceleration structure!");
+                    break;
                 case 'h': {
                         help();
                         return 0;
@@ -153,6 +299,7 @@ public:
 
         ref<Scene> scene;
         ref<ShapeKDTree> kdtree;
+        std::vector<const TriMesh *> meshes;
 
         std::string lowercase = boost::to_lower_copy(std::string(argv[optind]));
         if (boost::ends_with(lowercase, ".xml")) {
@@ -174,6 +321,7 @@ public:
             mesh->configure();
             kdtree = new ShapeKDTree();
             kdtree->addShape(mesh);
+            meshes.push_back(mesh);
         } else {
             Log(EError, "The supplied scene filename must end in either PLY or XML!");
         }
@@ -202,44 +350,107 @@ public:
         logger->setLogLevel(EDebug);
         formatter->setHaveDate(false);
 
+        ref<Timer> buildTimer = new Timer();
         if (scene)
             scene->initialize();
-        else
+        else if (!useBVH)
             kdtree->build();
 
-        BSphere bsphere(kdtree->getAABB().getBSphere());
-        const size_t nRays = 5000000;
+        ref<TriangleBVH> bvh;
+        if (useBVH) {
+            if (fitParameters)
+                Log(EError, "Cost fitting (-f) is only supported for kd-trees!");
+            if (scene) {
+                const std::vector<TriMesh *> &sceneMeshes = scene->getMeshes();
+                meshes.assign(sceneMeshes.begin(), sceneMeshes.end());
+            }
+            buildTimer->reset();
+            bvh = new TriangleBVH();
+            bvh->addKeyframe(meshes);
+            bvh->build();
+            Log(EInfo, "Built a BVH with " SIZE_T_FMT " nodes over " SIZE_T_FMT
+                " triangles in %i ms", bvh->getNodeCount(),
+                bvh->getPrimitiveCount(), buildTimer->getMilliseconds());
+        } else if (!scene) {
+            Log(EInfo, "Built the kd-tree in %i ms", buildTimer->getMilliseconds());
+        }
+
+        unsigned int buildTime = buildTimer->getMilliseconds();
+        BSphere bsphere(useBVH ? bvh->getAABB().getBSphere()
+            : kdtree->getAABB().getBSphere());
 
         if (!fitParameters) {
             Log(EInfo, "Bounding sphere: %s", bsphere.toString().c_str());
-            Float best = 0;
-            for (int j=0; j<3; ++j) {
-                ref<Random> random = new Random();
-                ref<Timer> timer = new Timer();
-                size_t nIntersections = 0;
-
-                Log(EInfo, "Shooting " SIZE_T_FMT " rays (1 thread, incoherent) ..", nRays);
-
-                for (size_t i=0; i<nRays; ++i) {
-                    Point2 sample1(random->nextFloat(), random->nextFloat()),
-                        sample2(random->nextFloat(), random->nextFloat());
-                    Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
-                    Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
-                    Ray r(p1, normalize(p2-p1), 0.0f);
-
-                    Intersection its;
-                    if (kdtree->rayIntersect(r, its))
-                        nIntersections++;
+
+            /* Workloads other than 'uniform' start at camera hits, which
+               are always found using the kd-tree */
+            if (!kdtree->isBuilt())
+                kdtree->build();
+            BenchmarkTracer tracer(kdtree, bvh);
+
+            std::ostringstream json;
+            json << "{" << endl
+                 << "  \"scene\": \"" << escapeJSON(argv[optind]) << "\"," << endl
+                 << "  \"accel\": \"" << (useBVH ? "bvh" : "kdtree") << "\"," << endl
+                 << "  \"primitives\": " << kdtree->getPrimitiveCount() << "," << endl
+                 << "  \"buildTimeMs\": " << buildTime << "," << endl
+                 << "  \"results\": [";
+            bool first = true;
+
+            for (size_t w=0; w<workloads.size(); ++w) {
+                BenchmarkTracer::EWorkload workload = workloads[w];
+                const char *name = BenchmarkTracer::getWorkloadName(workload);
+                if (workload == BenchmarkTracer::EProbe && useBVH) {
+                    Log(EWarn, "Skipping the 'probe' workload, which requires the kd-tree");
+                    continue;
+                }
+
+                std::vector<Ray> rays;
+                generateRays(workload, scene, kdtree, bsphere, nRays, rays);
+
+                for (size_t k=0; k<threadCounts.size(); ++k) {
+                    int nThreads = threadCounts[k];
+                    Float best = 0;
+                    size_t nIntersections = 0;
+                    for (int j=0; j<3; ++j) {
+                        Log(EInfo, "Shooting " SIZE_T_FMT " rays (%i thread%s, %s) ..",
+                            rays.size(), nThreads, nThreads > 1 ? "s" : "", name);
+                        ref<Timer> timer = new Timer();
+                        nIntersections = traceParallel(tracer, workload, rays, nThreads);
+                        unsigned int time = std::max(timer->getMilliseconds(), 1u);
+
+                        Log(EInfo, "Found " SIZE_T_FMT " intersections in %i ms",
+                            nIntersections, time);
+                        Float mrays = rays.size() / (time * (Float) 1000);
+                        Log(EInfo, "-> %.3f MRays/s", mrays);
+                        Log(EInfo, "");
+                        best = std::max(best, mrays);
+                    }
+                    Log(EInfo, "Best of three (%s, %i thread%s): %.3f MRays/s",
+                        name, nThreads, nThreads > 1 ? "s" : "", best);
+                    Log(EInfo, "");
+
+                    json << (first ? "" : ",") << endl
+                         << "    { \"workload\": \"" << name << "\", "
+                         << "\"threads\": " << nThreads << ", "
+                         << "\"rays\": " << rays.size() << ", "
+                         << "\"intersections\": " << nIntersections << ", "
+                         << "\"mraysPerSecond\": " << best << " }";
+                    first = false;
                 }
+            }
+            json << endl << "  ]" << endl << "}" << endl;
 
-                Log(EInfo, "Found " SIZE_T_FMT " intersections in %i ms",
-                    nIntersections, timer->getMilliseconds());
-                Float mrays = nRays / (timer->getMilliseconds() * (Float) 1000);
-                Log(EInfo, "-> %.3f MRays/s", mrays);
-                Log(EInfo, "");
-                best = std::max(best, mrays);
+            if (jsonFilename == "-") {
+                cout << json.str();
+            } else if (!jsonFilename.empty()) {
+                std::ofstream os(jsonFilename.c_str());
+                os << json.str();
+                if (os.fail())
+                    Log(EError, "Could not write the JSON results to \"%s\"!",
+                        jsonFilename.c_str());
+                Log(EInfo, "Wrote the results to \"%s\"", jsonFilename.c_str());
             }
-            Log(EInfo, "Best of three: %.3f MRays/s", best);
         } else {
             Float intersectionCost, traversalCost;
             kdtree->findCosts(intersectionCost, traversalCost);
@@ -249,8 +460,185 @@ public:
         return 0;
     }
 
+    /// Parse a comma-separated list of workload names
+    std::vector<BenchmarkTracer::EWorkload> parseWorkloads(const std::string &str) {
+        std::vector<BenchmarkTracer::EWorkload> result;
+        std::vector<std::string> tokens = tokenize(boost::to_lower_copy(str), ",");
+        for (size_t i=0; i<tokens.size(); ++i) {
+            if (tokens[i] == "all") {
+                for (int j=0; j<BenchmarkTracer::EWorkloadCount; ++j)
+                    result.push_back((BenchmarkTracer::EWorkload) j);
+                continue;
+            }
+            int j = 0;
+            while (j < BenchmarkTracer::EWorkloadCount && tokens[i] !=
+                    BenchmarkTracer::getWorkloadName((BenchmarkTracer::EWorkload) j))
+                ++j;
+            if (j == BenchmarkTracer::EWorkloadCount)
+                SLog(EError, "Unknown workload \"%s\"!", tokens[i].c_str());
+            result.push_back((BenchmarkTracer::EWorkload) j);
+        }
+        if (result.empty())
+            SLog(EError, "No workloads were specified!");
+        return result;
+    }
+
+    /// Escape a string for use in a JSON document
+    static std::string escapeJSON(const std::string &str) {
+        std::string result;
+        for (size_t i=0; i<str.length(); ++i) {
+            if (str[i] == '"' || str[i] == '\\')
+                result += '\\';
+            result += str[i];
+        }
+        return result;
+    }
+
+    /// Uniformly distributed ray between two points of the bounding sphere
+    static Ray sampleUniformRay(Random *random, const BSphere &bsphere) {
+        Point2 sample1(random->nextFloat(), random->nextFloat()),
+            sample2(random->nextFloat(), random->nextFloat());
+        Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+        Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+        return Ray(p1, normalize(p2-p1), 0.0f);
+    }
+
+    /**
+     * \brief Generate camera rays in 8x8 pixel tiles, one jittered sample
+     * per pixel and pass, using the scene's sensor when there is one
+     * (and otherwise a pinhole looking at the bounding sphere)
+     */
+    static void generateCameraRays(Random *random, const Scene *scene,
+            const BSphere &bsphere, size_t count, std::vector<Ray> &rays) {
+        const Sensor *sensor = scene ? scene->getSensor() : NULL;
+        Vector2i size(512, 512);
+        Point2i offset(0, 0);
+        if (sensor) {
+            size = sensor->getFilm()->getCropSize();
+            offset = sensor->getFilm()->getCropOffset();
+        }
+        const int tileSize = 8;
+
+        while (rays.size() < count) {
+            for (int ty=0; ty<size.y && rays.size() < count; ty += tileSize) {
+                for (int tx=0; tx<size.x && rays.size() < count; tx += tileSize) {
+                    for (int y=ty; y<std::min(ty+tileSize, size.y); ++y) {
+                        for (int x=tx; x<std::min(tx+tileSize, size.x); ++x) {
+                            if (rays.size() == count)
+                                return;
+                            Point2 pixel(x + random->nextFloat(), y + random->nextFloat());
+                            Ray ray;
+                            if (sensor) {
+                                Point2 apertureSample(random->nextFloat(), random->nextFloat());
+                                sensor->sampleRay(ray, pixel + Vector2(offset.x, offset.y),
+                                    apertureSample, random->nextFloat());
+                            } else {
+                                Point eye = bsphere.center + Vector(0, 0, 3 * bsphere.radius);
+                                Point target = bsphere.center + Vector(
+                                    (2 * pixel.x / size.x - 1) * bsphere.radius,
+                                    (1 - 2 * pixel.y / size.y) * bsphere.radius, 0);
+                                ray = Ray(eye, normalize(target - eye), 0.0f);
+                            }
+                            rays.push_back(ray);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /// Generate the rays of a workload
+    void generateRays(BenchmarkTracer::EWorkload workload, const Scene *scene,
+            const ShapeKDTree *kdtree, const BSphere &bsphere, size_t count,
+            std::vector<Ray> &rays) {
+        ref<Random> random = new Random();
+        rays.clear();
+        rays.reserve(count);
+
+        if (workload == BenchmarkTracer::EUniform) {
+            for (size_t i=0; i<count; ++i)
+                rays.push_back(sampleUniformRay(random, bsphere));
+            return;
+        }
+
+        std::vector<Ray> cameraRays;
+        generateCameraRays(random, scene, bsphere, count, cameraRays);
+        if (workload == BenchmarkTracer::ECamera) {
+            rays.swap(cameraRays);
+            return;
+        }
+
+        /* The remaining workloads start at the camera hits */
+        bool haveEmitters = scene && !scene->getEmitters().empty();
+        for (size_t i=0; i<cameraRays.size(); ++i) {
+            Intersection its;
+            if (!kdtree->rayIntersect(cameraRays[i], its))
+                continue;
+
+            Vector n(its.geoFrame.n);
+            if (dot(n, cameraRays[i].d) > 0)
+                n = -n;
+            Point2 sample(random->nextFloat(), random->nextFloat());
+
+            if (workload == BenchmarkTracer::ESecondary) {
+                Vector d = Frame(n).toWorld(warp::squareToCosineHemisphere(sample));
+                rays.push_back(Ray(its.p, d, its.time));
+            } else if (workload == BenchmarkTracer::EShadow) {
+                DirectSamplingRecord dRec(its);
+                if (haveEmitters) {
+                    if (scene->sampleEmitterDirect(dRec, sample, false).isZero())
+                        continue;
+                } else {
+                    dRec.p = bsphere.center
+                        + warp::squareToUniformSphere(sample) * bsphere.radius;
+                    dRec.d = dRec.p - its.p;
+                    dRec.dist = dRec.d.length();
+                    dRec.d /= dRec.dist;
+                }
+                rays.push_back(Ray(its.p, dRec.d, Epsilon,
+                    dRec.dist * (1 - ShadowEpsilon), its.time));
+            } else {
+                Float inf = std::numeric_limits<Float>::infinity();
+                Vector d = warp::squareToUniformSphere(sample);
+                rays.push_back(Ray(its.p, d, -inf, inf, its.time));
+            }
+        }
+
+        if (rays.empty()) {
+            Log(EWarn, "The camera rays did not hit anything -- using uniform "
+                "rays for the '%s' workload", BenchmarkTracer::getWorkloadName(workload));
+            for (size_t i=0; i<count; ++i)
+                rays.push_back(sampleUniformRay(random, bsphere));
+        }
+    }
+
+    /// Trace a batch of rays split evenly over several threads
+    size_t traceParallel(const BenchmarkTracer &tracer,
+            BenchmarkTracer::EWorkload workload,
+            const std::vector<Ray> &rays, int nThreads) {
+        if (nThreads == 1)
+            return tracer.trace(workload, &rays[0], rays.size());
+
+        ref_vector<BenchmarkThread> threads;
+        size_t chunkSize = (rays.size() + nThreads - 1) / nThreads;
+        for (int i=0; i<nThreads; ++i) {
+            size_t start = std::min(rays.size(), i * chunkSize),
+                   end = std::min(rays.size(), start + chunkSize);
+            threads.push_back(new BenchmarkThread(i, &tracer,
+                workload, &rays[0] + start, end - start));
+            threads[i]->start();
+        }
+        size_t nIntersections = 0;
+        for (int i=0; i<nThreads; ++i) {
+            threads[i]->join();
+            nIntersections += threads[i]->getIntersectionCount();
+        }
+        return nIntersections;
+    }
+
     MTS_DECLARE_UTILITY()
 };
 
+MTS_IMPLEMENT_CLASS(BenchmarkThread, false, Thread)
 MTS_EXPORT_UTILITY(KDBench, "kd-tree performance benchmark")
 MTS_NAMESPACE_END
@@ -0,0 +1,817 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/scene.h>
+#include <mitsuba/render/dss.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/version.h>
+#include <boost/algorithm/string.hpp>
+#include <fstream>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+/// Number of distinct precomputed queries, which are cycled through
+#define KERNELBENCH_POOL_SIZE 65536
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Set of timed kernels of one scattering model
+ *
+ * The queries are precomputed once, so that the timings only cover
+ * the calls into the plugin. Every kernel returns a sum of the results
+ * so that the compiler cannot discard the calls.
+ */
+class KernelSet : public Object {
+public:
+    /// Return the names of the timed kernels
+    virtual std::vector<std::string> getKernels() const = 0;
+
+    /// Precompute the query pool
+    virtual void prepare(Random *random, Sampler *sampler) = 0;
+
+    /// Run one kernel for the queries <tt>[start, end)</tt>
+    virtual Float run(int kernel, size_t start, size_t end,
+        Sampler *sampler) const = 0;
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~KernelSet() { }
+
+    /// Uniformly distributed ray between two points of a bounding sphere
+    static Ray sampleUniformRay(Random *random, const BSphere &bsphere) {
+        Point2 sample1(random->nextFloat(), random->nextFloat()),
+            sample2(random->nextFloat(), random->nextFloat());
+        Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+        Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+        return Ray(p1, normalize(p2-p1), 0.0f);
+    }
+
+    /// Find a random surface point of the benchmark geometry
+    static void sampleSurface(Random *random, const Scene *scene, Intersection &its) {
+        BSphere bsphere = scene->getKDTree()->getAABB().getBSphere();
+        for (int i=0; i<1000; ++i) {
+            if (scene->rayIntersect(sampleUniformRay(random, bsphere), its))
+                return;
+        }
+        SLog(EError, "Could not find a point on the benchmark geometry!");
+    }
+};
+
+/// Kernels of a BSDF: sample(), eval() and pdf()
+class BSDFKernels : public KernelSet {
+public:
+    BSDFKernels(const Scene *scene, const BSDF *bsdf)
+        : m_scene(scene), m_bsdf(bsdf) { }
+
+    std::vector<std::string> getKernels() const {
+        std::vector<std::string> result;
+        result.push_back("sample");
+        result.push_back("eval");
+        result.push_back("pdf");
+        /* BSDF lookup at the shading point through a borrowed pointer and
+           through a reference. All threads share the BSDF, hence the
+           latter shows the cost of the atomic reference count updates */
+        result.push_back("lookup");
+        result.push_back("lookupRef");
+        return result;
+    }
+
+    void prepare(Random *random, Sampler *sampler) {
+        m_queries.resize(KERNELBENCH_POOL_SIZE);
+        for (size_t i=0; i<m_queries.size(); ++i) {
+            Query &query = m_queries[i];
+            sampleSurface(random, m_scene, query.its);
+            query.its.wi = warp::squareToCosineHemisphere(
+                Point2(random->nextFloat(), random->nextFloat()));
+            query.sample = Point2(random->nextFloat(), random->nextFloat());
+
+            /* Evaluate at directions that the BSDF would actually sample */
+            BSDFSamplingRecord bRec(query.its, sampler);
+            if (!m_bsdf->sample(bRec, query.sample).isZero())
+                query.wo = bRec.wo;
+            else
+                query.wo = warp::squareToCosineHemisphere(
+                    Point2(random->nextFloat(), random->nextFloat()));
+        }
+    }
+
+    Float run(int kernel, size_t start, size_t end, Sampler *sampler) const {
+        Float result = 0;
+        for (size_t i=start; i<end; ++i) {
+            const Query &query = m_queries[i % m_queries.size()];
+            if (kernel == 0) {
+                BSDFSamplingRecord bRec(query.its, sampler);
+                result += m_bsdf->sample(bRec, query.sample)[0];
+            } else if (kernel == 3) {
+                const BSDF *bsdf = query.its.getBSDF();
+                result += (Float) bsdf->getType();
+            } else if (kernel == 4) {
+                ref<const BSDF> bsdf = query.its.getBSDF();
+                result += (Float) bsdf->getType();
+            } else {
+                BSDFSamplingRecord bRec(query.its, query.its.wi, query.wo);
+                if (kernel == 1)
+                    result += m_bsdf->eval(bRec)[0];
+                else
+                    result += m_bsdf->pdf(bRec);
+            }
+        }
+        return result;
+    }
+private:
+    struct Query {
+        Intersection its;
+        Vector wo;
+        Point2 sample;
+    };
+
+    ref<const Scene> m_scene;
+    ref<const BSDF> m_bsdf;
+    std::vector<Query> m_queries;
+};
+
+/// Number of outgoing directions per call of PhaseFunction::evalBatch()
+#define KERNELBENCH_PHASE_BATCH 64
+
+/// Kernels of a phase function: sample(), eval(), pdf() and evalBatch()
+class PhaseKernels : public KernelSet {
+public:
+    PhaseKernels(const Medium *medium)
+        : m_medium(medium), m_phase(medium->getPhaseFunction()) { }
+
+    std::vector<std::string> getKernels() const {
+        std::vector<std::string> result;
+        result.push_back("sample");
+        result.push_back("eval");
+        result.push_back("pdf");
+        result.push_back("evalBatch");
+        return result;
+    }
+
+    void prepare(Random *random, Sampler *sampler) {
+        m_mRec.medium = m_medium;
+        m_mRec.p = Point(0.0f);
+        m_mRec.t = 0;
+        m_mRec.time = 0;
+
+        m_queries.resize(KERNELBENCH_POOL_SIZE);
+        for (size_t i=0; i<m_queries.size(); ++i) {
+            Query &query = m_queries[i];
+            query.wi = warp::squareToUniformSphere(
+                Point2(random->nextFloat(), random->nextFloat()));
+            PhaseFunctionSamplingRecord pRec(m_mRec, query.wi);
+            if (m_phase->sample(pRec, sampler) != 0)
+                query.wo = pRec.wo;
+            else
+                query.wo = warp::squareToUniformSphere(
+                    Point2(random->nextFloat(), random->nextFloat()));
+        }
+    }
+
+    Float run(int kernel, size_t start, size_t end, Sampler *sampler) const {
+        Float result = 0;
+        if (kernel == 3) {
+            /* Every batch shares the incident direction of its first query.
+               The time per call refers to a single direction */
+            Vector wo[KERNELBENCH_PHASE_BATCH];
+            Float values[KERNELBENCH_PHASE_BATCH];
+            for (size_t i=start; i<end; i += KERNELBENCH_PHASE_BATCH) {
+                size_t count = std::min(end - i, (size_t) KERNELBENCH_PHASE_BATCH);
+                for (size_t j=0; j<count; ++j)
+                    wo[j] = m_queries[(i + j) % m_queries.size()].wo;
+                m_phase->evalBatch(m_mRec, m_queries[i % m_queries.size()].wi,
+                    count, wo, values);
+                for (size_t j=0; j<count; ++j)
+                    result += values[j];
+            }
+            return result;
+        }
+
+        for (size_t i=start; i<end; ++i) {
+            const Query &query = m_queries[i % m_queries.size()];
+            if (kernel == 0) {
+                PhaseFunctionSamplingRecord pRec(m_mRec, query.wi);
+                result += m_phase->sample(pRec, sampler);
+            } else {
+                PhaseFunctionSamplingRecord pRec(m_mRec, query.wi, query.wo);
+                if (kernel == 1)
+                    result += m_phase->eval(pRec);
+                else
+                    result += m_phase->pdf(pRec);
+            }
+        }
+        return result;
+    }
+private:
+    struct Query {
+        Vector wi, wo;
+    };
+
+    ref<const Medium> m_medium;
+    ref<const PhaseFunction> m_phase;
+    MediumSamplingRecord m_mRec;
+    std::vector<Query> m_queries;
+};
+
+/// Kernels of a direct sampling subsurface model on the benchmark geometry
+class SubsurfaceKernels : public KernelSet {
+public:
+    SubsurfaceKernels(const Scene *scene, const DirectSamplingSubsurface *dss)
+        : m_scene(scene), m_dss(dss) {
+        m_extraSize = std::max(dss->extraParamsSize(), (size_t) 1);
+    }
+
+    std::vector<std::string> getKernels() const {
+        std::vector<std::string> result;
+        result.push_back("samplePointOnSurface");
+        result.push_back("pdfPointOnSurface");
+        result.push_back("sampleExtraParams");
+        result.push_back("sampleBssrdfDirection");
+        result.push_back("bssrdf");
+        return result;
+    }
+
+    void prepare(Random *random, Sampler *sampler) {
+        Spectrum throughput(1.0f);
+        m_queries.resize(KERNELBENCH_POOL_SIZE);
+        m_extraParams.resize(m_queries.size() * m_extraSize);
+
+        size_t failures = 0;
+        for (size_t i=0; i<m_queries.size(); ++i) {
+            Query &query = m_queries[i];
+            char *extraParams = &m_extraParams[i * m_extraSize];
+            bool success = false;
+
+            /* Only keep complete configurations, which are representative
+               of the queries made during rendering */
+            for (int attempt=0; attempt<100 && !success; ++attempt) {
+                sampleSurface(random, m_scene, query.its_out);
+                query.d_out = query.its_out.shFrame.toWorld(
+                    warp::squareToCosineHemisphere(
+                        Point2(random->nextFloat(), random->nextFloat())));
+                memset(extraParams, 0, m_extraSize);
+                success =
+                    m_dss->samplePointOnSurface(query.its_out, query.d_out,
+                        m_scene, query.its_in, throughput, sampler) != 0 &&
+                    !m_dss->sampleExtraParams(m_scene, query.its_out, query.d_out,
+                        query.its_in, NULL, throughput, extraParams, sampler).isZero() &&
+                    !m_dss->sampleBssrdfDirection(m_scene, query.its_out, query.d_out,
+                        query.its_in, query.d_in, extraParams, throughput,
+                        sampler).isZero();
+                if (!success)
+                    ++failures;
+            }
+            if (!success)
+                Log(EError, "Could not sample a valid BSSRDF configuration!");
+        }
+
+        if (failures > 0)
+            Log(EInfo, "Discarded " SIZE_T_FMT " invalid BSSRDF configurations "
+                "(%.1f%%)", failures, failures * 100.0f / (failures + m_queries.size()));
+    }
+
+    Float run(int kernel, size_t start, size_t end, Sampler *sampler) const {
+        Spectrum throughput(1.0f);
+        const Scene *scene = m_scene.get();
+        std::vector<char> scratch(m_extraSize);
+        Intersection its_in;
+        Vector d_in;
+        Float result = 0;
+
+        for (size_t i=start; i<end; ++i) {
+            size_t index = i % m_queries.size();
+            const Query &query = m_queries[index];
+            const char *extraParams = &m_extraParams[index * m_extraSize];
+            switch (kernel) {
+                case 0:
+                    result += m_dss->samplePointOnSurface(query.its_out,
+                        query.d_out, scene, its_in, throughput, sampler);
+                    break;
+                case 1:
+                    result += m_dss->pdfPointOnSurface(query.its_out,
+                        query.d_out, scene, query.its_in, throughput);
+                    break;
+                case 2:
+                    result += m_dss->sampleExtraParams(scene, query.its_out,
+                        query.d_out, query.its_in, NULL, throughput,
+                        &scratch[0], sampler)[0];
+                    break;
+                case 3:
+                    its_in = query.its_in;
+                    result += m_dss->sampleBssrdfDirection(scene, query.its_out,
+                        query.d_out, its_in, d_in, extraParams, throughput,
+                        sampler)[0];
+                    break;
+                default:
+                    result += m_dss->bssrdf(scene,
+                        query.its_in.p, query.d_in, query.its_in.shFrame.n,
+                        query.its_out.p, query.d_out, query.its_out.shFrame.n,
+                        extraParams)[0];
+            }
+        }
+        return result;
+    }
+private:
+    struct Query {
+        Intersection its_out, its_in;
+        Vector d_out, d_in;
+    };
+
+    ref<const Scene> m_scene;
+    ref<const DirectSamplingSubsurface> m_dss;
+    std::vector<Query> m_queries;
+    std::vector<char> m_extraParams;
+    size_t m_extraSize;
+};
+
+/**
+ * \brief Lookups of a 2D texture
+ *
+ * The queries use uniformly distributed UV coordinates and footprints
+ * of 1-64 texels with random orientations. The "grazing" kernel
+ * stretches the footprints 32 times along one axis, like lookups at
+ * grazing angles, which is where EWA filtering visits the most texels.
+ */
+class TextureKernels : public KernelSet {
+public:
+    TextureKernels(const Texture *texture) : m_texture(texture) { }
+
+    std::vector<std::string> getKernels() const {
+        std::vector<std::string> result;
+        result.push_back("unfiltered");
+        result.push_back("filtered");
+        result.push_back("grazing");
+        return result;
+    }
+
+    void prepare(Random *random, Sampler *sampler) {
+        Vector3i res = m_texture->getResolution();
+        Float texel = 1.0f / std::max(1, std::max(res.x, res.y));
+
+        m_queries.resize(KERNELBENCH_POOL_SIZE);
+        for (size_t i=0; i<m_queries.size(); ++i) {
+            Query &query = m_queries[i];
+            query.uv = Point2(random->nextFloat(), random->nextFloat());
+            Float radius = texel * std::pow((Float) 2, 6 * random->nextFloat());
+            Float sinPhi, cosPhi;
+            math::sincos(2 * M_PI * random->nextFloat(), &sinPhi, &cosPhi);
+            query.d0 = Vector2(cosPhi, sinPhi) * radius;
+            query.d1 = Vector2(-sinPhi, cosPhi) * radius;
+        }
+    }
+
+    Float run(int kernel, size_t start, size_t end, Sampler *sampler) const {
+        Intersection its;
+        its.hasUVPartials = true;
+        Float result = 0;
+        for (size_t i=start; i<end; ++i) {
+            const Query &query = m_queries[i % m_queries.size()];
+            its.uv = query.uv;
+            its.dudx = query.d0.x; its.dvdx = query.d0.y;
+            its.dudy = query.d1.x; its.dvdy = query.d1.y;
+            if (kernel == 2) {
+                its.dudx *= 32;
+                its.dvdx *= 32;
+            }
+            result += m_texture->eval(its, kernel != 0).average();
+        }
+        return result;
+    }
+private:
+    struct Query {
+        Point2 uv;
+        Vector2 d0, d1;
+    };
+
+    ref<const Texture> m_texture;
+    std::vector<Query> m_queries;
+};
+
+/**
+ * \brief Kernels of the \ref Spectrum arithmetic
+ *
+ * These don't depend on a scene and time the operations that dominate
+ * the cost of scattering models in spectral builds. Comparing builds
+ * with different \c SPECTRUM_SAMPLES or instruction sets shows the
+ * effect of the packet arithmetic in \ref TSpectrum.
+ */
+class SpectrumKernels : public KernelSet {
+public:
+    std::vector<std::string> getKernels() const {
+        std::vector<std::string> result;
+        result.push_back("arithmetic");
+        result.push_back("exp");
+        result.push_back("sqrt");
+        result.push_back("max");
+        result.push_back("isZero");
+        result.push_back("average");
+        return result;
+    }
+
+    void prepare(Random *random, Sampler *sampler) {
+        m_queries.resize(KERNELBENCH_POOL_SIZE);
+        for (size_t i=0; i<m_queries.size(); ++i) {
+            Query &query = m_queries[i];
+            for (int j=0; j<SPECTRUM_SAMPLES; ++j) {
+                query.a[j] = random->nextFloat();
+                query.b[j] = random->nextFloat() + 0.5f;
+            }
+            query.weight = random->nextFloat();
+        }
+    }
+
+    Float run(int kernel, size_t start, size_t end, Sampler *sampler) const {
+        Spectrum accum(0.0f);
+        Float result = 0;
+        for (size_t i=start; i<end; ++i) {
+            const Query &query = m_queries[i % m_queries.size()];
+            switch (kernel) {
+                case 0:
+                    accum += query.a * query.b / query.b - query.a * query.weight;
+                    accum.addWeighted(query.weight, query.b);
+                    break;
+                case 1: accum += (-query.a).exp(); break;
+                case 2: accum += query.b.sqrt(); break;
+                case 3: result += query.a.max(); break;
+                case 4: result += query.a.isZero() ? 0.0f : 1.0f; break;
+                default: result += query.a.average();
+            }
+        }
+        return result + accum[0];
+    }
+private:
+    struct Query {
+        Spectrum a, b;
+        Float weight;
+    };
+
+    std::vector<Query> m_queries;
+};
+
+/// Worker thread that runs one kernel on a contiguous range of queries
+class KernelThread : public Thread {
+public:
+    KernelThread(int id, const KernelSet *kernels, int kernel,
+            size_t start, size_t end, Sampler *sampler)
+        : Thread(formatString("bench%i", id)), m_kernels(kernels),
+          m_kernel(kernel), m_start(start), m_end(end), m_sampler(sampler),
+          m_result(0) { }
+
+    void run() {
+        m_result = m_kernels->run(m_kernel, m_start, m_end, m_sampler);
+    }
+
+    inline Float getResult() const { return m_result; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~KernelThread() { }
+private:
+    const KernelSet *m_kernels;
+    int m_kernel;
+    size_t m_start, m_end;
+    ref<Sampler> m_sampler;
+    Float m_result;
+};
+
+class KernelBench : public Utility {
+public:
+    void help() {
+        cout << endl;
+        cout << "Synopsis: Performance benchmark of the sampling and evaluation routines of" << endl;
+        cout << "a BSDF, phase function, direct sampling subsurface model or texture. The" << endl;
+        cout << "model is described by an XML file that contains a single <bsdf>, <phase>," << endl;
+        cout << "<subsurface> or <texture> element. Subsurface models and BSDFs are placed on" << endl;
+        cout << "a canonical geometry. Every kernel is called for a large number of randomized queries," << endl;
+        cout << "and the time per call and total throughput are reported per thread count." << endl;
+        cout << endl;
+        cout << "With -S, the Spectrum arithmetic of the current build is timed instead." << endl;
+        cout << endl;
+        cout << "Usage: mtsutil kernelbench [options] <XML file>" << endl;
+        cout << "       mtsutil kernelbench -S [options]" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -g sphere/slab Benchmark geometry (default: sphere)" << endl << endl;
+        cout << "   -r size        Radius of the sphere, or thickness of the slab (default: 1)" << endl << endl;
+        cout << "   -k list        Comma-separated kernels to time (default: all)" << endl << endl;
+        cout << "   -n list        Comma-separated thread counts (default: 1)" << endl << endl;
+        cout << "   -N count       Number of calls per kernel (default: 1000000)" << endl << endl;
+        cout << "   -S             Time the Spectrum arithmetic instead of a model" << endl << endl;
+        cout << "   -D key=val     Define a constant, which can referenced as \"$key\" in the XML" << endl << endl;
+        cout << "   -j file        Write the results as JSON to a file (\"-\" for stdout)" << endl << endl;
+        cout << "Example:" << endl;
+        cout << "  $ cat skin.xml" << endl;
+        cout << "  <subsurface type=\"fwddip\">" << endl;
+        cout << "      <string name=\"material\" value=\"skin1\"/>" << endl;
+        cout << "  </subsurface>" << endl;
+        cout << "  $ mtsutil kernelbench -g slab -r 10 -n 1,4 skin.xml" << endl;
+        cout << "  $ cat tex.xml" << endl;
+        cout << "  <texture type=\"bitmap\">" << endl;
+        cout << "      <string name=\"filename\" value=\"wood.exr\"/>" << endl;
+        cout << "  </texture>" << endl;
+        cout << "  $ mtsutil kernelbench -k filtered,grazing tex.xml" << endl << endl;
+    }
+
+    int run(int argc, char **argv) {
+        ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver();
+        ParameterMap parameters;
+        int optchar;
+        char *end_ptr = NULL;
+        std::string geometry = "sphere", jsonFilename;
+        std::vector<std::string> kernelNames;
+        std::vector<int> threadCounts(1, 1);
+        size_t nCalls = 1000000;
+        bool spectrumKernels = false;
+        Float size = 1;
+        optind = 1;
+
+        /* Parse command-line arguments */
+        while ((optchar = getopt(argc, argv, "g:r:k:n:N:SD:j:h")) != -1) {
+            switch (optchar) {
+                case 'g':
+                    geometry = boost::to_lower_copy(std::string(optarg));
+                    if (geometry != "sphere" && geometry != "slab")
+                        SLog(EError, "Unknown geometry \"%s\"!", optarg);
+                    break;
+                case 'r':
+                    size = (Float) strtod(optarg, &end_ptr);
+                    if (*end_ptr != '\0' || size <= 0)
+                        SLog(EError, "Could not parse the geometry size!");
+                    break;
+                case 'k':
+                    kernelNames = tokenize(optarg, ",");
+                    break;
+                case 'n': {
+                        threadCounts.clear();
+                        std::vector<std::string> tokens = tokenize(optarg, ",");
+                        for (size_t i=0; i<tokens.size(); ++i) {
+                            int count = strtol(tokens[i].c_str(), &end_ptr, 10);
+                            if (*end_ptr != '\0' || count <= 0)
+                                SLog(EError, "Could not parse the thread counts!");
+                            threadCounts.push_back(count);
+                        }
+                        if (threadCounts.empty())
+                            SLog(EError, "Could not parse the thread counts!");
+                    }
+                    break;
+                case 'N': {
+                        long long count = strtoll(optarg, &end_ptr, 10);
+                        if (*end_ptr != '\0' || count <= 0)
+                            SLog(EError, "Could not parse the call count!");
+                        nCalls = (size_t) count;
+                    }
+                    break;
+                case 'S':
+                    spectrumKernels = true;
+                    break;
+                case 'D': {
+                        std::vector<std::string> param = tokenize(optarg, "=");
+                        if (param.size() != 2)
+                            SLog(EError, "Invalid parameter specification \"%s\"", optarg);
+                        parameters[param[0]] = param[1];
+                    }
+                    break;
+                case 'j':
+                    jsonFilename = optarg;
+                    break;
+                case 'h':
+                default:
+                    help();
+                    return 0;
+            };
+        }
+
+        ref<KernelSet> kernels;
+        std::string modelName, kind;
+        if (spectrumKernels) {
+            if (optind != argc) {
+                help();
+                return 0;
+            }
+            kernels = new SpectrumKernels();
+            modelName = formatString("Spectrum[%i]", SPECTRUM_SAMPLES);
+            kind = "spectrum";
+            geometry = "none";
+        } else {
+            if (optind == argc || optind+1 < argc) {
+                help();
+                return 0;
+            }
+
+            /* Load the model description and place it on the benchmark geometry */
+            fs::path filename = fileResolver->resolve(argv[optind]);
+            fs::ifstream is(filename);
+            if (!is.good())
+                Log(EError, "Could not open \"%s\"!", filename.string().c_str());
+            std::string element((std::istreambuf_iterator<char>(is)),
+                std::istreambuf_iterator<char>());
+            kind = getElementName(element);
+
+            ref<FileResolver> frClone = fileResolver->clone();
+            frClone->prependPath(fs::absolute(filename).parent_path());
+            Thread::getThread()->setFileResolver(frClone);
+
+            std::ostringstream xml;
+            xml << "<scene version=\"" MTS_VERSION "\">" << endl;
+            if (kind == "texture") {
+                /* Textures are looked up directly, without any geometry */
+                xml << element << endl << "</scene>" << endl;
+                ref<Scene> scene = loadSceneFromString(xml.str(), parameters);
+                const ref_vector<ConfigurableObject> &objects = scene->getReferencedObjects();
+                for (size_t i=0; i<objects.size() && !kernels; ++i) {
+                    if (objects[i]->getClass()->derivesFrom(MTS_CLASS(Texture))) {
+                        kernels = new TextureKernels(static_cast<const Texture *>(objects[i].get()));
+                        modelName = objects[i]->getClass()->getName();
+                    }
+                }
+                if (!kernels)
+                    Log(EError, "Could not instantiate the texture!");
+                geometry = "none";
+            } else {
+                if (geometry == "sphere") {
+                    xml << "<shape type=\"sphere\"><float name=\"radius\" value=\""
+                        << size << "\"/>" << endl;
+                } else {
+                    /* Wide enough that the boundary hardly matters */
+                    xml << "<shape type=\"cube\"><transform name=\"toWorld\">"
+                        << "<scale x=\"" << 50 * size << "\" y=\"" << 50 * size
+                        << "\" z=\"" << 0.5f * size << "\"/></transform>" << endl;
+                }
+                if (kind == "phase")
+                    xml << "<medium type=\"homogeneous\" name=\"interior\">" << element
+                        << "</medium>" << endl;
+                else
+                    xml << element << endl;
+                xml << "</shape>" << endl << "</scene>" << endl;
+
+                ref<Scene> scene = loadSceneFromString(xml.str(), parameters);
+                scene->initialize();
+                const Shape *shape = scene->getShapes()[0].get();
+
+                if (kind == "bsdf") {
+                    kernels = new BSDFKernels(scene, shape->getBSDF());
+                    modelName = shape->getBSDF()->getClass()->getName();
+                } else if (kind == "phase") {
+                    kernels = new PhaseKernels(shape->getInteriorMedium());
+                    modelName = shape->getInteriorMedium()->getPhaseFunction()->getClass()->getName();
+                } else if (kind == "subsurface") {
+                    const Subsurface *subsurface = shape->getSubsurface();
+                    if (!subsurface->getClass()->derivesFrom(MTS_CLASS(DirectSamplingSubsurface)))
+                        Log(EError, "Only direct sampling subsurface models can be benchmarked!");
+                    kernels = new SubsurfaceKernels(scene,
+                        static_cast<const DirectSamplingSubsurface *>(subsurface));
+                    modelName = subsurface->getClass()->getName();
+                } else {
+                    Log(EError, "The XML file must contain a single <bsdf>, <phase>, "
+                        "<subsurface> or <texture> element!");
+                }
+            }
+        }
+
+        /* Determine the kernels to be timed */
+        std::vector<std::string> available = kernels->getKernels();
+        std::vector<int> selected;
+        if (kernelNames.empty() || (kernelNames.size() == 1 && kernelNames[0] == "all")) {
+            for (size_t i=0; i<available.size(); ++i)
+                selected.push_back((int) i);
+        } else {
+            for (size_t i=0; i<kernelNames.size(); ++i) {
+                std::vector<std::string>::iterator it = std::find(
+                    available.begin(), available.end(), kernelNames[i]);
+                if (it == available.end())
+                    Log(EError, "Unknown kernel \"%s\" (available: %s)",
+                        kernelNames[i].c_str(), boost::join(available, ", ").c_str());
+                selected.push_back((int) (it - available.begin()));
+            }
+        }
+
+        ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+            createObject(MTS_CLASS(Sampler), Properties("independent")));
+        ref<Random> random = new Random();
+
+        ref<Timer> timer = new Timer();
+        kernels->prepare(random, sampler);
+        Log(EInfo, "Prepared %i queries for %s (%s) in %i ms", KERNELBENCH_POOL_SIZE,
+            modelName.c_str(), kind.c_str(), timer->getMilliseconds());
+
+        std::ostringstream json;
+        json << "{" << endl
+             << "  \"model\": \"" << modelName << "\"," << endl
+             << "  \"kind\": \"" << kind << "\"," << endl
+             << "  \"geometry\": \"" << geometry << "\"," << endl
+             << "  \"calls\": " << nCalls << "," << endl
+             << "  \"spectrumSamples\": " << SPECTRUM_SAMPLES << "," << endl
+             << "  \"packetWidth\": " << (int) Spectrum::Packet::Width << "," << endl
+             << "  \"cpuFeatures\": \"" << getCPUFeatureString() << "\"," << endl
+             << "  \"results\": [";
+        bool first = true;
+
+        for (size_t k=0; k<selected.size(); ++k) {
+            const std::string &name = available[selected[k]];
+            for (size_t t=0; t<threadCounts.size(); ++t) {
+                int nThreads = threadCounts[t];
+                Float best = std::numeric_limits<Float>::infinity(), checksum = 0;
+                for (int j=0; j<3; ++j) {
+                    timer->reset();
+                    checksum = runParallel(kernels, selected[k], nCalls,
+                        nThreads, sampler);
+                    best = std::min(best, (Float) (timer->getNanoseconds() * 1e-9));
+                }
+
+                /* Cost of a single call on one thread, and overall throughput */
+                Float nsPerCall = best * 1e9f * nThreads / nCalls;
+                Float mcallsPerSecond = nCalls / (best * 1e6f);
+                Log(EInfo, "%-22s %2i thread%s: %10.1f ns/call, %9.3f MCalls/s "
+                    "(checksum %g)", name.c_str(), nThreads, nThreads > 1 ? "s" : " ",
+                    nsPerCall, mcallsPerSecond, checksum);
+
+                json << (first ? "" : ",") << endl
+                     << "    { \"kernel\": \"" << name << "\", "
+                     << "\"threads\": " << nThreads << ", "
+                     << "\"nsPerCall\": " << nsPerCall << ", "
+                     << "\"mcallsPerSecond\": " << mcallsPerSecond << " }";
+                first = false;
+            }
+        }
+        json << endl << "  ]" << endl << "}" << endl;
+
+        if (jsonFilename == "-") {
+            cout << json.str();
+        } else if (!jsonFilename.empty()) {
+            std::ofstream os(jsonFilename.c_str());
+            os << json.str();
+            if (os.fail())
+                Log(EError, "Could not write the JSON results to \"%s\"!",
+                    jsonFilename.c_str());
+            Log(EInfo, "Wrote the results to \"%s\"", jsonFilename.c_str());
+        }
+
+        return 0;
+    }
+
+    /// Return the name of the first XML element in a string
+    static std::string getElementName(const std::string &xml) {
+        size_t pos = 0;
+        while ((pos = xml.find('<', pos)) != std::string::npos) {
+            if (pos + 1 < xml.length() && (xml[pos+1] == '?' || xml[pos+1] == '!')) {
+                ++pos;
+                continue;
+            }
+            size_t end = xml.find_first_of(" \t\r\n/>", pos + 1);
+            if (end == std::string::npos)
+                break;
+            return xml.substr(pos + 1, end - pos - 1);
+        }
+        return "";
+    }
+
+    /// Run a kernel for the given number of calls split evenly over several threads
+    Float runParallel(const KernelSet *kernels, int kernel, size_t nCalls,
+            int nThreads, Sampler *sampler) {
+        if (nThreads == 1)
+            return kernels->run(kernel, 0, nCalls, sampler);
+
+        ref_vector<KernelThread> threads;
+        size_t chunkSize = (nCalls + nThreads - 1) / nThreads;
+        for (int i=0; i<nThreads; ++i) {
+            size_t start = std::min(nCalls, i * chunkSize),
+                   end = std::min(nCalls, start + chunkSize);
+            threads.push_back(new KernelThread(i, kernels, kernel,
+                start, end, sampler->clone()));
+            threads[i]->start();
+        }
+        Float result = 0;
+        for (int i=0; i<nThreads; ++i) {
+            threads[i]->join();
+            result += threads[i]->getResult();
+        }
+        return result;
+    }
+
+    MTS_DECLARE_UTILITY()
+};
+
+MTS_IMPLEMENT_CLASS(KernelSet, true, Object)
+MTS_IMPLEMENT_CLASS(KernelThread, false, Thread)
+MTS_EXPORT_UTILITY(KernelBench, "Sampling and evaluation kernel benchmark")
+MTS_NAMESPACE_END
@@ -0,0 +1,189 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/scene.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/version.h>
+#include <mitsuba/core/mstream.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class ParseBench : public Utility {
+public:
+    void help() {
+        cout << endl;
+        cout << "Synopsis: Scene parsing benchmark. Measures the time that is spent on parsing" << endl;
+        cout << "a scene description and constructing its objects (excluding the acceleration" << endl;
+        cout << "data structures). By default, a synthetic scene with a large number of" << endl;
+        cout << "instanced shapes is used. In addition, the property record operations that a" << endl;
+        cout << "typical plugin constructor performs are timed in isolation. Finally, the" << endl;
+        cout << "scene is serialized into a memory stream as for network rendering." << endl;
+        cout << endl;
+        cout << "Usage: mtsutil parsebench [options] [Scene XML file]" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -n count       Number of instances in the synthetic scene (default: 100000)" << endl << endl;
+        cout << "   -r count       Number of repetitions (default: 3)" << endl << endl;
+        cout << "   -D key=val     Define a constant, which can referenced as \"$key\" in the XML" << endl << endl;
+    }
+
+    /// Synthetic scene: one shape group, referenced by many instances
+    std::string generateScene(size_t instanceCount) {
+        std::ostringstream xml;
+        xml << "<scene version=\"" MTS_VERSION "\">" << endl
+            << "<shape type=\"shapegroup\" id=\"group\">" << endl
+            << "<shape type=\"sphere\"><float name=\"radius\" value=\"0.25\"/>"
+            << "<bsdf type=\"diffuse\"><rgb name=\"reflectance\" value=\"0.5 0.4 0.3\"/>"
+            << "</bsdf></shape>" << endl
+            << "</shape>" << endl;
+        int side = std::max(1, (int) std::ceil(std::sqrt((Float) instanceCount)));
+        for (size_t i=0; i<instanceCount; ++i) {
+            xml << "<shape type=\"instance\"><ref id=\"group\"/>"
+                << "<transform name=\"toWorld\"><rotate y=\"1\" angle=\"" << (i % 360)
+                << "\"/><translate x=\"" << (int) (i % side) << "\" y=\"0\" z=\""
+                << (int) (i / side) << "\"/></transform></shape>" << endl;
+        }
+        xml << "</scene>" << endl;
+        return xml.str();
+    }
+
+    /// Mimics the property accesses of a shape constructor
+    void benchmarkProperties(size_t count, int repetitions) {
+        const char *names[] = { "toWorld", "radius", "center", "flipNormals",
+            "faceNormals", "maxSmoothAngle", "filename", "shapeIndex",
+            "reflectance", "alpha", "intIOR", "extIOR" };
+        const int nameCount = (int) (sizeof(names) / sizeof(names[0]));
+        std::vector<std::string> keys(names, names + nameCount);
+
+        for (int rep=0; rep<repetitions; ++rep) {
+            ref<Timer> timer = new Timer();
+            size_t checksum = 0;
+            for (size_t i=0; i<count; ++i) {
+                Properties props("sphere");
+                props.setTransform(keys[0], Transform::translate(Vector((Float) i, 0, 0)));
+                props.setFloat(keys[1], 1.0f);
+                props.setPoint(keys[2], Point(0.0f));
+                props.setBoolean(keys[3], false);
+                props.setString(keys[6], "mesh.obj");
+
+                Properties copy(props);
+                for (int j=0; j<nameCount; ++j) {
+                    if (copy.hasProperty(keys[j]))
+                        copy.markQueried(keys[j]);
+                }
+                checksum += copy.getBoolean("faceNormals", false) ? 1 : 0;
+                checksum += (size_t) copy.getFloat("maxSmoothAngle", 0.0f);
+                checksum += (size_t) copy.getFloat(keys[1]);
+                checksum += copy.getUnqueried().size();
+            }
+            Log(EInfo, "Properties: %i construction sequences in %i ms (checksum %i)",
+                (int) count, timer->getMilliseconds(), (int) checksum);
+        }
+    }
+
+    /// Serializes a scene the way it is sent to network rendering nodes
+    void benchmarkSerialization(Scene *scene, int repetitions) {
+        scene->initialize();
+        ref<MemoryStream> stream = new MemoryStream();
+        for (int rep=0; rep<repetitions; ++rep) {
+            stream->reset();
+            ref<Timer> timer = new Timer();
+            ref<InstanceManager> manager = new InstanceManager();
+            manager->serialize(stream, scene);
+            unsigned int serializeTime = timer->getMilliseconds();
+            Log(EInfo, "Serialization: wrote %s in %i ms (%.1f MiB/s)",
+                memString(stream->getSize()).c_str(), serializeTime,
+                stream->getSize() / (1024.0 * 1024.0) / std::max(1e-3, serializeTime * 1e-3));
+        }
+    }
+
+    int run(int argc, char **argv) {
+        ParameterMap parameters;
+        int optchar;
+        char *end_ptr = NULL;
+        size_t instanceCount = 100000;
+        int repetitions = 3;
+        optind = 1;
+
+        /* Parse command-line arguments */
+        while ((optchar = getopt(argc, argv, "n:r:D:h")) != -1) {
+            switch (optchar) {
+                case 'n': {
+                        long long count = strtoll(optarg, &end_ptr, 10);
+                        if (*end_ptr != '\0' || count <= 0)
+                            SLog(EError, "Could not parse the instance count!");
+                        instanceCount = (size_t) count;
+                    }
+                    break;
+                case 'r':
+                    repetitions = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || repetitions <= 0)
+                        SLog(EError, "Could not parse the repetition count!");
+                    break;
+                case 'D': {
+                        std::vector<std::string> param = tokenize(optarg, "=");
+                        if (param.size() != 2)
+                            SLog(EError, "Invalid parameter specification \"%s\"", optarg);
+                        parameters[param[0]] = param[1];
+                    }
+                    break;
+                case 'h':
+                default:
+                    help();
+                    return 0;
+            }
+        }
+
+        benchmarkProperties(instanceCount, repetitions);
+
+        std::string xml;
+        fs::path filename;
+        if (optind < argc)
+            filename = Thread::getThread()->getFileResolver()->resolve(argv[optind]);
+        else
+            xml = generateScene(instanceCount);
+
+        for (int rep=0; rep<repetitions; ++rep) {
+            ref<Timer> timer = new Timer();
+            ref<Scene> scene = filename.empty() ? loadSceneFromString(xml, parameters)
+                : loadScene(filename, parameters);
+            unsigned int parseTime = timer->getMilliseconds();
+            size_t shapeCount = scene->getShapes().size();
+            timer->reset();
+            scene = NULL;
+            Log(EInfo, "Scene: parsed %i shapes in %i ms (%.2f us/shape), released in %i ms",
+                (int) shapeCount, parseTime, 1000.0 * parseTime / std::max((size_t) 1, shapeCount),
+                timer->getMilliseconds());
+        }
+
+        benchmarkSerialization(filename.empty() ? loadSceneFromString(xml, parameters)
+            : loadScene(filename, parameters), repetitions);
+
+        return 0;
+    }
+
+    MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(ParseBench, "Scene parsing benchmark")
+MTS_NAMESPACE_END
@@ -0,0 +1,506 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/scene.h>
+#include <mitsuba/render/renderjob.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/sched.h>
+#include <mitsuba/core/version.h>
+#include <boost/algorithm/string.hpp>
+#include <fstream>
+#include <iomanip>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+/// Interval, at which the memory usage is polled while rendering (in ms)
+#define PERFSUITE_MEMORY_POLL_INTERVAL 10
+
+MTS_NAMESPACE_BEGIN
+
+/// Reference scenes in \c data/tests, stored as <tt>perf_[name].xml</tt>
+static const char *perfSceneNames[] = {
+    "path", "volpath", "fwddip", "dipole", "sppm", "pssmlt", "texture"
+};
+
+/// Polls the private memory usage of the process to find its peak
+class MemoryMonitor : public Thread {
+public:
+    MemoryMonitor() : Thread("memmon"), m_peak(0), m_stop(false) { }
+
+    void run() {
+        while (!m_stop) {
+            m_peak = std::max(m_peak, getPrivateMemoryUsage());
+            sleep(PERFSUITE_MEMORY_POLL_INTERVAL);
+        }
+    }
+
+    /// Stop polling and return the peak memory usage in bytes
+    size_t finish() {
+        m_stop = true;
+        join();
+        return std::max(m_peak, getPrivateMemoryUsage());
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~MemoryMonitor() { }
+private:
+    size_t m_peak;
+    volatile bool m_stop;
+};
+
+/**
+ * \brief Minimal reader for the JSON documents written by this utility
+ *
+ * All numbers are collected into a flat map, whose keys are the names
+ * of the enclosing objects joined by newline characters. Strings, booleans
+ * and arrays are skipped.
+ */
+class BaselineReader {
+public:
+    typedef std::map<std::string, double> ValueMap;
+
+    BaselineReader(const std::string &str) : m_str(str), m_pos(0) { }
+
+    ValueMap read() {
+        ValueMap result;
+        parseValue("", result);
+        skipWhitespace();
+        if (m_pos != m_str.length())
+            error("trailing characters");
+        return result;
+    }
+private:
+    void parseValue(const std::string &key, ValueMap &result) {
+        skipWhitespace();
+        if (m_pos >= m_str.length())
+            error("unexpected end of file");
+        char c = m_str[m_pos];
+        if (c == '{') {
+            ++m_pos;
+            skipWhitespace();
+            if (peek() == '}') {
+                ++m_pos;
+                return;
+            }
+            while (true) {
+                skipWhitespace();
+                std::string name = parseString();
+                skipWhitespace();
+                expect(':');
+                parseValue(key.empty() ? name : key + "\n" + name, result);
+                skipWhitespace();
+                if (peek() == ',') {
+                    ++m_pos;
+                } else {
+                    expect('}');
+                    break;
+                }
+            }
+        } else if (c == '[') {
+            ++m_pos;
+            skipWhitespace();
+            if (peek() == ']') {
+                ++m_pos;
+                return;
+            }
+            ValueMap ignored;
+            while (true) {
+                parseValue("", ignored);
+                skipWhitespace();
+                if (peek() == ',') {
+                    ++m_pos;
+                } else {
+                    expect(']');
+                    break;
+                }
+            }
+        } else if (c == '"') {
+            parseString();
+        } else if (m_str.compare(m_pos, 4, "true") == 0 ||
+                   m_str.compare(m_pos, 4, "null") == 0) {
+            m_pos += 4;
+        } else if (m_str.compare(m_pos, 5, "false") == 0) {
+            m_pos += 5;
+        } else {
+            const char *start = m_str.c_str() + m_pos;
+            char *end = NULL;
+            double value = strtod(start, &end);
+            if (end == start)
+                error("invalid value");
+            m_pos += end - start;
+            result[key] = value;
+        }
+    }
+
+    std::string parseString() {
+        expect('"');
+        std::string result;
+        while (m_pos < m_str.length() && m_str[m_pos] != '"') {
+            if (m_str[m_pos] == '\\' && m_pos + 1 < m_str.length())
+                ++m_pos;
+            result += m_str[m_pos++];
+        }
+        expect('"');
+        return result;
+    }
+
+    void skipWhitespace() {
+        while (m_pos < m_str.length() && isspace((unsigned char) m_str[m_pos]))
+            ++m_pos;
+    }
+
+    char peek() const {
+        return m_pos < m_str.length() ? m_str[m_pos] : '\0';
+    }
+
+    void expect(char c) {
+        if (peek() != c)
+            error(formatString("expected '%c'", c));
+        ++m_pos;
+    }
+
+    void error(const std::string &msg) const {
+        SLog(EError, "Could not parse the baseline: %s (at offset " SIZE_T_FMT ")",
+            msg.c_str(), m_pos);
+    }
+private:
+    const std::string &m_str;
+    size_t m_pos;
+};
+
+class PerfSuite : public Utility {
+public:
+    /// Measurements of one reference scene
+    struct Result {
+        std::string name;
+        unsigned int loadTime;
+        unsigned int renderTime;
+        double samples;
+        size_t peakMemory;
+        bool success;
+        std::vector<std::pair<std::string, double> > counters;
+    };
+
+    void help() {
+        cout << endl;
+        cout << "Synopsis: Render performance regression suite. Renders a set of small" << endl;
+        cout << "reference scenes at a fixed sample budget and records the wall-clock time," << endl;
+        cout << "the number of pixel samples per second, the peak memory usage and the values" << endl;
+        cout << "of all statistics counters. The results can be stored as a JSON baseline and" << endl;
+        cout << "compared against a previously stored baseline. When comparing, the exit code" << endl;
+        cout << "is nonzero if any scene became slower or uses more memory than allowed." << endl;
+        cout << endl;
+        cout << "Usage: mtsutil perfsuite [options] [Scene XML files]" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -s list        Comma-separated subset of the reference scenes in" << endl;
+        cout << "                  data/tests to render, or \"none\" (default: all of" << endl;
+        cout << "                  path, volpath, fwddip, dipole, sppm, pssmlt, texture)" << endl << endl;
+        cout << "   -r count       Number of repetitions, the fastest one is kept (default: 1)" << endl << endl;
+        cout << "   -o file        Write the results as JSON to a file (\"-\" for stdout)" << endl << endl;
+        cout << "   -b file        Compare the results against a baseline JSON file" << endl << endl;
+        cout << "   -t value       Relative tolerance of the comparison (default: 0.1)" << endl << endl;
+        cout << "   -D key=val     Define a constant, which can referenced as \"$key\" in the XML" << endl << endl;
+        cout << "Additional scene files given on the command line are rendered after the" << endl;
+        cout << "reference scenes and identified by their file name without extension." << endl << endl;
+        cout << "Examples:" << endl;
+        cout << "  Record a baseline, then check another build against it:" << endl << endl;
+        cout << "  $ mtsutil perfsuite -o baseline.json" << endl;
+        cout << "  $ mtsutil perfsuite -b baseline.json -o current.json" << endl << endl;
+        cout << "  Note that timings are only comparable on the same machine and with the" << endl;
+        cout << "  same number of worker threads." << endl << endl;
+    }
+
+    /// Load and render one scene and collect its measurements
+    Result render(const std::string &name, const fs::path &path,
+            const ParameterMap &parameters) {
+        FileResolver *fileResolver = Thread::getThread()->getFileResolver();
+        fs::path filename = fileResolver->resolve(path);
+        if (!fs::exists(filename))
+            Log(EError, "Scene file \"%s\" does not exist!", path.string().c_str());
+
+        /* Resolve references relative to the scene file */
+        ref<FileResolver> frClone = fileResolver->clone();
+        frClone->prependPath(fs::absolute(filename).parent_path());
+        Thread::getThread()->setFileResolver(frClone);
+
+        Result result;
+        result.name = name;
+
+        Statistics::getInstance()->resetAll();
+        ref<MemoryMonitor> monitor = new MemoryMonitor();
+        monitor->start();
+
+        Log(EInfo, "Rendering \"%s\" ..", filename.string().c_str());
+        ref<Timer> timer = new Timer();
+        ref<Scene> scene = loadScene(filename, parameters);
+        result.loadTime = timer->getMilliseconds();
+
+        /* Develop the film without writing an output file */
+        scene->setDestinationFile(fs::path());
+        const Film *film = scene->getFilm();
+        result.samples = (double) film->getCropSize().x * film->getCropSize().y
+            * scene->getSampler()->getSampleCount();
+
+        timer->reset();
+        ref<RenderQueue> queue = new RenderQueue();
+        ref<RenderJob> job = new RenderJob("perf", scene, queue);
+        job->start();
+        result.success = job->wait();
+        queue->join();
+        result.renderTime = std::max(timer->getMilliseconds(), 1u);
+        result.peakMemory = monitor->finish();
+
+        std::vector<const StatsCounter *> counters =
+            Statistics::getInstance()->getCounters();
+        for (size_t i=0; i<counters.size(); ++i) {
+            const StatsCounter *counter = counters[i];
+            std::string key = counter->getCategory() + ": " + counter->getName();
+            double value;
+            if (counter->getType() == EMinimumValue)
+                value = (double) counter->getMinimum();
+            else if (counter->getType() == EMaximumValue)
+                value = (double) counter->getMaximum();
+            else
+                value = (double) counter->getValue();
+            double base = (double) counter->getBase();
+            if (value == 0 && base == 0)
+                continue;
+            result.counters.push_back(std::make_pair(key, value));
+            if (base != 0)
+                result.counters.push_back(std::make_pair(key + " (base)", base));
+        }
+
+        Thread::getThread()->setFileResolver(fileResolver);
+
+        Log(EInfo, "\"%s\": loaded in %i ms, rendered in %i ms (%.3f MSamples/s), "
+            "peak memory %s%s", name.c_str(), result.loadTime, result.renderTime,
+            result.samples / (result.renderTime * 1000.0),
+            memString(result.peakMemory).c_str(), result.success ? "" : " (cancelled)");
+        return result;
+    }
+
+    /// Compare against a baseline and return the number of regressions
+    int compare(const std::vector<Result> &results,
+            const BaselineReader::ValueMap &baseline, Float tolerance) {
+        int regressions = 0;
+        for (size_t i=0; i<results.size(); ++i) {
+            const Result &result = results[i];
+            std::string prefix = "scenes\n" + result.name + "\n";
+            BaselineReader::ValueMap::const_iterator timeIt =
+                baseline.find(prefix + "renderTimeMs");
+            BaselineReader::ValueMap::const_iterator memIt =
+                baseline.find(prefix + "peakMemory");
+            if (timeIt == baseline.end()) {
+                Log(EWarn, "\"%s\": not contained in the baseline", result.name.c_str());
+                continue;
+            }
+
+            double timeRatio = result.renderTime / std::max(timeIt->second, 1.0);
+            bool slower = timeRatio > 1 + tolerance;
+            ELogLevel level = slower ? EWarn : EInfo;
+            Log(level, "\"%s\": render time %i ms vs. %.0f ms "
+                "in the baseline (%+.1f%%)%s", result.name.c_str(), result.renderTime,
+                timeIt->second, (timeRatio - 1) * 100, slower ? " -- REGRESSION" : "");
+            regressions += slower ? 1 : 0;
+
+            if (memIt != baseline.end() && memIt->second > 0) {
+                double memRatio = result.peakMemory / memIt->second;
+                bool larger = memRatio > 1 + tolerance;
+                level = larger ? EWarn : EInfo;
+                Log(level, "\"%s\": peak memory %s vs. %s in the "
+                    "baseline (%+.1f%%)%s", result.name.c_str(),
+                    memString(result.peakMemory).c_str(),
+                    memString((size_t) memIt->second).c_str(),
+                    (memRatio - 1) * 100, larger ? " -- REGRESSION" : "");
+                regressions += larger ? 1 : 0;
+            }
+
+            /* Counter changes indicate a different workload, e.g. due to
+               altered sampling, and are reported without failing */
+            for (size_t j=0; j<result.counters.size(); ++j) {
+                BaselineReader::ValueMap::const_iterator it =
+                    baseline.find(prefix + "counters\n" + result.counters[j].first);
+                double value = result.counters[j].second;
+                double reference = it == baseline.end() ? 0 : it->second;
+                if (std::abs(value - reference) > tolerance * std::abs(reference))
+                    Log(EInfo, "\"%s\": counter \"%s\" changed from %.6g to %.6g",
+                        result.name.c_str(), result.counters[j].first.c_str(),
+                        reference, value);
+            }
+        }
+        return regressions;
+    }
+
+    /// Serialize the results into a JSON document
+    std::string toJSON(const std::vector<Result> &results) {
+        std::ostringstream json;
+        json << "{" << endl
+             << "  \"version\": \"" MTS_VERSION "\"," << endl
+             << "  \"host\": \"" << escapeJSON(getHostName()) << "\"," << endl
+             << "  \"cores\": " << Scheduler::getInstance()->getCoreCount() << "," << endl
+             << "  \"processPeakMemory\": " << getPeakMemoryUsage() << "," << endl
+             << "  \"scenes\": {";
+        for (size_t i=0; i<results.size(); ++i) {
+            const Result &result = results[i];
+            json << (i == 0 ? "" : ",") << endl
+                 << "    \"" << escapeJSON(result.name) << "\": {" << endl
+                 << "      \"success\": " << (result.success ? "true" : "false") << "," << endl
+                 << "      \"loadTimeMs\": " << result.loadTime << "," << endl
+                 << "      \"renderTimeMs\": " << result.renderTime << "," << endl
+                 << "      \"samples\": " << (size_t) result.samples << "," << endl
+                 << "      \"samplesPerSecond\": "
+                 << (size_t) (result.samples * 1000.0 / result.renderTime) << "," << endl
+                 << "      \"peakMemory\": " << result.peakMemory << "," << endl
+                 << "      \"counters\": {";
+            for (size_t j=0; j<result.counters.size(); ++j)
+                json << (j == 0 ? "" : ",") << endl << "        \""
+                     << escapeJSON(result.counters[j].first) << "\": "
+                     << std::setprecision(17) << result.counters[j].second;
+            json << endl << "      }" << endl << "    }";
+        }
+        json << endl << "  }" << endl << "}" << endl;
+        return json.str();
+    }
+
+    int run(int argc, char **argv) {
+        ParameterMap parameters;
+        int optchar;
+        char *end_ptr = NULL;
+        int repetitions = 1;
+        Float tolerance = 0.1f;
+        std::string outputFilename, baselineFilename;
+        std::vector<std::string> sceneNames(perfSceneNames, perfSceneNames
+            + sizeof(perfSceneNames) / sizeof(perfSceneNames[0]));
+        optind = 1;
+
+        /* Parse command-line arguments */
+        while ((optchar = getopt(argc, argv, "s:r:o:b:t:D:h")) != -1) {
+            switch (optchar) {
+                case 's':
+                    sceneNames = tokenize(boost::to_lower_copy(std::string(optarg)), ",");
+                    if (sceneNames.size() == 1 && sceneNames[0] == "none")
+                        sceneNames.clear();
+                    break;
+                case 'r':
+                    repetitions = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || repetitions <= 0)
+                        SLog(EError, "Could not parse the repetition count!");
+                    break;
+                case 'o':
+                    outputFilename = optarg;
+                    break;
+                case 'b':
+                    baselineFilename = optarg;
+                    break;
+                case 't':
+                    tolerance = (Float) strtod(optarg, &end_ptr);
+                    if (*end_ptr != '\0' || tolerance < 0)
+                        SLog(EError, "Could not parse the tolerance!");
+                    break;
+                case 'D': {
+                        std::vector<std::string> param = tokenize(optarg, "=");
+                        if (param.size() != 2)
+                            SLog(EError, "Invalid parameter specification \"%s\"", optarg);
+                        parameters[param[0]] = param[1];
+                    }
+                    break;
+                case 'h':
+                default:
+                    help();
+                    return 0;
+            }
+        }
+
+        std::vector<std::pair<std::string, fs::path> > scenes;
+        for (size_t i=0; i<sceneNames.size(); ++i)
+            scenes.push_back(std::make_pair(sceneNames[i],
+                fs::path("data/tests") / ("perf_" + sceneNames[i] + ".xml")));
+        for (int i=optind; i<argc; ++i)
+            scenes.push_back(std::make_pair(fs::path(argv[i]).stem().string(),
+                fs::path(argv[i])));
+        if (scenes.empty())
+            SLog(EError, "No scenes were specified!");
+
+        std::vector<Result> results;
+        for (size_t i=0; i<scenes.size(); ++i) {
+            Result best;
+            for (int rep=0; rep<repetitions; ++rep) {
+                Result result = render(scenes[i].first, scenes[i].second, parameters);
+                if (rep == 0 || result.renderTime < best.renderTime)
+                    best = result;
+            }
+            results.push_back(best);
+        }
+
+        std::string json = toJSON(results);
+        if (outputFilename == "-") {
+            cout << json;
+        } else if (!outputFilename.empty()) {
+            std::ofstream os(outputFilename.c_str());
+            os << json;
+            if (os.fail())
+                Log(EError, "Could not write the results to \"%s\"!",
+                    outputFilename.c_str());
+            Log(EInfo, "Wrote the results to \"%s\"", outputFilename.c_str());
+        }
+
+        if (!baselineFilename.empty()) {
+            std::ifstream is(baselineFilename.c_str());
+            if (is.fail())
+                Log(EError, "Could not open the baseline \"%s\"!",
+                    baselineFilename.c_str());
+            std::string contents((std::istreambuf_iterator<char>(is)),
+                std::istreambuf_iterator<char>());
+            BaselineReader::ValueMap baseline = BaselineReader(contents).read();
+
+            int regressions = compare(results, baseline, tolerance);
+            if (regressions > 0) {
+                Log(EWarn, "Found %i performance regression%s compared to \"%s\"",
+                    regressions, regressions > 1 ? "s" : "", baselineFilename.c_str());
+                return 1;
+            }
+            Log(EInfo, "No performance regressions compared to \"%s\"",
+                baselineFilename.c_str());
+        }
+
+        return 0;
+    }
+
+    /// Escape a string for use in a JSON document
+    static std::string escapeJSON(const std::string &str) {
+        std::string result;
+        for (size_t i=0; i<str.length(); ++i) {
+            if (str[i] == '"' || str[i] == '\\')
+                result += '\\';
+            result += str[i];
+        }
+        return result;
+    }
+
+    MTS_DECLARE_UTILITY()
+};
+
+MTS_IMPLEMENT_CLASS(MemoryMonitor, false, Thread)
+MTS_EXPORT_UTILITY(PerfSuite, "Render performance regression suite")
+MTS_NAMESPACE_END
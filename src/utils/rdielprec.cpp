@@ -16,14 +16,22 @@
     along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+
 #include <mitsuba/render/util.h>
+#include <mitsuba/render/bsdf.h>
+#include <mitsuba/render/range.h>
 #include <mitsuba/core/quad.h>
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/sched.h>
+#include <mitsuba/core/spline.h>
+#include <mitsuba/core/timer.h>
 #include <boost/bind.hpp>
 #include <fstream>
 #include <iomanip>
-#include <omp.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
 
 #define RESOLUTION_IOR          50
 #define RESOLUTION_ROUGHNESS    30
@@ -37,10 +45,77 @@
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * Layout of a transmittance table: the relative IOR, roughness and angle
+ * of incidence are warped by a fourth power to place more samples near
+ * the lower end of their ranges. One "cell" consists of the values for
+ * all angles of incidence at a fixed (orientation, IOR, roughness), followed
+ * by the diffuse transmittance. Cells are numbered in file order, i.e. the
+ * non-inverted half of the table comes first.
+ */
+struct TransmittanceGrid {
+    std::string distribution;
+    size_t resolutionIOR, resolutionAlpha, resolutionTheta;
+    Float iorStart, iorEnd, alphaStart, alphaEnd;
+
+    inline size_t getCellCount() const {
+        return 2 * resolutionIOR * resolutionAlpha;
+    }
+
+    /// Number of values that are stored per cell
+    inline size_t getCellSize() const {
+        return resolutionTheta + 1;
+    }
+
+    inline bool isInverted(size_t cell) const {
+        return cell >= resolutionIOR * resolutionAlpha;
+    }
+
+    inline Float getIOR(size_t cell) const {
+        size_t i = (cell / resolutionAlpha) % resolutionIOR;
+        Float t = i / (Float) (resolutionIOR-1);
+        return iorStart + (iorEnd-iorStart) * std::pow(t, (Float) 4.0f);
+    }
+
+    inline Float getAlpha(size_t cell) const {
+        size_t j = cell % resolutionAlpha;
+        Float t = j / (Float) (resolutionAlpha-1);
+        return alphaStart + (alphaEnd-alphaStart) * std::pow(t, (Float) 4.0f);
+    }
+
+    void serialize(Stream *stream) const {
+        stream->writeString(distribution);
+        stream->writeSize(resolutionIOR);
+        stream->writeSize(resolutionAlpha);
+        stream->writeSize(resolutionTheta);
+        stream->writeSingle((float) iorStart);
+        stream->writeSingle((float) iorEnd);
+        stream->writeSingle((float) alphaStart);
+        stream->writeSingle((float) alphaEnd);
+    }
+
+    void unserialize(Stream *stream) {
+        distribution = stream->readString();
+        resolutionIOR = stream->readSize();
+        resolutionAlpha = stream->readSize();
+        resolutionTheta = stream->readSize();
+        iorStart = (Float) stream->readSingle();
+        iorEnd = (Float) stream->readSingle();
+        alphaStart = (Float) stream->readSingle();
+        alphaEnd = (Float) stream->readSingle();
+    }
+
+    bool operator==(const TransmittanceGrid &g) const {
+        return distribution == g.distribution && resolutionIOR == g.resolutionIOR
+            && resolutionAlpha == g.resolutionAlpha && resolutionTheta == g.resolutionTheta
+            && (float) iorStart == (float) g.iorStart && (float) iorEnd == (float) g.iorEnd
+            && (float) alphaStart == (float) g.alphaStart && (float) alphaEnd == (float) g.alphaEnd;
+    }
+};
+
 void transmittanceIntegrand(const BSDF *bsdf, const Vector &wi, size_t nPts, const Float *in, Float *out) {
     Intersection its;
 
-    #pragma omp parallel for
     for (int i=0; i<(int) nPts; ++i) {
         BSDFSamplingRecord bRec(its, wi, Vector(), EImportance);
         bRec.typeMask = BSDF::ETransmission;
@@ -56,15 +131,96 @@ void transmittanceIntegrand(const BSDF *bsdf, const Vector &wi, size_t nPts, con
 }
 
 void diffTransmittanceIntegrand(Float *data, size_t resolution, size_t nPts, const Float *in, Float *out) {
-    #pragma omp parallel for
     for (int i=0; i<(int) nPts; ++i)
-        out[i] = 2 * in[i] * interpCubic1D(std::pow(in[i], (Float) 0.25f), data, 0, 1, resolution);
+        out[i] = 2 * in[i] * evalCubicInterp1D(std::pow(in[i], (Float) 0.25f), data, resolution, 0, 1);
 }
 
-class PrecomputeTransmittance : public Utility {
+/// Values of a range of table cells
+class TransmittanceResult : public WorkResult {
+public:
+    TransmittanceResult(size_t cellSize) : m_cellSize(cellSize), m_start(0) { }
+
+    inline void setRange(size_t start, size_t count) {
+        m_start = start;
+        m_values.resize(count * m_cellSize);
+    }
+
+    inline size_t getStart() const { return m_start; }
+    inline size_t getCount() const { return m_values.size() / m_cellSize; }
+    inline Float *getCell(size_t i) { return &m_values[i * m_cellSize]; }
+    inline const Float *getCell(size_t i) const { return &m_values[i * m_cellSize]; }
+
+    void load(Stream *stream) {
+        m_start = stream->readSize();
+        m_values.resize(stream->readSize());
+        stream->readFloatArray(&m_values[0], m_values.size());
+    }
+
+    void save(Stream *stream) const {
+        stream->writeSize(m_start);
+        stream->writeSize(m_values.size());
+        stream->writeFloatArray(&m_values[0], m_values.size());
+    }
+
+    std::string toString() const {
+        return formatString("TransmittanceResult[start=" SIZE_T_FMT
+            ", count=" SIZE_T_FMT "]", m_start, getCount());
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~TransmittanceResult() { }
+private:
+    size_t m_cellSize, m_start;
+    std::vector<Float> m_values;
+};
+
+/// Computes the transmittance values of table cells (also on remote machines)
+class TransmittanceWorker : public WorkProcessor {
 public:
-    Float *computeTransmittance(const char *name, Float ior, Float alpha,
-            size_t resolution, Float &diffTrans, int inverted) {
+    TransmittanceWorker(const TransmittanceGrid &grid) : m_grid(grid) { }
+
+    TransmittanceWorker(Stream *stream, InstanceManager *manager) {
+        m_grid.unserialize(stream);
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        m_grid.serialize(stream);
+    }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new RangeWorkUnit();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new TransmittanceResult(m_grid.getCellSize());
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new TransmittanceWorker(m_grid);
+    }
+
+    void prepare() { }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+        const bool &stop) {
+        const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+        TransmittanceResult *result = static_cast<TransmittanceResult *>(workResult);
+        size_t start = range->getRangeStart(),
+               count = range->getRangeEnd() - start + 1;
+
+        result->setRange(start, count);
+        for (size_t i=0; i<count && !stop; ++i) {
+            size_t cell = start + i;
+            Float *values = result->getCell(i);
+            computeTransmittance(m_grid.getIOR(cell), m_grid.getAlpha(cell),
+                m_grid.isInverted(cell), values, values[m_grid.resolutionTheta]);
+        }
+    }
+
+    void computeTransmittance(Float ior, Float alpha, bool inverted,
+            Float *transmittances, Float &diffTrans) {
+        size_t resolution = m_grid.resolutionTheta;
         Properties bsdfProps(alpha == 0 ? "dielectric" : "roughdielectric");
         if (inverted) {
             bsdfProps.setFloat("intIOR", 1.00);
@@ -74,16 +230,16 @@ public:
             bsdfProps.setFloat("intIOR", ior);
         }
         bsdfProps.setFloat("alpha", alpha);
-        bsdfProps.setString("distribution", name);
+        bsdfProps.setString("distribution", m_grid.distribution);
         ref<BSDF> bsdf = static_cast<BSDF *>(
                 PluginManager::getInstance()->createObject(bsdfProps));
 
         Float stepSize = 1.0f / (resolution-1);
         Float error;
 
+        /* Each worker already occupies one core, so integrate serially */
         NDIntegrator intTransmittance(1, 2, 50000, 0, 1e-6f);
         NDIntegrator intDiffTransmittance(1, 1, 50000, 0, 1e-6f);
-        Float *transmittances = new Float[resolution];
 
         for (size_t i=0; i<resolution; ++i) {
             Float t = i * stepSize;
@@ -96,7 +252,7 @@ public:
 
             Float min[2] = {0, 0}, max[2] = {1, 1};
             intTransmittance.integrateVectorized(
-                boost::bind(&transmittanceIntegrand, bsdf, wi, _1, _2, _3),
+                boost::bind(&transmittanceIntegrand, bsdf.get(), wi, _1, _2, _3),
                 min, max, &transmittances[i], &error, NULL);
         }
 
@@ -104,92 +260,153 @@ public:
         intDiffTransmittance.integrateVectorized(
             boost::bind(&diffTransmittanceIntegrand, transmittances, resolution, _1, _2, _3),
             min, max, &diffTrans, &error, NULL);
+    }
 
-        if (alpha == 0.0f)
-            cout << diffTrans << " vs " << 1-fresnelDiffuseReflectance(inverted ? (1.0f / ior) : ior) << endl;
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~TransmittanceWorker() { }
+private:
+    TransmittanceGrid m_grid;
+};
 
-        return transmittances;
+/**
+ * \brief Distributes the cells of a transmittance table over the scheduler
+ *
+ * Finished cells are appended to a checkpoint file as soon as they arrive,
+ * so that an interrupted run only recomputes the missing cells.
+ */
+class TransmittanceProcess : public ParallelProcess {
+public:
+    TransmittanceProcess(const TransmittanceGrid &grid, const fs::path &checkpoint)
+        : m_grid(grid), m_next(0) {
+        m_mutex = new Mutex();
+        m_values.resize(grid.getCellCount() * grid.getCellSize());
+        m_done.resize(grid.getCellCount(), false);
+        m_doneCount = 0;
+        openCheckpoint(checkpoint);
+        m_progress = new ProgressReporter("Computing", grid.getCellCount(), NULL);
+        m_progress->update(m_doneCount);
     }
 
-    void fit(const char *name, int inverted) {
-        size_t resolutionIOR = RESOLUTION_IOR,
-               resolutionAlpha = RESOLUTION_ROUGHNESS,
-               resolutionTheta = RESOLUTION_THETA;
-
-        Float alphaStart = ROUGHNESS_START,
-              alphaEnd   = ROUGHNESS_END,
-              iorStart   = IOR_START,
-              iorEnd     = IOR_END;
+    ref<WorkProcessor> createWorkProcessor() const {
+        return new TransmittanceWorker(m_grid);
+    }
 
-        std::ofstream os(formatString("%s%i.m", name, inverted).c_str());
-        os << std::fixed << std::setprecision(8);
+    std::vector<std::string> getRequiredPlugins() {
+        std::vector<std::string> result = ParallelProcess::getRequiredPlugins();
+        result.push_back("rdielprec");
+        result.push_back("dielectric");
+        result.push_back("roughdielectric");
+        return result;
+    }
 
-        os << "alphaStart=" << alphaStart << ";" << endl;
-        os << "alphaEnd=" << alphaEnd << ";" << endl;
-        os << "iorStart=" << iorStart << ";" << endl;
-        os << "iorEnd=" << iorEnd << ";" << endl;
-        os << "alphaSteps=" << resolutionAlpha << ";" << endl;
-        os << "thetaSteps=" << resolutionTheta << ";" << endl;
-        os << "iorSteps=" << resolutionIOR << ";" << endl;
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        /* Skip the cells that were restored from the checkpoint */
+        while (m_next < m_done.size() && m_done[m_next])
+            ++m_next;
+        if (m_next == m_done.size())
+            return EFailure;
+        static_cast<RangeWorkUnit *>(unit)->setRange(m_next, m_next);
+        ++m_next;
+        return ESuccess;
+    }
 
-        os << "transmittance={" << endl;
-        ref<FileStream> fstream = new FileStream(formatString("data/microfacet/%s.dat", name).c_str(),
-                inverted ? FileStream::EAppendReadWrite : FileStream::ETruncReadWrite);
+    void processResult(const WorkResult *wr, bool cancelled) {
+        if (cancelled)
+            return;
+        const TransmittanceResult *result = static_cast<const TransmittanceResult *>(wr);
+        size_t cellSize = m_grid.getCellSize();
+        std::vector<float> temp(cellSize);
+
+        LockGuard lock(m_mutex);
+        for (size_t i=0; i<result->getCount(); ++i) {
+            size_t cell = result->getStart() + i;
+            const Float *values = result->getCell(i);
+            memcpy(&m_values[cell * cellSize], values, cellSize * sizeof(Float));
+            m_done[cell] = true;
+            ++m_doneCount;
+
+            for (size_t k=0; k<cellSize; ++k)
+                temp[k] = (float) values[k];
+            m_checkpoint->writeSize(cell);
+            m_checkpoint->writeSingleArray(&temp[0], cellSize);
+        }
+        m_checkpoint->flush();
+        m_progress->update(m_doneCount);
+    }
 
-        fstream->setByteOrder(Stream::ELittleEndian);
+    inline bool isComplete() const { return m_doneCount == m_done.size(); }
+    inline const Float *getCell(size_t cell) const { return &m_values[cell * m_grid.getCellSize()]; }
+    inline size_t getRestoredCount() const { return m_restoredCount; }
+    inline void closeCheckpoint() { m_checkpoint->close(); }
 
-        if (!inverted) {
-            fstream->write("MTS_TRANSMITTANCE", 17);
-            fstream->writeSize(resolutionIOR);
-            fstream->writeSize(resolutionAlpha);
-            fstream->writeSize(resolutionTheta);
-            fstream->writeSingle(iorStart);
-            fstream->writeSingle(iorEnd);
-            fstream->writeSingle(alphaStart);
-            fstream->writeSingle(alphaEnd);
-        }
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~TransmittanceProcess() {
+        delete m_progress;
+    }
 
-        Float iorStepSize   = 1.0f / (resolutionIOR-1),
-              alphaStepSize = 1.0f / (resolutionAlpha-1);
-
-        for (size_t i=0; i<resolutionIOR; ++i) {
-            Float t = i * iorStepSize;
-            Float ior = iorStart + (iorEnd-iorStart) * std::pow(t, (Float) 4.0f);
-            cout << "ior = " << ior << endl;
-            os << "\t{" << endl;
-            for (size_t j=0; j<resolutionAlpha; ++j) {
-                Float t = j * alphaStepSize;
-                Float alpha = alphaStart + (alphaEnd-alphaStart) * std::pow(t, (Float) 4.0f);
-                cout << "alpha = " << alpha << endl;
-                Float diffTrans;
-                Float *transmittance = computeTransmittance(name,
-                        ior, alpha, resolutionTheta, diffTrans, inverted);
-                os << "\t\t{";
-                for (size_t k=0; k<resolutionTheta; ++k) {
-                    fstream->writeSingle((float) transmittance[k]);
-                    os << transmittance[k];
-                    if (k+1 < resolutionTheta)
-                        os << ", ";
+    void openCheckpoint(const fs::path &path) {
+        const char header[] = "MTS_TRANSMITTANCE_PARTIAL";
+        size_t headerLength = strlen(header), cellSize = m_grid.getCellSize();
+        m_restoredCount = 0;
+
+        if (fs::exists(path)) {
+            m_checkpoint = new FileStream(path, FileStream::EReadWrite);
+            m_checkpoint->setByteOrder(Stream::ELittleEndian);
+
+            char *fileHeader = (char *) alloca(headerLength);
+            m_checkpoint->read(fileHeader, headerLength);
+            if (memcmp(fileHeader, header, headerLength) != 0)
+                Log(EError, "\"%s\" is not a transmittance checkpoint file!",
+                    path.string().c_str());
+            TransmittanceGrid grid;
+            grid.unserialize(m_checkpoint);
+            if (!(grid == m_grid))
+                Log(EError, "The checkpoint file \"%s\" was created with different "
+                    "table parameters -- please remove it or use the same parameters",
+                    path.string().c_str());
+
+            /* Restore all complete records; drop a partially written one */
+            size_t recordSize = sizeof(uint64_t) + cellSize * sizeof(float);
+            std::vector<float> temp(cellSize);
+            while (m_checkpoint->getSize() - m_checkpoint->getPos() >= recordSize) {
+                size_t cell = m_checkpoint->readSize();
+                m_checkpoint->readSingleArray(&temp[0], cellSize);
+                if (cell >= m_done.size())
+                    Log(EError, "Invalid record in the checkpoint file \"%s\"!",
+                        path.string().c_str());
+                for (size_t k=0; k<cellSize; ++k)
+                    m_values[cell * cellSize + k] = (Float) temp[k];
+                if (!m_done[cell]) {
+                    m_done[cell] = true;
+                    ++m_doneCount;
                 }
-                os << "}";
-                if (j + 1 < resolutionAlpha)
-                    os << ",";
-                os << endl;
-                delete[] transmittance;
-                fstream->writeSingle((float) diffTrans);
+                ++m_restoredCount;
             }
-            os << "\t}";
-            if (i + 1 < resolutionIOR)
-                os << ",";
-            os << endl;
-            cout << endl;
+            m_checkpoint->truncate(m_checkpoint->getPos());
+            m_checkpoint->seek(m_checkpoint->getPos());
+        } else {
+            m_checkpoint = new FileStream(path, FileStream::ETruncReadWrite);
+            m_checkpoint->setByteOrder(Stream::ELittleEndian);
+            m_checkpoint->write(header, headerLength);
+            m_grid.serialize(m_checkpoint);
+            m_checkpoint->flush();
         }
-        os << "};" << endl;
-        os.close();
-        fstream->close();
     }
+private:
+    TransmittanceGrid m_grid;
+    size_t m_next, m_doneCount, m_restoredCount;
+    std::vector<Float> m_values;
+    std::vector<bool> m_done;
+    ref<FileStream> m_checkpoint;
+    ref<Mutex> m_mutex;
+    ProgressReporter *m_progress;
+};
 
-    int run(int argc, char **argv) {
+class PrecomputeTransmittance : public Utility {
+public:
+    void help() {
         cout << endl;
         cout << "rdielprec: precompute transmittances through a rough dielectric material" << endl;
         cout << "========================================================================" << endl;
@@ -204,29 +421,205 @@ public:
         cout << "Since a 2D integration is involved, the transmittance is quite expensive" << endl;
         cout << "to evaluate at runtime. This utility therefore precomputes the values on" << endl;
         cout << "a densely spaced grid and stores them on disk so that they can be " << endl;
-        cout << "interpolated at runtime (e.g. using cubic splines). The output will be " << endl;
-        cout << "written to 'data/microfacet'. This process will take 1-3 hours." << endl;
-        cout << "It is recommended that you compile Mitsuba in double precision when running" << endl;
-        cout << "this utility." << endl;
+        cout << "interpolated at runtime (e.g. using cubic splines). The table cells are" << endl;
+        cout << "distributed over all local cores and any servers specified using the" << endl;
+        cout << "-c/-s options of mtsutil. Finished cells are written to a checkpoint" << endl;
+        cout << "file ('<name>.dat.partial'), and re-running the same command resumes an" << endl;
+        cout << "interrupted computation. It is recommended that you compile Mitsuba in" << endl;
+        cout << "double precision when running this utility." << endl;
         cout << endl;
-        cout << "(Press any key to proceed)" << endl;
-        std::getchar();
-        omp_set_num_threads(4);
+        cout << "Usage: mtsutil rdielprec [options] <distribution> [distribution ..]" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -i min,max     Range of relative indices of refraction (default: "
+             << IOR_START << "," << IOR_END << ")" << endl << endl;
+        cout << "   -a min,max     Range of roughness values (default: "
+             << ROUGHNESS_START << "," << ROUGHNESS_END << ")" << endl << endl;
+        cout << "   -r i,a,t       Resolution along IOR, roughness and angle of incidence" << endl
+             << "                  (default: " << RESOLUTION_IOR << "," << RESOLUTION_ROUGHNESS
+             << "," << RESOLUTION_THETA << ")" << endl << endl;
+        cout << "   -o directory   Output directory (default: data/microfacet)" << endl << endl;
+        cout << "   -m             Also write the tables in MATLAB format" << endl << endl;
+    }
+
+    /// Parse a comma-separated list of floating point values
+    std::vector<Float> parseList(const char *str, size_t count, const char *name) {
+        std::vector<std::string> tokens = tokenize(str, ",");
+        std::vector<Float> result;
+        char *end_ptr = NULL;
+        for (size_t i=0; i<tokens.size(); ++i) {
+            result.push_back((Float) strtod(tokens[i].c_str(), &end_ptr));
+            if (*end_ptr != '\0')
+                break;
+        }
+        if (result.size() != count || *end_ptr != '\0')
+            Log(EError, "Could not parse the %s!", name);
+        return result;
+    }
+
+    void fit(TransmittanceGrid grid, const fs::path &outputDir, bool matlab) {
+        fs::path filename = outputDir / (grid.distribution + ".dat");
+        fs::path checkpoint = filename;
+        checkpoint.replace_extension(".dat.partial");
+
+        ref<Scheduler> sched = Scheduler::getInstance();
+        ref<TransmittanceProcess> proc = new TransmittanceProcess(grid, checkpoint);
+        if (proc->getRestoredCount() > 0)
+            Log(EInfo, "Resuming from \"%s\" (" SIZE_T_FMT "/" SIZE_T_FMT " cells done)",
+                checkpoint.string().c_str(), proc->getRestoredCount(), grid.getCellCount());
+
         ref<Timer> timer = new Timer();
+        sched->schedule(proc);
+        sched->wait(proc);
+        proc->closeCheckpoint();
 
-//      fit("beckmann", 0);
-//      fit("beckmann", 1);
-        fit("phong", 0);
-        fit("phong", 1);
-//      fit("ggx", 0);
-//      fit("ggx", 1);
-        cout << endl;
-        cout << "Done, took " << timer->getMilliseconds() / 1000.0f << " seconds" << endl;
+        if (proc->getReturnStatus() != ParallelProcess::ESuccess || !proc->isComplete())
+            Log(EError, "The computation of the \"%s\" table did not finish. Run the same "
+                "command again to resume it.", grid.distribution.c_str());
+
+        Log(EInfo, "Computed the \"%s\" table in %.1f seconds", grid.distribution.c_str(),
+            timer->getMilliseconds() / 1000.0f);
+
+        ref<FileStream> fstream = new FileStream(filename, FileStream::ETruncReadWrite);
+        fstream->setByteOrder(Stream::ELittleEndian);
+        fstream->write("MTS_TRANSMITTANCE", 17);
+        fstream->writeSize(grid.resolutionIOR);
+        fstream->writeSize(grid.resolutionAlpha);
+        fstream->writeSize(grid.resolutionTheta);
+        fstream->writeSingle((float) grid.iorStart);
+        fstream->writeSingle((float) grid.iorEnd);
+        fstream->writeSingle((float) grid.alphaStart);
+        fstream->writeSingle((float) grid.alphaEnd);
+        for (size_t cell=0; cell<grid.getCellCount(); ++cell) {
+            const Float *values = proc->getCell(cell);
+            for (size_t k=0; k<grid.getCellSize(); ++k)
+                fstream->writeSingle((float) values[k]);
+        }
+        fstream->close();
+        Log(EInfo, "Wrote \"%s\"", filename.string().c_str());
+
+        if (matlab) {
+            for (int inverted=0; inverted<2; ++inverted) {
+                fs::path mfile = outputDir / formatString("%s%i.m",
+                    grid.distribution.c_str(), inverted);
+                std::ofstream os(mfile.string().c_str());
+                os << std::fixed << std::setprecision(8);
+                os << "alphaStart=" << grid.alphaStart << ";" << endl;
+                os << "alphaEnd=" << grid.alphaEnd << ";" << endl;
+                os << "iorStart=" << grid.iorStart << ";" << endl;
+                os << "iorEnd=" << grid.iorEnd << ";" << endl;
+                os << "alphaSteps=" << grid.resolutionAlpha << ";" << endl;
+                os << "thetaSteps=" << grid.resolutionTheta << ";" << endl;
+                os << "iorSteps=" << grid.resolutionIOR << ";" << endl;
+                os << "transmittance={" << endl;
+                for (size_t i=0; i<grid.resolutionIOR; ++i) {
+                    os << "\t{" << endl;
+                    for (size_t j=0; j<grid.resolutionAlpha; ++j) {
+                        size_t cell = (inverted * grid.resolutionIOR + i)
+                            * grid.resolutionAlpha + j;
+                        const Float *values = proc->getCell(cell);
+                        os << "\t\t{";
+                        for (size_t k=0; k<grid.resolutionTheta; ++k) {
+                            os << values[k];
+                            if (k+1 < grid.resolutionTheta)
+                                os << ", ";
+                        }
+                        os << "}";
+                        if (j + 1 < grid.resolutionAlpha)
+                            os << ",";
+                        os << endl;
+                    }
+                    os << "\t}";
+                    if (i + 1 < grid.resolutionIOR)
+                        os << ",";
+                    os << endl;
+                }
+                os << "};" << endl;
+                os.close();
+            }
+        }
+
+        fs::remove(checkpoint);
+    }
+
+    int run(int argc, char **argv) {
+        TransmittanceGrid grid;
+        grid.resolutionIOR = RESOLUTION_IOR;
+        grid.resolutionAlpha = RESOLUTION_ROUGHNESS;
+        grid.resolutionTheta = RESOLUTION_THETA;
+        grid.iorStart = (Float) IOR_START;
+        grid.iorEnd = (Float) IOR_END;
+        grid.alphaStart = (Float) ROUGHNESS_START;
+        grid.alphaEnd = (Float) ROUGHNESS_END;
+        fs::path outputDir = "data/microfacet";
+        bool matlab = false;
+        int optchar;
+        optind = 1;
+
+        /* Parse command-line arguments */
+        while ((optchar = getopt(argc, argv, "i:a:r:o:mh")) != -1) {
+            switch (optchar) {
+                case 'i': {
+                        std::vector<Float> range = parseList(optarg, 2, "IOR range");
+                        grid.iorStart = range[0];
+                        grid.iorEnd = range[1];
+                    }
+                    break;
+                case 'a': {
+                        std::vector<Float> range = parseList(optarg, 2, "roughness range");
+                        grid.alphaStart = range[0];
+                        grid.alphaEnd = range[1];
+                    }
+                    break;
+                case 'r': {
+                        std::vector<Float> res = parseList(optarg, 3, "resolution");
+                        grid.resolutionIOR = (size_t) res[0];
+                        grid.resolutionAlpha = (size_t) res[1];
+                        grid.resolutionTheta = (size_t) res[2];
+                    }
+                    break;
+                case 'o':
+                    outputDir = optarg;
+                    break;
+                case 'm':
+                    matlab = true;
+                    break;
+                case 'h':
+                default:
+                    help();
+                    return 0;
+            }
+        }
+
+        if (optind == argc) {
+            help();
+            return 0;
+        }
+
+        if (grid.resolutionIOR < 2 || grid.resolutionAlpha < 2 || grid.resolutionTheta < 2)
+            Log(EError, "All resolutions must be at least 2!");
+        if (grid.iorStart <= 1 || grid.iorEnd <= grid.iorStart)
+            Log(EError, "Invalid IOR range (must satisfy 1 < min < max)!");
+        if (grid.alphaStart < 0 || grid.alphaEnd <= grid.alphaStart)
+            Log(EError, "Invalid roughness range (must satisfy 0 <= min < max)!");
+
+        ref<Timer> timer = new Timer();
+        for (int i=optind; i<argc; ++i) {
+            grid.distribution = argv[i];
+            if (grid.distribution != "beckmann" && grid.distribution != "phong"
+                    && grid.distribution != "ggx")
+                Log(EError, "Unsupported microfacet distribution \"%s\"!", argv[i]);
+            fit(grid, outputDir, matlab);
+        }
+        Log(EInfo, "Done, took %.1f seconds", timer->getMilliseconds() / 1000.0f);
         return 0;
     }
 
     MTS_DECLARE_UTILITY()
 };
 
+MTS_IMPLEMENT_CLASS(TransmittanceResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(TransmittanceWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(TransmittanceProcess, false, ParallelProcess)
 MTS_EXPORT_UTILITY(PrecomputeTransmittance, "Precompute transmittance data for rough dielectrics")
 MTS_NAMESPACE_END
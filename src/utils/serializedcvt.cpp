@@ -0,0 +1,77 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/render/util.h>
+
+MTS_NAMESPACE_BEGIN
+
+class SerializedConverter : public Utility {
+public:
+    int run(int argc, char **argv) {
+        bool compress = argc == 4 && strcmp(argv[1], "-c") == 0;
+        if (argc != 3 && !compress) {
+            cout << "Convert a .serialized geometry file between the compressed and the" << endl;
+            cout << "uncompressed, memory-mappable variant of the format" << endl;
+            cout << "Syntax: mtsutil serializedcvt [-c] <input.serialized> <output.serialized>" << endl;
+            cout << "Options:" << endl;
+            cout << "  -c   Write a compressed file (default: memory-mappable)" << endl;
+            return -1;
+        }
+        fs::path inputPath(argv[argc-2]), outputPath(argv[argc-1]);
+        if (fs::exists(outputPath) && fs::equivalent(inputPath, outputPath))
+            Log(EError, "The input and output files must be different!");
+
+        ref<Timer> timer = new Timer();
+        ref<FileStream> input = new FileStream(inputPath, FileStream::EReadOnly);
+        input->setByteOrder(Stream::ELittleEndian);
+        int meshCount = TriMesh::getSerializedMeshCount(input);
+
+        ref<FileStream> output = new FileStream(outputPath, FileStream::ETruncReadWrite);
+        output->setByteOrder(Stream::ELittleEndian);
+
+        std::vector<uint64_t> offsets;
+        for (int i=0; i<meshCount; ++i) {
+            input->seek(0);
+            ref<TriMesh> mesh = new TriMesh(input, i);
+            offsets.push_back((uint64_t) output->getPos());
+            if (compress)
+                mesh->serialize(output);
+            else
+                mesh->serializeMappable(output);
+        }
+
+        /* End-of-file dictionary */
+        for (size_t i=0; i<offsets.size(); ++i)
+            output->writeULong(offsets[i]);
+        output->writeUInt((uint32_t) offsets.size());
+        output->close();
+
+        Log(EInfo, "Converted %i meshes in %i ms (%s -> %s)", meshCount,
+            timer->getMilliseconds(), memString((size_t) fs::file_size(inputPath)).c_str(),
+            memString((size_t) fs::file_size(outputPath)).c_str());
+        return 0;
+    }
+
+    MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(SerializedConverter, "Convert between compressed and memory-mapped .serialized files");
+MTS_NAMESPACE_END
@@ -0,0 +1,389 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/properties.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/getopt.h>
+#include <mitsuba/render/volume.h>
+#include <mitsuba/render/util.h>
+
+MTS_NAMESPACE_BEGIN
+
+/* Layout of the 'sparsevolume' format */
+#define BRICK_SHIFT  3
+#define BRICK_SIZE   (1 << BRICK_SHIFT)
+#define BRICK_VOXELS (BRICK_SIZE * BRICK_SIZE * BRICK_SIZE)
+#define TILE_SHIFT   (2 * BRICK_SHIFT)
+#define EMPTY        0xFFFFFFFFu
+
+/// Provides the voxels of the volume that is being converted
+class VoxelSource {
+public:
+    virtual ~VoxelSource() { }
+
+    /// Write the voxel at the given position to \c value (\c channels entries)
+    virtual void fetch(int x, int y, int z, float *value) const = 0;
+
+    Vector3i res;
+    int channels;
+    AABB aabb;
+};
+
+/// Reads the voxels of a dense 'gridvolume' file (float32 or uint8)
+class DenseVoxelSource : public VoxelSource {
+public:
+    DenseVoxelSource(const fs::path &filename) {
+        m_mmap = new MemoryMappedFile(filename);
+        const uint8_t *data = (const uint8_t *) m_mmap->getData();
+        if (m_mmap->getSize() < 48 || data[0] != 'V' || data[1] != 'O'
+                || data[2] != 'L' || data[3] != 3)
+            SLog(EError, "\"%s\" is not a valid volume data file!",
+                filename.string().c_str());
+
+        const int32_t *header = (const int32_t *) (data + 4);
+        m_type = header[0];
+        res = Vector3i(header[1], header[2], header[3]);
+        channels = header[4];
+        const float *bounds = (const float *) (data + 24);
+        aabb = AABB(Point(bounds[0], bounds[1], bounds[2]),
+            Point(bounds[3], bounds[4], bounds[5]));
+
+        if (m_type != 1 && m_type != 3)
+            SLog(EError, "Only float32 and uint8 volumes can be converted "
+                "(encountered type %i)", m_type);
+        if (channels != 1 && channels != 3)
+            SLog(EError, "Only volumes with 1 or 3 channels can be "
+                "converted (encountered %i)", channels);
+
+        size_t expectedSize = 48 + (size_t) res.x * res.y * res.z
+            * channels * (m_type == 1 ? 4 : 1);
+        if (m_mmap->getSize() < expectedSize)
+            SLog(EError, "\"%s\" is truncated!", filename.string().c_str());
+        m_data = data + 48;
+    }
+
+    void fetch(int x, int y, int z, float *value) const {
+        size_t idx = (((size_t) z * res.y + y) * res.x + x) * channels;
+        for (int i=0; i<channels; ++i) {
+            if (m_type == 1)
+                value[i] = ((const float *) m_data)[idx + i];
+            else
+                value[i] = m_data[idx + i] / 255.0f;
+        }
+    }
+private:
+    ref<MemoryMappedFile> m_mmap;
+    const uint8_t *m_data;
+    int m_type;
+};
+
+/**
+ * Resamples an arbitrary volume data source (e.g. a 'hgridvolume')
+ * at the positions of a regular grid of voxels spanning its bounds
+ */
+class ResamplingVoxelSource : public VoxelSource {
+public:
+    ResamplingVoxelSource(const VolumeDataSource *source, const Vector3i &res_)
+            : m_source(source) {
+        res = res_;
+        aabb = source->getAABB();
+        if (source->supportsFloatLookups())
+            channels = 1;
+        else if (source->supportsSpectrumLookups())
+            channels = 3;
+        else
+            SLog(EError, "The volume data source must support float- "
+                "or spectrum-valued lookups!");
+    }
+
+    void fetch(int x, int y, int z, float *value) const {
+        /* Voxels on the upper boundary are moved slightly inwards,
+           since grid volumes return zero exactly on that boundary */
+        const int pos[3] = { x, y, z };
+        Point p;
+        for (int i=0; i<3; ++i)
+            p[i] = aabb.min[i] + aabb.getExtents()[i] * std::min(
+                (Float) pos[i], res[i] - 1 - 1e-3f) / (Float) (res[i] - 1);
+
+        if (channels == 1) {
+            value[0] = (float) m_source->lookupFloat(p);
+        } else {
+            Float r, g, b;
+            m_source->lookupSpectrum(p).toLinearRGB(r, g, b);
+            value[0] = (float) r; value[1] = (float) g; value[2] = (float) b;
+        }
+    }
+private:
+    ref<const VolumeDataSource> m_source;
+};
+
+class SparseVolumeConverter : public Utility {
+public:
+    void help() {
+        cout << endl;
+        cout << "Synopsis: Convert a dense volume (.vol) or a hierarchical grid dictionary" << endl;
+        cout << "into the sparse brick-based format of the 'sparsevolume' plugin" << endl;
+        cout << endl;
+        cout << "Usage: mtsutil svolcvt [options] <input> <output.svol>" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h          Display this help text" << endl << endl;
+        cout << "   -g          Interpret the input as a 'hgridvolume' dictionary" << endl << endl;
+        cout << "   -p prefix   Block file name prefix of the 'hgridvolume' dictionary" << endl << endl;
+        cout << "   -s postfix  Block file name postfix of the 'hgridvolume' dictionary" << endl << endl;
+        cout << "   -r x,y,z    Resolution used to resample a 'hgridvolume' dictionary" << endl;
+        cout << "               (default: that of the blocks, assuming that neighboring" << endl;
+        cout << "               blocks share their boundary voxels)" << endl << endl;
+        cout << "   -t value    Drop bricks whose values all have a magnitude below" << endl;
+        cout << "               or equal to this threshold (default: 0)" << endl << endl;
+    }
+
+    int run(int argc, char **argv) {
+        bool hgrid = false;
+        std::string prefix, postfix;
+        Vector3i res(0);
+        Float threshold = 0;
+        char *end_ptr = NULL;
+        int optchar;
+
+        optind = 1;
+        while ((optchar = getopt(argc, argv, "gp:s:r:t:h")) != -1) {
+            switch (optchar) {
+                case 'g':
+                    hgrid = true;
+                    break;
+                case 'p':
+                    prefix = optarg;
+                    break;
+                case 's':
+                    postfix = optarg;
+                    break;
+                case 'r': {
+                        std::vector<std::string> tokens = tokenize(optarg, ",");
+                        if (tokens.size() != 3)
+                            Log(EError, "Could not parse the resolution!");
+                        for (int i=0; i<3; ++i) {
+                            res[i] = strtol(tokens[i].c_str(), &end_ptr, 10);
+                            if (*end_ptr != '\0' || res[i] < 2)
+                                Log(EError, "Could not parse the resolution!");
+                        }
+                    }
+                    break;
+                case 't':
+                    threshold = (Float) strtod(optarg, &end_ptr);
+                    if (*end_ptr != '\0' || threshold < 0)
+                        Log(EError, "Could not parse the threshold!");
+                    break;
+                case 'h':
+                default:
+                    help();
+                    return 0;
+            }
+        }
+
+        if (argc - optind != 2) {
+            help();
+            return -1;
+        }
+
+        fs::path inputPath(argv[optind]), outputPath(argv[optind+1]);
+        if (fs::exists(outputPath) && fs::equivalent(inputPath, outputPath))
+            Log(EError, "The input and output files must be different!");
+
+        ref<Timer> timer = new Timer();
+        ref<VolumeDataSource> hgridSource;
+        VoxelSource *source;
+
+        if (hgrid) {
+            Properties props("hgridvolume");
+            props.setString("filename", inputPath.string());
+            props.setString("prefix", prefix);
+            props.setString("postfix", postfix);
+            hgridSource = static_cast<VolumeDataSource *> (PluginManager::getInstance()->
+                    createObject(MTS_CLASS(VolumeDataSource), props));
+            hgridSource->configure();
+            if (res == Vector3i(0))
+                res = getDictionaryResolution(inputPath, prefix, postfix);
+            source = new ResamplingVoxelSource(hgridSource, res);
+        } else {
+            source = new DenseVoxelSource(inputPath);
+        }
+
+        res = source->res;
+        const int channels = source->channels;
+        Vector3i tileRes;
+        for (int i=0; i<3; ++i)
+            tileRes[i] = (res[i] + (1 << TILE_SHIFT) - 1) >> TILE_SHIFT;
+
+        std::vector<uint32_t> root((size_t) tileRes.x * tileRes.y * tileRes.z, EMPTY);
+        std::vector<uint32_t> tiles;
+        std::vector<float> tileBounds, brickBounds, bricks;
+        std::vector<float> brick(BRICK_VOXELS * channels);
+
+        for (int tz=0; tz<tileRes.z; ++tz) {
+            for (int ty=0; ty<tileRes.y; ++ty) {
+                for (int tx=0; tx<tileRes.x; ++tx) {
+                    uint32_t table[BRICK_VOXELS];
+                    bool tileEmpty = true;
+                    float tileMin = 0, tileMax = 0;
+
+                    for (int b=0; b<BRICK_VOXELS; ++b) {
+                        table[b] = EMPTY;
+                        int bx = ((tx << TILE_SHIFT) >> BRICK_SHIFT) + (b % BRICK_SIZE),
+                            by = ((ty << TILE_SHIFT) >> BRICK_SHIFT) + ((b / BRICK_SIZE) % BRICK_SIZE),
+                            bz = ((tz << TILE_SHIFT) >> BRICK_SHIFT) + (b / (BRICK_SIZE*BRICK_SIZE));
+                        if ((bx << BRICK_SHIFT) >= res.x || (by << BRICK_SHIFT) >= res.y
+                                || (bz << BRICK_SHIFT) >= res.z)
+                            continue;
+
+                        /* Voxels beyond the end of the grid are padded with zeros */
+                        float brickMin = std::numeric_limits<float>::infinity(),
+                              brickMax = -std::numeric_limits<float>::infinity();
+                        bool brickEmpty = true, padded = false;
+                        for (int v=0; v<BRICK_VOXELS; ++v) {
+                            int x = (bx << BRICK_SHIFT) + (v % BRICK_SIZE),
+                                y = (by << BRICK_SHIFT) + ((v / BRICK_SIZE) % BRICK_SIZE),
+                                z = (bz << BRICK_SHIFT) + (v / (BRICK_SIZE*BRICK_SIZE));
+                            float *value = &brick[v * channels];
+                            if (x >= res.x || y >= res.y || z >= res.z) {
+                                for (int c=0; c<channels; ++c)
+                                    value[c] = 0.0f;
+                                padded = true;
+                                continue;
+                            }
+                            source->fetch(x, y, z, value);
+                            for (int c=0; c<channels; ++c) {
+                                brickMin = std::min(brickMin, value[c]);
+                                brickMax = std::max(brickMax, value[c]);
+                                if (std::abs(value[c]) > threshold)
+                                    brickEmpty = false;
+                            }
+                        }
+
+                        if (brickEmpty)
+                            continue;
+                        if (padded) {
+                            brickMin = std::min(brickMin, 0.0f);
+                            brickMax = std::max(brickMax, 0.0f);
+                        }
+
+                        table[b] = (uint32_t) (brickBounds.size() / 2);
+                        brickBounds.push_back(brickMin);
+                        brickBounds.push_back(brickMax);
+                        bricks.insert(bricks.end(), brick.begin(), brick.end());
+
+                        if (tileEmpty) {
+                            tileMin = brickMin; tileMax = brickMax;
+                            tileEmpty = false;
+                        } else {
+                            tileMin = std::min(tileMin, brickMin);
+                            tileMax = std::max(tileMax, brickMax);
+                        }
+                    }
+
+                    if (tileEmpty)
+                        continue;
+
+                    /* Missing bricks count as zero */
+                    for (int b=0; b<BRICK_VOXELS; ++b) {
+                        if (table[b] == EMPTY) {
+                            tileMin = std::min(tileMin, 0.0f);
+                            tileMax = std::max(tileMax, 0.0f);
+                            break;
+                        }
+                    }
+
+                    root[(tz * tileRes.y + ty) * tileRes.x + tx] = (uint32_t) (tileBounds.size() / 2);
+                    tiles.insert(tiles.end(), table, table + BRICK_VOXELS);
+                    tileBounds.push_back(tileMin);
+                    tileBounds.push_back(tileMax);
+                }
+            }
+        }
+
+        uint32_t tileCount = (uint32_t) (tileBounds.size() / 2),
+                 brickCount = (uint32_t) (brickBounds.size() / 2);
+
+        ref<FileStream> output = new FileStream(outputPath, FileStream::ETruncReadWrite);
+        output->setByteOrder(Stream::ELittleEndian);
+        output->write("SVL", 3);
+        output->writeUChar(1);
+        output->writeInt(channels);
+        res.serialize(output);
+        output->writeUInt(tileCount);
+        output->writeUInt(brickCount);
+        const AABB &aabb = source->aabb;
+        for (int i=0; i<3; ++i)
+            output->writeSingle((float) aabb.min[i]);
+        for (int i=0; i<3; ++i)
+            output->writeSingle((float) aabb.max[i]);
+        output->writeUIntArray(&root[0], root.size());
+        if (tileCount > 0) {
+            output->writeUIntArray(&tiles[0], tiles.size());
+            output->writeSingleArray(&tileBounds[0], tileBounds.size());
+        }
+        if (brickCount > 0) {
+            output->writeSingleArray(&brickBounds[0], brickBounds.size());
+            output->writeSingleArray(&bricks[0], bricks.size());
+        }
+        output->close();
+        delete source;
+
+        size_t totalBricks = (size_t) ((res.x + BRICK_SIZE - 1) >> BRICK_SHIFT)
+            * ((res.y + BRICK_SIZE - 1) >> BRICK_SHIFT) * ((res.z + BRICK_SIZE - 1) >> BRICK_SHIFT);
+        Log(EInfo, "Converted a %s volume in %i ms: kept %u of " SIZE_T_FMT
+            " bricks in %u tiles (%s)", res.toString().c_str(),
+            timer->getMilliseconds(), brickCount, totalBricks, tileCount,
+            memString((size_t) fs::file_size(outputPath)).c_str());
+        return 0;
+    }
+
+    /// Derive the resolution of a 'hgridvolume' from the first of its blocks
+    Vector3i getDictionaryResolution(const fs::path &filename,
+            const std::string &prefix, const std::string &postfix) {
+        ref<FileStream> stream = new FileStream(filename, FileStream::EReadOnly);
+        stream->setByteOrder(Stream::ELittleEndian);
+        stream->seek(6 * sizeof(float));
+        Vector3i blocks(stream);
+        if (stream->isEOF())
+            Log(EError, "The dictionary \"%s\" does not reference any blocks!",
+                filename.string().c_str());
+        Vector3i block(stream);
+
+        fs::path blockFilename = Thread::getThread()->getFileResolver()->resolve(
+            formatString("%s%03i_%03i_%03i%s", prefix.c_str(),
+            block.x, block.y, block.z, postfix.c_str()));
+        ref<FileStream> blockStream = new FileStream(blockFilename, FileStream::EReadOnly);
+        blockStream->setByteOrder(Stream::ELittleEndian);
+        blockStream->seek(8);
+        Vector3i blockRes(blockStream);
+
+        Vector3i res;
+        for (int i=0; i<3; ++i)
+            res[i] = blocks[i] * (blockRes[i] - 1) + 1;
+        return res;
+    }
+
+    MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(SparseVolumeConverter, "Convert dense or hierarchical grid volumes into sparse volumes");
+MTS_NAMESPACE_END
@@ -22,16 +22,97 @@
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/sched.h>
+#include <mitsuba/render/range.h>
 #include <boost/algorithm/string.hpp>
 #if defined(WIN32)
 # include <mitsuba/core/getopt.h>
 #endif
-#ifdef MTS_OPENMP
-# include <omp.h>
-#endif
+#include "exrscanline.h"
 
 MTS_NAMESPACE_BEGIN
 
+/// Processes one input file, identified by its index
+typedef std::function<void (size_t)> TonemapBody;
+
+/// Placeholder result: the files are written by the workers
+class TonemapResult : public WorkResult {
+public:
+    void load(Stream *stream) { }
+    void save(Stream *stream) const { }
+    std::string toString() const { return "TonemapResult[]"; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~TonemapResult() { }
+};
+
+class TonemapWorker : public WorkProcessor {
+public:
+    TonemapWorker(const TonemapBody *body) : m_body(body) { }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Log(EError, "Batch tonemapping is strictly local!");
+    }
+
+    ref<WorkUnit> createWorkUnit() const {
+        return new RangeWorkUnit();
+    }
+
+    ref<WorkResult> createWorkResult() const {
+        return new TonemapResult();
+    }
+
+    ref<WorkProcessor> clone() const {
+        return new TonemapWorker(m_body);
+    }
+
+    void prepare() { }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+        const bool &stop) {
+        const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+        for (size_t i=range->getRangeStart(); i<=range->getRangeEnd() && !stop; ++i)
+            (*m_body)(i);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~TonemapWorker() { }
+private:
+    const TonemapBody *m_body;
+};
+
+/// Hands out one file at a time to the local workers of the scheduler
+class TonemapProcess : public ParallelProcess {
+public:
+    TonemapProcess(size_t count, const TonemapBody &body)
+        : m_count(count), m_next(0), m_body(body) { }
+
+    ref<WorkProcessor> createWorkProcessor() const {
+        return new TonemapWorker(&m_body);
+    }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        if (m_next == m_count)
+            return EFailure;
+        static_cast<RangeWorkUnit *>(unit)->setRange(m_next, m_next);
+        ++m_next;
+        return ESuccess;
+    }
+
+    void processResult(const WorkResult *result, bool cancelled) { }
+
+    bool isLocal() const { return true; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~TonemapProcess() { }
+private:
+    size_t m_count, m_next;
+    TonemapBody m_body;
+};
+
 class Tonemap : public Utility {
 public:
     void help() {
@@ -61,6 +142,8 @@ public:
         cout << "                  frames of an animation using the '-p' option to avoid flicker" << endl << endl;
         cout << "   -o file        Save the output with a given filename" << endl << endl;
         cout << "   -t             Multithreaded: process several files in parallel" << endl << endl;
+        cout << "   -S             Streaming: read OpenEXR files in chunks of scanlines to save" << endl;
+        cout << "                  memory. Not supported in combination with -B and -s" << endl << endl;
         cout << " The operations are ordered as follows: 1. crop, 2. bloom, 3. resize, 4. color" << endl;
         cout << " balance, 5. tonemap, 6. annotate. To simply process a directory full of EXRs" << endl;
         cout << " in parallel, run the following: 'mtsutil tonemap -t path-to-directory/*.exr'" << endl;
@@ -110,6 +193,199 @@ public:
         return bitmap;
     }
 
+    struct TonemapSettings {
+        Float gamma, multiplier;
+        Bitmap::EFileFormat format;
+        Bitmap::EPixelFormat pixelFormat;
+        Float cbal[3];
+        int crop[4];
+        int resize[2];
+        Float tonemapper[2];
+        std::vector<Rect> rects;
+        ref<ReconstructionFilter> rfilter;
+        Float bloomFov;
+        bool streaming;
+    };
+
+    fs::path getOutputFile(const fs::path &inputFile, const TonemapSettings &settings,
+            const std::string &outputFilename) {
+        if (outputFilename != "")
+            return outputFilename;
+
+        fs::path outputFile = inputFile;
+        if (settings.format == Bitmap::EPNG)
+            outputFile.replace_extension(".png");
+        else if (settings.format == Bitmap::EJPEG)
+            outputFile.replace_extension(".jpg");
+        else
+            Log(EError, "Unknown target format!");
+        return outputFile;
+    }
+
+    /**
+     * Tonemap a single file. When a log-average and maximum luminance are
+     * provided (i.e. nonzero), Reinhard's operator uses them instead of
+     * computing its own, and they are updated otherwise.
+     */
+    void tonemapFile(const fs::path &inputFile, const fs::path &outputFile,
+            const TonemapSettings &settings, Float &logAvgLuminance,
+            Float &maxLuminance, ref<Bitmap> &bloomFilter) {
+        ref<Bitmap> output;
+
+#if defined(MTS_HAS_OPENEXR)
+        if (settings.streaming && settings.bloomFov == 0 && settings.resize[0] == -1
+                && EXRScanlineReader::canStream(inputFile)) {
+            output = tonemapStreaming(inputFile, settings, logAvgLuminance, maxLuminance);
+        } else
+#endif
+        {
+            if (settings.streaming)
+                Log(EInfo, "\"%s\" cannot be processed in streaming mode (requires an "
+                    "RGB[A]/Y[A] OpenEXR file, and no bloom or resizing)",
+                    inputFile.filename().string().c_str());
+
+            Log(EInfo, "Loading image \"%s\" ..", inputFile.string().c_str());
+            ref<FileStream> is = new FileStream(inputFile, FileStream::EReadOnly);
+            ref<Bitmap> input = new Bitmap(Bitmap::EAuto, is);
+
+            const int *crop = settings.crop;
+            if (crop[2] != -1 && crop[3] != -1)
+                input = input->crop(Point2i(crop[0], crop[1]), Vector2i(crop[2], crop[3]));
+
+            if (settings.bloomFov != 0) {
+                int maxDim = std::max(input->getWidth(), input->getHeight());
+                if (maxDim % 2 == 0)
+                    ++maxDim;
+
+                if (bloomFilter == NULL || bloomFilter->getWidth() != maxDim)
+                    bloomFilter = computeBloomFilter(maxDim, settings.bloomFov);
+
+                if (input->getComponentFormat() != Bitmap::EFloat)
+                    input = input->convert(input->getPixelFormat(), Bitmap::EFloat);
+
+                Log(EInfo, "Convolving image with bloom filter ..");
+                input->convolve(bloomFilter);
+            }
+
+            if (settings.resize[0] != -1)
+                input = input->resample(settings.rfilter.get(), ReconstructionFilter::EClamp,
+                    ReconstructionFilter::EClamp, Vector2i(settings.resize[0], settings.resize[1]));
+
+            const Float *cbal = settings.cbal;
+            if (cbal[0] != 1 || cbal[1] != 1 || cbal[2] != 1)
+                input->colorBalance(cbal[0], cbal[1], cbal[2]);
+
+            if (settings.tonemapper[0] != -1) {
+                input->tonemapReinhard(logAvgLuminance, maxLuminance,
+                    settings.tonemapper[0], settings.tonemapper[1]);
+                Log(EInfo, "Tonemapper reports: log-average luminance = %f, max. luminance = %f",
+                    logAvgLuminance, maxLuminance);
+            }
+
+            output = input->convert(settings.pixelFormat, Bitmap::EUInt8,
+                settings.gamma, settings.multiplier);
+        }
+
+        for (size_t i=0; i<settings.rects.size(); ++i) {
+            const int *r = settings.rects[i].r;
+            output->drawRect(Point2i(r[0], r[1]), Vector2i(r[2], r[3]), Spectrum(r[4]/255.0f));
+        }
+
+        Log(EInfo, "Writing tonemapped image to \"%s\" ..", outputFile.string().c_str());
+
+        ref<FileStream> os = new FileStream(outputFile, FileStream::ETruncReadWrite);
+        output->write(settings.format, os);
+    }
+
+#if defined(MTS_HAS_OPENEXR)
+    /**
+     * Streaming version of the crop, color balance, tonemapping and
+     * conversion steps: reads the input file in chunks of scanlines, so
+     * that only the 8-bit output has to fit into memory. The statistics of
+     * Reinhard's operator are gathered in a first pass over the file.
+     */
+    ref<Bitmap> tonemapStreaming(const fs::path &inputFile, const TonemapSettings &settings,
+            Float &logAvgLuminance, Float &maxLuminance) {
+        Log(EInfo, "Streaming image \"%s\" ..", inputFile.string().c_str());
+        EXRScanlineReader reader(inputFile);
+
+        Point2i offset(0);
+        Vector2i size = reader.getSize();
+        const int *crop = settings.crop;
+        if (crop[2] != -1 && crop[3] != -1) {
+            if (crop[0] < 0 || crop[1] < 0 || crop[0] + crop[2] > size.x
+                    || crop[1] + crop[3] > size.y)
+                Log(EError, "The crop rectangle lies outside of the image!");
+            offset = Point2i(crop[0], crop[1]);
+            size = Vector2i(crop[2], crop[3]);
+        }
+
+        const Float *cbal = settings.cbal;
+        bool colorBalance = cbal[0] != 1 || cbal[1] != 1 || cbal[2] != 1;
+        bool reinhard = settings.tonemapper[0] != -1;
+        Bitmap::EPixelFormat fmt = reader.getPixelFormat();
+
+        if (reinhard && (logAvgLuminance <= 0 || maxLuminance <= 0)) {
+            /* Pass 1: same statistics as Bitmap::tonemapReinhard() */
+            double logSum = 0;
+            maxLuminance = 0;
+            for (int y=0; y<size.y; y += MTS_EXR_SCANLINE_CHUNK) {
+                int rows = std::min(MTS_EXR_SCANLINE_CHUNK, size.y - y);
+                ref<Bitmap> chunk = readChunk(reader, offset, size.x, y, rows);
+                if (colorBalance)
+                    chunk->colorBalance(cbal[0], cbal[1], cbal[2]);
+
+                const float *ptr = chunk->getFloat32Data();
+                int channels = chunk->getChannelCount();
+                size_t pixels = (size_t) size.x * (size_t) rows;
+                Float chunkLogSum = 0;
+                for (size_t i=0; i<pixels; ++i) {
+                    Float luminance = (fmt == Bitmap::ERGB || fmt == Bitmap::ERGBA)
+                        ? (Float) (ptr[0] * (Float) 0.212671 + ptr[1] * (Float) 0.715160
+                            + ptr[2] * (Float) 0.072169) : (Float) ptr[0];
+                    if (luminance == 1024) // ignore the "rendered by mitsuba banner.."
+                        maxLuminance = 0.0f;
+                    maxLuminance = std::max(maxLuminance, luminance);
+                    chunkLogSum += math::fastlog(1e-3f + luminance);
+                    ptr += channels;
+                }
+                logSum += chunkLogSum;
+            }
+            logAvgLuminance = math::fastexp((Float) (logSum /
+                ((double) size.x * (double) size.y)));
+        }
+
+        /* Pass 2: convert chunk by chunk into the 8-bit output */
+        ref<Bitmap> output = new Bitmap(settings.pixelFormat, Bitmap::EUInt8, size);
+        for (int y=0; y<size.y; y += MTS_EXR_SCANLINE_CHUNK) {
+            int rows = std::min(MTS_EXR_SCANLINE_CHUNK, size.y - y);
+            ref<Bitmap> chunk = readChunk(reader, offset, size.x, y, rows);
+            if (colorBalance)
+                chunk->colorBalance(cbal[0], cbal[1], cbal[2]);
+            if (reinhard)
+                chunk->tonemapReinhard(logAvgLuminance, maxLuminance,
+                    settings.tonemapper[0], settings.tonemapper[1]);
+            output->copyFrom(chunk->convert(settings.pixelFormat, Bitmap::EUInt8,
+                settings.gamma, settings.multiplier), Point2i(0, y));
+        }
+
+        if (reinhard)
+            Log(EInfo, "Tonemapper reports: log-average luminance = %f, max. luminance = %f",
+                logAvgLuminance, maxLuminance);
+
+        return output;
+    }
+
+    /// Read the rows <tt>[y, y+rows)</tt> of a crop window that starts at \c offset
+    ref<Bitmap> readChunk(EXRScanlineReader &reader, const Point2i &offset,
+            int width, int y, int rows) {
+        ref<Bitmap> chunk = reader.read(offset.y + y, rows);
+        if (offset.x != 0 || width != chunk->getWidth())
+            chunk = chunk->crop(Point2i(offset.x, 0), Vector2i(width, rows));
+        return chunk;
+    }
+#endif
+
     int run(int argc, char **argv) {
         ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver();
         int optchar;
@@ -126,13 +402,13 @@ public:
         std::string outputFilename;
         Bitmap::EPixelFormat pixelFormat = Bitmap::ERGB;
         Float logAvgLuminance = 0, maxLuminance = 0;
-        bool runParallel = false;
-        ReconstructionFilter *rfilter = NULL;
+        bool runParallel = false, streaming = false;
+        ref<ReconstructionFilter> rfilter;
         Float bloomFov = 0;
         std::string rfilterName = "lanczos";
 
         /* Parse command-line arguments */
-        while ((optchar = getopt(argc, argv, "htxag:m:f:r:b:c:o:p:s:B:F:")) != -1) {
+        while ((optchar = getopt(argc, argv, "htxaSg:m:f:r:b:c:o:p:s:B:F:")) != -1) {
             switch (optchar) {
                 case 'h': {
                         help();
@@ -257,6 +533,10 @@ public:
                 case 't':
                     runParallel = true;
                     break;
+
+                case 'S':
+                    streaming = true;
+                    break;
             }
         }
 
@@ -287,80 +567,49 @@ public:
             rfilter->configure();
         }
 
-        if (runParallel) {
-            ref<Logger> logger = Thread::getThread()->getLogger();
-            std::vector<std::string> messages;
-
-            #if defined(MTS_OPENMP)
-                #pragma omp parallel for schedule(static)
-            #endif
-            for (int i=optind; i<argc; ++i) {
-                Thread *thread = Thread::getThread();
-                if (!thread) {
-                    thread = Thread::registerUnmanagedThread("omp");
-                    thread->setLogger(logger);
-                }
-                try {
-                    fs::path inputFile = fileResolver->resolve(argv[i]);
-                    Log(EInfo, "Loading image \"%s\" ..", inputFile.string().c_str());
-                    ref<FileStream> is = new FileStream(inputFile, FileStream::EReadOnly);
-                    ref<Bitmap> input = new Bitmap(Bitmap::EAuto, is);
-
-                    if (crop[2] != -1 && crop[3] != -1)
-                        input = input->crop(Point2i(crop[0], crop[1]), Vector2i(crop[2], crop[3]));
-
-                    if (bloomFov != 0) {
-                        int maxDim = std::max(input->getWidth(), input->getHeight());
-                        if (maxDim % 2 == 0)
-                            ++maxDim;
-
-                        ref<Bitmap> bloomFilter = computeBloomFilter(maxDim, bloomFov);
-
-                        if (input->getComponentFormat() != Bitmap::EFloat)
-                            input = input->convert(input->getPixelFormat(), Bitmap::EFloat);
-
-                        Log(EInfo, "Convolving image with bloom filter ..");
-                        input->convolve(bloomFilter);
-                    }
+        TonemapSettings settings;
+        settings.gamma = gamma;
+        settings.multiplier = multiplier;
+        settings.format = format;
+        settings.pixelFormat = pixelFormat;
+        for (int i=0; i<3; ++i)
+            settings.cbal[i] = cbal[i];
+        for (int i=0; i<4; ++i)
+            settings.crop[i] = crop[i];
+        for (int i=0; i<2; ++i) {
+            settings.resize[i] = resize[i];
+            settings.tonemapper[i] = tonemapper[i];
+        }
+        settings.rects = rects;
+        settings.rfilter = rfilter;
+        settings.bloomFov = bloomFov;
+        settings.streaming = streaming;
 
-                    if (resize[0] != -1)
-                        input = input->resample(rfilter, ReconstructionFilter::EClamp,
-                                ReconstructionFilter::EClamp, Vector2i(resize[0], resize[1]));
+        if (runParallel) {
+            std::vector<fs::path> inputFiles;
+            for (int i=optind; i<argc; ++i)
+                inputFiles.push_back(fileResolver->resolve(argv[i]));
 
-                    if (cbal[0] != 1 || cbal[1] != 1 || cbal[2] != 1)
-                        input->colorBalance(cbal[0], cbal[1], cbal[2]);
+            std::vector<std::string> messages;
+            ref<Mutex> mutex = new Mutex();
 
-                    if (tonemapper[0] != -1) {
+            /* One file per work unit on the local workers of the scheduler */
+            ref<Scheduler> sched = Scheduler::getInstance();
+            ref<TonemapProcess> proc = new TonemapProcess(inputFiles.size(),
+                [&](size_t i) {
+                    try {
                         Float logAvgLuminance = 0, maxLuminance = 0;
-                        input->tonemapReinhard(logAvgLuminance, maxLuminance, tonemapper[0], tonemapper[1]);
-                        Log(EInfo, "Tonemapper reports: log-average luminance = %f, max. luminance = %f",
-                            logAvgLuminance, maxLuminance);
-                    }
-
-                    ref<Bitmap> output = input->convert(pixelFormat, Bitmap::EUInt8, gamma, multiplier);
-
-                    for (size_t i=0; i<rects.size(); ++i) {
-                        int *r = rects[i].r;
-                        output->drawRect(Point2i(r[0], r[1]), Vector2i(r[2], r[3]), Spectrum(r[4]/255.0f));
+                        ref<Bitmap> bloomFilter;
+                        tonemapFile(inputFiles[i], getOutputFile(inputFiles[i], settings, ""),
+                            settings, logAvgLuminance, maxLuminance, bloomFilter);
+                    } catch (const std::exception &e) {
+                        LockGuard lock(mutex);
+                        messages.push_back(e.what());
                     }
+                });
+            sched->schedule(proc);
+            sched->wait(proc);
 
-                    fs::path outputFile = inputFile;
-                    if (format == Bitmap::EPNG)
-                        outputFile.replace_extension(".png");
-                    else if (format == Bitmap::EJPEG)
-                        outputFile.replace_extension(".jpg");
-                    else
-                        Log(EError, "Unknown target format!");
-
-                    Log(EInfo, "Writing tonemapped image to \"%s\" ..", outputFile.string().c_str());
-
-                    ref<FileStream> os = new FileStream(outputFile, FileStream::ETruncReadWrite);
-                    output->write(format, os);
-                } catch (const std::exception &e) {
-                    #pragma omp critical
-                    messages.push_back(e.what());
-                }
-            }
             if (!messages.empty()) {
                 Log(EWarn, "The tonemapping worker threads encountered several issues:");
                 for (size_t i=0; i<messages.size(); ++i)
@@ -370,68 +619,13 @@ public:
             ref<Bitmap> bloomFilter;
             for (int i=optind; i<argc; ++i) {
                 fs::path inputFile = fileResolver->resolve(argv[i]);
-                Log(EInfo, "Loading image \"%s\" ..", inputFile.string().c_str());
-                ref<FileStream> is = new FileStream(inputFile, FileStream::EReadOnly);
-                ref<Bitmap> input = new Bitmap(Bitmap::EAuto, is);
-
-                if (crop[2] != -1 && crop[3] != -1)
-                    input = input->crop(Point2i(crop[0], crop[1]), Vector2i(crop[2], crop[3]));
-
-                if (bloomFov != 0) {
-                    int maxDim = std::max(input->getWidth(), input->getHeight());
-                    if (maxDim % 2 == 0)
-                        ++maxDim;
-
-                    if (bloomFilter == NULL || bloomFilter->getWidth() != maxDim)
-                        bloomFilter = computeBloomFilter(maxDim, bloomFov);
+                tonemapFile(inputFile, getOutputFile(inputFile, settings, outputFilename),
+                    settings, logAvgLuminance, maxLuminance, bloomFilter);
 
-                    if (input->getComponentFormat() != Bitmap::EFloat)
-                        input = input->convert(input->getPixelFormat(), Bitmap::EFloat);
-
-                    Log(EInfo, "Convolving image with bloom filter ..");
-                    input->convolve(bloomFilter);
+                if (!temporalCoherence) {
+                    logAvgLuminance = 0;
+                    maxLuminance = 0;
                 }
-
-                if (resize[0] != -1)
-                    input = input->resample(rfilter, ReconstructionFilter::EClamp,
-                        ReconstructionFilter::EClamp, Vector2i(resize[0], resize[1]));
-
-                if (cbal[0] != 1 || cbal[1] != 1 || cbal[2] != 1)
-                    input->colorBalance(cbal[0], cbal[1], cbal[2]);
-
-                if (tonemapper[0] != -1) {
-                    input->tonemapReinhard(logAvgLuminance, maxLuminance, tonemapper[0], tonemapper[1]);
-                    Log(EInfo, "Tonemapper reports: log-average luminance = %f, max. luminance = %f",
-                        logAvgLuminance, maxLuminance);
-                    if (!temporalCoherence) {
-                        logAvgLuminance = 0;
-                        maxLuminance = 0;
-                    }
-                }
-
-                ref<Bitmap> output = input->convert(pixelFormat, Bitmap::EUInt8, gamma, multiplier);
-
-                for (size_t i=0; i<rects.size(); ++i) {
-                    int *r = rects[i].r;
-                    output->drawRect(Point2i(r[0], r[1]), Vector2i(r[2], r[3]), Spectrum(r[4]/255.0f));
-                }
-
-                fs::path outputFile = inputFile;
-                if (outputFilename == "") {
-                    if (format == Bitmap::EPNG)
-                        outputFile.replace_extension(".png");
-                    else if (format == Bitmap::EJPEG)
-                        outputFile.replace_extension(".jpg");
-                    else
-                        Log(EError, "Unknown target format!");
-                } else {
-                    outputFile = outputFilename;
-                }
-
-                Log(EInfo, "Writing tonemapped image to \"%s\" ..", outputFile.string().c_str());
-
-                ref<FileStream> os = new FileStream(outputFile, FileStream::ETruncReadWrite);
-                output->write(format, os);
             }
         }
         return 0;
@@ -440,5 +634,8 @@ public:
     MTS_DECLARE_UTILITY()
 };
 
+MTS_IMPLEMENT_CLASS(TonemapResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS(TonemapWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(TonemapProcess, false, ParallelProcess)
 MTS_EXPORT_UTILITY(Tonemap, "Command line batch tonemapper")
 MTS_NAMESPACE_END
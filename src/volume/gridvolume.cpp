@@ -29,6 +29,12 @@
 // Number of power iteration steps used to find the dominant direction
 #define POWER_ITERATION_STEPS 5
 
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+#include <mitsuba/core/sse.h>
+// Compute the interpolation weights and float-valued lookups using SSE
+#define GRIDVOLUME_SSE 1
+#endif
+
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{gridvolume}{Grid-based volume data source}
@@ -200,6 +206,11 @@ public:
         for (int i=0; i<8; ++i)
             m_aabb.expandBy(m_volumeToWorld(m_dataAABB.getCorner(i)));
 
+        /* Offsets of the voxels of an interpolation cell */
+        for (int k=0; k<8; ++k)
+            m_offsets[k] = (((k & 4) ? (size_t) m_res.y : 0) +
+                ((k & 2) ? 1 : 0)) * m_res.x + ((k & 1) ? 1 : 0);
+
         /* Precompute cosine and sine lookup tables */
         for (int i=0; i<255; i++) {
             Float angle = (float) i * ((float) M_PI / 255.0f);
@@ -286,259 +297,270 @@ public:
         m_data = (uint8_t *) (((float *) m_mmap->getData()) + 12);
     }
 
+    /// Interpolation cell of a lookup
+    struct Cell {
+        /// Linear index of the voxel at the lower corner of the cell
+        size_t index;
+
+        /// Trilinear weights of the 8 voxels of the cell (X varies fastest)
+        union {
+#if defined(GRIDVOLUME_SSE)
+            __m128 ps[2];
+#endif
+            Float f[8];
+        } weights;
+    };
+
     /**
-     * This is needed since Mitsuba might be
-     * compiled with either single/double precision
+     * \brief Locate the cell containing a position in grid space and
+     * compute the interpolation weights of its voxels.
+     *
+     * Returns \c false when the position lies outside of the grid.
      */
-    struct float3 {
-        float value[3];
+    FINLINE bool locate(const Point &p, Cell &cell) const {
+        const int x1 = math::floorToInt(p.x),
+              y1 = math::floorToInt(p.y),
+              z1 = math::floorToInt(p.z);
 
-        inline float3() { }
+        if (x1 < 0 || y1 < 0 || z1 < 0 || x1+1 >= m_res.x ||
+            y1+1 >= m_res.y || z1+1 >= m_res.z)
+            return false;
 
-        inline float3(float a, float b, float c) {
-            value[0] = a; value[1] = b; value[2] = c;
-        }
+        const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1,
+                _fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
 
-        inline explicit float3(double a, double b, double c) {
-            value[0] = (float) a; value[1] = (float) b; value[2] = (float) c;
+        cell.index = ((size_t) z1 * m_res.y + y1) * m_res.x + x1;
+#if defined(GRIDVOLUME_SSE)
+        const __m128 wxy = _mm_mul_ps(
+            _mm_set_ps(fx, _fx, fx, _fx), _mm_set_ps(fy, fy, _fy, _fy));
+        cell.weights.ps[0] = _mm_mul_ps(wxy, _mm_set1_ps(_fz));
+        cell.weights.ps[1] = _mm_mul_ps(wxy, _mm_set1_ps(fz));
+#else
+        const Float wxy[4] = { _fx*_fy, fx*_fy, _fx*fy, fx*fy };
+        for (int k=0; k<4; ++k) {
+            cell.weights.f[k]   = wxy[k] * _fz;
+            cell.weights.f[k+4] = wxy[k] * fz;
         }
+#endif
+        return true;
+    }
 
-        inline float3 operator*(Float v) const {
-            return float3((float) (value[0]*v), (float) (value[1]*v), (float) (value[2]*v));
-        }
+    /// Convert a stored voxel value into a floating point value
+    FINLINE Float toFloat(float value) const { return value; }
+    FINLINE Float toFloat(uint8_t value) const { return m_densityMap[value]; }
 
-        inline float3 operator+(const float3 &f2) const {
-            return float3(value[0]+f2.value[0], value[1]+f2.value[1], value[2]+f2.value[2]);
-        }
+#if defined(GRIDVOLUME_SSE)
+    /// Load the 4 voxels of one Z slice of a cell
+    FINLINE __m128 fetchSlice(const float *data) const {
+        return _mm_loadh_pi(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *) data)),
+            (const __m64 *) (data + m_res.x));
+    }
 
-        inline Spectrum toSpectrum() const {
-            Spectrum result;
-            result.fromLinearRGB(value[0], value[1], value[2]);
-            return result;
-        }
+    FINLINE __m128 fetchSlice(const uint8_t *data) const {
+        const uint8_t *row = data + m_res.x;
+        return _mm_set_ps(m_densityMap[row[1]], m_densityMap[row[0]],
+            m_densityMap[data[1]], m_densityMap[data[0]]);
+    }
 
-        inline Vector toVector() const {
-            return Vector(value[0], value[1], value[2]);
-        }
+    /// Load the three channels of a voxel
+    FINLINE __m128 fetchRGB(const float *value) const {
+        return _mm_movelh_ps(_mm_castsi128_ps(_mm_loadl_epi64(
+            (const __m128i *) value)), _mm_load_ss(value + 2));
+    }
+
+    FINLINE __m128 fetchRGB(const uint8_t *value) const {
+        return _mm_set_ps(0.0f, m_densityMap[value[2]],
+            m_densityMap[value[1]], m_densityMap[value[0]]);
+    }
+#endif
 
-        float operator[](int i) const {
-            return value[i];
+    /// Interpolate single-channel data of type \c T
+    template <typename T> FINLINE Float interpolateFloat(const Cell &cell) const {
+        const T *data = ((const T *) m_data) + cell.index;
+#if defined(GRIDVOLUME_SSE)
+        __m128 sum = _mm_add_ps(
+            _mm_mul_ps(fetchSlice(data), cell.weights.ps[0]),
+            _mm_mul_ps(fetchSlice(data + m_offsets[4]), cell.weights.ps[1]));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+#else
+        Float result = 0;
+        for (int k=0; k<8; ++k)
+            result += cell.weights.f[k] * toFloat(data[m_offsets[k]]);
+        return result;
+#endif
+    }
+
+    /// Interpolate three-channel data of type \c T
+    template <typename T> FINLINE Spectrum interpolateSpectrum(const Cell &cell) const {
+        const T *data = ((const T *) m_data) + 3 * cell.index;
+#if defined(GRIDVOLUME_SSE)
+        const __m128 w0 = cell.weights.ps[0], w1 = cell.weights.ps[1];
+        __m128 sum = _mm_mul_ps(fetchRGB(data), splat_ps(w0, 0));
+        sum = _mm_add_ps(sum, _mm_mul_ps(fetchRGB(data + 3 * m_offsets[1]), splat_ps(w0, 1)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(fetchRGB(data + 3 * m_offsets[2]), splat_ps(w0, 2)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(fetchRGB(data + 3 * m_offsets[3]), splat_ps(w0, 3)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(fetchRGB(data + 3 * m_offsets[4]), splat_ps(w1, 0)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(fetchRGB(data + 3 * m_offsets[5]), splat_ps(w1, 1)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(fetchRGB(data + 3 * m_offsets[6]), splat_ps(w1, 2)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(fetchRGB(data + 3 * m_offsets[7]), splat_ps(w1, 3)));
+        SSEVector rgb(sum);
+        Spectrum result;
+        result.fromLinearRGB(rgb.f0, rgb.f1, rgb.f2);
+#else
+        Float rgb[3] = { 0.0f, 0.0f, 0.0f };
+        for (int k=0; k<8; ++k) {
+            const T *value = data + 3 * m_offsets[k];
+            const Float weight = cell.weights.f[k];
+            for (int i=0; i<3; ++i)
+                rgb[i] += weight * toFloat(value[i]);
         }
+        Spectrum result;
+        result.fromLinearRGB(rgb[0], rgb[1], rgb[2]);
+#endif
+        return result;
+    }
 
-        inline Matrix3x3 tensor() const {
-            return Matrix3x3(
-                value[0]*value[0], value[0]*value[1], value[0]*value[2],
-                value[1]*value[0], value[1]*value[1], value[1]*value[2],
-                value[2]*value[0], value[2]*value[1], value[2]*value[2]
-            );
+    /// Fetch a direction stored with \c float32 or quantized encoding
+    FINLINE Vector fetchDirection(size_t index) const {
+        if (m_volumeType == EFloat32) {
+            const float *value = ((const float *) m_data) + 3 * index;
+            return Vector(value[0], value[1], value[2]);
+        } else {
+            return lookupQuantizedDirection(index);
         }
-    };
+    }
 
-    Float lookupFloat(const Point &_p) const {
+    template <typename T> void lookupFloatSequence(const Point &_p,
+            const Vector &_increment, size_t count, Float *values) const {
         const Point p = m_worldToGrid.transformAffine(_p);
-        const int x1 = math::floorToInt(p.x),
-              y1 = math::floorToInt(p.y),
-              z1 = math::floorToInt(p.z),
-              x2 = x1+1, y2 = y1+1, z2 = z1+1;
+        const Vector increment = m_worldToGrid(_increment);
+        Cell cell;
+        for (size_t i=0; i<count; ++i) {
+            if (locate(p + increment * (Float) i, cell))
+                values[i] = interpolateFloat<T>(cell);
+            else
+                values[i] = 0.0f;
+        }
+    }
 
-        if (x1 < 0 || y1 < 0 || z1 < 0 || x2 >= m_res.x ||
-            y2 >= m_res.y || z2 >= m_res.z)
-            return 0;
+    Float lookupFloat(const Point &p) const {
+        Cell cell;
+        if (!locate(m_worldToGrid.transformAffine(p), cell))
+            return 0.0f;
 
-        const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1,
-                _fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
+        switch (m_volumeType) {
+            case EFloat32: return interpolateFloat<float>(cell);
+            case EUInt8:   return interpolateFloat<uint8_t>(cell);
+            default:       return 0.0f;
+        }
+    }
 
+    void lookupFloatSequence(const Point &p, const Vector &increment,
+            size_t count, Float *values) const {
         switch (m_volumeType) {
-            case EFloat32: {
-                const float *floatData = (float *) m_data;
-                const Float
-                    d000 = floatData[(z1*m_res.y + y1)*m_res.x + x1],
-                    d001 = floatData[(z1*m_res.y + y1)*m_res.x + x2],
-                    d010 = floatData[(z1*m_res.y + y2)*m_res.x + x1],
-                    d011 = floatData[(z1*m_res.y + y2)*m_res.x + x2],
-                    d100 = floatData[(z2*m_res.y + y1)*m_res.x + x1],
-                    d101 = floatData[(z2*m_res.y + y1)*m_res.x + x2],
-                    d110 = floatData[(z2*m_res.y + y2)*m_res.x + x1],
-                    d111 = floatData[(z2*m_res.y + y2)*m_res.x + x2];
-
-                return ((d000*_fx + d001*fx)*_fy +
-                        (d010*_fx + d011*fx)*fy)*_fz +
-                       ((d100*_fx + d101*fx)*_fy +
-                        (d110*_fx + d111*fx)*fy)*fz;
-            }
-            case EUInt8: {
-                const Float
-                    d000 = m_densityMap[m_data[(z1*m_res.y + y1)*m_res.x + x1]],
-                    d001 = m_densityMap[m_data[(z1*m_res.y + y1)*m_res.x + x2]],
-                    d010 = m_densityMap[m_data[(z1*m_res.y + y2)*m_res.x + x1]],
-                    d011 = m_densityMap[m_data[(z1*m_res.y + y2)*m_res.x + x2]],
-                    d100 = m_densityMap[m_data[(z2*m_res.y + y1)*m_res.x + x1]],
-                    d101 = m_densityMap[m_data[(z2*m_res.y + y1)*m_res.x + x2]],
-                    d110 = m_densityMap[m_data[(z2*m_res.y + y2)*m_res.x + x1]],
-                    d111 = m_densityMap[m_data[(z2*m_res.y + y2)*m_res.x + x2]];
-
-                return ((d000*_fx + d001*fx)*_fy +
-                        (d010*_fx + d011*fx)*fy)*_fz +
-                       ((d100*_fx + d101*fx)*_fy +
-                        (d110*_fx + d111*fx)*fy)*fz;
-            }
-            default:
-                return 0.0f;
+            case EFloat32: lookupFloatSequence<float>(p, increment, count, values); break;
+            case EUInt8:   lookupFloatSequence<uint8_t>(p, increment, count, values); break;
+            default:       std::fill(values, values + count, (Float) 0.0f);
         }
     }
 
-    Spectrum lookupSpectrum(const Point &_p) const {
+    /**
+     * Selects one of the voxels of the cell with a probability equal to
+     * its interpolation weight. This is equivalent to jittering the lookup
+     * position by up to half a voxel and fetching the nearest voxel.
+     */
+    Float lookupFloatStochastic(const Point &_p, Float sample) const {
         const Point p = m_worldToGrid.transformAffine(_p);
+#if defined(GRIDVOLUME_SSE)
+        Cell cell;
+        if (!locate(p, cell))
+            return 0.0f;
+
+        /* Count the voxels whose cumulative weight does not exceed the
+           sample. The masks are contiguous runs of set bits starting at
+           the lowest one, so a table lookup gives their length. */
+        static const int runLength[16] = { 0, 1, 0, 2, 0, 0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 4 };
+        __m128 c0 = cell.weights.ps[0], c1 = cell.weights.ps[1];
+        c0 = _mm_add_ps(c0, epi32tops(_mm_slli_si128(pstoepi32(c0), 4)));
+        c0 = _mm_add_ps(c0, epi32tops(_mm_slli_si128(pstoepi32(c0), 8)));
+        c1 = _mm_add_ps(c1, epi32tops(_mm_slli_si128(pstoepi32(c1), 4)));
+        c1 = _mm_add_ps(c1, epi32tops(_mm_slli_si128(pstoepi32(c1), 8)));
+        c1 = _mm_add_ps(c1, splat_ps(c0, 3));
+        const __m128 s = _mm_set1_ps(sample);
+        int k = runLength[_mm_movemask_ps(_mm_cmple_ps(c0, s))]
+              + runLength[_mm_movemask_ps(_mm_cmple_ps(c1, s))];
+        const size_t index = cell.index + m_offsets[std::min(k, 7)];
+#else
         const int x1 = math::floorToInt(p.x),
               y1 = math::floorToInt(p.y),
-              z1 = math::floorToInt(p.z),
-              x2 = x1+1, y2 = y1+1, z2 = z1+1;
+              z1 = math::floorToInt(p.z);
+
+        if (x1 < 0 || y1 < 0 || z1 < 0 || x1+1 >= m_res.x ||
+            y1+1 >= m_res.y || z1+1 >= m_res.z)
+            return 0.0f;
+
+        const Float f[3] = { p.x - x1, p.y - y1, p.z - z1 };
+        size_t index = ((size_t) z1 * m_res.y + y1) * m_res.x + x1;
+
+        /* Choose the upper neighbor along each axis in turn,
+           and reuse the remaining randomness of the sample */
+        for (int i=0; i<3; ++i) {
+            if (sample < f[i]) {
+                index += m_offsets[1 << i];
+                sample /= f[i];
+            } else {
+                sample = (sample - f[i]) / (1 - f[i]);
+            }
+        }
+#endif
 
-        if (x1 < 0 || y1 < 0 || z1 < 0 || x2 >= m_res.x ||
-            y2 >= m_res.y || z2 >= m_res.z)
-            return Spectrum(0.0f);
+        switch (m_volumeType) {
+            case EFloat32: return ((const float *) m_data)[index];
+            case EUInt8:   return m_densityMap[m_data[index]];
+            default:       return 0.0f;
+        }
+    }
 
-        const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1,
-                _fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
+    Spectrum lookupSpectrum(const Point &p) const {
+        Cell cell;
+        if (!locate(m_worldToGrid.transformAffine(p), cell))
+            return Spectrum(0.0f);
 
         switch (m_volumeType) {
-            case EFloat32: {
-                const float3 *spectrumData = (float3 *) m_data;
-                const float3
-                    &d000 = spectrumData[(z1*m_res.y + y1)*m_res.x + x1],
-                    &d001 = spectrumData[(z1*m_res.y + y1)*m_res.x + x2],
-                    &d010 = spectrumData[(z1*m_res.y + y2)*m_res.x + x1],
-                    &d011 = spectrumData[(z1*m_res.y + y2)*m_res.x + x2],
-                    &d100 = spectrumData[(z2*m_res.y + y1)*m_res.x + x1],
-                    &d101 = spectrumData[(z2*m_res.y + y1)*m_res.x + x2],
-                    &d110 = spectrumData[(z2*m_res.y + y2)*m_res.x + x1],
-                    &d111 = spectrumData[(z2*m_res.y + y2)*m_res.x + x2];
-
-                return (((d000*_fx + d001*fx)*_fy +
-                         (d010*_fx + d011*fx)*fy)*_fz +
-                        ((d100*_fx + d101*fx)*_fy +
-                         (d110*_fx + d111*fx)*fy)*fz).toSpectrum();
-                }
-            case EUInt8: {
-                const float3
-                    d000 = float3(
-                        m_densityMap[m_data[3*((z1*m_res.y + y1)*m_res.x + x1)+0]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y1)*m_res.x + x1)+1]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y1)*m_res.x + x1)+2]]),
-                    d001 = float3(
-                        m_densityMap[m_data[3*((z1*m_res.y + y1)*m_res.x + x2)+0]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y1)*m_res.x + x2)+1]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y1)*m_res.x + x2)+2]]),
-                    d010 = float3(
-                        m_densityMap[m_data[3*((z1*m_res.y + y2)*m_res.x + x1)+0]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y2)*m_res.x + x1)+1]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y2)*m_res.x + x1)+2]]),
-                    d011 = float3(
-                        m_densityMap[m_data[3*((z1*m_res.y + y2)*m_res.x + x2)+0]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y2)*m_res.x + x2)+1]],
-                        m_densityMap[m_data[3*((z1*m_res.y + y2)*m_res.x + x2)+2]]),
-                    d100 = float3(
-                        m_densityMap[m_data[3*((z2*m_res.y + y1)*m_res.x + x1)+0]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y1)*m_res.x + x1)+1]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y1)*m_res.x + x1)+2]]),
-                    d101 = float3(
-                        m_densityMap[m_data[3*((z2*m_res.y + y1)*m_res.x + x2)+0]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y1)*m_res.x + x2)+1]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y1)*m_res.x + x2)+2]]),
-                    d110 = float3(
-                        m_densityMap[m_data[3*((z2*m_res.y + y2)*m_res.x + x1)+0]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y2)*m_res.x + x1)+1]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y2)*m_res.x + x1)+2]]),
-                    d111 = float3(
-                        m_densityMap[m_data[3*((z2*m_res.y + y2)*m_res.x + x2)+0]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y2)*m_res.x + x2)+1]],
-                        m_densityMap[m_data[3*((z2*m_res.y + y2)*m_res.x + x2)+2]]);
-
-                return (((d000*_fx + d001*fx)*_fy +
-                         (d010*_fx + d011*fx)*fy)*_fz +
-                        ((d100*_fx + d101*fx)*_fy +
-                         (d110*_fx + d111*fx)*fy)*fz).toSpectrum();
-
-                }
-            default: return Spectrum(0.0f);
+            case EFloat32: return interpolateSpectrum<float>(cell);
+            case EUInt8:   return interpolateSpectrum<uint8_t>(cell);
+            default:       return Spectrum(0.0f);
         }
     }
 
-    Vector lookupVector(const Point &_p) const {
-        const Point p = m_worldToGrid.transformAffine(_p);
-        const int x1 = math::floorToInt(p.x),
-              y1 = math::floorToInt(p.y),
-              z1 = math::floorToInt(p.z),
-              x2 = x1+1, y2 = y1+1, z2 = z1+1;
-
-        if (x1 < 0 || y1 < 0 || z1 < 0 || x2 >= m_res.x ||
-            y2 >= m_res.y || z2 >= m_res.z)
+    Vector lookupVector(const Point &p) const {
+        Cell cell;
+        if ((m_volumeType != EFloat32 && m_volumeType != EQuantizedDirections)
+            || !locate(m_worldToGrid.transformAffine(p), cell))
             return Vector(0.0f);
 
-        const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1;
         Vector value;
-
         #if defined(VINTERP_NEAREST_NEIGHBOR)
-            /* Nearest neighbor */
-            switch (m_volumeType) {
-                case EFloat32: {
-                    const float3 *vectorData = (float3 *) m_data;
-                    value = vectorData[
-                        (((fz < .5) ? z1 : z2) * m_res.y +
-                        ((fy < .5) ? y1 : y2)) * m_res.x +
-                        ((fx < .5) ? x1 : x2)].toVector();
-                    }
-                    break;
-                case EQuantizedDirections: {
-                    value = lookupQuantizedDirection(
-                        (((fz < .5) ? z1 : z2) * m_res.y +
-                        ((fy < .5) ? y1 : y2)) * m_res.x +
-                        ((fx < .5) ? x1 : x2));
-                    }
-                    break;
-                default:
-                    return Vector(0.0f);
+            /* Nearest neighbor: the voxel with the largest weight */
+            int nearest = 0;
+            for (int k=1; k<8; ++k) {
+                if (cell.weights.f[k] > cell.weights.f[nearest])
+                    nearest = k;
             }
+            value = fetchDirection(cell.index + m_offsets[nearest]);
         #else
-            Float _fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
-
             Matrix3x3 tensor(0.0f);
-            switch (m_volumeType) {
-                case EFloat32: {
-                        const float3 *vectorData = (float3 *) m_data;
-                        for (int k=0; k<8; ++k) {
-                            uint32_t index = (((k & 4) ? z2 : z1) * m_res.y +
-                                ((k & 2) ? y2 : y1)) * m_res.x + ((k & 1) ? x2 : x1);
-                            Float factor = ((k & 1) ? fx : _fx) * ((k & 2) ? fy : _fy)
-                                * ((k & 4) ? fz : _fz);
-                            Vector d = vectorData[index].toVector();
-                            tensor(0, 0) += factor * d.x * d.x;
-                            tensor(0, 1) += factor * d.x * d.y;
-                            tensor(0, 2) += factor * d.x * d.z;
-                            tensor(1, 1) += factor * d.y * d.y;
-                            tensor(1, 2) += factor * d.y * d.z;
-                            tensor(2, 2) += factor * d.z * d.z;
-                        }
-                    }
-                    break;
-                case EQuantizedDirections: {
-                        for (int k=0; k<8; ++k) {
-                            uint32_t index = (((k & 4) ? z2 : z1) * m_res.y +
-                                ((k & 2) ? y2 : y1)) * m_res.x + ((k & 1) ? x2 : x1);
-                            Float factor = ((k & 1) ? fx : _fx) * ((k & 2) ? fy : _fy)
-                                * ((k & 4) ? fz : _fz);
-                            Vector d = lookupQuantizedDirection(index);
-                            tensor(0, 0) += factor * d.x * d.x;
-                            tensor(0, 1) += factor * d.x * d.y;
-                            tensor(0, 2) += factor * d.x * d.z;
-                            tensor(1, 1) += factor * d.y * d.y;
-                            tensor(1, 2) += factor * d.y * d.z;
-                            tensor(2, 2) += factor * d.z * d.z;
-                        }
-                    }
-                    break;
-                default:
-                    return Vector(0.0f);
+            for (int k=0; k<8; ++k) {
+                Float factor = cell.weights.f[k];
+                Vector d = fetchDirection(cell.index + m_offsets[k]);
+                tensor(0, 0) += factor * d.x * d.x;
+                tensor(0, 1) += factor * d.x * d.y;
+                tensor(0, 2) += factor * d.x * d.z;
+                tensor(1, 1) += factor * d.y * d.y;
+                tensor(1, 2) += factor * d.y * d.z;
+                tensor(2, 2) += factor * d.z * d.z;
             }
 
             tensor(1, 0) = tensor(0, 1);
@@ -617,6 +639,7 @@ protected:
     Transform m_volumeToWorld;
     Float m_stepSize;
     AABB m_dataAABB;
+    size_t m_offsets[8];
     ref<MemoryMappedFile> m_mmap;
     Float m_cosTheta[256], m_sinTheta[256];
     Float m_cosPhi[256], m_sinPhi[256];
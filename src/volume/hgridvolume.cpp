@@ -21,13 +21,25 @@
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/lock.h>
 
 MTS_NAMESPACE_BEGIN
 
+static StatsCounter statsBlockLoads("Hierarchical grid", "Block loads");
+static StatsCounter statsBlockEvictions("Hierarchical grid", "Block evictions");
+
 /**
  * This class implements a two-layer hierarchical grid
  * using 'gridvolume'-based files. It loads a dictionary
  * and then proceeds to map volume data into memory
+ *
+ * When 'lazyLoading' is set, only the headers of the blocks are read
+ * up front, and a block is mapped into memory the first time that a
+ * lookup touches its cell. The optional 'residencyLimit' (in MiB, 0 means
+ * unlimited) then bounds the total size of the mapped blocks: blocks that
+ * were not used recently are released again using a second chance (clock)
+ * policy, and get mapped again when they are needed later on.
  */
 class HierarchicalGridDataSource : public VolumeDataSource {
 public:
@@ -36,6 +48,8 @@ public:
         m_volumeToWorld = props.getTransform("toWorld", Transform());
         m_prefix = props.getString("prefix");
         m_postfix = props.getString("postfix");
+        m_lazyLoading = props.getBoolean("lazyLoading", false);
+        m_residencyLimit = (size_t) props.getLong("residencyLimit", 0) * 1024 * 1024;
         std::string filename = props.getString("filename");
         loadDictionary(filename);
     }
@@ -46,6 +60,8 @@ public:
         std::string filename = stream->readString();
         m_prefix = stream->readString();
         m_postfix = stream->readString();
+        m_lazyLoading = stream->readBool();
+        m_residencyLimit = stream->readSize();
         loadDictionary(filename);
     }
 
@@ -65,6 +81,8 @@ public:
         stream->writeString(m_filename);
         stream->writeString(m_prefix);
         stream->writeString(m_postfix);
+        stream->writeBool(m_lazyLoading);
+        stream->writeSize(m_residencyLimit);
     }
 
     void loadDictionary(const std::string &filename) {
@@ -93,23 +111,55 @@ public:
         m_supportsSpectrumLookups = true;
         m_stepSize = std::numeric_limits<Float>::infinity();
 
+        if (m_lazyLoading) {
+            m_lazyBlocks.resize(nCells);
+            m_residentBytes = 0;
+            m_clockHand = 0;
+            m_resident.clear();
+            m_residencyMutex = new Mutex();
+            m_blockLocks.resize(EBlockLocks);
+            for (int i=0; i<EBlockLocks; ++i)
+                m_blockLocks[i] = new Mutex();
+        }
+
         int numBlocks = 0;
+        size_t totalSize = 0;
         while (!stream->isEOF()) {
             Vector3i block = Vector3i(stream);
             Assert(block.x >= 0 && block.y >= 0 && block.z >= 0
                     && block.x < m_res.x && block.y < m_res.y && block.z < m_res.z);
-            Properties props("gridvolume");
-            props.setString("filename", formatString("%s%03i_%03i_%03i%s",
-                        m_prefix.c_str(), block.x, block.y, block.z, m_postfix.c_str()));
-            props.setTransform("toWorld", m_volumeToWorld);
-            props.setBoolean("sendData", false);
+            std::string blockFilename = formatString("%s%03i_%03i_%03i%s",
+                m_prefix.c_str(), block.x, block.y, block.z, m_postfix.c_str());
+            size_t cellIdx = (m_res.y * block.z + block.y) * m_res.x + block.x;
+
+            if (m_lazyLoading) {
+                /* Only read the header now. The file name is resolved here,
+                   since the rendering threads will open the file later on */
+                LazyBlock &lazy = m_lazyBlocks[cellIdx];
+                lazy.filename = Thread::getThread()->getFileResolver()->resolve(
+                    blockFilename).string();
+                lazy.size = (size_t) fs::file_size(lazy.filename);
+                lazy.referenced = false;
+                totalSize += lazy.size;
+
+                int channels;
+                Float stepSize;
+                readBlockHeader(lazy.filename, channels, stepSize);
 
-            VolumeDataSource *content = static_cast<VolumeDataSource *> (PluginManager::getInstance()->
-                    createObject(MTS_CLASS(VolumeDataSource), props));
-            content->configure();
+                /* Grid volumes report a maximum value of 1 */
+                m_maxFloatValue = 1.0f;
+                m_stepSize = std::min(m_stepSize, stepSize);
+                m_supportsVectorLookups = m_supportsVectorLookups && channels == 3;
+                m_supportsFloatLookups = m_supportsFloatLookups && channels == 1;
+                m_supportsSpectrumLookups = m_supportsSpectrumLookups && channels == 3;
+                ++numBlocks;
+                continue;
+            }
+
+            VolumeDataSource *content = createBlock(blockFilename);
 
             m_maxFloatValue = content->getMaximumFloatValue();
-            m_blocks[(m_res.y * block.z + block.y) * m_res.x + block.x] = content;
+            m_blocks[cellIdx] = content;
             m_stepSize = std::min(m_stepSize, content->getStepSize());
             m_supportsVectorLookups = m_supportsVectorLookups && content->supportsVectorLookups();
             m_supportsFloatLookups = m_supportsFloatLookups && content->supportsFloatLookups();
@@ -119,6 +169,10 @@ public:
         }
         Log(EInfo, "%i blocks total, %s, stepSize=%f, resolution=%s", numBlocks,
                 aabb.toString().c_str(), m_stepSize, m_res.toString().c_str());
+        if (m_lazyLoading)
+            Log(EInfo, "Loading blocks on demand (%s in total, residency limit: %s)",
+                memString(totalSize).c_str(), m_residencyLimit > 0 ?
+                memString(m_residencyLimit).c_str() : "none");
 
         m_aabb.reset();
         for (int i=0; i<8; ++i)
@@ -151,7 +205,13 @@ public:
             z < 0 || z >= m_res.z)
             return 0.0f;
 
-        VolumeDataSource *block = m_blocks[((z * m_res.y) + y) * m_res.x + x];
+        const size_t idx = ((z * m_res.y) + y) * m_res.x + x;
+        if (m_lazyLoading) {
+            ref<VolumeDataSource> block = acquireBlock(idx);
+            return block.get() ? block->lookupFloat(_p) : 0.0f;
+        }
+
+        VolumeDataSource *block = m_blocks[idx];
         if (block == NULL)
             return 0.0f;
         else
@@ -168,7 +228,13 @@ public:
             z < 0 || z >= m_res.z)
             return Spectrum(0.0f);
 
-        VolumeDataSource *block = m_blocks[((z * m_res.y) + y) * m_res.x + x];
+        const size_t idx = ((z * m_res.y) + y) * m_res.x + x;
+        if (m_lazyLoading) {
+            ref<VolumeDataSource> block = acquireBlock(idx);
+            return block.get() ? block->lookupSpectrum(_p) : Spectrum(0.0f);
+        }
+
+        VolumeDataSource *block = m_blocks[idx];
         if (block == NULL)
             return Spectrum(0.0f);
         else
@@ -185,7 +251,13 @@ public:
             z < 0 || z >= m_res.z)
             return Vector(0.0f);
 
-        VolumeDataSource *block = m_blocks[((z * m_res.y) + y) * m_res.x + x];
+        const size_t idx = ((z * m_res.y) + y) * m_res.x + x;
+        if (m_lazyLoading) {
+            ref<VolumeDataSource> block = acquireBlock(idx);
+            return block.get() ? block->lookupVector(_p) : Vector();
+        }
+
+        VolumeDataSource *block = m_blocks[idx];
         if (block == NULL)
             return Vector();
         else
@@ -198,6 +270,131 @@ public:
 
     MTS_DECLARE_CLASS()
 protected:
+    enum {
+        /// Number of locks that protect the block pointers in lazy mode
+        EBlockLocks = 64
+    };
+
+    /// Block that is loaded on demand
+    struct LazyBlock {
+        /// Resolved file name (empty if there is no block in this cell)
+        std::string filename;
+        /// Size of the block file in bytes
+        size_t size;
+        /// Was the block used since the last pass of the clock hand?
+        volatile bool referenced;
+    };
+
+    VolumeDataSource *createBlock(const std::string &filename) const {
+        Properties props("gridvolume");
+        props.setString("filename", filename);
+        props.setTransform("toWorld", m_volumeToWorld);
+        props.setBoolean("sendData", false);
+
+        VolumeDataSource *content = static_cast<VolumeDataSource *> (PluginManager::getInstance()->
+                createObject(MTS_CLASS(VolumeDataSource), props));
+        content->configure();
+        return content;
+    }
+
+    /// Read the channel count and step size from the header of a block
+    void readBlockHeader(const std::string &filename, int &channels, Float &stepSize) const {
+        ref<FileStream> stream = new FileStream(filename, FileStream::EReadOnly);
+        stream->setByteOrder(Stream::ELittleEndian);
+
+        char header[4];
+        stream->read(header, 4);
+        if (header[0] != 'V' || header[1] != 'O' || header[2] != 'L' || header[3] != 3)
+            Log(EError, "Encountered an invalid volume data file \"%s\"", filename.c_str());
+        stream->readInt(); /* Data type */
+        Vector3i res(stream);
+        channels = stream->readInt();
+        Float xmin = stream->readSingle(), ymin = stream->readSingle(), zmin = stream->readSingle();
+        Float xmax = stream->readSingle(), ymax = stream->readSingle(), zmax = stream->readSingle();
+        Vector extents = AABB(Point(xmin, ymin, zmin), Point(xmax, ymax, zmax)).getExtents();
+
+        /* Same as the step size of 'gridvolume' */
+        stepSize = std::numeric_limits<Float>::infinity();
+        for (int i=0; i<3; ++i)
+            stepSize = std::min(stepSize, 0.5f * extents[i] / (Float) (res[i]-1));
+    }
+
+    /// Return the block of a cell, mapping it into memory if necessary (lazy mode)
+    ref<VolumeDataSource> acquireBlock(size_t idx) const {
+        LazyBlock &lazy = m_lazyBlocks[idx];
+        if (lazy.filename.empty())
+            return NULL;
+
+        if (m_residencyLimit == 0) {
+            /* Blocks are never released: no need to lock once loaded */
+            VolumeDataSource *block = *((VolumeDataSource * volatile *) &m_blocks[idx]);
+            if (EXPECT_TAKEN(block != NULL))
+                return block;
+        }
+
+        ref<VolumeDataSource> block;
+        {
+            LockGuard lock(m_blockLocks[idx % EBlockLocks]);
+            block = m_blocks[idx];
+            if (block.get()) {
+                if (!lazy.referenced)
+                    lazy.referenced = true;
+                return block;
+            }
+
+            VolumeDataSource *content = createBlock(lazy.filename);
+            content->incRef();
+            lazy.referenced = true;
+            m_blocks[idx] = content;
+            block = content;
+        }
+        ++statsBlockLoads;
+
+        LockGuard lock(m_residencyMutex);
+        m_resident.push_back(idx);
+        m_residentBytes += lazy.size;
+        if (m_residencyLimit > 0)
+            evictBlocks(idx);
+        return block;
+    }
+
+    /**
+     * \brief Release blocks until the residency limit is met (the caller
+     * holds \c m_residencyMutex)
+     *
+     * Readers that still use an evicted block hold a reference to it, so
+     * it is only unmapped once they are done.
+     */
+    void evictBlocks(size_t keep) const {
+        size_t steps = 0;
+        while (m_residentBytes > m_residencyLimit && m_resident.size() > 1) {
+            if (m_clockHand >= m_resident.size())
+                m_clockHand = 0;
+            size_t idx = m_resident[m_clockHand];
+            LazyBlock &lazy = m_lazyBlocks[idx];
+
+            /* Give recently used blocks a second chance, but not forever
+               (other threads can keep setting the flag) */
+            bool secondChance = lazy.referenced && steps < 2 * m_resident.size();
+            if (idx == keep || secondChance) {
+                lazy.referenced = false;
+                ++m_clockHand;
+                ++steps;
+                continue;
+            }
+
+            {
+                LockGuard lock(m_blockLocks[idx % EBlockLocks]);
+                m_blocks[idx]->decRef();
+                m_blocks[idx] = NULL;
+            }
+            m_residentBytes -= lazy.size;
+            m_resident[m_clockHand] = m_resident.back();
+            m_resident.pop_back();
+            ++statsBlockEvictions;
+        }
+    }
+
     std::string m_filename, m_prefix, m_postfix;
     Transform m_volumeToWorld;
     Transform m_worldToVolume;
@@ -209,6 +406,14 @@ protected:
     bool m_supportsSpectrumLookups;
     bool m_supportsVectorLookups;
     Float m_stepSize, m_maxFloatValue;
+
+    bool m_lazyLoading;
+    size_t m_residencyLimit;
+    mutable std::vector<LazyBlock> m_lazyBlocks;
+    mutable std::vector<ref<Mutex> > m_blockLocks;
+    mutable ref<Mutex> m_residencyMutex;
+    mutable std::vector<size_t> m_resident;
+    mutable size_t m_residentBytes, m_clockHand;
 };
 
 MTS_IMPLEMENT_CLASS_S(HierarchicalGridDataSource, false, VolumeDataSource);
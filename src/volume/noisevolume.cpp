@@ -0,0 +1,224 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/volume.h>
+#include <mitsuba/render/noise.h>
+#include <mitsuba/core/properties.h>
+#include <boost/algorithm/string.hpp>
+
+/// Number of positions that are evaluated together in lookupFloatSequence()
+#define NOISEVOLUME_BATCH_SIZE 64
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{noisevolume}{Procedural noise volume data source}
+ * \parameters{
+ *     \parameter{type}{\String}{
+ *       Noise function: \code{fbm} (fractional Brownian motion) or
+ *       \code{turbulence} \default{\code{fbm}}
+ *     }
+ *     \parameter{octaves}{\Float}{
+ *       Number of octaves of Perlin noise. Fractional values fade
+ *       in the last octave \default{6}
+ *     }
+ *     \parameter{omega}{\Float}{
+ *       Amplitude falloff from one octave to the next \default{0.5}
+ *     }
+ *     \parameter{frequency}{\Float}{
+ *       Frequency of the first octave, relative to the unit cube
+ *       \default{4}
+ *     }
+ *     \parameter{offset}{\Float}{
+ *       Value that is added to the noise. Negative results are
+ *       clamped to zero \default{0}
+ *     }
+ *     \parameter{scale}{\Float}{
+ *       Scale factor that is applied to the result \default{1}
+ *     }
+ *     \parameter{toWorld}{\Transform}{
+ *       Maps the unit cube, which is the domain of the volume, to
+ *       world space. Lookups outside of it return zero.
+ *     }
+ * }
+ *
+ * This plugin provides a procedural, float-valued volume data source
+ * that evaluates \code{scale * max(0, noise(frequency * p) + offset)}
+ * at every point \code{p} of the unit cube. It is mainly intended for
+ * cloud- or smoke-like densities in the \pluginref{heterogeneous} medium
+ * that don't require storing a grid. The reported maximum value is a
+ * conservative bound of the noise function, so it is safe to use as the
+ * majorant of Woodcock tracking. Lookups along a ray are evaluated in
+ * batches, which uses SIMD instructions where available.
+ *
+ * \begin{xml}[caption={A cloud-like density inside a 2x2x2 box}]
+ * <medium type="heterogeneous">
+ *     <volume type="noisevolume" name="density">
+ *         <float name="octaves" value="5"/>
+ *         <float name="offset" value="-0.2"/>
+ *         <float name="scale" value="2"/>
+ *         <transform name="toWorld">
+ *             <scale value="2"/>
+ *             <translate x="-1" y="-1" z="-1"/>
+ *         </transform>
+ *     </volume>
+ *
+ *     <!-- .... remaining parameters for
+ *          the 'heterogeneous' plugin .... -->
+ * </medium>
+ * \end{xml}
+ */
+class NoiseDataSource : public VolumeDataSource {
+public:
+    NoiseDataSource(const Properties &props)
+        : VolumeDataSource(props) {
+        std::string type = boost::to_lower_copy(props.getString("type", "fbm"));
+        if (type == "fbm")
+            m_turbulence = false;
+        else if (type == "turbulence")
+            m_turbulence = true;
+        else
+            Log(EError, "The \"type\" parameter must either be equal "
+                "to \"fbm\" or \"turbulence\"!");
+
+        m_octaves = props.getFloat("octaves", 6.0f);
+        m_omega = props.getFloat("omega", 0.5f);
+        m_frequency = props.getFloat("frequency", 4.0f);
+        m_offset = props.getFloat("offset", 0.0f);
+        m_scale = props.getFloat("scale", 1.0f);
+        m_volumeToWorld = props.getTransform("toWorld", Transform());
+
+        if (m_octaves < 0 || m_frequency <= 0 || m_scale < 0)
+            Log(EError, "The \"octaves\", \"frequency\", and \"scale\" "
+                "parameters must be nonnegative!");
+    }
+
+    NoiseDataSource(Stream *stream, InstanceManager *manager)
+        : VolumeDataSource(stream, manager) {
+        m_turbulence = stream->readBool();
+        m_octaves = stream->readFloat();
+        m_omega = stream->readFloat();
+        m_frequency = stream->readFloat();
+        m_offset = stream->readFloat();
+        m_scale = stream->readFloat();
+        m_volumeToWorld = Transform(stream);
+        configure();
+    }
+
+    virtual ~NoiseDataSource() {
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        VolumeDataSource::serialize(stream, manager);
+        stream->writeBool(m_turbulence);
+        stream->writeFloat(m_octaves);
+        stream->writeFloat(m_omega);
+        stream->writeFloat(m_frequency);
+        stream->writeFloat(m_offset);
+        stream->writeFloat(m_scale);
+        m_volumeToWorld.serialize(stream);
+    }
+
+    void configure() {
+        m_worldToVolume = m_volumeToWorld.inverse();
+
+        m_aabb.reset();
+        AABB unitCube(Point(0.0f), Point(1.0f));
+        for (int i=0; i<8; ++i)
+            m_aabb.expandBy(m_volumeToWorld(unitCube.getCorner(i)));
+
+        m_maximum = m_scale * std::max((Float) 0,
+            Noise::getFbmBound(m_omega, m_octaves) + m_offset);
+
+        /* Resolve half a period of the highest octave */
+        Float finestPeriod = 1.0f / (m_frequency * std::pow(1.99f, std::ceil(m_octaves)));
+        m_stepSize = std::numeric_limits<Float>::infinity();
+        for (int i=0; i<3; ++i) {
+            Vector axis(0.0f);
+            axis[i] = 0.5f * finestPeriod;
+            m_stepSize = std::min(m_stepSize, m_volumeToWorld(axis).length());
+        }
+    }
+
+    Float lookupFloat(const Point &p) const {
+        Float result;
+        lookupFloatSequence(p, Vector(0.0f), 1, &result);
+        return result;
+    }
+
+    void lookupFloatSequence(const Point &p, const Vector &increment,
+            size_t count, Float *values) const {
+        const Point p0 = m_worldToVolume(p);
+        const Vector d = m_worldToVolume(increment);
+        Point positions[NOISEVOLUME_BATCH_SIZE];
+        bool inside[NOISEVOLUME_BATCH_SIZE];
+
+        for (size_t start=0; start<count; start += NOISEVOLUME_BATCH_SIZE) {
+            size_t size = std::min(count - start, (size_t) NOISEVOLUME_BATCH_SIZE);
+            for (size_t i=0; i<size; ++i) {
+                Point q = p0 + d * (Float) (start + i);
+                inside[i] = q.x >= 0 && q.y >= 0 && q.z >= 0 &&
+                            q.x <= 1 && q.y <= 1 && q.z <= 1;
+                positions[i] = q * m_frequency;
+            }
+
+            Float *result = values + start;
+            if (m_turbulence)
+                Noise::turbulence(positions, result, size, m_omega, m_octaves);
+            else
+                Noise::fbm(positions, result, size, m_omega, m_octaves);
+
+            for (size_t i=0; i<size; ++i)
+                result[i] = inside[i] ? m_scale * std::max((Float) 0,
+                    result[i] + m_offset) : (Float) 0;
+        }
+    }
+
+    bool supportsFloatLookups() const { return true; }
+
+    Float getStepSize() const { return m_stepSize; }
+
+    Float getMaximumFloatValue() const { return m_maximum; }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "NoiseVolume[" << endl
+            << "  type = " << (m_turbulence ? "turbulence" : "fbm") << "," << endl
+            << "  octaves = " << m_octaves << "," << endl
+            << "  omega = " << m_omega << "," << endl
+            << "  frequency = " << m_frequency << "," << endl
+            << "  offset = " << m_offset << "," << endl
+            << "  scale = " << m_scale << "," << endl
+            << "  maximum = " << m_maximum << "," << endl
+            << "  aabb = " << m_aabb.toString() << endl
+            << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    bool m_turbulence;
+    Float m_octaves, m_omega, m_frequency;
+    Float m_offset, m_scale;
+    Float m_maximum, m_stepSize;
+    Transform m_volumeToWorld;
+    Transform m_worldToVolume;
+};
+
+MTS_IMPLEMENT_CLASS_S(NoiseDataSource, false, VolumeDataSource);
+MTS_EXPORT_PLUGIN(NoiseDataSource, "Procedural noise data source");
+MTS_NAMESPACE_END
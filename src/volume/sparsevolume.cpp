@@ -0,0 +1,532 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/volume.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/properties.h>
+#include <mitsuba/core/mmap.h>
+
+// Number of power iteration steps used to find the dominant direction
+#define POWER_ITERATION_STEPS 5
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{sparsevolume}{Sparse brick-based volume data source}
+ * \parameters{
+ *     \parameter{filename}{\String}{
+ *       Specifies the filename of the sparse volume data file to be loaded
+ *     }
+ *     \parameter{toWorld}{\Transform}{
+ *         Optional linear transformation that should be applied to the data
+ *     }
+ *     \parameter{min, max}{\Point}{
+ *         Optional parameter that can be used to re-scale the data so that
+ *         it lies in the bounding box between \code{min} and \code{max}.
+ *     }
+ * }
+ *
+ * This class provides the same trilinearly interpolated lookups as
+ * \pluginref{gridvolume}, but only stores the parts of the grid that
+ * are not empty. The voxels are grouped into bricks of $8^3$ voxels,
+ * and the bricks are in turn grouped into tiles of $8^3$ bricks. A dense
+ * root table references the tiles, and every tile references its bricks.
+ * Bricks or tiles that only contain zeros are not stored at all, and
+ * lookups in them return zero without touching any voxel data.
+ *
+ * Every brick and tile also records the minimum and maximum of its
+ * values. \pluginref{heterogeneous} uses these to obtain tight local
+ * majorants (see its \code{majorantResolution} parameter) without
+ * having to sample the density, and the maximum of the whole volume
+ * replaces the conservative global bound of 1 reported by
+ * \pluginref{gridvolume}.
+ *
+ * Files in this format can be created from dense \code{.vol} files or
+ * \pluginref{hgridvolume} dictionaries using the \code{svolcvt} utility
+ * (\code{mtsutil svolcvt}). The file is memory-mapped, hence remote
+ * render nodes must have access to an identical copy. The format uses a
+ * little endian encoding and is specified as follows:\vspace{3mm}
+ *
+ * \begin{center}
+ * \begin{tabular}{>{\bfseries}p{2cm}p{11cm}}
+ * \toprule
+ * Position & Content\\
+ * \midrule
+ * Bytes 1-3&   ASCII Bytes '\code{S}', '\code{V}', and '\code{L}' \\
+ * Byte  4&     File format version number (currently 1)\\
+ * Bytes 5-8&   Number of channels (32 bit integer, supported values: 1 or 3)\\
+ * Bytes 9-20 & Number of voxels along the X, Y and Z axes (32 bit integers)\\
+ * Bytes 21-24 & Number of stored tiles $T$ (32 bit integer)\\
+ * Bytes 25-28 & Number of stored bricks $B$ (32 bit integer)\\
+ * Bytes 29-52 & Axis-aligned bounding box of the data stored in single
+ *                precision (order: xmin, ymin, zmin, xmax, ymax, zmax)\\
+ * Bytes 53-*  &  The following arrays, one after the other:
+ * \begin{enumerate}[1.]
+ * \item Root table: one 32 bit tile index per tile of the grid (there are
+ * $\lceil \mathrm{res}/64\rceil$ tiles along each axis), or \code{0xFFFFFFFF}
+ * for empty tiles.
+ * \item Tile tables: $T\times 512$ 32 bit brick indices, or
+ * \code{0xFFFFFFFF} for empty bricks.
+ * \item Tile bounds: $T\times 2$ floats (minimum and maximum)
+ * \item Brick bounds: $B\times 2$ floats (minimum and maximum)
+ * \item Brick data: $B\times 512\times\mathrm{channels}$ floats
+ * \end{enumerate}
+ * All tables are ordered so that the X coordinate varies fastest,
+ * followed by Y and Z, and the channels of a voxel are stored
+ * next to each other.\\
+ * \bottomrule
+ * \end{tabular}
+ * \end{center}
+ */
+class SparseGridDataSource : public VolumeDataSource {
+public:
+    enum {
+        /// log2 of the number of voxels along each axis of a brick
+        EBrickShift = 3,
+        EBrickSize = 1 << EBrickShift,
+        EBrickMask = EBrickSize - 1,
+        /// Voxels per brick
+        EBrickVoxels = EBrickSize * EBrickSize * EBrickSize,
+        /// log2 of the number of voxels along each axis of a tile
+        ETileShift = 2 * EBrickShift,
+        /// Bricks per tile
+        ETileBricks = EBrickVoxels,
+        /// Size of the file header in bytes
+        EHeaderSize = 52
+    };
+
+    /// Marks a missing (empty) tile or brick
+    static const uint32_t EEmpty = 0xFFFFFFFFu;
+
+    SparseGridDataSource(const Properties &props)
+        : VolumeDataSource(props) {
+        m_volumeToWorld = props.getTransform("toWorld", Transform());
+
+        if (props.hasProperty("min") && props.hasProperty("max")) {
+            /* Optionally allow to use an AABB other than
+               the one specified by the file */
+            m_dataAABB.min = props.getPoint("min");
+            m_dataAABB.max = props.getPoint("max");
+        }
+
+        loadFromFile(props.getString("filename"));
+    }
+
+    SparseGridDataSource(Stream *stream, InstanceManager *manager)
+            : VolumeDataSource(stream, manager) {
+        m_volumeToWorld = Transform(stream);
+        m_dataAABB = AABB(stream);
+        loadFromFile(stream->readString());
+        configure();
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        VolumeDataSource::serialize(stream, manager);
+
+        m_volumeToWorld.serialize(stream);
+        m_dataAABB.serialize(stream);
+        stream->writeString(m_filename.string());
+    }
+
+    void configure() {
+        Vector extents(m_dataAABB.getExtents());
+        m_worldToVolume = m_volumeToWorld.inverse();
+        m_worldToGrid = Transform::scale(Vector(
+                (m_res[0] - 1) / extents[0],
+                (m_res[1] - 1) / extents[1],
+                (m_res[2] - 1) / extents[2])
+            ) * Transform::translate(-Vector(m_dataAABB.min)) * m_worldToVolume;
+        m_stepSize = std::numeric_limits<Float>::infinity();
+        for (int i=0; i<3; ++i)
+            m_stepSize = std::min(m_stepSize, 0.5f * extents[i] / (Float) (m_res[i]-1));
+        m_aabb.reset();
+        for (int i=0; i<8; ++i)
+            m_aabb.expandBy(m_volumeToWorld(m_dataAABB.getCorner(i)));
+    }
+
+    void loadFromFile(const fs::path &filename) {
+        m_filename = filename;
+        fs::path resolved = Thread::getThread()->getFileResolver()->resolve(filename);
+        m_mmap = new MemoryMappedFile(resolved);
+        const uint8_t *data = (const uint8_t *) m_mmap->getData();
+        size_t size = m_mmap->getSize();
+
+        if (size < EHeaderSize || data[0] != 'S' || data[1] != 'V' || data[2] != 'L')
+            Log(EError, "Encountered an invalid sparse volume data file "
+                "(incorrect header identifier)");
+        if (data[3] != 1)
+            Log(EError, "Encountered an invalid sparse volume data file "
+                "(incorrect file version)");
+
+        const int32_t *header = (const int32_t *) (data + 4);
+        m_channels = header[0];
+        m_res = Vector3i(header[1], header[2], header[3]);
+        m_tileCount = (uint32_t) header[4];
+        m_brickCount = (uint32_t) header[5];
+
+        if (m_channels != 1 && m_channels != 3)
+            Log(EError, "Encountered an unsupported sparse volume data "
+                "file (%i channels, only 1 and 3 are supported)", m_channels);
+        if (m_res.x < 2 || m_res.y < 2 || m_res.z < 2)
+            Log(EError, "Encountered a sparse volume data file with an "
+                "invalid resolution (%s)", m_res.toString().c_str());
+
+        if (!m_dataAABB.isValid()) {
+            const float *aabb = (const float *) (data + 28);
+            m_dataAABB = AABB(Point(aabb[0], aabb[1], aabb[2]),
+                Point(aabb[3], aabb[4], aabb[5]));
+        }
+
+        for (int i=0; i<3; ++i)
+            m_tileRes[i] = (m_res[i] + (1 << ETileShift) - 1) >> ETileShift;
+        size_t rootSize = (size_t) m_tileRes.x * m_tileRes.y * m_tileRes.z;
+
+        size_t expectedSize = EHeaderSize + sizeof(uint32_t) * (rootSize
+            + (size_t) m_tileCount * (ETileBricks + 2)
+            + (size_t) m_brickCount * (EBrickVoxels * m_channels + 2));
+        if (size != expectedSize)
+            Log(EError, "Encountered a truncated or corrupt sparse volume data "
+                "file (%s, expected %s)", memString(size).c_str(),
+                memString(expectedSize).c_str());
+
+        m_root = (const uint32_t *) (data + EHeaderSize);
+        m_tiles = m_root + rootSize;
+        m_tileBounds = (const float *) (m_tiles + (size_t) m_tileCount * ETileBricks);
+        m_brickBounds = m_tileBounds + 2 * (size_t) m_tileCount;
+        m_bricks = m_brickBounds + 2 * (size_t) m_brickCount;
+
+        /* Validate the tables once, so that lookups don't have to */
+        for (size_t i=0; i<rootSize; ++i) {
+            if (m_root[i] != EEmpty && m_root[i] >= m_tileCount)
+                Log(EError, "Sparse volume data file contains an invalid tile index!");
+        }
+        for (size_t i=0; i<(size_t) m_tileCount * ETileBricks; ++i) {
+            if (m_tiles[i] != EEmpty && m_tiles[i] >= m_brickCount)
+                Log(EError, "Sparse volume data file contains an invalid brick index!");
+        }
+
+        m_maxValue = 0;
+        for (uint32_t i=0; i<m_tileCount; ++i)
+            m_maxValue = std::max(m_maxValue, (Float) m_tileBounds[2*i+1]);
+
+        Log(EDebug, "Mapped \"%s\" into memory: %ix%ix%i (%i channels), "
+            "%u tiles, %u bricks (%.1f%% occupancy), %s, %s",
+            resolved.filename().string().c_str(), m_res.x, m_res.y, m_res.z,
+            m_channels, m_tileCount, m_brickCount, 100.0f * m_brickCount * EBrickVoxels /
+            ((Float) m_res.x * (Float) m_res.y * (Float) m_res.z),
+            memString(size).c_str(), m_dataAABB.toString().c_str());
+    }
+
+    Float lookupFloat(const Point &_p) const {
+        const Point p = m_worldToGrid.transformAffine(_p);
+        const int x1 = math::floorToInt(p.x),
+              y1 = math::floorToInt(p.y),
+              z1 = math::floorToInt(p.z);
+
+        if (x1 < 0 || y1 < 0 || z1 < 0 || x1+1 >= m_res.x ||
+            y1+1 >= m_res.y || z1+1 >= m_res.z)
+            return 0;
+
+        const float *d[8];
+        if (!fetchCorners(x1, y1, z1, d))
+            return 0;
+
+        const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1,
+                _fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
+
+        return ((*d[0]*_fx + *d[1]*fx)*_fy +
+                (*d[2]*_fx + *d[3]*fx)*fy)*_fz +
+               ((*d[4]*_fx + *d[5]*fx)*_fy +
+                (*d[6]*_fx + *d[7]*fx)*fy)*fz;
+    }
+
+    /// Fetches a single voxel that is chosen with probability equal to its weight
+    Float lookupFloatStochastic(const Point &_p, Float sample) const {
+        const Point p = m_worldToGrid.transformAffine(_p);
+        int pos[3] = {
+            math::floorToInt(p.x),
+            math::floorToInt(p.y),
+            math::floorToInt(p.z)
+        };
+
+        if (pos[0] < 0 || pos[1] < 0 || pos[2] < 0 || pos[0]+1 >= m_res.x ||
+            pos[1]+1 >= m_res.y || pos[2]+1 >= m_res.z)
+            return 0;
+
+        for (int i=0; i<3; ++i) {
+            const Float f = p[i] - pos[i];
+            if (sample < f) {
+                ++pos[i];
+                sample /= f;
+            } else {
+                sample = (sample - f) / (1 - f);
+            }
+        }
+
+        const float *brick = lookupBrick(pos[0], pos[1], pos[2]);
+        if (!brick)
+            return 0;
+        return brick[voxelOffset(pos[0], pos[1], pos[2])];
+    }
+
+    Spectrum lookupSpectrum(const Point &_p) const {
+        const Point p = m_worldToGrid.transformAffine(_p);
+        const int x1 = math::floorToInt(p.x),
+              y1 = math::floorToInt(p.y),
+              z1 = math::floorToInt(p.z);
+
+        if (x1 < 0 || y1 < 0 || z1 < 0 || x1+1 >= m_res.x ||
+            y1+1 >= m_res.y || z1+1 >= m_res.z)
+            return Spectrum(0.0f);
+
+        const float *d[8];
+        if (!fetchCorners(x1, y1, z1, d))
+            return Spectrum(0.0f);
+
+        const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1,
+                _fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
+
+        Float rgb[3];
+        for (int i=0; i<3; ++i)
+            rgb[i] = ((d[0][i]*_fx + d[1][i]*fx)*_fy +
+                      (d[2][i]*_fx + d[3][i]*fx)*fy)*_fz +
+                     ((d[4][i]*_fx + d[5][i]*fx)*_fy +
+                      (d[6][i]*_fx + d[7][i]*fx)*fy)*fz;
+
+        Spectrum result;
+        result.fromLinearRGB(rgb[0], rgb[1], rgb[2]);
+        return result;
+    }
+
+    Vector lookupVector(const Point &_p) const {
+        const Point p = m_worldToGrid.transformAffine(_p);
+        const int x1 = math::floorToInt(p.x),
+              y1 = math::floorToInt(p.y),
+              z1 = math::floorToInt(p.z);
+
+        if (x1 < 0 || y1 < 0 || z1 < 0 || x1+1 >= m_res.x ||
+            y1+1 >= m_res.y || z1+1 >= m_res.z)
+            return Vector(0.0f);
+
+        const float *d[8];
+        if (!fetchCorners(x1, y1, z1, d))
+            return Vector(0.0f);
+
+        const Float fx = p.x - x1, fy = p.y - y1, fz = p.z - z1,
+                _fx = 1.0f - fx, _fy = 1.0f - fy, _fz = 1.0f - fz;
+
+        /* Interpolate the structure tensors, see 'gridvolume' */
+        Matrix3x3 tensor(0.0f);
+        for (int k=0; k<8; ++k) {
+            Float factor = ((k & 1) ? fx : _fx) * ((k & 2) ? fy : _fy)
+                * ((k & 4) ? fz : _fz);
+            Vector v(d[k][0], d[k][1], d[k][2]);
+            tensor(0, 0) += factor * v.x * v.x;
+            tensor(0, 1) += factor * v.x * v.y;
+            tensor(0, 2) += factor * v.x * v.z;
+            tensor(1, 1) += factor * v.y * v.y;
+            tensor(1, 2) += factor * v.y * v.z;
+            tensor(2, 2) += factor * v.z * v.z;
+        }
+        tensor(1, 0) = tensor(0, 1);
+        tensor(2, 0) = tensor(0, 2);
+        tensor(2, 1) = tensor(1, 2);
+
+        if (tensor.isZero())
+            return Vector(0.0f);
+
+        /* Square the structure tensor for faster convergence */
+        tensor *= tensor;
+
+        const Float invSqrt3 = 0.577350269189626f;
+        Vector value(invSqrt3, invSqrt3, invSqrt3);
+
+        /* Determine the dominant eigenvector using
+           a few power iterations */
+        for (int i=0; i<POWER_ITERATION_STEPS-1; ++i)
+            value = normalize(tensor * value);
+        value = tensor * value;
+
+        if (!value.isZero())
+            return normalize(m_volumeToWorld(value));
+        else
+            return Vector(0.0f);
+    }
+
+    bool supportsFloatLookups() const { return m_channels == 1; }
+    bool supportsSpectrumLookups() const { return m_channels == 3; }
+    bool supportsVectorLookups() const { return m_channels == 3; }
+    Float getStepSize() const { return m_stepSize; }
+
+    Float getMaximumFloatValue() const {
+        return m_maxValue;
+    }
+
+    bool hasLocalMaxima() const {
+        return true;
+    }
+
+    Float getLocalMaximumFloatValue(const AABB &aabb) const {
+        /* Bounding box of the region in grid coordinates */
+        AABB gridAABB;
+        for (int i=0; i<8; ++i)
+            gridAABB.expandBy(m_worldToGrid(aabb.getCorner(i)));
+
+        /* Range of voxels that interpolated lookups within the region
+           can access (i.e. including the upper neighbors) */
+        Vector3i vmin, vmax;
+        for (int i=0; i<3; ++i) {
+            vmin[i] = math::floorToInt(gridAABB.min[i]);
+            vmax[i] = math::floorToInt(gridAABB.max[i]) + 1;
+            if (vmax[i] < 0 || vmin[i] >= m_res[i])
+                return 0.0f;
+            vmin[i] = std::max(vmin[i], 0);
+            vmax[i] = std::min(vmax[i], m_res[i] - 1);
+        }
+
+        const Vector3i bmin(vmin.x >> EBrickShift, vmin.y >> EBrickShift, vmin.z >> EBrickShift),
+                       bmax(vmax.x >> EBrickShift, vmax.y >> EBrickShift, vmax.z >> EBrickShift);
+
+        Float result = 0.0f;
+        for (int tz=vmin.z >> ETileShift; tz<=(vmax.z >> ETileShift); ++tz) {
+            for (int ty=vmin.y >> ETileShift; ty<=(vmax.y >> ETileShift); ++ty) {
+                for (int tx=vmin.x >> ETileShift; tx<=(vmax.x >> ETileShift); ++tx) {
+                    uint32_t tile = m_root[(tz*m_tileRes.y + ty)*m_tileRes.x + tx];
+                    if (tile == EEmpty || m_tileBounds[2*tile+1] <= result)
+                        continue;
+
+                    /* Bricks of this tile that overlap the region */
+                    Vector3i tmin, tmax;
+                    const Vector3i tileOrigin(tx, ty, tz);
+                    for (int i=0; i<3; ++i) {
+                        tmin[i] = std::max(bmin[i] - (tileOrigin[i] << EBrickShift), 0);
+                        tmax[i] = std::min(bmax[i] - (tileOrigin[i] << EBrickShift), (int) EBrickMask);
+                    }
+
+                    const uint32_t *bricks = m_tiles + (size_t) tile * ETileBricks;
+                    for (int bz=tmin.z; bz<=tmax.z; ++bz)
+                        for (int by=tmin.y; by<=tmax.y; ++by)
+                            for (int bx=tmin.x; bx<=tmax.x; ++bx) {
+                                uint32_t brick = bricks[(bz*EBrickSize + by)*EBrickSize + bx];
+                                if (brick != EEmpty)
+                                    result = std::max(result, (Float) m_brickBounds[2*brick+1]);
+                            }
+                }
+            }
+        }
+        return result;
+    }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "SparseGridVolume[" << endl
+            << "  res = " << m_res.toString() << "," << endl
+            << "  channels = " << m_channels << "," << endl
+            << "  tiles = " << m_tileCount << "," << endl
+            << "  bricks = " << m_brickCount << "," << endl
+            << "  aabb = " << m_dataAABB.toString() << endl
+            << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~SparseGridDataSource() { }
+
+    /// Return the data of the brick containing a voxel, or NULL if it is empty
+    inline const float *lookupBrick(int x, int y, int z) const {
+        uint32_t tile = m_root[((z >> ETileShift)*m_tileRes.y
+            + (y >> ETileShift))*m_tileRes.x + (x >> ETileShift)];
+        if (tile == EEmpty)
+            return NULL;
+        uint32_t brick = m_tiles[(size_t) tile * ETileBricks
+            + ((((z >> EBrickShift) & EBrickMask) * EBrickSize
+            + ((y >> EBrickShift) & EBrickMask)) * EBrickSize
+            + ((x >> EBrickShift) & EBrickMask))];
+        if (brick == EEmpty)
+            return NULL;
+        return m_bricks + (size_t) brick * EBrickVoxels * m_channels;
+    }
+
+    /// Offset of a voxel within its brick (in voxels)
+    static inline int voxelOffset(int x, int y, int z) {
+        return ((z & EBrickMask) * EBrickSize + (y & EBrickMask)) * EBrickSize + (x & EBrickMask);
+    }
+
+    /**
+     * \brief Fetch the 8 voxels surrounding the lookup cell with
+     * the given lower corner (X varies fastest)
+     *
+     * Empty voxels point to a block of zeros. Returns \c false
+     * when all of them are empty.
+     */
+    inline bool fetchCorners(int x1, int y1, int z1, const float **d) const {
+        if ((x1 & EBrickMask) != EBrickMask && (y1 & EBrickMask) != EBrickMask
+                && (z1 & EBrickMask) != EBrickMask) {
+            /* Common case: the cell lies within a single brick */
+            const float *brick = lookupBrick(x1, y1, z1);
+            if (!brick)
+                return false;
+            const size_t sx = m_channels, sy = sx * EBrickSize, sz = sy * EBrickSize;
+            const float *base = brick + voxelOffset(x1, y1, z1) * sx;
+            d[0] = base;         d[1] = base + sx;
+            d[2] = base + sy;    d[3] = base + sy + sx;
+            d[4] = base + sz;    d[5] = base + sz + sx;
+            d[6] = base + sz + sy; d[7] = base + sz + sy + sx;
+            return true;
+        }
+
+        bool nonEmpty = false;
+        for (int k=0; k<8; ++k) {
+            const int x = x1 + (k & 1), y = y1 + ((k >> 1) & 1),
+                      z = z1 + ((k >> 2) & 1);
+            const float *brick = lookupBrick(x, y, z);
+            if (brick) {
+                d[k] = brick + voxelOffset(x, y, z) * m_channels;
+                nonEmpty = true;
+            } else {
+                d[k] = m_zero;
+            }
+        }
+        return nonEmpty;
+    }
+
+protected:
+    fs::path m_filename;
+    ref<MemoryMappedFile> m_mmap;
+    const uint32_t *m_root;
+    const uint32_t *m_tiles;
+    const float *m_tileBounds;
+    const float *m_brickBounds;
+    const float *m_bricks;
+    uint32_t m_tileCount, m_brickCount;
+    Vector3i m_res, m_tileRes;
+    int m_channels;
+    Float m_maxValue;
+    Transform m_worldToGrid;
+    Transform m_worldToVolume;
+    Transform m_volumeToWorld;
+    Float m_stepSize;
+    AABB m_dataAABB;
+    static const float m_zero[3];
+};
+
+const float SparseGridDataSource::m_zero[3] = { 0.0f, 0.0f, 0.0f };
+
+MTS_IMPLEMENT_CLASS_S(SparseGridDataSource, false, VolumeDataSource);
+MTS_EXPORT_PLUGIN(SparseGridDataSource, "Sparse grid data source");
+MTS_NAMESPACE_END
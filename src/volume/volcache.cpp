@@ -21,6 +21,9 @@
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/sched.h>
 #include <mitsuba/core/lrucache.h>
+#include <mitsuba/core/atomic.h>
+#include <boost/scoped_array.hpp>
+#include <atomic>
 #include <fstream>
 
 MTS_NAMESPACE_BEGIN
@@ -29,6 +32,7 @@ static StatsCounter statsHitRate("Volume cache", "Cache hit rate", EPercentage);
 static StatsCounter statsCreate("Volume cache", "Block creations");
 static StatsCounter statsDestruct("Volume cache", "Block destructions");
 static StatsCounter statsEmpty("Volume cache", "Empty blocks", EPercentage);
+static StatsCounter statsSharedRetries("Volume cache", "Shared cache read retries");
 
 /* Lexicographic ordering for Vector3i */
 struct Vector3iKeyOrder : public std::binary_function<Vector3i, Vector3i, bool> {
@@ -57,6 +61,11 @@ struct Vector3iKeyOrder : public std::binary_function<Vector3i, Vector3i, bool>
  *     \parameter{memoryLimit}{\Integer}{
  *         Maximum allowed memory usage in MiB. \default{1024, i.e. 1 GiB}
  *     }
+ *     \parameter{sharedCache}{\Boolean}{
+ *         Share one cache between all rendering threads instead of
+ *         giving each thread its own part of the memory limit?
+ *         \default{\code{false}}
+ *     }
  *     \parameter{toWorld}{\Transform}{
  *         Optional linear transformation that should be applied
  *         to the volume data
@@ -76,6 +85,16 @@ struct Vector3iKeyOrder : public std::binary_function<Vector3i, Vector3i, bool>
  * These are kept in memory until a user-specifiable threshold is exeeded,
  * after which point a \emph{least recently used} (LRU) policy removes
  * records that haven't been accessed in a long time.
+ *
+ * By default, every rendering thread has its own cache, which receives
+ * an equal part of \code{memoryLimit}. With many threads, the caches
+ * then end up small and each thread rasterizes the same blocks again.
+ * When \code{sharedCache} is enabled, all threads use a single
+ * set-associative cache of the full size. Blocks are looked up without
+ * locking (readers validate a per-block version counter) and a block that
+ * is missing is rasterized while holding one of several locks that each
+ * protect a part of the cache. Eviction uses the second chance (clock)
+ * policy within a set of blocks.
  */
 class CachingDataSource : public VolumeDataSource {
 public:
@@ -99,20 +118,38 @@ public:
         m_stepSizeMultiplier = (Float) props.getFloat("stepSizeMultiplier", 1.0f);
 
         m_volumeToWorld = props.getTransform("toWorld", Transform());
+
+        /* Share a single cache between all threads? */
+        m_sharedCache = props.getBoolean("sharedCache", false);
+        m_sharedSets = 0;
     }
 
     CachingDataSource(Stream *stream, InstanceManager *manager)
     : VolumeDataSource(stream, manager) {
         m_nested = static_cast<VolumeDataSource *>(manager->getInstance(stream));
+        m_blockSize = stream->readInt();
+        m_voxelWidth = stream->readFloat();
+        m_memoryLimit = stream->readSize();
+        m_stepSizeMultiplier = stream->readFloat();
+        m_volumeToWorld = Transform(stream);
+        m_sharedCache = stream->readBool();
         configure();
     }
 
     virtual ~CachingDataSource() {
+        for (size_t i=0; i<m_sharedSets * ESharedWays; ++i)
+            delete[] m_sharedBlocks[i].data;
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
         VolumeDataSource::serialize(stream, manager);
         manager->serialize(stream, m_nested.get());
+        stream->writeInt(m_blockSize);
+        stream->writeFloat(m_voxelWidth);
+        stream->writeSize(m_memoryLimit);
+        stream->writeFloat(m_stepSizeMultiplier);
+        m_volumeToWorld.serialize(stream);
+        stream->writeBool(m_sharedCache);
     }
 
     void configure() {
@@ -125,8 +162,8 @@ public:
         if (m_voxelWidth == -1)
             m_voxelWidth = m_nested->getStepSize();
 
-        size_t memoryLimitPerCore = m_memoryLimit
-            / std::max((size_t) 1, Scheduler::getInstance()->getLocalWorkerCount());
+        size_t memoryLimitPerCore = m_sharedCache ? m_memoryLimit : (m_memoryLimit
+            / std::max((size_t) 1, Scheduler::getInstance()->getLocalWorkerCount()));
 
         Vector totalCells  = m_aabb.getExtents() / m_voxelWidth;
         for (int i=0; i<3; ++i)
@@ -152,13 +189,41 @@ public:
         m_blockMask = ~(m_blockSize-1);
         m_blockShift = math::log2i((uint32_t) m_blockSize);
 
+        m_sharedSets = 0;
+        if (m_sharedCache) {
+            /* Largest power of two number of sets that fits in the memory limit */
+            size_t sets = std::max((size_t) 1, m_blocksPerCore / ESharedWays);
+            m_sharedSets = 1;
+            while (2 * m_sharedSets <= sets)
+                m_sharedSets *= 2;
+
+            m_sharedBlocks.reset(new SharedBlock[m_sharedSets * ESharedWays]);
+            for (size_t i=0; i<m_sharedSets * ESharedWays; ++i) {
+                SharedBlock &block = m_sharedBlocks[i];
+                block.version = 0;
+                block.key = -1;
+                block.referenced = false;
+                block.empty = true;
+                block.data = NULL;
+            }
+            m_sharedClock.reset(new uint8_t[m_sharedSets]);
+            memset(m_sharedClock.get(), 0, m_sharedSets);
+            m_sharedLocks.resize(ESharedLocks);
+            for (int i=0; i<ESharedLocks; ++i)
+                m_sharedLocks[i] = new Mutex();
+        }
+
         Log(EInfo, "Volume cache configuration");
         Log(EInfo, "   Block size in voxels      = %i", m_blockSize);
         Log(EInfo, "   Voxel width               = %f", m_voxelWidth);
         Log(EInfo, "   Memory usage of one block = %s", memString(blockMemoryUsage).c_str());
         Log(EInfo, "   Memory limit              = %s", memString(m_memoryLimit).c_str());
         Log(EInfo, "   Memory limit per core     = %s", memString(memoryLimitPerCore).c_str());
-        Log(EInfo, "   Max. blocks per core      = %i", m_blocksPerCore);
+        if (m_sharedCache)
+            Log(EInfo, "   Shared cache              = %i sets of %i blocks",
+                (int) m_sharedSets, (int) ESharedWays);
+        else
+            Log(EInfo, "   Max. blocks per core      = %i", m_blocksPerCore);
         Log(EInfo, "   Effective resolution      = %s", totalCells.toString().c_str());
         Log(EInfo, "   Effective storage         = %s", memString((size_t)
             (totalCells[0]*totalCells[1]*totalCells[2]*sizeof(float)*m_channels)).c_str());
@@ -174,6 +239,14 @@ public:
             z < 0 || z >= m_cellCount.z))
             return 0.0f;
 
+        const Vector3i blockIdx(
+            (x & m_blockMask) >> m_blockShift,
+            (y & m_blockMask) >> m_blockShift,
+            (z & m_blockMask) >> m_blockShift);
+
+        if (m_sharedCache)
+            return lookupShared(blockIdx, p, x, y, z);
+
         BlockCache *cache = m_cache.get();
         if (EXPECT_NOT_TAKEN(cache == NULL)) {
             cache = new BlockCache(m_blocksPerCore,
@@ -211,10 +284,7 @@ public:
 #endif
 
         bool hit = false;
-        float *blockData = cache->get(Vector3i(
-            (x & m_blockMask) >> m_blockShift,
-            (y & m_blockMask) >> m_blockShift,
-            (z & m_blockMask) >> m_blockShift), hit);
+        float *blockData = cache->get(blockIdx, hit);
 
         statsHitRate.incrementBase();
         if (hit)
@@ -223,6 +293,81 @@ public:
         if (blockData == NULL)
             return 0.0f;
 
+        return interpolate(blockData, p, x, y, z);
+    }
+
+    /// Look up a voxel in the shared cache (see the plugin description)
+    Float lookupShared(const Vector3i &blockIdx, const Point &p,
+            int x, int y, int z) const {
+        const int64_t key = blockIdx.x + ((int64_t) blockIdx.y << 21)
+            + ((int64_t) blockIdx.z << 42);
+        const size_t set = (size_t) (((uint64_t) key
+            * 0x9E3779B97F4A7C15ULL) >> 32) & (m_sharedSets - 1);
+        SharedBlock *blocks = &m_sharedBlocks[set * ESharedWays];
+
+        statsHitRate.incrementBase();
+
+        /* Optimistic lookup without locking. A block that is being
+           rewritten has an odd version; a version that changed while
+           interpolating means that the block was evicted meanwhile */
+        for (int i=0; i<ESharedWays; ++i) {
+            SharedBlock &block = blocks[i];
+            const int32_t version = block.version;
+            if ((version & 1) || block.key != key)
+                continue;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            Float result = block.empty ? 0.0f : interpolate(block.data, p, x, y, z);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (EXPECT_NOT_TAKEN(block.version != version)) {
+                ++statsSharedRetries;
+                break;
+            }
+            if (!block.referenced)
+                block.referenced = true;
+            ++statsHitRate;
+            return result;
+        }
+
+        /* Search again while holding the lock of this set: another
+           thread may have rasterized the block in the meantime */
+        LockGuard lock(m_sharedLocks[set % ESharedLocks]);
+        for (int i=0; i<ESharedWays; ++i) {
+            SharedBlock &block = blocks[i];
+            if (block.key == key) {
+                block.referenced = true;
+                return block.empty ? 0.0f : interpolate(block.data, p, x, y, z);
+            }
+        }
+
+        /* Second chance eviction: advance the clock hand of the set until
+           it reaches a block that was not referenced since the last pass */
+        uint8_t &hand = m_sharedClock[set];
+        SharedBlock *victim = NULL;
+        while (victim == NULL) {
+            SharedBlock &block = blocks[hand];
+            hand = (uint8_t) ((hand + 1) % ESharedWays);
+            if (block.key == -1 || !block.referenced)
+                victim = &block;
+            else
+                block.referenced = false;
+        }
+        if (victim->key != -1)
+            ++statsDestruct;
+
+        atomicAdd(&victim->version, 1);
+        victim->key = key;
+        if (!victim->data)
+            victim->data = new float[m_blockRes*m_blockRes*m_blockRes];
+        victim->empty = !rasterizeBlock(blockIdx, victim->data);
+        victim->referenced = true;
+        atomicAdd(&victim->version, 1);
+
+        return victim->empty ? 0.0f : interpolate(victim->data, p, x, y, z);
+    }
+
+    /// Trilinearly interpolate within a cache block
+    inline Float interpolate(const float *blockData, const Point &p,
+            int x, int y, int z) const {
         const int x1 = x & m_voxelMask, y1 = y & m_voxelMask, z1 = z & m_voxelMask,
                 x2 = x1 + 1, y2 = y1 + 1, z2 = z1 + 1;
 
@@ -282,6 +427,17 @@ public:
 
     float *renderBlock(const Vector3i &blockIdx) const {
         float *result = new float[m_blockRes*m_blockRes*m_blockRes];
+
+        if (rasterizeBlock(blockIdx, result)) {
+            return result;
+        } else {
+            delete[] result;
+            return NULL;
+        }
+    }
+
+    /// Rasterize a block of the nested volume, returns false if it is empty
+    bool rasterizeBlock(const Vector3i &blockIdx, float *result) const {
         Point offset = m_aabb.min + Vector(
             blockIdx.x * m_blockSize * m_voxelWidth,
             blockIdx.y * m_blockSize * m_voxelWidth,
@@ -303,13 +459,9 @@ public:
         ++statsCreate;
         statsEmpty.incrementBase();
 
-        if (nonempty) {
-            return result;
-        } else {
+        if (!nonempty)
             ++statsEmpty;
-            delete[] result;
-            return NULL;
-        }
+        return nonempty;
     }
 
     void destroyBlock(float *ptr) const {
@@ -323,6 +475,26 @@ public:
 
     MTS_DECLARE_CLASS()
 protected:
+    enum {
+        /// Number of blocks in one set of the shared cache
+        ESharedWays = 4,
+        /// Number of locks that protect the sets of the shared cache
+        ESharedLocks = 64
+    };
+
+    /// Block of the shared cache
+    struct SharedBlock {
+        /// Incremented before and after rewriting the block (odd while busy)
+        volatile int32_t version;
+        /// Packed block index, or -1 if the block is unused
+        volatile int64_t key;
+        /// Was the block referenced since the last pass of the clock hand?
+        volatile bool referenced;
+        /// Is the block empty? Then \c data is not used.
+        bool empty;
+        float *data;
+    };
+
     ref<VolumeDataSource> m_nested;
     Transform m_volumeToWorld;
     Transform m_worldToVolume;
@@ -336,6 +508,11 @@ protected:
     int m_blockMask, m_voxelMask, m_blockShift;
     Vector3i m_cellCount;
     mutable ThreadLocal<BlockCache> m_cache;
+    bool m_sharedCache;
+    size_t m_sharedSets;
+    boost::scoped_array<SharedBlock> m_sharedBlocks;
+    boost::scoped_array<uint8_t> m_sharedClock;
+    mutable std::vector<ref<Mutex> > m_sharedLocks;
 };
 
 MTS_IMPLEMENT_CLASS_S(CachingDataSource, false, VolumeDataSource);